@@ -40,11 +40,25 @@ namespace OrthancDatabases
     {
     }
 
+    // Takes the content of "content" without copying it (the
+    // argument receives the previous content of this value)
+    void Swap(std::string& content)
+    {
+      content_.swap(content);
+    }
+
     const std::string& GetContent() const
     {
       return content_;
     }
 
+    // Reuses the memory that is already allocated by this value
+    void Assign(const void* content,
+                size_t size)
+    {
+      content_.assign(reinterpret_cast<const char*>(content), size);
+    }
+
     const void* GetBuffer() const
     {
       return (content_.empty() ? NULL : content_.c_str());
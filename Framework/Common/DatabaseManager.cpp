@@ -30,17 +30,24 @@
 #include <Compatibility.h>  // For std::unique_ptr<>
 #include <Logging.h>
 #include <OrthancException.h>
+#include <Toolbox.h>
 
+#include <boost/lexical_cast.hpp>
 #include <boost/thread.hpp>
 
 namespace OrthancDatabases
 {
+  static boost::mutex  transactionSequenceMutex_;
+  static uint64_t      lastTransactionSequence_ = 0;
+
+
   void DatabaseManager::Close()
   {
     LOG(TRACE) << "Closing the connection to the database";
 
     // Rollback active transaction, if any
     transaction_.reset(NULL);
+    ClearCommitActions();
 
     // Delete all the cached statements (must occur before closing
     // the database)
@@ -49,9 +56,16 @@ namespace OrthancDatabases
     {
       assert(it->second != NULL);
       delete it->second;
+      RetireStatistics(it->first);
     }
 
     cachedStatements_.clear();
+    pinnedStatements_.clear();
+
+    while (!cachedStatementsIndex_.IsEmpty())
+    {
+      cachedStatementsIndex_.RemoveOldest();
+    }
 
     // Close the database
     database_.reset(NULL);
@@ -69,6 +83,7 @@ namespace OrthancDatabases
       )
     {
       transaction_.reset(NULL);
+      ClearCommitActions();
     }
 
     if (e == Orthanc::ErrorCode_DatabaseUnavailable)
@@ -79,7 +94,7 @@ namespace OrthancDatabases
   }
 
 
-  IPrecompiledStatement* DatabaseManager::LookupCachedStatement(const StatementId& statementId) const
+  IPrecompiledStatement* DatabaseManager::LookupCachedStatement(const StatementId& statementId)
   {
     CachedStatements::const_iterator found = cachedStatements_.find(statementId);
 
@@ -90,6 +105,9 @@ namespace OrthancDatabases
     else
     {
       assert(found->second != NULL);
+      cachedStatementsIndex_.MakeMostRecent(statementId);
+      pinnedStatements_[statementId] += 1;
+      statistics_[statementId].AddHit();
       return found->second;
     }
   }
@@ -99,7 +117,14 @@ namespace OrthancDatabases
                                                          const Query& query)
   {
     LOG(TRACE) << "Caching statement from " << statementId.GetFile() << ":" << statementId.GetLine() << "" << statementId.GetDynamicStatement();
-      
+
+    if (maxCachedStatements_ != 0)
+    {
+      // Make room for the new statement
+      EvictCachedStatements(maxCachedStatements_ - 1);
+    }
+
+    Orthanc::Toolbox::ElapsedTimer timer;
     std::unique_ptr<IPrecompiledStatement> statement(GetDatabase().Compile(query));
       
     IPrecompiledStatement* tmp = statement.get();
@@ -108,12 +133,213 @@ namespace OrthancDatabases
       throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
     }
 
+    statistics_[statementId].AddMiss(timer.GetElapsedMicroseconds());
+
     assert(cachedStatements_.find(statementId) == cachedStatements_.end());
     cachedStatements_[statementId] = statement.release();
+    cachedStatementsIndex_.Add(statementId);
+    pinnedStatements_[statementId] += 1;
 
     return *tmp;
   }
 
+
+  void DatabaseManager::UnpinCachedStatement(const StatementId& statementId)
+  {
+    PinnedStatements::iterator found = pinnedStatements_.find(statementId);
+
+    // The statement might have been removed if the connection was closed in between
+    if (found != pinnedStatements_.end())
+    {
+      assert(found->second > 0);
+      found->second--;
+
+      if (found->second == 0)
+      {
+        pinnedStatements_.erase(found);
+      }
+    }
+  }
+
+
+  void DatabaseManager::EvictCachedStatements(size_t maxSize)
+  {
+    /**
+     * The statements that are still in use by some "CachedStatement"
+     * cannot be deleted, as their "IResult" might refer to them: Move
+     * them to the front of the LRU index. As a consequence, the size
+     * of the cache can temporarily exceed its limit if many
+     * statements are simultaneously in use.
+     **/
+    assert(cachedStatements_.size() >= pinnedStatements_.size());
+    size_t countUnpinned = cachedStatements_.size() - pinnedStatements_.size();
+
+    while (cachedStatements_.size() > maxSize &&
+           countUnpinned > 0)
+    {
+      const StatementId oldest = cachedStatementsIndex_.GetOldest();
+
+      if (pinnedStatements_.find(oldest) != pinnedStatements_.end())
+      {
+        cachedStatementsIndex_.MakeMostRecent(oldest);
+      }
+      else
+      {
+        CachedStatements::iterator found = cachedStatements_.find(oldest);
+        assert(found != cachedStatements_.end() &&
+               found->second != NULL);
+
+        LOG(TRACE) << "Evicting cached statement from " << oldest.GetFile() << ":" << oldest.GetLine() << " " << oldest.GetDynamicStatement();
+
+        delete found->second;
+        cachedStatements_.erase(found);
+        cachedStatementsIndex_.RemoveOldest();
+        RetireStatistics(oldest);
+        countUnpinned--;
+      }
+    }
+  }
+
+
+  void DatabaseManager::RetireStatistics(const StatementId& statementId)
+  {
+    if (!statementId.GetDynamicStatement().empty())
+    {
+      StatementsStatistics::iterator found = statistics_.find(statementId);
+
+      if (found != statistics_.end())
+      {
+        evictedStatistics_.Merge(found->second);
+        statistics_.erase(found);
+      }
+    }
+  }
+
+
+  void DatabaseManager::WarmupStatements()
+  {
+    assert(statementsWarmup_ != NULL);
+
+    std::vector<StatementsWarmup::Statement> statements;
+    statementsWarmup_->ListHottest(statements);
+
+    if (statements.empty())
+    {
+      return;
+    }
+
+    Orthanc::Toolbox::ElapsedTimer timer;
+    size_t count = 0;
+
+    for (size_t i = 0; i < statements.size(); i++)
+    {
+      const StatementId& statementId = statements[i].first;
+      assert(statements[i].second.get() != NULL);
+
+      if ((maxCachedStatements_ != 0 && cachedStatements_.size() >= maxCachedStatements_) ||
+          cachedStatements_.find(statementId) != cachedStatements_.end())
+      {
+        continue;
+      }
+
+      try
+      {
+        IPrecompiledStatement& statement = CacheStatement(statementId, *statements[i].second);
+        UnpinCachedStatement(statementId);
+        statement.Warmup();
+        count++;
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        // The statement will be compiled again on its first use
+        LOG(INFO) << "Cannot precompile the statement from " << statementId.GetFile() << ":"
+                  << statementId.GetLine() << ": " << e.What();
+
+        if (e.GetErrorCode() == Orthanc::ErrorCode_DatabaseUnavailable)
+        {
+          break;
+        }
+      }
+    }
+
+    LOG(INFO) << "Precompiled " << count << " statement(s) on a new connection to the database in "
+              << (timer.GetElapsedMicroseconds() / 1000) << " ms";
+  }
+
+
+  void DatabaseManager::AddStatementExecution(const StatementId& statementId,
+                                              uint64_t executeTime)
+  {
+    statistics_[statementId].AddExecution(executeTime);
+  }
+
+
+  void DatabaseManager::CheckSlowStatement(const std::string& sql,
+                                           const Dictionary& parameters,
+                                           uint64_t executeTime)
+  {
+    if (slowStatementThreshold_ != 0 &&
+        executeTime >= slowStatementThreshold_)
+    {
+      std::string s;
+      parameters.Format(s);
+
+      LOG(WARNING) << "Slow SQL statement (" << (executeTime / 1000) << "ms): " << sql
+                   << (s.empty() ? "" : " -- Parameters: ") << s;
+
+      if (slowStatementListener_ != NULL)
+      {
+        slowStatementListener_->SignalSlowStatement(sql, parameters, executeTime);
+      }
+    }
+  }
+
+
+  static DatabaseManager::IStatementsTracer* statementsTracer_ = NULL;
+
+
+  void DatabaseManager::SetStatementsTracer(IStatementsTracer* tracer)
+  {
+    statementsTracer_ = tracer;
+  }
+
+
+  void DatabaseManager::TraceStatement(const StatementId* statementId,
+                                       uint64_t executeTime,
+                                       bool success)
+  {
+    if (statementsTracer_ != NULL)
+    {
+      if (statementId == NULL)
+      {
+        statementsTracer_->TraceStatement("standalone", executeTime, success);
+      }
+      else
+      {
+        statementsTracer_->TraceStatement(std::string(statementId->GetFile()) + ":" +
+                                          boost::lexical_cast<std::string>(statementId->GetLine()),
+                                          executeTime, success);
+      }
+    }
+  }
+
+
+  void DatabaseManager::SetSlowStatementThreshold(unsigned int milliseconds)
+  {
+    slowStatementThreshold_ = static_cast<uint64_t>(milliseconds) * 1000;
+  }
+
+
+  void DatabaseManager::SetMaxCachedStatements(size_t count)
+  {
+    maxCachedStatements_ = count;
+
+    if (count != 0)
+    {
+      EvictCachedStatements(count);
+    }
+  }
+
     
   ITransaction& DatabaseManager::GetTransaction()
   {
@@ -123,7 +349,7 @@ namespace OrthancDatabases
 
       try
       {
-        transaction_.reset(GetDatabase().CreateTransaction(TransactionType_Implicit));
+        SetTransaction(GetDatabase().CreateTransaction(TransactionType_Implicit), false);
       }
       catch (Orthanc::OrthancException& e)
       {
@@ -137,6 +363,101 @@ namespace OrthancDatabases
   }
 
 
+  void DatabaseManager::SetTransaction(ITransaction* transaction,
+                                       bool readWrite)
+  {
+    std::unique_ptr<ITransaction> protection(transaction);
+
+    if (transaction == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+    }
+
+    {
+      boost::mutex::scoped_lock lock(transactionSequenceMutex_);
+      lastTransactionSequence_++;
+      transactionSequence_ = lastTransactionSequence_;
+    }
+
+    transaction_.reset(protection.release());
+    readWriteTransaction_ = readWrite;
+  }
+
+
+  void DatabaseManager::ExecuteCommitActions()
+  {
+    while (!commitActions_.empty())
+    {
+      std::unique_ptr<ICommitAction> action(commitActions_.front());
+      commitActions_.pop_front();
+
+      try
+      {
+        action->Execute();
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        // The transaction is already committed, don't report the error to the caller
+        LOG(ERROR) << "Error in an action after a commit: " << e.What();
+      }
+    }
+  }
+
+
+  void DatabaseManager::ClearCommitActions()
+  {
+    for (std::list<ICommitAction*>::iterator it = commitActions_.begin();
+         it != commitActions_.end(); ++it)
+    {
+      assert(*it != NULL);
+      delete *it;
+    }
+
+    commitActions_.clear();
+  }
+
+
+  void DatabaseManager::AddCommitAction(ICommitAction* action)
+  {
+    std::unique_ptr<ICommitAction> protection(action);
+
+    if (action == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+    }
+    else if (transaction_.get() == NULL ||
+             transaction_->IsImplicit())
+    {
+      protection->Execute();
+    }
+    else
+    {
+      commitActions_.push_back(protection.release());
+    }
+  }
+
+
+  uint64_t DatabaseManager::GetTransactionSequence() const
+  {
+    if (transaction_.get() == NULL)
+    {
+      // The next statement will create an implicit transaction
+      return GetLastTransactionSequence() + 1;
+    }
+    else
+    {
+      return transactionSequence_;
+    }
+  }
+
+
+  uint64_t DatabaseManager::GetLastTransactionSequence()
+  {
+    boost::mutex::scoped_lock lock(transactionSequenceMutex_);
+    return lastTransactionSequence_;
+  }
+
+
   void DatabaseManager::ReleaseImplicitTransaction()
   {
     if (transaction_.get() != NULL &&
@@ -160,7 +481,13 @@ namespace OrthancDatabases
     
   DatabaseManager::DatabaseManager(IDatabaseFactory* factory) :
     factory_(factory),
-    dialect_(Dialect_Unknown)
+    maxCachedStatements_(0),
+    dialect_(Dialect_Unknown),
+    readWriteTransaction_(false),
+    slowStatementThreshold_(0),
+    slowStatementListener_(NULL),
+    statementsWarmup_(NULL),
+    transactionSequence_(0)
   {
     if (factory == NULL)
     {
@@ -187,6 +514,11 @@ namespace OrthancDatabases
       {
         throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
       }
+
+      if (statementsWarmup_ != NULL)
+      {
+        WarmupStatements();
+      }
     }
 
     return *database_;
@@ -217,7 +549,7 @@ namespace OrthancDatabases
         throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);
       }
 
-      transaction_.reset(GetDatabase().CreateTransaction(type));
+      SetTransaction(GetDatabase().CreateTransaction(type), (type == TransactionType_ReadWrite));
     }
     catch (Orthanc::OrthancException& e)
     {
@@ -243,9 +575,12 @@ namespace OrthancDatabases
       }
       catch (Orthanc::OrthancException& e)
       {
+        ClearCommitActions();
         CloseIfUnavailable(e.GetErrorCode());
         throw;
       }
+
+      ExecuteCommitActions();
     }
   }
 
@@ -259,6 +594,8 @@ namespace OrthancDatabases
     }
     else
     {
+      ClearCommitActions();
+
       try
       {
         transaction_->Rollback();
@@ -394,6 +731,24 @@ namespace OrthancDatabases
   }
 
 
+  void DatabaseManager::StatementBase::SetStreaming(bool streaming)
+  {
+    if (query_.get() != NULL)
+    {
+      query_->SetStreaming(streaming);
+    }
+  }
+
+
+  void DatabaseManager::StatementBase::SetPlanCacheMode(PlanCacheMode mode)
+  {
+    if (query_.get() != NULL)
+    {
+      query_->SetPlanCacheMode(mode);
+    }
+  }
+
+
   void DatabaseManager::StatementBase::SetParameterType(const std::string& parameter,
                                                         ValueType type)
   {
@@ -490,7 +845,8 @@ namespace OrthancDatabases
       switch (value.GetType())
       {
         case ValueType_Integer64:
-          return dynamic_cast<const Integer64Value&>(value).GetValue();
+          // The type is already checked, no need for "dynamic_cast<>" in this hot path
+          return static_cast<const Integer64Value&>(value).GetValue();
 
         default:
           // LOG(ERROR) << value.GetType();
@@ -502,22 +858,15 @@ namespace OrthancDatabases
 
   int32_t DatabaseManager::StatementBase::ReadInteger32(size_t field) const
   {
-    if (IsDone())
+    int64_t value = ReadInteger64(field);
+
+    if (value != static_cast<int64_t>(static_cast<int32_t>(value)))
     {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Integer overflow");
     }
     else
     {
-      int64_t value = ReadInteger64(field);
-
-      if (value != static_cast<int64_t>(static_cast<int32_t>(value)))
-      {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Integer overflow");
-      }
-      else
-      {
-        return static_cast<int32_t>(value);
-      }
+      return static_cast<int32_t>(value);
     }
   }
 
@@ -534,16 +883,21 @@ namespace OrthancDatabases
   }
 
   std::string DatabaseManager::StatementBase::ReadString(size_t field) const
+  {
+    return ReadStringReference(field);
+  }
+
+  const std::string& DatabaseManager::StatementBase::ReadStringReference(size_t field) const
   {
     const IValue& value = GetResultField(field);
 
     switch (value.GetType())
     {
       case ValueType_BinaryString:
-        return dynamic_cast<const BinaryStringValue&>(value).GetContent();
+        return static_cast<const BinaryStringValue&>(value).GetContent();
 
       case ValueType_Utf8String:
-        return dynamic_cast<const Utf8StringValue&>(value).GetContent();
+        return static_cast<const Utf8StringValue&>(value).GetContent();
 
       default:
         throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "The returned field is not of the correct type (String)");
@@ -568,22 +922,51 @@ namespace OrthancDatabases
       LOG(TRACE) << "Reusing cached statement from "
                  << statementId_.GetFile() << ":" << statementId_.GetLine() << " " << statementId_.GetDynamicStatement();
     }
+
+    if (manager.IsSlowStatementsLogEnabled())
+    {
+      sql_ = sql;
+    }
   }
 
-  void DatabaseManager::CachedStatement::ExecuteInternal(const Dictionary& parameters, bool withResults)
+
+  DatabaseManager::CachedStatement::~CachedStatement()
   {
-    try
+    if (statement_ != NULL)
     {
-      std::unique_ptr<Query> query(ReleaseQuery());
+      GetManager().UnpinCachedStatement(statementId_);
+    }
+  }
+
+
+  IPrecompiledStatement& DatabaseManager::CachedStatement::Prepare()
+  {
+    std::unique_ptr<Query> query(ReleaseQuery());
       
-      if (query.get() != NULL)
+    if (query.get() != NULL)
+    {
+      // Register the newly-created statement
+      assert(statement_ == NULL);
+      statement_ = &GetManager().CacheStatement(statementId_, *query);
+
+      if (GetManager().statementsWarmup_ != NULL)
       {
-        // Register the newly-created statement
-        assert(statement_ == NULL);
-        statement_ = &GetManager().CacheStatement(statementId_, *query);
+        GetManager().statementsWarmup_->Register(statementId_, *query);
       }
+    }
         
-      assert(statement_ != NULL);
+    assert(statement_ != NULL);
+    return *statement_;
+  }
+
+
+  void DatabaseManager::CachedStatement::ExecuteInternal(const Dictionary& parameters, bool withResults)
+  {
+    Orthanc::Toolbox::ElapsedTimer timer;
+
+    try
+    {
+      Prepare();
 
       /*
         TODO - Sample code to monitor the execution time of each
@@ -596,6 +979,8 @@ namespace OrthancDatabases
         #endif
       */
 
+      timer.Restart();
+
       if (withResults)
       {
         SetResult(GetTransaction().Execute(*statement_, parameters));
@@ -604,9 +989,19 @@ namespace OrthancDatabases
       {
         GetTransaction().ExecuteWithoutResult(*statement_, parameters);
       }
+
+      const uint64_t executeTime = timer.GetElapsedMicroseconds();
+      GetManager().AddStatementExecution(statementId_, executeTime);
+      TraceStatement(&statementId_, executeTime, true);
+
+      if (!sql_.empty())
+      {
+        GetManager().CheckSlowStatement(sql_, parameters, executeTime);
+      }
     }
     catch (Orthanc::OrthancException& e)
     {
+      TraceStatement(&statementId_, timer.GetElapsedMicroseconds(), false);
       GetManager().CloseIfUnavailable(e.GetErrorCode());
       throw;
     }
@@ -623,12 +1018,41 @@ namespace OrthancDatabases
     ExecuteInternal(parameters, false);
   }
 
+
+  void DatabaseManager::CachedStatement::ExecuteBatchWithoutResult(const std::vector<const Dictionary*>& parameters)
+  {
+    Orthanc::Toolbox::ElapsedTimer timer;
+
+    try
+    {
+      IPrecompiledStatement& statement = Prepare();
+
+      timer.Restart();
+      GetTransaction().ExecuteBatchWithoutResult(statement, parameters);
+
+      const uint64_t executeTime = timer.GetElapsedMicroseconds();
+      GetManager().AddStatementExecution(statementId_, executeTime);
+      TraceStatement(&statementId_, executeTime, true);
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      TraceStatement(&statementId_, timer.GetElapsedMicroseconds(), false);
+      GetManager().CloseIfUnavailable(e.GetErrorCode());
+      throw;
+    }
+  }
+
   
   DatabaseManager::StandaloneStatement::StandaloneStatement(DatabaseManager& manager,
                                                             const std::string& sql) :
     StatementBase(manager)
   {
     SetQuery(new Query(sql));
+
+    if (manager.IsSlowStatementsLogEnabled())
+    {
+      sql_ = sql;
+    }
   }
 
       
@@ -652,6 +1076,8 @@ namespace OrthancDatabases
 
   void DatabaseManager::StandaloneStatement::ExecuteInternal(const Dictionary& parameters, bool withResults)
   {
+    Orthanc::Toolbox::ElapsedTimer timer;
+
     try
     {
       std::unique_ptr<Query> query(ReleaseQuery());
@@ -663,8 +1089,17 @@ namespace OrthancDatabases
       statement_.reset(GetManager().GetDatabase().Compile(*query));
       assert(statement_.get() != NULL);
 
+      timer.Restart();
       std::unique_ptr<IResult> result(GetTransaction().Execute(*statement_, parameters));
 
+      const uint64_t executeTime = timer.GetElapsedMicroseconds();
+      TraceStatement(NULL, executeTime, true);
+
+      if (!sql_.empty())
+      {
+        GetManager().CheckSlowStatement(sql_, parameters, executeTime);
+      }
+
       if (withResults)
       {
         SetResult(result.release());
@@ -672,6 +1107,7 @@ namespace OrthancDatabases
     }
     catch (Orthanc::OrthancException& e)
     {
+      TraceStatement(NULL, timer.GetElapsedMicroseconds(), false);
       GetManager().CloseIfUnavailable(e.GetErrorCode());
       throw;
     }
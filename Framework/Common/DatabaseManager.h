@@ -25,11 +25,17 @@
 
 #include "IDatabaseFactory.h"
 #include "StatementId.h"
+#include "StatementsWarmup.h"
 
+#include <Cache/LeastRecentlyUsedIndex.h>
 #include <Compatibility.h>  // For std::unique_ptr<>
 #include <Enumerations.h>
 
+#include <boost/unordered_map.hpp>
+#include <list>
+#include <map>
 #include <memory>
+#include <stdint.h>
 
 
 namespace OrthancDatabases
@@ -45,29 +51,221 @@ namespace OrthancDatabases
    * "DatabaseManager" takes a "IDatabaseFactory" as input, in order
    * to be able to automatically re-open the database connection if
    * the latter gets lost.
+   *
+   * The number of precompiled statements that are kept by one
+   * connection can be bounded by "SetMaxCachedStatements()". In such
+   * a case, the least recently used statements are evicted first,
+   * except if they are still in use by some "CachedStatement".
    **/
   class DatabaseManager : public boost::noncopyable
   {
+  public:
+    /**
+     * Counters about the use of one cached statement. The times are
+     * expressed in microseconds. These counters are kept even if the
+     * statement gets evicted from the cache, except for the dynamic
+     * statements (whose SQL is generated, hence possibly unique): The
+     * counters of an evicted dynamic statement are added to those of
+     * "GetEvictedStatementsStatistics()", so that they don't grow the
+     * map of the statistics without bound.
+     **/
+    class StatementStatistics
+    {
+    private:
+      uint64_t  hits_;
+      uint64_t  misses_;
+      uint64_t  prepareTime_;
+      uint64_t  executions_;
+      uint64_t  executeTime_;
+
+    public:
+      StatementStatistics() :
+        hits_(0),
+        misses_(0),
+        prepareTime_(0),
+        executions_(0),
+        executeTime_(0)
+      {
+      }
+
+      void AddHit()
+      {
+        hits_++;
+      }
+
+      void AddMiss(uint64_t prepareTime)
+      {
+        misses_++;
+        prepareTime_ += prepareTime;
+      }
+
+      void AddExecution(uint64_t executeTime)
+      {
+        executions_++;
+        executeTime_ += executeTime;
+      }
+
+      void Merge(const StatementStatistics& other)
+      {
+        hits_ += other.hits_;
+        misses_ += other.misses_;
+        prepareTime_ += other.prepareTime_;
+        executions_ += other.executions_;
+        executeTime_ += other.executeTime_;
+      }
+
+      uint64_t GetHits() const
+      {
+        return hits_;
+      }
+
+      uint64_t GetMisses() const
+      {
+        return misses_;
+      }
+
+      uint64_t GetPrepareTime() const
+      {
+        return prepareTime_;
+      }
+
+      uint64_t GetExecutions() const
+      {
+        return executions_;
+      }
+
+      uint64_t GetExecuteTime() const
+      {
+        return executeTime_;
+      }
+    };
+
+    typedef std::map<StatementId, StatementStatistics>  StatementsStatistics;
+
+    /**
+     * Receives the statements whose execution took longer than the
+     * threshold set by "SetSlowStatementThreshold()". The listener
+     * can be shared by several connections, and is invoked from the
+     * thread that executed the statement: It must be thread-safe and
+     * must return quickly.
+     **/
+    class ISlowStatementListener : public boost::noncopyable
+    {
+    public:
+      virtual ~ISlowStatementListener()
+      {
+      }
+
+      virtual void SignalSlowStatement(const std::string& sql,
+                                       const Dictionary& parameters,
+                                       uint64_t executeTime /* in microseconds */) = 0;
+    };
+
+    /**
+     * Receives all the executions of the statements of all the
+     * managers of the process (cf. "SetStatementsTracer()"), from the
+     * thread that executed the statement. It must be thread-safe and
+     * must return quickly.
+     **/
+    class IStatementsTracer : public boost::noncopyable
+    {
+    public:
+      virtual ~IStatementsTracer()
+      {
+      }
+
+      // "statement" identifies the statement in the source code (e.g. "IndexBackend.cpp:123")
+      virtual void TraceStatement(const std::string& statement,
+                                  uint64_t executeTime /* in microseconds */,
+                                  bool success) = 0;
+    };
+
+    /**
+     * Action that is executed once the active transaction of the
+     * manager has been successfully committed, and that is dropped if
+     * the transaction is rolled back (cf. "AddCommitAction()"). This
+     * is typically used to invalidate the in-process caches, that
+     * must not forget about the modifications before the other
+     * connections can see them.
+     **/
+    class ICommitAction : public boost::noncopyable
+    {
+    public:
+      virtual ~ICommitAction()
+      {
+      }
+
+      virtual void Execute() = 0;
+    };
+
   private:
-    typedef std::map<StatementId, IPrecompiledStatement*>  CachedStatements;
+    typedef boost::unordered_map<StatementId, IPrecompiledStatement*>  CachedStatements;
+    typedef boost::unordered_map<StatementId, unsigned int>            PinnedStatements;
 
     std::unique_ptr<IDatabaseFactory>  factory_;
     std::unique_ptr<IDatabase>     database_;
     std::unique_ptr<ITransaction>  transaction_;
     CachedStatements               cachedStatements_;
+    Orthanc::LeastRecentlyUsedIndex<StatementId>  cachedStatementsIndex_;
+    PinnedStatements               pinnedStatements_;
+    size_t                         maxCachedStatements_;
+    StatementsStatistics           statistics_;
+    StatementStatistics            evictedStatistics_;
     Dialect                        dialect_;
+    bool                           readWriteTransaction_;
+    uint64_t                       slowStatementThreshold_;  // In microseconds, "0" if disabled
+    ISlowStatementListener*        slowStatementListener_;   // Not owned, can be NULL
+    StatementsWarmup*              statementsWarmup_;        // Not owned, can be NULL
+    std::list<ICommitAction*>      commitActions_;
+    uint64_t                       transactionSequence_;
 
     void CloseIfUnavailable(Orthanc::ErrorCode e);
 
-    IPrecompiledStatement* LookupCachedStatement(const StatementId& statementId) const;
+    // Both "LookupCachedStatement()" (if it succeeds) and
+    // "CacheStatement()" pin the statement, that must be released
+    // by "UnpinCachedStatement()"
+    IPrecompiledStatement* LookupCachedStatement(const StatementId& statementId);
 
     IPrecompiledStatement& CacheStatement(const StatementId& statementId,
                                           const Query& query);
 
+    void UnpinCachedStatement(const StatementId& statementId);
+
+    void EvictCachedStatements(size_t maxSize);
+
+    // Moves the counters of a dynamic statement that is not cached anymore
+    void RetireStatistics(const StatementId& statementId);
+
+    // Precompiles the hot statements on a newly opened connection
+    void WarmupStatements();
+
+    void AddStatementExecution(const StatementId& statementId,
+                               uint64_t executeTime);
+
+    bool IsSlowStatementsLogEnabled() const
+    {
+      return slowStatementThreshold_ != 0;
+    }
+
+    void CheckSlowStatement(const std::string& sql,
+                            const Dictionary& parameters,
+                            uint64_t executeTime);
+
+    static void TraceStatement(const StatementId* statementId /* NULL for a standalone statement */,
+                               uint64_t executeTime,
+                               bool success);
+
     ITransaction& GetTransaction();
 
     void ReleaseImplicitTransaction();
 
+    void SetTransaction(ITransaction* transaction,
+                        bool readWrite);
+
+    void ExecuteCommitActions();
+
+    void ClearCommitActions();
+
   public:
     explicit DatabaseManager(IDatabaseFactory* factory);  // Takes ownership
     
@@ -88,6 +286,78 @@ namespace OrthancDatabases
     
     void RollbackTransaction();
 
+    // Whether an explicit read-write transaction is active, in which
+    // case the changes are not visible yet to the other connections
+    bool IsReadWriteTransaction() const
+    {
+      return (transaction_.get() != NULL &&
+              readWriteTransaction_);
+    }
+
+    /**
+     * Registers an action to be executed after the commit of the
+     * active explicit transaction. If there is no such transaction,
+     * the action is executed immediately. Takes ownership.
+     **/
+    void AddCommitAction(ICommitAction* action);
+
+    /**
+     * Sequence number of the active transaction (including the
+     * implicit transactions), that increases with the start of the
+     * transactions of all the managers of the process. A transaction
+     * whose sequence is less than or equal to the value returned by
+     * "GetLastTransactionSequence()" at some point in time, was
+     * started before this point in time.
+     **/
+    uint64_t GetTransactionSequence() const;
+
+    static uint64_t GetLastTransactionSequence();
+
+    // "0" means that the number of cached statements is not bounded
+    void SetMaxCachedStatements(size_t count);
+
+    size_t GetMaxCachedStatements() const
+    {
+      return maxCachedStatements_;
+    }
+
+    size_t GetCachedStatementsCount() const
+    {
+      return cachedStatements_.size();
+    }
+
+    const StatementsStatistics& GetStatementsStatistics() const
+    {
+      return statistics_;
+    }
+
+    // Sum of the counters of the dynamic statements that were evicted
+    const StatementStatistics& GetEvictedStatementsStatistics() const
+    {
+      return evictedStatistics_;
+    }
+
+    // Log a warning with the SQL and the parameters of the statements
+    // that take longer than this delay ("0" means no warning)
+    void SetSlowStatementThreshold(unsigned int milliseconds);
+
+    // The listener is not owned, and must outlive the manager
+    void SetSlowStatementListener(ISlowStatementListener* listener)
+    {
+      slowStatementListener_ = listener;
+    }
+
+    // The tracer is not owned, and is shared by all the managers. It
+    // must be set before the statements are executed, "NULL" to disable.
+    static void SetStatementsTracer(IStatementsTracer* tracer);
+
+    // The warmup is not owned, and must outlive the manager. It can
+    // be shared by several connections.
+    void SetStatementsWarmup(StatementsWarmup* warmup)
+    {
+      statementsWarmup_ = warmup;
+    }
+
 
     // This class is only used in the "StorageBackend" and in
     // "IDatabaseBackend::ConfigureDatabase()"
@@ -160,7 +430,7 @@ namespace OrthancDatabases
 
       virtual ~StatementBase();
 
-      // Used only by SQLite
+      // Used only by SQLite and MySQL
       IDatabase& GetDatabase()
       {
         return manager_.GetDatabase();
@@ -168,6 +438,10 @@ namespace OrthancDatabases
 
       void SetReadOnly(bool readOnly);
 
+      void SetStreaming(bool streaming);
+
+      void SetPlanCacheMode(PlanCacheMode mode);
+
       void SetParameterType(const std::string& parameter,
                             ValueType type);
       
@@ -188,6 +462,10 @@ namespace OrthancDatabases
 
       std::string ReadString(size_t field) const;
 
+      // Same as "ReadString()", without copying the string. The
+      // reference is invalidated by the next call to "Next()".
+      const std::string& ReadStringReference(size_t field) const;
+
       bool IsNull(size_t field) const;
 
       void PrintResult(std::ostream& stream)
@@ -211,12 +489,15 @@ namespace OrthancDatabases
     private:
       StatementId             statementId_;
       IPrecompiledStatement*  statement_;
+      std::string             sql_;  // Only kept if the slow statements are logged
 
     public:
       CachedStatement(const StatementId& statementId,
                       DatabaseManager& manager,
                       const std::string& sql);
 
+      virtual ~CachedStatement();
+
       void Execute()
       {
         Dictionary parameters;
@@ -233,8 +514,13 @@ namespace OrthancDatabases
 
       void ExecuteWithoutResult(const Dictionary& parameters);
 
+      // Executes the statement once for each set of parameters
+      void ExecuteBatchWithoutResult(const std::vector<const Dictionary*>& parameters);
+
     private:
       void ExecuteInternal(const Dictionary& parameters, bool withResults);
+
+      IPrecompiledStatement& Prepare();
     };
 
 
@@ -242,6 +528,7 @@ namespace OrthancDatabases
     {
     private:
       std::unique_ptr<IPrecompiledStatement>  statement_;
+      std::string                             sql_;  // Only kept if the slow statements are logged
       
     public:
       StandaloneStatement(DatabaseManager& manager,
@@ -53,5 +53,12 @@ namespace OrthancDatabases
     TransactionType_Implicit   // Should only arise with Orthanc SDK <= 1.9.1
   };
 
+  enum PlanCacheMode
+  {
+    PlanCacheMode_Auto,          // Choice of the database (PostgreSQL: generic plan after 5 executions)
+    PlanCacheMode_ForceCustom,   // Planned at each execution, with the values of the parameters
+    PlanCacheMode_Adaptive       // "Auto", switching to "ForceCustom" if the latency diverges
+  };
+
   const char* EnumerationToString(ValueType type);
 }
@@ -33,38 +33,147 @@
 #include <Logging.h>
 #include <OrthancException.h>
 
+#include <boost/lexical_cast.hpp>
+#include <algorithm>
 #include <cassert>
 
 namespace OrthancDatabases
 {
+  void Dictionary::Slot::Clear()
+  {
+    if (value_ != NULL)
+    {
+      delete value_;
+      value_ = NULL;
+    }
+  }
+
+
+  void Dictionary::Slot::SetValue(IValue* value)
+  {
+    assert(value != NULL);
+    Clear();
+    value_ = value;
+  }
+
+
+  void Dictionary::Slot::SetInteger64(int64_t value)
+  {
+    Clear();
+    integer_.SetValue(value);
+  }
+
+
+  const IValue& Dictionary::Slot::GetValue() const
+  {
+    if (value_ == NULL)
+    {
+      return integer_;
+    }
+    else
+    {
+      return *value_;
+    }
+  }
+
+
+  void Dictionary::Slot::Swap(Slot& other)
+  {
+    key_.swap(other.key_);
+    std::swap(value_, other.value_);
+
+    const int64_t tmp = integer_.GetValue();
+    integer_.SetValue(other.integer_.GetValue());
+    other.integer_.SetValue(tmp);
+  }
+
+
+  Dictionary::Slot* Dictionary::LookupSlot(const std::string& key)
+  {
+    for (size_t i = 0; i < slotsCount_; i++)
+    {
+      if (slots_[i].GetKey() == key)
+      {
+        return &slots_[i];
+      }
+    }
+
+    return NULL;
+  }
+
+
+  const Dictionary::Slot* Dictionary::LookupSlot(const std::string& key) const
+  {
+    return const_cast<Dictionary&>(*this).LookupSlot(key);
+  }
+
+
+  Dictionary::Slot* Dictionary::AddSlot(const std::string& key)
+  {
+    if (slotsCount_ < SLOTS_COUNT &&
+        overflow_.find(key) == overflow_.end())
+    {
+      Slot& slot = slots_[slotsCount_];
+      slotsCount_++;
+
+      slot.SetKey(key);
+      return &slot;
+    }
+    else
+    {
+      return NULL;
+    }
+  }
+
+
   void Dictionary::Clear()
   {
-    for (Values::iterator it = values_.begin(); 
-         it != values_.end(); ++it)
+    for (size_t i = 0; i < slotsCount_; i++)
+    {
+      slots_[i].Clear();
+    }
+
+    slotsCount_ = 0;
+
+    for (Values::iterator it = overflow_.begin(); 
+         it != overflow_.end(); ++it)
     {
       assert(it->second != NULL);
       delete it->second;
     }
 
-    values_.clear();
+    overflow_.clear();
   }
   
 
   bool Dictionary::HasKey(const std::string& key) const
   {
-    return values_.find(key) != values_.end();
+    return (LookupSlot(key) != NULL ||
+            overflow_.find(key) != overflow_.end());
   }
 
 
   void Dictionary::Remove(const std::string& key)
   {
-    Values::iterator found = values_.find(key);
+    Slot* slot = LookupSlot(key);
 
-    if (found != values_.end())
+    if (slot != NULL)
+    {
+      // Move the last slot in place of the removed one
+      assert(slotsCount_ > 0);
+      slot->Swap(slots_[slotsCount_ - 1]);
+      slots_[slotsCount_ - 1].Clear();
+      slotsCount_--;
+      return;
+    }
+
+    Values::iterator found = overflow_.find(key);
+
+    if (found != overflow_.end())
     {
       assert(found->second != NULL);
       delete found->second;
-      values_.erase(found);
+      overflow_.erase(found);
     }
   }
 
@@ -77,11 +186,23 @@ namespace OrthancDatabases
       throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
     }
 
-    Values::iterator found = values_.find(key);
+    Slot* slot = LookupSlot(key);
+    if (slot == NULL)
+    {
+      slot = AddSlot(key);
+    }
 
-    if (found == values_.end())
+    if (slot != NULL)
     {
-      values_[key] = value;
+      slot->SetValue(value);
+      return;
+    }
+
+    Values::iterator found = overflow_.find(key);
+
+    if (found == overflow_.end())
+    {
+      overflow_[key] = value;
     }
     else
     {
@@ -124,7 +245,20 @@ namespace OrthancDatabases
   void Dictionary::SetIntegerValue(const std::string& key,
                                    int64_t value)
   {
-    SetValue(key, new Integer64Value(value));
+    Slot* slot = LookupSlot(key);
+    if (slot == NULL)
+    {
+      slot = AddSlot(key);
+    }
+
+    if (slot == NULL)
+    {
+      SetValue(key, new Integer64Value(value));
+    }
+    else
+    {
+      slot->SetInteger64(value);
+    }
   }
 
 
@@ -142,9 +276,15 @@ namespace OrthancDatabases
   
   const IValue& Dictionary::GetValue(const std::string& key) const
   {
-    Values::const_iterator found = values_.find(key);
+    const Slot* slot = LookupSlot(key);
+    if (slot != NULL)
+    {
+      return slot->GetValue();
+    }
+
+    Values::const_iterator found = overflow_.find(key);
 
-    if (found == values_.end())
+    if (found == overflow_.end())
     {
       LOG(ERROR) << "Inexistent value in a dictionary: " << key;
       throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem);
@@ -155,4 +295,121 @@ namespace OrthancDatabases
       return *found->second;
     }
   }
+
+
+  void Dictionary::ListKeys(std::list<std::string>& target) const
+  {
+    target.clear();
+
+    for (size_t i = 0; i < slotsCount_; i++)
+    {
+      target.push_back(slots_[i].GetKey());
+    }
+
+    for (Values::const_iterator it = overflow_.begin(); it != overflow_.end(); ++it)
+    {
+      target.push_back(it->first);
+    }
+
+    // Same order as if all the values were stored in a "std::map"
+    target.sort();
+  }
+
+
+  void Dictionary::Copy(Dictionary& target) const
+  {
+    target.Clear();
+
+    std::list<std::string> keys;
+    ListKeys(keys);
+
+    for (std::list<std::string>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+    {
+      const IValue& value = GetValue(*it);
+
+      switch (value.GetType())
+      {
+        case ValueType_Integer64:
+          target.SetIntegerValue(*it, dynamic_cast<const Integer64Value&>(value).GetValue());
+          break;
+
+        case ValueType_Integer32:
+          target.SetInteger32Value(*it, dynamic_cast<const Integer32Value&>(value).GetValue());
+          break;
+
+        case ValueType_Utf8String:
+          target.SetUtf8Value(*it, dynamic_cast<const Utf8StringValue&>(value).GetContent());
+          break;
+
+        case ValueType_BinaryString:
+          target.SetBinaryValue(*it, dynamic_cast<const BinaryStringValue&>(value).GetContent());
+          break;
+
+        case ValueType_InputFile:
+          target.SetFileValue(*it, dynamic_cast<const InputFileValue&>(value).GetContent());
+          break;
+
+        case ValueType_Null:
+          target.SetNullValue(*it);
+          break;
+
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+      }
+    }
+  }
+
+
+  void Dictionary::Format(std::string& target) const
+  {
+    target.clear();
+
+    std::list<std::string> keys;
+    ListKeys(keys);
+
+    for (std::list<std::string>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+    {
+      const IValue& value = GetValue(*it);
+
+      if (!target.empty())
+      {
+        target += ", ";
+      }
+
+      target += "${" + *it + "}=";
+
+      switch (value.GetType())
+      {
+        case ValueType_Integer64:
+          target += boost::lexical_cast<std::string>(dynamic_cast<const Integer64Value&>(value).GetValue());
+          break;
+
+        case ValueType_Integer32:
+          target += boost::lexical_cast<std::string>(dynamic_cast<const Integer32Value&>(value).GetValue());
+          break;
+
+        case ValueType_Utf8String:
+          target += "\"" + dynamic_cast<const Utf8StringValue&>(value).GetContent() + "\"";
+          break;
+
+        case ValueType_BinaryString:
+          target += "(binary, " + boost::lexical_cast<std::string>(
+            dynamic_cast<const BinaryStringValue&>(value).GetSize()) + " bytes)";
+          break;
+
+        case ValueType_InputFile:
+          target += "(file, " + boost::lexical_cast<std::string>(
+            dynamic_cast<const InputFileValue&>(value).GetSize()) + " bytes)";
+          break;
+
+        case ValueType_Null:
+          target += "NULL";
+          break;
+
+        default:
+          target += "(unknown)";
+          break;
+      }
+    }
+  }
 }
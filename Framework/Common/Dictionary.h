@@ -23,21 +23,82 @@
 
 #pragma once
 
-#include "IValue.h"
+#include "Integer64Value.h"
 
+#include <list>
 #include <map>
 #include <stdint.h>
 
 namespace OrthancDatabases
 {
+  /**
+   * The first values of the dictionary are stored inline, which
+   * covers the arguments of almost all the SQL statements. The 64-bit
+   * integers that are stored inline are not allocated on the heap.
+   **/
   class Dictionary : public boost::noncopyable
   {
   private:
+    class Slot : public boost::noncopyable
+    {
+    private:
+      std::string     key_;
+      IValue*         value_;     // NULL iff the inline integer is used
+      Integer64Value  integer_;
+
+    public:
+      Slot() :
+        value_(NULL),
+        integer_(0)
+      {
+      }
+
+      ~Slot()
+      {
+        Clear();
+      }
+
+      const std::string& GetKey() const
+      {
+        return key_;
+      }
+
+      void SetKey(const std::string& key)
+      {
+        key_ = key;
+      }
+
+      void Clear();
+
+      void SetValue(IValue* value);   // Takes ownership
+
+      void SetInteger64(int64_t value);
+
+      const IValue& GetValue() const;
+
+      void Swap(Slot& other);
+    };
+
     typedef std::map<std::string, IValue*>   Values;
 
-    Values  values_;
+    static const size_t SLOTS_COUNT = 8;
+
+    Slot    slots_[SLOTS_COUNT];
+    size_t  slotsCount_;
+    Values  overflow_;   // Values that don't fit in the slots
+
+    Slot* LookupSlot(const std::string& key);
+
+    const Slot* LookupSlot(const std::string& key) const;
+
+    Slot* AddSlot(const std::string& key);
 
   public:
+    Dictionary() :
+      slotsCount_(0)
+    {
+    }
+
     ~Dictionary()
     {
       Clear();
@@ -74,5 +135,13 @@ namespace OrthancDatabases
     void SetNullValue(const std::string& key);
 
     const IValue& GetValue(const std::string& key) const;
+
+    void ListKeys(std::list<std::string>& target) const;
+
+    // Deep copy of the values of the dictionary into "target"
+    void Copy(Dictionary& target) const;
+
+    // Human-readable dump of the values, for the logs
+    void Format(std::string& target) const;
   };
 }
@@ -41,5 +41,12 @@ namespace OrthancDatabases
     virtual IPrecompiledStatement* Compile(const Query& query) = 0;
 
     virtual ITransaction* CreateTransaction(TransactionType type) = 0;
+
+    // Whether "ITransaction::ExecuteBatchWithoutResult()" executes
+    // all the sets of parameters in one round-trip
+    virtual bool HasBatchExecution() const
+    {
+      return false;
+    }
   };
 }
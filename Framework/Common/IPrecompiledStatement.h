@@ -33,5 +33,11 @@ namespace OrthancDatabases
     virtual ~IPrecompiledStatement()
     {
     }
+
+    // Sends the statement to the database server ahead of its first
+    // execution, if the engine prepares the statements lazily
+    virtual void Warmup()
+    {
+    }
   };
 }
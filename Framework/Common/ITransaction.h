@@ -27,6 +27,8 @@
 #include "IPrecompiledStatement.h"
 #include "IResult.h"
 
+#include <vector>
+
 namespace OrthancDatabases
 {
   class ITransaction : public boost::noncopyable
@@ -48,6 +50,21 @@ namespace OrthancDatabases
     virtual void ExecuteWithoutResult(IPrecompiledStatement& statement,
                                       const Dictionary& parameters) = 0;
 
+    /**
+     * Executes the statement once for each set of parameters. By
+     * default, this is one round-trip per set, but the drivers that
+     * support arrays of parameters (cf. "IDatabase::HasBatchExecution()")
+     * send all the sets at once.
+     **/
+    virtual void ExecuteBatchWithoutResult(IPrecompiledStatement& statement,
+                                           const std::vector<const Dictionary*>& parameters)
+    {
+      for (size_t i = 0; i < parameters.size(); i++)
+      {
+        ExecuteWithoutResult(statement, *parameters[i]);
+      }
+    }
+
     virtual bool DoesTableExist(const std::string& name) = 0;
 
     virtual bool DoesIndexExist(const std::string& name) = 0;
@@ -47,6 +47,11 @@ namespace OrthancDatabases
       return value_;
     }
 
+    void SetValue(int64_t value)
+    {
+      value_ = value;
+    }
+
     virtual ValueType GetType() const ORTHANC_OVERRIDE
     {
       return ValueType_Integer64;
@@ -23,75 +23,61 @@
 
 #include "Query.h"
 
+#include <Compatibility.h>  // For std::unique_ptr<>
 #include <Logging.h>
 #include <OrthancException.h>
 
-#include <boost/regex.hpp>
+#include <cassert>
+#include <memory>
 
 namespace OrthancDatabases
 {
-  class Query::Token : public boost::noncopyable
-  {
-  private:
-    bool         isParameter_;
-    std::string  content_;
-
-  public:
-    Token(bool isParameter,
-          const std::string& content) :
-      isParameter_(isParameter),
-      content_(content)
-    {
-    }
-
-    bool IsParameter() const
-    {
-      return isParameter_;
-    }
-
-    const std::string& GetContent() const
-    {
-      return content_;
-    }
-  };
-
-
   void Query::Setup(const std::string& sql)
   {
-    boost::regex regex("\\$\\{(.*?)\\}");
-
-    std::string::const_iterator last = sql.begin();
-    boost::sregex_token_iterator it(sql.begin(), sql.end(), regex, 0);
-    boost::sregex_token_iterator end;
-
-    while (it != end)
+    /**
+     * Hand-written equivalent of the "\$\{(.*?)\}" regular
+     * expression, as queries are parsed each time a dynamic or a
+     * standalone statement is created.
+     **/
+    size_t last = 0;
+
+    for (;;)
     {
-      if (last != it->first)
+      const size_t start = sql.find("${", last);
+      if (start == std::string::npos)
       {
-        tokens_.push_back(new Token(false, std::string(last, it->first)));
+        break;
       }
 
-      std::string parameter = *it;
-      assert(parameter.size() >= 3);
-      parameter = parameter.substr(2, parameter.size() - 3);
+      const size_t end = sql.find('}', start + 2);
+      if (end == std::string::npos)
+      {
+        break;
+      }
 
-      tokens_.push_back(new Token(true, parameter));
-      parameters_[parameter] = ValueType_Utf8String;
+      if (last != start)
+      {
+        tokens_.push_back(Token(false, sql.substr(last, start - last)));
+      }
 
-      last = it->second;
+      const std::string parameter = sql.substr(start + 2, end - start - 2);
+      tokens_.push_back(Token(true, parameter));
+      parameters_[parameter] = ValueType_Utf8String;
 
-      ++it;
+      last = end + 1;
     }
 
-    if (last != sql.end())
+    if (last != sql.size())
     {
-      tokens_.push_back(new Token(false, std::string(last, sql.end())));
+      tokens_.push_back(Token(false, sql.substr(last)));
     }
   }
 
 
   Query::Query(const std::string& sql) :
-    readOnly_(false)
+    readOnly_(false),
+    streaming_(false),
+    planCacheMode_(PlanCacheMode_Auto)
   {
     Setup(sql);
   }
@@ -99,7 +85,9 @@ namespace OrthancDatabases
 
   Query::Query(const std::string& sql,
                bool readOnly) :
-    readOnly_(readOnly)
+    readOnly_(readOnly),
+    streaming_(false),
+    planCacheMode_(PlanCacheMode_Auto)
   {
     Setup(sql);
   }
@@ -107,11 +95,17 @@ namespace OrthancDatabases
   
   Query::~Query()
   {
-    for (size_t i = 0; i < tokens_.size(); i++)
-    {
-      assert(tokens_[i] != NULL);
-      delete tokens_[i];
-    }
+  }
+
+
+  Query* Query::Clone() const
+  {
+    std::unique_ptr<Query> clone(new Query("", readOnly_));
+    clone->tokens_ = tokens_;
+    clone->parameters_ = parameters_;
+    clone->streaming_ = streaming_;
+    clone->planCacheMode_ = planCacheMode_;
+    return clone.release();
   }
 
 
@@ -161,11 +155,9 @@ namespace OrthancDatabases
 
     for (size_t i = 0; i < tokens_.size(); i++)
     {
-      assert(tokens_[i] != NULL);
-
-      const std::string& content = tokens_[i]->GetContent();
+      const std::string& content = tokens_[i].GetContent();
 
-      if (tokens_[i]->IsParameter())
+      if (tokens_[i].IsParameter())
       {
         std::string parameter;
         formatter.Format(parameter, content, GetType(content));
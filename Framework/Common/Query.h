@@ -51,11 +51,36 @@ namespace OrthancDatabases
   private:
     typedef std::map<std::string, ValueType>  Parameters;
 
-    class Token;
+    class Token
+    {
+    private:
+      bool         isParameter_;
+      std::string  content_;
 
-    std::vector<Token*>  tokens_;
+    public:
+      Token(bool isParameter,
+            const std::string& content) :
+        isParameter_(isParameter),
+        content_(content)
+      {
+      }
+
+      bool IsParameter() const
+      {
+        return isParameter_;
+      }
+
+      const std::string& GetContent() const
+      {
+        return content_;
+      }
+    };
+
+    std::vector<Token>   tokens_;
     Parameters           parameters_;
     bool                 readOnly_;
+    bool                 streaming_;
+    PlanCacheMode        planCacheMode_;
 
     void Setup(const std::string& sql);
 
@@ -67,6 +92,9 @@ namespace OrthancDatabases
 
     ~Query();
 
+    // Deep copy of the query, including the types of its parameters
+    Query* Clone() const;
+
     bool IsReadOnly() const
     {
       return readOnly_;
@@ -77,6 +105,40 @@ namespace OrthancDatabases
       readOnly_ = isReadOnly;
     }
 
+    bool IsStreaming() const
+    {
+      return streaming_;
+    }
+
+    /**
+     * Hint telling that the rows of the result can be fetched
+     * incrementally, instead of being fully loaded in memory once
+     * the statement is executed. Only taken into account by
+     * PostgreSQL and MySQL. While such a result is not fully read, no
+     * other statement can be executed on the same connection.
+     **/
+    void SetStreaming(bool streaming)
+    {
+      streaming_ = streaming;
+    }
+
+    PlanCacheMode GetPlanCacheMode() const
+    {
+      return planCacheMode_;
+    }
+
+    /**
+     * Hint telling how the plan of a precompiled statement is reused
+     * between its executions, which matters for the statements whose
+     * best plan depends on the values of their parameters (e.g. the
+     * lookups on tags with skewed values). Only taken into account by
+     * PostgreSQL.
+     **/
+    void SetPlanCacheMode(PlanCacheMode mode)
+    {
+      planCacheMode_ = mode;
+    }
+
     bool HasParameter(const std::string& parameter) const;
 
     ValueType GetType(const std::string& parameter) const;
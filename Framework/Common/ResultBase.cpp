@@ -46,6 +46,90 @@ namespace OrthancDatabases
         delete fields_[i];
         fields_[i] = NULL;
       }
+
+      if (recycled_[i] != NULL)
+      {
+        delete recycled_[i];
+        recycled_[i] = NULL;
+      }
+    }
+  }
+
+
+  IValue* ResultBase::TakeRecycled(size_t index,
+                                   ValueType type)
+  {
+    if (index < recycled_.size() &&
+        recycled_[index] != NULL &&
+        recycled_[index]->GetType() == type)
+    {
+      IValue* value = recycled_[index];
+      recycled_[index] = NULL;
+      return value;
+    }
+    else
+    {
+      return NULL;
+    }
+  }
+
+
+  IValue* ResultBase::RecycleNull(size_t index)
+  {
+    IValue* value = TakeRecycled(index, ValueType_Null);
+    return (value == NULL ? new NullValue : value);
+  }
+
+
+  IValue* ResultBase::RecycleInteger64(size_t index,
+                                       int64_t value)
+  {
+    Integer64Value* recycled = dynamic_cast<Integer64Value*>(TakeRecycled(index, ValueType_Integer64));
+
+    if (recycled == NULL)
+    {
+      return new Integer64Value(value);
+    }
+    else
+    {
+      recycled->SetValue(value);
+      return recycled;
+    }
+  }
+
+
+  IValue* ResultBase::RecycleUtf8String(size_t index,
+                                        const char* value,
+                                        size_t size)
+  {
+    Utf8StringValue* recycled = dynamic_cast<Utf8StringValue*>(TakeRecycled(index, ValueType_Utf8String));
+
+    if (recycled == NULL)
+    {
+      return new Utf8StringValue(std::string(value, size));
+    }
+    else
+    {
+      recycled->Assign(value, size);
+      return recycled;
+    }
+  }
+
+
+  IValue* ResultBase::RecycleBinaryString(size_t index,
+                                          const void* value,
+                                          size_t size)
+  {
+    BinaryStringValue* recycled = dynamic_cast<BinaryStringValue*>(TakeRecycled(index, ValueType_BinaryString));
+
+    if (recycled == NULL)
+    {
+      return new BinaryStringValue(std::string(reinterpret_cast<const char*>(value), size));
+    }
+    else
+    {
+      recycled->Assign(value, size);
+      return recycled;
     }
   }
 
@@ -84,7 +168,17 @@ namespace OrthancDatabases
 
   void ResultBase::FetchFields()
   {
-    ClearFields();
+    // The values of the current row become available to "RecycleXXX()"
+    for (size_t i = 0; i < fields_.size(); i++)
+    {
+      if (recycled_[i] != NULL)
+      {
+        delete recycled_[i];
+      }
+
+      recycled_[i] = fields_[i];
+      fields_[i] = NULL;
+    }
 
     if (!IsDone())
     {
@@ -112,6 +206,7 @@ namespace OrthancDatabases
     }
     
     fields_.resize(count);
+    recycled_.resize(count, NULL);
     expectedType_.resize(count, ValueType_Null);
     hasExpectedType_.resize(count, false);
   }
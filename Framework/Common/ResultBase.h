@@ -39,12 +39,35 @@ namespace OrthancDatabases
     void ConvertFields();
 
     std::vector<IValue*>   fields_;
+    std::vector<IValue*>   recycled_;  // Values of the previous row
     std::vector<ValueType> expectedType_;
     std::vector<bool>      hasExpectedType_;
+
+    IValue* TakeRecycled(size_t index,
+                         ValueType type);
     
   protected:
     virtual IValue* FetchField(size_t index) = 0;
 
+    /**
+     * The following methods can be used by "FetchField()" to avoid
+     * one allocation per cell: They reuse the value that was read
+     * from the same column in the previous row, if it has the same
+     * type.
+     **/
+    IValue* RecycleNull(size_t index);
+
+    IValue* RecycleInteger64(size_t index,
+                             int64_t value);
+
+    IValue* RecycleUtf8String(size_t index,
+                              const char* value,
+                              size_t size);
+
+    IValue* RecycleBinaryString(size_t index,
+                                const void* value,
+                                size_t size);
+
     void FetchFields();
 
     void SetFieldsCount(size_t count);
@@ -28,10 +28,87 @@
 
 #include <OrthancException.h>
 
+#include <algorithm>
 #include <boost/lexical_cast.hpp>
+#include <string.h>
 
 namespace OrthancDatabases
 {
+  void ResultFileValue::ReadWhole(IBufferAllocator& allocator) const
+  {
+    std::string content;
+    ReadWhole(content);
+
+    void* target = allocator.Allocate(content.size());
+
+    if (!content.empty())
+    {
+      if (target == NULL)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+      }
+
+      memcpy(target, content.c_str(), content.size());
+    }
+  }
+
+
+  void ResultFileValue::ReadRange(void* target,
+                                  uint64_t start,
+                                  size_t length) const
+  {
+    std::string content;
+    ReadRange(content, start, length);
+
+    if (content.size() != length)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+    else if (length > 0)
+    {
+      if (target == NULL)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+      }
+
+      memcpy(target, content.c_str(), length);
+    }
+  }
+
+
+  void ResultFileValue::ReadRange(IChunkVisitor& visitor,
+                                  uint64_t start,
+                                  size_t length,
+                                  size_t chunkSize) const
+  {
+    std::string content;
+    ReadRange(content, start, length);
+    VisitChunks(visitor, content.empty() ? NULL : content.c_str(), content.size(), chunkSize);
+  }
+
+
+  void ResultFileValue::VisitChunks(IChunkVisitor& visitor,
+                                    const void* data,
+                                    size_t size,
+                                    size_t chunkSize)
+  {
+    if (chunkSize == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    const uint8_t* position = reinterpret_cast<const uint8_t*>(data);
+
+    while (size > 0)
+    {
+      const size_t chunk = std::min(size, chunkSize);
+      visitor.VisitChunk(position, chunk);
+      position += chunk;
+      size -= chunk;
+    }
+  }
+
+
   IValue* ResultFileValue::Convert(ValueType target) const
   {
     switch (target)
@@ -38,11 +38,70 @@ namespace OrthancDatabases
   class ResultFileValue : public IValue
   {
   public:
+    /**
+     * Interface to let the caller provide the memory buffer that
+     * receives the whole content of the file, once its size is known.
+     * This avoids an intermediate copy of large files.
+     **/
+    class IBufferAllocator : public boost::noncopyable
+    {
+    public:
+      virtual ~IBufferAllocator()
+      {
+      }
+
+      // The returned buffer must contain at least "size" bytes (it
+      // can be NULL if "size" is zero)
+      virtual void* Allocate(size_t size) = 0;
+    };
+
+    /**
+     * Interface to receive the content of a file as a sequence of
+     * chunks. The memory of a chunk is only valid during the call.
+     **/
+    class IChunkVisitor : public boost::noncopyable
+    {
+    public:
+      virtual ~IChunkVisitor()
+      {
+      }
+
+      virtual void VisitChunk(const void* data,
+                              size_t size) = 0;
+    };
+
     virtual void ReadWhole(std::string& target) const = 0;
     
     virtual void ReadRange(std::string& target,
                            uint64_t start,
                            size_t length) const = 0;
+
+    /**
+     * Zero-copy versions of "ReadWhole()" and "ReadRange()". The
+     * default implementations go through a temporary string, and
+     * should be overridden by the database backends that can write
+     * directly into the target buffer.
+     **/
+    virtual void ReadWhole(IBufferAllocator& allocator) const;
+
+    virtual void ReadRange(void* target,
+                           uint64_t start,
+                           size_t length) const;
+
+    /**
+     * Streams a range of the file by chunks of at most "chunkSize"
+     * bytes, so that the whole range never has to be held in memory.
+     * The default implementation reads the whole range at once.
+     **/
+    virtual void ReadRange(IChunkVisitor& visitor,
+                           uint64_t start,
+                           size_t length,
+                           size_t chunkSize) const;
+
+    static void VisitChunks(IChunkVisitor& visitor,
+                            const void* data,
+                            size_t size,
+                            size_t chunkSize);
     
     virtual ValueType GetType() const ORTHANC_OVERRIDE
     {
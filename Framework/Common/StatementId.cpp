@@ -24,23 +24,84 @@
 #include "StatementId.h"
 
 #include <string.h>
-#include <Toolbox.h>
 
 namespace OrthancDatabases
 {
+  static void UpdateHash(uint64_t& hash,
+                         const char* data,
+                         size_t size)
+  {
+    // 64-bit FNV-1a hash
+    for (size_t i = 0; i < size; i++)
+    {
+      hash ^= static_cast<uint8_t>(data[i]);
+      hash *= static_cast<uint64_t>(1099511628211ULL);
+    }
+  }
+
+
+  void StatementId::ComputeHash()
+  {
+    hash_ = static_cast<uint64_t>(14695981039346656037ULL);
+
+    UpdateHash(hash_, file_, strlen(file_));
+    UpdateHash(hash_, reinterpret_cast<const char*>(&line_), sizeof(line_));
+
+    if (!statement_.empty())
+    {
+      UpdateHash(hash_, statement_.c_str(), statement_.size());
+    }
+  }
+
+
   bool StatementId::operator< (const StatementId& other) const
   {
-    return hash_ < other.hash_;
+    /**
+     * The hashes are compared first, which almost always decides. The
+     * full comparison only happens on hash collisions, or if both
+     * identifiers are equal.
+     **/
+    if (hash_ != other.hash_)
+    {
+      return hash_ < other.hash_;
+    }
+    else if (line_ != other.line_)
+    {
+      return line_ < other.line_;
+    }
+    else
+    {
+      int c = strcmp(file_, other.file_);
+      if (c != 0)
+      {
+        return c < 0;
+      }
+      else
+      {
+        return statement_ < other.statement_;
+      }
+    }
+  }
+
+
+  bool StatementId::operator== (const StatementId& other) const
+  {
+    return (hash_ == other.hash_ &&
+            line_ == other.line_ &&
+            strcmp(file_, other.file_) == 0 &&
+            statement_ == other.statement_);
   }
 
+
   StatementId::StatementId(const char* file,
                            int line) :
       file_(file),
       line_(line)
   {
-    Orthanc::Toolbox::ComputeMD5(hash_, file_ + boost::lexical_cast<std::string>(line_));
+    ComputeHash();
   }
 
+
   StatementId::StatementId(const char* file,
                            int line,
                            const std::string& statement) :
@@ -48,7 +109,6 @@ namespace OrthancDatabases
       line_(line),
       statement_(statement)
   {
-    Orthanc::Toolbox::ComputeMD5(hash_, file_ + boost::lexical_cast<std::string>(line_) + statement_);
+    ComputeHash();
   }
-
 }
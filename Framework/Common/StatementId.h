@@ -23,6 +23,7 @@
 
 #pragma once
 
+#include <stdint.h>
 #include <string>
 
 #define STATEMENT_FROM_HERE  ::OrthancDatabases::StatementId(__FILE__, __LINE__)
@@ -37,7 +38,9 @@ namespace OrthancDatabases
     const char* file_;
     int line_;
     std::string statement_;
-    std::string hash_;
+    uint64_t hash_;   // Only used to speed up the comparisons
+
+    void ComputeHash();
 
     StatementId(); // Forbidden
     
@@ -64,6 +67,20 @@ namespace OrthancDatabases
       return statement_;
     }
 
+    uint64_t GetHash() const
+    {
+      return hash_;
+    }
+
     bool operator< (const StatementId& other) const;
+
+    bool operator== (const StatementId& other) const;
   };
+
+
+  // For "boost::unordered_map<>"
+  inline std::size_t hash_value(const StatementId& id)
+  {
+    return static_cast<std::size_t>(id.GetHash());
+  }
 }
@@ -0,0 +1,99 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "StatementsWarmup.h"
+
+#include <OrthancException.h>
+
+#include <algorithm>
+#include <cassert>
+
+namespace OrthancDatabases
+{
+  static bool IsHotter(const std::pair<unsigned int, const StatementId*>& a,
+                       const std::pair<unsigned int, const StatementId*>& b)
+  {
+    return a.first > b.first;
+  }
+
+
+  StatementsWarmup::StatementsWarmup(size_t count) :
+    count_(count)
+  {
+    if (count == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  void StatementsWarmup::Register(const StatementId& statementId,
+                                  const Query& query)
+  {
+    if (!statementId.GetDynamicStatement().empty())
+    {
+      return;
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Items::iterator found = items_.find(statementId);
+    if (found != items_.end())
+    {
+      found->second.hits_++;
+    }
+    else if (items_.size() < 4 * count_)  // Bound the memory that is used by the statistics
+    {
+      Item item;
+      item.query_.reset(query.Clone());
+      item.hits_ = 1;
+      items_.insert(std::make_pair(statementId, item));
+    }
+  }
+
+
+  void StatementsWarmup::ListHottest(std::vector<Statement>& target)
+  {
+    target.clear();
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    std::vector< std::pair<unsigned int, const StatementId*> >  hits;
+    hits.reserve(items_.size());
+
+    for (Items::const_iterator it = items_.begin(); it != items_.end(); ++it)
+    {
+      hits.push_back(std::make_pair(it->second.hits_, &it->first));
+    }
+
+    std::stable_sort(hits.begin(), hits.end(), IsHotter);
+
+    for (size_t i = 0; i < hits.size() && i < count_; i++)
+    {
+      Items::const_iterator found = items_.find(*hits[i].second);
+      assert(found != items_.end());
+      target.push_back(std::make_pair(found->first, found->second.query_));
+    }
+  }
+}
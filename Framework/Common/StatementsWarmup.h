@@ -0,0 +1,80 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "Query.h"
+#include "StatementId.h"
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <map>
+#include <vector>
+
+namespace OrthancDatabases
+{
+  /**
+   * Set of the statements that are the most often compiled by the
+   * connections sharing this object. A connection that is opened (or
+   * re-opened after the loss of the database server) uses it to
+   * precompile the hot statements before serving its first request,
+   * instead of compiling them lazily. This class is thread-safe.
+   **/
+  class StatementsWarmup : public boost::noncopyable
+  {
+  public:
+    typedef std::pair<StatementId, boost::shared_ptr<const Query> >  Statement;
+
+  private:
+    struct Item
+    {
+      boost::shared_ptr<const Query>  query_;
+      unsigned int                    hits_;
+    };
+
+    typedef std::map<StatementId, Item>  Items;
+
+    boost::mutex  mutex_;
+    size_t        count_;
+    Items         items_;
+
+  public:
+    // "count" is the number of statements to be precompiled by
+    // each new connection
+    explicit StatementsWarmup(size_t count);
+
+    size_t GetCount() const
+    {
+      return count_;
+    }
+
+    // Only the static statements (i.e. from "STATEMENT_FROM_HERE")
+    // are recorded, as the dynamic ones are rarely reused
+    void Register(const StatementId& statementId,
+                  const Query& query);
+
+    // The hottest statements come first
+    void ListHottest(std::vector<Statement>& target);
+  };
+}
@@ -46,6 +46,13 @@ namespace OrthancDatabases
       return utf8_;
     }
 
+    // Reuses the memory that is already allocated by this value
+    void Assign(const char* utf8,
+                size_t size)
+    {
+      utf8_.assign(utf8, size);
+    }
+
     virtual ValueType GetType() const ORTHANC_OVERRIDE
     {
       return ValueType_Utf8String;
@@ -39,12 +39,21 @@
 #include <mysqld_error.h>
 
 #include <memory>
+#include <string.h>
 #include <boost/thread.hpp>
 
+
+// Size above which the deferred statements are sent to the server,
+// far below the default "max_allowed_packet" (4MB before MySQL 8.0)
+static const size_t MAX_BATCH_SIZE = 1024 * 1024;
+
+
 namespace OrthancDatabases
 {
   void MySQLDatabase::Close()
   {
+    DiscardBatch();
+
     if (mysql_ != NULL)
     {
       LOG(INFO) << "Closing connection to MySQL database";
@@ -103,7 +112,8 @@ namespace OrthancDatabases
 
   MySQLDatabase::MySQLDatabase(const MySQLParameters& parameters) :
     parameters_(parameters),
-    mysql_(NULL)
+    mysql_(NULL),
+    batchCount_(0)
   {
   }
 
@@ -144,6 +154,39 @@ namespace OrthancDatabases
     }
   }
 
+
+  int64_t MySQLDatabase::GetLastInsertId()
+  {
+    // The execution of the prepared statements also updates this
+    // value, the same as "mysql_stmt_insert_id()". After a batch,
+    // this is the value of its last statement.
+    FlushBatch();
+    return static_cast<int64_t>(mysql_insert_id(GetObject()));
+  }
+
+
+  bool MySQLDatabase::IsMariaDB()
+  {
+    const char* info = mysql_get_server_info(GetObject());
+    return (info != NULL &&
+            strstr(info, "MariaDB") != NULL);
+  }
+
+
+  bool MySQLDatabase::HasSkipLocked()
+  {
+    const unsigned long version = mysql_get_server_version(GetObject());
+
+    if (IsMariaDB())
+    {
+      return version >= 100600;
+    }
+    else
+    {
+      return version >= 80000;
+    }
+  }
+
   
   void MySQLDatabase::OpenInternal(const char* db)
   {
@@ -184,6 +227,27 @@ namespace OrthancDatabases
 #endif
     }
 
+    if (!parameters_.GetCompression().empty())
+    {
+#if !defined(MARIADB_VERSION_ID) && MYSQL_VERSION_ID >= 80018
+      // The server falls back to "uncompressed" if it doesn't support the algorithm
+      const std::string algorithms = parameters_.GetCompression() + ",uncompressed";
+      mysql_options(mysql_, MYSQL_OPT_COMPRESSION_ALGORITHMS, algorithms.c_str());
+#else
+      if (parameters_.GetCompression() == "zlib")
+      {
+        mysql_options(mysql_, MYSQL_OPT_COMPRESS, NULL);
+      }
+      else
+      {
+        Close();
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented,
+                                        "MySQL: The client library is too old to support this protocol compression: " +
+                                        parameters_.GetCompression());
+      }
+#endif
+    }
+
     const char* socket = (parameters_.GetUnixSocket().empty() ? NULL :
                           parameters_.GetUnixSocket().c_str());
 
@@ -191,7 +255,8 @@ namespace OrthancDatabases
                            parameters_.GetHost().c_str(),
                            parameters_.GetUsername().c_str(),
                            parameters_.GetPassword().c_str(), db,
-                           parameters_.GetPort(), socket, 0) == 0)
+                           parameters_.GetPort(), socket,
+                           parameters_.IsMultiStatements() ? CLIENT_MULTI_STATEMENTS : 0) == 0)
     {
       LogError();
       Close();
@@ -259,6 +324,8 @@ namespace OrthancDatabases
                     const std::string& sql) :
         result_(NULL)
       {
+        mysql.FlushBatch();
+
         if (mysql_real_query(mysql.GetObject(), sql.c_str(), sql.size()))
         {
           mysql.LogError();
@@ -310,6 +377,31 @@ namespace OrthancDatabases
   }
 
   
+  bool MySQLDatabase::LookupSessionStatus(std::string& value,
+                                          const std::string& variable)
+  {
+    if (!IsValidDatabaseIdentifier(variable))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    ResultWrapper result(*this, "SHOW SESSION STATUS LIKE '" + variable + "'");
+
+    MYSQL_ROW row = mysql_fetch_row(result.GetObject());
+    if (mysql_errno(mysql_) == 0 &&
+        row &&
+        row[1])
+    {
+      value = std::string(row[1]);
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+  
   bool MySQLDatabase::LookupGlobalIntegerVariable(int64_t& value,
                                                   const std::string& variable)
   {
@@ -494,6 +586,39 @@ namespace OrthancDatabases
   }
 
 
+  bool MySQLDatabase::DoesIndexExist(MySQLTransaction& transaction,
+                                     const std::string& name)
+  {
+    if (mysql_ == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    if (!IsValidDatabaseIdentifier(name))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    // NB: There is one row per column of the index
+    Query query("SELECT COUNT(*) FROM information_schema.STATISTICS "
+                "WHERE (TABLE_SCHEMA = ${database}) AND (INDEX_NAME = ${index})", true);
+    query.SetType("database", ValueType_Utf8String);
+    query.SetType("index", ValueType_Utf8String);
+    
+    MySQLStatement statement(*this, query);
+
+    Dictionary args;
+    args.SetUtf8Value("database", parameters_.GetDatabase());
+    args.SetUtf8Value("index", name);
+
+    std::unique_ptr<IResult> result(statement.Execute(transaction, args));
+    return (!result->IsDone() &&
+            result->GetFieldsCount() == 1 &&
+            result->GetField(0).GetType() == ValueType_Integer64 &&
+            dynamic_cast<const Integer64Value&>(result->GetField(0)).GetValue() != 0);
+  }
+
+
   void MySQLDatabase::ExecuteMultiLines(const std::string& sql,
                                         bool arobaseSeparator)
   {
@@ -502,6 +627,8 @@ namespace OrthancDatabases
       throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
     }
 
+    FlushBatch();
+
     // This emulates the behavior of "CLIENT_MULTI_STATEMENTS" in
     // "mysql_real_connect()", avoiding to implement a loop over
     // "mysql_query()"
@@ -526,6 +653,84 @@ namespace OrthancDatabases
     }
   }
 
+
+  void MySQLDatabase::QueueStatement(const std::string& sql)
+  {
+    if (!parameters_.IsMultiStatements())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    if (!batch_.empty())
+    {
+      batch_ += ";";
+    }
+
+    batch_ += sql;
+    batchCount_++;
+
+    if (batch_.size() >= MAX_BATCH_SIZE)
+    {
+      FlushBatch();
+    }
+  }
+
+
+  void MySQLDatabase::FlushBatch()
+  {
+    if (batch_.empty())
+    {
+      return;
+    }
+
+    std::string sql;
+    sql.swap(batch_);
+
+    const size_t count = batchCount_;
+    batchCount_ = 0;
+
+    LOG(TRACE) << "MySQL: Sending a batch of " << count << " statements";
+
+    MYSQL* mysql = GetObject();
+
+    if (mysql_real_query(mysql, sql.c_str(), sql.size()) != 0)
+    {
+      ThrowException();
+    }
+
+    // All the results must be consumed before sending another
+    // statement. After an error, the next statements are not run.
+    for (;;)
+    {
+      MYSQL_RES* result = mysql_store_result(mysql);
+      if (result != NULL)
+      {
+        mysql_free_result(result);
+      }
+      else if (mysql_field_count(mysql) != 0)
+      {
+        ThrowException();
+      }
+
+      const int status = mysql_next_result(mysql);
+      if (status == -1)
+      {
+        break;  // No more result
+      }
+      else if (status != 0)
+      {
+        ThrowException();
+      }
+    }
+  }
+
+
+  void MySQLDatabase::DiscardBatch()
+  {
+    batch_.clear();
+    batchCount_ = 0;
+  }
+
   
   IPrecompiledStatement* MySQLDatabase::Compile(const Query& query)
   {
@@ -678,7 +883,15 @@ namespace OrthancDatabases
     {
       std::unique_ptr<MySQLDatabase> db(new MySQLDatabase(parameters_));
       db->Open();
-      db->ExecuteMultiLines("SET SESSION TRANSACTION ISOLATION LEVEL SERIALIZABLE", false);
+      if (parameters_.IsMultiWriter())
+      {
+        // The writers of different patients must not conflict on the gap locks of "SERIALIZABLE"
+        db->ExecuteMultiLines("SET SESSION TRANSACTION ISOLATION LEVEL READ COMMITTED", false);
+      }
+      else
+      {
+        db->ExecuteMultiLines("SET SESSION TRANSACTION ISOLATION LEVEL SERIALIZABLE", false);
+      }
       return db.release();
     }
       
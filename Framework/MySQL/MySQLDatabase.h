@@ -43,6 +43,8 @@ namespace OrthancDatabases
     
     MySQLParameters  parameters_;
     MYSQL           *mysql_;
+    std::string      batch_;        // Deferred statements, separated by semicolons
+    size_t           batchCount_;
 
     void OpenInternal(const char* database);
     
@@ -64,6 +66,14 @@ namespace OrthancDatabases
 
     MYSQL* GetObject();
 
+    /**
+     * Value of the AUTO_INCREMENT column that was generated by the
+     * last INSERT on this connection. It is sent by the server
+     * together with the result of the INSERT, so contrarily to
+     * "SELECT LAST_INSERT_ID()", this doesn't cost a round-trip.
+     **/
+    int64_t GetLastInsertId();
+
     void Open();
 
     void OpenRoot()
@@ -79,15 +89,43 @@ namespace OrthancDatabases
     bool LookupGlobalIntegerVariable(int64_t& value,
                                      const std::string& variable);
 
+    // Status variable of the current connection, e.g. "Compression"
+    bool LookupSessionStatus(std::string& value,
+                             const std::string& variable);
+
     bool AcquireAdvisoryLock(const std::string& lock);
 
     bool ReleaseAdvisoryLock(const std::string& lock);
 
     void AdvisoryLock(const std::string& lock);
 
+    bool IsMariaDB();
+
+    // Whether "SELECT ... FOR UPDATE SKIP LOCKED" is available (MySQL >= 8.0, MariaDB >= 10.6)
+    bool HasSkipLocked();
+
     void ExecuteMultiLines(const std::string& sql,
                            bool arobaseSeparator);
 
+    bool IsMultiStatements() const
+    {
+      return parameters_.IsMultiStatements();
+    }
+
+    /**
+     * Defers the execution of a statement, whose parameters are
+     * already formatted as literals, until the next call to
+     * "FlushBatch()". The batch is automatically flushed before any
+     * other statement is sent to the server. The errors of the
+     * deferred statements are only reported by the flush.
+     **/
+    void QueueStatement(const std::string& sql);
+
+    // Sends the deferred statements in one single round-trip
+    void FlushBatch();
+
+    void DiscardBatch();
+
     bool DoesTableExist(MySQLTransaction& transaction,
                         const std::string& name);
 
@@ -97,6 +135,9 @@ namespace OrthancDatabases
     bool DoesTriggerExist(MySQLTransaction& transaction,
                           const std::string& name);
 
+    bool DoesIndexExist(MySQLTransaction& transaction,
+                        const std::string& name);
+
     virtual Dialect GetDialect() const ORTHANC_OVERRIDE
     {
       return Dialect_MySQL;
@@ -45,12 +45,14 @@ namespace OrthancDatabases
 #endif
     
     lock_ = true;
+    multiWriter_ = false;
   }
 
   
   MySQLParameters::MySQLParameters() :
     ssl_(false),
     verifySslServerCertificates_(true),
+    multiStatements_(false),
     maxConnectionRetries_(10),
     connectionRetryInterval_(5)
   {
@@ -62,7 +64,41 @@ namespace OrthancDatabases
                                    const OrthancPlugins::OrthancConfiguration& orthancConfiguration)
   {
     Reset();
+    LoadConnectionParameters(pluginConfiguration);
 
+    lock_ = pluginConfiguration.GetBooleanValue("Lock", true);  // Use locking by default
+    multiWriter_ = pluginConfiguration.GetBooleanValue("EnableMultiWriter", false);
+
+    if (multiWriter_ &&
+        lock_)
+    {
+      LOG(WARNING) << "MySQL: the \"Lock\" option is ignored, as \"EnableMultiWriter\" is set";
+      lock_ = false;
+    }
+
+    multiStatements_ = pluginConfiguration.GetBooleanValue("EnableMultiStatements", false);
+
+    SetCompression(pluginConfiguration.GetStringValue("ProtocolCompression", ""));
+
+    ssl_ = pluginConfiguration.GetBooleanValue("EnableSsl", false);
+    verifySslServerCertificates_ = pluginConfiguration.GetBooleanValue("SslVerifyServerCertificates", true);
+
+    const std::string defaultCaCertificates = orthancConfiguration.GetStringValue("HttpsCACertificates", "");
+    sslCaCertificates_ = pluginConfiguration.GetStringValue("SslCACertificates", defaultCaCertificates);
+
+    if (ssl_ && verifySslServerCertificates_ && sslCaCertificates_.empty())
+    {
+      LOG(ERROR) << "MySQL: No SslCACertificates defined, unable to check SSL Server certificates";
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    maxConnectionRetries_ = pluginConfiguration.GetUnsignedIntegerValue("MaximumConnectionRetries", 10);
+    connectionRetryInterval_ = pluginConfiguration.GetUnsignedIntegerValue("ConnectionRetryInterval", 5);
+  }
+
+
+  void MySQLParameters::LoadConnectionParameters(const OrthancPlugins::OrthancConfiguration& pluginConfiguration)
+  {
     std::string s;
     if (pluginConfiguration.LookupStringValue(s, "Host"))
     {
@@ -94,23 +130,6 @@ namespace OrthancDatabases
     {
       SetUnixSocket(s);
     }
-
-    lock_ = pluginConfiguration.GetBooleanValue("Lock", true);  // Use locking by default
-
-    ssl_ = pluginConfiguration.GetBooleanValue("EnableSsl", false);
-    verifySslServerCertificates_ = pluginConfiguration.GetBooleanValue("SslVerifyServerCertificates", true);
-
-    const std::string defaultCaCertificates = orthancConfiguration.GetStringValue("HttpsCACertificates", "");
-    sslCaCertificates_ = pluginConfiguration.GetStringValue("SslCACertificates", defaultCaCertificates);
-
-    if (ssl_ && verifySslServerCertificates_ && sslCaCertificates_.empty())
-    {
-      LOG(ERROR) << "MySQL: No SslCACertificates defined, unable to check SSL Server certificates";
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
-    }
-
-    maxConnectionRetries_ = pluginConfiguration.GetUnsignedIntegerValue("MaximumConnectionRetries", 10);
-    connectionRetryInterval_ = pluginConfiguration.GetUnsignedIntegerValue("ConnectionRetryInterval", 5);
   }
 
 
@@ -176,6 +195,22 @@ namespace OrthancDatabases
     unixSocket_ = socket;
   }
 
+
+  void MySQLParameters::SetCompression(const std::string& algorithm)
+  {
+    if (algorithm.empty() ||
+        algorithm == "zlib" ||
+        algorithm == "zstd")
+    {
+      compression_ = algorithm;
+    }
+    else
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "MySQL: Unknown protocol compression (must be \"zlib\" or \"zstd\"): " + algorithm);
+    }
+  }
+
   
   void MySQLParameters::Format(Json::Value& target) const
   {
@@ -187,5 +222,6 @@ namespace OrthancDatabases
     target["Port"] = port_;
     target["UnixSocket"] = unixSocket_;
     target["Lock"] = lock_;
+    target["EnableMultiWriter"] = multiWriter_;
   }
 }
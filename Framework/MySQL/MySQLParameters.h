@@ -44,6 +44,9 @@ namespace OrthancDatabases
     bool         verifySslServerCertificates_;
     std::string  sslCaCertificates_;
     bool         lock_;
+    bool         multiWriter_;
+    bool         multiStatements_;
+    std::string  compression_;
     unsigned int maxConnectionRetries_;
     unsigned int connectionRetryInterval_;
 
@@ -55,6 +58,10 @@ namespace OrthancDatabases
     MySQLParameters(const OrthancPlugins::OrthancConfiguration& pluginConfiguration,
                     const OrthancPlugins::OrthancConfiguration& orthancConfiguration);
 
+    // Only reads the options that identify the server ("Host",
+    // "Username", "Password", "Database", "Port" and "UnixSocket")
+    void LoadConnectionParameters(const OrthancPlugins::OrthancConfiguration& pluginConfiguration);
+
     const std::string& GetHost() const
     {
       return host_;
@@ -122,6 +129,50 @@ namespace OrthancDatabases
       return lock_;
     }
 
+    /**
+     * In the multi-writer mode, several Orthanc servers share the same
+     * index (e.g. a Galera cluster): The global "GET_LOCK()" is not
+     * taken, the transactions are "READ COMMITTED", and the ingestion
+     * of the instances of one patient is serialized by the row lock of
+     * the patient in "Resources".
+     **/
+    void SetMultiWriter(bool multiWriter)
+    {
+      multiWriter_ = multiWriter;
+    }
+
+    bool IsMultiWriter() const
+    {
+      return multiWriter_;
+    }
+
+    /**
+     * If enabled, the connections are opened with the
+     * "CLIENT_MULTI_STATEMENTS" flag, and the writes of the explicit
+     * transactions are deferred, then sent together in one round-trip.
+     **/
+    /**
+     * Compression of the client/server protocol: "" (none), "zlib"
+     * or "zstd". The "zstd" algorithm requires the MySQL client
+     * library >= 8.0.18, and a server that supports it.
+     **/
+    void SetCompression(const std::string& algorithm);
+
+    const std::string& GetCompression() const
+    {
+      return compression_;
+    }
+
+    void SetMultiStatements(bool enabled)
+    {
+      multiStatements_ = enabled;
+    }
+
+    bool IsMultiStatements() const
+    {
+      return multiStatements_;
+    }
+
     unsigned int GetMaxConnectionRetries() const
     {
       return maxConnectionRetries_;
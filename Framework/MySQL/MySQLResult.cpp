@@ -29,6 +29,8 @@
 #include <errmsg.h>
 #include <mysqld_error.h>
 
+#include <cassert>
+
 namespace OrthancDatabases
 {
   void MySQLResult::Step()
@@ -62,7 +64,27 @@ namespace OrthancDatabases
 
   IValue* MySQLResult::FetchField(size_t index)
   {
-    return statement_.FetchResultField(index);
+    const char* value = NULL;
+    size_t size = 0;
+    ValueType type;
+
+    if (statement_.LookupResultFieldView(value, size, type, index))
+    {
+      // Reuse the value of the previous row, without intermediate copy
+      if (type == ValueType_Utf8String)
+      {
+        return RecycleUtf8String(index, value, size);
+      }
+      else
+      {
+        assert(type == ValueType_BinaryString);
+        return RecycleBinaryString(index, value, size);
+      }
+    }
+    else
+    {
+      return statement_.FetchResultField(index);
+    }
   }
   
   
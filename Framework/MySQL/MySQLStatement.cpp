@@ -34,9 +34,17 @@
 #include <Logging.h>
 #include <OrthancException.h>
 
+#include <boost/lexical_cast.hpp>
+#include <cassert>
 #include <list>
 #include <memory>
 
+
+// Number of rows that are fetched at once from the server-side
+// cursor of a read-only statement whose result is streamed
+static const unsigned long STREAMING_PREFETCH_ROWS = 256;
+
+
 namespace OrthancDatabases
 {
   class MySQLStatement::ResultField : public boost::noncopyable
@@ -203,13 +211,18 @@ namespace OrthancDatabases
       return orthancType_;
     }
 
-    void PrepareBind(MYSQL_BIND& bind)
+    void Reset()
     {
-      memset(&bind, 0, sizeof(bind));
-
       isNull_ = false;
       isError_ = false;
       length_ = 0;
+    }
+
+    void PrepareBind(MYSQL_BIND& bind)
+    {
+      memset(&bind, 0, sizeof(bind));
+
+      Reset();
 
       bind.buffer_length = buffer_.size();
       bind.buffer_type = mysqlType_;
@@ -230,10 +243,31 @@ namespace OrthancDatabases
     }
 
 
+    bool LookupStringView(const char*& value,
+                          size_t& size) const
+    {
+      if (!isError_ &&
+          !isNull_ &&
+          (orthancType_ == ValueType_Utf8String ||
+           orthancType_ == ValueType_BinaryString) &&
+          length_ <= buffer_.size())
+      {
+        // The value was entirely received in "buffer_"
+        value = buffer_.c_str();
+        size = length_;
+        return true;
+      }
+      else
+      {
+        return false;
+      }
+    }
+
+
     IValue* FetchValue(MySQLDatabase& database,
                        MYSQL_STMT& statement,
-                       MYSQL_BIND& bind,
-                       unsigned int column) const
+                       const MYSQL_BIND& bind,
+                       unsigned int index) const
     {
       if (isError_)
       {
@@ -257,10 +291,13 @@ namespace OrthancDatabases
         {
           if (buffer_.empty())
           {
-            bind.buffer = &tmp[0];
-            bind.buffer_length = tmp.size();
+            // The bind structure is reused by the next executions of
+            // the statement, so it must not keep a pointer to "tmp"
+            MYSQL_BIND column = bind;
+            column.buffer = &tmp[0];
+            column.buffer_length = tmp.size();
 
-            database.CheckErrorCode(mysql_stmt_fetch_column(&statement, &bind, column, 0));
+            database.CheckErrorCode(mysql_stmt_fetch_column(&statement, &column, index, 0));
           }
           else if (tmp.size() <= buffer_.size())
           {
@@ -278,7 +315,10 @@ namespace OrthancDatabases
         }
         else
         {
-          return new BinaryStringValue(tmp);
+          // Avoid a copy of the content, which can be a large file
+          std::unique_ptr<BinaryStringValue> value(new BinaryStringValue(""));
+          value->Swap(tmp);
+          return value.release();
         }
       }
       else
@@ -356,10 +396,10 @@ namespace OrthancDatabases
                                  const Query& query) :
     db_(db),
     statement_(NULL),
-    formatter_(Dialect_MySQL)
+    formatter_(Dialect_MySQL),
+    streaming_(query.IsStreaming())
   {
-    std::string sql;
-    query.Format(sql, formatter_);
+    query.Format(sql_, formatter_);
 
     statement_ = mysql_stmt_init(db.GetObject());
     if (statement_ == NULL)
@@ -368,9 +408,9 @@ namespace OrthancDatabases
       throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);
     }
 
-    LOG(TRACE) << "Preparing MySQL statement: " << sql;
+    LOG(TRACE) << "Preparing MySQL statement: " << sql_;
 
-    db_.CheckErrorCode(mysql_stmt_prepare(statement_, sql.c_str(), sql.size()));
+    db_.CheckErrorCode(mysql_stmt_prepare(statement_, sql_.c_str(), sql_.size()));
 
     if (mysql_stmt_param_count(statement_) != formatter_.GetParametersCount())
     {
@@ -395,6 +435,16 @@ namespace OrthancDatabases
       {
         throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
       }
+
+      // The output buffers only depend on the metadata of the
+      // result, so they are shared by all the executions
+      outputs_.resize(result_.size());
+
+      for (size_t i = 0; i < result_.size(); i++)
+      {
+        assert(result_[i] != NULL);
+        result_[i]->PrepareBind(outputs_[i]);
+      }
     }
     catch (Orthanc::OrthancException&)
     {
@@ -406,6 +456,9 @@ namespace OrthancDatabases
     {
       unsigned long type = (unsigned long) CURSOR_TYPE_READ_ONLY;
       mysql_stmt_attr_set(statement_, STMT_ATTR_CURSOR_TYPE, (void*) &type);
+
+      unsigned long rows = STREAMING_PREFETCH_ROWS;
+      mysql_stmt_attr_set(statement_, STMT_ATTR_PREFETCH_ROWS, (void*) &rows);
     }
   }
 
@@ -450,32 +503,171 @@ namespace OrthancDatabases
   }
 
 
-  IResult* MySQLStatement::Execute(ITransaction& transaction,
-                                   const Dictionary& parameters)
+  bool MySQLStatement::LookupResultFieldView(const char*& value,
+                                             size_t& size,
+                                             ValueType& type,
+                                             size_t i) const
   {
-    std::list<long long int>  int64Parameters;
+    if (i >= result_.size())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      assert(result_[i] != NULL);
+      type = result_[i]->GetOrthancType();
+      return result_[i]->LookupStringView(value, size);
+    }
+  }
 
-    std::vector<MYSQL_BIND>  inputs(formatter_.GetParametersCount());
 
-    for (size_t i = 0; i < inputs.size(); i++)
+  const IValue& MySQLStatement::GetParameter(const Dictionary& parameters,
+                                             size_t i) const
+  {
+    const std::string& name = formatter_.GetParameterName(i);
+    if (!parameters.HasKey(name))
     {
-      memset(&inputs[i], 0, sizeof(MYSQL_BIND));
+      LOG(ERROR) << "Missing required parameter in a SQL query: " << name;
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem);
+    }
+
+    const IValue& value = parameters.GetValue(name);
+    if (value.GetType() != formatter_.GetParameterType(i))
+    {
+      LOG(ERROR) << "Bad type of argument provided to a SQL query: " << name;
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadParameterType);
+    }
+
+    return value;
+  }
 
-      const std::string& name = formatter_.GetParameterName(i);
-      if (!parameters.HasKey(name))
+
+  bool MySQLStatement::FormatWithLiterals(std::string& target,
+                                          const Dictionary& parameters) const
+  {
+    std::vector<std::string> literals(formatter_.GetParametersCount());
+
+    for (size_t i = 0; i < literals.size(); i++)
+    {
+      const IValue& value = GetParameter(parameters, i);
+
+      switch (value.GetType())
       {
-        LOG(ERROR) << "Missing required parameter in a SQL query: " << name;
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem);
+        case ValueType_Integer64:
+          literals[i] = boost::lexical_cast<std::string>(dynamic_cast<const Integer64Value&>(value).GetValue());
+          break;
+
+        case ValueType_Utf8String:
+        {
+          const std::string& utf8 = dynamic_cast<const Utf8StringValue&>(value).GetContent();
+
+          // The escaping depends on the character set of the connection
+          std::string escaped;
+          escaped.resize(2 * utf8.size() + 1);
+          const unsigned long length = mysql_real_escape_string(
+            db_.GetObject(), &escaped[0], utf8.c_str(), utf8.size());
+          if (length == static_cast<unsigned long>(-1))
+          {
+            return false;
+          }
+
+          literals[i] = "'" + escaped.substr(0, length) + "'";
+          break;
+        }
+
+        case ValueType_BinaryString:
+        {
+          // Hexadecimal literal, which is not checked against the character set
+          const std::string& content = dynamic_cast<const BinaryStringValue&>(value).GetContent();
+          static const char HEX[] = "0123456789abcdef";
+
+          literals[i].reserve(2 * content.size() + 3);
+          literals[i] = "X'";
+          for (size_t j = 0; j < content.size(); j++)
+          {
+            const uint8_t c = static_cast<uint8_t>(content[j]);
+            literals[i].push_back(HEX[c >> 4]);
+            literals[i].push_back(HEX[c & 0x0f]);
+          }
+          literals[i].push_back('\'');
+          break;
+        }
+
+        case ValueType_Null:
+          literals[i] = "NULL";
+          break;
+
+        default:
+          return false;  // The files are sent through the prepared statement
       }
+    }
+
+    // Replace the "?" placeholders that are outside of the quoted strings
+    target.clear();
+    target.reserve(sql_.size());
+
+    char quote = '\0';
+    size_t count = 0;
+
+    for (size_t i = 0; i < sql_.size(); i++)
+    {
+      const char c = sql_[i];
 
-      ValueType type = formatter_.GetParameterType(i);
+      if (quote != '\0')
+      {
+        if (c == quote)
+        {
+          quote = '\0';
+        }
 
-      const IValue& value = parameters.GetValue(name);
-      if (value.GetType() != type)
+        target.push_back(c);
+      }
+      else if (c == '\'' || c == '"' || c == '`')
       {
-        LOG(ERROR) << "Bad type of argument provided to a SQL query: " << name;
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadParameterType);
+        quote = c;
+        target.push_back(c);
       }
+      else if (c == '?')
+      {
+        if (count >= literals.size())
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+        }
+
+        target += literals[count];
+        count++;
+      }
+      else
+      {
+        target.push_back(c);
+      }
+    }
+
+    if (count != literals.size())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+
+    return true;
+  }
+
+
+  IResult* MySQLStatement::Execute(ITransaction& transaction,
+                                   const Dictionary& parameters)
+  {
+    // The deferred statements must be run first
+    db_.FlushBatch();
+
+    std::list<long long int>  int64Parameters;
+
+    std::vector<MYSQL_BIND>  inputs(formatter_.GetParametersCount());
+
+    for (size_t i = 0; i < inputs.size(); i++)
+    {
+      memset(&inputs[i], 0, sizeof(MYSQL_BIND));
+
+      const IValue& value = GetParameter(parameters, i);
+      const ValueType type = value.GetType();
 
       // https://dev.mysql.com/doc/refman/8.0/en/c-api-prepared-statement-type-codes.html
       switch (type)
@@ -534,18 +726,20 @@ namespace OrthancDatabases
 
     db_.CheckErrorCode(mysql_stmt_execute(statement_));
 
-    outputs_.resize(result_.size());
-
     for (size_t i = 0; i < result_.size(); i++)
     {
       assert(result_[i] != NULL);
-      result_[i]->PrepareBind(outputs_[i]);
+      result_[i]->Reset();
     }
 
     if (!outputs_.empty())
     {
       db_.CheckErrorCode(mysql_stmt_bind_result(statement_, &outputs_[0]));
-      db_.CheckErrorCode(mysql_stmt_store_result(statement_));
+
+      if (!streaming_)
+      {
+        db_.CheckErrorCode(mysql_stmt_store_result(statement_));
+      }
     }
 
     return new MySQLResult(db_, *this);
@@ -555,6 +749,17 @@ namespace OrthancDatabases
   void MySQLStatement::ExecuteWithoutResult(ITransaction& transaction,
                                             const Dictionary& parameters)
   {
+    if (db_.IsMultiStatements() &&
+        !transaction.IsImplicit())
+    {
+      std::string sql;
+      if (FormatWithLiterals(sql, parameters))
+      {
+        db_.QueueStatement(sql);
+        return;
+      }
+    }
+
     std::unique_ptr<IResult> dummy(Execute(transaction, parameters));
   }
 }
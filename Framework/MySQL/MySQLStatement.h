@@ -40,11 +40,20 @@ namespace OrthancDatabases
 
     void Close();
 
+    const IValue& GetParameter(const Dictionary& parameters,
+                               size_t i) const;
+
+    // Returns "false" if some parameter is not worth being copied
+    bool FormatWithLiterals(std::string& target,
+                            const Dictionary& parameters) const;
+
     MySQLDatabase&             db_;
     MYSQL_STMT                *statement_;
+    std::string                sql_;
     GenericFormatter           formatter_;
     std::vector<ResultField*>  result_;
     std::vector<MYSQL_BIND>    outputs_;
+    bool                       streaming_;
 
   public:
     MySQLStatement(MySQLDatabase& db,
@@ -54,6 +63,23 @@ namespace OrthancDatabases
 
     MYSQL_STMT* GetObject();
 
+    bool IsStreaming() const
+    {
+      return streaming_;
+    }
+
+    /**
+     * If streaming is enabled, the rows are not stored on the client
+     * side once the statement is executed, but are fetched as they
+     * are read (by batches from a server-side cursor if the statement
+     * is read-only). Without a cursor, no other statement can be
+     * executed on the connection until the result is fully read.
+     **/
+    void SetStreaming(bool streaming)
+    {
+      streaming_ = streaming;
+    }
+
     size_t GetResultFieldsCount() const
     {
       return result_.size();
@@ -61,9 +87,21 @@ namespace OrthancDatabases
 
     IValue* FetchResultField(size_t i);
 
+    // Gives access to a string field without copying it, if it is
+    // entirely available in the bound buffer
+    bool LookupResultFieldView(const char*& value,
+                               size_t& size,
+                               ValueType& type,
+                               size_t i) const;
+
     IResult* Execute(ITransaction& transaction,
                      const Dictionary& parameters);
 
+    /**
+     * Inside an explicit transaction whose connection has the
+     * multi-statements enabled, the statement is deferred until the
+     * next flush of the batch of the connection.
+     **/
     void ExecuteWithoutResult(ITransaction& transaction,
                               const Dictionary& parameters);
   };
@@ -38,19 +38,31 @@ namespace OrthancDatabases
     db_(db),
     active_(false)
   {
+    std::string sql;
+
     switch (type)
     {
       case TransactionType_ReadWrite:
-        db_.ExecuteMultiLines("START TRANSACTION READ WRITE", false);
+        sql = "START TRANSACTION READ WRITE";
         break;
 
       case TransactionType_ReadOnly:
-        db_.ExecuteMultiLines("START TRANSACTION READ ONLY", false);
+        sql = "START TRANSACTION READ ONLY";
         break;
 
       default:
         throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
     }
+
+    if (db_.IsMultiStatements())
+    {
+      // Sent together with the first statement of the transaction
+      db_.QueueStatement(sql);
+    }
+    else
+    {
+      db_.ExecuteMultiLines(sql, false);
+    }
         
     active_ = true;
   }
@@ -64,6 +76,7 @@ namespace OrthancDatabases
 
       try
       {
+        db_.DiscardBatch();
         db_.ExecuteMultiLines("ROLLBACK", false);
       }
       catch (Orthanc::OrthancException&)
@@ -78,6 +91,7 @@ namespace OrthancDatabases
   {
     if (active_)
     {
+      db_.DiscardBatch();
       db_.ExecuteMultiLines("ROLLBACK", false);
       active_ = false;
     }
@@ -93,7 +107,17 @@ namespace OrthancDatabases
   {
     if (active_)
     {
-      db_.ExecuteMultiLines("COMMIT", false);
+      if (db_.IsMultiStatements())
+      {
+        // The deferred statements and the commit share one round-trip
+        db_.QueueStatement("COMMIT");
+        db_.FlushBatch();
+      }
+      else
+      {
+        db_.ExecuteMultiLines("COMMIT", false);
+      }
+
       active_ = false;
     }
     else
@@ -66,7 +66,7 @@ namespace OrthancDatabases
 
     virtual bool DoesIndexExist(const std::string& name) ORTHANC_OVERRIDE
     {
-      return false;
+      return db_.DoesIndexExist(*this, name);
     }
 
     virtual bool DoesTriggerExist(const std::string& name) ORTHANC_OVERRIDE
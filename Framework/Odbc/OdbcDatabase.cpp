@@ -219,6 +219,12 @@ namespace OrthancDatabases
     {
       std::unique_ptr<IResult> result(Execute(statement, parameters));
     }
+
+    virtual void ExecuteBatchWithoutResult(IPrecompiledStatement& statement,
+                                           const std::vector<const Dictionary*>& parameters) ORTHANC_OVERRIDE
+    {
+      dynamic_cast<OdbcPreparedStatement&>(statement).ExecuteArray(parameters);
+    }
   };
 
 
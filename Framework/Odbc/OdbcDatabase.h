@@ -73,6 +73,14 @@ namespace OrthancDatabases
 
     virtual ITransaction* CreateTransaction(TransactionType type) ORTHANC_OVERRIDE;
 
+    // The arrays of parameters are only enabled for the drivers that
+    // are known to implement them (SQL Server and psqlODBC)
+    virtual bool HasBatchExecution() const ORTHANC_OVERRIDE
+    {
+      return (dialect_ == Dialect_MSSQL ||
+              dialect_ == Dialect_PostgreSQL);
+    }
+
     // https://en.wikipedia.org/wiki/History_of_Microsoft_SQL_Server
     unsigned int GetDbmsMajorVersion() const;
 
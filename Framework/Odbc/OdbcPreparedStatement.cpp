@@ -28,9 +28,12 @@
 #include "../Common/Utf8StringValue.h"
 #include "OdbcResult.h"
 
+#include <Compatibility.h>  // For std::unique_ptr<>
 #include <Logging.h>
 #include <OrthancException.h>
 
+#include <algorithm>
+#include <cassert>
 #include <sqlext.h>
 
 
@@ -103,6 +106,30 @@ namespace OrthancDatabases
   }
 
     
+  static const IValue& GetArrayParameter(const Dictionary& parameters,
+                                         const std::string& name,
+                                         ValueType expectedType)
+  {
+    if (!parameters.HasKey(name))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem,
+                                      "Missing parameter to SQL prepared statement: " + name);
+    }
+
+    const IValue& value = parameters.GetValue(name);
+    if (value.GetType() != ValueType_Null &&
+        value.GetType() != expectedType)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadParameterType,
+                                      "Parameter \"" + name + "\" should be of type \"" +
+                                      EnumerationToString(expectedType) +
+                                      "\", found \"" + EnumerationToString(value.GetType()) + "\"");
+    }
+
+    return value;
+  }
+
+
   IResult* OdbcPreparedStatement::Execute()
   {
     Dictionary parameters;
@@ -251,4 +278,164 @@ namespace OrthancDatabases
                                       "Cannot execute ODBC statement:\n" + statement_.FormatError());
     }
   }
+
+
+  void OdbcPreparedStatement::ExecuteArray(const std::vector<const Dictionary*>& parameters)
+  {
+    if (parameters.size() <= 1 ||
+        formatter_.GetParametersCount() == 0)
+    {
+      for (size_t i = 0; i < parameters.size(); i++)
+      {
+        std::unique_ptr<IResult> result(Execute(*parameters[i]));
+      }
+
+      return;
+    }
+
+    const size_t rows = parameters.size();
+    const size_t columns = formatter_.GetParametersCount();
+
+    /**
+     * Column-wise binding: Each parameter is bound to one buffer that
+     * contains its values for all the rows. The strings are stored in
+     * fixed-width slots, whose width is the longest value.
+     **/
+    std::vector< std::vector<int64_t> >  integers(columns);
+    std::vector<std::string>             strings(columns);
+    std::vector< std::vector<SQLLEN> >   lengths(columns);
+
+    for (size_t i = 0; i < columns; i++)
+    {
+      const std::string& name = formatter_.GetParameterName(i);
+      lengths[i].resize(rows);
+
+      switch (formatter_.GetParameterType(i))
+      {
+        case ValueType_Integer64:
+        {
+          integers[i].resize(rows);
+
+          for (size_t row = 0; row < rows; row++)
+          {
+            assert(parameters[row] != NULL);
+            const IValue& value = GetArrayParameter(*parameters[row], name, ValueType_Integer64);
+
+            if (value.GetType() == ValueType_Null)
+            {
+              lengths[i][row] = SQL_NULL_DATA;
+            }
+            else
+            {
+              integers[i][row] = dynamic_cast<const Integer64Value&>(value).GetValue();
+              lengths[i][row] = sizeof(int64_t);
+            }
+          }
+
+          if (!SQL_SUCCEEDED(SQLBindParameter(statement_.GetHandle(), i + 1, SQL_PARAM_INPUT, SQL_C_SBIGINT, SQL_BIGINT,
+                                              0 /* ignored */, 0 /* ignored */, &integers[i][0],
+                                              sizeof(int64_t), &lengths[i][0])))
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_Database,
+                                            "Cannot bind integer array parameter: " + statement_.FormatError());
+          }
+
+          break;
+        }
+
+        case ValueType_Utf8String:
+        {
+          size_t width = 1;
+
+          for (size_t row = 0; row < rows; row++)
+          {
+            assert(parameters[row] != NULL);
+            const IValue& value = GetArrayParameter(*parameters[row], name, ValueType_Utf8String);
+
+            if (value.GetType() != ValueType_Null)
+            {
+              width = std::max(width, dynamic_cast<const Utf8StringValue&>(value).GetContent().size());
+            }
+          }
+
+          strings[i].assign(width * rows, '\0');
+
+          for (size_t row = 0; row < rows; row++)
+          {
+            const IValue& value = parameters[row]->GetValue(name);
+
+            if (value.GetType() == ValueType_Null)
+            {
+              lengths[i][row] = SQL_NULL_DATA;
+            }
+            else
+            {
+              const std::string& content = dynamic_cast<const Utf8StringValue&>(value).GetContent();
+              strings[i].replace(row * width, content.size(), content);
+              lengths[i][row] = content.size();
+            }
+          }
+
+          if (!SQL_SUCCEEDED(SQLBindParameter(
+                               statement_.GetHandle(), i + 1, SQL_PARAM_INPUT, SQL_C_CHAR, SQL_VARCHAR,
+                               0 /* ignored */, 0 /* ignored */, &strings[i][0], width, &lengths[i][0])))
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_Database,
+                                            "Cannot bind UTF-8 array parameter: " + statement_.FormatError());
+          }
+
+          break;
+        }
+
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented,
+                                          "This type of parameter cannot be bound as an array");
+      }
+    }
+
+    if (!SQL_SUCCEEDED(SQLSetStmtAttr(statement_.GetHandle(), SQL_ATTR_PARAM_BIND_TYPE,
+                                      (SQLPOINTER) SQL_PARAM_BIND_BY_COLUMN, 0)) ||
+        !SQL_SUCCEEDED(SQLSetStmtAttr(statement_.GetHandle(), SQL_ATTR_PARAMSET_SIZE,
+                                      (SQLPOINTER) static_cast<SQLULEN>(rows), 0)))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_Database,
+                                      "The ODBC driver does not support arrays of parameters: " + statement_.FormatError());
+    }
+
+    const Dialect dialect = formatter_.GetAutoincrementDialect();
+
+    SQLRETURN code = SQLExecute(statement_.GetHandle());
+
+    std::string error;
+    if (code != SQL_SUCCESS &&
+        code != SQL_SUCCESS_WITH_INFO &&
+        code != SQL_NO_DATA)
+    {
+      error = statement_.FormatError();
+
+      try
+      {
+        // Must be done before "SQLSetStmtAttr()", that clears the diagnostics
+        statement_.CheckCollision(dialect);
+      }
+      catch (Orthanc::OrthancException&)
+      {
+        SQLSetStmtAttr(statement_.GetHandle(), SQL_ATTR_PARAMSET_SIZE, (SQLPOINTER) 1, 0);
+        throw;
+      }
+    }
+
+    // The statement is cached, and is subsequently executed with single parameters
+    SQLSetStmtAttr(statement_.GetHandle(), SQL_ATTR_PARAMSET_SIZE, (SQLPOINTER) 1, 0);
+
+    if (error.empty())
+    {
+      std::unique_ptr<IResult> result(new OdbcResult(statement_, dialect));
+    }
+    else
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_Database,
+                                      "Cannot execute ODBC statement with an array of parameters:\n" + error);
+    }
+  }
 }
@@ -56,5 +56,13 @@ namespace OrthancDatabases
     IResult* Execute();
 
     IResult* Execute(const Dictionary& parameters);
+
+    /**
+     * Executes the statement once for each set of parameters, in one
+     * single round-trip to the server, by binding the parameters as
+     * arrays ("SQL_ATTR_PARAMSET_SIZE"). Only the integer and UTF-8
+     * parameters can be bound as arrays.
+     **/
+    void ExecuteArray(const std::vector<const Dictionary*>& parameters);
   };
 }
@@ -39,6 +39,13 @@
 
 namespace OrthancDatabases
 {
+  // Number of rows that are fetched at once by the block cursors
+  static const SQLULEN BLOCK_CURSOR_ROWS = 256;
+
+  // The columns with larger strings are read by "SQLGetData()", one row at a time
+  static const SQLULEN BLOCK_CURSOR_MAX_STRING_LENGTH = 256;
+
+
   static void ThrowCannotReadString()
   {
     throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Cannot read text field");
@@ -179,7 +186,10 @@ namespace OrthancDatabases
     statement_(statement),
     dialect_(dialect),
     first_(true),
-    done_(false)
+    done_(false),
+    block_(false),
+    blockFetched_(0),
+    blockPosition_(0)
   {
     SQLSMALLINT count;
     if (!SQL_SUCCEEDED(SQLNumResultCols(statement_.GetHandle(), &count)))
@@ -216,6 +226,192 @@ namespace OrthancDatabases
       std::string name(reinterpret_cast<const char*>(buffer), length);
       Orthanc::Toolbox::ToLowerCase(typeNames_[i], name);
     }
+
+    columnTypes_.resize(count);
+    for (size_t i = 0; i < columnTypes_.size(); i++)
+    {
+      columnTypes_[i] = GetColumnType(i);
+    }
+
+    if (count > 0)
+    {
+      SetupBlockCursor();
+    }
+  }
+
+
+  OdbcResult::ColumnType OdbcResult::GetColumnType(size_t column) const
+  {
+    const SQLLEN type = types_[column];
+    const std::string& name = typeNames_[column];
+
+    if (type == SQL_INTEGER)
+    {
+      return ColumnType_Integer32;
+    }
+    else if (type == SQL_BIGINT ||
+             (dialect_ == Dialect_PostgreSQL && name == "bigserial"))
+    {
+      return ColumnType_Integer64;
+    }
+    else if (type == SQL_VARCHAR ||
+             name == "varchar" ||
+             (dialect_ == Dialect_MSSQL && name == "nvarchar") ||  // This means UTF-16
+             (dialect_ == Dialect_MySQL && name == "longtext") ||
+             (dialect_ == Dialect_MySQL && name.empty() && type == -9) ||  // Seen in "SQLTables()"
+             (dialect_ == Dialect_PostgreSQL && name == "text") ||
+             (dialect_ == Dialect_SQLite && name == "text") ||
+             (dialect_ == Dialect_SQLite && name == "wvarchar"))  // Seen on Windows with sqliteodbc-0.9998-win32.exe
+    {
+      return ColumnType_String;
+    }
+    else if (type == SQL_NUMERIC)
+    {
+      return ColumnType_Numeric;
+    }
+    else if (type == SQL_BINARY ||
+             (dialect_ == Dialect_PostgreSQL && name == "bytea") ||
+             (dialect_ == Dialect_MySQL && name == "longblob") ||
+             (dialect_ == Dialect_MSSQL && name == "varbinary"))
+    {
+      return ColumnType_Binary;
+    }
+    else
+    {
+      return ColumnType_Unknown;
+    }
+  }
+
+
+  void OdbcResult::SetupBlockCursor()
+  {
+    const size_t count = columnTypes_.size();
+
+    blockWidths_.resize(count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+      switch (columnTypes_[i])
+      {
+        case ColumnType_Integer32:
+        case ColumnType_Integer64:
+          blockWidths_[i] = 0;
+          break;
+
+        case ColumnType_String:
+        {
+          // Maximum number of characters in the column (0 if unbounded)
+          SQLLEN length = 0;
+          if (!SQL_SUCCEEDED(SQLColAttribute(statement_.GetHandle(), i + 1, SQL_DESC_LENGTH, NULL, 0, NULL, &length)) ||
+              length <= 0 ||
+              static_cast<SQLULEN>(length) > BLOCK_CURSOR_MAX_STRING_LENGTH)
+          {
+            return;
+          }
+
+          // Each character takes at most 4 bytes in UTF-8, plus the null termination
+          blockWidths_[i] = 4 * static_cast<size_t>(length) + 1;
+          break;
+        }
+
+        default:
+          return;  // The long or binary values are only read by "SQLGetData()"
+      }
+    }
+
+    if (!SQL_SUCCEEDED(SQLSetStmtAttr(statement_.GetHandle(), SQL_ATTR_ROW_BIND_TYPE, (SQLPOINTER) SQL_BIND_BY_COLUMN, 0)) ||
+        !SQL_SUCCEEDED(SQLSetStmtAttr(statement_.GetHandle(), SQL_ATTR_ROW_ARRAY_SIZE, (SQLPOINTER) BLOCK_CURSOR_ROWS, 0)))
+    {
+      // The driver does not support block cursors
+      SQLSetStmtAttr(statement_.GetHandle(), SQL_ATTR_ROW_ARRAY_SIZE, (SQLPOINTER) 1, 0);
+      return;
+    }
+
+    blockIntegers_.resize(count);
+    blockStrings_.resize(count);
+    blockLengths_.resize(count);
+
+    bool success = SQL_SUCCEEDED(SQLSetStmtAttr(statement_.GetHandle(), SQL_ATTR_ROWS_FETCHED_PTR, &blockFetched_, 0));
+
+    for (size_t i = 0; success && i < count; i++)
+    {
+      blockLengths_[i].resize(BLOCK_CURSOR_ROWS);
+
+      if (blockWidths_[i] == 0)
+      {
+        blockIntegers_[i].resize(BLOCK_CURSOR_ROWS);
+        success = SQL_SUCCEEDED(SQLBindCol(statement_.GetHandle(), i + 1, SQL_C_SBIGINT, &blockIntegers_[i][0],
+                                           sizeof(int64_t), &blockLengths_[i][0]));
+      }
+      else
+      {
+        blockStrings_[i].resize(blockWidths_[i] * BLOCK_CURSOR_ROWS);
+        success = SQL_SUCCEEDED(SQLBindCol(statement_.GetHandle(), i + 1, SQL_C_CHAR, &blockStrings_[i][0],
+                                           blockWidths_[i], &blockLengths_[i][0]));
+      }
+    }
+
+    if (success)
+    {
+      block_ = true;
+    }
+    else
+    {
+      SQLSetStmtAttr(statement_.GetHandle(), SQL_ATTR_ROW_ARRAY_SIZE, (SQLPOINTER) 1, 0);
+      SQLSetStmtAttr(statement_.GetHandle(), SQL_ATTR_ROWS_FETCHED_PTR, NULL, 0);
+      SQLFreeStmt(statement_.GetHandle(), SQL_UNBIND);
+    }
+  }
+
+
+  void OdbcResult::NextBlockRow()
+  {
+    blockPosition_++;
+
+    if (blockPosition_ >= blockFetched_)
+    {
+      SQLRETURN code = SQLFetch(statement_.GetHandle());
+
+      if (code == SQL_NO_DATA)
+      {
+        blockFetched_ = 0;
+      }
+      else if (code != SQL_SUCCESS &&
+               code != SQL_SUCCESS_WITH_INFO)  // The truncations are detected below
+      {
+        statement_.CheckCollision(dialect_);
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Cannot fetch new rows");
+      }
+
+      blockPosition_ = 0;
+    }
+
+    done_ = (blockFetched_ == 0);
+
+    for (size_t i = 0; i < values_.size(); i++)
+    {
+      if (done_ ||
+          blockLengths_[i][blockPosition_] == SQL_NULL_DATA)
+      {
+        SetValue(i, new NullValue);
+      }
+      else if (blockWidths_[i] == 0)
+      {
+        SetValue(i, new Integer64Value(blockIntegers_[i][blockPosition_]));
+      }
+      else
+      {
+        const SQLLEN length = blockLengths_[i][blockPosition_];
+
+        if (length < 0 ||
+            static_cast<size_t>(length) >= blockWidths_[i])
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Truncated text field in block cursor");
+        }
+
+        SetValue(i, new Utf8StringValue(std::string(&blockStrings_[i][blockPosition_ * blockWidths_[i]], length)));
+      }
+    }
   }
 
     
@@ -234,6 +430,14 @@ namespace OrthancDatabases
     {
       LOG(WARNING) << "Cannot close the ODBC cursor: " << std::endl << statement_.FormatError();
     }
+
+    if (block_)
+    {
+      // The statement is cached, and its next results might not use a block cursor
+      SQLSetStmtAttr(statement_.GetHandle(), SQL_ATTR_ROW_ARRAY_SIZE, (SQLPOINTER) 1, 0);
+      SQLSetStmtAttr(statement_.GetHandle(), SQL_ATTR_ROWS_FETCHED_PTR, NULL, 0);
+      SQLFreeStmt(statement_.GetHandle(), SQL_UNBIND);
+    }
   }
     
       
@@ -260,6 +464,12 @@ namespace OrthancDatabases
 
   void OdbcResult::Next() 
   {
+    if (block_)
+    {
+      NextBlockRow();
+      return;
+    }
+
     SQLRETURN code = SQLFetch(statement_.GetHandle());
 
     if (code == SQL_NO_DATA)
@@ -277,97 +487,99 @@ namespace OrthancDatabases
     }
 
     assert(values_.size() == types_.size() &&
-           values_.size() == typeNames_.size());
+           values_.size() == typeNames_.size() &&
+           values_.size() == columnTypes_.size());
 
     for (size_t i = 0; i < values_.size(); i++)
     {
-      SQLLEN type = types_[i];
-      const std::string& name = typeNames_[i];
-          
       if (done_)
       {
         SetValue(i, new NullValue);
+        continue;
       }
-      else if (type == SQL_INTEGER)
+
+      switch (columnTypes_[i])
       {
-        int32_t value;
-        SQLLEN length;
-        if (SQL_SUCCEEDED(SQLGetData(statement_.GetHandle(), i + 1, SQL_INTEGER, &value, sizeof(value), &length)))
+        case ColumnType_Integer32:
         {
-          if (length == SQL_NULL_DATA)
+          int32_t value;
+          SQLLEN length;
+          if (SQL_SUCCEEDED(SQLGetData(statement_.GetHandle(), i + 1, SQL_INTEGER, &value, sizeof(value), &length)))
           {
-            SetValue(i, new NullValue);
+            if (length == SQL_NULL_DATA)
+            {
+              SetValue(i, new NullValue);
+            }
+            else
+            {
+              SetValue(i, new Integer64Value(value));
+            }
           }
           else
           {
-            SetValue(i, new Integer64Value(value));
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Cannot get int32_t field");
           }
+
+          break;
         }
-        else
-        {
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Cannot get int32_t field");
-        }
-      }
-      else if (type == SQL_BIGINT ||
-               (dialect_ == Dialect_PostgreSQL && name == "bigserial"))
-      {
-        int64_t value;
-        SQLLEN length;
-        if (SQL_SUCCEEDED(SQLGetData(statement_.GetHandle(), i + 1, SQL_C_SBIGINT, &value, sizeof(value), &length)))
+
+        case ColumnType_Integer64:
         {
-          if (length == SQL_NULL_DATA)
+          int64_t value;
+          SQLLEN length;
+          if (SQL_SUCCEEDED(SQLGetData(statement_.GetHandle(), i + 1, SQL_C_SBIGINT, &value, sizeof(value), &length)))
           {
-            SetValue(i, new NullValue);
+            if (length == SQL_NULL_DATA)
+            {
+              SetValue(i, new NullValue);
+            }
+            else
+            {
+              SetValue(i, new Integer64Value(value));
+            }
           }
           else
           {
-            SetValue(i, new Integer64Value(value));
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Cannot get int64_t field");
           }
+
+          break;
         }
-        else
+
+        case ColumnType_String:
         {
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Cannot get int64_t field");
+          std::string value;
+          ReadString(value, i, false /* not binary */);
+          SetValue(i, new Utf8StringValue(value));
+          break;
         }
-      }
-      else if (type == SQL_VARCHAR ||
-               name == "varchar" ||
-               (dialect_ == Dialect_MSSQL && name == "nvarchar") ||  // This means UTF-16
-               (dialect_ == Dialect_MySQL && name == "longtext") ||
-               (dialect_ == Dialect_MySQL && name.empty() && type == -9) ||  // Seen in "SQLTables()"
-               (dialect_ == Dialect_PostgreSQL && name == "text") ||
-               (dialect_ == Dialect_SQLite && name == "text") ||
-               (dialect_ == Dialect_SQLite && name == "wvarchar"))  // Seen on Windows with sqliteodbc-0.9998-win32.exe
-      {
-        std::string value;
-        ReadString(value, i, false /* not binary */);
-        SetValue(i, new Utf8StringValue(value));
-      }
-      else if (type == SQL_NUMERIC)
-      {
-        /**
-         * SQL_NUMERIC_STRUCT could be used here, but is much more
-         * complex to deal with:
-         * https://stackoverflow.com/a/9188737/881731
-         **/
+
+        case ColumnType_Numeric:
+        {
+          /**
+           * SQL_NUMERIC_STRUCT could be used here, but is much more
+           * complex to deal with:
+           * https://stackoverflow.com/a/9188737/881731
+           **/
         
-        std::string value;
-        ReadString(value, i, false /* not binary */);
-        SetValue(i, new Integer64Value(boost::lexical_cast<int64_t>(value)));
-      }
-      else if (type == SQL_BINARY ||
-               (dialect_ == Dialect_PostgreSQL && name == "bytea") ||
-               (dialect_ == Dialect_MySQL && name == "longblob") ||
-               (dialect_ == Dialect_MSSQL && name == "varbinary"))
-      {
-        std::string value;
-        ReadString(value, i, true /* binary */);
-        SetValue(i, new BinaryStringValue(value));
-      }
-      else
-      {
-        throw Orthanc::OrthancException(
-          Orthanc::ErrorCode_NotImplemented,
-          "Unknown type in result: " + name + " (" + boost::lexical_cast<std::string>(type) + ")");
+          std::string value;
+          ReadString(value, i, false /* not binary */);
+          SetValue(i, new Integer64Value(boost::lexical_cast<int64_t>(value)));
+          break;
+        }
+
+        case ColumnType_Binary:
+        {
+          std::string value;
+          ReadString(value, i, true /* binary */);
+          SetValue(i, new BinaryStringValue(value));
+          break;
+        }
+
+        default:
+          throw Orthanc::OrthancException(
+            Orthanc::ErrorCode_NotImplemented,
+            "Unknown type in result: " + typeNames_[i] + " (" + boost::lexical_cast<std::string>(types_[i]) + ")");
       }
     }
   }
@@ -38,14 +38,45 @@ namespace OrthancDatabases
   class OdbcResult : public IResult
   {
   private:
+    enum ColumnType
+    {
+      ColumnType_Integer32,
+      ColumnType_Integer64,
+      ColumnType_String,
+      ColumnType_Numeric,
+      ColumnType_Binary,
+      ColumnType_Unknown
+    };
+
     OdbcStatement&            statement_;
     Dialect                   dialect_;
     bool                      first_;
     bool                      done_;
     std::vector<SQLLEN>       types_;
     std::vector<std::string>  typeNames_;
+    std::vector<ColumnType>   columnTypes_;
     std::vector<IValue*>      values_;
 
+    /**
+     * Block cursor: If all the columns have a bounded size, they are
+     * bound to buffers that receive "SQL_ATTR_ROW_ARRAY_SIZE" rows per
+     * call to "SQLFetch()", instead of one row per call followed by
+     * one call to "SQLGetData()" per column.
+     **/
+    bool                                 block_;
+    SQLULEN                              blockFetched_;   // Number of rows in the buffers
+    SQLULEN                              blockPosition_;  // Current row in the buffers
+    std::vector<size_t>                  blockWidths_;    // Width of the string slots (0 for integers)
+    std::vector< std::vector<int64_t> >  blockIntegers_;
+    std::vector<std::string>             blockStrings_;
+    std::vector< std::vector<SQLLEN> >   blockLengths_;
+
+    ColumnType GetColumnType(size_t column) const;
+
+    void SetupBlockCursor();
+
+    void NextBlockRow();
+
     void LoadFirst();
 
     void SetValue(size_t index,
@@ -0,0 +1,160 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+
+#include "AdmissionController.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+namespace OrthancDatabases
+{
+  static const double SHORT_LATENCY_WEIGHT = 0.1;    // Weight of the last transaction in the short-term average
+  static const double LONG_LATENCY_WEIGHT = 0.01;    // Weight of the last transaction in the long-term average
+  static const double LIMIT_SMOOTHING = 0.2;         // Weight of the new estimation of the limit
+  static const double MIN_GRADIENT = 0.5;            // The limit is at most halved at once
+
+
+  AdmissionController::AdmissionController() :
+    maxInFlight_(0),
+    limit_(0),
+    inFlight_(0),
+    shortLatency_(0),
+    longLatency_(0),
+    admitted_(0),
+    rejected_(0)
+  {
+  }
+
+
+  void AdmissionController::SetMaxInFlight(size_t count)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    maxInFlight_ = count;
+    limit_ = static_cast<double>(count);
+  }
+
+
+  size_t AdmissionController::GetMaxInFlight()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return maxInFlight_;
+  }
+
+
+  size_t AdmissionController::GetLimit()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return static_cast<size_t>(limit_);
+  }
+
+
+  bool AdmissionController::Enter(bool critical)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (critical ||
+        maxInFlight_ == 0 ||
+        static_cast<double>(inFlight_ + 1) <= limit_)
+    {
+      inFlight_++;
+      admitted_++;
+      return true;
+    }
+    else
+    {
+      rejected_++;
+      return false;
+    }
+  }
+
+
+  void AdmissionController::Leave(uint64_t latencyMicroseconds)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    assert(inFlight_ > 0);
+    inFlight_--;
+
+    if (maxInFlight_ == 0)
+    {
+      return;
+    }
+
+    const double latency = std::max(1.0, static_cast<double>(latencyMicroseconds));
+
+    if (longLatency_ == 0)
+    {
+      shortLatency_ = latency;
+      longLatency_ = latency;
+    }
+    else
+    {
+      shortLatency_ = (1.0 - SHORT_LATENCY_WEIGHT) * shortLatency_ + SHORT_LATENCY_WEIGHT * latency;
+      longLatency_ = (1.0 - LONG_LATENCY_WEIGHT) * longLatency_ + LONG_LATENCY_WEIGHT * latency;
+
+      if (longLatency_ > 2.0 * shortLatency_)
+      {
+        // The database has recovered from a slowdown, forget about it faster
+        longLatency_ *= 0.95;
+      }
+    }
+
+    // Below 1 if the transactions are getting slower
+    const double gradient = std::max(MIN_GRADIENT, std::min(1.0, longLatency_ / shortLatency_));
+
+    // The square root of the limit is the allowed queue size
+    double estimation = gradient * limit_ + std::sqrt(limit_);
+
+    if (estimation > limit_ &&
+        static_cast<double>(inFlight_ + 1) < limit_ / 2.0)
+    {
+      // Only a fraction of the limit is used, which doesn't tell whether it can grow
+      return;
+    }
+
+    limit_ = (1.0 - LIMIT_SMOOTHING) * limit_ + LIMIT_SMOOTHING * estimation;
+    limit_ = std::max(1.0, std::min(static_cast<double>(maxInFlight_), limit_));
+  }
+
+
+  void AdmissionController::Cancel()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    assert(inFlight_ > 0);
+    inFlight_--;
+  }
+
+
+  void AdmissionController::GetStatistics(uint64_t& admitted,
+                                          uint64_t& rejected,
+                                          size_t& inFlight)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    admitted = admitted_;
+    rejected = rejected_;
+    inFlight = inFlight_;
+  }
+}
@@ -0,0 +1,83 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <stdint.h>
+
+namespace OrthancDatabases
+{
+  /**
+   * Adaptive limit on the number of in-flight transactions, in order
+   * to shed the load if the database slows down (e.g. during a vacuum
+   * or a backup), instead of letting the wait queue of the connections
+   * grow without bound. This class is thread-safe.
+   *
+   * The limit follows the gradient between the long-term and the
+   * short-term moving averages of the latency of the transactions:
+   * It shrinks as soon as the transactions get slower, and grows back
+   * up to the maximum once the latency is stable again. Above the
+   * limit, the non-critical transactions are rejected, whereas the
+   * critical ones (i.e. the writers, that ingest the instances) are
+   * always admitted: They are counted in the in-flight transactions,
+   * which reserves the capacity of the database to them.
+   **/
+  class AdmissionController : public boost::noncopyable
+  {
+  private:
+    boost::mutex  mutex_;
+    size_t        maxInFlight_;     // "0" if the admission control is disabled
+    double        limit_;
+    size_t        inFlight_;
+    double        shortLatency_;    // Moving average over the last transactions, in microseconds
+    double        longLatency_;     // Moving average over a longer period, in microseconds
+    uint64_t      admitted_;
+    uint64_t      rejected_;
+
+  public:
+    AdmissionController();
+
+    // "0" disables the admission control (the default)
+    void SetMaxInFlight(size_t count);
+
+    size_t GetMaxInFlight();
+
+    size_t GetLimit();
+
+    // Returns "false" if the transaction is rejected. Otherwise,
+    // either "Leave()" or "Cancel()" must be called afterward.
+    bool Enter(bool critical);
+
+    // End of a transaction, given its latency
+    void Leave(uint64_t latencyMicroseconds);
+
+    // End of a transaction whose latency is not significant (e.g. failure to get a connection)
+    void Cancel();
+
+    void GetStatistics(uint64_t& admitted,
+                       uint64_t& rejected,
+                       size_t& inFlight);
+  };
+}
@@ -0,0 +1,286 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "AnalyticsExport.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <boost/filesystem/fstream.hpp>
+#include <boost/lexical_cast.hpp>
+
+
+namespace OrthancDatabases
+{
+  static const char* const LAST_SEQ = "last-seq";
+
+
+  template <typename T>
+  static void AppendCsvNumber(std::string& target,
+                              T value)
+  {
+    target += boost::lexical_cast<std::string>(value);
+  }
+
+
+  static std::string FormatFilename(const std::string& table,
+                                    int64_t seq)
+  {
+    // Padded, so that the files are sorted by their names
+    std::string s = boost::lexical_cast<std::string>(seq);
+    if (s.size() < 20)
+    {
+      s.insert(0, 20 - s.size(), '0');
+    }
+
+    return table + "-" + s + ".csv";
+  }
+
+
+  AnalyticsExport::Delta::Delta(int64_t since,
+                                int64_t to) :
+    since_(since),
+    to_(to),
+    resources_("internalId,resourceType,publicId,parentId,seq\n"),
+    tags_("internalId,tagGroup,tagElement,value\n"),
+    attachments_("internalId,fileType,compressedSize,uncompressedSize\n"),
+    empty_(true)
+  {
+    if (since < 0 ||
+        to <= since)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  void AnalyticsExport::Delta::AddResource(int64_t internalId,
+                                           int32_t resourceType,
+                                           const std::string& publicId,
+                                           bool hasParent,
+                                           int64_t parentId,
+                                           int64_t lastSeq)
+  {
+    AppendCsvNumber(resources_, internalId);
+    resources_ += ',';
+    AppendCsvNumber(resources_, resourceType);
+    resources_ += ',';
+    AppendCsvField(resources_, publicId);
+    resources_ += ',';
+
+    if (hasParent)
+    {
+      AppendCsvNumber(resources_, parentId);
+    }
+
+    resources_ += ',';
+    AppendCsvNumber(resources_, lastSeq);
+    resources_ += '\n';
+
+    empty_ = false;
+  }
+
+
+  void AnalyticsExport::Delta::AddMainDicomTag(int64_t internalId,
+                                               int32_t group,
+                                               int32_t element,
+                                               const std::string& value)
+  {
+    AppendCsvNumber(tags_, internalId);
+    tags_ += ',';
+    AppendCsvNumber(tags_, group);
+    tags_ += ',';
+    AppendCsvNumber(tags_, element);
+    tags_ += ',';
+    AppendCsvField(tags_, value);
+    tags_ += '\n';
+
+    empty_ = false;
+  }
+
+
+  void AnalyticsExport::Delta::AddAttachment(int64_t internalId,
+                                             int32_t fileType,
+                                             int64_t compressedSize,
+                                             int64_t uncompressedSize)
+  {
+    AppendCsvNumber(attachments_, internalId);
+    attachments_ += ',';
+    AppendCsvNumber(attachments_, fileType);
+    attachments_ += ',';
+    AppendCsvNumber(attachments_, compressedSize);
+    attachments_ += ',';
+    AppendCsvNumber(attachments_, uncompressedSize);
+    attachments_ += '\n';
+
+    empty_ = false;
+  }
+
+
+  void AnalyticsExport::WriteFile(const std::string& filename,
+                                  const std::string& content) const
+  {
+    // Written to a temporary file, then renamed, so that the readers never see a truncated file
+    const boost::filesystem::path path = directory_ / filename;
+    const boost::filesystem::path tmp = directory_ / (filename + ".tmp");
+
+    {
+      boost::filesystem::ofstream f(tmp, std::ofstream::out | std::ofstream::binary);
+      if (!f.good())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile,
+                                        "Cannot write the analytics export: " + tmp.string());
+      }
+
+      f.write(content.c_str(), content.size());
+      f.close();
+
+      if (!f.good())
+      {
+        boost::system::error_code error;
+        boost::filesystem::remove(tmp, error);
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile,
+                                        "Cannot write the analytics export: " + tmp.string());
+      }
+    }
+
+    try
+    {
+      boost::filesystem::rename(tmp, path);
+    }
+    catch (boost::filesystem::filesystem_error& e)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile,
+                                      "Cannot write the analytics export: " + path.string() + " (" + e.what() + ")");
+    }
+  }
+
+
+  AnalyticsExport::AnalyticsExport() :
+    batchSize_(10000)
+  {
+  }
+
+
+  void AnalyticsExport::SetDirectory(const std::string& directory,
+                                     unsigned int batchSize)
+  {
+    if (batchSize == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    if (!directory.empty())
+    {
+      try
+      {
+        boost::filesystem::create_directories(directory);
+      }
+      catch (boost::filesystem::filesystem_error& e)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_DirectoryExpected,
+                                        "Cannot create the directory of the analytics export: " +
+                                        directory + " (" + e.what() + ")");
+      }
+    }
+
+    directory_ = directory;
+    batchSize_ = batchSize;
+  }
+
+
+  int64_t AnalyticsExport::ReadLastSeq() const
+  {
+    if (!IsEnabled())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    const boost::filesystem::path path = directory_ / LAST_SEQ;
+    if (!boost::filesystem::exists(path))
+    {
+      return 0;
+    }
+
+    boost::filesystem::ifstream f(path, std::ifstream::in | std::ifstream::binary);
+
+    std::string s;
+    f >> s;
+
+    try
+    {
+      return boost::lexical_cast<int64_t>(s);
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                      "Corrupted state of the analytics export: " + path.string());
+    }
+  }
+
+
+  void AnalyticsExport::Write(const Delta& delta)
+  {
+    if (!IsEnabled())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    if (!delta.IsEmpty())
+    {
+      WriteFile(FormatFilename("resources", delta.GetTo()), delta.GetResources());
+      WriteFile(FormatFilename("tags", delta.GetTo()), delta.GetTags());
+      WriteFile(FormatFilename("attachments", delta.GetTo()), delta.GetAttachments());
+    }
+
+    WriteFile(LAST_SEQ, boost::lexical_cast<std::string>(delta.GetTo()) + "\n");
+  }
+
+
+  void AnalyticsExport::AppendCsvField(std::string& target,
+                                       const std::string& value)
+  {
+    if (value.find_first_of(",\"\r\n") == std::string::npos)
+    {
+      target += value;
+    }
+    else
+    {
+      target += '"';
+
+      for (size_t i = 0; i < value.size(); i++)
+      {
+        if (value[i] == '"')
+        {
+          target += "\"\"";
+        }
+        else
+        {
+          target += value[i];
+        }
+      }
+
+      target += '"';
+    }
+  }
+}
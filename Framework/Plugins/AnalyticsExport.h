@@ -0,0 +1,159 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include <stdint.h>
+#include <string>
+
+
+namespace OrthancDatabases
+{
+  /**
+   * Incremental export of the index into CSV files, so that the
+   * analytics (e.g. studies per modality and per day, storage per
+   * institution) can be computed by external tools (e.g. DuckDB,
+   * Spark) instead of running on the production database.
+   *
+   * Each delta covers a range of the sequence numbers of the
+   * "Changes" table, and contains the current content of the
+   * resources that were changed in this range, as three files:
+   * "resources-<seq>.csv", "tags-<seq>.csv" and "attachments-<seq>.csv",
+   * where "<seq>" is the last sequence number of the range, padded
+   * with zeros. A resource that is changed again is exported again
+   * by a later delta, whose rows replace the previous ones. The
+   * deleted resources are not exported. The last exported sequence
+   * number is stored in the "last-seq" file of the directory, which
+   * is written after the files of the delta: A delta that is
+   * interrupted is written again by the next export.
+   *
+   * This class is not thread-safe, as it is only used by the
+   * housekeeping thread.
+   **/
+  class AnalyticsExport : public boost::noncopyable
+  {
+  public:
+    class Delta : public boost::noncopyable
+    {
+    private:
+      int64_t      since_;
+      int64_t      to_;
+      std::string  resources_;
+      std::string  tags_;
+      std::string  attachments_;
+      bool         empty_;
+
+    public:
+      // Covers the sequence numbers in the range "]since, to]"
+      Delta(int64_t since,
+            int64_t to);
+
+      int64_t GetSince() const
+      {
+        return since_;
+      }
+
+      int64_t GetTo() const
+      {
+        return to_;
+      }
+
+      bool IsEmpty() const
+      {
+        return empty_;
+      }
+
+      const std::string& GetResources() const
+      {
+        return resources_;
+      }
+
+      const std::string& GetTags() const
+      {
+        return tags_;
+      }
+
+      const std::string& GetAttachments() const
+      {
+        return attachments_;
+      }
+
+      // "parentId" is ignored if "hasParent" is "false" (patients)
+      void AddResource(int64_t internalId,
+                       int32_t resourceType,
+                       const std::string& publicId,
+                       bool hasParent,
+                       int64_t parentId,
+                       int64_t lastSeq);
+
+      void AddMainDicomTag(int64_t internalId,
+                           int32_t group,
+                           int32_t element,
+                           const std::string& value);
+
+      void AddAttachment(int64_t internalId,
+                         int32_t fileType,
+                         int64_t compressedSize,
+                         int64_t uncompressedSize);
+    };
+
+  private:
+    boost::filesystem::path  directory_;
+    unsigned int             batchSize_;
+
+    void WriteFile(const std::string& filename,
+                   const std::string& content) const;
+
+  public:
+    AnalyticsExport();
+
+    /**
+     * An empty directory disables the export. Each delta covers at
+     * most "batchSize" sequence numbers of the "Changes" table.
+     **/
+    void SetDirectory(const std::string& directory,
+                      unsigned int batchSize);
+
+    bool IsEnabled() const
+    {
+      return !directory_.empty();
+    }
+
+    unsigned int GetBatchSize() const
+    {
+      return batchSize_;
+    }
+
+    // Returns "0" if nothing was exported yet
+    int64_t ReadLastSeq() const;
+
+    // Writes the files of the delta (if not empty), then moves the last sequence number
+    void Write(const Delta& delta);
+
+    // RFC 4180: The fields are quoted if need be, with doubled quotes
+    static void AppendCsvField(std::string& target,
+                               const std::string& value);
+  };
+}
@@ -0,0 +1,201 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "AttachmentCache.h"
+
+#include <OrthancException.h>
+
+#include <cassert>
+
+
+namespace OrthancDatabases
+{
+  void AttachmentCache::Remove(Entries::iterator entry)
+  {
+    assert(entry != entries_.end() &&
+           entry->second.get() != NULL &&
+           currentSize_ >= entry->second->size());
+
+    currentSize_ -= entry->second->size();
+    index_.Invalidate(entry->first);
+    entries_.erase(entry);
+  }
+
+
+  void AttachmentCache::RemoveOldest()
+  {
+    Entries::iterator oldest = entries_.find(index_.GetOldest());
+    Remove(oldest);
+  }
+
+
+  AttachmentCache::AttachmentCache() :
+    maxSize_(0),
+    currentSize_(0)
+  {
+  }
+
+
+  void AttachmentCache::SetMaxSize(uint64_t maxSize)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    maxSize_ = maxSize;
+
+    while (currentSize_ > maxSize_)
+    {
+      RemoveOldest();
+    }
+  }
+
+
+  uint64_t AttachmentCache::GetMaxSize()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return maxSize_;
+  }
+
+
+  uint64_t AttachmentCache::GetCurrentSize()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return currentSize_;
+  }
+
+
+  bool AttachmentCache::IsEnabled()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return maxSize_ != 0;
+  }
+
+
+  bool AttachmentCache::Lookup(Content& target,
+                               const std::string& uuid,
+                               OrthancPluginContentType type)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    const Key key(uuid, static_cast<int32_t>(type));
+    Entries::const_iterator found = entries_.find(key);
+
+    if (found == entries_.end())
+    {
+      return false;
+    }
+    else
+    {
+      target = found->second;
+      index_.MakeMostRecent(key);
+      return true;
+    }
+  }
+
+
+  bool AttachmentCache::LookupRange(std::string& target,
+                                    const std::string& uuid,
+                                    OrthancPluginContentType type,
+                                    uint64_t start,
+                                    size_t length)
+  {
+    Content content;
+
+    if (Lookup(content, uuid, type))
+    {
+      assert(content.get() != NULL);
+
+      if (start > content->size() ||
+          length > content->size() - start)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRange);
+      }
+
+      target.assign(*content, static_cast<size_t>(start), length);
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  void AttachmentCache::Store(const std::string& uuid,
+                              OrthancPluginContentType type,
+                              const void* content,
+                              size_t size)
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (static_cast<uint64_t>(size) > maxSize_)
+      {
+        return;
+      }
+    }
+
+    // Copy the content outside of the mutex
+    Content copy(size == 0 ? new std::string :
+                 new std::string(reinterpret_cast<const char*>(content), size));
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    const Key key(uuid, static_cast<int32_t>(type));
+
+    Entries::iterator found = entries_.find(key);
+    if (found != entries_.end())
+    {
+      // The attachment was stored by a concurrent read
+      index_.MakeMostRecent(key);
+      return;
+    }
+
+    if (static_cast<uint64_t>(size) > maxSize_)
+    {
+      return;  // The cache was shrunk in the meantime
+    }
+
+    while (currentSize_ + size > maxSize_)
+    {
+      RemoveOldest();
+    }
+
+    entries_[key] = copy;
+    index_.Add(key);
+    currentSize_ += size;
+  }
+
+
+  void AttachmentCache::Invalidate(const std::string& uuid,
+                                   OrthancPluginContentType type)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Entries::iterator found = entries_.find(Key(uuid, static_cast<int32_t>(type)));
+    if (found != entries_.end())
+    {
+      Remove(found);
+    }
+  }
+}
@@ -0,0 +1,100 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include <Cache/LeastRecentlyUsedIndex.h>
+#include <orthanc/OrthancCDatabasePlugin.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <map>
+#include <stdint.h>
+#include <string>
+
+
+namespace OrthancDatabases
+{
+  /**
+   * Read-through cache of the uncompressed content of the attachments
+   * in front of the storage area, indexed by "(uuid, type)". As the
+   * attachments never change once they are created, the entries only
+   * have to be invalidated if the attachment is removed. The ranges
+   * are extracted from the whole files in the cache. The cache is
+   * bounded by the total size of its entries, and evicts the least
+   * recently used entries. This class is thread-safe.
+   **/
+  class AttachmentCache : public boost::noncopyable
+  {
+  public:
+    typedef boost::shared_ptr<const std::string>  Content;
+
+  private:
+    typedef std::pair<std::string, int32_t>  Key;
+    typedef std::map<Key, Content>           Entries;
+
+    boost::mutex                          mutex_;
+    uint64_t                              maxSize_;
+    uint64_t                              currentSize_;
+    Entries                               entries_;
+    Orthanc::LeastRecentlyUsedIndex<Key>  index_;
+
+    void RemoveOldest();
+
+    void Remove(Entries::iterator entry);
+
+  public:
+    AttachmentCache();
+
+    // "0" disables the cache, which is the default
+    void SetMaxSize(uint64_t maxSize);
+
+    uint64_t GetMaxSize();
+
+    uint64_t GetCurrentSize();
+
+    bool IsEnabled();
+
+    // The returned content is shared, and can be read outside of the mutex
+    bool Lookup(Content& target,
+                const std::string& uuid,
+                OrthancPluginContentType type);
+
+    bool LookupRange(std::string& target,
+                     const std::string& uuid,
+                     OrthancPluginContentType type,
+                     uint64_t start,
+                     size_t length);
+
+    // The files that are larger than the cache are not stored
+    void Store(const std::string& uuid,
+               OrthancPluginContentType type,
+               const void* content,
+               size_t size);
+
+    void Invalidate(const std::string& uuid,
+                    OrthancPluginContentType type);
+  };
+}
@@ -0,0 +1,195 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "CacheInvalidations.h"
+
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <boost/lexical_cast.hpp>
+
+
+namespace OrthancDatabases
+{
+  // Duration of the window of dates that are polled again, in order
+  // to catch the transactions that commit late. It must be shorter
+  // than the retention of the rows.
+  static const unsigned int POLLING_WINDOW_SECONDS = 60;
+
+  static const char SEPARATOR = '|';
+
+
+  CacheInvalidations::CacheInvalidations() :
+    enabled_(false),
+    server_(Orthanc::Toolbox::GenerateUuid()),
+    isPolling_(false)
+  {
+  }
+
+
+  void CacheInvalidations::SetEnabled(bool enabled)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    enabled_ = enabled;
+    isPolling_ = false;
+    applied_.clear();
+  }
+
+
+  std::string CacheInvalidations::FormatPayload(const std::string& server,
+                                                CacheInvalidationType type,
+                                                int64_t internalId,
+                                                const std::string& value)
+  {
+    if (server.find(SEPARATOR) != std::string::npos)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    // The value comes last, as it might contain the separator
+    return (server + SEPARATOR + boost::lexical_cast<std::string>(static_cast<int>(type)) + SEPARATOR +
+            boost::lexical_cast<std::string>(internalId) + SEPARATOR + value);
+  }
+
+
+  bool CacheInvalidations::ParsePayload(std::string& server,
+                                        CacheInvalidationType& type,
+                                        int64_t& internalId,
+                                        std::string& value,
+                                        const std::string& payload)
+  {
+    const size_t first = payload.find(SEPARATOR);
+    if (first == std::string::npos)
+    {
+      return false;
+    }
+
+    const size_t second = payload.find(SEPARATOR, first + 1);
+    if (second == std::string::npos)
+    {
+      return false;
+    }
+
+    const size_t third = payload.find(SEPARATOR, second + 1);
+    if (third == std::string::npos)
+    {
+      return false;
+    }
+
+    int t;
+
+    try
+    {
+      t = boost::lexical_cast<int>(payload.substr(first + 1, second - first - 1));
+      internalId = boost::lexical_cast<int64_t>(payload.substr(second + 1, third - second - 1));
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+      return false;
+    }
+
+    switch (t)
+    {
+      case CacheInvalidationType_DeletedResource:
+      case CacheInvalidationType_Label:
+      case CacheInvalidationType_NewStudy:
+      case CacheInvalidationType_GlobalProperty:
+        type = static_cast<CacheInvalidationType>(t);
+        break;
+
+      default:
+        return false;
+    }
+
+    server = payload.substr(0, first);
+    value = payload.substr(third + 1);
+    return true;
+  }
+
+
+  bool CacheInvalidations::GetPollingStart(std::string& since,
+                                           const boost::posix_time::ptime& now)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (isPolling_)
+    {
+      // Forget about the rows that have left the window. A row is
+      // applied after its date, so the rows that were applied more
+      // than twice the window ago cannot be read again, even with
+      // some skew between the clocks.
+      const boost::posix_time::ptime limit = now - boost::posix_time::seconds(2 * POLLING_WINDOW_SECONDS);
+
+      Applied::iterator it = applied_.begin();
+      while (it != applied_.end())
+      {
+        if (it->second < limit)
+        {
+          applied_.erase(it++);
+        }
+        else
+        {
+          ++it;
+        }
+      }
+
+      since = FormatDate(now - boost::posix_time::seconds(POLLING_WINDOW_SECONDS));
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  void CacheInvalidations::StartPolling()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    isPolling_ = true;
+    applied_.clear();
+  }
+
+
+  bool CacheInvalidations::MarkApplied(int64_t seq,
+                                       const boost::posix_time::ptime& now)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (!isPolling_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    return applied_.insert(std::make_pair(seq, now)).second;
+  }
+
+
+  std::string CacheInvalidations::FormatDate(const boost::posix_time::ptime& date)
+  {
+    // Fixed-width format (without the fractional seconds), whose
+    // lexicographical order is the chronological order
+    return boost::posix_time::to_iso_string(
+      boost::posix_time::ptime(date.date(), boost::posix_time::seconds(date.time_of_day().total_seconds())));
+  }
+}
@@ -0,0 +1,118 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <map>
+#include <stdint.h>
+#include <string>
+
+
+namespace OrthancDatabases
+{
+  enum CacheInvalidationType
+  {
+    CacheInvalidationType_DeletedResource = 0,  // The value is the public ID of the resource
+    CacheInvalidationType_Label = 1,            // The value is the label
+    CacheInvalidationType_NewStudy = 2,         // No value
+    CacheInvalidationType_GlobalProperty = 3    // The internal ID is the property, the value is the server identifier
+  };
+
+
+  /**
+   * Invalidations of the in-process caches, that are exchanged
+   * between the Orthanc servers sharing the same database. Each
+   * server publishes the invalidations inside the transactions of its
+   * writes, tagged with its own identifier, and applies the
+   * invalidations of the other servers. On PostgreSQL, they are
+   * notified through LISTEN/NOTIFY. On the other databases, they are
+   * appended to the "CacheInvalidations" table, that is polled by
+   * date. As the sequence numbers and the dates are allocated before
+   * the commit, a row can become visible long after the rows with
+   * greater sequence numbers. The rows whose date is within a time
+   * window are thus read again at each poll, which catches the
+   * transactions that last less than this window (including the
+   * clock skew between the servers), and this class remembers the
+   * rows that were already applied. This class is thread-safe.
+   **/
+  class CacheInvalidations : public boost::noncopyable
+  {
+  private:
+    typedef std::map<int64_t, boost::posix_time::ptime>  Applied;
+
+    boost::mutex       mutex_;
+    bool               enabled_;
+    std::string        server_;
+    bool               isPolling_;
+    Applied            applied_;   // Sequence numbers of the window that were applied, with the time of their application
+
+  public:
+    CacheInvalidations();
+
+    // Must be called at startup
+    void SetEnabled(bool enabled);
+
+    bool IsEnabled() const
+    {
+      return enabled_;
+    }
+
+    // Random identifier of this process
+    const std::string& GetServer() const
+    {
+      return server_;
+    }
+
+    static std::string FormatPayload(const std::string& server,
+                                     CacheInvalidationType type,
+                                     int64_t internalId,
+                                     const std::string& value);
+
+    // Returns "false" if the payload is badly formatted
+    static bool ParsePayload(std::string& server,
+                             CacheInvalidationType& type,
+                             int64_t& internalId,
+                             std::string& value,
+                             const std::string& payload);
+
+    /**
+     * Returns "false" if the polling has not started yet. Otherwise,
+     * "since" is the date (in the format of the "date" column) from
+     * which the rows must be read.
+     **/
+    bool GetPollingStart(std::string& since,
+                         const boost::posix_time::ptime& now);
+
+    // The caches must be cleared after having started the polling
+    void StartPolling();
+
+    // Returns "false" if the row was already applied by a previous poll
+    bool MarkApplied(int64_t seq,
+                     const boost::posix_time::ptime& now);
+
+    static std::string FormatDate(const boost::posix_time::ptime& date);
+  };
+}
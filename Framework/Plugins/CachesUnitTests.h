@@ -0,0 +1,537 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "AttachmentCache.h"
+#include "CacheInvalidations.h"
+#include "CountResourcesCache.h"
+#include "FindProjectionsCache.h"
+#include "FindResultsCache.h"
+#include "GlobalPropertiesCache.h"
+#include "KeysetPaginationCache.h"
+#include "LabelsCache.h"
+#include "StatisticsCache.h"
+#include "TimedLruCache.h"
+
+#include <OrthancException.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <gtest/gtest.h>
+#include <list>
+#include <set>
+
+
+TEST(Caches, TimedLruCache)
+{
+  const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+  OrthancDatabases::TimedLruCache<int> cache;
+  ASSERT_FALSE(cache.IsEnabled());
+
+  int value;
+  cache.Store("a", 1, 10, now);
+  ASSERT_FALSE(cache.Lookup(value, "a", 10, now));
+
+  // The values never expire by default
+  cache.SetMaxSize(2);
+  ASSERT_TRUE(cache.IsEnabled());
+  cache.Store("a", 1, 10, now);
+  cache.Store("b", 2, 10, now);
+  ASSERT_TRUE(cache.Lookup(value, "a", 10, now + boost::posix_time::hours(24 * 365)));
+  ASSERT_EQ(1, value);
+
+  // "b" is the least recently used value, as "a" was read last
+  cache.Store("c", 3, 10, now);
+  ASSERT_EQ(2u, cache.GetSize());
+  ASSERT_FALSE(cache.Lookup(value, "b", 10, now));
+  ASSERT_TRUE(cache.Lookup(value, "c", 10, now));
+  ASSERT_EQ(3, value);
+
+  // Storing an existing key replaces its value
+  cache.Store("c", 4, 11, now);
+  ASSERT_EQ(2u, cache.GetSize());
+  ASSERT_TRUE(cache.Lookup(value, "c", 11, now));
+  ASSERT_EQ(4, value);
+
+  // A different last change drops the value
+  ASSERT_FALSE(cache.Lookup(value, "c", 12, now));
+  ASSERT_EQ(1u, cache.GetSize());
+
+  cache.SetTimeToLive(10);
+  cache.Store("d", 5, 10, now);
+  ASSERT_TRUE(cache.Lookup(value, "d", 10, now + boost::posix_time::seconds(9)));
+  ASSERT_FALSE(cache.Lookup(value, "d", 10, now + boost::posix_time::seconds(10)));
+  ASSERT_EQ(1u, cache.GetSize());
+
+  cache.Clear();
+  ASSERT_EQ(0u, cache.GetSize());
+  ASSERT_TRUE(cache.IsEnabled());
+
+  cache.Store("e", 6, 10, now);
+  cache.SetMaxSize(0);
+  ASSERT_FALSE(cache.IsEnabled());
+  ASSERT_EQ(0u, cache.GetSize());
+}
+
+
+TEST(Caches, StatisticsCache)
+{
+  OrthancDatabases::StatisticsCache cache;
+  ASSERT_FALSE(cache.IsEnabled());
+
+  const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+  OrthancDatabases::StatisticsCache::Statistics a;
+  a.patientsCount_ = 1;
+  a.studiesCount_ = 2;
+  a.seriesCount_ = 3;
+  a.instancesCount_ = 4;
+  a.compressedSize_ = 5;
+  a.uncompressedSize_ = 6;
+
+  // Nothing is stored while the cache is disabled
+  OrthancDatabases::StatisticsCache::Statistics b;
+  cache.Store(a, cache.GetRevision(), now);
+  ASSERT_FALSE(cache.Lookup(b, now));
+
+  cache.SetTimeToLive(10);
+  ASSERT_TRUE(cache.IsEnabled());
+
+  cache.Store(a, cache.GetRevision(), now);
+  ASSERT_TRUE(cache.Lookup(b, now + boost::posix_time::seconds(9)));
+  ASSERT_EQ(1, b.patientsCount_);
+  ASSERT_EQ(4, b.instancesCount_);
+  ASSERT_EQ(6, b.uncompressedSize_);
+  ASSERT_FALSE(cache.Lookup(b, now + boost::posix_time::seconds(10)));
+
+  // A write invalidates the snapshot
+  cache.Store(a, cache.GetRevision(), now);
+  cache.Invalidate();
+  ASSERT_FALSE(cache.Lookup(b, now));
+
+  // The statistics that were read before a write are discarded
+  const uint64_t revision = cache.GetRevision();
+  cache.Invalidate();
+  cache.Store(a, revision, now);
+  ASSERT_FALSE(cache.Lookup(b, now));
+
+  cache.Store(a, cache.GetRevision(), now);
+  ASSERT_TRUE(cache.Lookup(b, now));
+}
+
+
+TEST(Caches, AttachmentCache)
+{
+  OrthancDatabases::AttachmentCache cache;
+  ASSERT_FALSE(cache.IsEnabled());
+
+  OrthancDatabases::AttachmentCache::Content content;
+  std::string s;
+
+  // Nothing is stored while the cache is disabled
+  cache.Store("a", OrthancPluginContentType_Dicom, "hello", 5);
+  ASSERT_FALSE(cache.Lookup(content, "a", OrthancPluginContentType_Dicom));
+
+  cache.SetMaxSize(10);
+  ASSERT_TRUE(cache.IsEnabled());
+
+  cache.Store("a", OrthancPluginContentType_Dicom, "hello", 5);
+  cache.Store("b", OrthancPluginContentType_Dicom, "world", 5);
+  ASSERT_EQ(10u, cache.GetCurrentSize());
+  ASSERT_FALSE(cache.Lookup(content, "a", OrthancPluginContentType_DicomAsJson));
+  ASSERT_TRUE(cache.Lookup(content, "a", OrthancPluginContentType_Dicom));
+  ASSERT_EQ("hello", *content);
+
+  ASSERT_TRUE(cache.LookupRange(s, "b", OrthancPluginContentType_Dicom, 1, 3));
+  ASSERT_EQ("orl", s);
+  ASSERT_TRUE(cache.LookupRange(s, "b", OrthancPluginContentType_Dicom, 5, 0));
+  ASSERT_TRUE(s.empty());
+  ASSERT_THROW(cache.LookupRange(s, "b", OrthancPluginContentType_Dicom, 3, 3), Orthanc::OrthancException);
+
+  // "a" is the least recently used file, as "b" was read last
+  cache.Store("c", OrthancPluginContentType_Dicom, "!", 1);
+  ASSERT_EQ(6u, cache.GetCurrentSize());
+  ASSERT_FALSE(cache.Lookup(content, "a", OrthancPluginContentType_Dicom));
+  ASSERT_TRUE(cache.Lookup(content, "b", OrthancPluginContentType_Dicom));
+  ASSERT_TRUE(cache.Lookup(content, "c", OrthancPluginContentType_Dicom));
+
+  // The shared content survives the eviction
+  cache.Store("d", OrthancPluginContentType_Dicom, "0123456789", 10);
+  ASSERT_EQ(10u, cache.GetCurrentSize());
+  ASSERT_FALSE(cache.Lookup(content, "c", OrthancPluginContentType_Dicom));
+  ASSERT_EQ("!", *content);
+
+  // Files larger than the cache are not stored
+  cache.Store("e", OrthancPluginContentType_Dicom, "0123456789a", 11);
+  ASSERT_FALSE(cache.Lookup(content, "e", OrthancPluginContentType_Dicom));
+  ASSERT_TRUE(cache.Lookup(content, "d", OrthancPluginContentType_Dicom));
+
+  cache.Invalidate("d", OrthancPluginContentType_Dicom);
+  ASSERT_FALSE(cache.Lookup(content, "d", OrthancPluginContentType_Dicom));
+  ASSERT_EQ(0u, cache.GetCurrentSize());
+
+  cache.Store("f", OrthancPluginContentType_Dicom, "", 0);
+  ASSERT_TRUE(cache.Lookup(content, "f", OrthancPluginContentType_Dicom));
+  ASSERT_TRUE(content->empty());
+}
+
+
+TEST(Caches, CountResourcesCache)
+{
+  const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+  OrthancDatabases::CountResourcesCache cache;
+  ASSERT_FALSE(cache.IsEnabled());
+
+  uint64_t count;
+  cache.Store("a", 42, now);
+  ASSERT_FALSE(cache.Lookup(count, "a", now));
+
+  cache.SetTimeToLive(10);
+  ASSERT_TRUE(cache.IsEnabled());
+  cache.Store("a", 42, now);
+  cache.Store("b", 43, now);
+  ASSERT_EQ(2u, cache.GetSize());
+
+  count = 0;
+  ASSERT_TRUE(cache.Lookup(count, "a", now + boost::posix_time::seconds(9)));
+  ASSERT_EQ(42u, count);
+  ASSERT_FALSE(cache.Lookup(count, "c", now));
+
+  // Expired entries are removed
+  ASSERT_FALSE(cache.Lookup(count, "b", now + boost::posix_time::seconds(10)));
+  ASSERT_EQ(1u, cache.GetSize());
+
+  cache.SetTimeToLive(0);
+  ASSERT_FALSE(cache.IsEnabled());
+  ASSERT_EQ(0u, cache.GetSize());
+}
+
+
+TEST(Caches, LabelsCache)
+{
+  const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+  OrthancDatabases::LabelsCache cache;
+  ASSERT_FALSE(cache.IsEnabled());
+
+  OrthancDatabases::LabelsCache::Resources a, b, c;
+  a.push_back(1);
+  a.push_back(2);
+  a.push_back(5);
+
+  // Nothing is stored while the cache is disabled
+  cache.Store("a", a, cache.GetRevision(), now);
+  ASSERT_FALSE(cache.IsCached("a", now));
+
+  cache.SetTimeToLive(10);
+  ASSERT_TRUE(cache.IsEnabled());
+
+  a.clear();
+  a.push_back(1);
+  a.push_back(2);
+  a.push_back(5);
+  b.push_back(2);
+  b.push_back(3);
+  b.push_back(5);
+  cache.Store("a", a, cache.GetRevision(), now);
+  cache.Store("b", b, cache.GetRevision(), now);
+  ASSERT_EQ(2u, cache.GetSize());
+
+  std::set<std::string> labels;
+  labels.insert("a");
+  labels.insert("b");
+
+  OrthancDatabases::LabelsCache::Resources target;
+  ASSERT_TRUE(cache.Evaluate(target, labels, OrthancDatabases::LabelsConstraint_All, now));
+  ASSERT_EQ(2u, target.size());
+  ASSERT_EQ(2, target[0]);
+  ASSERT_EQ(5, target[1]);
+
+  ASSERT_TRUE(cache.Evaluate(target, labels, OrthancDatabases::LabelsConstraint_Any, now));
+  ASSERT_EQ(4u, target.size());
+  ASSERT_EQ(1, target[0]);
+  ASSERT_EQ(5, target[3]);
+
+  // "None" gives the resources to be excluded
+  ASSERT_TRUE(cache.Evaluate(target, labels, OrthancDatabases::LabelsConstraint_None, now));
+  ASSERT_EQ(4u, target.size());
+
+  labels.insert("c");
+  ASSERT_FALSE(cache.Evaluate(target, labels, OrthancDatabases::LabelsConstraint_Any, now));
+  ASSERT_TRUE(target.empty());
+
+  // The labels expire
+  ASSERT_TRUE(cache.IsCached("a", now + boost::posix_time::seconds(9)));
+  ASSERT_FALSE(cache.IsCached("a", now + boost::posix_time::seconds(10)));
+  ASSERT_EQ(1u, cache.GetSize());
+
+  // A label that was read before a write is discarded
+  const uint64_t revision = cache.GetRevision();
+  cache.InvalidateLabel("b");
+  ASSERT_FALSE(cache.IsCached("b", now));
+  c.push_back(3);
+  cache.Store("c", c, revision, now);
+  ASSERT_FALSE(cache.IsCached("c", now));
+
+  std::list<std::string> all;
+  all.push_back("a");
+  cache.StoreAllLabels(all, cache.GetRevision(), now);
+  all.clear();
+  ASSERT_TRUE(cache.LookupAllLabels(all, now));
+  ASSERT_EQ(1u, all.size());
+
+  // The deletion of resources only discards the list of all the labels
+  cache.Store("c", c, cache.GetRevision(), now);
+  cache.InvalidateListOfLabels();
+  ASSERT_FALSE(cache.LookupAllLabels(all, now));
+  ASSERT_TRUE(cache.IsCached("c", now));
+
+  cache.SetTimeToLive(0);
+  ASSERT_FALSE(cache.IsEnabled());
+  ASSERT_EQ(0u, cache.GetSize());
+}
+
+
+TEST(Caches, GlobalPropertiesCache)
+{
+  const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+  OrthancDatabases::GlobalPropertiesCache cache;
+  ASSERT_FALSE(cache.IsEnabled());
+
+  bool found;
+  std::string value;
+  cache.Store("", 6, true, "1", cache.GetRevision(), now);
+  ASSERT_FALSE(cache.Lookup(found, value, "", 6, now));
+
+  cache.SetTimeToLive(10);
+  ASSERT_TRUE(cache.IsEnabled());
+
+  cache.Store("", 6, true, "1", cache.GetRevision(), now);
+  cache.Store("server", 6, false, "", cache.GetRevision(), now);
+  ASSERT_EQ(2u, cache.GetSize());
+
+  ASSERT_TRUE(cache.Lookup(found, value, "", 6, now));
+  ASSERT_TRUE(found);
+  ASSERT_EQ("1", value);
+  ASSERT_TRUE(cache.Lookup(found, value, "server", 6, now));
+  ASSERT_FALSE(found);
+  ASSERT_FALSE(cache.Lookup(found, value, "", 6, now + boost::posix_time::seconds(11)));
+  ASSERT_EQ(1u, cache.GetSize());
+
+  // A write between the read of the revision and the storage
+  const uint64_t revision = cache.GetRevision();
+  cache.Invalidate("", 4);
+  cache.Store("", 4, true, "2", revision, now);
+  ASSERT_FALSE(cache.Lookup(found, value, "", 4, now));
+
+  // The internal properties of the plugins and the anonymization sequence
+  ASSERT_TRUE(OrthancDatabases::GlobalPropertiesCache::IsCacheable(1));
+  ASSERT_FALSE(OrthancDatabases::GlobalPropertiesCache::IsCacheable(3));
+  ASSERT_FALSE(OrthancDatabases::GlobalPropertiesCache::IsCacheable(10));
+  ASSERT_FALSE(OrthancDatabases::GlobalPropertiesCache::IsCacheable(19));
+  cache.Store("", 10, true, "3", cache.GetRevision(), now);
+  ASSERT_FALSE(cache.Lookup(found, value, "", 10, now));
+
+  cache.InvalidateAll();
+  ASSERT_EQ(0u, cache.GetSize());
+}
+
+
+TEST(Caches, FindResultsCache)
+{
+  const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+  OrthancDatabases::FindResultsCache cache;
+  ASSERT_FALSE(cache.IsEnabled());
+
+  std::string answer;
+  cache.Store("a", "hello", 10, now);
+  ASSERT_FALSE(cache.Lookup(answer, "a", 10, now));
+
+  cache.SetTimeToLive(10);
+  ASSERT_TRUE(cache.IsEnabled());
+  cache.Store("a", "hello", 10, now);
+  cache.Store("b", "world", 10, now);
+  cache.Store("c", "!", 10, now);
+  ASSERT_EQ(3u, cache.GetSize());
+
+  ASSERT_TRUE(cache.Lookup(answer, "a", 10, now + boost::posix_time::seconds(9)));
+  ASSERT_EQ("hello", answer);
+  ASSERT_FALSE(cache.Lookup(answer, "d", 10, now));
+
+  // A new change drops the answer
+  ASSERT_FALSE(cache.Lookup(answer, "b", 11, now));
+  ASSERT_EQ(2u, cache.GetSize());
+
+  // Expired entries are removed
+  ASSERT_FALSE(cache.Lookup(answer, "c", 10, now + boost::posix_time::seconds(10)));
+  ASSERT_EQ(1u, cache.GetSize());
+
+  // Too large answers are not stored
+  cache.Store("e", std::string(2 * 1024 * 1024, 'x'), 10, now);
+  ASSERT_FALSE(cache.Lookup(answer, "e", 10, now));
+
+  cache.SetTimeToLive(0);
+  ASSERT_FALSE(cache.IsEnabled());
+  ASSERT_EQ(0u, cache.GetSize());
+}
+
+
+TEST(Caches, FindProjectionsCache)
+{
+  OrthancDatabases::FindProjectionsCache cache;
+  cache.SetMaxSize(2);
+
+  OrthancDatabases::FindProjectionsCache::Projection projection;
+  projection.oneInstanceCTEs_ = "cte";
+  projection.branches_.push_back("lookup");
+  projection.branches_.push_back("tags");
+  cache.Store("a", projection);
+
+  projection.oneInstanceCTEs_.clear();
+  projection.branches_.resize(1);
+  cache.Store("b", projection);
+
+  OrthancDatabases::FindProjectionsCache::Projection found;
+  ASSERT_TRUE(cache.Lookup(found, "a"));
+  ASSERT_EQ("cte", found.oneInstanceCTEs_);
+  ASSERT_EQ(2u, found.branches_.size());
+  ASSERT_EQ("tags", found.branches_[1]);
+
+  // The least recently used shape is dropped
+  cache.Store("c", projection);
+  ASSERT_FALSE(cache.Lookup(found, "b"));
+  ASSERT_TRUE(cache.Lookup(found, "a"));
+  ASSERT_TRUE(cache.Lookup(found, "c"));
+  ASSERT_TRUE(found.oneInstanceCTEs_.empty());
+  ASSERT_EQ(1u, found.branches_.size());
+
+  cache.SetMaxSize(0);
+  ASSERT_FALSE(cache.Lookup(found, "a"));
+  cache.Store("a", projection);
+  ASSERT_FALSE(cache.Lookup(found, "a"));
+}
+
+
+TEST(Caches, KeysetPaginationCache)
+{
+  const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+  OrthancDatabases::KeysetPaginationCache cache;
+  ASSERT_FALSE(cache.IsEnabled());
+
+  OrthancDatabases::FindKeysetBound bound;
+  bound.AddValue("20240101");
+  bound.AddNull();
+  bound.SetPublicId("study");
+
+  cache.SetMaxSize(256);
+  ASSERT_TRUE(cache.IsEnabled());
+  cache.Store("lookup|100", bound, 10, now);
+
+  OrthancDatabases::FindKeysetBound found;
+  ASSERT_TRUE(cache.Lookup(found, "lookup|100", 10, now));
+  ASSERT_EQ(2u, found.GetValuesCount());
+  ASSERT_EQ("20240101", found.GetValue(0));
+  ASSERT_FALSE(found.IsNull(0));
+  ASSERT_TRUE(found.IsNull(1));
+  ASSERT_EQ("study", found.GetPublicId());
+
+  // The bounds expire after one minute by default
+  ASSERT_FALSE(cache.Lookup(found, "lookup|100", 10, now + boost::posix_time::seconds(60)));
+
+  // A new change drops the bound
+  cache.Store("lookup|100", bound, 10, now);
+  ASSERT_FALSE(cache.Lookup(found, "lookup|100", 11, now));
+  ASSERT_EQ(0u, cache.GetSize());
+
+  cache.Store("lookup|100", bound, 10, now);
+  cache.Clear();
+  ASSERT_FALSE(cache.Lookup(found, "lookup|100", 10, now));
+}
+
+
+TEST(Caches, CacheInvalidations)
+{
+  using namespace OrthancDatabases;
+
+  std::string server, value;
+  CacheInvalidationType type;
+  int64_t id;
+
+  const std::string payload = CacheInvalidations::FormatPayload("server", CacheInvalidationType_Label, 42, "a|b");
+  ASSERT_TRUE(CacheInvalidations::ParsePayload(server, type, id, value, payload));
+  ASSERT_EQ("server", server);
+  ASSERT_EQ(CacheInvalidationType_Label, type);
+  ASSERT_EQ(42, id);
+  ASSERT_EQ("a|b", value);
+
+  ASSERT_TRUE(CacheInvalidations::ParsePayload(server, type, id, value, "s|2|-1|"));
+  ASSERT_EQ(CacheInvalidationType_NewStudy, type);
+  ASSERT_EQ(-1, id);
+  ASSERT_TRUE(value.empty());
+
+  ASSERT_FALSE(CacheInvalidations::ParsePayload(server, type, id, value, "42"));
+  ASSERT_FALSE(CacheInvalidations::ParsePayload(server, type, id, value, "s|1|2"));
+  ASSERT_FALSE(CacheInvalidations::ParsePayload(server, type, id, value, "s|9|2|x"));
+  ASSERT_FALSE(CacheInvalidations::ParsePayload(server, type, id, value, "s|a|2|x"));
+
+  CacheInvalidations invalidations;
+  ASSERT_FALSE(invalidations.IsEnabled());
+  ASSERT_FALSE(invalidations.GetServer().empty());
+
+  invalidations.SetEnabled(true);
+  ASSERT_TRUE(invalidations.IsEnabled());
+
+  const boost::posix_time::ptime now(boost::gregorian::date(2024, 6, 1), boost::posix_time::time_duration(10, 30, 15, 500));
+  ASSERT_EQ("20240601T103015", CacheInvalidations::FormatDate(now));
+
+  std::string since;
+  ASSERT_FALSE(invalidations.GetPollingStart(since, now));
+  ASSERT_THROW(invalidations.MarkApplied(10, now), Orthanc::OrthancException);
+
+  invalidations.StartPolling();
+  ASSERT_TRUE(invalidations.GetPollingStart(since, now));
+  ASSERT_EQ("20240601T102915", since);
+
+  // A transaction with a lower sequence number might commit late,
+  // the rows of the window are read again by the next polls
+  ASSERT_TRUE(invalidations.MarkApplied(5001, now));
+  ASSERT_TRUE(invalidations.MarkApplied(5003, now));
+  ASSERT_FALSE(invalidations.MarkApplied(5001, now));
+  ASSERT_TRUE(invalidations.MarkApplied(5002, now + boost::posix_time::seconds(30)));
+  ASSERT_FALSE(invalidations.MarkApplied(5003, now + boost::posix_time::seconds(30)));
+  ASSERT_TRUE(invalidations.MarkApplied(10, now + boost::posix_time::seconds(30)));  // Late commit
+  ASSERT_FALSE(invalidations.MarkApplied(10, now + boost::posix_time::seconds(31)));
+
+  // The rows that were applied long ago cannot be read anymore, and are forgotten
+  ASSERT_TRUE(invalidations.GetPollingStart(since, now + boost::posix_time::seconds(121)));
+  ASSERT_EQ("20240601T103116", since);
+  ASSERT_TRUE(invalidations.MarkApplied(5001, now + boost::posix_time::seconds(121)));
+  ASSERT_FALSE(invalidations.MarkApplied(5002, now + boost::posix_time::seconds(121)));
+  ASSERT_FALSE(invalidations.MarkApplied(10, now + boost::posix_time::seconds(121)));
+}
@@ -0,0 +1,72 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "TimedLruCache.h"
+
+
+namespace OrthancDatabases
+{
+  /**
+   * Remembers the results of "ExecuteCount()" for a short period of
+   * time, so that the same count is not recomputed each time a user
+   * interface is refreshed. The key identifies the lookup. The cached
+   * counts are not invalidated by the writes: They can be as old as
+   * the time-to-live. This class is thread-safe.
+   **/
+  class CountResourcesCache : public boost::noncopyable
+  {
+  private:
+    TimedLruCache<uint64_t>  cache_;
+
+  public:
+    // "0" disables the cache
+    void SetTimeToLive(unsigned int seconds);
+
+    bool IsEnabled()
+    {
+      return cache_.IsEnabled();
+    }
+
+    bool Lookup(uint64_t& count,
+                const std::string& key,
+                const boost::posix_time::ptime& now)
+    {
+      return cache_.Lookup(count, key, 0, now);
+    }
+
+    void Store(const std::string& key,
+               uint64_t count,
+               const boost::posix_time::ptime& now)
+    {
+      cache_.Store(key, count, 0, now);
+    }
+
+    size_t GetSize()
+    {
+      return cache_.GetSize();
+    }
+  };
+}
@@ -64,6 +64,13 @@ namespace OrthancDatabases
      * "Orthanc::OrthancPluginDatabase::mutex_" in Orthanc >= 1.9.2
      * (the global mutex limited to backward compatibility with older
      * plugins). It is left here for additional safety.
+     *
+     * As a consequence, there is no point in dispatching the
+     * read-only callbacks onto a pool of connections: The core never
+     * invokes two callbacks of the V2 API concurrently. Furthermore,
+     * a transaction of the V2 API spans several callbacks, that must
+     * all see the uncommitted writes of this transaction, hence of
+     * this single connection.
      **/
     
     std::unique_ptr<IDatabaseBackend>  backend_;
@@ -279,6 +286,14 @@ namespace OrthancDatabases
       OrthancPluginDatabaseAnswerDicomTag(context_, database_, &tag);
     }
 
+    virtual void AnswerResourceDicomTag(int64_t resource,
+                                        uint16_t group,
+                                        uint16_t element,
+                                        const std::string& value) ORTHANC_OVERRIDE
+    {
+      throw std::runtime_error("Cannot answer with the DICOM tags of several resources");
+    }
+
     virtual void AnswerExportedResource(int64_t                    seq,
                                         OrthancPluginResourceType  resourceType,
                                         const std::string&         publicId,
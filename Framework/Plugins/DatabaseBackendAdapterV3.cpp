@@ -95,6 +95,7 @@ namespace OrthancDatabases
     
     _OrthancPluginDatabaseAnswerType            answerType_;
     std::list<std::string>                      stringsStore_;
+    std::list<std::string>::iterator            nextString_;  // First unused string of "stringsStore_"
     
     std::vector<OrthancPluginAttachment>        attachments_;
     std::vector<OrthancPluginChange>            changes_;
@@ -109,8 +110,31 @@ namespace OrthancDatabases
     
     const char* StoreString(const std::string& s)
     {
-      stringsStore_.push_back(s);
-      return stringsStore_.back().c_str();
+      // The strings of the previous answers are overwritten, which
+      // reuses their buffers, and keeps the returned pointers valid
+      if (nextString_ == stringsStore_.end())
+      {
+        stringsStore_.push_back(s);
+        return stringsStore_.back().c_str();
+      }
+      else
+      {
+        nextString_->assign(s);
+        const char* value = nextString_->c_str();
+        ++nextString_;
+        return value;
+      }
+    }
+
+    template <typename T>
+    static void ReleaseLargeVector(std::vector<T>& v,
+                                   size_t maxCapacity)
+    {
+      if (v.capacity() > maxCapacity)
+      {
+        std::vector<T> empty;
+        v.swap(empty);
+      }
     }
 
     void SetupAnswerType(_OrthancPluginDatabaseAnswerType type)
@@ -129,6 +153,7 @@ namespace OrthancDatabases
     Output() :
       answerType_(_OrthancPluginDatabaseAnswerType_None)
     {
+      nextString_ = stringsStore_.end();
     }
 
     void Clear()
@@ -182,7 +207,7 @@ namespace OrthancDatabases
       }
       
       answerType_ = _OrthancPluginDatabaseAnswerType_None;
-      stringsStore_.clear();
+      nextString_ = stringsStore_.begin();
       events_.clear();
       
       assert(attachments_.empty());
@@ -198,6 +223,38 @@ namespace OrthancDatabases
     }
 
 
+    /**
+     * The outputs are reused by the successive transactions, which
+     * keeps the capacity of their containers. This method frees the
+     * containers that have grown because of some large answer, so
+     * that the idle outputs don't hold too much memory.
+     **/
+    void ReleaseLargeBuffers()
+    {
+      static const size_t MAX_CAPACITY = 1024;
+
+      Clear();
+
+      ReleaseLargeVector(attachments_, MAX_CAPACITY);
+      ReleaseLargeVector(changes_, MAX_CAPACITY);
+      ReleaseLargeVector(tags_, MAX_CAPACITY);
+      ReleaseLargeVector(exported_, MAX_CAPACITY);
+      ReleaseLargeVector(events_, MAX_CAPACITY);
+      ReleaseLargeVector(integers32_, MAX_CAPACITY);
+      ReleaseLargeVector(integers64_, MAX_CAPACITY);
+      ReleaseLargeVector(matches_, MAX_CAPACITY);
+      ReleaseLargeVector(metadata_, MAX_CAPACITY);
+      ReleaseLargeVector(stringAnswers_, MAX_CAPACITY);
+
+      while (stringsStore_.size() > MAX_CAPACITY)
+      {
+        stringsStore_.pop_back();
+      }
+
+      nextString_ = stringsStore_.begin();
+    }
+
+
     OrthancPluginErrorCode ReadAnswersCount(uint32_t& target) const
     {
       switch (answerType_)
@@ -518,6 +575,15 @@ namespace OrthancDatabases
     }
     
 
+    virtual void AnswerResourceDicomTag(int64_t resource,
+                                        uint16_t group,
+                                        uint16_t element,
+                                        const std::string& value) ORTHANC_OVERRIDE
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+    }
+    
+
     virtual void AnswerExportedResource(int64_t                    seq,
                                         OrthancPluginResourceType  resourceType,
                                         const std::string&         publicId,
@@ -638,20 +704,67 @@ namespace OrthancDatabases
   class DatabaseBackendAdapterV3::Transaction : public boost::noncopyable
   {
   private:
+    // The outputs of the finished transactions, that are reused by
+    // the next transactions in order to avoid reallocating their
+    // containers. There are at most as many outputs as concurrent
+    // transactions, hence as connections.
+    static boost::mutex          outputsMutex_;
+    static std::vector<Output*>  outputs_;
+
     IndexConnectionsPool&                            pool_;
     std::unique_ptr<IndexConnectionsPool::Accessor>  accessor_;
     std::unique_ptr<Output>                          output_;
+
+    static Output* AcquireOutput()
+    {
+      {
+        boost::mutex::scoped_lock lock(outputsMutex_);
+
+        if (!outputs_.empty())
+        {
+          Output* output = outputs_.back();
+          outputs_.pop_back();
+          return output;
+        }
+      }
+
+      return new Output;
+    }
     
   public:
     Transaction(IndexConnectionsPool& pool) :
       pool_(pool),
       accessor_(new IndexConnectionsPool::Accessor(pool)),
-      output_(new Output)
+      output_(AcquireOutput())
     {
     }
 
     ~Transaction()
     {
+      try
+      {
+        output_->ReleaseLargeBuffers();
+
+        boost::mutex::scoped_lock lock(outputsMutex_);
+        outputs_.push_back(output_.get());
+        output_.release();
+      }
+      catch (...)
+      {
+        // The output is deleted by "output_"
+      }
+    }
+
+    static void ClearOutputs()
+    {
+      boost::mutex::scoped_lock lock(outputsMutex_);
+
+      for (size_t i = 0; i < outputs_.size(); i++)
+      {
+        delete outputs_[i];
+      }
+
+      outputs_.clear();
     }
 
     IndexBackend& GetBackend() const
@@ -670,6 +783,10 @@ namespace OrthancDatabases
     }
   };
 
+
+  boost::mutex  DatabaseBackendAdapterV3::Transaction::outputsMutex_;
+  std::vector<DatabaseBackendAdapterV3::Output*>  DatabaseBackendAdapterV3::Transaction::outputs_;
+
   
   static OrthancPluginErrorCode ReadAnswersCount(OrthancPluginDatabaseTransaction* transaction,
                                                  uint32_t* target /* out */)
@@ -1924,6 +2041,8 @@ namespace OrthancDatabases
     {
       fprintf(stderr, "The Orthanc core has not destructed the index backend, internal error\n");
     }
+
+    Transaction::ClearOutputs();
   }
 }
 
@@ -27,16 +27,28 @@
 #  if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 0)
 
 #include "IndexConnectionsPool.h"
+#include "IngestStatistics.h"
 #include "MessagesToolbox.h"
+#include "RequestsRecorder.h"
+#include "TracesExporter.h"
 
 #include <OrthancDatabasePlugin.pb.h>  // Include protobuf messages
+#include <google/protobuf/arena.h>
 
 #include <Logging.h>
+#include <MultiThreading/SharedMessageQueue.h>
 #include <OrthancException.h>
+#include <Toolbox.h>
 
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
 #include <stdexcept>
+#include <fstream>
 #include <list>
+#include <set>
 #include <string>
+#include <vector>
 #include <cassert>
 
 
@@ -104,6 +116,7 @@ namespace OrthancDatabases
     Orthanc::DatabasePluginMessages::GetMainDicomTags::Response*         getMainDicomTags_;
     Orthanc::DatabasePluginMessages::LookupAttachment::Response*         lookupAttachment_;
     Orthanc::DatabasePluginMessages::LookupResources::Response*          lookupResources_;
+    PrefetchedResources*                                                 prefetched_;
 
 #if ORTHANC_PLUGINS_HAS_CHANGES_EXTENDED == 1
     Orthanc::DatabasePluginMessages::GetChangesExtended::Response*       getChangesExtended_;
@@ -120,6 +133,7 @@ namespace OrthancDatabases
       getMainDicomTags_ = NULL;
       lookupAttachment_ = NULL;
       lookupResources_ = NULL;
+      prefetched_ = NULL;
 
 #if ORTHANC_PLUGINS_HAS_CHANGES_EXTENDED == 1
       getChangesExtended_ = NULL;
@@ -189,6 +203,12 @@ namespace OrthancDatabases
       lookupResources_ = &lookupResources;
     }
     
+    Output(PrefetchedResources& prefetched)
+    {
+      Clear();
+      prefetched_ = &prefetched;
+    }
+    
     virtual void SignalDeletedAttachment(const std::string& uuid,
                                          int32_t            contentType,
                                          uint64_t           uncompressedSize,
@@ -350,6 +370,21 @@ namespace OrthancDatabases
       }
     }
 
+    virtual void AnswerResourceDicomTag(int64_t resource,
+                                        uint16_t group,
+                                        uint16_t element,
+                                        const std::string& value) ORTHANC_OVERRIDE
+    {
+      if (prefetched_ != NULL)
+      {
+        prefetched_->AddMainDicomTag(resource, group, element, value);
+      }
+      else
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+      }
+    }
+
     virtual void AnswerExportedResource(int64_t                    seq,
                                         OrthancPluginResourceType  resourceType,
                                         const std::string&         publicId,
@@ -485,22 +520,27 @@ namespace OrthancDatabases
 
       case Orthanc::DatabasePluginMessages::OPERATION_START_TRANSACTION:
       {
-        std::unique_ptr<IndexConnectionsPool::Accessor> transaction(new IndexConnectionsPool::Accessor(pool));
+        TransactionType type;
 
         switch (request.start_transaction().type())
         {
           case Orthanc::DatabasePluginMessages::TRANSACTION_READ_ONLY:
-            transaction->GetManager().StartTransaction(TransactionType_ReadOnly);
+            type = TransactionType_ReadOnly;
             break;
 
           case Orthanc::DatabasePluginMessages::TRANSACTION_READ_WRITE:
-            transaction->GetManager().StartTransaction(TransactionType_ReadWrite);
+            type = TransactionType_ReadWrite;
             break;
 
           default:
             throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
         }
 
+        // Read-only transactions are routed to the read-only replica, if any
+        std::unique_ptr<IndexConnectionsPool::Accessor> transaction(new IndexConnectionsPool::Accessor(pool, type));
+        transaction->SetOperation("START_TRANSACTION");
+        transaction->StartTransaction(type);  // Postponed if group commit is enabled
+
         response.mutable_start_transaction()->set_transaction(reinterpret_cast<intptr_t>(transaction.release()));
         break;
       }
@@ -661,10 +701,132 @@ namespace OrthancDatabases
   }
 
   
+  /**
+   * Postpones the write operations whose answer is empty, and that
+   * the Orthanc core issues after "CreateInstance()" while ingesting
+   * an instance, or while logging the exported resources. Returns "false" if the operation must be executed
+   * immediately (after having flushed the previous deferred writes).
+   **/
+  static bool DeferTransactionOperation(DeferredWrites& writes,
+                                        const Orthanc::DatabasePluginMessages::TransactionRequest& request)
+  {
+    switch (request.operation())
+    {
+      case Orthanc::DatabasePluginMessages::OPERATION_SET_RESOURCES_CONTENT:
+      {
+        if (!writes.CanAdd(DeferredWrites::WriteKind_ResourcesContent))
+        {
+          return false;
+        }
+
+        for (int i = 0; i < request.set_resources_content().tags().size(); i++)
+        {
+          if (request.set_resources_content().tags(i).group() > 0xffffu ||
+              request.set_resources_content().tags(i).element() > 0xffffu)
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+          }
+        }
+
+        for (int i = 0; i < request.set_resources_content().tags().size(); i++)
+        {
+          const Orthanc::DatabasePluginMessages::SetResourcesContent_Request_Tag& tag = request.set_resources_content().tags(i);
+
+          if (tag.is_identifier())
+          {
+            writes.AddIdentifierTag(tag.resource_id(), static_cast<uint16_t>(tag.group()),
+                                    static_cast<uint16_t>(tag.element()), tag.value());
+          }
+          else
+          {
+            writes.AddMainDicomTag(tag.resource_id(), static_cast<uint16_t>(tag.group()),
+                                   static_cast<uint16_t>(tag.element()), tag.value());
+          }
+        }
+
+        for (int i = 0; i < request.set_resources_content().metadata().size(); i++)
+        {
+          writes.AddResourceMetadata(request.set_resources_content().metadata(i).resource_id(),
+                                     request.set_resources_content().metadata(i).metadata(),
+                                     request.set_resources_content().metadata(i).value());
+        }
+
+        return true;
+      }
+
+      case Orthanc::DatabasePluginMessages::OPERATION_ADD_ATTACHMENT:
+      {
+        if (!writes.CanAdd(DeferredWrites::WriteKind_Attachment))
+        {
+          return false;
+        }
+
+        OrthancPluginAttachment attachment;
+        attachment.uuid = request.add_attachment().attachment().uuid().c_str();
+        attachment.contentType = request.add_attachment().attachment().content_type();
+        attachment.uncompressedSize = request.add_attachment().attachment().uncompressed_size();
+        attachment.uncompressedHash = request.add_attachment().attachment().uncompressed_hash().c_str();
+        attachment.compressionType = request.add_attachment().attachment().compression_type();
+        attachment.compressedSize = request.add_attachment().attachment().compressed_size();
+        attachment.compressedHash = request.add_attachment().attachment().compressed_hash().c_str();
+
+        writes.AddAttachment(request.add_attachment().id(), attachment, request.add_attachment().revision());
+        return true;
+      }
+
+      case Orthanc::DatabasePluginMessages::OPERATION_SET_METADATA:
+      {
+        if (!writes.CanAdd(DeferredWrites::WriteKind_Metadata))
+        {
+          return false;
+        }
+
+        writes.AddMetadata(request.set_metadata().id(), request.set_metadata().metadata_type(),
+                           request.set_metadata().value(), request.set_metadata().revision());
+        return true;
+      }
+
+      case Orthanc::DatabasePluginMessages::OPERATION_LOG_CHANGE:
+      {
+        if (!writes.CanAdd(DeferredWrites::WriteKind_Change))
+        {
+          return false;
+        }
+
+        writes.AddChange(request.log_change().change_type(), request.log_change().resource_id(),
+                         Convert(request.log_change().resource_type()), request.log_change().date());
+        return true;
+      }
+
+      case Orthanc::DatabasePluginMessages::OPERATION_LOG_EXPORTED_RESOURCE:
+      {
+        if (!writes.CanAdd(DeferredWrites::WriteKind_ExportedResource))
+        {
+          return false;
+        }
+
+        writes.AddExportedResource(Convert(request.log_exported_resource().resource_type()),
+                                   request.log_exported_resource().public_id(),
+                                   request.log_exported_resource().modality(),
+                                   request.log_exported_resource().date(),
+                                   request.log_exported_resource().patient_id(),
+                                   request.log_exported_resource().study_instance_uid(),
+                                   request.log_exported_resource().series_instance_uid(),
+                                   request.log_exported_resource().sop_instance_uid());
+        return true;
+      }
+
+      default:
+        return false;
+    }
+  }
+
+
   static void ProcessTransactionOperation(Orthanc::DatabasePluginMessages::TransactionResponse& response,
                                           const Orthanc::DatabasePluginMessages::TransactionRequest& request,
                                           IndexBackend& backend,
-                                          DatabaseManager& manager)
+                                          DatabaseManager& manager,
+                                          PrefetchedResources& prefetched)
   {
     switch (request.operation())
     {
@@ -734,7 +896,10 @@ namespace OrthancDatabases
         typedef std::map<int32_t, std::string>  Values;
 
         Values values;
-        backend.GetAllMetadata(values, manager, request.get_all_metadata().id());
+        if (!prefetched.LookupAllMetadata(values, request.get_all_metadata().id()))
+        {
+          backend.GetAllMetadata(values, manager, request.get_all_metadata().id());
+        }
 
         response.mutable_get_all_metadata()->mutable_metadata()->Reserve(values.size());
         for (Values::const_iterator it = values.begin(); it != values.end(); ++it)
@@ -750,31 +915,17 @@ namespace OrthancDatabases
       
       case Orthanc::DatabasePluginMessages::OPERATION_GET_ALL_PUBLIC_IDS:
       {
-        std::list<std::string>  values;
-        backend.GetAllPublicIds(values, manager, Convert(request.get_all_public_ids().resource_type()));
-
-        response.mutable_get_all_public_ids()->mutable_ids()->Reserve(values.size());
-        for (std::list<std::string>::const_iterator it = values.begin(); it != values.end(); ++it)
-        {
-          response.mutable_get_all_public_ids()->add_ids(*it);
-        }
-        
+        backend.GetAllPublicIds(*response.mutable_get_all_public_ids()->mutable_ids(), manager,
+                                Convert(request.get_all_public_ids().resource_type()));
         break;
       }
       
       case Orthanc::DatabasePluginMessages::OPERATION_GET_ALL_PUBLIC_IDS_WITH_LIMITS:
       {
-        std::list<std::string>  values;
-        backend.GetAllPublicIds(values, manager, Convert(request.get_all_public_ids_with_limits().resource_type()),
+        backend.GetAllPublicIds(*response.mutable_get_all_public_ids_with_limits()->mutable_ids(), manager,
+                                Convert(request.get_all_public_ids_with_limits().resource_type()),
                                 request.get_all_public_ids_with_limits().since(),
                                 request.get_all_public_ids_with_limits().limit());
-
-        response.mutable_get_all_public_ids_with_limits()->mutable_ids()->Reserve(values.size());
-        for (std::list<std::string>::const_iterator it = values.begin(); it != values.end(); ++it)
-        {
-          response.mutable_get_all_public_ids_with_limits()->add_ids(*it);
-        }
-        
         break;
       }
       
@@ -809,9 +960,42 @@ namespace OrthancDatabases
 
       case Orthanc::DatabasePluginMessages::OPERATION_GET_CHILDREN_INTERNAL_ID:
       {
+        if (!backend.IsChildrenPrefetch() ||
+            manager.IsReadWriteTransaction())
+        {
+          // No prefetching: Write the children straight into the response
+          backend.GetChildrenInternalId(*response.mutable_get_children_internal_id()->mutable_ids(),
+                                        manager, request.get_children_internal_id().id());
+          break;
+        }
+
         std::list<int64_t>  values;
         backend.GetChildrenInternalId(values, manager, request.get_children_internal_id().id());
 
+        if (values.size() > 1)
+        {
+          // Orthanc will most probably read the main DICOM tags and
+          // the metadata of each child: Read them in two queries
+          prefetched.Clear();
+
+          for (std::list<int64_t>::const_iterator it = values.begin(); it != values.end(); ++it)
+          {
+            prefetched.AddResource(*it);
+          }
+
+          Output output(prefetched);
+          backend.GetResourcesMainDicomTags(output, manager, values);
+
+          std::map<int64_t, std::map<int32_t, std::string> > metadata;
+          backend.GetResourcesMetadata(metadata, manager, values);
+
+          for (std::map<int64_t, std::map<int32_t, std::string> >::const_iterator
+                 it = metadata.begin(); it != metadata.end(); ++it)
+          {
+            prefetched.SetMetadata(it->first, it->second);
+          }
+        }
+
         response.mutable_get_children_internal_id()->mutable_ids()->Reserve(values.size());
         for (std::list<int64_t>::const_iterator it = values.begin(); it != values.end(); ++it)
         {
@@ -823,14 +1007,26 @@ namespace OrthancDatabases
       
       case Orthanc::DatabasePluginMessages::OPERATION_GET_CHILDREN_PUBLIC_ID:
       {
-        std::list<std::string>  values;
-        backend.GetChildrenPublicId(values, manager, request.get_children_public_id().id());
+        // Stream the children by batches, so that series with many
+        // instances don't need all of them in an intermediate list
+        static const uint32_t BATCH_SIZE = 1000;
+
+        std::vector<std::string>  values;
+        values.reserve(BATCH_SIZE);
 
-        response.mutable_get_children_public_id()->mutable_ids()->Reserve(values.size());
-        for (std::list<std::string>::const_iterator it = values.begin(); it != values.end(); ++it)
+        int64_t last = -1;
+        bool done;
+
+        do
         {
-          response.mutable_get_children_public_id()->add_ids(*it);
+          done = backend.GetChildrenPublicId(values, last, manager, request.get_children_public_id().id(), BATCH_SIZE);
+
+          for (size_t i = 0; i < values.size(); i++)
+          {
+            response.mutable_get_children_public_id()->add_ids()->swap(values[i]);
+          }
         }
+        while (!done);
         
         break;
       }
@@ -868,7 +1064,10 @@ namespace OrthancDatabases
       case Orthanc::DatabasePluginMessages::OPERATION_GET_MAIN_DICOM_TAGS:
       {
         Output output(*response.mutable_get_main_dicom_tags());
-        backend.GetMainDicomTags(output, manager, request.get_main_dicom_tags().id());
+        if (!prefetched.LookupMainDicomTags(output, request.get_main_dicom_tags().id()))
+        {
+          backend.GetMainDicomTags(output, manager, request.get_main_dicom_tags().id());
+        }
         break;
       }
 
@@ -915,15 +1114,8 @@ namespace OrthancDatabases
       
       case Orthanc::DatabasePluginMessages::OPERATION_LIST_AVAILABLE_ATTACHMENTS:
       {
-        std::list<int32_t>  values;
-        backend.ListAvailableAttachments(values, manager, request.list_available_attachments().id());
-
-        response.mutable_list_available_attachments()->mutable_attachments()->Reserve(values.size());
-        for (std::list<int32_t>::const_iterator it = values.begin(); it != values.end(); ++it)
-        {
-          response.mutable_list_available_attachments()->add_attachments(*it);
-        }
-        
+        backend.ListAvailableAttachments(*response.mutable_list_available_attachments()->mutable_attachments(),
+                                         manager, request.list_available_attachments().id());
         break;
       }
       
@@ -1223,15 +1415,8 @@ namespace OrthancDatabases
       
       case Orthanc::DatabasePluginMessages::OPERATION_GET_CHILDREN_METADATA:
       {
-        std::list<std::string> values;
-        backend.GetChildrenMetadata(values, manager, request.get_children_metadata().id(), request.get_children_metadata().metadata());
-
-        response.mutable_get_children_metadata()->mutable_values()->Reserve(values.size());
-        for (std::list<std::string>::const_iterator it = values.begin(); it != values.end(); ++it)
-        {
-          response.mutable_get_children_metadata()->add_values(*it);
-        }
-
+        backend.GetChildrenMetadata(*response.mutable_get_children_metadata()->mutable_values(), manager,
+                                    request.get_children_metadata().id(), request.get_children_metadata().metadata());
         break;
       }
       
@@ -1301,21 +1486,13 @@ namespace OrthancDatabases
       
       case Orthanc::DatabasePluginMessages::OPERATION_LIST_LABELS:
       {
-        std::list<std::string>  labels;
-
         if (request.list_labels().single_resource())
         {
-          backend.ListLabels(labels, manager, request.list_labels().id());
+          backend.ListLabels(*response.mutable_list_labels()->mutable_labels(), manager, request.list_labels().id());
         }
         else
         {
-          backend.ListAllLabels(labels, manager);
-        }
-
-        response.mutable_list_available_attachments()->mutable_attachments()->Reserve(labels.size());
-        for (std::list<std::string>::const_iterator it = labels.begin(); it != labels.end(); ++it)
-        {
-          response.mutable_list_labels()->add_labels(*it);
+          backend.ListAllLabels(*response.mutable_list_labels()->mutable_labels(), manager);
         }
         
         break;
@@ -1342,117 +1519,1756 @@ namespace OrthancDatabases
   }
 
   
-  static OrthancPluginErrorCode CallBackend(OrthancPluginMemoryBuffer64* serializedResponse,
-                                            void* rawPool,
-                                            const void* requestData,
-                                            uint64_t requestSize)
+#define CASE_OPERATION(name)                                       \
+  case Orthanc::DatabasePluginMessages::OPERATION_ ## name:         \
+    return #name;
+
+  static const char* GetOperationName(Orthanc::DatabasePluginMessages::DatabaseOperation operation)
   {
-    Orthanc::DatabasePluginMessages::Request request;
-    if (!request.ParseFromArray(requestData, requestSize))
+    switch (operation)
     {
-      LOG(ERROR) << "Cannot parse message from the Orthanc core using protobuf";
-      return OrthancPluginErrorCode_InternalError;
+      CASE_OPERATION(GET_SYSTEM_INFORMATION)
+      CASE_OPERATION(OPEN)
+      CASE_OPERATION(CLOSE)
+      CASE_OPERATION(FLUSH_TO_DISK)
+      CASE_OPERATION(START_TRANSACTION)
+      CASE_OPERATION(UPGRADE)
+      CASE_OPERATION(FINALIZE_TRANSACTION)
+#if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 3)
+      CASE_OPERATION(MEASURE_LATENCY)
+#endif
+
+      default:
+        return "UNKNOWN";
     }
+  }
 
-    if (rawPool == NULL)
+
+  static const char* GetOperationName(Orthanc::DatabasePluginMessages::TransactionOperation operation)
+  {
+    switch (operation)
     {
-      LOG(ERROR) << "Received a NULL pointer from the database";
-      return OrthancPluginErrorCode_InternalError;
+      CASE_OPERATION(ROLLBACK)
+      CASE_OPERATION(COMMIT)
+      CASE_OPERATION(ADD_ATTACHMENT)
+      CASE_OPERATION(CLEAR_CHANGES)
+      CASE_OPERATION(CLEAR_EXPORTED_RESOURCES)
+      CASE_OPERATION(DELETE_ATTACHMENT)
+      CASE_OPERATION(DELETE_METADATA)
+      CASE_OPERATION(DELETE_RESOURCE)
+      CASE_OPERATION(GET_ALL_METADATA)
+      CASE_OPERATION(GET_ALL_PUBLIC_IDS)
+      CASE_OPERATION(GET_ALL_PUBLIC_IDS_WITH_LIMITS)
+      CASE_OPERATION(GET_CHANGES)
+#if ORTHANC_PLUGINS_HAS_CHANGES_EXTENDED == 1
+      CASE_OPERATION(GET_CHANGES_EXTENDED)
+#endif
+      CASE_OPERATION(GET_CHILDREN_INTERNAL_ID)
+      CASE_OPERATION(GET_CHILDREN_PUBLIC_ID)
+      CASE_OPERATION(GET_EXPORTED_RESOURCES)
+      CASE_OPERATION(GET_LAST_CHANGE)
+      CASE_OPERATION(GET_LAST_EXPORTED_RESOURCE)
+      CASE_OPERATION(GET_MAIN_DICOM_TAGS)
+      CASE_OPERATION(GET_PUBLIC_ID)
+      CASE_OPERATION(GET_RESOURCES_COUNT)
+      CASE_OPERATION(GET_RESOURCE_TYPE)
+      CASE_OPERATION(GET_TOTAL_COMPRESSED_SIZE)
+      CASE_OPERATION(GET_TOTAL_UNCOMPRESSED_SIZE)
+      CASE_OPERATION(IS_PROTECTED_PATIENT)
+      CASE_OPERATION(LIST_AVAILABLE_ATTACHMENTS)
+      CASE_OPERATION(LOG_CHANGE)
+      CASE_OPERATION(LOG_EXPORTED_RESOURCE)
+      CASE_OPERATION(LOOKUP_ATTACHMENT)
+      CASE_OPERATION(LOOKUP_GLOBAL_PROPERTY)
+#if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 3)
+      CASE_OPERATION(UPDATE_AND_GET_STATISTICS)
+      CASE_OPERATION(INCREMENT_GLOBAL_PROPERTY)
+#endif
+      CASE_OPERATION(LOOKUP_METADATA)
+      CASE_OPERATION(LOOKUP_PARENT)
+      CASE_OPERATION(LOOKUP_RESOURCE)
+      CASE_OPERATION(SELECT_PATIENT_TO_RECYCLE)
+      CASE_OPERATION(SELECT_PATIENT_TO_RECYCLE_WITH_AVOID)
+      CASE_OPERATION(SET_GLOBAL_PROPERTY)
+      CASE_OPERATION(CLEAR_MAIN_DICOM_TAGS)
+      CASE_OPERATION(SET_METADATA)
+      CASE_OPERATION(SET_PROTECTED_PATIENT)
+      CASE_OPERATION(IS_DISK_SIZE_ABOVE)
+      CASE_OPERATION(LOOKUP_RESOURCES)
+      CASE_OPERATION(CREATE_INSTANCE)
+      CASE_OPERATION(SET_RESOURCES_CONTENT)
+      CASE_OPERATION(GET_CHILDREN_METADATA)
+      CASE_OPERATION(GET_LAST_CHANGE_INDEX)
+      CASE_OPERATION(LOOKUP_RESOURCE_AND_PARENT)
+      CASE_OPERATION(ADD_LABEL)
+      CASE_OPERATION(REMOVE_LABEL)
+      CASE_OPERATION(LIST_LABELS)
+#if ORTHANC_PLUGINS_HAS_INTEGRATED_FIND == 1
+      CASE_OPERATION(FIND)
+      CASE_OPERATION(COUNT_RESOURCES)
+#endif
+
+      default:
+        return "UNKNOWN";
     }
+  }
 
-    IndexConnectionsPool& pool = *reinterpret_cast<IndexConnectionsPool*>(rawPool);
+#undef CASE_OPERATION
 
-    try
+
+  static const char* GetOperationName(const Orthanc::DatabasePluginMessages::Request& request)
+  {
+    switch (request.type())
     {
-      Orthanc::DatabasePluginMessages::Response response;
-      
-      switch (request.type())
-      {
-        case Orthanc::DatabasePluginMessages::REQUEST_DATABASE:
-          ProcessDatabaseOperation(*response.mutable_database_response(), request.database_request(), pool);
-          break;
-          
-        case Orthanc::DatabasePluginMessages::REQUEST_TRANSACTION:
-        {
-          IndexConnectionsPool::Accessor& transaction = *reinterpret_cast<IndexConnectionsPool::Accessor*>(request.transaction_request().transaction());
-          ProcessTransactionOperation(*response.mutable_transaction_response(), request.transaction_request(),
-                                      transaction.GetBackend(), transaction.GetManager());
-          break;
-        }
-          
-        default:
-          LOG(ERROR) << "Not implemented request type from protobuf: " << request.type();
-          break;
-      }
+      case Orthanc::DatabasePluginMessages::REQUEST_DATABASE:
+        return GetOperationName(request.database_request().operation());
 
-      std::string s;
-      if (!response.SerializeToString(&s))
-      {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Cannot serialize to protobuf");
-      }
+      case Orthanc::DatabasePluginMessages::REQUEST_TRANSACTION:
+        return GetOperationName(request.transaction_request().operation());
 
-      if (OrthancPluginCreateMemoryBuffer64(pool.GetContext(), serializedResponse, s.size()) != OrthancPluginErrorCode_Success)
-      {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory, "Cannot allocate a memory buffer");
-      }
+      default:
+        return "UNKNOWN";
+    }
+  }
 
-      if (!s.empty())
-      {
-        assert(serializedResponse->size == s.size());
-        memcpy(serializedResponse->data, s.c_str(), s.size());
-      }
 
-      return OrthancPluginErrorCode_Success;
-    }
-    catch (::Orthanc::OrthancException& e)
+  static bool IsDatabaseOperation(const Orthanc::DatabasePluginMessages::Request& request,
+                                  Orthanc::DatabasePluginMessages::DatabaseOperation operation)
+  {
+    return (request.type() == Orthanc::DatabasePluginMessages::REQUEST_DATABASE &&
+            request.database_request().operation() == operation);
+  }
+
+
+  static bool IsStartTransaction(const Orthanc::DatabasePluginMessages::Request& request)
+  {
+    return IsDatabaseOperation(request, Orthanc::DatabasePluginMessages::OPERATION_START_TRANSACTION);
+  }
+
+
+  static bool IsCommit(const Orthanc::DatabasePluginMessages::Request& request)
+  {
+    return (request.type() == Orthanc::DatabasePluginMessages::REQUEST_TRANSACTION &&
+            request.transaction_request().operation() == Orthanc::DatabasePluginMessages::OPERATION_COMMIT);
+  }
+
+
+  // Returns the transaction that is targeted by the request, or 0
+  static int64_t GetCapturedTransaction(const Orthanc::DatabasePluginMessages::Request& request)
+  {
+    if (request.type() == Orthanc::DatabasePluginMessages::REQUEST_TRANSACTION)
     {
-      if (e.GetErrorCode() == ::Orthanc::ErrorCode_DatabaseCannotSerialize)
-      {
-        LOG(WARNING) << "An SQL transaction failed and will likely be retried: " << e.GetDetails();
-      }
-      else
-      {
-        LOG(ERROR) << "Exception in database back-end: " << e.What();
-      }
-      return static_cast<OrthancPluginErrorCode>(e.GetErrorCode());
+      return request.transaction_request().transaction();
     }
-    catch (::std::runtime_error& e)
+    else if (IsDatabaseOperation(request, Orthanc::DatabasePluginMessages::OPERATION_FINALIZE_TRANSACTION))
     {
-      LOG(ERROR) << "Exception in database back-end: " << e.what();
-      return OrthancPluginErrorCode_DatabasePlugin;
+      return request.database_request().finalize_transaction().transaction();
     }
-    catch (...)
+    else
     {
-      LOG(ERROR) << "Native exception";
-      return OrthancPluginErrorCode_DatabasePlugin;
+      return 0;
     }
   }
 
-  static void FinalizeBackend(void* rawPool)
+
+  // Recording of the requests, only modified before the registration
+  static std::unique_ptr<RequestsRecorder>  recorder_;
+
+
+  // Timelines of the ingests, only modified before the registration
+  static std::unique_ptr<IngestStatistics>  ingestStatistics_;
+
+  static std::unique_ptr<TracesExporter>  tracesExporter_;
+
+
+  static IngestStatistics::Stage GetIngestStage(Orthanc::DatabasePluginMessages::TransactionOperation operation)
   {
-    if (rawPool != NULL)
+    switch (operation)
     {
-      IndexConnectionsPool* pool = reinterpret_cast<IndexConnectionsPool*>(rawPool);
-      
-      if (isBackendInUse_)
-      {
-        isBackendInUse_ = false;
-      }
-      else
-      {
-        LOG(ERROR) << "More than one index backend was registered, internal error";
-      }
+      case Orthanc::DatabasePluginMessages::OPERATION_CREATE_INSTANCE:
+        return IngestStatistics::Stage_CreateInstance;
 
-      delete pool;
-    }
-    else
-    {
-      LOG(ERROR) << "Received a null pointer from the Orthanc core, internal error";
+      case Orthanc::DatabasePluginMessages::OPERATION_SET_RESOURCES_CONTENT:
+        return IngestStatistics::Stage_SetResourcesContent;
+
+      case Orthanc::DatabasePluginMessages::OPERATION_ADD_ATTACHMENT:
+        return IngestStatistics::Stage_AddAttachment;
+
+      case Orthanc::DatabasePluginMessages::OPERATION_SET_METADATA:
+        return IngestStatistics::Stage_SetMetadata;
+
+      case Orthanc::DatabasePluginMessages::OPERATION_LOG_CHANGE:
+        return IngestStatistics::Stage_LogChange;
+
+      case Orthanc::DatabasePluginMessages::OPERATION_COMMIT:
+        return IngestStatistics::Stage_Commit;
+
+      default:
+        return IngestStatistics::Stage_Other;
     }
   }
 
-  
-  void DatabaseBackendAdapterV4::Register(IndexBackend* backend,
+
+  /**
+   * Adds the duration of a successful operation to the timeline of
+   * its transaction. The timeline is published at commit. If the
+   * writes are deferred, their duration is accounted to the
+   * operation that flushes them (usually the commit).
+   **/
+  static void AddToIngestTimeline(const Orthanc::DatabasePluginMessages::Request& request,
+                                  const Orthanc::DatabasePluginMessages::Response& response,
+                                  uint64_t microseconds)
+  {
+    if (ingestStatistics_.get() == NULL ||
+        request.type() != Orthanc::DatabasePluginMessages::REQUEST_TRANSACTION)
+    {
+      return;
+    }
+
+    IndexConnectionsPool::Accessor& transaction =
+      *reinterpret_cast<IndexConnectionsPool::Accessor*>(request.transaction_request().transaction());
+
+    IngestStatistics::Timeline& timeline = transaction.GetIngestTimeline();
+
+    switch (request.transaction_request().operation())
+    {
+      case Orthanc::DatabasePluginMessages::OPERATION_ROLLBACK:
+        timeline.Reset();
+        break;
+
+      case Orthanc::DatabasePluginMessages::OPERATION_CREATE_INSTANCE:
+        if (response.transaction_response().create_instance().is_new_instance())
+        {
+          timeline.SetInstance(request.transaction_request().create_instance().instance());
+        }
+
+        timeline.Add(IngestStatistics::Stage_CreateInstance, microseconds);
+        break;
+
+      case Orthanc::DatabasePluginMessages::OPERATION_COMMIT:
+        timeline.Add(IngestStatistics::Stage_Commit, microseconds);
+        ingestStatistics_->Add(timeline);
+        timeline.Reset();
+        break;
+
+      default:
+        timeline.Add(GetIngestStage(request.transaction_request().operation()), microseconds);
+        break;
+    }
+  }
+
+
+  static void IngestStatisticsRestCallback(OrthancPluginRestOutput* output,
+                                           const char* url,
+                                           const OrthancPluginHttpRequest* request)
+  {
+    if (request->method != OrthancPluginHttpMethod_Get)
+    {
+      OrthancPlugins::AnswerMethodNotAllowed(output, "GET");
+      return;
+    }
+
+    Json::Value answer = Json::objectValue;
+
+    if (ingestStatistics_.get() != NULL)
+    {
+      ingestStatistics_->Format(answer);
+    }
+
+    OrthancPlugins::AnswerJson(answer, output);
+  }
+
+
+  static IndexConnectionsPool* restPool_ = NULL;  // Not NULL while the backend is registered
+
+
+  static void IndexAdvisorRestCallback(OrthancPluginRestOutput* output,
+                                       const char* url,
+                                       const OrthancPluginHttpRequest* request)
+  {
+    if (request->method != OrthancPluginHttpMethod_Get &&
+        request->method != OrthancPluginHttpMethod_Post)
+    {
+      OrthancPlugins::AnswerMethodNotAllowed(output, "GET,POST");
+      return;
+    }
+
+    Json::Value answer = Json::objectValue;
+
+    if (restPool_ != NULL)
+    {
+      // POST creates the recommended indexes
+      IndexConnectionsPool::Accessor accessor(*restPool_);
+      accessor.GetBackend().AdviseIndexes(answer, accessor.GetManager(),
+                                          request->method == OrthancPluginHttpMethod_Post);
+    }
+
+    OrthancPlugins::AnswerJson(answer, output);
+  }
+
+
+  template <typename T>
+  static T ParseGetArgument(const std::string& key,
+                            const std::string& value)
+  {
+    try
+    {
+      return boost::lexical_cast<T>(value);
+    }
+    catch (boost::bad_lexical_cast&)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "Bad value for the GET argument \"" + key + "\": " + value);
+    }
+  }
+
+
+  /**
+   * GET arguments: "since" (defaults to 0), "limit" (defaults to 100)
+   * and "type", that is a list of numerical change types separated
+   * by semicolons (e.g. "type=9;10").
+   **/
+  static void ChangesCursorRestCallback(OrthancPluginRestOutput* output,
+                                        const char* url,
+                                        const OrthancPluginHttpRequest* request)
+  {
+    if (request->method != OrthancPluginHttpMethod_Get)
+    {
+      OrthancPlugins::AnswerMethodNotAllowed(output, "GET");
+      return;
+    }
+
+    int64_t since = 0;
+    uint32_t limit = 100;
+    std::set<uint32_t> changeTypes;
+
+    for (uint32_t i = 0; i < request->getCount; i++)
+    {
+      const std::string key(request->getKeys[i]);
+      const std::string value(request->getValues[i]);
+
+      if (key == "since")
+      {
+        since = ParseGetArgument<int64_t>(key, value);
+      }
+      else if (key == "limit")
+      {
+        limit = ParseGetArgument<uint32_t>(key, value);
+      }
+      else if (key == "type")
+      {
+        std::vector<std::string> tokens;
+        Orthanc::Toolbox::TokenizeString(tokens, value, ';');
+
+        for (size_t j = 0; j < tokens.size(); j++)
+        {
+          changeTypes.insert(ParseGetArgument<uint32_t>(key, tokens[j]));
+        }
+      }
+    }
+
+    Json::Value answer = Json::objectValue;
+
+    if (restPool_ != NULL)
+    {
+      Orthanc::DatabasePluginMessages::GetChanges::Response response;
+      bool done;
+      int64_t next;
+
+      {
+        IndexConnectionsPool::Accessor accessor(*restPool_);
+        DatabaseManager::Transaction transaction(accessor.GetManager(), TransactionType_ReadOnly);
+
+        Output changes(response);
+        accessor.GetBackend().GetChangesCursor(changes, done, next, accessor.GetManager(), since, changeTypes, limit);
+
+        transaction.Commit();
+      }
+
+      answer["Changes"] = Json::arrayValue;
+
+      for (int i = 0; i < response.changes().size(); i++)
+      {
+        const Orthanc::DatabasePluginMessages::ServerIndexChange& change = response.changes(i);
+
+        Json::Value item = Json::objectValue;
+        item["Seq"] = static_cast<Json::Int64>(change.seq());
+        item["ChangeType"] = change.change_type();
+        item["ResourceType"] = Orthanc::EnumerationToString(MessagesToolbox::Convert(change.resource_type()));
+        item["ID"] = change.public_id();
+        item["Date"] = change.date();
+        answer["Changes"].append(item);
+      }
+
+      answer["Done"] = done;
+      answer["Next"] = static_cast<Json::Int64>(next);
+    }
+
+    OrthancPlugins::AnswerJson(answer, output);
+  }
+
+
+  /**
+   * GET argument: "id", that is a list of at most 1000 internal IDs
+   * of resources separated by semicolons (e.g. "id=12;13"). Answers
+   * all the attachments of these resources, with their revisions.
+   * Cf. "IndexBackend::LookupAttachments()".
+   **/
+  static void AttachmentsRestCallback(OrthancPluginRestOutput* output,
+                                      const char* url,
+                                      const OrthancPluginHttpRequest* request)
+  {
+    static const size_t MAX_IDS = 1000;
+
+    if (request->method != OrthancPluginHttpMethod_Get)
+    {
+      OrthancPlugins::AnswerMethodNotAllowed(output, "GET");
+      return;
+    }
+
+    std::set<int64_t> ids;
+
+    for (uint32_t i = 0; i < request->getCount; i++)
+    {
+      const std::string key(request->getKeys[i]);
+      const std::string value(request->getValues[i]);
+
+      if (key == "id")
+      {
+        std::vector<std::string> tokens;
+        Orthanc::Toolbox::TokenizeString(tokens, value, ';');
+
+        for (size_t j = 0; j < tokens.size(); j++)
+        {
+          ids.insert(ParseGetArgument<int64_t>(key, tokens[j]));
+        }
+      }
+    }
+
+    if (ids.size() > MAX_IDS)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "At most " + boost::lexical_cast<std::string>(MAX_IDS) + " resources can be looked up at once");
+    }
+
+    Json::Value answer = Json::arrayValue;
+
+    if (restPool_ != NULL)
+    {
+      google::protobuf::RepeatedPtrField<Orthanc::DatabasePluginMessages::Find_Response> resources;
+
+      {
+        IndexConnectionsPool::Accessor accessor(*restPool_, TransactionType_ReadOnly);
+        DatabaseManager::Transaction transaction(accessor.GetManager(), TransactionType_ReadOnly);
+        accessor.GetBackend().LookupAttachments(resources, accessor.GetManager(), ids);
+        transaction.Commit();
+      }
+
+      for (int i = 0; i < resources.size(); i++)
+      {
+        const Orthanc::DatabasePluginMessages::Find_Response& resource = resources.Get(i);
+
+        Json::Value item = Json::objectValue;
+        item["InternalID"] = static_cast<Json::Int64>(resource.internal_id());
+        item["ID"] = resource.public_id();
+        item["Attachments"] = Json::arrayValue;
+
+        for (int j = 0; j < resource.attachments_size(); j++)
+        {
+          const Orthanc::DatabasePluginMessages::FileInfo& file = resource.attachments(j);
+
+          Json::Value attachment = Json::objectValue;
+          attachment["ContentType"] = file.content_type();
+          attachment["Uuid"] = file.uuid();
+          attachment["UncompressedSize"] = static_cast<Json::Int64>(file.uncompressed_size());
+          attachment["UncompressedMD5"] = file.uncompressed_hash();
+          attachment["CompressionType"] = file.compression_type();
+          attachment["CompressedSize"] = static_cast<Json::Int64>(file.compressed_size());
+          attachment["CompressedMD5"] = file.compressed_hash();
+          attachment["Revision"] = static_cast<Json::Int64>(resource.attachments_revisions(j));
+          item["Attachments"].append(attachment);
+        }
+
+        answer.append(item);
+      }
+    }
+
+    OrthancPlugins::AnswerJson(answer, output);
+  }
+
+
+  /**
+   * GET arguments: "since" (defaults to -1), "limit" (defaults to
+   * 1000) and "changes" (if "true", "since" is a sequence number of
+   * the changes instead of an internal ID). Cf.
+   * "IndexBackend::ReadReplicaPage()".
+   **/
+  static void ReplicaRestCallback(OrthancPluginRestOutput* output,
+                                  const char* url,
+                                  const OrthancPluginHttpRequest* request)
+  {
+    if (request->method != OrthancPluginHttpMethod_Get)
+    {
+      OrthancPlugins::AnswerMethodNotAllowed(output, "GET");
+      return;
+    }
+
+    int64_t since = -1;
+    uint32_t limit = 1000;
+    bool changes = false;
+
+    for (uint32_t i = 0; i < request->getCount; i++)
+    {
+      const std::string key(request->getKeys[i]);
+      const std::string value(request->getValues[i]);
+
+      if (key == "since")
+      {
+        since = ParseGetArgument<int64_t>(key, value);
+      }
+      else if (key == "limit")
+      {
+        limit = ParseGetArgument<uint32_t>(key, value);
+      }
+      else if (key == "changes")
+      {
+        changes = (value == "true" || value == "1");
+      }
+    }
+
+    Json::Value answer = Json::objectValue;
+
+    if (restPool_ != NULL)
+    {
+      IndexConnectionsPool::Accessor accessor(*restPool_, TransactionType_ReadOnly);
+      DatabaseManager::Transaction transaction(accessor.GetManager(), TransactionType_ReadOnly);
+      accessor.GetBackend().ReadReplicaPage(answer, accessor.GetManager(), since, limit, changes);
+      transaction.Commit();
+    }
+
+    OrthancPlugins::AnswerJson(answer, output);
+  }
+
+
+  /**
+   * GET arguments: "level" (defaults to "Study"), "since" (defaults
+   * to the empty string), "since-id" (defaults to -1), "to" (no upper
+   * bound by default) and "limit" (defaults to 1000). The dates have
+   * the format of the "LastUpdate" metadata ("YYYYMMDDTHHMMSS"). The
+   * next page is read by copying "Since" and "SinceID" of the answer.
+   * The same resource can be returned by two polls, and the deletions
+   * are not reported. Cf. "IndexBackend::LookupUpdatedResources()".
+   **/
+  static void UpdatedResourcesRestCallback(OrthancPluginRestOutput* output,
+                                           const char* url,
+                                           const OrthancPluginHttpRequest* request)
+  {
+    if (request->method != OrthancPluginHttpMethod_Get)
+    {
+      OrthancPlugins::AnswerMethodNotAllowed(output, "GET");
+      return;
+    }
+
+    Orthanc::ResourceType level = Orthanc::ResourceType_Study;
+    std::string since;
+    int64_t sinceId = -1;
+    std::string to;
+    uint32_t limit = 1000;
+
+    for (uint32_t i = 0; i < request->getCount; i++)
+    {
+      const std::string key(request->getKeys[i]);
+      const std::string value(request->getValues[i]);
+
+      if (key == "level")
+      {
+        level = Orthanc::StringToResourceType(value.c_str());
+      }
+      else if (key == "since")
+      {
+        since = value;
+      }
+      else if (key == "since-id")
+      {
+        sinceId = ParseGetArgument<int64_t>(key, value);
+      }
+      else if (key == "to")
+      {
+        to = value;
+      }
+      else if (key == "limit")
+      {
+        limit = ParseGetArgument<uint32_t>(key, value);
+      }
+    }
+
+    Json::Value answer = Json::objectValue;
+
+    if (restPool_ != NULL)
+    {
+      IndexConnectionsPool::Accessor accessor(*restPool_, TransactionType_ReadOnly);
+      DatabaseManager::Transaction transaction(accessor.GetManager(), TransactionType_ReadOnly);
+      accessor.GetBackend().LookupUpdatedResources(answer, accessor.GetManager(), MessagesToolbox::ConvertToPlainC(level),
+                                                   since, sinceId, to, limit);
+      transaction.Commit();
+    }
+
+    OrthancPlugins::AnswerJson(answer, output);
+  }
+
+
+  // Delay between two attempts to reconnect to the database, after the loss of a connection
+  static const unsigned int FAILOVER_RECONNECT_DELAY_MILLISECONDS = 100;
+
+
+  /**
+   * The operations of a read-only transaction whose connection is lost
+   * (e.g. because of the failover of the PostgreSQL primary) are
+   * re-executed on a new connection, until the budget is exhausted. If
+   * the transaction has already returned data, re-executing the
+   * operation on a new snapshot could mix two states of the database:
+   * The Orthanc core is then asked to retry the whole transaction, as
+   * for a serialization failure.
+   **/
+  static void ProcessReadOnlyTransactionOperation(Orthanc::DatabasePluginMessages::TransactionResponse& response,
+                                                  const Orthanc::DatabasePluginMessages::TransactionRequest& request,
+                                                  IndexConnectionsPool::Accessor& transaction,
+                                                  unsigned int budget)
+  {
+    const bool isEnd = (request.operation() == Orthanc::DatabasePluginMessages::OPERATION_COMMIT ||
+                        request.operation() == Orthanc::DatabasePluginMessages::OPERATION_ROLLBACK);
+
+    Orthanc::Toolbox::ElapsedTimer timer;
+
+    for (;;)
+    {
+      try
+      {
+        // The answer of a failed attempt might have been partially filled
+        response.Clear();
+
+        ProcessTransactionOperation(response, request, transaction.GetBackend(), transaction.GetManager(),
+                                    transaction.GetPrefetchedResources());
+
+        if (!isEnd)
+        {
+          transaction.SignalRead();
+        }
+
+        return;
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        if (e.GetErrorCode() != Orthanc::ErrorCode_DatabaseUnavailable)
+        {
+          throw;
+        }
+
+        LOG(WARNING) << "Lost the connection to the database in a read-only transaction, "
+                     << "reconnecting: " << e.What();
+      }
+
+      for (;;)
+      {
+        if (timer.GetElapsedMicroseconds() >= static_cast<uint64_t>(budget) * 1000)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_DatabaseUnavailable,
+                                          "The database is still unavailable after the failover budget of " +
+                                          boost::lexical_cast<std::string>(budget) + "ms");
+        }
+        else if (transaction.ReconnectReadOnly())
+        {
+          break;
+        }
+        else
+        {
+          boost::this_thread::sleep(boost::posix_time::milliseconds(FAILOVER_RECONNECT_DELAY_MILLISECONDS));
+        }
+      }
+
+      // The prefetched resources were read from the snapshot of the lost transaction
+      transaction.GetPrefetchedResources().Clear();
+
+      // The end of a read-only transaction is simply replayed on the new transaction
+      if (transaction.HasRead() &&
+          !isEnd)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_DatabaseCannotSerialize,
+                                        "Reconnected to the database, the read-only transaction must be retried");
+      }
+    }
+  }
+
+
+  static void ProcessRequest(Orthanc::DatabasePluginMessages::Response& response,
+                             const Orthanc::DatabasePluginMessages::Request& request,
+                             IndexConnectionsPool& pool,
+                             const char* operation)
+  {
+    switch (request.type())
+    {
+      case Orthanc::DatabasePluginMessages::REQUEST_DATABASE:
+        ProcessDatabaseOperation(*response.mutable_database_response(), request.database_request(), pool);
+        break;
+        
+      case Orthanc::DatabasePluginMessages::REQUEST_TRANSACTION:
+      {
+        IndexConnectionsPool::Accessor& transaction = *reinterpret_cast<IndexConnectionsPool::Accessor*>(request.transaction_request().transaction());
+        transaction.SetOperation(operation);
+
+        const Orthanc::DatabasePluginMessages::TransactionOperation type = request.transaction_request().operation();
+
+        // Only the transactions that ingest an instance can be merged with other transactions
+        transaction.PrepareOperation(type == Orthanc::DatabasePluginMessages::OPERATION_CREATE_INSTANCE);
+
+        if (transaction.HasLeftGroup())
+        {
+          if (type == Orthanc::DatabasePluginMessages::OPERATION_ROLLBACK)
+          {
+            break;  // The transaction of the group has already been ended
+          }
+          else
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+          }
+        }
+
+        DeferredWrites& writes = transaction.GetDeferredWrites();
+
+        if (transaction.GetBackend().HasDeferredWrites() &&
+            DeferTransactionOperation(writes, request.transaction_request()))
+        {
+          break;  // The answer is empty
+        }
+
+        {
+          // The members of a group share the same connection
+          std::unique_ptr<boost::mutex::scoped_lock> groupLock;
+          if (transaction.IsGroupMember())
+          {
+            groupLock.reset(new boost::mutex::scoped_lock(transaction.GetGroupMutex()));
+          }
+
+          if (!writes.IsEmpty())
+          {
+            if (type == Orthanc::DatabasePluginMessages::OPERATION_ROLLBACK)
+            {
+              writes.Clear();
+            }
+            else
+            {
+              try
+              {
+                transaction.GetBackend().FlushDeferredWrites(transaction.GetManager(), writes);
+                writes.Clear();
+              }
+              catch (...)
+              {
+                writes.Clear();
+                throw;
+              }
+            }
+          }
+
+          if (transaction.IsReadOnly() &&
+              pool.GetFailoverRetryBudget() != 0)
+          {
+            ProcessReadOnlyTransactionOperation(*response.mutable_transaction_response(), request.transaction_request(),
+                                                transaction, pool.GetFailoverRetryBudget());
+            break;
+          }
+          else if (!transaction.IsGroupMember() ||
+                   (type != Orthanc::DatabasePluginMessages::OPERATION_COMMIT &&
+                    type != Orthanc::DatabasePluginMessages::OPERATION_ROLLBACK))
+          {
+            ProcessTransactionOperation(*response.mutable_transaction_response(), request.transaction_request(),
+                                        transaction.GetBackend(), transaction.GetManager(),
+                                        transaction.GetPrefetchedResources());
+
+            if (type == Orthanc::DatabasePluginMessages::OPERATION_COMMIT &&
+                !transaction.IsReadOnly())
+            {
+              transaction.SignalCommitted();  // For the read-your-writes consistency of the replica
+            }
+
+            break;
+          }
+        }
+
+        // Wait for the other transactions of the group, without locking their operations
+        if (!transaction.LeaveGroup(type == Orthanc::DatabasePluginMessages::OPERATION_COMMIT) &&
+            type == Orthanc::DatabasePluginMessages::OPERATION_COMMIT)
+        {
+          // Another transaction of the group has failed, Orthanc will retry this one
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_DatabaseCannotSerialize);
+        }
+
+        break;
+      }
+        
+      default:
+        LOG(ERROR) << "Not implemented request type from protobuf: " << request.type();
+        break;
+    }
+  }
+
+
+  namespace
+  {
+    // One captured request, or the order to stop if "IsStop()"
+    class ReplayedRequest : public Orthanc::IDynamicObject
+    {
+    private:
+      Orthanc::DatabasePluginMessages::Request  request_;
+      bool                                      isStop_;
+
+    public:
+      explicit ReplayedRequest(bool isStop) :
+        isStop_(isStop)
+      {
+      }
+
+      bool IsStop() const
+      {
+        return isStop_;
+      }
+
+      Orthanc::DatabasePluginMessages::Request& GetRequest()
+      {
+        return request_;
+      }
+    };
+
+
+    // Replays the requests of one captured transaction, in a separate thread
+    class ReplayedTransaction : public boost::noncopyable
+    {
+    private:
+      IndexConnectionsPool&        pool_;
+      Orthanc::SharedMessageQueue  queue_;
+      int64_t                      transaction_;  // The new identifier of the transaction
+      uint64_t                     countErrors_;
+      uint64_t                     countSerializationFailures_;
+      boost::thread                thread_;
+
+      // Returns "false" iff the transaction is over
+      bool Process(Orthanc::DatabasePluginMessages::Request& request)
+      {
+        const bool isStart = IsStartTransaction(request);
+        const bool isFinalize = IsDatabaseOperation(request, Orthanc::DatabasePluginMessages::OPERATION_FINALIZE_TRANSACTION);
+
+        if (!isStart)
+        {
+          if (transaction_ == 0)
+          {
+            countErrors_++;  // The transaction could not be created
+            return !isFinalize;
+          }
+          else if (isFinalize)
+          {
+            request.mutable_database_request()->mutable_finalize_transaction()->set_transaction(transaction_);
+          }
+          else
+          {
+            request.mutable_transaction_request()->set_transaction(transaction_);
+          }
+        }
+
+        try
+        {
+          Orthanc::DatabasePluginMessages::Response response;
+          ProcessRequest(response, request, pool_, GetOperationName(request));
+
+          if (isStart)
+          {
+            transaction_ = response.database_response().start_transaction().transaction();
+          }
+        }
+        catch (Orthanc::OrthancException& e)
+        {
+          countErrors_++;
+
+          if (e.GetErrorCode() == Orthanc::ErrorCode_DatabaseCannotSerialize)
+          {
+            countSerializationFailures_++;
+          }
+        }
+        catch (...)
+        {
+          countErrors_++;
+        }
+
+        if (isFinalize)
+        {
+          transaction_ = 0;
+          return false;
+        }
+        else
+        {
+          return true;
+        }
+      }
+
+      static void Worker(ReplayedTransaction* that)
+      {
+        for (;;)
+        {
+          std::unique_ptr<Orthanc::IDynamicObject> obj(that->queue_.Dequeue(0));
+          if (obj.get() != NULL)
+          {
+            ReplayedRequest& request = dynamic_cast<ReplayedRequest&>(*obj);
+            if (request.IsStop() ||
+                !that->Process(request.GetRequest()))
+            {
+              return;
+            }
+          }
+        }
+      }
+
+    public:
+      explicit ReplayedTransaction(IndexConnectionsPool& pool) :
+        pool_(pool),
+        transaction_(0),
+        countErrors_(0),
+        countSerializationFailures_(0)
+      {
+        thread_ = boost::thread(Worker, this);
+      }
+
+      ~ReplayedTransaction()
+      {
+        Join();
+
+        if (transaction_ != 0)
+        {
+          // The capture ends before the transaction
+          delete reinterpret_cast<IndexConnectionsPool::Accessor*>(transaction_);
+        }
+      }
+
+      void Enqueue(ReplayedRequest* request)
+      {
+        queue_.Enqueue(request);
+      }
+
+      void Join()
+      {
+        if (thread_.joinable())
+        {
+          queue_.Enqueue(new ReplayedRequest(true));
+          thread_.join();
+        }
+      }
+
+      uint64_t GetCountErrors() const
+      {
+        return countErrors_;
+      }
+
+      uint64_t GetCountSerializationFailures() const
+      {
+        return countSerializationFailures_;
+      }
+    };
+  }
+
+
+  namespace
+  {
+    // Adds the request to "recorder_" once it has been processed
+    class RequestRecording : public boost::noncopyable
+    {
+    private:
+      const void*               data_;
+      uint64_t                  size_;
+      int64_t                   transaction_;
+      bool                      hasAccessor_;
+      boost::posix_time::ptime  start_;
+      bool                      success_;
+      bool                      isDone_;
+
+      void Add()
+      {
+        try
+        {
+          int64_t connection = 0;
+
+          if (hasAccessor_ &&
+              transaction_ != 0)
+          {
+            // The accessor exists until OPERATION_FINALIZE_TRANSACTION
+            connection = reinterpret_cast<intptr_t>(&reinterpret_cast<IndexConnectionsPool::Accessor*>(transaction_)->GetManager());
+          }
+
+          recorder_->Add(transaction_, connection, start_, boost::posix_time::microsec_clock::universal_time(),
+                         success_, data_, static_cast<size_t>(size_));
+        }
+        catch (...)
+        {
+          LOG(ERROR) << "Cannot record a request to the index";
+        }
+      }
+
+    public:
+      RequestRecording(const Orthanc::DatabasePluginMessages::Request& request,
+                       const void* data,
+                       uint64_t size) :
+        data_(data),
+        size_(size),
+        transaction_(GetCapturedTransaction(request)),
+        hasAccessor_(request.type() == Orthanc::DatabasePluginMessages::REQUEST_TRANSACTION),
+        start_(boost::posix_time::microsec_clock::universal_time()),
+        success_(true),
+        isDone_(false)
+      {
+        if (IsDatabaseOperation(request, Orthanc::DatabasePluginMessages::OPERATION_FINALIZE_TRANSACTION))
+        {
+          // Recorded before the accessor is freed, as a new transaction
+          // can immediately reuse its address, hence its identifier
+          Add();
+          isDone_ = true;
+        }
+        else
+        {
+          success_ = false;
+        }
+      }
+
+      ~RequestRecording()
+      {
+        if (!isDone_)
+        {
+          Add();
+        }
+      }
+
+      // The identifier of a new transaction is only known once it is created
+      void SetStartedTransaction(int64_t transaction)
+      {
+        transaction_ = transaction;
+        hasAccessor_ = true;
+      }
+
+      void SetSuccess()
+      {
+        success_ = true;
+      }
+    };
+
+
+    /**
+     * Memory blocks that are reused by the successive calls to
+     * "CallBackend()" as the first block of their protobuf arena,
+     * so that most calls don't involve any heap allocation for the
+     * messages. A pool is used instead of thread-local storage, as
+     * the threads belong to the Orthanc core, and may outlive the
+     * plugin.
+     **/
+    class ArenaBlocksPool : public boost::noncopyable
+    {
+    private:
+      boost::mutex        mutex_;
+      std::vector<char*>  available_;
+
+    public:
+      static const size_t BLOCK_SIZE = 64 * 1024;
+      static const size_t MAX_AVAILABLE_BLOCKS = 64;
+
+      ~ArenaBlocksPool()
+      {
+        for (size_t i = 0; i < available_.size(); i++)
+        {
+          delete[] available_[i];
+        }
+      }
+
+      char* Acquire()
+      {
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+          if (!available_.empty())
+          {
+            char* block = available_.back();
+            available_.pop_back();
+            return block;
+          }
+        }
+
+        return new char[BLOCK_SIZE];
+      }
+
+      void Release(char* block)
+      {
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+          if (available_.size() < MAX_AVAILABLE_BLOCKS)
+          {
+            available_.push_back(block);
+            return;
+          }
+        }
+
+        delete[] block;
+      }
+    };
+
+
+    class ArenaBlock : public boost::noncopyable
+    {
+    private:
+      ArenaBlocksPool&  pool_;
+      char*             block_;
+
+    public:
+      explicit ArenaBlock(ArenaBlocksPool& pool) :
+        pool_(pool),
+        block_(pool.Acquire())
+      {
+      }
+
+      ~ArenaBlock()
+      {
+        pool_.Release(block_);
+      }
+
+      void Configure(google::protobuf::ArenaOptions& options) const
+      {
+        options.initial_block = block_;
+        options.initial_block_size = ArenaBlocksPool::BLOCK_SIZE;
+      }
+    };
+  }
+
+
+  static ArenaBlocksPool  arenaBlocks_;
+
+
+  static OrthancPluginErrorCode CallBackend(OrthancPluginMemoryBuffer64* serializedResponse,
+                                            void* rawPool,
+                                            const void* requestData,
+                                            uint64_t requestSize)
+  {
+    /**
+     * All the messages of this call are allocated in one arena, which
+     * avoids one heap allocation per field of the large answers (such
+     * as the ones of OPERATION_FIND), and frees them at once. The
+     * first block of the arena is recycled from a previous call (it
+     * must outlive the arena, hence the order of the declarations).
+     **/
+    ArenaBlock block(arenaBlocks_);
+
+    google::protobuf::ArenaOptions options;
+    block.Configure(options);
+
+    google::protobuf::Arena arena(options);
+
+    Orthanc::DatabasePluginMessages::Request& request =
+      *google::protobuf::Arena::CreateMessage<Orthanc::DatabasePluginMessages::Request>(&arena);
+
+    if (!request.ParseFromArray(requestData, requestSize))
+    {
+      LOG(ERROR) << "Cannot parse message from the Orthanc core using protobuf";
+      return OrthancPluginErrorCode_InternalError;
+    }
+
+    if (rawPool == NULL)
+    {
+      LOG(ERROR) << "Received a NULL pointer from the database";
+      return OrthancPluginErrorCode_InternalError;
+    }
+
+    IndexConnectionsPool& pool = *reinterpret_cast<IndexConnectionsPool*>(rawPool);
+
+    const char* const operation = GetOperationName(request);
+
+    std::unique_ptr<RequestRecording> recording;
+    if (recorder_.get() != NULL)
+    {
+      recording.reset(new RequestRecording(request, requestData, requestSize));
+    }
+
+    // Records the latency of the operation, as a success or as an error
+    OperationsStatistics::Timer timer(pool.GetOperationsStatistics(), operation);
+
+    TracesExporter::Span span(std::string("index.") + operation);
+
+    try
+    {
+      Orthanc::DatabasePluginMessages::Response& response =
+        *google::protobuf::Arena::CreateMessage<Orthanc::DatabasePluginMessages::Response>(&arena);
+
+      Orthanc::Toolbox::ElapsedTimer elapsed;
+      ProcessRequest(response, request, pool, operation);
+      AddToIngestTimeline(request, response, elapsed.GetElapsedMicroseconds());
+
+      if (IsCommit(request))
+      {
+        pool.GetRetryPolicy().SignalSuccess();
+      }
+
+      if (recording.get() != NULL &&
+          IsStartTransaction(request))
+      {
+        recording->SetStartedTransaction(response.database_response().start_transaction().transaction());
+      }
+
+      // Serialize straight into the buffer that is returned to Orthanc, without intermediate string
+      const size_t size = response.ByteSizeLong();
+
+      if (OrthancPluginCreateMemoryBuffer64(pool.GetContext(), serializedResponse, size) != OrthancPluginErrorCode_Success)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory, "Cannot allocate a memory buffer");
+      }
+
+      if (size != 0)
+      {
+        assert(serializedResponse->size == size);
+
+        uint8_t* start = reinterpret_cast<uint8_t*>(serializedResponse->data);
+        uint8_t* end = response.SerializeWithCachedSizesToArray(start);
+
+        if (end != start + size)
+        {
+          OrthancPluginFreeMemoryBuffer64(pool.GetContext(), serializedResponse);
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Cannot serialize to protobuf");
+        }
+      }
+
+      timer.SetSuccess();
+      span.SetSuccess();
+      return OrthancPluginErrorCode_Success;
+    }
+    catch (::Orthanc::OrthancException& e)
+    {
+      span.SetAttribute("orthanc.error_code", static_cast<int64_t>(e.GetErrorCode()));
+
+      if (e.GetErrorCode() == ::Orthanc::ErrorCode_DatabaseCannotSerialize)
+      {
+        pool.GetRetryPolicy().SignalConflict();
+        LOG(WARNING) << "An SQL transaction failed and will likely be retried: " << e.GetDetails();
+      }
+      else
+      {
+        LOG(ERROR) << "Exception in database back-end: " << e.What();
+      }
+      return static_cast<OrthancPluginErrorCode>(e.GetErrorCode());
+    }
+    catch (::std::runtime_error& e)
+    {
+      LOG(ERROR) << "Exception in database back-end: " << e.what();
+      return OrthancPluginErrorCode_DatabasePlugin;
+    }
+    catch (...)
+    {
+      LOG(ERROR) << "Native exception";
+      return OrthancPluginErrorCode_DatabasePlugin;
+    }
+  }
+
+  namespace
+  {
+    // One resource to be deleted, or the order to stop if the ID is empty
+    class ChunkedDeletionItem : public Orthanc::IDynamicObject
+    {
+    private:
+      std::string  publicId_;
+
+    public:
+      explicit ChunkedDeletionItem(const std::string& publicId) :
+        publicId_(publicId)
+      {
+      }
+
+      bool IsStop() const
+      {
+        return publicId_.empty();
+      }
+
+      const std::string& GetPublicId() const
+      {
+        return publicId_;
+      }
+    };
+
+
+    // Deletes the resources in a separate thread, by batches of instances
+    class ChunkedDeletion : public boost::noncopyable
+    {
+    private:
+      IndexConnectionsPool&        pool_;
+      unsigned int                 batchSize_;
+      Orthanc::SharedMessageQueue  queue_;
+      mutable boost::mutex         mutex_;
+      std::set<std::string>        pending_;  // Queued or running deletions
+      bool                         stopped_;
+      boost::thread                thread_;
+
+      bool IsStopped() const
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        return stopped_;
+      }
+
+      bool LookupResource(int64_t& id,
+                          Orthanc::ResourceType& level,
+                          const std::string& publicId)
+      {
+        IndexConnectionsPool::Accessor accessor(pool_);
+        DatabaseManager::Transaction transaction(accessor.GetManager(), TransactionType_ReadOnly);
+
+        OrthancPluginResourceType type;
+        bool found = accessor.GetBackend().LookupResource(id, type, accessor.GetManager(), publicId.c_str());
+
+        transaction.Commit();
+
+        if (found)
+        {
+          level = MessagesToolbox::Convert(type);
+        }
+
+        return found;
+      }
+
+      void Hide(int64_t id,
+                Orthanc::ResourceType level)
+      {
+        IndexConnectionsPool::Accessor accessor(pool_);
+        accessor.GetBackend().HideResource(id, level);
+      }
+
+      void Unhide(int64_t id)
+      {
+        IndexConnectionsPool::Accessor accessor(pool_);
+        accessor.GetBackend().UnhideResource(id);
+      }
+
+      static std::string GetUri(Orthanc::ResourceType level,
+                                const std::string& publicId)
+      {
+        switch (level)
+        {
+          case Orthanc::ResourceType_Patient:
+            return "/patients/" + publicId;
+
+          case Orthanc::ResourceType_Study:
+            return "/studies/" + publicId;
+
+          case Orthanc::ResourceType_Series:
+            return "/series/" + publicId;
+
+          case Orthanc::ResourceType_Instance:
+            return "/instances/" + publicId;
+
+          default:
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+        }
+      }
+
+      /**
+       * The instances are deleted through the REST API, so that the
+       * Orthanc core removes their files and the ancestors that
+       * become empty, i.e. the series, then the studies, and finally
+       * the resource itself, each in its own short transaction.
+       **/
+      void DeleteInstances(int64_t id,
+                           Orthanc::ResourceType level)
+      {
+        std::vector<std::string> instances;
+
+        while (!IsStopped())
+        {
+          {
+            IndexConnectionsPool::Accessor accessor(pool_);
+            DatabaseManager::Transaction transaction(accessor.GetManager(), TransactionType_ReadOnly);
+            accessor.GetBackend().GetDescendantInstances(instances, accessor.GetManager(), id, level, batchSize_);
+            transaction.Commit();
+          }
+
+          if (instances.empty())
+          {
+            return;
+          }
+
+          size_t deleted = 0;
+          for (size_t i = 0; i < instances.size() && !IsStopped(); i++)
+          {
+            if (OrthancPlugins::RestApiDelete("/instances/" + instances[i], false))
+            {
+              deleted++;
+            }
+          }
+
+          if (deleted == 0 &&
+              !IsStopped())
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Cannot delete the instances of the resource");
+          }
+        }
+      }
+
+      void Process(const std::string& publicId)
+      {
+        int64_t id;
+        Orthanc::ResourceType level;
+
+        if (!LookupResource(id, level, publicId))
+        {
+          LOG(WARNING) << "Chunked deletion of an inexistent resource: " << publicId;
+          return;
+        }
+
+        if (level != Orthanc::ResourceType_Instance)
+        {
+          Hide(id, level);
+
+          try
+          {
+            DeleteInstances(id, level);
+          }
+          catch (...)
+          {
+            Unhide(id);
+            throw;
+          }
+
+          Unhide(id);
+        }
+
+        // The resource is removed together with its last instance, unless it had none
+        if (!IsStopped() &&
+            LookupResource(id, level, publicId))
+        {
+          OrthancPlugins::RestApiDelete(GetUri(level, publicId), false);
+        }
+
+        if (!IsStopped())
+        {
+          LOG(INFO) << "Chunked deletion is over: " << publicId;
+        }
+      }
+
+      static void Worker(ChunkedDeletion* that)
+      {
+        for (;;)
+        {
+          std::unique_ptr<Orthanc::IDynamicObject> obj(that->queue_.Dequeue(0));
+          if (obj.get() != NULL)
+          {
+            const ChunkedDeletionItem& item = dynamic_cast<const ChunkedDeletionItem&>(*obj);
+            if (item.IsStop())
+            {
+              return;
+            }
+
+            try
+            {
+              that->Process(item.GetPublicId());
+            }
+            catch (Orthanc::OrthancException& e)
+            {
+              LOG(ERROR) << "Error in the chunked deletion of " << item.GetPublicId() << ": " << e.What();
+            }
+            catch (...)
+            {
+              LOG(ERROR) << "Native exception in the chunked deletion of " << item.GetPublicId();
+            }
+
+            {
+              boost::mutex::scoped_lock lock(that->mutex_);
+              that->pending_.erase(item.GetPublicId());
+            }
+          }
+        }
+      }
+
+    public:
+      ChunkedDeletion(IndexConnectionsPool& pool,
+                      unsigned int batchSize) :
+        pool_(pool),
+        batchSize_(batchSize),
+        stopped_(false)
+      {
+        if (batchSize == 0)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+        }
+
+        thread_ = boost::thread(Worker, this);
+      }
+
+      ~ChunkedDeletion()
+      {
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+          stopped_ = true;  // The running deletion stops after its current instance
+        }
+
+        if (thread_.joinable())
+        {
+          queue_.Enqueue(new ChunkedDeletionItem(""));
+          thread_.join();
+        }
+      }
+
+      // Returns "false" if the deletion of this resource is already pending
+      bool Enqueue(const std::string& publicId)
+      {
+        if (publicId.empty())
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+        }
+
+        {
+          boost::mutex::scoped_lock lock(mutex_);
+          if (!pending_.insert(publicId).second)
+          {
+            return false;
+          }
+        }
+
+        queue_.Enqueue(new ChunkedDeletionItem(publicId));
+        return true;
+      }
+
+      void ListPending(Json::Value& target) const
+      {
+        target = Json::arrayValue;
+
+        boost::mutex::scoped_lock lock(mutex_);
+        for (std::set<std::string>::const_iterator it = pending_.begin(); it != pending_.end(); ++it)
+        {
+          target.append(*it);
+        }
+      }
+    };
+  }
+
+
+  static std::unique_ptr<ChunkedDeletion>  chunkedDeletion_;  // Not NULL while the backend is registered, if enabled
+
+
+  /**
+   * POST with a body "{ "ID" : ... }" queues the chunked deletion of
+   * the resource with this public ID. GET lists the resources whose
+   * deletion is queued or running.
+   **/
+  static void ChunkedDeletionRestCallback(OrthancPluginRestOutput* output,
+                                          const char* url,
+                                          const OrthancPluginHttpRequest* request)
+  {
+    if (request->method != OrthancPluginHttpMethod_Get &&
+        request->method != OrthancPluginHttpMethod_Post)
+    {
+      OrthancPlugins::AnswerMethodNotAllowed(output, "GET,POST");
+      return;
+    }
+
+    Json::Value answer = Json::objectValue;
+
+    if (chunkedDeletion_.get() != NULL)
+    {
+      if (request->method == OrthancPluginHttpMethod_Post)
+      {
+        Json::Value body;
+        if (!Orthanc::Toolbox::ReadJson(body, request->body, request->bodySize) ||
+            body.type() != Json::objectValue ||
+            !body.isMember("ID") ||
+            body["ID"].type() != Json::stringValue)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                          "The body must be a JSON object with a string field \"ID\"");
+        }
+
+        answer["ID"] = body["ID"].asString();
+        answer["Queued"] = chunkedDeletion_->Enqueue(body["ID"].asString());
+      }
+
+      chunkedDeletion_->ListPending(answer["Pending"]);
+    }
+
+    OrthancPlugins::AnswerJson(answer, output);
+  }
+
+
+  /**
+   * Runtime settings of the pool of connections. POST with a body
+   * "{ "IndexConnectionsCount" : ..., "MinIndexConnections" : ...,
+   * "HousekeepingIntervals" : { task : seconds } }" changes the
+   * settings (each field being optional), GET returns them.
+   **/
+  static void PoolRestCallback(OrthancPluginRestOutput* output,
+                               const char* url,
+                               const OrthancPluginHttpRequest* request)
+  {
+    if (request->method != OrthancPluginHttpMethod_Get &&
+        request->method != OrthancPluginHttpMethod_Post)
+    {
+      OrthancPlugins::AnswerMethodNotAllowed(output, "GET,POST");
+      return;
+    }
+
+    Json::Value answer = Json::objectValue;
+
+    if (restPool_ != NULL)
+    {
+      if (request->method == OrthancPluginHttpMethod_Post)
+      {
+        Json::Value body;
+        if (!Orthanc::Toolbox::ReadJson(body, request->body, request->bodySize) ||
+            body.type() != Json::objectValue ||
+            (body.isMember("IndexConnectionsCount") && !body["IndexConnectionsCount"].isUInt()) ||
+            (body.isMember("MinIndexConnections") && !body["MinIndexConnections"].isUInt()) ||
+            (body.isMember("HousekeepingIntervals") && body["HousekeepingIntervals"].type() != Json::objectValue))
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                          "The body must be a JSON object with the optional integer fields \"IndexConnectionsCount\" "
+                                          "and \"MinIndexConnections\", and the optional object \"HousekeepingIntervals\"");
+        }
+
+        if (body.isMember("HousekeepingIntervals"))
+        {
+          const Json::Value& intervals = body["HousekeepingIntervals"];
+          const Json::Value::Members tasks = intervals.getMemberNames();
+
+          // Validate all the intervals before applying any of them
+          for (size_t i = 0; i < tasks.size(); i++)
+          {
+            if (!intervals[tasks[i]].isUInt())
+            {
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                              "The interval of the housekeeping task " + tasks[i] + " must be a number of seconds");
+            }
+          }
+
+          for (size_t i = 0; i < tasks.size(); i++)
+          {
+            restPool_->SetHousekeepingInterval(tasks[i], intervals[tasks[i]].asUInt());
+          }
+        }
+
+        if (body.isMember("IndexConnectionsCount") ||
+            body.isMember("MinIndexConnections"))
+        {
+          size_t countConnections, minConnections;
+          restPool_->GetLimits(countConnections, minConnections);
+
+          if (body.isMember("IndexConnectionsCount"))
+          {
+            countConnections = body["IndexConnectionsCount"].asUInt();
+
+            if (!body.isMember("MinIndexConnections") &&
+                minConnections > countConnections)
+            {
+              minConnections = countConnections;
+            }
+          }
+
+          if (body.isMember("MinIndexConnections"))
+          {
+            minConnections = body["MinIndexConnections"].asUInt();
+          }
+
+          restPool_->Resize(countConnections, minConnections);
+        }
+      }
+
+      size_t countConnections, minConnections;
+      restPool_->GetLimits(countConnections, minConnections);
+      answer["IndexConnectionsCount"] = static_cast<Json::UInt64>(countConnections);
+      answer["MinIndexConnections"] = static_cast<Json::UInt64>(minConnections);
+
+      std::map<std::string, unsigned int> intervals;
+      restPool_->GetHousekeepingIntervals(intervals);
+
+      answer["HousekeepingIntervals"] = Json::objectValue;
+      for (std::map<std::string, unsigned int>::const_iterator it = intervals.begin(); it != intervals.end(); ++it)
+      {
+        answer["HousekeepingIntervals"][it->first] = it->second;
+      }
+    }
+
+    OrthancPlugins::AnswerJson(answer, output);
+  }
+
+
+  /**
+   * POST with a body "{ "Enabled" : ... }" enters or leaves the
+   * bulk-load mode of the backend, GET returns whether it is active.
+   **/
+  static void BulkLoadRestCallback(OrthancPluginRestOutput* output,
+                                   const char* url,
+                                   const OrthancPluginHttpRequest* request)
+  {
+    if (request->method != OrthancPluginHttpMethod_Get &&
+        request->method != OrthancPluginHttpMethod_Post)
+    {
+      OrthancPlugins::AnswerMethodNotAllowed(output, "GET,POST");
+      return;
+    }
+
+    Json::Value answer = Json::objectValue;
+
+    if (restPool_ != NULL)
+    {
+      // The connection that writes to the database
+      IndexConnectionsPool::Accessor accessor(*restPool_);
+
+      if (request->method == OrthancPluginHttpMethod_Post)
+      {
+        Json::Value body;
+        if (!Orthanc::Toolbox::ReadJson(body, request->body, request->bodySize) ||
+            body.type() != Json::objectValue ||
+            !body.isMember("Enabled") ||
+            body["Enabled"].type() != Json::booleanValue)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                          "The body must be a JSON object with a Boolean field \"Enabled\"");
+        }
+
+        accessor.SetOperation("BULK_LOAD");
+        accessor.GetBackend().SetBulkLoad(accessor.GetManager(), body["Enabled"].asBool());
+      }
+
+      answer["Enabled"] = accessor.GetBackend().IsBulkLoad();
+    }
+
+    OrthancPlugins::AnswerJson(answer, output);
+  }
+
+
+  static void FinalizeBackend(void* rawPool)
+  {
+    if (rawPool != NULL)
+    {
+      IndexConnectionsPool* pool = reinterpret_cast<IndexConnectionsPool*>(rawPool);
+
+      if (restPool_ == pool)
+      {
+        restPool_ = NULL;
+      }
+
+      chunkedDeletion_.reset(NULL);  // Stops the deletions, which use the pool
+      
+      if (isBackendInUse_)
+      {
+        isBackendInUse_ = false;
+      }
+      else
+      {
+        LOG(ERROR) << "More than one index backend was registered, internal error";
+      }
+
+      delete pool;
+    }
+    else
+    {
+      LOG(ERROR) << "Received a null pointer from the Orthanc core, internal error";
+    }
+  }
+
+  
+  void DatabaseBackendAdapterV4::Register(IndexBackend* backend,
                                           size_t countConnections,
                                           unsigned int maxDatabaseRetries,
                                           unsigned int housekeepingDelaySeconds)
@@ -1465,10 +3281,63 @@ namespace OrthancDatabases
     }
 
     OrthancPluginContext* context = backend->GetContext();
+
+    if (!backend->GetCaptureFile().empty())
+    {
+      LOG(WARNING) << "The requests to the index are recorded into: " << backend->GetCaptureFile();
+      recorder_.reset(new RequestsRecorder(backend->GetCaptureFile(), backend->GetCaptureBufferSize()));
+    }
+
+    if (backend->IsIngestStatistics())
+    {
+      LOG(WARNING) << "The timelines of the ingests are available at: /index/ingest-statistics";
+      ingestStatistics_.reset(new IngestStatistics(100));
+      OrthancPlugins::RegisterRestCallback<IngestStatisticsRestCallback>("/index/ingest-statistics", true);
+    }
+
+    if (!backend->GetTracesExportUrl().empty())
+    {
+      LOG(WARNING) << "The traces of the database operations are exported to: " << backend->GetTracesExportUrl();
+      tracesExporter_.reset(new TracesExporter(backend->GetTracesExportUrl(), backend->GetTracesServiceName()));
+      TracesExporter::Start(*tracesExporter_);
+    }
+
+    restPool_ = pool.get();
+
+    if (backend->IsIndexAdvisor())
+    {
+      LOG(WARNING) << "The index advisor is available at: /index/advisor";
+      OrthancPlugins::RegisterRestCallback<IndexAdvisorRestCallback>("/index/advisor", true);
+    }
+
+    OrthancPlugins::RegisterRestCallback<ChangesCursorRestCallback>("/index/changes", true);
+    OrthancPlugins::RegisterRestCallback<AttachmentsRestCallback>("/index/attachments", true);
+    OrthancPlugins::RegisterRestCallback<PoolRestCallback>("/index/pool", true);
+    OrthancPlugins::RegisterRestCallback<UpdatedResourcesRestCallback>("/index/updated-resources", true);
+
+    if (backend->IsReplicaSource())
+    {
+      LOG(WARNING) << "The content of the index is published for the replicas at: /index/replica";
+      OrthancPlugins::RegisterRestCallback<ReplicaRestCallback>("/index/replica", true);
+    }
+
+    if (backend->HasBulkLoad())
+    {
+      OrthancPlugins::RegisterRestCallback<BulkLoadRestCallback>("/index/bulk-load", true);
+    }
+
+    if (backend->GetChunkedDeletionBatchSize() > 0)
+    {
+      LOG(WARNING) << "The chunked deletions are available at: /index/chunked-delete";
+      chunkedDeletion_.reset(new ChunkedDeletion(*pool, backend->GetChunkedDeletionBatchSize()));
+      OrthancPlugins::RegisterRestCallback<ChunkedDeletionRestCallback>("/index/chunked-delete", true);
+    }
  
     if (OrthancPluginRegisterDatabaseBackendV4(context, pool.release(), maxDatabaseRetries,
                                                CallBackend, FinalizeBackend) != OrthancPluginErrorCode_Success)
     {
+      restPool_ = NULL;
+      chunkedDeletion_.reset(NULL);
       delete backend;
       throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Unable to register the database backend");
     }
@@ -1483,6 +3352,273 @@ namespace OrthancDatabases
     {
       LOG(ERROR) << "The Orthanc core has not destructed the index backend, internal error";
     }
+
+    recorder_.reset(NULL);  // Writes the pending records
+    ingestStatistics_.reset(NULL);
+
+    if (tracesExporter_.get() != NULL)
+    {
+      TracesExporter::Stop();
+      tracesExporter_.reset(NULL);  // Sends the pending spans
+    }
+  }
+
+
+  void DatabaseBackendAdapterV4::ExecuteRequest(Orthanc::DatabasePluginMessages::Response& response,
+                                                const Orthanc::DatabasePluginMessages::Request& request,
+                                                IndexConnectionsPool& pool)
+  {
+    ProcessRequest(response, request, pool, GetOperationName(request));
+  }
+
+
+  void DatabaseBackendAdapterV4::Replay(uint64_t& countRequests,
+                                        uint64_t& countErrors,
+                                        uint64_t& countSerializationFailures,
+                                        IndexConnectionsPool& pool,
+                                        const std::string& path)
+  {
+    countRequests = 0;
+    countErrors = 0;
+    countSerializationFailures = 0;
+
+    std::ifstream stream(path.c_str(), std::ios::binary);
+    if (!stream.good())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentFile, "Cannot open the capture file: " + path);
+    }
+
+    typedef std::map<int64_t, ReplayedTransaction*>  Transactions;
+
+    Transactions active;  // Indexed by the captured identifiers
+    std::list<ReplayedTransaction*> finished;
+
+    try
+    {
+      RequestsRecorder::Record record;
+
+      while (record.Read(stream))
+      {
+        std::unique_ptr<ReplayedRequest> request(new ReplayedRequest(false));
+        if (!request->GetRequest().ParseFromString(record.GetRequest()))
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Bad request in the capture file: " + path);
+        }
+
+        countRequests++;
+
+        const int64_t id = record.GetTransaction();
+
+        if (IsStartTransaction(request->GetRequest()))
+        {
+          Transactions::iterator found = active.find(id);
+          if (found != active.end())
+          {
+            // The capture has missed the end of the previous transaction at the same address
+            finished.push_back(found->second);
+            active.erase(found);
+          }
+
+          std::unique_ptr<ReplayedTransaction> replayed(new ReplayedTransaction(pool));
+          replayed->Enqueue(request.release());
+          active[id] = replayed.release();
+        }
+        else if (id != 0)
+        {
+          Transactions::iterator found = active.find(id);
+          if (found == active.end())
+          {
+            countErrors++;  // The capture has started in the middle of the transaction
+          }
+          else
+          {
+            const bool isFinalize = IsDatabaseOperation(request->GetRequest(), Orthanc::DatabasePluginMessages::OPERATION_FINALIZE_TRANSACTION);
+            found->second->Enqueue(request.release());
+
+            if (isFinalize)
+            {
+              finished.push_back(found->second);
+              active.erase(found);
+            }
+          }
+        }
+        else if (IsDatabaseOperation(request->GetRequest(), Orthanc::DatabasePluginMessages::OPERATION_OPEN) ||
+                 IsDatabaseOperation(request->GetRequest(), Orthanc::DatabasePluginMessages::OPERATION_CLOSE) ||
+                 IsDatabaseOperation(request->GetRequest(), Orthanc::DatabasePluginMessages::OPERATION_UPGRADE))
+        {
+          // The pool is managed by the caller
+        }
+        else
+        {
+          try
+          {
+            Orthanc::DatabasePluginMessages::Response response;
+            ProcessRequest(response, request->GetRequest(), pool, GetOperationName(request->GetRequest()));
+          }
+          catch (Orthanc::OrthancException&)
+          {
+            countErrors++;
+          }
+        }
+      }
+    }
+    catch (...)
+    {
+      for (Transactions::iterator it = active.begin(); it != active.end(); ++it)
+      {
+        delete it->second;
+      }
+
+      for (std::list<ReplayedTransaction*>::iterator it = finished.begin(); it != finished.end(); ++it)
+      {
+        delete *it;
+      }
+
+      throw;
+    }
+
+    for (Transactions::iterator it = active.begin(); it != active.end(); ++it)
+    {
+      finished.push_back(it->second);
+    }
+
+    for (std::list<ReplayedTransaction*>::iterator it = finished.begin(); it != finished.end(); ++it)
+    {
+      (*it)->Join();
+      countErrors += (*it)->GetCountErrors();
+      countSerializationFailures += (*it)->GetCountSerializationFailures();
+      delete *it;
+    }
+  }
+
+
+  namespace
+  {
+    class TransactionSummary
+    {
+    private:
+      uint64_t  start_;
+      uint64_t  end_;
+      int64_t   connection_;
+      unsigned int  countRequests_;
+
+    public:
+      explicit TransactionSummary(const RequestsRecorder::Record& record) :
+        start_(record.GetTimestamp()),
+        end_(record.GetTimestamp() + record.GetDuration()),
+        connection_(record.GetConnection()),
+        countRequests_(1)
+      {
+      }
+
+      void Add(const RequestsRecorder::Record& record)
+      {
+        end_ = std::max(end_, record.GetTimestamp() + record.GetDuration());
+        countRequests_++;
+
+        if (record.GetConnection() != 0)
+        {
+          connection_ = record.GetConnection();
+        }
+      }
+
+      uint64_t GetStart() const
+      {
+        return start_;
+      }
+
+      uint64_t GetDuration() const
+      {
+        return end_ - start_;
+      }
+
+      int64_t GetConnection() const
+      {
+        return connection_;
+      }
+
+      unsigned int GetCountRequests() const
+      {
+        return countRequests_;
+      }
+
+      bool operator< (const TransactionSummary& other) const
+      {
+        return GetDuration() > other.GetDuration();  // The longest first
+      }
+    };
+  }
+
+
+  void DatabaseBackendAdapterV4::LogLongestTransactions(const std::string& path,
+                                                        size_t count)
+  {
+    std::ifstream stream(path.c_str(), std::ios::binary);
+    if (!stream.good())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentFile, "Cannot open the capture file: " + path);
+    }
+
+    std::map<int64_t, TransactionSummary> active;
+    std::vector<TransactionSummary> finished;
+
+    RequestsRecorder::Record record;
+
+    while (record.Read(stream))
+    {
+      if (record.GetTransaction() == 0)
+      {
+        continue;
+      }
+
+      Orthanc::DatabasePluginMessages::Request request;
+      if (!request.ParseFromString(record.GetRequest()))
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Bad request in the capture file: " + path);
+      }
+
+      std::map<int64_t, TransactionSummary>::iterator found = active.find(record.GetTransaction());
+
+      if (IsStartTransaction(request))
+      {
+        if (found != active.end())
+        {
+          finished.push_back(found->second);
+          active.erase(found);
+        }
+
+        active.insert(std::make_pair(record.GetTransaction(), TransactionSummary(record)));
+      }
+      else if (found != active.end())
+      {
+        found->second.Add(record);
+
+        if (IsDatabaseOperation(request, Orthanc::DatabasePluginMessages::OPERATION_FINALIZE_TRANSACTION))
+        {
+          finished.push_back(found->second);
+          active.erase(found);
+        }
+      }
+    }
+
+    for (std::map<int64_t, TransactionSummary>::const_iterator it = active.begin(); it != active.end(); ++it)
+    {
+      finished.push_back(it->second);
+    }
+
+    std::sort(finished.begin(), finished.end());
+
+    const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+
+    for (size_t i = 0; i < finished.size() && i < count; i++)
+    {
+      const boost::posix_time::ptime start = epoch + boost::posix_time::microseconds(finished[i].GetStart());
+
+      LOG(WARNING) << "Transaction started at " << boost::posix_time::to_iso_extended_string(start)
+                   << " has held connection " << std::hex << finished[i].GetConnection() << std::dec
+                   << " during " << (finished[i].GetDuration() / 1000) << "ms ("
+                   << finished[i].GetCountRequests() << " requests)";
+    }
   }
 }
 
@@ -30,8 +30,12 @@
 #if defined(ORTHANC_PLUGINS_VERSION_IS_ABOVE)         // Macro introduced in Orthanc 1.3.1
 #  if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 0)
 
+#include <OrthancDatabasePlugin.pb.h>  // Include protobuf messages
+
 namespace OrthancDatabases
 {  
+  class IndexConnectionsPool;
+
   /**
    * @brief Bridge between C and C++ database engines.
    * 
@@ -54,6 +58,36 @@ namespace OrthancDatabases
                          unsigned int housekeepingDelaySeconds);
 
     static void Finalize();
+
+    /**
+     * Processes one request of the Orthanc core against a pool whose
+     * connections are open, as the registered callback does (e.g. for
+     * the unit tests), but without the statistics and the captures.
+     **/
+    static void ExecuteRequest(Orthanc::DatabasePluginMessages::Response& response,
+                               const Orthanc::DatabasePluginMessages::Request& request,
+                               IndexConnectionsPool& pool);
+
+    /**
+     * Replays the requests that were captured by the "CaptureFile"
+     * option of the backend (cf. "IndexBackend::SetCaptureFile()"),
+     * against a pool whose connections are open. Each captured
+     * transaction is replayed by a separate thread in the order of
+     * the capture, which reproduces the contention between the
+     * transactions of a production server.
+     **/
+    static void Replay(uint64_t& countRequests,
+                       uint64_t& countErrors,
+                       uint64_t& countSerializationFailures,
+                       IndexConnectionsPool& pool,
+                       const std::string& path);
+
+    /**
+     * Logs the transactions of a capture that have held a connection
+     * for the longest time, from their start to their finalization.
+     **/
+    static void LogLongestTransactions(const std::string& path,
+                                       size_t count);
   };
 }
 
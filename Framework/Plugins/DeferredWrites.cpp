@@ -0,0 +1,178 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "DeferredWrites.h"
+
+#include <OrthancException.h>
+
+
+namespace OrthancDatabases
+{
+  void DeferredWrites::Touch(WriteKind kind)
+  {
+    if (!CanAdd(kind))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    empty_ = false;
+    lastKind_ = kind;
+  }
+
+
+  void DeferredWrites::Clear()
+  {
+    empty_ = true;
+    lastKind_ = WriteKind_ResourcesContent;
+    identifierTags_.clear();
+    mainDicomTags_.clear();
+    resourcesMetadata_.clear();
+    attachments_.clear();
+    metadata_.clear();
+    changes_.clear();
+    exportedResources_.clear();
+  }
+
+
+  void DeferredWrites::AddIdentifierTag(int64_t resource,
+                                        uint16_t group,
+                                        uint16_t element,
+                                        const std::string& value)
+  {
+    Touch(WriteKind_ResourcesContent);
+
+    Tag tag;
+    tag.resource_ = resource;
+    tag.group_ = group;
+    tag.element_ = element;
+    tag.value_ = value;
+    identifierTags_.push_back(tag);
+  }
+
+
+  void DeferredWrites::AddMainDicomTag(int64_t resource,
+                                       uint16_t group,
+                                       uint16_t element,
+                                       const std::string& value)
+  {
+    Touch(WriteKind_ResourcesContent);
+
+    Tag tag;
+    tag.resource_ = resource;
+    tag.group_ = group;
+    tag.element_ = element;
+    tag.value_ = value;
+    mainDicomTags_.push_back(tag);
+  }
+
+
+  void DeferredWrites::AddResourceMetadata(int64_t resource,
+                                           int32_t type,
+                                           const std::string& value)
+  {
+    Touch(WriteKind_ResourcesContent);
+
+    ResourceMetadata metadata;
+    metadata.resource_ = resource;
+    metadata.type_ = type;
+    metadata.value_ = value;
+    metadata.revision_ = 0;
+    resourcesMetadata_.push_back(metadata);
+  }
+
+
+  void DeferredWrites::AddAttachment(int64_t resource,
+                                     const OrthancPluginAttachment& attachment,
+                                     int64_t revision)
+  {
+    Touch(WriteKind_Attachment);
+
+    Attachment item;
+    item.resource_ = resource;
+    item.uuid_ = attachment.uuid;
+    item.contentType_ = attachment.contentType;
+    item.uncompressedSize_ = attachment.uncompressedSize;
+    item.uncompressedHash_ = attachment.uncompressedHash;
+    item.compressionType_ = attachment.compressionType;
+    item.compressedSize_ = attachment.compressedSize;
+    item.compressedHash_ = attachment.compressedHash;
+    item.revision_ = revision;
+    attachments_.push_back(item);
+  }
+
+
+  void DeferredWrites::AddMetadata(int64_t resource,
+                                   int32_t type,
+                                   const std::string& value,
+                                   int64_t revision)
+  {
+    Touch(WriteKind_Metadata);
+
+    ResourceMetadata metadata;
+    metadata.resource_ = resource;
+    metadata.type_ = type;
+    metadata.value_ = value;
+    metadata.revision_ = revision;
+    metadata_.push_back(metadata);
+  }
+
+
+  void DeferredWrites::AddChange(int32_t changeType,
+                                 int64_t resource,
+                                 OrthancPluginResourceType resourceType,
+                                 const std::string& date)
+  {
+    Touch(WriteKind_Change);
+
+    Change change;
+    change.changeType_ = changeType;
+    change.resource_ = resource;
+    change.resourceType_ = resourceType;
+    change.date_ = date;
+    changes_.push_back(change);
+  }
+
+
+  void DeferredWrites::AddExportedResource(OrthancPluginResourceType resourceType,
+                                           const std::string& publicId,
+                                           const std::string& modality,
+                                           const std::string& date,
+                                           const std::string& patientId,
+                                           const std::string& studyInstanceUid,
+                                           const std::string& seriesInstanceUid,
+                                           const std::string& sopInstanceUid)
+  {
+    Touch(WriteKind_ExportedResource);
+
+    ExportedResource resource;
+    resource.resourceType_ = resourceType;
+    resource.publicId_ = publicId;
+    resource.modality_ = modality;
+    resource.date_ = date;
+    resource.patientId_ = patientId;
+    resource.studyInstanceUid_ = studyInstanceUid;
+    resource.seriesInstanceUid_ = seriesInstanceUid;
+    resource.sopInstanceUid_ = sopInstanceUid;
+    exportedResources_.push_back(resource);
+  }
+}
@@ -0,0 +1,213 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <orthanc/OrthancCDatabasePlugin.h>
+
+#include <boost/noncopyable.hpp>
+#include <string>
+#include <vector>
+
+
+namespace OrthancDatabases
+{
+  /**
+   * Write operations of a transaction whose execution is postponed,
+   * so that they can be sent to the database server at once. This is
+   * used by the V4 adapter to batch the write operations that the
+   * Orthanc core issues while ingesting an instance, and whose
+   * answer is empty. The writes must be flushed before any other
+   * operation of the transaction.
+   *
+   * The kinds of writes must be added in the order of the
+   * "WriteKind" enumeration, which is the order in which they are
+   * flushed. "CanAdd()" returns "false" if adding a write would break
+   * this order, in which case the previous writes must be flushed.
+   **/
+  class DeferredWrites : public boost::noncopyable
+  {
+  public:
+    enum WriteKind
+    {
+      WriteKind_ResourcesContent = 0,
+      WriteKind_Attachment = 1,
+      WriteKind_Metadata = 2,
+      WriteKind_Change = 3,
+      WriteKind_ExportedResource = 4
+    };
+
+    struct Tag
+    {
+      int64_t      resource_;
+      uint16_t     group_;
+      uint16_t     element_;
+      std::string  value_;
+    };
+
+    struct ResourceMetadata
+    {
+      int64_t      resource_;
+      int32_t      type_;
+      std::string  value_;
+      int64_t      revision_;
+    };
+
+    struct Attachment
+    {
+      int64_t      resource_;
+      std::string  uuid_;
+      int32_t      contentType_;
+      uint64_t     uncompressedSize_;
+      std::string  uncompressedHash_;
+      int32_t      compressionType_;
+      uint64_t     compressedSize_;
+      std::string  compressedHash_;
+      int64_t      revision_;
+    };
+
+    struct Change
+    {
+      int32_t                     changeType_;
+      int64_t                     resource_;
+      OrthancPluginResourceType   resourceType_;
+      std::string                 date_;
+    };
+
+    struct ExportedResource
+    {
+      OrthancPluginResourceType   resourceType_;
+      std::string                 publicId_;
+      std::string                 modality_;
+      std::string                 date_;
+      std::string                 patientId_;
+      std::string                 studyInstanceUid_;
+      std::string                 seriesInstanceUid_;
+      std::string                 sopInstanceUid_;
+    };
+
+  private:
+    bool                           empty_;
+    WriteKind                      lastKind_;
+    std::vector<Tag>               identifierTags_;
+    std::vector<Tag>               mainDicomTags_;
+    std::vector<ResourceMetadata>  resourcesMetadata_;   // From "SetResourcesContent()"
+    std::vector<Attachment>        attachments_;
+    std::vector<ResourceMetadata>  metadata_;            // From "SetMetadata()"
+    std::vector<Change>            changes_;
+    std::vector<ExportedResource>  exportedResources_;
+
+    void Touch(WriteKind kind);
+
+  public:
+    DeferredWrites() :
+      empty_(true),
+      lastKind_(WriteKind_ResourcesContent)
+    {
+    }
+
+    bool IsEmpty() const
+    {
+      return empty_;
+    }
+
+    bool CanAdd(WriteKind kind) const
+    {
+      return (empty_ || kind >= lastKind_);
+    }
+
+    void Clear();
+
+    void AddIdentifierTag(int64_t resource,
+                          uint16_t group,
+                          uint16_t element,
+                          const std::string& value);
+
+    void AddMainDicomTag(int64_t resource,
+                         uint16_t group,
+                         uint16_t element,
+                         const std::string& value);
+
+    void AddResourceMetadata(int64_t resource,
+                             int32_t type,
+                             const std::string& value);
+
+    void AddAttachment(int64_t resource,
+                       const OrthancPluginAttachment& attachment,
+                       int64_t revision);
+
+    void AddMetadata(int64_t resource,
+                     int32_t type,
+                     const std::string& value,
+                     int64_t revision);
+
+    void AddChange(int32_t changeType,
+                   int64_t resource,
+                   OrthancPluginResourceType resourceType,
+                   const std::string& date);
+
+    void AddExportedResource(OrthancPluginResourceType resourceType,
+                             const std::string& publicId,
+                             const std::string& modality,
+                             const std::string& date,
+                             const std::string& patientId,
+                             const std::string& studyInstanceUid,
+                             const std::string& seriesInstanceUid,
+                             const std::string& sopInstanceUid);
+
+    const std::vector<Tag>& GetIdentifierTags() const
+    {
+      return identifierTags_;
+    }
+
+    const std::vector<Tag>& GetMainDicomTags() const
+    {
+      return mainDicomTags_;
+    }
+
+    const std::vector<ResourceMetadata>& GetResourcesMetadata() const
+    {
+      return resourcesMetadata_;
+    }
+
+    const std::vector<Attachment>& GetAttachments() const
+    {
+      return attachments_;
+    }
+
+    const std::vector<ResourceMetadata>& GetMetadata() const
+    {
+      return metadata_;
+    }
+
+    const std::vector<Change>& GetChanges() const
+    {
+      return changes_;
+    }
+
+    const std::vector<ExportedResource>& GetExportedResources() const
+    {
+      return exportedResources_;
+    }
+  };
+}
@@ -0,0 +1,204 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "FilesystemStorage.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <boost/filesystem/fstream.hpp>
+
+
+namespace OrthancDatabases
+{
+  boost::filesystem::path FilesystemStorage::GetPath(const std::string& uuid) const
+  {
+    // Prevents the uuid from escaping the root directory
+    if (!Orthanc::Toolbox::IsUuid(uuid))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    return root_ / uuid.substr(0, 2) / uuid.substr(2, 2) / uuid;
+  }
+
+
+  FilesystemStorage::FilesystemStorage(const std::string& root) :
+    root_(root)
+  {
+    if (root.empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    try
+    {
+      boost::filesystem::create_directories(root_);
+    }
+    catch (boost::filesystem::filesystem_error& e)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_DirectoryExpected,
+                                      "Cannot create the storage directory: " + root + " (" + e.what() + ")");
+    }
+  }
+
+
+  void FilesystemStorage::Create(const std::string& uuid,
+                                 const void* content,
+                                 size_t size)
+  {
+    const boost::filesystem::path path = GetPath(uuid);
+
+    try
+    {
+      boost::filesystem::create_directories(path.parent_path());
+    }
+    catch (boost::filesystem::filesystem_error&)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_DirectoryExpected);
+    }
+
+    if (boost::filesystem::exists(path))
+    {
+      // Same behavior as the "PRIMARY KEY" of the "StorageArea" table
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "File already exists in the storage area: " + uuid);
+    }
+
+    {
+      boost::filesystem::ofstream f(path, std::ofstream::out | std::ofstream::binary);
+      if (!f.good())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile);
+      }
+
+      if (size > 0)
+      {
+        f.write(reinterpret_cast<const char*>(content), size);
+      }
+
+      f.close();
+
+      if (!f.good())
+      {
+        // Don't leave a truncated file, e.g. if the disk is full
+        boost::system::error_code error;
+        boost::filesystem::remove(path, error);
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile);
+      }
+    }
+  }
+
+
+  bool FilesystemStorage::Exists(const std::string& uuid) const
+  {
+    return boost::filesystem::exists(GetPath(uuid));
+  }
+
+
+  uint64_t FilesystemStorage::GetSize(const std::string& uuid) const
+  {
+    boost::system::error_code error;
+    const uintmax_t size = boost::filesystem::file_size(GetPath(uuid), error);
+
+    if (error)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "Unknown file in the storage area: " + uuid);
+    }
+    else
+    {
+      return static_cast<uint64_t>(size);
+    }
+  }
+
+
+  void FilesystemStorage::ReadRange(void* target,
+                                    const std::string& uuid,
+                                    uint64_t start,
+                                    size_t length) const
+  {
+    if (length == 0)
+    {
+      return;
+    }
+
+    boost::filesystem::ifstream f(GetPath(uuid), std::ifstream::in | std::ifstream::binary);
+    if (!f.good())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "Unknown file in the storage area: " + uuid);
+    }
+
+    f.seekg(static_cast<std::streamoff>(start), std::ios::beg);
+    f.read(reinterpret_cast<char*>(target), static_cast<std::streamsize>(length));
+
+    if (!f.good() ||
+        f.gcount() != static_cast<std::streamsize>(length))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRange);
+    }
+  }
+
+
+  void FilesystemStorage::ReadWhole(std::string& target,
+                                    const std::string& uuid) const
+  {
+    const uint64_t size = GetSize(uuid);
+
+    if (static_cast<uint64_t>(static_cast<size_t>(size)) != size)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory);
+    }
+
+    target.resize(static_cast<size_t>(size));
+
+    if (size > 0)
+    {
+      ReadRange(&target[0], uuid, 0, static_cast<size_t>(size));
+    }
+  }
+
+
+  void FilesystemStorage::Remove(const std::string& uuid)
+  {
+    const boost::filesystem::path path = GetPath(uuid);
+
+    boost::system::error_code error;
+    boost::filesystem::remove(path, error);
+
+    if (error)
+    {
+      LOG(WARNING) << "Cannot remove file from the storage area: " << path.string();
+    }
+    else
+    {
+      // Remove the two levels of parent directories if they are
+      // empty, as the Orthanc core does
+      boost::filesystem::remove(path.parent_path(), error);
+      if (!error)
+      {
+        boost::filesystem::remove(path.parent_path().parent_path(), error);
+      }
+    }
+  }
+}
@@ -0,0 +1,75 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include <boost/filesystem.hpp>
+#include <boost/noncopyable.hpp>
+#include <stdint.h>
+#include <string>
+
+
+namespace OrthancDatabases
+{
+  /**
+   * Stores files in a directory, using the same layout as the default
+   * filesystem storage area of the Orthanc core (i.e.
+   * "root/ab/cd/abcd..."), so that both can share the same directory.
+   * This class is thread-safe, as each file is only written once.
+   **/
+  class FilesystemStorage : public boost::noncopyable
+  {
+  private:
+    boost::filesystem::path  root_;
+
+    boost::filesystem::path GetPath(const std::string& uuid) const;
+
+  public:
+    explicit FilesystemStorage(const std::string& root);
+
+    const boost::filesystem::path& GetRoot() const
+    {
+      return root_;
+    }
+
+    void Create(const std::string& uuid,
+                const void* content,
+                size_t size);
+
+    bool Exists(const std::string& uuid) const;
+
+    uint64_t GetSize(const std::string& uuid) const;
+
+    // Reads exactly "length" bytes, starting at offset "start"
+    void ReadRange(void* target,
+                   const std::string& uuid,
+                   uint64_t start,
+                   size_t length) const;
+
+    void ReadWhole(std::string& target,
+                   const std::string& uuid) const;
+
+    void Remove(const std::string& uuid);
+  };
+}
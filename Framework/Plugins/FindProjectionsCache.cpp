@@ -0,0 +1,52 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "FindProjectionsCache.h"
+
+
+namespace OrthancDatabases
+{
+  // As the time-to-live is infinite, the current time is irrelevant
+  static const boost::posix_time::ptime ANY_TIME(boost::posix_time::min_date_time);
+
+
+  FindProjectionsCache::FindProjectionsCache()
+  {
+    cache_.SetMaxSize(256);  // The number of distinct shapes is small in practice
+  }
+
+
+  bool FindProjectionsCache::Lookup(Projection& target,
+                                    const std::string& shape)
+  {
+    return cache_.Lookup(target, shape, 0, ANY_TIME);
+  }
+
+
+  void FindProjectionsCache::Store(const std::string& shape,
+                                   const Projection& projection)
+  {
+    cache_.Store(shape, projection, 0, ANY_TIME);
+  }
+}
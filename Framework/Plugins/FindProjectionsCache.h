@@ -0,0 +1,69 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "TimedLruCache.h"
+
+#include <vector>
+
+
+namespace OrthancDatabases
+{
+  /**
+   * The SQL of the branches of "ExecuteFind()" that follow the lookup
+   * (i.e. the projection of the answers) only depends on the shape of
+   * the request: its level and the content to be retrieved, not on
+   * its constraints. This class remembers the SQL of the recent
+   * shapes, so that it is only formatted once. The projections never
+   * expire. This class is thread-safe.
+   **/
+  class FindProjectionsCache : public boost::noncopyable
+  {
+  public:
+    struct Projection
+    {
+      std::string               oneInstanceCTEs_;
+      std::vector<std::string>  branches_;
+    };
+
+  private:
+    TimedLruCache<Projection>  cache_;
+
+  public:
+    FindProjectionsCache();
+
+    // "0" disables the cache
+    void SetMaxSize(size_t maxSize)
+    {
+      cache_.SetMaxSize(maxSize);
+    }
+
+    bool Lookup(Projection& target,
+                const std::string& shape);
+
+    void Store(const std::string& shape,
+               const Projection& projection);
+  };
+}
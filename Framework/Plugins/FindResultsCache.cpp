@@ -0,0 +1,51 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "FindResultsCache.h"
+
+
+namespace OrthancDatabases
+{
+  static const size_t MAX_FIND_RESULTS_CACHE_SIZE = 256;
+  static const size_t MAX_FIND_RESULTS_ANSWER_SIZE = 1024 * 1024;
+
+
+  void FindResultsCache::SetTimeToLive(unsigned int seconds)
+  {
+    cache_.SetTimeToLive(seconds);
+    cache_.SetMaxSize(seconds == 0 ? 0 : MAX_FIND_RESULTS_CACHE_SIZE);
+  }
+
+
+  void FindResultsCache::Store(const std::string& key,
+                               const std::string& answer,
+                               int64_t lastChange,
+                               const boost::posix_time::ptime& now)
+  {
+    if (answer.size() <= MAX_FIND_RESULTS_ANSWER_SIZE)
+    {
+      cache_.Store(key, answer, lastChange, now);
+    }
+  }
+}
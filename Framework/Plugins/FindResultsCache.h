@@ -0,0 +1,79 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "TimedLruCache.h"
+
+
+namespace OrthancDatabases
+{
+  /**
+   * Remembers the serialized answers of "ExecuteFind()" for a short
+   * period of time, so that the same lookup that is repeatedly issued
+   * by polling clients (e.g. worklists or viewers) is not recomputed.
+   * Each answer is tagged with the last change index of the database
+   * at the time it was computed: It is dropped as soon as a new change
+   * is logged. The writes that do not log a change (labels, deletions)
+   * clear the whole cache once committed. This class is thread-safe.
+   **/
+  class FindResultsCache : public boost::noncopyable
+  {
+  private:
+    TimedLruCache<std::string>  cache_;
+
+  public:
+    // "0" disables the cache
+    void SetTimeToLive(unsigned int seconds);
+
+    bool IsEnabled()
+    {
+      return cache_.IsEnabled();
+    }
+
+    bool Lookup(std::string& answer,
+                const std::string& key,
+                int64_t lastChange,
+                const boost::posix_time::ptime& now)
+    {
+      return cache_.Lookup(answer, key, lastChange, now);
+    }
+
+    // The answers that are too large are not stored
+    void Store(const std::string& key,
+               const std::string& answer,
+               int64_t lastChange,
+               const boost::posix_time::ptime& now);
+
+    void Clear()
+    {
+      cache_.Clear();
+    }
+
+    size_t GetSize()
+    {
+      return cache_.GetSize();
+    }
+  };
+}
@@ -0,0 +1,151 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "GlobalPropertiesCache.h"
+
+#include "GlobalProperties.h"
+
+
+namespace OrthancDatabases
+{
+  // Incremented by "ServerIndex::IncrementGlobalSequence()" in the Orthanc core
+  static const int32_t GLOBAL_PROPERTY_ANONYMIZATION_SEQUENCE = 3;
+
+
+  GlobalPropertiesCache::GlobalPropertiesCache() :
+    enabled_(false),
+    revision_(0)
+  {
+  }
+
+
+  void GlobalPropertiesCache::SetTimeToLive(unsigned int seconds)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    timeToLive_ = boost::posix_time::seconds(seconds);
+    enabled_ = (seconds != 0);
+    content_.clear();
+  }
+
+
+  bool GlobalPropertiesCache::IsEnabled()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return enabled_;
+  }
+
+
+  bool GlobalPropertiesCache::IsCacheable(int32_t property)
+  {
+    return (property != GLOBAL_PROPERTY_ANONYMIZATION_SEQUENCE &&
+            (property < Orthanc::GlobalProperty_DatabaseInternal0 ||
+             property > Orthanc::GlobalProperty_DatabaseInternal9));
+  }
+
+
+  uint64_t GlobalPropertiesCache::GetRevision()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return revision_;
+  }
+
+
+  bool GlobalPropertiesCache::Lookup(bool& found,
+                                     std::string& value,
+                                     const std::string& server,
+                                     int32_t property,
+                                     const boost::posix_time::ptime& now)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    Content::iterator it = content_.find(std::make_pair(server, property));
+
+    if (it == content_.end())
+    {
+      return false;
+    }
+    else if (it->second.expiration_ <= now)
+    {
+      content_.erase(it);
+      return false;
+    }
+    else
+    {
+      found = it->second.found_;
+
+      if (found)
+      {
+        value = it->second.value_;
+      }
+
+      return true;
+    }
+  }
+
+
+  void GlobalPropertiesCache::Store(const std::string& server,
+                                    int32_t property,
+                                    bool found,
+                                    const std::string& value,
+                                    uint64_t revision,
+                                    const boost::posix_time::ptime& now)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (enabled_ &&
+        revision == revision_ &&
+        IsCacheable(property))
+    {
+      Item& item = content_[std::make_pair(server, property)];
+      item.found_ = found;
+      item.value_ = (found ? value : "");
+      item.expiration_ = now + timeToLive_;
+    }
+  }
+
+
+  void GlobalPropertiesCache::Invalidate(const std::string& server,
+                                         int32_t property)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    content_.erase(std::make_pair(server, property));
+    revision_++;
+  }
+
+
+  void GlobalPropertiesCache::InvalidateAll()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    content_.clear();
+    revision_++;
+  }
+
+
+  size_t GlobalPropertiesCache::GetSize()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return content_.size();
+  }
+}
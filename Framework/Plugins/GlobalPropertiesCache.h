@@ -0,0 +1,106 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <map>
+#include <stdint.h>
+#include <string>
+
+
+namespace OrthancDatabases
+{
+  /**
+   * In-process copy of the rows of the "GlobalProperties" and
+   * "ServerProperties" tables that are read outside of the read-write
+   * transactions, including the properties that are missing. The
+   * properties are
+   * invalidated by the writes of this process, and can be outdated by
+   * at most the time-to-live with respect to the writes of other
+   * processes, unless the cache invalidations are enabled. The
+   * internal properties of the plugins and the anonymization sequence
+   * are never cached, as they are incremented by read-modify-write
+   * transactions. This class is thread-safe.
+   **/
+  class GlobalPropertiesCache : public boost::noncopyable
+  {
+  private:
+    struct Item
+    {
+      bool                      found_;
+      std::string               value_;
+      boost::posix_time::ptime  expiration_;
+    };
+
+    typedef std::pair<std::string, int32_t>  Key;  // Server identifier (empty if global), property
+    typedef std::map<Key, Item>              Content;
+
+    boost::mutex                      mutex_;
+    boost::posix_time::time_duration  timeToLive_;
+    bool                              enabled_;
+    Content                           content_;
+    uint64_t                          revision_;
+
+  public:
+    GlobalPropertiesCache();
+
+    // "0" disables the cache
+    void SetTimeToLive(unsigned int seconds);
+
+    bool IsEnabled();
+
+    static bool IsCacheable(int32_t property);
+
+    /**
+     * The revision must be read before reading a property from the
+     * database: The property is not stored if a write has happened in
+     * the meantime, as it might miss this write.
+     **/
+    uint64_t GetRevision();
+
+    // Returns "false" if the property is not cached, "found" tells whether the property exists
+    bool Lookup(bool& found,
+                std::string& value,
+                const std::string& server,
+                int32_t property,
+                const boost::posix_time::ptime& now);
+
+    void Store(const std::string& server,
+               int32_t property,
+               bool found,
+               const std::string& value,
+               uint64_t revision,
+               const boost::posix_time::ptime& now);
+
+    // To be called once the write of the property is committed
+    void Invalidate(const std::string& server,
+                    int32_t property);
+
+    void InvalidateAll();
+
+    size_t GetSize();
+  };
+}
@@ -0,0 +1,64 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "HiddenResources.h"
+
+
+namespace OrthancDatabases
+{
+  void HiddenResources::Hide(int64_t id,
+                             Orthanc::ResourceType level)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    content_[id] = level;
+  }
+
+
+  void HiddenResources::Unhide(int64_t id)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    content_.erase(id);
+  }
+
+
+  bool HiddenResources::IsEmpty() const
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return content_.empty();
+  }
+
+
+  void HiddenResources::GetSnapshot(Snapshot& target) const
+  {
+    target.clear();
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    // The map is ordered by internal ID, so each vector is sorted
+    for (Content::const_iterator it = content_.begin(); it != content_.end(); ++it)
+    {
+      target[it->second].push_back(it->first);
+    }
+  }
+}
@@ -0,0 +1,67 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include <Enumerations.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <map>
+#include <stdint.h>
+#include <vector>
+
+
+namespace OrthancDatabases
+{
+  /**
+   * The resources whose chunked deletion is in progress (cf. the
+   * "ChunkedDeletionBatchSize" option). They are hidden from the
+   * lookups, together with their descendants, until their deletion
+   * is over. The marker only lives in this process: The other Orthanc
+   * servers that share the database see the resources shrink, batch
+   * after batch. This class is thread-safe.
+   **/
+  class HiddenResources : public boost::noncopyable
+  {
+  public:
+    typedef std::map<Orthanc::ResourceType, std::vector<int64_t> >  Snapshot;  // Sorted internal IDs per level
+
+  private:
+    typedef std::map<int64_t, Orthanc::ResourceType>  Content;
+
+    mutable boost::mutex  mutex_;
+    Content               content_;
+
+  public:
+    void Hide(int64_t id,
+              Orthanc::ResourceType level);
+
+    void Unhide(int64_t id);
+
+    bool IsEmpty() const;
+
+    void GetSnapshot(Snapshot& target) const;
+  };
+}
@@ -0,0 +1,182 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "HousekeepingScheduler.h"
+
+#include <OrthancException.h>
+
+
+namespace OrthancDatabases
+{
+  void HousekeepingScheduler::AddTask(const std::string& name,
+                                      unsigned int intervalSeconds,
+                                      const boost::posix_time::ptime& now)
+  {
+    if (intervalSeconds != 0)
+    {
+      Task task;
+      task.name_ = name;
+      task.interval_ = boost::posix_time::seconds(intervalSeconds);
+      task.due_ = now + task.interval_;
+      task.next_ = task.due_;
+      tasks_.push_back(task);
+    }
+  }
+
+
+  const std::string& HousekeepingScheduler::GetTaskName(size_t index) const
+  {
+    if (index >= tasks_.size())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      return tasks_[index].name_;
+    }
+  }
+
+
+  unsigned int HousekeepingScheduler::GetInterval(size_t index) const
+  {
+    if (index >= tasks_.size())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+    else if (tasks_[index].next_.is_pos_infinity())
+    {
+      return 0;
+    }
+    else
+    {
+      return static_cast<unsigned int>(tasks_[index].interval_.total_seconds());
+    }
+  }
+
+
+  bool HousekeepingScheduler::SetInterval(const std::string& name,
+                                          unsigned int intervalSeconds,
+                                          const boost::posix_time::ptime& now)
+  {
+    for (size_t i = 0; i < tasks_.size(); i++)
+    {
+      if (tasks_[i].name_ == name)
+      {
+        if (intervalSeconds == 0)
+        {
+          // The task stays registered, so that it can be enabled again
+          tasks_[i].due_ = boost::posix_time::ptime(boost::posix_time::pos_infin);
+        }
+        else
+        {
+          tasks_[i].interval_ = boost::posix_time::seconds(intervalSeconds);
+          tasks_[i].due_ = now + tasks_[i].interval_;
+        }
+
+        tasks_[i].next_ = tasks_[i].due_;
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+
+  bool HousekeepingScheduler::IsDue(size_t index,
+                                    const boost::posix_time::ptime& now) const
+  {
+    if (index >= tasks_.size())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      return now >= tasks_[index].next_;
+    }
+  }
+
+
+  bool HousekeepingScheduler::CanPostpone(size_t index,
+                                          const boost::posix_time::ptime& now) const
+  {
+    if (index >= tasks_.size())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      return now - tasks_[index].due_ < tasks_[index].interval_;
+    }
+  }
+
+
+  void HousekeepingScheduler::Postpone(size_t index,
+                                       const boost::posix_time::ptime& now,
+                                       const boost::posix_time::time_duration& delay)
+  {
+    if (index >= tasks_.size())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      tasks_[index].next_ = now + delay;
+    }
+  }
+
+
+  void HousekeepingScheduler::SignalExecuted(size_t index,
+                                             const boost::posix_time::ptime& now)
+  {
+    if (index >= tasks_.size())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      tasks_[index].due_ = now + tasks_[index].interval_;
+      tasks_[index].next_ = tasks_[index].due_;
+    }
+  }
+
+
+  boost::posix_time::ptime HousekeepingScheduler::GetNextDeadline() const
+  {
+    if (tasks_.empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    boost::posix_time::ptime deadline = tasks_[0].next_;
+
+    for (size_t i = 1; i < tasks_.size(); i++)
+    {
+      if (tasks_[i].next_ < deadline)
+      {
+        deadline = tasks_[i].next_;
+      }
+    }
+
+    return deadline;
+  }
+}
@@ -0,0 +1,99 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+#include <string>
+#include <vector>
+
+
+namespace OrthancDatabases
+{
+  /**
+   * Schedule of the housekeeping tasks of an index backend, each task
+   * having its own interval. This class is not thread-safe, it is
+   * only used by the housekeeping thread of "IndexConnectionsPool".
+   **/
+  class HousekeepingScheduler : public boost::noncopyable
+  {
+  private:
+    struct Task
+    {
+      std::string                       name_;
+      boost::posix_time::time_duration  interval_;
+      boost::posix_time::ptime          due_;         // When the task should have been executed
+      boost::posix_time::ptime          next_;        // When the task will be considered again
+    };
+
+    std::vector<Task>  tasks_;
+
+  public:
+    // An interval of "0" seconds disables the task
+    void AddTask(const std::string& name,
+                 unsigned int intervalSeconds,
+                 const boost::posix_time::ptime& now);
+
+    bool IsEmpty() const
+    {
+      return tasks_.empty();
+    }
+
+    size_t GetTasksCount() const
+    {
+      return tasks_.size();
+    }
+
+    const std::string& GetTaskName(size_t index) const;
+
+    // Returns "0" if the task is disabled
+    unsigned int GetInterval(size_t index) const;
+
+    /**
+     * Changes the interval of a task at runtime, an interval of "0"
+     * seconds disabling the task. Returns "false" if the task is not
+     * registered.
+     **/
+    bool SetInterval(const std::string& name,
+                     unsigned int intervalSeconds,
+                     const boost::posix_time::ptime& now);
+
+    bool IsDue(size_t index,
+               const boost::posix_time::ptime& now) const;
+
+    // A task that is late by more than its interval cannot be postponed anymore
+    bool CanPostpone(size_t index,
+                     const boost::posix_time::ptime& now) const;
+
+    void Postpone(size_t index,
+                  const boost::posix_time::ptime& now,
+                  const boost::posix_time::time_duration& delay);
+
+    void SignalExecuted(size_t index,
+                        const boost::posix_time::ptime& now);
+
+    // Must not be called if the scheduler is empty
+    boost::posix_time::ptime GetNextDeadline() const;
+  };
+}
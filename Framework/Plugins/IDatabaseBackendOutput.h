@@ -82,6 +82,13 @@ namespace OrthancDatabases
                                 uint16_t element,
                                 const std::string& value) = 0;
 
+    // Answer of "IndexBackend::GetResourcesMainDicomTags()", that
+    // reads the main DICOM tags of several resources at once
+    virtual void AnswerResourceDicomTag(int64_t resource,
+                                        uint16_t group,
+                                        uint16_t element,
+                                        const std::string& value) = 0;
+
     virtual void AnswerExportedResource(int64_t                    seq,
                                         OrthancPluginResourceType  resourceType,
                                         const std::string&         publicId,
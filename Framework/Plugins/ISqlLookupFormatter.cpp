@@ -35,13 +35,61 @@
 #include <OrthancException.h>
 #include <Toolbox.h>
 
+#include <algorithm>
 #include <cassert>
 #include <boost/lexical_cast.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/shared_mutex.hpp>
 #include <list>
+#include <map>
 
 
 namespace OrthancDatabases
 {
+  void FindKeysetBound::AddValue(const std::string& value)
+  {
+    isNull_.push_back(false);
+    values_.push_back(value);
+  }
+
+
+  void FindKeysetBound::AddNull()
+  {
+    isNull_.push_back(true);
+    values_.push_back("");
+  }
+
+
+  bool FindKeysetBound::IsNull(size_t index) const
+  {
+    if (index >= isNull_.size())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      return isNull_[index];
+    }
+  }
+
+
+  const std::string& FindKeysetBound::GetValue(size_t index) const
+  {
+    if (index >= values_.size())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+    else if (isNull_[index])
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      return values_[index];
+    }
+  }
+
+
   static std::string FormatLevel(Orthanc::ResourceType level)
   {
     switch (level)
@@ -131,7 +179,7 @@ namespace OrthancDatabases
         }
         else
         {
-          comparison = "lower(" + tag + ".value) " + op + " lower(" + parameter + ")";
+          comparison = formatter.FormatLowerValue(tag + ".value") + " " + op + " lower(" + parameter + ")";
         }
 
         break;
@@ -164,7 +212,7 @@ namespace OrthancDatabases
         }
         else
         {
-          comparison = "lower(" +  tag + ".value) IN (" + comparison + ")";
+          comparison = formatter.FormatLowerValue(tag + ".value") + " IN (" + comparison + ")";
         }
 
         break;
@@ -232,7 +280,7 @@ namespace OrthancDatabases
           }
           else
           {
-            comparison = ("lower(" + tag + ".value) LIKE lower(" +
+            comparison = (formatter.FormatLowerValue(tag + ".value") + " LIKE lower(" +
                           parameter + ") " + formatter.FormatWildcardEscape());
           }
         }
@@ -314,6 +362,122 @@ namespace OrthancDatabases
 
   }
 
+  static bool FormatWildcardFullText(std::string& target,
+                                     ISqlLookupFormatter& formatter,
+                                     const std::string& column,
+                                     const std::string& wildcard)
+  {
+    // Only the runs of letters and digits that are at least as long
+    // as the default "ngram_token_size" of MySQL can be looked up in
+    // the FULLTEXT index. Each run becomes a mandatory phrase of the
+    // boolean query, the exact match being done by "LIKE" afterwards.
+    static const size_t MIN_TERM_LENGTH = 2;
+
+    std::string query, term;
+    size_t termLength = 0;  // In characters, not in bytes
+
+    for (size_t i = 0; i <= wildcard.size(); i++)
+    {
+      const unsigned char c = (i < wildcard.size() ? static_cast<unsigned char>(wildcard[i]) : 0);
+
+      if ((c >= 'a' && c <= 'z') ||
+          (c >= 'A' && c <= 'Z') ||
+          (c >= '0' && c <= '9') ||
+          c >= 0x80)  // Bytes of UTF-8 sequences
+      {
+        term.push_back(static_cast<char>(c));
+
+        if (c < 0x80 || c >= 0xc0)  // Not a continuation byte
+        {
+          termLength++;
+        }
+      }
+      else
+      {
+        if (termLength >= MIN_TERM_LENGTH)
+        {
+          query += (query.empty() ? "+\"" : " +\"") + term + "\"";
+        }
+
+        term.clear();
+        termLength = 0;
+      }
+    }
+
+    if (query.empty())
+    {
+      return false;
+    }
+    else
+    {
+      target = "MATCH(" + column + ") AGAINST(" + formatter.GenerateParameter(query) + " IN BOOLEAN MODE)";
+      return true;
+    }
+  }
+
+
+  static bool FormatWildcardPrefixRange(std::string& target,
+                                        ISqlLookupFormatter& formatter,
+                                        const std::string& column,
+                                        const std::string& wildcard)
+  {
+    // With a bytewise comparison, the values matching a wildcard that
+    // starts with a literal prefix are a range of the index on
+    // "(tagGroup, tagElement, value)", the exact match being done by
+    // "LIKE" afterwards. The upper bound of the range is the prefix
+    // whose last byte is incremented. The prefix is truncated before
+    // its first non-ASCII byte, so that both bounds remain valid UTF-8.
+    std::string lower = wildcard.substr(0, wildcard.find_first_of("*?"));
+
+    for (size_t i = 0; i < lower.size(); i++)
+    {
+      if (static_cast<unsigned char>(lower[i]) >= 0x80)
+      {
+        lower.resize(i);
+        break;
+      }
+    }
+
+    if (lower.empty())
+    {
+      return false;
+    }
+
+    std::string upper = lower;
+    while (!upper.empty() &&
+           static_cast<unsigned char>(upper[upper.size() - 1]) == 0x7f)
+    {
+      upper.resize(upper.size() - 1);
+    }
+
+    target = formatter.FormatBytewiseComparison(column, ">=", formatter.GenerateParameter(lower));
+
+    if (!upper.empty())
+    {
+      upper[upper.size() - 1] = static_cast<char>(upper[upper.size() - 1] + 1);
+      target += " AND " + formatter.FormatBytewiseComparison(column, "<", formatter.GenerateParameter(upper));
+    }
+
+    return true;
+  }
+
+
+  /**
+   * The values of the identifier tags (table "DicomIdentifiers") are
+   * already normalized by the Orthanc core, both when they are stored
+   * and in the constraints: Only ASCII characters are kept, and they
+   * are uppercased (cf. "ServerToolbox::NormalizeIdentifier()"). A
+   * case-insensitive comparison on an identifier is thus the same as
+   * a case-sensitive one, which doesn't wrap the column into "lower()"
+   * and can use the "(tagGroup, tagElement, value)" indexes.
+   **/
+  static bool IsCaseSensitiveComparison(const DatabaseConstraint& constraint)
+  {
+    return (constraint.IsCaseSensitive() ||
+            constraint.IsIdentifier());
+  }
+
+
   static bool FormatComparison(std::string& target,
                                ISqlLookupFormatter& formatter,
                                const DatabaseConstraint& constraint,
@@ -333,45 +497,143 @@ namespace OrthancDatabases
       values.push_back(constraint.GetSingleValue());
     }
 
-    return FormatComparison(target,
-                            formatter,
-                            constraint.GetConstraintType(),
-                            values,
-                            constraint.IsCaseSensitive(),
-                            constraint.IsMandatory(),
-                            index,
-                            escapeBrackets); 
+    if (!FormatComparison(target,
+                          formatter,
+                          constraint.GetConstraintType(),
+                          values,
+                          IsCaseSensitiveComparison(constraint),
+                          constraint.IsMandatory(),
+                          index,
+                          escapeBrackets))
+    {
+      return false;
+    }
+
+    std::string fullText;
+    if (formatter.HasWildcardFullTextIndex() &&
+        constraint.IsIdentifier() &&
+        constraint.IsMandatory() &&
+        constraint.GetConstraintType() == ConstraintType_Wildcard &&
+        FormatWildcardFullText(fullText, formatter, "t" + boost::lexical_cast<std::string>(index) + ".value",
+                               constraint.GetSingleValue()))
+    {
+      target = fullText + " AND " + target;
+    }
+
+    std::string range;
+    if (formatter.HasBytewiseComparison() &&
+        IsCaseSensitiveComparison(constraint) &&
+        constraint.IsMandatory() &&
+        constraint.GetConstraintType() == ConstraintType_Wildcard &&
+        FormatWildcardPrefixRange(range, formatter, "t" + boost::lexical_cast<std::string>(index) + ".value",
+                                  constraint.GetSingleValue()))
+    {
+      target = range + " AND " + target;
+    }
+
+    return true;
   }
 
-  static void FormatJoin(std::string& target,
-                         const DatabaseConstraint& constraint,
-                         size_t index)
+  namespace
   {
-    std::string tag = "t" + boost::lexical_cast<std::string>(index);
+    // Condition of the join on one tag, split around the alias of
+    // the joined table, e.g. "tN.id = studies.internalId AND
+    // tN.tagGroup = 32 AND tN.tagElement = 13"
+    struct TagJoinFragment
+    {
+      std::string  id_;       // ".id = studies.internalId AND "
+      std::string  group_;    // ".tagGroup = 32 AND "
+      std::string  element_;  // ".tagElement = 13"
+    };
 
-    if (constraint.IsMandatory())
+    typedef std::map< std::pair<Orthanc::ResourceType, Orthanc::DicomTag>, TagJoinFragment >  TagJoinFragments;
+  }
+
+  static boost::shared_mutex  tagJoinFragmentsMutex_;
+  static TagJoinFragments     tagJoinFragments_;
+
+  static void FormatTagJoinFragment(TagJoinFragment& target,
+                                    Orthanc::ResourceType level,
+                                    const Orthanc::DicomTag& tag)
+  {
+    target.id_ = ".id = " + FormatLevel(level) + ".internalId AND ";
+    target.group_ = ".tagGroup = " + boost::lexical_cast<std::string>(tag.GetGroup()) + " AND ";
+    target.element_ = ".tagElement = " + boost::lexical_cast<std::string>(tag.GetElement());
+  }
+
+  static void AppendTagJoinFragment(std::string& target,
+                                    const std::string& alias,
+                                    const TagJoinFragment& fragment)
+  {
+    target += alias;
+    target += " ON ";
+    target += alias;
+    target += fragment.id_;
+    target += alias;
+    target += fragment.group_;
+    target += alias;
+    target += fragment.element_;
+  }
+
+  int64_t ISqlLookupFormatter::EncodeTagSortKey(uint16_t group,
+                                                uint16_t element)
+  {
+    return (static_cast<int64_t>(group) << 16) + static_cast<int64_t>(element);
+  }
+
+
+  int64_t ISqlLookupFormatter::EncodeMetadataSortKey(int32_t metadata)
+  {
+    if (metadata < 0)
     {
-      target = " INNER JOIN ";
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
     }
     else
     {
-      target = " LEFT JOIN ";
+      return (static_cast<int64_t>(1) << 32) + static_cast<int64_t>(metadata);
     }
+  }
+
 
-    if (constraint.IsIdentifier())
+  void ISqlLookupFormatter::PrepareIdentifierTags(const std::list<IdentifierTag>& identifierTags)
+  {
+    boost::unique_lock<boost::shared_mutex>  lock(tagJoinFragmentsMutex_);
+
+    tagJoinFragments_.clear();
+
+    for (std::list<IdentifierTag>::const_iterator it = identifierTags.begin(); it != identifierTags.end(); ++it)
     {
-      target += "DicomIdentifiers ";
+      FormatTagJoinFragment(tagJoinFragments_[std::make_pair(it->GetLevel(), it->GetTag())],
+                            it->GetLevel(), it->GetTag());
     }
-    else
+  }
+
+  // Appends the join to "target", that is reused across the constraints
+  static void AppendJoin(std::string& target,
+                         const DatabaseConstraint& constraint,
+                         size_t index)
+  {
+    const std::string alias = "t" + boost::lexical_cast<std::string>(index);
+
+    target += (constraint.IsMandatory() ? " INNER JOIN " : " LEFT JOIN ");
+    target += (constraint.IsIdentifier() ? "DicomIdentifiers " : "MainDicomTags ");
+
     {
-      target += "MainDicomTags ";
+      boost::shared_lock<boost::shared_mutex>  lock(tagJoinFragmentsMutex_);
+
+      TagJoinFragments::const_iterator found =
+        tagJoinFragments_.find(std::make_pair(constraint.GetLevel(), constraint.GetTag()));
+
+      if (found != tagJoinFragments_.end())
+      {
+        AppendTagJoinFragment(target, alias, found->second);
+        return;
+      }
     }
 
-    target += (tag + " ON " + tag + ".id = " + FormatLevel(constraint.GetLevel()) +
-               ".internalId AND " + tag + ".tagGroup = " +
-               boost::lexical_cast<std::string>(constraint.GetTag().GetGroup()) +
-               " AND " + tag + ".tagElement = " +
-               boost::lexical_cast<std::string>(constraint.GetTag().GetElement()));
+    TagJoinFragment fragment;
+    FormatTagJoinFragment(fragment, constraint.GetLevel(), constraint.GetTag());
+    AppendTagJoinFragment(target, alias, fragment);
   }
 
   static void FormatJoin(std::string& target,
@@ -398,6 +660,7 @@ namespace OrthancDatabases
   }
 
   static void FormatJoinForOrdering(std::string& target,
+                                    const ISqlLookupFormatter& formatter,
                                     uint32_t tagGroup,
                                     uint32_t tagElement,
                                     Orthanc::ResourceType tagLevel,
@@ -414,17 +677,30 @@ namespace OrthancDatabases
       tagLevel = Orthanc::ResourceType_Study;
     }
 
+    const int64_t sortKey = ISqlLookupFormatter::EncodeTagSortKey(static_cast<uint16_t>(tagGroup), static_cast<uint16_t>(tagElement));
+
     std::string tagTable;
-    if (isIdentifierTag)
+    std::string tagFilter;
+
+    if (formatter.IsSortKey(sortKey))
     {
-      tagTable = "DicomIdentifiers ";
+      // The "SortKeys" table has the same "id" and "value" columns as the tables of the tags
+      tagTable = "SortKeys ";
+      tagFilter = orderArg + ".sortKey = " + boost::lexical_cast<std::string>(sortKey);
     }
     else
     {
-      tagTable = "MainDicomTags ";
-    }
+      if (isIdentifierTag)
+      {
+        tagTable = "DicomIdentifiers ";
+      }
+      else
+      {
+        tagTable = "MainDicomTags ";
+      }
 
-    std::string tagFilter = orderArg + ".tagGroup = " + boost::lexical_cast<std::string>(tagGroup) + " AND " + orderArg + ".tagElement = " + boost::lexical_cast<std::string>(tagElement);
+      tagFilter = orderArg + ".tagGroup = " + boost::lexical_cast<std::string>(tagGroup) + " AND " + orderArg + ".tagElement = " + boost::lexical_cast<std::string>(tagElement);
+    }
 
     if (tagLevel == requestLevel)
     {
@@ -452,15 +728,27 @@ namespace OrthancDatabases
   }
 
   static void FormatJoinForOrdering(std::string& target,
+                                    const ISqlLookupFormatter& formatter,
                                     int32_t metadata,
                                     size_t index,
                                     Orthanc::ResourceType requestLevel)
   {
     std::string arg = "order" + boost::lexical_cast<std::string>(index);
 
-    target = " INNER JOIN Metadata " + arg + " ON " + arg + ".id = " + FormatLevel(requestLevel) +
-             ".internalId AND " + arg + ".type = " +
-             boost::lexical_cast<std::string>(metadata);
+    const int64_t sortKey = ISqlLookupFormatter::EncodeMetadataSortKey(metadata);
+
+    if (formatter.IsSortKey(sortKey))
+    {
+      target = " INNER JOIN SortKeys " + arg + " ON " + arg + ".id = " + FormatLevel(requestLevel) +
+               ".internalId AND " + arg + ".sortKey = " +
+               boost::lexical_cast<std::string>(sortKey);
+    }
+    else
+    {
+      target = " INNER JOIN Metadata " + arg + " ON " + arg + ".id = " + FormatLevel(requestLevel) +
+               ".internalId AND " + arg + ".type = " +
+               boost::lexical_cast<std::string>(metadata);
+    }
   }
 
 
@@ -495,6 +783,209 @@ namespace OrthancDatabases
     }
   }
 
+
+  /**
+   * Formats the label constraint on the resources whose internal ID
+   * is "internalId". "Any" and "None" are formatted as semi-joins
+   * ("EXISTS" and "NOT EXISTS"), that can stop at the first matching
+   * label. "All" is formatted as a lookup of "LabelsIndex2" on the
+   * set of labels, grouped by resource, instead of a correlated count
+   * that must be evaluated for each candidate resource.
+   *
+   * "In SQL Server, NOT EXISTS and NOT IN predicates are the best
+   * way to search for missing values, as long as both columns in
+   * question are NOT NULL."
+   * https://explainextended.com/2009/09/15/not-in-vs-not-exists-vs-left-join-is-null-sql-server/
+   **/
+  static std::string FormatLabelsConstraint(const std::string& internalId,
+                                            const std::list<std::string>& formattedLabels,
+                                            LabelsConstraint constraint)
+  {
+    assert(!formattedLabels.empty());
+
+    const std::string labels = Join(formattedLabels, "", ", ");
+
+    switch (constraint)
+    {
+      case LabelsConstraint_All:
+        if (formattedLabels.size() > 1)
+        {
+          return (internalId + " IN (SELECT id FROM Labels WHERE label IN (" + labels + ") GROUP BY id "
+                  "HAVING COUNT(1) = " + boost::lexical_cast<std::string>(formattedLabels.size()) + ")");
+        }
+        else
+        {
+          // With one single label, "All" is the same as "Any"
+          return FormatLabelsConstraint(internalId, formattedLabels, LabelsConstraint_Any);
+        }
+
+      case LabelsConstraint_Any:
+        return ("EXISTS (SELECT 1 FROM Labels AS selectedLabels WHERE selectedLabels.id = " + internalId +
+                " AND selectedLabels.label IN (" + labels + "))");
+
+      case LabelsConstraint_None:
+        return ("NOT EXISTS (SELECT 1 FROM Labels AS selectedLabels WHERE selectedLabels.id = " + internalId +
+                " AND selectedLabels.label IN (" + labels + "))");
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  // Same as "FormatLabelsConstraint()", from the resources that were
+  // computed by the cache of the labels (cf. "GetLabelsResources()").
+  // Also restricts the lookups to the candidate resources, with "Any".
+  static std::string FormatLabelsResources(const std::string& internalId,
+                                           const std::vector<int64_t>& resources,
+                                           LabelsConstraint constraint)
+  {
+    if (resources.empty())
+    {
+      return (constraint == LabelsConstraint_None ? "1 = 1" : "1 = 0");
+    }
+
+    std::string s;
+    s.reserve(resources.size() * 8);
+
+    for (size_t i = 0; i < resources.size(); i++)
+    {
+      if (i > 0)
+      {
+        s += ",";
+      }
+
+      s += boost::lexical_cast<std::string>(resources[i]);
+    }
+
+    return internalId + (constraint == LabelsConstraint_None ? " NOT IN (" : " IN (") + s + ")";
+  }
+
+
+  /**
+   * Excludes the hidden resources of the query level, and the
+   * descendants of the hidden resources of the upper levels. The
+   * descendants are reached by nested subqueries on "parentId", from
+   * the hidden level down to the parent level of the query.
+   **/
+  static void FormatHiddenResources(std::list<std::string>& where,
+                                    const ISqlLookupFormatter& formatter,
+                                    Orthanc::ResourceType queryLevel,
+                                    const std::string& internalId,
+                                    const std::string& parentId)
+  {
+    for (int level = Orthanc::ResourceType_Patient; level <= queryLevel; level++)
+    {
+      const std::vector<int64_t>* hidden = formatter.GetHiddenResources(static_cast<Orthanc::ResourceType>(level));
+
+      if (hidden == NULL ||
+          hidden->empty())
+      {
+        continue;
+      }
+      else if (level == queryLevel)
+      {
+        where.push_back(FormatLabelsResources(internalId, *hidden, LabelsConstraint_None));
+      }
+      else if (level + 1 == queryLevel)
+      {
+        where.push_back(FormatLabelsResources(parentId, *hidden, LabelsConstraint_None));
+      }
+      else
+      {
+        std::string children = "SELECT internalId FROM Resources WHERE " + FormatLabelsResources("parentId", *hidden, LabelsConstraint_Any);
+
+        for (int child = level + 2; child < queryLevel; child++)
+        {
+          children = "SELECT internalId FROM Resources WHERE parentId IN (" + children + ")";
+        }
+
+        where.push_back(parentId + " NOT IN (" + children + ")");
+      }
+    }
+  }
+
+
+  /**
+   * Estimated selectivity of a constraint on the main DICOM tags, the
+   * lower the more selective. Some planners (notably MySQL and
+   * SQLite) follow the textual order of the joins, so the most
+   * selective constraints must come first: equality beats lists,
+   * which beat ranges, which beat wildcards. The optional constraints
+   * (LEFT JOIN) don't filter anything, and go last.
+   **/
+  static unsigned int EstimateSelectivityRank(const DatabaseConstraint& constraint)
+  {
+    if (!constraint.IsMandatory())
+    {
+      return 10;
+    }
+
+    // The identifier tags are the most discriminating ones (patient ID, UIDs, accession number...)
+    const unsigned int identifier = (constraint.IsIdentifier() ? 0 : 1);
+
+    switch (constraint.GetConstraintType())
+    {
+      case ConstraintType_Equal:
+        return identifier;
+
+      case ConstraintType_List:
+        return 2 + identifier;
+
+      case ConstraintType_SmallerOrEqual:
+      case ConstraintType_GreaterOrEqual:
+        return 4 + identifier;
+
+      case ConstraintType_Wildcard:
+      {
+        const std::string& value = constraint.GetSingleValue();
+        if (!value.empty() &&
+            value[0] != '*' &&
+            value[0] != '?')
+        {
+          return 6 + identifier;  // Literal prefix
+        }
+        else
+        {
+          return 8 + identifier;
+        }
+      }
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  namespace
+  {
+    class SelectivityComparator
+    {
+    public:
+      bool operator() (const DatabaseConstraint* a,
+                       const DatabaseConstraint* b) const
+      {
+        return EstimateSelectivityRank(*a) < EstimateSelectivityRank(*b);
+      }
+    };
+  }
+
+
+  // The order of the constraints with the same rank is preserved
+  static void SortBySelectivity(std::vector<const DatabaseConstraint*>& target,
+                                const DatabaseConstraints& constraints)
+  {
+    target.resize(constraints.GetSize());
+
+    for (size_t i = 0; i < constraints.GetSize(); i++)
+    {
+      target[i] = &constraints.GetConstraint(i);
+    }
+
+    std::stable_sort(target.begin(), target.end(), SelectivityComparator());
+  }
+
+
   static bool FormatComparison2(std::string& target,
                                 ISqlLookupFormatter& formatter,
                                 const DatabaseConstraint& constraint,
@@ -531,13 +1022,13 @@ namespace OrthancDatabases
 
         std::string parameter = formatter.GenerateParameter(constraint.GetSingleValue());
 
-        if (constraint.IsCaseSensitive())
+        if (IsCaseSensitiveComparison(constraint))
         {
           comparison = " AND value " + op + " " + parameter;
         }
         else
         {
-          comparison = " AND lower(value) " + op + " lower(" + parameter + ")";
+          comparison = " AND " + formatter.FormatLowerValue("value") + " " + op + " lower(" + parameter + ")";
         }
 
         break;
@@ -550,7 +1041,7 @@ namespace OrthancDatabases
         {
           std::string parameter = formatter.GenerateParameter(constraint.GetValue(i));
 
-          if (constraint.IsCaseSensitive())
+          if (IsCaseSensitiveComparison(constraint))
           {
             comparisonValues.push_back(parameter);
           }
@@ -563,13 +1054,13 @@ namespace OrthancDatabases
         std::string values;
         Orthanc::Toolbox::JoinStrings(values, comparisonValues, ", ");
 
-        if (constraint.IsCaseSensitive())
+        if (IsCaseSensitiveComparison(constraint))
         {
           comparison = " AND value IN (" + values + ")";
         }
         else
         {
-          comparison = " AND lower(value) IN (" + values + ")";
+          comparison = " AND " + formatter.FormatLowerValue("value") + " IN (" + values + ")";
         }
 
         break;
@@ -630,13 +1121,31 @@ namespace OrthancDatabases
 
           std::string parameter = formatter.GenerateParameter(escaped);
 
-          if (constraint.IsCaseSensitive())
+          if (IsCaseSensitiveComparison(constraint))
           {
             comparison = " AND value LIKE " + parameter + " " + formatter.FormatWildcardEscape();
           }
           else
           {
-            comparison = " AND lower(value) LIKE lower(" + parameter + ") " + formatter.FormatWildcardEscape();
+            comparison = " AND " + formatter.FormatLowerValue("value") + " LIKE lower(" + parameter + ") " + formatter.FormatWildcardEscape();
+          }
+
+          std::string fullText;
+          if (formatter.HasWildcardFullTextIndex() &&
+              constraint.IsIdentifier() &&
+              constraint.IsMandatory() &&
+              FormatWildcardFullText(fullText, formatter, "value", value))
+          {
+            comparison = " AND " + fullText + comparison;
+          }
+
+          std::string range;
+          if (formatter.HasBytewiseComparison() &&
+              IsCaseSensitiveComparison(constraint) &&
+              constraint.IsMandatory() &&
+              FormatWildcardPrefixRange(range, formatter, "value", value))
+          {
+            comparison = " AND " + range + comparison;
           }
         }
 
@@ -713,17 +1222,20 @@ namespace OrthancDatabases
 
     size_t count = 0;
 
-    for (size_t i = 0; i < lookup.GetSize(); i++)
+    std::vector<const DatabaseConstraint*> sorted;
+    SortBySelectivity(sorted, lookup);
+
+    joins.reserve(128 * sorted.size());
+
+    for (size_t i = 0; i < sorted.size(); i++)
     {
-      const DatabaseConstraint& constraint = lookup.GetConstraint(i);
+      const DatabaseConstraint& constraint = *sorted[i];
 
       std::string comparison;
 
       if (FormatComparison(comparison, formatter, constraint, count, escapeBrackets))
       {
-        std::string join;
-        FormatJoin(join, constraint, count);
-        joins += join;
+        AppendJoin(joins, constraint, count);
 
         if (!comparison.empty())
         {
@@ -759,42 +1271,29 @@ namespace OrthancDatabases
     where.push_back(FormatLevel(queryLevel) + ".resourceType = " +
                     formatter.FormatResourceType(queryLevel) + comparisons);
 
-    if (!labels.empty())
+    if (formatter.GetCandidateResources() != NULL)
     {
-      /**
-       * "In SQL Server, NOT EXISTS and NOT IN predicates are the best
-       * way to search for missing values, as long as both columns in
-       * question are NOT NULL."
-       * https://explainextended.com/2009/09/15/not-in-vs-not-exists-vs-left-join-is-null-sql-server/
-       **/
+      where.push_back(FormatLabelsResources(FormatLevel(queryLevel) + ".internalId", *formatter.GetCandidateResources(), LabelsConstraint_Any));
+    }
+
+    FormatHiddenResources(where, formatter, queryLevel, FormatLevel(queryLevel) + ".internalId", FormatLevel(queryLevel) + ".parentId");
 
-      std::list<std::string> formattedLabels;
-      for (std::set<std::string>::const_iterator it = labels.begin(); it != labels.end(); ++it)
+    if (!labels.empty())
+    {
+      if (formatter.GetLabelsResources() != NULL)
       {
-        formattedLabels.push_back(formatter.GenerateParameter(*it));
+        where.push_back(FormatLabelsResources(FormatLevel(queryLevel) + ".internalId", *formatter.GetLabelsResources(), labelsConstraint));
       }
-
-      std::string condition;
-      switch (labelsConstraint)
+      else
       {
-        case LabelsConstraint_Any:
-          condition = "> 0";
-          break;
-
-        case LabelsConstraint_All:
-          condition = "= " + boost::lexical_cast<std::string>(labels.size());
-          break;
-
-        case LabelsConstraint_None:
-          condition = "= 0";
-          break;
+        std::list<std::string> formattedLabels;
+        for (std::set<std::string>::const_iterator it = labels.begin(); it != labels.end(); ++it)
+        {
+          formattedLabels.push_back(formatter.GenerateParameter(*it));
+        }
 
-        default:
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+        where.push_back(FormatLabelsConstraint(FormatLevel(queryLevel) + ".internalId", formattedLabels, labelsConstraint));
       }
-
-      where.push_back("(SELECT COUNT(1) FROM Labels AS selectedLabels WHERE selectedLabels.id = " + FormatLevel(queryLevel) +
-                      ".internalId AND selectedLabels.label IN (" + Join(formattedLabels, "", ", ") + ")) " + condition);
     }
 
     sql += joins + Join(where, " WHERE ", " AND ");
@@ -808,6 +1307,35 @@ namespace OrthancDatabases
 
 
 #if ORTHANC_PLUGINS_HAS_INTEGRATED_FIND == 1
+  static void FormatJoinsForOrdering(std::string& target,
+                                     const ISqlLookupFormatter& formatter,
+                                     const Orthanc::DatabasePluginMessages::Find_Request& request,
+                                     Orthanc::ResourceType queryLevel)
+  {
+    target.clear();
+
+    for (int i = 0; i < request.ordering_size(); ++i)
+    {
+      std::string orderingJoin;
+      const Orthanc::DatabasePluginMessages::Find_Request_Ordering& ordering = request.ordering(i);
+
+      switch (ordering.key_type())
+      {
+        case Orthanc::DatabasePluginMessages::OrderingKeyType::ORDERING_KEY_TYPE_DICOM_TAG:
+          FormatJoinForOrdering(orderingJoin, formatter, ordering.tag_group(), ordering.tag_element(), MessagesToolbox::Convert(ordering.tag_level()), ordering.is_identifier_tag(), i, queryLevel);
+          break;
+        case Orthanc::DatabasePluginMessages::OrderingKeyType::ORDERING_KEY_TYPE_METADATA:
+          FormatJoinForOrdering(orderingJoin, formatter, ordering.metadata(), i, queryLevel);
+          break;
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+
+      target += orderingJoin;
+    }
+  }
+
+
   static Orthanc::ResourceType DetectLevel(const Orthanc::DatabasePluginMessages::Find_Request& request)
   {
     // This corresponds to "Orthanc::OrthancIdentifiers()::DetectLevel()" in the Orthanc core
@@ -859,7 +1387,8 @@ namespace OrthancDatabases
 
   void ISqlLookupFormatter::Apply(std::string& sql,
                                   ISqlLookupFormatter& formatter,
-                                  const Orthanc::DatabasePluginMessages::Find_Request& request)
+                                  const Orthanc::DatabasePluginMessages::Find_Request& request,
+                                  const FindKeysetBound* bound)
   {
     const bool escapeBrackets = formatter.IsEscapeBrackets();
     Orthanc::ResourceType queryLevel = MessagesToolbox::Convert(request.level());
@@ -878,67 +1407,51 @@ namespace OrthancDatabases
     assert(upperLevel <= queryLevel &&
            queryLevel <= lowerLevel);
 
-    std::string ordering;
     std::string orderingJoins;
+    FormatJoinsForOrdering(orderingJoins, formatter, request, queryLevel);
+
+    /**
+     * The NULL values are put at the end of each ordering key, and the
+     * public ID breaks the ties: This makes the order total, which is
+     * needed by keyset pagination, and makes "since" repeatable.
+     **/
+    std::vector<std::string> orderByFields;
 
-    if (request.ordering_size() > 0)
+    for (int i = 0; i < request.ordering_size(); ++i)
     {
-      std::vector<std::string> orderByFields;
+      const std::string value = "order" + boost::lexical_cast<std::string>(i) + ".value";
 
-      for (int i = 0; i < request.ordering_size(); ++i)
+      std::string orderByField;
+      if (!formatter.SupportsNullsLast())
       {
-        std::string orderingJoin;
-        const Orthanc::DatabasePluginMessages::Find_Request_Ordering& ordering = request.ordering(i);
-        
-        switch (ordering.key_type())
-        {
-          case Orthanc::DatabasePluginMessages::OrderingKeyType::ORDERING_KEY_TYPE_DICOM_TAG:
-            FormatJoinForOrdering(orderingJoin, ordering.tag_group(), ordering.tag_element(), MessagesToolbox::Convert(ordering.tag_level()), ordering.is_identifier_tag(), i, queryLevel);
-            break;
-          case Orthanc::DatabasePluginMessages::OrderingKeyType::ORDERING_KEY_TYPE_METADATA:
-            FormatJoinForOrdering(orderingJoin, ordering.metadata(), i, queryLevel);
-            break;
-          default:
-            throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
-        }
-
-        orderingJoins += orderingJoin;
-        
-        std::string orderByField;
-        if (!formatter.SupportsNullsLast())
-        {
-          orderByField = "CASE WHEN order" + boost::lexical_cast<std::string>(i) + ".value IS NULL THEN 1 ELSE 0 END, ";
-        }
-        orderByField += "order" + boost::lexical_cast<std::string>(i) + ".value";
-         
-        if (ordering.direction() == Orthanc::DatabasePluginMessages::OrderingDirection::ORDERING_DIRECTION_ASC)
-        {
-          orderByField += " ASC";
-        }
-        else
-        {
-          orderByField += " DESC";
-        }
-
-        orderByFields.push_back(orderByField);
+        orderByField = "CASE WHEN " + value + " IS NULL THEN 1 ELSE 0 END, ";
       }
+      orderByField += value;
 
-      std::string orderByFieldsString;
-      Orthanc::Toolbox::JoinStrings(orderByFieldsString, orderByFields, ", ");
-
-      if (formatter.SupportsNullsLast())
+      if (request.ordering(i).direction() == Orthanc::DatabasePluginMessages::OrderingDirection::ORDERING_DIRECTION_ASC)
       {
-        ordering = "ROW_NUMBER() OVER (ORDER BY " + orderByFieldsString + " NULLS LAST) AS rowNumber";
+        orderByField += " ASC";
       }
       else
       {
-        ordering = "ROW_NUMBER() OVER (ORDER BY " + orderByFieldsString + ") AS rowNumber";
+        orderByField += " DESC";
       }
+
+      if (formatter.SupportsNullsLast())
+      {
+        orderByField += " NULLS LAST";
+      }
+
+      orderByFields.push_back(orderByField);
     }
-    else
-    {
-      ordering = "ROW_NUMBER() OVER (ORDER BY " + strQueryLevel + ".publicId) AS rowNumber";  // we need a default ordering in order to make default queries repeatable when using since&limit
-    }
+
+    // we need a default ordering in order to make default queries repeatable when using since&limit
+    orderByFields.push_back(strQueryLevel + ".publicId");
+
+    std::string orderByFieldsString;
+    Orthanc::Toolbox::JoinStrings(orderByFieldsString, orderByFields, ", ");
+
+    const std::string ordering = "ROW_NUMBER() OVER (ORDER BY " + orderByFieldsString + ") AS rowNumber";
 
     sql = ("SELECT " +
            strQueryLevel + ".publicId, " +
@@ -986,17 +1499,20 @@ namespace OrthancDatabases
 
     size_t count = 0;
 
-    for (size_t i = 0; i < constraints.GetSize(); i++)
+    std::vector<const DatabaseConstraint*> sorted;
+    SortBySelectivity(sorted, constraints);
+
+    joins.reserve(joins.size() + 128 * sorted.size());
+
+    for (size_t i = 0; i < sorted.size(); i++)
     {
-      const DatabaseConstraint& constraint = constraints.GetConstraint(i);
+      const DatabaseConstraint& constraint = *sorted[i];
 
       std::string comparison;
 
       if (FormatComparison(comparison, formatter, constraint, count, escapeBrackets))
       {
-        std::string join;
-        FormatJoin(join, constraint, count);
-        joins += join;
+        AppendJoin(joins, constraint, count);
 
         if (!comparison.empty())
         {
@@ -1047,52 +1563,142 @@ namespace OrthancDatabases
     where.push_back(strQueryLevel + ".resourceType = " +
                     formatter.FormatResourceType(queryLevel) + comparisons);
 
-
-    if (!request.labels().empty())
+    if (formatter.GetCandidateResources() != NULL)
     {
-      /**
-       * "In SQL Server, NOT EXISTS and NOT IN predicates are the best
-       * way to search for missing values, as long as both columns in
-       * question are NOT NULL."
-       * https://explainextended.com/2009/09/15/not-in-vs-not-exists-vs-left-join-is-null-sql-server/
-       **/
+      where.push_back(FormatLabelsResources(strQueryLevel + ".internalId", *formatter.GetCandidateResources(), LabelsConstraint_Any));
+    }
+
+    FormatHiddenResources(where, formatter, queryLevel, strQueryLevel + ".internalId", strQueryLevel + ".parentId");
 
-      std::list<std::string> formattedLabels;
-      for (int i = 0; i < request.labels().size(); i++)
-      {
-        formattedLabels.push_back(formatter.GenerateParameter(request.labels(i)));
-      }
 
-      std::string condition;
+    if (!request.labels().empty())
+    {
+      LabelsConstraint constraint;
       switch (request.labels_constraint())
       {
         case Orthanc::DatabasePluginMessages::LABELS_CONSTRAINT_ANY:
-          condition = "> 0";
+          constraint = LabelsConstraint_Any;
           break;
 
         case Orthanc::DatabasePluginMessages::LABELS_CONSTRAINT_ALL:
-          condition = "= " + boost::lexical_cast<std::string>(request.labels().size());
+          constraint = LabelsConstraint_All;
           break;
 
         case Orthanc::DatabasePluginMessages::LABELS_CONSTRAINT_NONE:
-          condition = "= 0";
+          constraint = LabelsConstraint_None;
           break;
 
         default:
           throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
       }
 
-      where.push_back("(SELECT COUNT(1) FROM Labels AS selectedLabels WHERE selectedLabels.id = " + strQueryLevel +
-                      ".internalId AND selectedLabels.label IN (" + Join(formattedLabels, "", ", ") + ")) " + condition);
+      if (formatter.GetLabelsResources() != NULL)
+      {
+        where.push_back(FormatLabelsResources(strQueryLevel + ".internalId", *formatter.GetLabelsResources(), constraint));
+      }
+      else
+      {
+        std::list<std::string> formattedLabels;
+        for (int i = 0; i < request.labels().size(); i++)
+        {
+          formattedLabels.push_back(formatter.GenerateParameter(request.labels(i)));
+        }
+
+        where.push_back(FormatLabelsConstraint(strQueryLevel + ".internalId", formattedLabels, constraint));
+      }
+    }
+
+    if (bound != NULL)
+    {
+      if (bound->GetValuesCount() != static_cast<size_t>(request.ordering_size()))
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+      }
+
+      /**
+       * Lexicographic "strictly after the bound", consistently with
+       * the ORDER BY clause above (NULL values last, then the public ID).
+       **/
+      std::list<std::string> seek;
+      std::string equalities;
+
+      for (int i = 0; i < request.ordering_size(); ++i)
+      {
+        const std::string value = "order" + boost::lexical_cast<std::string>(i) + ".value";
+
+        if (bound->IsNull(i))
+        {
+          // Nothing comes after NULL for this key
+          equalities += value + " IS NULL AND ";
+        }
+        else
+        {
+          const std::string parameter = formatter.GenerateParameter(bound->GetValue(i));
+          const bool isAscending = (request.ordering(i).direction() ==
+                                    Orthanc::DatabasePluginMessages::OrderingDirection::ORDERING_DIRECTION_ASC);
+
+          seek.push_back("(" + equalities + "(" + value + (isAscending ? " > " : " < ") + parameter +
+                         " OR " + value + " IS NULL))");
+          equalities += value + " = " + parameter + " AND ";
+        }
+      }
+
+      seek.push_back("(" + equalities + strQueryLevel + ".publicId > " +
+                     formatter.GenerateParameter(bound->GetPublicId()) + ")");
+
+      where.push_back("(" + Join(seek, "", " OR ") + ")");
     }
 
     sql += joins + orderingJoins + Join(where, " WHERE ", " AND ");
 
     if (request.has_limits())
     {
-      sql += formatter.FormatLimits(request.limits().since(), request.limits().count());
+      const uint64_t since = (bound != NULL ? 0 : request.limits().since());
+
+      if (formatter.IsOrderByRequiredByLimits() &&
+          (since > 0 || request.limits().count() > 0))
+      {
+        sql += " ORDER BY rowNumber";
+      }
+
+      sql += formatter.FormatLimits(since, request.limits().count());
+    }
+
+  }
+
+
+  void ISqlLookupFormatter::Apply(std::string& sql,
+                                  ISqlLookupFormatter& formatter,
+                                  const Orthanc::DatabasePluginMessages::Find_Request& request)
+  {
+    Apply(sql, formatter, request, NULL);
+  }
+
+
+  void ISqlLookupFormatter::FormatKeysetBoundLookup(std::string& sql,
+                                                    ISqlLookupFormatter& formatter,
+                                                    const Orthanc::DatabasePluginMessages::Find_Request& request,
+                                                    const std::string& publicId)
+  {
+    Orthanc::ResourceType queryLevel = MessagesToolbox::Convert(request.level());
+    const std::string& strQueryLevel = FormatLevel(queryLevel);
+
+    std::string orderingJoins;
+    FormatJoinsForOrdering(orderingJoins, formatter, request, queryLevel);
+
+    std::list<std::string> values;
+    for (int i = 0; i < request.ordering_size(); ++i)
+    {
+      values.push_back("order" + boost::lexical_cast<std::string>(i) + ".value");
+    }
+
+    if (values.empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
     }
 
+    sql = ("SELECT " + Join(values, "", ", ") + " FROM Resources AS " + strQueryLevel + orderingJoins +
+           " WHERE " + strQueryLevel + ".publicId = " + formatter.GenerateParameter(publicId));
   }
 #endif
 
@@ -1116,9 +1722,12 @@ namespace OrthancDatabases
 
     std::vector<std::string> mainDicomTagsComparisons, dicomIdentifiersComparisons;
 
-    for (size_t i = 0; i < lookup.GetSize(); i++)
+    std::vector<const DatabaseConstraint*> sorted;
+    SortBySelectivity(sorted, lookup);
+
+    for (size_t i = 0; i < sorted.size(); i++)
     {
-      const DatabaseConstraint& constraint = lookup.GetConstraint(i);
+      const DatabaseConstraint& constraint = *sorted[i];
 
       std::string comparison;
 
@@ -1159,50 +1768,37 @@ namespace OrthancDatabases
       }
     }
 
-    if (!labels.empty())
+    if (formatter.GetCandidateResources() != NULL)
     {
-      /**
-       * "In SQL Server, NOT EXISTS and NOT IN predicates are the best
-       * way to search for missing values, as long as both columns in
-       * question are NOT NULL."
-       * https://explainextended.com/2009/09/15/not-in-vs-not-exists-vs-left-join-is-null-sql-server/
-       **/
+      sql += " AND " + FormatLabelsResources("internalId", *formatter.GetCandidateResources(), LabelsConstraint_Any);
+    }
+
+    {
+      std::list<std::string> hidden;
+      FormatHiddenResources(hidden, formatter, queryLevel, "internalId", "parentId");
 
-      std::list<std::string> formattedLabels;
-      for (std::set<std::string>::const_iterator it = labels.begin(); it != labels.end(); ++it)
+      for (std::list<std::string>::const_iterator it = hidden.begin(); it != hidden.end(); ++it)
       {
-        formattedLabels.push_back(formatter.GenerateParameter(*it));
+        sql += " AND " + *it;
       }
+    }
 
-      std::string condition;
-      std::string inOrNotIn;
-      switch (labelsConstraint)
+    if (!labels.empty())
+    {
+      if (formatter.GetLabelsResources() != NULL)
       {
-        case LabelsConstraint_Any:
-          condition = "> 0";
-          inOrNotIn = "IN";
-          break;
-
-        case LabelsConstraint_All:
-          condition = "= " + boost::lexical_cast<std::string>(labels.size());
-          inOrNotIn = "IN";
-          break;
-
-        case LabelsConstraint_None:
-          condition = "> 0";
-          inOrNotIn = "NOT IN";
-          break;
-
-        default:
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+        sql += " AND " + FormatLabelsResources("internalId", *formatter.GetLabelsResources(), labelsConstraint);
       }
+      else
+      {
+        std::list<std::string> formattedLabels;
+        for (std::set<std::string>::const_iterator it = labels.begin(); it != labels.end(); ++it)
+        {
+          formattedLabels.push_back(formatter.GenerateParameter(*it));
+        }
 
-      sql += (" AND internalId " + inOrNotIn + " (SELECT id"
-                                 " FROM (SELECT id, COUNT(1) AS labelsCount "
-                                        "FROM Labels "
-                                        "WHERE label IN (" + Join(formattedLabels, "", ", ") + ") GROUP BY id"
-                                        ") AS temp "
-                                 " WHERE labelsCount " + condition + ")");
+        sql += " AND " + FormatLabelsConstraint("internalId", formattedLabels, labelsConstraint);
+      }
     }
 
     if (limit != 0)
@@ -30,9 +30,11 @@
 
 #pragma once
 
+#include "IdentifierTag.h"
 #include "MessagesToolbox.h"
 
 #include <boost/noncopyable.hpp>
+#include <list>
 #include <vector>
 
 namespace OrthancDatabases
@@ -47,6 +49,45 @@ namespace OrthancDatabases
     LabelsConstraint_None
   };
 
+  /**
+   * Position of the last resource of a page of "ExecuteFind()": The
+   * values of its ordering keys, followed by its public ID. It is
+   * used to replace "OFFSET" by a seek condition in the next page
+   * (keyset pagination), whose cost does not depend on the offset.
+   **/
+  class FindKeysetBound
+  {
+  private:
+    std::vector<bool>         isNull_;
+    std::vector<std::string>  values_;
+    std::string               publicId_;
+
+  public:
+    void AddValue(const std::string& value);
+
+    void AddNull();
+
+    size_t GetValuesCount() const
+    {
+      return values_.size();
+    }
+
+    bool IsNull(size_t index) const;
+
+    const std::string& GetValue(size_t index) const;
+
+    void SetPublicId(const std::string& publicId)
+    {
+      publicId_ = publicId;
+    }
+
+    const std::string& GetPublicId() const
+    {
+      return publicId_;
+    }
+  };
+
+
   class ISqlLookupFormatter : public boost::noncopyable
   {
   public:
@@ -73,6 +114,89 @@ namespace OrthancDatabases
 
     virtual bool SupportsNullsLast() const = 0;
 
+    /**
+     * Whether the limits can only be applied to an ordered query,
+     * which is the case of "OFFSET ... FETCH" in MSSQL.
+     **/
+    virtual bool IsOrderByRequiredByLimits() const = 0;
+
+    /**
+     * Whether the wildcard constraints on the identifier tags can be
+     * pre-filtered by "MATCH ... AGAINST" on a FULLTEXT index of
+     * "DicomIdentifiers.value" using the "ngram" parser (MySQL).
+     **/
+    virtual bool HasWildcardFullTextIndex() const = 0;
+
+    /**
+     * Whether the strings can be compared bytewise by an operator that
+     * can use the indexes on the values (e.g. the "BINARY" collation
+     * of SQLite, or the "text_pattern_ops" operators of PostgreSQL),
+     * in which case the case-sensitive wildcard constraints that start
+     * with a literal prefix are completed by a range on the value.
+     **/
+    virtual bool HasBytewiseComparison() const = 0;
+
+    // "op" is either ">=" or "<"
+    virtual std::string FormatBytewiseComparison(const std::string& column,
+                                                 const std::string& op,
+                                                 const std::string& parameter) const = 0;
+
+    /**
+     * Lowercases a column of values for the case-insensitive
+     * constraints. The column must be lowercased with the default
+     * collation of the database, even if the column has the "C"
+     * collation, which only lowercases the ASCII characters.
+     **/
+    virtual std::string FormatLowerValue(const std::string& column) const = 0;
+
+    /**
+     * The sorted internal IDs of the resources that satisfy the
+     * constraint on the labels ("All" and "Any"), or that must be
+     * excluded ("None"), if they were computed from the cache of the
+     * labels. If NULL, the constraint is looked up in the "Labels"
+     * table.
+     **/
+    virtual const std::vector<int64_t>* GetLabelsResources() const = 0;
+
+    /**
+     * The sorted internal IDs of the resources out of which the
+     * results of the lookup are selected, if they were computed from
+     * the column store of the studies. If NULL, all the resources of
+     * the query level are considered.
+     **/
+    virtual const std::vector<int64_t>* GetCandidateResources() const = 0;
+
+    /**
+     * The sorted internal IDs of the resources of the given level
+     * whose deletion is in progress, that are hidden from the lookups
+     * together with their descendants (cf. "HiddenResources"). NULL if
+     * no resource of this level is hidden.
+     **/
+    virtual const std::vector<int64_t>* GetHiddenResources(Orthanc::ResourceType level) const = 0;
+
+    /**
+     * Whether the values of the given ordering key (cf.
+     * "EncodeTagSortKey()" and "EncodeMetadataSortKey()") are
+     * materialized in the "SortKeys(id, sortKey, value)" table, whose
+     * index on "(sortKey, value)" is then used to order the results of
+     * "ExecuteFind()" instead of joining the tables of the tags or of
+     * the metadata.
+     **/
+    virtual bool IsSortKey(int64_t sortKey) const = 0;
+
+    // The tags are numbered below 2^32, the metadata above
+    static int64_t EncodeTagSortKey(uint16_t group,
+                                    uint16_t element);
+
+    static int64_t EncodeMetadataSortKey(int32_t metadata);
+
+    /**
+     * Precomputes the fragments of the joins on the identifier tags,
+     * that are the most frequent constraints of the lookups. The
+     * joins on the other tags are formatted on the fly.
+     **/
+    static void PrepareIdentifierTags(const std::list<IdentifierTag>& identifierTags);
+
     static void GetLookupLevels(Orthanc::ResourceType& lowerLevel,
                                 Orthanc::ResourceType& upperLevel,
                                 const Orthanc::ResourceType& queryLevel,
@@ -98,6 +222,20 @@ namespace OrthancDatabases
     static void Apply(std::string& sql,
                       ISqlLookupFormatter& formatter,
                       const Orthanc::DatabasePluginMessages::Find_Request& request);
+
+    // If "bound" is not NULL, the resources are read after this
+    // bound, ignoring "request.limits().since()"
+    static void Apply(std::string& sql,
+                      ISqlLookupFormatter& formatter,
+                      const Orthanc::DatabasePluginMessages::Find_Request& request,
+                      const FindKeysetBound* bound);
+
+    // Query that reads the values of the ordering keys of one
+    // resource, from which the bound of the next page is created
+    static void FormatKeysetBoundLookup(std::string& sql,
+                                        ISqlLookupFormatter& formatter,
+                                        const Orthanc::DatabasePluginMessages::Find_Request& request,
+                                        const std::string& publicId);
 #endif
   };
 }
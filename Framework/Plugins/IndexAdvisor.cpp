@@ -0,0 +1,147 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "IndexAdvisor.h"
+
+#include <algorithm>
+#include <stdio.h>
+
+
+namespace OrthancDatabases
+{
+  IndexAdvisor::Shape::Shape(IndexAdvisor& advisor) :
+    advisor_(advisor),
+    start_(boost::posix_time::microsec_clock::universal_time())
+  {
+  }
+
+
+  IndexAdvisor::Shape::~Shape()
+  {
+    if (!keys_.empty())
+    {
+      const boost::posix_time::time_duration elapsed = boost::posix_time::microsec_clock::universal_time() - start_;
+      advisor_.Record(keys_, static_cast<uint64_t>(std::max<int64_t>(0, elapsed.total_microseconds())));
+    }
+  }
+
+
+  void IndexAdvisor::Shape::AddConstraint(const Orthanc::DicomTag& tag,
+                                          bool isIdentifier)
+  {
+    keys_[std::make_pair(tag, isIdentifier)].constraints_ ++;
+  }
+
+
+  void IndexAdvisor::Shape::AddOrdering(const Orthanc::DicomTag& tag,
+                                        bool isIdentifier)
+  {
+    keys_[std::make_pair(tag, isIdentifier)].orderings_ ++;
+  }
+
+
+  void IndexAdvisor::Record(const Usages& keys,
+                            uint64_t microseconds)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    for (Usages::const_iterator it = keys.begin(); it != keys.end(); ++it)
+    {
+      Usage& usage = usages_[it->first];
+      usage.constraints_ += it->second.constraints_;
+      usage.orderings_ += it->second.orderings_;
+      usage.microseconds_ += microseconds;
+    }
+  }
+
+
+  IndexAdvisor::IndexAdvisor() :
+    enabled_(false)
+  {
+  }
+
+
+  void IndexAdvisor::SetEnabled(bool enabled)
+  {
+    enabled_ = enabled;
+  }
+
+
+  void IndexAdvisor::GetUsages(Usages& target)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    target = usages_;
+  }
+
+
+  void IndexAdvisor::Clear()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    usages_.clear();
+  }
+
+
+  void IndexAdvisor::GetSortedKeys(std::vector<Key>& target,
+                                    const Usages& usages)
+  {
+    std::vector< std::pair<uint64_t, Key> > sorted;
+    sorted.reserve(usages.size());
+
+    for (Usages::const_iterator it = usages.begin(); it != usages.end(); ++it)
+    {
+      sorted.push_back(std::make_pair(it->second.microseconds_, it->first));
+    }
+
+    std::sort(sorted.begin(), sorted.end());
+
+    target.clear();
+    target.reserve(sorted.size());
+
+    for (size_t i = sorted.size(); i > 0; i--)
+    {
+      target.push_back(sorted[i - 1].second);
+    }
+  }
+
+
+  void IndexAdvisor::Format(Json::Value& target,
+                            const Key& key,
+                            const Usage& usage)
+  {
+    target = Json::objectValue;
+    target["Tag"] = key.first.Format();
+    target["Table"] = (key.second ? "DicomIdentifiers" : "MainDicomTags");
+    target["Constraints"] = static_cast<Json::UInt64>(usage.constraints_);
+    target["Orderings"] = static_cast<Json::UInt64>(usage.orderings_);
+    target["TotalMilliseconds"] = static_cast<Json::UInt64>(usage.microseconds_ / 1000);
+  }
+
+
+  std::string IndexAdvisor::FormatIndexName(const Orthanc::DicomTag& tag)
+  {
+    char buf[16];
+    sprintf(buf, "%04x%04x", tag.GetGroup(), tag.GetElement());
+    return "MainDicomTagsAdvised" + std::string(buf);
+  }
+}
@@ -0,0 +1,127 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include <DicomFormat/DicomTag.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <json/value.h>
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+namespace OrthancDatabases
+{
+  /**
+   * Usage of the tags by the constraints and by the orderings of the
+   * lookups ("ExecuteFind()" and "ExecuteCount()") of this process,
+   * together with the cumulative duration of these lookups. It is the
+   * input of the index advisor (cf. "IndexBackend::AdviseIndexes()"),
+   * as each site matches on its own set of tags. This class is
+   * thread-safe.
+   **/
+  class IndexAdvisor : public boost::noncopyable
+  {
+  public:
+    struct Usage
+    {
+      uint64_t  constraints_;
+      uint64_t  orderings_;
+      uint64_t  microseconds_;   // Cumulative duration of the lookups using the tag
+
+      Usage() :
+        constraints_(0),
+        orderings_(0),
+        microseconds_(0)
+      {
+      }
+    };
+
+    // The tag, and whether it is stored in "DicomIdentifiers"
+    typedef std::pair<Orthanc::DicomTag, bool>  Key;
+
+    typedef std::map<Key, Usage>  Usages;
+
+    /**
+     * Shape of one lookup, whose duration is measured from the
+     * construction to the destruction of this object.
+     **/
+    class Shape : public boost::noncopyable
+    {
+    private:
+      IndexAdvisor&             advisor_;
+      Usages                    keys_;
+      boost::posix_time::ptime  start_;
+
+    public:
+      explicit Shape(IndexAdvisor& advisor);
+
+      ~Shape();
+
+      void AddConstraint(const Orthanc::DicomTag& tag,
+                         bool isIdentifier);
+
+      void AddOrdering(const Orthanc::DicomTag& tag,
+                       bool isIdentifier);
+    };
+
+  private:
+    boost::mutex  mutex_;
+    bool          enabled_;
+    Usages        usages_;
+
+    void Record(const Usages& keys,
+                uint64_t microseconds);
+
+  public:
+    IndexAdvisor();
+
+    void SetEnabled(bool enabled);
+
+    bool IsEnabled() const
+    {
+      return enabled_;  // Only modified at the initialization of the plugin
+    }
+
+    void GetUsages(Usages& target);
+
+    void Clear();
+
+    // The tags sorted by decreasing cumulative duration
+    static void GetSortedKeys(std::vector<Key>& target,
+                              const Usages& usages);
+
+    static void Format(Json::Value& target,
+                       const Key& key,
+                       const Usage& usage);
+
+    // Name of the partial index that is advised for a tag of "MainDicomTags"
+    static std::string FormatIndexName(const Orthanc::DicomTag& tag);
+  };
+}
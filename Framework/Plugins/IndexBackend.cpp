@@ -31,14 +31,42 @@
 #include "DatabaseBackendAdapterV4.h"
 #include "GlobalProperties.h"
 
+#include "../../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
 #include <Compatibility.h>  // For std::unique_ptr<>
 #include <Logging.h>
 #include <OrthancException.h>
 #include <Toolbox.h>
 
+#include <algorithm>
+#include <boost/thread.hpp>
+
 
 namespace OrthancDatabases
 {
+  // Beyond this number of studies, the list of the candidates of a
+  // lookup is less efficient than the indexes of the database
+  static const size_t MAX_STUDY_CANDIDATES_IN_LOOKUP = 10000;
+
+  // Number of pending studies whose values are read by one statement
+  static const size_t MAX_PENDING_STUDIES_PER_STATEMENT = 1000;
+
+  // The rows of "CacheInvalidations" are kept for one hour, which
+  // leaves time for the other Orthanc servers to poll them
+  static const unsigned int CACHE_INVALIDATIONS_RETENTION_MINUTES = 60;
+
+  // The sequence numbers of "Changes" are not allocated in the order
+  // of the commits: Each delta of the analytics export also reads the
+  // last changes of the previous delta, so that the changes committed
+  // late are exported anyway (the rows of the later deltas replace
+  // the previous ones)
+  static const int64_t ANALYTICS_EXPORT_OVERLAP = 100;
+
+  // Same reason for the pages of the changes that are read by the
+  // local replicas of the index
+  static const int64_t REPLICA_CHANGES_OVERLAP = 100;
+
+
   static std::string ConvertWildcardToLike(const std::string& query)
   {
     std::string s = query;
@@ -73,15 +101,117 @@ namespace OrthancDatabases
 
     return joinedChangesTypes;
   }
+
+
+  /**
+   * Estimation of the size of an answer while its rows are read (cf.
+   * "SetMaxResponseSize()"). Each value is counted with the overhead
+   * of its protobuf field, the answer being only serialized once the
+   * transaction is over.
+   **/
+  class IndexBackend::ResponseBudget : public boost::noncopyable
+  {
+  private:
+    static const uint64_t VALUE_OVERHEAD = 16;
+
+    uint64_t  maxSize_;  // "0" means no limit
+    uint64_t  size_;
+
+  public:
+    explicit ResponseBudget(uint64_t maxSize) :
+      maxSize_(maxSize),
+      size_(0)
+    {
+    }
+
+    void Add(size_t valueSize)
+    {
+      if (maxSize_ != 0)
+      {
+        size_ += static_cast<uint64_t>(valueSize) + VALUE_OVERHEAD;
+
+        if (size_ > maxSize_)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory,
+                                          "The answer exceeds the memory budget of " +
+                                          boost::lexical_cast<std::string>(maxSize_ / (1024 * 1024)) +
+                                          "MB (cf. option \"MaxResponseSize\"), the request should be paginated");
+        }
+      }
+    }
+
+    uint64_t GetSize() const
+    {
+      return size_;
+    }
+  };
+
   
+  /**
+   * Overloads that allow the same reading loops to fill either a
+   * standard container, or directly a repeated field of a protobuf
+   * response (which avoids one allocation and one copy per value).
+   **/
+  template <typename T>
+  static void ClearTarget(std::list<T>& target)
+  {
+    target.clear();
+  }
+
+  template <typename T>
+  static void ClearTarget(std::vector<T>& target)
+  {
+    target.clear();   // Keeps the capacity
+  }
+
+  template <typename T>
+  static void ClearTarget(google::protobuf::RepeatedField<T>& target)
+  {
+    target.Clear();
+  }
+
+  static void ClearTarget(google::protobuf::RepeatedPtrField<std::string>& target)
+  {
+    target.Clear();
+  }
+
+  template <typename T>
+  static void AppendToTarget(std::list<T>& target,
+                             const T& value)
+  {
+    target.push_back(value);
+  }
+
+  template <typename T>
+  static void AppendToTarget(std::vector<T>& target,
+                             const T& value)
+  {
+    target.push_back(value);
+  }
+
   template <typename T>
-  static void ReadListOfIntegers(std::list<T>& target,
+  static void AppendToTarget(google::protobuf::RepeatedField<T>& target,
+                             const T& value)
+  {
+    target.Add(value);
+  }
+
+  static void AppendToTarget(google::protobuf::RepeatedPtrField<std::string>& target,
+                             const std::string& value)
+  {
+    target.Add()->assign(value);
+  }
+
+
+  template <typename T, typename Target>
+  static void ReadListOfIntegers(Target& target,
                                  DatabaseManager::CachedStatement& statement,
-                                 const Dictionary& args)
+                                 const Dictionary& args,
+                                 IndexBackend::ResponseBudget* budget = NULL)
   {
     statement.Execute(args);
       
-    target.clear();
+    ClearTarget(target);
 
     if (!statement.IsDone())
     {
@@ -94,20 +224,27 @@ namespace OrthancDatabases
 
       while (!statement.IsDone())
       {
-        target.push_back(static_cast<T>(statement.ReadInteger64(0)));
+        if (budget != NULL)
+        {
+          budget->Add(sizeof(T));
+        }
+
+        AppendToTarget(target, static_cast<T>(statement.ReadInteger64(0)));
         statement.Next();
       }
     }
   }
 
     
-  static void ReadListOfStrings(std::list<std::string>& target,
+  template <typename Target>
+  static void ReadListOfStrings(Target& target,
                                 DatabaseManager::CachedStatement& statement,
-                                const Dictionary& args)
+                                const Dictionary& args,
+                                IndexBackend::ResponseBudget* budget = NULL)
   {
     statement.Execute(args);
 
-    target.clear();
+    ClearTarget(target);
       
     if (!statement.IsDone())
     {
@@ -118,7 +255,14 @@ namespace OrthancDatabases
       
       while (!statement.IsDone())
       {
-        target.push_back(statement.ReadString(0));
+        const std::string& value = statement.ReadStringReference(0);
+
+        if (budget != NULL)
+        {
+          budget->Add(value.size());
+        }
+
+        AppendToTarget(target, value);
         statement.Next();
       }
     }
@@ -143,13 +287,13 @@ namespace OrthancDatabases
   }
 
 
-  void IndexBackend::ReadChangesInternal(IDatabaseBackendOutput& output,
-                                         bool& done,
-                                         DatabaseManager& manager,
-                                         DatabaseManager::CachedStatement& statement,
-                                         const Dictionary& args,
-                                         uint32_t limit,
-                                         bool returnFirstResults)
+  int64_t IndexBackend::ReadChangesInternal(IDatabaseBackendOutput& output,
+                                            bool& done,
+                                            DatabaseManager& manager,
+                                            DatabaseManager::CachedStatement& statement,
+                                            const Dictionary& args,
+                                            uint32_t limit,
+                                            bool returnFirstResults)
   {
     statement.Execute(args);
 
@@ -188,6 +332,8 @@ namespace OrthancDatabases
     {
       output.AnswerChange(it->seq_, it->changeType_, it->resourceType_, it->publicId_, it->changeDate_);
     }
+
+    return (changes.empty() ? -1 : changes.back().seq_);
   }
 
 
@@ -266,7 +412,9 @@ namespace OrthancDatabases
       "SELECT uuid, fileType, uncompressedSize, uncompressedHash, compressionType, "
       "compressedSize, compressedHash FROM DeletedFiles");
 
+    // The files of a whole patient are read by chunks, not as a whole result set
     statement.SetReadOnly(true);
+    statement.SetStreaming(true);
     statement.Execute();
 
     while (!statement.IsDone())
@@ -292,24 +440,190 @@ namespace OrthancDatabases
       "SELECT resourceType, publicId FROM DeletedResources");
 
     statement.SetReadOnly(true);
+    statement.SetStreaming(true);
     statement.Execute();
 
+    std::list<std::string> deleted;
+
     while (!statement.IsDone())
     {
+      const std::string publicId = statement.ReadString(1);
+
       output.SignalDeletedResource(
-        statement.ReadString(1),
-        static_cast<OrthancPluginResourceType>(statement.ReadInteger32(0)));
+        publicId, static_cast<OrthancPluginResourceType>(statement.ReadInteger32(0)));
+
+      deleted.push_back(publicId);
 
       statement.Next();
     }
+
+    InvalidateCachedResources(manager, deleted);
+
+    if (!cacheInvalidations_.IsEnabled())
+    {
+      return;
+    }
+
+    for (std::list<std::string>::const_iterator it = deleted.begin(); it != deleted.end(); ++it)
+    {
+      SignalCacheInvalidation(manager, CacheInvalidationType_DeletedResource, -1, *it);
+    }
+  }
+
+
+  class IndexBackend::InvalidateResourcesAction : public DatabaseManager::ICommitAction
+  {
+  private:
+    IndexBackend&           that_;
+    std::list<std::string>  publicIds_;
+
+  public:
+    InvalidateResourcesAction(IndexBackend& that,
+                              const std::list<std::string>& publicIds) :
+      that_(that),
+      publicIds_(publicIds)
+    {
+    }
+
+    virtual void Execute() ORTHANC_OVERRIDE
+    {
+      for (std::list<std::string>::const_iterator it = publicIds_.begin(); it != publicIds_.end(); ++it)
+      {
+        that_.InvalidateCachedResource(*it);
+      }
+
+      // The deletions move the offsets, without necessarily logging a
+      // change that would invalidate the cached answers
+      that_.findResultsCache_.Clear();
+      that_.keysetPagination_.Clear();
+    }
+  };
+
+
+  class IndexBackend::InvalidateGlobalPropertyAction : public DatabaseManager::ICommitAction
+  {
+  private:
+    GlobalPropertiesCache&  cache_;
+    std::string             server_;
+    int32_t                 property_;
+
+  public:
+    InvalidateGlobalPropertyAction(GlobalPropertiesCache& cache,
+                                   const std::string& server,
+                                   int32_t property) :
+      cache_(cache),
+      server_(server),
+      property_(property)
+    {
+    }
+
+    virtual void Execute() ORTHANC_OVERRIDE
+    {
+      cache_.Invalidate(server_, property_);
+    }
+  };
+
+
+  class IndexBackend::InvalidateLabelAction : public DatabaseManager::ICommitAction
+  {
+  private:
+    IndexBackend&  that_;
+    std::string    label_;
+
+  public:
+    InvalidateLabelAction(IndexBackend& that,
+                          const std::string& label) :
+      that_(that),
+      label_(label)
+    {
+    }
+
+    virtual void Execute() ORTHANC_OVERRIDE
+    {
+      that_.labelsCache_.InvalidateLabel(label_);
+
+      // The labels don't log a change that would invalidate the cached answers
+      that_.findResultsCache_.Clear();
+      that_.keysetPagination_.Clear();
+    }
+  };
+
+
+  void IndexBackend::InvalidateCachedResources(DatabaseManager& manager,
+                                               const std::list<std::string>& publicIds)
+  {
+    if (!publicIds.empty())
+    {
+      manager.AddCommitAction(new InvalidateResourcesAction(*this, publicIds));
+    }
   }
 
 
   IndexBackend::IndexBackend(OrthancPluginContext* context,
                              bool readOnly) :
     context_(context),
-    readOnly_(readOnly)
+    readOnly_(readOnly),
+    maxCachedStatements_(0),
+    connectionHoldWarningThreshold_(0),
+    minConnections_(0),
+    idleConnectionsTimeout_(0),
+    healthCheckInterval_(0),
+    lifoConnections_(false),
+    connectionsAffinity_(false),
+    groupCommitSize_(0),
+    groupCommitDelay_(5),
+    maxConcurrentWriters_(0),
+    failoverRetryBudget_(0),
+    maxInFlightTransactions_(0),
+    reservedReadOnlyConnections_(0),
+    reservedReadWriteConnections_(0),
+    studyColumnStoreReloadInterval_(0),
+    childrenPrefetch_(false),
+    replicaReadYourWrites_(false),
+    idleConnections_(NULL),
+    findParallelism_(0),
+    findTwoPhases_(false),
+    findJsonAggregation_(false),
+    findStatementTimeout_(0),
+    maxResponseSize_(0),
+    lookupPlanCacheMode_(PlanCacheMode_Auto),
+    captureBufferSize_(1024),
+    ingestStatistics_(false),
+    chunkedDeletionBatchSize_(0),
+    replicaSource_(false),
+    slowStatementThreshold_(0),
+    exportedResourcesRetentionDays_(0),
+    exportedResourcesRetentionBatchSize_(10000)
+  {
+  }
+
+
+  unsigned int IndexBackend::GetHousekeepingInterval(const std::string& task,
+                                                     unsigned int defaultSeconds) const
+  {
+    std::map<std::string, unsigned int>::const_iterator found = housekeepingIntervals_.find(task);
+
+    if (found == housekeepingIntervals_.end())
+    {
+      return defaultSeconds;
+    }
+    else
+    {
+      return found->second;
+    }
+  }
+
+
+  void IndexBackend::SetExportedResourcesRetention(unsigned int days,
+                                                   unsigned int batchSize)
   {
+    if (batchSize == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    exportedResourcesRetentionDays_ = days;
+    exportedResourcesRetentionBatchSize_ = batchSize;
   }
 
 
@@ -421,7 +735,7 @@ namespace OrthancDatabases
     args.SetIntegerValue("parent", parent);
     args.SetIntegerValue("child", child);
     
-    statement.Execute(args);
+    statement.ExecuteWithoutResult(args);
   }
 
     
@@ -464,7 +778,7 @@ namespace OrthancDatabases
       args.SetIntegerValue("id", id);
       args.SetIntegerValue("type", static_cast<int>(attachment));
     
-      statement.Execute(args);
+      statement.ExecuteWithoutResult(args);
     }
 
     SignalDeletedFiles(output, manager);
@@ -486,7 +800,7 @@ namespace OrthancDatabases
     args.SetIntegerValue("id", id);
     args.SetIntegerValue("type", static_cast<int>(metadataType));
     
-    statement.Execute(args);
+    statement.ExecuteWithoutResult(args);
   }
 
 
@@ -535,6 +849,134 @@ namespace OrthancDatabases
   }
 
 
+  namespace
+  {
+    // Forwards the deleted attachments and resources to the wrapped
+    // output, but keeps the remaining ancestors, as the output
+    // accepts at most one remaining ancestor per transaction
+    class DeleteResourcesOutput : public IDatabaseBackendOutput
+    {
+    private:
+      IDatabaseBackendOutput&                             output_;
+      std::map<std::string, OrthancPluginResourceType>&  remainingAncestors_;
+
+    public:
+      DeleteResourcesOutput(IDatabaseBackendOutput& output,
+                            std::map<std::string, OrthancPluginResourceType>& remainingAncestors) :
+        output_(output),
+        remainingAncestors_(remainingAncestors)
+      {
+      }
+
+      virtual void SignalDeletedAttachment(const std::string& uuid,
+                                           int32_t            contentType,
+                                           uint64_t           uncompressedSize,
+                                           const std::string& uncompressedHash,
+                                           int32_t            compressionType,
+                                           uint64_t           compressedSize,
+                                           const std::string& compressedHash) ORTHANC_OVERRIDE
+      {
+        output_.SignalDeletedAttachment(uuid, contentType, uncompressedSize, uncompressedHash,
+                                        compressionType, compressedSize, compressedHash);
+      }
+
+      virtual void SignalDeletedResource(const std::string& publicId,
+                                         OrthancPluginResourceType resourceType) ORTHANC_OVERRIDE
+      {
+        // The ancestor of a previous resource may have been deleted afterwards
+        remainingAncestors_.erase(publicId);
+        output_.SignalDeletedResource(publicId, resourceType);
+      }
+
+      virtual void SignalRemainingAncestor(const std::string& ancestorId,
+                                           OrthancPluginResourceType ancestorType) ORTHANC_OVERRIDE
+      {
+        remainingAncestors_[ancestorId] = ancestorType;
+      }
+
+      virtual void AnswerAttachment(const std::string& uuid,
+                                    int32_t            contentType,
+                                    uint64_t           uncompressedSize,
+                                    const std::string& uncompressedHash,
+                                    int32_t            compressionType,
+                                    uint64_t           compressedSize,
+                                    const std::string& compressedHash) ORTHANC_OVERRIDE
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+
+      virtual void AnswerChange(int64_t                    seq,
+                                int32_t                    changeType,
+                                OrthancPluginResourceType  resourceType,
+                                const std::string&         publicId,
+                                const std::string&         date) ORTHANC_OVERRIDE
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+
+      virtual void AnswerDicomTag(uint16_t group,
+                                  uint16_t element,
+                                  const std::string& value) ORTHANC_OVERRIDE
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+
+      virtual void AnswerResourceDicomTag(int64_t resource,
+                                          uint16_t group,
+                                          uint16_t element,
+                                          const std::string& value) ORTHANC_OVERRIDE
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+
+      virtual void AnswerExportedResource(int64_t                    seq,
+                                          OrthancPluginResourceType  resourceType,
+                                          const std::string&         publicId,
+                                          const std::string&         modality,
+                                          const std::string&         date,
+                                          const std::string&         patientId,
+                                          const std::string&         studyInstanceUid,
+                                          const std::string&         seriesInstanceUid,
+                                          const std::string&         sopInstanceUid) ORTHANC_OVERRIDE
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+
+#if ORTHANC_PLUGINS_HAS_DATABASE_CONSTRAINT == 1
+      virtual void AnswerMatchingResource(const std::string& resourceId) ORTHANC_OVERRIDE
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+
+      virtual void AnswerMatchingResource(const std::string& resourceId,
+                                          const std::string& someInstanceId) ORTHANC_OVERRIDE
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+#endif
+    };
+  }
+
+
+  void IndexBackend::DeleteResources(IDatabaseBackendOutput& output,
+                                     std::map<std::string, OrthancPluginResourceType>& remainingAncestors,
+                                     DatabaseManager& manager,
+                                     const std::list<int64_t>& ids)
+  {
+    remainingAncestors.clear();
+
+    DeleteResourcesOutput wrapper(output, remainingAncestors);
+
+    for (std::list<int64_t>::const_iterator it = ids.begin(); it != ids.end(); ++it)
+    {
+      if (IsExistingResource(manager, *it))  // The resource may be the descendant of a previous one
+      {
+        DeleteResource(wrapper, manager, *it);
+      }
+    }
+  }
+
+
   void IndexBackend::GetAllInternalIds(std::list<int64_t>& target,
                                        DatabaseManager& manager,
                                        OrthancPluginResourceType resourceType)
@@ -544,38 +986,63 @@ namespace OrthancDatabases
       "SELECT internalId FROM Resources WHERE resourceType=${type}");
       
     statement.SetReadOnly(true);
+    statement.SetStreaming(true);
     statement.SetParameterType("type", ValueType_Integer64);
 
     Dictionary args;
     args.SetIntegerValue("type", static_cast<int>(resourceType));
 
-    ReadListOfIntegers<int64_t>(target, statement, args);
+    ResponseBudget budget(maxResponseSize_);
+    ReadListOfIntegers<int64_t>(target, statement, args, &budget);
   }
 
     
-  void IndexBackend::GetAllPublicIds(std::list<std::string>& target,
-                                     DatabaseManager& manager,
-                                     OrthancPluginResourceType resourceType)
+  template <typename Target>
+  static void GetAllPublicIdsInternal(Target& target,
+                                      DatabaseManager& manager,
+                                      OrthancPluginResourceType resourceType,
+                                      IndexBackend::ResponseBudget& budget)
   {
     DatabaseManager::CachedStatement statement(
       STATEMENT_FROM_HERE, manager,
       "SELECT publicId FROM Resources WHERE resourceType=${type}");
       
     statement.SetReadOnly(true);
+    statement.SetStreaming(true);
     statement.SetParameterType("type", ValueType_Integer64);
 
     Dictionary args;
     args.SetIntegerValue("type", static_cast<int>(resourceType));
 
-    ReadListOfStrings(target, statement, args);
+    ReadListOfStrings(target, statement, args, &budget);
   }
 
     
   void IndexBackend::GetAllPublicIds(std::list<std::string>& target,
                                      DatabaseManager& manager,
-                                     OrthancPluginResourceType resourceType,
-                                     int64_t since,
-                                     uint32_t limit)
+                                     OrthancPluginResourceType resourceType)
+  {
+    ResponseBudget budget(maxResponseSize_);
+    GetAllPublicIdsInternal(target, manager, resourceType, budget);
+  }
+
+    
+  void IndexBackend::GetAllPublicIds(google::protobuf::RepeatedPtrField<std::string>& target,
+                                     DatabaseManager& manager,
+                                     OrthancPluginResourceType resourceType)
+  {
+    ResponseBudget budget(maxResponseSize_);
+    GetAllPublicIdsInternal(target, manager, resourceType, budget);
+  }
+
+    
+  template <typename Target>
+  static void GetAllPublicIdsInternal(Target& target,
+                                      DatabaseManager& manager,
+                                      OrthancPluginResourceType resourceType,
+                                      int64_t since,
+                                      uint32_t limit,
+                                      IndexBackend::ResponseBudget& budget)
   {
     std::string suffix;
     if (manager.GetDialect() == Dialect_MSSQL)
@@ -593,6 +1060,7 @@ namespace OrthancDatabases
     DatabaseManager::CachedStatement statement(STATEMENT_FROM_HERE_DYNAMIC(sql), manager, sql);
       
     statement.SetReadOnly(true);
+    statement.SetStreaming(true);
 
     Dictionary args;
 
@@ -607,29 +1075,156 @@ namespace OrthancDatabases
       args.SetIntegerValue("since", since);
     }
 
-    ReadListOfStrings(target, statement, args);
+    ReadListOfStrings(target, statement, args, &budget);
   }
 
-  void IndexBackend::GetChanges(IDatabaseBackendOutput& output,
-                                bool& done /*out*/,
-                                DatabaseManager& manager,
-                                int64_t since,
-                                uint32_t limit)
-  {
-    std::set<uint32_t> changeTypes;
-    GetChangesExtended(output, done, manager, since, -1, changeTypes, limit);
-  }
 
-  /* Use GetOutput().AnswerChange() */
-  void IndexBackend::GetChangesExtended(IDatabaseBackendOutput& output,
-                                        bool& done /*out*/,
-                                        DatabaseManager& manager,
-                                        int64_t since,
-                                        int64_t to,
-                                        const std::set<uint32_t>& changeTypes,
-                                        uint32_t limit)
+  // Seek-based variant of the function above, whose cost doesn't depend on the depth of the page
+  template <typename Target>
+  static void GetAllPublicIdsAfterInternal(Target& target,
+                                           DatabaseManager& manager,
+                                           OrthancPluginResourceType resourceType,
+                                           const std::string& after,
+                                           uint32_t limit,
+                                           IndexBackend::ResponseBudget& budget)
   {
-    std::string limitSuffix;
+    std::string suffix;
+    if (manager.GetDialect() == Dialect_MSSQL)
+    {
+      suffix = "OFFSET 0 ROWS FETCH FIRST ${limit} ROWS ONLY";
+    }
+    else
+    {
+      suffix = "LIMIT ${limit}";
+    }
+
+    std::string sql = "SELECT publicId FROM Resources WHERE resourceType=${type} AND publicId > ${after} "
+      "ORDER BY publicId " + suffix;
+
+    DatabaseManager::CachedStatement statement(STATEMENT_FROM_HERE_DYNAMIC(sql), manager, sql);
+      
+    statement.SetReadOnly(true);
+    statement.SetStreaming(true);
+    statement.SetParameterType("type", ValueType_Integer64);
+    statement.SetParameterType("after", ValueType_Utf8String);
+    statement.SetParameterType("limit", ValueType_Integer64);
+
+    Dictionary args;
+    args.SetIntegerValue("type", static_cast<int>(resourceType));
+    args.SetUtf8Value("after", after);
+    args.SetIntegerValue("limit", limit);
+
+    ReadListOfStrings(target, statement, args, &budget);
+  }
+
+
+  static const std::string& GetLastPublicId(const std::list<std::string>& target)
+  {
+    return target.back();
+  }
+
+
+  static const std::string& GetLastPublicId(const google::protobuf::RepeatedPtrField<std::string>& target)
+  {
+    return target.Get(target.size() - 1);
+  }
+
+
+  /**
+   * If the keyset pagination is enabled, the end of each full page is
+   * remembered, so that the walkers of the whole archive (that read
+   * the successive pages with increasing "since") get each page by a
+   * seek on the index of the public IDs, instead of an "OFFSET". A
+   * bound is dropped if a change was logged since it was stored, as
+   * the offsets of the public IDs after it might have moved.
+   **/
+  template <typename Target>
+  static void GetAllPublicIdsWithKeyset(Target& target,
+                                        IndexBackend& backend,
+                                        DatabaseManager& manager,
+                                        KeysetPaginationCache& keysetPagination,
+                                        OrthancPluginResourceType resourceType,
+                                        int64_t since,
+                                        uint32_t limit,
+                                        IndexBackend::ResponseBudget& budget)
+  {
+    if (limit == 0 ||
+        since < 0 ||
+        !keysetPagination.IsEnabled())
+    {
+      GetAllPublicIdsInternal(target, manager, resourceType, since, limit, budget);
+      return;
+    }
+
+    const std::string prefix = "publicIds|" + boost::lexical_cast<std::string>(resourceType) + "|";
+    const int64_t lastChange = backend.GetLastChangeIndex(manager);
+    const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+    FindKeysetBound bound;
+    if (since == 0)
+    {
+      GetAllPublicIdsAfterInternal(target, manager, resourceType, "", limit, budget);
+    }
+    else if (keysetPagination.Lookup(bound, prefix + boost::lexical_cast<std::string>(since), lastChange, now))
+    {
+      GetAllPublicIdsAfterInternal(target, manager, resourceType, bound.GetPublicId(), limit, budget);
+    }
+    else
+    {
+      GetAllPublicIdsInternal(target, manager, resourceType, since, limit, budget);
+    }
+
+    if (static_cast<uint32_t>(target.size()) == limit &&
+        !manager.IsReadWriteTransaction())  // Don't remember the uncommitted changes
+    {
+      // The page is full: Remember where it ends, as the bound of the next page
+      bound = FindKeysetBound();
+      bound.SetPublicId(GetLastPublicId(target));
+      keysetPagination.Store(prefix + boost::lexical_cast<std::string>(since + limit), bound, lastChange, now);
+    }
+  }
+
+
+  void IndexBackend::GetAllPublicIds(std::list<std::string>& target,
+                                     DatabaseManager& manager,
+                                     OrthancPluginResourceType resourceType,
+                                     int64_t since,
+                                     uint32_t limit)
+  {
+    ResponseBudget budget(maxResponseSize_);
+    GetAllPublicIdsWithKeyset(target, *this, manager, keysetPagination_, resourceType, since, limit, budget);
+  }
+
+  void IndexBackend::GetAllPublicIds(google::protobuf::RepeatedPtrField<std::string>& target,
+                                     DatabaseManager& manager,
+                                     OrthancPluginResourceType resourceType,
+                                     int64_t since,
+                                     uint32_t limit)
+  {
+    ResponseBudget budget(maxResponseSize_);
+    GetAllPublicIdsWithKeyset(target, *this, manager, keysetPagination_, resourceType, since, limit, budget);
+  }
+
+  void IndexBackend::GetChanges(IDatabaseBackendOutput& output,
+                                bool& done /*out*/,
+                                DatabaseManager& manager,
+                                int64_t since,
+                                uint32_t limit)
+  {
+    std::set<uint32_t> changeTypes;
+    GetChangesExtended(output, done, manager, since, -1, changeTypes, limit);
+  }
+
+  /* Use GetOutput().AnswerChange() */
+  void IndexBackend::GetChangesExtended(IDatabaseBackendOutput& output,
+                                        bool& done /*out*/,
+                                        DatabaseManager& manager,
+                                        int64_t since,
+                                        int64_t to,
+                                        const std::set<uint32_t>& changeTypes,
+                                        uint32_t limit)
+  {
+    std::string limitSuffix;
     if (manager.GetDialect() == Dialect_MSSQL)
     {
       limitSuffix = "OFFSET 0 ROWS FETCH FIRST ${limit} ROWS ONLY";
@@ -690,6 +1285,7 @@ namespace OrthancDatabases
 
     DatabaseManager::CachedStatement statement(STATEMENT_FROM_HERE_DYNAMIC(sql), manager, sql);
     statement.SetReadOnly(true);
+    statement.SetStreaming(true);
     Dictionary args;
 
     statement.SetParameterType("limit", ValueType_Integer64);
@@ -710,10 +1306,67 @@ namespace OrthancDatabases
     ReadChangesInternal(output, done, manager, statement, args, limit, returnFirstResults);
   }
 
+
+  void IndexBackend::GetChangesCursor(IDatabaseBackendOutput& output,
+                                      bool& done /*out*/,
+                                      int64_t& next /*out*/,
+                                      DatabaseManager& manager,
+                                      int64_t since,
+                                      const std::set<uint32_t>& changeTypes,
+                                      uint32_t limit)
+  {
+    if (limit == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    // Read before the changes, so that "next" never skips a change that is not answered
+    const int64_t last = GetLastChangeIndex(manager);
+
+    std::string sql = ("SELECT Changes.seq, Changes.changeType, Changes.resourceType, Resources.publicId, "
+                       "Changes.date FROM Changes INNER JOIN Resources "
+                       "ON Changes.internalId = Resources.internalId WHERE seq>${since} ");
+
+    if (!changeTypes.empty())
+    {
+      sql += "AND changeType IN (" + JoinChanges(changeTypes) + ") ";
+    }
+
+    if (manager.GetDialect() == Dialect_MSSQL)
+    {
+      sql += "ORDER BY seq ASC OFFSET 0 ROWS FETCH FIRST ${limit} ROWS ONLY";
+    }
+    else
+    {
+      sql += "ORDER BY seq ASC LIMIT ${limit}";
+    }
+
+    DatabaseManager::CachedStatement statement(STATEMENT_FROM_HERE_DYNAMIC(sql), manager, sql);
+    statement.SetReadOnly(true);
+    statement.SetParameterType("since", ValueType_Integer64);
+    statement.SetParameterType("limit", ValueType_Integer64);
+
+    Dictionary args;
+    args.SetIntegerValue("since", since);
+    args.SetIntegerValue("limit", limit + 1);  // The extra change tells whether "done" must be set
+
+    const int64_t answered = ReadChangesInternal(output, done, manager, statement, args, limit, true);
+
+    if (done)
+    {
+      next = std::max(since, std::max(last, answered));
+    }
+    else
+    {
+      next = answered;
+    }
+  }
+
     
-  void IndexBackend::GetChildrenInternalId(std::list<int64_t>& target /*out*/,
-                                           DatabaseManager& manager,
-                                           int64_t id)
+  template <typename Target>
+  static void GetChildrenInternalIdInternal(Target& target,
+                                            DatabaseManager& manager,
+                                            int64_t id)
   {
     DatabaseManager::CachedStatement statement(
       STATEMENT_FROM_HERE, manager,
@@ -730,6 +1383,22 @@ namespace OrthancDatabases
   }
 
     
+  void IndexBackend::GetChildrenInternalId(std::list<int64_t>& target /*out*/,
+                                           DatabaseManager& manager,
+                                           int64_t id)
+  {
+    GetChildrenInternalIdInternal(target, manager, id);
+  }
+
+    
+  void IndexBackend::GetChildrenInternalId(google::protobuf::RepeatedField<int64_t>& target /*out*/,
+                                           DatabaseManager& manager,
+                                           int64_t id)
+  {
+    GetChildrenInternalIdInternal(target, manager, id);
+  }
+
+    
   void IndexBackend::GetChildrenPublicId(std::list<std::string>& target /*out*/,
                                          DatabaseManager& manager,
                                          int64_t id)
@@ -748,6 +1417,115 @@ namespace OrthancDatabases
     ReadListOfStrings(target, statement, args);
   }
 
+
+  bool IndexBackend::GetChildrenPublicId(std::vector<std::string>& target /*out*/,
+                                         int64_t& last /*inout*/,
+                                         DatabaseManager& manager,
+                                         int64_t id,
+                                         uint32_t limit)
+  {
+    std::string suffix;
+    if (manager.GetDialect() == Dialect_MSSQL)
+    {
+      suffix = "OFFSET 0 ROWS FETCH FIRST ${limit} ROWS ONLY";
+    }
+    else
+    {
+      suffix = "LIMIT ${limit}";
+    }
+
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "SELECT internalId, publicId FROM Resources "
+      "WHERE parentId = ${id} AND internalId > ${last} ORDER BY internalId " + suffix);
+
+    statement.SetReadOnly(true);
+    statement.SetParameterType("id", ValueType_Integer64);
+    statement.SetParameterType("last", ValueType_Integer64);
+    statement.SetParameterType("limit", ValueType_Integer64);
+
+    Dictionary args;
+    args.SetIntegerValue("id", id);
+    args.SetIntegerValue("last", last);
+    args.SetIntegerValue("limit", limit);
+
+    statement.Execute(args);
+
+    // "clear()" keeps the capacity of the vector across the batches
+    target.clear();
+
+    while (!statement.IsDone())
+    {
+      last = statement.ReadInteger64(0);
+      target.push_back(statement.ReadString(1));
+      statement.Next();
+    }
+
+    return (target.size() < limit);
+  }
+
+
+  void IndexBackend::GetDescendantInstances(std::vector<std::string>& target /*out*/,
+                                            DatabaseManager& manager,
+                                            int64_t id,
+                                            Orthanc::ResourceType level,
+                                            uint32_t limit)
+  {
+    std::string sql = "SELECT instances.publicId FROM Resources instances";
+    std::string parent = "instances.parentId";
+
+    switch (level)
+    {
+      case Orthanc::ResourceType_Patient:
+        sql += (" INNER JOIN Resources series ON series.internalId = instances.parentId"
+                " INNER JOIN Resources studies ON studies.internalId = series.parentId");
+        parent = "studies.parentId";
+        break;
+
+      case Orthanc::ResourceType_Study:
+        sql += " INNER JOIN Resources series ON series.internalId = instances.parentId";
+        parent = "series.parentId";
+        break;
+
+      case Orthanc::ResourceType_Series:
+        break;
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    sql += " WHERE " + parent + " = ${id}";
+
+    if (manager.GetDialect() == Dialect_MSSQL)
+    {
+      sql += " ORDER BY instances.internalId OFFSET 0 ROWS FETCH FIRST ${limit} ROWS ONLY";
+    }
+    else
+    {
+      sql += " LIMIT ${limit}";
+    }
+
+    DatabaseManager::CachedStatement statement(STATEMENT_FROM_HERE_DYNAMIC(sql), manager, sql);
+
+    statement.SetReadOnly(true);
+    statement.SetParameterType("id", ValueType_Integer64);
+    statement.SetParameterType("limit", ValueType_Integer64);
+
+    Dictionary args;
+    args.SetIntegerValue("id", id);
+    args.SetIntegerValue("limit", limit);
+
+    statement.Execute(args);
+
+    target.clear();
+
+    while (!statement.IsDone())
+    {
+      target.push_back(statement.ReadString(0));
+      statement.Next();
+    }
+  }
+
     
   /* Use GetOutput().AnswerExportedResource() */
   void IndexBackend::GetExportedResources(IDatabaseBackendOutput& output,
@@ -868,6 +1646,15 @@ namespace OrthancDatabases
   std::string IndexBackend::GetPublicId(DatabaseManager& manager,
                                         int64_t resourceId)
   {
+    const bool useCache = IsLookupCacheUsable(manager);
+
+    std::string publicId;
+    if (useCache &&
+        lookupCache_.LookupPublicId(publicId, resourceId))
+    {
+      return publicId;
+    }
+
     DatabaseManager::CachedStatement statement(
       STATEMENT_FROM_HERE, manager,
       "SELECT publicId FROM Resources WHERE internalId=${id}");
@@ -886,7 +1673,14 @@ namespace OrthancDatabases
     }
     else
     {
-      return statement.ReadString(0);
+      publicId = statement.ReadString(0);
+
+      if (useCache)
+      {
+        lookupCache_.StorePublicId(resourceId, publicId);
+      }
+
+      return publicId;
     }
   }
 
@@ -1091,9 +1885,10 @@ namespace OrthancDatabases
   }
 
     
-  void IndexBackend::ListAvailableAttachments(std::list<int32_t>& target /*out*/,
-                                              DatabaseManager& manager,
-                                              int64_t id)
+  template <typename Target>
+  static void ListAvailableAttachmentsInternal(Target& target,
+                                               DatabaseManager& manager,
+                                               int64_t id)
   {
     DatabaseManager::CachedStatement statement(
       STATEMENT_FROM_HERE, manager,
@@ -1109,6 +1904,22 @@ namespace OrthancDatabases
   }
 
     
+  void IndexBackend::ListAvailableAttachments(std::list<int32_t>& target /*out*/,
+                                              DatabaseManager& manager,
+                                              int64_t id)
+  {
+    ListAvailableAttachmentsInternal(target, manager, id);
+  }
+
+    
+  void IndexBackend::ListAvailableAttachments(google::protobuf::RepeatedField<int32_t>& target /*out*/,
+                                              DatabaseManager& manager,
+                                              int64_t id)
+  {
+    ListAvailableAttachmentsInternal(target, manager, id);
+  }
+
+    
   void IndexBackend::LogChange(DatabaseManager& manager,
                                int32_t changeType,
                                int64_t resourceId,
@@ -1254,24 +2065,86 @@ namespace OrthancDatabases
   }
 
 
-  static bool ReadGlobalProperty(std::string& target,
-                                 DatabaseManager::CachedStatement& statement,
-                                 const Dictionary& args)
+  void IndexBackend::LookupAttachments(google::protobuf::RepeatedPtrField<Orthanc::DatabasePluginMessages::Find_Response>& target,
+                                       DatabaseManager& manager,
+                                       const std::set<int64_t>& ids)
   {
-    statement.Execute(args);
-    statement.SetResultFieldType(0, ValueType_Utf8String);
-
-    if (statement.IsDone())
+    if (ids.empty())
     {
-      return false;
+      return;
     }
-    else
-    {
-      ValueType type = statement.GetResultField(0).GetType();
 
-      if (type == ValueType_Null)
+    std::string values;
+    for (std::set<int64_t>::const_iterator it = ids.begin(); it != ids.end(); ++it)
+    {
+      if (!values.empty())
       {
-        return false;
+        values += ", ";
+      }
+
+      values += boost::lexical_cast<std::string>(*it);
+    }
+
+    // Not cached, as the SQL contains the identifiers of the resources
+    DatabaseManager::StandaloneStatement statement(
+      manager,
+      "SELECT Resources.internalId, Resources.publicId, fileType, uuid, uncompressedSize, compressionType, "
+      "compressedSize, uncompressedHash, compressedHash, " + std::string(HasRevisionsSupport() ? "revision" : "0") +
+      " FROM Resources INNER JOIN AttachedFiles ON AttachedFiles.id = Resources.internalId "
+      "WHERE Resources.internalId IN (" + values + ") ORDER BY Resources.internalId, fileType");
+
+    statement.SetReadOnly(true);
+    statement.Execute();
+
+    Orthanc::DatabasePluginMessages::Find_Response* resource = NULL;
+
+    while (!statement.IsDone())
+    {
+      const int64_t id = statement.ReadInteger64(0);
+
+      if (resource == NULL ||
+          resource->internal_id() != id)
+      {
+        resource = target.Add();
+        resource->set_internal_id(id);
+        resource->set_public_id(statement.ReadString(1));
+      }
+
+      Orthanc::DatabasePluginMessages::FileInfo* attachment = resource->add_attachments();
+      attachment->set_content_type(statement.ReadInteger32(2));
+      attachment->set_uuid(statement.ReadString(3));
+      attachment->set_uncompressed_size(statement.ReadInteger64(4));
+      attachment->set_compression_type(statement.ReadInteger32(5));
+      attachment->set_compressed_size(statement.ReadInteger64(6));
+      attachment->set_uncompressed_hash(statement.ReadString(7));
+      attachment->set_compressed_hash(statement.ReadString(8));
+
+      // The revision is NULL for the files that have been attached by older Orthanc versions
+      resource->add_attachments_revisions(statement.IsNull(9) ? 0 : statement.ReadInteger32(9));
+
+      statement.Next();
+    }
+  }
+
+
+  static bool ReadGlobalProperty(std::string& target,
+                                 DatabaseManager::CachedStatement& statement,
+                                 const Dictionary& args)
+  {
+    statement.Execute(args);
+    statement.SetResultFieldType(0, ValueType_Utf8String);
+
+    if (statement.IsDone())
+    {
+      return false;
+    }
+    else
+    {
+      ValueType type = statement.GetResultField(0).GetType();
+
+      if (type == ValueType_Null)
+      {
+        return false;
       }
       else if (type != ValueType_Utf8String)
       {
@@ -1286,6 +2159,46 @@ namespace OrthancDatabases
   }
   
     
+  static bool LookupGlobalPropertyInDatabase(std::string& target /*out*/,
+                                             DatabaseManager& manager,
+                                             const char* serverIdentifier,
+                                             int32_t property)
+  {
+    assert(serverIdentifier != NULL);
+
+    if (strlen(serverIdentifier) == 0)
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "SELECT value FROM GlobalProperties WHERE property=${property}");
+
+      statement.SetReadOnly(true);
+      statement.SetParameterType("property", ValueType_Integer64);
+
+      Dictionary args;
+      args.SetIntegerValue("property", property);
+
+      return ReadGlobalProperty(target, statement, args);
+    }
+    else
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "SELECT value FROM ServerProperties WHERE server=${server} AND property=${property}");
+
+      statement.SetReadOnly(true);
+      statement.SetParameterType("server", ValueType_Utf8String);
+      statement.SetParameterType("property", ValueType_Integer64);
+
+      Dictionary args;
+      args.SetUtf8Value("server", serverIdentifier);
+      args.SetIntegerValue("property", property);
+
+      return ReadGlobalProperty(target, statement, args);
+    }
+  }
+
+
   bool IndexBackend::LookupGlobalProperty(std::string& target /*out*/,
                                           DatabaseManager& manager,
                                           const char* serverIdentifier,
@@ -1295,41 +2208,47 @@ namespace OrthancDatabases
     {
       throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
     }
-    else
+    else if (globalPropertiesCache_.IsEnabled() &&
+             GlobalPropertiesCache::IsCacheable(property) &&
+             !manager.IsReadWriteTransaction())  // Don't cache the uncommitted changes
     {
-      if (strlen(serverIdentifier) == 0)
-      {
-        DatabaseManager::CachedStatement statement(
-          STATEMENT_FROM_HERE, manager,
-          "SELECT value FROM GlobalProperties WHERE property=${property}");
+      const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
 
-        statement.SetReadOnly(true);
-        statement.SetParameterType("property", ValueType_Integer64);
+      bool found;
+      if (!globalPropertiesCache_.Lookup(found, target, serverIdentifier, property, now))
+      {
+        const uint64_t revision = globalPropertiesCache_.GetRevision();
+        found = LookupGlobalPropertyInDatabase(target, manager, serverIdentifier, property);
+        globalPropertiesCache_.Store(serverIdentifier, property, found, target, revision, now);
+      }
 
-        Dictionary args;
-        args.SetIntegerValue("property", property);
+      return found;
+    }
+    else
+    {
+      return LookupGlobalPropertyInDatabase(target, manager, serverIdentifier, property);
+    }
+  }
 
-        return ReadGlobalProperty(target, statement, args);
-      }
-      else
-      {
-        DatabaseManager::CachedStatement statement(
-          STATEMENT_FROM_HERE, manager,
-          "SELECT value FROM ServerProperties WHERE server=${server} AND property=${property}");
 
-        statement.SetReadOnly(true);
-        statement.SetParameterType("server", ValueType_Utf8String);
-        statement.SetParameterType("property", ValueType_Integer64);
+  void IndexBackend::InvalidateGlobalProperty(DatabaseManager& manager,
+                                              const char* serverIdentifier,
+                                              int32_t property)
+  {
+    assert(serverIdentifier != NULL);
 
-        Dictionary args;
-        args.SetUtf8Value("server", serverIdentifier);
-        args.SetIntegerValue("property", property);
+    if (GlobalPropertiesCache::IsCacheable(property))
+    {
+      // Bumping the revision before the commit would let the other
+      // connections store the former value in the meantime
+      manager.AddCommitAction(new InvalidateGlobalPropertyAction(globalPropertiesCache_, serverIdentifier, property));
 
-        return ReadGlobalProperty(target, statement, args);
-      }
+      // The row is only visible to the other servers once committed
+      SignalCacheInvalidation(manager, CacheInvalidationType_GlobalProperty, property, serverIdentifier);
     }
   }
 
+
   bool IndexBackend::HasAtomicIncrementGlobalProperty()
   {
     return false; // currently only implemented in Postgres
@@ -1576,6 +2495,14 @@ namespace OrthancDatabases
                                     DatabaseManager& manager,
                                     const char* publicId)
   {
+    const bool useCache = IsLookupCacheUsable(manager);
+
+    if (useCache &&
+        lookupCache_.LookupResource(id, type, publicId))
+    {
+      return true;
+    }
+
     DatabaseManager::CachedStatement statement(
       STATEMENT_FROM_HERE, manager,
       "SELECT internalId, resourceType FROM Resources WHERE publicId=${id}");
@@ -1596,6 +2523,12 @@ namespace OrthancDatabases
     {
       id = statement.ReadInteger64(0);
       type = static_cast<OrthancPluginResourceType>(statement.ReadInteger32(1));
+
+      if (useCache)
+      {
+        lookupCache_.StoreResource(manager.GetTransactionSequence(), publicId, id, type);
+      }
+
       return true;
     }
   }
@@ -1613,12 +2546,15 @@ namespace OrthancDatabases
     {
       suffix = "LIMIT 1";
     }
+
+    const std::string lock = GetRecyclingLockClause(manager);
     
     DatabaseManager::CachedStatement statement(
       STATEMENT_FROM_HERE, manager,
-      "SELECT patientId FROM PatientRecyclingOrder ORDER BY seq ASC " + suffix);
+      "SELECT patientId FROM PatientRecyclingOrder ORDER BY seq ASC " + suffix +
+      (lock.empty() ? "" : " " + lock));
     
-    statement.SetReadOnly(true);
+    statement.SetReadOnly(lock.empty());
     statement.Execute();
 
     if (statement.IsDone())
@@ -1647,12 +2583,15 @@ namespace OrthancDatabases
       suffix = "LIMIT 1";
     }
     
+    const std::string lock = GetRecyclingLockClause(manager);
+
     DatabaseManager::CachedStatement statement(
       STATEMENT_FROM_HERE, manager,
       "SELECT patientId FROM PatientRecyclingOrder "
-      "WHERE patientId != ${id} ORDER BY seq ASC " + suffix);
+      "WHERE patientId != ${id} ORDER BY seq ASC " + suffix +
+      (lock.empty() ? "" : " " + lock));
 
-    statement.SetReadOnly(true);
+    statement.SetReadOnly(lock.empty());
     statement.SetParameterType("id", ValueType_Integer64);
 
     Dictionary args;
@@ -1672,6 +2611,50 @@ namespace OrthancDatabases
   }
 
 
+  void IndexBackend::SelectPatientsToRecycle(std::list<int64_t>& internalIds /*out*/,
+                                             DatabaseManager& manager,
+                                             uint32_t count)
+  {
+    internalIds.clear();
+
+    if (count == 0)
+    {
+      return;
+    }
+
+    std::string suffix;
+    if (manager.GetDialect() == Dialect_MSSQL)
+    {
+      suffix = "OFFSET 0 ROWS FETCH FIRST ${count} ROWS ONLY";
+    }
+    else
+    {
+      suffix = "LIMIT ${count}";
+    }
+
+    const std::string lock = GetRecyclingLockClause(manager);
+
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "SELECT patientId FROM PatientRecyclingOrder ORDER BY seq ASC " + suffix +
+      (lock.empty() ? "" : " " + lock));
+
+    statement.SetReadOnly(lock.empty());
+    statement.SetParameterType("count", ValueType_Integer64);
+
+    Dictionary args;
+    args.SetIntegerValue("count", count);
+
+    statement.Execute(args);
+
+    while (!statement.IsDone())
+    {
+      internalIds.push_back(statement.ReadInteger64(0));
+      statement.Next();
+    }
+  }
+
+
   static void RunSetGlobalPropertyStatement(DatabaseManager::CachedStatement& statement,
                                             bool hasServer,
                                             bool hasValue,
@@ -1781,6 +2764,8 @@ namespace OrthancDatabases
         }
       }
     }
+
+    InvalidateGlobalProperty(manager, serverIdentifier, property);
   }
 
 
@@ -1830,6 +2815,11 @@ namespace OrthancDatabases
       "INSERT INTO DicomIdentifiers VALUES(${id}, ${group}, ${element}, ${value})");
         
     ExecuteSetTag(statement, id, group, element, value);
+
+    if (studyColumnStore_.IsEnabled())
+    {
+      studyColumnStore_.SetValue(id, group, element, value, boost::posix_time::microsec_clock::universal_time());
+    }
   } 
 
 
@@ -1849,6 +2839,151 @@ namespace OrthancDatabases
 
     statement.Execute(args);
   }
+
+
+  static bool HasMetadataUpsert(Dialect dialect)
+  {
+    return (dialect == Dialect_PostgreSQL ||
+            dialect == Dialect_MySQL ||
+            dialect == Dialect_SQLite);
+  }
+
+
+  /**
+   * Inserts or replaces several metadata at once, in one statement
+   * per batch of rows. If the same metadata of the same resource
+   * appears several times, only its last value is kept, as
+   * PostgreSQL refuses to update the same row twice in a statement.
+   **/
+  static void UpsertMetadata(DatabaseManager& manager,
+                             bool hasRevisionsSupport,
+                             const std::vector<DeferredWrites::ResourceMetadata>& items)
+  {
+    // 4 parameters per row, which remains below the limit of 999
+    // parameters of the SQLite versions before 3.32.0
+    static const size_t MAX_ROWS = 64;
+
+    assert(HasMetadataUpsert(manager.GetDialect()));
+
+    std::vector<size_t> rows;
+    rows.reserve(items.size());
+
+    {
+      std::map<std::pair<int64_t, int32_t>, size_t> last;
+      for (size_t i = 0; i < items.size(); i++)
+      {
+        last[std::make_pair(items[i].resource_, items[i].type_)] = i;
+      }
+
+      for (size_t i = 0; i < items.size(); i++)
+      {
+        if (last[std::make_pair(items[i].resource_, items[i].type_)] == i)
+        {
+          rows.push_back(i);
+        }
+      }
+    }
+
+    for (size_t start = 0; start < rows.size(); start += MAX_ROWS)
+    {
+      const size_t end = std::min(rows.size(), start + MAX_ROWS);
+
+      std::string sql;
+      if (manager.GetDialect() == Dialect_SQLite)
+      {
+        sql = "INSERT OR REPLACE INTO Metadata VALUES ";
+      }
+      else
+      {
+        sql = "INSERT INTO Metadata VALUES ";
+      }
+
+      Dictionary args;
+
+      for (size_t i = start; i < end; i++)
+      {
+        const DeferredWrites::ResourceMetadata& item = items[rows[i]];
+        const std::string suffix = boost::lexical_cast<std::string>(i - start);
+
+        args.SetIntegerValue("i" + suffix, item.resource_);
+        args.SetIntegerValue("t" + suffix, item.type_);
+        args.SetUtf8Value("v" + suffix, item.value_);
+
+        if (i != start)
+        {
+          sql += ", ";
+        }
+
+        sql += "(${i" + suffix + "}, ${t" + suffix + "}, ${v" + suffix + "}";
+
+        if (hasRevisionsSupport)
+        {
+          args.SetIntegerValue("r" + suffix, item.revision_);
+          sql += ", ${r" + suffix + "}";
+        }
+
+        sql += ")";
+      }
+
+      switch (manager.GetDialect())
+      {
+        case Dialect_PostgreSQL:
+          sql += " ON CONFLICT (id, type) DO UPDATE SET value = EXCLUDED.value";
+          if (hasRevisionsSupport)
+          {
+            sql += ", revision = EXCLUDED.revision";
+          }
+          break;
+
+        case Dialect_MySQL:
+          sql += " ON DUPLICATE KEY UPDATE value = VALUES(value)";
+          if (hasRevisionsSupport)
+          {
+            sql += ", revision = VALUES(revision)";
+          }
+          break;
+
+        default:
+          break;
+      }
+
+      // The full batches share the same text, hence the cache
+      DatabaseManager::CachedStatement statement(STATEMENT_FROM_HERE_DYNAMIC(sql), manager, sql);
+
+      for (size_t i = 0; i < end - start; i++)
+      {
+        const std::string suffix = boost::lexical_cast<std::string>(i);
+        statement.SetParameterType("i" + suffix, ValueType_Integer64);
+        statement.SetParameterType("t" + suffix, ValueType_Integer64);
+        statement.SetParameterType("v" + suffix, ValueType_Utf8String);
+
+        if (hasRevisionsSupport)
+        {
+          statement.SetParameterType("r" + suffix, ValueType_Integer64);
+        }
+      }
+
+      statement.ExecuteWithoutResult(args);
+    }
+  }
+
+    
+  void IndexBackend::SetResourcesMetadata(DatabaseManager& manager,
+                                          const std::vector<DeferredWrites::ResourceMetadata>& items)
+  {
+    if (HasMetadataUpsert(manager.GetDialect()))
+    {
+      UpsertMetadata(manager, HasRevisionsSupport(), items);
+    }
+    else
+    {
+      for (size_t i = 0; i < items.size(); i++)
+      {
+        SetMetadata(manager, items[i].resource_, items[i].type_, items[i].value_.c_str(), items[i].revision_);
+      }
+    }
+  }
+
     
   void IndexBackend::SetMetadata(DatabaseManager& manager,
                                  int64_t id,
@@ -1869,6 +3004,17 @@ namespace OrthancDatabases
 
       ExecuteSetMetadata(statement, args, id, metadataType, value);
     }
+    else if (HasMetadataUpsert(manager.GetDialect()))
+    {
+      // A single statement instead of DELETE + INSERT
+      std::vector<DeferredWrites::ResourceMetadata> items(1);
+      items[0].resource_ = id;
+      items[0].type_ = metadataType;
+      items[0].value_ = value;
+      items[0].revision_ = revision;
+
+      UpsertMetadata(manager, HasRevisionsSupport(), items);
+    }
     else
     {
       {
@@ -2000,7 +3146,7 @@ namespace OrthancDatabases
       Dictionary args;
       args.SetIntegerValue("id", internalId);
         
-      statement.Execute(args);
+      statement.ExecuteWithoutResult(args);
     }
 
     {
@@ -2013,7 +3159,7 @@ namespace OrthancDatabases
       Dictionary args;
       args.SetIntegerValue("id", internalId);
         
-      statement.Execute(args);
+      statement.ExecuteWithoutResult(args);
     }
   }
 
@@ -2146,8 +3292,15 @@ namespace OrthancDatabases
   {
   private:
     Dialect     dialect_;
+    bool        wildcardFullTextIndex_;
+    bool        binaryCollation_;
     size_t      count_;
     Dictionary  dictionary_;
+    std::set<size_t>  integerParameters_;
+    const LabelsCache::Resources*  labelsResources_;  // Not owned, can be NULL
+    const StudyColumnStore::Resources*  candidateResources_;  // Not owned, can be NULL
+    const std::set<int64_t>*  sortKeys_;  // Not owned, can be NULL
+    HiddenResources::Snapshot  hidden_;
 
     static std::string FormatParameter(size_t index)
     {
@@ -2155,12 +3308,64 @@ namespace OrthancDatabases
     }
     
   public:
-    LookupFormatter(Dialect dialect) :
+    LookupFormatter(Dialect dialect,
+                    bool wildcardFullTextIndex,
+                    bool binaryCollation) :
       dialect_(dialect),
-      count_(0)
+      wildcardFullTextIndex_(wildcardFullTextIndex),
+      binaryCollation_(binaryCollation),
+      count_(0),
+      labelsResources_(NULL),
+      candidateResources_(NULL),
+      sortKeys_(NULL)
     {
     }
 
+    // The resources must be kept alive until the SQL is formatted
+    void SetLabelsResources(const LabelsCache::Resources& resources)
+    {
+      labelsResources_ = &resources;
+    }
+
+    virtual const std::vector<int64_t>* GetLabelsResources() const
+    {
+      return labelsResources_;
+    }
+
+    // The resources must be kept alive until the SQL is formatted
+    void SetCandidateResources(const StudyColumnStore::Resources& resources)
+    {
+      candidateResources_ = &resources;
+    }
+
+    virtual const std::vector<int64_t>* GetCandidateResources() const
+    {
+      return candidateResources_;
+    }
+
+    void SetHiddenResources(const HiddenResources& resources)
+    {
+      resources.GetSnapshot(hidden_);
+    }
+
+    virtual const std::vector<int64_t>* GetHiddenResources(Orthanc::ResourceType level) const
+    {
+      HiddenResources::Snapshot::const_iterator found = hidden_.find(level);
+      return (found == hidden_.end() ? NULL : &found->second);
+    }
+
+    // The keys must be kept alive until the SQL is formatted, can be NULL
+    void SetSortKeys(const std::set<int64_t>* sortKeys)
+    {
+      sortKeys_ = sortKeys;
+    }
+
+    virtual bool IsSortKey(int64_t sortKey) const
+    {
+      return (sortKeys_ != NULL &&
+              sortKeys_->find(sortKey) != sortKeys_->end());
+    }
+
     virtual std::string GenerateParameter(const std::string& value)
     {
       const std::string key = FormatParameter(count_);
@@ -2171,6 +3376,19 @@ namespace OrthancDatabases
       return "${" + key + "}";
     }
 
+    // The limits are bound as parameters, so that they are not part
+    // of the SQL that is the key of the statement cache
+    std::string GenerateIntegerParameter(uint64_t value)
+    {
+      const std::string key = FormatParameter(count_);
+
+      integerParameters_.insert(count_);
+      count_ ++;
+      dictionary_.SetIntegerValue(key, static_cast<int64_t>(value));
+
+      return "${" + key + "}";
+    }
+
     virtual std::string FormatResourceType(Orthanc::ResourceType level)
     {
       return boost::lexical_cast<std::string>(MessagesToolbox::ConvertToPlainC(level));
@@ -2199,7 +3417,20 @@ namespace OrthancDatabases
       {
         case Dialect_PostgreSQL:
           return std::string("NULL::") + type;
+
         case Dialect_MSSQL:
+          // An untyped NULL is an INT in SQL Server, that cannot be
+          // unionized with strings. "TEXT" is replaced by
+          // "VARCHAR(MAX)", consistently with the schema (OMSSQL-5).
+          if (std::string(type) == "TEXT")
+          {
+            return "CAST(NULL AS VARCHAR(MAX))";
+          }
+          else
+          {
+            return std::string("CAST(NULL AS ") + type + ")";
+          }
+
         case Dialect_SQLite:
         case Dialect_MySQL:
           return "NULL";
@@ -2220,11 +3451,11 @@ namespace OrthancDatabases
         {
           if (count > 0 || since > 0)
           {
-            sql += " OFFSET " + boost::lexical_cast<std::string>(since) + " ROWS ";
+            sql += " OFFSET " + GenerateIntegerParameter(since) + " ROWS ";
           }
           if (count > 0)
           {
-            sql += " FETCH NEXT " + boost::lexical_cast<std::string>(count) + " ROWS ONLY ";
+            sql += " FETCH NEXT " + GenerateIntegerParameter(count) + " ROWS ONLY ";
           }
         }; break;
         case Dialect_SQLite:
@@ -2232,26 +3463,26 @@ namespace OrthancDatabases
         {
           if (count > 0)
           {
-            sql += " LIMIT " + boost::lexical_cast<std::string>(count);
+            sql += " LIMIT " + GenerateIntegerParameter(count);
           }
           if (since > 0)
           {
-            sql += " OFFSET " + boost::lexical_cast<std::string>(since);
+            sql += " OFFSET " + GenerateIntegerParameter(since);
           }
         }; break;
         case Dialect_MySQL:
         {
           if (count > 0 && since > 0)
           {
-            sql += " LIMIT " + boost::lexical_cast<std::string>(since) + ", " + boost::lexical_cast<std::string>(count);
+            sql += " LIMIT " + GenerateIntegerParameter(since) + ", " + GenerateIntegerParameter(count);
           }
           else if (count > 0)
           {
-            sql += " LIMIT " + boost::lexical_cast<std::string>(count);
+            sql += " LIMIT " + GenerateIntegerParameter(count);
           }
           else if (since > 0)
           {
-            sql += " LIMIT " + boost::lexical_cast<std::string>(since) + ", 18446744073709551615"; // max uint64 value when you don't want any limit
+            sql += " LIMIT " + GenerateIntegerParameter(since) + ", 18446744073709551615"; // max uint64 value when you don't want any limit
           }
         }; break;
         default:
@@ -2273,13 +3504,62 @@ namespace OrthancDatabases
       return (dialect_ == Dialect_PostgreSQL);
     }
 
-    void PrepareStatement(DatabaseManager::StandaloneStatement& statement) const
+    virtual bool IsOrderByRequiredByLimits() const
+    {
+      return (dialect_ == Dialect_MSSQL);
+    }
+
+    virtual bool HasWildcardFullTextIndex() const
+    {
+      return (dialect_ == Dialect_MySQL && wildcardFullTextIndex_);
+    }
+
+    virtual bool HasBytewiseComparison() const
+    {
+      return (dialect_ == Dialect_SQLite ||
+              dialect_ == Dialect_PostgreSQL);
+    }
+
+    virtual std::string FormatBytewiseComparison(const std::string& column,
+                                                 const std::string& op,
+                                                 const std::string& parameter) const
+    {
+      switch (dialect_)
+      {
+        case Dialect_SQLite:
+          // The default collation of SQLite is "BINARY"
+          return column + " " + op + " " + parameter;
+
+        case Dialect_PostgreSQL:
+          // The operators of "text_pattern_ops" ignore the collation of the database
+          return column + " ~" + op + "~ " + parameter;
+
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+    }
+
+    virtual std::string FormatLowerValue(const std::string& column) const
+    {
+      if (dialect_ == Dialect_PostgreSQL &&
+          binaryCollation_)
+      {
+        return "lower(" + column + " COLLATE \"default\")";
+      }
+      else
+      {
+        return "lower(" + column + ")";
+      }
+    }
+
+    void PrepareStatement(DatabaseManager::StatementBase& statement) const
     {
       statement.SetReadOnly(true);
       
       for (size_t i = 0; i < count_; i++)
       {
-        statement.SetParameterType(FormatParameter(i), ValueType_Utf8String);
+        statement.SetParameterType(FormatParameter(i), (integerParameters_.find(i) == integerParameters_.end() ?
+                                                        ValueType_Utf8String : ValueType_Integer64));
       }
     }
 
@@ -2302,8 +3582,22 @@ namespace OrthancDatabases
                                      uint32_t limit,
                                      bool requestSomeInstance)
   {
-    LookupFormatter formatter(manager.GetDialect());
+    LookupFormatter formatter(manager.GetDialect(), HasWildcardFullTextIndex(), HasBinaryCollation());
+    formatter.SetHiddenResources(hiddenResources_);
+
+    LabelsCache::Resources labelsResources;
+    if (LookupLabelsResources(labelsResources, manager, labels, labelsConstraint))
+    {
+      formatter.SetLabelsResources(labelsResources);
+    }
+
     Orthanc::ResourceType queryLevel = MessagesToolbox::Convert(queryLevel_);
+
+    StudyColumnStore::Resources candidates;
+    if (studyColumnStore_.Evaluate(candidates, lookup, queryLevel, MAX_STUDY_CANDIDATES_IN_LOOKUP))
+    {
+      formatter.SetCandidateResources(candidates);
+    }
     Orthanc::ResourceType lowerLevel, upperLevel;
     ISqlLookupFormatter::GetLookupLevels(lowerLevel, upperLevel,  queryLevel, lookup);
 
@@ -2398,23 +3692,40 @@ namespace OrthancDatabases
       }
     }
 
-    DatabaseManager::StandaloneStatement statement(manager, sql);
-    formatter.PrepareStatement(statement);
+    /**
+     * The formatter binds all the values of the constraints and the
+     * limits as positional parameters "${p0}", "${p1}"..., so the
+     * generated SQL only depends on the "shape" of the lookup
+     * (constraint types, tags, level and labels). It can be used as
+     * the key of the statement cache.
+     **/
+    std::unique_ptr<DatabaseManager::StatementBase> statement;
+    if (manager.GetDialect() == Dialect_MySQL)
+    { // Same as in "ExecuteFind()"
+      statement.reset(new DatabaseManager::StandaloneStatement(manager, sql));
+    }
+    else
+    {
+      statement.reset(new DatabaseManager::CachedStatement(STATEMENT_FROM_HERE_DYNAMIC(sql), manager, sql));
+    }
+
+    statement->SetPlanCacheMode(lookupPlanCacheMode_);
+    formatter.PrepareStatement(*statement);
 
-    statement.Execute(formatter.GetDictionary());
+    statement->Execute(formatter.GetDictionary());
 
-    while (!statement.IsDone())
+    while (!statement->IsDone())
     {
       if (requestSomeInstance)
       {
-        output.AnswerMatchingResource(statement.ReadString(0), statement.ReadString(1));
+        output.AnswerMatchingResource(statement->ReadString(0), statement->ReadString(1));
       }
       else
       {
-        output.AnswerMatchingResource(statement.ReadString(0));
+        output.AnswerMatchingResource(statement->ReadString(0));
       }
 
-      statement.Next();
+      statement->Next();
     }    
   }
 #endif
@@ -2428,6 +3739,53 @@ namespace OrthancDatabases
     uint32_t count,
     const OrthancPluginResourcesContentTags* tags)
   {
+    if (count > 1 &&
+        manager.GetDatabase().HasBatchExecution())
+    {
+      // One single prepared statement, whose parameters are bound as
+      // arrays, instead of a statement whose text depends on "count"
+      const std::string sql = ("INSERT INTO " + table + " VALUES(${resource}, ${group}, ${element}, ${value})");
+
+      std::vector<Dictionary*> rows(count);
+      std::vector<const Dictionary*> parameters(count);
+
+      try
+      {
+        for (uint32_t i = 0; i < count; i++)
+        {
+          rows[i] = new Dictionary;
+          rows[i]->SetIntegerValue("resource", tags[i].resource);
+          rows[i]->SetIntegerValue("group", tags[i].group);
+          rows[i]->SetIntegerValue("element", tags[i].element);
+          rows[i]->SetUtf8Value("value", tags[i].value);
+          parameters[i] = rows[i];
+        }
+
+        DatabaseManager::CachedStatement statement(STATEMENT_FROM_HERE_DYNAMIC(sql), manager, sql);
+        statement.SetParameterType("resource", ValueType_Integer64);
+        statement.SetParameterType("group", ValueType_Integer64);
+        statement.SetParameterType("element", ValueType_Integer64);
+        statement.SetParameterType("value", ValueType_Utf8String);
+        statement.ExecuteBatchWithoutResult(parameters);
+      }
+      catch (...)
+      {
+        for (size_t i = 0; i < rows.size(); i++)
+        {
+          delete rows[i];
+        }
+
+        throw;
+      }
+
+      for (size_t i = 0; i < rows.size(); i++)
+      {
+        delete rows[i];
+      }
+
+      return;
+    }
+
     std::string sql;
     Dictionary args;
     
@@ -2475,6 +3833,21 @@ namespace OrthancDatabases
     uint32_t count,
     const OrthancPluginResourcesContentMetadata* metadata)
   {
+    if (HasMetadataUpsert(manager.GetDialect()))
+    {
+      std::vector<DeferredWrites::ResourceMetadata> items(count);
+      for (uint32_t i = 0; i < count; i++)
+      {
+        items[i].resource_ = metadata[i].resource;
+        items[i].type_ = metadata[i].metadata;
+        items[i].value_ = metadata[i].value;
+        items[i].revision_ = 0;
+      }
+
+      UpsertMetadata(manager, hasRevisionsSupport, items);
+      return;
+    }
+
     std::string sqlRemove;  // To overwrite    
     std::string sqlInsert;
     Dictionary args;
@@ -2565,714 +3938,3222 @@ namespace OrthancDatabases
                                    countMainDicomTags, mainDicomTags);
     
     ExecuteSetResourcesContentMetadata(manager, HasRevisionsSupport(), countMetadata, metadata);
+
+    UpdateStudyColumnStore(countIdentifierTags, identifierTags);
   }
 #endif
 
 
-  // New primitive since Orthanc 1.5.2
-  void IndexBackend::GetChildrenMetadata(std::list<std::string>& target,
-                                         DatabaseManager& manager,
-                                         int64_t resourceId,
-                                         int32_t metadata)
+  static void ConvertDeferredTags(std::vector<OrthancPluginResourcesContentTags>& target,
+                                  const std::vector<DeferredWrites::Tag>& source)
   {
-    DatabaseManager::CachedStatement statement(
-      STATEMENT_FROM_HERE, manager,
-      "SELECT value FROM Metadata WHERE type=${metadata} AND "
-      "id IN (SELECT internalId FROM Resources WHERE parentId=${id})");
-      
-    statement.SetReadOnly(true);
-    statement.SetParameterType("id", ValueType_Integer64);
-    statement.SetParameterType("metadata", ValueType_Integer64);
-
-    Dictionary args;
-    args.SetIntegerValue("id", static_cast<int>(resourceId));
-    args.SetIntegerValue("metadata", static_cast<int>(metadata));
+    target.resize(source.size());
 
-    ReadListOfStrings(target, statement, args);
+    for (size_t i = 0; i < source.size(); i++)
+    {
+      target[i].resource = source[i].resource_;
+      target[i].group = source[i].group_;
+      target[i].element = source[i].element_;
+      target[i].value = source[i].value_.c_str();
+    }
   }
 
 
-  // New primitive since Orthanc 1.5.2
-  void IndexBackend::TagMostRecentPatient(DatabaseManager& manager,
-                                          int64_t patient)
+  void IndexBackend::FlushDeferredWrites(DatabaseManager& manager,
+                                         const DeferredWrites& writes)
   {
-    std::string suffix;
-    if (manager.GetDialect() == Dialect_MSSQL)
+#if ORTHANC_PLUGINS_HAS_DATABASE_CONSTRAINT == 1
     {
-      suffix = "OFFSET 0 ROWS FETCH FIRST 2 ROWS ONLY";
+      std::vector<OrthancPluginResourcesContentTags> identifierTags;
+      std::vector<OrthancPluginResourcesContentTags> mainDicomTags;
+      ConvertDeferredTags(identifierTags, writes.GetIdentifierTags());
+      ConvertDeferredTags(mainDicomTags, writes.GetMainDicomTags());
+
+      std::vector<OrthancPluginResourcesContentMetadata> metadata(writes.GetResourcesMetadata().size());
+      for (size_t i = 0; i < metadata.size(); i++)
+      {
+        metadata[i].resource = writes.GetResourcesMetadata()[i].resource_;
+        metadata[i].metadata = writes.GetResourcesMetadata()[i].type_;
+        metadata[i].value = writes.GetResourcesMetadata()[i].value_.c_str();
+      }
+
+      if (!identifierTags.empty() ||
+          !mainDicomTags.empty() ||
+          !metadata.empty())
+      {
+        SetResourcesContent(manager,
+                            identifierTags.size(), (identifierTags.empty() ? NULL : &identifierTags[0]),
+                            mainDicomTags.size(), (mainDicomTags.empty() ? NULL : &mainDicomTags[0]),
+                            metadata.size(), (metadata.empty() ? NULL : &metadata[0]));
+      }
     }
-    else
+#else
+    if (!writes.GetIdentifierTags().empty() ||
+        !writes.GetMainDicomTags().empty() ||
+        !writes.GetResourcesMetadata().empty())
     {
-      suffix = "LIMIT 2";
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
     }
+#endif
 
-    int64_t seq;
-    
+    for (size_t i = 0; i < writes.GetAttachments().size(); i++)
     {
-      DatabaseManager::CachedStatement statement(
-        STATEMENT_FROM_HERE, manager,
-        "SELECT * FROM PatientRecyclingOrder WHERE seq >= "
-        "(SELECT seq FROM PatientRecyclingOrder WHERE patientid=${id}) ORDER BY seq " + suffix);
+      const DeferredWrites::Attachment& item = writes.GetAttachments()[i];
 
-      statement.SetReadOnly(true);
-      statement.SetParameterType("id", ValueType_Integer64);
+      OrthancPluginAttachment attachment;
+      attachment.uuid = item.uuid_.c_str();
+      attachment.contentType = item.contentType_;
+      attachment.uncompressedSize = item.uncompressedSize_;
+      attachment.uncompressedHash = item.uncompressedHash_.c_str();
+      attachment.compressionType = item.compressionType_;
+      attachment.compressedSize = item.compressedSize_;
+      attachment.compressedHash = item.compressedHash_.c_str();
+
+      AddAttachment(manager, item.resource_, attachment, item.revision_);
+    }
+
+    SetResourcesMetadata(manager, writes.GetMetadata());
+
+    for (size_t i = 0; i < writes.GetChanges().size(); i++)
+    {
+      const DeferredWrites::Change& item = writes.GetChanges()[i];
+      LogChange(manager, item.changeType_, item.resource_, item.resourceType_, item.date_.c_str());
+    }
+
+    LogExportedResources(manager, writes.GetExportedResources());
+  }
+
+
+  void IndexBackend::LogExportedResources(DatabaseManager& manager,
+                                          const std::vector<DeferredWrites::ExportedResource>& resources)
+  {
+    // 8 parameters per row, which remains below the limit of 999
+    // parameters of the SQLite versions before 3.32.0
+    static const size_t MAX_ROWS = 64;
+
+    if (resources.size() == 1)
+    {
+      const DeferredWrites::ExportedResource& item = resources[0];
+      LogExportedResource(manager, item.resourceType_, item.publicId_.c_str(), item.modality_.c_str(),
+                          item.date_.c_str(), item.patientId_.c_str(), item.studyInstanceUid_.c_str(),
+                          item.seriesInstanceUid_.c_str(), item.sopInstanceUid_.c_str());
+      return;
+    }
+
+    for (size_t start = 0; start < resources.size(); start += MAX_ROWS)
+    {
+      const size_t end = std::min(resources.size(), start + MAX_ROWS);
 
+      // The columns are listed, as "${AUTOINCREMENT}" is only
+      // allowed as the first parameter of a statement
+      std::string sql = ("INSERT INTO ExportedResources(resourceType, publicId, remoteModality, patientId, "
+                         "studyInstanceUid, seriesInstanceUid, sopInstanceUid, date) VALUES ");
       Dictionary args;
-      args.SetIntegerValue("id", patient);
 
-      statement.Execute(args);
-      
-      if (statement.IsDone())
+      for (size_t i = start; i < end; i++)
       {
-        // The patient is protected, don't add it to the recycling order
-        return;
-      }
+        const DeferredWrites::ExportedResource& item = resources[i];
+        const std::string suffix = boost::lexical_cast<std::string>(i - start);
+
+        args.SetUtf8Value("p" + suffix, item.publicId_);
+        args.SetUtf8Value("m" + suffix, item.modality_);
+        args.SetUtf8Value("a" + suffix, item.patientId_);
+        args.SetUtf8Value("t" + suffix, item.studyInstanceUid_);
+        args.SetUtf8Value("s" + suffix, item.seriesInstanceUid_);
+        args.SetUtf8Value("i" + suffix, item.sopInstanceUid_);
+        args.SetUtf8Value("d" + suffix, item.date_);
+
+        if (i != start)
+        {
+          sql += ", ";
+        }
 
-      seq = statement.ReadInteger64(0);
+        sql += ("(" + boost::lexical_cast<std::string>(static_cast<int>(item.resourceType_)) +
+                ", ${p" + suffix + "}, ${m" + suffix + "}, ${a" + suffix + "}, ${t" + suffix +
+                "}, ${s" + suffix + "}, ${i" + suffix + "}, ${d" + suffix + "})");
+      }
 
-      statement.Next();
+      // The full batches share the same text, hence the cache
+      DatabaseManager::CachedStatement statement(STATEMENT_FROM_HERE_DYNAMIC(sql), manager, sql);
 
-      if (statement.IsDone())
+      for (size_t i = 0; i < end - start; i++)
       {
-        // The patient is already at the end of the recycling order
-        // (because of the "LIMIT 2" above), no need to modify the table
-        return;
+        const std::string suffix = boost::lexical_cast<std::string>(i);
+        statement.SetParameterType("p" + suffix, ValueType_Utf8String);
+        statement.SetParameterType("m" + suffix, ValueType_Utf8String);
+        statement.SetParameterType("a" + suffix, ValueType_Utf8String);
+        statement.SetParameterType("t" + suffix, ValueType_Utf8String);
+        statement.SetParameterType("s" + suffix, ValueType_Utf8String);
+        statement.SetParameterType("i" + suffix, ValueType_Utf8String);
+        statement.SetParameterType("d" + suffix, ValueType_Utf8String);
       }
+
+      statement.ExecuteWithoutResult(args);
     }
+  }
 
-    // Delete the old position of the patient in the recycling order
 
+  void IndexBackend::DeleteExpiredExportedResources(DatabaseManager& manager,
+                                                    const std::string& olderThan,
+                                                    unsigned int batchSize)
+  {
+    if (batchSize == 0)
     {
-      DatabaseManager::CachedStatement statement(
-        STATEMENT_FROM_HERE, manager,
-        "DELETE FROM PatientRecyclingOrder WHERE seq=${seq}");
-        
-      statement.SetParameterType("seq", ValueType_Integer64);
-        
-      Dictionary args;
-      args.SetIntegerValue("seq", seq);
-        
-      statement.Execute(args);
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
     }
 
-    // Add the patient to the end of the recycling order
+    unsigned int countBatches = 0;
 
+    for (;;)
     {
-      DatabaseManager::CachedStatement statement(
-        STATEMENT_FROM_HERE, manager,
-        "INSERT INTO PatientRecyclingOrder VALUES(${AUTOINCREMENT} ${id})");
-        
-      statement.SetParameterType("id", ValueType_Integer64);
-        
-      Dictionary args;
-      args.SetIntegerValue("id", patient);
-        
-      statement.Execute(args);
-    }
-  }
+      DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
 
+      int64_t first;
 
-// New primitive since Orthanc 1.5.4
-bool IndexBackend::LookupResourceAndParent(int64_t& id,
-                                           OrthancPluginResourceType& type,
-                                           std::string& parentPublicId,
-                                           DatabaseManager& manager,
-                                           const char* publicId)
-{
-  DatabaseManager::CachedStatement statement(
-    STATEMENT_FROM_HERE, manager,
-    "SELECT resource.internalId, resource.resourceType, parent.publicId "
-    "FROM Resources AS resource LEFT JOIN Resources parent ON parent.internalId=resource.parentId "
-    "WHERE resource.publicId=${id}");
+      {
+        // The sequence numbers follow the order of the exports, so
+        // that the oldest expired row is found by scanning the
+        // primary key from its beginning
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, manager,
+          "SELECT MIN(seq) FROM ExportedResources WHERE date < ${date}");
 
-  statement.SetParameterType("id", ValueType_Utf8String);
-        
-  Dictionary args;
-  args.SetUtf8Value("id", publicId);
+        statement.SetReadOnly(true);
+        statement.SetParameterType("date", ValueType_Utf8String);
 
-  statement.Execute(args);
+        Dictionary args;
+        args.SetUtf8Value("date", olderThan);
 
-  if (statement.IsDone())
-  {
-    return false;
+        statement.Execute(args);
+
+        if (statement.IsDone() ||
+            statement.IsNull(0))
+        {
+          t.Commit();
+          break;
+        }
+
+        first = statement.ReadInteger64(0);
+      }
+
+      {
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, manager,
+          "DELETE FROM ExportedResources WHERE seq >= ${first} AND seq < ${end} AND date < ${date}");
+
+        statement.SetParameterType("first", ValueType_Integer64);
+        statement.SetParameterType("end", ValueType_Integer64);
+        statement.SetParameterType("date", ValueType_Utf8String);
+
+        Dictionary args;
+        args.SetIntegerValue("first", first);
+        args.SetIntegerValue("end", first + static_cast<int64_t>(batchSize));
+        args.SetUtf8Value("date", olderThan);
+
+        statement.ExecuteWithoutResult(args);
+      }
+
+      t.Commit();
+      countBatches++;
+    }
+
+    if (countBatches > 0)
+    {
+      LOG(INFO) << "Deleted the exported resources before " << olderThan << " in " << countBatches << " batch(es)";
+    }
   }
-  else
+
+
+  unsigned int IndexBackend::ExportAnalytics(DatabaseManager& manager)
   {
-    if (statement.GetResultFieldsCount() != 3)
+    if (!analyticsExport_.IsEnabled())
     {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
     }
 
-    statement.SetResultFieldType(0, ValueType_Integer64);
-    statement.SetResultFieldType(1, ValueType_Integer64);      
-    statement.SetResultFieldType(2, ValueType_Utf8String);
-
-    id = statement.ReadInteger64(0);
-    type = static_cast<OrthancPluginResourceType>(statement.ReadInteger32(1));
+    unsigned int countDeltas = 0;
 
-    const IValue& value = statement.GetResultField(2);
-      
-    switch (value.GetType())
+    for (;;)
     {
-      case ValueType_Null:
-        parentPublicId.clear();
-        break;
+      DatabaseManager::Transaction t(manager, TransactionType_ReadOnly);
 
-      case ValueType_Utf8String:
-        parentPublicId = dynamic_cast<const Utf8StringValue&>(value).GetContent();
+      const int64_t since = analyticsExport_.ReadLastSeq();
+      const int64_t last = GetLastChangeIndex(manager);
+
+      if (last <= since)
+      {
+        t.Commit();
         break;
+      }
 
-      default:
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
-    }
-      
-    assert((statement.Next(), statement.IsDone()));
-    return true;
-  }
-}
-  
+      AnalyticsExport::Delta delta(since, std::min(last, since + static_cast<int64_t>(analyticsExport_.GetBatchSize())));
 
-  // New primitive since Orthanc 1.5.4
-  void IndexBackend::GetAllMetadata(std::map<int32_t, std::string>& result,
-                                    DatabaseManager& manager,
-                                    int64_t id)
-  {
-    DatabaseManager::CachedStatement statement(
-      STATEMENT_FROM_HERE, manager,
-      "SELECT type, value FROM Metadata WHERE id=${id}");
-      
-    statement.SetReadOnly(true);
-    statement.SetParameterType("id", ValueType_Integer64);
+      Dictionary args;
+      args.SetIntegerValue("since", std::max(static_cast<int64_t>(0), since - ANALYTICS_EXPORT_OVERLAP));
+      args.SetIntegerValue("to", delta.GetTo());
 
-    Dictionary args;
-    args.SetIntegerValue("id", id);
+      {
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, manager,
+          "SELECT r.internalId, r.resourceType, r.publicId, r.parentId, MAX(c.seq) "
+          "FROM Resources AS r INNER JOIN Changes AS c ON c.internalId = r.internalId "
+          "WHERE c.seq > ${since} AND c.seq <= ${to} "
+          "GROUP BY r.internalId, r.resourceType, r.publicId, r.parentId");
 
-    statement.Execute(args);
-      
-    result.clear();
+        statement.SetReadOnly(true);
+        statement.SetParameterType("since", ValueType_Integer64);
+        statement.SetParameterType("to", ValueType_Integer64);
+        statement.Execute(args);
+
+        while (!statement.IsDone())
+        {
+          const bool hasParent = !statement.IsNull(3);
+          delta.AddResource(statement.ReadInteger64(0), statement.ReadInteger32(1), statement.ReadString(2),
+                            hasParent, hasParent ? statement.ReadInteger64(3) : -1, statement.ReadInteger64(4));
+          statement.Next();
+        }
+      }
 
-    if (!statement.IsDone())
-    {
-      if (statement.GetResultFieldsCount() != 2)
       {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, manager,
+          "SELECT id, tagGroup, tagElement, value FROM MainDicomTags "
+          "WHERE id IN (SELECT internalId FROM Changes WHERE seq > ${since} AND seq <= ${to})");
+
+        statement.SetReadOnly(true);
+        statement.SetParameterType("since", ValueType_Integer64);
+        statement.SetParameterType("to", ValueType_Integer64);
+        statement.Execute(args);
+
+        while (!statement.IsDone())
+        {
+          delta.AddMainDicomTag(statement.ReadInteger64(0), statement.ReadInteger32(1), statement.ReadInteger32(2),
+                                statement.IsNull(3) ? "" : statement.ReadString(3));
+          statement.Next();
+        }
       }
-      
-      statement.SetResultFieldType(0, ValueType_Integer64);
-      statement.SetResultFieldType(1, ValueType_Utf8String);
 
-      while (!statement.IsDone())
       {
-        result[statement.ReadInteger32(0)] = statement.ReadString(1);
-        statement.Next();
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, manager,
+          "SELECT id, fileType, compressedSize, uncompressedSize FROM AttachedFiles "
+          "WHERE id IN (SELECT internalId FROM Changes WHERE seq > ${since} AND seq <= ${to})");
+
+        statement.SetReadOnly(true);
+        statement.SetParameterType("since", ValueType_Integer64);
+        statement.SetParameterType("to", ValueType_Integer64);
+        statement.Execute(args);
+
+        while (!statement.IsDone())
+        {
+          delta.AddAttachment(statement.ReadInteger64(0), statement.ReadInteger32(1),
+                              statement.ReadInteger64(2), statement.ReadInteger64(3));
+          statement.Next();
+        }
       }
+
+      t.Commit();
+
+      analyticsExport_.Write(delta);
+      countDeltas++;
+    }
+
+    if (countDeltas > 0)
+    {
+      LOG(INFO) << "Analytics export: " << countDeltas << " delta(s) written";
     }
+
+    return countDeltas;
   }
 
 
-#if ORTHANC_PLUGINS_HAS_DATABASE_CONSTRAINT == 1
-  void IndexBackend::CreateInstanceGeneric(OrthancPluginCreateInstanceResult& result,
-                                           DatabaseManager& manager,
-                                           const char* hashPatient,
-                                           const char* hashStudy,
-                                           const char* hashSeries,
-                                           const char* hashInstance)
+  static std::string FormatInternalIds(const std::vector<int64_t>& ids)
   {
-    // Check out "OrthancServer/Sources/Database/Compatibility/ICreateInstance.cpp"
-    
+    std::string s;
+    s.reserve(ids.size() * 8);
+
+    for (size_t i = 0; i < ids.size(); i++)
     {
-      OrthancPluginResourceType type;
-      int64_t tmp;
-        
-      if (LookupResource(tmp, type, manager, hashInstance))
+      if (i > 0)
       {
-        // The instance already exists
-        assert(type == OrthancPluginResourceType_Instance);
-        result.instanceId = tmp;
-        result.isNewInstance = false;
-        return;
+        s += ",";
       }
+
+      s += boost::lexical_cast<std::string>(ids[i]);
     }
 
-    result.instanceId = CreateResource(manager, hashInstance, OrthancPluginResourceType_Instance);
-    result.isNewInstance = true;
+    return s;
+  }
+
+
+  // Returns NULL if the resource was deleted while reading the page
+  static Json::Value* GetReplicaResource(Json::Value& resources,
+                                         const std::map<int64_t, Json::ArrayIndex>& index,
+                                         int64_t id)
+  {
+    std::map<int64_t, Json::ArrayIndex>::const_iterator found = index.find(id);
+    if (found == index.end())
+    {
+      return NULL;
+    }
+    else
+    {
+      return &resources[found->second];
+    }
+  }
 
-    result.isNewPatient = false;
-    result.isNewStudy = false;
-    result.isNewSeries = false;
-    result.patientId = -1;
-    result.studyId = -1;
-    result.seriesId = -1;
-      
-    // Detect up to which level the patient/study/series/instance
-    // hierarchy must be created
 
+  void IndexBackend::ReadReplicaPage(Json::Value& target /*out*/,
+                                     DatabaseManager& manager,
+                                     int64_t since,
+                                     uint32_t limit,
+                                     bool changes)
+  {
+    if (limit == 0)
     {
-      OrthancPluginResourceType dummy;
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
 
-      if (LookupResource(result.seriesId, dummy, manager, hashSeries))
-      {
-        assert(dummy == OrthancPluginResourceType_Series);
-        // The patient, the study and the series already exist
+    // Read before the resources, so that the replica reads the later changes again
+    const int64_t lastChange = GetLastChangeIndex(manager);
 
-        bool ok = (LookupResource(result.patientId, dummy, manager, hashPatient) &&
-                   LookupResource(result.studyId, dummy, manager, hashStudy));
-        (void) ok;  // Remove warning about unused variable in release builds
-        assert(ok);
-      }
-      else if (LookupResource(result.studyId, dummy, manager, hashStudy))
-      {
-        assert(dummy == OrthancPluginResourceType_Study);
+    std::vector<int64_t> ids;
+    int64_t next;
+    bool done;
 
-        // New series: The patient and the study already exist
-        result.isNewSeries = true;
+    if (changes)
+    {
+      const int64_t to = std::min(lastChange, since + static_cast<int64_t>(limit));
 
-        bool ok = LookupResource(result.patientId, dummy, manager, hashPatient);
-        (void) ok;  // Remove warning about unused variable in release builds
-        assert(ok);
-      }
-      else if (LookupResource(result.patientId, dummy, manager, hashPatient))
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "SELECT DISTINCT internalId FROM Changes WHERE seq > ${since} AND seq <= ${to} ORDER BY internalId");
+
+      statement.SetReadOnly(true);
+      statement.SetParameterType("since", ValueType_Integer64);
+      statement.SetParameterType("to", ValueType_Integer64);
+
+      Dictionary args;
+      args.SetIntegerValue("since", std::max(static_cast<int64_t>(0), since - REPLICA_CHANGES_OVERLAP));
+      args.SetIntegerValue("to", to);
+      statement.Execute(args);
+
+      while (!statement.IsDone())
       {
-        assert(dummy == OrthancPluginResourceType_Patient);
+        ids.push_back(statement.ReadInteger64(0));
+        statement.Next();
+      }
 
-        // New study and series: The patient already exist
-        result.isNewStudy = true;
-        result.isNewSeries = true;
+      next = std::max(since, to);
+      done = (to >= lastChange);
+    }
+    else
+    {
+      std::string suffix;
+      if (manager.GetDialect() == Dialect_MSSQL)
+      {
+        suffix = "OFFSET 0 ROWS FETCH FIRST ${limit} ROWS ONLY";
       }
       else
       {
-        // New patient, study and series: Nothing exists
-        result.isNewPatient = true;
-        result.isNewStudy = true;
-        result.isNewSeries = true;
+        suffix = "LIMIT ${limit}";
+      }
+
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "SELECT internalId FROM Resources WHERE internalId > ${since} ORDER BY internalId " + suffix);
+
+      statement.SetReadOnly(true);
+      statement.SetParameterType("since", ValueType_Integer64);
+      statement.SetParameterType("limit", ValueType_Integer64);
+
+      Dictionary args;
+      args.SetIntegerValue("since", since);
+      args.SetIntegerValue("limit", limit);
+      statement.Execute(args);
+
+      while (!statement.IsDone())
+      {
+        ids.push_back(statement.ReadInteger64(0));
+        statement.Next();
       }
+
+      next = (ids.empty() ? since : ids.back());
+      done = (ids.size() < limit);
     }
 
-    // Create the series if needed
-    if (result.isNewSeries)
+    target = Json::objectValue;
+    target["Resources"] = Json::arrayValue;
+    target["Next"] = static_cast<Json::Int64>(next);
+    target["Done"] = done;
+    target["LastChange"] = static_cast<Json::Int64>(lastChange);
+
+    if (ids.empty())
     {
-      result.seriesId = CreateResource(manager, hashSeries, OrthancPluginResourceType_Series);
+      return;
     }
 
-    // Create the study if needed
-    if (result.isNewStudy)
+    Json::Value& resources = target["Resources"];
+    std::map<int64_t, Json::ArrayIndex> index;
+
+    const std::string list = FormatInternalIds(ids);
+
     {
-      result.studyId = CreateResource(manager, hashStudy, OrthancPluginResourceType_Study);
+      DatabaseManager::StandaloneStatement statement(
+        manager, "SELECT internalId, resourceType, publicId, parentId FROM Resources "
+        "WHERE internalId IN (" + list + ") ORDER BY internalId");
+      statement.SetReadOnly(true);
+      statement.Execute();
+
+      while (!statement.IsDone())
+      {
+        Json::Value resource = Json::objectValue;
+        resource["ID"] = static_cast<Json::Int64>(statement.ReadInteger64(0));
+        resource["Type"] = statement.ReadInteger32(1);
+        resource["PublicID"] = statement.ReadString(2);
+        resource["Parent"] = (statement.IsNull(3) ? Json::Value(Json::nullValue) :
+                              Json::Value(static_cast<Json::Int64>(statement.ReadInteger64(3))));
+        resource["Tags"] = Json::arrayValue;
+        resource["Identifiers"] = Json::arrayValue;
+        resource["Metadata"] = Json::arrayValue;
+        resource["Attachments"] = Json::arrayValue;
+        resource["Labels"] = Json::arrayValue;
+
+        index[statement.ReadInteger64(0)] = resources.size();
+        resources.append(resource);
+        statement.Next();
+      }
     }
 
-    // Create the patient if needed
-    if (result.isNewPatient)
+    for (unsigned int table = 0; table < 2; table++)
     {
-      result.patientId = CreateResource(manager, hashPatient, OrthancPluginResourceType_Patient);
-    }
+      DatabaseManager::StandaloneStatement statement(
+        manager, std::string("SELECT id, tagGroup, tagElement, value FROM ") +
+        (table == 0 ? "MainDicomTags" : "DicomIdentifiers") + " WHERE id IN (" + list + ")");
+      statement.SetReadOnly(true);
+      statement.Execute();
 
-    // Create the parent-to-child links
-    AttachChild(manager, result.seriesId, result.instanceId);
+      while (!statement.IsDone())
+      {
+        Json::Value tag = Json::arrayValue;
+        tag.append(statement.ReadInteger32(1));
+        tag.append(statement.ReadInteger32(2));
+        tag.append(statement.IsNull(3) ? "" : statement.ReadString(3));
+        Json::Value* resource = GetReplicaResource(resources, index, statement.ReadInteger64(0));
+        if (resource != NULL)
+        {
+          (*resource)[table == 0 ? "Tags" : "Identifiers"].append(tag);
+        }
 
-    if (result.isNewSeries)
-    {
-      AttachChild(manager, result.studyId, result.seriesId);
+        statement.Next();
+      }
     }
 
-    if (result.isNewStudy)
     {
-      AttachChild(manager, result.patientId, result.studyId);
+      DatabaseManager::StandaloneStatement statement(
+        manager, std::string("SELECT id, type, value") + (HasRevisionsSupport() ? ", revision" : "") +
+        " FROM Metadata WHERE id IN (" + list + ")");
+      statement.SetReadOnly(true);
+      statement.Execute();
+
+      while (!statement.IsDone())
+      {
+        Json::Value metadata = Json::arrayValue;
+        metadata.append(statement.ReadInteger32(1));
+        metadata.append(statement.IsNull(2) ? "" : statement.ReadString(2));
+        metadata.append(HasRevisionsSupport() && !statement.IsNull(3) ?
+                        static_cast<Json::Int64>(statement.ReadInteger64(3)) : 0);
+        Json::Value* resource = GetReplicaResource(resources, index, statement.ReadInteger64(0));
+        if (resource != NULL)
+        {
+          (*resource)["Metadata"].append(metadata);
+        }
+
+        statement.Next();
+      }
     }
 
-    TagMostRecentPatient(manager, result.patientId);
-      
-    // Sanity checks
-    assert(result.patientId != -1);
-    assert(result.studyId != -1);
-    assert(result.seriesId != -1);
-    assert(result.instanceId != -1);
-  }
-#endif
+    {
+      DatabaseManager::StandaloneStatement statement(
+        manager, std::string("SELECT id, fileType, uuid, compressedSize, uncompressedSize, compressionType, "
+                             "uncompressedHash, compressedHash") + (HasRevisionsSupport() ? ", revision" : "") +
+        " FROM AttachedFiles WHERE id IN (" + list + ")");
+      statement.SetReadOnly(true);
+      statement.Execute();
 
+      while (!statement.IsDone())
+      {
+        Json::Value attachment = Json::objectValue;
+        attachment["Type"] = statement.ReadInteger32(1);
+        attachment["UUID"] = statement.ReadString(2);
+        attachment["CompressedSize"] = static_cast<Json::Int64>(statement.ReadInteger64(3));
+        attachment["UncompressedSize"] = static_cast<Json::Int64>(statement.ReadInteger64(4));
+        attachment["CompressionType"] = statement.ReadInteger32(5);
+        attachment["UncompressedHash"] = (statement.IsNull(6) ? "" : statement.ReadString(6));
+        attachment["CompressedHash"] = (statement.IsNull(7) ? "" : statement.ReadString(7));
+        attachment["Revision"] = (HasRevisionsSupport() && !statement.IsNull(8) ?
+                                  static_cast<Json::Int64>(statement.ReadInteger64(8)) : 0);
+        Json::Value* resource = GetReplicaResource(resources, index, statement.ReadInteger64(0));
+        if (resource != NULL)
+        {
+          (*resource)["Attachments"].append(attachment);
+        }
 
-  void IndexBackend::AddLabel(DatabaseManager& manager,
-                              int64_t resource,
-                              const std::string& label)
-  {
-    std::unique_ptr<DatabaseManager::CachedStatement> statement;
+        statement.Next();
+      }
+    }
 
-    switch (manager.GetDialect())
+    if (HasLabelsSupport())
     {
-      case Dialect_PostgreSQL:
-        statement.reset(new DatabaseManager::CachedStatement(
-                          STATEMENT_FROM_HERE, manager,
-                          "INSERT INTO Labels VALUES(${id}, ${label}) ON CONFLICT DO NOTHING"));
-        break;
-
-      case Dialect_SQLite:
-        statement.reset(new DatabaseManager::CachedStatement(
-                          STATEMENT_FROM_HERE, manager,
-                          "INSERT OR IGNORE INTO Labels VALUES(${id}, ${label})"));
-        break;
+      DatabaseManager::StandaloneStatement statement(
+        manager, "SELECT id, label FROM Labels WHERE id IN (" + list + ")");
+      statement.SetReadOnly(true);
+      statement.Execute();
 
-      case Dialect_MySQL:
-        statement.reset(new DatabaseManager::CachedStatement(
-                          STATEMENT_FROM_HERE, manager,
-                          "INSERT IGNORE INTO Labels VALUES(${id}, ${label})"));
-        break;
+      while (!statement.IsDone())
+      {
+        Json::Value* resource = GetReplicaResource(resources, index, statement.ReadInteger64(0));
+        if (resource != NULL)
+        {
+          (*resource)["Labels"].append(statement.ReadString(1));
+        }
 
-      default:
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+        statement.Next();
+      }
     }
-    
-    statement->SetParameterType("id", ValueType_Integer64);
-    statement->SetParameterType("label", ValueType_Utf8String);
+  }
 
-    Dictionary args;
-    args.SetIntegerValue("id", resource);
-    args.SetUtf8Value("label", label);
 
-    statement->Execute(args);
-  }
+  // Margin for the commits in progress and for the skew of the clocks
+  static const unsigned int UPDATED_RESOURCES_SAFETY_MARGIN_SECONDS = 60;
 
 
-  void IndexBackend::RemoveLabel(DatabaseManager& manager,
-                                 int64_t resource,
-                                 const std::string& label)
+  void IndexBackend::LookupUpdatedResources(Json::Value& target /*out*/,
+                                            DatabaseManager& manager,
+                                            OrthancPluginResourceType level,
+                                            const std::string& since,
+                                            int64_t sinceId,
+                                            const std::string& to,
+                                            uint32_t limit)
   {
-    DatabaseManager::CachedStatement statement(
-      STATEMENT_FROM_HERE, manager,
-      "DELETE FROM Labels WHERE id=${id} AND label=${label}");
+    if (limit == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
 
-    statement.SetParameterType("id", ValueType_Integer64);
-    statement.SetParameterType("label", ValueType_Utf8String);
+    std::string suffix;
+    if (manager.GetDialect() == Dialect_MSSQL)
+    {
+      suffix = "OFFSET 0 ROWS FETCH FIRST ${limit} ROWS ONLY";
+    }
+    else
+    {
+      suffix = "LIMIT ${limit}";
+    }
+
+    // The dates of "LastUpdate" are ISO strings ("YYYYMMDDTHHMMSS"),
+    // whose lexicographical order is the chronological order
+    const std::string sql =
+      "SELECT Metadata.id, Resources.publicId, Metadata.value FROM Metadata "
+      "INNER JOIN Resources ON Resources.internalId = Metadata.id "
+      "WHERE Metadata.type = " + boost::lexical_cast<std::string>(Orthanc::MetadataType_LastUpdate) + " "
+      "AND Metadata.value >= ${since} AND (Metadata.value > ${since2} OR Metadata.id > ${sinceId}) " +
+      (to.empty() ? std::string() : "AND Metadata.value < ${to} ") +
+      "AND Resources.resourceType = ${type} "
+      "ORDER BY Metadata.value, Metadata.id " + suffix;
+
+    DatabaseManager::CachedStatement statement(STATEMENT_FROM_HERE_DYNAMIC(sql), manager, sql);
+
+    statement.SetReadOnly(true);
+    statement.SetParameterType("since", ValueType_Utf8String);
+    statement.SetParameterType("since2", ValueType_Utf8String);
+    statement.SetParameterType("sinceId", ValueType_Integer64);
+    statement.SetParameterType("type", ValueType_Integer64);
+    statement.SetParameterType("limit", ValueType_Integer64);
 
     Dictionary args;
-    args.SetIntegerValue("id", resource);
-    args.SetUtf8Value("label", label);
+    args.SetUtf8Value("since", since);
+    args.SetUtf8Value("since2", since);
+    args.SetIntegerValue("sinceId", sinceId);
+    args.SetIntegerValue("type", static_cast<int>(level));
+    args.SetIntegerValue("limit", limit);
+
+    if (!to.empty())
+    {
+      statement.SetParameterType("to", ValueType_Utf8String);
+      args.SetUtf8Value("to", to);
+    }
 
     statement.Execute(args);
+
+    target = Json::objectValue;
+    target["Resources"] = Json::arrayValue;
+
+    std::string next = since;
+    int64_t nextId = sinceId;
+
+    while (!statement.IsDone())
+    {
+      nextId = statement.ReadInteger64(0);
+      next = statement.ReadString(2);
+
+      Json::Value item = Json::objectValue;
+      item["InternalID"] = static_cast<Json::Int64>(nextId);
+      item["ID"] = statement.ReadString(1);
+      item["LastUpdate"] = next;
+      target["Resources"].append(item);
+
+      statement.Next();
+    }
+
+    const bool done = (target["Resources"].size() < limit);
+
+    if (done)
+    {
+      // Re-read the recent dates at the next poll, as they can still
+      // receive the resources of the transactions that are not committed yet
+      const std::string horizon = CacheInvalidations::FormatDate(
+        boost::posix_time::microsec_clock::universal_time() -
+        boost::posix_time::seconds(UPDATED_RESOURCES_SAFETY_MARGIN_SECONDS));
+
+      if (next > horizon)
+      {
+        next = horizon;
+        nextId = -1;
+      }
+    }
+
+    // The next page starts strictly after the last resource of this page
+    target["Done"] = done;
+    target["Since"] = next;
+    target["SinceID"] = static_cast<Json::Int64>(nextId);
   }
 
 
-  void IndexBackend::ListLabels(std::list<std::string>& target,
-                                DatabaseManager& manager,
-                                int64_t resource)
+  template <typename Target>
+  static void GetChildrenMetadataInternal(Target& target,
+                                          DatabaseManager& manager,
+                                          int64_t resourceId,
+                                          int32_t metadata)
   {
     DatabaseManager::CachedStatement statement(
       STATEMENT_FROM_HERE, manager,
-      "SELECT label FROM Labels WHERE id=${id}");
+      "SELECT value FROM Metadata WHERE type=${metadata} AND "
+      "id IN (SELECT internalId FROM Resources WHERE parentId=${id})");
       
     statement.SetReadOnly(true);
     statement.SetParameterType("id", ValueType_Integer64);
+    statement.SetParameterType("metadata", ValueType_Integer64);
 
     Dictionary args;
-    args.SetIntegerValue("id", resource);
+    args.SetIntegerValue("id", static_cast<int>(resourceId));
+    args.SetIntegerValue("metadata", static_cast<int>(metadata));
 
     ReadListOfStrings(target, statement, args);
   }
-  
 
-  void IndexBackend::ListAllLabels(std::list<std::string>& target,
-                                   DatabaseManager& manager)
+
+  // New primitive since Orthanc 1.5.2
+  void IndexBackend::GetChildrenMetadata(std::list<std::string>& target,
+                                         DatabaseManager& manager,
+                                         int64_t resourceId,
+                                         int32_t metadata)
   {
-    DatabaseManager::CachedStatement statement(
-      STATEMENT_FROM_HERE, manager,
-      "SELECT DISTINCT label FROM Labels");
-      
-    Dictionary args;
-    ReadListOfStrings(target, statement, args);
+    GetChildrenMetadataInternal(target, manager, resourceId, metadata);
   }
 
-  
-  void IndexBackend::Register(IndexBackend* backend,
-                              size_t countConnections,
-                              unsigned int maxDatabaseRetries,
-                              unsigned int housekeepingDelaySeconds)
+
+  void IndexBackend::GetChildrenMetadata(google::protobuf::RepeatedPtrField<std::string>& target,
+                                         DatabaseManager& manager,
+                                         int64_t resourceId,
+                                         int32_t metadata)
   {
-    if (backend == NULL)
-    {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
-    }
-    
-    LOG(WARNING) << "The index plugin will use " << countConnections << " connection(s) to the database, "
-                 << "and will retry up to " << maxDatabaseRetries << " time(s) in the case of a collision";
-      
-#if defined(ORTHANC_PLUGINS_VERSION_IS_ABOVE)         // Macro introduced in Orthanc 1.3.1
-#  if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 0)
-    if (OrthancPluginCheckVersionAdvanced(backend->GetContext(), 1, 12, 0) == 1)
-    {
-      DatabaseBackendAdapterV4::Register(backend, countConnections, maxDatabaseRetries, housekeepingDelaySeconds);
-      return;
-    }
-#  endif
-#endif
+    GetChildrenMetadataInternal(target, manager, resourceId, metadata);
+  }
 
-#if defined(ORTHANC_PLUGINS_VERSION_IS_ABOVE)         // Macro introduced in Orthanc 1.3.1
-#  if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 9, 2)
-    if (OrthancPluginCheckVersionAdvanced(backend->GetContext(), 1, 9, 2) == 1)
+
+  // New primitive since Orthanc 1.5.2
+  void IndexBackend::TagMostRecentPatient(DatabaseManager& manager,
+                                          int64_t patient)
+  {
+    if (manager.GetDialect() == Dialect_SQLite)
     {
-      DatabaseBackendAdapterV3::Register(backend, countConnections, maxDatabaseRetries, housekeepingDelaySeconds);
-      return;
-    }
-#  endif
-#endif
+      /**
+       * SQLite allows to update the "seq" primary key in place, and
+       * its AUTOINCREMENT always picks a key above the largest one.
+       * The single statement is a no-op if the patient is protected
+       * (no row), or if it is already at the end of the recycling
+       * order, which coalesces the successive bumps of one patient.
+       * Updating the key would break the AUTO_INCREMENT counter of
+       * MySQL and the sequence of PostgreSQL, and is not allowed on
+       * the IDENTITY columns of SQL Server.
+       **/
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "UPDATE PatientRecyclingOrder SET seq = (SELECT MAX(seq) FROM PatientRecyclingOrder) + 1 "
+        "WHERE patientId=${id} AND seq < (SELECT MAX(seq) FROM PatientRecyclingOrder)");
 
-    LOG(WARNING) << "Performance warning: Your version of the Orthanc core or SDK doesn't support multiple readers/writers";
-    DatabaseBackendAdapterV2::Register(backend);
-  }
+      statement.SetParameterType("id", ValueType_Integer64);
 
+      Dictionary args;
+      args.SetIntegerValue("id", patient);
 
-  bool IndexBackend::LookupGlobalIntegerProperty(int& target,
-                                                 DatabaseManager& manager,
-                                                 const char* serverIdentifier,
-                                                 int32_t property)
-  {
-    std::string value;
+      statement.ExecuteWithoutResult(args);
+      return;
+    }
 
-    if (LookupGlobalProperty(value, manager, serverIdentifier, property))
+    std::string suffix;
+    if (manager.GetDialect() == Dialect_MSSQL)
     {
-      try
-      {
-        target = boost::lexical_cast<int>(value);
-        return true;
-      }
-      catch (boost::bad_lexical_cast&)
-      {
-        LOG(ERROR) << "Corrupted database";
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);
-      }      
+      suffix = "OFFSET 0 ROWS FETCH FIRST 2 ROWS ONLY";
     }
     else
     {
-      return false;
-    }    
-  }
-  
-
-  void IndexBackend::SetGlobalIntegerProperty(DatabaseManager& manager,
-                                              const char* serverIdentifier,
-                                              int32_t property,
-                                              int value)
-  {
-    std::string s = boost::lexical_cast<std::string>(value);
-    SetGlobalProperty(manager, serverIdentifier, property, s.c_str());
-  }
-  
+      suffix = "LIMIT 2";
+    }
 
-  void IndexBackend::Finalize()
-  {
-    DatabaseBackendAdapterV2::Finalize();
+    int64_t seq;
+    
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "SELECT * FROM PatientRecyclingOrder WHERE seq >= "
+        "(SELECT seq FROM PatientRecyclingOrder WHERE patientid=${id}) ORDER BY seq " + suffix);
 
-#if defined(ORTHANC_PLUGINS_VERSION_IS_ABOVE)         // Macro introduced in Orthanc 1.3.1
-#  if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 9, 2)
-    DatabaseBackendAdapterV3::Finalize();
-#  endif
-#endif
+      statement.SetReadOnly(true);
+      statement.SetParameterType("id", ValueType_Integer64);
 
-#if defined(ORTHANC_PLUGINS_VERSION_IS_ABOVE)         // Macro introduced in Orthanc 1.3.1
-#  if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 0)
-    DatabaseBackendAdapterV4::Finalize();
-#  endif
-#endif
-  }
+      Dictionary args;
+      args.SetIntegerValue("id", patient);
 
+      statement.Execute(args);
+      
+      if (statement.IsDone())
+      {
+        // The patient is protected, don't add it to the recycling order
+        return;
+      }
 
-  uint64_t IndexBackend::MeasureLatency(DatabaseManager& manager)
-  {
-    // execute 11x the simplest statement and return the median value
-    std::vector<uint64_t> measures;
+      seq = statement.ReadInteger64(0);
 
-    for (int i = 0; i < 11; i++)
-    {
-      DatabaseManager::StandaloneStatement statement(manager, "SELECT 1");
+      statement.Next();
 
-      Orthanc::Toolbox::ElapsedTimer timer;
+      if (statement.IsDone())
+      {
+        // The patient is already at the end of the recycling order
+        // (because of the "LIMIT 2" above), no need to modify the table
+        return;
+      }
+    }
 
-      statement.ExecuteWithoutResult();
+    // Delete the old position of the patient in the recycling order
 
-      measures.push_back(timer.GetElapsedMicroseconds());
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "DELETE FROM PatientRecyclingOrder WHERE seq=${seq}");
+        
+      statement.SetParameterType("seq", ValueType_Integer64);
+        
+      Dictionary args;
+      args.SetIntegerValue("seq", seq);
+        
+      statement.Execute(args);
     }
-    
-    std::sort(measures.begin(), measures.end());
 
-    return measures[measures.size() / 2];
+    // Add the patient to the end of the recycling order
+
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "INSERT INTO PatientRecyclingOrder VALUES(${AUTOINCREMENT} ${id})");
+        
+      statement.SetParameterType("id", ValueType_Integer64);
+        
+      Dictionary args;
+      args.SetIntegerValue("id", patient);
+        
+      statement.Execute(args);
+    }
   }
 
 
-  DatabaseManager* IndexBackend::CreateSingleDatabaseManager(IDatabaseBackend& backend,
-                                                             bool hasIdentifierTags,
-                                                             const std::list<IdentifierTag>& identifierTags)
+// New primitive since Orthanc 1.5.4
+bool IndexBackend::LookupResourceAndParent(int64_t& id,
+                                           OrthancPluginResourceType& type,
+                                           std::string& parentPublicId,
+                                           DatabaseManager& manager,
+                                           const char* publicId)
+{
+  const bool useCache = IsLookupCacheUsable(manager);
+
+  if (useCache &&
+      lookupCache_.LookupResourceAndParent(id, type, parentPublicId, publicId))
   {
-    std::unique_ptr<DatabaseManager> manager(new DatabaseManager(backend.CreateDatabaseFactory()));
-    backend.ConfigureDatabase(*manager, hasIdentifierTags, identifierTags);
-    return manager.release();
+    return true;
   }
 
+  DatabaseManager::CachedStatement statement(
+    STATEMENT_FROM_HERE, manager,
+    "SELECT resource.internalId, resource.resourceType, parent.publicId "
+    "FROM Resources AS resource LEFT JOIN Resources parent ON parent.internalId=resource.parentId "
+    "WHERE resource.publicId=${id}");
+
+  statement.SetParameterType("id", ValueType_Utf8String);
+        
+  Dictionary args;
+  args.SetUtf8Value("id", publicId);
+
+  statement.Execute(args);
+
+  if (statement.IsDone())
+  {
+    return false;
+  }
+  else
+  {
+    if (statement.GetResultFieldsCount() != 3)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+
+    statement.SetResultFieldType(0, ValueType_Integer64);
+    statement.SetResultFieldType(1, ValueType_Integer64);      
+    statement.SetResultFieldType(2, ValueType_Utf8String);
+
+    id = statement.ReadInteger64(0);
+    type = static_cast<OrthancPluginResourceType>(statement.ReadInteger32(1));
+
+    const IValue& value = statement.GetResultField(2);
+      
+    switch (value.GetType())
+    {
+      case ValueType_Null:
+        parentPublicId.clear();
+        break;
+
+      case ValueType_Utf8String:
+        parentPublicId = dynamic_cast<const Utf8StringValue&>(value).GetContent();
+        break;
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+      
+    assert((statement.Next(), statement.IsDone()));
+
+    if (useCache)
+    {
+      lookupCache_.StoreResourceAndParent(manager.GetTransactionSequence(), publicId, id, type, parentPublicId);
+    }
+
+    return true;
+  }
+}
+  
+
+  // New primitive since Orthanc 1.5.4
+  void IndexBackend::GetAllMetadata(std::map<int32_t, std::string>& result,
+                                    DatabaseManager& manager,
+                                    int64_t id)
+  {
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "SELECT type, value FROM Metadata WHERE id=${id}");
+      
+    statement.SetReadOnly(true);
+    statement.SetParameterType("id", ValueType_Integer64);
+
+    Dictionary args;
+    args.SetIntegerValue("id", id);
+
+    statement.Execute(args);
+      
+    result.clear();
+
+    if (!statement.IsDone())
+    {
+      if (statement.GetResultFieldsCount() != 2)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+      
+      statement.SetResultFieldType(0, ValueType_Integer64);
+      statement.SetResultFieldType(1, ValueType_Utf8String);
+
+      while (!statement.IsDone())
+      {
+        result[statement.ReadInteger32(0)] = statement.ReadString(1);
+        statement.Next();
+      }
+    }
+  }
+
+
+  // Splits the internal IDs into chunks of "IN (...)" lists, so as to
+  // bound the length of the SQL queries
+  static void JoinInternalIds(std::list<std::string>& target,
+                              const std::list<int64_t>& ids)
+  {
+    static const size_t CHUNK_SIZE = 256;
+
+    target.clear();
+
+    std::string chunk;
+    size_t count = 0;
+
+    for (std::list<int64_t>::const_iterator it = ids.begin(); it != ids.end(); ++it)
+    {
+      if (count > 0)
+      {
+        chunk += ", ";
+      }
+
+      chunk += boost::lexical_cast<std::string>(*it);
+      count++;
+
+      if (count == CHUNK_SIZE)
+      {
+        target.push_back(chunk);
+        chunk.clear();
+        count = 0;
+      }
+    }
+
+    if (count > 0)
+    {
+      target.push_back(chunk);
+    }
+  }
+
+
+  void IndexBackend::GetResourcesMainDicomTags(IDatabaseBackendOutput& output,
+                                               DatabaseManager& manager,
+                                               const std::list<int64_t>& ids)
+  {
+    std::list<std::string> chunks;
+    JoinInternalIds(chunks, ids);
+
+    for (std::list<std::string>::const_iterator it = chunks.begin(); it != chunks.end(); ++it)
+    {
+      // The IDs are integers that are formatted by the plugin, and
+      // the statement is not cached, as its text depends on the IDs
+      DatabaseManager::StandaloneStatement statement(
+        manager, "SELECT id, tagGroup, tagElement, value FROM MainDicomTags WHERE id IN (" + *it + ")");
+
+      statement.SetReadOnly(true);
+      statement.Execute();
+
+      while (!statement.IsDone())
+      {
+        output.AnswerResourceDicomTag(statement.ReadInteger64(0),
+                                      static_cast<uint16_t>(statement.ReadInteger64(1)),
+                                      static_cast<uint16_t>(statement.ReadInteger64(2)),
+                                      statement.ReadString(3));
+        statement.Next();
+      }
+    }
+  }
+
+
+  void IndexBackend::GetResourcesMetadata(std::map<int64_t, std::map<int32_t, std::string> >& result,
+                                          DatabaseManager& manager,
+                                          const std::list<int64_t>& ids)
+  {
+    result.clear();
+
+    std::list<std::string> chunks;
+    JoinInternalIds(chunks, ids);
+
+    for (std::list<std::string>::const_iterator it = chunks.begin(); it != chunks.end(); ++it)
+    {
+      DatabaseManager::StandaloneStatement statement(
+        manager, "SELECT id, type, value FROM Metadata WHERE id IN (" + *it + ")");
+
+      statement.SetReadOnly(true);
+      statement.Execute();
+
+      if (!statement.IsDone())
+      {
+        if (statement.GetResultFieldsCount() != 3)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+        }
+
+        statement.SetResultFieldType(0, ValueType_Integer64);
+        statement.SetResultFieldType(1, ValueType_Integer64);
+        statement.SetResultFieldType(2, ValueType_Utf8String);
+
+        while (!statement.IsDone())
+        {
+          result[statement.ReadInteger64(0)][statement.ReadInteger32(1)] = statement.ReadString(2);
+          statement.Next();
+        }
+      }
+    }
+  }
+
+
+  void IndexBackend::LookupHierarchy(int64_t& patientId /*out*/,
+                                     int64_t& studyId /*out*/,
+                                     int64_t& seriesId /*out*/,
+                                     int64_t& instanceId /*out*/,
+                                     DatabaseManager& manager,
+                                     const char* hashPatient,
+                                     const char* hashStudy,
+                                     const char* hashSeries,
+                                     const char* hashInstance)
+  {
+    patientId = -1;
+    studyId = -1;
+    seriesId = -1;
+    instanceId = -1;
+
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "SELECT publicId, internalId FROM Resources WHERE publicId IN "
+      "(${patient}, ${study}, ${series}, ${instance})");
+
+    statement.SetReadOnly(true);
+    statement.SetParameterType("patient", ValueType_Utf8String);
+    statement.SetParameterType("study", ValueType_Utf8String);
+    statement.SetParameterType("series", ValueType_Utf8String);
+    statement.SetParameterType("instance", ValueType_Utf8String);
+
+    Dictionary args;
+    args.SetUtf8Value("patient", hashPatient);
+    args.SetUtf8Value("study", hashStudy);
+    args.SetUtf8Value("series", hashSeries);
+    args.SetUtf8Value("instance", hashInstance);
+
+    statement.Execute(args);
+
+    while (!statement.IsDone())
+    {
+      const std::string publicId = statement.ReadString(0);
+      const int64_t internalId = statement.ReadInteger64(1);
+
+      if (publicId == hashPatient)
+      {
+        patientId = internalId;
+      }
+      else if (publicId == hashStudy)
+      {
+        studyId = internalId;
+      }
+      else if (publicId == hashSeries)
+      {
+        seriesId = internalId;
+      }
+      else if (publicId == hashInstance)
+      {
+        instanceId = internalId;
+      }
+
+      statement.Next();
+    }
+  }
+
+
+#if ORTHANC_PLUGINS_HAS_DATABASE_CONSTRAINT == 1
+  void IndexBackend::CreateInstanceGeneric(OrthancPluginCreateInstanceResult& result,
+                                           DatabaseManager& manager,
+                                           const char* hashPatient,
+                                           const char* hashStudy,
+                                           const char* hashSeries,
+                                           const char* hashInstance)
+  {
+    // Check out "OrthancServer/Sources/Database/Compatibility/ICreateInstance.cpp"
+
+    // The four levels are probed at once, and the answer is reused
+    // for the whole decision tree
+    int64_t instanceId;
+    LookupHierarchy(result.patientId, result.studyId, result.seriesId, instanceId,
+                    manager, hashPatient, hashStudy, hashSeries, hashInstance);
+
+    if (instanceId != -1)
+    {
+      // The instance already exists
+      result.instanceId = instanceId;
+      result.isNewInstance = false;
+      return;
+    }
+
+    result.instanceId = CreateResource(manager, hashInstance, OrthancPluginResourceType_Instance);
+    result.isNewInstance = true;
+
+    // Detect up to which level the patient/study/series/instance
+    // hierarchy must be created
+    if (result.seriesId != -1)
+    {
+      // The patient, the study and the series already exist
+      assert(result.patientId != -1 && result.studyId != -1);
+      result.isNewPatient = false;
+      result.isNewStudy = false;
+      result.isNewSeries = false;
+    }
+    else if (result.studyId != -1)
+    {
+      // New series: The patient and the study already exist
+      assert(result.patientId != -1);
+      result.isNewPatient = false;
+      result.isNewStudy = false;
+      result.isNewSeries = true;
+    }
+    else if (result.patientId != -1)
+    {
+      // New study and series: The patient already exist
+      result.isNewPatient = false;
+      result.isNewStudy = true;
+      result.isNewSeries = true;
+    }
+    else
+    {
+      // New patient, study and series: Nothing exists
+      result.isNewPatient = true;
+      result.isNewStudy = true;
+      result.isNewSeries = true;
+    }
+
+    // Create the series if needed
+    if (result.isNewSeries)
+    {
+      result.seriesId = CreateResource(manager, hashSeries, OrthancPluginResourceType_Series);
+    }
+
+    // Create the study if needed
+    if (result.isNewStudy)
+    {
+      result.studyId = CreateResource(manager, hashStudy, OrthancPluginResourceType_Study);
+    }
+
+    // Create the patient if needed
+    if (result.isNewPatient)
+    {
+      result.patientId = CreateResource(manager, hashPatient, OrthancPluginResourceType_Patient);
+    }
+
+    // Create the parent-to-child links
+    AttachChild(manager, result.seriesId, result.instanceId);
+
+    if (result.isNewSeries)
+    {
+      AttachChild(manager, result.studyId, result.seriesId);
+    }
+
+    if (result.isNewStudy)
+    {
+      AttachChild(manager, result.patientId, result.studyId);
+    }
+
+    TagMostRecentPatient(manager, result.patientId);
+
+    if (result.isNewStudy)
+    {
+      SignalCacheInvalidation(manager, CacheInvalidationType_NewStudy, result.studyId, "");
+    }
+      
+    // Sanity checks
+    assert(result.patientId != -1);
+    assert(result.studyId != -1);
+    assert(result.seriesId != -1);
+    assert(result.instanceId != -1);
+  }
+#endif
+
+
+  void IndexBackend::AddLabel(DatabaseManager& manager,
+                              int64_t resource,
+                              const std::string& label)
+  {
+    std::unique_ptr<DatabaseManager::CachedStatement> statement;
+
+    switch (manager.GetDialect())
+    {
+      case Dialect_PostgreSQL:
+        statement.reset(new DatabaseManager::CachedStatement(
+                          STATEMENT_FROM_HERE, manager,
+                          "INSERT INTO Labels VALUES(${id}, ${label}) ON CONFLICT DO NOTHING"));
+        break;
+
+      case Dialect_SQLite:
+        statement.reset(new DatabaseManager::CachedStatement(
+                          STATEMENT_FROM_HERE, manager,
+                          "INSERT OR IGNORE INTO Labels VALUES(${id}, ${label})"));
+        break;
+
+      case Dialect_MySQL:
+        statement.reset(new DatabaseManager::CachedStatement(
+                          STATEMENT_FROM_HERE, manager,
+                          "INSERT IGNORE INTO Labels VALUES(${id}, ${label})"));
+        break;
+
+      case Dialect_MSSQL:
+        statement.reset(new DatabaseManager::CachedStatement(
+                          STATEMENT_FROM_HERE, manager,
+                          "INSERT INTO Labels SELECT ${id}, ${label} WHERE NOT EXISTS "
+                          "(SELECT 1 FROM Labels WHERE id=${id} AND label=${label})"));
+        break;
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+    }
+    
+    statement->SetParameterType("id", ValueType_Integer64);
+    statement->SetParameterType("label", ValueType_Utf8String);
+
+    Dictionary args;
+    args.SetIntegerValue("id", resource);
+    args.SetUtf8Value("label", label);
+
+    statement->Execute(args);
+
+    // Invalidating the label before the commit would let the other
+    // connections store its former resources in the meantime
+    manager.AddCommitAction(new InvalidateLabelAction(*this, label));
+    SignalCacheInvalidation(manager, CacheInvalidationType_Label, resource, label);
+  }
+
+
+  void IndexBackend::RemoveLabel(DatabaseManager& manager,
+                                 int64_t resource,
+                                 const std::string& label)
+  {
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "DELETE FROM Labels WHERE id=${id} AND label=${label}");
+
+    statement.SetParameterType("id", ValueType_Integer64);
+    statement.SetParameterType("label", ValueType_Utf8String);
+
+    Dictionary args;
+    args.SetIntegerValue("id", resource);
+    args.SetUtf8Value("label", label);
+
+    statement.ExecuteWithoutResult(args);
+
+    // Invalidating the label before the commit would let the other
+    // connections store its former resources in the meantime
+    manager.AddCommitAction(new InvalidateLabelAction(*this, label));
+    SignalCacheInvalidation(manager, CacheInvalidationType_Label, resource, label);
+  }
+
+
+  template <typename Target>
+  static void ListLabelsInternal(Target& target,
+                                 DatabaseManager& manager,
+                                 int64_t resource)
+  {
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "SELECT label FROM Labels WHERE id=${id}");
+      
+    statement.SetReadOnly(true);
+    statement.SetParameterType("id", ValueType_Integer64);
+
+    Dictionary args;
+    args.SetIntegerValue("id", resource);
+
+    ReadListOfStrings(target, statement, args);
+  }
+  
+
+  template <typename Target>
+  static void ListAllLabelsInternal(Target& target,
+                                    DatabaseManager& manager,
+                                    bool hasLabelsCatalog)
+  {
+    Dictionary args;
+
+    if (hasLabelsCatalog)
+    {
+      // The labels whose resources have all been removed are kept in
+      // the catalog until its next compaction
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "SELECT label FROM LabelsCatalog GROUP BY label HAVING SUM(count) > 0");
+
+      ReadListOfStrings(target, statement, args);
+    }
+    else
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "SELECT DISTINCT label FROM Labels");
+
+      ReadListOfStrings(target, statement, args);
+    }
+  }
+
+
+  void IndexBackend::ListLabels(std::list<std::string>& target,
+                                DatabaseManager& manager,
+                                int64_t resource)
+  {
+    ListLabelsInternal(target, manager, resource);
+  }
+
+
+  void IndexBackend::ListLabels(google::protobuf::RepeatedPtrField<std::string>& target,
+                                DatabaseManager& manager,
+                                int64_t resource)
+  {
+    ListLabelsInternal(target, manager, resource);
+  }
+
+
+  void IndexBackend::ListAllLabels(std::list<std::string>& target,
+                                   DatabaseManager& manager)
+  {
+    if (labelsCache_.IsEnabled() &&
+        !manager.IsReadWriteTransaction())  // Don't cache the uncommitted changes
+    {
+      const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+      if (!labelsCache_.LookupAllLabels(target, now))
+      {
+        const uint64_t revision = labelsCache_.GetRevision();
+        ListAllLabelsInternal(target, manager, HasLabelsCatalog());
+        labelsCache_.StoreAllLabels(target, revision, now);
+      }
+    }
+    else
+    {
+      ListAllLabelsInternal(target, manager, HasLabelsCatalog());
+    }
+  }
+
+
+  void IndexBackend::ListAllLabels(google::protobuf::RepeatedPtrField<std::string>& target,
+                                   DatabaseManager& manager)
+  {
+    if (labelsCache_.IsEnabled())
+    {
+      std::list<std::string> labels;
+      ListAllLabels(labels, manager);
+
+      target.Clear();
+      for (std::list<std::string>::const_iterator it = labels.begin(); it != labels.end(); ++it)
+      {
+        *target.Add() = *it;
+      }
+    }
+    else
+    {
+      ListAllLabelsInternal(target, manager, HasLabelsCatalog());
+    }
+  }
+
+
+  bool IndexBackend::LookupLabelsResources(LabelsCache::Resources& target,
+                                           DatabaseManager& manager,
+                                           const std::set<std::string>& labels,
+                                           LabelsConstraint constraint)
+  {
+    // Long lists of IDs are less efficient than the lookup of "LabelsIndex2"
+    static const size_t MAX_LABELS_RESOURCES_IN_LOOKUP = 10000;
+
+    if (labels.empty() ||
+        !labelsCache_.IsEnabled() ||
+        manager.IsReadWriteTransaction())  // Don't cache the uncommitted changes
+    {
+      return false;
+    }
+
+    const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+    if (!labelsCache_.Evaluate(target, labels, constraint, now))
+    {
+      for (std::set<std::string>::const_iterator it = labels.begin(); it != labels.end(); ++it)
+      {
+        if (!labelsCache_.IsCached(*it, now))
+        {
+          const uint64_t revision = labelsCache_.GetRevision();
+
+          DatabaseManager::CachedStatement statement(
+            STATEMENT_FROM_HERE, manager,
+            "SELECT id FROM Labels WHERE label=${label} ORDER BY id");
+
+          statement.SetReadOnly(true);
+          statement.SetParameterType("label", ValueType_Utf8String);
+
+          Dictionary args;
+          args.SetUtf8Value("label", *it);
+
+          statement.Execute(args);
+          statement.SetResultFieldType(0, ValueType_Integer64);
+
+          LabelsCache::Resources resources;
+          while (!statement.IsDone())
+          {
+            resources.push_back(statement.ReadInteger64(0));
+            statement.Next();
+          }
+
+          labelsCache_.Store(*it, resources, revision, now);
+        }
+      }
+
+      if (!labelsCache_.Evaluate(target, labels, constraint, now))
+      {
+        return false;  // A label has been invalidated in the meantime
+      }
+    }
+
+    return (target.size() <= MAX_LABELS_RESOURCES_IN_LOOKUP);
+  }
+
+
+  void IndexBackend::PrepareStudyColumnStore(const std::list<IdentifierTag>& identifierTags)
+  {
+    std::set<std::string> missing = studyColumnStoreTags_;
+    std::vector<Orthanc::DicomTag> tags;
+
+    for (std::list<IdentifierTag>::const_iterator it = identifierTags.begin(); it != identifierTags.end(); ++it)
+    {
+      if (it->GetLevel() == Orthanc::ResourceType_Study &&
+          missing.erase(it->GetName()) > 0)
+      {
+        tags.push_back(it->GetTag());
+      }
+    }
+
+    for (std::set<std::string>::const_iterator it = missing.begin(); it != missing.end(); ++it)
+    {
+      LOG(WARNING) << "Tag \"" << *it << "\" is not an identifier tag of the studies, it is ignored by the column store";
+    }
+
+    studyColumnStore_.SetTags(tags);
+  }
+
+
+#if ORTHANC_PLUGINS_HAS_DATABASE_CONSTRAINT == 1
+  void IndexBackend::UpdateStudyColumnStore(uint32_t countIdentifierTags,
+                                            const OrthancPluginResourcesContentTags* identifierTags)
+  {
+    if (countIdentifierTags != 0 &&
+        studyColumnStore_.IsEnabled())
+    {
+      const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+      for (uint32_t i = 0; i < countIdentifierTags; i++)
+      {
+        studyColumnStore_.SetValue(identifierTags[i].resource, identifierTags[i].group,
+                                   identifierTags[i].element, identifierTags[i].value, now);
+      }
+    }
+  }
+#endif
+
+
+  void IndexBackend::UpdateStudyColumnStore(const std::vector<DeferredWrites::Tag>& identifierTags)
+  {
+    if (!identifierTags.empty() &&
+        studyColumnStore_.IsEnabled())
+    {
+      const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+      for (size_t i = 0; i < identifierTags.size(); i++)
+      {
+        studyColumnStore_.SetValue(identifierTags[i].resource_, identifierTags[i].group_,
+                                   identifierTags[i].element_, identifierTags[i].value_, now);
+      }
+    }
+  }
+
+
+  static std::string FormatStudyColumnStoreCondition(const std::vector<Orthanc::DicomTag>& tags)
+  {
+    std::string condition;
+    for (size_t i = 0; i < tags.size(); i++)
+    {
+      if (i > 0)
+      {
+        condition += " OR ";
+      }
+
+      condition += ("(d.tagGroup = " + boost::lexical_cast<std::string>(tags[i].GetGroup()) +
+                    " AND d.tagElement = " + boost::lexical_cast<std::string>(tags[i].GetElement()) + ")");
+    }
+
+    return condition;
+  }
+
+
+  void IndexBackend::ReloadStudyColumnStore(DatabaseManager& manager)
+  {
+    const std::string condition = FormatStudyColumnStoreCondition(studyColumnStore_.GetTags());
+
+    std::unique_ptr<StudyColumnStore::Table> table(studyColumnStore_.CreateTable());
+
+    {
+      DatabaseManager::Transaction t(manager, TransactionType_ReadOnly);
+
+      const std::string sql = ("SELECT d.id, d.tagGroup, d.tagElement, d.value FROM DicomIdentifiers AS d "
+                               "INNER JOIN Resources AS r ON r.internalId = d.id WHERE r.resourceType = " +
+                               boost::lexical_cast<std::string>(static_cast<int>(OrthancPluginResourceType_Study)) +
+                               " AND (" + condition + ")");
+
+      DatabaseManager::CachedStatement statement(STATEMENT_FROM_HERE_DYNAMIC(sql), manager, sql);
+
+      // The rows are only read in the loop below, without issuing other statements
+      statement.SetReadOnly(true);
+      statement.SetStreaming(true);
+      statement.Execute();
+
+      while (!statement.IsDone())
+      {
+        const Orthanc::DicomTag tag(static_cast<uint16_t>(statement.ReadInteger64(1)),
+                                    static_cast<uint16_t>(statement.ReadInteger64(2)));
+        table->SetValue(statement.ReadInteger64(0), tag, statement.ReadStringReference(3));
+        statement.Next();
+      }
+
+      t.Commit();
+    }
+
+    LOG(INFO) << "Loaded " << table->GetRowsCount() << " studies into the column store";
+
+    studyColumnStore_.CommitReload(table.release(), boost::posix_time::microsec_clock::universal_time());
+  }
+
+
+  void IndexBackend::LoadPendingStudies(DatabaseManager& manager)
+  {
+    const std::string condition = FormatStudyColumnStoreCondition(studyColumnStore_.GetTags());
+
+    for (;;)
+    {
+      std::vector<int64_t> pending;
+      studyColumnStore_.GetPendingStudies(pending, MAX_PENDING_STUDIES_PER_STATEMENT);
+
+      if (pending.empty())
+      {
+        return;
+      }
+
+      std::string ids;
+      for (size_t i = 0; i < pending.size(); i++)
+      {
+        ids += (i == 0 ? "" : ",") + boost::lexical_cast<std::string>(pending[i]);
+      }
+
+      {
+        DatabaseManager::Transaction t(manager, TransactionType_ReadOnly);
+
+        // Not a cached statement, as the list of IDs varies
+        DatabaseManager::StandaloneStatement statement(
+          manager, "SELECT d.id, d.tagGroup, d.tagElement, d.value FROM DicomIdentifiers AS d "
+          "WHERE d.id IN (" + ids + ") AND (" + condition + ")");
+
+        statement.SetReadOnly(true);
+        statement.Execute();
+
+        const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+        while (!statement.IsDone())
+        {
+          studyColumnStore_.SetValue(statement.ReadInteger64(0),
+                                     static_cast<uint16_t>(statement.ReadInteger64(1)),
+                                     static_cast<uint16_t>(statement.ReadInteger64(2)),
+                                     statement.ReadString(3), now);
+          statement.Next();
+        }
+
+        t.Commit();
+      }
+
+      studyColumnStore_.RemovePendingStudies(pending);
+
+      if (pending.size() < MAX_PENDING_STUDIES_PER_STATEMENT)
+      {
+        return;
+      }
+    }
+  }
+
+
+  void IndexBackend::SignalCacheInvalidation(DatabaseManager& manager,
+                                             CacheInvalidationType type,
+                                             int64_t internalId,
+                                             const std::string& value)
+  {
+    if (cacheInvalidations_.IsEnabled())
+    {
+      WriteCacheInvalidation(manager, cacheInvalidations_.GetServer(), type, internalId, value);
+    }
+  }
+
+
+  void IndexBackend::WriteCacheInvalidation(DatabaseManager& manager,
+                                            const std::string& server,
+                                            CacheInvalidationType type,
+                                            int64_t internalId,
+                                            const std::string& value)
+  {
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "INSERT INTO CacheInvalidations(server, type, internalId, value, date) "
+      "VALUES(${server}, ${type}, ${id}, ${value}, ${date})");
+
+    statement.SetParameterType("server", ValueType_Utf8String);
+    statement.SetParameterType("type", ValueType_Integer64);
+    statement.SetParameterType("id", ValueType_Integer64);
+    statement.SetParameterType("value", ValueType_Utf8String);
+    statement.SetParameterType("date", ValueType_Utf8String);
+
+    Dictionary args;
+    args.SetUtf8Value("server", server);
+    args.SetIntegerValue("type", static_cast<int>(type));
+    args.SetIntegerValue("id", internalId);
+    args.SetUtf8Value("value", value);
+    args.SetUtf8Value("date", CacheInvalidations::FormatDate(boost::posix_time::second_clock::universal_time()));
+
+    statement.ExecuteWithoutResult(args);
+  }
+
+
+  void IndexBackend::ApplyCacheInvalidation(const std::string& server,
+                                            CacheInvalidationType type,
+                                            int64_t internalId,
+                                            const std::string& value)
+  {
+    if (server == cacheInvalidations_.GetServer())
+    {
+      return;  // Already applied by the writes of this process
+    }
+
+    switch (type)
+    {
+      case CacheInvalidationType_DeletedResource:
+        // The deletions don't necessarily log a change, which would invalidate the answers
+        InvalidateCachedResource(value);
+        findResultsCache_.Clear();
+        keysetPagination_.Clear();
+        break;
+
+      case CacheInvalidationType_Label:
+        labelsCache_.InvalidateLabel(value);
+        findResultsCache_.Clear();
+        keysetPagination_.Clear();
+        break;
+
+      case CacheInvalidationType_NewStudy:
+        studyColumnStore_.AddPendingStudy(internalId);
+        break;
+
+      case CacheInvalidationType_GlobalProperty:
+        globalPropertiesCache_.Invalidate(value, static_cast<int32_t>(internalId));
+        break;
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  void IndexBackend::HideResource(int64_t id,
+                                  Orthanc::ResourceType level)
+  {
+    hiddenResources_.Hide(id, level);
+    findResultsCache_.Clear();  // The cached answers might contain the resource
+    keysetPagination_.Clear();  // The offsets of the lookups move
+  }
+
+
+  void IndexBackend::UnhideResource(int64_t id)
+  {
+    hiddenResources_.Unhide(id);
+    keysetPagination_.Clear();
+  }
+
+
+  void IndexBackend::ClearCaches()
+  {
+    lookupCache_.Clear();
+    labelsCache_.InvalidateAll();
+    findResultsCache_.Clear();
+    keysetPagination_.Clear();
+    globalPropertiesCache_.InvalidateAll();
+
+    if (studyColumnStore_.IsEnabled())
+    {
+      studyColumnStore_.Unload();  // Reloaded by the housekeeping thread
+    }
+  }
+
+
+  void IndexBackend::PollCacheInvalidations(DatabaseManager& manager)
+  {
+    std::string since;
+
+    if (!cacheInvalidations_.GetPollingStart(since, boost::posix_time::second_clock::universal_time()))
+    {
+      cacheInvalidations_.StartPolling();
+
+      // The invalidations that were published before are unknown
+      ClearCaches();
+      return;
+    }
+
+    {
+      DatabaseManager::Transaction t(manager, TransactionType_ReadOnly);
+
+      // The rows are read by date, not by sequence number, as a
+      // transaction can commit after the rows with greater sequence
+      // numbers (cf. "CacheInvalidations")
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "SELECT seq, server, type, internalId, value FROM CacheInvalidations WHERE date >= ${since} ORDER BY seq");
+
+      statement.SetReadOnly(true);
+      statement.SetParameterType("since", ValueType_Utf8String);
+
+      Dictionary args;
+      args.SetUtf8Value("since", since);
+      statement.Execute(args);
+
+      const boost::posix_time::ptime now = boost::posix_time::second_clock::universal_time();
+
+      while (!statement.IsDone())
+      {
+        const int type = statement.ReadInteger32(2);
+
+        if (cacheInvalidations_.MarkApplied(statement.ReadInteger64(0), now) &&
+            type >= CacheInvalidationType_DeletedResource &&
+            type <= CacheInvalidationType_GlobalProperty)
+        {
+          ApplyCacheInvalidation(statement.ReadString(1), static_cast<CacheInvalidationType>(type),
+                                 statement.ReadInteger64(3), statement.ReadString(4));
+        }
+
+        statement.Next();
+      }
+
+      t.Commit();
+    }
+
+    const boost::posix_time::ptime now = boost::posix_time::second_clock::universal_time();
+
+    if (!IsReadOnly() &&
+        (cacheInvalidationsPruned_.is_not_a_date_time() ||
+         now >= cacheInvalidationsPruned_ + boost::posix_time::minutes(1)))
+    {
+      DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "DELETE FROM CacheInvalidations WHERE date < ${date}");
+
+      statement.SetParameterType("date", ValueType_Utf8String);
+
+      Dictionary args;
+      args.SetUtf8Value("date", CacheInvalidations::FormatDate(
+                          now - boost::posix_time::minutes(CACHE_INVALIDATIONS_RETENTION_MINUTES)));
+      statement.ExecuteWithoutResult(args);
+
+      t.Commit();
+      cacheInvalidationsPruned_ = now;
+    }
+  }
+
+  
+  void IndexBackend::Register(IndexBackend* backend,
+                              size_t countConnections,
+                              unsigned int maxDatabaseRetries,
+                              unsigned int housekeepingDelaySeconds)
+  {
+    if (backend == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+    }
+    
+    LOG(WARNING) << "The index plugin will use " << countConnections << " connection(s) to the database, "
+                 << "and will retry up to " << maxDatabaseRetries << " time(s) in the case of a collision";
+      
+#if defined(ORTHANC_PLUGINS_VERSION_IS_ABOVE)         // Macro introduced in Orthanc 1.3.1
+#  if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 0)
+    if (OrthancPluginCheckVersionAdvanced(backend->GetContext(), 1, 12, 0) == 1)
+    {
+      DatabaseBackendAdapterV4::Register(backend, countConnections, maxDatabaseRetries, housekeepingDelaySeconds);
+      return;
+    }
+#  endif
+#endif
+
+#if defined(ORTHANC_PLUGINS_VERSION_IS_ABOVE)         // Macro introduced in Orthanc 1.3.1
+#  if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 9, 2)
+    if (OrthancPluginCheckVersionAdvanced(backend->GetContext(), 1, 9, 2) == 1)
+    {
+      DatabaseBackendAdapterV3::Register(backend, countConnections, maxDatabaseRetries, housekeepingDelaySeconds);
+      return;
+    }
+#  endif
+#endif
+
+    LOG(WARNING) << "Performance warning: Your version of the Orthanc core or SDK doesn't support multiple readers/writers";
+
+    if (countConnections > 1)
+    {
+      LOG(WARNING) << "Only 1 connection to the database will be used instead of " << countConnections
+                   << ", as the Orthanc core serializes all the accesses to the database: "
+                   << "Upgrade to Orthanc >= 1.9.2 to run concurrent transactions";
+    }
+
+    DatabaseBackendAdapterV2::Register(backend);
+  }
+
+
+  bool IndexBackend::LookupGlobalIntegerProperty(int& target,
+                                                 DatabaseManager& manager,
+                                                 const char* serverIdentifier,
+                                                 int32_t property)
+  {
+    std::string value;
+
+    if (LookupGlobalProperty(value, manager, serverIdentifier, property))
+    {
+      try
+      {
+        target = boost::lexical_cast<int>(value);
+        return true;
+      }
+      catch (boost::bad_lexical_cast&)
+      {
+        LOG(ERROR) << "Corrupted database";
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);
+      }      
+    }
+    else
+    {
+      return false;
+    }    
+  }
+  
+
+  void IndexBackend::SetGlobalIntegerProperty(DatabaseManager& manager,
+                                              const char* serverIdentifier,
+                                              int32_t property,
+                                              int value)
+  {
+    std::string s = boost::lexical_cast<std::string>(value);
+    SetGlobalProperty(manager, serverIdentifier, property, s.c_str());
+  }
+  
+
+  void IndexBackend::Finalize()
+  {
+    DatabaseBackendAdapterV2::Finalize();
+
+#if defined(ORTHANC_PLUGINS_VERSION_IS_ABOVE)         // Macro introduced in Orthanc 1.3.1
+#  if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 9, 2)
+    DatabaseBackendAdapterV3::Finalize();
+#  endif
+#endif
+
+#if defined(ORTHANC_PLUGINS_VERSION_IS_ABOVE)         // Macro introduced in Orthanc 1.3.1
+#  if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 0)
+    DatabaseBackendAdapterV4::Finalize();
+#  endif
+#endif
+  }
+
+
+  uint64_t IndexBackend::MeasureLatency(DatabaseManager& manager)
+  {
+    // execute 11x the simplest statement and return the median value
+    std::vector<uint64_t> measures;
+
+    for (int i = 0; i < 11; i++)
+    {
+      DatabaseManager::StandaloneStatement statement(manager, "SELECT 1");
+
+      Orthanc::Toolbox::ElapsedTimer timer;
+
+      statement.ExecuteWithoutResult();
+
+      measures.push_back(timer.GetElapsedMicroseconds());
+    }
+    
+    std::sort(measures.begin(), measures.end());
+
+    return measures[measures.size() / 2];
+  }
+
+
+  DatabaseManager* IndexBackend::CreateSingleDatabaseManager(IDatabaseBackend& backend,
+                                                             bool hasIdentifierTags,
+                                                             const std::list<IdentifierTag>& identifierTags)
+  {
+    ISqlLookupFormatter::PrepareIdentifierTags(identifierTags);
+
+    std::unique_ptr<DatabaseManager> manager(new DatabaseManager(backend.CreateDatabaseFactory()));
+    backend.ConfigureDatabase(*manager, hasIdentifierTags, identifierTags);
+    return manager.release();
+  }
+
+  bool IndexBackend::LookupAdvisedIndex(std::string& name,
+                                        std::string& sql,
+                                        DatabaseManager& manager,
+                                        const Orthanc::DicomTag& tag)
+  {
+    if (manager.GetDialect() == Dialect_SQLite)
+    {
+      // The predicate matches the literal tags that are generated by "ISqlLookupFormatter"
+      name = IndexAdvisor::FormatIndexName(tag);
+      sql = ("CREATE INDEX IF NOT EXISTS " + name + " ON MainDicomTags(value) WHERE tagGroup = " +
+             boost::lexical_cast<std::string>(tag.GetGroup()) + " AND tagElement = " +
+             boost::lexical_cast<std::string>(tag.GetElement()));
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  void IndexBackend::CreateAdvisedIndex(DatabaseManager& manager,
+                                        const std::string& sql)
+  {
+    DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+    t.GetDatabaseTransaction().ExecuteMultiLines(sql);
+    t.Commit();
+  }
+
+
+  void IndexBackend::AdviseIndexes(Json::Value& target,
+                                   DatabaseManager& manager,
+                                   bool create)
+  {
+    IndexAdvisor::Usages usages;
+    indexAdvisor_.GetUsages(usages);
+
+    std::vector<IndexAdvisor::Key> keys;
+    IndexAdvisor::GetSortedKeys(keys, usages);
+
+    target = Json::objectValue;
+    target["Tags"] = Json::arrayValue;
+    target["Statements"] = Json::arrayValue;
+
+    std::map<std::string, std::string> missing;  // The SQL of the missing indexes, by name
+
+    {
+      DatabaseManager::Transaction t(manager, TransactionType_ReadOnly);
+
+      for (size_t i = 0; i < keys.size(); i++)
+      {
+        Json::Value item;
+        IndexAdvisor::Format(item, keys[i], usages[keys[i]]);
+
+        std::string name, sql;
+
+        if (keys[i].second)
+        {
+          // The values of the identifier tags are indexed by all the plugins
+          item["Indexed"] = true;
+        }
+        else if (LookupAdvisedIndex(name, sql, manager, keys[i].first))
+        {
+          const bool indexed = (missing.find(name) == missing.end() &&
+                                t.GetDatabaseTransaction().DoesIndexExist(name));
+
+          item["Index"] = name;
+          item["Indexed"] = indexed;
+
+          if (!indexed)
+          {
+            item["Recommendation"] = sql;
+            missing[name] = sql;
+          }
+        }
+        else
+        {
+          item["Indexed"] = false;
+        }
+
+        target["Tags"].append(item);
+      }
+
+      ReadStatementsStatistics(target["Statements"], manager);
+
+      t.Commit();
+    }
+
+    target["Created"] = Json::arrayValue;
+
+    if (create)
+    {
+      for (std::map<std::string, std::string>::const_iterator it = missing.begin(); it != missing.end(); ++it)
+      {
+        LOG(WARNING) << "Creating the index recommended by the index advisor: " << it->second;
+        CreateAdvisedIndex(manager, it->second);
+        target["Created"].append(it->first);
+      }
+    }
+  }
+
+
 #if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 5)
   bool IndexBackend::HasFindSupport() const
   {
-    // TODO-FIND  move to child plugins ?
-    return true;
+    // TODO-FIND  move to child plugins ?
+    return true;
+  }
+#endif
+
+
+#if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 5)
+  Orthanc::DatabasePluginMessages::Find_Response_ResourceContent* GetResourceContent(
+                              Orthanc::DatabasePluginMessages::Find_Response* response,
+                              Orthanc::DatabasePluginMessages::ResourceType level)
+  {
+    Orthanc::DatabasePluginMessages::Find_Response_ResourceContent* content = NULL;  // the protobuf response will be the owner
+    
+    switch (level)
+    {
+      case Orthanc::DatabasePluginMessages::ResourceType::RESOURCE_PATIENT:
+        content = response->mutable_patient_content();
+        break;
+      case Orthanc::DatabasePluginMessages::ResourceType::RESOURCE_STUDY:
+        content = response->mutable_study_content();
+        break;
+      case Orthanc::DatabasePluginMessages::ResourceType::RESOURCE_SERIES:
+        content =response->mutable_series_content();
+        break;
+      case Orthanc::DatabasePluginMessages::ResourceType::RESOURCE_INSTANCE:
+        content = response->mutable_instance_content();
+        break;
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+    }
+    return content;
+  }
+
+  static void ReadResourceSummary(Orthanc::DatabasePluginMessages::Find_Response_ResourceContent* content,
+                                  const std::string& summary,
+                                  bool retrieveMainDicomTags,
+                                  bool retrieveMetadata)
+  {
+    // cf. "IndexBackend::HasResourceSummary()" for the format
+    Json::Value json;
+    if (!Orthanc::Toolbox::ReadJson(json, summary) ||
+        json.type() != Json::arrayValue ||
+        json.size() != 2 ||
+        json[0].type() != Json::arrayValue ||
+        json[1].type() != Json::arrayValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Corrupted content in the ResourceSummary table");
+    }
+
+    if (retrieveMainDicomTags)
+    {
+      for (Json::Value::ArrayIndex i = 0; i < json[0].size(); i++)
+      {
+        const Json::Value& item = json[0][i];
+        Orthanc::DatabasePluginMessages::Find_Response_Tag* tag = content->add_main_dicom_tags();
+        tag->set_group(item[0].asInt());
+        tag->set_element(item[1].asInt());
+        tag->set_value(item[2].isString() ? item[2].asString() : std::string());
+      }
+    }
+
+    if (retrieveMetadata)
+    {
+      for (Json::Value::ArrayIndex i = 0; i < json[1].size(); i++)
+      {
+        const Json::Value& item = json[1][i];
+        Orthanc::DatabasePluginMessages::Find_Response_Metadata* metadata = content->add_metadata();
+        metadata->set_key(item[0].asInt());
+        metadata->set_revision(item[1].asInt());
+        metadata->set_value(item[2].isString() ? item[2].asString() : std::string());
+      }
+    }
+  }
+
+  Orthanc::DatabasePluginMessages::Find_Response_ChildrenContent* GetChildrenContent(
+                              Orthanc::DatabasePluginMessages::Find_Response* response,
+                              Orthanc::DatabasePluginMessages::ResourceType childrenLevel)
+  {
+    Orthanc::DatabasePluginMessages::Find_Response_ChildrenContent* content = NULL;  // the protobuf response will be the owner
+    
+    switch (childrenLevel)
+    {
+      case Orthanc::DatabasePluginMessages::ResourceType::RESOURCE_STUDY:
+        content = response->mutable_children_studies_content();
+        break;
+      case Orthanc::DatabasePluginMessages::ResourceType::RESOURCE_SERIES:
+        content =response->mutable_children_series_content();
+        break;
+      case Orthanc::DatabasePluginMessages::ResourceType::RESOURCE_INSTANCE:
+        content = response->mutable_children_instances_content();
+        break;
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+    }
+    return content;
+  }
+
+  std::string JoinRequestedMetadata(const Orthanc::DatabasePluginMessages::Find_Request_ChildrenSpecification* childrenSpec)
+  {
+    std::set<std::string> metadataTypes;
+    for (int i = 0; i < childrenSpec->retrieve_metadata_size(); ++i)
+    {
+      metadataTypes.insert(boost::lexical_cast<std::string>(childrenSpec->retrieve_metadata(i)));
+    }
+    std::string joinedMetadataTypes;
+    Orthanc::Toolbox::JoinStrings(joinedMetadataTypes, metadataTypes, ", ");
+
+    return joinedMetadataTypes;
+  }
+
+  std::string JoinRequestedTags(const Orthanc::DatabasePluginMessages::Find_Request_ChildrenSpecification* childrenSpec)
+  {
+    std::set<std::string> tags;
+    for (int i = 0; i < childrenSpec->retrieve_main_dicom_tags_size(); ++i)
+    {
+      tags.insert("(" + boost::lexical_cast<std::string>(childrenSpec->retrieve_main_dicom_tags(i).group()) 
+                  + ", " + boost::lexical_cast<std::string>(childrenSpec->retrieve_main_dicom_tags(i).element()) + ")");
+    }
+    std::string joinedTags;
+    Orthanc::Toolbox::JoinStrings(joinedTags, tags, ", ");
+
+    return joinedTags;
+  }
+
+
+#define C0_QUERY_ID 0
+#define C1_INTERNAL_ID 1
+#define C2_ROW_NUMBER 2
+#define C3_STRING_1 3
+#define C4_STRING_2 4
+#define C5_STRING_3 5
+#define C6_INT_1 6
+#define C7_INT_2 7
+#define C8_INT_3 8
+#define C9_BIG_INT_1 9
+#define C10_BIG_INT_2 10
+#define C11_PAYLOAD 11  // Only if the rows are aggregated as JSON
+
+#define QUERY_LOOKUP 1
+#define QUERY_MAIN_DICOM_TAGS 2
+#define QUERY_ATTACHMENTS 3
+#define QUERY_METADATA 4
+#define QUERY_LABELS 5
+#define QUERY_RESOURCE_SUMMARY 6
+#define QUERY_PARENT_MAIN_DICOM_TAGS 10
+#define QUERY_PARENT_IDENTIFIER 11
+#define QUERY_PARENT_METADATA 12
+#define QUERY_GRAND_PARENT_MAIN_DICOM_TAGS 15
+#define QUERY_GRAND_PARENT_METADATA 16
+#define QUERY_CHILDREN_IDENTIFIERS 20
+#define QUERY_CHILDREN_MAIN_DICOM_TAGS 21
+#define QUERY_CHILDREN_METADATA 22
+#define QUERY_CHILDREN_COUNT 23
+#define QUERY_GRAND_CHILDREN_IDENTIFIERS 30
+#define QUERY_GRAND_CHILDREN_MAIN_DICOM_TAGS 31
+#define QUERY_GRAND_CHILDREN_METADATA 32
+#define QUERY_GRAND_CHILDREN_COUNT 33
+#define QUERY_GRAND_GRAND_CHILDREN_IDENTIFIERS 40
+#define QUERY_GRAND_GRAND_CHILDREN_COUNT 41
+#define QUERY_ONE_INSTANCE_IDENTIFIER 50
+#define QUERY_ONE_INSTANCE_METADATA 51
+#define QUERY_ONE_INSTANCE_ATTACHMENTS 52
+
+#define STRINGIFY(x) #x
+#define TOSTRING(x) STRINGIFY(x)
+
+  static bool IsCountWithoutConstraints(const Orthanc::DatabasePluginMessages::Find_Request& request)
+  {
+    return (!request.has_limits() &&
+            request.dicom_tag_constraints_size() == 0 &&
+            request.metadata_constraints_size() == 0 &&
+            request.labels_size() == 0 &&
+            request.orthanc_id_patient().empty() &&
+            request.orthanc_id_study().empty() &&
+            request.orthanc_id_series().empty() &&
+            request.orthanc_id_instance().empty());
+  }
+
+
+  // Records the tags of the lookup for the index advisor, NULL if the advisor is disabled
+  static IndexAdvisor::Shape* CreateLookupShape(IndexAdvisor& advisor,
+                                                const Orthanc::DatabasePluginMessages::Find_Request& request)
+  {
+    if (!advisor.IsEnabled())
+    {
+      return NULL;
+    }
+
+    std::unique_ptr<IndexAdvisor::Shape> shape(new IndexAdvisor::Shape(advisor));
+
+    for (int i = 0; i < request.dicom_tag_constraints_size(); i++)
+    {
+      const Orthanc::DatabasePluginMessages::DatabaseConstraint& constraint = request.dicom_tag_constraints(i);
+      shape->AddConstraint(Orthanc::DicomTag(constraint.tag_group(), constraint.tag_element()),
+                           constraint.is_identifier_tag());
+    }
+
+    for (int i = 0; i < request.ordering_size(); i++)
+    {
+      const Orthanc::DatabasePluginMessages::Find_Request_Ordering& ordering = request.ordering(i);
+      if (ordering.key_type() == Orthanc::DatabasePluginMessages::OrderingKeyType::ORDERING_KEY_TYPE_DICOM_TAG)
+      {
+        shape->AddOrdering(Orthanc::DicomTag(ordering.tag_group(), ordering.tag_element()),
+                           ordering.is_identifier_tag());
+      }
+    }
+
+    return shape.release();
+  }
+
+
+  // Bounds the duration of the statements that are run during the lifetime of this object
+  class IndexBackend::StatementTimeout : public boost::noncopyable
+  {
+  private:
+    IndexBackend&     backend_;
+    DatabaseManager&  manager_;
+    bool              active_;
+
+  public:
+    StatementTimeout(IndexBackend& backend,
+                     DatabaseManager& manager,
+                     unsigned int milliseconds) :
+      backend_(backend),
+      manager_(manager),
+      active_(false)
+    {
+      if (milliseconds != 0)
+      {
+        backend_.SetStatementTimeout(manager_, milliseconds);
+        active_ = true;
+      }
+    }
+
+    ~StatementTimeout()
+    {
+      if (active_)
+      {
+        try
+        {
+          backend_.SetStatementTimeout(manager_, 0);
+        }
+        catch (Orthanc::OrthancException&)
+        {
+          // The transaction is aborted, e.g. because the timeout was reached
+        }
+      }
+    }
+  };
+
+
+  void IndexBackend::ExecuteCount(Orthanc::DatabasePluginMessages::TransactionResponse& response,
+                                  DatabaseManager& manager,
+                                  const Orthanc::DatabasePluginMessages::Find_Request& request)
+  {
+    if (IsCountWithoutConstraints(request))
+    {
+      // Counting all the resources of one level: Use the statistics,
+      // which are maintained by the triggers in PostgreSQL and MySQL
+      const OrthancPluginResourceType level = MessagesToolbox::ConvertToPlainC(MessagesToolbox::Convert(request.level()));
+      response.mutable_count_resources()->set_count(GetResourcesCount(manager, level));
+      return;
+    }
+
+    std::string key;
+    const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+    if (countsCache_.IsEnabled() &&
+        !manager.IsReadWriteTransaction())  // Don't cache the uncommitted changes
+    {
+      key = request.SerializeAsString();
+
+      uint64_t count;
+      if (countsCache_.Lookup(count, key, now))
+      {
+        response.mutable_count_resources()->set_count(count);
+        return;
+      }
+    }
+
+    std::unique_ptr<IndexAdvisor::Shape> shape(CreateLookupShape(indexAdvisor_, request));
+
+    std::string sql;
+
+    LookupFormatter formatter(manager.GetDialect(), HasWildcardFullTextIndex(), HasBinaryCollation());
+    formatter.SetSortKeys(GetSortKeys());
+    formatter.SetHiddenResources(hiddenResources_);
+
+    LabelsCache::Resources labelsResources;
+    if (LookupLabelsResources(labelsResources, manager, request))
+    {
+      formatter.SetLabelsResources(labelsResources);
+    }
+
+    StudyColumnStore::Resources candidates;
+    if (LookupStudyCandidates(candidates, request))
+    {
+      formatter.SetCandidateResources(candidates);
+    }
+
+    std::string lookupSql;
+    ISqlLookupFormatter::Apply(lookupSql, formatter, request);
+
+    sql = "WITH Lookup AS (" + lookupSql + ") SELECT COUNT(*) FROM Lookup";
+
+    uint64_t count;
+
+    {
+      StatementTimeout timeout(*this, manager, findStatementTimeout_);
+
+      DatabaseManager::CachedStatement statement(STATEMENT_FROM_HERE_DYNAMIC(sql), manager, sql);
+      statement.SetPlanCacheMode(lookupPlanCacheMode_);
+      formatter.PrepareStatement(statement);
+      statement.Execute(formatter.GetDictionary());
+
+      count = static_cast<uint64_t>(statement.ReadInteger64(0));
+    }
+
+    response.mutable_count_resources()->set_count(count);
+
+    if (!key.empty())
+    {
+      countsCache_.Store(key, count, now);
+    }
+  }
+
+  static std::string GetKeysetPrefix(const Orthanc::DatabasePluginMessages::Find_Request& request)
+  {
+    // Identifies the lookup, independently of the requested page
+    Orthanc::DatabasePluginMessages::Find_Request lookup(request);
+    lookup.clear_limits();
+    return lookup.SerializeAsString() + "|";
+  }
+
+
+  bool IndexBackend::LookupLabelsResources(LabelsCache::Resources& target,
+                                           DatabaseManager& manager,
+                                           const Orthanc::DatabasePluginMessages::Find_Request& request)
+  {
+    if (request.labels().empty() ||
+        !labelsCache_.IsEnabled())
+    {
+      return false;
+    }
+
+    std::set<std::string> labels;
+    for (int i = 0; i < request.labels().size(); i++)
+    {
+      labels.insert(request.labels(i));
+    }
+
+    switch (request.labels_constraint())
+    {
+      case Orthanc::DatabasePluginMessages::LABELS_CONSTRAINT_ANY:
+        return LookupLabelsResources(target, manager, labels, LabelsConstraint_Any);
+
+      case Orthanc::DatabasePluginMessages::LABELS_CONSTRAINT_ALL:
+        return LookupLabelsResources(target, manager, labels, LabelsConstraint_All);
+
+      case Orthanc::DatabasePluginMessages::LABELS_CONSTRAINT_NONE:
+        return LookupLabelsResources(target, manager, labels, LabelsConstraint_None);
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  bool IndexBackend::LookupStudyCandidates(StudyColumnStore::Resources& target,
+                                           const Orthanc::DatabasePluginMessages::Find_Request& request)
+  {
+    if (request.dicom_tag_constraints().empty() ||
+        !studyColumnStore_.IsEnabled())
+    {
+      return false;
+    }
+
+    DatabaseConstraints constraints;
+
+    for (int i = 0; i < request.dicom_tag_constraints().size(); i++)
+    {
+      constraints.AddConstraint(new DatabaseConstraint(request.dicom_tag_constraints(i)));
+    }
+
+    return studyColumnStore_.Evaluate(target, constraints, MessagesToolbox::Convert(request.level()),
+                                      MAX_STUDY_CANDIDATES_IN_LOOKUP);
+  }
+
+
+  bool IndexBackend::LookupKeysetBound(FindKeysetBound& target,
+                                       DatabaseManager& manager,
+                                       const Orthanc::DatabasePluginMessages::Find_Request& request,
+                                       const std::string& publicId)
+  {
+    target.SetPublicId(publicId);
+
+    if (request.ordering_size() == 0)
+    {
+      return true;  // The resources are ordered by their public ID
+    }
+
+    LookupFormatter formatter(manager.GetDialect(), HasWildcardFullTextIndex(), HasBinaryCollation());
+    formatter.SetSortKeys(GetSortKeys());
+
+    std::string sql;
+    ISqlLookupFormatter::FormatKeysetBoundLookup(sql, formatter, request, publicId);
+
+    std::unique_ptr<DatabaseManager::StatementBase> statement;
+    if (manager.GetDialect() == Dialect_MySQL)
+    { // Same as in "ExecuteFind()"
+      statement.reset(new DatabaseManager::StandaloneStatement(manager, sql));
+    }
+    else
+    {
+      statement.reset(new DatabaseManager::CachedStatement(STATEMENT_FROM_HERE_DYNAMIC(sql), manager, sql));
+    }
+
+    formatter.PrepareStatement(*statement);
+    statement->Execute(formatter.GetDictionary());
+
+    if (statement->IsDone())
+    {
+      return false;  // The resource has been deleted in the meantime
+    }
+
+    for (int i = 0; i < request.ordering_size(); i++)
+    {
+      if (statement->IsNull(i))
+      {
+        target.AddNull();
+      }
+      else
+      {
+        target.AddValue(statement->ReadString(i));
+      }
+    }
+
+    return true;
+  }
+
+
+  /**
+   * Adds one row of the results of "ExecuteFind()" to the answer.
+   * "Row" is either the statement, or a "FindRow" that was read by
+   * another connection.
+   **/
+  template <typename Row>
+  static void ReadFindRow(Orthanc::DatabasePluginMessages::TransactionResponse& response,
+                          std::map<int64_t, Orthanc::DatabasePluginMessages::Find_Response*>& responses,
+                          const Orthanc::DatabasePluginMessages::Find_Request& request,
+                          IndexBackend::ResponseBudget& budget,
+                          const Row& row)
+  {
+    int32_t queryId = row.ReadInteger32(C0_QUERY_ID);
+    int64_t internalId = row.ReadInteger64(C1_INTERNAL_ID);
+
+    // The main string is the bulk of the row, the other columns are mostly small integers
+    budget.Add(row.IsNull(C3_STRING_1) ? 0 : row.ReadStringReference(C3_STRING_1).size());
+    
+    assert(queryId == QUERY_LOOKUP || responses.find(internalId) != responses.end()); // the QUERY_LOOKUP must be read first and must create the response before any other query tries to populate the fields
+
+    // LOG(INFO) << queryId << "  " << row.ReadStringReference(C3_STRING_1);
+
+    switch (queryId)
+    {
+      case QUERY_LOOKUP:
+        responses[internalId] = response.add_find();
+        responses[internalId]->set_public_id(row.ReadStringReference(C3_STRING_1));
+        responses[internalId]->set_internal_id(internalId);
+        break;
+
+      case QUERY_LABELS:
+        responses[internalId]->add_labels(row.ReadStringReference(C3_STRING_1));
+        break;
+
+      case QUERY_MAIN_DICOM_TAGS:
+      {
+        Orthanc::DatabasePluginMessages::Find_Response_ResourceContent* content = GetResourceContent(responses[internalId], request.level());
+        Orthanc::DatabasePluginMessages::Find_Response_Tag* tag = content->add_main_dicom_tags();
+
+        tag->set_value(row.ReadStringReference(C3_STRING_1));
+        tag->set_group(row.ReadInteger32(C6_INT_1));
+        tag->set_element(row.ReadInteger32(C7_INT_2));
+        }; break;
+
+      case QUERY_RESOURCE_SUMMARY:
+        ReadResourceSummary(GetResourceContent(responses[internalId], request.level()),
+                            row.ReadStringReference(C3_STRING_1),
+                            request.retrieve_main_dicom_tags(), request.retrieve_metadata());
+        break;
+
+      case QUERY_PARENT_MAIN_DICOM_TAGS:
+      {
+        Orthanc::DatabasePluginMessages::Find_Response_ResourceContent* content = GetResourceContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() - 1));
+        Orthanc::DatabasePluginMessages::Find_Response_Tag* tag = content->add_main_dicom_tags();
+
+        tag->set_value(row.ReadStringReference(C3_STRING_1));
+        tag->set_group(row.ReadInteger32(C6_INT_1));
+        tag->set_element(row.ReadInteger32(C7_INT_2));
+      }; break;
+
+      case QUERY_GRAND_PARENT_MAIN_DICOM_TAGS:
+      {
+        Orthanc::DatabasePluginMessages::Find_Response_ResourceContent* content = GetResourceContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() - 2));
+        Orthanc::DatabasePluginMessages::Find_Response_Tag* tag = content->add_main_dicom_tags();
+
+        tag->set_value(row.ReadStringReference(C3_STRING_1));
+        tag->set_group(row.ReadInteger32(C6_INT_1));
+        tag->set_element(row.ReadInteger32(C7_INT_2));
+      }; break;
+
+      case QUERY_CHILDREN_IDENTIFIERS:
+      {
+        Orthanc::DatabasePluginMessages::Find_Response_ChildrenContent* content = GetChildrenContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() + 1));
+        content->add_identifiers(row.ReadStringReference(C3_STRING_1));
+        content->set_count(content->identifiers_size());
+      }; break;
+
+      case QUERY_CHILDREN_COUNT:
+      {
+        Orthanc::DatabasePluginMessages::Find_Response_ChildrenContent* content = GetChildrenContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() + 1));
+        content->set_count(row.ReadInteger64(C9_BIG_INT_1));
+      }; break;
+
+      case QUERY_CHILDREN_MAIN_DICOM_TAGS:
+      {
+        Orthanc::DatabasePluginMessages::Find_Response_ChildrenContent* content = GetChildrenContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() + 1));
+        Orthanc::DatabasePluginMessages::Find_Response_MultipleTags* tag = content->add_main_dicom_tags();
+        tag->add_values(row.ReadStringReference(C3_STRING_1)); // TODO: handle sequences ??
+        tag->set_group(row.ReadInteger32(C6_INT_1));
+        tag->set_element(row.ReadInteger32(C7_INT_2));
+      }; break;
+
+      case QUERY_CHILDREN_METADATA:
+      {
+        Orthanc::DatabasePluginMessages::Find_Response_ChildrenContent* content = GetChildrenContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() + 1));
+        Orthanc::DatabasePluginMessages::Find_Response_MultipleMetadata* metadata = content->add_metadata();
+
+        metadata->add_values(row.ReadStringReference(C3_STRING_1));
+        metadata->set_key(row.ReadInteger32(C6_INT_1));
+      }; break;
+
+      case QUERY_GRAND_CHILDREN_IDENTIFIERS:
+      {
+        Orthanc::DatabasePluginMessages::Find_Response_ChildrenContent* content = GetChildrenContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() + 2));
+        content->add_identifiers(row.ReadStringReference(C3_STRING_1));
+        content->set_count(content->identifiers_size());
+      }; break;
+
+      case QUERY_GRAND_CHILDREN_COUNT:
+      {
+        Orthanc::DatabasePluginMessages::Find_Response_ChildrenContent* content = GetChildrenContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() + 2));
+        content->set_count(row.ReadInteger64(C9_BIG_INT_1));
+      }; break;
+
+      case QUERY_GRAND_CHILDREN_MAIN_DICOM_TAGS:
+      {
+        Orthanc::DatabasePluginMessages::Find_Response_ChildrenContent* content = GetChildrenContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() + 2));
+        Orthanc::DatabasePluginMessages::Find_Response_MultipleTags* tag = content->add_main_dicom_tags();
+
+        tag->add_values(row.ReadStringReference(C3_STRING_1)); // TODO: handle sequences ??
+        tag->set_group(row.ReadInteger32(C6_INT_1));
+        tag->set_element(row.ReadInteger32(C7_INT_2));
+      }; break;
+
+      case QUERY_GRAND_CHILDREN_METADATA:
+      {
+        Orthanc::DatabasePluginMessages::Find_Response_ChildrenContent* content = GetChildrenContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() + 2));
+        Orthanc::DatabasePluginMessages::Find_Response_MultipleMetadata* metadata = content->add_metadata();
+
+        metadata->add_values(row.ReadStringReference(C3_STRING_1));
+        metadata->set_key(row.ReadInteger32(C6_INT_1));
+      }; break;
+
+      case QUERY_GRAND_GRAND_CHILDREN_IDENTIFIERS:
+      {
+        Orthanc::DatabasePluginMessages::Find_Response_ChildrenContent* content = GetChildrenContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() + 3));
+        content->add_identifiers(row.ReadStringReference(C3_STRING_1));
+        content->set_count(content->identifiers_size());
+      }; break;
+
+      case QUERY_GRAND_GRAND_CHILDREN_COUNT:
+      {
+        Orthanc::DatabasePluginMessages::Find_Response_ChildrenContent* content = GetChildrenContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() + 3));
+        content->set_count(row.ReadInteger64(C9_BIG_INT_1));
+      }; break;
+
+      case QUERY_ATTACHMENTS:
+      {
+        Orthanc::DatabasePluginMessages::FileInfo* attachment = responses[internalId]->add_attachments();
+
+        attachment->set_uuid(row.ReadStringReference(C3_STRING_1));
+        attachment->set_uncompressed_hash(row.ReadStringReference(C4_STRING_2));
+        attachment->set_compressed_hash(row.ReadStringReference(C5_STRING_3));
+        attachment->set_content_type(row.ReadInteger32(C6_INT_1));
+        attachment->set_compression_type(row.ReadInteger32(C8_INT_3));
+        attachment->set_compressed_size(row.ReadInteger64(C9_BIG_INT_1));
+        attachment->set_uncompressed_size(row.ReadInteger64(C10_BIG_INT_2));
+
+        if (!row.IsNull(C7_INT_2))  // revision can be null for files that have been atttached by older Orthanc versions
+        {
+          responses[internalId]->add_attachments_revisions(row.ReadInteger32(C7_INT_2));
+        }
+        else
+        {
+          responses[internalId]->add_attachments_revisions(0);
+        }
+      }; break;
+
+      case QUERY_METADATA:
+      {
+        Orthanc::DatabasePluginMessages::Find_Response_ResourceContent* content = GetResourceContent(responses[internalId], request.level());
+        Orthanc::DatabasePluginMessages::Find_Response_Metadata* metadata = content->add_metadata();
+
+        metadata->set_value(row.ReadStringReference(C3_STRING_1));
+        metadata->set_key(row.ReadInteger32(C6_INT_1));
+        
+        if (!row.IsNull(C7_INT_2))  // revision can be null for metadata that have been created by older Orthanc versions
+        {
+          metadata->set_revision(row.ReadInteger32(C7_INT_2));
+        }
+        else
+        {
+          metadata->set_revision(0);
+        }
+      }; break;
+
+      case QUERY_PARENT_METADATA:
+      {
+        Orthanc::DatabasePluginMessages::Find_Response_ResourceContent* content = GetResourceContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() - 1));
+        Orthanc::DatabasePluginMessages::Find_Response_Metadata* metadata = content->add_metadata();
+
+        metadata->set_value(row.ReadStringReference(C3_STRING_1));
+        metadata->set_key(row.ReadInteger32(C6_INT_1));
+
+        if (!row.IsNull(C7_INT_2))  // revision can be null for metadata that have been created by older Orthanc versions
+        {
+          metadata->set_revision(row.ReadInteger32(C7_INT_2));
+        }
+        else
+        {
+          metadata->set_revision(0);
+        }
+      }; break;
+
+      case QUERY_GRAND_PARENT_METADATA:
+      {
+        Orthanc::DatabasePluginMessages::Find_Response_ResourceContent* content = GetResourceContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() - 2));
+        Orthanc::DatabasePluginMessages::Find_Response_Metadata* metadata = content->add_metadata();
+
+        metadata->set_value(row.ReadStringReference(C3_STRING_1));
+        metadata->set_key(row.ReadInteger32(C6_INT_1));
+
+        if (!row.IsNull(C7_INT_2))  // revision can be null for metadata that have been created by older Orthanc versions
+        {
+          metadata->set_revision(row.ReadInteger32(C7_INT_2));
+        }
+        else
+        {
+          metadata->set_revision(0);
+        }
+      }; break;
+
+      case QUERY_PARENT_IDENTIFIER:
+      {
+        responses[internalId]->set_parent_public_id(row.ReadStringReference(C3_STRING_1));
+      }; break;
+
+      case QUERY_ONE_INSTANCE_IDENTIFIER:
+      {
+        responses[internalId]->set_one_instance_public_id(row.ReadStringReference(C3_STRING_1));
+      }; break;
+      case QUERY_ONE_INSTANCE_METADATA:
+      {
+        Orthanc::DatabasePluginMessages::Find_Response_Metadata* metadata = responses[internalId]->add_one_instance_metadata();
+
+        metadata->set_value(row.ReadStringReference(C3_STRING_1));
+        metadata->set_key(row.ReadInteger32(C6_INT_1));
+
+        if (!row.IsNull(C7_INT_2))  // revision can be null for metadata that have been created by older Orthanc versions
+        {
+          metadata->set_revision(row.ReadInteger32(C7_INT_2));
+        }
+        else
+        {
+          metadata->set_revision(0);
+        }
+      }; break;
+      case QUERY_ONE_INSTANCE_ATTACHMENTS:
+      {
+        Orthanc::DatabasePluginMessages::FileInfo* attachment = responses[internalId]->add_one_instance_attachments();
+        
+        attachment->set_uuid(row.ReadStringReference(C3_STRING_1));
+        attachment->set_uncompressed_hash(row.ReadStringReference(C4_STRING_2));
+        attachment->set_compressed_hash(row.ReadStringReference(C5_STRING_3));
+        attachment->set_content_type(row.ReadInteger32(C6_INT_1));
+        attachment->set_compression_type(row.ReadInteger32(C8_INT_3));
+        attachment->set_compressed_size(row.ReadInteger64(C9_BIG_INT_1));
+        attachment->set_uncompressed_size(row.ReadInteger64(C10_BIG_INT_2));
+      }; break;
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+    }
+  }
+
+
+  namespace
+  {
+    // Copy of one row of the results of "ExecuteFind()"
+    class FindRow
+    {
+    private:
+      static const size_t FIELDS_COUNT = C10_BIG_INT_2 + 1;
+
+      bool         isNull_[FIELDS_COUNT];
+      int64_t      integers_[FIELDS_COUNT];
+      std::string  strings_[3];  // "C3_STRING_1" to "C5_STRING_3"
+
+      static bool IsStringField(size_t field)
+      {
+        return (field >= C3_STRING_1 &&
+                field <= C5_STRING_3);
+      }
+
+      void CheckField(size_t field,
+                      bool isString) const
+      {
+        if (field >= FIELDS_COUNT ||
+            isNull_[field] ||
+            IsStringField(field) != isString)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "The returned field is not of the correct type");
+        }
+      }
+
+    public:
+      explicit FindRow(const DatabaseManager::StatementBase& statement)
+      {
+        for (size_t i = 0; i < FIELDS_COUNT; i++)
+        {
+          isNull_[i] = statement.IsNull(i);
+          integers_[i] = 0;
+
+          if (!isNull_[i])
+          {
+            if (IsStringField(i))
+            {
+              strings_[i - C3_STRING_1] = statement.ReadStringReference(i);
+            }
+            else
+            {
+              integers_[i] = statement.ReadInteger64(i);
+            }
+          }
+        }
+      }
+
+      // The JSON array of the fields of one row that was aggregated by the database
+      explicit FindRow(const Json::Value& row)
+      {
+        if (row.type() != Json::arrayValue ||
+            row.size() != FIELDS_COUNT)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Bad aggregated row in ExecuteFind()");
+        }
+
+        for (size_t i = 0; i < FIELDS_COUNT; i++)
+        {
+          const Json::Value& value = row[static_cast<Json::ArrayIndex>(i)];
+
+          isNull_[i] = value.isNull();
+          integers_[i] = 0;
+
+          if (!isNull_[i])
+          {
+            if (IsStringField(i) &&
+                value.type() == Json::stringValue)
+            {
+              strings_[i - C3_STRING_1] = value.asString();
+            }
+            else if (!IsStringField(i) &&
+                     value.isIntegral())
+            {
+              integers_[i] = value.asInt64();
+            }
+            else
+            {
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Bad aggregated row in ExecuteFind()");
+            }
+          }
+        }
+      }
+
+      bool IsNull(size_t field) const
+      {
+        return (field >= FIELDS_COUNT ||
+                isNull_[field]);
+      }
+
+      int64_t ReadInteger64(size_t field) const
+      {
+        CheckField(field, false);
+        return integers_[field];
+      }
+
+      int32_t ReadInteger32(size_t field) const
+      {
+        CheckField(field, false);
+        return static_cast<int32_t>(integers_[field]);
+      }
+
+      const std::string& ReadStringReference(size_t field) const
+      {
+        CheckField(field, true);
+        return strings_[field - C3_STRING_1];
+      }
+    };
+
+
+    /**
+     * Runs some branches of "ExecuteFind()" on a connection that is
+     * borrowed from the pool, in a separate thread and in a separate
+     * read-only transaction. The rows are kept in memory until they
+     * are merged into the answer by the main thread.
+     **/
+    class FindWorker : public boost::noncopyable
+    {
+    private:
+      IndexBackend::IIdleConnections&  connections_;
+      DatabaseManager&                 manager_;
+      std::string                      sql_;
+      std::list<FindRow>               rows_;
+      Orthanc::ErrorCode               error_;
+      boost::thread                    thread_;
+
+      static void Worker(FindWorker* that)
+      {
+        try
+        {
+          that->manager_.StartTransaction(TransactionType_ReadOnly);
+
+          try
+          {
+            that->Execute();
+            that->manager_.CommitTransaction();
+          }
+          catch (...)
+          {
+            that->manager_.RollbackTransaction();
+            throw;
+          }
+
+          that->error_ = Orthanc::ErrorCode_Success;
+        }
+        catch (Orthanc::OrthancException& e)
+        {
+          that->error_ = e.GetErrorCode();
+        }
+        catch (...)
+        {
+          that->error_ = Orthanc::ErrorCode_InternalError;
+        }
+      }
+
+      void Execute()
+      {
+        // Not cached, as the SQL contains the identifiers of the resources
+        DatabaseManager::StandaloneStatement statement(manager_, sql_);
+        statement.SetReadOnly(true);
+        statement.Execute();
+
+        while (!statement.IsDone())
+        {
+          rows_.push_back(FindRow(statement));
+          statement.Next();
+        }
+      }
+
+    public:
+      FindWorker(IndexBackend::IIdleConnections& connections,
+                 DatabaseManager& manager /* borrowed from "connections" */,
+                 const std::string& sql) :
+        connections_(connections),
+        manager_(manager),
+        sql_(sql),
+        error_(Orthanc::ErrorCode_InternalError)
+      {
+        thread_ = boost::thread(Worker, this);
+      }
+
+      ~FindWorker()
+      {
+        Join();
+        connections_.ReleaseIdleConnection(manager_);
+      }
+
+      void Join()
+      {
+        if (thread_.joinable())
+        {
+          thread_.join();
+        }
+      }
+
+      Orthanc::ErrorCode GetError() const
+      {
+        return error_;
+      }
+
+      const std::list<FindRow>& GetRows() const
+      {
+        return rows_;
+      }
+    };
   }
-#endif
 
 
-#if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 5)
-  Orthanc::DatabasePluginMessages::Find_Response_ResourceContent* GetResourceContent(
-                              Orthanc::DatabasePluginMessages::Find_Response* response,
-                              Orthanc::DatabasePluginMessages::ResourceType level)
+  // Reads the JSON array of the rows of one resource (cf. "SetFindJsonAggregation()")
+  static void ReadAggregatedFindRows(Orthanc::DatabasePluginMessages::TransactionResponse& response,
+                                     std::map<int64_t, Orthanc::DatabasePluginMessages::Find_Response*>& responses,
+                                     const Orthanc::DatabasePluginMessages::Find_Request& request,
+                                     IndexBackend::ResponseBudget& budget,
+                                     const std::string& payload)
   {
-    Orthanc::DatabasePluginMessages::Find_Response_ResourceContent* content = NULL;  // the protobuf response will be the owner
-    
-    switch (level)
+    Json::Value rows;
+    if (!Orthanc::Toolbox::ReadJson(rows, payload) ||
+        rows.type() != Json::arrayValue)
     {
-      case Orthanc::DatabasePluginMessages::ResourceType::RESOURCE_PATIENT:
-        content = response->mutable_patient_content();
-        break;
-      case Orthanc::DatabasePluginMessages::ResourceType::RESOURCE_STUDY:
-        content = response->mutable_study_content();
-        break;
-      case Orthanc::DatabasePluginMessages::ResourceType::RESOURCE_SERIES:
-        content =response->mutable_series_content();
-        break;
-      case Orthanc::DatabasePluginMessages::ResourceType::RESOURCE_INSTANCE:
-        content = response->mutable_instance_content();
-        break;
-      default:
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError, "Bad aggregated rows in ExecuteFind()");
+    }
+
+    for (Json::ArrayIndex i = 0; i < rows.size(); i++)
+    {
+      ReadFindRow(response, responses, request, budget, FindRow(rows[i]));
     }
-    return content;
   }
 
-  Orthanc::DatabasePluginMessages::Find_Response_ChildrenContent* GetChildrenContent(
-                              Orthanc::DatabasePluginMessages::Find_Response* response,
-                              Orthanc::DatabasePluginMessages::ResourceType childrenLevel)
+
+  // The aggregate of the columns of the branches of "ExecuteFind()" into a JSON array, as text
+  static std::string FormatFindJsonAggregation(Dialect dialect)
   {
-    Orthanc::DatabasePluginMessages::Find_Response_ChildrenContent* content = NULL;  // the protobuf response will be the owner
-    
-    switch (childrenLevel)
+    static const char* const COLUMNS = ("c0_queryId, c1_internalId, c2_rowNumber, c3_string1, c4_string2, c5_string3, "
+                                        "c6_int1, c7_int2, c8_int3, c9_big_int1, c10_big_int2");
+
+    switch (dialect)
     {
-      case Orthanc::DatabasePluginMessages::ResourceType::RESOURCE_STUDY:
-        content = response->mutable_children_studies_content();
-        break;
-      case Orthanc::DatabasePluginMessages::ResourceType::RESOURCE_SERIES:
-        content =response->mutable_children_series_content();
-        break;
-      case Orthanc::DatabasePluginMessages::ResourceType::RESOURCE_INSTANCE:
-        content = response->mutable_children_instances_content();
-        break;
+      case Dialect_PostgreSQL:
+        return std::string("CAST(json_agg(json_build_array(") + COLUMNS + ") ORDER BY c0_queryId) AS TEXT)";
+
+      case Dialect_MySQL:
+        // JSON_ARRAYAGG() has no ORDER BY, which doesn't matter as the rows of one resource can be read in any order
+        return std::string("CAST(JSON_ARRAYAGG(JSON_ARRAY(") + COLUMNS + ")) AS CHAR)";
+
       default:
         throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
     }
-    return content;
   }
 
-  std::string JoinRequestedMetadata(const Orthanc::DatabasePluginMessages::Find_Request_ChildrenSpecification* childrenSpec)
+
+  void IndexBackend::ExecuteFindBranches(Orthanc::DatabasePluginMessages::TransactionResponse& response,
+                                         std::map<int64_t, Orthanc::DatabasePluginMessages::Find_Response*>& responses,
+                                         DatabaseManager& manager,
+                                         const Orthanc::DatabasePluginMessages::Find_Request& request,
+                                         const std::string& oneInstanceCTEs,
+                                         const std::vector<std::string>& branches,
+                                         bool parallel,
+                                         ResponseBudget& budget)
   {
-    std::set<std::string> metadataTypes;
-    for (int i = 0; i < childrenSpec->retrieve_metadata_size(); ++i)
+    assert(!parallel || idleConnections_ != NULL);
+    assert(branches.size() > 1);
+
+    // The lookup CTE is replaced by the resources it has selected
+    std::string ids;
+    for (std::map<int64_t, Orthanc::DatabasePluginMessages::Find_Response*>::const_iterator
+           it = responses.begin(); it != responses.end(); ++it)
     {
-      metadataTypes.insert(boost::lexical_cast<std::string>(childrenSpec->retrieve_metadata(i)));
+      if (!ids.empty())
+      {
+        ids += ", ";
+      }
+
+      ids += boost::lexical_cast<std::string>(it->first);
+    }
+
+    const std::string ctes = ("WITH Lookup AS (SELECT internalId, publicId FROM Resources WHERE internalId IN (" +
+                              ids + ")) " + oneInstanceCTEs);
+
+    // This connection runs one group of branches, the idle connections the other ones
+    const size_t maxWorkers = (parallel ? std::min(findParallelism_, branches.size() - 2) : 0);
+
+    std::vector<DatabaseManager*> connections;
+    connections.reserve(maxWorkers);
+
+    while (connections.size() < maxWorkers)
+    {
+      DatabaseManager* connection = idleConnections_->TryAcquireIdleConnection();
+      if (connection == NULL)
+      {
+        break;
+      }
+      else
+      {
+        connections.push_back(connection);
+      }
+    }
+
+    std::vector<std::string> groups(connections.size() + 1);
+    for (size_t i = 1; i < branches.size(); i++)
+    {
+      std::string& group = groups[(i - 1) % groups.size()];
+
+      if (!group.empty())
+      {
+        group += " UNION ALL ";
+      }
+
+      group += branches[i];
     }
-    std::string joinedMetadataTypes;
-    Orthanc::Toolbox::JoinStrings(joinedMetadataTypes, metadataTypes, ", ");
 
-    return joinedMetadataTypes;
-  }
+    std::vector<FindWorker*> workers;
+    workers.reserve(connections.size());
 
-  std::string JoinRequestedTags(const Orthanc::DatabasePluginMessages::Find_Request_ChildrenSpecification* childrenSpec)
-  {
-    std::set<std::string> tags;
-    for (int i = 0; i < childrenSpec->retrieve_main_dicom_tags_size(); ++i)
+    try
     {
-      tags.insert("(" + boost::lexical_cast<std::string>(childrenSpec->retrieve_main_dicom_tags(i).group()) 
-                  + ", " + boost::lexical_cast<std::string>(childrenSpec->retrieve_main_dicom_tags(i).element()) + ")");
-    }
-    std::string joinedTags;
-    Orthanc::Toolbox::JoinStrings(joinedTags, tags, ", ");
+      for (size_t i = 0; i < connections.size(); i++)
+      {
+        workers.push_back(new FindWorker(*idleConnections_, *connections[i], ctes + groups[i + 1]));
+      }
 
-    return joinedTags;
-  }
+      {
+        DatabaseManager::StandaloneStatement statement(manager, ctes + groups[0]);
+        statement.SetReadOnly(true);
+        statement.Execute();
 
+        while (!statement.IsDone())
+        {
+          ReadFindRow(response, responses, request, budget, statement);
+          statement.Next();
+        }
+      }
 
-#define C0_QUERY_ID 0
-#define C1_INTERNAL_ID 1
-#define C2_ROW_NUMBER 2
-#define C3_STRING_1 3
-#define C4_STRING_2 4
-#define C5_STRING_3 5
-#define C6_INT_1 6
-#define C7_INT_2 7
-#define C8_INT_3 8
-#define C9_BIG_INT_1 9
-#define C10_BIG_INT_2 10
+      for (size_t i = 0; i < workers.size(); i++)
+      {
+        workers[i]->Join();
 
-#define QUERY_LOOKUP 1
-#define QUERY_MAIN_DICOM_TAGS 2
-#define QUERY_ATTACHMENTS 3
-#define QUERY_METADATA 4
-#define QUERY_LABELS 5
-#define QUERY_PARENT_MAIN_DICOM_TAGS 10
-#define QUERY_PARENT_IDENTIFIER 11
-#define QUERY_PARENT_METADATA 12
-#define QUERY_GRAND_PARENT_MAIN_DICOM_TAGS 15
-#define QUERY_GRAND_PARENT_METADATA 16
-#define QUERY_CHILDREN_IDENTIFIERS 20
-#define QUERY_CHILDREN_MAIN_DICOM_TAGS 21
-#define QUERY_CHILDREN_METADATA 22
-#define QUERY_CHILDREN_COUNT 23
-#define QUERY_GRAND_CHILDREN_IDENTIFIERS 30
-#define QUERY_GRAND_CHILDREN_MAIN_DICOM_TAGS 31
-#define QUERY_GRAND_CHILDREN_METADATA 32
-#define QUERY_GRAND_CHILDREN_COUNT 33
-#define QUERY_GRAND_GRAND_CHILDREN_IDENTIFIERS 40
-#define QUERY_GRAND_GRAND_CHILDREN_COUNT 41
-#define QUERY_ONE_INSTANCE_IDENTIFIER 50
-#define QUERY_ONE_INSTANCE_METADATA 51
-#define QUERY_ONE_INSTANCE_ATTACHMENTS 52
+        if (workers[i]->GetError() != Orthanc::ErrorCode_Success)
+        {
+          throw Orthanc::OrthancException(workers[i]->GetError());
+        }
 
-#define STRINGIFY(x) #x
-#define TOSTRING(x) STRINGIFY(x)
+        const std::list<FindRow>& rows = workers[i]->GetRows();
+        for (std::list<FindRow>::const_iterator it = rows.begin(); it != rows.end(); ++it)
+        {
+          // The resource may have been deleted since the lookup
+          if (responses.find(it->ReadInteger64(C1_INTERNAL_ID)) != responses.end())
+          {
+            ReadFindRow(response, responses, request, budget, *it);
+          }
+        }
+      }
+    }
+    catch (...)
+    {
+      // The workers give back their connection to the pool
+      for (size_t i = 0; i < workers.size(); i++)
+      {
+        delete workers[i];
+      }
 
-  void IndexBackend::ExecuteCount(Orthanc::DatabasePluginMessages::TransactionResponse& response,
-                                  DatabaseManager& manager,
-                                  const Orthanc::DatabasePluginMessages::Find_Request& request)
-  {
-    std::string sql;
+      for (size_t i = workers.size(); i < connections.size(); i++)
+      {
+        idleConnections_->ReleaseIdleConnection(*connections[i]);
+      }
 
-    LookupFormatter formatter(manager.GetDialect());
-    std::string lookupSql;
-    ISqlLookupFormatter::Apply(lookupSql, formatter, request);
+      throw;
+    }
 
-    sql = "WITH Lookup AS (" + lookupSql + ") SELECT COUNT(*) FROM Lookup";
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+      delete workers[i];
+    }
+  }
 
-    DatabaseManager::CachedStatement statement(STATEMENT_FROM_HERE_DYNAMIC(sql), manager, sql);
-    statement.Execute(formatter.GetDictionary());
-    response.mutable_count_resources()->set_count(statement.ReadInteger64(0));
+
+  static void AppendFindProjectionFlag(std::string& shape,
+                                       bool flag)
+  {
+    shape.push_back(flag ? '1' : '0');
   }
 
-  void IndexBackend::ExecuteFind(Orthanc::DatabasePluginMessages::TransactionResponse& response,
-                                    DatabaseManager& manager,
-                                    const Orthanc::DatabasePluginMessages::Find_Request& request)
+
+  static std::string GetFindProjectionShape(Dialect dialect,
+                                            bool hasRevisions,
+                                            bool hasResourceSummary,
+                                            bool hasChildCountTable,
+                                            const Orthanc::DatabasePluginMessages::Find_Request& request)
   {
-    // TODO-FIND move to child plugins ?
+    // All the fields of the request that are read by "FormatFindProjection()"
+    std::string shape = boost::lexical_cast<std::string>(static_cast<int>(dialect)) + "|" +
+      boost::lexical_cast<std::string>(static_cast<int>(request.level())) + "|";
+
+    AppendFindProjectionFlag(shape, hasRevisions);
+    AppendFindProjectionFlag(shape, hasResourceSummary);
+    AppendFindProjectionFlag(shape, hasChildCountTable);
+    AppendFindProjectionFlag(shape, request.retrieve_main_dicom_tags());
+    AppendFindProjectionFlag(shape, request.retrieve_metadata());
+    AppendFindProjectionFlag(shape, request.retrieve_attachments());
+    AppendFindProjectionFlag(shape, request.retrieve_labels());
+    AppendFindProjectionFlag(shape, request.retrieve_parent_identifier());
+    AppendFindProjectionFlag(shape, request.retrieve_one_instance_metadata_and_attachments());
+    AppendFindProjectionFlag(shape, request.parent_patient().retrieve_main_dicom_tags());
+    AppendFindProjectionFlag(shape, request.parent_patient().retrieve_metadata());
+    AppendFindProjectionFlag(shape, request.parent_study().retrieve_main_dicom_tags());
+    AppendFindProjectionFlag(shape, request.parent_study().retrieve_metadata());
+    AppendFindProjectionFlag(shape, request.parent_series().retrieve_main_dicom_tags());
+    AppendFindProjectionFlag(shape, request.parent_series().retrieve_metadata());
+
+    const Orthanc::DatabasePluginMessages::Find_Request_ChildrenSpecification* children[] = {
+      &request.children_studies(),
+      &request.children_series(),
+      &request.children_instances()
+    };
+
+    for (size_t i = 0; i < sizeof(children) / sizeof(children[0]); i++)
+    {
+      shape += "|";
+      AppendFindProjectionFlag(shape, children[i]->retrieve_identifiers());
+      AppendFindProjectionFlag(shape, children[i]->retrieve_count());
 
+      if (children[i]->retrieve_main_dicom_tags_size() > 0)
+      {
+        shape += JoinRequestedTags(children[i]);
+      }
 
-    // If we want the Find to use a read-only transaction, we can not create temporary tables with
-    // the lookup results.  So we must use a CTE (Common Table Expression).  
-    // However, a CTE can only be used in a single query -> we must unionize all the following 
-    // queries to retrieve values from various tables.
-    // However, to use UNION, all tables must have the same columns (numbers and types).  That's
-    // why we have generic column names.
-    // So, at the end we'll have only one very big query !
+      shape += "|";
 
-    std::string sql;
+      if (children[i]->retrieve_metadata_size() > 0)
+      {
+        shape += JoinRequestedMetadata(children[i]);
+      }
+    }
 
-    // extract the resource id of interest by executing the lookup in a CTE
-    LookupFormatter formatter(manager.GetDialect());
-    std::string lookupSqlCTE;
-    ISqlLookupFormatter::Apply(lookupSqlCTE, formatter, request);
+    return shape;
+  }
 
-    // base query, retrieve the ordered internalId and publicId of the selected resources
-    sql = "WITH Lookup AS (" + lookupSqlCTE + ") ";
 
+  void IndexBackend::FormatFindProjection(FindProjectionsCache::Projection& target,
+                                          LookupFormatter& formatter,
+                                          const Orthanc::DatabasePluginMessages::Find_Request& request)
+  {
     std::string oneInstanceSqlCTE;
+    std::string& oneInstanceCTEs = target.oneInstanceCTEs_;
+    std::vector<std::string>& branches = target.branches_;  // The "SELECT" that are unionized, the lookup being the first one
+
+    oneInstanceCTEs.clear();
+    branches.clear();
 
     if (request.level() != Orthanc::DatabasePluginMessages::ResourceType::RESOURCE_INSTANCE &&
         request.retrieve_one_instance_metadata_and_attachments())
@@ -3303,8 +7184,8 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
         default:
           throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
       }
-      sql += ", _OneInstance AS (" + oneInstanceSqlCTE + ") ";
-      sql += ", OneInstance AS (SELECT parentInternalId, instancePublicId, instanceInternalId FROM _OneInstance WHERE rowNum = 1) ";  // this is a generic way to implement DISTINCT ON
+      oneInstanceCTEs = ", _OneInstance AS (" + oneInstanceSqlCTE + ") ";
+      oneInstanceCTEs += ", OneInstance AS (SELECT parentInternalId, instancePublicId, instanceInternalId FROM _OneInstance WHERE rowNum = 1) ";  // this is a generic way to implement DISTINCT ON
     }
 
     // if (!oneInstanceSqlCTE.empty() && (manager.GetDialect() == Dialect_MySQL || manager.GetDialect() == Dialect_SQLite))
@@ -3322,7 +7203,7 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
     }
 
 
-    sql += " SELECT "
+    branches.push_back("SELECT "
           "  " TOSTRING(QUERY_LOOKUP) " AS c0_queryId, "
           "  Lookup.internalId AS c1_internalId, "
           "  Lookup.rowNumber AS c2_rowNumber, "
@@ -3334,12 +7215,34 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
           "  " + formatter.FormatNull("INT") + " AS c8_int3, "
           "  " + formatter.FormatNull("BIGINT") + " AS c9_big_int1, "
           "  " + formatter.FormatNull("BIGINT") + " AS c10_big_int2 "
-          "  FROM Lookup ";
+          "  FROM Lookup ");
+
+    const bool useResourceSummary = (HasResourceSummary() &&
+                                     (request.retrieve_main_dicom_tags() || request.retrieve_metadata()));
+
+    if (useResourceSummary)
+    {
+      // a single indexed read per resource instead of the 2 queries below
+      branches.push_back("SELECT "
+             "  " TOSTRING(QUERY_RESOURCE_SUMMARY) " AS c0_queryId, "
+             "  Lookup.internalId AS c1_internalId, "
+             "  " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
+             "  content AS c3_string1, "
+             "  " + formatter.FormatNull("TEXT") + " AS c4_string2, "
+             "  " + formatter.FormatNull("TEXT") + " AS c5_string3, "
+             "  " + formatter.FormatNull("INT") + " AS c6_int1, "
+             "  " + formatter.FormatNull("INT") + " AS c7_int2, "
+             "  " + formatter.FormatNull("INT") + " AS c8_int3, "
+             "  " + formatter.FormatNull("BIGINT") + " AS c9_big_int1, "
+             "  " + formatter.FormatNull("BIGINT") + " AS c10_big_int2 "
+             "FROM Lookup "
+             "INNER JOIN ResourceSummary ON ResourceSummary.id = Lookup.internalId ");
+    }
 
     // need MainDicomTags from resource ?
-    if (request.retrieve_main_dicom_tags())
+    if (request.retrieve_main_dicom_tags() && !useResourceSummary)
     {
-      sql += "UNION ALL SELECT "
+      branches.push_back("SELECT "
              "  " TOSTRING(QUERY_MAIN_DICOM_TAGS) " AS c0_queryId, "
              "  Lookup.internalId AS c1_internalId, "
              "  " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
@@ -3352,13 +7255,13 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
              "  " + formatter.FormatNull("BIGINT") + " AS c9_big_int1, "
              "  " + formatter.FormatNull("BIGINT") + " AS c10_big_int2 "
              "FROM Lookup "
-             "INNER JOIN MainDicomTags ON MainDicomTags.id = Lookup.internalId ";
+             "INNER JOIN MainDicomTags ON MainDicomTags.id = Lookup.internalId ");
     }
     
     // need resource metadata ?
-    if (request.retrieve_metadata())
+    if (request.retrieve_metadata() && !useResourceSummary)
     {
-      sql += "UNION ALL SELECT "
+      branches.push_back("SELECT "
              "  " TOSTRING(QUERY_METADATA) " AS c0_queryId, "
              "  Lookup.internalId AS c1_internalId, "
              "  " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
@@ -3371,13 +7274,13 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
              "  " + formatter.FormatNull("BIGINT") + " AS c9_big_int1, "
              "  " + formatter.FormatNull("BIGINT") + " AS c10_big_int2 "
              "FROM Lookup "
-             "INNER JOIN Metadata ON Metadata.id = Lookup.internalId ";
+             "INNER JOIN Metadata ON Metadata.id = Lookup.internalId ");
     }
 
     // need resource attachments ?
     if (request.retrieve_attachments())
     {
-      sql += "UNION ALL SELECT "
+      branches.push_back("SELECT "
              "  " TOSTRING(QUERY_ATTACHMENTS) " AS c0_queryId, "
              "  Lookup.internalId AS c1_internalId, "
              "  " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
@@ -3390,13 +7293,13 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
              "  compressedSize AS c9_big_int1, "
              "  uncompressedSize AS c10_big_int2 "
              "FROM Lookup "
-             "INNER JOIN AttachedFiles ON AttachedFiles.id = Lookup.internalId ";
+             "INNER JOIN AttachedFiles ON AttachedFiles.id = Lookup.internalId ");
     }
 
     // need resource labels ?
     if (request.retrieve_labels())
     {
-      sql += "UNION ALL SELECT "
+      branches.push_back("SELECT "
              "  " TOSTRING(QUERY_LABELS) " AS c0_queryId, "
              "  Lookup.internalId AS c1_internalId, "
              "  " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
@@ -3409,7 +7312,7 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
              "  " + formatter.FormatNull("BIGINT") + " AS c9_big_int1, "
              "  " + formatter.FormatNull("BIGINT") + " AS c10_big_int2 "
              "FROM Lookup "
-             "INNER JOIN Labels ON Labels.id = Lookup.internalId ";
+             "INNER JOIN Labels ON Labels.id = Lookup.internalId ");
     }
 
     // need MainDicomTags from parent ?
@@ -3434,7 +7337,7 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
 
       if (parentSpec->retrieve_main_dicom_tags())
       {
-        sql += "UNION ALL SELECT "
+        branches.push_back("SELECT "
                "  " TOSTRING(QUERY_PARENT_MAIN_DICOM_TAGS) " AS c0_queryId, "
                "  Lookup.internalId AS c1_internalId, "
                "  " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
@@ -3448,12 +7351,12 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
                "  " + formatter.FormatNull("BIGINT") + " AS c10_big_int2 "
                "FROM Lookup "
                "INNER JOIN Resources currentLevel ON Lookup.internalId = currentLevel.internalId "
-               "INNER JOIN MainDicomTags ON MainDicomTags.id = currentLevel.parentId ";
+               "INNER JOIN MainDicomTags ON MainDicomTags.id = currentLevel.parentId ");
       }
 
       if (parentSpec->retrieve_metadata())
       {
-        sql += "UNION ALL SELECT "
+        branches.push_back("SELECT "
                "  " TOSTRING(QUERY_PARENT_METADATA) " AS c0_queryId, "
                "  Lookup.internalId AS c1_internalId, "
                "  " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
@@ -3467,7 +7370,7 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
                "  " + formatter.FormatNull("BIGINT") + " AS c10_big_int2 "
                "FROM Lookup "
                "INNER JOIN Resources currentLevel ON Lookup.internalId = currentLevel.internalId "
-               "INNER JOIN Metadata ON Metadata.id = currentLevel.parentId ";
+               "INNER JOIN Metadata ON Metadata.id = currentLevel.parentId ");
       }
 
       // need MainDicomTags from grandparent ?
@@ -3489,7 +7392,7 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
 
         if (grandparentSpec->retrieve_main_dicom_tags())
         {
-          sql += "UNION ALL SELECT "
+          branches.push_back("SELECT "
                "  " TOSTRING(QUERY_GRAND_PARENT_MAIN_DICOM_TAGS) " AS c0_queryId, "
                "  Lookup.internalId AS c1_internalId, "
                "  " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
@@ -3504,12 +7407,12 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
                "FROM Lookup "
                "INNER JOIN Resources currentLevel ON Lookup.internalId = currentLevel.internalId "
                "INNER JOIN Resources parentLevel ON currentLevel.parentId = parentLevel.internalId "
-               "INNER JOIN MainDicomTags ON MainDicomTags.id = parentLevel.parentId ";
+               "INNER JOIN MainDicomTags ON MainDicomTags.id = parentLevel.parentId ");
         }
 
         if (grandparentSpec->retrieve_metadata())
         {
-          sql += "UNION ALL SELECT "
+          branches.push_back("SELECT "
                 "  " TOSTRING(QUERY_GRAND_PARENT_METADATA) " AS c0_queryId, "
                 "  Lookup.internalId AS c1_internalId, "
                 "  " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
@@ -3524,7 +7427,7 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
                 "FROM Lookup "
                 "INNER JOIN Resources currentLevel ON Lookup.internalId = currentLevel.internalId "
                 "INNER JOIN Resources parentLevel ON currentLevel.parentId = parentLevel.internalId "
-                "INNER JOIN Metadata ON Metadata.id = parentLevel.parentId ";
+                "INNER JOIN Metadata ON Metadata.id = parentLevel.parentId ");
         }
       }
     }
@@ -3551,7 +7454,7 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
 
       if (childrenSpec->retrieve_main_dicom_tags_size() > 0)
       {
-        sql += "UNION ALL SELECT "
+        branches.push_back("SELECT "
                "  " TOSTRING(QUERY_CHILDREN_MAIN_DICOM_TAGS) " AS c0_queryId, "
                "  Lookup.internalId AS c1_internalId, "
                "  " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
@@ -3565,13 +7468,13 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
                "  " + formatter.FormatNull("BIGINT") + " AS c10_big_int2 "
                "FROM Lookup "
                "  INNER JOIN Resources childLevel ON childLevel.parentId = Lookup.internalId "
-               "  INNER JOIN MainDicomTags ON MainDicomTags.id = childLevel.internalId AND (tagGroup, tagElement) IN (" + JoinRequestedTags(childrenSpec) + ")";
+               "  INNER JOIN MainDicomTags ON MainDicomTags.id = childLevel.internalId AND (tagGroup, tagElement) IN (" + JoinRequestedTags(childrenSpec) + ")");
       }
 
       // need children identifiers ?
       if (childrenSpec->retrieve_identifiers())  
       {
-        sql += "UNION ALL SELECT "
+        branches.push_back("SELECT "
                "  " TOSTRING(QUERY_CHILDREN_IDENTIFIERS) " AS c0_queryId, "
                "  Lookup.internalId AS c1_internalId, "
                "  " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
@@ -3584,7 +7487,7 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
                "  " + formatter.FormatNull("BIGINT") + " AS c9_big_int1, "
                "  " + formatter.FormatNull("BIGINT") + " AS c10_big_int2 "
                "FROM Lookup "
-               "  INNER JOIN Resources childLevel ON Lookup.internalId = childLevel.parentId ";
+               "  INNER JOIN Resources childLevel ON Lookup.internalId = childLevel.parentId ");
       }
       else if (childrenSpec->retrieve_count())  // no need to count if we have retrieved the list of identifiers
       {
@@ -3611,8 +7514,9 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
           //       "FROM Lookup "
           //       "LEFT JOIN ChildCount ON Lookup.internalId = ChildCount.parentId ";
 
-          // we get the count value either from the childCount column if it has been computed or from the Resources table
-          sql += "UNION ALL SELECT "
+          // we get the count value either from the childCount column if it has been computed (plus the
+          // pending changes that are not folded yet by the housekeeping) or from the Resources table
+          branches.push_back("SELECT "
                 "  " TOSTRING(QUERY_CHILDREN_COUNT) " AS c0_queryId, "
                 "  Lookup.internalId AS c1_internalId, "
                 "  " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
@@ -3623,18 +7527,19 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
                 "  " + formatter.FormatNull("INT") + " AS c7_int2, "
                 "  " + formatter.FormatNull("INT") + " AS c8_int3, "
                 "  COALESCE("
-                "           (Resources.childCount),"
+                "           (Resources.childCount + (SELECT COALESCE(SUM(delta), 0) FROM ChildCountChanges"
+                "                                    WHERE ChildCountChanges.parentId = Resources.internalId)),"
                 "        		(SELECT COUNT(childLevel.internalId)"
                 "            FROM Resources AS childLevel"
                 "            WHERE Lookup.internalId = childLevel.parentId"
                 "           )) AS c9_big_int1, "
                 "  " + formatter.FormatNull("BIGINT") + " AS c10_big_int2 "
                 "FROM Lookup "
-                "LEFT JOIN Resources ON Lookup.internalId = Resources.internalId ";
+                "LEFT JOIN Resources ON Lookup.internalId = Resources.internalId ");
         }
         else
         {
-          sql += "UNION ALL SELECT "
+          branches.push_back("SELECT "
                 "  " TOSTRING(QUERY_CHILDREN_COUNT) " AS c0_queryId, "
                 "  Lookup.internalId AS c1_internalId, "
                 "  " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
@@ -3647,13 +7552,13 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
                 "  COUNT(childLevel.internalId) AS c9_big_int1, "
                 "  " + formatter.FormatNull("BIGINT") + " AS c10_big_int2 "
                 "FROM Lookup "
-                "  INNER JOIN Resources childLevel ON Lookup.internalId = childLevel.parentId GROUP BY Lookup.internalId ";
+                "  INNER JOIN Resources childLevel ON Lookup.internalId = childLevel.parentId GROUP BY Lookup.internalId ");
         }
       }
 
       if (childrenSpec->retrieve_metadata_size() > 0)
       {
-        sql += "UNION ALL SELECT "
+        branches.push_back("SELECT "
                 "  " TOSTRING(QUERY_CHILDREN_METADATA) " AS c0_queryId, "
                 "  Lookup.internalId AS c1_internalId, "
                 "  " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
@@ -3667,7 +7572,7 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
                 "  " + formatter.FormatNull("BIGINT") + " AS c10_big_int2 "
                 "FROM Lookup "
                 "  INNER JOIN Resources childLevel ON childLevel.parentId = Lookup.internalId "
-                "  INNER JOIN Metadata ON Metadata.id = childLevel.internalId AND Metadata.type IN (" + JoinRequestedMetadata(childrenSpec) + ") ";
+                "  INNER JOIN Metadata ON Metadata.id = childLevel.internalId AND Metadata.type IN (" + JoinRequestedMetadata(childrenSpec) + ") ");
       }
 
       if (request.level() <= Orthanc::DatabasePluginMessages::ResourceType::RESOURCE_STUDY)
@@ -3689,7 +7594,7 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
         // need grand children identifiers ?
         if (grandchildrenSpec->retrieve_identifiers())  
         {
-          sql += "UNION ALL SELECT "
+          branches.push_back("SELECT "
                 "  " TOSTRING(QUERY_GRAND_CHILDREN_IDENTIFIERS) " AS c0_queryId, "
                 "  Lookup.internalId AS c1_internalId, "
                 "  " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
@@ -3703,7 +7608,7 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
                 "  " + formatter.FormatNull("BIGINT") + " AS c10_big_int2 "
                 "FROM Lookup "
                 "INNER JOIN Resources childLevel ON Lookup.internalId = childLevel.parentId "
-                "INNER JOIN Resources grandChildLevel ON childLevel.internalId = grandChildLevel.parentId ";
+                "INNER JOIN Resources grandChildLevel ON childLevel.internalId = grandChildLevel.parentId ");
         }
         else if (grandchildrenSpec->retrieve_count())  // no need to count if we have retrieved the list of identifiers
         {
@@ -3734,7 +7639,7 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
             //       "FROM Lookup ";
 
             // we get the count value either from the childCount column if it has been computed or from the Resources table
-            sql += "UNION ALL SELECT "
+            branches.push_back("SELECT "
                   "  " TOSTRING(QUERY_GRAND_CHILDREN_COUNT) " AS c0_queryId, "
                   "  Lookup.internalId AS c1_internalId, "
                   "  " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
@@ -3745,7 +7650,8 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
                   "  " + formatter.FormatNull("INT") + " AS c7_int2, "
                   "  " + formatter.FormatNull("INT") + " AS c8_int3, "
                   "  COALESCE("
-		              "           (SELECT SUM(childLevel.childCount)"
+		              "           (SELECT SUM(childLevel.childCount + (SELECT COALESCE(SUM(delta), 0) FROM ChildCountChanges"
+		              "                                                WHERE ChildCountChanges.parentId = childLevel.internalId))"
 		              "            FROM Resources AS childLevel"
                   "            WHERE childLevel.parentId = Lookup.internalId),"
                   "        		(SELECT COUNT(grandChildLevel.internalId)"
@@ -3754,11 +7660,11 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
                   "            WHERE Lookup.internalId = childLevel.parentId"
                   "           )) AS c9_big_int1, "
                   "  " + formatter.FormatNull("BIGINT") + " AS c10_big_int2 "
-                  "FROM Lookup ";
+                  "FROM Lookup ");
           }
           else
           {
-            sql += "UNION ALL SELECT "
+            branches.push_back("SELECT "
                   "  " TOSTRING(QUERY_GRAND_CHILDREN_COUNT) " AS c0_queryId, "
                   "  Lookup.internalId AS c1_internalId, "
                   "  " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
@@ -3772,13 +7678,13 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
                   "  " + formatter.FormatNull("BIGINT") + " AS c10_big_int2 "
                   "FROM Lookup "
                   "  INNER JOIN Resources childLevel ON Lookup.internalId = childLevel.parentId "
-                  "  INNER JOIN Resources grandChildLevel ON childLevel.internalId = grandChildLevel.parentId GROUP BY Lookup.internalId ";
+                  "  INNER JOIN Resources grandChildLevel ON childLevel.internalId = grandChildLevel.parentId GROUP BY Lookup.internalId ");
           }
         }
 
         if (grandchildrenSpec->retrieve_main_dicom_tags_size() > 0)
         {
-          sql += "UNION ALL SELECT "
+          branches.push_back("SELECT "
                  "  " TOSTRING(QUERY_GRAND_CHILDREN_MAIN_DICOM_TAGS) " AS c0_queryId, "
                  "  Lookup.internalId AS c1_internalId, "
                  "  " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
@@ -3793,12 +7699,12 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
                  "FROM Lookup "
                  "  INNER JOIN Resources childLevel ON childLevel.parentId = Lookup.internalId "
                  "  INNER JOIN Resources grandChildLevel ON grandChildLevel.parentId = childLevel.internalId "
-                 "  INNER JOIN MainDicomTags ON MainDicomTags.id = grandChildLevel.internalId AND (tagGroup, tagElement) IN (" + JoinRequestedTags(grandchildrenSpec) + ")";
+                 "  INNER JOIN MainDicomTags ON MainDicomTags.id = grandChildLevel.internalId AND (tagGroup, tagElement) IN (" + JoinRequestedTags(grandchildrenSpec) + ")");
         }
 
         if (grandchildrenSpec->retrieve_metadata_size() > 0)
         {
-          sql += "UNION ALL SELECT "
+          branches.push_back("SELECT "
                  "  " TOSTRING(QUERY_GRAND_CHILDREN_METADATA) " AS c0_queryId, "
                  "  Lookup.internalId AS c1_internalId, "
                  "  " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
@@ -3813,7 +7719,7 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
                  "FROM Lookup "
                  "  INNER JOIN Resources childLevel ON childLevel.parentId = Lookup.internalId "
                  "  INNER JOIN Resources grandChildLevel ON grandChildLevel.parentId = childLevel.internalId "
-                 "  INNER JOIN Metadata ON Metadata.id = grandChildLevel.internalId AND Metadata.type IN (" + JoinRequestedMetadata(grandchildrenSpec) + ") ";
+                 "  INNER JOIN Metadata ON Metadata.id = grandChildLevel.internalId AND Metadata.type IN (" + JoinRequestedMetadata(grandchildrenSpec) + ") ");
         }
 
         if (request.level() == Orthanc::DatabasePluginMessages::ResourceType::RESOURCE_PATIENT)
@@ -3823,7 +7729,7 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
           // need grand children identifiers ?
           if (grandgrandchildrenSpec->retrieve_identifiers())  
           {
-            sql += "UNION ALL SELECT "
+            branches.push_back("SELECT "
                   "  " TOSTRING(QUERY_GRAND_GRAND_CHILDREN_IDENTIFIERS) " AS c0_queryId, "
                   "  Lookup.internalId AS c1_internalId, "
                   "  " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
@@ -3838,7 +7744,7 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
                   "FROM Lookup "
                   "INNER JOIN Resources childLevel ON Lookup.internalId = childLevel.parentId "
                   "INNER JOIN Resources grandChildLevel ON childLevel.internalId = grandChildLevel.parentId "
-                  "INNER JOIN Resources grandGrandChildLevel ON grandChildLevel.internalId = grandGrandChildLevel.parentId ";
+                  "INNER JOIN Resources grandGrandChildLevel ON grandChildLevel.internalId = grandGrandChildLevel.parentId ");
           }
           else if (grandgrandchildrenSpec->retrieve_count())  // no need to count if we have retrieved the list of identifiers
           {
@@ -3871,7 +7777,7 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
               //       "FROM Lookup ";
 
               // we get the count value either from the childCount column if it has been computed or from the Resources table
-              sql += "UNION ALL SELECT "
+              branches.push_back("SELECT "
                     "  " TOSTRING(QUERY_GRAND_GRAND_CHILDREN_COUNT) " AS c0_queryId, "
                     "  Lookup.internalId AS c1_internalId, "
                     "  " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
@@ -3882,7 +7788,8 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
                     "  " + formatter.FormatNull("INT") + " AS c7_int2, "
                     "  " + formatter.FormatNull("INT") + " AS c8_int3, "
                     "  COALESCE("
-                    "           (SELECT SUM(grandChildLevel.childCount)"
+                    "           (SELECT SUM(grandChildLevel.childCount + (SELECT COALESCE(SUM(delta), 0) FROM ChildCountChanges"
+                    "                                                       WHERE ChildCountChanges.parentId = grandChildLevel.internalId))"
                     "            FROM Resources AS grandChildLevel"
                     "            INNER JOIN Resources AS childLevel ON childLevel.parentId = Lookup.internalId"
                     "            WHERE grandChildLevel.parentId = childLevel.internalId),"
@@ -3893,11 +7800,11 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
                     "            WHERE Lookup.internalId = childLevel.parentId"
                     "           )) AS c9_big_int1, "
                     "  " + formatter.FormatNull("BIGINT") + " AS c10_big_int2 "
-                    "FROM Lookup ";
+                    "FROM Lookup ");
             }
             else
             {
-              sql += "UNION ALL SELECT "
+              branches.push_back("SELECT "
                     "  " TOSTRING(QUERY_GRAND_GRAND_CHILDREN_COUNT) " AS c0_queryId, "
                     "  Lookup.internalId AS c1_internalId, "
                     "  " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
@@ -3912,86 +7819,255 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
                     "FROM Lookup "
                     "INNER JOIN Resources childLevel ON Lookup.internalId = childLevel.parentId "
                     "INNER JOIN Resources grandChildLevel ON childLevel.internalId = grandChildLevel.parentId "
-                    "INNER JOIN Resources grandGrandChildLevel ON grandChildLevel.internalId = grandGrandChildLevel.parentId GROUP BY Lookup.internalId ";
+                    "INNER JOIN Resources grandGrandChildLevel ON grandChildLevel.internalId = grandGrandChildLevel.parentId GROUP BY Lookup.internalId ");
             }
           }
         }
       }
-    }
+    }
+
+    // need parent identifier ?
+    if (request.retrieve_parent_identifier())
+    {
+      branches.push_back("SELECT "
+             "  " TOSTRING(QUERY_PARENT_IDENTIFIER) " AS c0_queryId, "
+             "  Lookup.internalId AS c1_internalId, "
+             "  " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
+             "  parentLevel.publicId AS c3_string1, "
+             "  " + formatter.FormatNull("TEXT") + " AS c4_string2, "
+             "  " + formatter.FormatNull("TEXT") + " AS c5_string3, "
+             "  " + formatter.FormatNull("INT") + " AS c6_int1, "
+             "  " + formatter.FormatNull("INT") + " AS c7_int2, "
+             "  " + formatter.FormatNull("INT") + " AS c8_int3, "
+             "  " + formatter.FormatNull("BIGINT") + " AS c9_big_int1, "
+             "  " + formatter.FormatNull("BIGINT") + " AS c10_big_int2 "
+             "FROM Lookup "
+             "  INNER JOIN Resources currentLevel ON currentLevel.internalId = Lookup.internalId "
+             "  INNER JOIN Resources parentLevel ON currentLevel.parentId = parentLevel.internalId ");
+    }
+
+    // need one instance info ?
+    if (request.level() != Orthanc::DatabasePluginMessages::ResourceType::RESOURCE_INSTANCE &&
+        request.retrieve_one_instance_metadata_and_attachments())
+    {
+      branches.push_back("SELECT "
+             "    " TOSTRING(QUERY_ONE_INSTANCE_IDENTIFIER) " AS c0_queryId, "
+             "    parentInternalId AS c1_internalId, "
+             "    " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
+             "    instancePublicId AS c3_string1, "
+             "    " + formatter.FormatNull("TEXT") + " AS c4_string2, "
+             "    " + formatter.FormatNull("TEXT") + " AS c5_string3, "
+             "    " + formatter.FormatNull("INT") + " AS c6_int1, "
+             "    " + formatter.FormatNull("INT") + " AS c7_int2, "
+             "  " + formatter.FormatNull("INT") + " AS c8_int3, "
+             "    instanceInternalId AS c9_big_int1, "
+             "    " + formatter.FormatNull("BIGINT") + " AS c10_big_int2 "
+             "   FROM OneInstance ");
+
+      branches.push_back("SELECT "
+             "    " TOSTRING(QUERY_ONE_INSTANCE_METADATA) " AS c0_queryId, "
+             "    parentInternalId AS c1_internalId, "
+             "    " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
+             "    Metadata.value AS c3_string1, "
+             "    " + formatter.FormatNull("TEXT") + " AS c4_string2, "
+             "    " + formatter.FormatNull("TEXT") + " AS c5_string3, "
+             "    Metadata.type AS c6_int1, "
+             + revisionInC7 +
+             "  " + formatter.FormatNull("INT") + " AS c8_int3, "
+             "    " + formatter.FormatNull("BIGINT") + " AS c9_big_int1, "
+             "    " + formatter.FormatNull("BIGINT") + " AS c10_big_int2 "
+             "   FROM Metadata "
+             "   INNER JOIN OneInstance ON Metadata.id = OneInstance.instanceInternalId");
+             
+      branches.push_back("SELECT "
+             "    " TOSTRING(QUERY_ONE_INSTANCE_ATTACHMENTS) " AS c0_queryId, "
+             "    parentInternalId AS c1_internalId, "
+             "    " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
+             "    uuid AS c3_string1, "
+             "    uncompressedHash AS c4_string2, "
+             "    compressedHash AS c5_string3, "
+             "    fileType AS c6_int1, "
+             + revisionInC7 +
+             "    compressionType AS c8_int3, "
+             "    compressedSize AS c9_big_int1, "
+             "    uncompressedSize AS c10_big_int2 "
+             "   FROM AttachedFiles "
+             "   INNER JOIN OneInstance ON AttachedFiles.id = OneInstance.instanceInternalId");
+
+      // sql += "  ) ";
+
+    }
+  }
+
+
+  void IndexBackend::ExecuteFind(Orthanc::DatabasePluginMessages::TransactionResponse& response,
+                                    DatabaseManager& manager,
+                                    const Orthanc::DatabasePluginMessages::Find_Request& request)
+  {
+    // TODO-FIND move to child plugins ?
+
+    std::string cacheKey;
+    int64_t lastChange = 0;
+    const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+    if (findResultsCache_.IsEnabled() &&
+        !manager.IsReadWriteTransaction() &&  // Don't cache the uncommitted changes
+        response.ByteSizeLong() == 0)
+    {
+      cacheKey = request.SerializeAsString();
+      lastChange = GetLastChangeIndex(manager);
+
+      std::string answer;
+      if (findResultsCache_.Lookup(answer, cacheKey, lastChange, now))
+      {
+        if (!response.ParseFromString(answer))
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+        }
+
+        return;
+      }
+    }
+
+    std::unique_ptr<IndexAdvisor::Shape> shape(CreateLookupShape(indexAdvisor_, request));
+
+    // If we want the Find to use a read-only transaction, we can not create temporary tables with
+    // the lookup results.  So we must use a CTE (Common Table Expression).  
+    // However, a CTE can only be used in a single query -> we must unionize all the following 
+    // queries to retrieve values from various tables.
+    // However, to use UNION, all tables must have the same columns (numbers and types).  That's
+    // why we have generic column names.
+    // So, at the end we'll have only one very big query !
+
+    std::string sql;
+
+    // extract the resource id of interest by executing the lookup in a CTE
+    LookupFormatter formatter(manager.GetDialect(), HasWildcardFullTextIndex(), HasBinaryCollation());
+    formatter.SetSortKeys(GetSortKeys());
+    formatter.SetHiddenResources(hiddenResources_);
+
+    LabelsCache::Resources labelsResources;
+    if (LookupLabelsResources(labelsResources, manager, request))
+    {
+      formatter.SetLabelsResources(labelsResources);
+    }
+
+    StudyColumnStore::Resources candidates;
+    if (LookupStudyCandidates(candidates, request))
+    {
+      formatter.SetCandidateResources(candidates);
+    }
+
+    // Use keyset pagination if the end of the previous page of the same lookup is known
+    std::string keysetPrefix;
+    int64_t keysetLastChange = 0;
+    FindKeysetBound bound;
+    bool hasBound = false;
+
+    if (request.has_limits() &&
+        request.limits().count() > 0 &&
+        keysetPagination_.IsEnabled())
+    {
+      keysetPrefix = GetKeysetPrefix(request);
+      keysetLastChange = (cacheKey.empty() ? GetLastChangeIndex(manager) : lastChange);
+      hasBound = (request.limits().since() > 0 &&
+                  keysetPagination_.Lookup(bound, keysetPrefix + boost::lexical_cast<std::string>(request.limits().since()),
+                                           keysetLastChange, now));
+    }
+
+    std::string lookupSqlCTE;
+    ISqlLookupFormatter::Apply(lookupSqlCTE, formatter, request, hasBound ? &bound : NULL);
+
+    // base query, retrieve the ordered internalId and publicId of the selected resources
+    sql = "WITH Lookup AS (" + lookupSqlCTE + ") ";
+
+    // The projection doesn't depend on the constraints of the request
+    const std::string projectionShape = GetFindProjectionShape(manager.GetDialect(), HasRevisionsSupport(),
+                                                               HasResourceSummary(), HasChildCountTable(), request);
+
+    FindProjectionsCache::Projection projection;
+    if (!findProjections_.Lookup(projection, projectionShape))
+    {
+      FormatFindProjection(projection, formatter, request);
+      findProjections_.Store(projectionShape, projection);
+    }
+
+    const std::string& oneInstanceCTEs = projection.oneInstanceCTEs_;
+    const std::vector<std::string>& branches = projection.branches_;
+
+    sql += oneInstanceCTEs;
+
+    /**
+     * Optionally, the lookup is executed alone, and the other branches
+     * of the union are only executed if it has selected some
+     * resources, possibly distributed over the idle connections of the
+     * pool. The lookup is bounded, as its results are inlined in the
+     * queries of the second phase.
+     **/
+    static const uint64_t MAX_PARALLEL_FIND_RESOURCES = 1000;
+
+    const bool bounded = (request.has_limits() &&
+                          request.limits().count() > 0 &&
+                          request.limits().count() <= MAX_PARALLEL_FIND_RESOURCES);
+
+    const bool parallel = (findParallelism_ > 0 &&
+                           idleConnections_ != NULL &&
+                           !manager.IsReadWriteTransaction() &&
+                           branches.size() > 2 &&
+                           bounded);
+
+    const bool twoPhases = (parallel ||
+                            (findTwoPhases_ &&
+                             branches.size() > 1 &&
+                             bounded));
+
+    const bool jsonAggregation = (findJsonAggregation_ &&
+                                  !twoPhases &&
+                                  branches.size() > 1 &&
+                                  (manager.GetDialect() == Dialect_PostgreSQL ||
+                                   manager.GetDialect() == Dialect_MySQL));
+
+    assert(!branches.empty());
+
+    if (jsonAggregation)
+    {
+      // One row per resource, whose other rows are in the "c11_payload" column
+      sql += ", Payload AS (SELECT c1_internalId AS payloadId, " + FormatFindJsonAggregation(manager.GetDialect()) + " AS payload FROM (";
+
+      for (size_t i = 1; i < branches.size(); i++)
+      {
+        if (i > 1)
+        {
+          sql += " UNION ALL ";
+        }
+
+        sql += branches[i];
+      }
 
-    // need parent identifier ?
-    if (request.retrieve_parent_identifier())
+      sql += ") AS Branches GROUP BY c1_internalId) ";
+      sql += ("SELECT Branch0.*, Payload.payload AS c11_payload FROM (" + branches[0] + ") AS Branch0 "
+              "LEFT JOIN Payload ON Payload.payloadId = Branch0.c1_internalId ORDER BY c2_rowNumber");
+    }
+    else if (twoPhases)
     {
-      sql += "UNION ALL SELECT "
-             "  " TOSTRING(QUERY_PARENT_IDENTIFIER) " AS c0_queryId, "
-             "  Lookup.internalId AS c1_internalId, "
-             "  " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
-             "  parentLevel.publicId AS c3_string1, "
-             "  " + formatter.FormatNull("TEXT") + " AS c4_string2, "
-             "  " + formatter.FormatNull("TEXT") + " AS c5_string3, "
-             "  " + formatter.FormatNull("INT") + " AS c6_int1, "
-             "  " + formatter.FormatNull("INT") + " AS c7_int2, "
-             "  " + formatter.FormatNull("INT") + " AS c8_int3, "
-             "  " + formatter.FormatNull("BIGINT") + " AS c9_big_int1, "
-             "  " + formatter.FormatNull("BIGINT") + " AS c10_big_int2 "
-             "FROM Lookup "
-             "  INNER JOIN Resources currentLevel ON currentLevel.internalId = Lookup.internalId "
-             "  INNER JOIN Resources parentLevel ON currentLevel.parentId = parentLevel.internalId ";
+      sql += branches[0];
+      sql += " ORDER BY c2_rowNumber";
     }
-
-    // need one instance info ?
-    if (request.level() != Orthanc::DatabasePluginMessages::ResourceType::RESOURCE_INSTANCE &&
-        request.retrieve_one_instance_metadata_and_attachments())
+    else
     {
-      sql += "   UNION ALL SELECT"
-             "    " TOSTRING(QUERY_ONE_INSTANCE_IDENTIFIER) " AS c0_queryId, "
-             "    parentInternalId AS c1_internalId, "
-             "    " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
-             "    instancePublicId AS c3_string1, "
-             "    " + formatter.FormatNull("TEXT") + " AS c4_string2, "
-             "    " + formatter.FormatNull("TEXT") + " AS c5_string3, "
-             "    " + formatter.FormatNull("INT") + " AS c6_int1, "
-             "    " + formatter.FormatNull("INT") + " AS c7_int2, "
-             "  " + formatter.FormatNull("INT") + " AS c8_int3, "
-             "    instanceInternalId AS c9_big_int1, "
-             "    " + formatter.FormatNull("BIGINT") + " AS c10_big_int2 "
-             "   FROM OneInstance ";
-
-      sql += "   UNION ALL SELECT"
-             "    " TOSTRING(QUERY_ONE_INSTANCE_METADATA) " AS c0_queryId, "
-             "    parentInternalId AS c1_internalId, "
-             "    " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
-             "    Metadata.value AS c3_string1, "
-             "    " + formatter.FormatNull("TEXT") + " AS c4_string2, "
-             "    " + formatter.FormatNull("TEXT") + " AS c5_string3, "
-             "    Metadata.type AS c6_int1, "
-             + revisionInC7 +
-             "  " + formatter.FormatNull("INT") + " AS c8_int3, "
-             "    " + formatter.FormatNull("BIGINT") + " AS c9_big_int1, "
-             "    " + formatter.FormatNull("BIGINT") + " AS c10_big_int2 "
-             "   FROM Metadata "
-             "   INNER JOIN OneInstance ON Metadata.id = OneInstance.instanceInternalId";
-             
-      sql += "   UNION ALL SELECT"
-             "    " TOSTRING(QUERY_ONE_INSTANCE_ATTACHMENTS) " AS c0_queryId, "
-             "    parentInternalId AS c1_internalId, "
-             "    " + formatter.FormatNull("BIGINT") + " AS c2_rowNumber, "
-             "    uuid AS c3_string1, "
-             "    uncompressedHash AS c4_string2, "
-             "    compressedHash AS c5_string3, "
-             "    fileType AS c6_int1, "
-             + revisionInC7 +
-             "    compressionType AS c8_int3, "
-             "    compressedSize AS c9_big_int1, "
-             "    uncompressedSize AS c10_big_int2 "
-             "   FROM AttachedFiles "
-             "   INNER JOIN OneInstance ON AttachedFiles.id = OneInstance.instanceInternalId";
+      sql += branches[0];
 
-      // sql += "  ) ";
+      for (size_t i = 1; i < branches.size(); i++)
+      {
+        sql += " UNION ALL " + branches[i];
+      }
 
+      sql += " ORDER BY c0_queryId, c2_rowNumber";  // this is really important to make sure that the Lookup query is the first one to provide results since we use it to create the responses element !
     }
 
-    sql += " ORDER BY c0_queryId, c2_rowNumber";  // this is really important to make sure that the Lookup query is the first one to provide results since we use it to create the responses element !
+    // In the case of two phases, only the lookup is bounded, as the
+    // other branches are restricted to the resources it has selected
+    std::unique_ptr<StatementTimeout> timeout(new StatementTimeout(*this, manager, findStatementTimeout_));
 
     std::unique_ptr<DatabaseManager::StatementBase> statement;
     if (manager.GetDialect() == Dialect_MySQL)
@@ -4002,269 +8078,233 @@ bool IndexBackend::LookupResourceAndParent(int64_t& id,
     {
       statement.reset(new DatabaseManager::CachedStatement(STATEMENT_FROM_HERE_DYNAMIC(sql), manager, sql));
     }
-    
+
+    // The rows are only read in the loop below, without issuing other statements
+    statement->SetStreaming(true);
+    statement->SetPlanCacheMode(lookupPlanCacheMode_);
+
+    formatter.PrepareStatement(*statement);
     statement->Execute(formatter.GetDictionary());
     
     // LOG(INFO) << sql;
 
     std::map<int64_t, Orthanc::DatabasePluginMessages::Find_Response*> responses;
+    ResponseBudget budget(maxResponseSize_);
 
     while (!statement->IsDone())
     {
-      int32_t queryId = statement->ReadInteger32(C0_QUERY_ID);
-      int64_t internalId = statement->ReadInteger64(C1_INTERNAL_ID);
-      
-      assert(queryId == QUERY_LOOKUP || responses.find(internalId) != responses.end()); // the QUERY_LOOKUP must be read first and must create the response before any other query tries to populate the fields
+      ReadFindRow(response, responses, request, budget, *statement);
 
-      // LOG(INFO) << queryId << "  " << statement->ReadString(C3_STRING_1);
-
-      switch (queryId)
+      if (jsonAggregation &&
+          !statement->IsNull(C11_PAYLOAD))  // NULL if the resource has no other row
       {
-        case QUERY_LOOKUP:
-          responses[internalId] = response.add_find();
-          responses[internalId]->set_public_id(statement->ReadString(C3_STRING_1));
-          responses[internalId]->set_internal_id(internalId);
-          break;
-
-        case QUERY_LABELS:
-          responses[internalId]->add_labels(statement->ReadString(C3_STRING_1));
-          break;
-
-        case QUERY_MAIN_DICOM_TAGS:
-        {
-          Orthanc::DatabasePluginMessages::Find_Response_ResourceContent* content = GetResourceContent(responses[internalId], request.level());
-          Orthanc::DatabasePluginMessages::Find_Response_Tag* tag = content->add_main_dicom_tags();
-
-          tag->set_value(statement->ReadString(C3_STRING_1));
-          tag->set_group(statement->ReadInteger32(C6_INT_1));
-          tag->set_element(statement->ReadInteger32(C7_INT_2));
-          }; break;
-
-        case QUERY_PARENT_MAIN_DICOM_TAGS:
-        {
-          Orthanc::DatabasePluginMessages::Find_Response_ResourceContent* content = GetResourceContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() - 1));
-          Orthanc::DatabasePluginMessages::Find_Response_Tag* tag = content->add_main_dicom_tags();
-
-          tag->set_value(statement->ReadString(C3_STRING_1));
-          tag->set_group(statement->ReadInteger32(C6_INT_1));
-          tag->set_element(statement->ReadInteger32(C7_INT_2));
-        }; break;
+        ReadAggregatedFindRows(response, responses, request, budget, statement->ReadStringReference(C11_PAYLOAD));
+      }
 
-        case QUERY_GRAND_PARENT_MAIN_DICOM_TAGS:
-        {
-          Orthanc::DatabasePluginMessages::Find_Response_ResourceContent* content = GetResourceContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() - 2));
-          Orthanc::DatabasePluginMessages::Find_Response_Tag* tag = content->add_main_dicom_tags();
+      statement->Next();
+    }    
 
-          tag->set_value(statement->ReadString(C3_STRING_1));
-          tag->set_group(statement->ReadInteger32(C6_INT_1));
-          tag->set_element(statement->ReadInteger32(C7_INT_2));
-        }; break;
+    timeout.reset(NULL);
 
-        case QUERY_CHILDREN_IDENTIFIERS:
-        {
-          Orthanc::DatabasePluginMessages::Find_Response_ChildrenContent* content = GetChildrenContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() + 1));
-          content->add_identifiers(statement->ReadString(C3_STRING_1));
-          content->set_count(content->identifiers_size());
-        }; break;
+    if (twoPhases &&
+        !responses.empty())
+    {
+      ExecuteFindBranches(response, responses, manager, request, oneInstanceCTEs, branches, parallel, budget);
+    }
 
-        case QUERY_CHILDREN_COUNT:
-        {
-          Orthanc::DatabasePluginMessages::Find_Response_ChildrenContent* content = GetChildrenContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() + 1));
-          content->set_count(statement->ReadInteger64(C9_BIG_INT_1));
-        }; break;
+    if (!keysetPrefix.empty() &&
+        !manager.IsReadWriteTransaction() &&  // Don't remember the uncommitted changes
+        static_cast<uint64_t>(response.find_size()) == request.limits().count())
+    {
+      // The page is full: Remember where it ends, as the bound of the next page
+      statement.reset();
 
-        case QUERY_CHILDREN_MAIN_DICOM_TAGS:
-        {
-          Orthanc::DatabasePluginMessages::Find_Response_ChildrenContent* content = GetChildrenContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() + 1));
-          Orthanc::DatabasePluginMessages::Find_Response_MultipleTags* tag = content->add_main_dicom_tags();
-          tag->add_values(statement->ReadString(C3_STRING_1)); // TODO: handle sequences ??
-          tag->set_group(statement->ReadInteger32(C6_INT_1));
-          tag->set_element(statement->ReadInteger32(C7_INT_2));
-        }; break;
+      const std::string& last = response.find(response.find_size() - 1).public_id();
+      const uint64_t next = request.limits().since() + request.limits().count();
 
-        case QUERY_CHILDREN_METADATA:
-        {
-          Orthanc::DatabasePluginMessages::Find_Response_ChildrenContent* content = GetChildrenContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() + 1));
-          Orthanc::DatabasePluginMessages::Find_Response_MultipleMetadata* metadata = content->add_metadata();
+      FindKeysetBound nextBound;
+      if (LookupKeysetBound(nextBound, manager, request, last))
+      {
+        keysetPagination_.Store(keysetPrefix + boost::lexical_cast<std::string>(next), nextBound, keysetLastChange, now);
+      }
+    }
 
-          metadata->add_values(statement->ReadString(C3_STRING_1));
-          metadata->set_key(statement->ReadInteger32(C6_INT_1));
-        }; break;
+    if (!cacheKey.empty())
+    {
+      findResultsCache_.Store(cacheKey, response.SerializeAsString(), lastChange, now);
+    }
+  }
 
-        case QUERY_GRAND_CHILDREN_IDENTIFIERS:
-        {
-          Orthanc::DatabasePluginMessages::Find_Response_ChildrenContent* content = GetChildrenContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() + 2));
-          content->add_identifiers(statement->ReadString(C3_STRING_1));
-          content->set_count(content->identifiers_size());
-        }; break;
+  bool IndexBackend::HasPerformDbHousekeeping()
+  {
+    return false;
+  }
 
-        case QUERY_GRAND_CHILDREN_COUNT:
-        {
-          Orthanc::DatabasePluginMessages::Find_Response_ChildrenContent* content = GetChildrenContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() + 2));
-          content->set_count(statement->ReadInteger64(C9_BIG_INT_1));
-        }; break;
+  void IndexBackend::PerformDbHousekeeping(DatabaseManager& manager)
+  {
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);    
+  }
 
-        case QUERY_GRAND_CHILDREN_MAIN_DICOM_TAGS:
-        {
-          Orthanc::DatabasePluginMessages::Find_Response_ChildrenContent* content = GetChildrenContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() + 2));
-          Orthanc::DatabasePluginMessages::Find_Response_MultipleTags* tag = content->add_main_dicom_tags();
+  void IndexBackend::RegisterHousekeepingTasks(HousekeepingScheduler& scheduler,
+                                               unsigned int defaultIntervalSeconds,
+                                               const boost::posix_time::ptime& now)
+  {
+    if (HasPerformDbHousekeeping())
+    {
+      scheduler.AddTask("Housekeeping", GetHousekeepingInterval("Housekeeping", defaultIntervalSeconds), now);
+    }
 
-          tag->add_values(statement->ReadString(C3_STRING_1)); // TODO: handle sequences ??
-          tag->set_group(statement->ReadInteger32(C6_INT_1));
-          tag->set_element(statement->ReadInteger32(C7_INT_2));
-        }; break;
+    if (exportedResourcesRetentionDays_ > 0 &&
+        !IsReadOnly())
+    {
+      scheduler.AddTask("ExportedResourcesRetention",
+                        GetHousekeepingInterval("ExportedResourcesRetention", defaultIntervalSeconds), now);
+    }
 
-        case QUERY_GRAND_CHILDREN_METADATA:
-        {
-          Orthanc::DatabasePluginMessages::Find_Response_ChildrenContent* content = GetChildrenContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() + 2));
-          Orthanc::DatabasePluginMessages::Find_Response_MultipleMetadata* metadata = content->add_metadata();
+    if (HasStudyColumnStore())
+    {
+      scheduler.AddTask("StudyColumnStore", GetHousekeepingInterval("StudyColumnStore", defaultIntervalSeconds), now);
+    }
 
-          metadata->add_values(statement->ReadString(C3_STRING_1));
-          metadata->set_key(statement->ReadInteger32(C6_INT_1));
-        }; break;
+    if (HasCacheInvalidations())
+    {
+      scheduler.AddTask("CacheInvalidations", GetHousekeepingInterval("CacheInvalidations", 1), now);
+    }
 
-        case QUERY_GRAND_GRAND_CHILDREN_IDENTIFIERS:
-        {
-          Orthanc::DatabasePluginMessages::Find_Response_ChildrenContent* content = GetChildrenContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() + 3));
-          content->add_identifiers(statement->ReadString(C3_STRING_1));
-          content->set_count(content->identifiers_size());
-        }; break;
+    if (analyticsExport_.IsEnabled())
+    {
+      scheduler.AddTask("AnalyticsExport", GetHousekeepingInterval("AnalyticsExport", defaultIntervalSeconds), now);
+    }
 
-        case QUERY_GRAND_GRAND_CHILDREN_COUNT:
-        {
-          Orthanc::DatabasePluginMessages::Find_Response_ChildrenContent* content = GetChildrenContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() + 3));
-          content->set_count(statement->ReadInteger64(C9_BIG_INT_1));
-        }; break;
+    scheduler.AddTask("DatabaseMetrics", GetHousekeepingInterval("DatabaseMetrics", 0), now);
+  }
 
-        case QUERY_ATTACHMENTS:
-        {
-          Orthanc::DatabasePluginMessages::FileInfo* attachment = responses[internalId]->add_attachments();
+  void IndexBackend::PerformHousekeepingTask(DatabaseManager& manager,
+                                             const std::string& task)
+  {
+    if (task == "Housekeeping")
+    {
+      PerformDbHousekeeping(manager);
+    }
+    else if (task == "ExportedResourcesRetention")
+    {
+      // The dates of the exported resources are UTC
+      const boost::posix_time::ptime limit = (boost::posix_time::second_clock::universal_time() -
+                                              boost::posix_time::hours(24 * exportedResourcesRetentionDays_));
+      DeleteExpiredExportedResources(manager, boost::posix_time::to_iso_string(limit),
+                                     exportedResourcesRetentionBatchSize_);
+    }
+    else if (task == "StudyColumnStore")
+    {
+      // The task runs at the interval of the housekeeping, so that the store is loaded soon after the startup
+      const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
 
-          attachment->set_uuid(statement->ReadString(C3_STRING_1));
-          attachment->set_uncompressed_hash(statement->ReadString(C4_STRING_2));
-          attachment->set_compressed_hash(statement->ReadString(C5_STRING_3));
-          attachment->set_content_type(statement->ReadInteger32(C6_INT_1));
-          attachment->set_compression_type(statement->ReadInteger32(C8_INT_3));
-          attachment->set_compressed_size(statement->ReadInteger64(C9_BIG_INT_1));
-          attachment->set_uncompressed_size(statement->ReadInteger64(C10_BIG_INT_2));
+      if (studyColumnStore_.IsEnabled() &&
+          (!studyColumnStore_.IsLoaded() ||
+           (studyColumnStoreReloadInterval_ != 0 &&
+            now >= studyColumnStoreReloaded_ + boost::posix_time::seconds(studyColumnStoreReloadInterval_))))
+      {
+        ReloadStudyColumnStore(manager);
+        studyColumnStoreReloaded_ = now;
+      }
+      else if (studyColumnStore_.IsLoaded())
+      {
+        LoadPendingStudies(manager);
+      }
+    }
+    else if (task == "CacheInvalidations")
+    {
+      PollCacheInvalidations(manager);
+    }
+    else if (task == "AnalyticsExport")
+    {
+      ExportAnalytics(manager);
+    }
+    else if (task == "DatabaseMetrics")
+    {
+      std::map<std::string, float> metrics;
+      CollectDatabaseMetrics(metrics, manager);
 
-          if (!statement->IsNull(C7_INT_2))  // revision can be null for files that have been atttached by older Orthanc versions
-          {
-            responses[internalId]->add_attachments_revisions(statement->ReadInteger32(C7_INT_2));
-          }
-          else
-          {
-            responses[internalId]->add_attachments_revisions(0);
-          }
-        }; break;
+#if HAS_ORTHANC_PLUGIN_METRICS == 1
+      for (std::map<std::string, float>::const_iterator it = metrics.begin(); it != metrics.end(); ++it)
+      {
+        OrthancPluginSetMetricsValue(GetContext(), it->first.c_str(), it->second, OrthancPluginMetricsType_Default);
+      }
+#endif
+    }
+    else
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "Unknown housekeeping task: " + task);
+    }
+  }
 
-        case QUERY_METADATA:
-        {
-          Orthanc::DatabasePluginMessages::Find_Response_ResourceContent* content = GetResourceContent(responses[internalId], request.level());
-          Orthanc::DatabasePluginMessages::Find_Response_Metadata* metadata = content->add_metadata();
 
-          metadata->set_value(statement->ReadString(C3_STRING_1));
-          metadata->set_key(statement->ReadInteger32(C6_INT_1));
-          
-          if (!statement->IsNull(C7_INT_2))  // revision can be null for metadata that have been created by older Orthanc versions
-          {
-            metadata->set_revision(statement->ReadInteger32(C7_INT_2));
-          }
-          else
-          {
-            metadata->set_revision(0);
-          }
-        }; break;
+  bool IndexBackend::LookupDatabaseSize(uint64_t& target,
+                                        DatabaseManager& manager)
+  {
+    std::string sql;
 
-        case QUERY_PARENT_METADATA:
-        {
-          Orthanc::DatabasePluginMessages::Find_Response_ResourceContent* content = GetResourceContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() - 1));
-          Orthanc::DatabasePluginMessages::Find_Response_Metadata* metadata = content->add_metadata();
+    switch (manager.GetDialect())
+    {
+      case Dialect_PostgreSQL:
+        sql = "SELECT pg_database_size(current_database())";
+        break;
 
-          metadata->set_value(statement->ReadString(C3_STRING_1));
-          metadata->set_key(statement->ReadInteger32(C6_INT_1));
+      case Dialect_MySQL:
+        sql = ("SELECT CAST(COALESCE(SUM(data_length + index_length), 0) AS SIGNED) "
+               "FROM information_schema.tables WHERE table_schema = DATABASE()");
+        break;
 
-          if (!statement->IsNull(C7_INT_2))  // revision can be null for metadata that have been created by older Orthanc versions
-          {
-            metadata->set_revision(statement->ReadInteger32(C7_INT_2));
-          }
-          else
-          {
-            metadata->set_revision(0);
-          }
-        }; break;
+      case Dialect_SQLite:
+        sql = "SELECT page_count * page_size FROM pragma_page_count(), pragma_page_size()";
+        break;
 
-        case QUERY_GRAND_PARENT_METADATA:
-        {
-          Orthanc::DatabasePluginMessages::Find_Response_ResourceContent* content = GetResourceContent(responses[internalId], static_cast<Orthanc::DatabasePluginMessages::ResourceType>(request.level() - 2));
-          Orthanc::DatabasePluginMessages::Find_Response_Metadata* metadata = content->add_metadata();
+      default:
+        return false;
+    }
 
-          metadata->set_value(statement->ReadString(C3_STRING_1));
-          metadata->set_key(statement->ReadInteger32(C6_INT_1));
+    DatabaseManager::CachedStatement statement(STATEMENT_FROM_HERE_DYNAMIC(sql), manager, sql);
+    statement.SetReadOnly(true);
+    statement.Execute();
 
-          if (!statement->IsNull(C7_INT_2))  // revision can be null for metadata that have been created by older Orthanc versions
-          {
-            metadata->set_revision(statement->ReadInteger32(C7_INT_2));
-          }
-          else
-          {
-            metadata->set_revision(0);
-          }
-        }; break;
+    if (statement.IsDone() ||
+        statement.IsNull(0))
+    {
+      return false;
+    }
+    else
+    {
+      statement.SetResultFieldType(0, ValueType_Integer64);
+      target = static_cast<uint64_t>(statement.ReadInteger64(0));
+      return true;
+    }
+  }
 
-        case QUERY_PARENT_IDENTIFIER:
-        {
-          responses[internalId]->set_parent_public_id(statement->ReadString(C3_STRING_1));
-        }; break;
 
-        case QUERY_ONE_INSTANCE_IDENTIFIER:
-        {
-          responses[internalId]->set_one_instance_public_id(statement->ReadString(C3_STRING_1));
-        }; break;
-        case QUERY_ONE_INSTANCE_METADATA:
-        {
-          Orthanc::DatabasePluginMessages::Find_Response_Metadata* metadata = responses[internalId]->add_one_instance_metadata();
+  void IndexBackend::CollectDatabaseMetrics(std::map<std::string, float>& metrics,
+                                            DatabaseManager& manager)
+  {
+    if (HasMeasureLatency())
+    {
+      metrics["orthanc_index_latency_ms"] = static_cast<float>(MeasureLatency(manager)) / 1000.0f;
+    }
 
-          metadata->set_value(statement->ReadString(C3_STRING_1));
-          metadata->set_key(statement->ReadInteger32(C6_INT_1));
+    DatabaseManager::Transaction t(manager, TransactionType_ReadOnly);
 
-          if (!statement->IsNull(C7_INT_2))  // revision can be null for metadata that have been created by older Orthanc versions
-          {
-            metadata->set_revision(statement->ReadInteger32(C7_INT_2));
-          }
-          else
-          {
-            metadata->set_revision(0);
-          }
-        }; break;
-        case QUERY_ONE_INSTANCE_ATTACHMENTS:
-        {
-          Orthanc::DatabasePluginMessages::FileInfo* attachment = responses[internalId]->add_one_instance_attachments();
-          
-          attachment->set_uuid(statement->ReadString(C3_STRING_1));
-          attachment->set_uncompressed_hash(statement->ReadString(C4_STRING_2));
-          attachment->set_compressed_hash(statement->ReadString(C5_STRING_3));
-          attachment->set_content_type(statement->ReadInteger32(C6_INT_1));
-          attachment->set_compression_type(statement->ReadInteger32(C8_INT_3));
-          attachment->set_compressed_size(statement->ReadInteger64(C9_BIG_INT_1));
-          attachment->set_uncompressed_size(statement->ReadInteger64(C10_BIG_INT_2));
-        }; break;
+    metrics["orthanc_index_last_change"] = static_cast<float>(GetLastChangeIndex(manager));
 
-        default:
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
-      }
-      statement->Next();
-    }    
-  }
+    uint64_t size;
+    if (LookupDatabaseSize(size, manager))
+    {
+      metrics["orthanc_index_database_size_mb"] = static_cast<float>(size / (1024 * 1024));
+    }
 
-  bool IndexBackend::HasPerformDbHousekeeping()
-  {
-    return false;
-  }
+    if (studyColumnStore_.IsEnabled())
+    {
+      metrics["orthanc_index_study_column_store_rows"] = static_cast<float>(studyColumnStore_.GetRowsCount());
+    }
 
-  void IndexBackend::PerformDbHousekeeping(DatabaseManager& manager)
-  {
-    throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);    
+    t.Commit();
   }
 
 #endif
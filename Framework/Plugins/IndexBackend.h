@@ -23,11 +23,27 @@
 
 #pragma once
 
+#include "AnalyticsExport.h"
+#include "CacheInvalidations.h"
+#include "DeferredWrites.h"
+#include "FindProjectionsCache.h"
+#include "FindResultsCache.h"
+#include "CountResourcesCache.h"
+#include "GlobalPropertiesCache.h"
+#include "HiddenResources.h"
+#include "HousekeepingScheduler.h"
 #include "IDatabaseBackend.h"
+#include "IndexAdvisor.h"
+#include "KeysetPaginationCache.h"
+#include "LabelsCache.h"
+#include "ResourcesLookupCache.h"
+#include "StudyColumnStore.h"
 
 #include <OrthancException.h>
 
 #include <boost/thread/shared_mutex.hpp>
+#include <map>
+#include <vector>
 
 
 namespace OrthancDatabases
@@ -38,11 +54,87 @@ namespace OrthancDatabases
    **/
   class IndexBackend : public IDatabaseBackend
   {
+  public:
+    /**
+     * Access to the idle connections of the pool, that are lent to
+     * the parallel mode of "ExecuteFind()".
+     **/
+    class IIdleConnections : public boost::noncopyable
+    {
+    public:
+      virtual ~IIdleConnections()
+      {
+      }
+
+      // Returns NULL if no connection is idle
+      virtual DatabaseManager* TryAcquireIdleConnection() = 0;
+
+      virtual void ReleaseIdleConnection(DatabaseManager& manager) = 0;
+    };
+
+    class ResponseBudget;
+
   private:
     class LookupFormatter;
+    class StatementTimeout;
+    class InvalidateResourcesAction;
+    class InvalidateGlobalPropertyAction;
+    class InvalidateLabelAction;
 
     OrthancPluginContext*  context_;
     bool                   readOnly_;
+    size_t                 maxCachedStatements_;
+    unsigned int           connectionHoldWarningThreshold_;
+    size_t                 minConnections_;
+    unsigned int           idleConnectionsTimeout_;
+    unsigned int           healthCheckInterval_;
+    bool                   lifoConnections_;
+    bool                   connectionsAffinity_;
+    size_t                 groupCommitSize_;
+    unsigned int           groupCommitDelay_;
+    size_t                 maxConcurrentWriters_;
+    unsigned int           failoverRetryBudget_;
+    size_t                 maxInFlightTransactions_;
+    size_t                 reservedReadOnlyConnections_;
+    size_t                 reservedReadWriteConnections_;
+    KeysetPaginationCache  keysetPagination_;
+    CountResourcesCache    countsCache_;
+    FindResultsCache       findResultsCache_;
+    FindProjectionsCache   findProjections_;
+    ResourcesLookupCache   lookupCache_;
+    LabelsCache            labelsCache_;
+    GlobalPropertiesCache  globalPropertiesCache_;
+    StudyColumnStore       studyColumnStore_;
+    std::set<std::string>  studyColumnStoreTags_;
+    unsigned int           studyColumnStoreReloadInterval_;
+    boost::posix_time::ptime  studyColumnStoreReloaded_;  // Only used by the housekeeping thread
+    CacheInvalidations     cacheInvalidations_;
+    boost::posix_time::ptime  cacheInvalidationsPruned_;  // Only used by the housekeeping thread
+    bool                   childrenPrefetch_;
+    bool                   replicaReadYourWrites_;
+    IIdleConnections*      idleConnections_;  // Not owned, can be NULL
+    size_t                 findParallelism_;
+    bool                   findTwoPhases_;
+    bool                   findJsonAggregation_;
+    unsigned int           findStatementTimeout_;
+    uint64_t               maxResponseSize_;
+    PlanCacheMode          lookupPlanCacheMode_;
+    std::string            captureFile_;
+    size_t                 captureBufferSize_;
+    std::string            tracesExportUrl_;
+    std::string            tracesServiceName_;
+    bool                   ingestStatistics_;
+    unsigned int           chunkedDeletionBatchSize_;
+    bool                   replicaSource_;
+    HiddenResources        hiddenResources_;
+    IndexAdvisor           indexAdvisor_;
+    unsigned int           slowStatementThreshold_;
+    std::unique_ptr<DatabaseManager::ISlowStatementListener>  slowStatementListener_;
+    std::unique_ptr<StatementsWarmup>  statementsWarmup_;
+    std::map<std::string, unsigned int>  housekeepingIntervals_;
+    unsigned int           exportedResourcesRetentionDays_;
+    unsigned int           exportedResourcesRetentionBatchSize_;
+    AnalyticsExport        analyticsExport_;
 
     boost::shared_mutex                                outputFactoryMutex_;
     std::unique_ptr<IDatabaseBackendOutput::IFactory>  outputFactory_;
@@ -54,27 +146,237 @@ namespace OrthancDatabases
 
     virtual void ClearRemainingAncestor(DatabaseManager& manager);
 
+    // The "childCount" column of "Resources", and its pending changes
+    // in the "ChildCountChanges" table (PostgreSQL)
     virtual bool HasChildCountTable() const = 0;
 
+    /**
+     * Clause that is appended to the selection of the patients to
+     * recycle, so that concurrent transactions (possibly from other
+     * Orthanc servers) select different patients instead of
+     * conflicting, e.g. "FOR UPDATE SKIP LOCKED". It must be the same
+     * for all the connections. By default, no lock is taken.
+     **/
+    virtual std::string GetRecyclingLockClause(DatabaseManager& manager)
+    {
+      return "";
+    }
+
+    /**
+     * If this returns "true", "ExecuteFind()" reads the main DICOM
+     * tags and the metadata of the resources from the denormalized
+     * "ResourceSummary(id, content)" table, whose "content" column is
+     * a JSON array "[ [ [group, element, value], ... ],
+     * [ [type, revision, value], ... ] ]".
+     **/
+    virtual bool HasResourceSummary() const
+    {
+      return false;
+    }
+
+    /**
+     * The ordering keys (cf. "ISqlLookupFormatter::IsSortKey()")
+     * whose values are materialized in the "SortKeys(id, sortKey,
+     * value)" table, or NULL if this table is not available. The
+     * table must hold the values of all the resources for these keys.
+     **/
+    virtual const std::set<int64_t>* GetSortKeys() const
+    {
+      return NULL;
+    }
+
+    /**
+     * If this returns "true", "ListAllLabels()" reads the
+     * "LabelsCatalog(label, shard, count)" table, whose rows are
+     * summed by label, instead of scanning the "Labels" table.
+     **/
+    virtual bool HasLabelsCatalog() const
+    {
+      return false;
+    }
+
+    /**
+     * If this returns "true", the mandatory wildcard constraints on
+     * the identifier tags are pre-filtered by a "MATCH ... AGAINST"
+     * on the FULLTEXT index of "DicomIdentifiers.value" (MySQL only).
+     **/
+    virtual bool HasWildcardFullTextIndex() const
+    {
+      return false;
+    }
+
+    /**
+     * If this returns "true", "DicomIdentifiers.value" has the "C"
+     * collation, and the case-insensitive constraints lowercase the
+     * values with the default collation (PostgreSQL only).
+     **/
+    virtual bool HasBinaryCollation() const
+    {
+      return false;
+    }
+
+    /**
+     * Bounds the duration of the next statements of the current
+     * transaction of "manager", in milliseconds ("0" removes the
+     * bound). The database server aborts the statements that exceed
+     * this duration. By default, the statements are not bounded.
+     **/
+    virtual void SetStatementTimeout(DatabaseManager& manager,
+                                     unsigned int milliseconds)
+    {
+    }
+
+    /**
+     * Gives the name and the SQL of an index on the values of the
+     * given tag in "MainDicomTags", as recommended by the index
+     * advisor (cf. "AdviseIndexes()"). Returns "false" if the
+     * database engine has no such index. By default, this is a
+     * partial index on SQLite.
+     **/
+    virtual bool LookupAdvisedIndex(std::string& name /*out*/,
+                                    std::string& sql /*out*/,
+                                    DatabaseManager& manager,
+                                    const Orthanc::DicomTag& tag);
+
+    // Executes the SQL of "LookupAdvisedIndex()", by default in a read-write transaction
+    virtual void CreateAdvisedIndex(DatabaseManager& manager,
+                                    const std::string& sql);
+
+    /**
+     * Adds the statistics of the database engine about the slowest
+     * statements on "MainDicomTags" and "DicomIdentifiers" (e.g.
+     * "pg_stat_statements"), if available. To be called within a
+     * read-only transaction.
+     **/
+    virtual void ReadStatementsStatistics(Json::Value& target /*out*/,
+                                          DatabaseManager& manager)
+    {
+    }
+
     void SignalDeletedFiles(IDatabaseBackendOutput& output,
                             DatabaseManager& manager);
 
     void SignalDeletedResources(IDatabaseBackendOutput& output,
                                 DatabaseManager& manager);
 
+    // The cached lookups are bypassed within the read-write
+    // transactions, whose changes might still be rolled back
+    bool IsLookupCacheUsable(const DatabaseManager& manager) const
+    {
+      return (lookupCache_.IsEnabled() &&
+              !manager.IsReadWriteTransaction());
+    }
+
+    void InvalidateCachedResource(const std::string& publicId)
+    {
+      lookupCache_.Invalidate(publicId);
+      labelsCache_.InvalidateListOfLabels();  // The labels of the resource might not be used anymore
+    }
+
+    // Invalidates the cached lookups of the deleted resources, once
+    // their deletion is committed by "manager"
+    void InvalidateCachedResources(DatabaseManager& manager,
+                                   const std::list<std::string>& publicIds);
+
+    /**
+     * Computes the resources that satisfy a constraint on the labels
+     * from "labelsCache_", reading the missing labels from the
+     * database. Returns "false" if the constraint must be looked up
+     * in the "Labels" table (e.g. too many resources).
+     **/
+    bool LookupLabelsResources(LabelsCache::Resources& target,
+                               DatabaseManager& manager,
+                               const std::set<std::string>& labels,
+                               LabelsConstraint constraint);
+
+    /**
+     * Resolves the names of the tags of the column store of the
+     * studies (cf. "SetStudyColumnStore()"), that must be identifier
+     * tags of the studies. To be called by "ConfigureDatabase()".
+     **/
+    void PrepareStudyColumnStore(const std::list<IdentifierTag>& identifierTags);
+
+    // To be called by the implementations of the writes of the identifier tags
+#if ORTHANC_PLUGINS_HAS_DATABASE_CONSTRAINT == 1
+    void UpdateStudyColumnStore(uint32_t countIdentifierTags,
+                                const OrthancPluginResourcesContentTags* identifierTags);
+#endif
+
+    void UpdateStudyColumnStore(const std::vector<DeferredWrites::Tag>& identifierTags);
+
+    // Reads the column store of the studies from the database
+    void ReloadStudyColumnStore(DatabaseManager& manager);
+
+    // Reads the values of the studies that were created by other processes
+    void LoadPendingStudies(DatabaseManager& manager);
+
+    /**
+     * Publishes an invalidation of the caches of the other Orthanc
+     * servers, inside the current transaction, so that it is discarded
+     * if the transaction is rolled back. Does nothing if the
+     * invalidations are disabled (cf. "SetCacheInvalidations()").
+     **/
+    void SignalCacheInvalidation(DatabaseManager& manager,
+                                 CacheInvalidationType type,
+                                 int64_t internalId,
+                                 const std::string& value);
+
+    // By default, the invalidations are appended to the "CacheInvalidations" table
+    virtual void WriteCacheInvalidation(DatabaseManager& manager,
+                                        const std::string& server,
+                                        CacheInvalidationType type,
+                                        int64_t internalId,
+                                        const std::string& value);
+
+    // Applies an invalidation that was published by some Orthanc server
+    void ApplyCacheInvalidation(const std::string& server,
+                                CacheInvalidationType type,
+                                int64_t internalId,
+                                const std::string& value);
+
+    // To be called by the writes of the global properties that bypass
+    // "SetGlobalProperty()", the cached value is invalidated at commit
+    void InvalidateGlobalProperty(DatabaseManager& manager,
+                                  const char* serverIdentifier,
+                                  int32_t property);
+
+    // To be called if some invalidations might have been missed
+    void ClearCaches();
+
+    // Applies the new rows of the "CacheInvalidations" table
+    void PollCacheInvalidations(DatabaseManager& manager);
+
+    const CacheInvalidations& GetCacheInvalidations() const
+    {
+      return cacheInvalidations_;
+    }
+
     bool IsReadOnly()
     {
       return readOnly_;
     }
 
+    // Resolves the internal IDs of the four levels of a hierarchy by
+    // a single statement, the missing levels being set to -1
+    void LookupHierarchy(int64_t& patientId /*out*/,
+                         int64_t& studyId /*out*/,
+                         int64_t& seriesId /*out*/,
+                         int64_t& instanceId /*out*/,
+                         DatabaseManager& manager,
+                         const char* hashPatient,
+                         const char* hashStudy,
+                         const char* hashSeries,
+                         const char* hashInstance);
+
   private:
-    void ReadChangesInternal(IDatabaseBackendOutput& output,
-                             bool& done,
-                             DatabaseManager& manager,
-                             DatabaseManager::CachedStatement& statement,
-                             const Dictionary& args,
-                             uint32_t limit,
-                             bool returnFirstResults);
+    // Returns the sequence number of the last answered change, or "-1" if none
+    int64_t ReadChangesInternal(IDatabaseBackendOutput& output,
+                                bool& done,
+                                DatabaseManager& manager,
+                                DatabaseManager::CachedStatement& statement,
+                                const Dictionary& args,
+                                uint32_t limit,
+                                bool returnFirstResults);
 
     void ReadExportedResourcesInternal(IDatabaseBackendOutput& output,
                                        bool& done,
@@ -90,6 +392,702 @@ namespace OrthancDatabases
       return context_;
     }
 
+    // Maximum number of precompiled statements per connection ("0" means no limit)
+    void SetMaxCachedStatements(size_t count)
+    {
+      maxCachedStatements_ = count;
+    }
+
+    size_t GetMaxCachedStatements() const
+    {
+      return maxCachedStatements_;
+    }
+
+    // Log a warning if a connection of the pool is held for longer
+    // than this delay, in seconds ("0" means no warning)
+    void SetConnectionHoldWarningThreshold(unsigned int seconds)
+    {
+      connectionHoldWarningThreshold_ = seconds;
+    }
+
+    unsigned int GetConnectionHoldWarningThreshold() const
+    {
+      return connectionHoldWarningThreshold_;
+    }
+
+    // Log a warning with the SQL and the parameters of the statements
+    // that take longer than this delay, in milliseconds ("0" means no
+    // warning)
+    void SetSlowStatementThreshold(unsigned int milliseconds)
+    {
+      slowStatementThreshold_ = milliseconds;
+    }
+
+    unsigned int GetSlowStatementThreshold() const
+    {
+      return slowStatementThreshold_;
+    }
+
+    // The listener is shared by all the connections of the pool, and
+    // is only invoked if the threshold above is not zero
+    void SetSlowStatementListener(DatabaseManager::ISlowStatementListener* listener)  // Takes ownership
+    {
+      slowStatementListener_.reset(listener);
+    }
+
+    DatabaseManager::ISlowStatementListener* GetSlowStatementListener() const  // Can be NULL
+    {
+      return slowStatementListener_.get();
+    }
+
+    // Number of the most used statements that are precompiled by a
+    // connection once it is opened or re-opened ("0" to disable)
+    void SetStatementsWarmup(size_t count)
+    {
+      if (count == 0)
+      {
+        statementsWarmup_.reset(NULL);
+      }
+      else
+      {
+        statementsWarmup_.reset(new StatementsWarmup(count));
+      }
+    }
+
+    StatementsWarmup* GetStatementsWarmup() const  // Can be NULL
+    {
+      return statementsWarmup_.get();
+    }
+
+    // Number of connections that are opened at startup and never
+    // closed ("0" means that all the connections are opened at startup)
+    void SetMinConnections(size_t count)
+    {
+      minConnections_ = count;
+    }
+
+    size_t GetMinConnections() const
+    {
+      return minConnections_;
+    }
+
+    // The connections above the minimum number are closed if idle for
+    // longer than this delay, in seconds ("0" means never)
+    void SetIdleConnectionsTimeout(unsigned int seconds)
+    {
+      idleConnectionsTimeout_ = seconds;
+    }
+
+    unsigned int GetIdleConnectionsTimeout() const
+    {
+      return idleConnectionsTimeout_;
+    }
+
+    // The connections that are available in the pool are checked by
+    // the housekeeping thread if idle for longer than this delay, in
+    // seconds, and reopened if broken ("0" means no health check)
+    void SetHealthCheckInterval(unsigned int seconds)
+    {
+      healthCheckInterval_ = seconds;
+    }
+
+    unsigned int GetHealthCheckInterval() const
+    {
+      return healthCheckInterval_;
+    }
+
+    /**
+     * Order in which the available connections are handed out by the
+     * pool. With "lifo", the most recently released connection is
+     * reused first (which keeps its caches warm, and lets the idle
+     * connections be closed), instead of round-robin. With "affinity",
+     * a thread gets back the connection it last released, if available.
+     **/
+    void SetConnectionsHandout(bool lifo,
+                               bool affinity)
+    {
+      lifoConnections_ = lifo;
+      connectionsAffinity_ = affinity;
+    }
+
+    bool IsLifoConnections() const
+    {
+      return lifoConnections_;
+    }
+
+    bool HasConnectionsAffinity() const
+    {
+      return connectionsAffinity_;
+    }
+
+    /**
+     * Group commit: up to "size" concurrent read-write transactions
+     * that ingest an instance are merged into one database
+     * transaction, that is committed once all of them are finished
+     * and at most "delay" milliseconds after the first one started.
+     * A size below 2 disables group commit (this is the default).
+     **/
+    void SetGroupCommit(size_t size,
+                        unsigned int delay)
+    {
+      groupCommitSize_ = size;
+      groupCommitDelay_ = delay;
+    }
+
+    size_t GetGroupCommitSize() const
+    {
+      return groupCommitSize_;
+    }
+
+    unsigned int GetGroupCommitDelay() const
+    {
+      return groupCommitDelay_;
+    }
+
+    /**
+     * Upper bound on the number of concurrent read-write transactions
+     * ("0" means no limit, which is the default). The actual limit is
+     * halved when the transactions conflict, and grows back to this
+     * value with the successful commits.
+     **/
+    void SetMaxConcurrentWriters(size_t count)
+    {
+      maxConcurrentWriters_ = count;
+    }
+
+    size_t GetMaxConcurrentWriters() const
+    {
+      return maxConcurrentWriters_;
+    }
+
+    /**
+     * Upper bound on the number of in-flight transactions ("0"
+     * disables the admission control, which is the default). The
+     * actual limit shrinks if the transactions get slower, and the
+     * read-only transactions above the limit are rejected with
+     * "ErrorCode_DatabaseUnavailable" (HTTP status 503), whereas the
+     * read-write transactions are always admitted.
+     **/
+    void SetMaxInFlightTransactions(size_t count)
+    {
+      maxInFlightTransactions_ = count;
+    }
+
+    size_t GetMaxInFlightTransactions() const
+    {
+      return maxInFlightTransactions_;
+    }
+
+    /**
+     * Time during which the operations of a read-only transaction are
+     * re-executed on a new connection, if the connection to the
+     * database is lost (e.g. during the failover of a PostgreSQL
+     * primary). In milliseconds, "0" means that the loss of the
+     * connection is reported to the Orthanc core (the default).
+     **/
+    void SetFailoverRetryBudget(unsigned int milliseconds)
+    {
+      failoverRetryBudget_ = milliseconds;
+    }
+
+    unsigned int GetFailoverRetryBudget() const
+    {
+      return failoverRetryBudget_;
+    }
+
+    /**
+     * Number of connections of the pool that are reserved to the
+     * read-only (resp. read-write) transactions: A transaction only
+     * takes a connection if the other type of transactions can still
+     * get its reserved connections. This way, a burst of ingests
+     * cannot starve the lookups of the viewers, and conversely.
+     **/
+    void SetReservedConnections(size_t readOnly,
+                                size_t readWrite)
+    {
+      reservedReadOnlyConnections_ = readOnly;
+      reservedReadWriteConnections_ = readWrite;
+    }
+
+    size_t GetReservedReadOnlyConnections() const
+    {
+      return reservedReadOnlyConnections_;
+    }
+
+    size_t GetReservedReadWriteConnections() const
+    {
+      return reservedReadWriteConnections_;
+    }
+
+    /**
+     * Interval between two executions of a housekeeping task, in
+     * seconds ("0" disables the task). The tasks whose interval is
+     * not set use the delay that is given to "Register()".
+     **/
+    void SetHousekeepingInterval(const std::string& task,
+                                 unsigned int seconds)
+    {
+      housekeepingIntervals_[task] = seconds;
+    }
+
+    unsigned int GetHousekeepingInterval(const std::string& task,
+                                         unsigned int defaultSeconds) const;
+
+    /**
+     * If "days" is not zero, the "ExportedResourcesRetention"
+     * housekeeping task deletes the exported resources that are older
+     * than "days", by batches of at most "batchSize" rows that are
+     * each deleted by a separate transaction.
+     **/
+    void SetExportedResourcesRetention(unsigned int days,
+                                       unsigned int batchSize);
+
+    unsigned int GetExportedResourcesRetentionDays() const
+    {
+      return exportedResourcesRetentionDays_;
+    }
+
+    /**
+     * If "directory" is not empty, the "AnalyticsExport" housekeeping
+     * task exports the resources that were changed since its last
+     * execution into CSV files in this directory (cf. class
+     * "AnalyticsExport"). This works on read-only databases.
+     **/
+    void SetAnalyticsExport(const std::string& directory,
+                            unsigned int batchSize)
+    {
+      analyticsExport_.SetDirectory(directory, batchSize);
+    }
+
+    /**
+     * Keyset pagination: The position where the last pages of
+     * "ExecuteFind()" and of "GetAllPublicIds()" end is remembered, so
+     * that reading the next page of the same lookup uses a seek
+     * condition instead of an "OFFSET", which takes constant time.
+     * This is disabled by default.
+     **/
+    void SetKeysetPagination(bool enabled)
+    {
+      keysetPagination_.SetMaxSize(enabled ? 256 : 0);
+    }
+
+    /**
+     * If not empty, the requests that are received from the Orthanc
+     * core through the database SDK "V4" are appended to this file,
+     * together with their timestamp, duration, transaction and
+     * connection, so that the workload can be analyzed and replayed
+     * offline by "DatabaseBackendAdapterV4::Replay()". WARNING: The
+     * file contains the DICOM tags of the patients.
+     **/
+    void SetCaptureFile(const std::string& path,
+                        size_t bufferSize /* number of requests kept in memory before writing them */)
+    {
+      captureFile_ = path;
+      captureBufferSize_ = bufferSize;
+    }
+
+    const std::string& GetCaptureFile() const
+    {
+      return captureFile_;
+    }
+
+    size_t GetCaptureBufferSize() const
+    {
+      return captureBufferSize_;
+    }
+
+    /**
+     * If not empty, the V4 adapter records one span per operation of
+     * the index and of the storage area, together with the SQL
+     * statements they execute, and exports them to this OpenTelemetry
+     * collector (OTLP/HTTP with JSON encoding, cf. "TracesExporter").
+     **/
+    void SetTracesExport(const std::string& url,
+                         const std::string& serviceName)
+    {
+      tracesExportUrl_ = url;
+      tracesServiceName_ = serviceName;
+    }
+
+    const std::string& GetTracesExportUrl() const
+    {
+      return tracesExportUrl_;
+    }
+
+    const std::string& GetTracesServiceName() const
+    {
+      return tracesServiceName_;
+    }
+
+    /**
+     * If enabled, the V4 adapter records the time spent in each stage
+     * of the ingestion of each instance (cf. "IngestStatistics"), and
+     * publishes the histograms and the slowest ingests at the URI
+     * "/index/ingest-statistics" of the REST API.
+     **/
+    void SetIngestStatistics(bool enabled)
+    {
+      ingestStatistics_ = enabled;
+    }
+
+    bool IsIngestStatistics() const
+    {
+      return ingestStatistics_;
+    }
+
+    /**
+     * If not zero, the V4 adapter publishes the URI
+     * "/index/chunked-delete" of the REST API, that deletes a resource
+     * in the background, by batches of the given number of instances.
+     * Each instance is deleted by its own short transaction of the
+     * Orthanc core, instead of deleting the whole resource at once,
+     * and the resource is hidden from the lookups of this process
+     * meanwhile. "0" disables the URI, which is the default.
+     **/
+    void SetChunkedDeletionBatchSize(unsigned int size)
+    {
+      chunkedDeletionBatchSize_ = size;
+    }
+
+    unsigned int GetChunkedDeletionBatchSize() const
+    {
+      return chunkedDeletionBatchSize_;
+    }
+
+    /**
+     * If enabled, the V4 adapter publishes the content of the index at
+     * the URI "/index/replica" of the REST API, from which the remote
+     * Orthanc servers maintain a local copy of the index (cf.
+     * "ReadReplicaPage()"). Disabled by default.
+     **/
+    void SetReplicaSource(bool enabled)
+    {
+      replicaSource_ = enabled;
+    }
+
+    bool IsReplicaSource() const
+    {
+      return replicaSource_;
+    }
+
+    // The resource and its descendants are hidden from the lookups, until "UnhideResource()"
+    void HideResource(int64_t id,
+                      Orthanc::ResourceType level);
+
+    void UnhideResource(int64_t id);
+
+    /**
+     * If enabled, the tags that are used by the constraints and by
+     * the orderings of the lookups are recorded (cf. "IndexAdvisor"),
+     * and the V4 adapter publishes the recommended indexes at the URI
+     * "/index/advisor" of the REST API. A POST to this URI creates
+     * the recommended indexes.
+     **/
+    void SetIndexAdvisor(bool enabled)
+    {
+      indexAdvisor_.SetEnabled(enabled);
+    }
+
+    bool IsIndexAdvisor() const
+    {
+      return indexAdvisor_.IsEnabled();
+    }
+
+    /**
+     * Lists the tags that are used by the lookups of this process,
+     * sorted by decreasing cumulative duration of the lookups, with
+     * the indexes that are recommended for them. The missing indexes
+     * are created if "create" is "true".
+     **/
+    void AdviseIndexes(Json::Value& target /*out*/,
+                       DatabaseManager& manager,
+                       bool create);
+
+    /**
+     * The results of "ExecuteCount()" for the lookups with constraints
+     * are remembered during the given number of seconds, so the counts
+     * can be outdated by at most this delay. "0" disables the cache,
+     * which is the default. The lookups without any constraints are
+     * always answered by the statistics of the database.
+     **/
+    void SetCountCacheTimeToLive(unsigned int seconds)
+    {
+      countsCache_.SetTimeToLive(seconds);
+    }
+
+    /**
+     * The answers of "ExecuteFind()" are remembered during the given
+     * number of seconds, as long as no change is logged in the
+     * database. "0" disables the cache, which is the default.
+     **/
+    void SetFindCacheTimeToLive(unsigned int seconds)
+    {
+      findResultsCache_.SetTimeToLive(seconds);
+    }
+
+    /**
+     * In-process cache of the mappings between the public IDs and the
+     * internal IDs of the resources. The entries are invalidated when
+     * the resources are deleted through this plugin, which is only
+     * safe if no other Orthanc server writes to the same database.
+     * "0" disables the cache, which is the default.
+     **/
+    void SetLookupCacheSize(size_t size)
+    {
+      lookupCache_.SetMaxSize(size);
+    }
+
+    /**
+     * The internal IDs of the resources of the labels that are used
+     * by the lookups are kept in memory during the given number of
+     * seconds, and the constraints on the labels are evaluated by
+     * merging these lists. The labels are invalidated by the writes
+     * of this plugin, so the lookups can miss the labels that were
+     * changed by other Orthanc servers during at most this delay.
+     * "0" disables the cache, which is the default.
+     **/
+    void SetLabelsCacheTimeToLive(unsigned int seconds)
+    {
+      labelsCache_.SetTimeToLive(seconds);
+    }
+
+    /**
+     * The global properties that are read by the Orthanc core (e.g.
+     * the schema version and the capabilities of the database) are
+     * kept in memory during the given number of seconds, instead of
+     * being read by one SELECT at each lookup. The properties are
+     * invalidated by the writes of this plugin, and by the writes of
+     * the other Orthanc servers if the cache invalidations are
+     * enabled. "0" disables the cache, which is the default.
+     **/
+    void SetGlobalPropertiesCacheTimeToLive(unsigned int seconds)
+    {
+      globalPropertiesCache_.SetTimeToLive(seconds);
+    }
+
+    /**
+     * Keeps the values of the given identifier tags of all the studies
+     * in memory (e.g. "PatientName", "StudyDate"), so that the
+     * study-level lookups on these tags are restricted to the studies
+     * whose values match, before the database evaluates the lookup.
+     * The store is loaded by the housekeeping thread, then is updated
+     * by the writes of this plugin. It is reloaded at the given
+     * interval of seconds, as it misses the studies that are created
+     * by other Orthanc servers in the meantime, unless the cache
+     * invalidations are enabled. An empty set disables the store,
+     * which is the default.
+     **/
+    void SetStudyColumnStore(const std::set<std::string>& tags,
+                             unsigned int reloadIntervalSeconds)
+    {
+      studyColumnStoreTags_ = tags;
+      studyColumnStoreReloadInterval_ = reloadIntervalSeconds;
+    }
+
+    bool HasStudyColumnStore() const
+    {
+      return !studyColumnStoreTags_.empty();
+    }
+
+    size_t GetStudyColumnStoreSize() const
+    {
+      return studyColumnStore_.GetRowsCount();
+    }
+
+    /**
+     * Exchanges the invalidations of the in-process caches (lookups,
+     * labels, answers of "ExecuteFind()", column store of the studies)
+     * with the other Orthanc servers that share the same database and
+     * that enable this option. Disabled by default.
+     **/
+    void SetCacheInvalidations(bool enabled)
+    {
+      cacheInvalidations_.SetEnabled(enabled);
+    }
+
+    bool HasCacheInvalidations() const
+    {
+      return cacheInvalidations_.IsEnabled();
+    }
+
+    /**
+     * If enabled, the V4 adapter reads the main DICOM tags and the
+     * metadata of all the children of a resource as soon as Orthanc
+     * lists them in a read-only transaction, instead of one query per
+     * child. This helps the versions of Orthanc that don't use
+     * "ExecuteFind()". This is disabled by default.
+     **/
+    void SetChildrenPrefetch(bool enabled)
+    {
+      childrenPrefetch_ = enabled;
+    }
+
+    bool IsChildrenPrefetch() const
+    {
+      return childrenPrefetch_;
+    }
+
+    /**
+     * Parallel mode of "ExecuteFind()" in the read-only transactions
+     * whose number of results is limited: Once the lookup is done,
+     * the other parts of the query (main DICOM tags, metadata,
+     * children...) are distributed over at most "maxConnections" idle
+     * connections of the pool, in addition to the connection of the
+     * transaction. These connections use their own transaction, so
+     * they might observe changes that are more recent than the
+     * lookup. "0" disables this mode, which is the default.
+     **/
+    void SetFindParallelism(size_t maxConnections)
+    {
+      findParallelism_ = maxConnections;
+    }
+
+    /**
+     * If enabled, the lookup of "ExecuteFind()" is executed alone if
+     * its number of results is limited, and the other parts of the
+     * query are only planned and executed if the lookup has selected
+     * some resources. This saves the planning of the whole union in
+     * the case of the empty finds, at the price of one additional
+     * statement for the other finds. Disabled by default.
+     **/
+    void SetFindTwoPhases(bool enabled)
+    {
+      findTwoPhases_ = enabled;
+    }
+
+    /**
+     * If enabled, the rows of the parts of "ExecuteFind()" other than
+     * the lookup (main DICOM tags, metadata, attachments, children...)
+     * are aggregated by the database into one JSON array per resource,
+     * which is returned in an additional column of the lookup. This
+     * divides the number of rows by the number of values of each
+     * resource. Only used by PostgreSQL and MySQL >= 8, and ignored if
+     * the lookup is executed alone (cf. "SetFindTwoPhases()").
+     * Disabled by default.
+     **/
+    void SetFindJsonAggregation(bool enabled)
+    {
+      findJsonAggregation_ = enabled;
+    }
+
+    /**
+     * Maximum duration of the lookups of "ExecuteFind()" and
+     * "ExecuteCount()", in milliseconds ("0" means no limit, which is
+     * the default), so that a runaway lookup (e.g. a wildcard on a tag
+     * that is not indexed) doesn't hold its connection for minutes.
+     **/
+    void SetFindStatementTimeout(unsigned int milliseconds)
+    {
+      findStatementTimeout_ = milliseconds;
+    }
+
+    /**
+     * Memory budget of the answer of one "ExecuteFind()" or of one
+     * listing of all the resources of a level, in bytes ("0" means
+     * no limit, which is the default). The answer is estimated while
+     * its rows are read, and the request fails with "not enough
+     * memory" as soon as the budget is exceeded, instead of growing
+     * the answer (and its serialization) without bound.
+     **/
+    void SetMaxResponseSize(uint64_t size)
+    {
+      maxResponseSize_ = size;
+    }
+
+    uint64_t GetMaxResponseSize() const
+    {
+      return maxResponseSize_;
+    }
+
+    /**
+     * Plan cache mode of the statements of "LookupResources()",
+     * "ExecuteFind()" and "ExecuteCount()", that are cached by the
+     * shape of the lookup: The best plan of a shape might depend on
+     * the values of its parameters (e.g. a frequent vs. a rare
+     * modality). Only taken into account by PostgreSQL.
+     **/
+    void SetLookupPlanCacheMode(PlanCacheMode mode)
+    {
+      lookupPlanCacheMode_ = mode;
+    }
+
+    // Set by "IndexConnectionsPool"
+    void SetIdleConnections(IIdleConnections* connections)
+    {
+      idleConnections_ = connections;
+    }
+
+    /**
+     * Connections to a read-only replica of the database (e.g. a
+     * PostgreSQL hot standby), that are used by the read-only
+     * transactions. By default, there is no replica.
+     **/
+    virtual size_t GetReplicaConnectionsCount() const
+    {
+      return 0;
+    }
+
+    virtual IDatabaseFactory* CreateReplicaDatabaseFactory()
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+    }
+
+    /**
+     * Read-your-writes consistency of the read-only replica: After a
+     * commit of this Orthanc server, the read-only transactions are
+     * only routed to the replica once it has replayed the commit, and
+     * to the primary database otherwise. The positions in the log of
+     * the database are only compared with each other. A commit
+     * position of "0" means that the backend cannot track the commits,
+     * in which case the replica is always used.
+     **/
+    void SetReplicaReadYourWrites(bool enabled)
+    {
+      replicaReadYourWrites_ = enabled;
+    }
+
+    bool IsReplicaReadYourWrites() const
+    {
+      return replicaReadYourWrites_;
+    }
+
+    // Whether the backend has a bulk-load mode (cf. "/index/bulk-load")
+    virtual bool HasBulkLoad() const
+    {
+      return false;
+    }
+
+    virtual bool IsBulkLoad() const
+    {
+      return false;
+    }
+
+    // Must be called on the connection that writes to the database, outside of a transaction
+    virtual void SetBulkLoad(DatabaseManager& manager,
+                             bool enabled)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+    }
+
+    // Position of the last commit, read on a connection to the primary database
+    virtual uint64_t GetCommitPosition(DatabaseManager& manager)
+    {
+      return 0;
+    }
+
+    // Position of the log that was replayed by the replica, "0" if unknown
+    virtual uint64_t GetReplayPosition(DatabaseManager& replica)
+    {
+      return 0;
+    }
+
+    // Connection that is dedicated to the housekeeping tasks, which
+    // can have its own session settings
+    virtual IDatabaseFactory* CreateHousekeepingDatabaseFactory()
+    {
+      return CreateDatabaseFactory();
+    }
+
     virtual void SetOutputFactory(IDatabaseBackendOutput::IFactory* factory) ORTHANC_OVERRIDE;
     
     virtual IDatabaseBackendOutput* CreateOutput() ORTHANC_OVERRIDE;
@@ -120,6 +1118,19 @@ namespace OrthancDatabases
                                 DatabaseManager& manager,
                                 int64_t id) ORTHANC_OVERRIDE;
 
+    /**
+     * Deletes a set of resources at once (e.g. for retention
+     * policies). The deleted attachments and resources are signaled
+     * to "output", but the remaining ancestors are stored into
+     * "remainingAncestors" (map from public ID to resource type), as
+     * there can be several of them. By default, this loops over
+     * "DeleteResource()".
+     **/
+    virtual void DeleteResources(IDatabaseBackendOutput& output,
+                                 std::map<std::string, OrthancPluginResourceType>& remainingAncestors,
+                                 DatabaseManager& manager,
+                                 const std::list<int64_t>& ids);
+
     virtual void GetAllInternalIds(std::list<int64_t>& target,
                                    DatabaseManager& manager,
                                    OrthancPluginResourceType resourceType) ORTHANC_OVERRIDE;
@@ -133,6 +1144,55 @@ namespace OrthancDatabases
                                  OrthancPluginResourceType resourceType,
                                  int64_t since,
                                  uint32_t limit) ORTHANC_OVERRIDE;
+
+    /**
+     * The overloads below write the values of the listing primitives
+     * straight into the repeated fields of the protobuf responses of
+     * the V4 adapter, without any intermediate "std::list". They run
+     * the same SQL as the virtual methods of the same name, so a
+     * backend that overrides one of these virtual methods must also
+     * override the corresponding overload.
+     **/
+    virtual void GetAllPublicIds(google::protobuf::RepeatedPtrField<std::string>& target,
+                                 DatabaseManager& manager,
+                                 OrthancPluginResourceType resourceType);
+
+    virtual void GetAllPublicIds(google::protobuf::RepeatedPtrField<std::string>& target,
+                                 DatabaseManager& manager,
+                                 OrthancPluginResourceType resourceType,
+                                 int64_t since,
+                                 uint32_t limit);
+
+    virtual void GetChildrenInternalId(google::protobuf::RepeatedField<int64_t>& target /*out*/,
+                                       DatabaseManager& manager,
+                                       int64_t id);
+
+    virtual void ListAvailableAttachments(google::protobuf::RepeatedField<int32_t>& target /*out*/,
+                                          DatabaseManager& manager,
+                                          int64_t id);
+
+    /**
+     * Batched version of "LookupAttachment()": Reads all the
+     * attachments of the given resources, with their revisions, in a
+     * single statement. One "Find_Response" is added per resource that
+     * has attachments, in the "internal_id" order, whose
+     * "attachments" and "attachments_revisions" are filled.
+     **/
+    virtual void LookupAttachments(google::protobuf::RepeatedPtrField<Orthanc::DatabasePluginMessages::Find_Response>& target /*out*/,
+                                   DatabaseManager& manager,
+                                   const std::set<int64_t>& ids);
+
+    virtual void GetChildrenMetadata(google::protobuf::RepeatedPtrField<std::string>& target,
+                                     DatabaseManager& manager,
+                                     int64_t resourceId,
+                                     int32_t metadata);
+
+    virtual void ListLabels(google::protobuf::RepeatedPtrField<std::string>& target,
+                            DatabaseManager& manager,
+                            int64_t resource);
+
+    virtual void ListAllLabels(google::protobuf::RepeatedPtrField<std::string>& target,
+                               DatabaseManager& manager);
     
     virtual void GetChanges(IDatabaseBackendOutput& output,
                             bool& done /*out*/,
@@ -148,6 +1208,24 @@ namespace OrthancDatabases
                                     const std::set<uint32_t>& changeTypes,
                                     uint32_t limit) ORTHANC_OVERRIDE;
 
+    /**
+     * Cursor over the changes of the given types (all the types if
+     * empty), that are read through the "(changeType, seq)" index.
+     * Contrarily to "GetChangesExtended()", "next" is the sequence
+     * number from which the consumer must resume, even if none of the
+     * scanned changes matches the types: It is the last answered
+     * change if "done" is "false", or the last change of the database
+     * otherwise. The V4 adapter publishes this cursor at the URI
+     * "/index/changes" of the REST API.
+     **/
+    void GetChangesCursor(IDatabaseBackendOutput& output,
+                          bool& done /*out*/,
+                          int64_t& next /*out*/,
+                          DatabaseManager& manager,
+                          int64_t since,
+                          const std::set<uint32_t>& changeTypes,
+                          uint32_t limit);
+
     virtual void GetChildrenInternalId(std::list<int64_t>& target /*out*/,
                                        DatabaseManager& manager,
                                        int64_t id) ORTHANC_OVERRIDE;
@@ -155,6 +1233,26 @@ namespace OrthancDatabases
     virtual void GetChildrenPublicId(std::list<std::string>& target /*out*/,
                                      DatabaseManager& manager,
                                      int64_t id) ORTHANC_OVERRIDE;
+
+    /**
+     * Keyset-paged version of "GetChildrenPublicId()": Reads at most
+     * "limit" children whose internal ID is above "last", in the
+     * order of their internal IDs, and updates "last" to the internal
+     * ID of the last child that was read (start with "last = -1").
+     * Returns "true" iff there are no more children.
+     **/
+    bool GetChildrenPublicId(std::vector<std::string>& target /*out*/,
+                             int64_t& last /*inout*/,
+                             DatabaseManager& manager,
+                             int64_t id,
+                             uint32_t limit);
+
+    // Reads the public IDs of at most "limit" instances below the given resource
+    void GetDescendantInstances(std::vector<std::string>& target /*out*/,
+                                DatabaseManager& manager,
+                                int64_t id,
+                                Orthanc::ResourceType level,
+                                uint32_t limit);
     
     virtual void GetExportedResources(IDatabaseBackendOutput& output,
                                       bool& done /*out*/,
@@ -263,6 +1361,12 @@ namespace OrthancDatabases
     virtual bool SelectPatientToRecycle(int64_t& internalId /*out*/,
                                         DatabaseManager& manager,
                                         int64_t patientIdToAvoid) ORTHANC_OVERRIDE;
+
+    // Selects at most "count" patients in the recycling order, that
+    // are locked as in "SelectPatientToRecycle()"
+    void SelectPatientsToRecycle(std::list<int64_t>& internalIds /*out*/,
+                                 DatabaseManager& manager,
+                                 uint32_t count);
     
     virtual void SetGlobalProperty(DatabaseManager& manager,
                                    const char* serverIdentifier,
@@ -340,6 +1444,94 @@ namespace OrthancDatabases
       const OrthancPluginResourcesContentMetadata* metadata) ORTHANC_OVERRIDE;
 #endif
 
+    /**
+     * If this returns "true", the V4 adapter postpones the writes that
+     * the Orthanc core issues while ingesting an instance, and sends
+     * them at once to "FlushDeferredWrites()" before the next
+     * operation of the transaction.
+     **/
+    virtual bool HasDeferredWrites() const
+    {
+      return false;
+    }
+
+    // The default implementation executes the writes one by one
+    virtual void FlushDeferredWrites(DatabaseManager& manager,
+                                     const DeferredWrites& writes);
+
+    // Multi-key version of "SetMetadata()", as a single upsert
+    // statement per batch of rows if the dialect supports it
+    void SetResourcesMetadata(DatabaseManager& manager,
+                              const std::vector<DeferredWrites::ResourceMetadata>& items);
+
+    // Multi-row version of "LogExportedResource()"
+    void LogExportedResources(DatabaseManager& manager,
+                              const std::vector<DeferredWrites::ExportedResource>& resources);
+
+    /**
+     * Deletes the exported resources whose date (in the ISO format
+     * "YYYYMMDDTHHMMSS") is before "olderThan", by batches of
+     * consecutive sequence numbers. Each batch is deleted by its own
+     * transaction, so this must be called outside of a transaction.
+     **/
+    void DeleteExpiredExportedResources(DatabaseManager& manager,
+                                        const std::string& olderThan,
+                                        unsigned int batchSize);
+
+    /**
+     * Writes the deltas of the analytics export, until the last
+     * change. Each delta is read by its own transaction, so this must
+     * be called outside of a transaction. Returns the number of deltas.
+     **/
+    unsigned int ExportAnalytics(DatabaseManager& manager);
+
+    /**
+     * Reads one page of the content of the index for the local
+     * replicas. If "changes" is "false", the page contains the
+     * resources whose internal ID is above "since", in the order of
+     * their internal IDs. Otherwise, it contains the resources that
+     * were changed after the sequence number "since". The answer has
+     * the fields "Resources" (with their tags, identifiers, metadata,
+     * attachments and labels), "Done", "Next" (the "since" of the next
+     * page) and "LastChange". Must be called inside a transaction.
+     **/
+    void ReadReplicaPage(Json::Value& target /*out*/,
+                         DatabaseManager& manager,
+                         int64_t since,
+                         uint32_t limit,
+                         bool changes);
+
+    /**
+     * Resources of one level whose "LastUpdate" metadata is in the
+     * window ["since", "to"[ (an empty "to" means no upper bound), in
+     * the order of this date then of their internal ID, for the
+     * incremental synchronizations. The page starts strictly after the
+     * resource "(since, sinceId)", so that the resources that share
+     * the same date are not skipped. The answer has the fields
+     * "Resources", "Done", "Since" and "SinceID" (the arguments of the
+     * next page). This is an index range scan if the backend has the
+     * "LastUpdate" index (cf. option "EnableLastUpdateIndex"), that also
+     * serves the constraints of "ExecuteFind()" on this metadata.
+     *
+     * WARNING: "LastUpdate" is written by the Orthanc core before its
+     * transaction commits, using the clock of the Orthanc server that
+     * did the write. A resource can thus become visible after the
+     * resources with a later date were returned, and the clocks of
+     * several Orthanc servers might be skewed. Once the last page is
+     * reached ("Done" is "true"), "Since" is therefore rewound by a
+     * safety margin before the current time (with "SinceID" set to
+     * "-1"), so that the late resources are read by the next poll:
+     * The clients must accept to receive a resource more than once.
+     * The deleted resources are not reported.
+     **/
+    void LookupUpdatedResources(Json::Value& target /*out*/,
+                                DatabaseManager& manager,
+                                OrthancPluginResourceType level,
+                                const std::string& since,
+                                int64_t sinceId,
+                                const std::string& to,
+                                uint32_t limit);
+
     // New primitive since Orthanc 1.5.2
     virtual void GetChildrenMetadata(std::list<std::string>& target,
                                      DatabaseManager& manager,
@@ -361,10 +1553,22 @@ namespace OrthancDatabases
                                 DatabaseManager& manager,
                                 int64_t id) ORTHANC_OVERRIDE;
 
+    // Batched version of "GetMainDicomTags()", that uses
+    // "output.AnswerResourceDicomTag()"
+    void GetResourcesMainDicomTags(IDatabaseBackendOutput& output,
+                                   DatabaseManager& manager,
+                                   const std::list<int64_t>& ids);
+
+    // Batched version of "GetAllMetadata()", the resources without
+    // metadata are absent from "result"
+    void GetResourcesMetadata(std::map<int64_t, std::map<int32_t, std::string> >& result,
+                              DatabaseManager& manager,
+                              const std::list<int64_t>& ids);
+
     virtual bool HasCreateInstance() const ORTHANC_OVERRIDE
     {
-      // This extension is available in PostgreSQL and MySQL, but is
-      // emulated by "CreateInstanceGeneric()" in SQLite
+      // This extension is available in PostgreSQL, MySQL and SQLite,
+      // but is emulated by "CreateInstanceGeneric()" in ODBC
       return false;
     }
       
@@ -446,6 +1650,38 @@ namespace OrthancDatabases
 
     virtual bool HasFindSupport() const ORTHANC_OVERRIDE;
 
+    // Reads the values of the ordering keys of the last resource of a page
+    bool LookupKeysetBound(FindKeysetBound& target,
+                           DatabaseManager& manager,
+                           const Orthanc::DatabasePluginMessages::Find_Request& request,
+                           const std::string& publicId);
+
+    // Same as the other overload, for the labels of a request
+    bool LookupLabelsResources(LabelsCache::Resources& target,
+                               DatabaseManager& manager,
+                               const Orthanc::DatabasePluginMessages::Find_Request& request);
+
+    // Candidates of a study-level request (cf. "StudyColumnStore")
+    bool LookupStudyCandidates(StudyColumnStore::Resources& target,
+                               const Orthanc::DatabasePluginMessages::Find_Request& request);
+
+    // Formats the lookup branch and the branches of the content to be
+    // retrieved by "ExecuteFind()" (cf. "FindProjectionsCache")
+    void FormatFindProjection(FindProjectionsCache::Projection& target,
+                              LookupFormatter& formatter,
+                              const Orthanc::DatabasePluginMessages::Find_Request& request);
+
+    // Second phase of "ExecuteFind()", once the lookup has been done,
+    // optionally distributed over the idle connections
+    void ExecuteFindBranches(Orthanc::DatabasePluginMessages::TransactionResponse& response,
+                             std::map<int64_t, Orthanc::DatabasePluginMessages::Find_Response*>& responses,
+                             DatabaseManager& manager,
+                             const Orthanc::DatabasePluginMessages::Find_Request& request,
+                             const std::string& oneInstanceCTEs,
+                             const std::vector<std::string>& branches,
+                             bool parallel,
+                             ResponseBudget& budget);
+
     virtual void ExecuteFind(Orthanc::DatabasePluginMessages::TransactionResponse& response,
                              DatabaseManager& manager,
                              const Orthanc::DatabasePluginMessages::Find_Request& request) ORTHANC_OVERRIDE;
@@ -458,6 +1694,34 @@ namespace OrthancDatabases
 
     virtual void PerformDbHousekeeping(DatabaseManager& manager) ORTHANC_OVERRIDE;
 
+    /**
+     * The housekeeping thread of "IndexConnectionsPool" runs each
+     * task of the scheduler at its own interval, on a dedicated
+     * connection. By default, "PerformDbHousekeeping()" is the only
+     * task, named "Housekeeping".
+     **/
+    virtual void RegisterHousekeepingTasks(HousekeepingScheduler& scheduler,
+                                           unsigned int defaultIntervalSeconds,
+                                           const boost::posix_time::ptime& now);
+
+    virtual void PerformHousekeepingTask(DatabaseManager& manager,
+                                         const std::string& task);
+
+    /**
+     * Size of the database as reported by the database engine, in
+     * bytes. Returns "false" if the engine cannot report it.
+     **/
+    virtual bool LookupDatabaseSize(uint64_t& target /*out*/,
+                                    DatabaseManager& manager);
+
+    /**
+     * Collects the gauges of the database, indexed by the name of
+     * their Orthanc metrics. They are published by the housekeeping
+     * task "DatabaseMetrics", if "DatabaseMetricsInterval" is set.
+     **/
+    virtual void CollectDatabaseMetrics(std::map<std::string, float>& metrics /*out*/,
+                                        DatabaseManager& manager);
+
 #endif
 
 
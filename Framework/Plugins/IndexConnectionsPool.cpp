@@ -23,198 +23,1785 @@
 
 #include "IndexConnectionsPool.h"
 
+#include "../../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
 #include <Logging.h>
 
+#include <algorithm>
+#include <map>
+
+
+namespace OrthancDatabases
+{
+  // Number of times a thread yields before waiting for a connection to be released
+  static const unsigned int ACQUIRE_SPIN_COUNT = 16;
+
+
+  class IndexConnectionsPool::ManagerReference : public boost::noncopyable
+  {
+  private:
+    DatabaseManager*          manager_;
+    boost::posix_time::ptime  released_;
+    boost::posix_time::ptime  checked_;
+    boost::thread::id         owner_;     // Thread that released the connection
+
+  public:
+    explicit ManagerReference(DatabaseManager& manager) :
+      manager_(&manager)
+    {
+      SignalReleased();
+    }
+
+    const boost::thread::id& GetOwner() const
+    {
+      return owner_;
+    }
+
+    DatabaseManager& GetManager()
+    {
+      assert(manager_ != NULL);
+      return *manager_;
+    }
+
+    // Time since the connection was put back into the available connections
+    boost::posix_time::time_duration GetIdleDuration() const
+    {
+      return boost::posix_time::microsec_clock::universal_time() - released_;
+    }
+
+    // Time since the connection was last used, or health-checked
+    boost::posix_time::time_duration GetUncheckedDuration() const
+    {
+      return boost::posix_time::microsec_clock::universal_time() - checked_;
+    }
+
+    void SignalChecked()
+    {
+      checked_ = boost::posix_time::microsec_clock::universal_time();
+    }
+
+    void SignalReleased()
+    {
+      released_ = boost::posix_time::microsec_clock::universal_time();
+      checked_ = released_;
+      owner_ = boost::this_thread::get_id();
+    }
+  };
+
+
+  /**
+   * Connections that are available in the pool, from the least to
+   * the most recently released one. The housekeeping always visits
+   * the least recently released connections, whatever the policy
+   * used to hand out the connections to the requests.
+   *
+   * The reference of a connection is created once, when it is first
+   * released: Handing out and giving back a connection doesn't
+   * allocate memory, and the critical sections only move pointers.
+   **/
+  class IndexConnectionsPool::AvailableConnections : public boost::noncopyable
+  {
+  private:
+    typedef std::map<DatabaseManager*, ManagerReference*>  References;
+
+    boost::mutex                     mutex_;
+    boost::condition_variable        released_;
+    References                       references_;  // All the connections, including the ones in use
+    std::vector<ManagerReference*>   available_;
+    size_t                           waiters_;
+    bool                             lifo_;
+    bool                             affinity_;
+
+    ManagerReference* TakeAt(size_t index)
+    {
+      assert(index < available_.size());
+      ManagerReference* reference = available_[index];
+      available_.erase(available_.begin() + index);
+      return reference;
+    }
+
+    void Push(ManagerReference* reference,
+              bool front)
+    {
+      if (front)
+      {
+        available_.insert(available_.begin(), reference);
+      }
+      else
+      {
+        available_.push_back(reference);
+      }
+
+      if (waiters_ > 0)
+      {
+        released_.notify_one();  // Don't signal the condition variable if nobody waits
+      }
+    }
+
+  public:
+    AvailableConnections(size_t capacity,
+                         bool lifo,
+                         bool affinity) :
+      waiters_(0),
+      lifo_(lifo),
+      affinity_(affinity)
+    {
+      available_.reserve(capacity);
+    }
+
+    ~AvailableConnections()
+    {
+      for (References::iterator it = references_.begin(); it != references_.end(); ++it)
+      {
+        assert(it->second != NULL);
+        delete it->second;
+      }
+    }
+
+    size_t GetSize()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return available_.size();
+    }
+
+    void Release(DatabaseManager& manager)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      References::iterator found = references_.find(&manager);
+
+      ManagerReference* reference;
+      if (found == references_.end())
+      {
+        // New connection
+        std::unique_ptr<ManagerReference> protection(new ManagerReference(manager));
+        references_[&manager] = protection.get();
+        reference = protection.release();
+      }
+      else
+      {
+        reference = found->second;
+        reference->SignalReleased();
+      }
+
+      Push(reference, false);
+    }
+
+    // Returns NULL if no connection was released before the timeout
+    DatabaseManager* Acquire(unsigned int milliseconds)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      // Short spin before parking the thread, as the connections are
+      // typically held for much less than the cost of a wake up
+      for (unsigned int i = 0; available_.empty() && i < ACQUIRE_SPIN_COUNT; i++)
+      {
+        lock.unlock();
+        boost::this_thread::yield();
+        lock.lock();
+      }
+
+      if (available_.empty())
+      {
+        const boost::system_time timeout = boost::get_system_time() + boost::posix_time::milliseconds(milliseconds);
+
+        waiters_++;
+
+        while (available_.empty())
+        {
+          if (!released_.timed_wait(lock, timeout) &&
+              available_.empty())
+          {
+            waiters_--;
+            return NULL;
+          }
+        }
+
+        waiters_--;
+      }
+
+      if (affinity_)
+      {
+        const boost::thread::id self = boost::this_thread::get_id();
+
+        for (size_t i = available_.size(); i > 0; i--)
+        {
+          if (available_[i - 1]->GetOwner() == self)
+          {
+            return &TakeAt(i - 1)->GetManager();
+          }
+        }
+      }
+
+      if (lifo_)
+      {
+        ManagerReference* reference = available_.back();
+        available_.pop_back();
+        return &reference->GetManager();
+      }
+      else
+      {
+        return &TakeAt(0)->GetManager();
+      }
+    }
+
+    // Returns NULL if all the connections are in use
+    ManagerReference* AcquireOldest()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (available_.empty())
+      {
+        return NULL;
+      }
+      else
+      {
+        return TakeAt(0);
+      }
+    }
+
+    // Puts back a connection given by "AcquireOldest()", without altering its reference
+    void Restore(ManagerReference* reference,
+                 bool asOldest)
+    {
+      assert(reference != NULL);
+      boost::mutex::scoped_lock lock(mutex_);
+      Push(reference, asOldest);
+    }
+
+    // Forgets about a connection given by "AcquireOldest()", that is about to be closed
+    void Remove(ManagerReference* reference)
+    {
+      assert(reference != NULL);
+
+      {
+        boost::mutex::scoped_lock lock(mutex_);
+        references_.erase(&reference->GetManager());
+      }
+
+      delete reference;
+    }
+  };
+
+
+  class IndexConnectionsPool::IdleConnections : public IndexBackend::IIdleConnections
+  {
+  private:
+    IndexConnectionsPool&  pool_;
+
+  public:
+    explicit IdleConnections(IndexConnectionsPool& pool) :
+      pool_(pool)
+    {
+    }
+
+    virtual DatabaseManager* TryAcquireIdleConnection() ORTHANC_OVERRIDE
+    {
+      // The caller holds an accessor, hence a shared lock on
+      // "connectionsMutex_": The connections cannot be removed. The
+      // pool is not grown, as the caller can do without this connection.
+      return pool_.availableConnections_->Acquire(0);
+    }
+
+    virtual void ReleaseIdleConnection(DatabaseManager& manager) ORTHANC_OVERRIDE
+    {
+      pool_.availableConnections_->Release(manager);
+    }
+  };
+
+
+  class IndexConnectionsPool::CommitGroup : public boost::noncopyable
+  {
+  private:
+    DatabaseManager&                manager_;      // Connection of the accessor that created the group
+    boost::mutex                    operationsMutex_;
+    Orthanc::Toolbox::ElapsedTimer  age_;
+    size_t                          members_;      // Number of transactions that have joined the group
+    size_t                          finished_;     // Number of transactions that have committed or rolled back
+    size_t                          references_;   // Number of accessors that have not left the group yet
+    bool                            closed_;       // No more transaction can join the group
+    bool                            failed_;
+    bool                            done_;
+
+  public:
+    explicit CommitGroup(DatabaseManager& manager) :
+      manager_(manager),
+      members_(1),
+      finished_(0),
+      references_(1),
+      closed_(false),
+      failed_(false),
+      done_(false)
+    {
+    }
+
+    DatabaseManager& GetManager() const
+    {
+      return manager_;
+    }
+
+    boost::mutex& GetOperationsMutex()
+    {
+      return operationsMutex_;
+    }
+
+    uint64_t GetAge()  // In milliseconds
+    {
+      return age_.GetElapsedMicroseconds() / 1000;
+    }
+
+    friend class IndexConnectionsPool;
+  };
+
+
+  static const unsigned int METRICS_PUBLICATION_DELAY_SECONDS = 10;
+
+
+  // Delay after which a task that was postponed because of a saturated pool is considered again
+  static const unsigned int HOUSEKEEPING_POSTPONE_DELAY_SECONDS = 1;
+
+
+  // Maximum number of connections that are concurrently opened at startup
+  static const size_t MAX_OPENING_THREADS = 8;
+
+
+  bool IndexConnectionsPool::IsSaturated()
+  {
+    size_t countConnections;
+
+    {
+      boost::mutex::scoped_lock lock(elasticMutex_);
+      countConnections = countConnections_;
+    }
+
+    size_t active = 0;
+
+    {
+      boost::mutex::scoped_lock lock(accessorsMutex_);
+
+      for (std::set<Accessor*>::const_iterator it = activeAccessors_.begin(); it != activeAccessors_.end(); ++it)
+      {
+        assert(*it != NULL);
+        if (!(*it)->IsReplica())
+        {
+          active++;
+        }
+      }
+    }
+
+    return active >= countConnections;
+  }
+
+
+  void IndexConnectionsPool::RunHousekeepingTasks()
+  {
+    assert(housekeepingScheduler_.get() != NULL &&
+           housekeepingConnection_.get() != NULL);
+
+    for (size_t i = 0; i < housekeepingScheduler_->GetTasksCount(); i++)
+    {
+      const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+      if (housekeepingScheduler_->IsDue(i, now))
+      {
+        const std::string& task = housekeepingScheduler_->GetTaskName(i);
+
+        if (IsSaturated() &&
+            housekeepingScheduler_->CanPostpone(i, now))
+        {
+          // Backpressure: Leave the database to the requests
+          LOG(INFO) << "Postponing the housekeeping task " << task << ", as all the connections to the database are in use";
+          housekeepingScheduler_->Postpone(i, now, boost::posix_time::seconds(HOUSEKEEPING_POSTPONE_DELAY_SECONDS));
+          continue;
+        }
+
+        Orthanc::Toolbox::ElapsedTimer timer;
+        bool success = false;
+
+        try
+        {
+          backend_->PerformHousekeepingTask(*housekeepingConnection_, task);
+          success = true;
+        }
+        catch (Orthanc::OrthancException& e)
+        {
+          LOG(ERROR) << "Exception during the database housekeeping task " << task << ": " << e.What();
+        }
+        catch (...)
+        {
+          LOG(ERROR) << "Native exception during the database housekeeping task " << task;
+        }
+
+        operationsStatistics_.Add("HOUSEKEEPING_" + task, timer.GetElapsedMicroseconds(), success);
+        housekeepingScheduler_->SignalExecuted(i, boost::posix_time::microsec_clock::universal_time());
+      }
+    }
+  }
+
+
+  void IndexConnectionsPool::OpeningThread(IndexConnectionsPool* that)
+  {
+    /**
+     * Each connection involves a network round-trip, a TLS handshake
+     * and the authentication: The connections beyond the first one
+     * are opened concurrently, while the pool is already in use.
+     **/
+    for (;;)
+    {
+      {
+        boost::mutex::scoped_lock lock(that->housekeepingMutex_);
+        if (!that->housekeepingContinue_)
+        {
+          return;  // The pool is being closed
+        }
+      }
+
+      size_t minConnections;
+
+      {
+        boost::mutex::scoped_lock lock(that->elasticMutex_);
+        minConnections = that->minConnections_;
+      }
+
+      DatabaseManager* manager = NULL;
+
+      try
+      {
+        manager = that->GrowConnections(minConnections);
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        // The missing connections will be opened on demand
+        LOG(ERROR) << "Cannot open a connection to the database at startup: " << e.What();
+        return;
+      }
+
+      if (manager == NULL)
+      {
+        return;  // The pool contains its minimum number of connections
+      }
+      else
+      {
+        that->availableConnections_->Release(*manager);
+      }
+    }
+  }
+
+
+  void IndexConnectionsPool::JoinOpeningThreads()
+  {
+    for (size_t i = 0; i < openingThreads_.size(); i++)
+    {
+      assert(openingThreads_[i] != NULL);
+
+      if (openingThreads_[i]->joinable())
+      {
+        openingThreads_[i]->join();
+      }
+
+      delete openingThreads_[i];
+    }
+
+    openingThreads_.clear();
+  }
+
+
+  void IndexConnectionsPool::ApplyHousekeepingChanges()
+  {
+    std::map<std::string, unsigned int> changes;
+
+    {
+      boost::mutex::scoped_lock lock(housekeepingMutex_);
+      changes.swap(housekeepingChanges_);
+      housekeepingWakeUp_ = false;
+    }
+
+    const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+    for (std::map<std::string, unsigned int>::const_iterator it = changes.begin(); it != changes.end(); ++it)
+    {
+      if (housekeepingScheduler_->SetInterval(it->first, it->second, now))
+      {
+        LOG(WARNING) << "The interval of the housekeeping task " << it->first << " is now "
+                     << it->second << " second(s)" << (it->second == 0 ? " (disabled)" : "");
+      }
+    }
+  }
+
+
+  void IndexConnectionsPool::HousekeepingThread(IndexConnectionsPool* that)
+  {
+    boost::posix_time::ptime lastMetricsPublication = boost::posix_time::microsec_clock::universal_time();
+
+    // The monitoring of the connections needs a granularity of one second
+    const bool hasMonitoring = (that->holdWarningThreshold_ != 0 ||
+                                that->idleConnectionsTimeout_ != 0 ||
+                                that->healthCheckInterval_ != 0);
+
+    for (;;)
+    {
+      that->ApplyHousekeepingChanges();
+
+      if (!that->housekeepingScheduler_->IsEmpty())
+      {
+        that->RunHousekeepingTasks();
+      }
+
+      that->WarnAboutLongHeldConnections();
+
+      try
+      {
+        that->CloseIdleConnections();
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        LOG(ERROR) << "Exception while closing the idle connections to the database: " << e.What();
+      }
+
+      that->CheckConnectionsHealth(*that->availableConnections_);
+      that->CheckConnectionsHealth(*that->availableReplicaConnections_);
+
+      if (boost::posix_time::microsec_clock::universal_time() - lastMetricsPublication >=
+          boost::posix_time::seconds(METRICS_PUBLICATION_DELAY_SECONDS))
+      {
+        try
+        {
+          that->operationsStatistics_.Publish(that->context_);
+          that->PublishConnectionsMetrics();
+        }
+        catch (Orthanc::OrthancException& e)
+        {
+          LOG(ERROR) << "Exception while publishing the metrics of the database: " << e.What();
+        }
+
+        lastMetricsPublication = boost::posix_time::microsec_clock::universal_time();
+      }
+
+      // Sleep until the next deadline, instead of polling
+      boost::posix_time::ptime wakeUp = lastMetricsPublication + boost::posix_time::seconds(METRICS_PUBLICATION_DELAY_SECONDS);
+
+      if (!that->housekeepingScheduler_->IsEmpty() &&
+          that->housekeepingScheduler_->GetNextDeadline() < wakeUp)
+      {
+        wakeUp = that->housekeepingScheduler_->GetNextDeadline();
+      }
+
+      if (hasMonitoring)
+      {
+        const boost::posix_time::ptime next = boost::posix_time::microsec_clock::universal_time() + boost::posix_time::seconds(1);
+        if (next < wakeUp)
+        {
+          wakeUp = next;
+        }
+      }
+
+      {
+        boost::mutex::scoped_lock lock(that->housekeepingMutex_);
+
+        while (that->housekeepingContinue_ &&
+               !that->housekeepingWakeUp_ &&
+               boost::posix_time::microsec_clock::universal_time() < wakeUp)
+        {
+          that->housekeepingCondition_.timed_wait(lock, wakeUp);
+        }
+
+        if (!that->housekeepingContinue_)
+        {
+          return;
+        }
+      }
+    }
+  }
+
+
+  IndexConnectionsPool::IndexConnectionsPool(IndexBackend* backend,
+                                             size_t countConnections,
+                                             unsigned int houseKeepingDelaySeconds) :
+    backend_(backend),
+    countConnections_(countConnections),
+    minConnections_(countConnections),
+    idleConnectionsTimeout_(0),
+    healthCheckInterval_(0),
+    pendingConnections_(0),
+    housekeepingContinue_(true),
+    housekeepingWakeUp_(false),
+    housekeepingDelay_(houseKeepingDelaySeconds),
+    operationsStatistics_("orthanc_index_"),
+    failoverRetryBudget_(0),
+    replicaReadYourWrites_(false),
+    commitPosition_(0),
+    peakActiveAccessors_(0),
+    holdWarningThreshold_(0),
+    reservedReadOnly_(0),
+    reservedReadWrite_(0),
+    activeReadOnly_(0),
+    activeReadWrite_(0),
+    openGroup_(NULL),
+    groupCommitSize_(0),
+    groupCommitDelay_(0)
+  {
+    if (countConnections == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "There must be a non-zero number of connections to the database");
+    }
+    else if (backend == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+    }
+    else
+    {
+      context_ = backend_->GetContext();
+      holdWarningThreshold_ = backend_->GetConnectionHoldWarningThreshold();
+
+      idleConnections_.reset(new IdleConnections(*this));
+      backend_->SetIdleConnections(idleConnections_.get());
+      idleConnectionsTimeout_ = backend_->GetIdleConnectionsTimeout();
+      healthCheckInterval_ = backend_->GetHealthCheckInterval();
+      groupCommitSize_ = backend_->GetGroupCommitSize();
+      groupCommitDelay_ = backend_->GetGroupCommitDelay();
+      retryPolicy_.SetMaxWriters(backend_->GetMaxConcurrentWriters());
+      failoverRetryBudget_ = backend_->GetFailoverRetryBudget();
+      admissionController_.SetMaxInFlight(backend_->GetMaxInFlightTransactions());
+      replicaReadYourWrites_ = backend_->IsReplicaReadYourWrites();
+
+      availableConnections_.reset(new AvailableConnections(countConnections, backend_->IsLifoConnections(),
+                                                           backend_->HasConnectionsAffinity()));
+      availableReplicaConnections_.reset(new AvailableConnections(backend_->GetReplicaConnectionsCount(),
+                                                                  backend_->IsLifoConnections(),
+                                                                  backend_->HasConnectionsAffinity()));
+
+      if (backend_->GetMinConnections() > countConnections)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "The minimum number of connections to the database cannot be above their maximum number");
+      }
+      else if (backend_->GetMinConnections() != 0)
+      {
+        minConnections_ = backend_->GetMinConnections();
+      }
+
+      reservedReadOnly_ = backend_->GetReservedReadOnlyConnections();
+      reservedReadWrite_ = backend_->GetReservedReadWriteConnections();
+
+      if (reservedReadOnly_ + reservedReadWrite_ > countConnections)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "There are more reserved connections to the database than connections");
+      }
+    }
+  }
+
+
+  DatabaseManager* IndexConnectionsPool::CreateConnection(IDatabaseFactory* factory)
+  {
+    assert(backend_.get() != NULL);
+
+    std::unique_ptr<DatabaseManager> manager(new DatabaseManager(factory));
+    manager->SetMaxCachedStatements(backend_->GetMaxCachedStatements());
+    manager->SetSlowStatementThreshold(backend_->GetSlowStatementThreshold());
+    manager->SetSlowStatementListener(backend_->GetSlowStatementListener());
+    manager->SetStatementsWarmup(backend_->GetStatementsWarmup());
+    manager->GetDatabase();  // Make sure to open the database connection
+    return manager.release();
+  }
+
+
+  DatabaseManager* IndexConnectionsPool::GrowConnections(size_t limit)
+  {
+    {
+      boost::mutex::scoped_lock lock(elasticMutex_);
+
+      // The maximum number of connections can be lowered at runtime
+      if (connections_.size() + pendingConnections_ >= std::min(limit, countConnections_))
+      {
+        return NULL;
+      }
+      else
+      {
+        pendingConnections_++;
+      }
+    }
+
+    // Open the new connection without locking the pool, as this can take some time
+    std::unique_ptr<DatabaseManager> manager;
+
+    try
+    {
+      manager.reset(CreateConnection());
+    }
+    catch (Orthanc::OrthancException&)
+    {
+      boost::mutex::scoped_lock lock(elasticMutex_);
+      pendingConnections_--;
+      throw;
+    }
+
+    boost::mutex::scoped_lock lock(elasticMutex_);
+    pendingConnections_--;
+    connections_.push_back(manager.get());
+
+    LOG(INFO) << "Opening a new connection to the database, the pool now contains "
+              << connections_.size() << " connection(s)";
+
+    return manager.release();
+  }
+
+
+  void IndexConnectionsPool::CloseIdleConnections()
+  {
+    /**
+     * The front of the available connections is the connection that
+     * has been idle for the longest time. With a LIFO handout, the
+     * connections in excess stay at the front, and can be closed.
+     * The connections above the maximum number (that is lowered by
+     * "Resize()") are closed as soon as they are released.
+     **/
+    for (;;)
+    {
+      bool aboveMaximum;
+
+      {
+        boost::mutex::scoped_lock lock(elasticMutex_);
+        if (connections_.size() <= minConnections_)
+        {
+          return;
+        }
+
+        aboveMaximum = (connections_.size() > countConnections_);
+      }
+
+      if (!aboveMaximum &&
+          idleConnectionsTimeout_ == 0)
+      {
+        return;
+      }
+
+      ManagerReference* reference = availableConnections_->AcquireOldest();
+      if (reference == NULL)
+      {
+        return;  // All the connections are in use
+      }
+
+      if (!aboveMaximum &&
+          reference->GetIdleDuration() < boost::posix_time::seconds(idleConnectionsTimeout_))
+      {
+        availableConnections_->Restore(reference, true /* as oldest */);
+        return;
+      }
+      else
+      {
+        DatabaseManager* manager = &reference->GetManager();
+        availableConnections_->Remove(reference);
+
+        size_t count;
+
+        {
+          boost::mutex::scoped_lock lock(elasticMutex_);
+          connections_.remove(manager);
+          count = connections_.size();
+        }
+
+        delete manager;  // This closes the connection
+
+        LOG(INFO) << "Closing " << (aboveMaximum ? "a" : "an idle") << " connection to the database, the pool now contains "
+                  << count << " connection(s)";
+      }
+    }
+  }
+
+
+  bool IndexConnectionsPool::CheckConnectionHealth(DatabaseManager& manager)
+  {
+    Orthanc::Toolbox::ElapsedTimer timer;
+
+    try
+    {
+      DatabaseManager::StandaloneStatement statement(manager, "SELECT 1");
+      statement.ExecuteWithoutResult();
+
+      operationsStatistics_.Add("HEALTH_CHECK", timer.GetElapsedMicroseconds(), true);
+      return true;
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      operationsStatistics_.Add("HEALTH_CHECK", timer.GetElapsedMicroseconds(), false);
+      LOG(WARNING) << "Broken connection to the database, reconnecting: " << e.What();
+    }
+
+    try
+    {
+      // Reconnect now, instead of during the next request using this connection
+      manager.Close();
+      manager.GetDatabase();
+      return true;
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "Cannot reconnect to the database: " << e.What();
+      return false;
+    }
+  }
+
+
+  void IndexConnectionsPool::CheckConnectionsHealth(AvailableConnections& available)
+  {
+    if (healthCheckInterval_ == 0)
+    {
+      return;
+    }
+
+    // Only visit the connections that were available at the beginning
+    const size_t count = available.GetSize();
+
+    for (size_t i = 0; i < count; i++)
+    {
+      ManagerReference* reference = available.AcquireOldest();
+      if (reference == NULL)
+      {
+        return;  // All the connections are in use
+      }
+
+      bool healthy = true;
+
+      if (reference->GetUncheckedDuration() >= boost::posix_time::seconds(healthCheckInterval_))
+      {
+        healthy = CheckConnectionHealth(reference->GetManager());
+        reference->SignalChecked();
+      }
+
+      /**
+       * The same reference is put back, so that the idle duration and
+       * the owner are unchanged. Once all the connections are visited,
+       * their order is also unchanged.
+       **/
+      available.Restore(reference, false /* as newest */);
+
+      if (!healthy)
+      {
+        return;  // The database is not available, don't try the other connections
+      }
+    }
+  }
+
+
+  void IndexConnectionsPool::RegisterAccessor(Accessor& accessor)
+  {
+    boost::mutex::scoped_lock lock(accessorsMutex_);
+    activeAccessors_.insert(&accessor);
+
+    if (activeAccessors_.size() > peakActiveAccessors_)
+    {
+      peakActiveAccessors_ = activeAccessors_.size();
+    }
+  }
+
+
+  void IndexConnectionsPool::UnregisterAccessor(Accessor& accessor)
+  {
+    const uint64_t held = accessor.heldTimer_.GetElapsedMicroseconds() / 1000;  // In milliseconds
+
+    boost::mutex::scoped_lock lock(accessorsMutex_);
+    activeAccessors_.erase(&accessor);
+
+    if (holdWarningThreshold_ != 0 &&
+        held >= static_cast<uint64_t>(holdWarningThreshold_) * 1000)
+    {
+      LOG(WARNING) << "A connection to the database has been held during " << held
+                   << "ms, last operation: " << accessor.GetOperation();
+    }
+  }
+
+
+  void IndexConnectionsPool::WarnAboutLongHeldConnections()
+  {
+    if (holdWarningThreshold_ != 0)
+    {
+      boost::mutex::scoped_lock lock(accessorsMutex_);
+
+      for (std::set<Accessor*>::iterator it = activeAccessors_.begin(); it != activeAccessors_.end(); ++it)
+      {
+        assert(*it != NULL);
+        Accessor& accessor = **it;
+
+        const uint64_t held = accessor.heldTimer_.GetElapsedMicroseconds() / 1000;  // In milliseconds
+
+        if (!accessor.hasWarned_ &&
+            held >= static_cast<uint64_t>(holdWarningThreshold_) * 1000)
+        {
+          LOG(WARNING) << "A connection to the database is held since " << held
+                       << "ms, current operation: " << accessor.GetOperation();
+          accessor.hasWarned_ = true;
+        }
+      }
+    }
+  }
+
+
+  void IndexConnectionsPool::PublishConnectionsMetrics()
+  {
+#if HAS_ORTHANC_PLUGIN_METRICS == 1
+    size_t active, peak, count;
+
+    {
+      boost::mutex::scoped_lock lock(accessorsMutex_);
+      active = activeAccessors_.size();
+      peak = peakActiveAccessors_;
+    }
+
+    {
+      boost::mutex::scoped_lock lock(elasticMutex_);
+      count = connections_.size();
+    }
+
+    OrthancPluginSetMetricsValue(context_, "orthanc_index_connections_count",
+                                 static_cast<float>(count), OrthancPluginMetricsType_Default);
+    OrthancPluginSetMetricsValue(context_, "orthanc_index_connections_in_use",
+                                 static_cast<float>(active), OrthancPluginMetricsType_Default);
+    OrthancPluginSetMetricsValue(context_, "orthanc_index_connections_peak_in_use",
+                                 static_cast<float>(peak), OrthancPluginMetricsType_Default);
+
+    uint64_t successes, conflicts, retries, exhaustedRetries;
+    double conflictRate;
+    retryPolicy_.GetStatistics(successes, conflicts, retries, exhaustedRetries, conflictRate);
+
+    OrthancPluginSetMetricsValue(context_, "orthanc_index_conflicts_count",
+                                 static_cast<float>(conflicts), OrthancPluginMetricsType_Default);
+    OrthancPluginSetMetricsValue(context_, "orthanc_index_conflict_rate",
+                                 static_cast<float>(conflictRate), OrthancPluginMetricsType_Default);
+
+    if (admissionController_.GetMaxInFlight() != 0)
+    {
+      uint64_t admitted, rejected;
+      size_t inFlight;
+      admissionController_.GetStatistics(admitted, rejected, inFlight);
+
+      OrthancPluginSetMetricsValue(context_, "orthanc_index_admission_limit",
+                                   static_cast<float>(admissionController_.GetLimit()), OrthancPluginMetricsType_Default);
+      OrthancPluginSetMetricsValue(context_, "orthanc_index_in_flight_transactions",
+                                   static_cast<float>(inFlight), OrthancPluginMetricsType_Default);
+      OrthancPluginSetMetricsValue(context_, "orthanc_index_rejected_transactions_count",
+                                   static_cast<float>(rejected), OrthancPluginMetricsType_Default);
+    }
+
+    if (retryPolicy_.GetMaxWriters() != 0)
+    {
+      OrthancPluginSetMetricsValue(context_, "orthanc_index_writers_limit",
+                                   static_cast<float>(retryPolicy_.GetWritersLimit()), OrthancPluginMetricsType_Default);
+    }
+#endif
+  }
+
+  
+  void IndexConnectionsPool::EnterLane(TransactionType type)
+  {
+    boost::mutex::scoped_lock lock(lanesMutex_);
+
+    size_t& active = (type == TransactionType_ReadOnly ? activeReadOnly_ : activeReadWrite_);
+    const size_t& otherActive = (type == TransactionType_ReadOnly ? activeReadWrite_ : activeReadOnly_);
+    const size_t otherReserved = (type == TransactionType_ReadOnly ? reservedReadWrite_ : reservedReadOnly_);
+
+    for (;;)
+    {
+      // Connections that must stay available for the other type of transactions
+      const size_t kept = (otherActive < otherReserved ? otherReserved - otherActive : 0);
+
+      if (active + otherActive + kept < countConnections_)
+      {
+        active++;
+        return;
+      }
+      else
+      {
+        lanesCondition_.wait(lock);
+      }
+    }
+  }
+
+
+  void IndexConnectionsPool::LeaveLane(TransactionType type)
+  {
+    boost::mutex::scoped_lock lock(lanesMutex_);
+
+    if (type == TransactionType_ReadOnly)
+    {
+      assert(activeReadOnly_ > 0);
+      activeReadOnly_--;
+    }
+    else
+    {
+      assert(activeReadWrite_ > 0);
+      activeReadWrite_--;
+    }
+
+    lanesCondition_.notify_all();
+  }
+
+
+  IndexConnectionsPool::CommitGroup* IndexConnectionsPool::JoinGroup(DatabaseManager& manager)
+  {
+    boost::mutex::scoped_lock lock(groupMutex_);
+
+    if (openGroup_ != NULL)
+    {
+      if (!openGroup_->closed_ &&
+          openGroup_->members_ < groupCommitSize_ &&
+          openGroup_->GetAge() < groupCommitDelay_)
+      {
+        openGroup_->members_++;
+        openGroup_->references_++;
+        return openGroup_;
+      }
+      else
+      {
+        openGroup_->closed_ = true;
+        openGroup_ = NULL;
+        groupCondition_.notify_all();
+      }
+    }
+
+    // Start a new group, whose transaction runs on the connection of the caller
+    std::unique_ptr<CommitGroup> group(new CommitGroup(manager));
+    manager.StartTransaction(TransactionType_ReadWrite);
+
+    openGroup_ = group.release();
+    return openGroup_;
+  }
+
+
+  bool IndexConnectionsPool::LeaveGroup(CommitGroup& group,
+                                        bool commit)
+  {
+    Orthanc::Toolbox::ElapsedTimer timer;
+
+    boost::mutex::scoped_lock lock(groupMutex_);
+
+    if (!commit)
+    {
+      // Rolling back one transaction rolls back the whole group
+      group.failed_ = true;
+    }
+
+    group.finished_++;
+
+    while (!group.done_)
+    {
+      if (!group.closed_ &&
+          (group.failed_ ||
+           group.members_ >= groupCommitSize_ ||
+           group.GetAge() >= groupCommitDelay_))
+      {
+        group.closed_ = true;
+
+        if (openGroup_ == &group)
+        {
+          openGroup_ = NULL;
+        }
+      }
+
+      if (group.closed_ &&
+          group.finished_ == group.members_)
+      {
+        // This is the last transaction of the group, which ends the
+        // database transaction on behalf of all the members
+        const bool rollback = group.failed_;
+        bool success = !rollback;
+
+        lock.unlock();
+
+        try
+        {
+          if (rollback)
+          {
+            group.manager_.RollbackTransaction();
+          }
+          else
+          {
+            group.manager_.CommitTransaction();
+            RecordCommitPosition(group.manager_);
+          }
+        }
+        catch (Orthanc::OrthancException& e)
+        {
+          LOG(ERROR) << "Cannot end the transaction of a group of " << group.members_
+                     << " transaction(s): " << e.What();
+          success = false;
+        }
+
+        lock.lock();
+
+        LOG(INFO) << "End of the transaction of a group of " << group.members_ << " transaction(s)";
+
+        group.failed_ = !success;
+        group.done_ = true;
+        groupCondition_.notify_all();
+      }
+      else if (group.closed_)
+      {
+        groupCondition_.wait(lock);
+      }
+      else
+      {
+        const uint64_t age = group.GetAge();
+        groupCondition_.timed_wait(lock, boost::posix_time::milliseconds(
+                                     age < groupCommitDelay_ ? groupCommitDelay_ - age : 0));
+      }
+    }
+
+    const bool success = !group.failed_;
+
+    assert(group.references_ > 0);
+    group.references_--;
+
+    if (group.references_ == 0)
+    {
+      assert(openGroup_ != &group);
+      delete &group;
+    }
+
+    lock.unlock();
+
+    // Time spent waiting for the other transactions of the group
+    operationsStatistics_.Add("GROUP_COMMIT_WAIT", timer.GetElapsedMicroseconds(), success);
+
+    return success;
+  }
+
+
+  IndexConnectionsPool::~IndexConnectionsPool()
+  {
+    {
+      boost::mutex::scoped_lock lock(housekeepingMutex_);
+      housekeepingContinue_ = false;
+    }
+
+    JoinOpeningThreads();
+
+    backend_->SetIdleConnections(NULL);
+
+    for (std::list<DatabaseManager*>::iterator
+           it = connections_.begin(); it != connections_.end(); ++it)
+    {
+      assert(*it != NULL);
+      delete *it;
+    }
+
+    for (std::list<DatabaseManager*>::iterator
+           it = replicaConnections_.begin(); it != replicaConnections_.end(); ++it)
+    {
+      assert(*it != NULL);
+      delete *it;
+    }
+  }
+
+
+  void IndexConnectionsPool::OpenConnections(bool hasIdentifierTags,
+                                             const std::list<IdentifierTag>& identifierTags)
+  {
+    boost::unique_lock<boost::shared_mutex>  lock(connectionsMutex_);
+
+    if (connections_.size() == 0)
+    {
+      assert(backend_.get() != NULL);
+
+      ISqlLookupFormatter::PrepareIdentifierTags(identifierTags);
+
+      {
+        std::unique_ptr<DatabaseManager> manager(CreateConnection());
+        backend_->ConfigureDatabase(*manager, hasIdentifierTags, identifierTags);
+        connections_.push_back(manager.release());
+        availableConnections_->Release(*connections_.back());
+      }
+
+      const size_t countReplicaConnections = backend_->GetReplicaConnectionsCount();
+      if (countReplicaConnections > 0)
+      {
+        LOG(WARNING) << "Read-only transactions are routed to a replica of the database, using "
+                     << countReplicaConnections << " connection(s)";
+
+        for (size_t i = 0; i < countReplicaConnections; i++)
+        {
+          std::unique_ptr<DatabaseManager> manager(new DatabaseManager(backend_->CreateReplicaDatabaseFactory()));
+          manager->SetMaxCachedStatements(backend_->GetMaxCachedStatements());
+          manager->SetSlowStatementThreshold(backend_->GetSlowStatementThreshold());
+          manager->SetSlowStatementListener(backend_->GetSlowStatementListener());
+          manager->GetDatabase();  // Make sure to open the database connection
+
+          replicaConnections_.push_back(manager.release());
+          availableReplicaConnections_->Release(*replicaConnections_.back());
+        }
+      }
+
+      housekeepingScheduler_.reset(new HousekeepingScheduler);
+      backend_->RegisterHousekeepingTasks(*housekeepingScheduler_, housekeepingDelay_,
+                                          boost::posix_time::microsec_clock::universal_time());
+
+      {
+        boost::mutex::scoped_lock lock(housekeepingMutex_);
+        housekeepingIntervals_.clear();
+        housekeepingChanges_.clear();
+
+        for (size_t i = 0; i < housekeepingScheduler_->GetTasksCount(); i++)
+        {
+          housekeepingIntervals_[housekeepingScheduler_->GetTaskName(i)] = housekeepingScheduler_->GetInterval(i);
+        }
+      }
+
+      if (!housekeepingScheduler_->IsEmpty())
+      {
+        // The housekeeping does not steal the connections of the requests
+        housekeepingConnection_.reset(CreateConnection(backend_->CreateHousekeepingDatabaseFactory()));
+      }
+
+      // Start the housekeeping thread, that also publishes the metrics
+      {
+        boost::mutex::scoped_lock lock(housekeepingMutex_);
+        housekeepingContinue_ = true;
+      }
+
+      housekeepingThread_ = boost::thread(HousekeepingThread, this);
+
+      /**
+       * The pool is usable as soon as its first connection is open:
+       * The other connections, up to "minConnections_", are opened in
+       * background, and the ones up to "countConnections_" on demand.
+       **/
+      if (minConnections_ > 1)
+      {
+        const size_t countThreads = std::min(minConnections_ - 1, MAX_OPENING_THREADS);
+
+        LOG(INFO) << "Opening " << (minConnections_ - 1) << " more connection(s) to the database in background, using "
+                  << countThreads << " thread(s)";
+
+        for (size_t i = 0; i < countThreads; i++)
+        {
+          openingThreads_.push_back(new boost::thread(OpeningThread, this));
+        }
+      }
+    }
+    else
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+  }
+
+
+  void IndexConnectionsPool::CloseConnections()
+  {
+    {
+      // Stop the housekeeping thread
+      {
+        boost::mutex::scoped_lock lock(housekeepingMutex_);
+        housekeepingContinue_ = false;
+        housekeepingCondition_.notify_all();
+      }
+
+      if (housekeepingThread_.joinable())
+      {
+        housekeepingThread_.join();
+      }
+
+      JoinOpeningThreads();
+
+      if (housekeepingConnection_.get() != NULL)
+      {
+        housekeepingConnection_->Close();
+        housekeepingConnection_.reset(NULL);
+      }
+    }
+
+    boost::unique_lock<boost::shared_mutex>  lock(connectionsMutex_);
+
+    // Less than "minConnections_" connections if some could not be opened in background, and more
+    // than "countConnections_" if the pool was shrunk by "Resize()" since the last housekeeping
+    if (connections_.empty() ||
+        pendingConnections_ != 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+    else if (availableConnections_->GetSize() != connections_.size() ||
+             availableReplicaConnections_->GetSize() != replicaConnections_.size())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Some connections are still in use, bug in the Orthanc core");
+    }
+    else
+    {
+      for (std::list<DatabaseManager*>::iterator
+             it = connections_.begin(); it != connections_.end(); ++it)
+      {
+        assert(*it != NULL);
+        (*it)->Close();
+      }
+
+      for (std::list<DatabaseManager*>::iterator
+             it = replicaConnections_.begin(); it != replicaConnections_.end(); ++it)
+      {
+        assert(*it != NULL);
+        (*it)->Close();
+      }
+    }
+  }
+
 
-namespace OrthancDatabases
-{
-  class IndexConnectionsPool::ManagerReference : public Orthanc::IDynamicObject
+  void IndexConnectionsPool::RecordCommitPosition(DatabaseManager& manager)
   {
-  private:
-    DatabaseManager*  manager_;
-
-  public:
-    explicit ManagerReference(DatabaseManager& manager) :
-      manager_(&manager)
+    // "replicaConnections_" is not modified while the pool is in use
+    if (!replicaReadYourWrites_ ||
+        replicaConnections_.empty())
     {
+      return;
     }
 
-    DatabaseManager& GetManager()
+    try
     {
-      assert(manager_ != NULL);
-      return *manager_;
+      const uint64_t position = backend_->GetCommitPosition(manager);
+
+      boost::mutex::scoped_lock lock(positionsMutex_);
+      if (position > commitPosition_)
+      {
+        commitPosition_ = position;
+      }
     }
-  };
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(WARNING) << "Cannot read the position of the last commit in the log of the database: " << e.What();
+    }
+  }
 
 
-  void IndexConnectionsPool::HousekeepingThread(IndexConnectionsPool* that)
+  bool IndexConnectionsPool::IsReplicaUpToDate(DatabaseManager& replica)
   {
-    boost::posix_time::ptime lastInvocation = boost::posix_time::second_clock::local_time();
+    if (!replicaReadYourWrites_)
+    {
+      return true;
+    }
+
+    uint64_t commit;
 
-    while (that->housekeepingContinue_)
     {
-      if (boost::posix_time::second_clock::local_time() - lastInvocation >= that->housekeepingDelay_)
+      boost::mutex::scoped_lock lock(positionsMutex_);
+      commit = commitPosition_;
+
+      std::map<DatabaseManager*, uint64_t>::const_iterator found = replayPositions_.find(&replica);
+      if (commit == 0 ||  // No write since the startup, or the backend cannot track the commits
+          (found != replayPositions_.end() &&
+           found->second >= commit))
       {
-        Accessor accessor(*that);
+        return true;  // No need to ask the replica again
+      }
+    }
 
-        try
-        {
-          accessor.GetBackend().PerformDbHousekeeping(accessor.GetManager());
-        }
-        catch (Orthanc::OrthancException& e)
-        {
-          LOG(ERROR) << "Exception during the database housekeeping: " << e.What();
-        }
-        catch (...)
-        {
-          LOG(ERROR) << "Native exception during the database houskeeping";
-        }
+    Orthanc::Toolbox::ElapsedTimer timer;
+    uint64_t replay;
 
-        lastInvocation = boost::posix_time::second_clock::local_time();
-      }
+    try
+    {
+      replay = backend_->GetReplayPosition(replica);
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(WARNING) << "Cannot read the position of the log that was replayed by the replica: " << e.What();
+      replay = 0;
+    }
 
-      boost::this_thread::sleep(boost::posix_time::milliseconds(1000));
+    const bool upToDate = (replay >= commit);
+    operationsStatistics_.Add("REPLICA_LAG_CHECK", timer.GetElapsedMicroseconds(), upToDate);
+
+    {
+      boost::mutex::scoped_lock lock(positionsMutex_);
+      replayPositions_[&replica] = replay;
     }
+
+    return upToDate;
   }
 
 
-  IndexConnectionsPool::IndexConnectionsPool(IndexBackend* backend,
-                                             size_t countConnections,
-                                             unsigned int houseKeepingDelaySeconds) :
-    backend_(backend),
-    countConnections_(countConnections),
-    housekeepingContinue_(true),
-    housekeepingDelay_(boost::posix_time::seconds(houseKeepingDelaySeconds))
+  void IndexConnectionsPool::Resize(size_t countConnections,
+                                    size_t minConnections)
   {
     if (countConnections == 0)
     {
       throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
                                       "There must be a non-zero number of connections to the database");
     }
-    else if (backend == NULL)
+    else if (minConnections > countConnections)
     {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "The minimum number of connections to the database cannot be above their maximum number");
+    }
+    else if (reservedReadOnly_ + reservedReadWrite_ > countConnections)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "There are more reserved connections to the database than connections");
+    }
+
+    {
+      boost::mutex::scoped_lock elasticLock(elasticMutex_);
+      boost::mutex::scoped_lock lanesLock(lanesMutex_);
+
+      LOG(WARNING) << "Resizing the pool of connections to the index database: from "
+                   << minConnections_ << "-" << countConnections_ << " to "
+                   << minConnections << "-" << countConnections << " connection(s)";
+
+      countConnections_ = countConnections;
+      minConnections_ = minConnections;
+
+      // The transactions that wait for a lane might be able to start
+      lanesCondition_.notify_all();
+    }
+
+    {
+      // Close the connections in excess without waiting for the next deadline
+      boost::mutex::scoped_lock lock(housekeepingMutex_);
+      housekeepingWakeUp_ = true;
+      housekeepingCondition_.notify_all();
+    }
+  }
+
+
+  void IndexConnectionsPool::GetLimits(size_t& countConnections,
+                                       size_t& minConnections)
+  {
+    boost::mutex::scoped_lock lock(elasticMutex_);
+    countConnections = countConnections_;
+    minConnections = minConnections_;
+  }
+
+
+  void IndexConnectionsPool::GetHousekeepingIntervals(std::map<std::string, unsigned int>& target)
+  {
+    boost::mutex::scoped_lock lock(housekeepingMutex_);
+    target = housekeepingIntervals_;
+  }
+
+
+  void IndexConnectionsPool::SetHousekeepingInterval(const std::string& task,
+                                                     unsigned int intervalSeconds)
+  {
+    boost::mutex::scoped_lock lock(housekeepingMutex_);
+
+    std::map<std::string, unsigned int>::iterator found = housekeepingIntervals_.find(task);
+
+    if (found == housekeepingIntervals_.end())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InexistentItem,
+                                      "Unknown housekeeping task, or task disabled at startup: " + task);
     }
     else
     {
-      context_ = backend_->GetContext();
+      // The scheduler is only accessed by the housekeeping thread
+      found->second = intervalSeconds;
+      housekeepingChanges_[task] = intervalSeconds;
+      housekeepingWakeUp_ = true;
+      housekeepingCondition_.notify_all();
     }
   }
 
-  
-  IndexConnectionsPool::~IndexConnectionsPool()
+
+  void IndexConnectionsPool::Accessor::AcquireConnection()
   {
-    for (std::list<DatabaseManager*>::iterator
-           it = connections_.begin(); it != connections_.end(); ++it)
+    for (;;)
     {
-      assert(*it != NULL);
-      delete *it;
+      if (pool_.availableConnections_->GetSize() == 0)
+      {
+        // All the connections are in use, try and open a new one
+        manager_ = pool_.GrowConnections();
+        if (manager_ != NULL)
+        {
+          break;
+        }
+      }
+
+      manager_ = pool_.availableConnections_->Acquire(100);
+      if (manager_ != NULL)
+      {
+        break;
+      }
     }
+
+    // "heldTimer_" was started at the beginning of the constructor
+    pool_.operationsStatistics_.Add("CONNECTION_WAIT", heldTimer_.GetElapsedMicroseconds(), true);
+
+    heldTimer_.Restart();
+    pool_.RegisterAccessor(*this);
   }
 
 
-  void IndexConnectionsPool::OpenConnections(bool hasIdentifierTags,
-                                             const std::list<IdentifierTag>& identifierTags)
+  void IndexConnectionsPool::Accessor::AcquireReplicaConnection()
   {
-    boost::unique_lock<boost::shared_mutex>  lock(connectionsMutex_);
+    for (;;)
+    {
+      manager_ = pool_.availableReplicaConnections_->Acquire(100);
+      if (manager_ != NULL)
+      {
+        isReplica_ = true;
+        break;
+      }
+    }
 
-    if (connections_.size() == 0)
+    pool_.operationsStatistics_.Add("REPLICA_CONNECTION_WAIT", heldTimer_.GetElapsedMicroseconds(), true);
+
+    heldTimer_.Restart();
+    pool_.RegisterAccessor(*this);
+  }
+
+
+  IndexConnectionsPool::Accessor::Accessor(IndexConnectionsPool& pool) :
+    lock_(pool.connectionsMutex_),
+    pool_(pool),
+    manager_(NULL),
+    isReplica_(false),
+    operation_(NULL),
+    hasWarned_(false),
+    groupState_(GroupState_None),
+    group_(NULL),
+    hasLane_(false),
+    lane_(TransactionType_ReadOnly),
+    isReadOnly_(false),
+    hasRead_(false),
+    isAdmitted_(false)
+  {
+    AcquireConnection();
+  }
+
+
+  IndexConnectionsPool::Accessor::Accessor(IndexConnectionsPool& pool,
+                                           TransactionType type) :
+    lock_(pool.connectionsMutex_),
+    pool_(pool),
+    manager_(NULL),
+    isReplica_(false),
+    operation_(NULL),
+    hasWarned_(false),
+    groupState_(GroupState_None),
+    group_(NULL),
+    hasLane_(false),
+    lane_(type),
+    isReadOnly_(type == TransactionType_ReadOnly),
+    hasRead_(false),
+    isAdmitted_(false)
+  {
+    // "replicaConnections_" is only modified while "connectionsMutex_" is exclusively locked
+    if (type == TransactionType_ReadOnly &&
+        !pool_.replicaConnections_.empty())
     {
-      assert(backend_.get() != NULL);
+      AcquireReplicaConnection();
 
+      if (pool_.IsReplicaUpToDate(*manager_))
       {
-        std::unique_ptr<DatabaseManager> manager(new DatabaseManager(backend_->CreateDatabaseFactory()));
-        manager->GetDatabase();  // Make sure to open the database connection
-          
-        backend_->ConfigureDatabase(*manager, hasIdentifierTags, identifierTags);
-        connections_.push_back(manager.release());
+        return;
       }
 
-      for (size_t i = 1; i < countConnections_; i++)
+      // The replica lags behind the last commit, read from the primary database
+      pool_.UnregisterAccessor(*this);
+      pool_.availableReplicaConnections_->Release(*manager_);
+      manager_ = NULL;
+      isReplica_ = false;
+      heldTimer_.Restart();
+    }
+
+    // Fail fast instead of waiting for a connection, so that the
+    // writers keep the capacity of the database if it slows down
+    if (!pool_.admissionController_.Enter(type == TransactionType_ReadWrite))
+    {
+      pool_.operationsStatistics_.Add("LOAD_SHEDDING", 0, false);
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_DatabaseUnavailable,
+                                      "The database is overloaded, the read-only transaction is rejected");
+    }
+
+    isAdmitted_ = true;
+
+    try
+    {
+      if (type == TransactionType_ReadWrite)
       {
-        connections_.push_back(new DatabaseManager(backend_->CreateDatabaseFactory()));
-        connections_.back()->GetDatabase();  // Make sure to open the database connection
+        // Wait before taking a connection, if the conflicts have reduced the number of writers
+        writerSlot_.reset(new RetryPolicy::WriterSlot(pool_.retryPolicy_));
       }
 
-      for (std::list<DatabaseManager*>::iterator
-             it = connections_.begin(); it != connections_.end(); ++it)
+      if (pool_.HasLanes())
       {
-        assert(*it != NULL);
-        availableConnections_.Enqueue(new ManagerReference(**it));
+        pool_.EnterLane(type);
+        hasLane_ = true;
       }
 
-      // Start the housekeeping thread
-      housekeepingContinue_ = true;
-
-      if (backend_->HasPerformDbHousekeeping())
+      AcquireConnection();
+    }
+    catch (...)
+    {
+      if (hasLane_)
       {
-        housekeepingThread_ = boost::thread(HousekeepingThread, this);
+        pool_.LeaveLane(type);
       }
+
+      pool_.admissionController_.Cancel();
+      throw;
+    }
+  }
+
+  
+  IndexConnectionsPool::Accessor::~Accessor()
+  {
+    assert(manager_ != NULL);
+
+    if (groupState_ == GroupState_Member)
+    {
+      // The transaction was neither committed nor rolled back
+      LeaveGroup(false);
+    }
+
+    pool_.UnregisterAccessor(*this);
+
+    if (isAdmitted_)
+    {
+      // The latency of the transaction drives the limit of the in-flight transactions
+      pool_.admissionController_.Leave(heldTimer_.GetElapsedMicroseconds());
+    }
+
+    if (isReplica_)
+    {
+      pool_.availableReplicaConnections_->Release(*manager_);
     }
     else
     {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+      pool_.availableConnections_->Release(*manager_);
+    }
+
+    // Leave the lane once the connection is available to the waiting transactions
+    if (hasLane_)
+    {
+      pool_.LeaveLane(lane_);
     }
   }
 
 
-  void IndexConnectionsPool::CloseConnections()
+  void IndexConnectionsPool::Accessor::SetOperation(const char* operation)
   {
+    // Called by each operation: The lock of the pool is only taken by the reports
+    boost::mutex::scoped_lock lock(operationMutex_);
+    operation_ = operation;
+  }
+
+
+  const char* IndexConnectionsPool::Accessor::GetOperation()
+  {
+    boost::mutex::scoped_lock lock(operationMutex_);
+    return (operation_ == NULL ? "none" : operation_);
+  }
+
+  
+  void IndexConnectionsPool::Accessor::SignalCommitted()
+  {
+    assert(manager_ != NULL);
+
+    if (!isReplica_)
     {
-      // Stop the housekeeping thread
-      housekeepingContinue_ = false;
-      if (housekeepingThread_.joinable())
+      pool_.RecordCommitPosition(*manager_);
+    }
+  }
+
+
+  bool IndexConnectionsPool::Accessor::ReconnectReadOnly()
+  {
+    assert(manager_ != NULL);
+
+    if (!isReadOnly_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    try
+    {
+      manager_->Close();  // Also drops the transaction, if any
+      manager_->StartTransaction(TransactionType_ReadOnly);  // Opens a new connection
+      return true;
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      if (e.GetErrorCode() == Orthanc::ErrorCode_DatabaseUnavailable)
       {
-        housekeepingThread_.join();
+        return false;
+      }
+      else
+      {
+        throw;
       }
     }
+  }
 
-    boost::unique_lock<boost::shared_mutex>  lock(connectionsMutex_);
 
-    if (connections_.size() != countConnections_)
+  void IndexConnectionsPool::Accessor::StartTransaction(TransactionType type)
+  {
+    assert(manager_ != NULL);
+
+    if (groupState_ != GroupState_None)
     {
       throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
     }
-    else if (availableConnections_.GetSize() != countConnections_)
+    else if (type == TransactionType_ReadWrite &&
+             !isReplica_ &&
+             pool_.groupCommitSize_ >= 2)
     {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Some connections are still in use, bug in the Orthanc core");
+      groupState_ = GroupState_Pending;
     }
     else
     {
-      for (std::list<DatabaseManager*>::iterator
-             it = connections_.begin(); it != connections_.end(); ++it)
-      {
-        assert(*it != NULL);
-        (*it)->Close();
-      }
+      manager_->StartTransaction(type);
     }
   }
 
 
-  IndexConnectionsPool::Accessor::Accessor(IndexConnectionsPool& pool) :
-    lock_(pool.connectionsMutex_),
-    pool_(pool),
-    manager_(NULL)
+  void IndexConnectionsPool::Accessor::PrepareOperation(bool canJoinGroup)
   {
-    for (;;)
+    if (groupState_ == GroupState_Pending)
     {
-      std::unique_ptr<Orthanc::IDynamicObject> manager(pool.availableConnections_.Dequeue(100));
-      if (manager.get() != NULL)
+      if (canJoinGroup)
       {
-        manager_ = &dynamic_cast<ManagerReference&>(*manager).GetManager();
-        return;
+        group_ = pool_.JoinGroup(*manager_);
+        groupState_ = GroupState_Member;
+      }
+      else
+      {
+        manager_->StartTransaction(TransactionType_ReadWrite);
+        groupState_ = GroupState_None;
       }
     }
   }
 
-  
-  IndexConnectionsPool::Accessor::~Accessor()
+
+  boost::mutex& IndexConnectionsPool::Accessor::GetGroupMutex() const
   {
-    assert(manager_ != NULL);
-    pool_.availableConnections_.Enqueue(new ManagerReference(*manager_));
+    if (groupState_ == GroupState_Member)
+    {
+      assert(group_ != NULL);
+      return group_->GetOperationsMutex();
+    }
+    else
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
   }
 
-  
+
+  bool IndexConnectionsPool::Accessor::LeaveGroup(bool commit)
+  {
+    if (groupState_ == GroupState_Member)
+    {
+      assert(group_ != NULL);
+      CommitGroup& group = *group_;
+
+      group_ = NULL;
+      groupState_ = GroupState_Left;
+
+      return pool_.LeaveGroup(group, commit);
+    }
+    else
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+  }
+
+
   IndexBackend& IndexConnectionsPool::Accessor::GetBackend() const
   {
     return *pool_.backend_;
@@ -224,6 +1811,15 @@ namespace OrthancDatabases
   DatabaseManager& IndexConnectionsPool::Accessor::GetManager() const
   {
     assert(manager_ != NULL);
-    return *manager_;
+
+    if (groupState_ == GroupState_Member)
+    {
+      assert(group_ != NULL);
+      return group_->GetManager();
+    }
+    else
+    {
+      return *manager_;
+    }
   }
 }
@@ -23,33 +23,158 @@
 
 #pragma once
 
+#include "AdmissionController.h"
+#include "HousekeepingScheduler.h"
 #include "IdentifierTag.h"
 #include "IndexBackend.h"
+#include "IngestStatistics.h"
+#include "OperationsStatistics.h"
+#include "PrefetchedResources.h"
+#include "RetryPolicy.h"
 
-#include <MultiThreading/SharedMessageQueue.h>
-
+#include <limits>
 #include <list>
+#include <map>
+#include <set>
+#include <vector>
 #include <boost/thread.hpp>
 
 namespace OrthancDatabases
 {
   class IndexConnectionsPool : public boost::noncopyable
   {
+  public:
+    class Accessor;
+
   private:
     class ManagerReference;
+    class AvailableConnections;
+    class CommitGroup;
+    class IdleConnections;
 
     std::unique_ptr<IndexBackend>  backend_;
     OrthancPluginContext*          context_;
     boost::shared_mutex            connectionsMutex_;
-    size_t                         countConnections_;
+    size_t                         countConnections_;        // Maximum number of connections, protected by "elasticMutex_" and "lanesMutex_"
+    size_t                         minConnections_;          // Protected by "elasticMutex_"
+    unsigned int                   idleConnectionsTimeout_;  // In seconds, 0 to never close idle connections
+    unsigned int                   healthCheckInterval_;     // In seconds, 0 to disable the health checks
+    boost::mutex                   elasticMutex_;            // Protects "connections_" while the pool is open
+    size_t                         pendingConnections_;
     std::list<DatabaseManager*>    connections_;
-    Orthanc::SharedMessageQueue    availableConnections_;
+    std::unique_ptr<AvailableConnections>   availableConnections_;
+    std::list<DatabaseManager*>    replicaConnections_;      // Connections to the read-only replica, if any
+    std::unique_ptr<AvailableConnections>   availableReplicaConnections_;
+    boost::mutex                   housekeepingMutex_;       // Protects "housekeepingContinue_" and the 3 next members
+    boost::condition_variable      housekeepingCondition_;
     bool                           housekeepingContinue_;
+    bool                           housekeepingWakeUp_;      // Whether the settings were changed at runtime
+    std::map<std::string, unsigned int>  housekeepingIntervals_;  // Intervals of the registered tasks, in seconds
+    std::map<std::string, unsigned int>  housekeepingChanges_;    // Intervals to be applied by the housekeeping thread
     boost::thread                  housekeepingThread_;
-    boost::posix_time::time_duration  housekeepingDelay_;
+    unsigned int                   housekeepingDelay_;       // Default interval of the tasks, in seconds
+    std::unique_ptr<HousekeepingScheduler>  housekeepingScheduler_;
+    std::unique_ptr<DatabaseManager>        housekeepingConnection_;  // Dedicated connection of the housekeeping thread
+    OperationsStatistics           operationsStatistics_;
+    RetryPolicy                    retryPolicy_;             // About the read-write transactions
+    unsigned int                   failoverRetryBudget_;     // In milliseconds, 0 to disable the failover of the read-only transactions
+    AdmissionController            admissionController_;     // About the transactions on the primary database
+
+    // Read-your-writes consistency of the read-only replica
+    bool                           replicaReadYourWrites_;
+    boost::mutex                   positionsMutex_;
+    uint64_t                       commitPosition_;          // Last commit of this server on the primary database
+    std::map<DatabaseManager*, uint64_t>  replayPositions_;  // Last position that was replayed, for each connection to the replica
+    std::unique_ptr<IdleConnections>        idleConnections_;  // Lent to "backend_" for the parallel lookups
+    std::vector<boost::thread*>    openingThreads_;          // Open the minimum number of connections in background
+
+    // Monitoring of the connections that are checked out of the pool
+    boost::mutex                   accessorsMutex_;
+    std::set<Accessor*>            activeAccessors_;
+    size_t                         peakActiveAccessors_;
+    unsigned int                   holdWarningThreshold_;  // In seconds, 0 to disable
+
+    // Connections reserved to the read-only and to the read-write transactions
+    boost::mutex                   lanesMutex_;
+    boost::condition_variable      lanesCondition_;
+    size_t                         reservedReadOnly_;
+    size_t                         reservedReadWrite_;
+    size_t                         activeReadOnly_;        // Protected by "lanesMutex_"
+    size_t                         activeReadWrite_;       // Protected by "lanesMutex_"
+
+    // Group commit of the transactions that ingest instances
+    boost::mutex                   groupMutex_;
+    boost::condition_variable      groupCondition_;
+    CommitGroup*                   openGroup_;             // Group that can still be joined, if any
+    size_t                         groupCommitSize_;       // Below 2 to disable group commit
+    unsigned int                   groupCommitDelay_;      // In milliseconds
 
     static void HousekeepingThread(IndexConnectionsPool* that);
 
+    void RunHousekeepingTasks();
+
+    static void OpeningThread(IndexConnectionsPool* that);
+
+    void JoinOpeningThreads();
+
+    // Whether all the connections to the primary database are in use
+    bool IsSaturated();
+
+    DatabaseManager* CreateConnection(IDatabaseFactory* factory /* takes ownership */);
+
+    DatabaseManager* CreateConnection()
+    {
+      return CreateConnection(backend_->CreateDatabaseFactory());
+    }
+
+    // Returns NULL if the pool already contains "limit" connections, or if they are being opened
+    DatabaseManager* GrowConnections(size_t limit);
+
+    // Returns NULL if the pool already contains the maximum number of connections
+    DatabaseManager* GrowConnections()
+    {
+      return GrowConnections(std::numeric_limits<size_t>::max());
+    }
+
+    void ApplyHousekeepingChanges();
+
+    void CloseIdleConnections();
+
+    // Returns "false" if the connection is broken and cannot be reopened
+    bool CheckConnectionHealth(DatabaseManager& manager);
+
+    void CheckConnectionsHealth(AvailableConnections& available);
+
+    void RegisterAccessor(Accessor& accessor);
+
+    void UnregisterAccessor(Accessor& accessor);
+
+    void WarnAboutLongHeldConnections();
+
+    void PublishConnectionsMetrics();
+
+    bool HasLanes() const
+    {
+      return reservedReadOnly_ != 0 || reservedReadWrite_ != 0;
+    }
+
+    // Waits until a transaction of this type can take a connection
+    void EnterLane(TransactionType type);
+
+    void LeaveLane(TransactionType type);
+
+    // To be called after a commit on the primary database
+    void RecordCommitPosition(DatabaseManager& manager);
+
+    // Whether the replica has replayed the last commit of this server
+    bool IsReplicaUpToDate(DatabaseManager& replica);
+
+    CommitGroup* JoinGroup(DatabaseManager& manager);
+
+    // Returns "false" if the transactions of the group were rolled back
+    bool LeaveGroup(CommitGroup& group,
+                    bool commit);
+
   public:
     IndexConnectionsPool(IndexBackend* backend /* takes ownership */,
                          size_t countConnections,
@@ -62,26 +187,185 @@ namespace OrthancDatabases
       return context_;
     }
 
+    OperationsStatistics& GetOperationsStatistics()
+    {
+      return operationsStatistics_;
+    }
+
+    // The retries of the index are done by the Orthanc core, so only
+    // the conflicts and the limit of the writers are used
+    RetryPolicy& GetRetryPolicy()
+    {
+      return retryPolicy_;
+    }
+
+    unsigned int GetFailoverRetryBudget() const
+    {
+      return failoverRetryBudget_;
+    }
+
     void OpenConnections(bool hasIdentifierTags,
                          const std::list<IdentifierTag>& identifierTags);
 
     void CloseConnections();
 
+    /**
+     * Changes the number of connections at runtime. The new
+     * connections are opened on demand, and the connections above the
+     * maximum number are closed by the housekeeping thread once they
+     * are released, so that no transaction is interrupted.
+     **/
+    void Resize(size_t countConnections,
+                size_t minConnections);
+
+    void GetLimits(size_t& countConnections,
+                   size_t& minConnections);
+
+    void GetHousekeepingIntervals(std::map<std::string, unsigned int>& target);
+
+    // An interval of "0" seconds disables the task, that must have been registered by the backend
+    void SetHousekeepingInterval(const std::string& task,
+                                 unsigned int intervalSeconds);
+
     class Accessor : public boost::noncopyable
     {
+      friend class IndexConnectionsPool;
+
     private:
+      enum GroupState
+      {
+        GroupState_None,      // Transaction on "manager_", or no transaction
+        GroupState_Pending,   // Read-write transaction not started yet
+        GroupState_Member,    // Transaction shared with other accessors through "group_"
+        GroupState_Left       // The transaction of the group is closed
+      };
+
       boost::shared_lock<boost::shared_mutex>  lock_;
       IndexConnectionsPool&                    pool_;
       DatabaseManager*                         manager_;
+      bool                                     isReplica_;
+      Orthanc::Toolbox::ElapsedTimer           heldTimer_;
+      boost::mutex                             operationMutex_;  // Not contended, as the accessor has a single user
+      const char*                              operation_;       // Static string, protected by "operationMutex_"
+      bool                                     hasWarned_;       // Protected by "pool_.accessorsMutex_"
+      DeferredWrites                           deferredWrites_;
+      PrefetchedResources                      prefetched_;
+      IngestStatistics::Timeline               ingestTimeline_;
+      GroupState                               groupState_;
+      CommitGroup*                             group_;
+      std::unique_ptr<RetryPolicy::WriterSlot> writerSlot_;      // For the read-write transactions
+      bool                                     hasLane_;
+      TransactionType                          lane_;
+      bool                                     isReadOnly_;      // Read-only transaction
+      bool                                     hasRead_;         // Whether the read-only transaction has returned data
+      bool                                     isAdmitted_;      // Whether "pool_.admissionController_" counts this transaction
       
+      void AcquireConnection();
+
+      void AcquireReplicaConnection();
+
     public:
+      // Gets a connection to the primary database
       explicit Accessor(IndexConnectionsPool& pool);
 
+      /**
+       * Read-only transactions are routed to the replica, if any. If
+       * the database is overloaded, the read-only transactions on the
+       * primary database are rejected with "DatabaseUnavailable".
+       **/
+      Accessor(IndexConnectionsPool& pool,
+               TransactionType type);
+
       ~Accessor();
 
+      bool IsReplica() const
+      {
+        return isReplica_;
+      }
+
+      bool IsReadOnly() const
+      {
+        return isReadOnly_;
+      }
+
+      bool HasRead() const
+      {
+        return hasRead_;
+      }
+
+      void SignalRead()
+      {
+        hasRead_ = true;
+      }
+
+      // To be called after the commit of a read-write transaction
+      void SignalCommitted();
+
+      /**
+       * To be called if the connection of a read-only transaction was
+       * lost: Reopens the connection and starts a new read-only
+       * transaction. Returns "false" if the database is still
+       * unavailable.
+       **/
+      bool ReconnectReadOnly();
+
+      // Writes of the transaction that are postponed by the V4 adapter
+      DeferredWrites& GetDeferredWrites()
+      {
+        return deferredWrites_;
+      }
+
+      // Children that are prefetched by the V4 adapter
+      PrefetchedResources& GetPrefetchedResources()
+      {
+        return prefetched_;
+      }
+
+      // Durations of the operations of the transaction, if it ingests an instance
+      IngestStatistics::Timeline& GetIngestTimeline()
+      {
+        return ingestTimeline_;
+      }
+
+      /**
+       * If group commit is enabled, the start of a read-write
+       * transaction is postponed until its first operation, that is
+       * given to "PrepareOperation()": The transactions that start
+       * with "CreateInstance()" join a group of transactions sharing
+       * the same connection, the other ones are started as usual.
+       **/
+      void StartTransaction(TransactionType type);
+
+      void PrepareOperation(bool canJoinGroup);
+
+      bool IsGroupMember() const
+      {
+        return groupState_ == GroupState_Member;
+      }
+
+      bool HasLeftGroup() const
+      {
+        return groupState_ == GroupState_Left;
+      }
+
+      // Serializes the operations of the members of the group
+      boost::mutex& GetGroupMutex() const;
+
+      // Waits for the end of the transaction of the group, returns
+      // "false" if it was rolled back
+      bool LeaveGroup(bool commit);
+
       IndexBackend& GetBackend() const;
 
       DatabaseManager& GetManager() const;
+
+      // Name of the last operation that was run on this connection,
+      // for the warnings about long-held connections. It must be a
+      // static string, as it is only referenced by the accessor.
+      void SetOperation(const char* operation);
+
+      // Returns "none" if no operation was run yet
+      const char* GetOperation();
     };
   };
 }
@@ -0,0 +1,164 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "IndexShards.h"
+
+#include <OrthancException.h>
+
+#include <algorithm>
+#include <limits>
+
+
+namespace OrthancDatabases
+{
+  IndexShards::IndexShards(size_t countShards) :
+    countShards_(countShards)
+  {
+    if (countShards == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange, "There must be at least one shard");
+    }
+  }
+
+
+  size_t IndexShards::GetPatientShard(const std::string& patientPublicId) const
+  {
+    // 32-bit FNV-1a, as "boost::hash" depends on the platform
+    uint32_t hash = 2166136261u;
+
+    for (size_t i = 0; i < patientPublicId.size(); i++)
+    {
+      hash ^= static_cast<uint8_t>(patientPublicId[i]);
+      hash *= 16777619u;
+    }
+
+    return static_cast<size_t>(hash % countShards_);
+  }
+
+
+  int64_t IndexShards::EncodeIdentifier(size_t shard,
+                                        int64_t localId) const
+  {
+    const int64_t count = static_cast<int64_t>(countShards_);
+
+    if (shard >= countShards_ ||
+        localId < 0 ||
+        localId > (std::numeric_limits<int64_t>::max() - static_cast<int64_t>(shard)) / count)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      return localId * count + static_cast<int64_t>(shard);
+    }
+  }
+
+
+  size_t IndexShards::GetShard(int64_t globalId) const
+  {
+    if (globalId < 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      return static_cast<size_t>(globalId % static_cast<int64_t>(countShards_));
+    }
+  }
+
+
+  int64_t IndexShards::GetLocalIdentifier(int64_t globalId) const
+  {
+    if (globalId < 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+    else
+    {
+      return globalId / static_cast<int64_t>(countShards_);
+    }
+  }
+
+
+  int64_t IndexShards::GetLocalSince(size_t shard,
+                                     int64_t globalSince) const
+  {
+    if (shard >= countShards_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    // "local * count + shard > globalSince" <=> "local > floor((globalSince - shard) / count)"
+    const int64_t count = static_cast<int64_t>(countShards_);
+    const int64_t delta = globalSince - static_cast<int64_t>(shard);
+
+    if (delta >= 0)
+    {
+      return delta / count;
+    }
+    else
+    {
+      return -((-delta + count - 1) / count);
+    }
+  }
+
+
+  bool IndexShards::MergePages(std::vector<int64_t>& target,
+                               const std::vector< std::vector<int64_t> >& pages,
+                               const std::vector<bool>& done,
+                               uint32_t limit)
+  {
+    if (pages.size() != done.size())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    target.clear();
+
+    bool allDone = true;
+
+    for (size_t i = 0; i < pages.size(); i++)
+    {
+      target.insert(target.end(), pages[i].begin(), pages[i].end());
+      allDone = (allDone && done[i]);
+    }
+
+    std::sort(target.begin(), target.end());
+
+    /**
+     * Each shard has returned its "limit" smallest items, so the
+     * "limit" smallest items of the union are complete. The items
+     * that are beyond the limit are re-read by the next page.
+     **/
+    if (target.size() > limit)
+    {
+      target.resize(limit);
+      return false;
+    }
+    else
+    {
+      return allDone;
+    }
+  }
+}
@@ -0,0 +1,89 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+namespace OrthancDatabases
+{
+  /**
+   * Routing of the patients over several index databases (shards),
+   * as an alternative to Citus for the backends that cannot scale
+   * their writes (SQLite, MySQL). Each patient, together with its
+   * studies, series and instances, is stored in one shard that is
+   * chosen by a hash of its public ID. The identifiers that are
+   * exchanged with the Orthanc core (internal IDs, sequences of the
+   * changes) encode their shard, so that the requests that only
+   * provide an identifier can be routed as well. This class is
+   * immutable, hence thread-safe.
+   **/
+  class IndexShards : public boost::noncopyable
+  {
+  private:
+    size_t  countShards_;
+
+  public:
+    explicit IndexShards(size_t countShards);
+
+    size_t GetShardsCount() const
+    {
+      return countShards_;
+    }
+
+    // The hash is stable across the platforms and the versions, as it decides where the patients are stored
+    size_t GetPatientShard(const std::string& patientPublicId) const;
+
+    int64_t EncodeIdentifier(size_t shard,
+                             int64_t localId) const;
+
+    size_t GetShard(int64_t globalId) const;
+
+    int64_t GetLocalIdentifier(int64_t globalId) const;
+
+    /**
+     * Returns the sequence to be provided as "since" to one shard, so
+     * that the local sequences that are greater than it are exactly
+     * those whose global sequence is greater than "globalSince".
+     **/
+    int64_t GetLocalSince(size_t shard,
+                          int64_t globalSince) const;
+
+    /**
+     * Scatter-gather of a page of ordered results: "pages[i]" contains
+     * the global identifiers (e.g. sequences of changes) returned by the
+     * shard "i" in increasing order, limited to "limit" items, and
+     * "done[i]" tells whether this shard has no more items. Returns
+     * whether the merged page is the last one.
+     **/
+    static bool MergePages(std::vector<int64_t>& target,
+                           const std::vector< std::vector<int64_t> >& pages,
+                           const std::vector<bool>& done,
+                           uint32_t limit);
+  };
+}
@@ -25,12 +25,29 @@
 
 #include "../Common/ImplicitTransaction.h"
 #include "DatabaseBackendAdapterV2.h"
+#include "DatabaseBackendAdapterV4.h"
 #include "GlobalProperties.h"
+#include "IndexConnectionsPool.h"
+#include "StorageBackend.h"
 
 #include <Compatibility.h>  // For std::unique_ptr<>
+#include <Toolbox.h>
 
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
 #include <gtest/gtest.h>
+#include <algorithm>
 #include <list>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#if !defined(_WIN32)
+#  include <sys/resource.h>
+#endif
+
 
 #if !defined(ORTHANC_DATABASE_VERSION)
 // This happens if using the Orthanc framework system-wide library
@@ -41,7 +58,7 @@
 #if ORTHANC_ENABLE_POSTGRESQL == 1
 #  define HAS_REVISIONS 1
 #elif ORTHANC_ENABLE_MYSQL == 1
-#  define HAS_REVISIONS 0
+#  define HAS_REVISIONS 1
 #elif ORTHANC_ENABLE_SQLITE == 1
 #  define HAS_REVISIONS 1
 #elif ORTHANC_ENABLE_ODBC == 1
@@ -319,6 +336,34 @@ TEST(IndexBackend, Basic)
   ASSERT_TRUE(cp.back() == "series" || cp.back() == "series2");
   ASSERT_NE(cp.front(), cp.back());
 
+  {
+    std::vector<std::string> batch;
+    int64_t last = -1;
+    ASSERT_FALSE(db.GetChildrenPublicId(batch, last, *manager, a, 1));
+    ASSERT_EQ(1u, batch.size());
+    ASSERT_EQ("series", batch[0]);
+    ASSERT_EQ(b, last);
+    ASSERT_FALSE(db.GetChildrenPublicId(batch, last, *manager, a, 1));
+    ASSERT_EQ(1u, batch.size());
+    ASSERT_EQ("series2", batch[0]);
+    ASSERT_EQ(c, last);
+    ASSERT_TRUE(db.GetChildrenPublicId(batch, last, *manager, a, 1));
+    ASSERT_EQ(0u, batch.size());
+    ASSERT_EQ(c, last);
+
+    last = -1;
+    ASSERT_TRUE(db.GetChildrenPublicId(batch, last, *manager, a, 10));
+    ASSERT_EQ(2u, batch.size());
+    ASSERT_TRUE(db.GetChildrenPublicId(batch, last, *manager, b, 10));
+    ASSERT_EQ(0u, batch.size());
+
+    db.GetDescendantInstances(batch, *manager, a, Orthanc::ResourceType_Study, 10);
+    ASSERT_EQ(0u, batch.size());
+    db.GetDescendantInstances(batch, *manager, b, Orthanc::ResourceType_Series, 10);
+    ASSERT_EQ(0u, batch.size());
+    ASSERT_THROW(db.GetDescendantInstances(batch, *manager, b, Orthanc::ResourceType_Instance, 10), Orthanc::OrthancException);
+  }
+
   std::list<std::string> pub;
   db.GetAllPublicIds(pub, *manager, OrthancPluginResourceType_Patient);
   ASSERT_EQ(0u, pub.size());
@@ -331,6 +376,22 @@ TEST(IndexBackend, Basic)
   ASSERT_TRUE(pub.back() == "series" || pub.back() == "series2");
   ASSERT_NE(pub.front(), pub.back());
 
+  {
+    google::protobuf::RepeatedPtrField<std::string> ids;
+    db.GetAllPublicIds(ids, *manager, OrthancPluginResourceType_Series);
+    ASSERT_EQ(2, ids.size());
+    ASSERT_NE(ids.Get(0), ids.Get(1));
+    db.GetAllPublicIds(ids, *manager, OrthancPluginResourceType_Series, 1, 10);
+    ASSERT_EQ(1, ids.size());
+    ASSERT_EQ("series2", ids.Get(0));
+
+    google::protobuf::RepeatedField<int64_t> internalIds;
+    db.GetChildrenInternalId(internalIds, *manager, a);
+    ASSERT_EQ(2, internalIds.size());
+    ASSERT_TRUE(internalIds.Get(0) == b || internalIds.Get(0) == c);
+    ASSERT_NE(internalIds.Get(0), internalIds.Get(1));
+  }
+
   std::list<int64_t> ci;
   db.GetChildrenInternalId(ci, *manager, a);
   ASSERT_EQ(2u, ci.size());
@@ -338,6 +399,41 @@ TEST(IndexBackend, Basic)
   ASSERT_TRUE(ci.back() == b || ci.back() == c);
   ASSERT_NE(ci.front(), ci.back());
 
+  {
+    DatabaseManager::Transaction transaction(*manager, TransactionType_ReadWrite);
+    db.LogChange(*manager, OrthancPluginChangeType_NewSeries, b, OrthancPluginResourceType_Series, "20240101T000000");
+    db.LogChange(*manager, OrthancPluginChangeType_NewSeries, c, OrthancPluginResourceType_Series, "20240101T000000");
+    transaction.Commit();
+  }
+
+  {
+    DatabaseManager::Transaction transaction(*manager, TransactionType_ReadOnly);
+
+    const int64_t last = db.GetLastChangeIndex(*manager);
+
+    std::set<uint32_t> changeTypes;
+    changeTypes.insert(OrthancPluginChangeType_StableStudy);
+
+    // The cursor moves past the changes that are filtered out
+    bool done = false;
+    int64_t next = -1;
+    db.GetChangesCursor(*output, done, next, *manager, 0, changeTypes, 10);
+    ASSERT_TRUE(done);
+    ASSERT_EQ(last, next);
+
+    changeTypes.insert(OrthancPluginChangeType_NewSeries);
+    db.GetChangesCursor(*output, done, next, *manager, 0, changeTypes, 1);
+    ASSERT_FALSE(done);
+    ASSERT_EQ(last - 1, next);
+    db.GetChangesCursor(*output, done, next, *manager, next, changeTypes, 1);
+    ASSERT_TRUE(done);
+    ASSERT_EQ(last, next);
+
+    ASSERT_THROW(db.GetChangesCursor(*output, done, next, *manager, 0, changeTypes, 0), Orthanc::OrthancException);
+
+    transaction.Commit();
+  }
+
   db.SetMetadata(*manager, a, Orthanc::MetadataType_ModifiedFrom, "modified", 42);
   db.SetMetadata(*manager, a, Orthanc::MetadataType_LastUpdate, "update2", 43);
   int64_t revision = -1;
@@ -364,6 +460,19 @@ TEST(IndexBackend, Basic)
   std::list<int32_t> md;
   db.ListAvailableMetadata(md, *manager, a);
   ASSERT_EQ(2u, md.size());
+
+  {
+    std::list<int64_t> ids;
+    ids.push_back(a);
+    ids.push_back(b);
+
+    std::map<int64_t, std::map<int32_t, std::string> > batch;
+    db.GetResourcesMetadata(batch, *manager, ids);
+    ASSERT_EQ(1u, batch.size());
+    ASSERT_EQ(2u, batch[a].size());
+    ASSERT_EQ("modified", batch[a][Orthanc::MetadataType_ModifiedFrom]);
+    ASSERT_STREQ(reinterpret_cast<const char*>(UTF8), batch[a][Orthanc::MetadataType_LastUpdate].c_str());
+  }
   ASSERT_TRUE(md.front() == Orthanc::MetadataType_ModifiedFrom || md.back() == Orthanc::MetadataType_ModifiedFrom);
   ASSERT_TRUE(md.front() == Orthanc::MetadataType_LastUpdate || md.back() == Orthanc::MetadataType_LastUpdate);
   std::string mdd;
@@ -398,6 +507,46 @@ TEST(IndexBackend, Basic)
   ASSERT_EQ(1u, md.size());
   ASSERT_EQ(Orthanc::MetadataType_ModifiedFrom, md.front());
 
+  {
+    std::vector<OrthancDatabases::DeferredWrites::ResourceMetadata> items(3);
+    items[0].resource_ = b;
+    items[0].type_ = Orthanc::MetadataType_LastUpdate;
+    items[0].value_ = "first";
+    items[0].revision_ = 1;
+    items[1].resource_ = b;
+    items[1].type_ = Orthanc::MetadataType_ModifiedFrom;
+    items[1].value_ = "from";
+    items[1].revision_ = 2;
+    items[2].resource_ = b;
+    items[2].type_ = Orthanc::MetadataType_LastUpdate;
+    items[2].value_ = "second";   // Overwrites "first" within the same batch
+    items[2].revision_ = 3;
+    db.SetResourcesMetadata(*manager, items);
+
+    ASSERT_TRUE(db.LookupMetadata(s, revision, *manager, b, Orthanc::MetadataType_LastUpdate));
+    ASSERT_EQ("second", s);
+#if HAS_REVISIONS == 1
+    ASSERT_EQ(3, revision);
+#endif
+
+    items.resize(1);
+    items[0].value_ = "third";
+    items[0].revision_ = 4;
+    db.SetResourcesMetadata(*manager, items);   // Overwrites an existing row
+
+    ASSERT_TRUE(db.LookupMetadata(s, revision, *manager, b, Orthanc::MetadataType_LastUpdate));
+    ASSERT_EQ("third", s);
+    ASSERT_TRUE(db.LookupMetadata(s, revision, *manager, b, Orthanc::MetadataType_ModifiedFrom));
+    ASSERT_EQ("from", s);
+
+    db.ListAvailableMetadata(md, *manager, b);
+    ASSERT_EQ(2u, md.size());
+    db.DeleteMetadata(*manager, b, Orthanc::MetadataType_LastUpdate);
+    db.DeleteMetadata(*manager, b, Orthanc::MetadataType_ModifiedFrom);
+    db.ListAvailableMetadata(md, *manager, b);
+    ASSERT_EQ(0u, md.size());
+  }
+
   ASSERT_EQ(0u, db.GetTotalCompressedSize(*manager));
   ASSERT_EQ(0u, db.GetTotalUncompressedSize(*manager));
 
@@ -467,6 +616,33 @@ TEST(IndexBackend, Basic)
   ASSERT_EQ(0, revision);
 #endif
 
+  {
+    std::set<int64_t> ids;
+    ids.insert(a);
+    ids.insert(b);
+
+    google::protobuf::RepeatedPtrField<Orthanc::DatabasePluginMessages::Find_Response> attachments;
+    db.LookupAttachments(attachments, *manager, ids);
+    ASSERT_EQ(1, attachments.size());  // "b" has no attachment
+    ASSERT_EQ(a, attachments.Get(0).internal_id());
+    ASSERT_EQ("study", attachments.Get(0).public_id());
+    ASSERT_EQ(2, attachments.Get(0).attachments_size());
+    ASSERT_EQ(2, attachments.Get(0).attachments_revisions_size());
+    ASSERT_EQ("uuid1", attachments.Get(0).attachments(0).uuid());
+    ASSERT_EQ(Orthanc::FileContentType_Dicom, attachments.Get(0).attachments(0).content_type());
+    ASSERT_EQ(42u, attachments.Get(0).attachments(0).uncompressed_size());
+    ASSERT_EQ("md5_1", attachments.Get(0).attachments(0).compressed_hash());
+    ASSERT_EQ("uuid2", attachments.Get(0).attachments(1).uuid());
+    ASSERT_EQ(4242u, attachments.Get(0).attachments(1).compressed_size());
+
+#if HAS_REVISIONS == 1
+    ASSERT_EQ(42, attachments.Get(0).attachments_revisions(0));
+    ASSERT_EQ(43, attachments.Get(0).attachments_revisions(1));
+#else
+    ASSERT_EQ(0, attachments.Get(0).attachments_revisions(0));
+#endif
+  }
+
   db.ListAvailableAttachments(fc, *manager, b);
   ASSERT_EQ(0u, fc.size());
   db.DeleteAttachment(*output, *manager, a, Orthanc::FileContentType_Dicom);
@@ -603,6 +779,40 @@ TEST(IndexBackend, Basic)
   ASSERT_TRUE(db.SelectPatientToRecycle(r, *manager, p3));
   ASSERT_EQ(p1, r);
 
+  {
+    std::list<int64_t> patients;
+    db.SelectPatientsToRecycle(patients, *manager, 10);
+    ASSERT_EQ(2u, patients.size());
+    ASSERT_EQ(p3, patients.front());
+    ASSERT_EQ(p1, patients.back());
+
+    db.SelectPatientsToRecycle(patients, *manager, 1);
+    ASSERT_EQ(1u, patients.size());
+    ASSERT_EQ(p3, patients.front());
+
+    db.SelectPatientsToRecycle(patients, *manager, 0);
+    ASSERT_TRUE(patients.empty());
+
+    // Tagging the most recent patient twice doesn't change the order
+    db.TagMostRecentPatient(*manager, p3);
+    db.TagMostRecentPatient(*manager, p3);
+    db.SelectPatientsToRecycle(patients, *manager, 10);
+    ASSERT_EQ(2u, patients.size());
+    ASSERT_EQ(p1, patients.front());
+    ASSERT_EQ(p3, patients.back());
+
+    db.TagMostRecentPatient(*manager, p1);
+    ASSERT_EQ(2u, db.GetUnprotectedPatientsCount(*manager));
+    ASSERT_TRUE(db.SelectPatientToRecycle(r, *manager));
+    ASSERT_EQ(p3, r);
+
+    // Protected patients are not added back to the recycling order
+    db.SetProtectedPatient(*manager, p3, true);
+    db.TagMostRecentPatient(*manager, p3);
+    ASSERT_EQ(1u, db.GetUnprotectedPatientsCount(*manager));
+    db.SetProtectedPatient(*manager, p3, false);
+  }
+
   {
     // Test creating a large property of 16MB (large properties are
     // notably necessary to serialize jobs)
@@ -769,5 +979,1905 @@ TEST(IndexBackend, Basic)
     }
   }
 
+  {
+    // Test bulk deletion, including a resource whose parent is also deleted
+    ASSERT_EQ(0u, db.GetAllResourcesCount(*manager));
+
+    int64_t p1 = db.CreateResource(*manager, "patient1", OrthancPluginResourceType_Patient);
+    int64_t s1a = db.CreateResource(*manager, "study1a", OrthancPluginResourceType_Study);
+    int64_t s1b = db.CreateResource(*manager, "study1b", OrthancPluginResourceType_Study);
+    int64_t p2 = db.CreateResource(*manager, "patient2", OrthancPluginResourceType_Patient);
+    int64_t s2 = db.CreateResource(*manager, "study2", OrthancPluginResourceType_Study);
+    db.AttachChild(*manager, p1, s1a);
+    db.AttachChild(*manager, p1, s1b);
+    db.AttachChild(*manager, p2, s2);
+
+    OrthancPluginAttachment d;
+    d.uuid = "attachment";
+    d.contentType = Orthanc::FileContentType_DicomAsJson;
+    d.uncompressedSize = 4242;
+    d.uncompressedHash = "md5";
+    d.compressionType = Orthanc::CompressionType_None;
+    d.compressedSize = 4242;
+    d.compressedHash = "md5";
+    db.AddAttachment(*manager, s2, d, 42);
+
+    std::list<int64_t> ids;
+    ids.push_back(s1a);
+    ids.push_back(p2);
+    ids.push_back(s2);
+
+    deletedAttachments.clear();
+    deletedResources.clear();
+    remainingAncestor.reset();
+
+    std::map<std::string, OrthancPluginResourceType> remainingAncestors;
+
+    manager->StartTransaction(TransactionType_ReadWrite);
+    db.DeleteResources(*output, remainingAncestors, *manager, ids);
+    manager->CommitTransaction();
+
+    ASSERT_EQ(1u, deletedAttachments.size());
+    ASSERT_EQ("attachment", *deletedAttachments.begin());
+    ASSERT_EQ(3u, deletedResources.size());
+    ASSERT_EQ(OrthancPluginResourceType_Study, deletedResources["study1a"]);
+    ASSERT_EQ(OrthancPluginResourceType_Patient, deletedResources["patient2"]);
+    ASSERT_EQ(OrthancPluginResourceType_Study, deletedResources["study2"]);
+    ASSERT_TRUE(remainingAncestor.get() == NULL);
+    ASSERT_EQ(1u, remainingAncestors.size());
+    ASSERT_EQ(OrthancPluginResourceType_Patient, remainingAncestors["patient1"]);
+
+    ASSERT_EQ(2u, db.GetAllResourcesCount(*manager));
+    ASSERT_TRUE(db.IsExistingResource(*manager, p1));
+    ASSERT_TRUE(db.IsExistingResource(*manager, s1b));
+
+    db.DeleteResource(*output, *manager, p1);
+  }
+
+#if ORTHANC_PLUGINS_HAS_DATABASE_CONSTRAINT == 1
+  {
+    manager->StartTransaction(TransactionType_ReadWrite);
+    ASSERT_EQ(0u, db.GetAllResourcesCount(*manager));
+
+    OrthancPluginCreateInstanceResult a;
+    db.CreateInstanceGeneric(a, *manager, "patient", "study", "series", "instance1");
+    ASSERT_TRUE(a.isNewInstance && a.isNewPatient && a.isNewStudy && a.isNewSeries);
+    ASSERT_EQ(4u, db.GetAllResourcesCount(*manager));
+
+    OrthancPluginCreateInstanceResult b;
+    db.CreateInstanceGeneric(b, *manager, "patient", "study", "series", "instance1");
+    ASSERT_FALSE(b.isNewInstance);
+    ASSERT_EQ(a.instanceId, b.instanceId);
+
+    db.CreateInstanceGeneric(b, *manager, "patient", "study", "series2", "instance2");
+    ASSERT_TRUE(b.isNewInstance && b.isNewSeries);
+    ASSERT_FALSE(b.isNewPatient || b.isNewStudy);
+    ASSERT_EQ(a.patientId, b.patientId);
+    ASSERT_EQ(a.studyId, b.studyId);
+
+    std::string parent;
+    ASSERT_TRUE(db.GetParentPublicId(parent, *manager, b.seriesId));
+    ASSERT_EQ("study", parent);
+    ASSERT_EQ(6u, db.GetAllResourcesCount(*manager));
+
+    db.DeleteResource(*output, *manager, a.patientId);
+    manager->CommitTransaction();
+  }
+#endif
+
+  manager->Close();
+}
+
+
+#if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 5)
+// Reads one page of the studies, ordered by their "StudyDescription"
+static std::string ReadOrderedStudies(OrthancDatabases::IndexBackend& db,
+                                      OrthancDatabases::DatabaseManager& manager,
+                                      Orthanc::DatabasePluginMessages::OrderingDirection direction,
+                                      uint64_t since,
+                                      uint64_t count)
+{
+  Orthanc::DatabasePluginMessages::Find_Request request;
+  request.set_level(Orthanc::DatabasePluginMessages::RESOURCE_STUDY);
+  request.mutable_limits()->set_since(since);
+  request.mutable_limits()->set_count(count);
+
+  Orthanc::DatabasePluginMessages::Find_Request_Ordering* ordering = request.add_ordering();
+  ordering->set_key_type(Orthanc::DatabasePluginMessages::OrderingKeyType::ORDERING_KEY_TYPE_DICOM_TAG);
+  ordering->set_tag_group(0x0008);
+  ordering->set_tag_element(0x1030);
+  ordering->set_tag_level(Orthanc::DatabasePluginMessages::RESOURCE_STUDY);
+  ordering->set_is_identifier_tag(false);
+  ordering->set_direction(direction);
+
+  Orthanc::DatabasePluginMessages::TransactionResponse response;
+  manager.StartTransaction(OrthancDatabases::TransactionType_ReadOnly);
+  db.ExecuteFind(response, manager, request);
+  manager.CommitTransaction();
+
+  std::string s;
+  for (int i = 0; i < response.find_size(); i++)
+  {
+    s += (i == 0 ? "" : " ") + response.find(i).public_id();
+  }
+
+  return s;
+}
+
+
+TEST(IndexBackend, KeysetPagination)
+{
+  using namespace OrthancDatabases;
+
+  OrthancPluginContext context;
+  context.pluginsManager = NULL;
+  context.orthancVersion = "mainline";
+  context.Free = ::free;
+  context.InvokeService = InvokeService;
+
+#if ORTHANC_ENABLE_POSTGRESQL == 1
+  PostgreSQLIndex db(&context, globalParameters_, false);
+  db.SetClearAll(true);
+#elif ORTHANC_ENABLE_MYSQL == 1
+  MySQLIndex db(&context, globalParameters_, false);
+  db.SetClearAll(true);
+#elif ORTHANC_ENABLE_ODBC == 1
+  OdbcIndex db(&context, connectionString_, false);
+#elif ORTHANC_ENABLE_SQLITE == 1  // Must be the last one
+  SQLiteIndex db(&context);  // Open in memory
+#else
+#  error Unsupported database backend
+#endif
+
+  db.SetOutputFactory(new DatabaseBackendAdapterV2::Factory(&context, NULL));
+  db.SetKeysetPagination(true);
+
+  std::list<IdentifierTag> identifierTags;
+  std::unique_ptr<DatabaseManager> manager(IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+  std::unique_ptr<IDatabaseBackendOutput> output(db.CreateOutput());
+
+  if (db.HasFindSupport())
+  {
+    // Ties on the ordering key, and NULL values ("s2" and "s5")
+    const char* descriptions[] = { "B", "A", NULL, "B", "C", NULL, "A" };
+
+    manager->StartTransaction(TransactionType_ReadWrite);
+
+    for (size_t i = 0; i < sizeof(descriptions) / sizeof(const char*); i++)
+    {
+      int64_t id = db.CreateResource(*manager, "s" + boost::lexical_cast<std::string>(i), OrthancPluginResourceType_Study);
+      if (descriptions[i] != NULL)
+      {
+        db.SetMainDicomTag(*manager, id, 0x0008, 0x1030, descriptions[i]);
+      }
+    }
+
+    manager->CommitTransaction();
+
+    const Orthanc::DatabasePluginMessages::OrderingDirection ASC =
+      Orthanc::DatabasePluginMessages::OrderingDirection::ORDERING_DIRECTION_ASC;
+    const Orthanc::DatabasePluginMessages::OrderingDirection DESC =
+      Orthanc::DatabasePluginMessages::OrderingDirection::ORDERING_DIRECTION_DESC;
+
+    // The pages after the first one are read using the seek
+    // condition, whose bounds split the ties and the NULL values
+    ASSERT_EQ("s1 s6 s0", ReadOrderedStudies(db, *manager, ASC, 0, 3));
+    ASSERT_EQ("s3 s4 s2", ReadOrderedStudies(db, *manager, ASC, 3, 3));
+    ASSERT_EQ("s5", ReadOrderedStudies(db, *manager, ASC, 6, 3));
+
+    ASSERT_EQ("s4 s0", ReadOrderedStudies(db, *manager, DESC, 0, 2));
+    ASSERT_EQ("s3 s1", ReadOrderedStudies(db, *manager, DESC, 2, 2));
+    ASSERT_EQ("s6 s2", ReadOrderedStudies(db, *manager, DESC, 4, 2));
+    ASSERT_EQ("s5", ReadOrderedStudies(db, *manager, DESC, 6, 2));
+
+    // The bound after "s0" is dropped once a study is added before it
+    ASSERT_EQ("s4 s0", ReadOrderedStudies(db, *manager, DESC, 0, 2));
+
+    int64_t s7;
+
+    manager->StartTransaction(TransactionType_ReadWrite);
+    s7 = db.CreateResource(*manager, "s7", OrthancPluginResourceType_Study);
+    db.SetMainDicomTag(*manager, s7, 0x0008, 0x1030, "D");
+    db.LogChange(*manager, OrthancPluginChangeType_NewStudy, s7, OrthancPluginResourceType_Study, "20240101T000000");
+    manager->CommitTransaction();
+
+    ASSERT_EQ("s0 s3", ReadOrderedStudies(db, *manager, DESC, 2, 2));
+
+    // The deletions don't log a change, but they drop the bounds as well
+    ASSERT_EQ("s7 s4", ReadOrderedStudies(db, *manager, DESC, 0, 2));
+
+    deletedResources.clear();
+    remainingAncestor.reset();
+
+    manager->StartTransaction(TransactionType_ReadWrite);
+    db.DeleteResource(*output, *manager, s7);
+    manager->CommitTransaction();
+
+    ASSERT_EQ("s3 s1", ReadOrderedStudies(db, *manager, DESC, 2, 2));
+  }
+
+  deletedResources.clear();
+  remainingAncestor.reset();
+
+  manager->Close();
+}
+
+
+// Formats the answers of "ExecuteFind()" at the study level, in the alphabetical order
+static std::string FormatFoundStudies(const Orthanc::DatabasePluginMessages::TransactionResponse& response)
+{
+  std::vector<std::string> studies;
+
+  for (int i = 0; i < response.find_size(); i++)
+  {
+    const Orthanc::DatabasePluginMessages::Find_Response& find = response.find(i);
+
+    std::vector<std::string> values;
+
+    for (int j = 0; j < find.study_content().main_dicom_tags_size(); j++)
+    {
+      char tag[16];
+      sprintf(tag, "%04x,%04x=", find.study_content().main_dicom_tags(j).group(),
+              find.study_content().main_dicom_tags(j).element());
+      values.push_back(tag + find.study_content().main_dicom_tags(j).value());
+    }
+
+    for (int j = 0; j < find.study_content().metadata_size(); j++)
+    {
+      values.push_back(boost::lexical_cast<std::string>(find.study_content().metadata(j).key()) + "=" +
+                       find.study_content().metadata(j).value());
+    }
+
+    std::sort(values.begin(), values.end());
+
+    std::string s = find.public_id() + "[";
+    for (size_t j = 0; j < values.size(); j++)
+    {
+      s += (j == 0 ? "" : " ") + values[j];
+    }
+
+    studies.push_back(s + "]");
+  }
+
+  std::sort(studies.begin(), studies.end());
+
+  std::string s;
+  for (size_t i = 0; i < studies.size(); i++)
+  {
+    s += (i == 0 ? "" : " ") + studies[i];
+  }
+
+  return s;
+}
+
+
+// Looks up the studies by their "StudyInstanceUID"
+static std::string FindStudies(OrthancDatabases::IndexBackend& db,
+                               OrthancDatabases::DatabaseManager& manager,
+                               Orthanc::DatabasePluginMessages::ConstraintType type,
+                               const std::string& value)
+{
+  Orthanc::DatabasePluginMessages::Find_Request request;
+  request.set_level(Orthanc::DatabasePluginMessages::RESOURCE_STUDY);
+  request.set_retrieve_main_dicom_tags(true);
+  request.set_retrieve_metadata(true);
+  request.mutable_limits()->set_since(0);
+  request.mutable_limits()->set_count(10);
+
+  Orthanc::DatabasePluginMessages::DatabaseConstraint* constraint = request.add_dicom_tag_constraints();
+  constraint->set_level(Orthanc::DatabasePluginMessages::RESOURCE_STUDY);
+  constraint->set_tag_group(0x0020);
+  constraint->set_tag_element(0x000d);
+  constraint->set_is_identifier_tag(true);
+  constraint->set_is_case_sensitive(true);
+  constraint->set_is_mandatory(true);
+  constraint->set_type(type);
+  constraint->add_values(value);
+
+  Orthanc::DatabasePluginMessages::TransactionResponse response;
+  manager.StartTransaction(OrthancDatabases::TransactionType_ReadOnly);
+  db.ExecuteFind(response, manager, request);
+  manager.CommitTransaction();
+
+  return FormatFoundStudies(response);
+}
+
+
+TEST(IndexBackend, FindTwoPhases)
+{
+  using namespace OrthancDatabases;
+
+  OrthancPluginContext context;
+  context.pluginsManager = NULL;
+  context.orthancVersion = "mainline";
+  context.Free = ::free;
+  context.InvokeService = InvokeService;
+
+#if ORTHANC_ENABLE_POSTGRESQL == 1
+  PostgreSQLIndex db(&context, globalParameters_, false);
+  db.SetClearAll(true);
+#elif ORTHANC_ENABLE_MYSQL == 1
+  MySQLIndex db(&context, globalParameters_, false);
+  db.SetClearAll(true);
+#elif ORTHANC_ENABLE_ODBC == 1
+  OdbcIndex db(&context, connectionString_, false);
+#elif ORTHANC_ENABLE_SQLITE == 1  // Must be the last one
+  SQLiteIndex db(&context);  // Open in memory
+#else
+#  error Unsupported database backend
+#endif
+
+  db.SetOutputFactory(new DatabaseBackendAdapterV2::Factory(&context, NULL));
+
+  std::list<IdentifierTag> identifierTags;
+  std::unique_ptr<DatabaseManager> manager(IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+
+  if (db.HasFindSupport())
+  {
+    manager->StartTransaction(TransactionType_ReadWrite);
+
+    for (unsigned int i = 0; i < 3; i++)
+    {
+      const std::string suffix = boost::lexical_cast<std::string>(i);
+      int64_t id = db.CreateResource(*manager, "s" + suffix, OrthancPluginResourceType_Study);
+      db.SetIdentifierTag(*manager, id, 0x0020, 0x000d, "uid" + suffix);
+      db.SetMainDicomTag(*manager, id, 0x0008, 0x1030, "description" + suffix);
+      db.SetMetadata(*manager, id, 1024, ("metadata" + suffix).c_str(), 1);
+    }
+
+    manager->CommitTransaction();
+
+    const Orthanc::DatabasePluginMessages::ConstraintType EQUAL = Orthanc::DatabasePluginMessages::CONSTRAINT_EQUAL;
+    const Orthanc::DatabasePluginMessages::ConstraintType WILDCARD = Orthanc::DatabasePluginMessages::CONSTRAINT_WILDCARD;
+
+    // The single query is the reference for the two phases, for an empty and a non-empty lookup
+    db.SetFindTwoPhases(false);
+    const std::string empty = FindStudies(db, *manager, EQUAL, "nope");
+    const std::string one = FindStudies(db, *manager, EQUAL, "uid1");
+    const std::string all = FindStudies(db, *manager, WILDCARD, "uid*");
+
+    ASSERT_TRUE(empty.empty());
+    ASSERT_EQ("s1[0008,1030=description1 1024=metadata1]", one);
+    ASSERT_EQ("s0[0008,1030=description0 1024=metadata0] "
+              "s1[0008,1030=description1 1024=metadata1] "
+              "s2[0008,1030=description2 1024=metadata2]", all);
+
+    db.SetFindTwoPhases(true);
+    ASSERT_EQ(empty, FindStudies(db, *manager, EQUAL, "nope"));
+    ASSERT_EQ(one, FindStudies(db, *manager, EQUAL, "uid1"));
+    ASSERT_EQ(all, FindStudies(db, *manager, WILDCARD, "uid*"));
+  }
+
+  manager->Close();
+}
+
+
+TEST(IndexBackend, FindProjectionsCache)
+{
+  using namespace OrthancDatabases;
+
+  OrthancPluginContext context;
+  context.pluginsManager = NULL;
+  context.orthancVersion = "mainline";
+  context.Free = ::free;
+  context.InvokeService = InvokeService;
+
+#if ORTHANC_ENABLE_POSTGRESQL == 1
+  PostgreSQLIndex db(&context, globalParameters_, false);
+  db.SetClearAll(true);
+#elif ORTHANC_ENABLE_MYSQL == 1
+  MySQLIndex db(&context, globalParameters_, false);
+  db.SetClearAll(true);
+#elif ORTHANC_ENABLE_ODBC == 1
+  OdbcIndex db(&context, connectionString_, false);
+#elif ORTHANC_ENABLE_SQLITE == 1  // Must be the last one
+  SQLiteIndex db(&context);  // Open in memory
+#else
+#  error Unsupported database backend
+#endif
+
+  db.SetOutputFactory(new DatabaseBackendAdapterV2::Factory(&context, NULL));
+
+  std::list<IdentifierTag> identifierTags;
+  std::unique_ptr<DatabaseManager> manager(IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+
+  if (db.HasFindSupport())
+  {
+    manager->StartTransaction(TransactionType_ReadWrite);
+
+    for (unsigned int i = 0; i < 3; i++)
+    {
+      const std::string suffix = boost::lexical_cast<std::string>(i);
+      int64_t id = db.CreateResource(*manager, "s" + suffix, OrthancPluginResourceType_Study);
+      db.SetIdentifierTag(*manager, id, 0x0020, 0x000d, "uid" + suffix);
+      db.SetMainDicomTag(*manager, id, 0x0008, 0x1030, "description" + suffix);
+      db.SetMetadata(*manager, id, 1024, ("metadata" + suffix).c_str(), 1);
+    }
+
+    manager->CommitTransaction();
+
+    // The constraints are not part of the shape of the projection,
+    // so the first find stores the projection that the others reuse
+    ASSERT_EQ("s0[0008,1030=description0 1024=metadata0]",
+              FindStudies(db, *manager, Orthanc::DatabasePluginMessages::CONSTRAINT_EQUAL, "uid0"));
+    ASSERT_EQ("s2[0008,1030=description2 1024=metadata2]",
+              FindStudies(db, *manager, Orthanc::DatabasePluginMessages::CONSTRAINT_EQUAL, "uid2"));
+    ASSERT_EQ("s1[0008,1030=description1 1024=metadata1]",
+              FindStudies(db, *manager, Orthanc::DatabasePluginMessages::CONSTRAINT_WILDCARD, "uid1*"));
+    ASSERT_TRUE(FindStudies(db, *manager, Orthanc::DatabasePluginMessages::CONSTRAINT_EQUAL, "nope").empty());
+
+    // A study without metadata, that is created once the projection is cached
+    manager->StartTransaction(TransactionType_ReadWrite);
+    int64_t s3 = db.CreateResource(*manager, "s3", OrthancPluginResourceType_Study);
+    db.SetIdentifierTag(*manager, s3, 0x0020, 0x000d, "uid3");
+    db.SetMainDicomTag(*manager, s3, 0x0008, 0x1030, "description3");
+    manager->CommitTransaction();
+
+    ASSERT_EQ("s3[0008,1030=description3]",
+              FindStudies(db, *manager, Orthanc::DatabasePluginMessages::CONSTRAINT_EQUAL, "uid3"));
+  }
+
   manager->Close();
 }
+
+
+// Looks up the studies with the given label, or all the studies if the label is empty
+static std::string FindLabeledStudies(OrthancDatabases::IndexBackend& db,
+                                      OrthancDatabases::DatabaseManager& manager,
+                                      const std::string& label)
+{
+  Orthanc::DatabasePluginMessages::Find_Request request;
+  request.set_level(Orthanc::DatabasePluginMessages::RESOURCE_STUDY);
+  request.mutable_limits()->set_since(0);
+  request.mutable_limits()->set_count(10);
+
+  if (!label.empty())
+  {
+    request.add_labels(label);
+    request.set_labels_constraint(Orthanc::DatabasePluginMessages::LABELS_CONSTRAINT_ALL);
+  }
+
+  Orthanc::DatabasePluginMessages::TransactionResponse response;
+  manager.StartTransaction(OrthancDatabases::TransactionType_ReadOnly);
+  db.ExecuteFind(response, manager, request);
+  manager.CommitTransaction();
+
+  return FormatFoundStudies(response);
+}
+
+
+TEST(IndexBackend, FindResultsCacheInvalidations)
+{
+  using namespace OrthancDatabases;
+
+  OrthancPluginContext context;
+  context.pluginsManager = NULL;
+  context.orthancVersion = "mainline";
+  context.Free = ::free;
+  context.InvokeService = InvokeService;
+
+#if ORTHANC_ENABLE_POSTGRESQL == 1
+  PostgreSQLIndex db(&context, globalParameters_, false);
+  db.SetClearAll(true);
+#elif ORTHANC_ENABLE_MYSQL == 1
+  MySQLIndex db(&context, globalParameters_, false);
+  db.SetClearAll(true);
+#elif ORTHANC_ENABLE_ODBC == 1
+  OdbcIndex db(&context, connectionString_, false);
+#elif ORTHANC_ENABLE_SQLITE == 1  // Must be the last one
+  SQLiteIndex db(&context);  // Open in memory
+#else
+#  error Unsupported database backend
+#endif
+
+  db.SetOutputFactory(new DatabaseBackendAdapterV2::Factory(&context, NULL));
+  db.SetFindCacheTimeToLive(3600);
+
+  std::list<IdentifierTag> identifierTags;
+  std::unique_ptr<DatabaseManager> manager(IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+  std::unique_ptr<IDatabaseBackendOutput> output(db.CreateOutput());
+
+  if (db.HasFindSupport() &&
+      db.HasLabelsSupport())
+  {
+    int64_t s0, s1;
+
+    manager->StartTransaction(TransactionType_ReadWrite);
+    s0 = db.CreateResource(*manager, "s0", OrthancPluginResourceType_Study);
+    s1 = db.CreateResource(*manager, "s1", OrthancPluginResourceType_Study);
+    manager->CommitTransaction();
+
+    ASSERT_TRUE(FindLabeledStudies(db, *manager, "hello").empty());
+    ASSERT_EQ("s0[] s1[]", FindLabeledStudies(db, *manager, ""));
+
+    // The labels don't log a change, but they clear the cached answers once committed
+    manager->StartTransaction(TransactionType_ReadWrite);
+    db.AddLabel(*manager, s0, "hello");
+    manager->CommitTransaction();
+
+    ASSERT_EQ("s0[]", FindLabeledStudies(db, *manager, "hello"));
+
+    manager->StartTransaction(TransactionType_ReadWrite);
+    db.RemoveLabel(*manager, s0, "hello");
+    manager->CommitTransaction();
+
+    ASSERT_TRUE(FindLabeledStudies(db, *manager, "hello").empty());
+
+    // Same for the deletions
+    deletedResources.clear();
+    remainingAncestor.reset();
+
+    manager->StartTransaction(TransactionType_ReadWrite);
+    db.DeleteResource(*output, *manager, s1);
+    manager->CommitTransaction();
+
+    ASSERT_EQ("s0[]", FindLabeledStudies(db, *manager, ""));
+  }
+
+  deletedResources.clear();
+  remainingAncestor.reset();
+
+  manager->Close();
+}
+#endif
+
+
+#if ORTHANC_PLUGINS_HAS_DATABASE_CONSTRAINT == 1
+static unsigned int GetBenchmarkParameter(const char* name,
+                                          unsigned int defaultValue)
+{
+  const char* value = getenv(name);
+  if (value == NULL)
+  {
+    return defaultValue;
+  }
+  else
+  {
+    return boost::lexical_cast<unsigned int>(value);
+  }
+}
+
+
+static void PrintBenchmark(const std::string& name,
+                           const boost::posix_time::ptime& start,
+                           unsigned int count)
+{
+  const double ms = static_cast<double>((boost::posix_time::microsec_clock::universal_time() - start).total_microseconds()) / 1000.0;
+  printf("[benchmark] %-40s %10.2f ms  %10.3f ms/op  (%u ops)\n", name.c_str(), ms,
+         count == 0 ? 0.0 : ms / static_cast<double>(count), count);
+}
+
+
+static void InitializeBenchmarkContext(OrthancPluginContext& context)
+{
+  context.pluginsManager = NULL;
+  context.orthancVersion = "mainline";
+  context.Free = ::free;
+  context.InvokeService = InvokeService;
+}
+
+
+static void AddBenchmarkTag(std::list<OrthancPluginDicomTag>& target,
+                            uint16_t group,
+                            uint16_t element,
+                            const std::string& value /* must outlive "target" */)
+{
+  OrthancPluginDicomTag tag;
+  tag.group = group;
+  tag.element = element;
+  tag.value = value.c_str();
+  target.push_back(tag);
+}
+
+
+static bool IsBenchmarkIdentifierTag(const OrthancPluginDicomTag& tag)
+{
+  return ((tag.group == 0x0010 && tag.element == 0x0020) ||  // PatientID
+          (tag.group == 0x0020 && tag.element == 0x000d) ||  // StudyInstanceUID
+          (tag.group == 0x0008 && tag.element == 0x0050) ||  // AccessionNumber
+          (tag.group == 0x0020 && tag.element == 0x000e) ||  // SeriesInstanceUID
+          (tag.group == 0x0008 && tag.element == 0x0018));   // SOPInstanceUID
+}
+
+
+/**
+ * Ingests one instance as Orthanc does, in its own transaction. The
+ * tags of each level (0 for the patient, 3 for the instance) are only
+ * stored if the resource of this level is new.
+ **/
+static void IngestBenchmarkInstance(OrthancPluginCreateInstanceResult& result,
+                                    OrthancDatabases::IndexBackend& db,
+                                    OrthancDatabases::DatabaseManager& manager,
+                                    const std::string& patient,
+                                    const std::string& study,
+                                    const std::string& series,
+                                    const std::string& instance,
+                                    const std::list<OrthancPluginDicomTag> tags[4])
+{
+  manager.StartTransaction(OrthancDatabases::TransactionType_ReadWrite);
+
+  if (db.HasCreateInstance())
+  {
+    db.CreateInstance(result, manager, patient.c_str(), study.c_str(), series.c_str(), instance.c_str());
+  }
+  else
+  {
+    db.CreateInstanceGeneric(result, manager, patient.c_str(), study.c_str(), series.c_str(), instance.c_str());
+  }
+
+  const bool isNew[4] = { result.isNewPatient != 0, result.isNewStudy != 0, result.isNewSeries != 0, true };
+  const int64_t ids[4] = { result.patientId, result.studyId, result.seriesId, result.instanceId };
+
+  std::vector<OrthancPluginResourcesContentTags> identifierTags, mainDicomTags;
+
+  for (unsigned int level = 0; level < 4; level++)
+  {
+    if (isNew[level])
+    {
+      for (std::list<OrthancPluginDicomTag>::const_iterator it = tags[level].begin(); it != tags[level].end(); ++it)
+      {
+        OrthancPluginResourcesContentTags tag = { ids[level], it->group, it->element, it->value };
+        mainDicomTags.push_back(tag);
+
+        if (IsBenchmarkIdentifierTag(*it))
+        {
+          identifierTags.push_back(tag);
+        }
+      }
+    }
+  }
+
+  OrthancPluginResourcesContentMetadata metadata = { result.instanceId, Orthanc::MetadataType_LastUpdate, "20240101T000000" };
+
+  db.SetResourcesContent(manager,
+                         static_cast<uint32_t>(identifierTags.size()), identifierTags.empty() ? NULL : &identifierTags[0],
+                         static_cast<uint32_t>(mainDicomTags.size()), mainDicomTags.empty() ? NULL : &mainDicomTags[0],
+                         1, &metadata);
+
+  manager.CommitTransaction();
+}
+
+
+/**
+ * Performance measurements of the primitives of IndexBackend, to
+ * detect the regressions between two versions of the plugins. This
+ * test is disabled by default, run it with:
+ *
+ *   ./UnitTests <arguments> --gtest_also_run_disabled_tests --gtest_filter=IndexBackend.DISABLED_Benchmark
+ *
+ * The scale is set by the "ORTHANC_BENCHMARK_PATIENTS",
+ * "ORTHANC_BENCHMARK_SERIES" (per patient) and
+ * "ORTHANC_BENCHMARK_INSTANCES" (per series) environment
+ * variables. WARNING: The content of the database is cleared.
+ **/
+TEST(IndexBackend, DISABLED_Benchmark)
+{
+  using namespace OrthancDatabases;
+
+  const unsigned int countPatients = GetBenchmarkParameter("ORTHANC_BENCHMARK_PATIENTS", 100);
+  const unsigned int countSeries = GetBenchmarkParameter("ORTHANC_BENCHMARK_SERIES", 2);
+  const unsigned int countInstances = GetBenchmarkParameter("ORTHANC_BENCHMARK_INSTANCES", 10);
+
+  OrthancPluginContext context;
+  InitializeBenchmarkContext(context);
+
+#if ORTHANC_ENABLE_POSTGRESQL == 1
+  PostgreSQLIndex db(&context, globalParameters_, false);
+  db.SetClearAll(true);
+#elif ORTHANC_ENABLE_MYSQL == 1
+  MySQLIndex db(&context, globalParameters_, false);
+  db.SetClearAll(true);
+#elif ORTHANC_ENABLE_ODBC == 1
+  OdbcIndex db(&context, connectionString_, false);
+#elif ORTHANC_ENABLE_SQLITE == 1  // Must be the last one
+  SQLiteIndex db(&context);  // Open in memory
+#else
+#  error Unsupported database backend
+#endif
+
+  db.SetOutputFactory(new DatabaseBackendAdapterV2::Factory(&context, NULL));
+
+  std::list<IdentifierTag> identifierTags;
+  std::unique_ptr<DatabaseManager> manager(IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+  std::unique_ptr<IDatabaseBackendOutput> output(db.CreateOutput());
+
+  printf("[benchmark] %u patients, %u series per patient, %u instances per series\n",
+         countPatients, countSeries, countInstances);
+
+  std::vector<int64_t> patients;
+  patients.reserve(countPatients);
+
+  {
+    // Ingestion, as done by Orthanc: One transaction per instance
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    unsigned int count = 0;
+
+    for (unsigned int p = 0; p < countPatients; p++)
+    {
+      const std::string patient = "patient" + boost::lexical_cast<std::string>(p);
+      const std::string study = "study" + boost::lexical_cast<std::string>(p);
+
+      for (unsigned int s = 0; s < countSeries; s++)
+      {
+        const std::string series = study + "-series" + boost::lexical_cast<std::string>(s);
+
+        for (unsigned int i = 0; i < countInstances; i++)
+        {
+          const std::string instance = series + "-instance" + boost::lexical_cast<std::string>(i);
+
+          std::list<OrthancPluginDicomTag> tags[4];
+          AddBenchmarkTag(tags[0], 0x0010, 0x0020, patient);
+          AddBenchmarkTag(tags[1], 0x0020, 0x000d, study);
+          AddBenchmarkTag(tags[2], 0x0020, 0x000e, series);
+          AddBenchmarkTag(tags[3], 0x0008, 0x0018, instance);
+
+          OrthancPluginCreateInstanceResult result;
+          IngestBenchmarkInstance(result, db, *manager, patient, study, series, instance, tags);
+
+          if (result.isNewPatient)
+          {
+            patients.push_back(result.patientId);
+          }
+
+          count++;
+        }
+      }
+    }
+
+    PrintBenchmark("CreateInstance + SetResourcesContent", start, count);
+  }
+
+#if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 5)
+  if (db.HasFindSupport())
+  {
+    const unsigned int ITERATIONS = 20;
+
+    for (unsigned int shape = 0; shape < 4; shape++)
+    {
+      Orthanc::DatabasePluginMessages::Find_Request request;
+      request.set_level(Orthanc::DatabasePluginMessages::RESOURCE_STUDY);
+      request.set_retrieve_main_dicom_tags(true);
+      request.set_retrieve_metadata(true);
+
+      std::string name;
+
+      switch (shape)
+      {
+        case 0:
+          name = "ExecuteFind (all studies, 100 first)";
+          request.mutable_limits()->set_since(0);
+          request.mutable_limits()->set_count(100);
+          break;
+
+        case 1:
+        case 2:
+        case 3:
+        {
+          Orthanc::DatabasePluginMessages::DatabaseConstraint* constraint = request.add_dicom_tag_constraints();
+          constraint->set_level(Orthanc::DatabasePluginMessages::RESOURCE_PATIENT);
+          constraint->set_tag_group(0x0010);
+          constraint->set_tag_element(0x0020);
+          constraint->set_is_identifier_tag(true);
+          constraint->set_is_case_sensitive(true);
+          constraint->set_is_mandatory(true);
+
+          if (shape == 1)
+          {
+            name = "ExecuteFind (PatientID equal)";
+            constraint->set_type(Orthanc::DatabasePluginMessages::CONSTRAINT_EQUAL);
+            constraint->add_values("patient" + boost::lexical_cast<std::string>(countPatients / 2));
+          }
+          else if (shape == 2)
+          {
+            name = "ExecuteFind (PatientID prefix wildcard)";
+            constraint->set_type(Orthanc::DatabasePluginMessages::CONSTRAINT_WILDCARD);
+            constraint->add_values("patient1*");
+          }
+          else
+          {
+            name = "ExecuteFind (PatientID list)";
+            constraint->set_type(Orthanc::DatabasePluginMessages::CONSTRAINT_LIST);
+            constraint->add_values("patient0");
+            constraint->add_values("patient1");
+            constraint->add_values("patient2");
+          }
+          break;
+        }
+
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+
+      const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+      for (unsigned int i = 0; i < ITERATIONS; i++)
+      {
+        Orthanc::DatabasePluginMessages::TransactionResponse response;
+        manager->StartTransaction(TransactionType_ReadOnly);
+        db.ExecuteFind(response, *manager, request);
+        manager->CommitTransaction();
+      }
+
+      PrintBenchmark(name, start, ITERATIONS);
+    }
+  }
+#endif
+
+  {
+    const unsigned int ITERATIONS = 10;
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    for (unsigned int i = 0; i < ITERATIONS; i++)
+    {
+      int64_t patientsCount, studiesCount, seriesCount, instancesCount, compressedSize, uncompressedSize;
+      manager->StartTransaction(TransactionType_ReadWrite);
+
+      if (db.HasUpdateAndGetStatistics())
+      {
+        db.UpdateAndGetStatistics(*manager, patientsCount, studiesCount, seriesCount,
+                                  instancesCount, compressedSize, uncompressedSize);
+      }
+      else
+      {
+        patientsCount = static_cast<int64_t>(db.GetResourcesCount(*manager, OrthancPluginResourceType_Patient));
+        studiesCount = static_cast<int64_t>(db.GetResourcesCount(*manager, OrthancPluginResourceType_Study));
+        seriesCount = static_cast<int64_t>(db.GetResourcesCount(*manager, OrthancPluginResourceType_Series));
+        instancesCount = static_cast<int64_t>(db.GetResourcesCount(*manager, OrthancPluginResourceType_Instance));
+        compressedSize = static_cast<int64_t>(db.GetTotalCompressedSize(*manager));
+        uncompressedSize = static_cast<int64_t>(db.GetTotalUncompressedSize(*manager));
+      }
+
+      manager->CommitTransaction();
+
+      ASSERT_EQ(static_cast<int64_t>(countPatients), patientsCount);
+    }
+
+    PrintBenchmark("Statistics", start, ITERATIONS);
+  }
+
+  {
+    // Cascade deletion of whole patients
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    for (size_t i = 0; i < patients.size(); i++)
+    {
+      deletedResources.clear();
+      remainingAncestor.reset();
+
+      manager->StartTransaction(TransactionType_ReadWrite);
+      db.DeleteResource(*output, *manager, patients[i]);
+      manager->CommitTransaction();
+    }
+
+    PrintBenchmark("DeleteResource (patient)", start, static_cast<unsigned int>(patients.size()));
+    ASSERT_EQ(0u, db.GetAllResourcesCount(*manager));
+  }
+
+  manager->Close();
+}
+
+
+// The content of the database is kept, contrarily to "SetClearAll()"
+static OrthancDatabases::IndexBackend* CreateWorkloadBackend(OrthancPluginContext* context)
+{
+#if ORTHANC_ENABLE_POSTGRESQL == 1
+  return new OrthancDatabases::PostgreSQLIndex(context, globalParameters_, false);
+#elif ORTHANC_ENABLE_MYSQL == 1
+  return new OrthancDatabases::MySQLIndex(context, globalParameters_, false);
+#elif ORTHANC_ENABLE_ODBC == 1
+  return new OrthancDatabases::OdbcIndex(context, connectionString_, false);
+#elif ORTHANC_ENABLE_SQLITE == 1  // Must be the last one
+  return new OrthancDatabases::SQLiteIndex(context, "workload.db");
+#else
+#  error Unsupported database backend
+#endif
+}
+
+
+/**
+ * Deterministic pseudo-random generator (xorshift64*), so that the
+ * workloads are reproducible from their seed.
+ **/
+class WorkloadRandom : public boost::noncopyable
+{
+private:
+  uint64_t  state_;
+
+public:
+  explicit WorkloadRandom(uint64_t seed) :
+    state_(seed == 0 ? ((static_cast<uint64_t>(0x9e3779b9u) << 32) | 0x7f4a7c15u) : seed)
+  {
+  }
+
+  uint64_t Next()
+  {
+    state_ ^= state_ >> 12;
+    state_ ^= state_ << 25;
+    state_ ^= state_ >> 27;
+    return state_ * ((static_cast<uint64_t>(0x2545f491u) << 32) | 0x4f6cdd1du);
+  }
+
+  // Uniform in [0, 1)
+  double NextUniform()
+  {
+    return static_cast<double>(Next() >> 11) / 9007199254740992.0;  // 2^53
+  }
+
+  // Uniform in [0, count)
+  unsigned int NextInteger(unsigned int count)
+  {
+    return static_cast<unsigned int>(Next() % count);
+  }
+
+  // Zipf distribution in [1, max]
+  unsigned int NextZipf(unsigned int max,
+                        double exponent)
+  {
+    double total = 0;
+    for (unsigned int i = 1; i <= max; i++)
+    {
+      total += 1.0 / pow(static_cast<double>(i), exponent);
+    }
+
+    double threshold = NextUniform() * total;
+    for (unsigned int i = 1; i <= max; i++)
+    {
+      threshold -= 1.0 / pow(static_cast<double>(i), exponent);
+      if (threshold < 0)
+      {
+        return i;
+      }
+    }
+
+    return max;
+  }
+
+  // Log-uniform distribution in [min, max]
+  unsigned int NextLogUniform(unsigned int min,
+                              unsigned int max)
+  {
+    const double value = exp(log(static_cast<double>(min)) +
+                             NextUniform() * (log(static_cast<double>(max) + 1.0) - log(static_cast<double>(min))));
+    return std::min(max, std::max(min, static_cast<unsigned int>(value)));
+  }
+
+  std::string NextDate(unsigned int firstYear,
+                       unsigned int countYears)
+  {
+    char buffer[16];
+    sprintf(buffer, "%04u%02u%02u", firstYear + NextInteger(countYears), 1 + NextInteger(12), 1 + NextInteger(28));
+    return buffer;
+  }
+};
+
+
+/**
+ * Generator of a realistic index, to reproduce the production
+ * workloads offline: Zipf-distributed numbers of studies per patient
+ * and of series per study, log-uniform numbers of instances per
+ * series, and main DICOM tags with realistic cardinalities. The
+ * resources are added to the content of the database. Run it with:
+ *
+ *   ./UnitTests <arguments> --gtest_also_run_disabled_tests --gtest_filter=IndexBackend.DISABLED_Workload
+ *
+ * The environment variables are "ORTHANC_WORKLOAD_PATIENTS",
+ * "ORTHANC_WORKLOAD_MAX_INSTANCES" (per series) and
+ * "ORTHANC_WORKLOAD_SEED" (the generated identifiers depend on it).
+ **/
+TEST(IndexBackend, DISABLED_Workload)
+{
+  using namespace OrthancDatabases;
+
+  const unsigned int countPatients = GetBenchmarkParameter("ORTHANC_WORKLOAD_PATIENTS", 100);
+  const unsigned int maxInstances = std::max(1u, GetBenchmarkParameter("ORTHANC_WORKLOAD_MAX_INSTANCES", 2000));
+  const unsigned int seed = GetBenchmarkParameter("ORTHANC_WORKLOAD_SEED", 1);
+
+  static const char* const MODALITIES[] = { "CT", "MR", "CR", "DX", "US", "MG", "PT", "NM" };
+  static const char* const SEXES[] = { "F", "M", "O" };
+
+  OrthancPluginContext context;
+  InitializeBenchmarkContext(context);
+
+  std::unique_ptr<IndexBackend> db(CreateWorkloadBackend(&context));
+  db->SetOutputFactory(new DatabaseBackendAdapterV2::Factory(&context, NULL));
+
+  std::list<IdentifierTag> identifierTags;
+  std::unique_ptr<DatabaseManager> manager(IndexBackend::CreateSingleDatabaseManager(*db, false, identifierTags));
+
+  WorkloadRandom random(seed);
+  const std::string prefix = "workload" + boost::lexical_cast<std::string>(seed) + "-";
+
+  unsigned int countStudies = 0;
+  unsigned int countSeries = 0;
+  unsigned int countInstances = 0;
+
+  const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+  for (unsigned int p = 0; p < countPatients; p++)
+  {
+    const std::string patientId = prefix + boost::lexical_cast<std::string>(p);
+    const std::string patientName = ("NAME" + boost::lexical_cast<std::string>(random.NextInteger(countPatients / 2 + 1)) +
+                                     "^FIRSTNAME" + boost::lexical_cast<std::string>(random.NextInteger(100)));
+    const std::string patientSex = SEXES[random.NextInteger(3)];
+    const std::string patientBirthDate = random.NextDate(1930, 90);
+
+    const unsigned int studies = random.NextZipf(50, 1.5);
+
+    for (unsigned int st = 0; st < studies; st++)
+    {
+      const std::string studyUid = patientId + "." + boost::lexical_cast<std::string>(st);
+      const std::string accessionNumber = "ACC" + boost::lexical_cast<std::string>(random.Next() % 100000000u);
+      const std::string studyDate = random.NextDate(2015, 10);
+      const std::string studyDescription = "STUDY DESCRIPTION " + boost::lexical_cast<std::string>(random.NextZipf(50, 1.0));
+      const std::string referringPhysician = "PHYSICIAN^" + boost::lexical_cast<std::string>(random.NextInteger(100));
+
+      const unsigned int series = random.NextZipf(12, 1.2);
+
+      for (unsigned int se = 0; se < series; se++)
+      {
+        const std::string seriesUid = studyUid + "." + boost::lexical_cast<std::string>(se);
+        const std::string modality = MODALITIES[random.NextZipf(8, 1.0) - 1];
+        const std::string seriesDescription = "SERIES DESCRIPTION " + boost::lexical_cast<std::string>(random.NextZipf(200, 1.0));
+        const std::string bodyPart = "BODYPART" + boost::lexical_cast<std::string>(random.NextZipf(20, 1.0));
+
+        const unsigned int instances = random.NextLogUniform(1, maxInstances);
+
+        for (unsigned int i = 0; i < instances; i++)
+        {
+          const std::string sopUid = seriesUid + "." + boost::lexical_cast<std::string>(i);
+          const std::string instanceNumber = boost::lexical_cast<std::string>(i + 1);
+
+          std::list<OrthancPluginDicomTag> tags[4];
+          AddBenchmarkTag(tags[0], 0x0010, 0x0020, patientId);
+          AddBenchmarkTag(tags[0], 0x0010, 0x0010, patientName);
+          AddBenchmarkTag(tags[0], 0x0010, 0x0040, patientSex);
+          AddBenchmarkTag(tags[0], 0x0010, 0x0030, patientBirthDate);
+          AddBenchmarkTag(tags[1], 0x0020, 0x000d, studyUid);
+          AddBenchmarkTag(tags[1], 0x0008, 0x0050, accessionNumber);
+          AddBenchmarkTag(tags[1], 0x0008, 0x0020, studyDate);
+          AddBenchmarkTag(tags[1], 0x0008, 0x1030, studyDescription);
+          AddBenchmarkTag(tags[1], 0x0008, 0x0090, referringPhysician);
+          AddBenchmarkTag(tags[2], 0x0020, 0x000e, seriesUid);
+          AddBenchmarkTag(tags[2], 0x0008, 0x0060, modality);
+          AddBenchmarkTag(tags[2], 0x0008, 0x103e, seriesDescription);
+          AddBenchmarkTag(tags[2], 0x0018, 0x0015, bodyPart);
+          AddBenchmarkTag(tags[3], 0x0008, 0x0018, sopUid);
+          AddBenchmarkTag(tags[3], 0x0020, 0x0013, instanceNumber);
+
+          OrthancPluginCreateInstanceResult result;
+          IngestBenchmarkInstance(result, *db, *manager, patientId, studyUid, seriesUid, sopUid, tags);
+          countInstances++;
+        }
+
+        countSeries++;
+      }
+
+      countStudies++;
+    }
+  }
+
+  printf("[workload] %u patients, %u studies, %u series, %u instances\n",
+         countPatients, countStudies, countSeries, countInstances);
+  PrintBenchmark("Workload generation", start, countInstances);
+
+  manager->Close();
+}
+
+
+#if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 0)
+/**
+ * Replays the requests that were captured on a production server
+ * through the "CaptureFile" option, against the database of the
+ * tests, typically after "DISABLED_Workload". The transactions of the
+ * capture that have held a connection for the longest time are
+ * logged beforehand. The file is given by
+ * the "ORTHANC_REPLAY_FILE" environment variable, and the size of the
+ * pool by "ORTHANC_REPLAY_CONNECTIONS".
+ **/
+TEST(IndexBackend, DISABLED_Replay)
+{
+  using namespace OrthancDatabases;
+
+  const char* path = getenv("ORTHANC_REPLAY_FILE");
+  if (path == NULL)
+  {
+    printf("[replay] The \"ORTHANC_REPLAY_FILE\" environment variable is not set\n");
+    return;
+  }
+
+  const unsigned int countConnections = std::max(1u, GetBenchmarkParameter("ORTHANC_REPLAY_CONNECTIONS", 5));
+
+  OrthancPluginContext context;
+  InitializeBenchmarkContext(context);
+
+  IndexConnectionsPool pool(CreateWorkloadBackend(&context), countConnections, 10 /* housekeeping delay */);
+
+  std::list<IdentifierTag> identifierTags;
+  pool.OpenConnections(false, identifierTags);
+
+  DatabaseBackendAdapterV4::LogLongestTransactions(path, 10);
+
+  const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+  uint64_t countRequests, countErrors, countSerializationFailures;
+  DatabaseBackendAdapterV4::Replay(countRequests, countErrors, countSerializationFailures, pool, path);
+
+  PrintBenchmark("Replay", start, static_cast<unsigned int>(countRequests));
+  printf("[replay] %u errors, including %u serialization failures\n",
+         static_cast<unsigned int>(countErrors), static_cast<unsigned int>(countSerializationFailures));
+
+  pool.CloseConnections();
+}
+#endif
+
+
+#if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 0)
+enum StressOperation
+{
+  StressOperation_CreateInstance,
+  StressOperation_DeleteResource,
+  StressOperation_Labels,
+  StressOperation_Find,
+  StressOperation_Statistics,
+  StressOperation_Count  // Not an operation
+};
+
+
+static const char* GetStressOperationName(StressOperation operation)
+{
+  switch (operation)
+  {
+    case StressOperation_CreateInstance:
+      return "CreateInstance (shared series)";
+
+    case StressOperation_DeleteResource:
+      return "DeleteResource (instance)";
+
+    case StressOperation_Labels:
+      return "AddLabel + RemoveLabel";
+
+    case StressOperation_Find:
+      return "ExecuteFind (100 first studies)";
+
+    case StressOperation_Statistics:
+      return "Statistics";
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+}
+
+
+// The deleted resources are not checked by the stress test, and the
+// output of the unit tests is not thread-safe
+class StressOutput : public OrthancDatabases::IDatabaseBackendOutput
+{
+public:
+  virtual void SignalDeletedAttachment(const std::string& uuid,
+                                       int32_t            contentType,
+                                       uint64_t           uncompressedSize,
+                                       const std::string& uncompressedHash,
+                                       int32_t            compressionType,
+                                       uint64_t           compressedSize,
+                                       const std::string& compressedHash) ORTHANC_OVERRIDE
+  {
+  }
+
+  virtual void SignalDeletedResource(const std::string& publicId,
+                                     OrthancPluginResourceType resourceType) ORTHANC_OVERRIDE
+  {
+  }
+
+  virtual void SignalRemainingAncestor(const std::string& ancestorId,
+                                       OrthancPluginResourceType ancestorType) ORTHANC_OVERRIDE
+  {
+  }
+
+  virtual void AnswerAttachment(const std::string& uuid,
+                                int32_t            contentType,
+                                uint64_t           uncompressedSize,
+                                const std::string& uncompressedHash,
+                                int32_t            compressionType,
+                                uint64_t           compressedSize,
+                                const std::string& compressedHash) ORTHANC_OVERRIDE
+  {
+  }
+
+  virtual void AnswerChange(int64_t                    seq,
+                            int32_t                    changeType,
+                            OrthancPluginResourceType  resourceType,
+                            const std::string&         publicId,
+                            const std::string&         date) ORTHANC_OVERRIDE
+  {
+  }
+
+  virtual void AnswerDicomTag(uint16_t group,
+                              uint16_t element,
+                              const std::string& value) ORTHANC_OVERRIDE
+  {
+  }
+
+  virtual void AnswerResourceDicomTag(int64_t resource,
+                                      uint16_t group,
+                                      uint16_t element,
+                                      const std::string& value) ORTHANC_OVERRIDE
+  {
+  }
+
+  virtual void AnswerExportedResource(int64_t                    seq,
+                                      OrthancPluginResourceType  resourceType,
+                                      const std::string&         publicId,
+                                      const std::string&         modality,
+                                      const std::string&         date,
+                                      const std::string&         patientId,
+                                      const std::string&         studyInstanceUid,
+                                      const std::string&         seriesInstanceUid,
+                                      const std::string&         sopInstanceUid) ORTHANC_OVERRIDE
+  {
+  }
+
+  virtual void AnswerMatchingResource(const std::string& resourceId) ORTHANC_OVERRIDE
+  {
+  }
+
+  virtual void AnswerMatchingResource(const std::string& resourceId,
+                                      const std::string& someInstanceId) ORTHANC_OVERRIDE
+  {
+  }
+};
+
+
+// Measurements of one kind of operation, either of one thread or of the whole run
+struct StressCounters
+{
+  std::vector<uint64_t>  latencies_;  // Microseconds, including the retries
+  unsigned int           conflicts_;  // Serialization failures, including the retried ones
+  unsigned int           retries_;
+  unsigned int           failures_;   // Operations that still fail after the retries
+
+  StressCounters() :
+    conflicts_(0),
+    retries_(0),
+    failures_(0)
+  {
+  }
+
+  void Merge(const StressCounters& other)
+  {
+    latencies_.insert(latencies_.end(), other.latencies_.begin(), other.latencies_.end());
+    conflicts_ += other.conflicts_;
+    retries_ += other.retries_;
+    failures_ += other.failures_;
+  }
+};
+
+
+struct StressParameters
+{
+  OrthancDatabases::IndexConnectionsPool*  pool_;
+  unsigned int                             countOperations_;  // Per thread
+  unsigned int                             countSeries_;      // Number of series that are shared by the threads
+  unsigned int                             maxRetries_;
+  unsigned int                             seed_;
+  boost::mutex                             mutex_;            // Protects the members below
+  StressCounters                           counters_[StressOperation_Count];
+  std::vector<int64_t>                     remaining_;        // Instances that were not deleted by the threads
+};
+
+
+static void RunStressOperation(OrthancDatabases::IndexConnectionsPool::Accessor& accessor,
+                               std::vector<int64_t>& instances,
+                               StressOperation operation,
+                               unsigned int threadIndex,
+                               unsigned int iteration,
+                               unsigned int series)
+{
+  using namespace OrthancDatabases;
+
+  IndexBackend& db = accessor.GetBackend();
+  DatabaseManager& manager = accessor.GetManager();
+
+  switch (operation)
+  {
+    case StressOperation_CreateInstance:
+    {
+      const std::string suffix = boost::lexical_cast<std::string>(series);
+      const std::string instance = ("stress-instance-" + boost::lexical_cast<std::string>(threadIndex) +
+                                    "-" + boost::lexical_cast<std::string>(iteration));
+
+      DatabaseManager::Transaction transaction(manager, TransactionType_ReadWrite);
+
+      OrthancPluginCreateInstanceResult result;
+      if (db.HasCreateInstance())
+      {
+        db.CreateInstance(result, manager, ("stress-patient-" + suffix).c_str(), ("stress-study-" + suffix).c_str(),
+                          ("stress-series-" + suffix).c_str(), instance.c_str());
+      }
+      else
+      {
+        db.CreateInstanceGeneric(result, manager, ("stress-patient-" + suffix).c_str(), ("stress-study-" + suffix).c_str(),
+                                 ("stress-series-" + suffix).c_str(), instance.c_str());
+      }
+
+      OrthancPluginResourcesContentMetadata metadata = { result.instanceId, Orthanc::MetadataType_LastUpdate, "20240101T000000" };
+      db.SetResourcesContent(manager, 0, NULL, 0, NULL, 1, &metadata);
+
+      transaction.Commit();
+      instances.push_back(result.instanceId);
+      break;
+    }
+
+    case StressOperation_DeleteResource:
+    {
+      DatabaseManager::Transaction transaction(manager, TransactionType_ReadWrite);
+      StressOutput output;
+      db.DeleteResource(output, manager, instances.back());
+      transaction.Commit();
+      instances.pop_back();
+      break;
+    }
+
+    case StressOperation_Labels:
+    {
+      const std::string label = "stress" + boost::lexical_cast<std::string>(series);
+
+      DatabaseManager::Transaction transaction(manager, TransactionType_ReadWrite);
+      db.AddLabel(manager, instances.back(), label);
+      db.RemoveLabel(manager, instances.front(), label);
+      transaction.Commit();
+      break;
+    }
+
+    case StressOperation_Find:
+    {
+#if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 5)
+      Orthanc::DatabasePluginMessages::Find_Request request;
+      request.set_level(Orthanc::DatabasePluginMessages::RESOURCE_STUDY);
+      request.set_retrieve_main_dicom_tags(true);
+      request.mutable_limits()->set_since(0);
+      request.mutable_limits()->set_count(100);
+
+      Orthanc::DatabasePluginMessages::TransactionResponse response;
+      DatabaseManager::Transaction transaction(manager, TransactionType_ReadOnly);
+      db.ExecuteFind(response, manager, request);
+      transaction.Commit();
+#endif
+      break;
+    }
+
+    case StressOperation_Statistics:
+    {
+      DatabaseManager::Transaction transaction(manager, TransactionType_ReadWrite);
+
+      if (db.HasUpdateAndGetStatistics())
+      {
+        int64_t patientsCount, studiesCount, seriesCount, instancesCount, compressedSize, uncompressedSize;
+        db.UpdateAndGetStatistics(manager, patientsCount, studiesCount, seriesCount,
+                                  instancesCount, compressedSize, uncompressedSize);
+      }
+      else
+      {
+        db.GetResourcesCount(manager, OrthancPluginResourceType_Instance);
+        db.GetTotalCompressedSize(manager);
+      }
+
+      transaction.Commit();
+      break;
+    }
+
+    default:
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+  }
+}
+
+
+static void StressThread(StressParameters* parameters,
+                         unsigned int threadIndex)
+{
+  using namespace OrthancDatabases;
+
+  WorkloadRandom random(parameters->seed_ + threadIndex);
+  StressCounters counters[StressOperation_Count];
+  std::vector<int64_t> instances;  // Created by this thread
+
+  for (unsigned int i = 0; i < parameters->countOperations_; i++)
+  {
+    // 40% of ingests, 15% of deletions, 15% of labels, 15% of lookups, 15% of statistics
+    const unsigned int draw = random.NextInteger(100);
+    StressOperation operation = (draw < 40 ? StressOperation_CreateInstance :
+                                 draw < 55 ? StressOperation_DeleteResource :
+                                 draw < 70 ? StressOperation_Labels :
+                                 draw < 85 ? StressOperation_Find :
+                                 StressOperation_Statistics);
+
+    if (instances.empty() &&
+        (operation == StressOperation_DeleteResource ||
+         operation == StressOperation_Labels))
+    {
+      operation = StressOperation_CreateInstance;
+    }
+
+    const unsigned int series = random.NextInteger(parameters->countSeries_);
+    StressCounters& target = counters[operation];
+
+    Orthanc::Toolbox::ElapsedTimer timer;
+
+    for (unsigned int attempt = 0; ; attempt++)
+    {
+      try
+      {
+        IndexConnectionsPool::Accessor accessor(*parameters->pool_);
+
+        if (operation == StressOperation_Labels &&
+            !accessor.GetBackend().HasLabelsSupport())
+        {
+          break;
+        }
+
+        RunStressOperation(accessor, instances, operation, threadIndex, i, series);
+        break;
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        if (e.GetErrorCode() != Orthanc::ErrorCode_DatabaseCannotSerialize)
+        {
+          target.failures_++;
+          break;
+        }
+
+        target.conflicts_++;
+
+        if (attempt < parameters->maxRetries_)
+        {
+          target.retries_++;
+        }
+        else
+        {
+          target.failures_++;
+          break;
+        }
+      }
+    }
+
+    target.latencies_.push_back(timer.GetElapsedMicroseconds());
+  }
+
+  boost::mutex::scoped_lock lock(parameters->mutex_);
+
+  for (unsigned int i = 0; i < StressOperation_Count; i++)
+  {
+    parameters->counters_[i].Merge(counters[i]);
+  }
+
+  parameters->remaining_.insert(parameters->remaining_.end(), instances.begin(), instances.end());
+}
+
+
+static void PrintStressCounters(const std::string& name,
+                                StressCounters& counters)
+{
+  std::sort(counters.latencies_.begin(), counters.latencies_.end());
+
+  const size_t count = counters.latencies_.size();
+  uint64_t total = 0;
+  for (size_t i = 0; i < count; i++)
+  {
+    total += counters.latencies_[i];
+  }
+
+  const double mean = (count == 0 ? 0.0 : static_cast<double>(total) / static_cast<double>(count) / 1000.0);
+  const double p99 = (count == 0 ? 0.0 : static_cast<double>(counters.latencies_[(count * 99 - 1) / 100]) / 1000.0);
+  const unsigned int attempts = static_cast<unsigned int>(count) + counters.retries_;
+
+  printf("[stress] %-40s %6u ops  %8.3f ms/op  p99 %8.3f ms  %5.1f%% conflicts  %u retries  %u failures\n",
+         name.c_str(), static_cast<unsigned int>(count), mean, p99,
+         attempts == 0 ? 0.0 : 100.0 * static_cast<double>(counters.conflicts_) / static_cast<double>(attempts),
+         counters.retries_, counters.failures_);
+}
+
+
+/**
+ * Concurrency stress test of the pool of connections: Several threads
+ * mix ingests in a few shared series, deletions, labels, lookups and
+ * statistics, and the throughput, the latencies and the serialization
+ * conflicts are reported per operation, so that the contention of two
+ * versions of the plugins can be compared. With PostgreSQL, the test
+ * is run in both "ReadCommitted" and "Serializable" transaction modes.
+ * The instances that are created are deleted at the end. Run it with:
+ *
+ *   ./UnitTests <arguments> --gtest_also_run_disabled_tests --gtest_filter=IndexBackend.DISABLED_ConcurrencyStress
+ *
+ * The environment variables are "ORTHANC_STRESS_THREADS",
+ * "ORTHANC_STRESS_CONNECTIONS", "ORTHANC_STRESS_OPERATIONS" (per
+ * thread), "ORTHANC_STRESS_SERIES" (shared by the threads),
+ * "ORTHANC_STRESS_RETRIES" and "ORTHANC_STRESS_SEED".
+ **/
+TEST(IndexBackend, DISABLED_ConcurrencyStress)
+{
+  using namespace OrthancDatabases;
+
+  const unsigned int countThreads = std::max(1u, GetBenchmarkParameter("ORTHANC_STRESS_THREADS", 8));
+  const unsigned int countConnections = std::max(1u, GetBenchmarkParameter("ORTHANC_STRESS_CONNECTIONS", 4));
+
+#if ORTHANC_ENABLE_POSTGRESQL == 1
+  const unsigned int countModes = 2;
+#else
+  const unsigned int countModes = 1;  // The isolation level is not configurable
+#endif
+
+  OrthancPluginContext context;
+  InitializeBenchmarkContext(context);
+
+  for (unsigned int mode = 0; mode < countModes; mode++)
+  {
+#if ORTHANC_ENABLE_POSTGRESQL == 1
+    PostgreSQLParameters parameters(globalParameters_);
+    parameters.SetIsolationMode(mode == 0 ? IsolationMode_ReadCommited : IsolationMode_Serializable);
+    const std::string modeName = (mode == 0 ? "ReadCommitted" : "Serializable");
+    IndexConnectionsPool pool(new PostgreSQLIndex(&context, parameters, false), countConnections, 10 /* housekeeping delay */);
+#else
+    const std::string modeName = "default";
+    IndexConnectionsPool pool(CreateWorkloadBackend(&context), countConnections, 10 /* housekeeping delay */);
+#endif
+
+    std::list<IdentifierTag> identifierTags;
+    pool.OpenConnections(false, identifierTags);
+
+    StressParameters stress;
+    stress.pool_ = &pool;
+    stress.countOperations_ = GetBenchmarkParameter("ORTHANC_STRESS_OPERATIONS", 200);
+    stress.countSeries_ = std::max(1u, GetBenchmarkParameter("ORTHANC_STRESS_SERIES", 4));
+    stress.maxRetries_ = GetBenchmarkParameter("ORTHANC_STRESS_RETRIES", 10);
+    stress.seed_ = GetBenchmarkParameter("ORTHANC_STRESS_SEED", 1);
+
+    printf("[stress] Transaction mode \"%s\": %u threads, %u connections, %u operations per thread, %u shared series\n",
+           modeName.c_str(), countThreads, countConnections, stress.countOperations_, stress.countSeries_);
+
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    std::vector<boost::thread*> threads(countThreads);
+    for (unsigned int i = 0; i < countThreads; i++)
+    {
+      threads[i] = new boost::thread(StressThread, &stress, i);
+    }
+
+    for (unsigned int i = 0; i < countThreads; i++)
+    {
+      threads[i]->join();
+      delete threads[i];
+    }
+
+    const double seconds = static_cast<double>((boost::posix_time::microsec_clock::universal_time() - start).total_microseconds()) / 1000000.0;
+
+    StressCounters total;
+    for (unsigned int i = 0; i < StressOperation_Count; i++)
+    {
+      PrintStressCounters(GetStressOperationName(static_cast<StressOperation>(i)), stress.counters_[i]);
+      total.Merge(stress.counters_[i]);
+    }
+
+    PrintStressCounters("All operations", total);
+    printf("[stress] Throughput: %.1f ops/s\n", seconds <= 0 ? 0.0 : static_cast<double>(total.latencies_.size()) / seconds);
+
+    {
+      IndexConnectionsPool::Accessor accessor(pool);
+      StressOutput output;
+
+      DatabaseManager::Transaction transaction(accessor.GetManager(), TransactionType_ReadWrite);
+      for (size_t i = 0; i < stress.remaining_.size(); i++)
+      {
+        accessor.GetBackend().DeleteResource(output, accessor.GetManager(), stress.remaining_[i]);
+      }
+      transaction.Commit();
+    }
+
+    pool.CloseConnections();
+  }
+}
+#endif
+
+
+#if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 0)
+#if ORTHANC_ENABLE_POSTGRESQL == 1
+typedef OrthancDatabases::PostgreSQLIndex  FailoverBaseBackend;
+#elif ORTHANC_ENABLE_MYSQL == 1
+typedef OrthancDatabases::MySQLIndex  FailoverBaseBackend;
+#elif ORTHANC_ENABLE_ODBC == 1
+typedef OrthancDatabases::OdbcIndex  FailoverBaseBackend;
+#elif ORTHANC_ENABLE_SQLITE == 1  // Must be the last one
+typedef OrthancDatabases::SQLiteIndex  FailoverBaseBackend;
+#endif
+
+
+// Backend whose listing of the public IDs loses its connection once,
+// after the IDs have been written into the answer
+class FailoverTestBackend : public FailoverBaseBackend
+{
+private:
+  bool  fail_;
+
+public:
+  explicit FailoverTestBackend(OrthancPluginContext* context) :
+#if ORTHANC_ENABLE_POSTGRESQL == 1 || ORTHANC_ENABLE_MYSQL == 1
+    FailoverBaseBackend(context, globalParameters_, false),
+#elif ORTHANC_ENABLE_ODBC == 1
+    FailoverBaseBackend(context, connectionString_, false),
+#else
+    FailoverBaseBackend(context, "failover.db"),  // Not in memory, as the connection is reopened
+#endif
+    fail_(false)
+  {
+  }
+
+  void SetFail(bool fail)
+  {
+    fail_ = fail;
+  }
+
+  using FailoverBaseBackend::GetAllPublicIds;
+
+  virtual void GetAllPublicIds(google::protobuf::RepeatedPtrField<std::string>& target,
+                               OrthancDatabases::DatabaseManager& manager,
+                               OrthancPluginResourceType resourceType) ORTHANC_OVERRIDE
+  {
+    FailoverBaseBackend::GetAllPublicIds(target, manager, resourceType);
+
+    if (fail_)
+    {
+      fail_ = false;
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_DatabaseUnavailable);
+    }
+  }
+};
+
+
+static int CountPatientsInReadOnlyTransaction(OrthancDatabases::IndexConnectionsPool& pool)
+{
+  using namespace OrthancDatabases;
+
+  Orthanc::DatabasePluginMessages::Request request;
+  Orthanc::DatabasePluginMessages::Response response;
+
+  request.set_type(Orthanc::DatabasePluginMessages::REQUEST_DATABASE);
+  request.mutable_database_request()->set_operation(Orthanc::DatabasePluginMessages::OPERATION_START_TRANSACTION);
+  request.mutable_database_request()->mutable_start_transaction()->set_type(Orthanc::DatabasePluginMessages::TRANSACTION_READ_ONLY);
+  DatabaseBackendAdapterV4::ExecuteRequest(response, request, pool);
+
+  const int64_t transaction = response.database_response().start_transaction().transaction();
+
+  request.Clear();
+  response.Clear();
+  request.set_type(Orthanc::DatabasePluginMessages::REQUEST_TRANSACTION);
+  request.mutable_transaction_request()->set_transaction(transaction);
+  request.mutable_transaction_request()->set_operation(Orthanc::DatabasePluginMessages::OPERATION_GET_ALL_PUBLIC_IDS);
+  request.mutable_transaction_request()->mutable_get_all_public_ids()->set_resource_type(Orthanc::DatabasePluginMessages::RESOURCE_PATIENT);
+  DatabaseBackendAdapterV4::ExecuteRequest(response, request, pool);
+
+  const int count = response.transaction_response().get_all_public_ids().ids_size();
+
+  request.Clear();
+  response.Clear();
+  request.set_type(Orthanc::DatabasePluginMessages::REQUEST_TRANSACTION);
+  request.mutable_transaction_request()->set_transaction(transaction);
+  request.mutable_transaction_request()->set_operation(Orthanc::DatabasePluginMessages::OPERATION_COMMIT);
+  DatabaseBackendAdapterV4::ExecuteRequest(response, request, pool);
+
+  request.Clear();
+  response.Clear();
+  request.set_type(Orthanc::DatabasePluginMessages::REQUEST_DATABASE);
+  request.mutable_database_request()->set_operation(Orthanc::DatabasePluginMessages::OPERATION_FINALIZE_TRANSACTION);
+  request.mutable_database_request()->mutable_finalize_transaction()->set_transaction(transaction);
+  DatabaseBackendAdapterV4::ExecuteRequest(response, request, pool);
+
+  return count;
+}
+
+
+TEST(IndexBackend, FailoverPartialAnswer)
+{
+  using namespace OrthancDatabases;
+
+  OrthancPluginContext context;
+  InitializeBenchmarkContext(context);
+
+  FailoverTestBackend* backend = new FailoverTestBackend(&context);
+  backend->SetFailoverRetryBudget(5000);
+
+  IndexConnectionsPool pool(backend, 1, 10 /* housekeeping delay */);
+
+  std::list<IdentifierTag> identifierTags;
+  pool.OpenConnections(false, identifierTags);
+
+  {
+    IndexConnectionsPool::Accessor accessor(pool);
+    DatabaseManager::Transaction transaction(accessor.GetManager(), TransactionType_ReadWrite);
+    accessor.GetBackend().CreateResource(accessor.GetManager(), Orthanc::Toolbox::GenerateUuid().c_str(), OrthancPluginResourceType_Patient);
+    accessor.GetBackend().CreateResource(accessor.GetManager(), Orthanc::Toolbox::GenerateUuid().c_str(), OrthancPluginResourceType_Patient);
+    transaction.Commit();
+  }
+
+  const int expected = CountPatientsInReadOnlyTransaction(pool);
+  ASSERT_GE(expected, 2);
+
+  // The IDs of the failed attempt are not kept in the answer of the operation
+  backend->SetFail(true);
+  ASSERT_EQ(expected, CountPatientsInReadOnlyTransaction(pool));
+
+  pool.CloseConnections();
+}
+#endif
+
+
+struct StorageBenchmarkJob
+{
+  OrthancDatabases::StorageBackend*  storage_;
+  const std::string*                 content_;
+  unsigned int                       thread_;
+  unsigned int                       countFiles_;
+  unsigned int                       phase_;   // 0 = Create, 1 = ReadWhole, 2 = ReadRange, 3 = Remove
+  bool                               success_;
+};
+
+
+static void RunStorageBenchmarkJob(StorageBenchmarkJob* job)
+{
+  using namespace OrthancDatabases;
+
+  try
+  {
+    std::unique_ptr<StorageBackend::IAccessor> accessor(job->storage_->CreateAccessor());
+
+    // The ranges are read in the middle of the files, as the DICOMweb plugin does for the frames
+    const size_t rangeSize = std::min(job->content_->size(), static_cast<size_t>(64 * 1024));
+    const uint64_t rangeStart = (job->content_->size() - rangeSize) / 2;
+
+    std::string buffer;
+
+    for (unsigned int i = 0; i < job->countFiles_; i++)
+    {
+      const std::string uuid = ("benchmark-" + boost::lexical_cast<std::string>(job->thread_) +
+                                "-" + boost::lexical_cast<std::string>(i));
+
+      switch (job->phase_)
+      {
+        case 0:
+          accessor->Create(uuid, job->content_->empty() ? NULL : job->content_->c_str(),
+                           job->content_->size(), OrthancPluginContentType_Unknown);
+          break;
+
+        case 1:
+          StorageBackend::ReadWholeToString(buffer, *accessor, uuid, OrthancPluginContentType_Unknown);
+          if (buffer.size() != job->content_->size())
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+          }
+          break;
+
+        case 2:
+          StorageBackend::ReadRangeToString(buffer, *accessor, uuid, OrthancPluginContentType_Unknown, rangeStart, rangeSize);
+          break;
+
+        case 3:
+          accessor->Remove(uuid, OrthancPluginContentType_Unknown);
+          break;
+
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+      }
+    }
+
+    job->success_ = true;
+  }
+  catch (Orthanc::OrthancException& e)
+  {
+    printf("[storage] Error in thread %u: %s\n", job->thread_, e.What());
+  }
+}
+
+
+static unsigned int GetPeakMemoryMB()
+{
+#if defined(_WIN32)
+  return 0;  // Not implemented
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+  {
+#  if defined(__APPLE__)
+    return static_cast<unsigned int>(usage.ru_maxrss / (1024 * 1024));  // In bytes
+#  else
+    return static_cast<unsigned int>(usage.ru_maxrss / 1024);  // In kilobytes
+#  endif
+  }
+  else
+  {
+    return 0;
+  }
+#endif
+}
+
+
+/**
+ * Throughput of a storage area through "StorageBackend::IAccessor",
+ * for files from 1 KB up to "ORTHANC_STORAGE_BENCHMARK_MAX_SIZE" bytes
+ * (16 MB by default, at most 2 GB), with 1 thread then with
+ * "ORTHANC_STORAGE_BENCHMARK_THREADS" threads (4 by default). Each
+ * thread creates, reads, reads a 64 KB range of, and removes
+ * "ORTHANC_STORAGE_BENCHMARK_FILES" files of each size (10 by
+ * default). The peak resident memory of the process is reported after
+ * each size, to check the streaming of the large files. This is to be
+ * called by the disabled tests of the storage plugins.
+ **/
+static void RunStorageBenchmark(OrthancDatabases::StorageBackend& storage,
+                                const std::string& name)
+{
+  static const char* const PHASES[4] = { "Create", "ReadWhole", "ReadRange (64 KB)", "Remove" };
+
+  const uint64_t maxSize = std::min(static_cast<uint64_t>(2048u) * 1024u * 1024u,
+                                    static_cast<uint64_t>(GetBenchmarkParameter("ORTHANC_STORAGE_BENCHMARK_MAX_SIZE", 16 * 1024 * 1024)));
+  const unsigned int maxThreads = std::max(1u, GetBenchmarkParameter("ORTHANC_STORAGE_BENCHMARK_THREADS", 4));
+  const unsigned int countFiles = std::max(1u, GetBenchmarkParameter("ORTHANC_STORAGE_BENCHMARK_FILES", 10));
+
+  if (storage.GetConnectionsCount() < maxThreads)
+  {
+    storage.SetConnectionsCount(maxThreads);
+  }
+
+  std::vector<unsigned int> concurrency;
+  concurrency.push_back(1);
+  if (maxThreads > 1)
+  {
+    concurrency.push_back(maxThreads);
+  }
+
+  for (uint64_t size = 1024; size <= maxSize; size *= 16)
+  {
+    const std::string content(static_cast<size_t>(size), 'x');
+
+    for (size_t c = 0; c < concurrency.size(); c++)
+    {
+      const unsigned int countThreads = concurrency[c];
+
+      for (unsigned int phase = 0; phase < 4; phase++)
+      {
+        std::vector<StorageBenchmarkJob> jobs(countThreads);
+        std::vector<boost::thread*> threads(countThreads);
+
+        const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+        for (unsigned int i = 0; i < countThreads; i++)
+        {
+          jobs[i].storage_ = &storage;
+          jobs[i].content_ = &content;
+          jobs[i].thread_ = i;
+          jobs[i].countFiles_ = countFiles;
+          jobs[i].phase_ = phase;
+          jobs[i].success_ = false;
+          threads[i] = new boost::thread(RunStorageBenchmarkJob, &jobs[i]);
+        }
+
+        bool success = true;
+        for (unsigned int i = 0; i < countThreads; i++)
+        {
+          threads[i]->join();
+          delete threads[i];
+          success = success && jobs[i].success_;
+        }
+
+        const double seconds = static_cast<double>((boost::posix_time::microsec_clock::universal_time() - start).total_microseconds()) / 1000000.0;
+        const unsigned int count = countThreads * countFiles;
+        const uint64_t bytes = (phase == 3 ? 0 : static_cast<uint64_t>(count) * (phase == 2 ? std::min(size, static_cast<uint64_t>(64 * 1024)) : size));
+
+        printf("[storage] %s, %10u bytes, %u thread(s), %-18s %10.1f ops/s  %10.1f MB/s%s\n",
+               name.c_str(), static_cast<unsigned int>(size), countThreads, PHASES[phase],
+               seconds <= 0 ? 0.0 : static_cast<double>(count) / seconds,
+               seconds <= 0 ? 0.0 : static_cast<double>(bytes) / (1024.0 * 1024.0) / seconds,
+               success ? "" : "  (errors)");
+      }
+    }
+
+    printf("[storage] %s, %10u bytes, peak resident memory: %u MB\n",
+           name.c_str(), static_cast<unsigned int>(size), GetPeakMemoryMB());
+  }
+}
+#endif
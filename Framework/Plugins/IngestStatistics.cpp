@@ -0,0 +1,214 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "IngestStatistics.h"
+
+#include <OrthancException.h>
+
+
+namespace OrthancDatabases
+{
+  IngestStatistics::Timeline::Timeline()
+  {
+    Reset();
+  }
+
+
+  void IngestStatistics::Timeline::Reset()
+  {
+    instance_.clear();
+    start_ = boost::posix_time::ptime();
+
+    for (unsigned int i = 0; i < Stage_Count; i++)
+    {
+      durations_[i] = 0;
+    }
+  }
+
+
+  void IngestStatistics::Timeline::SetInstance(const std::string& publicId)
+  {
+    instance_ = publicId;
+    start_ = boost::posix_time::microsec_clock::universal_time();
+  }
+
+
+  void IngestStatistics::Timeline::Add(Stage stage,
+                                       uint64_t microseconds)
+  {
+    if (stage >= Stage_Count)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    durations_[stage] += microseconds;
+  }
+
+
+  uint64_t IngestStatistics::Timeline::GetDuration(Stage stage) const
+  {
+    if (stage >= Stage_Count)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    return durations_[stage];
+  }
+
+
+  uint64_t IngestStatistics::Timeline::GetTotal() const
+  {
+    uint64_t total = 0;
+
+    for (unsigned int i = 0; i < Stage_Count; i++)
+    {
+      total += durations_[i];
+    }
+
+    return total;
+  }
+
+
+  void IngestStatistics::Timeline::Format(Json::Value& target) const
+  {
+    target = Json::objectValue;
+    target["Instance"] = instance_;
+
+    if (!start_.is_not_a_date_time())
+    {
+      target["Date"] = boost::posix_time::to_iso_string(start_);
+    }
+
+    target["TotalMicroseconds"] = static_cast<Json::UInt64>(GetTotal());
+
+    Json::Value stages = Json::objectValue;
+    for (unsigned int i = 0; i < Stage_Count; i++)
+    {
+      stages[GetStageName(static_cast<Stage>(i))] = static_cast<Json::UInt64>(durations_[i]);
+    }
+
+    target["StagesMicroseconds"] = stages;
+  }
+
+
+  IngestStatistics::IngestStatistics(size_t maxSlowest) :
+    maxSlowest_(maxSlowest)
+  {
+  }
+
+
+  const char* IngestStatistics::GetStageName(Stage stage)
+  {
+    switch (stage)
+    {
+      case Stage_CreateInstance:
+        return "CreateInstance";
+
+      case Stage_SetResourcesContent:
+        return "SetResourcesContent";
+
+      case Stage_AddAttachment:
+        return "AddAttachment";
+
+      case Stage_SetMetadata:
+        return "SetMetadata";
+
+      case Stage_LogChange:
+        return "LogChange";
+
+      case Stage_Commit:
+        return "Commit";
+
+      case Stage_Other:
+        return "Other";
+
+      default:
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+  }
+
+
+  void IngestStatistics::Add(const Timeline& timeline)
+  {
+    if (!timeline.IsIngest())
+    {
+      return;
+    }
+
+    for (unsigned int i = 0; i < Stage_Count; i++)
+    {
+      stages_[i].Add(timeline.GetDuration(static_cast<Stage>(i)), true);
+    }
+
+    const uint64_t total = timeline.GetTotal();
+    total_.Add(total, true);
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (maxSlowest_ != 0 &&
+        (slowest_.size() < maxSlowest_ ||
+         total > slowest_.begin()->first))
+    {
+      slowest_.insert(std::make_pair(total, timeline));
+
+      if (slowest_.size() > maxSlowest_)
+      {
+        slowest_.erase(slowest_.begin());
+      }
+    }
+  }
+
+
+  void IngestStatistics::Format(Json::Value& target)
+  {
+    target = Json::objectValue;
+
+    Json::Value stages = Json::objectValue;
+    for (unsigned int i = 0; i < Stage_Count; i++)
+    {
+      Json::Value item;
+      stages_[i].Format(item);
+      stages[GetStageName(static_cast<Stage>(i))] = item;
+    }
+
+    target["Stages"] = stages;
+    total_.Format(target["Total"]);
+
+    Json::Value slowest = Json::arrayValue;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      // The slowest ingest first
+      for (Slowest::const_reverse_iterator it = slowest_.rbegin(); it != slowest_.rend(); ++it)
+      {
+        Json::Value item;
+        it->second.Format(item);
+        slowest.append(item);
+      }
+    }
+
+    target["Slowest"] = slowest;
+  }
+}
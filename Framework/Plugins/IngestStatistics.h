@@ -0,0 +1,117 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "OperationsStatistics.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <json/value.h>
+#include <map>
+#include <stdint.h>
+#include <string>
+
+
+namespace OrthancDatabases
+{
+  /**
+   * Per-instance timeline of the ingestion through the database SDK
+   * "V4". The V4 adapter accumulates the durations of the operations
+   * of each transaction into a "Timeline" (one per transaction). If
+   * the transaction has created an instance, its timeline is added
+   * at commit to the histograms of the stages, and to the list of
+   * the slowest ingests. This class is thread-safe.
+   **/
+  class IngestStatistics : public boost::noncopyable
+  {
+  public:
+    enum Stage
+    {
+      Stage_CreateInstance,
+      Stage_SetResourcesContent,
+      Stage_AddAttachment,
+      Stage_SetMetadata,
+      Stage_LogChange,
+      Stage_Commit,
+      Stage_Other,      // Other operations of the transaction (lookups...)
+      Stage_Count       // Not a stage, must be last
+    };
+
+    class Timeline
+    {
+    private:
+      std::string               instance_;   // Empty if no instance was created
+      boost::posix_time::ptime  start_;
+      uint64_t                  durations_[Stage_Count];   // In microseconds
+
+    public:
+      Timeline();
+
+      void Reset();
+
+      // Marks the transaction as ingesting the given instance
+      void SetInstance(const std::string& publicId);
+
+      bool IsIngest() const
+      {
+        return !instance_.empty();
+      }
+
+      const std::string& GetInstance() const
+      {
+        return instance_;
+      }
+
+      void Add(Stage stage,
+               uint64_t microseconds);
+
+      uint64_t GetDuration(Stage stage) const;
+
+      uint64_t GetTotal() const;
+
+      void Format(Json::Value& target) const;
+    };
+
+  private:
+    typedef std::multimap<uint64_t, Timeline>  Slowest;   // Indexed by the total duration
+
+    OperationsStatistics::Histogram  stages_[Stage_Count];
+    OperationsStatistics::Histogram  total_;
+    boost::mutex                     mutex_;     // Protects "slowest_"
+    size_t                           maxSlowest_;
+    Slowest                          slowest_;
+
+  public:
+    // Keeps the "maxSlowest" slowest ingests
+    explicit IngestStatistics(size_t maxSlowest);
+
+    static const char* GetStageName(Stage stage);
+
+    void Add(const Timeline& timeline);
+
+    void Format(Json::Value& target);
+  };
+}
@@ -0,0 +1,95 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "ISqlLookupFormatter.h"
+#include "TimedLruCache.h"
+
+
+namespace OrthancDatabases
+{
+  /**
+   * Remembers where the pages of "ExecuteFind()" end, so that the
+   * next page of the same lookup can be read using a seek condition
+   * instead of an "OFFSET" (keyset pagination). The key identifies
+   * both the lookup and the "since" of the page that starts after
+   * the bound. The bound is only valid as long as the resources
+   * before it are unchanged: It is tagged with the last change index
+   * of the database, and dropped as soon as a new change is logged.
+   * The writes that do not log a change (e.g. the deletions) clear
+   * the cache, or are taken into account after the time-to-live.
+   * This class is thread-safe.
+   **/
+  class KeysetPaginationCache : public boost::noncopyable
+  {
+  private:
+    TimedLruCache<FindKeysetBound>  cache_;
+
+  public:
+    KeysetPaginationCache();
+
+    // "0" disables the cache
+    void SetMaxSize(size_t maxSize)
+    {
+      cache_.SetMaxSize(maxSize);
+    }
+
+    void SetTimeToLive(unsigned int seconds)
+    {
+      cache_.SetTimeToLive(seconds);
+    }
+
+    bool IsEnabled()
+    {
+      return cache_.IsEnabled();
+    }
+
+    bool Lookup(FindKeysetBound& target,
+                const std::string& key,
+                int64_t lastChange,
+                const boost::posix_time::ptime& now)
+    {
+      return cache_.Lookup(target, key, lastChange, now);
+    }
+
+    void Store(const std::string& key,
+               const FindKeysetBound& bound,
+               int64_t lastChange,
+               const boost::posix_time::ptime& now)
+    {
+      cache_.Store(key, bound, lastChange, now);
+    }
+
+    void Clear()
+    {
+      cache_.Clear();
+    }
+
+    size_t GetSize()
+    {
+      return cache_.GetSize();
+    }
+  };
+}
@@ -0,0 +1,287 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "LabelsCache.h"
+
+#include <Compatibility.h>  // For std::unique_ptr<>
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <iterator>
+
+
+namespace OrthancDatabases
+{
+  static const size_t MAX_LABELS_CACHE_SIZE = 64;
+
+
+  void LabelsCache::Remove(const std::string& label)
+  {
+    Content::iterator found = content_.find(label);
+
+    if (found != content_.end())
+    {
+      assert(found->second != NULL);
+      delete found->second;
+      content_.erase(found);
+      index_.Invalidate(label);
+    }
+  }
+
+
+  void LabelsCache::Clear()
+  {
+    for (Content::iterator it = content_.begin(); it != content_.end(); ++it)
+    {
+      assert(it->second != NULL);
+      delete it->second;
+    }
+
+    content_.clear();
+
+    while (!index_.IsEmpty())
+    {
+      index_.RemoveOldest();
+    }
+
+    hasAllLabels_ = false;
+    allLabels_.clear();
+  }
+
+
+  const LabelsCache::Item* LabelsCache::LookupItem(const std::string& label,
+                                                   const boost::posix_time::ptime& now)
+  {
+    Content::const_iterator found = content_.find(label);
+
+    if (found == content_.end())
+    {
+      return NULL;
+    }
+    else if (found->second->expiration_ <= now)
+    {
+      Remove(label);
+      return NULL;
+    }
+    else
+    {
+      index_.MakeMostRecent(label);
+      return found->second;
+    }
+  }
+
+
+  LabelsCache::LabelsCache() :
+    maxSize_(0),
+    revision_(0),
+    hasAllLabels_(false)
+  {
+  }
+
+
+  LabelsCache::~LabelsCache()
+  {
+    Clear();
+  }
+
+
+  void LabelsCache::SetTimeToLive(unsigned int seconds)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    timeToLive_ = boost::posix_time::seconds(seconds);
+    maxSize_ = (seconds == 0 ? 0 : MAX_LABELS_CACHE_SIZE);
+    Clear();
+  }
+
+
+  bool LabelsCache::IsEnabled()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return maxSize_ != 0;
+  }
+
+
+  uint64_t LabelsCache::GetRevision()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return revision_;
+  }
+
+
+  bool LabelsCache::IsCached(const std::string& label,
+                             const boost::posix_time::ptime& now)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return LookupItem(label, now) != NULL;
+  }
+
+
+  void LabelsCache::Store(const std::string& label,
+                          Resources& resources,
+                          uint64_t revision,
+                          const boost::posix_time::ptime& now)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (maxSize_ == 0 ||
+        revision != revision_)
+    {
+      return;
+    }
+
+    Remove(label);
+
+    while (content_.size() >= maxSize_)
+    {
+      Remove(index_.RemoveOldest());
+    }
+
+    std::unique_ptr<Item> item(new Item);
+    item->resources_.swap(resources);
+    item->expiration_ = now + timeToLive_;
+
+    assert(std::adjacent_find(item->resources_.begin(), item->resources_.end(),
+                              std::greater_equal<int64_t>()) == item->resources_.end());
+
+    content_[label] = item.release();
+    index_.Add(label);
+  }
+
+
+  bool LabelsCache::Evaluate(Resources& target,
+                             const std::set<std::string>& labels,
+                             LabelsConstraint constraint,
+                             const boost::posix_time::ptime& now)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    target.clear();
+
+    bool first = true;
+    for (std::set<std::string>::const_iterator it = labels.begin(); it != labels.end(); ++it)
+    {
+      const Item* item = LookupItem(*it, now);
+      if (item == NULL)
+      {
+        target.clear();
+        return false;
+      }
+
+      if (first)
+      {
+        target = item->resources_;
+        first = false;
+      }
+      else
+      {
+        Resources merged;
+
+        if (constraint == LabelsConstraint_All)
+        {
+          std::set_intersection(target.begin(), target.end(),
+                                item->resources_.begin(), item->resources_.end(),
+                                std::back_inserter(merged));
+        }
+        else
+        {
+          // "Any" and "None" both work on the union of the labels
+          std::set_union(target.begin(), target.end(),
+                         item->resources_.begin(), item->resources_.end(),
+                         std::back_inserter(merged));
+        }
+
+        target.swap(merged);
+      }
+    }
+
+    return true;
+  }
+
+
+  bool LabelsCache::LookupAllLabels(std::list<std::string>& target,
+                                    const boost::posix_time::ptime& now)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (hasAllLabels_ &&
+        now < allLabelsExpiration_)
+    {
+      target = allLabels_;
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  void LabelsCache::StoreAllLabels(const std::list<std::string>& labels,
+                                   uint64_t revision,
+                                   const boost::posix_time::ptime& now)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (maxSize_ != 0 &&
+        revision == revision_)
+    {
+      hasAllLabels_ = true;
+      allLabels_ = labels;
+      allLabelsExpiration_ = now + timeToLive_;
+    }
+  }
+
+
+  void LabelsCache::InvalidateLabel(const std::string& label)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    Remove(label);
+    hasAllLabels_ = false;
+    revision_++;
+  }
+
+
+  void LabelsCache::InvalidateListOfLabels()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    hasAllLabels_ = false;
+    revision_++;
+  }
+
+
+  void LabelsCache::InvalidateAll()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    Clear();
+    revision_++;
+  }
+
+
+  size_t LabelsCache::GetSize()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return content_.size();
+  }
+}
@@ -0,0 +1,138 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "ISqlLookupFormatter.h"
+
+#include <Cache/LeastRecentlyUsedIndex.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <list>
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+namespace OrthancDatabases
+{
+  /**
+   * In-process index of the labels, that maps each label to the
+   * sorted internal IDs of its resources. The constraints on the
+   * labels of the lookups are evaluated by merging these lists,
+   * instead of joining the "Labels" table. A label is read from the
+   * database the first time it is used. The labels are invalidated by
+   * the writes of this process, and can be outdated by at most the
+   * time-to-live with respect to the writes of other processes. This
+   * class is thread-safe.
+   **/
+  class LabelsCache : public boost::noncopyable
+  {
+  public:
+    typedef std::vector<int64_t>  Resources;  // Sorted internal IDs
+
+  private:
+    struct Item
+    {
+      Resources                 resources_;
+      boost::posix_time::ptime  expiration_;
+    };
+
+    typedef std::map<std::string, Item*>  Content;
+
+    boost::mutex                                  mutex_;
+    size_t                                        maxSize_;
+    boost::posix_time::time_duration              timeToLive_;
+    Content                                       content_;
+    Orthanc::LeastRecentlyUsedIndex<std::string>  index_;
+    uint64_t                                      revision_;
+    bool                                          hasAllLabels_;
+    std::list<std::string>                        allLabels_;
+    boost::posix_time::ptime                      allLabelsExpiration_;
+
+    void Remove(const std::string& label);
+
+    void Clear();
+
+    const Item* LookupItem(const std::string& label,
+                           const boost::posix_time::ptime& now);
+
+  public:
+    LabelsCache();
+
+    ~LabelsCache();
+
+    // "0" disables the cache
+    void SetTimeToLive(unsigned int seconds);
+
+    bool IsEnabled();
+
+    /**
+     * The revision must be read before reading a label from the
+     * database: The label is not stored if a write has happened in
+     * the meantime, as it might miss this write.
+     **/
+    uint64_t GetRevision();
+
+    bool IsCached(const std::string& label,
+                  const boost::posix_time::ptime& now);
+
+    // The content of "resources" is moved into the cache
+    void Store(const std::string& label,
+               Resources& resources,
+               uint64_t revision,
+               const boost::posix_time::ptime& now);
+
+    /**
+     * Computes the resources that have all the labels ("All"), one of
+     * the labels ("Any"), or the resources that must be excluded
+     * ("None"). Returns "false" if some label is not cached.
+     **/
+    bool Evaluate(Resources& target,
+                  const std::set<std::string>& labels,
+                  LabelsConstraint constraint,
+                  const boost::posix_time::ptime& now);
+
+    bool LookupAllLabels(std::list<std::string>& target,
+                         const boost::posix_time::ptime& now);
+
+    void StoreAllLabels(const std::list<std::string>& labels,
+                        uint64_t revision,
+                        const boost::posix_time::ptime& now);
+
+    // Also discards the list of all the labels. To be called once the
+    // write of the label is committed.
+    void InvalidateLabel(const std::string& label);
+
+    // To be called if resources are deleted, as a label might not be used anymore
+    void InvalidateListOfLabels();
+
+    void InvalidateAll();
+
+    size_t GetSize();
+  };
+}
@@ -0,0 +1,275 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "OperationsStatistics.h"
+
+#include "../../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <cassert>
+
+
+namespace OrthancDatabases
+{
+  uint64_t OperationsStatistics::Histogram::GetPercentileInternal(float percentile) const
+  {
+    // The mutex must be locked by the caller
+    if (count_ == 0)
+    {
+      return 0;
+    }
+
+    const uint64_t threshold = static_cast<uint64_t>(percentile * static_cast<float>(count_));
+    uint64_t cumulated = 0;
+
+    for (unsigned int i = 0; i < BUCKETS_COUNT; i++)
+    {
+      cumulated += buckets_[i];
+      if (cumulated > threshold ||
+          cumulated == count_)
+      {
+        const uint64_t upperBound = (static_cast<uint64_t>(1) << (i + 1));
+        return (upperBound < max_ ? upperBound : max_);
+      }
+    }
+
+    return max_;
+  }
+
+
+  OperationsStatistics::Histogram::Histogram() :
+    count_(0),
+    errors_(0),
+    total_(0),
+    max_(0)
+  {
+    for (unsigned int i = 0; i < BUCKETS_COUNT; i++)
+    {
+      buckets_[i] = 0;
+    }
+  }
+
+
+  void OperationsStatistics::Histogram::Add(uint64_t microseconds,
+                                            bool success)
+  {
+    unsigned int bucket = 0;
+    while (bucket + 1 < BUCKETS_COUNT &&
+           (microseconds >> (bucket + 1)) != 0)
+    {
+      bucket++;
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    count_++;
+    total_ += microseconds;
+    buckets_[bucket]++;
+
+    if (!success)
+    {
+      errors_++;
+    }
+
+    if (microseconds > max_)
+    {
+      max_ = microseconds;
+    }
+  }
+
+
+  uint64_t OperationsStatistics::Histogram::GetCount() const
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return count_;
+  }
+
+
+  uint64_t OperationsStatistics::Histogram::GetErrors() const
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return errors_;
+  }
+
+
+  uint64_t OperationsStatistics::Histogram::GetPercentile(float percentile) const
+  {
+    if (percentile < 0.0f ||
+        percentile > 1.0f)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    boost::mutex::scoped_lock lock(mutex_);
+    return GetPercentileInternal(percentile);
+  }
+
+
+  void OperationsStatistics::Histogram::Format(Json::Value& target) const
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    target = Json::objectValue;
+    target["Count"] = static_cast<Json::UInt64>(count_);
+    target["Errors"] = static_cast<Json::UInt64>(errors_);
+    target["AverageMicroseconds"] = static_cast<Json::UInt64>(count_ == 0 ? 0 : total_ / count_);
+    target["P50Microseconds"] = static_cast<Json::UInt64>(GetPercentileInternal(0.50f));
+    target["P95Microseconds"] = static_cast<Json::UInt64>(GetPercentileInternal(0.95f));
+    target["P99Microseconds"] = static_cast<Json::UInt64>(GetPercentileInternal(0.99f));
+    target["MaxMicroseconds"] = static_cast<Json::UInt64>(max_);
+  }
+
+
+  OperationsStatistics::Timer::Timer(OperationsStatistics& statistics,
+                                     const std::string& operation) :
+    statistics_(statistics),
+    operation_(operation),
+    success_(false)
+  {
+  }
+
+
+  OperationsStatistics::Timer::~Timer()
+  {
+    try
+    {
+      statistics_.Add(operation_, timer_.GetElapsedMicroseconds(), success_);
+    }
+    catch (...)
+    {
+      // Don't throw exceptions in destructors
+    }
+  }
+
+
+  OperationsStatistics::Histogram& OperationsStatistics::GetHistogram(const std::string& operation)
+  {
+    {
+      boost::shared_lock<boost::shared_mutex> lock(mutex_);
+
+      Histograms::const_iterator found = histograms_.find(operation);
+      if (found != histograms_.end())
+      {
+        assert(found->second != NULL);
+        return *found->second;
+      }
+    }
+
+    // First call to this operation
+    boost::unique_lock<boost::shared_mutex> lock(mutex_);
+
+    Histograms::const_iterator found = histograms_.find(operation);
+    if (found != histograms_.end())
+    {
+      assert(found->second != NULL);
+      return *found->second;
+    }
+    else
+    {
+      Histogram* histogram = new Histogram;
+      histograms_[operation] = histogram;
+      return *histogram;
+    }
+  }
+
+
+  OperationsStatistics::OperationsStatistics(const std::string& prefix) :
+    prefix_(prefix)
+  {
+  }
+
+
+  OperationsStatistics::~OperationsStatistics()
+  {
+    for (Histograms::iterator it = histograms_.begin(); it != histograms_.end(); ++it)
+    {
+      assert(it->second != NULL);
+      delete it->second;
+    }
+  }
+
+
+  void OperationsStatistics::Add(const std::string& operation,
+                                 uint64_t microseconds,
+                                 bool success)
+  {
+    GetHistogram(operation).Add(microseconds, success);
+  }
+
+
+  void OperationsStatistics::Format(Json::Value& target)
+  {
+    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+
+    target = Json::objectValue;
+
+    for (Histograms::const_iterator it = histograms_.begin(); it != histograms_.end(); ++it)
+    {
+      assert(it->second != NULL);
+
+      Json::Value item;
+      it->second->Format(item);
+      target[it->first] = item;
+    }
+  }
+
+
+  void OperationsStatistics::Publish(OrthancPluginContext* context)
+  {
+#if HAS_ORTHANC_PLUGIN_METRICS == 1
+    if (context == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+    }
+
+    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+
+    for (Histograms::const_iterator it = histograms_.begin(); it != histograms_.end(); ++it)
+    {
+      assert(it->second != NULL);
+
+      Json::Value item;
+      it->second->Format(item);
+
+      std::string name = prefix_ + it->first;
+      Orthanc::Toolbox::ToLowerCase(name);
+
+      // Latencies are published in milliseconds
+      OrthancPluginSetMetricsValue(context, (name + "_count").c_str(),
+                                   static_cast<float>(item["Count"].asUInt64()), OrthancPluginMetricsType_Default);
+      OrthancPluginSetMetricsValue(context, (name + "_errors").c_str(),
+                                   static_cast<float>(item["Errors"].asUInt64()), OrthancPluginMetricsType_Default);
+      OrthancPluginSetMetricsValue(context, (name + "_p50_ms").c_str(),
+                                   static_cast<float>(item["P50Microseconds"].asUInt64()) / 1000.0f, OrthancPluginMetricsType_Default);
+      OrthancPluginSetMetricsValue(context, (name + "_p95_ms").c_str(),
+                                   static_cast<float>(item["P95Microseconds"].asUInt64()) / 1000.0f, OrthancPluginMetricsType_Default);
+      OrthancPluginSetMetricsValue(context, (name + "_p99_ms").c_str(),
+                                   static_cast<float>(item["P99Microseconds"].asUInt64()) / 1000.0f, OrthancPluginMetricsType_Default);
+      OrthancPluginSetMetricsValue(context, (name + "_max_ms").c_str(),
+                                   static_cast<float>(item["MaxMicroseconds"].asUInt64()) / 1000.0f, OrthancPluginMetricsType_Default);
+    }
+#endif
+  }
+}
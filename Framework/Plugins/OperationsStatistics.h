@@ -0,0 +1,134 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <orthanc/OrthancCPlugin.h>
+
+#include <Toolbox.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <json/value.h>
+#include <map>
+#include <stdint.h>
+#include <string>
+
+
+namespace OrthancDatabases
+{
+  /**
+   * Latency histograms, call counts and error counts of the
+   * operations that are received from the Orthanc core. Each
+   * operation has its own histogram with its own mutex, so that
+   * concurrent operations of different types never wait for each
+   * other.
+   **/
+  class OperationsStatistics : public boost::noncopyable
+  {
+  public:
+    class Histogram : public boost::noncopyable
+    {
+    private:
+      // Bucket "i" counts the durations that are in the range [2^i, 2^(i+1)[ microseconds
+      enum
+      {
+        BUCKETS_COUNT = 40
+      };
+
+      mutable boost::mutex  mutex_;
+      uint64_t              count_;
+      uint64_t              errors_;
+      uint64_t              total_;
+      uint64_t              max_;
+      uint64_t              buckets_[BUCKETS_COUNT];
+
+      uint64_t GetPercentileInternal(float percentile) const;
+
+    public:
+      Histogram();
+
+      void Add(uint64_t microseconds,
+               bool success);
+
+      uint64_t GetCount() const;
+
+      uint64_t GetErrors() const;
+
+      // Returns the upper bound of the bucket containing the percentile (in microseconds)
+      uint64_t GetPercentile(float percentile) const;
+
+      void Format(Json::Value& target) const;
+    };
+
+
+    /**
+     * Measures the duration of one operation, that is counted as an
+     * error unless "SetSuccess()" is called before destruction.
+     **/
+    class Timer : public boost::noncopyable
+    {
+    private:
+      OperationsStatistics&           statistics_;
+      std::string                     operation_;
+      Orthanc::Toolbox::ElapsedTimer  timer_;
+      bool                            success_;
+
+    public:
+      Timer(OperationsStatistics& statistics,
+            const std::string& operation);
+
+      ~Timer();
+
+      void SetSuccess()
+      {
+        success_ = true;
+      }
+    };
+
+  private:
+    typedef std::map<std::string, Histogram*>  Histograms;
+
+    boost::shared_mutex  mutex_;
+    std::string          prefix_;
+    Histograms           histograms_;
+
+    Histogram& GetHistogram(const std::string& operation);
+
+  public:
+    // The prefix is used to name the metrics, e.g. "orthanc_index_"
+    explicit OperationsStatistics(const std::string& prefix);
+
+    ~OperationsStatistics();
+
+    void Add(const std::string& operation,
+             uint64_t microseconds,
+             bool success);
+
+    void Format(Json::Value& target);
+
+    // Publishes the statistics as Orthanc metrics (only if the Orthanc SDK supports metrics)
+    void Publish(OrthancPluginContext* context);
+  };
+}
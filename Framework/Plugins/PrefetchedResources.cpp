@@ -0,0 +1,94 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "PrefetchedResources.h"
+
+
+namespace OrthancDatabases
+{
+  void PrefetchedResources::Clear()
+  {
+    resources_.clear();
+    mainDicomTags_.clear();
+    metadata_.clear();
+  }
+
+
+  void PrefetchedResources::AddMainDicomTag(int64_t id,
+                                            uint16_t group,
+                                            uint16_t element,
+                                            const std::string& value)
+  {
+    Tag tag;
+    tag.group_ = group;
+    tag.element_ = element;
+    tag.value_ = value;
+    mainDicomTags_[id].push_back(tag);
+  }
+
+
+  bool PrefetchedResources::LookupMainDicomTags(IDatabaseBackendOutput& output,
+                                                int64_t id) const
+  {
+    if (resources_.find(id) == resources_.end())
+    {
+      return false;
+    }
+
+    MainDicomTags::const_iterator found = mainDicomTags_.find(id);
+
+    if (found != mainDicomTags_.end())
+    {
+      for (std::list<Tag>::const_iterator it = found->second.begin(); it != found->second.end(); ++it)
+      {
+        output.AnswerDicomTag(it->group_, it->element_, it->value_);
+      }
+    }
+
+    return true;
+  }
+
+
+  bool PrefetchedResources::LookupAllMetadata(std::map<int32_t, std::string>& target,
+                                              int64_t id) const
+  {
+    if (resources_.find(id) == resources_.end())
+    {
+      return false;
+    }
+
+    Metadata::const_iterator found = metadata_.find(id);
+
+    if (found == metadata_.end())
+    {
+      target.clear();
+    }
+    else
+    {
+      target = found->second;
+    }
+
+    return true;
+  }
+}
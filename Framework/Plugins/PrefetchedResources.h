@@ -0,0 +1,93 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "IDatabaseBackendOutput.h"
+
+#include <list>
+#include <map>
+#include <set>
+#include <string>
+
+
+namespace OrthancDatabases
+{
+  /**
+   * Main DICOM tags and metadata of a set of resources, that are read
+   * at once by a read-only transaction of the V4 adapter when Orthanc
+   * lists the children of a resource, as Orthanc then usually reads
+   * the main DICOM tags and the metadata of each child in turn. The
+   * content is only valid during the transaction.
+   **/
+  class PrefetchedResources : public boost::noncopyable
+  {
+  private:
+    struct Tag
+    {
+      uint16_t     group_;
+      uint16_t     element_;
+      std::string  value_;
+    };
+
+    typedef std::map<int64_t, std::list<Tag> >                  MainDicomTags;
+    typedef std::map<int64_t, std::map<int32_t, std::string> >  Metadata;
+
+    std::set<int64_t>  resources_;
+    MainDicomTags      mainDicomTags_;
+    Metadata           metadata_;
+
+  public:
+    void Clear();
+
+    bool IsEmpty() const
+    {
+      return resources_.empty();
+    }
+
+    void AddResource(int64_t id)
+    {
+      resources_.insert(id);
+    }
+
+    void AddMainDicomTag(int64_t id,
+                         uint16_t group,
+                         uint16_t element,
+                         const std::string& value);
+
+    void SetMetadata(int64_t id,
+                     const std::map<int32_t, std::string>& metadata)
+    {
+      metadata_[id] = metadata;
+    }
+
+    // Uses "output.AnswerDicomTag()", returns "false" if the
+    // resource was not prefetched
+    bool LookupMainDicomTags(IDatabaseBackendOutput& output,
+                             int64_t id) const;
+
+    bool LookupAllMetadata(std::map<int32_t, std::string>& target,
+                           int64_t id) const;
+  };
+}
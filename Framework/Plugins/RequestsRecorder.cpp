@@ -0,0 +1,223 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "RequestsRecorder.h"
+
+#include <OrthancException.h>
+
+#include <algorithm>
+
+
+namespace OrthancDatabases
+{
+  static void WriteInteger(std::ostream& stream,
+                           uint64_t value)
+  {
+    // Little-endian, whatever the platform
+    char buffer[8];
+    for (size_t i = 0; i < 8; i++)
+    {
+      buffer[i] = static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+
+    stream.write(buffer, 8);
+  }
+
+
+  static bool ReadInteger(uint64_t& value,
+                          std::istream& stream)
+  {
+    char buffer[8];
+    if (!stream.read(buffer, 8))
+    {
+      return false;
+    }
+
+    value = 0;
+    for (size_t i = 0; i < 8; i++)
+    {
+      value |= (static_cast<uint64_t>(static_cast<uint8_t>(buffer[i])) << (8 * i));
+    }
+
+    return true;
+  }
+
+
+  RequestsRecorder::Record::Record() :
+    transaction_(0),
+    connection_(0),
+    timestamp_(0),
+    duration_(0),
+    success_(false)
+  {
+  }
+
+
+  RequestsRecorder::Record::Record(int64_t transaction,
+                                   int64_t connection,
+                                   const boost::posix_time::ptime& start,
+                                   const boost::posix_time::ptime& end,
+                                   bool success,
+                                   const void* request,
+                                   size_t size) :
+    transaction_(transaction),
+    connection_(connection),
+    success_(success),
+    request_(reinterpret_cast<const char*>(request), size)
+  {
+    static const boost::posix_time::ptime EPOCH(boost::gregorian::date(1970, 1, 1));
+    timestamp_ = static_cast<uint64_t>((start - EPOCH).total_microseconds());
+    duration_ = (end > start ? static_cast<uint64_t>((end - start).total_microseconds()) : 0);
+  }
+
+
+  void RequestsRecorder::Record::Swap(Record& other)
+  {
+    std::swap(transaction_, other.transaction_);
+    std::swap(connection_, other.connection_);
+    std::swap(timestamp_, other.timestamp_);
+    std::swap(duration_, other.duration_);
+    std::swap(success_, other.success_);
+    request_.swap(other.request_);
+  }
+
+
+  void RequestsRecorder::Record::Write(std::ostream& stream) const
+  {
+    WriteInteger(stream, static_cast<uint64_t>(transaction_));
+    WriteInteger(stream, static_cast<uint64_t>(connection_));
+    WriteInteger(stream, timestamp_);
+    WriteInteger(stream, duration_);
+    WriteInteger(stream, success_ ? 1 : 0);
+    WriteInteger(stream, request_.size());
+    stream.write(request_.c_str(), request_.size());
+  }
+
+
+  bool RequestsRecorder::Record::Read(std::istream& stream)
+  {
+    uint64_t transaction;
+    if (!ReadInteger(transaction, stream))
+    {
+      return false;  // End of the file
+    }
+
+    uint64_t connection, success, size;
+    if (!ReadInteger(connection, stream) ||
+        !ReadInteger(timestamp_, stream) ||
+        !ReadInteger(duration_, stream) ||
+        !ReadInteger(success, stream) ||
+        !ReadInteger(size, stream))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Truncated record of requests");
+    }
+
+    transaction_ = static_cast<int64_t>(transaction);
+    connection_ = static_cast<int64_t>(connection);
+    success_ = (success != 0);
+    request_.resize(size);
+
+    if (size != 0 &&
+        !stream.read(&request_[0], size))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile, "Truncated record of requests");
+    }
+
+    return true;
+  }
+
+
+  void RequestsRecorder::Flush(boost::mutex::scoped_lock& lock)
+  {
+    std::vector<Record> records;
+    records.reserve(bufferSize_);
+    records.swap(buffer_);
+
+    // Taking "fileMutex_" before releasing "mutex_" keeps the order
+    // of the records, while the other threads keep on adding records
+    boost::mutex::scoped_lock fileLock(fileMutex_);
+    lock.unlock();
+
+    for (size_t i = 0; i < records.size(); i++)
+    {
+      records[i].Write(*file_);
+    }
+
+    file_->flush();
+  }
+
+
+  RequestsRecorder::RequestsRecorder(const std::string& path,
+                                     size_t bufferSize) :
+    file_(new std::ofstream(path.c_str(), std::ios::binary | std::ios::app)),
+    bufferSize_(bufferSize == 0 ? 1 : bufferSize)
+  {
+    if (!file_->good())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_CannotWriteFile, "Cannot open the file to record the requests: " + path);
+    }
+
+    buffer_.reserve(bufferSize_);
+  }
+
+
+  RequestsRecorder::~RequestsRecorder()
+  {
+    try
+    {
+      Flush();
+    }
+    catch (...)
+    {
+      // Don't throw exceptions in destructors
+    }
+  }
+
+
+  void RequestsRecorder::Add(int64_t transaction,
+                             int64_t connection,
+                             const boost::posix_time::ptime& start,
+                             const boost::posix_time::ptime& end,
+                             bool success,
+                             const void* request,
+                             size_t size)
+  {
+    Record record(transaction, connection, start, end, success, request, size);
+
+    boost::mutex::scoped_lock lock(mutex_);
+    buffer_.push_back(Record());
+    buffer_.back().Swap(record);  // Avoid copying the request under the lock
+
+    if (buffer_.size() >= bufferSize_)
+    {
+      Flush(lock);
+    }
+  }
+
+
+  void RequestsRecorder::Flush()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    Flush(lock);
+  }
+}
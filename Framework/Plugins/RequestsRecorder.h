@@ -0,0 +1,133 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <Compatibility.h>  // For std::unique_ptr<>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <fstream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+namespace OrthancDatabases
+{
+  /**
+   * Low-overhead recording of the requests that are received through
+   * the database SDK "V4", for the offline analysis and replay of the
+   * workloads (cf. "DatabaseBackendAdapterV4::Replay()"). The records
+   * are accumulated in memory, and are appended to the file each time
+   * the buffer is full. This class is thread-safe.
+   **/
+  class RequestsRecorder : public boost::noncopyable
+  {
+  public:
+    class Record
+    {
+    private:
+      int64_t      transaction_;  // 0 if not related to a transaction
+      int64_t      connection_;   // 0 if not related to a transaction
+      uint64_t     timestamp_;    // Start of the request, in microseconds since the Epoch
+      uint64_t     duration_;     // In microseconds
+      bool         success_;
+      std::string  request_;      // Serialized protobuf request
+
+    public:
+      Record();
+
+      Record(int64_t transaction,
+             int64_t connection,
+             const boost::posix_time::ptime& start,
+             const boost::posix_time::ptime& end,
+             bool success,
+             const void* request,
+             size_t size);
+
+      int64_t GetTransaction() const
+      {
+        return transaction_;
+      }
+
+      int64_t GetConnection() const
+      {
+        return connection_;
+      }
+
+      uint64_t GetTimestamp() const
+      {
+        return timestamp_;
+      }
+
+      uint64_t GetDuration() const
+      {
+        return duration_;
+      }
+
+      bool IsSuccess() const
+      {
+        return success_;
+      }
+
+      const std::string& GetRequest() const
+      {
+        return request_;
+      }
+
+      void Swap(Record& other);
+
+      void Write(std::ostream& stream) const;
+
+      // Returns "false" at the end of the file
+      bool Read(std::istream& stream);
+    };
+
+  private:
+    boost::mutex                    mutex_;       // Protects "buffer_"
+    boost::mutex                    fileMutex_;   // Protects "file_"
+    std::unique_ptr<std::ofstream>  file_;
+    size_t                          bufferSize_;
+    std::vector<Record>             buffer_;
+
+    void Flush(boost::mutex::scoped_lock& lock);
+
+  public:
+    RequestsRecorder(const std::string& path,
+                     size_t bufferSize);
+
+    ~RequestsRecorder();
+
+    void Add(int64_t transaction,
+             int64_t connection,
+             const boost::posix_time::ptime& start,
+             const boost::posix_time::ptime& end,
+             bool success,
+             const void* request,
+             size_t size);
+
+    void Flush();
+  };
+}
@@ -0,0 +1,324 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "ResourcesLookupCache.h"
+
+#include "../Common/DatabaseManager.h"
+
+#include <OrthancException.h>
+
+
+namespace OrthancDatabases
+{
+  static const size_t SHARDS_COUNT = 16;
+
+
+  ResourcesLookupCache::Shard& ResourcesLookupCache::GetShard(const std::string& publicId)
+  {
+    // FNV-1a hash of the public ID
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < publicId.size(); i++)
+    {
+      hash = (hash ^ static_cast<uint8_t>(publicId[i])) * 16777619u;
+    }
+
+    return *shards_[hash % shards_.size()];
+  }
+
+
+  ResourcesLookupCache::Shard& ResourcesLookupCache::GetShard(int64_t internalId)
+  {
+    return *shards_[static_cast<uint64_t>(internalId) % shards_.size()];
+  }
+
+
+  void ResourcesLookupCache::StoreInternal(uint64_t transactionSequence,
+                                           const std::string& publicId,
+                                           int64_t internalId,
+                                           OrthancPluginResourceType type,
+                                           bool hasParent,
+                                           const std::string& parentPublicId)
+  {
+    if (!IsEnabled())
+    {
+      return;
+    }
+
+    Shard& shard = GetShard(publicId);
+    boost::mutex::scoped_lock lock(shard.mutex_);
+
+    if (transactionSequence <= shard.invalidatedSequence_)
+    {
+      return;  // The lookup might have been read before the last invalidation
+    }
+
+    Resources::iterator found = shard.resources_.find(publicId);
+
+    if (found == shard.resources_.end())
+    {
+      while (shard.resources_.size() >= maxSizePerShard_)
+      {
+        shard.resources_.erase(shard.resourcesIndex_.RemoveOldest());
+      }
+
+      Resource& resource = shard.resources_[publicId];
+      resource.internalId_ = internalId;
+      resource.type_ = type;
+      resource.hasParent_ = hasParent;
+      resource.parentPublicId_ = parentPublicId;
+      shard.resourcesIndex_.Add(publicId);
+    }
+    else
+    {
+      found->second.internalId_ = internalId;
+      found->second.type_ = type;
+
+      if (hasParent)
+      {
+        found->second.hasParent_ = true;
+        found->second.parentPublicId_ = parentPublicId;
+      }
+
+      shard.resourcesIndex_.MakeMostRecent(publicId);
+    }
+  }
+
+
+  ResourcesLookupCache::ResourcesLookupCache() :
+    maxSizePerShard_(0)
+  {
+    shards_.resize(SHARDS_COUNT);
+
+    for (size_t i = 0; i < shards_.size(); i++)
+    {
+      shards_[i] = new Shard;
+    }
+  }
+
+
+  ResourcesLookupCache::~ResourcesLookupCache()
+  {
+    for (size_t i = 0; i < shards_.size(); i++)
+    {
+      delete shards_[i];
+    }
+  }
+
+
+  void ResourcesLookupCache::SetMaxSize(size_t maxSize)
+  {
+    if (maxSize == 0)
+    {
+      maxSizePerShard_ = 0;
+    }
+    else
+    {
+      maxSizePerShard_ = (maxSize + shards_.size() - 1) / shards_.size();
+    }
+
+    for (size_t i = 0; i < shards_.size(); i++)
+    {
+      Shard& shard = *shards_[i];
+      boost::mutex::scoped_lock lock(shard.mutex_);
+
+      while (shard.resources_.size() > maxSizePerShard_)
+      {
+        shard.resources_.erase(shard.resourcesIndex_.RemoveOldest());
+      }
+
+      while (shard.publicIds_.size() > maxSizePerShard_)
+      {
+        shard.publicIds_.erase(shard.publicIdsIndex_.RemoveOldest());
+      }
+    }
+  }
+
+
+  bool ResourcesLookupCache::LookupResource(int64_t& internalId,
+                                            OrthancPluginResourceType& type,
+                                            const std::string& publicId)
+  {
+    if (!IsEnabled())
+    {
+      return false;
+    }
+
+    Shard& shard = GetShard(publicId);
+    boost::mutex::scoped_lock lock(shard.mutex_);
+
+    Resources::const_iterator found = shard.resources_.find(publicId);
+
+    if (found == shard.resources_.end())
+    {
+      return false;
+    }
+    else
+    {
+      internalId = found->second.internalId_;
+      type = found->second.type_;
+      shard.resourcesIndex_.MakeMostRecent(publicId);
+      return true;
+    }
+  }
+
+
+  bool ResourcesLookupCache::LookupResourceAndParent(int64_t& internalId,
+                                                     OrthancPluginResourceType& type,
+                                                     std::string& parentPublicId,
+                                                     const std::string& publicId)
+  {
+    if (!IsEnabled())
+    {
+      return false;
+    }
+
+    Shard& shard = GetShard(publicId);
+    boost::mutex::scoped_lock lock(shard.mutex_);
+
+    Resources::const_iterator found = shard.resources_.find(publicId);
+
+    if (found == shard.resources_.end() ||
+        !found->second.hasParent_)
+    {
+      return false;
+    }
+    else
+    {
+      internalId = found->second.internalId_;
+      type = found->second.type_;
+      parentPublicId = found->second.parentPublicId_;
+      shard.resourcesIndex_.MakeMostRecent(publicId);
+      return true;
+    }
+  }
+
+
+  bool ResourcesLookupCache::LookupPublicId(std::string& publicId,
+                                            int64_t internalId)
+  {
+    if (!IsEnabled())
+    {
+      return false;
+    }
+
+    Shard& shard = GetShard(internalId);
+    boost::mutex::scoped_lock lock(shard.mutex_);
+
+    PublicIds::const_iterator found = shard.publicIds_.find(internalId);
+
+    if (found == shard.publicIds_.end())
+    {
+      return false;
+    }
+    else
+    {
+      publicId = found->second;
+      shard.publicIdsIndex_.MakeMostRecent(internalId);
+      return true;
+    }
+  }
+
+
+  void ResourcesLookupCache::StorePublicId(int64_t internalId,
+                                           const std::string& publicId)
+  {
+    if (!IsEnabled())
+    {
+      return;
+    }
+
+    Shard& shard = GetShard(internalId);
+    boost::mutex::scoped_lock lock(shard.mutex_);
+
+    PublicIds::iterator found = shard.publicIds_.find(internalId);
+
+    if (found == shard.publicIds_.end())
+    {
+      while (shard.publicIds_.size() >= maxSizePerShard_)
+      {
+        shard.publicIds_.erase(shard.publicIdsIndex_.RemoveOldest());
+      }
+
+      shard.publicIds_[internalId] = publicId;
+      shard.publicIdsIndex_.Add(internalId);
+    }
+    else
+    {
+      shard.publicIdsIndex_.MakeMostRecent(internalId);
+    }
+  }
+
+
+  void ResourcesLookupCache::Invalidate(const std::string& publicId)
+  {
+    if (!IsEnabled())
+    {
+      return;
+    }
+
+    // The internal IDs are never reused, so the mapping from the
+    // internal ID of the deleted resource can stay in the cache
+    const uint64_t sequence = DatabaseManager::GetLastTransactionSequence();
+
+    Shard& shard = GetShard(publicId);
+    boost::mutex::scoped_lock lock(shard.mutex_);
+
+    shard.invalidatedSequence_ = sequence;
+
+    Resources::iterator found = shard.resources_.find(publicId);
+
+    if (found != shard.resources_.end())
+    {
+      shard.resources_.erase(found);
+      shard.resourcesIndex_.Invalidate(publicId);
+    }
+  }
+
+
+  void ResourcesLookupCache::Clear()
+  {
+    const uint64_t sequence = DatabaseManager::GetLastTransactionSequence();
+
+    for (size_t i = 0; i < shards_.size(); i++)
+    {
+      Shard& shard = *shards_[i];
+      boost::mutex::scoped_lock lock(shard.mutex_);
+
+      shard.invalidatedSequence_ = sequence;
+
+      shard.resources_.clear();
+      shard.publicIds_.clear();
+
+      while (!shard.resourcesIndex_.IsEmpty())
+      {
+        shard.resourcesIndex_.RemoveOldest();
+      }
+
+      while (!shard.publicIdsIndex_.IsEmpty())
+      {
+        shard.publicIdsIndex_.RemoveOldest();
+      }
+    }
+  }
+}
@@ -0,0 +1,149 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include <Cache/LeastRecentlyUsedIndex.h>
+
+#include <orthanc/OrthancCDatabasePlugin.h>
+
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <map>
+#include <string>
+#include <vector>
+
+
+namespace OrthancDatabases
+{
+  /**
+   * In-process cache of the mappings between the public IDs and the
+   * internal IDs of the resources, that are repeatedly looked up by
+   * Orthanc while it builds one answer. The mapping of a resource
+   * never changes during its lifetime, so the entries only have to be
+   * invalidated when the resource is deleted. The lookups that are
+   * stored are tagged by the sequence of the database transaction
+   * that read them (cf. "DatabaseManager::GetTransactionSequence()"):
+   * A lookup whose transaction was started before the last
+   * invalidation of its shard is not stored, as its snapshot of the
+   * database might predate the deletion. The cache is split into
+   * shards that are protected by distinct mutexes, in order to limit
+   * the contention between the threads. Each shard is bounded, and
+   * evicts its least recently used entries. This class is thread-safe.
+   **/
+  class ResourcesLookupCache : public boost::noncopyable
+  {
+  private:
+    struct Resource
+    {
+      int64_t                    internalId_;
+      OrthancPluginResourceType  type_;
+      bool                       hasParent_;       // Whether "parentPublicId_" is known
+      std::string                parentPublicId_;  // Empty for patients
+    };
+
+    typedef std::map<std::string, Resource>  Resources;
+    typedef std::map<int64_t, std::string>   PublicIds;
+
+    struct Shard
+    {
+      boost::mutex                                  mutex_;
+      Resources                                     resources_;
+      Orthanc::LeastRecentlyUsedIndex<std::string>  resourcesIndex_;
+      PublicIds                                     publicIds_;
+      Orthanc::LeastRecentlyUsedIndex<int64_t>      publicIdsIndex_;
+      uint64_t                                      invalidatedSequence_;
+
+      Shard() :
+        invalidatedSequence_(0)
+      {
+      }
+    };
+
+    std::vector<Shard*>  shards_;
+    size_t               maxSizePerShard_;  // "0" if the cache is disabled
+
+    Shard& GetShard(const std::string& publicId);
+
+    Shard& GetShard(int64_t internalId);
+
+    void StoreInternal(uint64_t transactionSequence,
+                       const std::string& publicId,
+                       int64_t internalId,
+                       OrthancPluginResourceType type,
+                       bool hasParent,
+                       const std::string& parentPublicId);
+
+  public:
+    ResourcesLookupCache();
+
+    ~ResourcesLookupCache();
+
+    // Maximum number of resources in the cache, "0" disables the cache
+    // (this method is not thread-safe, and must be called at startup)
+    void SetMaxSize(size_t maxSize);
+
+    bool IsEnabled() const
+    {
+      return maxSizePerShard_ != 0;
+    }
+
+    bool LookupResource(int64_t& internalId,
+                        OrthancPluginResourceType& type,
+                        const std::string& publicId);
+
+    bool LookupResourceAndParent(int64_t& internalId,
+                                 OrthancPluginResourceType& type,
+                                 std::string& parentPublicId,
+                                 const std::string& publicId);
+
+    bool LookupPublicId(std::string& publicId,
+                        int64_t internalId);
+
+    void StoreResource(uint64_t transactionSequence,
+                       const std::string& publicId,
+                       int64_t internalId,
+                       OrthancPluginResourceType type)
+    {
+      StoreInternal(transactionSequence, publicId, internalId, type, false, "");
+    }
+
+    void StoreResourceAndParent(uint64_t transactionSequence,
+                                const std::string& publicId,
+                                int64_t internalId,
+                                OrthancPluginResourceType type,
+                                const std::string& parentPublicId)
+    {
+      StoreInternal(transactionSequence, publicId, internalId, type, true, parentPublicId);
+    }
+
+    void StorePublicId(int64_t internalId,
+                       const std::string& publicId);
+
+    // To be called once the deletion of the resource is committed
+    void Invalidate(const std::string& publicId);
+
+    void Clear();
+  };
+}
@@ -0,0 +1,209 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "RetryPolicy.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace OrthancDatabases
+{
+  static const unsigned int BASE_DELAY = 20;        // In milliseconds
+  static const unsigned int MAX_DELAY = 2000;       // In milliseconds
+  static const double MAX_RETRY_BUDGET = 20;        // Burst of retries
+  static const double RETRY_BUDGET_REFILL = 0.2;    // At most one retry for 5 successes on the long run
+  static const double CONFLICT_RATE_WEIGHT = 0.05;  // Weight of the last transaction in the moving average
+
+
+  RetryPolicy::WriterSlot::WriterSlot(RetryPolicy& policy) :
+    policy_(NULL)
+  {
+    boost::mutex::scoped_lock lock(policy.mutex_);
+
+    if (policy.maxWriters_ != 0)
+    {
+      while (static_cast<double>(policy.activeWriters_ + 1) > policy.writersLimit_)
+      {
+        policy.writersCondition_.wait(lock);
+
+        if (policy.maxWriters_ == 0)
+        {
+          return;  // The limiter was disabled in the meantime
+        }
+      }
+
+      policy.activeWriters_++;
+      policy_ = &policy;
+    }
+  }
+
+
+  RetryPolicy::WriterSlot::~WriterSlot()
+  {
+    if (policy_ != NULL)
+    {
+      boost::mutex::scoped_lock lock(policy_->mutex_);
+      assert(policy_->activeWriters_ > 0);
+      policy_->activeWriters_--;
+      policy_->writersCondition_.notify_one();
+    }
+  }
+
+
+  RetryPolicy::RetryPolicy() :
+    seed_(static_cast<uint64_t>(reinterpret_cast<intptr_t>(this)) ^ 0x9e3779b97f4a7c15ULL),
+    retryBudget_(MAX_RETRY_BUDGET),
+    successes_(0),
+    conflicts_(0),
+    retries_(0),
+    exhaustedRetries_(0),
+    conflictRate_(0),
+    maxWriters_(0),
+    writersLimit_(0),
+    activeWriters_(0),
+    lastDecrease_(boost::posix_time::min_date_time)
+  {
+  }
+
+
+  void RetryPolicy::SetMaxWriters(size_t count)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    maxWriters_ = count;
+    writersLimit_ = static_cast<double>(count);
+    writersCondition_.notify_all();
+  }
+
+
+  size_t RetryPolicy::GetMaxWriters()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return maxWriters_;
+  }
+
+
+  size_t RetryPolicy::GetWritersLimit()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return static_cast<size_t>(writersLimit_);
+  }
+
+
+  unsigned int RetryPolicy::GetNextDelay(unsigned int previousDelay)
+  {
+    uint64_t random;
+
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      // xorshift64*
+      seed_ ^= seed_ >> 12;
+      seed_ ^= seed_ << 25;
+      seed_ ^= seed_ >> 27;
+      random = seed_ * 2685821657736338717ULL;
+    }
+
+    const unsigned int upper = std::min(MAX_DELAY, std::max(BASE_DELAY, 3 * previousDelay));
+    return BASE_DELAY + static_cast<unsigned int>((random >> 32) % (upper - BASE_DELAY + 1));
+  }
+
+
+  bool RetryPolicy::TryRetry(unsigned int attempt)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (attempt == 0)
+    {
+      // The first retry of each operation is always allowed
+    }
+    else if (retryBudget_ >= 1)
+    {
+      retryBudget_ -= 1;
+    }
+    else
+    {
+      exhaustedRetries_++;
+      return false;
+    }
+
+    retries_++;
+    return true;
+  }
+
+
+  void RetryPolicy::SignalSuccess()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    successes_++;
+    retryBudget_ = std::min(MAX_RETRY_BUDGET, retryBudget_ + RETRY_BUDGET_REFILL);
+    conflictRate_ = (1.0 - CONFLICT_RATE_WEIGHT) * conflictRate_;
+
+    if (maxWriters_ != 0 &&
+        writersLimit_ < static_cast<double>(maxWriters_))
+    {
+      const size_t previous = static_cast<size_t>(writersLimit_);
+      writersLimit_ = std::min(static_cast<double>(maxWriters_), writersLimit_ + 1.0 / writersLimit_);
+
+      if (static_cast<size_t>(writersLimit_) != previous)
+      {
+        writersCondition_.notify_one();
+      }
+    }
+  }
+
+
+  void RetryPolicy::SignalConflict()
+  {
+    const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    conflicts_++;
+    conflictRate_ = (1.0 - CONFLICT_RATE_WEIGHT) * conflictRate_ + CONFLICT_RATE_WEIGHT;
+
+    if (maxWriters_ != 0 &&
+        now >= lastDecrease_ + boost::posix_time::seconds(1))
+    {
+      // The conflicts of the same burst only shrink the limit once
+      writersLimit_ = std::max(1.0, writersLimit_ / 2.0);
+      lastDecrease_ = now;
+    }
+  }
+
+
+  void RetryPolicy::GetStatistics(uint64_t& successes,
+                                  uint64_t& conflicts,
+                                  uint64_t& retries,
+                                  uint64_t& exhaustedRetries,
+                                  double& conflictRate)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    successes = successes_;
+    conflicts = conflicts_;
+    retries = retries_;
+    exhaustedRetries = exhaustedRetries_;
+    conflictRate = conflictRate_;
+  }
+}
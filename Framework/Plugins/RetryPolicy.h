@@ -0,0 +1,113 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <stdint.h>
+
+namespace OrthancDatabases
+{
+  /**
+   * Policy about the transactions that fail because of a collision
+   * between concurrent writers ("ErrorCode_DatabaseCannotSerialize").
+   * This class is shared by the index and by the storage area, and
+   * is thread-safe:
+   *
+   * - The delay before each retry is drawn at random between a base
+   *   delay and 3 times the previous delay, with an upper bound
+   *   (exponential backoff with decorrelated jitter).
+   *
+   * - Besides the first one, the retries of an operation consume a
+   *   budget that is refilled by the successful transactions, which
+   *   prevents the retries from taking over the database if most
+   *   transactions conflict.
+   *
+   * - If a maximum number of writers is set, the number of
+   *   concurrent writers is adapted to the conflicts: It is halved
+   *   at most once per second if conflicts occur, and slowly grows
+   *   back with the successes (additive increase, multiplicative
+   *   decrease).
+   **/
+  class RetryPolicy : public boost::noncopyable
+  {
+  private:
+    boost::mutex               mutex_;
+    boost::condition_variable  writersCondition_;
+    uint64_t                   seed_;
+    double                     retryBudget_;   // One token per retry
+    uint64_t                   successes_;
+    uint64_t                   conflicts_;
+    uint64_t                   retries_;
+    uint64_t                   exhaustedRetries_;
+    double                     conflictRate_;  // Moving average over the last transactions
+    size_t                     maxWriters_;    // "0" if the writers are not limited
+    double                     writersLimit_;
+    size_t                     activeWriters_;
+    boost::posix_time::ptime   lastDecrease_;
+
+  public:
+    class WriterSlot : public boost::noncopyable
+    {
+    private:
+      RetryPolicy*  policy_;  // NULL if the writers are not limited
+
+    public:
+      // Blocks until the number of concurrent writers is below the limit
+      explicit WriterSlot(RetryPolicy& policy);
+
+      ~WriterSlot();
+    };
+
+    RetryPolicy();
+
+    // "0" means that the number of concurrent writers is not limited
+    void SetMaxWriters(size_t count);
+
+    size_t GetMaxWriters();
+
+    size_t GetWritersLimit();
+
+    // Delay before the next attempt, in milliseconds, given the
+    // delay before the previous attempt ("0" for the first retry)
+    unsigned int GetNextDelay(unsigned int previousDelay);
+
+    // Returns "false" if the operation must not be retried anymore
+    bool TryRetry(unsigned int attempt /* number of previous retries */);
+
+    void SignalSuccess();
+
+    void SignalConflict();
+
+    // The conflict rate is between 0 and 1
+    void GetStatistics(uint64_t& successes,
+                       uint64_t& conflicts,
+                       uint64_t& retries,
+                       uint64_t& exhaustedRetries,
+                       double& conflictRate);
+  };
+}
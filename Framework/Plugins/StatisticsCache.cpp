@@ -0,0 +1,98 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "StatisticsCache.h"
+
+
+namespace OrthancDatabases
+{
+  StatisticsCache::StatisticsCache() :
+    hasStatistics_(false),
+    revision_(0)
+  {
+  }
+
+
+  void StatisticsCache::SetTimeToLive(unsigned int seconds)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    timeToLive_ = boost::posix_time::seconds(seconds);
+    hasStatistics_ = false;
+  }
+
+
+  bool StatisticsCache::IsEnabled()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return timeToLive_.total_seconds() != 0;
+  }
+
+
+  bool StatisticsCache::Lookup(Statistics& target,
+                               const boost::posix_time::ptime& now)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (hasStatistics_ &&
+        now < expiration_)
+    {
+      target = statistics_;
+      return true;
+    }
+    else
+    {
+      return false;
+    }
+  }
+
+
+  uint64_t StatisticsCache::GetRevision()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return revision_;
+  }
+
+
+  void StatisticsCache::Store(const Statistics& statistics,
+                              uint64_t revision,
+                              const boost::posix_time::ptime& now)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (timeToLive_.total_seconds() != 0 &&
+        revision == revision_)
+    {
+      hasStatistics_ = true;
+      statistics_ = statistics;
+      expiration_ = now + timeToLive_;
+    }
+  }
+
+
+  void StatisticsCache::Invalidate()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    hasStatistics_ = false;
+    revision_++;
+  }
+}
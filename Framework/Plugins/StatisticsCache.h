@@ -0,0 +1,89 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <stdint.h>
+
+
+namespace OrthancDatabases
+{
+  /**
+   * Remembers the statistics of the database (counts of resources and
+   * total sizes) during a short period of time, so that the periodic
+   * polling of "/statistics" doesn't query the database at each
+   * call. The statistics are invalidated by the writes of this
+   * process, and can be outdated by at most the time-to-live with
+   * respect to the writes of other processes. A snapshot can also be
+   * published by the housekeeping, in order to answer the read-only
+   * transactions on the replicas. This class is thread-safe.
+   **/
+  class StatisticsCache : public boost::noncopyable
+  {
+  public:
+    struct Statistics
+    {
+      int64_t  patientsCount_;
+      int64_t  studiesCount_;
+      int64_t  seriesCount_;
+      int64_t  instancesCount_;
+      int64_t  compressedSize_;
+      int64_t  uncompressedSize_;
+    };
+
+  private:
+    boost::mutex                      mutex_;
+    boost::posix_time::time_duration  timeToLive_;
+    bool                              hasStatistics_;
+    Statistics                        statistics_;
+    boost::posix_time::ptime          expiration_;
+    uint64_t                          revision_;
+
+  public:
+    StatisticsCache();
+
+    // "0" disables the cache
+    void SetTimeToLive(unsigned int seconds);
+
+    bool IsEnabled();
+
+    bool Lookup(Statistics& target,
+                const boost::posix_time::ptime& now);
+
+    /**
+     * The revision must be read before reading the statistics from
+     * the database: The statistics are not stored if a write has
+     * happened in the meantime, as they might miss this write.
+     **/
+    uint64_t GetRevision();
+
+    void Store(const Statistics& statistics,
+               uint64_t revision,
+               const boost::posix_time::ptime& now);
+
+    void Invalidate();
+  };
+}
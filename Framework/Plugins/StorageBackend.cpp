@@ -22,6 +22,8 @@
 
 
 #include "StorageBackend.h"
+#include "StorageCompression.h"
+#include "TracesExporter.h"
 
 #if HAS_ORTHANC_EXCEPTION != 1
 #  error HAS_ORTHANC_EXCEPTION must be set to 1
@@ -29,11 +31,14 @@
 
 #include "../../Framework/Common/BinaryStringValue.h"
 #include "../../Framework/Common/ResultFileValue.h"
+#include "../../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
 
 #include <Compatibility.h>  // For std::unique_ptr<>
 #include <Logging.h>
 #include <OrthancException.h>
+#include <Toolbox.h>
 
+#include <boost/lexical_cast.hpp>
 #include <boost/thread.hpp>
 #include <cassert>
 #include <limits>
@@ -59,6 +64,67 @@
 
 namespace OrthancDatabases
 {
+  // The files of the tier are not compressed, so that their ranges can be read
+  static void ReadWholeFromTier(StorageBackend::IFileContentVisitor& visitor,
+                                const FilesystemStorage& tier,
+                                const std::string& uuid)
+  {
+    if (visitor.IsZeroCopy())
+    {
+      const size_t size = static_cast<size_t>(tier.GetSize(uuid));
+      tier.ReadRange(visitor.AllocateBuffer(size), uuid, 0, size);
+      visitor.MarkAssigned();
+    }
+    else
+    {
+      std::string content;
+      tier.ReadWhole(content, uuid);
+      visitor.Assign(content);
+    }
+  }
+
+
+  static void ReadRangeFromTier(std::string& target,
+                                const FilesystemStorage& tier,
+                                const std::string& uuid,
+                                uint64_t start,
+                                size_t length)
+  {
+    target.resize(length);
+
+    if (length > 0)
+    {
+      tier.ReadRange(&target[0], uuid, start, length);
+    }
+  }
+
+
+  static void ReadRangeFromTier(StorageBackend::IFileContentVisitor& visitor,
+                                const FilesystemStorage& tier,
+                                const std::string& uuid,
+                                uint64_t start,
+                                size_t length)
+  {
+    if (visitor.IsZeroCopy())
+    {
+      tier.ReadRange(visitor.AllocateBuffer(length), uuid, start, length);
+      visitor.MarkAssigned();
+    }
+    else
+    {
+      std::string content;
+      ReadRangeFromTier(content, tier, uuid, start, length);
+      visitor.Assign(content);
+    }
+  }
+
+
+  static int64_t GetSecondsSinceEpoch(const boost::posix_time::ptime& time)
+  {
+    return static_cast<int64_t>((time - boost::posix_time::from_time_t(0)).total_seconds());
+  }
+
+
   class StorageBackend::ReadWholeOperation : public StorageBackend::IDatabaseOperation
   {
   private:
@@ -78,744 +144,3293 @@ namespace OrthancDatabases
 
     virtual void Execute(StorageBackend::IAccessor& accessor) ORTHANC_OVERRIDE
     {
-      accessor.ReadWhole(visitor_, uuid_, type_);
+      std::string uuid;
+      OrthancPluginContentType type;
+      accessor.ResolveContent(uuid, type, uuid_, type_);
+
+      FilesystemStorage* tier = accessor.LookupTier(uuid, type);
+      if (tier != NULL)
+      {
+        ReadWholeFromTier(visitor_, *tier, uuid);
+      }
+      else
+      {
+        accessor.ReadWhole(visitor_, uuid, type);
+      }
     }
   };
 
 
-  StorageBackend::StorageBackend(IDatabaseFactory* factory,
-                                 unsigned int maxRetries) :
-    manager_(factory),
-    maxRetries_(maxRetries)
-  {
-  }
-  
-  void StorageBackend::AccessorBase::Create(const std::string& uuid,
-                                            const void* content,
-                                            size_t size,
-                                            OrthancPluginContentType type)
+  /**
+   * All the connections of the pool are created from the same
+   * factory, that is owned by the storage backend. As a connection
+   * can be reopened from any thread (e.g. after a network failure),
+   * the calls to "Open()" are serialized.
+   **/
+  class StorageBackend::SharedFactory : public IDatabaseFactory
   {
-    DatabaseManager::Transaction transaction(manager_, TransactionType_ReadWrite);
+  private:
+    boost::mutex&      mutex_;
+    IDatabaseFactory&  factory_;
 
+  public:
+    SharedFactory(boost::mutex& mutex,
+                  IDatabaseFactory& factory) :
+      mutex_(mutex),
+      factory_(factory)
     {
-      DatabaseManager::CachedStatement statement(
-        STATEMENT_FROM_HERE, manager_,
-        "INSERT INTO StorageArea VALUES (${uuid}, ${content}, ${type})");
-     
-      statement.SetParameterType("uuid", ValueType_Utf8String);
-      statement.SetParameterType("content", ValueType_InputFile);
-      statement.SetParameterType("type", ValueType_Integer64);
-
-      Dictionary args;
-      args.SetUtf8Value("uuid", uuid);
-      args.SetFileValue("content", content, size);
-      args.SetIntegerValue("type", type);
-     
-      statement.Execute(args);
     }
 
-    transaction.Commit();
-  }
+    virtual IDatabase* Open() ORTHANC_OVERRIDE
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return factory_.Open();
+    }
+  };
 
 
-  void StorageBackend::AccessorBase::ReadWhole(StorageBackend::IFileContentVisitor& visitor,
-                                               const std::string& uuid,
-                                               OrthancPluginContentType type) 
+  class StorageBackend::VisitorAllocator : public ResultFileValue::IBufferAllocator
   {
-    DatabaseManager::Transaction transaction(manager_, TransactionType_ReadOnly);
+  private:
+    IFileContentVisitor&  visitor_;
+    void*                 buffer_;
+    size_t                size_;
 
+  public:
+    explicit VisitorAllocator(IFileContentVisitor& visitor) :
+      visitor_(visitor),
+      buffer_(NULL),
+      size_(0)
     {
-      DatabaseManager::CachedStatement statement(
-        STATEMENT_FROM_HERE, manager_,
-        "SELECT content FROM StorageArea WHERE uuid=${uuid} AND type=${type}");
-     
-      statement.SetParameterType("uuid", ValueType_Utf8String);
-      statement.SetParameterType("type", ValueType_Integer64);
+    }
 
-      Dictionary args;
-      args.SetUtf8Value("uuid", uuid);
-      args.SetIntegerValue("type", type);
-     
-      statement.Execute(args);
+    virtual void* Allocate(size_t size) ORTHANC_OVERRIDE
+    {
+      buffer_ = visitor_.AllocateBuffer(size);
+      size_ = size;
+      return buffer_;
+    }
 
-      if (statement.IsDone())
-      {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "ReadWhole: No content found for storage.");
-      }
-      else if (statement.GetResultFieldsCount() != 1)
-      {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);        
-      }
-      else
-      {
-        const IValue& value = statement.GetResultField(0);
-      
-        switch (value.GetType())
-        {
-          case ValueType_ResultFile:
-          {
-            std::string content;
-            dynamic_cast<const ResultFileValue&>(value).ReadWhole(content);
-            visitor.Assign(content);
-            break;
-          }
+    const void* GetBuffer() const
+    {
+      return buffer_;
+    }
 
-          case ValueType_BinaryString:
-            visitor.Assign(dynamic_cast<const BinaryStringValue&>(value).GetContent());
-            break;
+    size_t GetSize() const
+    {
+      return size_;
+    }
 
-          default:
-            throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);        
+    // Uncompresses the content if it was compressed by the storage area
+    void Finalize(bool compressed)
+    {
+      if (compressed)
+      {
+        std::string content;
+        StorageCompression::Uncompress(content, buffer_, size_);
+
+        void* target = visitor_.AllocateBuffer(content.size());
+        if (!content.empty())
+        {
+          memcpy(target, content.c_str(), content.size());
         }
       }
+
+      visitor_.MarkAssigned();
     }
+  };
 
-    transaction.Commit();
 
-    if (!visitor.IsSuccess())
+  static void AssignContent(StorageBackend::IFileContentVisitor& visitor,
+                            const std::string& content,
+                            bool compressed)
+  {
+    if (compressed)
     {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Could not read attachment from the storage area");
+      std::string uncompressed;
+      StorageCompression::Uncompress(uncompressed, content.c_str(), content.size());
+      visitor.Assign(uncompressed);
+    }
+    else
+    {
+      visitor.Assign(content);
     }
   }
 
 
-  void StorageBackend::AccessorBase::ReadRange(IFileContentVisitor& visitor,
-                                               const std::string& uuid,
-                                               OrthancPluginContentType type,
-                                               uint64_t start,
-                                               size_t length)
+  class StorageBackend::ManagerReference : public Orthanc::IDynamicObject
   {
-    /**
-     * This is a generic implementation, that will only work if
-     * "ResultFileValue" is implemented by the database backend. For
-     * instance, this will *not* work with MySQL, as the latter uses
-     * BLOB columns to store files.
-     **/
-    DatabaseManager::Transaction transaction(manager_, TransactionType_ReadOnly);
+  private:
+    DatabaseManager*  manager_;
+    unsigned int      shard_;
 
+  public:
+    ManagerReference(DatabaseManager& manager,
+                     unsigned int shard) :
+      manager_(&manager),
+      shard_(shard)
     {
-      DatabaseManager::CachedStatement statement(
-        STATEMENT_FROM_HERE, manager_,
-        "SELECT content FROM StorageArea WHERE uuid=${uuid} AND type=${type}");
-     
-      statement.SetParameterType("uuid", ValueType_Utf8String);
-      statement.SetParameterType("type", ValueType_Integer64);
+    }
 
-      Dictionary args;
-      args.SetUtf8Value("uuid", uuid);
-      args.SetIntegerValue("type", type);
-     
-      statement.Execute(args);
+    DatabaseManager& GetManager()
+    {
+      assert(manager_ != NULL);
+      return *manager_;
+    }
 
-      if (statement.IsDone())
-      {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "ReadRange: No content found for storage.");
-      }
-      else if (statement.GetResultFieldsCount() != 1)
-      {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);        
-      }
-      else
-      {
-        const IValue& value = statement.GetResultField(0);
-        if (value.GetType() == ValueType_ResultFile)
-        {
-          std::string content;
-          dynamic_cast<const ResultFileValue&>(value).ReadRange(content, start, length);
-          visitor.Assign(content);
-        }
-        else
-        {
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);        
-        }
-      }
+    unsigned int GetShard() const
+    {
+      return shard_;
     }
+  };
 
-    transaction.Commit();
 
-    if (!visitor.IsSuccess())
+  StorageBackend::StorageBackend(IDatabaseFactory* factory,
+                                 unsigned int maxRetries) :
+    factory_(factory),
+    countConnections_(0),
+    maxRetries_(maxRetries),
+    hasCompressedFiles_(false),
+    deferredRemove_(false),
+    deduplication_(false),
+    usageAccounting_(false),
+    deferredRemoveBatchSize_(0),
+    deferredRemoveInterval_(0),
+    deferredRemoveMaxRate_(0),
+    deferredRemoveStop_(false),
+    prefetchQueue_(1000),
+    prefetchStop_(false),
+    tieringAge_(0),
+    tieringBatchSize_(0),
+    tieringInterval_(0),
+    tieringStop_(false)
+  {
+    if (factory == NULL)
     {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Could not read attachment from the storage area");
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
     }
+
+    SetConnectionsCount(1);
   }
 
 
-  void StorageBackend::AccessorBase::Remove(const std::string& uuid,
-                                            OrthancPluginContentType type)
+  void StorageBackend::SetDicomDirectory(const std::string& root)
   {
-    DatabaseManager::Transaction transaction(manager_, TransactionType_ReadWrite);
+    dicomFilesystem_.reset(new FilesystemStorage(root));
+  }
 
+
+  StorageBackend::~StorageBackend()
+  {
     {
-      DatabaseManager::CachedStatement statement(
-        STATEMENT_FROM_HERE, manager_,
-        "DELETE FROM StorageArea WHERE uuid=${uuid} AND type=${type}");
-     
-      statement.SetParameterType("uuid", ValueType_Utf8String);
-      statement.SetParameterType("type", ValueType_Integer64);
+      boost::mutex::scoped_lock lock(deferredRemoveMutex_);
+      deferredRemoveStop_ = true;
+    }
 
-      Dictionary args;
-      args.SetUtf8Value("uuid", uuid);
-      args.SetIntegerValue("type", type);
-     
-      statement.Execute(args);
+    deferredRemoveCondition_.notify_all();
+
+    if (deferredRemoveThread_.joinable())
+    {
+      deferredRemoveThread_.join();
     }
-      
-    transaction.Commit();
-  }
-  
 
-  static OrthancPluginContext* context_ = NULL;
-  static std::unique_ptr<StorageBackend>  backend_;
-    
+    {
+      boost::mutex::scoped_lock lock(tieringMutex_);
+      tieringStop_ = true;
+    }
 
-  static OrthancPluginErrorCode StorageCreate(const char* uuid,
-                                              const void* content,
-                                              int64_t size,
-                                              OrthancPluginContentType type)
-  {
-    class Operation : public StorageBackend::IDatabaseOperation
+    tieringCondition_.notify_all();
+
+    if (tieringThread_.joinable())
     {
-    private:
-      const char*               uuid_;
-      const void*               content_;
-      int64_t                   size_;
-      OrthancPluginContentType  type_;
-      
-    public:
-      Operation(const char* uuid,
-                const void* content,
-                int64_t size,
-                OrthancPluginContentType type) :
-        uuid_(uuid),
-        content_(content),
-        size_(size),
-        type_(type)
-      {
-      }
-      
-      virtual void Execute(StorageBackend::IAccessor& accessor) ORTHANC_OVERRIDE
-      {
-        accessor.Create(uuid_, content_, size_, type_);
-      }
-    };
+      tieringThread_.join();
+    }
 
+    {
+      boost::mutex::scoped_lock lock(prefetchMutex_);
+      prefetchStop_ = true;
+    }
 
-    try
+    for (size_t i = 0; i < prefetchThreads_.size(); i++)
     {
-      if (backend_.get() == NULL)
+      assert(prefetchThreads_[i] != NULL);
+
+      if (prefetchThreads_[i]->joinable())
       {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+        prefetchThreads_[i]->join();
       }
-      else
+
+      delete prefetchThreads_[i];
+    }
+
+    for (size_t i = 0; i < connections_.size(); i++)
+    {
+      if (connections_[i] != NULL)
       {
-        Operation operation(uuid, content, size, type);
-        backend_->Execute(operation);
-        return OrthancPluginErrorCode_Success;
+        delete connections_[i];
       }
     }
-    ORTHANC_PLUGINS_DATABASE_CATCH;
   }
 
 
-#if defined(ORTHANC_PLUGINS_VERSION_IS_ABOVE)
-#  if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 9, 0)
-  static OrthancPluginErrorCode StorageReadWhole(OrthancPluginMemoryBuffer64* target,
-                                                 const char* uuid,
-                                                 OrthancPluginContentType type)
+  void StorageBackend::SetConnectionsCount(size_t count)
   {
-    class Visitor : public StorageBackend::IFileContentVisitor
+    if (count == 0)
     {
-    private:
-      OrthancPluginMemoryBuffer64* target_;
-      bool                         success_;
-      
-    public:
-      Visitor(OrthancPluginMemoryBuffer64* target) :
-        target_(target),
-        success_(false)
-      {
-        if (target == NULL)
-        {
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
-        }
-      }
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "There must be at least one connection to the storage area");
+    }
 
-      virtual bool IsSuccess() const ORTHANC_OVERRIDE
+    boost::mutex::scoped_lock lock(mutex_);
+
+    countConnections_ = count;
+
+    if (connections_.size() < count)
+    {
+      connections_.resize(count, NULL);
+    }
+
+    // The shards that were drained are reopened, the ones that are
+    // still in use (i.e. not drained yet) are simply kept
+    for (size_t i = 0; i < count; i++)
+    {
+      if (connections_[i] == NULL)
       {
-        return success_;
+        connections_[i] = new DatabaseManager(new SharedFactory(factoryMutex_, *factory_));
+        availableConnections_.Enqueue(new ManagerReference(*connections_[i], static_cast<unsigned int>(i)));
       }
-      
-      virtual void Assign(const std::string& content) ORTHANC_OVERRIDE
+    }
+
+    if (count < connections_.size())
+    {
+      /**
+       * Drain the available connections in excess. The connections
+       * that are in use are closed by the destructor of their
+       * accessor. As "mutex_" is locked, the accessors cannot give
+       * back their connection in the meantime.
+       **/
+      std::list<ManagerReference*> kept;
+      size_t closed = 0;
+
+      for (size_t i = 0; i < connections_.size(); i++)
       {
-        if (success_)
+        std::unique_ptr<Orthanc::IDynamicObject> reference(availableConnections_.Dequeue(1));
+        if (reference.get() == NULL)
         {
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+          break;  // The other connections are in use
+        }
+
+        const unsigned int shard = dynamic_cast<ManagerReference&>(*reference).GetShard();
+        if (shard < count)
+        {
+          kept.push_back(dynamic_cast<ManagerReference*>(reference.release()));
         }
         else
         {
-          assert(context_ != NULL);
-          
-          if (OrthancPluginCreateMemoryBuffer64(context_, target_, static_cast<uint64_t>(content.size())) !=
-              OrthancPluginErrorCode_Success)
-          {
-            throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory);
-          }
-
-          if (!content.empty())
-          {
-            memcpy(target_->data, content.c_str(), content.size());
-          }
-
-          success_ = true;
+          assert(connections_[shard] != NULL);
+          delete connections_[shard];
+          connections_[shard] = NULL;
+          closed++;
         }
       }
-    };
 
+      for (std::list<ManagerReference*>::iterator it = kept.begin(); it != kept.end(); ++it)
+      {
+        availableConnections_.Enqueue(*it);
+      }
 
-    try
-    {
-      if (backend_.get() == NULL)
+      while (!connections_.empty() &&
+             connections_.back() == NULL)
       {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+        connections_.pop_back();
       }
-      else
+
+      LOG(WARNING) << "The pool of connections to the storage area is shrunk to " << count
+                   << " connection(s), " << closed << " connection(s) closed immediately";
+    }
+  }
+
+
+  size_t StorageBackend::GetConnectionsCount()
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    return countConnections_;
+  }
+
+
+  void StorageBackend::SetCompressed(OrthancPluginContentType type,
+                                     bool compressed)
+  {
+    if (compressed)
+    {
+      if (!HasCompressedFiles())
       {
-        Visitor visitor(target);
+        AccessorBase accessor(*this);
+        DatabaseManager::Transaction transaction(accessor.GetManager(), TransactionType_ReadWrite);
 
+        // The files that were compressed by "Create()"
+        if (!transaction.GetDatabaseTransaction().DoesTableExist("StorageAreaCompressed"))
         {
-          StorageBackend::ReadWholeOperation operation(visitor, uuid, type);
-          backend_->Execute(operation);
+          transaction.GetDatabaseTransaction().ExecuteMultiLines(
+            "CREATE TABLE StorageAreaCompressed(uuid VARCHAR(64) NOT NULL, type INTEGER NOT NULL, "
+            "PRIMARY KEY(uuid, type))");
         }
 
-        return OrthancPluginErrorCode_Success;
+        transaction.Commit();
+
+        boost::mutex::scoped_lock lock(compressedFilesMutex_);
+        hasCompressedFiles_ = true;
       }
+
+      compressedContentTypes_.insert(type);
+    }
+    else
+    {
+      compressedContentTypes_.erase(type);
     }
-    ORTHANC_PLUGINS_DATABASE_CATCH;
   }
 
-  
-  static OrthancPluginErrorCode StorageReadRange(OrthancPluginMemoryBuffer64* target,
-                                                 const char* uuid,
-                                                 OrthancPluginContentType type,
-                                                 uint64_t start)
+
+  bool StorageBackend::IsCompressed(OrthancPluginContentType type) const
   {
-    class Visitor : public StorageBackend::IFileContentVisitor
+    return compressedContentTypes_.find(type) != compressedContentTypes_.end();
+  }
+
+
+  bool StorageBackend::HasCompressedFiles()
+  {
+    boost::mutex::scoped_lock lock(compressedFilesMutex_);
+    return hasCompressedFiles_;
+  }
+
+
+  bool StorageBackend::RefreshCompressedFiles(DatabaseManager& manager)
+  {
+    bool found;
+
     {
-    private:
-      OrthancPluginMemoryBuffer64* target_;  // This buffer is already allocated by the Orthanc core
-      bool                         success_;
-      
-    public:
-      Visitor(OrthancPluginMemoryBuffer64* target) :
-        target_(target),
-        success_(false)
-      {
-        if (target == NULL)
-        {
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
-        }
-      }
+      DatabaseManager::Transaction transaction(manager, TransactionType_ReadOnly);
+      found = transaction.GetDatabaseTransaction().DoesTableExist("StorageAreaCompressed");
+      transaction.Commit();
+    }
 
-      virtual bool IsSuccess() const ORTHANC_OVERRIDE
-      {
-        return success_;
-      }
-      
-      virtual void Assign(const std::string& content) ORTHANC_OVERRIDE
-      {
-        if (success_)
-        {
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
-        }
-        else
-        {
-          if (content.size() != target_->size)
-          {
-            throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
-          }
-          
-          if (!content.empty())
-          {
-            memcpy(target_->data, content.c_str(), content.size());
-          }
+    boost::mutex::scoped_lock lock(compressedFilesMutex_);
+    hasCompressedFiles_ = found;
+    return found;
+  }
 
-          success_ = true;
-        }
-      }
-    };
 
+  void StorageBackend::UnregisterCompression(DatabaseManager& manager,
+                                             const std::string& uuid,
+                                             OrthancPluginContentType type)
+  {
+    if (HasCompressedFiles())
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "DELETE FROM StorageAreaCompressed WHERE uuid=${uuid} AND type=${type}");
 
-    class Operation : public StorageBackend::IDatabaseOperation
+      statement.SetParameterType("uuid", ValueType_Utf8String);
+      statement.SetParameterType("type", ValueType_Integer64);
+
+      Dictionary args;
+      args.SetUtf8Value("uuid", uuid);
+      args.SetIntegerValue("type", type);
+
+      statement.Execute(args);
+    }
+  }
+
+
+  bool StorageBackend::AccessorBase::IsCompressedFile(const std::string& uuid,
+                                                      OrthancPluginContentType type)
+  {
+    if (!backend_.HasCompressedFiles())
     {
-    private:
-      Visitor&                  visitor_;
-      const char*               uuid_;
-      OrthancPluginContentType  type_;
-      uint64_t                  start_;
-      size_t                    length_;
+      return false;
+    }
 
-    public:
-      Operation(Visitor& visitor,
-                const char* uuid,
-                OrthancPluginContentType type,
-                uint64_t start,
-                size_t length) :
-        visitor_(visitor),
-        uuid_(uuid),
-        type_(type),
-        start_(start),
-        length_(length)
-      {
-      }
+    bool compressed;
+
+    {
+      DatabaseManager::Transaction transaction(*manager_, TransactionType_ReadOnly);
 
-      virtual void Execute(StorageBackend::IAccessor& accessor) ORTHANC_OVERRIDE
       {
-        accessor.ReadRange(visitor_, uuid_, type_, start_, length_);
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, *manager_,
+          "SELECT COUNT(*) FROM StorageAreaCompressed WHERE uuid=${uuid} AND type=${type}");
+
+        statement.SetReadOnly(true);
+        statement.SetParameterType("uuid", ValueType_Utf8String);
+        statement.SetParameterType("type", ValueType_Integer64);
+
+        Dictionary args;
+        args.SetUtf8Value("uuid", uuid);
+        args.SetIntegerValue("type", type);
+
+        statement.Execute(args);
+        statement.SetResultFieldType(0, ValueType_Integer64);
+        compressed = (statement.ReadInteger64(0) != 0);
       }
-    };
 
+      transaction.Commit();
+    }
 
-    try
+    return compressed;
+  }
+
+
+  bool StorageBackend::AccessorBase::IsCompressedContent(const std::string& uuid,
+                                                         OrthancPluginContentType type,
+                                                         const void* content,
+                                                         size_t size)
+  {
+    if (!StorageCompression::HasSignature(content, size))
     {
-      if (backend_.get() == NULL)
+      return false;
+    }
+    else if (!backend_.HasCompressedFiles() &&
+             !backend_.RefreshCompressedFiles(*manager_))
+    {
+      return false;  // No file was ever compressed
+    }
+    else
+    {
+      return IsCompressedFile(uuid, type);
+    }
+  }
+
+
+  StorageBackend::AccessorBase::AccessorBase(StorageBackend& backend) :
+    backend_(backend),
+    manager_(NULL),
+    shard_(0)
+  {
+    for (;;)
+    {
+      std::unique_ptr<Orthanc::IDynamicObject> manager(backend.availableConnections_.Dequeue(100));
+      if (manager.get() != NULL)
       {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+        manager_ = &dynamic_cast<ManagerReference&>(*manager).GetManager();
+        shard_ = dynamic_cast<ManagerReference&>(*manager).GetShard();
+        return;
       }
-      else
-      {
-        Visitor visitor(target);
+    }
+  }
 
-        {
-          Operation operation(visitor, uuid, type, start, target->size);
-          backend_->Execute(operation);
-        }
 
-        return OrthancPluginErrorCode_Success;
+  StorageBackend::AccessorBase::~AccessorBase()
+  {
+    assert(manager_ != NULL);
+
+    boost::mutex::scoped_lock lock(backend_.mutex_);
+
+    if (shard_ < backend_.countConnections_)
+    {
+      backend_.availableConnections_.Enqueue(new ManagerReference(*manager_, shard_));
+    }
+    else
+    {
+      // The pool was shrunk while the connection was in use
+      assert(shard_ < backend_.connections_.size() &&
+             backend_.connections_[shard_] == manager_);
+      delete manager_;
+      backend_.connections_[shard_] = NULL;
+
+      while (!backend_.connections_.empty() &&
+             backend_.connections_.back() == NULL)
+      {
+        backend_.connections_.pop_back();
       }
     }
-    ORTHANC_PLUGINS_DATABASE_CATCH;
   }
-#  endif
-#endif
 
-  
-  static OrthancPluginErrorCode StorageRead(void** data,
-                                            int64_t* size,
-                                            const char* uuid,
-                                            OrthancPluginContentType type)
+
+  void StorageBackend::AccessorBase::EnsureUsageRow(OrthancPluginContentType type)
   {
-    class Visitor : public StorageBackend::IFileContentVisitor
+    const std::pair<int32_t, unsigned int> row(static_cast<int32_t>(type), shard_);
+
     {
-    private:
-      void**    data_;
-      int64_t*  size_;
-      bool      success_;
-      
-    public:
-      Visitor(void** data,
-              int64_t* size) :
-        data_(data),
-        size_(size),
-        success_(false)
+      boost::mutex::scoped_lock lock(backend_.usageMutex_);
+      if (backend_.usageRows_.find(row) != backend_.usageRows_.end())
       {
+        return;
       }
+    }
+
+    try
+    {
+      DatabaseManager::Transaction transaction(*manager_, TransactionType_ReadWrite);
+
+      Dictionary args;
+      args.SetIntegerValue("type", type);
+      args.SetIntegerValue("shard", shard_);
+
+      bool exists;
 
-      ~Visitor()
       {
-        if (data_ != NULL /* this condition is invalidated by "Release()" */ &&
-            *data_ != NULL)
-        {
-          free(*data_);
-        }
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, *manager_,
+          "SELECT COUNT(*) FROM StorageAreaUsage WHERE type=${type} AND shard=${shard}");
+
+        statement.SetReadOnly(true);
+        statement.SetParameterType("type", ValueType_Integer64);
+        statement.SetParameterType("shard", ValueType_Integer64);
+        statement.Execute(args);
+
+        exists = (statement.ReadInteger64(0) != 0);
       }
 
-      void Release()
+      if (!exists)
       {
-        data_ = NULL;
-      }      
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, *manager_,
+          "INSERT INTO StorageAreaUsage VALUES(${type}, ${shard}, 0, 0)");
 
-      virtual bool IsSuccess() const ORTHANC_OVERRIDE
-      {
-        return success_;
+        statement.SetParameterType("type", ValueType_Integer64);
+        statement.SetParameterType("shard", ValueType_Integer64);
+        statement.Execute(args);
       }
-      
-      virtual void Assign(const std::string& content) ORTHANC_OVERRIDE
-      {
-        if (success_)
-        {
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
-        }
-        else if (data_ == NULL)
+
+      transaction.Commit();
+    }
+    catch (Orthanc::OrthancException&)
+    {
+      // The row was concurrently created by another Orthanc server
+      // that shares the same database
+      return;
+    }
+
+    boost::mutex::scoped_lock lock(backend_.usageMutex_);
+    backend_.usageRows_.insert(row);
+  }
+
+
+  void StorageBackend::AccessorBase::AccountCreation(const std::string& uuid,
+                                                     OrthancPluginContentType type,
+                                                     size_t size)
+  {
+    Dictionary args;
+    args.SetUtf8Value("uuid", uuid);
+    args.SetIntegerValue("type", type);
+    args.SetIntegerValue("shard", shard_);
+    args.SetIntegerValue("size", static_cast<int64_t>(size));
+
+    {
+      // The shard is remembered, as the file can be removed through another connection
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, *manager_,
+        "INSERT INTO StorageAreaSizes VALUES(${uuid}, ${type}, ${size}, ${shard})");
+
+      statement.SetParameterType("uuid", ValueType_Utf8String);
+      statement.SetParameterType("type", ValueType_Integer64);
+      statement.SetParameterType("size", ValueType_Integer64);
+      statement.SetParameterType("shard", ValueType_Integer64);
+      statement.Execute(args);
+    }
+
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, *manager_,
+        "UPDATE StorageAreaUsage SET filesCount = filesCount + 1, totalSize = totalSize + ${size} "
+        "WHERE type=${type} AND shard=${shard}");
+
+      statement.SetParameterType("type", ValueType_Integer64);
+      statement.SetParameterType("size", ValueType_Integer64);
+      statement.SetParameterType("shard", ValueType_Integer64);
+      statement.Execute(args);
+    }
+  }
+
+
+  void StorageBackend::AccountRemoval(DatabaseManager& manager,
+                                      const std::string& uuid,
+                                      OrthancPluginContentType type)
+  {
+    Dictionary args;
+    args.SetUtf8Value("uuid", uuid);
+    args.SetIntegerValue("type", type);
+
+    int64_t size, shard;
+
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "SELECT size, shard FROM StorageAreaSizes WHERE uuid=${uuid} AND type=${type}");
+
+      statement.SetReadOnly(true);
+      statement.SetParameterType("uuid", ValueType_Utf8String);
+      statement.SetParameterType("type", ValueType_Integer64);
+      statement.Execute(args);
+
+      if (statement.IsDone())
+      {
+        return;  // This file was written before the accounting was enabled
+      }
+
+      size = statement.ReadInteger64(0);
+      shard = statement.ReadInteger64(1);
+    }
+
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "DELETE FROM StorageAreaSizes WHERE uuid=${uuid} AND type=${type}");
+
+      statement.SetParameterType("uuid", ValueType_Utf8String);
+      statement.SetParameterType("type", ValueType_Integer64);
+      statement.Execute(args);
+    }
+
+    {
+      args.SetIntegerValue("size", size);
+      args.SetIntegerValue("shard", shard);
+
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "UPDATE StorageAreaUsage SET filesCount = filesCount - 1, totalSize = totalSize - ${size} "
+        "WHERE type=${type} AND shard=${shard}");
+
+      statement.SetParameterType("type", ValueType_Integer64);
+      statement.SetParameterType("size", ValueType_Integer64);
+      statement.SetParameterType("shard", ValueType_Integer64);
+      statement.Execute(args);
+    }
+  }
+
+  
+  bool StorageBackend::AccessorBase::CreateDuplicate(const std::string& uuid,
+                                                     OrthancPluginContentType type,
+                                                     const std::string& hash)
+  {
+    DatabaseManager::Transaction transaction(*manager_, TransactionType_ReadWrite);
+
+    {
+      // Locks the row, so that a concurrent "Remove()" cannot drop the shared content
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, *manager_,
+        "UPDATE StorageAreaContents SET refCount = refCount + 1 WHERE contentHash=${hash}");
+
+      statement.SetParameterType("hash", ValueType_Utf8String);
+
+      Dictionary args;
+      args.SetUtf8Value("hash", hash);
+
+      statement.Execute(args);
+    }
+
+    bool found;
+
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, *manager_,
+        "SELECT uuid FROM StorageAreaContents WHERE contentHash=${hash}");
+
+      statement.SetReadOnly(true);
+      statement.SetParameterType("hash", ValueType_Utf8String);
+
+      Dictionary args;
+      args.SetUtf8Value("hash", hash);
+
+      statement.Execute(args);
+      found = !statement.IsDone();
+    }
+
+    if (found)
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, *manager_,
+        "INSERT INTO StorageAreaDuplicates VALUES(${uuid}, ${type}, ${hash})");
+
+      statement.SetParameterType("uuid", ValueType_Utf8String);
+      statement.SetParameterType("type", ValueType_Integer64);
+      statement.SetParameterType("hash", ValueType_Utf8String);
+
+      Dictionary args;
+      args.SetUtf8Value("uuid", uuid);
+      args.SetIntegerValue("type", type);
+      args.SetUtf8Value("hash", hash);
+
+      statement.Execute(args);
+    }
+
+    transaction.Commit();
+    return found;
+  }
+
+
+  void StorageBackend::AccessorBase::RegisterContent(const std::string& uuid,
+                                                     OrthancPluginContentType type,
+                                                     const std::string& hash)
+  {
+    try
+    {
+      DatabaseManager::Transaction transaction(*manager_, TransactionType_ReadWrite);
+
+      {
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, *manager_,
+          "INSERT INTO StorageAreaContents VALUES(${hash}, ${uuid}, ${type}, 1)");
+
+        statement.SetParameterType("hash", ValueType_Utf8String);
+        statement.SetParameterType("uuid", ValueType_Utf8String);
+        statement.SetParameterType("type", ValueType_Integer64);
+
+        Dictionary args;
+        args.SetUtf8Value("hash", hash);
+        args.SetUtf8Value("uuid", uuid);
+        args.SetIntegerValue("type", type);
+
+        statement.Execute(args);
+      }
+
+      transaction.Commit();
+    }
+    catch (Orthanc::OrthancException&)
+    {
+      // The same content was concurrently written by another file:
+      // The file is kept, but it cannot be shared
+      LOG(INFO) << "Storage area: File " << uuid << " is not deduplicated";
+    }
+  }
+
+
+  void StorageBackend::AccessorBase::Create(const std::string& uuid,
+                                            const void* content,
+                                            size_t size,
+                                            OrthancPluginContentType type)
+  {
+    std::string hash;
+
+    if (backend_.IsDeduplication())
+    {
+      // The hash is computed before the compression
+      Orthanc::Toolbox::ComputeSHA1(hash, content, size);
+      hash += "-" + boost::lexical_cast<std::string>(size);
+
+      if (CreateDuplicate(uuid, type, hash))
+      {
+        return;  // The content is already stored
+      }
+    }
+
+    std::string compressed;
+    bool isCompressed = false;
+
+    if (backend_.IsCompressed(type) &&
+        !StorageCompression::HasCompressedTransferSyntax(content, size) &&
+        StorageCompression::Compress(compressed, content, size))
+    {
+      content = compressed.c_str();
+      size = compressed.size();
+      isCompressed = true;
+    }
+
+    if (backend_.IsUsageAccounting())
+    {
+      EnsureUsageRow(type);
+    }
+
+    {
+      DatabaseManager::Transaction transaction(*manager_, TransactionType_ReadWrite);
+
+      InsertContent(uuid, content, size, type);
+
+      if (isCompressed)
+      {
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, *manager_,
+          "INSERT INTO StorageAreaCompressed VALUES(${uuid}, ${type})");
+
+        statement.SetParameterType("uuid", ValueType_Utf8String);
+        statement.SetParameterType("type", ValueType_Integer64);
+
+        Dictionary args;
+        args.SetUtf8Value("uuid", uuid);
+        args.SetIntegerValue("type", type);
+
+        statement.Execute(args);
+      }
+
+      if (backend_.IsUsageAccounting())
+      {
+        AccountCreation(uuid, type, size);
+      }
+
+      if (backend_.IsTiering())
+      {
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, *manager_,
+          "INSERT INTO StorageAreaAges VALUES(${uuid}, ${type}, ${creation})");
+
+        statement.SetParameterType("uuid", ValueType_Utf8String);
+        statement.SetParameterType("type", ValueType_Integer64);
+        statement.SetParameterType("creation", ValueType_Integer64);
+
+        Dictionary args;
+        args.SetUtf8Value("uuid", uuid);
+        args.SetIntegerValue("type", type);
+        args.SetIntegerValue("creation", GetSecondsSinceEpoch(boost::posix_time::microsec_clock::universal_time()));
+
+        statement.Execute(args);
+      }
+
+      transaction.Commit();
+    }
+
+    if (!hash.empty())
+    {
+      RegisterContent(uuid, type, hash);
+    }
+  }
+
+
+  void StorageBackend::AccessorBase::InsertContent(const std::string& uuid,
+                                                   const void* content,
+                                                   size_t size,
+                                                   OrthancPluginContentType type)
+  {
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, *manager_,
+      "INSERT INTO StorageArea VALUES (${uuid}, ${content}, ${type})");
+
+    statement.SetParameterType("uuid", ValueType_Utf8String);
+    statement.SetParameterType("content", ValueType_InputFile);
+    statement.SetParameterType("type", ValueType_Integer64);
+
+    Dictionary args;
+    args.SetUtf8Value("uuid", uuid);
+    args.SetFileValue("content", content, size);
+    args.SetIntegerValue("type", type);
+
+    statement.Execute(args);
+  }
+
+
+  void StorageBackend::AccessorBase::ReadWhole(StorageBackend::IFileContentVisitor& visitor,
+                                               const std::string& uuid,
+                                               OrthancPluginContentType type) 
+  {
+    // The compression is looked up once the content has been read
+    VisitorAllocator allocator(visitor);
+    std::string content;
+    bool zeroCopy = false;
+
+    {
+      DatabaseManager::Transaction transaction(*manager_, TransactionType_ReadOnly);
+
+      {
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, *manager_,
+          "SELECT content FROM StorageArea WHERE uuid=${uuid} AND type=${type}");
+     
+        statement.SetParameterType("uuid", ValueType_Utf8String);
+        statement.SetParameterType("type", ValueType_Integer64);
+
+        Dictionary args;
+        args.SetUtf8Value("uuid", uuid);
+        args.SetIntegerValue("type", type);
+     
+        statement.Execute(args);
+
+        if (statement.IsDone())
         {
-          // "Release()" has been called
-          throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "ReadWhole: No content found for storage.");
+        }
+        else if (statement.GetResultFieldsCount() != 1)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);        
         }
         else
         {
-          if (content.empty())
-          {
-            *data_ = NULL;
-            *size_ = 0;
-          }
-          else
+          const IValue& value = statement.GetResultField(0);
+      
+          switch (value.GetType())
           {
-            *size_ = static_cast<int64_t>(content.size());
-    
-            if (static_cast<size_t>(*size_) != content.size())
+            case ValueType_ResultFile:
             {
-              throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory,
-                                              "File cannot be stored in a 63bit buffer");
+              if (visitor.IsZeroCopy())
+              {
+                dynamic_cast<const ResultFileValue&>(value).ReadWhole(allocator);
+                zeroCopy = true;
+              }
+              else
+              {
+                dynamic_cast<const ResultFileValue&>(value).ReadWhole(content);
+              }
+              break;
             }
 
-            *data_ = malloc(*size_);
-            if (*data_ == NULL)
-            {
-              throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory);
-            }
+            case ValueType_BinaryString:
+              content = dynamic_cast<const BinaryStringValue&>(value).GetContent();
+              break;
 
-            memcpy(*data_, content.c_str(), *size_);
+            default:
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);        
           }
-          
-          success_ = true;
         }
       }
-    };
 
+      transaction.Commit();
+    }
 
-    try
+    if (zeroCopy)
     {
-      if (backend_.get() == NULL)
+      allocator.Finalize(IsCompressedContent(uuid, type, allocator.GetBuffer(), allocator.GetSize()));
+    }
+    else
+    {
+      AssignContent(visitor, content, IsCompressedContent(uuid, type, content.c_str(), content.size()));
+    }
+
+    if (!visitor.IsSuccess())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Could not read attachment from the storage area");
+    }
+  }
+
+
+  void StorageBackend::AccessorBase::ReadRange(IFileContentVisitor& visitor,
+                                               const std::string& uuid,
+                                               OrthancPluginContentType type,
+                                               uint64_t start,
+                                               size_t length)
+  {
+    if (IsCompressedFile(uuid, type))
+    {
+      // The offsets in a compressed file are meaningless
+      std::string content;
+      ReadWholeToString(content, *this, uuid, type);
+
+      if (start + length > content.size())
       {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRange);
       }
-      else if (data == NULL ||
-               size == NULL)
+
+      visitor.Assign(content.substr(start, length));
+      return;
+    }
+
+    /**
+     * This is a generic implementation, that will only work if
+     * "ResultFileValue" is implemented by the database backend. For
+     * instance, this will *not* work with MySQL, as the latter uses
+     * BLOB columns to store files.
+     **/
+    DatabaseManager::Transaction transaction(*manager_, TransactionType_ReadOnly);
+
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, *manager_,
+        "SELECT content FROM StorageArea WHERE uuid=${uuid} AND type=${type}");
+     
+      statement.SetParameterType("uuid", ValueType_Utf8String);
+      statement.SetParameterType("type", ValueType_Integer64);
+
+      Dictionary args;
+      args.SetUtf8Value("uuid", uuid);
+      args.SetIntegerValue("type", type);
+     
+      statement.Execute(args);
+
+      if (statement.IsDone())
       {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "ReadRange: No content found for storage.");
+      }
+      else if (statement.GetResultFieldsCount() != 1)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);        
+      }
+      else
+      {
+        const IValue& value = statement.GetResultField(0);
+        if (value.GetType() == ValueType_ResultFile)
+        {
+          if (visitor.IsZeroCopy())
+          {
+            void* target = visitor.AllocateBuffer(length);
+            dynamic_cast<const ResultFileValue&>(value).ReadRange(target, start, length);
+            visitor.MarkAssigned();
+          }
+          else
+          {
+            std::string content;
+            dynamic_cast<const ResultFileValue&>(value).ReadRange(content, start, length);
+            visitor.Assign(content);
+          }
+        }
+        else
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);        
+        }
+      }
+    }
+
+    transaction.Commit();
+
+    if (!visitor.IsSuccess())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Could not read attachment from the storage area");
+    }
+  }
+
+
+  void StorageBackend::AccessorBase::ReadRange(IFileChunkVisitor& visitor,
+                                               const std::string& uuid,
+                                               OrthancPluginContentType type,
+                                               uint64_t start,
+                                               size_t length,
+                                               size_t chunkSize)
+  {
+    if (IsCompressedFile(uuid, type))
+    {
+      std::string content;
+      ReadWholeToString(content, *this, uuid, type);
+
+      if (start + length > content.size())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRange);
+      }
+
+      ResultFileValue::VisitChunks(visitor, (length == 0 ? NULL : content.c_str() + start), length, chunkSize);
+      return;
+    }
+
+    DatabaseManager::Transaction transaction(*manager_, TransactionType_ReadOnly);
+
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, *manager_,
+        "SELECT content FROM StorageArea WHERE uuid=${uuid} AND type=${type}");
+     
+      statement.SetParameterType("uuid", ValueType_Utf8String);
+      statement.SetParameterType("type", ValueType_Integer64);
+
+      Dictionary args;
+      args.SetUtf8Value("uuid", uuid);
+      args.SetIntegerValue("type", type);
+     
+      statement.Execute(args);
+
+      if (statement.IsDone())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "ReadRange: No content found for storage.");
+      }
+      else if (statement.GetResultFieldsCount() != 1)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);        
+      }
+      else
+      {
+        const IValue& value = statement.GetResultField(0);
+
+        switch (value.GetType())
+        {
+          case ValueType_ResultFile:
+            dynamic_cast<const ResultFileValue&>(value).ReadRange(visitor, start, length, chunkSize);
+            break;
+
+          case ValueType_BinaryString:
+          {
+            // The database has returned the whole file (e.g. BLOB column)
+            const BinaryStringValue& content = dynamic_cast<const BinaryStringValue&>(value);
+            if (start + length > content.GetSize())
+            {
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRange);
+            }
+
+            ResultFileValue::VisitChunks(visitor, (length == 0 ? NULL : content.GetContent().c_str() + start),
+                                         length, chunkSize);
+            break;
+          }
+
+          default:
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);        
+        }
+      }
+    }
+
+    transaction.Commit();
+  }
+
+
+  void StorageBackend::AccessorBase::ResolveContent(std::string& targetUuid,
+                                                    OrthancPluginContentType& targetType,
+                                                    const std::string& uuid,
+                                                    OrthancPluginContentType type)
+  {
+    targetUuid = uuid;
+    targetType = type;
+
+    if (!backend_.IsDeduplication())
+    {
+      return;
+    }
+
+    DatabaseManager::Transaction transaction(*manager_, TransactionType_ReadOnly);
+
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, *manager_,
+        "SELECT c.uuid, c.type FROM StorageAreaDuplicates AS d "
+        "INNER JOIN StorageAreaContents AS c ON c.contentHash = d.contentHash "
+        "WHERE d.uuid=${uuid} AND d.type=${type}");
+
+      statement.SetReadOnly(true);
+      statement.SetParameterType("uuid", ValueType_Utf8String);
+      statement.SetParameterType("type", ValueType_Integer64);
+
+      Dictionary args;
+      args.SetUtf8Value("uuid", uuid);
+      args.SetIntegerValue("type", type);
+
+      statement.Execute(args);
+
+      if (!statement.IsDone())
+      {
+        targetUuid = statement.ReadString(0);
+        targetType = static_cast<OrthancPluginContentType>(statement.ReadInteger32(1));
+        transaction.Commit();
+        return;
+      }
+    }
+
+    {
+      // The row of "StorageArea" of a removed owner is kept for its duplicates
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, *manager_,
+        "SELECT 1 FROM StorageAreaRemovedOwners WHERE uuid=${uuid} AND type=${type}");
+
+      statement.SetReadOnly(true);
+      statement.SetParameterType("uuid", ValueType_Utf8String);
+      statement.SetParameterType("type", ValueType_Integer64);
+
+      Dictionary args;
+      args.SetUtf8Value("uuid", uuid);
+      args.SetIntegerValue("type", type);
+
+      statement.Execute(args);
+
+      if (!statement.IsDone())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource, "The file was removed: " + uuid);
+      }
+    }
+
+    transaction.Commit();
+  }
+
+
+  FilesystemStorage* StorageBackend::AccessorBase::LookupTier(const std::string& uuid,
+                                                              OrthancPluginContentType type)
+  {
+    if (!backend_.IsTiering())
+    {
+      return NULL;
+    }
+
+    bool tiered;
+
+    {
+      DatabaseManager::Transaction transaction(*manager_, TransactionType_ReadOnly);
+
+      {
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, *manager_,
+          "SELECT COUNT(*) FROM StorageAreaTiered WHERE uuid=${uuid} AND type=${type}");
+
+        statement.SetReadOnly(true);
+        statement.SetParameterType("uuid", ValueType_Utf8String);
+        statement.SetParameterType("type", ValueType_Integer64);
+
+        Dictionary args;
+        args.SetUtf8Value("uuid", uuid);
+        args.SetIntegerValue("type", type);
+
+        statement.Execute(args);
+        tiered = (statement.ReadInteger64(0) != 0);
+      }
+
+      transaction.Commit();
+    }
+
+    return (tiered ? backend_.tierFilesystem_.get() : NULL);
+  }
+
+
+  bool StorageBackend::UnregisterTiering(DatabaseManager& manager,
+                                         const std::string& uuid,
+                                         OrthancPluginContentType type)
+  {
+    if (!IsTiering())
+    {
+      return false;
+    }
+
+    Dictionary args;
+    args.SetUtf8Value("uuid", uuid);
+    args.SetIntegerValue("type", type);
+
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "DELETE FROM StorageAreaAges WHERE uuid=${uuid} AND type=${type}");
+
+      statement.SetParameterType("uuid", ValueType_Utf8String);
+      statement.SetParameterType("type", ValueType_Integer64);
+      statement.Execute(args);
+    }
+
+    bool tiered;
+
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "SELECT COUNT(*) FROM StorageAreaTiered WHERE uuid=${uuid} AND type=${type}");
+
+      statement.SetReadOnly(true);
+      statement.SetParameterType("uuid", ValueType_Utf8String);
+      statement.SetParameterType("type", ValueType_Integer64);
+      statement.Execute(args);
+
+      tiered = (statement.ReadInteger64(0) != 0);
+    }
+
+    if (tiered)
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "DELETE FROM StorageAreaTiered WHERE uuid=${uuid} AND type=${type}");
+
+      statement.SetParameterType("uuid", ValueType_Utf8String);
+      statement.SetParameterType("type", ValueType_Integer64);
+      statement.Execute(args);
+    }
+
+    return tiered;
+  }
+
+
+  void StorageBackend::AccessorBase::Remove(const std::string& uuid,
+                                            OrthancPluginContentType type)
+  {
+    DatabaseManager::Transaction transaction(*manager_, TransactionType_ReadWrite);
+
+    // The file whose row of "StorageArea" must be removed
+    std::string targetUuid = uuid;
+    OrthancPluginContentType targetType = type;
+
+    if (backend_.IsDeduplication())
+    {
+      std::string hash;
+
+      {
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, *manager_,
+          "SELECT contentHash FROM StorageAreaDuplicates WHERE uuid=${uuid} AND type=${type}");
+
+        statement.SetReadOnly(true);
+        statement.SetParameterType("uuid", ValueType_Utf8String);
+        statement.SetParameterType("type", ValueType_Integer64);
+
+        Dictionary args;
+        args.SetUtf8Value("uuid", uuid);
+        args.SetIntegerValue("type", type);
+
+        statement.Execute(args);
+
+        if (!statement.IsDone())
+        {
+          hash = statement.ReadString(0);
+        }
+      }
+
+      if (!hash.empty())
+      {
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, *manager_,
+          "DELETE FROM StorageAreaDuplicates WHERE uuid=${uuid} AND type=${type}");
+
+        statement.SetParameterType("uuid", ValueType_Utf8String);
+        statement.SetParameterType("type", ValueType_Integer64);
+
+        Dictionary args;
+        args.SetUtf8Value("uuid", uuid);
+        args.SetIntegerValue("type", type);
+
+        statement.Execute(args);
+      }
+      else
+      {
+        // Is this file the first one that has stored a shared content?
+        bool removedOwner = false;
+
+        {
+          DatabaseManager::CachedStatement statement(
+            STATEMENT_FROM_HERE, *manager_,
+            "SELECT c.contentHash, r.uuid FROM StorageAreaContents AS c "
+            "LEFT JOIN StorageAreaRemovedOwners AS r ON r.uuid = c.uuid AND r.type = c.type "
+            "WHERE c.uuid=${uuid} AND c.type=${type}");
+
+          statement.SetReadOnly(true);
+          statement.SetParameterType("uuid", ValueType_Utf8String);
+          statement.SetParameterType("type", ValueType_Integer64);
+
+          Dictionary args;
+          args.SetUtf8Value("uuid", uuid);
+          args.SetIntegerValue("type", type);
+
+          statement.Execute(args);
+
+          if (!statement.IsDone())
+          {
+            hash = statement.ReadString(0);
+            removedOwner = !statement.IsNull(1);
+          }
+        }
+
+        if (removedOwner)
+        {
+          // The file was already removed, its content is kept for the duplicates
+          transaction.Commit();
+          return;
+        }
+      }
+
+      if (!hash.empty())
+      {
+        {
+          DatabaseManager::CachedStatement statement(
+            STATEMENT_FROM_HERE, *manager_,
+            "UPDATE StorageAreaContents SET refCount = refCount - 1 WHERE contentHash=${hash}");
+
+          statement.SetParameterType("hash", ValueType_Utf8String);
+
+          Dictionary args;
+          args.SetUtf8Value("hash", hash);
+
+          statement.Execute(args);
+        }
+
+        int64_t refCount = 0;
+
+        {
+          DatabaseManager::CachedStatement statement(
+            STATEMENT_FROM_HERE, *manager_,
+            "SELECT uuid, type, refCount FROM StorageAreaContents WHERE contentHash=${hash}");
+
+          statement.SetReadOnly(true);
+          statement.SetParameterType("hash", ValueType_Utf8String);
+
+          Dictionary args;
+          args.SetUtf8Value("hash", hash);
+
+          statement.Execute(args);
+
+          if (!statement.IsDone())
+          {
+            targetUuid = statement.ReadString(0);
+            targetType = static_cast<OrthancPluginContentType>(statement.ReadInteger32(1));
+            refCount = statement.ReadInteger64(2);
+          }
+        }
+
+        if (refCount > 0)
+        {
+          // The content is still used by other files
+          if (targetUuid == uuid &&
+              targetType == type)
+          {
+            // The row of "StorageArea" belongs to the removed file: It
+            // is kept for the duplicates, but cannot be read anymore
+            // through the UUID of the removed file
+            DatabaseManager::CachedStatement statement(
+              STATEMENT_FROM_HERE, *manager_,
+              "INSERT INTO StorageAreaRemovedOwners VALUES(${uuid}, ${type})");
+
+            statement.SetParameterType("uuid", ValueType_Utf8String);
+            statement.SetParameterType("type", ValueType_Integer64);
+
+            Dictionary args;
+            args.SetUtf8Value("uuid", uuid);
+            args.SetIntegerValue("type", type);
+
+            statement.Execute(args);
+          }
+
+          transaction.Commit();
+          return;
+        }
+        else
+        {
+          {
+            DatabaseManager::CachedStatement statement(
+              STATEMENT_FROM_HERE, *manager_,
+              "DELETE FROM StorageAreaContents WHERE contentHash=${hash}");
+
+            statement.SetParameterType("hash", ValueType_Utf8String);
+
+            Dictionary args;
+            args.SetUtf8Value("hash", hash);
+
+            statement.Execute(args);
+          }
+
+          {
+            DatabaseManager::CachedStatement statement(
+              STATEMENT_FROM_HERE, *manager_,
+              "DELETE FROM StorageAreaRemovedOwners WHERE uuid=${uuid} AND type=${type}");
+
+            statement.SetParameterType("uuid", ValueType_Utf8String);
+            statement.SetParameterType("type", ValueType_Integer64);
+
+            Dictionary args;
+            args.SetUtf8Value("uuid", targetUuid);
+            args.SetIntegerValue("type", targetType);
+
+            statement.Execute(args);
+          }
+        }
+      }
+    }
+
+    bool tiered = false;
+
+    if (backend_.IsDeferredRemove())
+    {
+      // The file will be removed by "DrainPendingDeletes()"
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, *manager_,
+        "INSERT INTO PendingDeletes VALUES(${uuid}, ${type})");
+     
+      statement.SetParameterType("uuid", ValueType_Utf8String);
+      statement.SetParameterType("type", ValueType_Integer64);
+
+      Dictionary args;
+      args.SetUtf8Value("uuid", targetUuid);
+      args.SetIntegerValue("type", targetType);
+     
+      statement.Execute(args);
+    }
+    else
+    {
+      if (backend_.IsUsageAccounting())
+      {
+        AccountRemoval(*manager_, targetUuid, targetType);
+      }
+
+      tiered = backend_.UnregisterTiering(*manager_, targetUuid, targetType);
+      backend_.UnregisterCompression(*manager_, targetUuid, targetType);
+
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, *manager_,
+        "DELETE FROM StorageArea WHERE uuid=${uuid} AND type=${type}");
+     
+      statement.SetParameterType("uuid", ValueType_Utf8String);
+      statement.SetParameterType("type", ValueType_Integer64);
+
+      Dictionary args;
+      args.SetUtf8Value("uuid", targetUuid);
+      args.SetIntegerValue("type", targetType);
+     
+      statement.Execute(args);
+    }
+      
+    transaction.Commit();
+
+    if (tiered)
+    {
+      backend_.tierFilesystem_->Remove(targetUuid);
+    }
+  }
+
+
+  void StorageBackend::SetDeferredRemove(unsigned int batchSize,
+                                         unsigned int intervalSeconds)
+  {
+    if (batchSize == 0 ||
+        intervalSeconds == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+    else if (deferredRemove_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    {
+      AccessorBase accessor(*this);
+      DatabaseManager::Transaction transaction(accessor.GetManager(), TransactionType_ReadWrite);
+
+      if (!transaction.GetDatabaseTransaction().DoesTableExist("PendingDeletes"))
+      {
+        transaction.GetDatabaseTransaction().ExecuteMultiLines(
+          "CREATE TABLE PendingDeletes(uuid VARCHAR(64) NOT NULL, type INTEGER NOT NULL, "
+          "PRIMARY KEY(uuid, type))");
+      }
+
+      transaction.Commit();
+    }
+
+    deferredRemove_ = true;
+    deferredRemoveBatchSize_ = batchSize;
+    deferredRemoveInterval_ = intervalSeconds;
+    deferredRemoveThread_ = boost::thread(DeferredRemoveThread, this);
+  }
+
+
+  void StorageBackend::SetDeferredRemoveMaxRate(unsigned int filesPerSecond)
+  {
+    boost::mutex::scoped_lock lock(deferredRemoveMutex_);
+    deferredRemoveMaxRate_ = filesPerSecond;
+  }
+
+
+  void StorageBackend::SetDeduplication(bool deduplication)
+  {
+    if (!deduplication)
+    {
+      AccessorBase accessor(*this);
+      DatabaseManager::Transaction transaction(accessor.GetManager(), TransactionType_ReadOnly);
+
+      bool shared = false;
+
+      if (transaction.GetDatabaseTransaction().DoesTableExist("StorageAreaDuplicates"))
+      {
+        DatabaseManager::StandaloneStatement statement(
+          accessor.GetManager(), "SELECT COUNT(*) FROM StorageAreaDuplicates");
+        statement.SetReadOnly(true);
+        statement.Execute();
+        statement.SetResultFieldType(0, ValueType_Integer64);
+        shared = (statement.ReadInteger64(0) != 0);
+      }
+
+      transaction.Commit();
+
+      if (shared)
+      {
+        // Without the deduplication, the duplicates would not be resolved to their content
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls,
+                                        "The deduplication of the storage area cannot be disabled, "
+                                        "as some files are shared");
+      }
+    }
+    else
+    {
+      AccessorBase accessor(*this);
+      DatabaseManager::Transaction transaction(accessor.GetManager(), TransactionType_ReadWrite);
+
+      // The first file that stores a content owns its row in
+      // "StorageArea", and "refCount" counts all the files that share it
+      if (!transaction.GetDatabaseTransaction().DoesTableExist("StorageAreaContents"))
+      {
+        transaction.GetDatabaseTransaction().ExecuteMultiLines(
+          "CREATE TABLE StorageAreaContents(contentHash VARCHAR(64) NOT NULL PRIMARY KEY, "
+          "uuid VARCHAR(64) NOT NULL, type INTEGER NOT NULL, refCount BIGINT NOT NULL)");
+        transaction.GetDatabaseTransaction().ExecuteMultiLines(
+          "CREATE INDEX StorageAreaContentsOwner ON StorageAreaContents(uuid, type)");
+      }
+
+      if (!transaction.GetDatabaseTransaction().DoesTableExist("StorageAreaDuplicates"))
+      {
+        transaction.GetDatabaseTransaction().ExecuteMultiLines(
+          "CREATE TABLE StorageAreaDuplicates(uuid VARCHAR(64) NOT NULL, type INTEGER NOT NULL, "
+          "contentHash VARCHAR(64) NOT NULL, PRIMARY KEY(uuid, type))");
+      }
+
+      // The owners that were removed while their content was still
+      // shared: Their row in "StorageArea" is kept for the duplicates
+      if (!transaction.GetDatabaseTransaction().DoesTableExist("StorageAreaRemovedOwners"))
+      {
+        transaction.GetDatabaseTransaction().ExecuteMultiLines(
+          "CREATE TABLE StorageAreaRemovedOwners(uuid VARCHAR(64) NOT NULL, type INTEGER NOT NULL, "
+          "PRIMARY KEY(uuid, type))");
+      }
+
+      transaction.Commit();
+    }
+
+    deduplication_ = deduplication;
+  }
+
+
+  void StorageBackend::SetUsageAccounting(bool enabled)
+  {
+    if (enabled)
+    {
+      AccessorBase accessor(*this);
+      DatabaseManager::Transaction transaction(accessor.GetManager(), TransactionType_ReadWrite);
+
+      if (!transaction.GetDatabaseTransaction().DoesTableExist("StorageAreaUsage"))
+      {
+        transaction.GetDatabaseTransaction().ExecuteMultiLines(
+          "CREATE TABLE StorageAreaUsage(type INTEGER NOT NULL, shard INTEGER NOT NULL, "
+          "filesCount BIGINT NOT NULL, totalSize BIGINT NOT NULL, PRIMARY KEY(type, shard))");
+      }
+
+      if (!transaction.GetDatabaseTransaction().DoesTableExist("StorageAreaSizes"))
+      {
+        transaction.GetDatabaseTransaction().ExecuteMultiLines(
+          "CREATE TABLE StorageAreaSizes(uuid VARCHAR(64) NOT NULL, type INTEGER NOT NULL, "
+          "size BIGINT NOT NULL, shard INTEGER NOT NULL, PRIMARY KEY(uuid, type))");
+      }
+
+      transaction.Commit();
+    }
+
+    usageAccounting_ = enabled;
+  }
+
+
+  void StorageBackend::ReadUsage(Usage& target)
+  {
+    target.clear();
+
+    if (!usageAccounting_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    AccessorBase accessor(*this);
+    DatabaseManager& manager = accessor.GetManager();
+
+    DatabaseManager::Transaction transaction(manager, TransactionType_ReadOnly);
+
+    {
+      // The shards are summed here, as the type of "SUM()" depends on the dialect
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "SELECT type, filesCount, totalSize FROM StorageAreaUsage");
+
+      statement.SetReadOnly(true);
+      statement.Execute();
+
+      while (!statement.IsDone())
+      {
+        std::pair<uint64_t, uint64_t>& usage = target[statement.ReadInteger32(0)];
+        usage.first += static_cast<uint64_t>(statement.ReadInteger64(1));
+        usage.second += static_cast<uint64_t>(statement.ReadInteger64(2));
+        statement.Next();
+      }
+    }
+
+    transaction.Commit();
+  }
+
+
+  size_t StorageBackend::DrainPendingDeletes(size_t maxCount)
+  {
+    AccessorBase accessor(*this);
+    DatabaseManager& manager = accessor.GetManager();
+
+    DatabaseManager::Transaction transaction(manager, TransactionType_ReadWrite);
+
+    if (HasBulkRemove() &&
+        !usageAccounting_ &&
+        !IsTiering() &&
+        !HasCompressedFiles())
+    {
+      const size_t count = RemovePendingInBulk(manager, maxCount);
+      transaction.Commit();
+      return count;
+    }
+
+    std::list< std::pair<std::string, int32_t> > files;
+
+    {
+      const std::string count = boost::lexical_cast<std::string>(maxCount);
+
+      std::string sql;
+      if (manager.GetDialect() == Dialect_MSSQL)
+      {
+        sql = "SELECT TOP(" + count + ") uuid, type FROM PendingDeletes";
+      }
+      else
+      {
+        sql = "SELECT uuid, type FROM PendingDeletes LIMIT " + count;
+      }
+
+      DatabaseManager::StandaloneStatement statement(manager, sql);
+      statement.Execute();
+
+      while (!statement.IsDone())
+      {
+        files.push_back(std::make_pair(statement.ReadString(0), statement.ReadInteger32(1)));
+        statement.Next();
+      }
+    }
+
+    std::list<std::string> tiered;
+
+    for (std::list< std::pair<std::string, int32_t> >::const_iterator
+           it = files.begin(); it != files.end(); ++it)
+    {
+      Dictionary args;
+      args.SetUtf8Value("uuid", it->first);
+      args.SetIntegerValue("type", it->second);
+
+      if (usageAccounting_)
+      {
+        AccountRemoval(manager, it->first, static_cast<OrthancPluginContentType>(it->second));
+      }
+
+      if (UnregisterTiering(manager, it->first, static_cast<OrthancPluginContentType>(it->second)))
+      {
+        tiered.push_back(it->first);
+      }
+
+      UnregisterCompression(manager, it->first, static_cast<OrthancPluginContentType>(it->second));
+
+      {
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, manager,
+          "DELETE FROM StorageArea WHERE uuid=${uuid} AND type=${type}");
+        statement.SetParameterType("uuid", ValueType_Utf8String);
+        statement.SetParameterType("type", ValueType_Integer64);
+        statement.Execute(args);
+      }
+
+      {
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, manager,
+          "DELETE FROM PendingDeletes WHERE uuid=${uuid} AND type=${type}");
+        statement.SetParameterType("uuid", ValueType_Utf8String);
+        statement.SetParameterType("type", ValueType_Integer64);
+        statement.Execute(args);
+      }
+    }
+
+    transaction.Commit();
+
+    for (std::list<std::string>::const_iterator it = tiered.begin(); it != tiered.end(); ++it)
+    {
+      tierFilesystem_->Remove(*it);
+    }
+
+    return files.size();
+  }
+
+
+  void StorageBackend::DeferredRemoveThread(StorageBackend* that)
+  {
+    assert(that != NULL);
+
+    for (;;)
+    {
+      {
+        boost::mutex::scoped_lock lock(that->deferredRemoveMutex_);
+
+        if (!that->deferredRemoveStop_)
+        {
+          that->deferredRemoveCondition_.timed_wait(
+            lock, boost::posix_time::seconds(that->deferredRemoveInterval_));
+        }
+
+        if (that->deferredRemoveStop_)
+        {
+          return;
+        }
+      }
+
+      try
+      {
+        // Drain the queue by batches, so that each transaction only
+        // locks a bounded number of rows
+        size_t count;
+
+        do
+        {
+          count = that->DrainPendingDeletes(that->deferredRemoveBatchSize_);
+
+          if (count > 0)
+          {
+            LOG(INFO) << "Removed " << count << " deferred file(s) from the storage area";
+          }
+
+          boost::mutex::scoped_lock lock(that->deferredRemoveMutex_);
+
+          if (count > 0 &&
+              that->deferredRemoveMaxRate_ > 0 &&
+              !that->deferredRemoveStop_)
+          {
+            // Spreads the batches over time, to bound the I/O rate of the removals
+            that->deferredRemoveCondition_.timed_wait(
+              lock, boost::posix_time::milliseconds(static_cast<int64_t>(count) * 1000 / that->deferredRemoveMaxRate_));
+          }
+
+          if (that->deferredRemoveStop_)
+          {
+            return;
+          }
+        }
+        while (count == that->deferredRemoveBatchSize_);
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        LOG(ERROR) << "Error while removing the deferred files from the storage area: " << e.What();
+      }
+    }
+  }
+  
+
+  static OrthancPluginContext* context_ = NULL;
+  static std::unique_ptr<StorageBackend>  backend_;
+    
+
+  static OrthancPluginErrorCode StorageCreate(const char* uuid,
+                                              const void* content,
+                                              int64_t size,
+                                              OrthancPluginContentType type)
+  {
+    class Operation : public StorageBackend::IDatabaseOperation
+    {
+    private:
+      const char*               uuid_;
+      const void*               content_;
+      int64_t                   size_;
+      OrthancPluginContentType  type_;
+      
+    public:
+      Operation(const char* uuid,
+                const void* content,
+                int64_t size,
+                OrthancPluginContentType type) :
+        uuid_(uuid),
+        content_(content),
+        size_(size),
+        type_(type)
+      {
+      }
+      
+      virtual void Execute(StorageBackend::IAccessor& accessor) ORTHANC_OVERRIDE
+      {
+        accessor.Create(uuid_, content_, size_, type_);
+      }
+    };
+
+
+    TracesExporter::Span span("storage.create");
+
+    try
+    {
+      if (backend_.get() == NULL)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+      }
+      else
+      {
+        FilesystemStorage* filesystem = backend_->LookupFilesystem(type);
+        if (filesystem != NULL)
+        {
+          filesystem->Create(uuid, content, static_cast<size_t>(size));
+        }
+        else
+        {
+          Operation operation(uuid, content, size, type);
+          backend_->Execute(operation);
+        }
+
+        span.SetAttribute("bytes", size);
+        span.SetSuccess();
+        return OrthancPluginErrorCode_Success;
+      }
+    }
+    ORTHANC_PLUGINS_DATABASE_CATCH;
+  }
+
+
+#if defined(ORTHANC_PLUGINS_VERSION_IS_ABOVE)
+#  if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 9, 0)
+  static OrthancPluginErrorCode StorageReadWhole(OrthancPluginMemoryBuffer64* target,
+                                                 const char* uuid,
+                                                 OrthancPluginContentType type)
+  {
+    class Visitor : public StorageBackend::IFileContentVisitor
+    {
+    private:
+      OrthancPluginMemoryBuffer64* target_;
+      bool                         allocated_;
+      bool                         success_;
+
+      void FreeBuffer()
+      {
+        if (allocated_)
+        {
+          assert(context_ != NULL);
+          OrthancPluginFreeMemoryBuffer64(context_, target_);
+          target_->data = NULL;
+          target_->size = 0;
+          allocated_ = false;
+        }
+      }
+      
+    public:
+      Visitor(OrthancPluginMemoryBuffer64* target) :
+        target_(target),
+        allocated_(false),
+        success_(false)
+      {
+        if (target == NULL)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+        }
+      }
+
+      ~Visitor()
+      {
+        if (!success_)
+        {
+          // Don't leak the buffer if reading the content has failed
+          FreeBuffer();
+        }
+      }
+
+      virtual bool IsSuccess() const ORTHANC_OVERRIDE
+      {
+        return success_;
+      }
+      
+      virtual void Assign(const std::string& content) ORTHANC_OVERRIDE
+      {
+        void* buffer = AllocateBuffer(content.size());
+
+        if (!content.empty())
+        {
+          memcpy(buffer, content.c_str(), content.size());
+        }
+
+        success_ = true;
+      }
+
+      virtual bool IsZeroCopy() const ORTHANC_OVERRIDE
+      {
+        return true;
+      }
+
+      virtual void* AllocateBuffer(size_t size) ORTHANC_OVERRIDE
+      {
+        if (success_)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+        }
+        else if (allocated_ &&
+                 target_->size == static_cast<uint64_t>(size))
+        {
+          // The transaction is retried, reuse the buffer
+          return target_->data;
+        }
+        else
+        {
+          FreeBuffer();
+
+          assert(context_ != NULL);
+          
+          if (OrthancPluginCreateMemoryBuffer64(context_, target_, static_cast<uint64_t>(size)) !=
+              OrthancPluginErrorCode_Success)
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory);
+          }
+
+          allocated_ = true;
+          return target_->data;
+        }
+      }
+
+      virtual void MarkAssigned() ORTHANC_OVERRIDE
+      {
+        if (success_ ||
+            !allocated_)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+        }
+        else
+        {
+          success_ = true;
+        }
+      }
+    };
+
+
+    TracesExporter::Span span("storage.read");
+
+    try
+    {
+      if (backend_.get() == NULL)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+      }
+      else
+      {
+        Visitor visitor(target);
+
+        AttachmentCache::Content cached;
+        FilesystemStorage* filesystem = backend_->LookupFilesystem(type);
+
+        if (backend_->GetAttachmentCache().Lookup(cached, uuid, type))
+        {
+          visitor.Assign(*cached);
+        }
+        else
+        {
+          if (filesystem != NULL)
+          {
+            const size_t size = static_cast<size_t>(filesystem->GetSize(uuid));
+            filesystem->ReadRange(visitor.AllocateBuffer(size), uuid, 0, size);
+            visitor.MarkAssigned();
+          }
+          else
+          {
+            StorageBackend::ReadWholeOperation operation(visitor, uuid, type);
+            backend_->Execute(operation);
+          }
+
+          if (backend_->GetAttachmentCache().IsEnabled())
+          {
+            backend_->GetAttachmentCache().Store(uuid, type, target->data, static_cast<size_t>(target->size));
+          }
+        }
+
+        span.SetAttribute("bytes", static_cast<int64_t>(target->size));
+        span.SetSuccess();
+        return OrthancPluginErrorCode_Success;
+      }
+    }
+    ORTHANC_PLUGINS_DATABASE_CATCH;
+  }
+
+  
+  static OrthancPluginErrorCode StorageReadRange(OrthancPluginMemoryBuffer64* target,
+                                                 const char* uuid,
+                                                 OrthancPluginContentType type,
+                                                 uint64_t start)
+  {
+    class Visitor : public StorageBackend::IFileContentVisitor
+    {
+    private:
+      OrthancPluginMemoryBuffer64* target_;  // This buffer is already allocated by the Orthanc core
+      bool                         success_;
+      
+    public:
+      Visitor(OrthancPluginMemoryBuffer64* target) :
+        target_(target),
+        success_(false)
+      {
+        if (target == NULL)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+        }
+      }
+
+      virtual bool IsSuccess() const ORTHANC_OVERRIDE
+      {
+        return success_;
+      }
+      
+      virtual void Assign(const std::string& content) ORTHANC_OVERRIDE
+      {
+        void* buffer = AllocateBuffer(content.size());
+
+        if (!content.empty())
+        {
+          memcpy(buffer, content.c_str(), content.size());
+        }
+
+        success_ = true;
+      }
+
+      virtual bool IsZeroCopy() const ORTHANC_OVERRIDE
+      {
+        return true;
+      }
+
+      virtual void* AllocateBuffer(size_t size) ORTHANC_OVERRIDE
+      {
+        if (success_ ||
+            static_cast<uint64_t>(size) != target_->size)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+        }
+        else
+        {
+          return target_->data;
+        }
+      }
+
+      virtual void MarkAssigned() ORTHANC_OVERRIDE
+      {
+        if (success_)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+        }
+        else
+        {
+          success_ = true;
+        }
+      }
+    };
+
+
+    class Operation : public StorageBackend::IDatabaseOperation
+    {
+    private:
+      Visitor&                  visitor_;
+      const char*               uuid_;
+      OrthancPluginContentType  type_;
+      uint64_t                  start_;
+      size_t                    length_;
+
+    public:
+      Operation(Visitor& visitor,
+                const char* uuid,
+                OrthancPluginContentType type,
+                uint64_t start,
+                size_t length) :
+        visitor_(visitor),
+        uuid_(uuid),
+        type_(type),
+        start_(start),
+        length_(length)
+      {
+      }
+
+      virtual void Execute(StorageBackend::IAccessor& accessor) ORTHANC_OVERRIDE
+      {
+        std::string uuid;
+        OrthancPluginContentType type;
+        accessor.ResolveContent(uuid, type, uuid_, type_);
+
+        FilesystemStorage* tier = accessor.LookupTier(uuid, type);
+        if (tier != NULL)
+        {
+          ReadRangeFromTier(visitor_, *tier, uuid, start_, length_);
+        }
+        else
+        {
+          accessor.ReadRange(visitor_, uuid, type, start_, length_);
+        }
+      }
+    };
+
+
+    TracesExporter::Span span("storage.read-range");
+
+    try
+    {
+      if (backend_.get() == NULL)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+      }
+      else
+      {
+        Visitor visitor(target);
+
+        std::string range;
+        FilesystemStorage* filesystem = backend_->LookupFilesystem(type);
+
+        if (backend_->GetAttachmentCache().LookupRange(range, uuid, type, start, static_cast<size_t>(target->size)))
+        {
+          visitor.Assign(range);
+        }
+        else if (filesystem != NULL)
+        {
+          filesystem->ReadRange(target->data, uuid, start, static_cast<size_t>(target->size));
+        }
+        else
+        {
+          // The ranges themselves are not cached, as only the whole
+          // files can serve the other ranges of the same file
+          Operation operation(visitor, uuid, type, start, target->size);
+          backend_->Execute(operation);
+        }
+
+        span.SetAttribute("bytes", static_cast<int64_t>(target->size));
+        span.SetSuccess();
+        return OrthancPluginErrorCode_Success;
+      }
+    }
+    ORTHANC_PLUGINS_DATABASE_CATCH;
+  }
+#  endif
+#endif
+
+  
+  static OrthancPluginErrorCode StorageRead(void** data,
+                                            int64_t* size,
+                                            const char* uuid,
+                                            OrthancPluginContentType type)
+  {
+    class Visitor : public StorageBackend::IFileContentVisitor
+    {
+    private:
+      void**    data_;
+      int64_t*  size_;
+      bool      success_;
+      
+    public:
+      Visitor(void** data,
+              int64_t* size) :
+        data_(data),
+        size_(size),
+        success_(false)
+      {
+      }
+
+      ~Visitor()
+      {
+        if (data_ != NULL /* this condition is invalidated by "Release()" */ &&
+            *data_ != NULL)
+        {
+          free(*data_);
+        }
+      }
+
+      void Release()
+      {
+        data_ = NULL;
+      }      
+
+      virtual bool IsSuccess() const ORTHANC_OVERRIDE
+      {
+        return success_;
+      }
+      
+      virtual void Assign(const std::string& content) ORTHANC_OVERRIDE
+      {
+        if (success_)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+        }
+        else if (data_ == NULL)
+        {
+          // "Release()" has been called
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+        }
+        else
+        {
+          if (content.empty())
+          {
+            *data_ = NULL;
+            *size_ = 0;
+          }
+          else
+          {
+            *size_ = static_cast<int64_t>(content.size());
+    
+            if (static_cast<size_t>(*size_) != content.size())
+            {
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory,
+                                              "File cannot be stored in a 63bit buffer");
+            }
+
+            *data_ = malloc(*size_);
+            if (*data_ == NULL)
+            {
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory);
+            }
+
+            memcpy(*data_, content.c_str(), *size_);
+          }
+          
+          success_ = true;
+        }
+      }
+    };
+
+
+    try
+    {
+      if (backend_.get() == NULL)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+      }
+      else if (data == NULL ||
+               size == NULL)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+      }
+      else
+      {
+        Visitor visitor(data, size);
+
+        AttachmentCache::Content cached;
+        FilesystemStorage* filesystem = backend_->LookupFilesystem(type);
+
+        if (backend_->GetAttachmentCache().Lookup(cached, uuid, type))
+        {
+          visitor.Assign(*cached);
+        }
+        else
+        {
+          if (filesystem != NULL)
+          {
+            std::string content;
+            filesystem->ReadWhole(content, uuid);
+            visitor.Assign(content);
+          }
+          else
+          {
+            StorageBackend::ReadWholeOperation operation(visitor, uuid, type);
+            backend_->Execute(operation);
+          }
+
+          if (backend_->GetAttachmentCache().IsEnabled())
+          {
+            backend_->GetAttachmentCache().Store(uuid, type, *data, static_cast<size_t>(*size));
+          }
+        }
+
+        visitor.Release();
+
+        return OrthancPluginErrorCode_Success;
+      }
+    }
+    ORTHANC_PLUGINS_DATABASE_CATCH;
+  }
+
+
+  static OrthancPluginErrorCode StorageRemove(const char* uuid,
+                                              OrthancPluginContentType type)
+  {
+    class Operation : public StorageBackend::IDatabaseOperation
+    {
+    private:
+      const char*               uuid_;
+      OrthancPluginContentType  type_;
+      
+    public:
+      Operation(const char* uuid,
+                OrthancPluginContentType type) :
+        uuid_(uuid),
+        type_(type)
+      {
+      }
+      
+      virtual void Execute(StorageBackend::IAccessor& accessor) ORTHANC_OVERRIDE
+      {
+        accessor.Remove(uuid_, type_);
+      }
+    };
+
+    
+    TracesExporter::Span span("storage.remove");
+
+    try
+    {
+      if (backend_.get() == NULL)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+      }
+      else
+      {
+        backend_->GetAttachmentCache().Invalidate(uuid, type);
+
+        FilesystemStorage* filesystem = backend_->LookupFilesystem(type);
+        if (filesystem != NULL)
+        {
+          filesystem->Remove(uuid);
+        }
+        else
+        {
+          Operation operation(uuid, type);
+          backend_->Execute(operation);
+        }
+
+        span.SetSuccess();
+        return OrthancPluginErrorCode_Success;
+      }
+    }
+    ORTHANC_PLUGINS_DATABASE_CATCH;
+  }
+
+  
+  static void PrefetchRestCallback(OrthancPluginRestOutput* output,
+                                   const char* url,
+                                   const OrthancPluginHttpRequest* request)
+  {
+    if (request->method != OrthancPluginHttpMethod_Post)
+    {
+      OrthancPlugins::AnswerMethodNotAllowed(output, "POST");
+      return;
+    }
+
+    Json::Value body;
+    if (backend_.get() == NULL ||
+        !OrthancPlugins::ReadJson(body, request->body, request->bodySize) ||
+        body.type() != Json::objectValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                      "Expected a JSON object with the \"Series\" and/or \"Instances\" to prefetch");
+    }
+
+    // The uuids of the attachments are only known by the index, hence
+    // the calls to the REST API of the Orthanc core
+    std::list<std::string> instances;
+
+    if (body.isMember("Instances") &&
+        body["Instances"].type() == Json::arrayValue)
+    {
+      for (Json::Value::ArrayIndex i = 0; i < body["Instances"].size(); i++)
+      {
+        instances.push_back(body["Instances"][i].asString());
+      }
+    }
+
+    if (body.isMember("Series") &&
+        body["Series"].type() == Json::arrayValue)
+    {
+      for (Json::Value::ArrayIndex i = 0; i < body["Series"].size(); i++)
+      {
+        Json::Value series;
+        if (OrthancPlugins::RestApiGet(series, "/series/" + body["Series"][i].asString(), false) &&
+            series.isMember("Instances") &&
+            series["Instances"].type() == Json::arrayValue)
+        {
+          for (Json::Value::ArrayIndex j = 0; j < series["Instances"].size(); j++)
+          {
+            instances.push_back(series["Instances"][j].asString());
+          }
+        }
+      }
+    }
+
+    unsigned int count = 0;
+
+    for (std::list<std::string>::const_iterator it = instances.begin(); it != instances.end(); ++it)
+    {
+      Json::Value info;
+      if (OrthancPlugins::RestApiGet(info, "/instances/" + *it + "/attachments/dicom/info", false) &&
+          info.isMember("Uuid") &&
+          info["Uuid"].type() == Json::stringValue)
+      {
+        backend_->Prefetch(info["Uuid"].asString(), OrthancPluginContentType_Dicom);
+        count++;
+      }
+    }
+
+    Json::Value answer = Json::objectValue;
+    answer["Scheduled"] = count;
+    OrthancPlugins::AnswerJson(answer, output);
+  }
+
+
+  static void PoolRestCallback(OrthancPluginRestOutput* output,
+                               const char* url,
+                               const OrthancPluginHttpRequest* request)
+  {
+    if (request->method != OrthancPluginHttpMethod_Get &&
+        request->method != OrthancPluginHttpMethod_Post)
+    {
+      OrthancPlugins::AnswerMethodNotAllowed(output, "GET,POST");
+      return;
+    }
+
+    if (backend_.get() == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    if (request->method == OrthancPluginHttpMethod_Post)
+    {
+      Json::Value body;
+      if (!OrthancPlugins::ReadJson(body, request->body, request->bodySize) ||
+          body.type() != Json::objectValue ||
+          !body.isMember("ConnectionsCount") ||
+          !body["ConnectionsCount"].isUInt())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat,
+                                        "Expected a JSON object with a positive integer \"ConnectionsCount\"");
+      }
+
+      backend_->SetConnectionsCount(body["ConnectionsCount"].asUInt());
+    }
+
+    Json::Value answer = Json::objectValue;
+    answer["ConnectionsCount"] = static_cast<Json::UInt64>(backend_->GetConnectionsCount());
+    OrthancPlugins::AnswerJson(answer, output);
+  }
+
+
+#if HAS_ORTHANC_PLUGIN_METRICS == 1
+  static void StorageRefreshMetrics()
+  {
+    try
+    {
+      if (backend_.get() == NULL)
+      {
+        return;
+      }
+
+      StorageBackend::Usage usage;
+      backend_->ReadUsage(usage);
+
+      uint64_t filesCount = 0;
+      uint64_t totalSize = 0;
+
+      for (StorageBackend::Usage::const_iterator it = usage.begin(); it != usage.end(); ++it)
+      {
+        const std::string prefix = "orthanc_storage_area_type" + boost::lexical_cast<std::string>(it->first);
+        OrthancPluginSetMetricsValue(context_, (prefix + "_files_count").c_str(),
+                                     static_cast<float>(it->second.first), OrthancPluginMetricsType_Default);
+        OrthancPluginSetMetricsValue(context_, (prefix + "_size_mb").c_str(),
+                                     static_cast<float>(it->second.second) / (1024.0f * 1024.0f), OrthancPluginMetricsType_Default);
+
+        filesCount += it->second.first;
+        totalSize += it->second.second;
+      }
+
+      OrthancPluginSetMetricsValue(context_, "orthanc_storage_area_files_count",
+                                   static_cast<float>(filesCount), OrthancPluginMetricsType_Default);
+      OrthancPluginSetMetricsValue(context_, "orthanc_storage_area_size_mb",
+                                   static_cast<float>(totalSize) / (1024.0f * 1024.0f), OrthancPluginMetricsType_Default);
+    }
+    catch (Orthanc::OrthancException& e)
+    {
+      LOG(ERROR) << "Cannot read the usage of the storage area: " << e.What();
+    }
+  }
+#endif
+
+
+  void StorageBackend::Register(OrthancPluginContext* context,
+                                StorageBackend* backend)
+  {
+    if (context == NULL ||
+        backend == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+    }
+    else if (context_ != NULL ||
+             backend_.get() != NULL)
+    {
+      // This function can only be invoked once in the plugin
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+    else
+    {
+      context_ = context;
+      backend_.reset(backend);
+
+      {
+        // The files that were compressed before this Orthanc server was started
+        AccessorBase accessor(*backend_);
+        backend_->RefreshCompressedFiles(accessor.GetManager());
+      }
+
+      bool hasLoadedV2 = false;
+
+#if defined(ORTHANC_PLUGINS_VERSION_IS_ABOVE)         // Macro introduced in Orthanc 1.3.1
+#  if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 9, 0)
+      if (OrthancPluginCheckVersionAdvanced(context, 1, 9, 0) == 1)
+      {
+        OrthancPluginStorageReadRange readRange = NULL;
+        if (backend_->HasReadRange() &&
+            !backend_->HasCompression())
+        {
+          readRange = StorageReadRange;
+        }
+        
+        OrthancPluginRegisterStorageArea2(context_, StorageCreate, StorageReadWhole, readRange, StorageRemove);
+        hasLoadedV2 = true;
+      }
+#  endif
+#endif
+
+      if (!hasLoadedV2)
+      {
+        LOG(WARNING) << "Performance warning: Your version of the Orthanc core or SDK doesn't support reading of file ranges";
+        OrthancPluginRegisterStorageArea(context_, StorageCreate, StorageRead, StorageRemove);
+      }
+
+      LOG(WARNING) << "The storage area plugin will retry up to " << backend_->GetMaxRetries()
+                   << " time(s) in the case of a collision";
+      LOG(WARNING) << "The storage area plugin uses " << backend_->GetConnectionsCount()
+                   << " connection(s) to the database";
+
+      // The pool of connections can be resized at runtime
+      OrthancPlugins::RegisterRestCallback<PoolRestCallback>("/storage-area/pool", true);
+
+      if (backend_->HasCompression())
+      {
+        LOG(WARNING) << "The storage area plugin transparently compresses the attachments using zlib";
+      }
+
+      if (backend_->LookupFilesystem(OrthancPluginContentType_Dicom) != NULL)
+      {
+        LOG(WARNING) << "The storage area plugin only stores the small attachments in the database, "
+                     << "the DICOM files are stored in directory: "
+                     << backend_->LookupFilesystem(OrthancPluginContentType_Dicom)->GetRoot().string();
+      }
+
+      if (backend_->IsTiering())
+      {
+        LOG(WARNING) << "The storage area plugin moves the files older than " << backend_->tieringAge_
+                     << " day(s) to directory: " << backend_->tierFilesystem_->GetRoot().string();
+      }
+
+      if (backend_->HasPrefetch())
+      {
+        LOG(WARNING) << "The storage area plugin prefetches the files that are posted to: /storage-area/prefetch";
+        OrthancPlugins::RegisterRestCallback<PrefetchRestCallback>("/storage-area/prefetch", true);
+      }
+
+      if (backend_->IsUsageAccounting())
+      {
+#if HAS_ORTHANC_PLUGIN_METRICS == 1
+        // The counters are only read when the metrics are requested
+        OrthancPluginRegisterRefreshMetricsCallback(context_, StorageRefreshMetrics);
+#else
+        LOG(WARNING) << "Your version of the Orthanc SDK doesn't support metrics, "
+                     << "the usage of the storage area is only available in the database";
+#endif
+      }
+
+      if (backend_->GetAttachmentCache().IsEnabled())
+      {
+        LOG(WARNING) << "The storage area plugin caches up to "
+                     << (backend_->GetAttachmentCache().GetMaxSize() / (1024 * 1024))
+                     << "MB of attachments in memory";
+      }
+    }
+  }
+
+
+  void StorageBackend::Finalize()
+  {
+    backend_.reset(NULL);
+    context_ = NULL;
+  }
+
+
+  class StorageBackend::StringVisitor : public StorageBackend::IFileContentVisitor
+  {
+  private:
+    std::string&  target_;
+    bool          success_;
+      
+  public:
+    explicit StringVisitor(std::string& target) :
+      target_(target),
+      success_(false)
+    {
+    }
+
+    virtual bool IsSuccess() const ORTHANC_OVERRIDE
+    {
+      return success_;
+    }
+      
+    virtual void Assign(const std::string& content) ORTHANC_OVERRIDE
+    {
+      if (success_)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
       }
       else
       {
-        Visitor visitor(data, size);
+        target_.assign(content);
+        success_ = true;
+      }
+    }
+
+    virtual bool IsZeroCopy() const ORTHANC_OVERRIDE
+    {
+      return true;
+    }
+
+    virtual void* AllocateBuffer(size_t size) ORTHANC_OVERRIDE
+    {
+      if (success_)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+      else
+      {
+        target_.resize(size);
+        return (size == 0 ? NULL : &target_[0]);
+      }
+    }
+
+    virtual void MarkAssigned() ORTHANC_OVERRIDE
+    {
+      if (success_)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      }
+      else
+      {
+        success_ = true;
+      }
+    }
+  };
+    
+
+  void StorageBackend::ReadWholeToString(std::string& target,
+                                         IAccessor& accessor,
+                                         const std::string& uuid,
+                                         OrthancPluginContentType type)
+  {
+    std::string targetUuid;
+    OrthancPluginContentType targetType;
+    accessor.ResolveContent(targetUuid, targetType, uuid, type);
+
+    StringVisitor visitor(target);
+
+    FilesystemStorage* tier = accessor.LookupTier(targetUuid, targetType);
+    if (tier != NULL)
+    {
+      ReadWholeFromTier(visitor, *tier, targetUuid);
+    }
+    else
+    {
+      accessor.ReadWhole(visitor, targetUuid, targetType);
+    }
+
+    if (!visitor.IsSuccess())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+  }
+    
+
+  void StorageBackend::ReadRangeToString(std::string& target,
+                                         IAccessor& accessor,
+                                         const std::string& uuid,
+                                         OrthancPluginContentType type,
+                                         uint64_t start,
+                                         size_t length)
+  {
+    std::string targetUuid;
+    OrthancPluginContentType targetType;
+    accessor.ResolveContent(targetUuid, targetType, uuid, type);
+
+    FilesystemStorage* tier = accessor.LookupTier(targetUuid, targetType);
+    if (tier != NULL)
+    {
+      ReadRangeFromTier(target, *tier, targetUuid, start, length);
+      return;
+    }
+
+    StringVisitor visitor(target);
+    accessor.ReadRange(visitor, targetUuid, targetType, start, length);
+
+    if (!visitor.IsSuccess())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+  }
+
+
+  namespace  // Anonymous namespace to avoid clashes between compilation modules
+  {
+    class StringChunkVisitor : public StorageBackend::IFileChunkVisitor
+    {
+    private:
+      std::string&  target_;
+
+    public:
+      explicit StringChunkVisitor(std::string& target) :
+        target_(target)
+      {
+        target_.clear();
+      }
+
+      virtual void VisitChunk(const void* data,
+                              size_t size) ORTHANC_OVERRIDE
+      {
+        target_.append(reinterpret_cast<const char*>(data), size);
+      }
+    };
+  }
+
+
+  void StorageBackend::ReadRangeToString(std::string& target,
+                                         IAccessor& accessor,
+                                         const std::string& uuid,
+                                         OrthancPluginContentType type,
+                                         uint64_t start,
+                                         size_t length,
+                                         size_t chunkSize)
+  {
+    std::string targetUuid;
+    OrthancPluginContentType targetType;
+    accessor.ResolveContent(targetUuid, targetType, uuid, type);
+
+    FilesystemStorage* tier = accessor.LookupTier(targetUuid, targetType);
+    if (tier != NULL)
+    {
+      std::string content;
+      ReadRangeFromTier(content, *tier, targetUuid, start, length);
+
+      StringChunkVisitor visitor(target);
+      ResultFileValue::VisitChunks(visitor, (length == 0 ? NULL : content.c_str()), length, chunkSize);
+      return;
+    }
+
+    StringChunkVisitor visitor(target);
+    accessor.ReadRange(visitor, targetUuid, targetType, start, length, chunkSize);
+
+    if (target.size() != length)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+  }
+
+
+  void StorageBackend::Execute(IDatabaseOperation& operation)
+  {
+    std::unique_ptr<IAccessor> accessor(CreateAccessor());
+    if (accessor.get() == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+    }
+    
+#if ORTHANC_FRAMEWORK_VERSION_IS_ABOVE(1, 9, 2)
+    unsigned int attempt = 0;
+    unsigned int delay = 0;
+#endif
+    
+    for (;;)
+    {
+      try
+      {
+        operation.Execute(*accessor);
+        retryPolicy_.SignalSuccess();
+        return;  // Success
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+#if ORTHANC_FRAMEWORK_VERSION_IS_ABOVE(1, 9, 2)
+        if (e.GetErrorCode() == Orthanc::ErrorCode_DatabaseCannotSerialize)
+        {
+          retryPolicy_.SignalConflict();
+
+          if (attempt >= maxRetries_)
+          {
+            throw;
+          }
+          else if (!retryPolicy_.TryRetry(attempt))
+          {
+            LOG(WARNING) << "Too many conflicts between the writers to the storage area, not retrying";
+            throw;
+          }
+          else
+          {
+            attempt++;
+
+            // The random delay de-synchronizes the writers
+            delay = retryPolicy_.GetNextDelay(delay);
+            boost::this_thread::sleep(boost::posix_time::milliseconds(delay));
+          }
+        }
+        else
+        {
+          throw;
+        }
+#else
+        throw;
+#endif
+      }
+    }
+  }
+
+
+  class StorageBackend::PrefetchRequest : public Orthanc::IDynamicObject
+  {
+  private:
+    std::string               uuid_;
+    OrthancPluginContentType  type_;
+
+  public:
+    PrefetchRequest(const std::string& uuid,
+                    OrthancPluginContentType type) :
+      uuid_(uuid),
+      type_(type)
+    {
+    }
+
+    const std::string& GetUuid() const
+    {
+      return uuid_;
+    }
+
+    OrthancPluginContentType GetType() const
+    {
+      return type_;
+    }
+  };
+
+
+  void StorageBackend::SetPrefetchThreads(unsigned int count)
+  {
+    if (!prefetchThreads_.empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+    else if (count > 0 &&
+             !attachmentCache_.IsEnabled())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls,
+                                      "The prefetching of the files requires the cache of the attachments");
+    }
 
-        {
-          StorageBackend::ReadWholeOperation operation(visitor, uuid, type);
-          backend_->Execute(operation);
-        }
+    for (unsigned int i = 0; i < count; i++)
+    {
+      prefetchThreads_.push_back(new boost::thread(PrefetchThread, this));
+    }
+  }
 
-        visitor.Release();
 
-        return OrthancPluginErrorCode_Success;
-      }
+  void StorageBackend::Prefetch(const std::string& uuid,
+                                OrthancPluginContentType type)
+  {
+    AttachmentCache::Content cached;
+
+    if (!prefetchThreads_.empty() &&
+        !attachmentCache_.Lookup(cached, uuid, type))
+    {
+      prefetchQueue_.Enqueue(new PrefetchRequest(uuid, type));
     }
-    ORTHANC_PLUGINS_DATABASE_CATCH;
   }
 
 
-  static OrthancPluginErrorCode StorageRemove(const char* uuid,
-                                              OrthancPluginContentType type)
+  void StorageBackend::ReadWholeUncached(std::string& target,
+                                         const std::string& uuid,
+                                         OrthancPluginContentType type)
   {
-    class Operation : public StorageBackend::IDatabaseOperation
+    FilesystemStorage* filesystem = LookupFilesystem(type);
+
+    if (filesystem != NULL)
     {
-    private:
-      const char*               uuid_;
-      OrthancPluginContentType  type_;
-      
-    public:
-      Operation(const char* uuid,
-                OrthancPluginContentType type) :
-        uuid_(uuid),
-        type_(type)
+      filesystem->ReadWhole(target, uuid);
+    }
+    else
+    {
+      StringVisitor visitor(target);
+
       {
+        ReadWholeOperation operation(visitor, uuid.c_str(), type);
+        Execute(operation);
       }
-      
-      virtual void Execute(StorageBackend::IAccessor& accessor) ORTHANC_OVERRIDE
+
+      if (!visitor.IsSuccess())
       {
-        accessor.Remove(uuid_, type_);
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
       }
-    };
+    }
+  }
 
-    
-    try
+
+  void StorageBackend::PrefetchThread(StorageBackend* that)
+  {
+    assert(that != NULL);
+
+    for (;;)
     {
-      if (backend_.get() == NULL)
       {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+        boost::mutex::scoped_lock lock(that->prefetchMutex_);
+        if (that->prefetchStop_)
+        {
+          return;
+        }
       }
-      else
+
+      std::unique_ptr<Orthanc::IDynamicObject> obj(that->prefetchQueue_.Dequeue(100));
+      if (obj.get() != NULL)
       {
-        Operation operation(uuid, type);
-        backend_->Execute(operation);
-        return OrthancPluginErrorCode_Success;
+        const PrefetchRequest& request = dynamic_cast<const PrefetchRequest&>(*obj);
+
+        AttachmentCache::Content cached;
+        if (!that->attachmentCache_.Lookup(cached, request.GetUuid(), request.GetType()))
+        {
+          try
+          {
+            std::string content;
+            that->ReadWholeUncached(content, request.GetUuid(), request.GetType());
+            that->attachmentCache_.Store(request.GetUuid(), request.GetType(), content.empty() ? NULL : content.c_str(), content.size());
+          }
+          catch (Orthanc::OrthancException& e)
+          {
+            // Not an error, as the file may have been removed in the meantime
+            LOG(INFO) << "Cannot prefetch file " << request.GetUuid() << " from the storage area: " << e.What();
+          }
+        }
       }
     }
-    ORTHANC_PLUGINS_DATABASE_CATCH;
   }
 
-  
-  void StorageBackend::Register(OrthancPluginContext* context,
-                                StorageBackend* backend)
+
+  void StorageBackend::SetTiering(const std::string& root,
+                                  unsigned int ageDays,
+                                  unsigned int batchSize,
+                                  unsigned int intervalSeconds)
   {
-    if (context == NULL ||
-        backend == NULL)
+    if (batchSize == 0 ||
+        intervalSeconds == 0)
     {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
     }
-    else if (context_ != NULL ||
-             backend_.get() != NULL)
+    else if (IsTiering())
     {
-      // This function can only be invoked once in the plugin
       throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
     }
-    else
-    {
-      context_ = context;
-      backend_.reset(backend);
 
-      bool hasLoadedV2 = false;
+    std::unique_ptr<FilesystemStorage> tier(new FilesystemStorage(root));
 
-#if defined(ORTHANC_PLUGINS_VERSION_IS_ABOVE)         // Macro introduced in Orthanc 1.3.1
-#  if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 9, 0)
-      if (OrthancPluginCheckVersionAdvanced(context, 1, 9, 0) == 1)
+    {
+      AccessorBase accessor(*this);
+      DatabaseManager& manager = accessor.GetManager();
+      DatabaseManager::Transaction transaction(manager, TransactionType_ReadWrite);
+
+      // The rows of "StorageAreaAges" are the files that are still stored in the database
+      if (!transaction.GetDatabaseTransaction().DoesTableExist("StorageAreaAges"))
       {
-        OrthancPluginStorageReadRange readRange = NULL;
-        if (backend_->HasReadRange())
-        {
-          readRange = StorageReadRange;
-        }
-        
-        OrthancPluginRegisterStorageArea2(context_, StorageCreate, StorageReadWhole, readRange, StorageRemove);
-        hasLoadedV2 = true;
+        transaction.GetDatabaseTransaction().ExecuteMultiLines(
+          "CREATE TABLE StorageAreaAges(uuid VARCHAR(64) NOT NULL, type INTEGER NOT NULL, "
+          "creation BIGINT NOT NULL, PRIMARY KEY(uuid, type))");
+        transaction.GetDatabaseTransaction().ExecuteMultiLines(
+          "CREATE INDEX StorageAreaAgesCreation ON StorageAreaAges(creation)");
+
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, manager,
+          "INSERT INTO StorageAreaAges SELECT uuid, type, ${creation} FROM StorageArea");
+
+        statement.SetParameterType("creation", ValueType_Integer64);
+
+        Dictionary args;
+        args.SetIntegerValue("creation", GetSecondsSinceEpoch(boost::posix_time::microsec_clock::universal_time()));
+
+        statement.Execute(args);
       }
-#  endif
-#endif
 
-      if (!hasLoadedV2)
+      if (!transaction.GetDatabaseTransaction().DoesTableExist("StorageAreaTiered"))
       {
-        LOG(WARNING) << "Performance warning: Your version of the Orthanc core or SDK doesn't support reading of file ranges";
-        OrthancPluginRegisterStorageArea(context_, StorageCreate, StorageRead, StorageRemove);
+        transaction.GetDatabaseTransaction().ExecuteMultiLines(
+          "CREATE TABLE StorageAreaTiered(uuid VARCHAR(64) NOT NULL, type INTEGER NOT NULL, "
+          "PRIMARY KEY(uuid, type))");
       }
 
-      LOG(WARNING) << "The storage area plugin will retry up to " << backend_->GetMaxRetries()
-                   << " time(s) in the case of a collision";
+      transaction.Commit();
     }
-  }
 
+    tierFilesystem_.reset(tier.release());
+    tieringAge_ = ageDays;
+    tieringBatchSize_ = batchSize;
+    tieringInterval_ = intervalSeconds;
 
-  void StorageBackend::Finalize()
-  {
-    backend_.reset(NULL);
-    context_ = NULL;
+    if (ageDays > 0)
+    {
+      tieringThread_ = boost::thread(TieringThread, this);
+    }
   }
 
 
-  class StorageBackend::StringVisitor : public StorageBackend::IFileContentVisitor
+  size_t StorageBackend::MoveToTier(size_t maxCount,
+                                    const boost::posix_time::ptime& now)
   {
-  private:
-    std::string&  target_;
-    bool          success_;
-      
-  public:
-    explicit StringVisitor(std::string& target) :
-      target_(target),
-      success_(false)
+    if (!IsTiering() ||
+        tieringAge_ == 0)
     {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
     }
 
-    virtual bool IsSuccess() const ORTHANC_OVERRIDE
-    {
-      return success_;
-    }
-      
-    virtual void Assign(const std::string& content) ORTHANC_OVERRIDE
+    // The subclass of the accessor reads the files as they are stored
+    // by the database engine (e.g. inline or chunked)
+    std::unique_ptr<IAccessor> accessor(CreateAccessor());
+    DatabaseManager& manager = dynamic_cast<AccessorBase&>(*accessor).GetManager();
+
+    std::list< std::pair<std::string, int32_t> > files;
+
     {
-      if (success_)
+      DatabaseManager::Transaction transaction(manager, TransactionType_ReadOnly);
+
+      const std::string count = boost::lexical_cast<std::string>(maxCount);
+      const std::string limit = boost::lexical_cast<std::string>(
+        GetSecondsSinceEpoch(now) - static_cast<int64_t>(tieringAge_) * 24 * 3600);
+
+      std::string sql;
+      if (manager.GetDialect() == Dialect_MSSQL)
       {
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+        sql = ("SELECT TOP(" + count + ") uuid, type FROM StorageAreaAges WHERE creation < " +
+               limit + " ORDER BY creation");
       }
       else
       {
-        target_.assign(content);
-        success_ = true;
+        sql = ("SELECT uuid, type FROM StorageAreaAges WHERE creation < " +
+               limit + " ORDER BY creation LIMIT " + count);
       }
-    }
-  };
-    
 
-  void StorageBackend::ReadWholeToString(std::string& target,
-                                         IAccessor& accessor,
-                                         const std::string& uuid,
-                                         OrthancPluginContentType type)
-  {
-    StringVisitor visitor(target);
-    accessor.ReadWhole(visitor, uuid, type);
+      DatabaseManager::StandaloneStatement statement(manager, sql);
+      statement.SetReadOnly(true);
+      statement.Execute();
 
-    if (!visitor.IsSuccess())
-    {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      while (!statement.IsDone())
+      {
+        files.push_back(std::make_pair(statement.ReadString(0), statement.ReadInteger32(1)));
+        statement.Next();
+      }
+
+      transaction.Commit();
     }
-  }
-    
 
-  void StorageBackend::ReadRangeToString(std::string& target,
-                                         IAccessor& accessor,
-                                         const std::string& uuid,
-                                         OrthancPluginContentType type,
-                                         uint64_t start,
-                                         size_t length)
-  {
-    StringVisitor visitor(target);
-    accessor.ReadRange(visitor, uuid, type, start, length);
+    size_t moved = 0;
 
-    if (!visitor.IsSuccess())
+    for (std::list< std::pair<std::string, int32_t> >::const_iterator
+           it = files.begin(); it != files.end(); ++it)
     {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+      const OrthancPluginContentType type = static_cast<OrthancPluginContentType>(it->second);
+
+      Dictionary args;
+      args.SetUtf8Value("uuid", it->first);
+      args.SetIntegerValue("type", type);
+
+      std::string content;
+
+      {
+        StringVisitor visitor(content);
+        accessor->ReadWhole(visitor, it->first, type);  // Uncompresses the file
+      }
+
+      if (tierFilesystem_->Exists(it->first))
+      {
+        tierFilesystem_->Remove(it->first);  // Left by an interrupted move
+      }
+
+      tierFilesystem_->Create(it->first, content.empty() ? NULL : content.c_str(), content.size());
+
+      bool found;
+
+      try
+      {
+        DatabaseManager::Transaction transaction(manager, TransactionType_ReadWrite);
+
+        {
+          // Locks the row, so that a concurrent "Remove()" waits for the move
+          DatabaseManager::CachedStatement statement(
+            STATEMENT_FROM_HERE, manager,
+            "UPDATE StorageAreaAges SET creation = creation WHERE uuid=${uuid} AND type=${type}");
+
+          statement.SetParameterType("uuid", ValueType_Utf8String);
+          statement.SetParameterType("type", ValueType_Integer64);
+          statement.Execute(args);
+        }
+
+        {
+          DatabaseManager::CachedStatement statement(
+            STATEMENT_FROM_HERE, manager,
+            "SELECT COUNT(*) FROM StorageAreaAges WHERE uuid=${uuid} AND type=${type}");
+
+          statement.SetReadOnly(true);
+          statement.SetParameterType("uuid", ValueType_Utf8String);
+          statement.SetParameterType("type", ValueType_Integer64);
+          statement.Execute(args);
+
+          found = (statement.ReadInteger64(0) != 0);
+        }
+
+        if (found)
+        {
+          {
+            DatabaseManager::CachedStatement statement(
+              STATEMENT_FROM_HERE, manager,
+              "DELETE FROM StorageArea WHERE uuid=${uuid} AND type=${type}");
+
+            statement.SetParameterType("uuid", ValueType_Utf8String);
+            statement.SetParameterType("type", ValueType_Integer64);
+            statement.Execute(args);
+          }
+
+          {
+            DatabaseManager::CachedStatement statement(
+              STATEMENT_FROM_HERE, manager,
+              "DELETE FROM StorageAreaAges WHERE uuid=${uuid} AND type=${type}");
+
+            statement.SetParameterType("uuid", ValueType_Utf8String);
+            statement.SetParameterType("type", ValueType_Integer64);
+            statement.Execute(args);
+          }
+
+          // The files of the tier are not compressed
+          UnregisterCompression(manager, it->first, type);
+
+          {
+            DatabaseManager::CachedStatement statement(
+              STATEMENT_FROM_HERE, manager,
+              "INSERT INTO StorageAreaTiered VALUES(${uuid}, ${type})");
+
+            statement.SetParameterType("uuid", ValueType_Utf8String);
+            statement.SetParameterType("type", ValueType_Integer64);
+            statement.Execute(args);
+          }
+        }
+
+        transaction.Commit();
+      }
+      catch (Orthanc::OrthancException&)
+      {
+        tierFilesystem_->Remove(it->first);
+        throw;
+      }
+
+      if (found)
+      {
+        moved++;
+      }
+      else
+      {
+        // The file has been removed in the meantime
+        tierFilesystem_->Remove(it->first);
+      }
     }
+
+    return moved;
   }
 
 
-  void StorageBackend::Execute(IDatabaseOperation& operation)
+  void StorageBackend::TieringThread(StorageBackend* that)
   {
-    std::unique_ptr<IAccessor> accessor(CreateAccessor());
-    if (accessor.get() == NULL)
-    {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
-    }
-    
-#if ORTHANC_FRAMEWORK_VERSION_IS_ABOVE(1, 9, 2)
-    unsigned int attempt = 0;
-#endif
-    
+    assert(that != NULL);
+
     for (;;)
     {
-      try
       {
-        operation.Execute(*accessor);
-        return;  // Success
+        boost::mutex::scoped_lock lock(that->tieringMutex_);
+
+        if (!that->tieringStop_)
+        {
+          that->tieringCondition_.timed_wait(
+            lock, boost::posix_time::seconds(that->tieringInterval_));
+        }
+
+        if (that->tieringStop_)
+        {
+          return;
+        }
       }
-      catch (Orthanc::OrthancException& e)
+
+      try
       {
-#if ORTHANC_FRAMEWORK_VERSION_IS_ABOVE(1, 9, 2)
-        if (e.GetErrorCode() == Orthanc::ErrorCode_DatabaseCannotSerialize)
+        size_t count;
+
+        do
         {
-          if (attempt >= maxRetries_)
+          count = that->MoveToTier(that->tieringBatchSize_, boost::posix_time::microsec_clock::universal_time());
+
+          if (count > 0)
           {
-            throw;
+            LOG(INFO) << "Moved " << count << " file(s) from the storage area to the tier";
           }
-          else
+
+          boost::mutex::scoped_lock lock(that->tieringMutex_);
+          if (that->tieringStop_)
           {
-            attempt++;
-            
-            // The "rand()" adds some jitter to de-synchronize writers
-            boost::this_thread::sleep(boost::posix_time::milliseconds(100 * attempt + 5 * (rand() % 10)));
+            return;
           }
         }
-        else
-        {
-          throw;
-        }
-#else
-        throw;
-#endif
+        while (count == that->tieringBatchSize_);
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        LOG(ERROR) << "Error while moving the files of the storage area to the tier: " << e.What();
       }
     }
   }
@@ -24,10 +24,23 @@
 #pragma once
 
 #include "../Common/DatabaseManager.h"
+#include "../Common/ResultFileValue.h"
+#include "AttachmentCache.h"
+#include "FilesystemStorage.h"
+#include "RetryPolicy.h"
 
+#include <MultiThreading/SharedMessageQueue.h>
+#include <OrthancException.h>
 #include <orthanc/OrthancCDatabasePlugin.h>
 
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/thread/mutex.hpp>
+#include <list>
+#include <map>
+#include <set>
+#include <vector>
 
 
 namespace OrthancDatabases
@@ -45,8 +58,32 @@ namespace OrthancDatabases
       virtual void Assign(const std::string& content) = 0;
 
       virtual bool IsSuccess() const = 0;
+
+      /**
+       * Zero-copy path: If this returns "true", the storage backend
+       * may directly write the content into the buffer returned by
+       * "AllocateBuffer()", then call "MarkAssigned()", instead of
+       * calling "Assign()". "AllocateBuffer()" can be called more
+       * than once if the transaction is retried.
+       **/
+      virtual bool IsZeroCopy() const
+      {
+        return false;
+      }
+
+      virtual void* AllocateBuffer(size_t size)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+      }
+
+      virtual void MarkAssigned()
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+      }
     };
 
+    typedef ResultFileValue::IChunkVisitor  IFileChunkVisitor;
+
     class IAccessor : public boost::noncopyable
     {
     public:
@@ -68,9 +105,31 @@ namespace OrthancDatabases
                              OrthancPluginContentType type,
                              uint64_t start,
                              size_t length) = 0;
+
+      // Streams a range of the file, by chunks of at most "chunkSize" bytes
+      virtual void ReadRange(IFileChunkVisitor& visitor,
+                             const std::string& uuid,
+                             OrthancPluginContentType type,
+                             uint64_t start,
+                             size_t length,
+                             size_t chunkSize) = 0;
       
       virtual void Remove(const std::string& uuid,
                           OrthancPluginContentType type) = 0;
+
+      // Gives the file whose row of "StorageArea" holds the content of
+      // "(uuid, type)", which differs if this file is a duplicate.
+      // Throws "ErrorCode_UnknownResource" if "(uuid, type)" is the
+      // removed owner of a content that is still shared.
+      virtual void ResolveContent(std::string& targetUuid,
+                                  OrthancPluginContentType& targetType,
+                                  const std::string& uuid,
+                                  OrthancPluginContentType type) = 0;
+
+      // Returns the tier that holds the content of the file, or "NULL"
+      // if this content is stored in the database
+      virtual FilesystemStorage* LookupTier(const std::string& uuid,
+                                            OrthancPluginContentType type) = 0;
     };
     
     /**
@@ -93,28 +152,143 @@ namespace OrthancDatabases
 
   private:
     class StringVisitor;
-    
-    boost::mutex      mutex_;
-    DatabaseManager   manager_;
-    unsigned int      maxRetries_;
+    class VisitorAllocator;
+    class SharedFactory;
+    class ManagerReference;
+
+    boost::mutex                         mutex_;  // Protects "connections_" and "countConnections_"
+    boost::mutex                         factoryMutex_;
+    std::unique_ptr<IDatabaseFactory>    factory_;
+    std::vector<DatabaseManager*>        connections_;       // Indexed by shard, NULL once drained
+    size_t                               countConnections_;  // The shards above are drained once released
+    Orthanc::SharedMessageQueue          availableConnections_;
+    unsigned int                         maxRetries_;
+    RetryPolicy                          retryPolicy_;
+    std::set<OrthancPluginContentType>   compressedContentTypes_;
+    boost::mutex                         compressedFilesMutex_;
+    bool                                 hasCompressedFiles_;  // Protected by "compressedFilesMutex_"
+    bool                                 deferredRemove_;
+    bool                                 deduplication_;
+    bool                                 usageAccounting_;
+    boost::mutex                         usageMutex_;
+    std::set< std::pair<int32_t, unsigned int> >  usageRows_;  // Protected by "usageMutex_"
+    unsigned int                         deferredRemoveBatchSize_;
+    unsigned int                         deferredRemoveInterval_;
+    unsigned int                         deferredRemoveMaxRate_;  // In files per second, "0" if unbounded
+    boost::mutex                         deferredRemoveMutex_;
+    boost::condition_variable            deferredRemoveCondition_;
+    bool                                 deferredRemoveStop_;  // Protected by "deferredRemoveMutex_"
+    boost::thread                        deferredRemoveThread_;
+    AttachmentCache                      attachmentCache_;
+    std::unique_ptr<FilesystemStorage>   dicomFilesystem_;
+    Orthanc::SharedMessageQueue          prefetchQueue_;
+    std::vector<boost::thread*>          prefetchThreads_;
+    bool                                 prefetchStop_;  // Protected by "prefetchMutex_"
+    boost::mutex                         prefetchMutex_;
+    std::unique_ptr<FilesystemStorage>   tierFilesystem_;
+    unsigned int                         tieringAge_;  // In days, "0" if the files are not moved anymore
+    unsigned int                         tieringBatchSize_;
+    unsigned int                         tieringInterval_;
+    boost::mutex                         tieringMutex_;
+    boost::condition_variable            tieringCondition_;
+    bool                                 tieringStop_;  // Protected by "tieringMutex_"
+    boost::thread                        tieringThread_;
+
+    static void DeferredRemoveThread(StorageBackend* that);
+
+    static void TieringThread(StorageBackend* that);
+
+    static void PrefetchThread(StorageBackend* that);
+
+    class PrefetchRequest;
+
+    // Must be called when the row of a file is deleted from "StorageArea"
+    static void AccountRemoval(DatabaseManager& manager,
+                               const std::string& uuid,
+                               OrthancPluginContentType type);
+
+    // Must be called when the row of a file is deleted from
+    // "StorageArea". Returns "true" if the content of the file is in
+    // the tier, which must then be removed once the transaction is
+    // committed.
+    bool UnregisterTiering(DatabaseManager& manager,
+                           const std::string& uuid,
+                           OrthancPluginContentType type);
+
+    // Whether the table "StorageAreaCompressed" is known to exist
+    bool HasCompressedFiles();
+
+    // Detects the table "StorageAreaCompressed", that might have been
+    // created by another Orthanc server since this one was started
+    bool RefreshCompressedFiles(DatabaseManager& manager);
+
+    // Must be called when the row of a file is deleted from "StorageArea"
+    void UnregisterCompression(DatabaseManager& manager,
+                               const std::string& uuid,
+                               OrthancPluginContentType type);
 
   protected:
+    /**
+     * Each accessor takes one connection out of the pool of the
+     * storage area for its whole lifetime, and gives it back in its
+     * destructor. If all the connections are in use, the constructor
+     * waits until one becomes available.
+     **/
     class AccessorBase : public IAccessor
     {
     private:
-      boost::mutex::scoped_lock  lock_;
-      DatabaseManager&           manager_;
+      StorageBackend&   backend_;
+      DatabaseManager*  manager_;
+      unsigned int      shard_;  // Index of the connection in the pool
+
+      void EnsureUsageRow(OrthancPluginContentType type);
+
+      void AccountCreation(const std::string& uuid,
+                           OrthancPluginContentType type,
+                           size_t size);
+
+      bool CreateDuplicate(const std::string& uuid,
+                           OrthancPluginContentType type,
+                           const std::string& hash);
+
+      void RegisterContent(const std::string& uuid,
+                           OrthancPluginContentType type,
+                           const std::string& hash);
+
+    protected:
+      // Tells whether the file was compressed by "Create()". This must
+      // be called outside of a transaction.
+      bool IsCompressedFile(const std::string& uuid,
+                            OrthancPluginContentType type);
+
+      // Same as "IsCompressedFile()", given the content of the file as
+      // read from the database. The lookup is skipped if the content
+      // doesn't start with the signature of the compressed files.
+      bool IsCompressedContent(const std::string& uuid,
+                               OrthancPluginContentType type,
+                               const void* content,
+                               size_t size);
+
+      // Inserts the content of a new file, once it has been compressed
+      // if need be. This is called within a read-write transaction.
+      virtual void InsertContent(const std::string& uuid,
+                                 const void* content,
+                                 size_t size,
+                                 OrthancPluginContentType type);
 
     public:
-      explicit AccessorBase(StorageBackend& backend) :
-        lock_(backend.mutex_),
-        manager_(backend.manager_)
+      explicit AccessorBase(StorageBackend& backend);
+
+      virtual ~AccessorBase();
+
+      StorageBackend& GetBackend() const
       {
+        return backend_;
       }
 
       DatabaseManager& GetManager() const
       {
-        return manager_;
+        return *manager_;
       }
 
       virtual void Create(const std::string& uuid,
@@ -131,19 +305,239 @@ namespace OrthancDatabases
                              OrthancPluginContentType type,
                              uint64_t start,
                              size_t length) ORTHANC_OVERRIDE;
+
+      virtual void ReadRange(IFileChunkVisitor& visitor,
+                             const std::string& uuid,
+                             OrthancPluginContentType type,
+                             uint64_t start,
+                             size_t length,
+                             size_t chunkSize) ORTHANC_OVERRIDE;
       
       virtual void Remove(const std::string& uuid,
                           OrthancPluginContentType type) ORTHANC_OVERRIDE;
+
+      virtual void ResolveContent(std::string& targetUuid,
+                                  OrthancPluginContentType& targetType,
+                                  const std::string& uuid,
+                                  OrthancPluginContentType type) ORTHANC_OVERRIDE;
+
+      virtual FilesystemStorage* LookupTier(const std::string& uuid,
+                                            OrthancPluginContentType type) ORTHANC_OVERRIDE;
     };
     
     virtual bool HasReadRange() const = 0;
 
+    /**
+     * Whether "RemovePendingInBulk()" is implemented. It is only used
+     * if neither the accounting of the usage, nor the tiering, nor the
+     * compression is used, as these require one statement per file.
+     **/
+    virtual bool HasBulkRemove() const
+    {
+      return false;
+    }
+
+    /**
+     * Removes at most "maxCount" queued files with a bounded number of
+     * statements (instead of one statement per file), and returns the
+     * number of files that were removed. This is called within a
+     * read-write transaction.
+     **/
+    virtual size_t RemovePendingInBulk(DatabaseManager& manager,
+                                       size_t maxCount)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+    }
+
   public:
     StorageBackend(IDatabaseFactory* factory /* takes ownership */,
                    unsigned int maxRetries);
 
-    virtual ~StorageBackend()
+    virtual ~StorageBackend();
+
+    /**
+     * Sets the number of connections to the database that are
+     * available to serve concurrent requests to the storage area. This
+     * can be called at runtime: If the pool shrinks, the connections
+     * in excess are closed as soon as they are given back by their
+     * accessor.
+     **/
+    void SetConnectionsCount(size_t count);
+
+    size_t GetConnectionsCount();
+
+    /**
+     * Enables the transparent compression of the files of the given
+     * content type. DICOM files whose transfer syntax is already
+     * compressed are stored as such. This must be called before
+     * "Register()". The files are always uncompressed on reading,
+     * whatever this setting.
+     **/
+    void SetCompressed(OrthancPluginContentType type,
+                       bool compressed);
+
+    bool IsCompressed(OrthancPluginContentType type) const;
+
+    /**
+     * Enables the deferred removal of the files: "Remove()" only
+     * queues the file into the "PendingDeletes" table, which is
+     * drained by a background thread by batches of "batchSize" files
+     * every "intervalSeconds". The file is thus removed outside of
+     * the request of the Orthanc core that deletes the resource. This
+     * must be called before "Register()".
+     **/
+    void SetDeferredRemove(unsigned int batchSize,
+                           unsigned int intervalSeconds);
+
+    bool IsDeferredRemove() const
+    {
+      return deferredRemove_;
+    }
+
+    /**
+     * Bounds the rate at which the background thread removes the
+     * queued files, so that the deletions of large studies don't
+     * compete with the ingests for the I/O of the database (e.g. the
+     * WAL of PostgreSQL). "0" means unbounded, which is the default.
+     **/
+    void SetDeferredRemoveMaxRate(unsigned int filesPerSecond);
+
+    /**
+     * Enables the deduplication of the files: Identical contents,
+     * identified by their SHA-1 and their size, are only written once
+     * to "StorageArea", and are shared by reference counting in the
+     * "StorageAreaContents" and "StorageAreaDuplicates" tables. The
+     * files that were written while the deduplication was disabled
+     * are left untouched. This must be called before "Register()".
+     * The deduplication cannot be disabled anymore once some files
+     * are shared, as their duplicates would become unreadable.
+     **/
+    void SetDeduplication(bool deduplication);
+
+    bool IsDeduplication() const
+    {
+      return deduplication_;
+    }
+
+    /**
+     * Maintains the number of files and the number of stored bytes
+     * (i.e. once compressed) for each content type, in the same
+     * transaction as the writes. The counters are split into one row
+     * per connection of the pool, in order to avoid contention. Only
+     * the files that are written once the accounting is enabled are
+     * counted. This must be called before "Register()".
+     **/
+    void SetUsageAccounting(bool enabled);
+
+    bool IsUsageAccounting() const
+    {
+      return usageAccounting_;
+    }
+
+    // Content type -> (files count, total size in bytes)
+    typedef std::map<int32_t, std::pair<uint64_t, uint64_t> >  Usage;
+
+    void ReadUsage(Usage& target);
+
+    // Removes at most "maxCount" queued files, and returns the number
+    // of files that were removed
+    size_t DrainPendingDeletes(size_t maxCount);
+
+    /**
+     * Enables the read-through cache of the attachments, whose total
+     * size is bounded by "maxSize" bytes. The hot files (e.g. the
+     * studies of a reading session) are then read from the memory of
+     * the plugin instead of from the database. "0" disables the
+     * cache, which is the default.
+     **/
+    void SetAttachmentCacheSize(uint64_t maxSize)
+    {
+      attachmentCache_.SetMaxSize(maxSize);
+    }
+
+    AttachmentCache& GetAttachmentCache()
+    {
+      return attachmentCache_;
+    }
+
+    /**
+     * Index-only mode ("StoreDicom" set to "false"): The DICOM files
+     * are written to the given directory, with the same layout as the
+     * default storage area of the Orthanc core, and only the small
+     * attachments (e.g. "DicomUntilPixelData") are kept in the
+     * database. This must be called before "Register()".
+     **/
+    void SetDicomDirectory(const std::string& root);
+
+    /**
+     * Starts "count" threads that read the files given to "Prefetch()"
+     * into the cache of the attachments, ahead of the requests of the
+     * Orthanc core (e.g. the other instances of a series opened in a
+     * viewer). Each thread takes one connection of the pool while it
+     * reads. This requires the cache of the attachments, and must be
+     * called before "Register()".
+     **/
+    void SetPrefetchThreads(unsigned int count);
+
+    bool HasPrefetch() const
     {
+      return !prefetchThreads_.empty();
+    }
+
+    // Queues the file for an asynchronous read into the cache. The
+    // oldest requests are dropped if too many files are queued.
+    void Prefetch(const std::string& uuid,
+                  OrthancPluginContentType type);
+
+    // Reads the whole file, either from the database or from the
+    // directory of the DICOM files, bypassing the cache
+    void ReadWholeUncached(std::string& target,
+                           const std::string& uuid,
+                           OrthancPluginContentType type);
+
+    // Returns "NULL" if the files of this type are stored in the database
+    FilesystemStorage* LookupFilesystem(OrthancPluginContentType type)
+    {
+      if (type == OrthancPluginContentType_Dicom)
+      {
+        return dicomFilesystem_.get();
+      }
+      else
+      {
+        return NULL;
+      }
+    }
+
+    /**
+     * Enables the tiering of the files: A background thread moves the
+     * files that were written more than "ageDays" days ago from the
+     * database to the given directory, by batches of "batchSize" files
+     * every "intervalSeconds". A row of "StorageAreaTiered" locates
+     * each moved file, so that the reads are unchanged. The files that
+     * were written before the tiering was enabled are aged from this
+     * moment. If "ageDays" is "0", the files are not moved anymore,
+     * but the files that were moved can still be read. This must be
+     * called before "Register()".
+     **/
+    void SetTiering(const std::string& root,
+                    unsigned int ageDays,
+                    unsigned int batchSize,
+                    unsigned int intervalSeconds);
+
+    bool IsTiering() const
+    {
+      return tierFilesystem_.get() != NULL;
+    }
+
+    // Moves at most "maxCount" files that are older than the tiering
+    // age at time "now", and returns the number of files that were moved
+    size_t MoveToTier(size_t maxCount,
+                      const boost::posix_time::ptime& now);
+
+    // If "true", the ranges of files are extracted from the uncompressed files
+    bool HasCompression() const
+    {
+      return !compressedContentTypes_.empty();
     }
 
     virtual IAccessor* CreateAccessor()
@@ -170,11 +564,25 @@ namespace OrthancDatabases
                                   uint64_t start,
                                   size_t length);
 
+    // For unit tests
+    static void ReadRangeToString(std::string& target,
+                                  IAccessor& accessor,
+                                  const std::string& uuid,
+                                  OrthancPluginContentType type,
+                                  uint64_t start,
+                                  size_t length,
+                                  size_t chunkSize);
+
     unsigned int GetMaxRetries() const
     {
       return maxRetries_;
     }
 
+    RetryPolicy& GetRetryPolicy()
+    {
+      return retryPolicy_;
+    }
+
     void Execute(IDatabaseOperation& operation);
   };
 }
@@ -0,0 +1,199 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "StorageCompression.h"
+
+#include <Compression/ZlibCompressor.h>
+#include <OrthancException.h>
+
+#include <string.h>
+
+
+namespace OrthancDatabases
+{
+  // Similar to the signature of PNG files
+  static const uint8_t SIGNATURE[] = { 0x89, 'O', 'Z', 'L', '\r', '\n', 0x1a, '\n' };
+  static const size_t SIGNATURE_SIZE = sizeof(SIGNATURE);
+
+
+  bool StorageCompression::HasSignature(const void* data,
+                                        size_t size)
+  {
+    return (size >= SIGNATURE_SIZE &&
+            memcmp(data, SIGNATURE, SIGNATURE_SIZE) == 0);
+  }
+
+
+  bool StorageCompression::Compress(std::string& target,
+                                    const void* data,
+                                    size_t size)
+  {
+    if (size == 0)
+    {
+      return false;
+    }
+
+    Orthanc::ZlibCompressor compressor;
+    compressor.SetPrefixWithUncompressedSize(true);
+
+    std::string compressed;
+    compressor.Compress(compressed, data, size);
+
+    if (compressed.size() + SIGNATURE_SIZE >= size)
+    {
+      return false;
+    }
+    else
+    {
+      target.reserve(SIGNATURE_SIZE + compressed.size());
+      target.assign(reinterpret_cast<const char*>(SIGNATURE), SIGNATURE_SIZE);
+      target.append(compressed);
+      return true;
+    }
+  }
+
+
+  void StorageCompression::Uncompress(std::string& target,
+                                      const void* data,
+                                      size_t size)
+  {
+    if (!HasSignature(data, size))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadFileFormat);
+    }
+
+    Orthanc::ZlibCompressor compressor;
+    compressor.SetPrefixWithUncompressedSize(true);
+    compressor.Uncompress(target, reinterpret_cast<const uint8_t*>(data) + SIGNATURE_SIZE, size - SIGNATURE_SIZE);
+  }
+
+
+  static uint16_t ReadUnsignedInteger16(const uint8_t* p)
+  {
+    return static_cast<uint16_t>(p[0]) | (static_cast<uint16_t>(p[1]) << 8);
+  }
+
+
+  static uint32_t ReadUnsignedInteger32(const uint8_t* p)
+  {
+    return (static_cast<uint32_t>(p[0]) |
+            (static_cast<uint32_t>(p[1]) << 8) |
+            (static_cast<uint32_t>(p[2]) << 16) |
+            (static_cast<uint32_t>(p[3]) << 24));
+  }
+
+
+  static bool LookupTransferSyntax(std::string& target,
+                                   const uint8_t* dicom,
+                                   size_t size)
+  {
+    // The meta header (group 0x0002) follows the 128-byte preamble
+    // and the "DICM" magic, and is always encoded as Explicit VR
+    // Little Endian (PS3.10 Section 7.1)
+    if (size < 132 ||
+        memcmp(dicom + 128, "DICM", 4) != 0)
+    {
+      return false;
+    }
+
+    size_t pos = 132;
+
+    while (pos + 8 <= size)
+    {
+      const uint16_t group = ReadUnsignedInteger16(dicom + pos);
+      const uint16_t element = ReadUnsignedInteger16(dicom + pos + 2);
+
+      if (group != 0x0002)
+      {
+        return false;
+      }
+
+      const char vr[2] = { static_cast<char>(dicom[pos + 4]), static_cast<char>(dicom[pos + 5]) };
+
+      uint32_t length;
+      if ((vr[0] == 'O' && (vr[1] == 'B' || vr[1] == 'W' || vr[1] == 'F')) ||
+          (vr[0] == 'S' && vr[1] == 'Q') ||
+          (vr[0] == 'U' && (vr[1] == 'T' || vr[1] == 'N')))
+      {
+        if (pos + 12 > size)
+        {
+          return false;
+        }
+
+        length = ReadUnsignedInteger32(dicom + pos + 8);
+        pos += 12;
+      }
+      else
+      {
+        length = ReadUnsignedInteger16(dicom + pos + 6);
+        pos += 8;
+      }
+
+      if (length > size - pos)
+      {
+        return false;
+      }
+
+      if (element == 0x0010)
+      {
+        target.assign(reinterpret_cast<const char*>(dicom + pos), length);
+
+        // Remove the padding
+        while (!target.empty() &&
+               (target[target.size() - 1] == '\0' ||
+                target[target.size() - 1] == ' '))
+        {
+          target.resize(target.size() - 1);
+        }
+
+        return true;
+      }
+
+      pos += length;
+    }
+
+    return false;
+  }
+
+
+  bool StorageCompression::HasCompressedTransferSyntax(const void* dicom,
+                                                       size_t size)
+  {
+    std::string transferSyntax;
+    if (!LookupTransferSyntax(transferSyntax, reinterpret_cast<const uint8_t*>(dicom), size))
+    {
+      return false;
+    }
+
+    // Deflated Explicit VR Little Endian
+    if (transferSyntax == "1.2.840.10008.1.2.1.99")
+    {
+      return true;
+    }
+
+    // JPEG, JPEG-LS, JPEG 2000, JPIP, MPEG, HEVC and HTJ2K share the
+    // prefix "1.2.840.10008.1.2.4.", then comes RLE Lossless
+    return (transferSyntax.compare(0, 20, "1.2.840.10008.1.2.4.") == 0 ||
+            transferSyntax == "1.2.840.10008.1.2.5");
+  }
+}
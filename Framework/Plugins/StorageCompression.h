@@ -0,0 +1,64 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include <boost/noncopyable.hpp>
+#include <stdint.h>
+#include <string>
+
+
+namespace OrthancDatabases
+{
+  /**
+   * Transparent compression of the files of the storage area. The
+   * compressed files start with a signature. As the signature can
+   * also occur at the beginning of a file that was not compressed
+   * (e.g. in the free-form preamble of a DICOM file), the storage
+   * area records which files were compressed: The signature is only
+   * used to skip this lookup for the other files.
+   **/
+  class StorageCompression : public boost::noncopyable
+  {
+  public:
+    static bool HasSignature(const void* data,
+                             size_t size);
+
+    // Returns "false" if compression would not reduce the size
+    static bool Compress(std::string& target,
+                         const void* data,
+                         size_t size);
+
+    static void Uncompress(std::string& target,
+                           const void* data,
+                           size_t size);
+
+    /**
+     * Checks whether the transfer syntax in the meta header of a
+     * DICOM file is already compressed (JPEG, JPEG-LS, JPEG 2000,
+     * RLE, MPEG...), in which case compressing it again is useless.
+     **/
+    static bool HasCompressedTransferSyntax(const void* dicom,
+                                            size_t size);
+  };
+}
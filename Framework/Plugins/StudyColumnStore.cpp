@@ -0,0 +1,719 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "StudyColumnStore.h"
+
+#include <OrthancException.h>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <limits>
+
+
+namespace OrthancDatabases
+{
+  static const uint32_t NO_VALUE = std::numeric_limits<uint32_t>::max();
+
+  // Longer than the transactions that write the identifier tags
+  static const unsigned int RECENT_UPDATES_MINUTES = 10;
+
+  // Above this number of distinct values, a column is not dictionary-encoded
+  static const size_t MAX_DICTIONARY_SIZE = 16384;
+
+
+  static bool IsDigits(const char* value,
+                       size_t size)
+  {
+    for (size_t i = 0; i < size; i++)
+    {
+      if (value[i] < '0' || value[i] > '9')
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
+
+
+  static bool IsEqual(const char* value,
+                      size_t size,
+                      const std::string& expected)
+  {
+    return (size == expected.size() &&
+            (size == 0 || memcmp(value, expected.c_str(), size) == 0));
+  }
+
+
+  static int CompareBytewise(const char* value,
+                             size_t size,
+                             const std::string& bound)
+  {
+    const int c = memcmp(value, bound.c_str(), std::min(size, bound.size()));
+
+    if (c != 0)
+    {
+      return c;
+    }
+    else if (size < bound.size())
+    {
+      return -1;
+    }
+    else if (size > bound.size())
+    {
+      return 1;
+    }
+    else
+    {
+      return 0;
+    }
+  }
+
+
+  // Skips one UTF-8 character, as "_" in the "LIKE" of the database
+  static size_t SkipCharacter(const char* value,
+                              size_t size,
+                              size_t position)
+  {
+    assert(position < size);
+    position++;
+
+    while (position < size &&
+           (static_cast<uint8_t>(value[position]) & 0xc0) == 0x80)
+    {
+      position++;
+    }
+
+    return position;
+  }
+
+
+  // "*" matches any sequence of characters, "?" matches one character
+  static bool MatchWildcard(const char* value,
+                            size_t size,
+                            const std::string& pattern)
+  {
+    size_t v = 0;
+    size_t p = 0;
+    size_t starPattern = std::string::npos;
+    size_t starValue = 0;
+
+    while (v < size)
+    {
+      if (p < pattern.size() &&
+          pattern[p] == '?')
+      {
+        v = SkipCharacter(value, size, v);
+        p++;
+      }
+      else if (p < pattern.size() &&
+               pattern[p] == '*')
+      {
+        starPattern = p;
+        starValue = v;
+        p++;
+      }
+      else if (p < pattern.size() &&
+               pattern[p] == value[v])
+      {
+        v++;
+        p++;
+      }
+      else if (starPattern != std::string::npos)
+      {
+        // Extend the sequence that is matched by the last "*"
+        starValue = SkipCharacter(value, size, starValue);
+        v = starValue;
+        p = starPattern + 1;
+      }
+      else
+      {
+        return false;
+      }
+    }
+
+    while (p < pattern.size() &&
+           pattern[p] == '*')
+    {
+      p++;
+    }
+
+    return (p == pattern.size());
+  }
+
+
+  // Whether the constraint is ignored by the database (cf. "FormatComparison()")
+  static bool IsUniversalConstraint(const DatabaseConstraint& constraint)
+  {
+    return (!constraint.IsMandatory() &&
+            constraint.GetConstraintType() == ConstraintType_Wildcard &&
+            constraint.GetSingleValue() == "*");
+  }
+
+
+  size_t StudyColumnStore::Table::Column::Append(const std::string& value)
+  {
+    if (encoded_)
+    {
+      Dictionary::const_iterator found = dictionary_.find(value);
+
+      if (found != dictionary_.end())
+      {
+        return found->second;
+      }
+      else if (dictionary_.size() == MAX_DICTIONARY_SIZE)
+      {
+        // Not a low-cardinality tag: The next values are appended one by one
+        encoded_ = false;
+
+        Dictionary empty;
+        dictionary_.swap(empty);
+      }
+    }
+
+    const size_t offset = data_.size();
+    data_.append(value);
+
+    if (encoded_)
+    {
+      dictionary_[value] = offset;
+    }
+
+    return offset;
+  }
+
+
+  StudyColumnStore::Table::Table(const std::vector<Orthanc::DicomTag>& tags)
+  {
+    columns_.reserve(tags.size());
+
+    for (size_t i = 0; i < tags.size(); i++)
+    {
+      columns_.push_back(Column(tags[i]));
+    }
+  }
+
+
+  bool StudyColumnStore::Table::SetValue(int64_t id,
+                                         const Orthanc::DicomTag& tag,
+                                         const std::string& value)
+  {
+    size_t column = 0;
+    while (column < columns_.size() &&
+           columns_[column].tag_ != tag)
+    {
+      column++;
+    }
+
+    if (column == columns_.size())
+    {
+      return false;
+    }
+
+    size_t row;
+
+    Rows::const_iterator found = rows_.find(id);
+    if (found == rows_.end())
+    {
+      row = ids_.size();
+      ids_.push_back(id);
+      changed_.push_back(0);
+
+      for (size_t i = 0; i < columns_.size(); i++)
+      {
+        columns_[i].offsets_.push_back(0);
+        columns_[i].sizes_.push_back(NO_VALUE);
+      }
+
+      rows_[id] = row;
+    }
+    else
+    {
+      row = found->second;
+    }
+
+    Column& target = columns_[column];
+
+    if (target.sizes_[row] != NO_VALUE)
+    {
+      if (IsEqual(target.data_.c_str() + target.offsets_[row], target.sizes_[row], value))
+      {
+        return true;
+      }
+      else
+      {
+        // The former value might be restored by a rollback
+        changed_[row] = 1;
+      }
+    }
+
+    if (value.size() >= NO_VALUE)
+    {
+      changed_[row] = 1;
+    }
+    else
+    {
+      // The former value is kept in "data_" until the next reload
+      target.offsets_[row] = target.Append(value);
+      target.sizes_[row] = static_cast<uint32_t>(value.size());
+    }
+
+    return true;
+  }
+
+
+  bool StudyColumnStore::Table::IsEncoded(const Orthanc::DicomTag& tag) const
+  {
+    for (size_t i = 0; i < columns_.size(); i++)
+    {
+      if (columns_[i].tag_ == tag)
+      {
+        return columns_[i].encoded_;
+      }
+    }
+
+    return false;
+  }
+
+
+  bool StudyColumnStore::Table::MatchColumn(std::vector<uint8_t>& matches,
+                                            const DatabaseConstraint& constraint) const
+  {
+    size_t index = 0;
+    while (index < columns_.size() &&
+           columns_[index].tag_ != constraint.GetTag())
+    {
+      index++;
+    }
+
+    if (index == columns_.size())
+    {
+      return false;
+    }
+
+    const Column& column = columns_[index];
+    const char* data = column.data_.c_str();
+    const uint8_t missing = (constraint.IsMandatory() ? 0 : 1);
+
+    assert(matches.size() == ids_.size() &&
+           column.sizes_.size() == ids_.size());
+
+    switch (constraint.GetConstraintType())
+    {
+      case ConstraintType_Equal:
+      {
+        const std::string& expected = constraint.GetSingleValue();
+
+        if (column.encoded_)
+        {
+          /**
+           * Each distinct value is stored once: The integers are
+           * compared instead of the strings. The size distinguishes
+           * the empty value from the value stored after it.
+           **/
+          Column::Dictionary::const_iterator found = column.dictionary_.find(expected);
+          const bool isKnown = (found != column.dictionary_.end());
+          const size_t offset = (isKnown ? found->second : 0);
+
+          for (size_t i = 0; i < matches.size(); i++)
+          {
+            if (matches[i])
+            {
+              const uint32_t size = column.sizes_[i];
+              matches[i] = (size == NO_VALUE ? missing :
+                            (isKnown && column.offsets_[i] == offset && size == expected.size()) ? 1 : 0);
+            }
+          }
+
+          return true;
+        }
+
+        for (size_t i = 0; i < matches.size(); i++)
+        {
+          if (matches[i])
+          {
+            const uint32_t size = column.sizes_[i];
+            matches[i] = (size == NO_VALUE ? missing :
+                          IsEqual(data + column.offsets_[i], size, expected) ? 1 : 0);
+          }
+        }
+
+        return true;
+      }
+
+      case ConstraintType_List:
+      {
+        if (column.encoded_)
+        {
+          std::vector< std::pair<size_t, size_t> > known;  // Offset and size of the values of the list
+          known.reserve(constraint.GetValuesCount());
+
+          for (size_t j = 0; j < constraint.GetValuesCount(); j++)
+          {
+            Column::Dictionary::const_iterator found = column.dictionary_.find(constraint.GetValue(j));
+            if (found != column.dictionary_.end())
+            {
+              known.push_back(std::make_pair(found->second, constraint.GetValue(j).size()));
+            }
+          }
+
+          for (size_t i = 0; i < matches.size(); i++)
+          {
+            if (matches[i])
+            {
+              const uint32_t size = column.sizes_[i];
+
+              if (size == NO_VALUE)
+              {
+                matches[i] = missing;
+              }
+              else
+              {
+                matches[i] = 0;
+
+                for (size_t j = 0; j < known.size(); j++)
+                {
+                  if (column.offsets_[i] == known[j].first &&
+                      size == known[j].second)
+                  {
+                    matches[i] = 1;
+                    break;
+                  }
+                }
+              }
+            }
+          }
+
+          return true;
+        }
+
+        for (size_t i = 0; i < matches.size(); i++)
+        {
+          if (matches[i])
+          {
+            const uint32_t size = column.sizes_[i];
+
+            if (size == NO_VALUE)
+            {
+              matches[i] = missing;
+            }
+            else
+            {
+              matches[i] = 0;
+
+              for (size_t j = 0; j < constraint.GetValuesCount(); j++)
+              {
+                if (IsEqual(data + column.offsets_[i], size, constraint.GetValue(j)))
+                {
+                  matches[i] = 1;
+                  break;
+                }
+              }
+            }
+          }
+        }
+
+        return true;
+      }
+
+      case ConstraintType_SmallerOrEqual:
+      case ConstraintType_GreaterOrEqual:
+      {
+        /**
+         * The database compares the values with its collation, that
+         * only matches the bytewise order for the strings of digits
+         * (e.g. the dates): The other values remain candidates.
+         **/
+        const std::string& bound = constraint.GetSingleValue();
+        const bool isDigitsBound = IsDigits(bound.c_str(), bound.size());
+        const int sign = (constraint.GetConstraintType() == ConstraintType_SmallerOrEqual ? 1 : -1);
+
+        for (size_t i = 0; i < matches.size(); i++)
+        {
+          if (matches[i])
+          {
+            const uint32_t size = column.sizes_[i];
+
+            if (size == NO_VALUE)
+            {
+              matches[i] = missing;
+            }
+            else if (isDigitsBound &&
+                     IsDigits(data + column.offsets_[i], size))
+            {
+              matches[i] = (sign * CompareBytewise(data + column.offsets_[i], size, bound) <= 0 ? 1 : 0);
+            }
+          }
+        }
+
+        return true;
+      }
+
+      case ConstraintType_Wildcard:
+      {
+        const std::string& pattern = constraint.GetSingleValue();
+
+        for (size_t i = 0; i < matches.size(); i++)
+        {
+          if (matches[i])
+          {
+            const uint32_t size = column.sizes_[i];
+            matches[i] = (size == NO_VALUE ? missing :
+                          MatchWildcard(data + column.offsets_[i], size, pattern) ? 1 : 0);
+          }
+        }
+
+        return true;
+      }
+
+      default:
+        return false;
+    }
+  }
+
+
+  bool StudyColumnStore::Table::Evaluate(Resources& candidates,
+                                         const DatabaseConstraints& constraints,
+                                         size_t maxCandidates) const
+  {
+    std::vector<uint8_t> matches(ids_.size(), 1);
+    bool hasMandatory = false;
+
+    for (size_t i = 0; i < constraints.GetSize(); i++)
+    {
+      const DatabaseConstraint& constraint = constraints.GetConstraint(i);
+
+      /**
+       * The studies that have none of the stored tags are not part of
+       * the table: At least one mandatory constraint must be evaluated,
+       * so that these studies are not candidates.
+       **/
+      if (constraint.GetLevel() == Orthanc::ResourceType_Study &&
+          constraint.IsIdentifier() &&
+          !IsUniversalConstraint(constraint) &&
+          MatchColumn(matches, constraint) &&
+          constraint.IsMandatory())
+      {
+        hasMandatory = true;
+      }
+    }
+
+    if (!hasMandatory)
+    {
+      return false;
+    }
+
+    candidates.clear();
+
+    for (size_t i = 0; i < ids_.size(); i++)
+    {
+      if (matches[i] ||
+          changed_[i])
+      {
+        if (candidates.size() == maxCandidates)
+        {
+          return false;
+        }
+
+        candidates.push_back(ids_[i]);
+      }
+    }
+
+    std::sort(candidates.begin(), candidates.end());
+    return true;
+  }
+
+
+  StudyColumnStore::StudyColumnStore()
+  {
+  }
+
+
+  void StudyColumnStore::SetTags(const std::vector<Orthanc::DicomTag>& tags)
+  {
+    boost::unique_lock<boost::shared_mutex> lock(mutex_);
+
+    tags_ = tags;
+    table_.reset(NULL);
+    recent_.clear();
+    pending_.clear();
+  }
+
+
+  bool StudyColumnStore::IsEnabled() const
+  {
+    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+    return !tags_.empty();
+  }
+
+
+  bool StudyColumnStore::IsLoaded() const
+  {
+    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+    return (table_.get() != NULL);
+  }
+
+
+  void StudyColumnStore::SetValue(int64_t id,
+                                  uint16_t group,
+                                  uint16_t element,
+                                  const std::string& value,
+                                  const boost::posix_time::ptime& now)
+  {
+    const Orthanc::DicomTag tag(group, element);
+
+    boost::unique_lock<boost::shared_mutex> lock(mutex_);
+
+    if (std::find(tags_.begin(), tags_.end(), tag) != tags_.end())
+    {
+      if (table_.get() != NULL)
+      {
+        table_->SetValue(id, tag, value);
+      }
+
+      recent_.push_back(Update(id, tag, value, now));
+
+      const boost::posix_time::ptime limit = now - boost::posix_time::minutes(RECENT_UPDATES_MINUTES);
+      while (!recent_.empty() &&
+             recent_.front().time_ < limit)
+      {
+        recent_.pop_front();
+      }
+    }
+  }
+
+
+  StudyColumnStore::Table* StudyColumnStore::CreateTable() const
+  {
+    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+    return new Table(tags_);
+  }
+
+
+  void StudyColumnStore::CommitReload(Table* table,
+                                      const boost::posix_time::ptime& now)
+  {
+    std::unique_ptr<Table> protection(table);
+
+    if (table == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+    }
+
+    boost::unique_lock<boost::shared_mutex> lock(mutex_);
+
+    const boost::posix_time::ptime limit = now - boost::posix_time::minutes(RECENT_UPDATES_MINUTES);
+    while (!recent_.empty() &&
+           recent_.front().time_ < limit)
+    {
+      recent_.pop_front();
+    }
+
+    for (std::deque<Update>::const_iterator it = recent_.begin(); it != recent_.end(); ++it)
+    {
+      protection->SetValue(it->id_, it->tag_, it->value_);
+    }
+
+    table_.reset(protection.release());
+  }
+
+
+  void StudyColumnStore::Unload()
+  {
+    boost::unique_lock<boost::shared_mutex> lock(mutex_);
+    table_.reset(NULL);
+  }
+
+
+  void StudyColumnStore::AddPendingStudy(int64_t id)
+  {
+    boost::unique_lock<boost::shared_mutex> lock(mutex_);
+
+    if (!tags_.empty())
+    {
+      pending_.insert(id);
+    }
+  }
+
+
+  void StudyColumnStore::GetPendingStudies(std::vector<int64_t>& target,
+                                           size_t maxCount) const
+  {
+    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+
+    target.clear();
+    target.reserve(std::min(maxCount, pending_.size()));
+
+    for (std::set<int64_t>::const_iterator it = pending_.begin();
+         it != pending_.end() && target.size() < maxCount; ++it)
+    {
+      target.push_back(*it);
+    }
+  }
+
+
+  void StudyColumnStore::RemovePendingStudies(const std::vector<int64_t>& ids)
+  {
+    boost::unique_lock<boost::shared_mutex> lock(mutex_);
+
+    for (size_t i = 0; i < ids.size(); i++)
+    {
+      pending_.erase(ids[i]);
+    }
+  }
+
+
+  bool StudyColumnStore::Evaluate(Resources& candidates,
+                                  const DatabaseConstraints& constraints,
+                                  Orthanc::ResourceType queryLevel,
+                                  size_t maxCandidates) const
+  {
+    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+
+    if (queryLevel != Orthanc::ResourceType_Study ||
+        table_.get() == NULL ||
+        pending_.size() > maxCandidates ||
+        !table_->Evaluate(candidates, constraints, maxCandidates - pending_.size()))
+    {
+      return false;
+    }
+
+    if (!pending_.empty())
+    {
+      // The pending studies might already be part of the table
+      candidates.insert(candidates.end(), pending_.begin(), pending_.end());
+      std::sort(candidates.begin(), candidates.end());
+      candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+    }
+
+    return true;
+  }
+
+
+  size_t StudyColumnStore::GetRowsCount() const
+  {
+    boost::shared_lock<boost::shared_mutex> lock(mutex_);
+    return (table_.get() == NULL ? 0 : table_->GetRowsCount());
+  }
+}
@@ -0,0 +1,207 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "DatabaseConstraint.h"
+
+#include <Compatibility.h>  // For std::unique_ptr<>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/unordered_map.hpp>
+#include <deque>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+
+namespace OrthancDatabases
+{
+  /**
+   * In-process column store of some identifier tags of the studies
+   * (i.e. the "DicomIdentifiers" table), with one contiguous column
+   * per tag. The constraints of the study-level lookups on these tags
+   * are evaluated by scanning the columns, which gives the candidate
+   * internal IDs of the lookup. The candidates are a superset of the
+   * matching studies: The database still evaluates all the
+   * constraints, but only on the candidates.
+   *
+   * The store is loaded from the database, then updated by the writes
+   * of this process, including the writes that are rolled back: This
+   * only adds candidates. The deleted studies are only removed by the
+   * next reload. The studies that are written by other processes are
+   * missed until the next reload, unless they are signaled as pending
+   * studies, that are candidates of all the lookups until their values
+   * are read. This class is thread-safe.
+   *
+   * The recent writes are replayed on the tables that are reloaded,
+   * as the transactions that were running when the reload started
+   * might not be visible to the statements that read the database.
+   **/
+  class StudyColumnStore : public boost::noncopyable
+  {
+  public:
+    typedef std::vector<int64_t>  Resources;  // Sorted internal IDs
+
+    /**
+     * Content of the store. A new table is filled outside of the
+     * store while reloading, then replaces the content of the store.
+     **/
+    class Table : public boost::noncopyable
+    {
+    private:
+      struct Column
+      {
+        typedef boost::unordered_map<std::string, size_t>  Dictionary;
+
+        Orthanc::DicomTag      tag_;
+        std::string            data_;      // Concatenation of the values
+        std::vector<size_t>    offsets_;   // Offset of the value of each row in "data_"
+        std::vector<uint32_t>  sizes_;     // Size of the value of each row, "NO_VALUE" if missing
+        bool                   encoded_;   // Whether each distinct value is stored only once
+        Dictionary             dictionary_;  // Offset of each distinct value, if "encoded_"
+
+        explicit Column(const Orthanc::DicomTag& tag) :
+          tag_(tag),
+          encoded_(true)
+        {
+        }
+
+        // Returns the offset of the value in "data_"
+        size_t Append(const std::string& value);
+      };
+
+      typedef boost::unordered_map<int64_t, size_t>  Rows;
+
+      std::vector<Column>   columns_;
+      std::vector<int64_t>  ids_;
+      std::vector<uint8_t>  changed_;   // Rows whose values were overwritten, that always are candidates
+      Rows                  rows_;
+
+      bool MatchColumn(std::vector<uint8_t>& matches,
+                       const DatabaseConstraint& constraint) const;
+
+    public:
+      explicit Table(const std::vector<Orthanc::DicomTag>& tags);
+
+      size_t GetRowsCount() const
+      {
+        return ids_.size();
+      }
+
+      // Whether the values of the tag are dictionary-encoded, i.e. the tag has a low cardinality
+      bool IsEncoded(const Orthanc::DicomTag& tag) const;
+
+      // Returns "false" if the tag is not stored
+      bool SetValue(int64_t id,
+                    const Orthanc::DicomTag& tag,
+                    const std::string& value);
+
+      /**
+       * Returns "false" if none of the constraints can be evaluated,
+       * or if there are more than "maxCandidates" candidates.
+       **/
+      bool Evaluate(Resources& candidates,
+                    const DatabaseConstraints& constraints,
+                    size_t maxCandidates) const;
+    };
+
+  private:
+    struct Update
+    {
+      int64_t                   id_;
+      Orthanc::DicomTag         tag_;
+      std::string               value_;
+      boost::posix_time::ptime  time_;
+
+      Update(int64_t id,
+             const Orthanc::DicomTag& tag,
+             const std::string& value,
+             const boost::posix_time::ptime& time) :
+        id_(id),
+        tag_(tag),
+        value_(value),
+        time_(time)
+      {
+      }
+    };
+
+    mutable boost::shared_mutex     mutex_;
+    std::vector<Orthanc::DicomTag>  tags_;
+    std::unique_ptr<Table>          table_;    // NULL if not loaded yet
+    std::deque<Update>              recent_;   // Writes of the last minutes, replayed by the reloads
+    std::set<int64_t>               pending_;  // Studies created by other processes, whose values are not known
+
+  public:
+    StudyColumnStore();
+
+    // Must be called before the first reload, an empty list disables the store
+    void SetTags(const std::vector<Orthanc::DicomTag>& tags);
+
+    bool IsEnabled() const;
+
+    bool IsLoaded() const;
+
+    const std::vector<Orthanc::DicomTag>& GetTags() const
+    {
+      return tags_;
+    }
+
+    // Ignored if the tag is not stored
+    void SetValue(int64_t id,
+                  uint16_t group,
+                  uint16_t element,
+                  const std::string& value,
+                  const boost::posix_time::ptime& now);
+
+    // Creates an empty table, to be filled from the database
+    Table* CreateTable() const;
+
+    // Replaces the content of the store, after having replayed the recent writes
+    void CommitReload(Table* table,  // Takes ownership
+                      const boost::posix_time::ptime& now);
+
+    // Drops the content of the store, until the next reload
+    void Unload();
+
+    // The study is a candidate of all the lookups, until it is removed from the pending studies
+    void AddPendingStudy(int64_t id);
+
+    void GetPendingStudies(std::vector<int64_t>& target,
+                           size_t maxCount) const;
+
+    // To be called once the values of the studies have been stored
+    void RemovePendingStudies(const std::vector<int64_t>& ids);
+
+    // Returns "false" if the store cannot narrow the lookup
+    bool Evaluate(Resources& candidates,
+                  const DatabaseConstraints& constraints,
+                  Orthanc::ResourceType queryLevel,
+                  size_t maxCandidates) const;
+
+    size_t GetRowsCount() const;
+  };
+}
@@ -0,0 +1,187 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include <Cache/LeastRecentlyUsedIndex.h>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <cassert>
+#include <map>
+#include <stdint.h>
+#include <string>
+
+
+namespace OrthancDatabases
+{
+  /**
+   * Generic cache of values indexed by a string, that is shared by
+   * the caches of "IndexBackend". At most "maxSize" values are kept,
+   * the least recently used value being dropped first. Each value
+   * expires after the time-to-live (by default, the values never
+   * expire). Each value is also tagged with the last change index of
+   * the database at the time it was computed, and is dropped if the
+   * last change index differs at the time of the lookup: The caches
+   * whose values do not depend on the changes always provide the same
+   * last change (e.g. zero). The cache is disabled as long as its
+   * maximum size is zero. This class is thread-safe.
+   **/
+  template <typename Value>
+  class TimedLruCache : public boost::noncopyable
+  {
+  private:
+    struct Item
+    {
+      Value                     value_;
+      int64_t                   lastChange_;
+      boost::posix_time::ptime  expiration_;
+    };
+
+    typedef std::map<std::string, Item>  Content;
+
+    boost::mutex                                  mutex_;
+    size_t                                        maxSize_;
+    boost::posix_time::time_duration              timeToLive_;
+    Content                                       content_;
+    Orthanc::LeastRecentlyUsedIndex<std::string>  index_;
+
+    void RemoveOldest()
+    {
+      const std::string oldest = index_.RemoveOldest();
+      assert(content_.find(oldest) != content_.end());
+      content_.erase(oldest);
+    }
+
+  public:
+    TimedLruCache() :
+      maxSize_(0),
+      timeToLive_(boost::posix_time::pos_infin)
+    {
+    }
+
+    // "0" disables the cache
+    void SetMaxSize(size_t maxSize)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      maxSize_ = maxSize;
+
+      while (content_.size() > maxSize_)
+      {
+        RemoveOldest();
+      }
+    }
+
+    // Only applies to the values that are stored afterward
+    void SetTimeToLive(unsigned int seconds)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      timeToLive_ = boost::posix_time::seconds(seconds);
+    }
+
+    bool IsEnabled()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return maxSize_ != 0;
+    }
+
+    bool Lookup(Value& target,
+                const std::string& key,
+                int64_t lastChange,
+                const boost::posix_time::ptime& now)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      typename Content::const_iterator found = content_.find(key);
+
+      if (found == content_.end())
+      {
+        return false;
+      }
+      else if (found->second.expiration_ <= now ||
+               found->second.lastChange_ != lastChange)
+      {
+        index_.Invalidate(key);
+        content_.erase(key);
+        return false;
+      }
+      else
+      {
+        target = found->second.value_;
+        index_.MakeMostRecent(key);
+        return true;
+      }
+    }
+
+    void Store(const std::string& key,
+               const Value& value,
+               int64_t lastChange,
+               const boost::posix_time::ptime& now)
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      if (maxSize_ == 0)
+      {
+        return;
+      }
+
+      if (content_.find(key) == content_.end())
+      {
+        while (content_.size() >= maxSize_)
+        {
+          RemoveOldest();
+        }
+
+        index_.Add(key);
+      }
+      else
+      {
+        index_.MakeMostRecent(key);
+      }
+
+      Item& item = content_[key];
+      item.value_ = value;
+      item.lastChange_ = lastChange;
+      item.expiration_ = now + timeToLive_;
+    }
+
+    void Clear()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+
+      while (!content_.empty())
+      {
+        RemoveOldest();
+      }
+    }
+
+    size_t GetSize()
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      return content_.size();
+    }
+  };
+}
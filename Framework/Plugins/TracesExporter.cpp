@@ -0,0 +1,404 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "TracesExporter.h"
+
+#include "../../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+#include <Toolbox.h>
+
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/tss.hpp>
+
+
+namespace OrthancDatabases
+{
+  static const size_t BATCH_SIZE = 512;            // Maximum number of spans per request to the collector
+  static const size_t MAX_QUEUE_SIZE = 16384;      // The spans are dropped beyond this size
+  static const unsigned int FLUSH_INTERVAL = 5000; // Maximum delay before sending the queued spans, in milliseconds
+
+  // OTLP enumerations
+  static const int SPAN_KIND_INTERNAL = 1;
+  static const int SPAN_KIND_CLIENT = 3;
+  static const int STATUS_CODE_OK = 1;
+  static const int STATUS_CODE_ERROR = 2;
+
+  static boost::mutex     startedMutex_;
+  static TracesExporter*  started_ = NULL;
+
+
+  static void DontDeleteSpan(TracesExporter::Span* span)
+  {
+    // The spans are owned by the stack of their thread
+  }
+
+  static boost::thread_specific_ptr<TracesExporter::Span>  currentSpan_(DontDeleteSpan);
+
+
+  // Random hexadecimal identifier with "length" digits (32 for a trace, 16 for a span)
+  static std::string GenerateIdentifier(size_t length)
+  {
+    std::string result;
+    result.reserve(length + 32);
+
+    while (result.size() < length)
+    {
+      const std::string uuid = Orthanc::Toolbox::GenerateUuid();
+
+      for (size_t i = 0; i < uuid.size(); i++)
+      {
+        if (uuid[i] != '-')
+        {
+          result.push_back(uuid[i]);
+        }
+      }
+    }
+
+    result.resize(length);
+    return result;
+  }
+
+
+  static void AddAttribute(Json::Value& span,
+                           const std::string& key,
+                           const Json::Value& value)
+  {
+    Json::Value attribute = Json::objectValue;
+    attribute["key"] = key;
+    attribute["value"] = value;
+    span["attributes"].append(attribute);
+  }
+
+
+  TracesExporter::Span::Span(const std::string& name) :
+    previous_(NULL),
+    success_(false)
+  {
+    {
+      boost::mutex::scoped_lock lock(startedMutex_);
+      enabled_ = (started_ != NULL);
+    }
+
+    if (enabled_)
+    {
+      previous_ = currentSpan_.get();
+
+      if (previous_ == NULL)
+      {
+        traceId_ = GenerateIdentifier(32);
+      }
+      else
+      {
+        traceId_ = previous_->traceId_;
+        parentSpanId_ = previous_->spanId_;
+      }
+
+      spanId_ = GenerateIdentifier(16);
+
+      content_ = Json::objectValue;
+      content_["name"] = name;
+      content_["kind"] = SPAN_KIND_INTERNAL;
+      content_["startTimeUnixNano"] = FormatTime(boost::posix_time::microsec_clock::universal_time());
+      content_["attributes"] = Json::arrayValue;
+
+      currentSpan_.reset(this);
+    }
+  }
+
+
+  TracesExporter::Span::~Span()
+  {
+    if (enabled_)
+    {
+      currentSpan_.reset(previous_);
+
+      try
+      {
+        content_["traceId"] = traceId_;
+        content_["spanId"] = spanId_;
+
+        if (!parentSpanId_.empty())
+        {
+          content_["parentSpanId"] = parentSpanId_;
+        }
+
+        content_["endTimeUnixNano"] = FormatTime(boost::posix_time::microsec_clock::universal_time());
+        content_["status"] = Json::objectValue;
+        content_["status"]["code"] = (success_ ? STATUS_CODE_OK : STATUS_CODE_ERROR);
+
+        boost::mutex::scoped_lock lock(startedMutex_);
+        if (started_ != NULL)
+        {
+          started_->Enqueue(content_);
+        }
+      }
+      catch (...)
+      {
+        // Never throw from a destructor
+      }
+    }
+  }
+
+
+  void TracesExporter::Span::SetAttribute(const std::string& key,
+                                          const std::string& value)
+  {
+    if (enabled_)
+    {
+      Json::Value v = Json::objectValue;
+      v["stringValue"] = value;
+      AddAttribute(content_, key, v);
+    }
+  }
+
+
+  void TracesExporter::Span::SetAttribute(const std::string& key,
+                                          int64_t value)
+  {
+    if (enabled_)
+    {
+      // OTLP/JSON encodes the 64-bit integers as strings
+      Json::Value v = Json::objectValue;
+      v["intValue"] = boost::lexical_cast<std::string>(value);
+      AddAttribute(content_, key, v);
+    }
+  }
+
+
+  void TracesExporter::Worker(TracesExporter* that)
+  {
+    for (;;)
+    {
+      std::deque<Json::Value> batch;
+      uint64_t dropped;
+      bool stop;
+
+      {
+        boost::mutex::scoped_lock lock(that->mutex_);
+
+        if (!that->stop_ &&
+            that->queue_.size() < BATCH_SIZE)
+        {
+          that->condition_.timed_wait(lock, boost::posix_time::milliseconds(FLUSH_INTERVAL));
+        }
+
+        while (!that->queue_.empty() &&
+               batch.size() < BATCH_SIZE)
+        {
+          batch.push_back(Json::nullValue);
+          batch.back().swap(that->queue_.front());
+          that->queue_.pop_front();
+        }
+
+        dropped = that->dropped_;
+        that->dropped_ = 0;
+        stop = (that->stop_ && that->queue_.empty());
+      }
+
+      if (dropped > 0)
+      {
+        LOG(WARNING) << "OpenTelemetry: " << dropped << " span(s) have been dropped, as the queue was full";
+      }
+
+      if (!batch.empty())
+      {
+        try
+        {
+          Json::Value body;
+          FormatBatch(body, that->serviceName_, batch);
+          that->Send(body);
+        }
+        catch (Orthanc::OrthancException& e)
+        {
+          LOG(ERROR) << "OpenTelemetry: Cannot export " << batch.size() << " span(s) to "
+                     << that->url_ << ": " << e.What();
+        }
+      }
+
+      if (stop)
+      {
+        return;
+      }
+    }
+  }
+
+
+  void TracesExporter::Enqueue(const Json::Value& span)
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (queue_.size() >= MAX_QUEUE_SIZE)
+    {
+      dropped_++;
+    }
+    else
+    {
+      queue_.push_back(span);
+
+      if (queue_.size() >= BATCH_SIZE)
+      {
+        condition_.notify_one();
+      }
+    }
+  }
+
+
+  void TracesExporter::Send(const Json::Value& body)
+  {
+    std::string s;
+    Orthanc::Toolbox::WriteFastJson(s, body);
+
+    OrthancPlugins::HttpClient client;
+    client.SetUrl(url_);
+    client.SetMethod(OrthancPluginHttpMethod_Post);
+    client.AddHeader("Content-Type", "application/json");
+    client.SetBody(s);
+    client.Execute();
+  }
+
+
+  TracesExporter::TracesExporter(const std::string& url,
+                                 const std::string& serviceName) :
+    url_(url),
+    serviceName_(serviceName),
+    dropped_(0),
+    stop_(false)
+  {
+    if (url.empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    thread_ = boost::thread(Worker, this);
+  }
+
+
+  TracesExporter::~TracesExporter()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      stop_ = true;
+      condition_.notify_one();
+    }
+
+    if (thread_.joinable())
+    {
+      thread_.join();
+    }
+  }
+
+
+  void TracesExporter::TraceStatement(const std::string& statement,
+                                      uint64_t executeTime,
+                                      bool success)
+  {
+    Span* parent = currentSpan_.get();
+
+    if (parent != NULL)
+    {
+      const boost::posix_time::ptime end = boost::posix_time::microsec_clock::universal_time();
+
+      Json::Value span = Json::objectValue;
+      span["traceId"] = parent->traceId_;
+      span["spanId"] = GenerateIdentifier(16);
+      span["parentSpanId"] = parent->spanId_;
+      span["name"] = "SQL";
+      span["kind"] = SPAN_KIND_CLIENT;
+      span["startTimeUnixNano"] = FormatTime(end - boost::posix_time::microseconds(executeTime));
+      span["endTimeUnixNano"] = FormatTime(end);
+      span["attributes"] = Json::arrayValue;
+      span["status"] = Json::objectValue;
+      span["status"]["code"] = (success ? STATUS_CODE_OK : STATUS_CODE_ERROR);
+
+      Json::Value v = Json::objectValue;
+      v["stringValue"] = statement;
+      AddAttribute(span, "db.statement.id", v);
+
+      Enqueue(span);
+    }
+  }
+
+
+  void TracesExporter::Start(TracesExporter& exporter)
+  {
+    boost::mutex::scoped_lock lock(startedMutex_);
+
+    if (started_ != NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls, "The traces exporter is already started");
+    }
+
+    started_ = &exporter;
+    DatabaseManager::SetStatementsTracer(&exporter);
+  }
+
+
+  void TracesExporter::Stop()
+  {
+    boost::mutex::scoped_lock lock(startedMutex_);
+    DatabaseManager::SetStatementsTracer(NULL);
+    started_ = NULL;
+  }
+
+
+  void TracesExporter::FormatBatch(Json::Value& target,
+                                   const std::string& serviceName,
+                                   const std::deque<Json::Value>& spans)
+  {
+    Json::Value serviceNameValue = Json::objectValue;
+    serviceNameValue["stringValue"] = serviceName;
+
+    Json::Value resource = Json::objectValue;
+    resource["attributes"] = Json::arrayValue;
+    AddAttribute(resource, "service.name", serviceNameValue);
+
+    Json::Value scopeSpans = Json::objectValue;
+    scopeSpans["scope"] = Json::objectValue;
+    scopeSpans["scope"]["name"] = "orthanc-databases";
+    scopeSpans["spans"] = Json::arrayValue;
+
+    for (std::deque<Json::Value>::const_iterator it = spans.begin(); it != spans.end(); ++it)
+    {
+      scopeSpans["spans"].append(*it);
+    }
+
+    Json::Value resourceSpans = Json::objectValue;
+    resourceSpans["resource"] = resource;
+    resourceSpans["scopeSpans"] = Json::arrayValue;
+    resourceSpans["scopeSpans"].append(scopeSpans);
+
+    target = Json::objectValue;
+    target["resourceSpans"] = Json::arrayValue;
+    target["resourceSpans"].append(resourceSpans);
+  }
+
+
+  std::string TracesExporter::FormatTime(const boost::posix_time::ptime& time)
+  {
+    static const boost::posix_time::ptime EPOCH(boost::gregorian::date(1970, 1, 1));
+    return boost::lexical_cast<std::string>((time - EPOCH).total_microseconds() * static_cast<int64_t>(1000));
+  }
+}
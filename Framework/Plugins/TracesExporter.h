@@ -0,0 +1,137 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#include "../Common/DatabaseManager.h"
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <json/value.h>
+#include <deque>
+#include <stdint.h>
+#include <string>
+
+
+namespace OrthancDatabases
+{
+  /**
+   * Records the spans of the database operations, and exports them by
+   * batches to an OpenTelemetry collector, using the JSON encoding of
+   * OTLP over HTTP (e.g. "http://localhost:4318/v1/traces"). The spans
+   * are queued by the threads that run the operations, and are sent by
+   * a background thread: The spans that don't fit in the queue (e.g.
+   * if the collector is down) are dropped. The SQL statements that are
+   * executed by a thread while one of its spans is active are recorded
+   * as children of this span. At most one exporter can be started in
+   * the process.
+   **/
+  class TracesExporter : public DatabaseManager::IStatementsTracer
+  {
+  public:
+    /**
+     * One span, that ends when the object is destroyed. It is the child
+     * of the span that is active in the same thread, if any. It is
+     * counted as an error unless "SetSuccess()" is called. This is a
+     * no-op if no exporter is started.
+     **/
+    class Span : public boost::noncopyable
+    {
+      friend class TracesExporter;
+
+    private:
+      bool         enabled_;
+      std::string  traceId_;
+      std::string  spanId_;
+      std::string  parentSpanId_;
+      Span*        previous_;  // The span that was active in this thread
+      Json::Value  content_;
+      bool         success_;
+
+    public:
+      explicit Span(const std::string& name);
+
+      ~Span();
+
+      bool IsEnabled() const
+      {
+        return enabled_;
+      }
+
+      void SetAttribute(const std::string& key,
+                        const std::string& value);
+
+      void SetAttribute(const std::string& key,
+                        int64_t value);
+
+      void SetSuccess()
+      {
+        success_ = true;
+      }
+    };
+
+  private:
+    std::string              url_;
+    std::string              serviceName_;
+    boost::mutex             mutex_;
+    boost::condition_variable  condition_;
+    std::deque<Json::Value>  queue_;
+    uint64_t                 dropped_;
+    bool                     stop_;
+    boost::thread            thread_;
+
+    static void Worker(TracesExporter* that);
+
+    void Enqueue(const Json::Value& span);
+
+    void Send(const Json::Value& body);
+
+  public:
+    TracesExporter(const std::string& url,
+                   const std::string& serviceName);
+
+    // Stops the background thread, after having sent the queued spans
+    virtual ~TracesExporter();
+
+    // Records a statement that has been executed, as a child of the active span of the thread
+    virtual void TraceStatement(const std::string& statement,
+                                uint64_t executeTime,
+                                bool success) ORTHANC_OVERRIDE;
+
+    // The exporter is owned by the caller, and must be stopped before its destruction
+    static void Start(TracesExporter& exporter);
+
+    static void Stop();
+
+    // Formats a batch of spans as the body of an OTLP request
+    static void FormatBatch(Json::Value& target,
+                            const std::string& serviceName,
+                            const std::deque<Json::Value>& spans);
+
+    // Nanoseconds since the epoch, as a string (as in OTLP)
+    static std::string FormatTime(const boost::posix_time::ptime& time);
+  };
+}
@@ -0,0 +1,141 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "PostgreSQLIncludes.h"  // Must be the first
+#include "PostgreSQLAsyncQueries.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <algorithm>
+#include <errno.h>
+
+#if !defined(_WIN32)
+#  include <sys/select.h>
+#endif
+
+
+namespace OrthancDatabases
+{
+  PostgreSQLAsyncQueries::~PostgreSQLAsyncQueries()
+  {
+    for (size_t i = 0; i < statements_.size(); i++)
+    {
+      if (pending_[i])
+      {
+        // The connection cannot be used until the result is received
+        PGconn* pg = reinterpret_cast<PGconn*>(statements_[i]->GetDatabase().pg_);
+
+        PGresult* result;
+        while ((result = PQgetResult(pg)) != NULL)
+        {
+          PQclear(result);
+        }
+      }
+    }
+  }
+
+
+  size_t PostgreSQLAsyncQueries::Add(PostgreSQLStatement& statement)
+  {
+    for (size_t i = 0; i < statements_.size(); i++)
+    {
+      if (pending_[i] &&
+          &statements_[i]->GetDatabase() == &statement.GetDatabase())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls,
+                                        "Only one statement can be in flight on each connection");
+      }
+    }
+
+    if (statement.GetDatabase().IsVerboseEnabled())
+    {
+      LOG(INFO) << "PostgreSQL: " << statement.sql_;
+    }
+
+    statement.SendQuery();
+
+    statements_.push_back(&statement);
+    pending_.push_back(true);
+
+    return statements_.size() - 1;
+  }
+
+
+  void PostgreSQLAsyncQueries::WaitAll(IHandler& handler)
+  {
+    for (;;)
+    {
+      fd_set input;
+      FD_ZERO(&input);
+
+      int maxSocket = -1;
+
+      for (size_t i = 0; i < statements_.size(); i++)
+      {
+        if (pending_[i])
+        {
+          PostgreSQLDatabase& database = statements_[i]->GetDatabase();
+          PGconn* pg = reinterpret_cast<PGconn*>(database.pg_);
+
+          if (!PQconsumeInput(pg))
+          {
+            database.ThrowException(true);
+          }
+
+          if (PQisBusy(pg))
+          {
+            const int socket = PQsocket(pg);
+            if (socket < 0)
+            {
+              database.ThrowException(true);
+            }
+
+            FD_SET(socket, &input);
+            maxSocket = std::max(maxSocket, socket);
+          }
+          else
+          {
+            // "PQgetResult()" will not block anymore
+            pending_[i] = false;
+
+            PostgreSQLResult result(database);
+            handler.Handle(i, result);
+          }
+        }
+      }
+
+      if (maxSocket == -1)
+      {
+        return;  // All the results have been handled
+      }
+
+      if (select(maxSocket + 1, &input, NULL, NULL, NULL) < 0 &&
+          errno != EINTR)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Cannot wait for the PostgreSQL connections");
+      }
+    }
+  }
+}
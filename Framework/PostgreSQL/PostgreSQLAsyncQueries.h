@@ -0,0 +1,81 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#if ORTHANC_ENABLE_POSTGRESQL != 1
+#  error PostgreSQL support must be enabled to use this file
+#endif
+
+#include "PostgreSQLResult.h"
+
+#include <vector>
+
+
+namespace OrthancDatabases
+{
+  /**
+   * Runs statements on several connections at once, from the calling
+   * thread. The statements are sent without waiting for their results,
+   * then a single loop waits for the sockets of all the connections,
+   * and the results are handled in the order they are received. This
+   * replaces one blocked thread per statement in flight. Each
+   * statement must be on its own connection, and its parameters must
+   * be bound before "Add()". The connections must not be used by other
+   * statements until "WaitAll()" has returned.
+   **/
+  class PostgreSQLAsyncQueries : public boost::noncopyable
+  {
+  public:
+    class IHandler : public boost::noncopyable
+    {
+    public:
+      virtual ~IHandler()
+      {
+      }
+
+      // Called by "WaitAll()", once the whole result of the query has been received
+      virtual void Handle(size_t query,
+                          PostgreSQLResult& result) = 0;
+    };
+
+  private:
+    std::vector<PostgreSQLStatement*>  statements_;
+    std::vector<bool>                  pending_;
+
+  public:
+    // Waits for the results that have not been handled (e.g. after an exception)
+    ~PostgreSQLAsyncQueries();
+
+    // Sends the statement, and returns the index of the query
+    size_t Add(PostgreSQLStatement& statement);
+
+    size_t GetSize() const
+    {
+      return statements_.size();
+    }
+
+    void WaitAll(IHandler& handler);
+  };
+}
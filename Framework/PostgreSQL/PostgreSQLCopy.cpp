@@ -0,0 +1,262 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "PostgreSQLIncludes.h"  // Must be the first
+#include "PostgreSQLCopy.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+
+namespace OrthancDatabases
+{
+  // Rows are sent to the server by chunks of this size
+  static const size_t COPY_BUFFER_SIZE = 1024 * 1024;
+
+
+  void PostgreSQLCopy::AppendInteger16(int16_t value)
+  {
+    const uint16_t v = htons(static_cast<uint16_t>(value));
+    buffer_.append(reinterpret_cast<const char*>(&v), sizeof(v));
+  }
+
+
+  void PostgreSQLCopy::AppendInteger32(int32_t value)
+  {
+    const uint32_t v = htonl(static_cast<uint32_t>(value));
+    buffer_.append(reinterpret_cast<const char*>(&v), sizeof(v));
+  }
+
+
+  void PostgreSQLCopy::AppendInteger64(int64_t value)
+  {
+    const uint64_t v = static_cast<uint64_t>(value);
+    AppendInteger32(static_cast<int32_t>(v >> 32));
+    AppendInteger32(static_cast<int32_t>(v & 0xffffffffu));
+  }
+
+
+  void PostgreSQLCopy::BeginField(int32_t size)
+  {
+    if (done_ ||
+        currentColumn_ >= countColumns_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    AppendInteger32(size);
+    currentColumn_++;
+  }
+
+
+  void PostgreSQLCopy::Flush()
+  {
+    if (!buffer_.empty())
+    {
+      if (PQputCopyData(reinterpret_cast<PGconn*>(database_.pg_), buffer_.c_str(),
+                        static_cast<int>(buffer_.size())) != 1)
+      {
+        database_.ThrowException(true);
+      }
+
+      buffer_.clear();
+    }
+  }
+
+
+  PostgreSQLCopy::PostgreSQLCopy(PostgreSQLDatabase& database,
+                                 const std::string& table,
+                                 const std::vector<std::string>& columns) :
+    database_(database),
+    countColumns_(columns.size()),
+    currentColumn_(columns.size()),
+    countRows_(0),
+    done_(false)
+  {
+    if (columns.empty() ||
+        columns.size() > 0x7fff)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    std::string sql = "COPY " + table + " (";
+
+    for (size_t i = 0; i < columns.size(); i++)
+    {
+      if (i > 0)
+      {
+        sql += ", ";
+      }
+
+      sql += columns[i];
+    }
+
+    sql += ") FROM STDIN (FORMAT BINARY)";
+
+    if (database_.IsVerboseEnabled())
+    {
+      LOG(INFO) << "PostgreSQL: " << sql;
+    }
+
+    database_.Open();
+    database_.FlushPipeline();
+
+    PGresult* result = PQexec(reinterpret_cast<PGconn*>(database_.pg_), sql.c_str());
+    if (result == NULL)
+    {
+      database_.ThrowException(true);
+    }
+
+    if (PQresultStatus(result) != PGRES_COPY_IN)
+    {
+      std::string message = PQresultErrorMessage(result);
+      PQclear(result);
+
+      LOG(ERROR) << "PostgreSQL error: " << message;
+      database_.ThrowException(false);
+    }
+
+    PQclear(result);
+
+    buffer_.reserve(COPY_BUFFER_SIZE + 64);
+
+    // Header of the binary format: Signature, flags and length of the header extension
+    buffer_.append("PGCOPY\n\377\r\n\0", 11);
+    AppendInteger32(0);
+    AppendInteger32(0);
+  }
+
+
+  PostgreSQLCopy::~PostgreSQLCopy()
+  {
+    if (!done_)
+    {
+      // Abort the "COPY" statement, which fails the current transaction
+      PGconn* pg = reinterpret_cast<PGconn*>(database_.pg_);
+
+      if (pg != NULL &&
+          PQputCopyEnd(pg, "Aborted by the client") == 1)
+      {
+        PGresult* result;
+        while ((result = PQgetResult(pg)) != NULL)
+        {
+          PQclear(result);
+        }
+      }
+    }
+  }
+
+
+  void PostgreSQLCopy::BeginRow()
+  {
+    if (done_ ||
+        currentColumn_ != countColumns_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    if (buffer_.size() >= COPY_BUFFER_SIZE)
+    {
+      Flush();
+    }
+
+    AppendInteger16(static_cast<int16_t>(countColumns_));
+    currentColumn_ = 0;
+    countRows_++;
+  }
+
+
+  void PostgreSQLCopy::AddNull()
+  {
+    BeginField(-1);
+  }
+
+
+  void PostgreSQLCopy::AddInteger32(int32_t value)
+  {
+    BeginField(4);
+    AppendInteger32(value);
+  }
+
+
+  void PostgreSQLCopy::AddInteger64(int64_t value)
+  {
+    BeginField(8);
+    AppendInteger64(value);
+  }
+
+
+  void PostgreSQLCopy::AddString(const std::string& value)
+  {
+    if (value.size() > 0x7fffffffu)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory);
+    }
+
+    BeginField(static_cast<int32_t>(value.size()));
+    buffer_.append(value);
+  }
+
+
+  void PostgreSQLCopy::Finish()
+  {
+    if (done_ ||
+        currentColumn_ != countColumns_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    AppendInteger16(-1);  // Trailer
+    Flush();
+
+    done_ = true;
+
+    PGconn* pg = reinterpret_cast<PGconn*>(database_.pg_);
+
+    if (PQputCopyEnd(pg, NULL) != 1)
+    {
+      database_.ThrowException(true);
+    }
+
+    bool success = true;
+    std::string message;
+
+    PGresult* result;
+    while ((result = PQgetResult(pg)) != NULL)
+    {
+      if (PQresultStatus(result) != PGRES_COMMAND_OK)
+      {
+        success = false;
+        message = PQresultErrorMessage(result);
+      }
+
+      PQclear(result);
+    }
+
+    if (!success)
+    {
+      LOG(ERROR) << "PostgreSQL error: " << message;
+      database_.ThrowException(false);
+    }
+  }
+}
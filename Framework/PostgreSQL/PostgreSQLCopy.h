@@ -0,0 +1,91 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#if ORTHANC_ENABLE_POSTGRESQL != 1
+#  error PostgreSQL support must be enabled to use this file
+#endif
+
+#include "PostgreSQLDatabase.h"
+
+#include <vector>
+
+
+namespace OrthancDatabases
+{
+  /**
+   * Streams rows into one table using "COPY ... FROM STDIN" in the
+   * binary format of PostgreSQL, which is much faster than one
+   * "INSERT" per row. The values of each row must be added in the
+   * order of the columns given to the constructor, and their type must
+   * exactly match the type of the columns (INTEGER, BIGINT or TEXT).
+   * No other statement can be run on the connection until "Finish()"
+   * is called.
+   **/
+  class PostgreSQLCopy : public boost::noncopyable
+  {
+  private:
+    PostgreSQLDatabase&  database_;
+    size_t               countColumns_;
+    size_t               currentColumn_;
+    uint64_t             countRows_;
+    std::string          buffer_;
+    bool                 done_;
+
+    void AppendInteger16(int16_t value);
+
+    void AppendInteger32(int32_t value);
+
+    void AppendInteger64(int64_t value);
+
+    void BeginField(int32_t size);
+
+    void Flush();
+
+  public:
+    PostgreSQLCopy(PostgreSQLDatabase& database,
+                   const std::string& table,
+                   const std::vector<std::string>& columns);
+
+    ~PostgreSQLCopy();
+
+    void BeginRow();
+
+    void AddNull();
+
+    void AddInteger32(int32_t value);
+
+    void AddInteger64(int64_t value);
+
+    void AddString(const std::string& value);
+
+    uint64_t GetRowsCount() const
+    {
+      return countRows_;
+    }
+
+    // Ends the "COPY" statement, which only takes effect at the commit of the transaction
+    void Finish();
+  };
+}
@@ -36,6 +36,11 @@
 
 #include <boost/lexical_cast.hpp>
 #include <boost/thread.hpp>
+#include <string.h>
+
+#if !defined(_WIN32)
+#  include <sys/select.h>
+#endif
 
 
 namespace OrthancDatabases
@@ -59,6 +64,215 @@ namespace OrthancDatabases
   }
 
 
+  void PostgreSQLDatabase::ThrowStatementError(const std::string& message)
+  {
+    if (PQtransactionStatus(reinterpret_cast<PGconn*>(pg_)) == PQTRANS_INERROR)
+    {
+#if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 9, 2)
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_DatabaseCannotSerialize, message, false); // don't log here, it is handled at higher level
+#else
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Collision between multiple writers");
+#endif
+    }
+    else
+    {
+      LOG(ERROR) << "PostgreSQL error: " << message;
+      ThrowException(false);
+    }
+  }
+
+
+  bool PostgreSQLDatabase::IsPipelineModeSupported()
+  {
+#if PG_VERSION_NUM >= 140000
+    return true;
+#else
+    return false;
+#endif
+  }
+
+
+  bool PostgreSQLDatabase::IsProtocolCompressionSupported()
+  {
+    // The option is not part of the mainline libpq yet, so its
+    // availability is checked at runtime among the known options
+    bool found = false;
+
+    PQconninfoOption* options = PQconndefaults();
+    if (options != NULL)
+    {
+      for (const PQconninfoOption* option = options; option->keyword != NULL; option++)
+      {
+        if (strcmp(option->keyword, "compression") == 0)
+        {
+          found = true;
+        }
+      }
+
+      PQconninfoFree(options);
+    }
+
+    return found;
+  }
+
+
+  bool PostgreSQLDatabase::IsPipelineEnabled() const
+  {
+    return (IsPipelineModeSupported() &&
+            parameters_.IsPipelineMode());
+  }
+
+
+  void PostgreSQLDatabase::EnterPipelineMode()
+  {
+#if PG_VERSION_NUM >= 140000
+    if (pipelineCount_ == 0 &&
+        PQpipelineStatus(reinterpret_cast<PGconn*>(pg_)) == PQ_PIPELINE_OFF &&
+        PQenterPipelineMode(reinterpret_cast<PGconn*>(pg_)) != 1)
+    {
+      ThrowException(true);
+    }
+
+    if (!deferredBegin_.empty())
+    {
+      // Queue the "BEGIN" in front of the first statement of the
+      // transaction. The pipeline mode only accepts one command per
+      // query, hence the split.
+      std::vector<std::string> commands;
+      Orthanc::Toolbox::TokenizeString(commands, deferredBegin_, ';');
+      deferredBegin_.clear();
+
+      for (size_t i = 0; i < commands.size(); i++)
+      {
+        const std::string command = Orthanc::Toolbox::StripSpaces(commands[i]);
+
+        if (!command.empty())
+        {
+          if (IsVerboseEnabled())
+          {
+            LOG(INFO) << "PostgreSQL: " << command;
+          }
+
+          if (PQsendQueryParams(reinterpret_cast<PGconn*>(pg_), command.c_str(),
+                                0, NULL, NULL, NULL, NULL, 1) != 1)
+          {
+            ThrowException(true);
+          }
+
+          pipelineCount_++;
+        }
+      }
+    }
+#else
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented, "libpq is too old to support the pipeline mode");
+#endif
+  }
+
+
+  void PostgreSQLDatabase::SyncPipeline(bool throwOnError)
+  {
+    if (pipelineCount_ == 0)
+    {
+      return;
+    }
+
+#if PG_VERSION_NUM >= 140000
+    PGconn* pg = reinterpret_cast<PGconn*>(pg_);
+
+    const size_t count = pipelineCount_;
+    pipelineCount_ = 0;
+
+    if (PQpipelineSync(pg) != 1)
+    {
+      ThrowException(true);
+    }
+
+    // Each queued statement is followed by NULL. After an error, the
+    // next statements are reported as "PGRES_PIPELINE_ABORTED".
+    std::string error;
+
+    for (size_t i = 0; i < count; i++)
+    {
+      PGresult* result;
+      while ((result = PQgetResult(pg)) != NULL)
+      {
+        if (PQresultStatus(result) == PGRES_FATAL_ERROR &&
+            error.empty())
+        {
+          error = PQresultErrorMessage(result);
+          if (error.empty())
+          {
+            error = "Error in a statement of the pipeline";
+          }
+        }
+
+        PQclear(result);
+      }
+    }
+
+    PGresult* result = PQgetResult(pg);
+    const bool synced = (result != NULL &&
+                         PQresultStatus(result) == PGRES_PIPELINE_SYNC);
+    if (result != NULL)
+    {
+      PQclear(result);
+    }
+
+    if (!synced ||
+        PQexitPipelineMode(pg) != 1)
+    {
+      ThrowException(true);
+    }
+
+    if (!error.empty() &&
+        throwOnError)
+    {
+      ThrowStatementError(error);
+    }
+#else
+    throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
+#endif
+  }
+
+
+  void PostgreSQLDatabase::DeferBegin(const std::string& sql)
+  {
+    if (!deferredBegin_.empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    deferredBegin_ = sql;
+  }
+
+
+  bool PostgreSQLDatabase::CancelDeferredBegin()
+  {
+    if (deferredBegin_.empty())
+    {
+      return false;
+    }
+    else
+    {
+      deferredBegin_.clear();
+      return true;
+    }
+  }
+
+
+  void PostgreSQLDatabase::FlushPipeline()
+  {
+    SyncPipeline(true);
+
+    if (!deferredBegin_.empty())
+    {
+      std::string sql;
+      sql.swap(deferredBegin_);
+      ExecuteMultiLines(sql);
+    }
+  }
+
+
   void PostgreSQLDatabase::Close()
   {
     if (pg_ != NULL)
@@ -67,6 +281,8 @@ namespace OrthancDatabases
       PQfinish(reinterpret_cast<PGconn*>(pg_));
       pg_ = NULL;
     }
+
+    pipelineCount_ = 0;
   }
 
 
@@ -111,6 +327,20 @@ namespace OrthancDatabases
       LOG(ERROR) << "PostgreSQL error: " << message;
       throw Orthanc::OrthancException(Orthanc::ErrorCode_DatabaseUnavailable);
     }
+
+    const std::string statements = parameters_.GetOpeningStatements();
+    if (!statements.empty())
+    {
+      // Session settings of the connection, that last until it is closed
+      ExecuteMultiLines(statements);
+    }
+  }
+
+
+  int PostgreSQLDatabase::GetServerVersion()
+  {
+    Open();
+    return PQserverVersion(reinterpret_cast<PGconn*>(pg_));
   }
 
 
@@ -165,8 +395,23 @@ namespace OrthancDatabases
       LOG(INFO) << "PostgreSQL: " << sql;
     }
     Open();
+    SyncPipeline(true);
+
+    PGresult* result;
+
+    if (deferredBegin_.empty())
+    {
+      result = PQexec(reinterpret_cast<PGconn*>(pg_), sql.c_str());
+    }
+    else
+    {
+      // Piggyback the deferred "BEGIN" onto these commands
+      std::string query;
+      query.swap(deferredBegin_);
+      query += "; " + sql;
+      result = PQexec(reinterpret_cast<PGconn*>(pg_), query.c_str());
+    }
 
-    PGresult* result = PQexec(reinterpret_cast<PGconn*>(pg_), sql.c_str());
     if (result == NULL)
     {
       ThrowException(true);
@@ -196,11 +441,12 @@ namespace OrthancDatabases
     Orthanc::Toolbox::ToLowerCase(lower, name);
 
     // http://stackoverflow.com/a/24089729/881731
+    // Kind "p" corresponds to the partitioned tables
 
     PostgreSQLStatement statement(*this, 
                                   "SELECT 1 FROM pg_catalog.pg_class c "
                                   "JOIN pg_catalog.pg_namespace n ON n.oid = c.relnamespace "
-                                  "WHERE n.nspname = 'public' AND c.relkind='r' "
+                                  "WHERE n.nspname = 'public' AND c.relkind IN ('r', 'p') "
                                   "AND c.relname=$1");
 
     statement.DeclareInputString(0);
@@ -210,17 +456,92 @@ namespace OrthancDatabases
     return !result.IsDone();
   }
 
+  static bool ReadNotification(std::string& channel,
+                               std::string& payload,
+                               PGconn* pg)
+  {
+    PGnotify* notification = PQnotifies(pg);
+    if (notification == NULL)
+    {
+      return false;
+    }
+    else
+    {
+      channel = (notification->relname == NULL ? "" : notification->relname);
+      payload = (notification->extra == NULL ? "" : notification->extra);
+      PQfreemem(notification);
+      return true;
+    }
+  }
+
+
+  bool PostgreSQLDatabase::WaitForNotification(std::string& payload,
+                                               unsigned int timeoutMilliseconds)
+  {
+    std::string channel;
+    return WaitForNotification(channel, payload, timeoutMilliseconds);
+  }
+
+
+  bool PostgreSQLDatabase::WaitForNotification(std::string& channel,
+                                               std::string& payload,
+                                               unsigned int timeoutMilliseconds)
+  {
+    Open();
+
+    PGconn* pg = reinterpret_cast<PGconn*>(pg_);
+
+    // The notifications that were already received are returned first
+    if (!PQconsumeInput(pg))
+    {
+      ThrowException(true);
+    }
+
+    if (ReadNotification(channel, payload, pg))
+    {
+      return true;
+    }
+
+    const int socket = PQsocket(pg);
+    if (socket < 0)
+    {
+      ThrowException(true);
+    }
+
+    fd_set input;
+    FD_ZERO(&input);
+    FD_SET(socket, &input);
+
+    struct timeval timeout;
+    timeout.tv_sec = timeoutMilliseconds / 1000;
+    timeout.tv_usec = (timeoutMilliseconds % 1000) * 1000;
+
+    if (select(socket + 1, &input, NULL, NULL, &timeout) <= 0)
+    {
+      return false;  // Timeout, or interrupted by a signal
+    }
+
+    if (!PQconsumeInput(pg))
+    {
+      ThrowException(true);
+    }
+
+    return ReadNotification(channel, payload, pg);
+  }
+
+
   bool PostgreSQLDatabase::DoesIndexExist(const std::string& name)
   {
     std::string lower;
     Orthanc::Toolbox::ToLowerCase(lower, name);
 
     // http://stackoverflow.com/a/24089729/881731
+    // Kind "I" corresponds to the indexes of the partitioned tables
 
     PostgreSQLStatement statement(*this, 
                                   "SELECT 1 FROM pg_catalog.pg_class c "
                                   "JOIN pg_catalog.pg_namespace n ON n.oid = c.relnamespace "
-                                  "WHERE n.nspname = 'public' AND c.relkind='i' "
+                                  "WHERE n.nspname = 'public' AND c.relkind IN ('i', 'I') "
                                   "AND c.relname=$1");
 
     statement.DeclareInputString(0);
@@ -35,17 +35,38 @@ namespace OrthancDatabases
   class PostgreSQLDatabase : public IDatabase
   {
   private:
+    friend class PostgreSQLAsyncQueries;
+    friend class PostgreSQLCopy;
     friend class PostgreSQLStatement;
     friend class PostgreSQLLargeObject;
+    friend class PostgreSQLResult;
     friend class PostgreSQLTransaction;
 
     class Factory;
 
     PostgreSQLParameters  parameters_;
     void*                 pg_;   /* Object of type "PGconn*" */
+    size_t                pipelineCount_;  // Number of queued statements whose results are not read yet
+    std::string           deferredBegin_;  // "BEGIN" of the current transaction, until its first statement
 
     void ThrowException(bool log);
 
+    // Throws the exception corresponding to an error in a statement
+    // (a collision between writers while in a transaction)
+    void ThrowStatementError(const std::string& message);
+
+    void EnterPipelineMode();
+
+    void SyncPipeline(bool throwOnError);
+
+    // The "BEGIN" is only sent to the server together with the first
+    // statement of the transaction, which saves the round trips of
+    // "BEGIN" and "COMMIT" for the transactions without statements
+    void DeferBegin(const std::string& sql);
+
+    // Returns "true" iff the transaction had not been opened yet
+    bool CancelDeferredBegin();
+
     void Close();
 
     bool RunAdvisoryLockStatement(const std::string& statement);
@@ -53,7 +74,8 @@ namespace OrthancDatabases
   public:
     explicit PostgreSQLDatabase(const PostgreSQLParameters& parameters) :
       parameters_(parameters),
-      pg_(NULL)
+      pg_(NULL),
+      pipelineCount_(0)
     {
     }
 
@@ -66,6 +88,11 @@ namespace OrthancDatabases
       return parameters_.IsVerboseEnabled();
     }
 
+    bool IsTransactionPooling() const
+    {
+      return parameters_.IsTransactionPooling();
+    }
+
     bool AcquireAdvisoryLock(int32_t lock);
 
     bool ReleaseAdvisoryLock(int32_t lock);
@@ -74,6 +101,42 @@ namespace OrthancDatabases
 
     void ExecuteMultiLines(const std::string& sql);
 
+    /**
+     * Waits for a notification on one of the channels this connection
+     * is listening to (cf. "LISTEN"). Returns "false" if no
+     * notification was received before the timeout.
+     **/
+    bool WaitForNotification(std::string& payload,
+                             unsigned int timeoutMilliseconds);
+
+    // Same as above, also returns the channel of the notification
+    bool WaitForNotification(std::string& channel,
+                             std::string& payload,
+                             unsigned int timeoutMilliseconds);
+
+    // The pipeline mode requires libpq >= 14
+    static bool IsPipelineModeSupported();
+
+    // Whether libpq knows about the "compression" connection option
+    static bool IsProtocolCompressionSupported();
+
+    // Version of the server, e.g. "90500" for PostgreSQL 9.5
+    int GetServerVersion();
+
+    // Whether the statements whose result is not needed are queued
+    // in the libpq pipeline mode, until the next synchronous call
+    bool IsPipelineEnabled() const;
+
+    // Waits for the queued statements, and throws if one of them
+    // failed. The deferred "BEGIN" is then executed, if any.
+    void FlushPipeline();
+
+    // Waits for the queued statements, ignoring their errors (before a rollback)
+    void DiscardPipeline()
+    {
+      SyncPipeline(false);
+    }
+
     bool DoesIndexExist(const std::string& name);
 
     bool DoesTableExist(const std::string& name);
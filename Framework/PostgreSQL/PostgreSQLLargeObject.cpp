@@ -29,14 +29,22 @@
 #include <Logging.h>
 #include <OrthancException.h>
 
+#include <algorithm>
 #include <boost/lexical_cast.hpp>
 #include <libpq/libpq-fs.h>
 
 
 namespace OrthancDatabases
 {  
-  void PostgreSQLLargeObject::Create()
+  static const int MAX_CHUNK_SIZE = 16 * 1024 * 1024;
+
+
+  PostgreSQLLargeObject::Writer::Writer(PostgreSQLDatabase& database) :
+    database_(database),
+    size_(0)
   {
+    database_.FlushPipeline();
+
     PGconn* pg = reinterpret_cast<PGconn*>(database_.pg_);
 
     oid_ = lo_creat(pg, INV_WRITE);
@@ -45,39 +53,48 @@ namespace OrthancDatabases
       LOG(ERROR) << "PostgreSQL: Cannot create a large object";
       database_.ThrowException(false);
     }
+
+    fd_ = lo_open(pg, oid_, INV_WRITE);
+    if (fd_ < 0)
+    {
+      database_.ThrowException(true);
+    }
   }
 
 
-  void PostgreSQLLargeObject::Write(const void* data, 
-                                    size_t size)
+  PostgreSQLLargeObject::Writer::~Writer()
   {
-    static int MAX_CHUNK_SIZE = 16 * 1024 * 1024;
+    lo_close(reinterpret_cast<PGconn*>(database_.pg_), fd_);
+  }
 
-    PGconn* pg = reinterpret_cast<PGconn*>(database_.pg_);
 
-    int fd = lo_open(pg, oid_, INV_WRITE);
-    if (fd < 0)
-    {
-      database_.ThrowException(true);
-    }
+  void PostgreSQLLargeObject::Writer::Append(const void* data,
+                                             size_t size)
+  {
+    PGconn* pg = reinterpret_cast<PGconn*>(database_.pg_);
 
     const char* position = reinterpret_cast<const char*>(data);
     while (size > 0)
     {
+      // "lo_write()" returns an "int": Bound the size of each call
       int chunk = (size > static_cast<size_t>(MAX_CHUNK_SIZE) ?
                    MAX_CHUNK_SIZE : static_cast<int>(size));
-      int nbytes = lo_write(pg, fd, position, chunk);
+      int nbytes = lo_write(pg, fd_, position, chunk);
       if (nbytes <= 0)
       {
-        lo_close(pg, fd);
         database_.ThrowException(true);
       }
 
       size -= nbytes;
       position += nbytes;
+      size_ += static_cast<uint64_t>(nbytes);
     }
+  }
 
-    lo_close(pg, fd);
+
+  std::string PostgreSQLLargeObject::Writer::GetOid() const
+  {
+    return boost::lexical_cast<std::string>(oid_);
   }
 
 
@@ -85,16 +102,21 @@ namespace OrthancDatabases
                                                const std::string& s) : 
     database_(database)
   {
-    Create();
+    Writer writer(database);
 
     if (s.size() != 0)
     {
-      Write(s.c_str(), s.size());
-    }
-    else
-    {
-      Write(NULL, 0);
+      writer.Append(s.c_str(), s.size());
     }
+
+    oid_ = writer.oid_;
+  }
+
+
+  PostgreSQLLargeObject::PostgreSQLLargeObject(const Writer& writer) :
+    database_(writer.database_),
+    oid_(writer.oid_)
+  {
   }
 
 
@@ -103,21 +125,39 @@ namespace OrthancDatabases
   private: 
     PostgreSQLDatabase& database_;
     int fd_;
-    size_t size_;
+    uint64_t size_;
+
+    // The 64-bit variants of "lo_lseek()" and "lo_tell()" are needed
+    // for the large objects of more than 2GB (PostgreSQL >= 9.3)
+    void Seek(PGconn* pg,
+              uint64_t position)
+    {
+      if (lo_lseek64(pg, fd_, static_cast<pg_int64>(position), SEEK_SET) < 0)
+      {
+        database_.ThrowException(true);
+      }
+    }
 
     void ReadInternal(PGconn* pg,
-                      std::string& target)
+                      char* target,
+                      size_t size)
     {
-      for (size_t position = 0; position < target.size(); )
+      for (size_t position = 0; position < size; )
       {
-        size_t remaining = target.size() - position;
+        // "lo_read()" returns an "int": Bound the size of each call
+        size_t remaining = std::min(size - position, static_cast<size_t>(MAX_CHUNK_SIZE));
 
-        int nbytes = lo_read(pg, fd_, &target[position], remaining);
+        int nbytes = lo_read(pg, fd_, target + position, remaining);
         if (nbytes < 0)
         {
           LOG(ERROR) << "PostgreSQL: Unable to read the large object in the database";
           database_.ThrowException(false);
         }
+        else if (nbytes == 0)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_Database,
+                                          "PostgreSQL: Unexpected end of the large object");
+        }
 
         position += static_cast<size_t>(nbytes);
       }
@@ -128,13 +168,15 @@ namespace OrthancDatabases
            const std::string& oid) : 
       database_(database)
     {
+      database.FlushPipeline();
+
       PGconn* pg = reinterpret_cast<PGconn*>(database.pg_);
       Oid id = boost::lexical_cast<Oid>(oid);
 
       fd_ = lo_open(pg, id, INV_READ);
 
       if (fd_ < 0 ||
-          lo_lseek(pg, fd_, 0, SEEK_END) < 0)
+          lo_lseek64(pg, fd_, 0, SEEK_END) < 0)
       {
         LOG(ERROR) << "PostgreSQL: No such large object in the database; "
                    << "Make sure you use a transaction";
@@ -142,12 +184,13 @@ namespace OrthancDatabases
       }
 
       // Get the size of the large object
-      int size = lo_tell(pg, fd_);
+      const pg_int64 size = lo_tell64(pg, fd_);
       if (size < 0)
       {
+        lo_close(pg, fd_);
         database.ThrowException(true);
       }
-      size_ = static_cast<size_t>(size);
+      size_ = static_cast<uint64_t>(size);
     }
 
     ~Reader()
@@ -155,14 +198,29 @@ namespace OrthancDatabases
       lo_close(reinterpret_cast<PGconn*>(database_.pg_), fd_);
     }
 
-    size_t GetSize() const
+    uint64_t GetSize() const
     {
       return size_;
     }
 
-    void ReadWhole(std::string& target)
+    // The size of the buffer that receives the whole large object
+    size_t GetBufferSize() const
+    {
+      if (static_cast<uint64_t>(static_cast<size_t>(size_)) != size_)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NotEnoughMemory,
+                                        "PostgreSQL: The large object is too large for this platform");
+      }
+      else
+      {
+        return static_cast<size_t>(size_);
+      }
+    }
+
+    void ReadWhole(void* target,
+                   size_t size)
     {
-      if (target.size() != size_)
+      if (size != size_)
       {
         throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
       }
@@ -170,20 +228,59 @@ namespace OrthancDatabases
       PGconn* pg = reinterpret_cast<PGconn*>(database_.pg_);
 
       // Go to the first byte of the object
-      lo_lseek(pg, fd_, 0, SEEK_SET);
+      Seek(pg, 0);
 
-      ReadInternal(pg, target);
+      ReadInternal(pg, reinterpret_cast<char*>(target), size);
     }
 
-    void ReadRange(std::string& target,
-                   uint64_t start)
+    void ReadRange(void* target,
+                   uint64_t start,
+                   size_t length)
     {
+      if (start >= size_ ||
+          start + length > size_)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRange);
+      }
+
       PGconn* pg = reinterpret_cast<PGconn*>(database_.pg_);
 
-      // Go to the first byte of the object
-      lo_lseek(pg, fd_, start, SEEK_SET);
+      // Go to the first byte of the range
+      Seek(pg, start);
 
-      ReadInternal(pg, target);
+      ReadInternal(pg, reinterpret_cast<char*>(target), length);
+    }
+
+    void ReadRange(ResultFileValue::IChunkVisitor& visitor,
+                   uint64_t start,
+                   size_t length,
+                   size_t chunkSize)
+    {
+      if (chunkSize == 0)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+      }
+      else if (start >= size_ ||
+               start + length > size_)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRange);
+      }
+
+      PGconn* pg = reinterpret_cast<PGconn*>(database_.pg_);
+
+      // Go to the first byte of the range
+      Seek(pg, start);
+
+      std::string buffer;
+      buffer.resize(std::min(length, chunkSize));
+
+      while (length > 0)
+      {
+        const size_t chunk = std::min(length, buffer.size());
+        ReadInternal(pg, &buffer[0], chunk);
+        visitor.VisitChunk(buffer.c_str(), chunk);
+        length -= chunk;
+      }
     }
   };
   
@@ -193,11 +290,11 @@ namespace OrthancDatabases
                                         const std::string& oid)
   {
     Reader reader(database, oid);
-    target.resize(reader.GetSize());    
+    target.resize(reader.GetBufferSize());
 
     if (target.size() > 0)
     {
-      reader.ReadWhole(target);
+      reader.ReadWhole(&target[0], target.size());
     }
   }
 
@@ -209,22 +306,75 @@ namespace OrthancDatabases
                                         size_t length)
   {
     Reader reader(database, oid);
+    target.resize(length);
 
-    if (start >= reader.GetSize() ||
-        start + length > reader.GetSize())
+    if (target.size() > 0)
+    {
+      reader.ReadRange(&target[0], start, target.size());
+    }
+    else if (start >= reader.GetSize())
     {
       throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRange);
     }
-    
-    target.resize(length);
+  }
 
-    if (target.size() > 0)
+
+  void PostgreSQLLargeObject::ReadWhole(ResultFileValue::IBufferAllocator& allocator,
+                                        PostgreSQLDatabase& database,
+                                        const std::string& oid)
+  {
+    Reader reader(database, oid);
+    const size_t size = reader.GetBufferSize();
+    void* target = allocator.Allocate(size);
+
+    if (size > 0)
     {
-      reader.ReadRange(target, start);
+      if (target == NULL)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+      }
+
+      reader.ReadWhole(target, size);
     }
   }
 
 
+  void PostgreSQLLargeObject::ReadRange(void* target,
+                                        PostgreSQLDatabase& database,
+                                        const std::string& oid,
+                                        uint64_t start,
+                                        size_t length)
+  {
+    Reader reader(database, oid);
+
+    if (length > 0)
+    {
+      if (target == NULL)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_NullPointer);
+      }
+
+      reader.ReadRange(target, start, length);
+    }
+    else if (start >= reader.GetSize())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRange);
+    }
+  }
+
+
+  void PostgreSQLLargeObject::ReadRange(ResultFileValue::IChunkVisitor& visitor,
+                                        PostgreSQLDatabase& database,
+                                        const std::string& oid,
+                                        uint64_t start,
+                                        size_t length,
+                                        size_t chunkSize)
+  {
+    Reader reader(database, oid);
+    reader.ReadRange(visitor, start, length, chunkSize);
+  }
+
+
   std::string PostgreSQLLargeObject::GetOid() const
   {
     return boost::lexical_cast<std::string>(oid_);
@@ -234,6 +384,8 @@ namespace OrthancDatabases
   void PostgreSQLLargeObject::Delete(PostgreSQLDatabase& database,
                                      const std::string& oid)
   {
+    database.FlushPipeline();
+
     PGconn* pg = reinterpret_cast<PGconn*>(database.pg_);
     Oid id = boost::lexical_cast<Oid>(oid);
 
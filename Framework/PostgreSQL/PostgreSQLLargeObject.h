@@ -28,6 +28,7 @@
 #endif
 
 #include "PostgreSQLDatabase.h"
+#include "../Common/ResultFileValue.h"
 
 #include <libpq-fe.h>
 
@@ -35,22 +36,53 @@ namespace OrthancDatabases
 {  
   class PostgreSQLLargeObject : public boost::noncopyable
   {
+  public:
+    /**
+     * Streaming writer, that creates a new large object and receives
+     * its content by chunks, so that the content doesn't have to be
+     * stored in one contiguous buffer. The large object is closed by
+     * the destructor, and must be created inside a transaction.
+     **/
+    class Writer : public boost::noncopyable
+    {
+      friend class PostgreSQLLargeObject;
+
+    private:
+      PostgreSQLDatabase& database_;
+      Oid                 oid_;
+      int                 fd_;
+      uint64_t            size_;
+
+    public:
+      explicit Writer(PostgreSQLDatabase& database);
+
+      ~Writer();
+
+      void Append(const void* data,
+                  size_t size);
+
+      uint64_t GetSize() const
+      {
+        return size_;
+      }
+
+      std::string GetOid() const;
+    };
+
   private:
     class Reader;
 
     PostgreSQLDatabase& database_;
     Oid oid_;
 
-    void Create();
-
-    void Write(const void* data, 
-               size_t size);
-
   public:
     // This constructor is used to deal with "InputFileValue"
     PostgreSQLLargeObject(PostgreSQLDatabase& database,
                           const std::string& s);
 
+    // Wraps a large object that has been created by a streaming writer
+    explicit PostgreSQLLargeObject(const Writer& writer);
+
     std::string GetOid() const;
 
     static void ReadWhole(std::string& target,
@@ -63,6 +95,25 @@ namespace OrthancDatabases
                           uint64_t start,
                           size_t size);
 
+    // Zero-copy versions, that read directly into the target buffer
+    static void ReadWhole(ResultFileValue::IBufferAllocator& allocator,
+                          PostgreSQLDatabase& database,
+                          const std::string& oid);
+
+    static void ReadRange(void* target,
+                          PostgreSQLDatabase& database,
+                          const std::string& oid,
+                          uint64_t start,
+                          size_t size);
+
+    // Streaming version, that reuses one buffer of "chunkSize" bytes
+    static void ReadRange(ResultFileValue::IChunkVisitor& visitor,
+                          PostgreSQLDatabase& database,
+                          const std::string& oid,
+                          uint64_t start,
+                          size_t length,
+                          size_t chunkSize);
+
     static void Delete(PostgreSQLDatabase& database,
                        const std::string& oid);
   };
@@ -27,6 +27,8 @@
 #include <OrthancException.h>
 
 #include <boost/lexical_cast.hpp>
+#include <cassert>
+#include <cctype>
 
 
 namespace OrthancDatabases
@@ -35,16 +37,32 @@ namespace OrthancDatabases
   {
     host_ = "localhost";
     port_ = 5432;
+    hosts_.clear();
+    hostsPorts_.clear();
+    targetSessionAttributes_.clear();
+    loadBalanceHosts_ = false;
     username_ = "";
     password_ = "";
     database_.clear();
     uri_.clear();
     ssl_ = false;
     lock_ = true;
+    multiWriter_ = false;
     maxConnectionRetries_ = 10;
     connectionRetryInterval_ = 5;
     isVerboseEnabled_ = false;
+    pipelineMode_ = false;
+    transactionPooling_ = false;
+    synchronousCommit_ = true;
+    compression_.clear();
     isolationMode_ = IsolationMode_Serializable;
+
+    for (size_t i = 0; i < 3; i++)
+    {
+      sessionSettings_[i].clear();
+    }
+
+    housekeeping_ = false;
   }
 
 
@@ -57,7 +75,62 @@ namespace OrthancDatabases
   PostgreSQLParameters::PostgreSQLParameters(const OrthancPlugins::OrthancConfiguration& configuration)
   {
     Reset();
+    LoadConnectionParameters(configuration);
+
+    if (hosts_.size() > 1 &&
+        targetSessionAttributes_.empty())
+    {
+      // Never write to a standby server of the cluster
+      targetSessionAttributes_ = "read-write";
+    }
+
+    lock_ = configuration.GetBooleanValue("Lock", true);  // Use locking by default
+    multiWriter_ = configuration.GetBooleanValue("EnableMultiWriter", false);
+
+    if (multiWriter_ &&
+        lock_)
+    {
+      LOG(WARNING) << "PostgreSQL: the \"Lock\" option is ignored, as \"EnableMultiWriter\" is set";
+      lock_ = false;
+    }
+
+    transactionPooling_ = configuration.GetBooleanValue("EnableTransactionPooling", false);
+
+    if (transactionPooling_ &&
+        lock_)
+    {
+      // The advisory lock is held by a session, that is not owned by the plugin behind the pooler
+      LOG(WARNING) << "PostgreSQL: the \"Lock\" option is ignored, as \"EnableTransactionPooling\" is set";
+      lock_ = false;
+    }
+
+    isVerboseEnabled_ = configuration.GetBooleanValue("EnableVerboseLogs", false);
+    pipelineMode_ = configuration.GetBooleanValue("EnablePipelineMode", false);
+    compression_ = configuration.GetStringValue("ProtocolCompression", "");
+
+    maxConnectionRetries_ = configuration.GetUnsignedIntegerValue("MaximumConnectionRetries", 10);
+    connectionRetryInterval_ = configuration.GetUnsignedIntegerValue("ConnectionRetryInterval", 5);
 
+    std::string transactionMode = configuration.GetStringValue("TransactionMode", "ReadCommitted");
+    if (transactionMode == "ReadCommitted")
+    {
+      LOG(WARNING) << "PostgreSQL: using READ COMMITTED transaction mode";
+      SetIsolationMode(IsolationMode_ReadCommited);
+    }
+    else if (transactionMode == "Serializable")
+    {
+      LOG(WARNING) << "PostgreSQL: using SERIALIZABLE transaction mode";
+      SetIsolationMode(IsolationMode_Serializable);
+    }
+    else
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadParameterType, std::string("Invalid value for 'TransactionMode': ") + transactionMode);
+    }
+  }
+
+
+  void PostgreSQLParameters::LoadConnectionParameters(const OrthancPlugins::OrthancConfiguration& configuration)
+  {
     std::string s;
 
     if (configuration.LookupStringValue(s, "ConnectionUri"))
@@ -71,6 +144,12 @@ namespace OrthancDatabases
         SetHost(s);
       }
 
+      std::list<std::string> hosts;
+      if (configuration.LookupListOfStrings(hosts, "Hosts", false))
+      {
+        SetHosts(hosts);
+      }
+
       unsigned int port;
       if (configuration.LookupUnsignedIntegerValue(port, "Port"))
       {
@@ -92,30 +171,14 @@ namespace OrthancDatabases
         SetPassword(s);
       }
 
-      ssl_ = configuration.GetBooleanValue("EnableSsl", false);
-    }
+      ssl_ = configuration.GetBooleanValue("EnableSsl", ssl_);
 
-    lock_ = configuration.GetBooleanValue("Lock", true);  // Use locking by default
-
-    isVerboseEnabled_ = configuration.GetBooleanValue("EnableVerboseLogs", false);
-
-    maxConnectionRetries_ = configuration.GetUnsignedIntegerValue("MaximumConnectionRetries", 10);
-    connectionRetryInterval_ = configuration.GetUnsignedIntegerValue("ConnectionRetryInterval", 5);
+      if (configuration.LookupStringValue(s, "TargetSessionAttributes"))
+      {
+        SetTargetSessionAttributes(s);
+      }
 
-    std::string transactionMode = configuration.GetStringValue("TransactionMode", "ReadCommitted");
-    if (transactionMode == "ReadCommitted")
-    {
-      LOG(WARNING) << "PostgreSQL: using READ COMMITTED transaction mode";
-      SetIsolationMode(IsolationMode_ReadCommited);
-    }
-    else if (transactionMode == "Serializable")
-    {
-      LOG(WARNING) << "PostgreSQL: using SERIALIZABLE transaction mode";
-      SetIsolationMode(IsolationMode_Serializable);
-    }
-    else
-    {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadParameterType, std::string("Invalid value for 'TransactionMode': ") + transactionMode);
+      loadBalanceHosts_ = configuration.GetBooleanValue("LoadBalanceHosts", loadBalanceHosts_);
     }
   }
 
@@ -141,20 +204,46 @@ namespace OrthancDatabases
           actualUri += ":" + password_;
         }
 
-        actualUri += "@" + host_;
+        actualUri += "@";
       }
-      else
+
+      if (hosts_.empty())
       {
         actualUri += host_;
+
+        if (port_ > 0)
+        {
+          actualUri += ":" + boost::lexical_cast<std::string>(port_);
+        }
       }
-      
-      if (port_ > 0)
+      else
       {
-        actualUri += ":" + boost::lexical_cast<std::string>(port_);
+        for (size_t i = 0; i < hosts_.size(); i++)
+        {
+          if (i > 0)
+          {
+            actualUri += ",";
+          }
+
+          actualUri += hosts_[i] + ":" + boost::lexical_cast<std::string>(GetHostPort(i));
+        }
       }
 
       actualUri += "/" + database_;
 
+      std::string options;
+      FormatHostsOptions(options, "&");
+
+      if (!compression_.empty())
+      {
+        options += (options.empty() ? "" : "&") + std::string("compression=") + compression_;
+      }
+
+      if (!options.empty())
+      {
+        actualUri += "?" + options;
+      }
+
       return actualUri;
     }
     else
@@ -168,6 +257,113 @@ namespace OrthancDatabases
   {
     uri_.clear();
     host_ = host;
+    hosts_.clear();
+    hostsPorts_.clear();
+  }
+
+
+  void PostgreSQLParameters::SetHosts(const std::list<std::string>& hosts)
+  {
+    std::vector<std::string> names;
+    std::vector<uint16_t> ports;
+
+    for (std::list<std::string>::const_iterator it = hosts.begin(); it != hosts.end(); ++it)
+    {
+      // The IPv6 addresses must be surrounded by brackets, as in "[::1]:5432"
+      const size_t bracket = it->rfind(']');
+      const size_t colon = it->rfind(':');
+
+      if (colon == std::string::npos ||
+          (bracket != std::string::npos && colon < bracket))
+      {
+        names.push_back(*it);
+        ports.push_back(0);
+      }
+      else
+      {
+        unsigned int port;
+
+        try
+        {
+          port = boost::lexical_cast<unsigned int>(it->substr(colon + 1));
+        }
+        catch (boost::bad_lexical_cast&)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                          "Bad PostgreSQL host: " + *it);
+        }
+
+        if (port == 0 ||
+            port >= 65535)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                          "Bad PostgreSQL host: " + *it);
+        }
+
+        names.push_back(it->substr(0, colon));
+        ports.push_back(static_cast<uint16_t>(port));
+      }
+
+      if (names.back().empty())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "Bad PostgreSQL host: " + *it);
+      }
+    }
+
+    uri_.clear();
+    hosts_.swap(names);
+    hostsPorts_.swap(ports);
+  }
+
+
+  uint16_t PostgreSQLParameters::GetHostPort(size_t index) const
+  {
+    assert(index < hostsPorts_.size());
+    return (hostsPorts_[index] == 0 ? port_ : hostsPorts_[index]);
+  }
+
+
+  void PostgreSQLParameters::FormatHostsOptions(std::string& target,
+                                                const std::string& separator) const
+  {
+    target.clear();
+
+    if (!targetSessionAttributes_.empty())
+    {
+      target = "target_session_attrs=" + targetSessionAttributes_;
+    }
+
+    if (loadBalanceHosts_)
+    {
+      if (!target.empty())
+      {
+        target += separator;
+      }
+
+      target += "load_balance_hosts=random";
+    }
+  }
+
+
+  void PostgreSQLParameters::SetTargetSessionAttributes(const std::string& attributes)
+  {
+    if (attributes.empty() ||
+        attributes == "any" ||
+        attributes == "read-write" ||
+        attributes == "read-only" ||
+        attributes == "primary" ||
+        attributes == "standby" ||
+        attributes == "prefer-standby")
+    {
+      uri_.clear();
+      targetSessionAttributes_ = attributes;
+    }
+    else
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "Bad value for the PostgreSQL target session attributes: " + attributes);
+    }
   }
 
   void PostgreSQLParameters::SetPortNumber(unsigned int port)
@@ -202,32 +398,202 @@ namespace OrthancDatabases
 
   const std::string PostgreSQLParameters::GetReadWriteTransactionStatement() const
   {
+    std::string statement;
+
     switch (isolationMode_)
     {
       case IsolationMode_ReadCommited:
-        return "SET TRANSACTION ISOLATION LEVEL READ COMMITTED READ WRITE";
+        statement = "SET TRANSACTION ISOLATION LEVEL READ COMMITTED READ WRITE";
+        break;
 
       case IsolationMode_Serializable:
-        return "SET TRANSACTION ISOLATION LEVEL SERIALIZABLE READ WRITE";
+        statement = "SET TRANSACTION ISOLATION LEVEL SERIALIZABLE READ WRITE";
+        break;
 
       default:
         throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
     }
+
+    if (!synchronousCommit_)
+    {
+      statement += "; SET LOCAL synchronous_commit = off";
+    }
+
+    AppendSessionSettings(statement, SessionProfile_ReadWrite, true);
+    AppendLocalHousekeepingSettings(statement);
+
+    return statement;
   }
 
   const std::string PostgreSQLParameters::GetReadOnlyTransactionStatement() const
   {
+    std::string statement;
+
     switch (isolationMode_)
     {
       case IsolationMode_ReadCommited:
-        return "SET TRANSACTION ISOLATION LEVEL READ COMMITTED READ ONLY";
+        statement = "SET TRANSACTION ISOLATION LEVEL READ COMMITTED READ ONLY";
+        break;
 
       case IsolationMode_Serializable:
-        return "SET TRANSACTION ISOLATION LEVEL SERIALIZABLE READ ONLY";
+        statement = "SET TRANSACTION ISOLATION LEVEL SERIALIZABLE READ ONLY";
+        break;
 
       default:
         throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
     }
+
+    AppendSessionSettings(statement, SessionProfile_ReadOnly, true);
+    AppendLocalHousekeepingSettings(statement);
+
+    return statement;
+  }
+
+  void PostgreSQLParameters::AppendSessionSettings(std::string& target,
+                                                   SessionProfile profile,
+                                                   bool local) const
+  {
+    const std::map<std::string, std::string>& settings = sessionSettings_[profile];
+
+    for (std::map<std::string, std::string>::const_iterator it = settings.begin(); it != settings.end(); ++it)
+    {
+      if (!target.empty())
+      {
+        target += "; ";
+      }
+
+      // The value is a string literal, which is accepted for all the types of parameters
+      std::string value;
+      for (size_t i = 0; i < it->second.size(); i++)
+      {
+        if (it->second[i] == '\'')
+        {
+          value += "''";
+        }
+        else
+        {
+          value.push_back(it->second[i]);
+        }
+      }
+
+      target += std::string(local ? "SET LOCAL " : "SET ") + it->first + " = '" + value + "'";
+    }
+  }
+
+  void PostgreSQLParameters::SetSessionSetting(SessionProfile profile,
+                                               const std::string& name,
+                                               const std::string& value)
+  {
+    if (static_cast<int>(profile) < 0 ||
+        static_cast<int>(profile) >= 3)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    bool valid = !name.empty();
+
+    for (size_t i = 0; i < name.size(); i++)
+    {
+      // The name is not quoted, as it can be qualified (e.g. "pg_trgm.similarity_threshold")
+      if (!isalnum(static_cast<unsigned char>(name[i])) &&
+          name[i] != '_' &&
+          name[i] != '.')
+      {
+        valid = false;
+      }
+    }
+
+    if (!valid)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "Bad name for a PostgreSQL session setting: " + name);
+    }
+
+    sessionSettings_[profile][name] = value;
+  }
+
+  bool PostgreSQLParameters::HasSessionSettings(SessionProfile profile) const
+  {
+    if (static_cast<int>(profile) < 0 ||
+        static_cast<int>(profile) >= 3)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    return !sessionSettings_[profile].empty();
+  }
+
+  void PostgreSQLParameters::LoadSessionSettings(const OrthancPlugins::OrthancConfiguration& configuration)
+  {
+    OrthancPlugins::OrthancConfiguration profiles;
+    configuration.GetSection(profiles, "SessionSettings");
+
+    static const char* const NAMES[] = { "ReadOnly", "ReadWrite", "Housekeeping" };
+
+    for (size_t i = 0; i < 3; i++)
+    {
+      OrthancPlugins::OrthancConfiguration section;
+      profiles.GetSection(section, NAMES[i]);
+
+      const Json::Value& settings = section.GetJson();
+      const Json::Value::Members names = settings.getMemberNames();
+
+      for (size_t j = 0; j < names.size(); j++)
+      {
+        const Json::Value& value = settings[names[j]];
+
+        if (value.type() == Json::stringValue)
+        {
+          SetSessionSetting(static_cast<SessionProfile>(i), names[j], value.asString());
+        }
+        else if (value.isIntegral())
+        {
+          SetSessionSetting(static_cast<SessionProfile>(i), names[j], boost::lexical_cast<std::string>(value.asInt64()));
+        }
+        else if (value.type() == Json::booleanValue)
+        {
+          SetSessionSetting(static_cast<SessionProfile>(i), names[j], value.asBool() ? "on" : "off");
+        }
+        else
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_BadParameterType,
+                                          "The PostgreSQL session setting \"" + names[j] + "\" of the profile \"" +
+                                          NAMES[i] + "\" must be a string, an integer or a Boolean");
+        }
+      }
+
+      if (!settings.empty())
+      {
+        std::string s;
+        AppendSessionSettings(s, static_cast<SessionProfile>(i), false);
+        LOG(WARNING) << "PostgreSQL: session settings of the " << NAMES[i] << " profile: " << s;
+      }
+    }
+  }
+
+  void PostgreSQLParameters::AppendLocalHousekeepingSettings(std::string& target) const
+  {
+    // A pooler in transaction mode can hand the transactions of a
+    // connection to different server sessions, and a session-level
+    // "SET" would leak to the other clients of the pooler
+    if (housekeeping_ &&
+        transactionPooling_)
+    {
+      AppendSessionSettings(target, SessionProfile_Housekeeping, true);
+    }
+  }
+
+  std::string PostgreSQLParameters::GetOpeningStatements() const
+  {
+    std::string statements;
+
+    if (housekeeping_ &&
+        !transactionPooling_)
+    {
+      AppendSessionSettings(statements, SessionProfile_Housekeeping, false);
+    }
+
+    return statements;
   }
 
   void PostgreSQLParameters::Format(std::string& target) const
@@ -239,9 +605,54 @@ namespace OrthancDatabases
       // network will make sure I always connect to the server I want."
       // https://www.postgresql.org/docs/current/libpq-ssl.html
       target = std::string(ssl_ ? "sslmode=require" : "sslmode=disable") +
-        " user=" + username_ + 
-        " host=" + host_ + 
-        " port=" + boost::lexical_cast<std::string>(port_);
+        " user=" + username_;
+
+      if (hosts_.empty())
+      {
+        target += " host=" + host_ + " port=" + boost::lexical_cast<std::string>(port_);
+      }
+      else
+      {
+        std::string hosts, ports;
+
+        for (size_t i = 0; i < hosts_.size(); i++)
+        {
+          if (i > 0)
+          {
+            hosts += ",";
+            ports += ",";
+          }
+
+          // libpq expects the IPv6 addresses without brackets in this syntax
+          if (hosts_[i].size() >= 2 &&
+              hosts_[i][0] == '[' &&
+              hosts_[i][hosts_[i].size() - 1] == ']')
+          {
+            hosts += hosts_[i].substr(1, hosts_[i].size() - 2);
+          }
+          else
+          {
+            hosts += hosts_[i];
+          }
+
+          ports += boost::lexical_cast<std::string>(GetHostPort(i));
+        }
+
+        target += " host=" + hosts + " port=" + ports;
+      }
+
+      std::string options;
+      FormatHostsOptions(options, " ");
+
+      if (!options.empty())
+      {
+        target += " " + options;
+      }
+
+      if (!compression_.empty())
+      {
+        target += " compression=" + compression_;
+      }
 
       if (!password_.empty())
       {
@@ -29,6 +29,10 @@
 
 #include "../../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
 
+#include <list>
+#include <map>
+#include <vector>
+
 namespace OrthancDatabases
 {
   enum IsolationMode
@@ -37,28 +41,63 @@ namespace OrthancDatabases
     IsolationMode_ReadCommited = 1
   };
 
+  enum SessionProfile
+  {
+    SessionProfile_ReadOnly = 0,      // Read-only transactions, e.g. the lookups of "ExecuteFind()"
+    SessionProfile_ReadWrite = 1,     // Read-write transactions, e.g. the ingest of the instances
+    SessionProfile_Housekeeping = 2   // Connection that is dedicated to the housekeeping tasks
+  };
+
   class PostgreSQLParameters
   {
   private:
     std::string  host_;
     uint16_t     port_;
+    std::vector<std::string>  hosts_;        // Overrides "host_" if not empty
+    std::vector<uint16_t>     hostsPorts_;   // "0" means "port_"
+    std::string  targetSessionAttributes_;
+    bool         loadBalanceHosts_;
     std::string  username_;
     std::string  password_;
     std::string  database_;
     std::string  uri_;
     bool         ssl_;
     bool         lock_;
+    bool         multiWriter_;
     unsigned int maxConnectionRetries_;
     unsigned int connectionRetryInterval_;
     bool         isVerboseEnabled_;
+    bool         pipelineMode_;
+    bool         transactionPooling_;
+    bool         synchronousCommit_;
+    std::string  compression_;
     IsolationMode isolationMode_;
+    std::map<std::string, std::string>  sessionSettings_[3];  // Indexed by "SessionProfile"
+    bool         housekeeping_;
+
     void Reset();
 
+    void AppendSessionSettings(std::string& target,
+                               SessionProfile profile,
+                               bool local) const;
+
+    void AppendLocalHousekeepingSettings(std::string& target) const;
+
+    uint16_t GetHostPort(size_t index) const;
+
+    void FormatHostsOptions(std::string& target,
+                            const std::string& separator) const;
+
   public:
     PostgreSQLParameters();
 
     explicit PostgreSQLParameters(const OrthancPlugins::OrthancConfiguration& configuration);
 
+    // Only reads the options that identify the server ("ConnectionUri",
+    // "Host", "Hosts", "Port", "Database", "Username", "Password",
+    // "EnableSsl", "TargetSessionAttributes" and "LoadBalanceHosts")
+    void LoadConnectionParameters(const OrthancPlugins::OrthancConfiguration& configuration);
+
     void SetConnectionUri(const std::string& uri);
 
     std::string GetConnectionUri() const;
@@ -70,6 +109,41 @@ namespace OrthancDatabases
       return host_;
     }
 
+    /**
+     * List of servers ("host" or "host:port") that are tried in turn
+     * by libpq, e.g. the members of a Patroni cluster. The server
+     * that is eventually used depends on the target session
+     * attributes below.
+     **/
+    void SetHosts(const std::list<std::string>& hosts);
+
+    size_t GetHostsCount() const
+    {
+      return hosts_.empty() ? 1 : hosts_.size();
+    }
+
+    // "any", "read-write", "read-only", "primary", "standby" or
+    // "prefer-standby" (the last 4 values need libpq >= 14). An empty
+    // string means the default of libpq.
+    void SetTargetSessionAttributes(const std::string& attributes);
+
+    const std::string& GetTargetSessionAttributes() const
+    {
+      return targetSessionAttributes_;
+    }
+
+    // Spread the connections randomly over the hosts, instead of
+    // trying them in order (needs libpq >= 16)
+    void SetLoadBalanceHosts(bool enabled)
+    {
+      loadBalanceHosts_ = enabled;
+    }
+
+    bool IsLoadBalanceHosts() const
+    {
+      return loadBalanceHosts_;
+    }
+
     void SetPortNumber(unsigned int port);
 
     uint16_t GetPortNumber() const
@@ -123,6 +197,22 @@ namespace OrthancDatabases
       return lock_;
     }
 
+    /**
+     * In the multi-writer mode, several Orthanc servers share the same
+     * index: The global advisory lock is not taken, and the ingestion
+     * of the instances of one patient is serialized by a per-patient
+     * advisory lock.
+     **/
+    void SetMultiWriter(bool multiWriter)
+    {
+      multiWriter_ = multiWriter;
+    }
+
+    bool IsMultiWriter() const
+    {
+      return multiWriter_;
+    }
+
     unsigned int GetMaxConnectionRetries() const
     {
       return maxConnectionRetries_;
@@ -152,6 +242,106 @@ namespace OrthancDatabases
       return isVerboseEnabled_;
     }
 
+    // Queue the statements whose result is not needed in the libpq
+    // pipeline mode (only available if libpq >= 14)
+    void SetPipelineMode(bool enabled)
+    {
+      pipelineMode_ = enabled;
+    }
+
+    bool IsPipelineMode() const
+    {
+      return pipelineMode_;
+    }
+
+    /**
+     * Whether the server is reached through a pooler in transaction
+     * mode (e.g. PgBouncer with "pool_mode = transaction"), where two
+     * successive transactions of the same connection can run in
+     * different server sessions. The statements are then executed as
+     * unnamed statements ("PQexecParams()"), as a named prepared
+     * statement would only exist in the session that prepared it. The
+     * SQL text and the types of the parameters are still reused by the
+     * cached statements on the client side.
+     **/
+    void SetTransactionPooling(bool enabled)
+    {
+      transactionPooling_ = enabled;
+    }
+
+    bool IsTransactionPooling() const
+    {
+      return transactionPooling_;
+    }
+
+    /**
+     * Value of the "compression" connection option of libpq, whose
+     * availability depends on the version of libpq and of the server
+     * (cf. "PostgreSQLDatabase::IsProtocolCompressionSupported()").
+     * An empty string disables the compression.
+     **/
+    void SetProtocolCompression(const std::string& compression)
+    {
+      compression_ = compression;
+    }
+
+    const std::string& GetProtocolCompression() const
+    {
+      return compression_;
+    }
+
+    /**
+     * If "false", the read-write transactions don't wait for their
+     * WAL records to be flushed to disk before "COMMIT" returns
+     * ("SET LOCAL synchronous_commit = off"). The database stays
+     * consistent, but the last transactions that were committed
+     * before a crash of the PostgreSQL server can be lost.
+     **/
+    void SetSynchronousCommit(bool synchronous)
+    {
+      synchronousCommit_ = synchronous;
+    }
+
+    bool IsSynchronousCommit() const
+    {
+      return synchronousCommit_;
+    }
+
+    /**
+     * Sets a run-time parameter of the PostgreSQL server (e.g.
+     * "work_mem" or "jit") for one class of connections, without
+     * changing the configuration of the server. The connections of
+     * the pool are shared by the read-only and by the read-write
+     * transactions, so their settings are applied by "SET LOCAL" at
+     * the beginning of each transaction, in the same round-trip as
+     * "BEGIN". The settings of the housekeeping are applied once,
+     * when its dedicated connection is opened.
+     **/
+    void SetSessionSetting(SessionProfile profile,
+                           const std::string& name,
+                           const std::string& value);
+
+    bool HasSessionSettings(SessionProfile profile) const;
+
+    // Reads the "SessionSettings" section, e.g. "{ "ReadOnly" : { "work_mem" : "64MB" } }"
+    void LoadSessionSettings(const OrthancPlugins::OrthancConfiguration& configuration);
+
+    // Statements "SET ..." that are run when the connection is opened, empty if none.
+    // With transaction pooling, the housekeeping settings are applied by "SET LOCAL"
+    // at the beginning of each transaction instead.
+    std::string GetOpeningStatements() const;
+
+    // Whether the connections are dedicated to the housekeeping tasks
+    void SetHousekeeping(bool housekeeping)
+    {
+      housekeeping_ = housekeeping;
+    }
+
+    bool IsHousekeeping() const
+    {
+      return housekeeping_;
+    }
+
 
     void Format(std::string& target) const;
   };
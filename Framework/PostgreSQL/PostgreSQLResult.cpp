@@ -41,7 +41,7 @@
 
 namespace OrthancDatabases
 {
-  void PostgreSQLResult::Clear()
+  void PostgreSQLResult::ReleaseCurrent()
   {
     if (result_ != NULL)
     {
@@ -51,12 +51,87 @@ namespace OrthancDatabases
   }
 
 
+  void PostgreSQLResult::DrainStream()
+  {
+    if (streaming_)
+    {
+      // The connection cannot be used until all the rows are received
+      PGresult* result;
+      while ((result = PQgetResult(reinterpret_cast<PGconn*>(database_.pg_))) != NULL)
+      {
+        PQclear(result);
+      }
+
+      streaming_ = false;
+    }
+  }
+
+
+  void PostgreSQLResult::FetchNextChunk()
+  {
+    assert(streaming_);
+
+    ReleaseCurrent();
+    position_ = 0;
+
+    PGresult* result = PQgetResult(reinterpret_cast<PGconn*>(database_.pg_));
+    if (result == NULL)
+    {
+      // End of the stream
+      streaming_ = false;
+      return;
+    }
+
+    switch (PQresultStatus(result))
+    {
+      case PGRES_SINGLE_TUPLE:
+#if PG_VERSION_NUM >= 170000
+      case PGRES_TUPLES_CHUNK:
+#endif
+      case PGRES_TUPLES_OK:  // Last (possibly empty) chunk, or the whole result set
+        result_ = result;
+        columnsCount_ = static_cast<unsigned int>(PQnfields(result));
+        break;
+
+      case PGRES_COMMAND_OK:
+        // This is not a SELECT request, we're done
+        PQclear(result);
+        DrainStream();
+        break;
+
+      default:
+      {
+        std::string message = PQresultErrorMessage(result);
+        PQclear(result);
+        DrainStream();
+        database_.ThrowStatementError(message);
+      }
+    }
+  }
+
+
+  void PostgreSQLResult::Clear()
+  {
+    ReleaseCurrent();
+    DrainStream();
+  }
+
+
   void PostgreSQLResult::CheckDone()
   {
-    if (position_ >= PQntuples(reinterpret_cast<PGresult*>(result_)))
+    while (result_ != NULL &&
+           position_ >= PQntuples(reinterpret_cast<PGresult*>(result_)))
     {
-      // We are at the end of the result set
-      Clear();
+      if (streaming_)
+      {
+        // Wait for the next rows
+        FetchNextChunk();
+      }
+      else
+      {
+        // We are at the end of the result set
+        Clear();
+      }
     }
   }
 
@@ -82,13 +157,26 @@ namespace OrthancDatabases
 
 
   PostgreSQLResult::PostgreSQLResult(PostgreSQLStatement& statement) : 
+    result_(NULL),
     position_(0), 
-    database_(statement.GetDatabase())
+    database_(statement.GetDatabase()),
+    columnsCount_(0),
+    streaming_(false)
   {
     if (database_.IsVerboseEnabled())
     {
       LOG(INFO) << "PostgreSQL: " << statement.sql_;
     }
+
+    if (statement.IsStreaming())
+    {
+      statement.Send();
+      streaming_ = true;
+
+      FetchNextChunk();
+      CheckDone();
+      return;
+    }
     
     result_ = statement.Execute();
     assert(result_ != NULL);   // An exception would have been thrown otherwise
@@ -108,6 +196,19 @@ namespace OrthancDatabases
   }
 
 
+  PostgreSQLResult::PostgreSQLResult(PostgreSQLDatabase& database) :
+    result_(NULL),
+    position_(0),
+    database_(database),
+    columnsCount_(0),
+    streaming_(true)
+  {
+    // The whole result set is read by the first call to "PQgetResult()"
+    FetchNextChunk();
+    CheckDone();
+  }
+
+
   PostgreSQLResult::~PostgreSQLResult()
   {
     try
@@ -177,6 +278,30 @@ namespace OrthancDatabases
   }
 
 
+  void PostgreSQLResult::GetStringView(const char*& value,
+                                       size_t& size,
+                                       unsigned int column) const
+  {
+    CheckColumn(column, 0);
+
+    Oid oid = PQftype(reinterpret_cast<PGresult*>(result_), column);
+    if (oid != TEXTOID && oid != VARCHAROID && oid != BYTEAOID)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadParameterType);
+    }
+
+    value = PQgetvalue(reinterpret_cast<PGresult*>(result_), position_, column);
+    size = static_cast<size_t>(PQgetlength(reinterpret_cast<PGresult*>(result_), position_, column));
+  }
+
+
+  unsigned int /*Oid*/ PostgreSQLResult::GetColumnType(unsigned int column) const
+  {
+    CheckColumn(column, 0);
+    return PQftype(reinterpret_cast<PGresult*>(result_), column);
+  }
+
+
   std::string PostgreSQLResult::GetLargeObjectOid(unsigned int column) const
   {
     CheckColumn(column, OIDOID);
@@ -227,6 +352,26 @@ namespace OrthancDatabases
     {
       PostgreSQLLargeObject::ReadRange(target, database_, oid_, start, length);
     }
+
+    virtual void ReadWhole(IBufferAllocator& allocator) const ORTHANC_OVERRIDE
+    {
+      PostgreSQLLargeObject::ReadWhole(allocator, database_, oid_);
+    }
+
+    virtual void ReadRange(void* target,
+                           uint64_t start,
+                           size_t length) const ORTHANC_OVERRIDE
+    {
+      PostgreSQLLargeObject::ReadRange(target, database_, oid_, start, length);
+    }
+
+    virtual void ReadRange(IChunkVisitor& visitor,
+                           uint64_t start,
+                           size_t length,
+                           size_t chunkSize) const ORTHANC_OVERRIDE
+    {
+      PostgreSQLLargeObject::ReadRange(visitor, database_, oid_, start, length, chunkSize);
+    }
   };
 
 
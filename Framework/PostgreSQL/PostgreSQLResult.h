@@ -34,12 +34,21 @@ namespace OrthancDatabases
   class PostgreSQLResult : public boost::noncopyable
   {
   private:
+    friend class PostgreSQLAsyncQueries;
+
     class LargeObjectResult;
     
     void                *result_;  /* Object of type "PGresult*" */
     int                  position_;
     PostgreSQLDatabase&  database_;
     unsigned int         columnsCount_;
+    bool                 streaming_;  // Whether "PQgetResult()" must still be called
+
+    void ReleaseCurrent();
+
+    void DrainStream();
+
+    void FetchNextChunk();
 
     void Clear();
 
@@ -47,6 +56,9 @@ namespace OrthancDatabases
 
     void CheckColumn(unsigned int column, /*Oid*/ unsigned int expectedType) const;
 
+    // Result of a statement that was sent by "SendQuery()", and that has been received
+    explicit PostgreSQLResult(PostgreSQLDatabase& database);
+
   public:
     explicit PostgreSQLResult(PostgreSQLStatement& statement);
 
@@ -74,6 +86,14 @@ namespace OrthancDatabases
 
     std::string GetString(unsigned int column) const;
 
+    // Gives access to the string without copying it: The pointer is
+    // invalidated by the next call to "Next()"
+    void GetStringView(const char*& value,
+                       size_t& size,
+                       unsigned int column) const;
+
+    unsigned int /*Oid*/ GetColumnType(unsigned int column) const;
+
     std::string GetLargeObjectOid(unsigned int column) const;
 
     void GetLargeObjectContent(std::string& content,
@@ -0,0 +1,242 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#include "PostgreSQLSlowStatementsExplainer.h"
+
+#include "../Common/Utf8StringValue.h"
+#include "PostgreSQLDatabase.h"
+#include "PostgreSQLStatement.h"
+#include "PostgreSQLTransaction.h"
+
+#include <Compatibility.h>  // For std::unique_ptr<>
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <cassert>
+
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/algorithm/string/trim.hpp>
+
+
+namespace OrthancDatabases
+{
+  static const size_t MAX_PENDING_STATEMENTS = 16;
+  static const size_t MAX_REMEMBERED_STATEMENTS = 1024;
+  static const time_t EXPLANATION_INTERVAL = 60;  // In seconds
+
+
+  class PostgreSQLSlowStatementsExplainer::PendingStatement : public boost::noncopyable
+  {
+  private:
+    std::string  sql_;
+    Dictionary   parameters_;
+    uint64_t     executeTime_;
+
+  public:
+    PendingStatement(const std::string& sql,
+                     const Dictionary& parameters,
+                     uint64_t executeTime) :
+      sql_(sql),
+      executeTime_(executeTime)
+    {
+      parameters.Copy(parameters_);
+    }
+
+    const std::string& GetSql() const
+    {
+      return sql_;
+    }
+
+    const Dictionary& GetParameters() const
+    {
+      return parameters_;
+    }
+
+    uint64_t GetExecuteTime() const
+    {
+      return executeTime_;
+    }
+  };
+
+
+  bool PostgreSQLSlowStatementsExplainer::IsExplainable(const std::string& sql)
+  {
+    const std::string s = boost::algorithm::trim_left_copy(sql);
+    return (boost::algorithm::istarts_with(s, "SELECT") ||
+            boost::algorithm::istarts_with(s, "WITH"));
+  }
+
+
+  void PostgreSQLSlowStatementsExplainer::Explain(PostgreSQLDatabase& database,
+                                                  const PendingStatement& statement)
+  {
+    Query query("EXPLAIN (ANALYZE, BUFFERS) " + statement.GetSql(), true);
+
+    std::list<std::string> keys;
+    statement.GetParameters().ListKeys(keys);
+
+    for (std::list<std::string>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+    {
+      const ValueType type = statement.GetParameters().GetValue(*it).GetType();
+      if (type != ValueType_Null &&
+          query.HasParameter(*it))
+      {
+        query.SetType(*it, type);
+      }
+    }
+
+    std::string plan;
+
+    {
+      PostgreSQLTransaction transaction(database, TransactionType_ReadOnly);
+      PostgreSQLStatement explain(database, query);
+
+      std::unique_ptr<IResult> result(transaction.Execute(explain, statement.GetParameters()));
+      result->SetExpectedType(0, ValueType_Utf8String);
+
+      while (!result->IsDone())
+      {
+        plan += "\n  " + dynamic_cast<const Utf8StringValue&>(result->GetField(0)).GetContent();
+        result->Next();
+      }
+
+      result.reset();
+      transaction.Rollback();
+    }
+
+    LOG(WARNING) << "Execution plan of a slow SQL statement (" << (statement.GetExecuteTime() / 1000)
+                 << "ms): " << statement.GetSql() << plan;
+  }
+
+
+  void PostgreSQLSlowStatementsExplainer::Worker(PostgreSQLSlowStatementsExplainer* that)
+  {
+    std::unique_ptr<PostgreSQLDatabase> database;
+
+    for (;;)
+    {
+      std::unique_ptr<PendingStatement> statement;
+
+      {
+        boost::mutex::scoped_lock lock(that->mutex_);
+
+        while (!that->done_ &&
+               that->queue_.empty())
+        {
+          that->condition_.wait(lock);
+        }
+
+        if (that->done_)
+        {
+          return;
+        }
+
+        statement.reset(that->queue_.front());
+        that->queue_.pop_front();
+      }
+
+      try
+      {
+        if (database.get() == NULL)
+        {
+          // The connection is only opened once some statement is slow
+          database.reset(new PostgreSQLDatabase(that->parameters_));
+          database->Open();
+        }
+
+        Explain(*database, *statement);
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        LOG(WARNING) << "Cannot explain a slow SQL statement: " << e.What();
+        database.reset();  // Reconnect at the next statement
+      }
+    }
+  }
+
+
+  PostgreSQLSlowStatementsExplainer::PostgreSQLSlowStatementsExplainer(const PostgreSQLParameters& parameters) :
+    parameters_(parameters),
+    done_(false)
+  {
+    thread_ = boost::thread(Worker, this);
+  }
+
+
+  PostgreSQLSlowStatementsExplainer::~PostgreSQLSlowStatementsExplainer()
+  {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      done_ = true;
+      condition_.notify_all();
+    }
+
+    if (thread_.joinable())
+    {
+      thread_.join();
+    }
+
+    for (std::list<PendingStatement*>::iterator it = queue_.begin(); it != queue_.end(); ++it)
+    {
+      assert(*it != NULL);
+      delete *it;
+    }
+  }
+
+
+  void PostgreSQLSlowStatementsExplainer::SignalSlowStatement(const std::string& sql,
+                                                              const Dictionary& parameters,
+                                                              uint64_t executeTime)
+  {
+    if (!IsExplainable(sql))
+    {
+      return;
+    }
+
+    const time_t now = time(NULL);
+
+    boost::mutex::scoped_lock lock(mutex_);
+
+    if (queue_.size() >= MAX_PENDING_STATEMENTS)
+    {
+      return;  // The explanations are lagging behind, drop this one
+    }
+
+    std::map<std::string, time_t>::iterator found = lastExplanations_.find(sql);
+    if (found != lastExplanations_.end() &&
+        now < found->second + EXPLANATION_INTERVAL)
+    {
+      return;
+    }
+
+    if (lastExplanations_.size() >= MAX_REMEMBERED_STATEMENTS)
+    {
+      lastExplanations_.clear();
+    }
+
+    lastExplanations_[sql] = now;
+    queue_.push_back(new PendingStatement(sql, parameters, executeTime));
+    condition_.notify_one();
+  }
+}
@@ -0,0 +1,79 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+
+#pragma once
+
+#if ORTHANC_ENABLE_POSTGRESQL != 1
+#  error PostgreSQL support must be enabled to use this file
+#endif
+
+#include "../Common/DatabaseManager.h"
+#include "PostgreSQLParameters.h"
+
+#include <boost/thread.hpp>
+#include <list>
+#include <map>
+
+namespace OrthancDatabases
+{
+  /**
+   * Logs the execution plan of the slow statements, as given by
+   * "EXPLAIN (ANALYZE, BUFFERS)". The statements are explained by a
+   * background thread on a separate connection, inside a read-only
+   * transaction that is rolled back, so that the connection that
+   * executed the slow statement is never blocked. As "ANALYZE"
+   * actually executes the statement, only the "SELECT" and "WITH"
+   * statements are explained, and each distinct statement is
+   * explained at most once per minute.
+   **/
+  class PostgreSQLSlowStatementsExplainer : public DatabaseManager::ISlowStatementListener
+  {
+  private:
+    class PendingStatement;
+
+    PostgreSQLParameters              parameters_;
+    boost::mutex                      mutex_;
+    boost::condition_variable         condition_;
+    std::list<PendingStatement*>      queue_;
+    std::map<std::string, time_t>     lastExplanations_;
+    bool                              done_;
+    boost::thread                     thread_;
+
+    static bool IsExplainable(const std::string& sql);
+
+    static void Explain(PostgreSQLDatabase& database,
+                        const PendingStatement& statement);
+
+    static void Worker(PostgreSQLSlowStatementsExplainer* that);
+
+  public:
+    explicit PostgreSQLSlowStatementsExplainer(const PostgreSQLParameters& parameters);
+
+    virtual ~PostgreSQLSlowStatementsExplainer();
+
+    virtual void SignalSlowStatement(const std::string& sql,
+                                     const Dictionary& parameters,
+                                     uint64_t executeTime) ORTHANC_OVERRIDE;
+  };
+}
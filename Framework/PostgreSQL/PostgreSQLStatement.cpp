@@ -39,11 +39,21 @@
 #include <Toolbox.h>
 #include <Endianness.h>
 
+#include <boost/date_time/posix_time/posix_time.hpp>
 #include <cassert>
 
 
 namespace OrthancDatabases
 {
+  // Number of executions whose latency gives the baseline of the "adaptive" plan cache mode
+  static const unsigned int ADAPTIVE_PLAN_BASELINE_EXECUTIONS = 5;
+
+  // The "adaptive" mode switches to custom plans if the moving average of the
+  // latency is both above this ratio of the baseline, and above 10ms
+  static const uint64_t ADAPTIVE_PLAN_MAX_RATIO = 10;
+  static const uint64_t ADAPTIVE_PLAN_MIN_LATENCY = 10000;
+
+
   class PostgreSQLStatement::Inputs : public boost::noncopyable
   {
   private:
@@ -168,6 +178,16 @@ namespace OrthancDatabases
       }
     }
 
+    if (customPlans_)
+    {
+      // The unnamed statements are prepared by each execution (this
+      // is always the case behind a pooler in transaction mode)
+      return;
+    }
+
+    // "PQprepare()" is synchronous
+    database_.FlushPipeline();
+
     id_ = Orthanc::Toolbox::GenerateUuid();
 
     const unsigned int* tmp = oids_.size() ? &oids_[0] : NULL;
@@ -260,10 +280,22 @@ namespace OrthancDatabases
   void* /* PGresult* */ PostgreSQLStatement::Execute()
   {
     Prepare();
+    database_.FlushPipeline();
 
     PGresult* result;
 
-    if (oids_.size() == 0)
+    if (customPlans_)
+    {
+      result = PQexecParams(reinterpret_cast<PGconn*>(database_.pg_),
+                            sql_.c_str(),
+                            oids_.size(),
+                            oids_.empty() ? NULL : &oids_[0],
+                            oids_.empty() ? NULL : &inputs_->GetValues()[0],
+                            oids_.empty() ? NULL : &inputs_->GetSizes()[0],
+                            oids_.empty() ? NULL : &binary_[0],
+                            1);
+    }
+    else if (oids_.size() == 0)
     {
       // No parameter
       result = PQexecPrepared(reinterpret_cast<PGconn*>(database_.pg_),
@@ -304,12 +336,117 @@ namespace OrthancDatabases
   }
 
 
+  void PostgreSQLStatement::Queue()
+  {
+    Prepare();
+
+    database_.EnterPipelineMode();
+
+    int success;
+
+    if (customPlans_)
+    {
+      success = PQsendQueryParams(reinterpret_cast<PGconn*>(database_.pg_),
+                                  sql_.c_str(),
+                                  oids_.size(),
+                                  oids_.empty() ? NULL : &oids_[0],
+                                  oids_.empty() ? NULL : &inputs_->GetValues()[0],
+                                  oids_.empty() ? NULL : &inputs_->GetSizes()[0],
+                                  oids_.empty() ? NULL : &binary_[0],
+                                  1);
+    }
+    else
+    {
+      success = PQsendQueryPrepared(reinterpret_cast<PGconn*>(database_.pg_),
+                                    id_.c_str(),
+                                    oids_.size(),
+                                    oids_.empty() ? NULL : &inputs_->GetValues()[0],
+                                    oids_.empty() ? NULL : &inputs_->GetSizes()[0],
+                                    oids_.empty() ? NULL : &binary_[0],
+                                    1);
+    }
+
+    if (success != 1)
+    {
+      database_.ThrowException(true);
+    }
+
+    database_.pipelineCount_++;
+  }
+
+
+  void PostgreSQLStatement::SendQuery()
+  {
+    Prepare();
+    database_.FlushPipeline();
+
+    PGconn* pg = reinterpret_cast<PGconn*>(database_.pg_);
+
+    int success;
+
+    if (customPlans_)
+    {
+      success = PQsendQueryParams(pg,
+                                  sql_.c_str(),
+                                  oids_.size(),
+                                  oids_.empty() ? NULL : &oids_[0],
+                                  oids_.empty() ? NULL : &inputs_->GetValues()[0],
+                                  oids_.empty() ? NULL : &inputs_->GetSizes()[0],
+                                  oids_.empty() ? NULL : &binary_[0],
+                                  1);
+    }
+    else
+    {
+      success = PQsendQueryPrepared(pg,
+                                    id_.c_str(),
+                                    oids_.size(),
+                                    oids_.empty() ? NULL : &inputs_->GetValues()[0],
+                                    oids_.empty() ? NULL : &inputs_->GetSizes()[0],
+                                    oids_.empty() ? NULL : &binary_[0],
+                                    1);
+    }
+
+    if (success != 1)
+    {
+      database_.ThrowException(true);
+    }
+  }
+
+
+  void PostgreSQLStatement::Send()
+  {
+    SendQuery();
+
+    PGconn* pg = reinterpret_cast<PGconn*>(database_.pg_);
+
+    /**
+     * If the mode cannot be changed, the whole result set is received
+     * at once by "PQgetResult()", which is handled by PostgreSQLResult.
+     **/
+#if PG_VERSION_NUM >= 170000
+    // "Chunked rows" mode avoids the overhead of one "PGresult" per row
+    if (PQsetChunkedRowsMode(pg, 1000) != 1)
+#else
+    if (PQsetSingleRowMode(pg) != 1)
+#endif
+    {
+      LOG(WARNING) << "PostgreSQL: Cannot fetch the result incrementally";
+    }
+  }
+
+
   PostgreSQLStatement::PostgreSQLStatement(PostgreSQLDatabase& database,
                                            const std::string& sql) :
     database_(database),
     sql_(sql),
     inputs_(new Inputs),
-    formatter_(Dialect_PostgreSQL)
+    formatter_(Dialect_PostgreSQL),
+    streaming_(false),
+    planCacheMode_(PlanCacheMode_Auto),
+    customPlans_(database.IsTransactionPooling()),
+    executionsCount_(0),
+    baselineLatency_(0),
+    averageLatency_(0)
   {
     if (database.IsVerboseEnabled())
     {
@@ -322,9 +459,16 @@ namespace OrthancDatabases
                                            const Query& query) :
     database_(database),
     inputs_(new Inputs),
-    formatter_(Dialect_PostgreSQL)
+    formatter_(Dialect_PostgreSQL),
+    streaming_(query.IsStreaming()),
+    planCacheMode_(PlanCacheMode_Auto),
+    customPlans_(database.IsTransactionPooling()),
+    executionsCount_(0),
+    baselineLatency_(0),
+    averageLatency_(0)
   {
     query.Format(sql_, formatter_);
+    SetPlanCacheMode(query.GetPlanCacheMode());
     
     if (database.IsVerboseEnabled())
     {
@@ -376,6 +520,48 @@ namespace OrthancDatabases
   }
 
 
+  void PostgreSQLStatement::SetPlanCacheMode(PlanCacheMode mode)
+  {
+    planCacheMode_ = mode;
+    customPlans_ = (mode == PlanCacheMode_ForceCustom ||
+                    database_.IsTransactionPooling());
+    executionsCount_ = 0;
+    baselineLatency_ = 0;
+    averageLatency_ = 0;
+  }
+
+
+  void PostgreSQLStatement::RecordLatency(uint64_t microseconds)
+  {
+    executionsCount_++;
+
+    if (executionsCount_ <= ADAPTIVE_PLAN_BASELINE_EXECUTIONS)
+    {
+      baselineLatency_ += microseconds;
+
+      if (executionsCount_ == ADAPTIVE_PLAN_BASELINE_EXECUTIONS)
+      {
+        baselineLatency_ /= ADAPTIVE_PLAN_BASELINE_EXECUTIONS;
+        averageLatency_ = baselineLatency_;
+      }
+    }
+    else
+    {
+      averageLatency_ = (7 * averageLatency_ + microseconds) / 8;
+
+      if (averageLatency_ > ADAPTIVE_PLAN_MIN_LATENCY &&
+          averageLatency_ > ADAPTIVE_PLAN_MAX_RATIO * baselineLatency_)
+      {
+        // The prepared statement is only deallocated by the destructor, as a result might still be streamed
+        LOG(WARNING) << "PostgreSQL: The latency of a precompiled statement has increased from "
+                     << baselineLatency_ / 1000 << "ms to " << averageLatency_ / 1000
+                     << "ms, switching to custom plans: " << sql_.substr(0, 256);
+        customPlans_ = true;
+      }
+    }
+  }
+
+
   void PostgreSQLStatement::Run()
   {
     PGresult* result = reinterpret_cast<PGresult*>(Execute());
@@ -459,7 +645,23 @@ namespace OrthancDatabases
       throw Orthanc::OrthancException(Orthanc::ErrorCode_BadParameterType);
     }
 
-    if (value.size() == 0)
+    if (oids_[param] == BYTEAOID)
+    {
+      // The binary strings are sent in the binary format, so that they
+      // can contain null bytes, except the empty string, as a
+      // zero-length parameter would be interpreted as NULL
+      if (value.empty())
+      {
+        binary_[param] = 0;
+        inputs_->SetItem(param, "", 1 /* end-of-string character */);
+      }
+      else
+      {
+        binary_[param] = 1;
+        inputs_->SetItem(param, value.c_str(), value.size());
+      }
+    }
+    else if (value.size() == 0)
     {
       inputs_->SetItem(param, "", 1 /* end-of-string character */);
     }
@@ -497,7 +699,44 @@ namespace OrthancDatabases
   protected:
     virtual IValue* FetchField(size_t index)
     {
-      return result_->GetValue(index);
+      // Reuse the values of the previous row for the most common
+      // types, as large results can contain millions of cells
+      if (result_->IsNull(index))
+      {
+        return RecycleNull(index);
+      }
+
+      switch (result_->GetColumnType(index))
+      {
+        case BOOLOID:
+          return RecycleInteger64(index, result_->GetBoolean(index) ? 1 : 0);
+
+        case INT4OID:
+          return RecycleInteger64(index, result_->GetInteger(index));
+
+        case INT8OID:
+          return RecycleInteger64(index, result_->GetInteger64(index));
+
+        case TEXTOID:
+        case VARCHAROID:
+        {
+          const char* value = NULL;
+          size_t size = 0;
+          result_->GetStringView(value, size, index);
+          return RecycleUtf8String(index, value, size);
+        }
+
+        case BYTEAOID:
+        {
+          const char* value = NULL;
+          size_t size = 0;
+          result_->GetStringView(value, size, index);
+          return RecycleBinaryString(index, value, size);
+        }
+
+        default:
+          return result_->GetValue(index);
+      }
     }
 
   public:
@@ -521,8 +760,7 @@ namespace OrthancDatabases
   };
 
 
-  IResult* PostgreSQLStatement::Execute(ITransaction& transaction,
-                                        const Dictionary& parameters)
+  void PostgreSQLStatement::BindParameters(const Dictionary& parameters)
   {
     for (size_t i = 0; i < formatter_.GetParametersCount(); i++)
     {
@@ -566,14 +804,43 @@ namespace OrthancDatabases
           throw Orthanc::OrthancException(Orthanc::ErrorCode_InternalError);
       }
     }
+  }
+
 
-    return new ResultWrapper(*this);
+  IResult* PostgreSQLStatement::Execute(ITransaction& transaction,
+                                        const Dictionary& parameters)
+  {
+    BindParameters(parameters);
+
+    if (planCacheMode_ == PlanCacheMode_Adaptive &&
+        !customPlans_)
+    {
+      // The construction of the result waits for the first rows, even if streaming
+      const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+      std::unique_ptr<IResult> result(new ResultWrapper(*this));
+      RecordLatency((boost::posix_time::microsec_clock::universal_time() - start).total_microseconds());
+      return result.release();
+    }
+    else
+    {
+      return new ResultWrapper(*this);
+    }
   }
 
 
   void PostgreSQLStatement::ExecuteWithoutResult(ITransaction& transaction,
                                                  const Dictionary& parameters)
   {
-    std::unique_ptr<IResult> dummy(Execute(transaction, parameters));
+    if (database_.IsPipelineEnabled() &&
+        !transaction.IsImplicit())
+    {
+      // The errors are reported by the next synchronous call, at the latest by the commit
+      BindParameters(parameters);
+      Queue();
+    }
+    else
+    {
+      std::unique_ptr<IResult> dummy(Execute(transaction, parameters));
+    }
   }
 }
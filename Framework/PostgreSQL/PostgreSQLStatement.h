@@ -46,6 +46,7 @@ namespace OrthancDatabases
   private:
     class ResultWrapper;
     class Inputs;
+    friend class PostgreSQLAsyncQueries;
     friend class PostgreSQLResult;
 
     PostgreSQLDatabase& database_;
@@ -55,6 +56,12 @@ namespace OrthancDatabases
     std::vector<int>  binary_;
     boost::shared_ptr<Inputs> inputs_;
     GenericFormatter formatter_;
+    bool streaming_;
+    PlanCacheMode planCacheMode_;
+    bool customPlans_;            // Executed as unnamed statements, that are planned at each execution
+    unsigned int executionsCount_;
+    uint64_t baselineLatency_;    // Average latency of the first executions, in microseconds
+    uint64_t averageLatency_;     // Moving average of the latency, in microseconds
 
     void Prepare();
 
@@ -65,6 +72,19 @@ namespace OrthancDatabases
 
     void* /* PGresult* */ Execute();
 
+    // Sends the statement in the pipeline mode, without waiting for its result
+    void Queue();
+
+    // Sends the statement, without waiting for its result
+    void SendQuery();
+
+    // Sends the statement, whose rows will be read by chunks using "PQgetResult()"
+    void Send();
+
+    void BindParameters(const Dictionary& parameters);
+
+    void RecordLatency(uint64_t microseconds);
+
   public:
     PostgreSQLStatement(PostgreSQLDatabase& database,
                         const std::string& sql);
@@ -73,6 +93,11 @@ namespace OrthancDatabases
                         const Query& query);
 
     ~PostgreSQLStatement();
+
+    virtual void Warmup() ORTHANC_OVERRIDE
+    {
+      Prepare();
+    }
     
     void DeclareInputInteger(unsigned int param);
     
@@ -101,6 +126,32 @@ namespace OrthancDatabases
       return database_;
     }
 
+    bool IsStreaming() const
+    {
+      return streaming_;
+    }
+
+    void SetStreaming(bool streaming)
+    {
+      streaming_ = streaming;
+    }
+
+    /**
+     * In the "adaptive" mode, the latency of the first executions is
+     * the baseline, as PostgreSQL plans the first 5 executions of a
+     * prepared statement with the values of their parameters. If the
+     * latency then diverges from this baseline (e.g. because of a
+     * generic plan), the statement is executed with custom plans
+     * until its destruction. This works with all the versions of
+     * PostgreSQL, contrarily to the "plan_cache_mode" setting (12+).
+     **/
+    void SetPlanCacheMode(PlanCacheMode mode);
+
+    bool IsCustomPlans() const
+    {
+      return customPlans_;
+    }
+
     IResult* Execute(ITransaction& transaction,
                      const Dictionary& parameters);
 
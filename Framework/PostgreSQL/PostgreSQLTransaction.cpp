@@ -42,12 +42,14 @@ namespace OrthancDatabases
 
   PostgreSQLTransaction::~PostgreSQLTransaction()
   {
-    if (isOpen_)
+    if (isOpen_ &&
+        !database_.CancelDeferredBegin())
     {
       LOG(INFO) << "PostgreSQL: An active PostgreSQL transaction was dismissed";
 
       try
       {
+        database_.DiscardPipeline();
         database_.ExecuteMultiLines("ABORT");
       }
       catch (Orthanc::OrthancException&)
@@ -85,7 +87,7 @@ namespace OrthancDatabases
         throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
     }
 
-    database_.ExecuteMultiLines("BEGIN; " + transactionStatement);
+    database_.DeferBegin("BEGIN; " + transactionStatement);
 
     isOpen_ = true;
   }
@@ -100,7 +102,12 @@ namespace OrthancDatabases
       throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
     }
 
-    database_.ExecuteMultiLines("ABORT");
+    if (!database_.CancelDeferredBegin())
+    {
+      database_.DiscardPipeline();
+      database_.ExecuteMultiLines("ABORT");
+    }
+
     isOpen_ = false;
   }
 
@@ -114,7 +121,12 @@ namespace OrthancDatabases
       throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
     }
 
-    database_.ExecuteMultiLines("COMMIT");
+    if (!database_.CancelDeferredBegin())
+    {
+      // Nothing to commit if no statement was executed
+      database_.ExecuteMultiLines("COMMIT");
+    }
+
     isOpen_ = false;
   }
 
@@ -27,10 +27,168 @@
 #include "SQLiteTransaction.h"
 #include "../Common/ImplicitTransaction.h"
 
+#include <Logging.h>
 #include <OrthancException.h>
+#include <SQLite/Statement.h>
 
 namespace OrthancDatabases
 {
+  class SQLiteDatabase::BatchedTransaction : public ITransaction
+  {
+  private:
+    SQLiteDatabase&  database_;
+    bool             readOnly_;
+    bool             isOpen_;
+
+  public:
+    BatchedTransaction(SQLiteDatabase& database,
+                       bool readOnly) :
+      database_(database),
+      readOnly_(readOnly),
+      isOpen_(false)
+    {
+      if (!database_.isBatchOpen_)
+      {
+        database_.Execute("BEGIN");
+        database_.isBatchOpen_ = true;
+        database_.batchedCommits_ = 0;
+        database_.batchStart_ = boost::posix_time::microsec_clock::universal_time();
+      }
+
+      database_.Execute("SAVEPOINT batched");
+      isOpen_ = true;
+    }
+
+    virtual ~BatchedTransaction()
+    {
+      if (isOpen_)
+      {
+        try
+        {
+          Rollback();
+        }
+        catch (Orthanc::OrthancException&)
+        {
+          LOG(ERROR) << "Cannot roll back a batched SQLite transaction";
+        }
+      }
+    }
+
+    virtual bool IsImplicit() const ORTHANC_OVERRIDE
+    {
+      return false;
+    }
+
+    virtual void Rollback() ORTHANC_OVERRIDE
+    {
+      if (!isOpen_)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+      }
+
+      // The previous transactions of the batch are kept
+      isOpen_ = false;
+      database_.Execute("ROLLBACK TO batched");
+      database_.Execute("RELEASE batched");
+    }
+
+    virtual void Commit() ORTHANC_OVERRIDE
+    {
+      if (!isOpen_)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+      }
+
+      isOpen_ = false;
+      database_.Execute("RELEASE batched");
+
+      if (!readOnly_)
+      {
+        database_.batchedCommits_++;
+      }
+
+      if (database_.batchedCommits_ >= database_.batchSize_ ||
+          (database_.batchMaxDuration_ != 0 &&
+           database_.batchedCommits_ != 0 &&
+           boost::posix_time::microsec_clock::universal_time() >=
+           database_.batchStart_ + boost::posix_time::seconds(database_.batchMaxDuration_)))
+      {
+        database_.CommitBatch();
+      }
+    }
+
+    virtual IResult* Execute(IPrecompiledStatement& statement,
+                             const Dictionary& parameters) ORTHANC_OVERRIDE
+    {
+      return dynamic_cast<SQLiteStatement&>(statement).Execute(*this, parameters);
+    }
+
+    virtual void ExecuteWithoutResult(IPrecompiledStatement& statement,
+                                      const Dictionary& parameters) ORTHANC_OVERRIDE
+    {
+      dynamic_cast<SQLiteStatement&>(statement).ExecuteWithoutResult(*this, parameters);
+    }
+
+    virtual bool DoesTableExist(const std::string& name) ORTHANC_OVERRIDE
+    {
+      return database_.GetObject().DoesTableExist(name.c_str());
+    }
+
+    virtual bool DoesIndexExist(const std::string& name) ORTHANC_OVERRIDE
+    {
+      return database_.DoesIndexExist(name);
+    }
+
+    virtual bool DoesTriggerExist(const std::string& name) ORTHANC_OVERRIDE
+    {
+      return false;
+    }
+
+    virtual void ExecuteMultiLines(const std::string& query) ORTHANC_OVERRIDE
+    {
+      database_.GetObject().Execute(query);
+    }
+  };
+
+
+  SQLiteDatabase::~SQLiteDatabase()
+  {
+    if (isBatchOpen_)
+    {
+      try
+      {
+        CommitBatch();
+      }
+      catch (Orthanc::OrthancException&)
+      {
+        LOG(ERROR) << "Cannot commit the last batch of SQLite transactions";
+      }
+    }
+  }
+
+
+  void SQLiteDatabase::CommitBatch()
+  {
+    if (isBatchOpen_)
+    {
+      isBatchOpen_ = false;
+      batchedCommits_ = 0;
+      Execute("COMMIT");
+    }
+  }
+
+
+  void SQLiteDatabase::SetBatchSize(size_t count)
+  {
+    if (count == 0)
+    {
+      CommitBatch();
+    }
+
+    batchSize_ = count;
+  }
+
+
   void SQLiteDatabase::Execute(const std::string& sql)
   {
     if (!connection_.Execute(sql))
@@ -40,6 +198,22 @@ namespace OrthancDatabases
   }
     
 
+  bool SQLiteDatabase::DoesIndexExist(const std::string& name)
+  {
+    Orthanc::SQLite::Statement statement(connection_, "SELECT COUNT(*) FROM sqlite_master WHERE type='index' AND name=?");
+    statement.BindString(0, name);
+
+    if (!statement.Step())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);
+    }
+    else
+    {
+      return statement.ColumnInt(0) != 0;
+    }
+  }
+
+
   IPrecompiledStatement* SQLiteDatabase::Compile(const Query& query)
   {
     return new SQLiteStatement(*this, query);
@@ -79,7 +253,7 @@ namespace OrthancDatabases
 
       virtual bool DoesIndexExist(const std::string& name) ORTHANC_OVERRIDE
       {
-        return false;
+        return db_.DoesIndexExist(name);
       }
 
       virtual bool DoesTriggerExist(const std::string& name) ORTHANC_OVERRIDE
@@ -103,7 +277,14 @@ namespace OrthancDatabases
 
       case TransactionType_ReadOnly:
       case TransactionType_ReadWrite:
-        return new SQLiteTransaction(*this);
+        if (batchSize_ != 0)
+        {
+          return new BatchedTransaction(*this, type == TransactionType_ReadOnly);
+        }
+        else
+        {
+          return new SQLiteTransaction(*this);
+        }
 
       default:
         throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
@@ -31,14 +31,35 @@
 
 #include <SQLite/Connection.h>
 
+#include <boost/date_time/posix_time/posix_time.hpp>
+
 namespace OrthancDatabases
 {
   class SQLiteDatabase : public IDatabase
   {
   private:
+    class BatchedTransaction;
+
     Orthanc::SQLite::Connection  connection_;
+    size_t                       batchSize_;        // "0" if the transactions are not batched
+    size_t                       batchedCommits_;   // Number of read-write transactions in the open batch
+    bool                         isBatchOpen_;
+    unsigned int                 batchMaxDuration_; // In seconds, "0" if the batches are not bounded in time
+    boost::posix_time::ptime     batchStart_;
+
+    void CommitBatch();
     
   public:
+    SQLiteDatabase() :
+      batchSize_(0),
+      batchedCommits_(0),
+      isBatchOpen_(false),
+      batchMaxDuration_(0)
+    {
+    }
+
+    virtual ~SQLiteDatabase();
+
     void OpenInMemory()
     {
       connection_.OpenInMemory();
@@ -55,11 +76,40 @@ namespace OrthancDatabases
     }
 
     void Execute(const std::string& sql);
+
+    bool DoesIndexExist(const std::string& name);
     
     int64_t GetLastInsertRowId() const
     {
       return connection_.GetLastInsertRowId();
     }
+
+    /**
+     * If "count > 0", the transactions are savepoints inside a
+     * transaction that is committed every "count" read-write
+     * transactions, which amortizes the cost of the commits during a
+     * bulk load. The transactions of the last batch are lost if the
+     * process stops, and they are only visible to the other
+     * connections once their batch is committed. "0" commits the open
+     * batch, if any. Must be called outside of a transaction.
+     **/
+    void SetBatchSize(size_t count);
+
+    size_t GetBatchSize() const
+    {
+      return batchSize_;
+    }
+
+    /**
+     * Bounds the time during which the transactions of a batch are
+     * not durable: The batch is also committed by the first
+     * transaction (possibly read-only) that ends at least "seconds"
+     * after the start of the batch. "0" disables this bound.
+     **/
+    void SetBatchMaxDuration(unsigned int seconds)
+    {
+      batchMaxDuration_ = seconds;
+    }
     
     virtual Dialect GetDialect() const ORTHANC_OVERRIDE
     {
@@ -71,7 +71,7 @@ namespace OrthancDatabases
 
     virtual bool DoesIndexExist(const std::string& name) ORTHANC_OVERRIDE
     {
-      return false;  // Not implemented yet
+      return database_.DoesIndexExist(name);
     }
 
     virtual bool DoesTriggerExist(const std::string& name) ORTHANC_OVERRIDE
@@ -0,0 +1,72 @@
+-- Variant of "CreateInstance" for the multi-writer mode (cf. option
+-- "EnableMultiWriter"), where several Orthanc servers share the index
+-- without the global "Lock". It requires the unique index
+-- "PublicIndex2" on "Resources(publicId, resourceType)", and the
+-- "READ COMMITTED" isolation level.
+-- The row of the patient is inserted or locked first: Its exclusive
+-- lock serializes the writers of the same patient until the end of
+-- their transaction, while the writers of other patients proceed.
+
+DROP PROCEDURE IF EXISTS CreateInstanceMultiWriter;
+
+CREATE PROCEDURE CreateInstanceMultiWriter(
+       IN patient TEXT,
+       IN study TEXT,
+       IN series TEXT,
+       IN instance TEXT,
+       OUT isNewPatient BOOLEAN,
+       OUT isNewStudy BOOLEAN,
+       OUT isNewSeries BOOLEAN,
+       OUT isNewInstance BOOLEAN,
+       OUT patientKey BIGINT,
+       OUT studyKey BIGINT,
+       OUT seriesKey BIGINT,
+       OUT instanceKey BIGINT)
+BEGIN  
+  DECLARE recyclingSeq BIGINT@
+
+  SELECT 0, 0, 0, 0 INTO isNewPatient, isNewStudy, isNewSeries, isNewInstance@
+
+  SELECT internalId INTO instanceKey FROM Resources WHERE publicId = instance AND resourceType = 3@
+
+  IF instanceKey IS NULL THEN
+    -- "ROW_COUNT()" is 1 if the row was inserted, and 0 if it already
+    -- existed (the update doesn't change its value, but locks it)
+    INSERT INTO Resources VALUES (DEFAULT, 0, patient, NULL)
+      ON DUPLICATE KEY UPDATE internalId = LAST_INSERT_ID(internalId)@
+    SELECT ROW_COUNT() = 1, LAST_INSERT_ID() INTO isNewPatient, patientKey@
+
+    -- The instance might have been created by another writer of the
+    -- same patient, while waiting for the lock
+    SELECT internalId INTO instanceKey FROM Resources WHERE publicId = instance AND resourceType = 3@
+  END IF@
+
+  IF instanceKey IS NULL THEN
+    INSERT INTO Resources VALUES (DEFAULT, 1, study, patientKey)
+      ON DUPLICATE KEY UPDATE internalId = LAST_INSERT_ID(internalId)@
+    SELECT ROW_COUNT() = 1, LAST_INSERT_ID() INTO isNewStudy, studyKey@
+
+    INSERT INTO Resources VALUES (DEFAULT, 2, series, studyKey)
+      ON DUPLICATE KEY UPDATE internalId = LAST_INSERT_ID(internalId)@
+    SELECT ROW_COUNT() = 1, LAST_INSERT_ID() INTO isNewSeries, seriesKey@
+
+    IF (isNewPatient AND NOT isNewStudy) OR (isNewStudy AND NOT isNewSeries) THEN
+       SIGNAL SQLSTATE '45000' SET MESSAGE_TEXT = 'Broken invariant 1'@
+    END IF@
+
+    INSERT INTO Resources VALUES (DEFAULT, 3, instance, seriesKey)@
+    SELECT LAST_INSERT_ID() INTO instanceKey@
+    SELECT 1 INTO isNewInstance@
+
+    -- Move the patient to the end of the recycling order
+    IF NOT isNewPatient THEN
+       SELECT seq FROM PatientRecyclingOrder WHERE patientId = patientKey INTO recyclingSeq@
+       
+       IF NOT recyclingSeq IS NULL THEN
+          -- The patient is not protected
+          DELETE FROM PatientRecyclingOrder WHERE seq = recyclingSeq@
+          INSERT INTO PatientRecyclingOrder VALUES (DEFAULT, patientKey)@
+       END IF@
+    END IF@
+  END IF@
+END;
@@ -1,3 +1,14 @@
+-- The resources to be deleted are staged in a permanent table that
+-- is keyed by the connection, instead of a temporary table, so that
+-- deleting resources doesn't involve any DDL statement
+CREATE TABLE IF NOT EXISTS DeletedResourcesStaging(
+       connectionId BIGINT NOT NULL,
+       internalId BIGINT NOT NULL,
+       resourceType INTEGER NOT NULL,
+       publicId VARCHAR(64) NOT NULL,
+       PRIMARY KEY(connectionId, internalId)
+       );
+
 DROP PROCEDURE IF EXISTS DeleteResources;
 
 CREATE PROCEDURE DeleteResources(
@@ -7,9 +18,19 @@ BEGIN
     DECLARE v_internalId BIGINT@
     DECLARE done INT DEFAULT FALSE@
 	DECLARE cur1 CURSOR FOR
-		SELECT internalId FROM DeletedResources@
+		SELECT internalId FROM DeletedResourcesStaging WHERE connectionId = CONNECTION_ID()@
 	DECLARE CONTINUE HANDLER FOR SQLSTATE '02000' SET done = TRUE@
-	set done=FALSE@	
+	set done=FALSE@
+
+	DELETE FROM DeletedResourcesStaging WHERE connectionId = CONNECTION_ID()@
+
+	-- MySQL does not support recursive foreign keys on the same table:
+	-- Explicitly list the resource and its descendants (at most 3 levels)
+	INSERT INTO DeletedResourcesStaging
+		SELECT CONNECTION_ID(), internalId, resourceType, publicId FROM Resources
+		WHERE internalId=p_id OR parentId=p_id
+		OR parentId IN (SELECT internalId FROM Resources WHERE parentId=p_id)
+		OR parentId IN (SELECT internalId FROM Resources WHERE parentId IN (SELECT internalId FROM Resources WHERE parentId=p_id))@
 
 	OPEN cur1@
 	REPEAT
@@ -20,4 +41,4 @@ BEGIN
 	UNTIL done END REPEAT@
 	CLOSE cur1@
 
-END;
\ No newline at end of file
+END;
@@ -0,0 +1,122 @@
+-- Fast statistics, similar to the "GlobalIntegersChanges" mechanism
+-- of the PostgreSQL plugin. The triggers only append rows to the
+-- "GlobalIntegersChanges" table, so that concurrent transactions do
+-- not compete for the rows of "GlobalIntegers". These rows are
+-- periodically folded into "GlobalIntegers" by "UpdateStatistics()".
+--
+-- Keys in "GlobalIntegers" (key 0 is the last change index):
+--   1 = total compressed size
+--   2 = total uncompressed size
+--   3, 4, 5, 6 = count of patients, studies, series, instances
+--                (i.e. "resourceType + 3")
+
+-- NB: Character "@" is used to replace the semicolon characters in triggers
+
+CREATE TABLE IF NOT EXISTS GlobalIntegersChanges(
+       id BIGINT NOT NULL AUTO_INCREMENT,
+       property INTEGER NOT NULL,
+       value BIGINT NOT NULL,
+       PRIMARY KEY(id)
+       );
+
+
+DELETE FROM GlobalIntegersChanges;
+DELETE FROM GlobalIntegers WHERE property BETWEEN 1 AND 6;
+
+INSERT INTO GlobalIntegers SELECT 1, COALESCE(SUM(compressedSize), 0) FROM AttachedFiles;
+INSERT INTO GlobalIntegers SELECT 2, COALESCE(SUM(uncompressedSize), 0) FROM AttachedFiles;
+INSERT INTO GlobalIntegers SELECT 3, COUNT(*) FROM Resources WHERE resourceType = 0;
+INSERT INTO GlobalIntegers SELECT 4, COUNT(*) FROM Resources WHERE resourceType = 1;
+INSERT INTO GlobalIntegers SELECT 5, COUNT(*) FROM Resources WHERE resourceType = 2;
+INSERT INTO GlobalIntegers SELECT 6, COUNT(*) FROM Resources WHERE resourceType = 3;
+
+
+-- MySQL < 8.0 only accepts one trigger per event and per timing, so
+-- the triggers from "PrepareIndex.sql" are replaced
+
+DROP TRIGGER IF EXISTS AttachedFileAdded;
+
+CREATE TRIGGER AttachedFileAdded
+AFTER INSERT ON AttachedFiles
+FOR EACH ROW
+BEGIN
+  INSERT INTO GlobalIntegersChanges VALUES(NULL, 1, new.compressedSize)@
+  INSERT INTO GlobalIntegersChanges VALUES(NULL, 2, new.uncompressedSize)@
+END;
+
+
+-- In MySQL, this trigger is only used if replacing some attachment:
+-- The foreign keys with "ON DELETE CASCADE" don't fire triggers, so
+-- the deletion of resources is handled by "ResourceDeleted" below
+DROP TRIGGER IF EXISTS AttachedFileDeleted;
+
+CREATE TRIGGER AttachedFileDeleted
+AFTER DELETE ON AttachedFiles
+FOR EACH ROW
+BEGIN
+  INSERT INTO DeletedFiles VALUES(old.uuid, old.filetype, old.compressedSize,
+                                  old.uncompressedSize, old.compressionType,
+                                  old.uncompressedHash, old.compressedHash)@
+  INSERT INTO GlobalIntegersChanges VALUES(NULL, 1, -old.compressedSize)@
+  INSERT INTO GlobalIntegersChanges VALUES(NULL, 2, -old.uncompressedSize)@
+END;
+
+
+DROP TRIGGER IF EXISTS ResourceDeleted;
+
+CREATE TRIGGER ResourceDeleted
+BEFORE DELETE ON Resources   -- WARNING: Must be "BEFORE", otherwise the attached file is already deleted
+FOR EACH ROW
+BEGIN
+   INSERT INTO DeletedFiles SELECT uuid, fileType, compressedSize, uncompressedSize, compressionType, uncompressedHash, compressedHash FROM AttachedFiles WHERE id=old.internalId@
+   INSERT INTO GlobalIntegersChanges SELECT NULL, 1, -SUM(compressedSize) FROM AttachedFiles WHERE id=old.internalId HAVING COUNT(*) > 0@
+   INSERT INTO GlobalIntegersChanges SELECT NULL, 2, -SUM(uncompressedSize) FROM AttachedFiles WHERE id=old.internalId HAVING COUNT(*) > 0@
+   INSERT INTO GlobalIntegersChanges VALUES(NULL, old.resourceType + 3, -1)@
+END;
+
+
+DROP TRIGGER IF EXISTS PatientAdded;
+
+CREATE TRIGGER PatientAdded
+AFTER INSERT ON Resources
+FOR EACH ROW
+BEGIN
+  IF new.resourceType = 0 THEN  -- The "0" corresponds to "OrthancPluginResourceType_Patient"
+    INSERT INTO PatientRecyclingOrder VALUES (NULL, new.internalId)@
+  END IF@
+  INSERT INTO GlobalIntegersChanges VALUES(NULL, new.resourceType + 3, 1)@
+END;
+
+
+-- Folds the pending changes into "GlobalIntegers". The locking read
+-- blocks the insertions until the end of the transaction, so that no
+-- row is deleted without having been accounted for.
+DROP PROCEDURE IF EXISTS UpdateStatistics;
+
+CREATE PROCEDURE UpdateStatistics(
+    OUT patientsCount BIGINT,
+    OUT studiesCount BIGINT,
+    OUT seriesCount BIGINT,
+    OUT instancesCount BIGINT,
+    OUT compressedSize BIGINT,
+    OUT uncompressedSize BIGINT
+)
+BEGIN
+    DECLARE maxId BIGINT@
+
+    SELECT COALESCE(MAX(id), 0) INTO maxId FROM GlobalIntegersChanges FOR UPDATE@
+
+    UPDATE GlobalIntegers SET value = value +
+      (SELECT COALESCE(SUM(c.value), 0) FROM GlobalIntegersChanges AS c
+       WHERE c.property = GlobalIntegers.property AND c.id <= maxId)
+      WHERE property BETWEEN 1 AND 6@
+
+    DELETE FROM GlobalIntegersChanges WHERE id <= maxId@
+
+    SELECT value INTO compressedSize FROM GlobalIntegers WHERE property = 1@
+    SELECT value INTO uncompressedSize FROM GlobalIntegers WHERE property = 2@
+    SELECT value INTO patientsCount FROM GlobalIntegers WHERE property = 3@
+    SELECT value INTO studiesCount FROM GlobalIntegers WHERE property = 4@
+    SELECT value INTO seriesCount FROM GlobalIntegers WHERE property = 5@
+    SELECT value INTO instancesCount FROM GlobalIntegers WHERE property = 6@
+END;
@@ -4,10 +4,26 @@ CREATE TABLE IF NOT EXISTS GlobalIntegers(
        );
 
 
-DELETE FROM GlobalIntegers WHERE property = 0;
+-- The value is never decreased, as the changes might have been deleted
+INSERT IGNORE INTO GlobalIntegers VALUES (0, 0);
 
-INSERT INTO GlobalIntegers
-SELECT 0, COALESCE(MAX(seq), 0) FROM Changes;
+UPDATE GlobalIntegers SET value = GREATEST(value, (SELECT COALESCE(MAX(seq), 0) FROM Changes))
+WHERE property = 0;
+
+
+-- The row of the property 0 serializes the transactions that insert
+-- changes: It is locked before the AUTO_INCREMENT "seq" is allocated
+-- (in a BEFORE trigger, "new.seq" is still 0), and is only released
+-- at the commit. The changes are therefore committed in the order of
+-- "seq", and the readers cannot skip the changes of a slower writer.
+DROP TRIGGER IF EXISTS ChangeAdding;
+
+CREATE TRIGGER ChangeAdding
+BEFORE INSERT ON Changes
+FOR EACH ROW
+BEGIN
+  UPDATE GlobalIntegers SET value = value WHERE property = 0@
+END;
 
 
 DROP TRIGGER IF EXISTS ChangeAdded;
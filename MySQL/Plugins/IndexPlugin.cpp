@@ -25,6 +25,7 @@
 #include "../../Framework/MySQL/MySQLDatabase.h"
 #include "../../Framework/Plugins/PluginInitialization.h"
 
+#include <Compatibility.h>  // For std::unique_ptr<>
 #include <HttpClient.h>
 #include <Logging.h>
 #include <Toolbox.h>
@@ -77,12 +78,73 @@ extern "C"
     try
     {
       const size_t countConnections = mysql.GetUnsignedIntegerValue("IndexConnectionsCount", 1);
-      const unsigned int housekeepingDelaySeconds = 5;  // TODO - PARAMETER
+      const unsigned int housekeepingDelaySeconds = mysql.GetUnsignedIntegerValue("HousekeepingInterval", 5);
 
       OrthancDatabases::MySQLParameters parameters(mysql, configuration);
+
+      std::unique_ptr<OrthancDatabases::MySQLIndex> index(
+        new OrthancDatabases::MySQLIndex(context, parameters, readOnly));
+      index->SetMaxCachedStatements(mysql.GetUnsignedIntegerValue("MaximumCachedStatements", 256));
+      index->SetStatementsWarmup(mysql.GetUnsignedIntegerValue("StatementsWarmup", 0));
+      index->SetExportedResourcesRetention(mysql.GetUnsignedIntegerValue("ExportedResourcesRetentionDays", 0),
+                                           mysql.GetUnsignedIntegerValue("ExportedResourcesRetentionBatchSize", 10000));
+      index->SetAnalyticsExport(mysql.GetStringValue("AnalyticsExportDirectory", ""),
+                                mysql.GetUnsignedIntegerValue("AnalyticsExportBatchSize", 10000));
+      index->SetHousekeepingInterval("AnalyticsExport", mysql.GetUnsignedIntegerValue("AnalyticsExportInterval", 60));
+      index->SetHousekeepingInterval("DatabaseMetrics", mysql.GetUnsignedIntegerValue("DatabaseMetricsInterval", 0));
+      index->SetConnectionHoldWarningThreshold(mysql.GetUnsignedIntegerValue("ConnectionHoldWarningThreshold", 0));
+      index->SetSlowStatementThreshold(mysql.GetUnsignedIntegerValue("SlowStatementThreshold", 0));
+      index->SetMinConnections(mysql.GetUnsignedIntegerValue("MinIndexConnections", 0));
+      index->SetIdleConnectionsTimeout(mysql.GetUnsignedIntegerValue("IndexConnectionsIdleTimeout", 60));
+      index->SetHealthCheckInterval(mysql.GetUnsignedIntegerValue("IndexConnectionsHealthCheckInterval", 0));
+      index->SetConnectionsHandout(mysql.GetBooleanValue("IndexConnectionsLifo", false),
+                                   mysql.GetBooleanValue("IndexConnectionsAffinity", false));
+      index->SetGroupCommit(mysql.GetUnsignedIntegerValue("GroupCommitSize", 0),
+                            mysql.GetUnsignedIntegerValue("GroupCommitDelay", 5));
+      index->SetMaxConcurrentWriters(mysql.GetUnsignedIntegerValue("MaxConcurrentWriters", 0));
+      index->SetMaxInFlightTransactions(mysql.GetUnsignedIntegerValue("MaxInFlightTransactions", 0));
+      index->SetFailoverRetryBudget(mysql.GetUnsignedIntegerValue("FailoverRetryBudget", 0));
+      index->SetReservedConnections(mysql.GetUnsignedIntegerValue("ReservedReadOnlyConnections", 0),
+                                    mysql.GetUnsignedIntegerValue("ReservedReadWriteConnections", 0));
+      index->SetKeysetPagination(mysql.GetBooleanValue("EnableKeysetPagination", false));
+      index->SetLookupCacheSize(mysql.GetUnsignedIntegerValue("LookupCacheSize", 0));
+      index->SetChildrenPrefetch(mysql.GetBooleanValue("EnableChildrenPrefetch", false));
+      index->SetFindParallelism(mysql.GetUnsignedIntegerValue("ParallelFindConnections", 0));
+      index->SetFindTwoPhases(mysql.GetBooleanValue("EnableFindTwoPhases", false));
+      index->SetFindJsonAggregation(mysql.GetBooleanValue("EnableFindJsonAggregation", false));
+      index->SetFindStatementTimeout(mysql.GetUnsignedIntegerValue("FindStatementTimeout", 0));
+      index->SetMaxResponseSize(static_cast<uint64_t>(mysql.GetUnsignedIntegerValue("MaxResponseSize", 0)) * 1024 * 1024);  // In MB
+      index->SetCountCacheTimeToLive(mysql.GetUnsignedIntegerValue("CountCacheTimeToLive", 0));
+      index->SetFindCacheTimeToLive(mysql.GetUnsignedIntegerValue("FindCacheTimeToLive", 0));
+      index->SetLabelsCacheTimeToLive(mysql.GetUnsignedIntegerValue("LabelsCacheTimeToLive", 0));
+      index->SetGlobalPropertiesCacheTimeToLive(mysql.GetUnsignedIntegerValue("GlobalPropertiesCacheTimeToLive", 0));
+      index->SetCacheInvalidations(mysql.GetBooleanValue("EnableCacheInvalidations", false));
+      index->SetHousekeepingInterval("CacheInvalidations", mysql.GetUnsignedIntegerValue("CacheInvalidationsInterval", 1));
+      index->SetCaptureFile(mysql.GetStringValue("CaptureFile", ""),
+                            mysql.GetUnsignedIntegerValue("CaptureBufferSize", 1024));
+      index->SetTracesExport(mysql.GetStringValue("TracesExportUrl", ""),
+                             mysql.GetStringValue("TracesExportServiceName", "orthanc-databases"));
+      index->SetIngestStatistics(mysql.GetBooleanValue("EnableIngestStatistics", false));
+      index->SetChunkedDeletionBatchSize(mysql.GetUnsignedIntegerValue("ChunkedDeletionBatchSize", 0));
+      index->SetReplicaSource(mysql.GetBooleanValue("EnableReplicaSource", false));
+      index->SetIndexAdvisor(mysql.GetBooleanValue("EnableIndexAdvisor", false));
+      index->SetWildcardIndex(mysql.GetBooleanValue("EnableWildcardIndex", false));
+
+      if (mysql.IsSection("ReadOnlyReplica"))
+      {
+        // The parameters that are not specified in the "ReadOnlyReplica"
+        // section are inherited from the primary database
+        OrthancPlugins::OrthancConfiguration replica;
+        mysql.GetSection(replica, "ReadOnlyReplica");
+
+        OrthancDatabases::MySQLParameters replicaParameters(parameters);
+        replicaParameters.LoadConnectionParameters(replica);
+
+        index->SetReplica(replicaParameters, replica.GetUnsignedIntegerValue("IndexConnectionsCount", countConnections));
+      }
+
       OrthancDatabases::IndexBackend::Register(
-        new OrthancDatabases::MySQLIndex(context, parameters, readOnly), countConnections,
-        parameters.GetMaxConnectionRetries(), housekeepingDelaySeconds);
+        index.release(), countConnections, parameters.GetMaxConnectionRetries(), housekeepingDelaySeconds);
     }
     catch (Orthanc::OrthancException& e)
     {
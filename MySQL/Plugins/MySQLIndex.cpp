@@ -34,6 +34,8 @@
 #include <Logging.h>
 #include <OrthancException.h>
 
+#include <boost/lexical_cast.hpp>
+#include <cassert>
 #include <ctype.h>
 
 namespace OrthancDatabases
@@ -43,7 +45,9 @@ namespace OrthancDatabases
                          bool readOnly) :
     IndexBackend(context, readOnly),
     parameters_(parameters),
-    clearAll_(false)
+    replicaConnectionsCount_(0),
+    clearAll_(false),
+    wildcardIndex_(false)
   {
   }
 
@@ -54,6 +58,27 @@ namespace OrthancDatabases
   }
 
 
+  void MySQLIndex::SetReplica(const MySQLParameters& parameters,
+                              size_t countConnections)
+  {
+    replicaParameters_.reset(new MySQLParameters(parameters));
+    replicaConnectionsCount_ = countConnections;
+  }
+
+
+  IDatabaseFactory* MySQLIndex::CreateReplicaDatabaseFactory()
+  {
+    if (replicaParameters_.get() == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls, "No read-only replica is configured");
+    }
+    else
+    {
+      return MySQLDatabase::CreateDatabaseFactory(*replicaParameters_);
+    }
+  }
+
+
   static void ThrowCannotCreateTrigger()
   {
     LOG(ERROR) << "The MySQL user is not allowed to create triggers => 2 possible solutions:";
@@ -338,12 +363,284 @@ namespace OrthancDatabases
         t.Commit();
       }
 
+      if (revision == 8)
+      {
+        DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+        
+        // Install the fast statistics (total size and resource counters)
+        std::string query;
+        
+        Orthanc::EmbeddedResources::GetFileResource
+          (query, Orthanc::EmbeddedResources::MYSQL_FAST_STATISTICS);
+
+        // Need to escape arobases: Don't use "t.GetDatabaseTransaction().ExecuteMultiLines()" here
+        db.ExecuteMultiLines(query, true);
+
+        if (!t.GetDatabaseTransaction().DoesTriggerExist("AttachedFileAdded"))
+        {
+          ThrowCannotCreateTrigger();
+        }
+
+        SetGlobalIntegerProperty(manager, MISSING_SERVER_IDENTIFIER, Orthanc::GlobalProperty_GetTotalSizeIsFast, 1);
+
+        revision = 9;
+        SetGlobalIntegerProperty(manager, MISSING_SERVER_IDENTIFIER, Orthanc::GlobalProperty_DatabasePatchLevel, revision);
+
+        t.Commit();
+      }
+
+      if (revision == 9)
+      {
+        // Added the "revision" columns to support the optimistic
+        // concurrency of Orthanc on metadata and attachments. The rows that predate this revision are
+        // reported with revision 0.
+        DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+
+        t.GetDatabaseTransaction().ExecuteMultiLines(
+          "ALTER TABLE Metadata ADD COLUMN revision INTEGER;"
+          "ALTER TABLE AttachedFiles ADD COLUMN revision INTEGER;");
+
+        revision = 10;
+        SetGlobalIntegerProperty(manager, MISSING_SERVER_IDENTIFIER, Orthanc::GlobalProperty_DatabasePatchLevel, revision);
+
+        t.Commit();
+      }
+
+      if (revision == 10)
+      {
+        DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+        
+        // Reinstall the "DeleteResources" extension, which doesn't
+        // use a temporary table anymore
+        std::string query;
+        
+        Orthanc::EmbeddedResources::GetFileResource
+          (query, Orthanc::EmbeddedResources::MYSQL_DELETE_RESOURCES);
+
+        // Need to escape arobases: Don't use "t.GetDatabaseTransaction().ExecuteMultiLines()" here
+        db.ExecuteMultiLines(query, true);
+        
+        revision = 11;
+        SetGlobalIntegerProperty(manager, MISSING_SERVER_IDENTIFIER, Orthanc::GlobalProperty_DatabasePatchLevel, revision);
+
+        t.Commit();
+      }
+
+      if (revision == 11)
+      {
+        // "ChildrenIndex2" replaces "ChildrenIndex": As the secondary
+        // indexes of InnoDB contain the primary key (i.e. "internalId"),
+        // the children are listed and counted by an index-only scan
+        DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+
+        t.GetDatabaseTransaction().ExecuteMultiLines(
+          "CREATE INDEX ChildrenIndex2 ON Resources(parentId, publicId);"
+          "DROP INDEX ChildrenIndex ON Resources;");
+
+        revision = 12;
+        SetGlobalIntegerProperty(manager, MISSING_SERVER_IDENTIFIER, Orthanc::GlobalProperty_DatabasePatchLevel, revision);
+
+        t.Commit();
+      }
+
+      if (revision == 12)
+      {
+        // Composite index for the range lookups on the identifier
+        // tags (e.g. the date ranges on "StudyDate"). As the primary
+        // key "(id, tagGroup, tagElement)" is part of the secondary
+        // indexes of InnoDB, the scans are index-only.
+        DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+
+        t.GetDatabaseTransaction().ExecuteMultiLines(
+          "CREATE INDEX DicomIdentifiersIndex3 ON DicomIdentifiers(tagGroup, tagElement, value);");
+
+        revision = 13;
+        SetGlobalIntegerProperty(manager, MISSING_SERVER_IDENTIFIER, Orthanc::GlobalProperty_DatabasePatchLevel, revision);
+
+        t.Commit();
+      }
+
+      if (revision == 13)
+      {
+        // The "ChangeAdded" trigger updated the same row of
+        // "GlobalIntegers" for each change, which serialized all the
+        // writers until their commit. This is reverted by the
+        // revision 17, as this serialization is needed by the readers
+        // of the changes.
+        DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+
+        t.GetDatabaseTransaction().ExecuteMultiLines(
+          "DROP TRIGGER IF EXISTS ChangeAdding;"
+          "DROP TRIGGER IF EXISTS ChangeAdded;"
+          "UPDATE GlobalIntegers SET value = GREATEST(value, (SELECT COALESCE(MAX(seq), 0) FROM Changes)) "
+          "WHERE property = 0;");
+
+        revision = 14;
+        SetGlobalIntegerProperty(manager, MISSING_SERVER_IDENTIFIER, Orthanc::GlobalProperty_DatabasePatchLevel, revision);
+
+        t.Commit();
+      }
+
+      if (revision == 14)
+      {
+        // Composite index for the change feeds that are filtered by
+        // change type (cf. "IndexBackend::GetChangesCursor()")
+        DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+
+        t.GetDatabaseTransaction().ExecuteMultiLines(
+          "CREATE INDEX ChangesIndex2 ON Changes(changeType, seq);");
+
+        revision = 15;
+        SetGlobalIntegerProperty(manager, MISSING_SERVER_IDENTIFIER, Orthanc::GlobalProperty_DatabasePatchLevel, revision);
+
+        t.Commit();
+      }
+
+      if (revision == 15)
+      {
+        DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+        
+        // Install the "CreateInstanceMultiWriter" extension, that is
+        // only called in the multi-writer mode
+        std::string query;
+        
+        Orthanc::EmbeddedResources::GetFileResource
+          (query, Orthanc::EmbeddedResources::MYSQL_CREATE_INSTANCE_MULTI_WRITER);
+
+        // Need to escape arobases: Don't use "t.GetDatabaseTransaction().ExecuteMultiLines()" here
+        db.ExecuteMultiLines(query, true);
+        
+        revision = 16;
+        SetGlobalIntegerProperty(manager, MISSING_SERVER_IDENTIFIER, Orthanc::GlobalProperty_DatabasePatchLevel, revision);
+
+        t.Commit();
+      }
+
+      if (revision == 16)
+      {
+        // Without the serialization of the writers on the row of the
+        // last change index, the changes could be committed in
+        // another order than "seq", and "MAX(seq)" could skip the
+        // changes of a slower transaction. The "GetLastChangeIndex"
+        // extension is re-installed, with its "ChangeAdding" trigger
+        // that locks the row before the "seq" is allocated.
+        DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+
+        std::string query;
+
+        Orthanc::EmbeddedResources::GetFileResource
+          (query, Orthanc::EmbeddedResources::MYSQL_GET_LAST_CHANGE_INDEX);
+
+        // Need to escape arobases: Don't use "t.GetDatabaseTransaction().ExecuteMultiLines()" here
+        db.ExecuteMultiLines(query, true);
+
+        if (!t.GetDatabaseTransaction().DoesTriggerExist("ChangeAdding") ||
+            !t.GetDatabaseTransaction().DoesTriggerExist("ChangeAdded"))
+        {
+          ThrowCannotCreateTrigger();
+        }
+
+        revision = 17;
+        SetGlobalIntegerProperty(manager, MISSING_SERVER_IDENTIFIER, Orthanc::GlobalProperty_DatabasePatchLevel, revision);
+
+        t.Commit();
+      }
 
-      if (revision != 8)
+      if (revision != 17)
       {
         LOG(ERROR) << "MySQL plugin is incompatible with database schema revision: " << revision;
         throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);        
       }
+
+      if (parameters_.IsMultiWriter())
+      {
+        // The unique index on the public IDs, that is required by the
+        // "ON DUPLICATE KEY" of "CreateInstanceMultiWriter", is not
+        // part of the schema revisions, as the single-writer mode
+        // doesn't need it
+        DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+
+        if (!t.GetDatabaseTransaction().DoesIndexExist("PublicIndex2"))
+        {
+          if (IsReadOnly())
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_Database,
+                                            "The multi-writer mode cannot create its unique index in read-only mode");
+          }
+
+          LOG(WARNING) << "Creating the unique index on the public IDs for the multi-writer mode";
+          t.GetDatabaseTransaction().ExecuteMultiLines(
+            "CREATE UNIQUE INDEX PublicIndex2 ON Resources(publicId, resourceType)");
+        }
+
+        t.Commit();
+      }
+
+      {
+        // The optional FULLTEXT index to speed up the wildcard
+        // lookups is not part of the schema revisions
+        DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+
+        const bool hasIndex = t.GetDatabaseTransaction().DoesIndexExist("DicomIdentifiersFullTextIndex");
+
+        if (IsReadOnly())
+        {
+          if (wildcardIndex_ && !hasIndex)
+          {
+            LOG(WARNING) << "The FULLTEXT index for wildcard lookups cannot be created in read-only mode";
+            wildcardIndex_ = false;
+          }
+        }
+        else if (wildcardIndex_ && !hasIndex)
+        {
+          LOG(WARNING) << "Creating the FULLTEXT index for wildcard lookups, this may take a while";
+          t.GetDatabaseTransaction().ExecuteMultiLines(
+            "CREATE FULLTEXT INDEX DicomIdentifiersFullTextIndex ON DicomIdentifiers(value) WITH PARSER ngram");
+        }
+        else if (!wildcardIndex_ && hasIndex)
+        {
+          LOG(WARNING) << "Dropping the FULLTEXT index for wildcard lookups";
+          t.GetDatabaseTransaction().ExecuteMultiLines(
+            "DROP INDEX DicomIdentifiersFullTextIndex ON DicomIdentifiers");
+        }
+
+        t.Commit();
+      }
+
+      if (HasCacheInvalidations())
+      {
+        // The table of the invalidations of the caches that are
+        // exchanged between the Orthanc servers (cf. "CacheInvalidations.h")
+        // is not part of the schema revisions either
+        DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+
+        if (!t.GetDatabaseTransaction().DoesTableExist("CacheInvalidations"))
+        {
+          if (IsReadOnly())
+          {
+            LOG(WARNING) << "The table of the cache invalidations cannot be created in read-only mode";
+            SetCacheInvalidations(false);
+          }
+          else
+          {
+            t.GetDatabaseTransaction().ExecuteMultiLines(
+              "CREATE TABLE CacheInvalidations(seq BIGINT NOT NULL AUTO_INCREMENT PRIMARY KEY, "
+              "server VARCHAR(64) NOT NULL, type INTEGER NOT NULL, internalId BIGINT NOT NULL, "
+              "value VARCHAR(255) NOT NULL, date VARCHAR(64) NOT NULL)");
+          }
+        }
+
+        if (!IsReadOnly() &&
+            HasCacheInvalidations() &&
+            !t.GetDatabaseTransaction().DoesIndexExist("CacheInvalidationsDate"))
+        {
+          // The table is polled by date (cf. "IndexBackend::PollCacheInvalidations()")
+          t.GetDatabaseTransaction().ExecuteMultiLines(
+            "CREATE INDEX CacheInvalidationsDate ON CacheInvalidations(date)");
+        }
+
+        t.Commit();
+      }
     }
 
     
@@ -366,30 +663,21 @@ namespace OrthancDatabases
                                      const char* publicId,
                                      OrthancPluginResourceType type)
   {
-    {
-      DatabaseManager::CachedStatement statement(
-        STATEMENT_FROM_HERE, manager,
-        "INSERT INTO Resources VALUES(NULL, ${type}, ${id}, NULL)");
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "INSERT INTO Resources VALUES(NULL, ${type}, ${id}, NULL)");
     
-      statement.SetParameterType("id", ValueType_Utf8String);
-      statement.SetParameterType("type", ValueType_Integer64);
+    statement.SetParameterType("id", ValueType_Utf8String);
+    statement.SetParameterType("type", ValueType_Integer64);
 
-      Dictionary args;
-      args.SetUtf8Value("id", publicId);
-      args.SetIntegerValue("type", static_cast<int>(type));
+    Dictionary args;
+    args.SetUtf8Value("id", publicId);
+    args.SetIntegerValue("type", static_cast<int>(type));
     
-      statement.Execute(args);
-    }
-
-    {
-      DatabaseManager::CachedStatement statement(
-        STATEMENT_FROM_HERE, manager,
-        "SELECT LAST_INSERT_ID()");
+    statement.Execute(args);
 
-      statement.Execute();
-      
-      return statement.ReadInteger64(0);
-    }
+    // The generated ID comes with the result of the INSERT
+    return dynamic_cast<MySQLDatabase&>(statement.GetDatabase()).GetLastInsertId();
   }
 
 
@@ -476,49 +764,168 @@ namespace OrthancDatabases
     }
 
     {
-      DatabaseManager::CachedStatement dropTemporaryTable(
+      // The procedure stages the deleted resources into
+      // "DeletedResourcesStaging", which avoids the DDL statements
+      // of a temporary table (revision 11)
+      DatabaseManager::CachedStatement deleteResources(
         STATEMENT_FROM_HERE, manager,
-        "DROP TEMPORARY TABLE IF EXISTS DeletedResources");
-      dropTemporaryTable.Execute();
-    }
+        "CALL DeleteResources(${id})");
 
-    {
-      DatabaseManager::CachedStatement lookupResourcesToDelete(
-        STATEMENT_FROM_HERE, manager,
-        "CREATE TEMPORARY TABLE DeletedResources SELECT * FROM (SELECT internalId, resourceType, publicId FROM Resources WHERE internalId=${id} OR parentId=${id} OR parentId IN (SELECT internalId FROM Resources WHERE parentId=${id}) OR parentId IN (SELECT internalId FROM Resources WHERE parentId IN (SELECT internalId FROM Resources WHERE parentId=${id}))) AS t");
-      lookupResourcesToDelete.SetParameterType("id", ValueType_Integer64);
+      deleteResources.SetParameterType("id", ValueType_Integer64);
 
       Dictionary args;
       args.SetIntegerValue("id", id);
-      lookupResourcesToDelete.Execute(args);
+    
+      deleteResources.Execute(args);
     }
 
-    // {
-    //   DatabaseManager::CachedStatement deleteHierarchy(
-    //     STATEMENT_FROM_HERE, manager,
-    //     "DELETE FROM Resources WHERE internalId IN (SELECT internalId FROM DeletedResources)");
-    //   deleteHierarchy.Execute();
-    // }
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "SELECT resourceType, publicId FROM DeletedResourcesStaging WHERE connectionId = CONNECTION_ID()");
+
+      statement.Execute();
+
+      std::list<std::string> deleted;
+
+      while (!statement.IsDone())
+      {
+        const std::string publicId = statement.ReadString(1);
+
+        output.SignalDeletedResource(
+          publicId, static_cast<OrthancPluginResourceType>(statement.ReadInteger32(0)));
+
+        deleted.push_back(publicId);
 
+        statement.Next();
+      }
+
+      InvalidateCachedResources(manager, deleted);
+    }
 
+    if (HasCacheInvalidations())
     {
-      DatabaseManager::CachedStatement deleteResources(
+      DatabaseManager::CachedStatement statement(
         STATEMENT_FROM_HERE, manager,
-        "CALL DeleteResources(${id})");
+        "INSERT INTO CacheInvalidations(server, type, internalId, value, date) "
+        "SELECT ${server}, ${type}, internalId, publicId, ${date} FROM DeletedResourcesStaging "
+        "WHERE connectionId = CONNECTION_ID()");
 
-      deleteResources.SetParameterType("id", ValueType_Integer64);
+      statement.SetParameterType("server", ValueType_Utf8String);
+      statement.SetParameterType("type", ValueType_Integer64);
+      statement.SetParameterType("date", ValueType_Utf8String);
 
       Dictionary args;
-      args.SetIntegerValue("id", id);
-    
-      deleteResources.Execute(args);
+      args.SetUtf8Value("server", GetCacheInvalidations().GetServer());
+      args.SetIntegerValue("type", static_cast<int>(CacheInvalidationType_DeletedResource));
+      args.SetUtf8Value("date", CacheInvalidations::FormatDate(boost::posix_time::second_clock::universal_time()));
+
+      statement.Execute(args);
+    }
+
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "DELETE FROM DeletedResourcesStaging WHERE connectionId = CONNECTION_ID()");
+
+      statement.Execute();
     }
 
-    SignalDeletedResources(output, manager);
     SignalDeletedFiles(output, manager);
   }
 
   
+  std::string MySQLIndex::GetRecyclingLockClause(DatabaseManager& manager)
+  {
+    if (dynamic_cast<MySQLDatabase&>(manager.GetDatabase()).HasSkipLocked())
+    {
+      return "FOR UPDATE SKIP LOCKED";
+    }
+    else
+    {
+      return "";
+    }
+  }
+
+
+  void MySQLIndex::SetStatementTimeout(DatabaseManager& manager,
+                                       unsigned int milliseconds)
+  {
+    // The variable is set for the session, hence it must be reset by the caller
+    std::string sql;
+
+    if (dynamic_cast<MySQLDatabase&>(manager.GetDatabase()).IsMariaDB())
+    {
+      // In seconds, as a floating-point number
+      sql = ("SET SESSION max_statement_time=" + boost::lexical_cast<std::string>(milliseconds / 1000) +
+             "." + boost::lexical_cast<std::string>(1000 + milliseconds % 1000).substr(1));
+    }
+    else
+    {
+      sql = "SET SESSION max_execution_time=" + boost::lexical_cast<std::string>(milliseconds);
+    }
+
+    DatabaseManager::StandaloneStatement statement(manager, sql);
+    statement.ExecuteWithoutResult();
+  }
+
+
+  bool MySQLIndex::LookupAdvisedIndex(std::string& name,
+                                      std::string& sql,
+                                      DatabaseManager& manager,
+                                      const Orthanc::DicomTag& tag)
+  {
+    // "LOCK=NONE" doesn't block the writes while the index is built
+    name = "MainDicomTagsAdvisedValues";
+    sql = ("ALTER TABLE MainDicomTags ADD INDEX " + name +
+           " (tagGroup, tagElement, value), ALGORITHM=INPLACE, LOCK=NONE");
+    return true;
+  }
+
+
+  void MySQLIndex::ReadStatementsStatistics(Json::Value& target,
+                                            DatabaseManager& manager)
+  {
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "SELECT COUNT(*) FROM information_schema.TABLES WHERE TABLE_SCHEMA = 'performance_schema' "
+        "AND TABLE_NAME = 'events_statements_summary_by_digest'");
+
+      statement.SetReadOnly(true);
+      statement.Execute();
+
+      if (statement.IsDone() ||
+          statement.ReadInteger64(0) == 0)
+      {
+        return;  // "performance_schema" is disabled
+      }
+    }
+
+    // "SUM_TIMER_WAIT" is in picoseconds
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "SELECT DIGEST_TEXT, CAST(COUNT_STAR AS SIGNED), CAST(SUM_TIMER_WAIT DIV 1000000000 AS SIGNED) "
+      "FROM performance_schema.events_statements_summary_by_digest WHERE SCHEMA_NAME = DATABASE() "
+      "AND (DIGEST_TEXT LIKE '%MainDicomTags%' OR DIGEST_TEXT LIKE '%DicomIdentifiers%') "
+      "ORDER BY SUM_TIMER_WAIT DESC LIMIT 10");
+
+    statement.SetReadOnly(true);
+    statement.Execute();
+
+    while (!statement.IsDone())
+    {
+      Json::Value item;
+      item["Query"] = statement.ReadString(0);
+      item["Calls"] = static_cast<Json::Int64>(statement.ReadInteger64(1));
+      item["TotalMilliseconds"] = static_cast<Json::Int64>(statement.ReadInteger64(2));
+      target.append(item);
+
+      statement.Next();
+    }
+  }
+
+
   int64_t MySQLIndex::GetLastChangeIndex(DatabaseManager& manager)
   {
     DatabaseManager::CachedStatement statement(
@@ -532,6 +939,112 @@ namespace OrthancDatabases
   }
 
 
+  int64_t MySQLIndex::ReadFastStatistics(DatabaseManager& manager,
+                                         int property)
+  {
+    // The value in "GlobalIntegers" is completed by the changes that
+    // have not been folded yet by "UpdateStatistics()"
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "SELECT (SELECT value FROM GlobalIntegers WHERE property = ${property}) + "
+      "(SELECT COALESCE(SUM(value), 0) FROM GlobalIntegersChanges WHERE property = ${property})");
+
+    statement.SetReadOnly(true);
+    statement.SetParameterType("property", ValueType_Integer64);
+
+    Dictionary args;
+    args.SetIntegerValue("property", property);
+    statement.Execute(args);
+    statement.SetResultFieldType(0, ValueType_Integer64);
+
+    if (statement.IsDone() ||
+        statement.IsNull(0))
+    {
+      return 0;
+    }
+    else
+    {
+      return statement.ReadInteger64(0);
+    }
+  }
+
+
+  uint64_t MySQLIndex::GetTotalCompressedSize(DatabaseManager& manager)
+  {
+    return static_cast<uint64_t>(ReadFastStatistics(manager, 1));  // For "1", check out "FastStatistics.sql"
+  }
+
+  
+  uint64_t MySQLIndex::GetTotalUncompressedSize(DatabaseManager& manager)
+  {
+    return static_cast<uint64_t>(ReadFastStatistics(manager, 2));
+  }
+
+  
+  uint64_t MySQLIndex::GetResourcesCount(DatabaseManager& manager,
+                                         OrthancPluginResourceType resourceType)
+  {
+    assert(OrthancPluginResourceType_Patient == 0 &&
+           OrthancPluginResourceType_Study == 1 &&
+           OrthancPluginResourceType_Series == 2 &&
+           OrthancPluginResourceType_Instance == 3);
+
+    return static_cast<uint64_t>(ReadFastStatistics(manager, resourceType + 3));  // For the "+ 3", check out "FastStatistics.sql"
+  }
+
+
+  void MySQLIndex::UpdateAndGetStatistics(DatabaseManager& manager,
+                                          int64_t& patientsCount,
+                                          int64_t& studiesCount,
+                                          int64_t& seriesCount,
+                                          int64_t& instancesCount,
+                                          int64_t& compressedSize,
+                                          int64_t& uncompressedSize)
+  {
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "CALL UpdateStatistics(@patientsCount, @studiesCount, @seriesCount, "
+        "@instancesCount, @compressedSize, @uncompressedSize)");
+
+      statement.Execute();
+
+      if (!statement.IsDone())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);
+      }
+    }
+
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "SELECT @patientsCount, @studiesCount, @seriesCount, "
+        "@instancesCount, @compressedSize, @uncompressedSize");
+
+      statement.Execute();
+
+      for (size_t i = 0; i < 6; i++)
+      {
+        statement.SetResultFieldType(i, ValueType_Integer64);
+      }
+
+      patientsCount = statement.ReadInteger64(0);
+      studiesCount = statement.ReadInteger64(1);
+      seriesCount = statement.ReadInteger64(2);
+      instancesCount = statement.ReadInteger64(3);
+      compressedSize = statement.ReadInteger64(4);
+      uncompressedSize = statement.ReadInteger64(5);
+    }
+  }
+
+
+  void MySQLIndex::PerformDbHousekeeping(DatabaseManager& manager)
+  {
+    int64_t patientsCount, studiesCount, seriesCount, instancesCount, compressedSize, uncompressedSize;
+    UpdateAndGetStatistics(manager, patientsCount, studiesCount, seriesCount, instancesCount, compressedSize, uncompressedSize);
+  }
+
+
 #if ORTHANC_PLUGINS_HAS_DATABASE_CONSTRAINT == 1
   void MySQLIndex::CreateInstance(OrthancPluginCreateInstanceResult& result,
                                   DatabaseManager& manager,
@@ -541,12 +1054,14 @@ namespace OrthancDatabases
                                   const char* hashInstance)
   {
     {
-      DatabaseManager::CachedStatement statement(
-        STATEMENT_FROM_HERE, manager,
-        "CALL CreateInstance(${patient}, ${study}, ${series}, ${instance}, "
+      const std::string sql = (
+        std::string(parameters_.IsMultiWriter() ? "CALL CreateInstanceMultiWriter" : "CALL CreateInstance") +
+        "(${patient}, ${study}, ${series}, ${instance}, "
         "@isNewPatient, @isNewStudy, @isNewSeries, @isNewInstance, "
         "@patientKey, @studyKey, @seriesKey, @instanceKey)");
 
+      DatabaseManager::CachedStatement statement(STATEMENT_FROM_HERE_DYNAMIC(sql), manager, sql);
+
       statement.SetParameterType("patient", ValueType_Utf8String);
       statement.SetParameterType("study", ValueType_Utf8String);
       statement.SetParameterType("series", ValueType_Utf8String);
@@ -591,7 +1106,13 @@ namespace OrthancDatabases
         result.studyId = statement.ReadInteger64(5);
         result.seriesId = statement.ReadInteger64(6);
       }
-    }   
+    }
+
+    if (result.isNewInstance &&
+        result.isNewStudy)
+    {
+      SignalCacheInvalidation(manager, CacheInvalidationType_NewStudy, result.studyId, "");
+    }
   }
 #endif
 
@@ -606,6 +1127,21 @@ namespace OrthancDatabases
 
 
 #if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 5)
+  void MySQLIndex::CollectDatabaseMetrics(std::map<std::string, float>& metrics,
+                                          DatabaseManager& manager)
+  {
+    IndexBackend::CollectDatabaseMetrics(metrics, manager);
+
+    // The client library doesn't count the uncompressed bytes, so the
+    // ratio is not available: Only report whether it is negotiated
+    std::string compression;
+    if (dynamic_cast<MySQLDatabase&>(manager.GetDatabase()).LookupSessionStatus(compression, "Compression"))
+    {
+      metrics["orthanc_index_protocol_compression"] = (compression == "ON" ? 1.0f : 0.0f);
+    }
+  }
+
+
   // void MySQLIndex::ExecuteFind(Orthanc::DatabasePluginMessages::TransactionResponse& response,
   //                              DatabaseManager& manager,
   //                              const Orthanc::DatabasePluginMessages::Find_Request& request)
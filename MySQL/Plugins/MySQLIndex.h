@@ -32,7 +32,13 @@ namespace OrthancDatabases
   {
   private:
     MySQLParameters        parameters_;
+    std::unique_ptr<MySQLParameters>  replicaParameters_;
+    size_t                 replicaConnectionsCount_;
     bool                   clearAll_;
+    bool                   wildcardIndex_;
+
+    int64_t ReadFastStatistics(DatabaseManager& manager,
+                               int property);
 
   protected:
     virtual bool HasChildCountTable() const
@@ -40,6 +46,28 @@ namespace OrthancDatabases
       return false;
     }
 
+    // "FOR UPDATE SKIP LOCKED" on MySQL >= 8.0 and MariaDB >= 10.6
+    virtual std::string GetRecyclingLockClause(DatabaseManager& manager) ORTHANC_OVERRIDE;
+
+    // "max_execution_time" on MySQL (only for "SELECT"), "max_statement_time" on MariaDB
+    virtual void SetStatementTimeout(DatabaseManager& manager,
+                                     unsigned int milliseconds) ORTHANC_OVERRIDE;
+
+    // One index for all the tags, as MySQL has no partial index
+    virtual bool LookupAdvisedIndex(std::string& name,
+                                    std::string& sql,
+                                    DatabaseManager& manager,
+                                    const Orthanc::DicomTag& tag) ORTHANC_OVERRIDE;
+
+    // Reads "performance_schema", if it is enabled
+    virtual void ReadStatementsStatistics(Json::Value& target,
+                                          DatabaseManager& manager) ORTHANC_OVERRIDE;
+
+    virtual bool HasWildcardFullTextIndex() const ORTHANC_OVERRIDE
+    {
+      return wildcardIndex_;
+    }
+
   public:
     MySQLIndex(OrthancPluginContext* context,
                const MySQLParameters& parameters,
@@ -50,15 +78,32 @@ namespace OrthancDatabases
       clearAll_ = clear;
     }
 
+    // Creates (or drops) the FULLTEXT index with the "ngram" parser on
+    // "DicomIdentifiers.value", which requires MySQL >= 5.7.6
+    void SetWildcardIndex(bool enabled)
+    {
+      wildcardIndex_ = enabled;
+    }
+
     virtual IDatabaseFactory* CreateDatabaseFactory() ORTHANC_OVERRIDE;
 
+    void SetReplica(const MySQLParameters& parameters,
+                    size_t countConnections);
+
+    virtual size_t GetReplicaConnectionsCount() const ORTHANC_OVERRIDE
+    {
+      return replicaConnectionsCount_;
+    }
+
+    virtual IDatabaseFactory* CreateReplicaDatabaseFactory() ORTHANC_OVERRIDE;
+
     virtual void ConfigureDatabase(DatabaseManager& database,
                                    bool hasIdentifierTags,
                                    const std::list<IdentifierTag>& identifierTags) ORTHANC_OVERRIDE;
  
     virtual bool HasRevisionsSupport() const ORTHANC_OVERRIDE
     {
-      return false;  // TODO - REVISIONS
+      return true;
     }
     
     virtual int64_t CreateResource(DatabaseManager& manager,
@@ -72,6 +117,34 @@ namespace OrthancDatabases
 
     virtual int64_t GetLastChangeIndex(DatabaseManager& manager) ORTHANC_OVERRIDE;
 
+    virtual uint64_t GetTotalCompressedSize(DatabaseManager& manager) ORTHANC_OVERRIDE;
+
+    virtual uint64_t GetTotalUncompressedSize(DatabaseManager& manager) ORTHANC_OVERRIDE;
+
+    virtual uint64_t GetResourcesCount(DatabaseManager& manager,
+                                       OrthancPluginResourceType resourceType) ORTHANC_OVERRIDE;
+
+    virtual bool HasUpdateAndGetStatistics() ORTHANC_OVERRIDE
+    {
+      return true;
+    }
+
+    virtual void UpdateAndGetStatistics(DatabaseManager& manager,
+                                        int64_t& patientsCount,
+                                        int64_t& studiesCount,
+                                        int64_t& seriesCount,
+                                        int64_t& instancesCount,
+                                        int64_t& compressedSize,
+                                        int64_t& uncompressedSize) ORTHANC_OVERRIDE;
+
+    // Periodically folds "GlobalIntegersChanges" into "GlobalIntegers"
+    virtual bool HasPerformDbHousekeeping() ORTHANC_OVERRIDE
+    {
+      return true;
+    }
+
+    virtual void PerformDbHousekeeping(DatabaseManager& manager) ORTHANC_OVERRIDE;
+
     virtual bool HasCreateInstance() const  ORTHANC_OVERRIDE
     {
       return true;
@@ -95,6 +168,10 @@ namespace OrthancDatabases
 
 #if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 5)
     virtual bool HasFindSupport() const ORTHANC_OVERRIDE;
+
+    // Adds whether the protocol compression is active on the connection
+    virtual void CollectDatabaseMetrics(std::map<std::string, float>& metrics,
+                                        DatabaseManager& manager) ORTHANC_OVERRIDE;
 #endif
 
 #if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 5)
@@ -24,6 +24,7 @@
 #include "MySQLStorageArea.h"
 
 #include "../../Framework/Common/BinaryStringValue.h"
+#include "../../Framework/Plugins/StorageCompression.h"
 #include "../../Framework/MySQL/MySQLDatabase.h"
 #include "../../Framework/MySQL/MySQLTransaction.h"
 #include "MySQLDefinitions.h"
@@ -32,6 +33,8 @@
 #include <Logging.h>
 
 #include <boost/math/special_functions/round.hpp>
+#include <algorithm>
+#include <limits>
 
 
 namespace OrthancDatabases
@@ -62,6 +65,13 @@ namespace OrthancDatabases
                
       if (clearAll)
       {
+        // The chunks reference the files by a foreign key
+        db.ExecuteMultiLines("DROP TABLE IF EXISTS StorageAreaChunks", false);
+        db.ExecuteMultiLines("DROP TABLE IF EXISTS StorageAreaContents", false);
+        db.ExecuteMultiLines("DROP TABLE IF EXISTS StorageAreaDuplicates", false);
+        db.ExecuteMultiLines("DROP TABLE IF EXISTS StorageAreaUsage", false);
+        db.ExecuteMultiLines("DROP TABLE IF EXISTS StorageAreaSizes", false);
+        db.ExecuteMultiLines("DROP TABLE IF EXISTS StorageAreaCompressed", false);
         db.ExecuteMultiLines("DROP TABLE IF EXISTS StorageArea", false);
       }
 
@@ -70,6 +80,11 @@ namespace OrthancDatabases
                            "content LONGBLOB NOT NULL,"
                            "type INTEGER NOT NULL)", false);
 
+      {
+        boost::mutex::scoped_lock chunksLock(chunksMutex_);
+        hasChunks_ = db.DoesTableExist(t, "StorageAreaChunks");
+      }
+
       t.Commit();
     }
 
@@ -91,7 +106,9 @@ namespace OrthancDatabases
   MySQLStorageArea::MySQLStorageArea(const MySQLParameters& parameters,
                                      bool clearAll) :
     StorageBackend(MySQLDatabase::CreateDatabaseFactory(parameters),
-                   parameters.GetMaxConnectionRetries())
+                   parameters.GetMaxConnectionRetries()),
+    chunkSize_(0),
+    hasChunks_(false)
   {
     {
       AccessorBase accessor(*this);
@@ -101,20 +118,419 @@ namespace OrthancDatabases
   }
 
 
+  bool MySQLStorageArea::HasChunks()
+  {
+    boost::mutex::scoped_lock lock(chunksMutex_);
+    return hasChunks_;
+  }
+
+
+  void MySQLStorageArea::SetChunkSize(size_t chunkSize)
+  {
+    if (chunkSize > 0 &&
+        !HasChunks())
+    {
+      AccessorBase accessor(*this);
+      MySQLDatabase& db = dynamic_cast<MySQLDatabase&>(accessor.GetManager().GetDatabase());
+
+      MySQLDatabase::TransientAdvisoryLock lock(db, MYSQL_LOCK_DATABASE_SETUP);
+      MySQLTransaction t(db, TransactionType_ReadWrite);
+
+      // The chunks are removed together with their file in "StorageArea",
+      // which also covers the deferred removals
+      db.ExecuteMultiLines("CREATE TABLE IF NOT EXISTS StorageAreaChunks("
+                           "uuid VARCHAR(64) NOT NULL,"
+                           "type INTEGER NOT NULL,"
+                           "chunkIndex INTEGER NOT NULL,"
+                           "data LONGBLOB NOT NULL,"
+                           "PRIMARY KEY(uuid, type, chunkIndex),"
+                           "CONSTRAINT StorageAreaChunks1 FOREIGN KEY (uuid) REFERENCES StorageArea(uuid) ON DELETE CASCADE)", false);
+
+      t.Commit();
+
+      boost::mutex::scoped_lock chunksLock(chunksMutex_);
+      hasChunks_ = true;
+    }
+
+    chunkSize_ = chunkSize;
+  }
+
+
   class MySQLStorageArea::Accessor : public StorageBackend::AccessorBase
   {
+  private:
+    // Forwards the content to the target visitor, except if it is
+    // empty, which is the case of the row of a chunked file in
+    // "StorageArea": The visitors can only be assigned once
+    class EmptyContentDetector : public IFileContentVisitor
+    {
+    private:
+      IFileContentVisitor&  target_;
+      bool                  isEmpty_;
+
+    public:
+      explicit EmptyContentDetector(IFileContentVisitor& target) :
+        target_(target),
+        isEmpty_(false)
+      {
+      }
+
+      bool IsEmpty() const
+      {
+        return isEmpty_;
+      }
+
+      virtual void Assign(const std::string& content) ORTHANC_OVERRIDE
+      {
+        if (content.empty())
+        {
+          isEmpty_ = true;
+        }
+        else
+        {
+          target_.Assign(content);
+        }
+      }
+
+      virtual bool IsSuccess() const ORTHANC_OVERRIDE
+      {
+        return isEmpty_ || target_.IsSuccess();
+      }
+    };
+
+    MySQLStorageArea&  that_;
+
+    /**
+     * The "StorageAreaChunks" table might have been created by another
+     * Orthanc server since this one was started: Its existence is
+     * checked again if the row of a file in "StorageArea" is empty,
+     * instead of returning an empty file.
+     **/
+    bool RefreshChunks()
+    {
+      if (that_.HasChunks())
+      {
+        return true;
+      }
+
+      bool exists;
+
+      {
+        DatabaseManager::Transaction transaction(GetManager(), TransactionType_ReadOnly);
+        exists = transaction.GetDatabaseTransaction().DoesTableExist("StorageAreaChunks");
+        transaction.Commit();
+      }
+
+      if (exists)
+      {
+        boost::mutex::scoped_lock lock(that_.chunksMutex_);
+        that_.hasChunks_ = true;
+      }
+
+      return exists;
+    }
+
+    // Returns "false" if the file is not chunked. All the chunks of
+    // one file have the same size, except the last one.
+    bool LookupChunkSize(uint64_t& chunkSize,
+                         const std::string& uuid,
+                         OrthancPluginContentType type)
+    {
+      if (!that_.HasChunks())
+      {
+        return false;
+      }
+
+      bool found;
+
+      {
+        DatabaseManager::Transaction transaction(GetManager(), TransactionType_ReadOnly);
+
+        {
+          DatabaseManager::CachedStatement statement(
+            STATEMENT_FROM_HERE, GetManager(),
+            "SELECT LENGTH(data) FROM StorageAreaChunks WHERE uuid=${uuid} AND type=${type} AND chunkIndex=0");
+
+          statement.SetParameterType("uuid", ValueType_Utf8String);
+          statement.SetParameterType("type", ValueType_Integer64);
+
+          Dictionary args;
+          args.SetUtf8Value("uuid", uuid);
+          args.SetIntegerValue("type", type);
+
+          statement.Execute(args);
+
+          if (statement.IsDone())
+          {
+            found = false;
+          }
+          else
+          {
+            chunkSize = static_cast<uint64_t>(statement.ReadInteger64(0));
+            found = (chunkSize > 0);
+          }
+        }
+
+        transaction.Commit();
+      }
+
+      return found;
+    }
+
+    // Concatenates the chunks from "firstChunk" to "lastChunk", and
+    // returns "false" if the file is not chunked
+    bool ReadChunks(std::string& target,
+                    const std::string& uuid,
+                    OrthancPluginContentType type,
+                    uint64_t firstChunk,
+                    uint64_t lastChunk)
+    {
+      target.clear();
+
+      if (!that_.HasChunks())
+      {
+        return false;
+      }
+
+      bool found = false;
+
+      {
+        DatabaseManager::Transaction transaction(GetManager(), TransactionType_ReadOnly);
+
+        {
+          DatabaseManager::CachedStatement statement(
+            STATEMENT_FROM_HERE, GetManager(),
+            "SELECT chunkIndex, data FROM StorageAreaChunks WHERE uuid=${uuid} AND type=${type} "
+            "AND chunkIndex BETWEEN ${first} AND ${last} ORDER BY chunkIndex");
+
+          // The chunks are appended one by one, without buffering all of them
+          statement.SetStreaming(true);
+          statement.SetParameterType("uuid", ValueType_Utf8String);
+          statement.SetParameterType("type", ValueType_Integer64);
+          statement.SetParameterType("first", ValueType_Integer64);
+          statement.SetParameterType("last", ValueType_Integer64);
+
+          Dictionary args;
+          args.SetUtf8Value("uuid", uuid);
+          args.SetIntegerValue("type", type);
+          args.SetIntegerValue("first", static_cast<int64_t>(firstChunk));
+          args.SetIntegerValue("last", static_cast<int64_t>(lastChunk));
+
+          statement.Execute(args);
+
+          uint64_t expected = firstChunk;
+
+          while (!statement.IsDone())
+          {
+            if (statement.ReadInteger64(0) != static_cast<int64_t>(expected))
+            {
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Missing chunk in the storage area: " + uuid);
+            }
+
+            const IValue& value = statement.GetResultField(1);
+            if (value.GetType() != ValueType_BinaryString)
+            {
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);
+            }
+
+            target.append(dynamic_cast<const BinaryStringValue&>(value).GetContent());
+            found = true;
+            expected++;
+            statement.Next();
+          }
+        }
+
+        transaction.Commit();
+      }
+
+      return found;
+    }
+
+  protected:
+    virtual void InsertContent(const std::string& uuid,
+                               const void* content,
+                               size_t size,
+                               OrthancPluginContentType type) ORTHANC_OVERRIDE
+    {
+      const size_t chunkSize = that_.chunkSize_;
+
+      if (chunkSize == 0 ||
+          size <= chunkSize)
+      {
+        AccessorBase::InsertContent(uuid, content, size, type);
+        return;
+      }
+
+      {
+        // The row in "StorageArea" is kept, with an empty content, so
+        // that the other operations on the storage area are unchanged
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, GetManager(),
+          "INSERT INTO StorageArea VALUES (${uuid}, '', ${type})");
+
+        statement.SetParameterType("uuid", ValueType_Utf8String);
+        statement.SetParameterType("type", ValueType_Integer64);
+
+        Dictionary args;
+        args.SetUtf8Value("uuid", uuid);
+        args.SetIntegerValue("type", type);
+
+        statement.Execute(args);
+      }
+
+      const char* position = reinterpret_cast<const char*>(content);
+
+      for (size_t offset = 0, index = 0; offset < size; offset += chunkSize, index++)
+      {
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, GetManager(),
+          "INSERT INTO StorageAreaChunks VALUES (${uuid}, ${type}, ${index}, ${data})");
+
+        statement.SetParameterType("uuid", ValueType_Utf8String);
+        statement.SetParameterType("type", ValueType_Integer64);
+        statement.SetParameterType("index", ValueType_Integer64);
+        statement.SetParameterType("data", ValueType_InputFile);
+
+        Dictionary args;
+        args.SetUtf8Value("uuid", uuid);
+        args.SetIntegerValue("type", type);
+        args.SetIntegerValue("index", static_cast<int64_t>(index));
+        args.SetFileValue("data", position + offset, std::min(chunkSize, size - offset));
+
+        statement.Execute(args);
+      }
+    }
+
+    bool ReadWholeChunks(IFileContentVisitor& visitor,
+                         const std::string& uuid,
+                         OrthancPluginContentType type)
+    {
+      std::string content;
+      if (!ReadChunks(content, uuid, type, 0, static_cast<uint64_t>(std::numeric_limits<int32_t>::max())))
+      {
+        return false;
+      }
+
+      if (IsCompressedContent(uuid, type, content.c_str(), content.size()))
+      {
+        std::string uncompressed;
+        StorageCompression::Uncompress(uncompressed, content.c_str(), content.size());
+        visitor.Assign(uncompressed);
+      }
+      else
+      {
+        visitor.Assign(content);
+      }
+
+      if (!visitor.IsSuccess())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Could not read attachment from the storage area");
+      }
+
+      return true;
+    }
+
+    // Concatenates the chunks that overlap the range, and returns
+    // "false" if the file is not chunked
+    bool ReadRangeChunks(IFileContentVisitor& visitor,
+                         const std::string& uuid,
+                         OrthancPluginContentType type,
+                         uint64_t start,
+                         size_t length)
+    {
+      uint64_t chunkSize;
+      if (!LookupChunkSize(chunkSize, uuid, type))
+      {
+        return false;
+      }
+
+      const uint64_t firstChunk = start / chunkSize;
+      const uint64_t lastChunk = (length == 0 ? firstChunk : (start + length - 1) / chunkSize);
+
+      std::string content;
+      if (!ReadChunks(content, uuid, type, firstChunk, lastChunk))
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRange);
+      }
+
+      const uint64_t offset = start - firstChunk * chunkSize;
+      if (offset + length > content.size())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRange);
+      }
+
+      visitor.Assign(content.substr(static_cast<size_t>(offset), length));
+
+      if (!visitor.IsSuccess())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Could not read range from the storage area");
+      }
+
+      return true;
+    }
+
   public:
     explicit Accessor(MySQLStorageArea& backend) :
-      AccessorBase(backend)
+      AccessorBase(backend),
+      that_(backend)
     {
     }
 
+    virtual void ReadWhole(IFileContentVisitor& visitor,
+                           const std::string& uuid,
+                           OrthancPluginContentType type) ORTHANC_OVERRIDE
+    {
+      if (that_.HasChunks())
+      {
+        if (!ReadWholeChunks(visitor, uuid, type))
+        {
+          AccessorBase::ReadWhole(visitor, uuid, type);
+        }
+      }
+      else
+      {
+        EmptyContentDetector detector(visitor);
+        AccessorBase::ReadWhole(detector, uuid, type);
+
+        if (detector.IsEmpty())
+        {
+          // This is possibly the row of a file that was chunked by
+          // another Orthanc server since this one was started
+          if (!RefreshChunks() ||
+              !ReadWholeChunks(visitor, uuid, type))
+          {
+            visitor.Assign(std::string());
+
+            if (!visitor.IsSuccess())
+            {
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Could not read attachment from the storage area");
+            }
+          }
+        }
+      }
+    }
+
     virtual void ReadRange(IFileContentVisitor& visitor,
                            const std::string& uuid,
                            OrthancPluginContentType type,
                            uint64_t start,
                            size_t length) ORTHANC_OVERRIDE
     {
+      if (IsCompressedFile(uuid, type))
+      {
+        // "SUBSTRING()" cannot be applied to compressed files
+        AccessorBase::ReadRange(visitor, uuid, type, start, length);
+        return;
+      }
+
+      // Only fetch the chunks that overlap the range
+      if (ReadRangeChunks(visitor, uuid, type, start, length))
+      {
+        return;
+      }
+
+      bool badRange = false;
+
       DatabaseManager::Transaction transaction(GetManager(), TransactionType_ReadOnly);
 
       {
@@ -165,7 +581,7 @@ namespace OrthancDatabases
             }
             else
             {
-              throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRange);
+              badRange = true;
             }
           }
           else
@@ -177,11 +593,41 @@ namespace OrthancDatabases
 
       transaction.Commit();
 
+      if (badRange)
+      {
+        // The row of a file that was chunked by another Orthanc
+        // server is empty: Check whether the chunks have appeared
+        if (!that_.HasChunks() &&
+            RefreshChunks() &&
+            ReadRangeChunks(visitor, uuid, type, start, length))
+        {
+          return;
+        }
+        else
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRange);
+        }
+      }
+
       if (!visitor.IsSuccess())
       {
         throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Could not read range from the storage area");
       }
     }
+
+    virtual void ReadRange(IFileChunkVisitor& visitor,
+                           const std::string& uuid,
+                           OrthancPluginContentType type,
+                           uint64_t start,
+                           size_t length,
+                           size_t chunkSize) ORTHANC_OVERRIDE
+    {
+      // MySQL cannot stream a BLOB column: Only fetch the requested
+      // range using "SUBSTRING()", then split it into chunks
+      std::string content;
+      StorageBackend::ReadRangeToString(content, *this, uuid, type, start, length);
+      ResultFileValue::VisitChunks(visitor, (content.empty() ? NULL : content.c_str()), content.size(), chunkSize);
+    }
   };
   
 
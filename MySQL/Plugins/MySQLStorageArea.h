@@ -33,6 +33,12 @@ namespace OrthancDatabases
   {
   private:
     class Accessor;
+
+    size_t        chunkSize_;
+    boost::mutex  chunksMutex_;
+    bool          hasChunks_;  // Whether the "StorageAreaChunks" table exists, protected by "chunksMutex_"
+
+    bool HasChunks();
     
     void ConfigureDatabase(MySQLDatabase& db,
                            const MySQLParameters& parameters,
@@ -48,6 +54,25 @@ namespace OrthancDatabases
     MySQLStorageArea(const MySQLParameters& parameters,
                      bool clearAll);
 
+    /**
+     * The files that are larger than "chunkSize" bytes are stored as
+     * rows of at most "chunkSize" bytes in the "StorageAreaChunks"
+     * table, so that "max_allowed_packet" only has to be larger than
+     * one chunk, and so that the range reads only fetch the chunks
+     * they need. "0" disables this layout, which is the default. The
+     * chunked files can still be read once this layout is disabled,
+     * but not by the previous versions of the plugin. If another
+     * Orthanc server enables this layout later on, the chunked files
+     * are detected by their empty row in "StorageArea". This must be
+     * called before "Register()".
+     **/
+    void SetChunkSize(size_t chunkSize);
+
+    size_t GetChunkSize() const
+    {
+      return chunkSize_;
+    }
+
     virtual IAccessor* CreateAccessor() ORTHANC_OVERRIDE;
   };
 }
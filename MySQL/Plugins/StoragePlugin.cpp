@@ -25,6 +25,7 @@
 #include "../../Framework/MySQL/MySQLDatabase.h"
 #include "../../Framework/Plugins/PluginInitialization.h"
 
+#include <Compatibility.h>  // For std::unique_ptr<>
 #include <HttpClient.h>
 #include <Logging.h>
 #include <Toolbox.h>
@@ -67,8 +68,54 @@ extern "C"
     try
     {
       OrthancDatabases::MySQLParameters parameters(mysql, configuration);
-      OrthancDatabases::StorageBackend::Register(
-        context, new OrthancDatabases::MySQLStorageArea(parameters, false /* don't clear database */));
+
+      std::unique_ptr<OrthancDatabases::MySQLStorageArea> storage(
+        new OrthancDatabases::MySQLStorageArea(parameters, false /* don't clear database */));
+      storage->SetConnectionsCount(mysql.GetUnsignedIntegerValue("StorageConnectionsCount", 1));
+
+      if (mysql.GetBooleanValue("EnableStorageCompression", false))
+      {
+        storage->SetCompressed(OrthancPluginContentType_Dicom, true);
+        storage->SetCompressed(OrthancPluginContentType_DicomUntilPixelData, true);
+      }
+
+      if (mysql.GetBooleanValue("EnableDeferredRemove", false))
+      {
+        storage->SetDeferredRemove(mysql.GetUnsignedIntegerValue("DeferredRemoveBatchSize", 100),
+                                   mysql.GetUnsignedIntegerValue("DeferredRemoveInterval", 5));
+        storage->SetDeferredRemoveMaxRate(mysql.GetUnsignedIntegerValue("DeferredRemoveMaxRate", 0));
+      }
+
+      storage->SetDeduplication(mysql.GetBooleanValue("EnableStorageDeduplication", false));
+      storage->SetUsageAccounting(mysql.GetBooleanValue("EnableStorageUsageAccounting", false));
+
+      if (!mysql.GetStringValue("TieringDirectory", "").empty())
+      {
+        // "TieringAgeDays" set to "0" stops moving the files, that can still be read
+        storage->SetTiering(mysql.GetStringValue("TieringDirectory", ""),
+                            mysql.GetUnsignedIntegerValue("TieringAgeDays", 90),
+                            mysql.GetUnsignedIntegerValue("TieringBatchSize", 100),
+                            mysql.GetUnsignedIntegerValue("TieringInterval", 3600));
+      }
+
+      if (!mysql.GetBooleanValue("StoreDicom", true))
+      {
+        // By default, share the directory of the default storage area of the Orthanc core
+        storage->SetDicomDirectory(mysql.GetStringValue("DicomDirectory", configuration.GetStringValue("StorageDirectory", "OrthancStorage")));
+      }
+
+      // Expressed in MB, "0" disables the cache of the attachments
+      storage->SetAttachmentCacheSize(static_cast<uint64_t>(mysql.GetUnsignedIntegerValue("StorageCacheSize", 0)) * 1024 * 1024);
+
+      if (storage->GetAttachmentCache().IsEnabled())
+      {
+        storage->SetPrefetchThreads(mysql.GetUnsignedIntegerValue("StoragePrefetchThreads", 0));
+      }
+
+      // Expressed in KB, "0" keeps each file in a single row
+      storage->SetChunkSize(static_cast<size_t>(mysql.GetUnsignedIntegerValue("StorageChunkSize", 0)) * 1024);
+
+      OrthancDatabases::StorageBackend::Register(context, storage.release());
     }
     catch (Orthanc::OrthancException& e)
     {
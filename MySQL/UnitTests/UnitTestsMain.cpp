@@ -26,11 +26,14 @@
 
 static OrthancDatabases::MySQLParameters globalParameters_;
 
+#include "../../Framework/Common/BinaryStringValue.h"
 #include "../../Framework/Common/Integer64Value.h"
+#include "../../Framework/Common/Utf8StringValue.h"
 #include "../../Framework/MySQL/MySQLDatabase.h"
 #include "../../Framework/MySQL/MySQLResult.h"
 #include "../../Framework/MySQL/MySQLStatement.h"
 #include "../../Framework/MySQL/MySQLTransaction.h"
+#include "../../Framework/Plugins/CachesUnitTests.h"
 #include "../../Framework/Plugins/IndexUnitTests.h"
 
 #include <Compatibility.h>  // For std::unique_ptr<>
@@ -39,6 +42,7 @@ static OrthancDatabases::MySQLParameters globalParameters_;
 #include <Toolbox.h>
 
 #include <gtest/gtest.h>
+#include <boost/thread.hpp>
 
 
 TEST(MySQLIndex, Lock)
@@ -70,6 +74,168 @@ TEST(MySQLIndex, Lock)
 }
 
 
+TEST(MySQLIndex, LastChangeIndex)
+{
+  OrthancDatabases::MySQLIndex db(NULL, globalParameters_, false);
+  db.SetClearAll(true);
+
+  std::list<OrthancDatabases::IdentifierTag> identifierTags;
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+
+  OrthancDatabases::DatabaseManager::Transaction t(*manager, OrthancDatabases::TransactionType_ReadWrite);
+
+  // The row of "GlobalIntegers" is locked before each change, then updated
+  ASSERT_TRUE(dynamic_cast<OrthancDatabases::MySQLTransaction&>(t.GetDatabaseTransaction()).DoesTriggerExist("ChangeAdding"));
+  ASSERT_TRUE(dynamic_cast<OrthancDatabases::MySQLTransaction&>(t.GetDatabaseTransaction()).DoesTriggerExist("ChangeAdded"));
+  ASSERT_EQ(0, db.GetLastChangeIndex(*manager));
+
+  const int64_t a = db.CreateResource(*manager, "a", OrthancPluginResourceType_Patient);
+  const int64_t b = db.CreateResource(*manager, "b", OrthancPluginResourceType_Patient);
+  db.LogChange(*manager, 1, a, OrthancPluginResourceType_Patient, "20240101T000000");
+  db.LogChange(*manager, 1, b, OrthancPluginResourceType_Patient, "20240101T000000");
+  ASSERT_EQ(2, db.GetLastChangeIndex(*manager));
+
+  // Deleting the changes doesn't decrease the index
+  db.ClearChanges(*manager);
+  ASSERT_EQ(2, db.GetLastChangeIndex(*manager));
+
+  db.LogChange(*manager, 1, a, OrthancPluginResourceType_Patient, "20240101T000000");
+  ASSERT_EQ(3, db.GetLastChangeIndex(*manager));
+
+  t.Commit();
+}
+
+
+static void LogChangeInTransaction(OrthancDatabases::MySQLIndex* db,
+                                   OrthancDatabases::DatabaseManager* manager,
+                                   int64_t resource)
+{
+  OrthancDatabases::DatabaseManager::Transaction t(*manager, OrthancDatabases::TransactionType_ReadWrite);
+  db->LogChange(*manager, 2, resource, OrthancPluginResourceType_Patient, "20240101T000000");
+  t.Commit();
+}
+
+
+TEST(MySQLIndex, ChangesCommitOrder)
+{
+  OrthancDatabases::MySQLParameters parameters = globalParameters_;
+  parameters.SetLock(false);
+  parameters.SetMultiWriter(true);  // "READ COMMITTED", so that the poller doesn't wait for the row lock
+
+  OrthancDatabases::MySQLIndex db(NULL, parameters, false);
+  db.SetClearAll(true);
+
+  // The connections are created before the database is filled, as each of them clears the database
+  std::list<OrthancDatabases::IdentifierTag> identifierTags;
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager1(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager2(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+  std::unique_ptr<OrthancDatabases::DatabaseManager> poller(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+
+  const int64_t a = db.CreateResource(*manager1, "a", OrthancPluginResourceType_Patient);
+
+  {
+    OrthancDatabases::DatabaseManager::Transaction t1(*manager1, OrthancDatabases::TransactionType_ReadWrite);
+    db.LogChange(*manager1, 1, a, OrthancPluginResourceType_Patient, "20240101T000000");
+
+    // The second writer cannot allocate its "seq" as long as the first one is not committed
+    boost::thread writer(LogChangeInTransaction, &db, manager2.get(), a);
+    ASSERT_FALSE(writer.timed_join(boost::posix_time::milliseconds(500)));
+    ASSERT_EQ(0, db.GetLastChangeIndex(*poller));
+
+    t1.Commit();
+    writer.join();
+  }
+
+  ASSERT_EQ(2, db.GetLastChangeIndex(*poller));
+
+  {
+    // No change was skipped, and the changes were committed in the order of "seq"
+    OrthancDatabases::DatabaseManager::Transaction t(*poller, OrthancDatabases::TransactionType_ReadOnly);
+    OrthancDatabases::DatabaseManager::StandaloneStatement statement(
+      *poller, "SELECT seq, changeType FROM Changes ORDER BY seq");
+    statement.SetReadOnly(true);
+    statement.Execute();
+    statement.SetResultFieldType(0, OrthancDatabases::ValueType_Integer64);
+    statement.SetResultFieldType(1, OrthancDatabases::ValueType_Integer64);
+
+    ASSERT_FALSE(statement.IsDone());
+    ASSERT_EQ(1, statement.ReadInteger64(0));
+    ASSERT_EQ(1, statement.ReadInteger64(1));
+    statement.Next();
+    ASSERT_FALSE(statement.IsDone());
+    ASSERT_EQ(2, statement.ReadInteger64(0));
+    ASSERT_EQ(2, statement.ReadInteger64(1));
+    statement.Next();
+    ASSERT_TRUE(statement.IsDone());
+    t.Commit();
+  }
+}
+
+
+#if ORTHANC_PLUGINS_HAS_DATABASE_CONSTRAINT == 1
+TEST(MySQLIndex, MultiWriter)
+{
+  OrthancDatabases::MySQLParameters parameters = globalParameters_;
+  parameters.SetLock(false);
+  parameters.SetMultiWriter(true);
+
+  OrthancDatabases::MySQLIndex db(NULL, parameters, false);
+  db.SetClearAll(true);
+
+  std::list<OrthancDatabases::IdentifierTag> identifierTags;
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager1(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+
+  OrthancPluginCreateInstanceResult r1, r2, r3;
+  memset(&r1, 0, sizeof(r1));
+  memset(&r2, 0, sizeof(r2));
+  memset(&r3, 0, sizeof(r3));
+
+  {
+    OrthancDatabases::DatabaseManager::Transaction t(*manager1, OrthancDatabases::TransactionType_ReadWrite);
+    ASSERT_TRUE(t.GetDatabaseTransaction().DoesIndexExist("PublicIndex2"));
+
+    db.CreateInstance(r1, *manager1, "a", "b", "c", "d");
+    db.CreateInstance(r2, *manager1, "a", "b", "c", "e");
+    db.CreateInstance(r3, *manager1, "a", "b", "c", "e");
+    t.Commit();
+  }
+
+  ASSERT_TRUE(r1.isNewInstance);
+  ASSERT_TRUE(r1.isNewPatient);
+  ASSERT_TRUE(r1.isNewStudy);
+  ASSERT_TRUE(r1.isNewSeries);
+
+  ASSERT_TRUE(r2.isNewInstance);
+  ASSERT_FALSE(r2.isNewPatient);
+  ASSERT_FALSE(r2.isNewStudy);
+  ASSERT_FALSE(r2.isNewSeries);
+  ASSERT_EQ(r1.patientId, r2.patientId);
+  ASSERT_EQ(r1.studyId, r2.studyId);
+  ASSERT_EQ(r1.seriesId, r2.seriesId);
+  ASSERT_NE(r1.instanceId, r2.instanceId);
+
+  ASSERT_FALSE(r3.isNewInstance);
+  ASSERT_EQ(r2.instanceId, r3.instanceId);
+
+  {
+    // The writer of another patient is not blocked by the row lock of the first patient
+    OrthancDatabases::MySQLIndex db2(NULL, parameters, false);
+    std::unique_ptr<OrthancDatabases::DatabaseManager> manager2(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db2, false, identifierTags));
+
+    OrthancDatabases::DatabaseManager::Transaction t1(*manager1, OrthancDatabases::TransactionType_ReadWrite);
+    db.CreateInstance(r1, *manager1, "a", "b", "c", "f");
+
+    OrthancDatabases::DatabaseManager::Transaction t2(*manager2, OrthancDatabases::TransactionType_ReadWrite);
+    db2.CreateInstance(r2, *manager2, "g", "h", "i", "j");
+    ASSERT_TRUE(r2.isNewPatient);
+    t2.Commit();
+
+    t1.Commit();
+  }
+}
+#endif
+
+
 TEST(MySQL, Lock2)
 {
   OrthancDatabases::MySQLDatabase::ClearDatabase(globalParameters_);  
@@ -285,6 +451,166 @@ TEST(MySQL, StorageReadRange)
 }
 
 
+static int64_t CountChunks(OrthancDatabases::MySQLDatabase& db)
+{
+  OrthancDatabases::MySQLTransaction transaction(db, OrthancDatabases::TransactionType_ReadOnly);
+
+  int64_t count;
+  {
+    OrthancDatabases::Query query("SELECT COUNT(*) FROM StorageAreaChunks", true);
+    OrthancDatabases::MySQLStatement s(db, query);
+    OrthancDatabases::Dictionary d;
+    std::unique_ptr<OrthancDatabases::IResult> result(s.Execute(transaction, d));
+    count = dynamic_cast<const OrthancDatabases::Integer64Value&>(result->GetField(0)).GetValue();
+  }
+
+  transaction.Commit();
+  return count;
+}
+
+
+TEST(MySQL, StorageChunks)
+{
+  OrthancDatabases::MySQLParameters parameters = globalParameters_;
+  parameters.SetLock(false);
+
+  std::unique_ptr<OrthancDatabases::MySQLDatabase> database(
+    OrthancDatabases::MySQLDatabase::CreateDatabaseConnection(parameters));
+
+  OrthancDatabases::MySQLStorageArea storageArea(parameters, true /* clear database */);
+  storageArea.SetChunkSize(4);
+
+  {
+    std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor(storageArea.CreateAccessor());
+    accessor->Create("uuid", "abcd\0\1\2\3\4\5", 10, OrthancPluginContentType_Unknown);
+    accessor->Create("empty", "", 0, OrthancPluginContentType_Unknown);
+
+    ASSERT_EQ(2, CountFiles(*database));
+    ASSERT_EQ(3, CountChunks(*database));  // 4 + 4 + 2 bytes
+
+    std::string s;
+    OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor, "uuid", OrthancPluginContentType_Unknown);
+    ASSERT_EQ(std::string("abcd\0\1\2\3\4\5", 10), s);
+
+    OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor, "empty", OrthancPluginContentType_Unknown);
+    ASSERT_TRUE(s.empty());
+
+    // Ranges across the boundaries of the chunks
+    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "uuid", OrthancPluginContentType_Unknown, 2, 4);
+    ASSERT_EQ(std::string("cd\0\1", 4), s);
+
+    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "uuid", OrthancPluginContentType_Unknown, 3, 7);
+    ASSERT_EQ(std::string("d\0\1\2\3\4\5", 7), s);
+
+    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "uuid", OrthancPluginContentType_Unknown, 4, 4);
+    ASSERT_EQ(std::string("\0\1\2\3", 4), s);
+
+    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "uuid", OrthancPluginContentType_Unknown, 10, 0);
+    ASSERT_TRUE(s.empty());
+
+    ASSERT_THROW(OrthancDatabases::StorageBackend::ReadRangeToString(
+                   s, *accessor, "uuid", OrthancPluginContentType_Unknown, 8, 3), Orthanc::OrthancException);
+
+    // The chunks are removed by the cascade of the foreign key
+    accessor->Remove("uuid", OrthancPluginContentType_Unknown);
+    accessor->Remove("empty", OrthancPluginContentType_Unknown);
+    ASSERT_EQ(0, CountFiles(*database));
+    ASSERT_EQ(0, CountChunks(*database));
+  }
+
+  storageArea.SetCompressed(OrthancPluginContentType_Unknown, true);
+
+  {
+    std::string value;
+    for (int i = 0; i < 1000; i++)
+    {
+      value += "Value " + boost::lexical_cast<std::string>(i % 10);
+    }
+
+    std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor(storageArea.CreateAccessor());
+    accessor->Create("compressed", value.c_str(), value.size(), OrthancPluginContentType_Unknown);
+    ASSERT_EQ(1, CountFiles(*database));
+    ASSERT_LT(1, CountChunks(*database));
+
+    std::string s;
+    OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor, "compressed", OrthancPluginContentType_Unknown);
+    ASSERT_EQ(value, s);
+
+    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "compressed", OrthancPluginContentType_Unknown, 1001, 50);
+    ASSERT_EQ(value.substr(1001, 50), s);
+
+    accessor->Remove("compressed", OrthancPluginContentType_Unknown);
+    ASSERT_EQ(0, CountFiles(*database));
+    ASSERT_EQ(0, CountChunks(*database));
+  }
+}
+
+
+TEST(MySQL, StorageChunksEnabledLater)
+{
+  OrthancDatabases::MySQLParameters parameters = globalParameters_;
+  parameters.SetLock(false);
+
+  // These storage areas are opened before the chunks are enabled, as
+  // by other Orthanc servers that were started earlier
+  OrthancDatabases::MySQLStorageArea stale1(parameters, true /* clear database */);
+  OrthancDatabases::MySQLStorageArea stale2(parameters, false);
+
+  {
+    std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor(stale1.CreateAccessor());
+    accessor->Create("other", "efgh\6\7", 6, OrthancPluginContentType_Unknown);
+  }
+
+  OrthancDatabases::MySQLStorageArea storageArea(parameters, false);
+  storageArea.SetChunkSize(4);
+
+  {
+    std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor(storageArea.CreateAccessor());
+    accessor->Create("uuid", "abcd\0\1\2\3\4\5", 10, OrthancPluginContentType_Unknown);
+  }
+
+  {
+    std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor(stale1.CreateAccessor());
+
+    std::string s;
+    OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor, "uuid", OrthancPluginContentType_Unknown);
+    ASSERT_EQ(std::string("abcd\0\1\2\3\4\5", 10), s);
+
+    // A file that is not chunked is still read from "StorageArea"
+    OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor, "other", OrthancPluginContentType_Unknown);
+    ASSERT_EQ(std::string("efgh\6\7", 6), s);
+  }
+
+  {
+    std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor(stale2.CreateAccessor());
+
+    std::string s;
+    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "uuid", OrthancPluginContentType_Unknown, 2, 4);
+    ASSERT_EQ(std::string("cd\0\1", 4), s);
+
+    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "other", OrthancPluginContentType_Unknown, 1, 4);
+    ASSERT_EQ(std::string("fgh\6", 4), s);
+  }
+}
+
+
+#if ORTHANC_PLUGINS_HAS_DATABASE_CONSTRAINT == 1
+/**
+ * Throughput of the storage area (cf. "RunStorageBenchmark()"), in
+ * BLOBs, or in chunks of "ORTHANC_STORAGE_BENCHMARK_CHUNK_SIZE" bytes
+ * (0 by default). WARNING: The database is cleared. Run it with:
+ *
+ *   ./UnitTests <arguments> --gtest_also_run_disabled_tests --gtest_filter=MySQL.DISABLED_StorageBenchmark
+ **/
+TEST(MySQL, DISABLED_StorageBenchmark)
+{
+  OrthancDatabases::MySQLStorageArea storageArea(globalParameters_, true /* clear database */);
+  storageArea.SetChunkSize(GetBenchmarkParameter("ORTHANC_STORAGE_BENCHMARK_CHUNK_SIZE", 0));
+  RunStorageBenchmark(storageArea, "MySQL");
+}
+#endif
+
+
 TEST(MySQL, ImplicitTransaction)
 {
   OrthancDatabases::MySQLDatabase::ClearDatabase(globalParameters_);  
@@ -338,6 +664,156 @@ TEST(MySQL, ImplicitTransaction)
 }
 
 
+TEST(MySQL, Streaming)
+{
+  OrthancDatabases::MySQLDatabase::ClearDatabase(globalParameters_);  
+  OrthancDatabases::MySQLDatabase db(globalParameters_);
+  db.Open();
+
+  db.ExecuteMultiLines("CREATE TABLE test(id INT, value BLOB)", false);
+
+  {
+    OrthancDatabases::Query query("INSERT INTO test VALUES(${id}, ${value})", false);
+    query.SetType("id", OrthancDatabases::ValueType_Integer64);
+    query.SetType("value", OrthancDatabases::ValueType_InputFile);
+    std::unique_ptr<OrthancDatabases::IPrecompiledStatement> s(db.Compile(query));
+
+    OrthancDatabases::MySQLTransaction t(db, OrthancDatabases::TransactionType_ReadWrite);
+
+    for (int i = 0; i < 100; i++)
+    {
+      OrthancDatabases::Dictionary args;
+      args.SetIntegerValue("id", i);
+      args.SetFileValue("value", std::string(i, 'a'));
+      t.ExecuteWithoutResult(*s, args);
+    }
+
+    t.Commit();
+  }
+
+  for (unsigned int k = 0; k < 2; k++)
+  {
+    const bool readOnly = (k == 1);
+
+    OrthancDatabases::Query query("SELECT id, value FROM test WHERE id >= ${id} ORDER BY id", readOnly);
+    query.SetType("id", OrthancDatabases::ValueType_Integer64);
+    query.SetStreaming(true);
+    std::unique_ptr<OrthancDatabases::IPrecompiledStatement> s(db.Compile(query));
+
+    // Several executions of the same statement reuse the bind buffers
+    for (int since = 0; since < 3; since++)
+    {
+      OrthancDatabases::MySQLTransaction t(db, OrthancDatabases::TransactionType_ReadOnly);
+
+      OrthancDatabases::Dictionary args;
+      args.SetIntegerValue("id", since * 40);
+
+      std::unique_ptr<OrthancDatabases::IResult> r(t.Execute(*s, args));
+      ASSERT_EQ(2u, r->GetFieldsCount());
+
+      int count = since * 40;
+      while (!r->IsDone())
+      {
+        ASSERT_EQ(count, dynamic_cast<const OrthancDatabases::Integer64Value&>(r->GetField(0)).GetValue());
+        ASSERT_EQ(std::string(count, 'a'), dynamic_cast<const OrthancDatabases::BinaryStringValue&>(r->GetField(1)).GetContent());
+        count++;
+        r->Next();
+      }
+
+      ASSERT_EQ(100, count);
+      t.Commit();
+    }
+  }
+}
+
+
+TEST(MySQL, MultiStatements)
+{
+  OrthancDatabases::MySQLDatabase::ClearDatabase(globalParameters_);
+
+  OrthancDatabases::MySQLParameters parameters = globalParameters_;
+  parameters.SetMultiStatements(true);
+
+  OrthancDatabases::MySQLDatabase db(parameters);
+  db.Open();
+
+  db.ExecuteMultiLines("CREATE TABLE test(id INT PRIMARY KEY, name VARCHAR(64), value BLOB)", false);
+
+  OrthancDatabases::Query insert("INSERT INTO test VALUES(${id}, ${name}, ${value})", false);
+  insert.SetType("id", OrthancDatabases::ValueType_Integer64);
+  insert.SetType("name", OrthancDatabases::ValueType_Utf8String);
+  insert.SetType("value", OrthancDatabases::ValueType_BinaryString);
+  std::unique_ptr<OrthancDatabases::IPrecompiledStatement> s(db.Compile(insert));
+
+  OrthancDatabases::Query count("SELECT COUNT(*) FROM test", false);
+  std::unique_ptr<OrthancDatabases::IPrecompiledStatement> c(db.Compile(count));
+
+  const std::string name = "it's \\ \"?\" ${id}";
+  const std::string value("a\0b'\xff", 5);
+
+  {
+    OrthancDatabases::MySQLTransaction t(db, OrthancDatabases::TransactionType_ReadWrite);
+
+    for (int i = 0; i < 10; i++)
+    {
+      OrthancDatabases::Dictionary args;
+      args.SetIntegerValue("id", i);
+      args.SetUtf8Value("name", name);
+      args.SetBinaryValue("value", value);
+      t.ExecuteWithoutResult(*s, args);
+    }
+
+    // The deferred statements are sent before a statement with a result
+    OrthancDatabases::Dictionary args;
+    std::unique_ptr<OrthancDatabases::IResult> r(t.Execute(*c, args));
+    ASSERT_EQ(10, dynamic_cast<const OrthancDatabases::Integer64Value&>(r->GetField(0)).GetValue());
+    r.reset(NULL);
+
+    t.Commit();
+  }
+
+  {
+    OrthancDatabases::Query query("SELECT name, value FROM test WHERE id = 7", false);
+    std::unique_ptr<OrthancDatabases::IPrecompiledStatement> s2(db.Compile(query));
+
+    OrthancDatabases::MySQLTransaction t(db, OrthancDatabases::TransactionType_ReadOnly);
+    OrthancDatabases::Dictionary args;
+    std::unique_ptr<OrthancDatabases::IResult> r(t.Execute(*s2, args));
+    ASSERT_FALSE(r->IsDone());
+    ASSERT_EQ(name, dynamic_cast<const OrthancDatabases::Utf8StringValue&>(r->GetField(0)).GetContent());
+    ASSERT_EQ(value, dynamic_cast<const OrthancDatabases::BinaryStringValue&>(r->GetField(1)).GetContent());
+    r.reset(NULL);
+    t.Commit();
+  }
+
+  {
+    // The error of a deferred statement is reported by the commit,
+    // and the statements of the batch are rolled back
+    OrthancDatabases::MySQLTransaction t(db, OrthancDatabases::TransactionType_ReadWrite);
+
+    for (int i = 9; i < 12; i++)
+    {
+      OrthancDatabases::Dictionary args;
+      args.SetIntegerValue("id", 20 - i);
+      args.SetUtf8Value("name", name);
+      args.SetBinaryValue("value", value);
+      t.ExecuteWithoutResult(*s, args);
+    }
+
+    ASSERT_THROW(t.Commit(), Orthanc::OrthancException);
+  }
+
+  {
+    OrthancDatabases::MySQLTransaction t(db, OrthancDatabases::TransactionType_ReadOnly);
+    OrthancDatabases::Dictionary args;
+    std::unique_ptr<OrthancDatabases::IResult> r(t.Execute(*c, args));
+    ASSERT_EQ(10, dynamic_cast<const OrthancDatabases::Integer64Value&>(r->GetField(0)).GetValue());
+    r.reset(NULL);
+    t.Commit();
+  }
+}
+
+
 int main(int argc, char **argv)
 {
   if (argc < 5)
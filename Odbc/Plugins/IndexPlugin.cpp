@@ -124,6 +124,45 @@ extern "C"
       std::unique_ptr<OrthancDatabases::OdbcIndex> index(new OrthancDatabases::OdbcIndex(context, connectionString, readOnly));
       index->SetMaxConnectionRetries(maxConnectionRetries);
       index->SetConnectionRetryInterval(connectionRetryInterval);
+      index->SetMaxCachedStatements(odbc.GetUnsignedIntegerValue("MaximumCachedStatements", 256));
+      index->SetStatementsWarmup(odbc.GetUnsignedIntegerValue("StatementsWarmup", 0));
+      index->SetExportedResourcesRetention(odbc.GetUnsignedIntegerValue("ExportedResourcesRetentionDays", 0),
+                                           odbc.GetUnsignedIntegerValue("ExportedResourcesRetentionBatchSize", 10000));
+      index->SetAnalyticsExport(odbc.GetStringValue("AnalyticsExportDirectory", ""),
+                                odbc.GetUnsignedIntegerValue("AnalyticsExportBatchSize", 10000));
+      index->SetHousekeepingInterval("AnalyticsExport", odbc.GetUnsignedIntegerValue("AnalyticsExportInterval", 60));
+      index->SetHousekeepingInterval("DatabaseMetrics", odbc.GetUnsignedIntegerValue("DatabaseMetricsInterval", 0));
+      index->SetConnectionHoldWarningThreshold(odbc.GetUnsignedIntegerValue("ConnectionHoldWarningThreshold", 0));
+      index->SetSlowStatementThreshold(odbc.GetUnsignedIntegerValue("SlowStatementThreshold", 0));
+      index->SetMinConnections(odbc.GetUnsignedIntegerValue("MinIndexConnections", 0));
+      index->SetIdleConnectionsTimeout(odbc.GetUnsignedIntegerValue("IndexConnectionsIdleTimeout", 60));
+      index->SetHealthCheckInterval(odbc.GetUnsignedIntegerValue("IndexConnectionsHealthCheckInterval", 0));
+      index->SetConnectionsHandout(odbc.GetBooleanValue("IndexConnectionsLifo", false),
+                                   odbc.GetBooleanValue("IndexConnectionsAffinity", false));
+      index->SetGroupCommit(odbc.GetUnsignedIntegerValue("GroupCommitSize", 0),
+                            odbc.GetUnsignedIntegerValue("GroupCommitDelay", 5));
+      index->SetMaxConcurrentWriters(odbc.GetUnsignedIntegerValue("MaxConcurrentWriters", 0));
+      index->SetMaxInFlightTransactions(odbc.GetUnsignedIntegerValue("MaxInFlightTransactions", 0));
+      index->SetMaxResponseSize(static_cast<uint64_t>(odbc.GetUnsignedIntegerValue("MaxResponseSize", 0)) * 1024 * 1024);  // In MB
+      index->SetFailoverRetryBudget(odbc.GetUnsignedIntegerValue("FailoverRetryBudget", 0));
+      index->SetReservedConnections(odbc.GetUnsignedIntegerValue("ReservedReadOnlyConnections", 0),
+                                    odbc.GetUnsignedIntegerValue("ReservedReadWriteConnections", 0));
+      index->SetKeysetPagination(odbc.GetBooleanValue("EnableKeysetPagination", false));
+      index->SetLookupCacheSize(odbc.GetUnsignedIntegerValue("LookupCacheSize", 0));
+      index->SetChildrenPrefetch(odbc.GetBooleanValue("EnableChildrenPrefetch", false));
+      index->SetFindParallelism(odbc.GetUnsignedIntegerValue("ParallelFindConnections", 0));
+      index->SetFindTwoPhases(odbc.GetBooleanValue("EnableFindTwoPhases", false));
+      index->SetCountCacheTimeToLive(odbc.GetUnsignedIntegerValue("CountCacheTimeToLive", 0));
+      index->SetFindCacheTimeToLive(odbc.GetUnsignedIntegerValue("FindCacheTimeToLive", 0));
+      index->SetLabelsCacheTimeToLive(odbc.GetUnsignedIntegerValue("LabelsCacheTimeToLive", 0));
+      index->SetGlobalPropertiesCacheTimeToLive(odbc.GetUnsignedIntegerValue("GlobalPropertiesCacheTimeToLive", 0));
+      index->SetCaptureFile(odbc.GetStringValue("CaptureFile", ""),
+                            odbc.GetUnsignedIntegerValue("CaptureBufferSize", 1024));
+      index->SetTracesExport(odbc.GetStringValue("TracesExportUrl", ""),
+                             odbc.GetStringValue("TracesExportServiceName", "orthanc-databases"));
+      index->SetIngestStatistics(odbc.GetBooleanValue("EnableIngestStatistics", false));
+      index->SetChunkedDeletionBatchSize(odbc.GetUnsignedIntegerValue("ChunkedDeletionBatchSize", 0));
+      index->SetReplicaSource(odbc.GetBooleanValue("EnableReplicaSource", false));
 
       OrthancDatabases::IndexBackend::Register(index.release(), countConnections, maxConnectionRetries, housekeepingDelaySeconds);
     }
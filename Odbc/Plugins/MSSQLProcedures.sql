@@ -0,0 +1,155 @@
+-- Stored procedures that are only installed on Microsoft SQL Server.
+-- They mirror "CreateInstance()" and "DeleteResource()" of the
+-- PostgreSQL plugin, so that each of these operations is a single
+-- round-trip instead of one round-trip per statement.
+
+-- NB: The file is split on the semicolons, and each chunk is sent as
+-- its own batch: The bodies of the procedures must not contain any
+-- semicolon (which is optional in T-SQL)
+
+
+IF OBJECT_ID('CreateInstance', 'P') IS NOT NULL DROP PROCEDURE CreateInstance;
+
+-- Same algorithm as "IndexBackend::CreateInstanceGeneric()",
+-- including the work of "TagMostRecentPatient()"
+CREATE PROCEDURE CreateInstance
+  @patient VARCHAR(64),
+  @study VARCHAR(64),
+  @series VARCHAR(64),
+  @instance VARCHAR(64)
+AS
+BEGIN
+  SET NOCOUNT ON
+
+  DECLARE @isNewPatient BIGINT = 0
+  DECLARE @isNewStudy BIGINT = 0
+  DECLARE @isNewSeries BIGINT = 0
+  DECLARE @isNewInstance BIGINT = 0
+  DECLARE @patientKey BIGINT = NULL
+  DECLARE @studyKey BIGINT = NULL
+  DECLARE @seriesKey BIGINT = NULL
+  DECLARE @instanceKey BIGINT = NULL
+  DECLARE @seq BIGINT = NULL
+
+  SELECT @patientKey = internalId FROM Resources WHERE publicId = @patient AND resourceType = 0
+  SELECT @studyKey = internalId FROM Resources WHERE publicId = @study AND resourceType = 1
+  SELECT @seriesKey = internalId FROM Resources WHERE publicId = @series AND resourceType = 2
+  SELECT @instanceKey = internalId FROM Resources WHERE publicId = @instance AND resourceType = 3
+
+  IF @instanceKey IS NULL
+  BEGIN
+    SET @isNewInstance = 1
+
+    IF @patientKey IS NULL
+    BEGIN
+      SET @isNewPatient = 1
+      INSERT INTO Resources VALUES(0, @patient, NULL)
+      SET @patientKey = SCOPE_IDENTITY()
+
+      -- In the other database plugins, this is done with a trigger
+      INSERT INTO PatientRecyclingOrder VALUES(@patientKey)
+    END
+
+    IF @studyKey IS NULL
+    BEGIN
+      SET @isNewStudy = 1
+      INSERT INTO Resources VALUES(1, @study, @patientKey)
+      SET @studyKey = SCOPE_IDENTITY()
+    END
+
+    IF @seriesKey IS NULL
+    BEGIN
+      SET @isNewSeries = 1
+      INSERT INTO Resources VALUES(2, @series, @studyKey)
+      SET @seriesKey = SCOPE_IDENTITY()
+    END
+
+    INSERT INTO Resources VALUES(3, @instance, @seriesKey)
+    SET @instanceKey = SCOPE_IDENTITY()
+
+    -- Move the patient to the end of the recycling order, unless it
+    -- is protected (no row) or already at the end
+    SELECT @seq = seq FROM PatientRecyclingOrder WHERE patientId = @patientKey
+
+    IF @seq IS NOT NULL AND @seq < (SELECT MAX(seq) FROM PatientRecyclingOrder)
+    BEGIN
+      DELETE FROM PatientRecyclingOrder WHERE seq = @seq
+      INSERT INTO PatientRecyclingOrder VALUES(@patientKey)
+    END
+  END
+
+  SELECT @isNewPatient, @isNewStudy, @isNewSeries, @isNewInstance,
+         @patientKey, @studyKey, @seriesKey, @instanceKey
+END;
+
+
+IF OBJECT_ID('DeleteResource', 'P') IS NOT NULL DROP PROCEDURE DeleteResource;
+
+-- Same algorithm as "OdbcIndex::DeleteResource()". The deleted
+-- resources and files are left in "DeletedResources" and
+-- "DeletedFiles", and the remaining ancestor (if any) is returned,
+-- together with "0" if the resource doesn't exist.
+CREATE PROCEDURE DeleteResource
+  @id BIGINT
+AS
+BEGIN
+  SET NOCOUNT ON
+
+  DECLARE @type INT = NULL
+  DECLARE @level INT
+  DECLARE @current BIGINT = @id
+  DECLARE @ancestor BIGINT = NULL
+  DECLARE @remainingPublicId VARCHAR(64) = NULL
+  DECLARE @remainingType INT = NULL
+
+  DELETE FROM DeletedFiles
+  DELETE FROM DeletedResources
+
+  SELECT @type = resourceType, @ancestor = parentId FROM Resources WHERE internalId = @id
+
+  IF @type IS NULL
+  BEGIN
+    SELECT CAST(NULL AS VARCHAR(64)), CAST(NULL AS INT), 0
+    RETURN
+  END
+
+  INSERT INTO DeletedResources SELECT internalId, resourceType, publicId
+    FROM Resources WHERE internalId = @id
+
+  -- The descendants, level by level
+  SET @level = @type + 1
+
+  WHILE @level <= 3
+  BEGIN
+    INSERT INTO DeletedResources SELECT Resources.internalId, Resources.resourceType, Resources.publicId
+      FROM Resources INNER JOIN DeletedResources ON Resources.parentId = DeletedResources.internalId
+      WHERE Resources.resourceType = @level
+    SET @level = @level + 1
+  END
+
+  -- The ancestors that have no other child
+  WHILE @ancestor IS NOT NULL
+  BEGIN
+    IF EXISTS (SELECT 1 FROM Resources WHERE parentId = @ancestor AND internalId <> @current)
+    BEGIN
+      SELECT @remainingPublicId = publicId, @remainingType = resourceType
+        FROM Resources WHERE internalId = @ancestor
+      BREAK
+    END
+
+    INSERT INTO DeletedResources SELECT internalId, resourceType, publicId
+      FROM Resources WHERE internalId = @ancestor
+
+    SET @current = @ancestor
+    SET @ancestor = (SELECT parentId FROM Resources WHERE internalId = @current)
+  END
+
+  -- This is implemented by triggers in the PostgreSQL and MySQL plugins
+  INSERT INTO DeletedFiles SELECT AttachedFiles.* FROM AttachedFiles
+    INNER JOIN DeletedResources ON AttachedFiles.id = DeletedResources.internalId
+
+  -- The attachments are automatically deleted by DELETE CASCADE
+  DELETE FROM Resources WHERE internalId IN (SELECT internalId FROM DeletedResources)
+
+  SELECT @remainingPublicId, @remainingType, 1
+END;
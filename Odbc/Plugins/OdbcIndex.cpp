@@ -38,6 +38,11 @@
 
 // Some aliases for internal properties
 static const Orthanc::GlobalProperty GlobalProperty_LastChange = Orthanc::GlobalProperty_DatabaseInternal0;
+static const Orthanc::GlobalProperty GlobalProperty_ProceduresRevision = Orthanc::GlobalProperty_DatabaseInternal1;
+static const Orthanc::GlobalProperty GlobalProperty_SchemaRevision = Orthanc::GlobalProperty_DatabaseInternal2;
+
+// Revision of "MSSQLProcedures.sql", to be incremented if the file changes
+static const int MSSQL_PROCEDURES_REVISION = 1;
 
 
 namespace OrthancDatabases
@@ -140,7 +145,8 @@ namespace OrthancDatabases
     IndexBackend(context, readOnly),
     maxConnectionRetries_(10),
     connectionRetryInterval_(5),
-    connectionString_(connectionString)
+    connectionString_(connectionString),
+    hasProcedures_(false)
   {
   }
 
@@ -246,6 +252,69 @@ namespace OrthancDatabases
         t.Commit();
       }
     }
+
+    if (!db.DoesTableExist("labels"))
+    {
+      // Added new table "Labels" to deal with the labels that were
+      // introduced in Orthanc 1.12.0
+      DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+
+      db.ExecuteMultiLines(
+        "CREATE TABLE Labels(id BIGINT NOT NULL,"
+        "label VARCHAR(64) NOT NULL,"
+        "PRIMARY KEY(id, label),"
+        "CONSTRAINT Labels1 FOREIGN KEY (id) REFERENCES Resources(internalId) ON DELETE CASCADE);"
+        "CREATE INDEX LabelsIndex1 ON Labels(id);"
+        "CREATE INDEX LabelsIndex2 ON Labels(label);");
+
+      t.Commit();
+    }
+
+    {
+      // The changes to the tables of "PrepareIndex.sql", that are not
+      // installed by the script, so as to be applied to the existing
+      // databases as well
+      DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+
+      int revision;
+      if (!LookupGlobalIntegerProperty(revision, manager, MISSING_SERVER_IDENTIFIER, GlobalProperty_SchemaRevision))
+      {
+        revision = 0;
+      }
+
+      if (revision < 1)
+      {
+        // Composite index for the change feeds that are filtered by
+        // change type (cf. "IndexBackend::GetChangesCursor()")
+        db.ExecuteMultiLines("CREATE INDEX ChangesIndex2 ON Changes(changeType, seq)");
+        revision = 1;
+        SetGlobalIntegerProperty(manager, MISSING_SERVER_IDENTIFIER, GlobalProperty_SchemaRevision, revision);
+      }
+
+      t.Commit();
+    }
+
+    if (db.GetDialect() == Dialect_MSSQL)
+    {
+      DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+
+      int revision;
+      if (!LookupGlobalIntegerProperty(revision, manager, MISSING_SERVER_IDENTIFIER, GlobalProperty_ProceduresRevision) ||
+          revision < MSSQL_PROCEDURES_REVISION)
+      {
+        LOG(WARNING) << "Installing the stored procedures of SQL Server";
+
+        std::string sql;
+        Orthanc::EmbeddedResources::GetFileResource(sql, Orthanc::EmbeddedResources::ODBC_MSSQL_PROCEDURES);
+        db.ExecuteMultiLines(sql);
+
+        SetGlobalIntegerProperty(manager, MISSING_SERVER_IDENTIFIER, GlobalProperty_ProceduresRevision, MSSQL_PROCEDURES_REVISION);
+      }
+
+      t.Commit();
+
+      hasProcedures_ = true;
+    }
   }
 
   
@@ -358,6 +427,49 @@ namespace OrthancDatabases
                                  DatabaseManager& manager,
                                  int64_t id)
   {
+    if (hasProcedures_)
+    {
+      bool hasRemainingAncestor = false;
+      std::string remainingAncestor;
+      OrthancPluginResourceType ancestorType = OrthancPluginResourceType_None;
+
+      {
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, manager, "EXEC DeleteResource ${id}");
+        statement.SetParameterType("id", ValueType_Integer64);
+
+        Dictionary args;
+        args.SetIntegerValue("id", id);
+        statement.Execute(args);
+
+        statement.SetResultFieldType(2, ValueType_Integer64);
+
+        if (statement.IsDone() ||
+            statement.ReadInteger64(2) == 0)
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource);
+        }
+
+        if (!statement.IsNull(0))
+        {
+          statement.SetResultFieldType(1, ValueType_Integer64);
+          hasRemainingAncestor = true;
+          remainingAncestor = statement.ReadString(0);
+          ancestorType = static_cast<OrthancPluginResourceType>(statement.ReadInteger64(1));
+        }
+      }
+
+      SignalDeletedResources(output, manager);
+      SignalDeletedFiles(output, manager);
+
+      if (hasRemainingAncestor)
+      {
+        output.SignalRemainingAncestor(remainingAncestor, ancestorType);
+      }
+
+      return;
+    }
+
     /**
      * Contrarily to PostgreSQL and SQLite, the MySQL dialect
      * doesn't support cascaded delete inside the same
@@ -571,6 +683,65 @@ namespace OrthancDatabases
   }
 
 
+#if ORTHANC_PLUGINS_HAS_DATABASE_CONSTRAINT == 1
+  void OdbcIndex::CreateInstance(OrthancPluginCreateInstanceResult& result,
+                                 DatabaseManager& manager,
+                                 const char* hashPatient,
+                                 const char* hashStudy,
+                                 const char* hashSeries,
+                                 const char* hashInstance)
+  {
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "EXEC CreateInstance ${patient}, ${study}, ${series}, ${instance}");
+
+      statement.SetParameterType("patient", ValueType_Utf8String);
+      statement.SetParameterType("study", ValueType_Utf8String);
+      statement.SetParameterType("series", ValueType_Utf8String);
+      statement.SetParameterType("instance", ValueType_Utf8String);
+
+      Dictionary args;
+      args.SetUtf8Value("patient", hashPatient);
+      args.SetUtf8Value("study", hashStudy);
+      args.SetUtf8Value("series", hashSeries);
+      args.SetUtf8Value("instance", hashInstance);
+
+      statement.Execute(args);
+
+      if (statement.IsDone())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);
+      }
+
+      for (size_t i = 0; i < 8; i++)
+      {
+        statement.SetResultFieldType(i, ValueType_Integer64);
+      }
+
+      result.isNewInstance = (statement.ReadInteger64(3) == 1);
+      result.instanceId = statement.ReadInteger64(7);
+
+      if (result.isNewInstance)
+      {
+        result.isNewPatient = (statement.ReadInteger64(0) == 1);
+        result.isNewStudy = (statement.ReadInteger64(1) == 1);
+        result.isNewSeries = (statement.ReadInteger64(2) == 1);
+        result.patientId = statement.ReadInteger64(4);
+        result.studyId = statement.ReadInteger64(5);
+        result.seriesId = statement.ReadInteger64(6);
+      }
+    }
+
+    if (result.isNewInstance &&
+        result.isNewStudy)
+    {
+      SignalCacheInvalidation(manager, CacheInvalidationType_NewStudy, result.studyId, "");
+    }
+  }
+#endif
+
+
   static void ExecuteLogChange(DatabaseManager::CachedStatement& statement,
                                const Dictionary& args)
   {
@@ -696,32 +867,4 @@ namespace OrthancDatabases
 
     SignalDeletedFiles(output, manager);
   }
-
-
-#if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 5)
-  bool OdbcIndex::HasFindSupport() const
-  {
-    // TODO-FIND
-    return false;
-  }
-#endif
-
-
-#if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 5)
-  // void OdbcIndex::ExecuteFind(Orthanc::DatabasePluginMessages::TransactionResponse& response,
-  //                             DatabaseManager& manager,
-  //                             const Orthanc::DatabasePluginMessages::Find_Request& request)
-  // {
-  //   // TODO-FIND
-  //   throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
-  // }
-
-  // void OdbcIndex::ExecuteCount(Orthanc::DatabasePluginMessages::TransactionResponse& response,
-  //                              DatabaseManager& manager,
-  //                              const Orthanc::DatabasePluginMessages::Find_Request& request)
-  // {
-  //   // TODO-FIND
-  //   throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
-  // }
-#endif
 }
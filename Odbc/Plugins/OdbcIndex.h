@@ -33,6 +33,7 @@ namespace OrthancDatabases
     unsigned int maxConnectionRetries_;
     unsigned int connectionRetryInterval_;
     std::string  connectionString_;
+    bool         hasProcedures_;  // Whether the SQL Server stored procedures are installed
     
   protected:
     virtual bool HasChildCountTable() const
@@ -73,6 +74,21 @@ namespace OrthancDatabases
       return true;
     }
 
+    // Only available on SQL Server, where the stored procedures are installed
+    virtual bool HasCreateInstance() const ORTHANC_OVERRIDE
+    {
+      return hasProcedures_;
+    }
+
+#if ORTHANC_PLUGINS_HAS_DATABASE_CONSTRAINT == 1
+    virtual void CreateInstance(OrthancPluginCreateInstanceResult& result,
+                                DatabaseManager& manager,
+                                const char* hashPatient,
+                                const char* hashStudy,
+                                const char* hashSeries,
+                                const char* hashInstance) ORTHANC_OVERRIDE;
+#endif
+
     virtual int64_t CreateResource(DatabaseManager& manager,
                                    const char* publicId,
                                    OrthancPluginResourceType type) ORTHANC_OVERRIDE;
@@ -97,21 +113,7 @@ namespace OrthancDatabases
     // New primitive since Orthanc 1.12.0
     virtual bool HasLabelsSupport() const ORTHANC_OVERRIDE
     {
-      return false;
+      return true;
     }
-
-#if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 5)
-    virtual bool HasFindSupport() const ORTHANC_OVERRIDE;
-#endif
-
-#if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 5)
-    // virtual void ExecuteFind(Orthanc::DatabasePluginMessages::TransactionResponse& response,
-    //                          DatabaseManager& manager,
-    //                          const Orthanc::DatabasePluginMessages::Find_Request& request) ORTHANC_OVERRIDE;
-
-    // virtual void ExecuteCount(Orthanc::DatabasePluginMessages::TransactionResponse& response,
-    //                           DatabaseManager& manager,
-    //                           const Orthanc::DatabasePluginMessages::Find_Request& request) ORTHANC_OVERRIDE;
-#endif
   };
 }
@@ -94,6 +94,7 @@ CREATE INDEX MainDicomTagsIndex ON MainDicomTags(id);
 CREATE INDEX DicomIdentifiersIndex1 ON DicomIdentifiers(id);
 CREATE INDEX DicomIdentifiersIndex2 ON DicomIdentifiers(tagGroup, tagElement);
 CREATE INDEX DicomIdentifiersIndexValues ON DicomIdentifiers(value);
+CREATE INDEX DicomIdentifiersIndex3 ON DicomIdentifiers(tagGroup, tagElement, value);
 
 CREATE INDEX ChangesIndex ON Changes(internalId);
 
@@ -118,6 +119,16 @@ CREATE TABLE DeletedResources(
        publicId VARCHAR(64) NOT NULL
        );
 
+CREATE TABLE Labels(
+       id BIGINT NOT NULL,
+       label VARCHAR(64) NOT NULL,
+       PRIMARY KEY(id, label),
+       CONSTRAINT Labels1 FOREIGN KEY (id) REFERENCES Resources(internalId) ON DELETE CASCADE
+       );
+
+CREATE INDEX LabelsIndex1 ON Labels(id);
+CREATE INDEX LabelsIndex2 ON Labels(label);
+
 
 
 -- Set version of database to 6
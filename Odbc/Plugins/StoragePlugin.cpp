@@ -21,6 +21,7 @@
  **/
 
 
+#include "../../Framework/Common/BinaryStringValue.h"
 #include "../../Framework/Odbc/OdbcDatabase.h"
 #include "../../Framework/Plugins/PluginInitialization.h"
 #include "../../Framework/Plugins/StorageBackend.h"
@@ -28,6 +29,7 @@
 
 #include <EmbeddedResources.h>  // Autogenerated file
 
+#include <Compatibility.h>  // For std::unique_ptr<>
 #include <Logging.h>
 
 #define ORTHANC_PLUGIN_NAME "odbc-storage"
@@ -37,11 +39,134 @@ namespace OrthancDatabases
 {
   class OdbcStorageArea : public StorageBackend
   {
+  private:
+    class Accessor : public AccessorBase
+    {
+    public:
+      explicit Accessor(OdbcStorageArea& backend) :
+        AccessorBase(backend)
+      {
+      }
+
+      virtual void ReadRange(IFileContentVisitor& visitor,
+                             const std::string& uuid,
+                             OrthancPluginContentType type,
+                             uint64_t start,
+                             size_t length) ORTHANC_OVERRIDE
+      {
+        if (IsCompressedFile(uuid, type))
+        {
+          // "SUBSTRING()" cannot be applied to compressed files
+          AccessorBase::ReadRange(visitor, uuid, type, start, length);
+          return;
+        }
+
+        // The index of the first byte is 1 in all the dialects
+        std::string sql;
+
+        switch (GetManager().GetDialect())
+        {
+          case Dialect_SQLite:
+            sql = "SELECT substr(content, ${start}, ${length}) FROM StorageArea WHERE uuid=${uuid} AND type=${type}";
+            break;
+
+          case Dialect_PostgreSQL:
+            // "substring(bytea, ...)" only accepts INTEGER positions
+            sql = ("SELECT substring(content FROM CAST(${start} AS INTEGER) FOR CAST(${length} AS INTEGER)) "
+                   "FROM StorageArea WHERE uuid=${uuid} AND type=${type}");
+            break;
+
+          case Dialect_MySQL:
+          case Dialect_MSSQL:
+            sql = "SELECT SUBSTRING(content, ${start}, ${length}) FROM StorageArea WHERE uuid=${uuid} AND type=${type}";
+            break;
+
+          default:
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_NotImplemented);
+        }
+
+        DatabaseManager::Transaction transaction(GetManager(), TransactionType_ReadOnly);
+
+        {
+          DatabaseManager::CachedStatement statement(STATEMENT_FROM_HERE_DYNAMIC(sql), GetManager(), sql);
+
+          statement.SetParameterType("uuid", ValueType_Utf8String);
+          statement.SetParameterType("type", ValueType_Integer64);
+          statement.SetParameterType("start", ValueType_Integer64);
+          statement.SetParameterType("length", ValueType_Integer64);
+
+          Dictionary args;
+          args.SetUtf8Value("uuid", uuid);
+          args.SetIntegerValue("type", type);
+          args.SetIntegerValue("start", start + 1);
+          args.SetIntegerValue("length", length);
+
+          statement.Execute(args);
+
+          if (statement.IsDone())
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_UnknownResource);
+          }
+          else if (statement.GetResultFieldsCount() != 1)
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);
+          }
+          else
+          {
+            const IValue& value = statement.GetResultField(0);
+
+            if (value.GetType() == ValueType_BinaryString)
+            {
+              const std::string& content = dynamic_cast<const BinaryStringValue&>(value).GetContent();
+
+              if (static_cast<uint64_t>(content.size()) == length)
+              {
+                visitor.Assign(content);
+              }
+              else
+              {
+                throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRange);
+              }
+            }
+            else if (value.GetType() == ValueType_Null &&
+                     length == 0)
+            {
+              visitor.Assign("");
+            }
+            else
+            {
+              throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);
+            }
+          }
+        }
+
+        transaction.Commit();
+
+        if (!visitor.IsSuccess())
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Could not read range from the storage area");
+        }
+      }
+
+      virtual void ReadRange(IFileChunkVisitor& visitor,
+                             const std::string& uuid,
+                             OrthancPluginContentType type,
+                             uint64_t start,
+                             size_t length,
+                             size_t chunkSize) ORTHANC_OVERRIDE
+      {
+        // Only fetch the requested range, then split it into chunks
+        std::string content;
+        StorageBackend::ReadRangeToString(content, *this, uuid, type, start, length);
+        ResultFileValue::VisitChunks(visitor, (content.empty() ? NULL : content.c_str()), content.size(), chunkSize);
+      }
+    };
+
   protected:
     virtual bool HasReadRange() const ORTHANC_OVERRIDE
     {
-      // Read range is only available in native PostgreSQL/MySQL plugins
-      return false;
+      // The range is extracted by the database, using "SUBSTRING()"
+      return true;
     }
 
   public:
@@ -91,6 +216,11 @@ namespace OrthancDatabases
         }
       }
     }
+
+    virtual IAccessor* CreateAccessor() ORTHANC_OVERRIDE
+    {
+      return new Accessor(*this);
+    }
   };
 }
 
@@ -166,9 +296,50 @@ extern "C"
                                         "No connection string provided for the ODBC storage area");
       }
 
-      OrthancDatabases::StorageBackend::Register(
-        context, new OrthancDatabases::OdbcStorageArea(
-          maxConnectionRetries, connectionRetryInterval, connectionString));
+      std::unique_ptr<OrthancDatabases::OdbcStorageArea> storage(
+        new OrthancDatabases::OdbcStorageArea(maxConnectionRetries, connectionRetryInterval, connectionString));
+      storage->SetConnectionsCount(odbc.GetUnsignedIntegerValue("StorageConnectionsCount", 1));
+
+      if (odbc.GetBooleanValue("EnableStorageCompression", false))
+      {
+        storage->SetCompressed(OrthancPluginContentType_Dicom, true);
+        storage->SetCompressed(OrthancPluginContentType_DicomUntilPixelData, true);
+      }
+
+      if (odbc.GetBooleanValue("EnableDeferredRemove", false))
+      {
+        storage->SetDeferredRemove(odbc.GetUnsignedIntegerValue("DeferredRemoveBatchSize", 100),
+                                   odbc.GetUnsignedIntegerValue("DeferredRemoveInterval", 5));
+        storage->SetDeferredRemoveMaxRate(odbc.GetUnsignedIntegerValue("DeferredRemoveMaxRate", 0));
+      }
+
+      storage->SetDeduplication(odbc.GetBooleanValue("EnableStorageDeduplication", false));
+      storage->SetUsageAccounting(odbc.GetBooleanValue("EnableStorageUsageAccounting", false));
+
+      if (!odbc.GetStringValue("TieringDirectory", "").empty())
+      {
+        // "TieringAgeDays" set to "0" stops moving the files, that can still be read
+        storage->SetTiering(odbc.GetStringValue("TieringDirectory", ""),
+                            odbc.GetUnsignedIntegerValue("TieringAgeDays", 90),
+                            odbc.GetUnsignedIntegerValue("TieringBatchSize", 100),
+                            odbc.GetUnsignedIntegerValue("TieringInterval", 3600));
+      }
+
+      if (!odbc.GetBooleanValue("StoreDicom", true))
+      {
+        // By default, share the directory of the default storage area of the Orthanc core
+        storage->SetDicomDirectory(odbc.GetStringValue("DicomDirectory", configuration.GetStringValue("StorageDirectory", "OrthancStorage")));
+      }
+
+      // Expressed in MB, "0" disables the cache of the attachments
+      storage->SetAttachmentCacheSize(static_cast<uint64_t>(odbc.GetUnsignedIntegerValue("StorageCacheSize", 0)) * 1024 * 1024);
+
+      if (storage->GetAttachmentCache().IsEnabled())
+      {
+        storage->SetPrefetchThreads(odbc.GetUnsignedIntegerValue("StoragePrefetchThreads", 0));
+      }
+
+      OrthancDatabases::StorageBackend::Register(context, storage.release());
     }
     catch (Orthanc::OrthancException& e)
     {
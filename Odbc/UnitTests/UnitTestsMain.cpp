@@ -26,6 +26,7 @@
 static std::string connectionString_;
 
 #include "../../Framework/Odbc/OdbcEnvironment.h"
+#include "../../Framework/Plugins/CachesUnitTests.h"
 #include "../../Framework/Plugins/IndexUnitTests.h"
 
 #include <Logging.h>
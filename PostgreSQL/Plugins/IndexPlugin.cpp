@@ -22,8 +22,11 @@
 
 
 #include "PostgreSQLIndex.h"
+#include "../../Framework/PostgreSQL/PostgreSQLDatabase.h"
+#include "../../Framework/PostgreSQL/PostgreSQLSlowStatementsExplainer.h"
 #include "../../Framework/Plugins/PluginInitialization.h"
 
+#include <Compatibility.h>  // For std::unique_ptr<>
 #include <Logging.h>
 #include <Toolbox.h>
 
@@ -75,12 +78,171 @@ extern "C"
     try
     {
       const size_t countConnections = postgresql.GetUnsignedIntegerValue("IndexConnectionsCount", 50);
-      const unsigned int housekeepingDelaySeconds = 5;  // TODO - PARAMETER
+      const unsigned int housekeepingDelaySeconds = postgresql.GetUnsignedIntegerValue("HousekeepingInterval", 5);
 
       OrthancDatabases::PostgreSQLParameters parameters(postgresql);
+      parameters.LoadSessionSettings(postgresql);  // Only for the index, and inherited by the replica
+
+      if (parameters.IsPipelineMode() &&
+          !OrthancDatabases::PostgreSQLDatabase::IsPipelineModeSupported())
+      {
+        LOG(WARNING) << "The \"EnablePipelineMode\" option is ignored, as the PostgreSQL client library is older than 14";
+      }
+
+      if (!parameters.GetProtocolCompression().empty() &&
+          !OrthancDatabases::PostgreSQLDatabase::IsProtocolCompressionSupported())
+      {
+        LOG(WARNING) << "The \"ProtocolCompression\" option is ignored, as the PostgreSQL client library doesn't support it";
+        parameters.SetProtocolCompression("");
+      }
+
+      std::unique_ptr<OrthancDatabases::PostgreSQLIndex> index(
+        new OrthancDatabases::PostgreSQLIndex(context, parameters, readOnly));
+      index->SetMaxCachedStatements(postgresql.GetUnsignedIntegerValue("MaximumCachedStatements", 256));
+      index->SetStatementsWarmup(postgresql.GetUnsignedIntegerValue("StatementsWarmup", 0));
+      index->SetExportedResourcesRetention(postgresql.GetUnsignedIntegerValue("ExportedResourcesRetentionDays", 0),
+                                           postgresql.GetUnsignedIntegerValue("ExportedResourcesRetentionBatchSize", 10000));
+      index->SetAnalyticsExport(postgresql.GetStringValue("AnalyticsExportDirectory", ""),
+                                postgresql.GetUnsignedIntegerValue("AnalyticsExportBatchSize", 10000));
+      index->SetHousekeepingInterval("AnalyticsExport", postgresql.GetUnsignedIntegerValue("AnalyticsExportInterval", 60));
+      index->SetHousekeepingInterval("DatabaseMetrics", postgresql.GetUnsignedIntegerValue("DatabaseMetricsInterval", 0));
+      index->SetConnectionHoldWarningThreshold(postgresql.GetUnsignedIntegerValue("ConnectionHoldWarningThreshold", 0));
+      index->SetSlowStatementThreshold(postgresql.GetUnsignedIntegerValue("SlowStatementThreshold", 0));
+      index->SetMinConnections(postgresql.GetUnsignedIntegerValue("MinIndexConnections", 0));
+      index->SetIdleConnectionsTimeout(postgresql.GetUnsignedIntegerValue("IndexConnectionsIdleTimeout", 60));
+      index->SetHealthCheckInterval(postgresql.GetUnsignedIntegerValue("IndexConnectionsHealthCheckInterval", 0));
+      index->SetConnectionsHandout(postgresql.GetBooleanValue("IndexConnectionsLifo", false),
+                                   postgresql.GetBooleanValue("IndexConnectionsAffinity", false));
+      index->SetGroupCommit(postgresql.GetUnsignedIntegerValue("GroupCommitSize", 0),
+                            postgresql.GetUnsignedIntegerValue("GroupCommitDelay", 5));
+      index->SetMaxConcurrentWriters(postgresql.GetUnsignedIntegerValue("MaxConcurrentWriters", 0));
+      index->SetMaxInFlightTransactions(postgresql.GetUnsignedIntegerValue("MaxInFlightTransactions", 0));
+      index->SetFailoverRetryBudget(postgresql.GetUnsignedIntegerValue("FailoverRetryBudget", 0));
+      index->SetReservedConnections(postgresql.GetUnsignedIntegerValue("ReservedReadOnlyConnections", 0),
+                                    postgresql.GetUnsignedIntegerValue("ReservedReadWriteConnections", 0));
+      index->SetKeysetPagination(postgresql.GetBooleanValue("EnableKeysetPagination", false));
+      index->SetLookupCacheSize(postgresql.GetUnsignedIntegerValue("LookupCacheSize", 0));
+      index->SetChildrenPrefetch(postgresql.GetBooleanValue("EnableChildrenPrefetch", false));
+      index->SetFindParallelism(postgresql.GetUnsignedIntegerValue("ParallelFindConnections", 0));
+      index->SetFindTwoPhases(postgresql.GetBooleanValue("EnableFindTwoPhases", false));
+      index->SetFindJsonAggregation(postgresql.GetBooleanValue("EnableFindJsonAggregation", false));
+      index->SetFindStatementTimeout(postgresql.GetUnsignedIntegerValue("FindStatementTimeout", 0));
+      index->SetMaxResponseSize(static_cast<uint64_t>(postgresql.GetUnsignedIntegerValue("MaxResponseSize", 0)) * 1024 * 1024);  // In MB
+
+      const std::string planCacheMode = postgresql.GetStringValue("LookupPlanCacheMode", "adaptive");
+      if (planCacheMode == "auto")
+      {
+        index->SetLookupPlanCacheMode(OrthancDatabases::PlanCacheMode_Auto);
+      }
+      else if (planCacheMode == "force_custom_plan")
+      {
+        index->SetLookupPlanCacheMode(OrthancDatabases::PlanCacheMode_ForceCustom);
+      }
+      else if (planCacheMode == "adaptive")
+      {
+        index->SetLookupPlanCacheMode(OrthancDatabases::PlanCacheMode_Adaptive);
+      }
+      else
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "Bad value for \"LookupPlanCacheMode\" (must be \"auto\", "
+                                        "\"force_custom_plan\" or \"adaptive\"): " + planCacheMode);
+      }
+
+      index->SetCountCacheTimeToLive(postgresql.GetUnsignedIntegerValue("CountCacheTimeToLive", 0));
+      index->SetFindCacheTimeToLive(postgresql.GetUnsignedIntegerValue("FindCacheTimeToLive", 0));
+      index->SetLabelsCacheTimeToLive(postgresql.GetUnsignedIntegerValue("LabelsCacheTimeToLive", 0));
+      index->SetGlobalPropertiesCacheTimeToLive(postgresql.GetUnsignedIntegerValue("GlobalPropertiesCacheTimeToLive", 0));
+
+      std::set<std::string> studyColumnStore;
+      if (postgresql.LookupSetOfStrings(studyColumnStore, "StudyColumnStore", false))
+      {
+        index->SetStudyColumnStore(studyColumnStore, postgresql.GetUnsignedIntegerValue("StudyColumnStoreReloadInterval", 3600));
+      }
+
+      index->SetCaptureFile(postgresql.GetStringValue("CaptureFile", ""),
+                            postgresql.GetUnsignedIntegerValue("CaptureBufferSize", 1024));
+      index->SetTracesExport(postgresql.GetStringValue("TracesExportUrl", ""),
+                             postgresql.GetStringValue("TracesExportServiceName", "orthanc-databases"));
+      index->SetIngestStatistics(postgresql.GetBooleanValue("EnableIngestStatistics", false));
+      index->SetChunkedDeletionBatchSize(postgresql.GetUnsignedIntegerValue("ChunkedDeletionBatchSize", 0));
+      index->SetReplicaSource(postgresql.GetBooleanValue("EnableReplicaSource", false));
+      index->SetIndexAdvisor(postgresql.GetBooleanValue("EnableIndexAdvisor", false));
+      index->SetBatchIngestWrites(postgresql.GetBooleanValue("BatchIngestWrites", true));
+      index->SetResourceSummary(postgresql.GetBooleanValue("EnableResourceSummary", false));
+
+      std::set<std::string> sortKeys;
+      if (postgresql.LookupSetOfStrings(sortKeys, "SortKeys", false))
+      {
+        index->SetSortKeys(sortKeys);
+      }
+
+      index->SetStatisticsRollupBatchSize(postgresql.GetUnsignedIntegerValue("StatisticsRollupBatchSize", 10000));
+      index->SetStatisticsCacheTimeToLive(postgresql.GetUnsignedIntegerValue("StatisticsCacheTimeToLive", 0));
+      index->SetChangesNotifications(postgresql.GetBooleanValue("EnableChangesNotifications", false));
+      index->SetCacheInvalidations(postgresql.GetBooleanValue("EnableCacheInvalidations", false));
+
+      if (parameters.IsTransactionPooling() &&
+          (postgresql.GetBooleanValue("EnableChangesNotifications", false) ||
+           postgresql.GetBooleanValue("EnableCacheInvalidations", false)))
+      {
+        LOG(WARNING) << "PostgreSQL: \"LISTEN\" is not supported by a pooler in transaction mode, "
+                     << "the changes notifications and the cache invalidations require a direct connection";
+      }
+      index->SetChangesPartitions(postgresql.GetUnsignedIntegerValue("ChangesPartitionSize", 0),
+                                  postgresql.GetUnsignedIntegerValue("ChangesRetentionDays", 0));
+      index->SetStudyDateBrinIndex(postgresql.GetBooleanValue("EnableStudyDateBrinIndex", false));
+      index->SetLastUpdateIndex(postgresql.GetBooleanValue("EnableLastUpdateIndex", false));
+      index->SetUnloggedTables(postgresql.GetBooleanValue("EnableUnloggedTables", false));
+      index->SetBinaryCollation(postgresql.GetBooleanValue("EnableBinaryCollation", false));
+      index->SetCitus(postgresql.GetBooleanValue("EnableCitus", false));
+      index->SetTagsPartitions(postgresql.GetUnsignedIntegerValue("TagsPartitionsCount", 0),
+                               postgresql.GetUnsignedIntegerValue("TagsPartitioningBatchSize", 10000));
+      index->SetHousekeepingInterval("UpdateStatistics", postgresql.GetUnsignedIntegerValue("UpdateStatisticsInterval", housekeepingDelaySeconds));
+      index->SetHousekeepingInterval("ComputeMissingChildCount", postgresql.GetUnsignedIntegerValue("ComputeMissingChildCountInterval", housekeepingDelaySeconds));
+      index->SetHousekeepingInterval("RollupChildCounts", postgresql.GetUnsignedIntegerValue("RollupChildCountsInterval", housekeepingDelaySeconds));
+      index->SetHousekeepingInterval("CompactLabelsCatalog", postgresql.GetUnsignedIntegerValue("CompactLabelsCatalogInterval", housekeepingDelaySeconds));
+      index->SetHousekeepingInterval("Analyze", postgresql.GetUnsignedIntegerValue("AnalyzeInterval", 0));
+      index->SetHousekeepingInterval("OnlineUpgrades", postgresql.GetUnsignedIntegerValue("OnlineUpgradesInterval", housekeepingDelaySeconds));
+      index->SetHousekeepingInterval("ChangesPartitions", postgresql.GetUnsignedIntegerValue("ChangesPartitionsInterval", housekeepingDelaySeconds));
+      index->SetHousekeepingInterval("TagsPartitioning", postgresql.GetUnsignedIntegerValue("TagsPartitioningInterval", housekeepingDelaySeconds));
+
+      if (postgresql.GetBooleanValue("ExplainSlowStatements", false))
+      {
+        if (index->GetSlowStatementThreshold() == 0)
+        {
+          LOG(WARNING) << "The \"ExplainSlowStatements\" option is ignored, as \"SlowStatementThreshold\" is zero";
+        }
+        else
+        {
+          index->SetSlowStatementListener(new OrthancDatabases::PostgreSQLSlowStatementsExplainer(parameters));
+        }
+      }
+
+      if (postgresql.IsSection("ReadOnlyReplica"))
+      {
+        // The parameters that are not specified in the "ReadOnlyReplica"
+        // section are inherited from the primary database
+        OrthancPlugins::OrthancConfiguration replica;
+        postgresql.GetSection(replica, "ReadOnlyReplica");
+
+        OrthancDatabases::PostgreSQLParameters replicaParameters(parameters);
+        replicaParameters.SetTargetSessionAttributes("");  // Not inherited from the primary database
+        replicaParameters.LoadConnectionParameters(replica);
+
+        if (replicaParameters.GetHostsCount() > 1 &&
+            replicaParameters.GetTargetSessionAttributes().empty())
+        {
+          // Use the standby servers of the cluster, if any is available
+          replicaParameters.SetTargetSessionAttributes("prefer-standby");
+        }
+
+        index->SetReplica(replicaParameters, replica.GetUnsignedIntegerValue("IndexConnectionsCount", countConnections));
+        index->SetReplicaReadYourWrites(replica.GetBooleanValue("ReadYourWrites", false));
+      }
+
       OrthancDatabases::IndexBackend::Register(
-        new OrthancDatabases::PostgreSQLIndex(context, parameters, readOnly), countConnections,
-        parameters.GetMaxConnectionRetries(), housekeepingDelaySeconds);
+        index.release(), countConnections, parameters.GetMaxConnectionRetries(), housekeepingDelaySeconds);
     }
     catch (Orthanc::OrthancException& e)
     {
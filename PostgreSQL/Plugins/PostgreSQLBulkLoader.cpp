@@ -0,0 +1,270 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#include "PostgreSQLBulkLoader.h"
+
+#include <Logging.h>
+#include <OrthancException.h>
+
+#include <cassert>
+
+
+namespace OrthancDatabases
+{
+  PostgreSQLCopy& PostgreSQLBulkLoader::SwitchTable(Table table)
+  {
+    if (transaction_.get() == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    if (table_ != table)
+    {
+      if (copy_.get() != NULL)
+      {
+        copy_->Finish();
+        copy_.reset(NULL);
+      }
+
+      std::vector<std::string> columns;
+      std::string name;
+
+      switch (table)
+      {
+        case Table_Resources:
+          name = "Resources";
+          columns.push_back("internalId");
+          columns.push_back("resourceType");
+          columns.push_back("publicId");
+          columns.push_back("parentId");
+          columns.push_back("childCount");
+          break;
+
+        case Table_MainDicomTags:
+        case Table_DicomIdentifiers:
+          name = (table == Table_MainDicomTags ? "MainDicomTags" : "DicomIdentifiers");
+          columns.push_back("id");
+          columns.push_back("tagGroup");
+          columns.push_back("tagElement");
+          columns.push_back("value");
+          break;
+
+        case Table_Metadata:
+          name = "Metadata";
+          columns.push_back("id");
+          columns.push_back("type");
+          columns.push_back("value");
+          columns.push_back("revision");
+          break;
+
+        case Table_AttachedFiles:
+          name = "AttachedFiles";
+          columns.push_back("id");
+          columns.push_back("fileType");
+          columns.push_back("uuid");
+          columns.push_back("compressedSize");
+          columns.push_back("uncompressedSize");
+          columns.push_back("compressionType");
+          columns.push_back("uncompressedHash");
+          columns.push_back("compressedHash");
+          columns.push_back("revision");
+          break;
+
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+      }
+
+      copy_.reset(new PostgreSQLCopy(database_, name, columns));
+      table_ = table;
+    }
+
+    assert(copy_.get() != NULL);
+    return *copy_;
+  }
+
+
+  void PostgreSQLBulkLoader::AddTag(Table table,
+                                    int64_t id,
+                                    uint16_t group,
+                                    uint16_t element,
+                                    const std::string& value)
+  {
+    PostgreSQLCopy& copy = SwitchTable(table);
+    copy.BeginRow();
+    copy.AddInteger64(id);
+    copy.AddInteger32(group);
+    copy.AddInteger32(element);
+    copy.AddString(value);
+  }
+
+
+  PostgreSQLBulkLoader::PostgreSQLBulkLoader(PostgreSQLDatabase& database) :
+    database_(database),
+    table_(Table_None)
+  {
+    transaction_.reset(new PostgreSQLTransaction(database_, TransactionType_ReadWrite));
+
+    /**
+     * The triggers maintain the statistics row by row, which would be
+     * much slower than rebuilding them at the end of the load. As
+     * "ALTER TABLE" is transactional, the triggers are re-enabled if
+     * the load fails. This also locks both tables until the commit.
+     **/
+    database_.ExecuteMultiLines(
+      "ALTER TABLE Resources DISABLE TRIGGER USER;"
+      "ALTER TABLE AttachedFiles DISABLE TRIGGER USER;");
+  }
+
+
+  void PostgreSQLBulkLoader::AddResource(int64_t internalId,
+                                         OrthancPluginResourceType type,
+                                         const std::string& publicId)
+  {
+    PostgreSQLCopy& copy = SwitchTable(Table_Resources);
+    copy.BeginRow();
+    copy.AddInteger64(internalId);
+    copy.AddInteger32(type);
+    copy.AddString(publicId);
+    copy.AddNull();
+    copy.AddInteger32(0);  // The child counts are computed by "Commit()"
+  }
+
+
+  void PostgreSQLBulkLoader::AddResource(int64_t internalId,
+                                         OrthancPluginResourceType type,
+                                         const std::string& publicId,
+                                         int64_t parentId)
+  {
+    PostgreSQLCopy& copy = SwitchTable(Table_Resources);
+    copy.BeginRow();
+    copy.AddInteger64(internalId);
+    copy.AddInteger32(type);
+    copy.AddString(publicId);
+    copy.AddInteger64(parentId);
+    copy.AddInteger32(0);
+  }
+
+
+  void PostgreSQLBulkLoader::AddMainDicomTag(int64_t id,
+                                             uint16_t group,
+                                             uint16_t element,
+                                             const std::string& value)
+  {
+    AddTag(Table_MainDicomTags, id, group, element, value);
+  }
+
+
+  void PostgreSQLBulkLoader::AddIdentifierTag(int64_t id,
+                                              uint16_t group,
+                                              uint16_t element,
+                                              const std::string& value)
+  {
+    AddTag(Table_DicomIdentifiers, id, group, element, value);
+  }
+
+
+  void PostgreSQLBulkLoader::AddMetadata(int64_t id,
+                                         int32_t type,
+                                         const std::string& value,
+                                         int32_t revision)
+  {
+    PostgreSQLCopy& copy = SwitchTable(Table_Metadata);
+    copy.BeginRow();
+    copy.AddInteger64(id);
+    copy.AddInteger32(type);
+    copy.AddString(value);
+    copy.AddInteger32(revision);
+  }
+
+
+  void PostgreSQLBulkLoader::AddAttachment(int64_t id,
+                                           const OrthancPluginAttachment& attachment,
+                                           int32_t revision)
+  {
+    PostgreSQLCopy& copy = SwitchTable(Table_AttachedFiles);
+    copy.BeginRow();
+    copy.AddInteger64(id);
+    copy.AddInteger32(attachment.contentType);
+    copy.AddString(attachment.uuid);
+    copy.AddInteger64(static_cast<int64_t>(attachment.compressedSize));
+    copy.AddInteger64(static_cast<int64_t>(attachment.uncompressedSize));
+    copy.AddInteger32(attachment.compressionType);
+    copy.AddString(attachment.uncompressedHash);
+    copy.AddString(attachment.compressedHash);
+    copy.AddInteger32(revision);
+  }
+
+
+  void PostgreSQLBulkLoader::Commit()
+  {
+    if (transaction_.get() == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls);
+    }
+
+    if (copy_.get() != NULL)
+    {
+      copy_->Finish();
+      copy_.reset(NULL);
+    }
+
+    table_ = Table_None;
+
+    LOG(WARNING) << "Bulk load: Rebuilding the child counts and the statistics of the index";
+
+    database_.ExecuteMultiLines(
+      // The sequence of the internal IDs must continue after the loaded resources
+      "SELECT setval(pg_get_serial_sequence('Resources', 'internalId'), COALESCE(MAX(internalId), 0) + 1, false) FROM Resources;"
+
+      // Child counts, also for the resources that existed before the load. The pending changes
+      // are folded first, as the resources without children are not recounted.
+      "WITH deleted_rows AS (DELETE FROM ChildCountChanges RETURNING parentId, delta) "
+      "UPDATE Resources AS r SET childCount = r.childCount + s.total "
+      "  FROM (SELECT parentId, SUM(delta) AS total FROM deleted_rows GROUP BY parentId) AS s "
+      "  WHERE r.internalId = s.parentId;"
+      "UPDATE Resources AS r SET childCount = c.count "
+      "  FROM (SELECT parentId, COUNT(*) AS count FROM Resources WHERE parentId IS NOT NULL GROUP BY parentId) AS c "
+      "  WHERE r.internalId = c.parentId AND r.childCount IS DISTINCT FROM c.count;"
+
+      // New patients are the most recent ones in the recycling order (cf. "PatientAddedFunc()")
+      "INSERT INTO PatientRecyclingOrder "
+      "  SELECT nextval('patientrecyclingorder_seq_seq'), internalId FROM ("
+      "    SELECT internalId FROM Resources AS r WHERE resourceType = 0 AND "
+      "    NOT EXISTS (SELECT 1 FROM PatientRecyclingOrder AS o WHERE o.patientId = r.internalId) "
+      "    ORDER BY internalId) AS p;"
+
+      // Statistics, the pending changes being included in the new values (cf. "UpdateSingleStatistic()")
+      "DELETE FROM GlobalIntegersChanges WHERE key BETWEEN 0 AND 5;"
+      "UPDATE GlobalIntegers SET value = (SELECT COALESCE(SUM(compressedSize), 0) FROM AttachedFiles) WHERE key = 0;"
+      "UPDATE GlobalIntegers SET value = (SELECT COALESCE(SUM(uncompressedSize), 0) FROM AttachedFiles) WHERE key = 1;"
+      "UPDATE GlobalIntegers SET value = (SELECT COUNT(*) FROM Resources WHERE resourceType = GlobalIntegers.key - 2) "
+      "  WHERE key BETWEEN 2 AND 5;"
+
+      "ALTER TABLE Resources ENABLE TRIGGER USER;"
+      "ALTER TABLE AttachedFiles ENABLE TRIGGER USER;"
+      "ANALYZE Resources, MainDicomTags, DicomIdentifiers, Metadata, AttachedFiles;");
+
+    transaction_->Commit();
+    transaction_.reset(NULL);
+  }
+}
@@ -0,0 +1,108 @@
+/**
+ * Orthanc - A Lightweight, RESTful DICOM Store
+ * Copyright (C) 2012-2016 Sebastien Jodogne, Medical Physics
+ * Department, University Hospital of Liege, Belgium
+ * Copyright (C) 2017-2023 Osimis S.A., Belgium
+ * Copyright (C) 2024-2024 Orthanc Team SRL, Belgium
+ * Copyright (C) 2021-2024 Sebastien Jodogne, ICTEAM UCLouvain, Belgium
+ *
+ * This program is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Affero General Public License for more details.
+ * 
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ **/
+
+
+#pragma once
+
+#include "../../Framework/PostgreSQL/PostgreSQLCopy.h"
+#include "../../Framework/PostgreSQL/PostgreSQLTransaction.h"
+
+#include <Compatibility.h>  // For std::unique_ptr<>
+
+#include <orthanc/OrthancCDatabasePlugin.h>
+
+
+namespace OrthancDatabases
+{
+  /**
+   * Bulk load of resources into an index that has already been
+   * prepared by "PostgreSQLIndex", typically to migrate from another
+   * database. The rows are streamed using "COPY" in one transaction,
+   * during which the triggers of the "Resources" and "AttachedFiles"
+   * tables are disabled. The resources must be added before the rows
+   * that refer to them, and their internal IDs are kept as such. The
+   * child counts, the patient recycling order and the statistics are
+   * rebuilt by "Commit()". Orthanc must not be running on the same
+   * database during the load.
+   **/
+  class PostgreSQLBulkLoader : public boost::noncopyable
+  {
+  private:
+    enum Table
+    {
+      Table_None,
+      Table_Resources,
+      Table_MainDicomTags,
+      Table_DicomIdentifiers,
+      Table_Metadata,
+      Table_AttachedFiles
+    };
+
+    PostgreSQLDatabase&                     database_;
+    std::unique_ptr<PostgreSQLTransaction>  transaction_;
+    std::unique_ptr<PostgreSQLCopy>         copy_;   // Must be destroyed before "transaction_"
+    Table                                   table_;
+
+    PostgreSQLCopy& SwitchTable(Table table);
+
+    void AddTag(Table table,
+                int64_t id,
+                uint16_t group,
+                uint16_t element,
+                const std::string& value);
+
+  public:
+    explicit PostgreSQLBulkLoader(PostgreSQLDatabase& database);
+
+    // Resource without parent (i.e. a patient)
+    void AddResource(int64_t internalId,
+                     OrthancPluginResourceType type,
+                     const std::string& publicId);
+
+    void AddResource(int64_t internalId,
+                     OrthancPluginResourceType type,
+                     const std::string& publicId,
+                     int64_t parentId);
+
+    void AddMainDicomTag(int64_t id,
+                         uint16_t group,
+                         uint16_t element,
+                         const std::string& value);
+
+    void AddIdentifierTag(int64_t id,
+                          uint16_t group,
+                          uint16_t element,
+                          const std::string& value);
+
+    void AddMetadata(int64_t id,
+                     int32_t type,
+                     const std::string& value,
+                     int32_t revision);
+
+    void AddAttachment(int64_t id,
+                       const OrthancPluginAttachment& attachment,
+                       int32_t revision);
+
+    // If "Commit()" is not called, nothing is loaded
+    void Commit();
+  };
+}
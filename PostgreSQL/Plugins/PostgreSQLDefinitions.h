@@ -53,6 +53,22 @@ static const int32_t POSTGRESQL_LOCK_DATABASE_SETUP = 44;
 /**
  * Transient advisory lock to protect the instance creation,
  * because it is not 100% resilient to concurrency in, e.g, READ COMIITED 
- * transaction isolation level.
+ * transaction isolation level. In the multi-writer mode, this is the
+ * first key of the per-patient transaction-level advisory locks, the
+ * second key being the hash of the patient.
  **/
 static const int32_t POSTGRESQL_LOCK_CREATE_INSTANCE = 45;
+
+/**
+ * Transient advisory lock to protect the creation and the drop of the
+ * partitions of the "Changes" table, in the case of several Orthanc
+ * servers sharing the database (cf. "InstallChangesPartitioning.sql").
+ **/
+static const int32_t POSTGRESQL_LOCK_CHANGES_PARTITIONS = 46;
+
+/**
+ * Transient advisory lock that is held by the Orthanc server that
+ * performs the online upgrades of the schema (e.g. the concurrent
+ * creation of indexes), as several servers can share the database.
+ **/
+static const int32_t POSTGRESQL_LOCK_ONLINE_UPGRADES = 47;
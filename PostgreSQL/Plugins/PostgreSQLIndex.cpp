@@ -25,17 +25,24 @@
 
 #include "../../Framework/Plugins/GlobalProperties.h"
 #include "../../Framework/PostgreSQL/PostgreSQLDatabase.h"
+#include "../../Framework/PostgreSQL/PostgreSQLResult.h"
+#include "../../Framework/PostgreSQL/PostgreSQLStatement.h"
 #include "../../Framework/PostgreSQL/PostgreSQLTransaction.h"
 #include "PostgreSQLDefinitions.h"
 
 #include <EmbeddedResources.h>  // Auto-generated file
 
 #include <Compatibility.h>  // For std::unique_ptr<>
+#include <DicomFormat/DicomTag.h>
 #include <Toolbox.h>
 #include <SystemToolbox.h>
 #include <Logging.h>
 #include <OrthancException.h>
 
+#include <boost/lexical_cast.hpp>
+
+#include <algorithm>
+
 
 namespace Orthanc
 {
@@ -45,19 +52,229 @@ namespace Orthanc
   static const GlobalProperty GlobalProperty_HasFastCountResources = GlobalProperty_DatabaseInternal2;
   static const GlobalProperty GlobalProperty_GetLastChangeIndex = GlobalProperty_DatabaseInternal3;
   static const GlobalProperty GlobalProperty_HasComputeStatisticsReadOnly = GlobalProperty_DatabaseInternal4;
+  static const GlobalProperty GlobalProperty_HasSetResourcesContent = GlobalProperty_DatabaseInternal5;
+  static const GlobalProperty GlobalProperty_HasSerializedChangeSeq = GlobalProperty_DatabaseInternal6;
+  static const GlobalProperty GlobalProperty_HasDeleteResources = GlobalProperty_DatabaseInternal7;
+  static const GlobalProperty GlobalProperty_OnlineUpgrades = GlobalProperty_DatabaseInternal8;
 }
 
 
 namespace OrthancDatabases
 {
+  // Maximum number of statistics batches that are folded by one housekeeping pass
+  static const unsigned int STATISTICS_ROLLUP_BATCHES_PER_HOUSEKEEPING = 10;
+
+  // Number of partitions of "Changes" that are created ahead of the last change
+  static const unsigned int CHANGES_PARTITIONS_AHEAD = 2;
+
+  // Number of resources whose missing child count is computed by one housekeeping pass
+  static const unsigned int CHILD_COUNT_BATCH_SIZE = 1000;
+
+  // Key of the progress of the child count backfill in "GlobalProperty_OnlineUpgrades"
+  static const char* const ONLINE_UPGRADE_CHILD_COUNT = "ChildCount";
+
+  // Key of the SHA-1 of the last applied "PrepareIndex.sql" in "GlobalProperty_OnlineUpgrades"
+  static const char* const ONLINE_UPGRADE_PREPARE_INDEX = "PrepareIndex";
+
+
+  static void GetPrepareIndex(std::string& query,
+                              std::string& hash)
+  {
+    Orthanc::EmbeddedResources::GetFileResource
+      (query, Orthanc::EmbeddedResources::POSTGRESQL_PREPARE_INDEX);
+    Orthanc::Toolbox::ComputeSHA1(hash, query);
+  }
+
+
+  static bool IsValidIndex(PostgreSQLDatabase& db,
+                           const std::string& name)
+  {
+    std::string lower;
+    Orthanc::Toolbox::ToLowerCase(lower, name);
+
+    // An index that is left invalid by an interrupted "CREATE INDEX CONCURRENTLY" is not used
+    PostgreSQLStatement statement(db,
+                                  "SELECT 1 FROM pg_catalog.pg_index i "
+                                  "JOIN pg_catalog.pg_class c ON c.oid = i.indexrelid "
+                                  "WHERE i.indisvalid AND c.relname=$1");
+
+    statement.DeclareInputString(0);
+    statement.BindString(0, lower);
+
+    PostgreSQLResult result(statement);
+    return !result.IsDone();
+  }
+
+
   PostgreSQLIndex::PostgreSQLIndex(OrthancPluginContext* context,
                                    const PostgreSQLParameters& parameters,
                                    bool readOnly) :
     IndexBackend(context, readOnly),
     parameters_(parameters),
+    replicaConnectionsCount_(0),
     clearAll_(false),
-    hkHasComputedAllMissingChildCount_(false)
+    hkHasComputedAllMissingChildCount_(false),
+    hkHasPerformedOnlineUpgrades_(false),
+    batchIngestWrites_(true),
+    resourceSummary_(false),
+    statisticsRollupBatchSize_(10000),
+    changesNotifications_(false),
+    changesPartitionSize_(0),
+    changesRetentionDays_(0),
+    tagsPartitionsCount_(0),
+    tagsPartitioningBatchSize_(10000),
+    hkHasSwappedTagsPartitions_(false),
+    studyDateBrinIndex_(false),
+    lastUpdateIndex_(false),
+    unloggedTables_(false),
+    binaryCollation_(false),
+    hasBinaryCollation_(false),
+    citus_(false),
+    changesListenerStop_(false),
+    lastChangeIndex_(-1)
+  {
+  }
+
+
+  PostgreSQLIndex::~PostgreSQLIndex()
+  {
+    {
+      boost::mutex::scoped_lock lock(changesMutex_);
+      changesListenerStop_ = true;
+    }
+
+    if (changesListener_.joinable())
+    {
+      changesListener_.join();
+    }
+  }
+
+
+  void PostgreSQLIndex::ListenChanges()
+  {
+    PostgreSQLDatabase db(parameters_);
+    db.Open();
+
+    if (HasCacheInvalidations())
+    {
+      db.ExecuteMultiLines("LISTEN orthanc_invalidations");
+
+      // The invalidations that were published before "LISTEN" are unknown
+      ClearCaches();
+    }
+
+    if (changesNotifications_)
+    {
+      db.ExecuteMultiLines("LISTEN orthanc_changes");
+
+      // The last change index is read after "LISTEN", so that no change can be missed
+      PostgreSQLStatement statement(
+        db, "SELECT value FROM GlobalIntegers WHERE key = 6");
+
+      PostgreSQLResult result(statement);
+
+      boost::mutex::scoped_lock lock(changesMutex_);
+      lastChangeIndex_ = ((result.IsDone() || result.IsNull(0)) ? 0 : result.GetInteger64(0));
+    }
+
+    for (;;)
+    {
+      {
+        boost::mutex::scoped_lock lock(changesMutex_);
+        if (changesListenerStop_)
+        {
+          return;
+        }
+      }
+
+      std::string channel, payload;
+      if (!db.WaitForNotification(channel, payload, 100 /* check the stop flag every 100ms */))
+      {
+        continue;
+      }
+
+      if (channel == "orthanc_invalidations")
+      {
+        std::string server, value;
+        CacheInvalidationType type;
+        int64_t internalId;
+
+        if (CacheInvalidations::ParsePayload(server, type, internalId, value, payload))
+        {
+          ApplyCacheInvalidation(server, type, internalId, value);
+        }
+        else
+        {
+          LOG(WARNING) << "Ignoring a badly formatted notification of cache invalidation: " << payload;
+        }
+      }
+      else
+      {
+        int64_t seq;
+
+        try
+        {
+          seq = boost::lexical_cast<int64_t>(payload);
+        }
+        catch (boost::bad_lexical_cast&)
+        {
+          LOG(WARNING) << "Ignoring a badly formatted notification of change: " << payload;
+          continue;
+        }
+
+        boost::mutex::scoped_lock lock(changesMutex_);
+        if (seq > lastChangeIndex_)
+        {
+          lastChangeIndex_ = seq;
+        }
+      }
+    }
+  }
+
+
+  void PostgreSQLIndex::ChangesListenerThread(PostgreSQLIndex* that)
+  {
+    for (;;)
+    {
+      try
+      {
+        that->ListenChanges();
+        return;  // The index is being destroyed
+      }
+      catch (Orthanc::OrthancException& e)
+      {
+        LOG(ERROR) << "Error while listening to the notifications of changes, reconnecting: " << e.What();
+      }
+
+      {
+        // Fall back to the database until the listener is reconnected
+        boost::mutex::scoped_lock lock(that->changesMutex_);
+        that->lastChangeIndex_ = -1;
+
+        if (that->changesListenerStop_)
+        {
+          return;
+        }
+      }
+
+      boost::this_thread::sleep(boost::posix_time::seconds(1));
+    }
+  }
+
+
+  bool PostgreSQLIndex::LookupCachedLastChangeIndex(int64_t& target)
   {
+    boost::mutex::scoped_lock lock(changesMutex_);
+
+    if (lastChangeIndex_ < 0)
+    {
+      return false;
+    }
+    else
+    {
+      target = lastChangeIndex_;
+      return true;
+    }
   }
 
   
@@ -66,19 +283,186 @@ namespace OrthancDatabases
     return PostgreSQLDatabase::CreateDatabaseFactory(parameters_);
   }
 
-  void PostgreSQLIndex::ApplyPrepareIndex(DatabaseManager::Transaction& t, DatabaseManager& manager)
+
+  void PostgreSQLIndex::SetUnloggedTables(bool enabled)
   {
-    std::string query;
+    if (enabled &&
+        replicaParameters_.get() != NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "PostgreSQL: \"EnableUnloggedTables\" cannot be combined with \"ReadOnlyReplica\", "
+                                      "as the unlogged tables are neither replicated nor readable by a hot standby");
+    }
 
-    Orthanc::EmbeddedResources::GetFileResource
-      (query, Orthanc::EmbeddedResources::POSTGRESQL_PREPARE_INDEX);
+    unloggedTables_ = enabled;
+  }
+
+
+  void PostgreSQLIndex::SetReplica(const PostgreSQLParameters& parameters,
+                                   size_t countConnections)
+  {
+    if (unloggedTables_)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "PostgreSQL: \"EnableUnloggedTables\" cannot be combined with \"ReadOnlyReplica\", "
+                                      "as the unlogged tables are neither replicated nor readable by a hot standby");
+    }
+
+    replicaParameters_.reset(new PostgreSQLParameters(parameters));
+    replicaConnectionsCount_ = countConnections;
+  }
+
+
+  IDatabaseFactory* PostgreSQLIndex::CreateReplicaDatabaseFactory()
+  {
+    if (replicaParameters_.get() == NULL)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls, "No read-only replica is configured");
+    }
+    else
+    {
+      return PostgreSQLDatabase::CreateDatabaseFactory(*replicaParameters_);
+    }
+  }
+
+
+  IDatabaseFactory* PostgreSQLIndex::CreateHousekeepingDatabaseFactory()
+  {
+    PostgreSQLParameters parameters(parameters_);
+    parameters.SetHousekeeping(true);
+    return PostgreSQLDatabase::CreateDatabaseFactory(parameters);
+  }
+
+
+  uint64_t PostgreSQLIndex::GetCommitPosition(DatabaseManager& manager)
+  {
+    if (dynamic_cast<PostgreSQLDatabase&>(manager.GetDatabase()).GetServerVersion() < 100000)
+    {
+      return 0;  // "pg_current_wal_lsn()" needs PostgreSQL >= 10, the commits are not tracked
+    }
+
+    // The current position of the WAL is at or after the commit of this connection
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "SELECT (pg_current_wal_lsn() - '0/0')::BIGINT");
+
+    statement.Execute();
+
+    if (statement.IsDone() ||
+        statement.IsNull(0))
+    {
+      return 0;
+    }
+    else
+    {
+      return static_cast<uint64_t>(statement.ReadInteger64(0));
+    }
+  }
+
+
+  uint64_t PostgreSQLIndex::GetReplayPosition(DatabaseManager& replica)
+  {
+    if (dynamic_cast<PostgreSQLDatabase&>(replica.GetDatabase()).GetServerVersion() < 100000)
+    {
+      return 0;  // "pg_last_wal_replay_lsn()" needs PostgreSQL >= 10
+    }
+
+    // NULL if the replica is not a standby server, whose WAL is not comparable
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, replica,
+      "SELECT (pg_last_wal_replay_lsn() - '0/0')::BIGINT");
+
+    statement.Execute();
+
+    if (statement.IsDone() ||
+        statement.IsNull(0))
+    {
+      return 0;
+    }
+    else
+    {
+      return static_cast<uint64_t>(statement.ReadInteger64(0));
+    }
+  }
+
+
+  static bool HasCitusExtension(DatabaseManager& manager)
+  {
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "SELECT 1 FROM pg_extension WHERE extname = 'citus'");
+
+    statement.Execute();
+    return !statement.IsDone();
+  }
+
+
+  static bool IsCitusDistributed(DatabaseManager& manager)
+  {
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "SELECT 1 FROM pg_dist_partition WHERE logicalrelid = 'maindicomtags'::regclass");
+
+    statement.Execute();
+    return !statement.IsDone();
+  }
+
+
+  static bool DoesChangeNotificationTriggerExist(DatabaseManager& manager)
+  {
+    // Re-creating the trigger would lock the "Changes" table
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "SELECT 1 FROM pg_trigger WHERE tgname = 'changenotification'");
+
+    statement.Execute();
+    return !statement.IsDone();
+  }
+
+
+  static bool IsBinaryCollation(DatabaseManager& manager)
+  {
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "SELECT 1 FROM information_schema.columns WHERE table_schema = current_schema() AND "
+      "table_name = 'dicomidentifiers' AND column_name = 'value' AND collation_name = 'C'");
+
+    statement.SetReadOnly(true);
+    statement.Execute();
+    return !statement.IsDone();
+  }
+
+
+  void PostgreSQLIndex::ApplyPrepareIndex(DatabaseManager::Transaction& t, DatabaseManager& manager)
+  {
+    std::string query, hash;
+    GetPrepareIndex(query, hash);
     t.GetDatabaseTransaction().ExecuteMultiLines(query);
+
+    // Remember which version of the script was applied, next to the
+    // progress of the online upgrades (that is kept by the script)
+    Json::Value progress = Json::objectValue;
+
+    std::string s;
+    if (LookupGlobalProperty(s, manager, MISSING_SERVER_IDENTIFIER, Orthanc::GlobalProperty_OnlineUpgrades) &&
+        (!Orthanc::Toolbox::ReadJson(progress, s) ||
+         progress.type() != Json::objectValue))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Corrupted progress of the online upgrades");
+    }
+
+    progress[ONLINE_UPGRADE_PREPARE_INDEX] = hash;
+
+    Orthanc::Toolbox::WriteFastJson(s, progress);
+    SetGlobalProperty(manager, MISSING_SERVER_IDENTIFIER, Orthanc::GlobalProperty_OnlineUpgrades, s.c_str());
   }
   
   void PostgreSQLIndex::ConfigureDatabase(DatabaseManager& manager,
                                           bool hasIdentifierTags,
                                           const std::list<IdentifierTag>& identifierTags)
   {
+    PrepareStudyColumnStore(identifierTags);
+
     uint32_t expectedVersion = 6;
 
     if (GetContext())   // "GetContext()" can possibly be NULL in the unit tests
@@ -196,6 +580,70 @@ namespace OrthancDatabases
 
           applyPrepareIndex = applyUpgradeV2toV3;
 
+          if (!LookupGlobalIntegerProperty(property, manager, MISSING_SERVER_IDENTIFIER,
+                                          Orthanc::GlobalProperty_HasSetResourcesContent) ||
+              property != 2)
+          {
+            // The "SetResourcesContent()" and "IngestResources()" functions were added after the DB schema revision 3
+            applyPrepareIndex = true;
+          }
+
+          if (!LookupGlobalIntegerProperty(property, manager, MISSING_SERVER_IDENTIFIER,
+                                          Orthanc::GlobalProperty_HasSerializedChangeSeq) ||
+              property != 3)
+          {
+            // The former revisions of "PrepareIndex.sql" sharded the ChangeSeq over the
+            // "GlobalIntegersShards" table, that must be folded into "GlobalIntegers" and dropped
+            applyPrepareIndex = true;
+          }
+
+          if (!LookupGlobalIntegerProperty(property, manager, MISSING_SERVER_IDENTIFIER,
+                                          Orthanc::GlobalProperty_HasDeleteResources) ||
+              property != 1)
+          {
+            // The "DeleteResources()" function was added after the DB schema revision 3
+            applyPrepareIndex = true;
+          }
+
+          std::string progress;
+          if (!LookupGlobalProperty(progress, manager, MISSING_SERVER_IDENTIFIER,
+                                    Orthanc::GlobalProperty_OnlineUpgrades))
+          {
+            // The "ComputeMissingChildCountFrom()" function and the progress of the
+            // online upgrades were added after the DB schema revision 3
+            applyPrepareIndex = true;
+          }
+          else
+          {
+            // Re-applying "PrepareIndex.sql" re-creates the triggers, which locks the
+            // hot tables for the other servers: Only do it if the script has changed
+            std::string query, hash;
+            GetPrepareIndex(query, hash);
+
+            Json::Value json;
+            if (!Orthanc::Toolbox::ReadJson(json, progress) ||
+                json.type() != Json::objectValue ||
+                !json.isMember(ONLINE_UPGRADE_PREPARE_INDEX) ||
+                json[ONLINE_UPGRADE_PREPARE_INDEX].type() != Json::stringValue ||
+                json[ONLINE_UPGRADE_PREPARE_INDEX].asString() != hash)
+            {
+              LOG(WARNING) << "The PostgreSQL schema differs from the one of this version of the plugin, updating it";
+              applyPrepareIndex = true;
+            }
+          }
+
+          if (!t.GetDatabaseTransaction().DoesIndexExist("DicomIdentifiersIndex4"))
+          {
+            // The index for the range scans on the wildcards was added after the DB schema revision 3
+            applyPrepareIndex = true;
+          }
+
+          if (!t.GetDatabaseTransaction().DoesIndexExist("ChangesIndex2"))
+          {
+            // The index for the change feeds filtered by type was added after the DB schema revision 3
+            applyPrepareIndex = true;
+          }
+
           if (applyUpgradeFromUnknownToV1)
           {
             LOG(WARNING) << "Upgrading DB schema from unknown to revision 1";
@@ -236,31 +684,299 @@ namespace OrthancDatabases
 
         }
 
-        t.Commit();
-      }
-    }
-    else
-    {
-      LOG(WARNING) << "READ-ONLY SYSTEM: checking if the DB already exists and has the right schema"; 
+        if (resourceSummary_ &&
+            !t.GetDatabaseTransaction().DoesTableExist("ResourceSummary"))
+        {
+          LOG(WARNING) << "Creating the ResourceSummary table, this may take several minutes on large databases";
 
-      DatabaseManager::Transaction t(manager, TransactionType_ReadOnly);
+          std::string query;
+          Orthanc::EmbeddedResources::GetFileResource
+            (query, Orthanc::EmbeddedResources::POSTGRESQL_INSTALL_RESOURCE_SUMMARY);
+          t.GetDatabaseTransaction().ExecuteMultiLines(query);
+        }
+        else if (!resourceSummary_ &&
+                 t.GetDatabaseTransaction().DoesTableExist("ResourceSummary"))
+        {
+          LOG(WARNING) << "Removing the ResourceSummary table since \"EnableResourceSummary\" is false";
 
-      // test if the latest "extension" has been installed
-      int revision;
-      if (!LookupGlobalIntegerProperty(revision, manager, MISSING_SERVER_IDENTIFIER, Orthanc::GlobalProperty_DatabasePatchLevel)
-          || revision != 3)
-      {      
-        LOG(ERROR) << "READ-ONLY SYSTEM: the DB does not have the correct schema to run with this version of the plugin"; 
-        throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);
-      }
-    }
-  }
+          std::string query;
+          Orthanc::EmbeddedResources::GetFileResource
+            (query, Orthanc::EmbeddedResources::POSTGRESQL_UNINSTALL_RESOURCE_SUMMARY);
+          t.GetDatabaseTransaction().ExecuteMultiLines(query);
+        }
 
+        if (!sortKeys_.empty())
+        {
+          if (!t.GetDatabaseTransaction().DoesTableExist("SortKeys"))
+          {
+            LOG(WARNING) << "Creating the SortKeys table";
 
-  int64_t PostgreSQLIndex::CreateResource(DatabaseManager& manager,
-                                          const char* publicId,
+            std::string query;
+            Orthanc::EmbeddedResources::GetFileResource
+              (query, Orthanc::EmbeddedResources::POSTGRESQL_INSTALL_SORT_KEYS);
+            t.GetDatabaseTransaction().ExecuteMultiLines(query);
+          }
+
+          SynchronizeSortKeys(manager);
+        }
+        else if (t.GetDatabaseTransaction().DoesTableExist("SortKeys"))
+        {
+          LOG(WARNING) << "Removing the SortKeys table since \"SortKeys\" is empty";
+
+          std::string query;
+          Orthanc::EmbeddedResources::GetFileResource
+            (query, Orthanc::EmbeddedResources::POSTGRESQL_UNINSTALL_SORT_KEYS);
+          t.GetDatabaseTransaction().ExecuteMultiLines(query);
+        }
+
+        if (changesPartitionSize_ > 0 &&
+            !t.GetDatabaseTransaction().DoesTableExist("ChangesPartitions"))
+        {
+          if (db.GetServerVersion() < 110000)
+          {
+            LOG(ERROR) << "The partitioning of the Changes table requires PostgreSQL >= 11";
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+          }
+
+          LOG(WARNING) << "Partitioning the Changes table, this may take several minutes on large databases";
+
+          std::string query;
+          Orthanc::EmbeddedResources::GetFileResource
+            (query, Orthanc::EmbeddedResources::POSTGRESQL_INSTALL_CHANGES_PARTITIONING);
+          t.GetDatabaseTransaction().ExecuteMultiLines(query);
+        }
+        else if (changesPartitionSize_ == 0 &&
+                 t.GetDatabaseTransaction().DoesTableExist("ChangesPartitions"))
+        {
+          // Converting back the table would be as expensive as the partitioning
+          LOG(WARNING) << "The Changes table is partitioned, but \"ChangesPartitionSize\" is zero: "
+                       << "The partitions must be maintained by another Orthanc server";
+        }
+
+        hasBinaryCollation_ = IsBinaryCollation(manager);
+
+        if ((binaryCollation_ || hasBinaryCollation_) &&
+            (tagsPartitionsCount_ > 0 ||
+             t.GetDatabaseTransaction().DoesTableExist("DicomIdentifiersPartitioned")))
+        {
+          // The partitioned tables are created with the default collation
+          LOG(ERROR) << "The \"C\" collation of the identifier tags cannot be combined with \"TagsPartitionsCount\"";
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+        }
+
+        if (binaryCollation_ &&
+            !hasBinaryCollation_)
+        {
+          LOG(WARNING) << "Rebuilding the DicomIdentifiers.value column with the \"C\" collation, "
+                       << "this may take several minutes on large databases";
+
+          t.GetDatabaseTransaction().ExecuteMultiLines(
+            "ALTER TABLE DicomIdentifiers ALTER COLUMN value TYPE TEXT COLLATE \"C\"");
+          hasBinaryCollation_ = true;
+        }
+
+        if (tagsPartitionsCount_ > 0 &&
+            !t.GetDatabaseTransaction().DoesTableExist("TagsPartitioning"))
+        {
+          if (db.GetServerVersion() < 110000)
+          {
+            LOG(ERROR) << "The partitioning of the MainDicomTags and DicomIdentifiers tables requires PostgreSQL >= 11";
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+          }
+
+          LOG(WARNING) << "Starting the online migration of the MainDicomTags and DicomIdentifiers tables to "
+                       << tagsPartitionsCount_ << " hash partitions";
+
+          std::string query;
+          Orthanc::EmbeddedResources::GetFileResource
+            (query, Orthanc::EmbeddedResources::POSTGRESQL_INSTALL_TAGS_PARTITIONING);
+          t.GetDatabaseTransaction().ExecuteMultiLines(query);
+
+          DatabaseManager::CachedStatement statement(
+            STATEMENT_FROM_HERE, manager,
+            "SELECT CreateTagsPartitions(${count})");
+
+          statement.SetParameterType("count", ValueType_Integer64);
+
+          Dictionary args;
+          args.SetIntegerValue("count", tagsPartitionsCount_);
+          statement.ExecuteWithoutResult(args);
+        }
+
+        if (changesNotifications_ &&
+            !DoesChangeNotificationTriggerExist(manager))
+        {
+          // The trigger is left in place if the option is disabled, as
+          // it can be used by other Orthanc servers sharing the database
+          t.GetDatabaseTransaction().ExecuteMultiLines(
+            "CREATE OR REPLACE FUNCTION ChangeNotificationFunc() "
+            "RETURNS TRIGGER AS $body$ "
+            "BEGIN "
+            "  PERFORM pg_notify('orthanc_changes', CAST(new.seq AS TEXT)); "
+            "  RETURN NULL; "
+            "END; "
+            "$body$ LANGUAGE plpgsql; "
+            "DROP TRIGGER IF EXISTS ChangeNotification ON Changes; "
+            "CREATE TRIGGER ChangeNotification AFTER INSERT ON Changes "
+            "FOR EACH ROW EXECUTE PROCEDURE ChangeNotificationFunc();");
+        }
+
+        t.Commit();
+      }
+
+      if (changesPartitionSize_ > 0)
+      {
+        MaintainChangesPartitions(manager);
+      }
+
+      // Before the tables are switched back to LOGGED, in the case
+      // they have been emptied while they were unlogged
+      RecoverUnloggedTables(manager);
+
+      {
+        DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+
+        // The content of an unlogged table is lost after a crash: The
+        // row of "UnloggedTablesSentinel" tells whether this happened
+        if (unloggedTables_ &&
+            !t.GetDatabaseTransaction().DoesTableExist("UnloggedTablesSentinel"))
+        {
+          if (db.GetServerVersion() < 90500)
+          {
+            LOG(ERROR) << "The unlogged tables require PostgreSQL >= 9.5";
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+          }
+
+          LOG(WARNING) << "Switching the GlobalIntegersChanges and ChildCountChanges tables to UNLOGGED";
+
+          t.GetDatabaseTransaction().ExecuteMultiLines(
+            "ALTER TABLE GlobalIntegersChanges SET UNLOGGED; "
+            "ALTER TABLE ChildCountChanges SET UNLOGGED; "
+            "CREATE UNLOGGED TABLE UnloggedTablesSentinel(value INTEGER); "
+            "INSERT INTO UnloggedTablesSentinel VALUES(1);");
+        }
+        else if (!unloggedTables_ &&
+                 t.GetDatabaseTransaction().DoesTableExist("UnloggedTablesSentinel"))
+        {
+          LOG(WARNING) << "Switching back the GlobalIntegersChanges and ChildCountChanges tables to LOGGED "
+                       << "since \"EnableUnloggedTables\" is false";
+
+          t.GetDatabaseTransaction().ExecuteMultiLines(
+            "ALTER TABLE GlobalIntegersChanges SET LOGGED; "
+            "ALTER TABLE ChildCountChanges SET LOGGED; "
+            "DROP TABLE UnloggedTablesSentinel;");
+        }
+
+        t.Commit();
+      }
+
+      if (citus_)
+      {
+        if (tagsPartitionsCount_ > 0 ||
+            resourceSummary_ ||
+            !sortKeys_.empty())
+        {
+          LOG(ERROR) << "The Citus distribution cannot be combined with \"TagsPartitionsCount\", "
+                     << "\"EnableResourceSummary\" nor \"SortKeys\"";
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+        }
+
+        // In a distinct transaction, as Citus forbids the distribution
+        // of tables that were modified earlier in the same transaction
+        DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+
+        if (!HasCitusExtension(manager))
+        {
+          LOG(ERROR) << "The \"citus\" extension is not installed in the database";
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);
+        }
+
+        if (!IsCitusDistributed(manager))
+        {
+          LOG(WARNING) << "Distributing the MainDicomTags and DicomIdentifiers tables over the Citus "
+                       << "workers, this may take a while on large databases";
+
+          std::string query;
+          Orthanc::EmbeddedResources::GetFileResource
+            (query, Orthanc::EmbeddedResources::POSTGRESQL_INSTALL_CITUS);
+          t.GetDatabaseTransaction().ExecuteMultiLines(query);
+        }
+
+        t.Commit();
+      }
+    }
+    else
+    {
+      LOG(WARNING) << "READ-ONLY SYSTEM: checking if the DB already exists and has the right schema"; 
+
+      DatabaseManager::Transaction t(manager, TransactionType_ReadOnly);
+
+      // test if the latest "extension" has been installed
+      int revision;
+      if (!LookupGlobalIntegerProperty(revision, manager, MISSING_SERVER_IDENTIFIER, Orthanc::GlobalProperty_DatabasePatchLevel)
+          || revision != 3)
+      {      
+        LOG(ERROR) << "READ-ONLY SYSTEM: the DB does not have the correct schema to run with this version of the plugin"; 
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);
+      }
+
+      hasBinaryCollation_ = IsBinaryCollation(manager);
+
+      if (resourceSummary_ &&
+          !t.GetDatabaseTransaction().DoesTableExist("ResourceSummary"))
+      {
+        LOG(WARNING) << "READ-ONLY SYSTEM: the ResourceSummary table does not exist, ignoring \"EnableResourceSummary\"";
+        resourceSummary_ = false;
+      }
+
+      if (!sortKeys_.empty())
+      {
+        // Only use the keys that are maintained by the read-write servers
+        std::set<int64_t> configured;
+        configured.swap(sortKeys_);
+
+        if (t.GetDatabaseTransaction().DoesTableExist("SortKeys"))
+        {
+          DatabaseManager::CachedStatement statement(
+            STATEMENT_FROM_HERE, manager,
+            "SELECT sortKey FROM SortKeysDefinitions");
+
+          statement.SetReadOnly(true);
+          statement.SetResultFieldType(0, ValueType_Integer64);
+          statement.Execute();
+
+          while (!statement.IsDone())
+          {
+            if (configured.find(statement.ReadInteger64(0)) != configured.end())
+            {
+              sortKeys_.insert(statement.ReadInteger64(0));
+            }
+
+            statement.Next();
+          }
+        }
+
+        if (sortKeys_.size() != configured.size())
+        {
+          LOG(WARNING) << "READ-ONLY SYSTEM: some of the sort keys are not available in the SortKeys table, they are ignored";
+        }
+      }
+    }
+
+    if ((changesNotifications_ || HasCacheInvalidations()) &&
+        !changesListener_.joinable())
+    {
+      changesListener_ = boost::thread(ChangesListenerThread, this);
+    }
+  }
+
+
+  int64_t PostgreSQLIndex::CreateResource(DatabaseManager& manager,
+                                          const char* publicId,
                                           OrthancPluginResourceType type)
   {
+    statisticsCache_.Invalidate();
+
     DatabaseManager::CachedStatement statement(
       STATEMENT_FROM_HERE, manager,
       "INSERT INTO Resources VALUES(DEFAULT, ${type}, ${id}, NULL) RETURNING internalId");
@@ -278,8 +994,130 @@ namespace OrthancDatabases
   }
 
 
+  std::string PostgreSQLIndex::GetRecyclingLockClause(DatabaseManager& manager)
+  {
+    // The patients that are being recycled by another transaction
+    // are skipped, instead of waiting for them and conflicting
+    if (dynamic_cast<PostgreSQLDatabase&>(manager.GetDatabase()).GetServerVersion() >= 90500)
+    {
+      return "FOR UPDATE SKIP LOCKED";
+    }
+    else
+    {
+      return "";
+    }
+  }
+
+
+  void PostgreSQLIndex::SetStatementTimeout(DatabaseManager& manager,
+                                            unsigned int milliseconds)
+  {
+    // Contrarily to "SET LOCAL", "set_config()" can be prepared
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "SELECT set_config('statement_timeout', ${timeout}, true)");
+
+    statement.SetParameterType("timeout", ValueType_Utf8String);
+
+    Dictionary args;
+    args.SetUtf8Value("timeout", boost::lexical_cast<std::string>(milliseconds));
+    statement.Execute(args);
+  }
+
+
+  bool PostgreSQLIndex::LookupAdvisedIndex(std::string& name,
+                                           std::string& sql,
+                                           DatabaseManager& manager,
+                                           const Orthanc::DicomTag& tag)
+  {
+    name = IndexAdvisor::FormatIndexName(tag);
+
+    // The partitioned tables don't support "CONCURRENTLY". The
+    // predicate matches the literal tags that are generated by
+    // "ISqlLookupFormatter".
+    sql = (std::string(tagsPartitionsCount_ == 0 ? "CREATE INDEX CONCURRENTLY" : "CREATE INDEX") +
+           " IF NOT EXISTS " + name + " ON MainDicomTags(value) WHERE tagGroup = " +
+           boost::lexical_cast<std::string>(tag.GetGroup()) + " AND tagElement = " +
+           boost::lexical_cast<std::string>(tag.GetElement()));
+    return true;
+  }
+
+
+  void PostgreSQLIndex::CreateAdvisedIndex(DatabaseManager& manager,
+                                           const std::string& sql)
+  {
+    if (tagsPartitionsCount_ == 0)
+    {
+      PostgreSQLDatabase& db = dynamic_cast<PostgreSQLDatabase&>(manager.GetDatabase());
+      db.ExecuteMultiLines(sql);
+    }
+    else
+    {
+      IndexBackend::CreateAdvisedIndex(manager, sql);
+    }
+  }
+
+
+  void PostgreSQLIndex::ReadStatementsStatistics(Json::Value& target,
+                                                 DatabaseManager& manager)
+  {
+    PostgreSQLDatabase& db = dynamic_cast<PostgreSQLDatabase&>(manager.GetDatabase());
+
+    std::unique_ptr<DatabaseManager::CachedStatement> statement;
+
+    // The column "total_time" was renamed as "total_exec_time" in PostgreSQL 13
+    if (db.DoesColumnExist("pg_stat_statements", "total_exec_time"))
+    {
+      statement.reset(new DatabaseManager::CachedStatement(
+                        STATEMENT_FROM_HERE, manager,
+                        "SELECT query, calls, total_exec_time::BIGINT FROM pg_stat_statements "
+                        "WHERE query LIKE '%MainDicomTags%' OR query LIKE '%DicomIdentifiers%' "
+                        "ORDER BY total_exec_time DESC LIMIT 10"));
+    }
+    else if (db.DoesColumnExist("pg_stat_statements", "total_time"))
+    {
+      statement.reset(new DatabaseManager::CachedStatement(
+                        STATEMENT_FROM_HERE, manager,
+                        "SELECT query, calls, total_time::BIGINT FROM pg_stat_statements "
+                        "WHERE query LIKE '%MainDicomTags%' OR query LIKE '%DicomIdentifiers%' "
+                        "ORDER BY total_time DESC LIMIT 10"));
+    }
+    else
+    {
+      return;  // "pg_stat_statements" is not installed
+    }
+
+    statement->SetReadOnly(true);
+    statement->Execute();
+
+    if (!statement->IsDone())
+    {
+      statement->SetResultFieldType(1, ValueType_Integer64);
+      statement->SetResultFieldType(2, ValueType_Integer64);
+    }
+
+    while (!statement->IsDone())
+    {
+      Json::Value item;
+      item["Query"] = statement->ReadString(0);
+      item["Calls"] = static_cast<Json::Int64>(statement->ReadInteger64(1));
+      item["TotalMilliseconds"] = static_cast<Json::Int64>(statement->ReadInteger64(2));
+      target.append(item);
+
+      statement->Next();
+    }
+  }
+
+
   uint64_t PostgreSQLIndex::GetTotalCompressedSize(DatabaseManager& manager)
   {
+    if (statisticsCache_.IsEnabled())
+    {
+      StatisticsCache::Statistics statistics;
+      GetCachedStatistics(statistics, manager);
+      return static_cast<uint64_t>(statistics.compressedSize_);
+    }
+
     uint64_t result;
 
     {
@@ -307,6 +1145,13 @@ namespace OrthancDatabases
   
   uint64_t PostgreSQLIndex::GetTotalUncompressedSize(DatabaseManager& manager)
   {
+    if (statisticsCache_.IsEnabled())
+    {
+      StatisticsCache::Statistics statistics;
+      GetCachedStatistics(statistics, manager);
+      return static_cast<uint64_t>(statistics.uncompressedSize_);
+    }
+
     uint64_t result;
 
     {
@@ -359,7 +1204,9 @@ namespace OrthancDatabases
         
         statement.Execute(args);
 
-        return statement.ReadInteger64(0);
+        const int64_t value = statement.ReadInteger64(0);
+        InvalidateGlobalProperty(manager, serverIdentifier, property);
+        return value;
       }
       else
       {
@@ -380,7 +1227,9 @@ namespace OrthancDatabases
         
         statement.Execute(args);
 
-        return statement.ReadInteger64(0);
+        const int64_t value = statement.ReadInteger64(0);
+        InvalidateGlobalProperty(manager, serverIdentifier, property);
+        return value;
       }
     }
   }
@@ -393,128 +1242,804 @@ namespace OrthancDatabases
                                                int64_t& compressedSize,
                                                int64_t& uncompressedSize)
   {
-    DatabaseManager::CachedStatement statement(
-      STATEMENT_FROM_HERE, manager,
-      "SELECT * FROM UpdateStatistics()");
+    const uint64_t revision = statisticsCache_.GetRevision();
 
-    statement.Execute();
-
-    patientsCount = statement.ReadInteger64(0);
-    studiesCount = statement.ReadInteger64(1);
-    seriesCount = statement.ReadInteger64(2);
-    instancesCount = statement.ReadInteger64(3);
-    compressedSize = statement.ReadInteger64(4);
-    uncompressedSize = statement.ReadInteger64(5);
-  }
+    StatisticsCache::Statistics statistics;
 
-  void PostgreSQLIndex::ClearDeletedFiles(DatabaseManager& manager)
-  {
-    { // note: the temporary table lifespan is the session, not the transaction -> that's why we need the IF NOT EXISTS
+    if (statisticsRollupBatchSize_ == 0)
+    {
       DatabaseManager::CachedStatement statement(
         STATEMENT_FROM_HERE, manager,
-        "SELECT CreateDeletedFilesTemporaryTable()"
-        );
-      statement.ExecuteWithoutResult();
-    }
+        "SELECT * FROM UpdateStatistics()");
 
-  }
-
-  void PostgreSQLIndex::ClearDeletedResources(DatabaseManager& manager)
-  {
-    { // note: the temporary table lifespan is the session, not the transaction -> that's why we need the IF NOT EXISTS
-      DatabaseManager::CachedStatement statement(
-        STATEMENT_FROM_HERE, manager,
-        "CREATE TEMPORARY TABLE IF NOT EXISTS  DeletedResources("
-        "resourceType INTEGER NOT NULL,"
-        "publicId VARCHAR(64) NOT NULL"
-        ");"
-        );
       statement.Execute();
+
+      statistics.patientsCount_ = statement.ReadInteger64(0);
+      statistics.studiesCount_ = statement.ReadInteger64(1);
+      statistics.seriesCount_ = statement.ReadInteger64(2);
+      statistics.instancesCount_ = statement.ReadInteger64(3);
+      statistics.compressedSize_ = statement.ReadInteger64(4);
+      statistics.uncompressedSize_ = statement.ReadInteger64(5);
     }
+    else
     {
-      DatabaseManager::CachedStatement statement(
-        STATEMENT_FROM_HERE, manager,
-        "DELETE FROM DeletedResources;"
-        );
-
-      statement.Execute();
+      // Fold one bounded batch, then add the remaining changes without
+      // deleting them, so that the latency does not depend on the backlog
+      RollupStatistics(manager, statisticsRollupBatchSize_);
+      ReadStatistics(statistics, manager);
     }
 
-  }
+    statisticsCache_.Store(statistics, revision, boost::posix_time::microsec_clock::universal_time());
 
-  void PostgreSQLIndex::ClearRemainingAncestor(DatabaseManager& manager)
-  {
+    patientsCount = statistics.patientsCount_;
+    studiesCount = statistics.studiesCount_;
+    seriesCount = statistics.seriesCount_;
+    instancesCount = statistics.instancesCount_;
+    compressedSize = statistics.compressedSize_;
+    uncompressedSize = statistics.uncompressedSize_;
   }
 
-  void PostgreSQLIndex::DeleteResource(IDatabaseBackendOutput& output,
-                                       DatabaseManager& manager,
-                                       int64_t id)
+
+  void PostgreSQLIndex::ReadStatistics(StatisticsCache::Statistics& target,
+                                       DatabaseManager& manager)
   {
-    // clearing of temporary table is now implemented in the funcion DeleteResource
     DatabaseManager::CachedStatement statement(
       STATEMENT_FROM_HERE, manager,
-      "SELECT * FROM DeleteResource(${id})");
+      "SELECT "
+      "  CAST((SELECT value FROM GlobalIntegers WHERE key = 2) + COALESCE(SUM(value) FILTER (WHERE key = 2), 0) AS BIGINT), "
+      "  CAST((SELECT value FROM GlobalIntegers WHERE key = 3) + COALESCE(SUM(value) FILTER (WHERE key = 3), 0) AS BIGINT), "
+      "  CAST((SELECT value FROM GlobalIntegers WHERE key = 4) + COALESCE(SUM(value) FILTER (WHERE key = 4), 0) AS BIGINT), "
+      "  CAST((SELECT value FROM GlobalIntegers WHERE key = 5) + COALESCE(SUM(value) FILTER (WHERE key = 5), 0) AS BIGINT), "
+      "  CAST((SELECT value FROM GlobalIntegers WHERE key = 0) + COALESCE(SUM(value) FILTER (WHERE key = 0), 0) AS BIGINT), "
+      "  CAST((SELECT value FROM GlobalIntegers WHERE key = 1) + COALESCE(SUM(value) FILTER (WHERE key = 1), 0) AS BIGINT) "
+      "FROM GlobalIntegersChanges");
+
+    // NB: "SUM()" of BIGINT values is a NUMERIC in PostgreSQL, hence the casts
+    statement.Execute();
 
-    statement.SetParameterType("id", ValueType_Integer64);
+    target.patientsCount_ = statement.ReadInteger64(0);
+    target.studiesCount_ = statement.ReadInteger64(1);
+    target.seriesCount_ = statement.ReadInteger64(2);
+    target.instancesCount_ = statement.ReadInteger64(3);
+    target.compressedSize_ = statement.ReadInteger64(4);
+    target.uncompressedSize_ = statement.ReadInteger64(5);
+  }
 
-    Dictionary args;
-    args.SetIntegerValue("id", id);
 
-    statement.Execute(args);
+  void PostgreSQLIndex::GetCachedStatistics(StatisticsCache::Statistics& target,
+                                            DatabaseManager& manager)
+  {
+    const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
 
-    if (statement.IsDone() ||
-        statement.GetResultFieldsCount() != 2)
+    if (!statisticsCache_.Lookup(target, now))
     {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);
+      const uint64_t revision = statisticsCache_.GetRevision();
+      ReadStatistics(target, manager);
+      statisticsCache_.Store(target, revision, now);
     }
+  }
 
-    statement.SetResultFieldType(0, ValueType_Integer64);
-    statement.SetResultFieldType(1, ValueType_Utf8String);
 
-    if (!statement.IsNull(0))
-    {
-      output.SignalRemainingAncestor(
-        statement.ReadString(1),
-        static_cast<OrthancPluginResourceType>(statement.ReadInteger32(0)));
-    }
+  int64_t PostgreSQLIndex::RollupStatistics(DatabaseManager& manager,
+                                            unsigned int maxRows)
+  {
+    // The rows are locked with "SKIP LOCKED", so that concurrent
+    // rollups fold distinct rows instead of waiting for each other.
+    // The "ctid = ANY(ARRAY(...))" form makes PostgreSQL use a TID scan.
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "WITH deleted_rows AS ("
+      "  DELETE FROM GlobalIntegersChanges WHERE ctid = ANY(ARRAY("
+      "    SELECT ctid FROM GlobalIntegersChanges LIMIT ${max} FOR UPDATE SKIP LOCKED)) "
+      "  RETURNING key, value), "
+      "sums AS (SELECT key, SUM(value) AS delta FROM deleted_rows GROUP BY key), "
+      "updated AS ("
+      "  UPDATE GlobalIntegers SET value = GlobalIntegers.value + sums.delta "
+      "  FROM sums WHERE GlobalIntegers.key = sums.key RETURNING 1) "
+      "SELECT COUNT(*) FROM deleted_rows");
+
+    statement.SetParameterType("max", ValueType_Integer64);
 
-    SignalDeletedFiles(output, manager);
-    SignalDeletedResources(output, manager);
-  }
+    Dictionary args;
+    args.SetIntegerValue("max", maxRows);
 
+    statement.Execute(args);
 
+    return statement.ReadInteger64(0);
+  }
 
-#if ORTHANC_PLUGINS_HAS_DATABASE_CONSTRAINT == 1
-  void PostgreSQLIndex::CreateInstance(OrthancPluginCreateInstanceResult& result,
-                                       DatabaseManager& manager,
-                                       const char* hashPatient,
-                                       const char* hashStudy,
-                                       const char* hashSeries,
-                                       const char* hashInstance)
+  int64_t PostgreSQLIndex::RollupChildCounts(DatabaseManager& manager,
+                                             unsigned int maxRows)
   {
+    // Same locking as in "RollupStatistics()". The changes of the
+    // resources whose "childCount" is NULL are discarded, as the
+    // "ComputeMissingChildCount" task will count their children.
     DatabaseManager::CachedStatement statement(
       STATEMENT_FROM_HERE, manager,
-      "SELECT * FROM CreateInstance(${patient}, ${study}, ${series}, ${instance})");
-
-    statement.SetParameterType("patient", ValueType_Utf8String);
-    statement.SetParameterType("study", ValueType_Utf8String);
-    statement.SetParameterType("series", ValueType_Utf8String);
-    statement.SetParameterType("instance", ValueType_Utf8String);
+      "WITH deleted_rows AS ("
+      "  DELETE FROM ChildCountChanges WHERE ctid = ANY(ARRAY("
+      "    SELECT ctid FROM ChildCountChanges LIMIT ${max} FOR UPDATE SKIP LOCKED)) "
+      "  RETURNING parentId, delta), "
+      "sums AS (SELECT parentId, SUM(delta) AS total FROM deleted_rows GROUP BY parentId), "
+      "updated AS ("
+      "  UPDATE Resources SET childCount = Resources.childCount + sums.total "
+      "  FROM sums WHERE Resources.internalId = sums.parentId AND Resources.childCount IS NOT NULL RETURNING 1) "
+      "SELECT COUNT(*) FROM deleted_rows");
+
+    statement.SetParameterType("max", ValueType_Integer64);
 
     Dictionary args;
-    args.SetUtf8Value("patient", hashPatient);
-    args.SetUtf8Value("study", hashStudy);
-    args.SetUtf8Value("series", hashSeries);
-    args.SetUtf8Value("instance", hashInstance);
+    args.SetIntegerValue("max", maxRows);
 
     statement.Execute(args);
 
-    if (statement.IsDone() ||
-        statement.GetResultFieldsCount() != 8)
-    {
-      throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);
-    }
-
+    return statement.ReadInteger64(0);
+  }
+
+  int64_t PostgreSQLIndex::CompactLabelsCatalog(DatabaseManager& manager)
+  {
+    // The shards that are locked by the running transactions are
+    // folded by the next compaction
+    int64_t count;
+
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "WITH deleted_rows AS ("
+        "  DELETE FROM LabelsCatalog WHERE ctid = ANY(ARRAY("
+        "    SELECT ctid FROM LabelsCatalog WHERE shard <> -1 FOR UPDATE SKIP LOCKED)) "
+        "  RETURNING label, count), "
+        "sums AS (SELECT label, SUM(count) AS total FROM deleted_rows GROUP BY label), "
+        "inserted AS ("
+        "  INSERT INTO LabelsCatalog SELECT label, -1, total FROM sums "
+        "  ON CONFLICT (label, shard) DO UPDATE SET count = LabelsCatalog.count + EXCLUDED.count RETURNING 1) "
+        "SELECT COUNT(*) FROM deleted_rows");
+
+      statement.Execute();
+      count = statement.ReadInteger64(0);
+    }
+
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "DELETE FROM LabelsCatalog WHERE ctid = ANY(ARRAY("
+        "  SELECT ctid FROM LabelsCatalog WHERE count = 0 FOR UPDATE SKIP LOCKED))");
+
+      statement.ExecuteWithoutResult();
+    }
+
+    return count;
+  }
+
+  void PostgreSQLIndex::RecoverUnloggedTables(DatabaseManager& manager)
+  {
+    {
+      DatabaseManager::Transaction t(manager, TransactionType_ReadOnly);
+
+      bool lost = false;
+
+      if (t.GetDatabaseTransaction().DoesTableExist("UnloggedTablesSentinel"))
+      {
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, manager,
+          "SELECT COUNT(*) FROM UnloggedTablesSentinel");
+
+        statement.SetReadOnly(true);
+        statement.Execute();
+        statement.SetResultFieldType(0, ValueType_Integer64);
+        lost = (statement.ReadInteger64(0) == 0);
+      }
+
+      t.Commit();
+
+      if (!lost)
+      {
+        return;
+      }
+    }
+
+    DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+
+    // The locks are taken by the first statement of the transaction,
+    // hence before its snapshot: The concurrent writers are either
+    // visible to the recomputation, or wait for it to be committed
+    t.GetDatabaseTransaction().ExecuteMultiLines(
+      "LOCK TABLE UnloggedTablesSentinel, GlobalIntegersChanges, ChildCountChanges IN EXCLUSIVE MODE");
+
+    {
+      // Another Orthanc server might have recovered in the meantime
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "SELECT COUNT(*) FROM UnloggedTablesSentinel");
+
+      statement.Execute();
+      statement.SetResultFieldType(0, ValueType_Integer64);
+
+      if (statement.ReadInteger64(0) != 0)
+      {
+        t.Commit();
+        return;
+      }
+    }
+
+    LOG(WARNING) << "The unlogged tables have been emptied by the crash recovery of PostgreSQL, "
+                 << "recomputing the statistics and the child counts";
+
+    // The changes that were added since the crash are part of the
+    // recomputed values. The child counts that are set to NULL are
+    // counted by the readers, until "ComputeMissingChildCount" is done.
+    t.GetDatabaseTransaction().ExecuteMultiLines(
+      "UPDATE GlobalIntegers SET value = CASE key "
+      "  WHEN 0 THEN (SELECT CAST(COALESCE(SUM(compressedSize), 0) AS BIGINT) FROM AttachedFiles) "
+      "  WHEN 1 THEN (SELECT CAST(COALESCE(SUM(uncompressedSize), 0) AS BIGINT) FROM AttachedFiles) "
+      "  ELSE (SELECT COUNT(*) FROM Resources WHERE resourceType = GlobalIntegers.key - 2) END "
+      "  WHERE key >= 0 AND key <= 5; "
+      "DELETE FROM GlobalIntegersChanges; "
+      "DELETE FROM ChildCountChanges; "
+      "UPDATE Resources SET childCount = NULL WHERE resourceType < 3 AND childCount IS NOT NULL; "
+      "INSERT INTO UnloggedTablesSentinel VALUES(1);");
+
+    Json::Value progress = Json::objectValue;
+
+    std::string s;
+    if (LookupGlobalProperty(s, manager, MISSING_SERVER_IDENTIFIER, Orthanc::GlobalProperty_OnlineUpgrades) &&
+        (!Orthanc::Toolbox::ReadJson(progress, s) ||
+         progress.type() != Json::objectValue))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Corrupted progress of the online upgrades");
+    }
+
+    progress[ONLINE_UPGRADE_CHILD_COUNT] = 0;
+    Orthanc::Toolbox::WriteFastJson(s, progress);
+    SetGlobalProperty(manager, MISSING_SERVER_IDENTIFIER, Orthanc::GlobalProperty_OnlineUpgrades, s.c_str());
+
+    t.Commit();
+
+    hkHasComputedAllMissingChildCount_ = false;
+  }
+
+  void PostgreSQLIndex::MaintainChangesPartitions(DatabaseManager& manager)
+  {
+    int64_t created, dropped = 0;
+
+    {
+      DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+
+      {
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, manager,
+          "SELECT pg_advisory_xact_lock(" + boost::lexical_cast<std::string>(POSTGRESQL_LOCK_CHANGES_PARTITIONS) + ")");
+        statement.ExecuteWithoutResult();
+      }
+
+      {
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, manager,
+          "SELECT CreateChangesPartitions(${size}, ${ahead})");
+
+        statement.SetParameterType("size", ValueType_Integer64);
+        statement.SetParameterType("ahead", ValueType_Integer64);
+
+        Dictionary args;
+        args.SetIntegerValue("size", changesPartitionSize_);
+        args.SetIntegerValue("ahead", CHANGES_PARTITIONS_AHEAD);
+
+        statement.Execute(args);
+        created = statement.ReadInteger64(0);
+      }
+
+      if (changesRetentionDays_ > 0)
+      {
+        // The dates of the changes are UTC in the ISO format "YYYYMMDDTHHMMSS"
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, manager,
+          "SELECT DropExpiredChangesPartitions(to_char((now() AT TIME ZONE 'UTC') - "
+          "${days} * INTERVAL '1 day', 'YYYYMMDD\"T\"HH24MISS'))");
+
+        statement.SetParameterType("days", ValueType_Integer64);
+
+        Dictionary args;
+        args.SetIntegerValue("days", changesRetentionDays_);
+
+        statement.Execute(args);
+        dropped = statement.ReadInteger64(0);
+      }
+
+      t.Commit();
+    }
+
+    if (created > 0 ||
+        dropped > 0)
+    {
+      LOG(INFO) << "Created " << created << " and dropped " << dropped << " partitions of the Changes table";
+    }
+  }
+
+  void PostgreSQLIndex::SetSortKeys(const std::set<std::string>& keys)
+  {
+    sortKeys_.clear();
+
+    for (std::set<std::string>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+    {
+      Orthanc::DicomTag tag(0, 0);
+      int32_t metadata = -1;
+
+      if (Orthanc::DicomTag::ParseHexadecimal(tag, it->c_str()))
+      {
+        sortKeys_.insert(ISqlLookupFormatter::EncodeTagSortKey(tag.GetGroup(), tag.GetElement()));
+        continue;
+      }
+
+      try
+      {
+        metadata = boost::lexical_cast<int32_t>(*it);
+      }
+      catch (boost::bad_lexical_cast&)
+      {
+      }
+
+      if (metadata < 0)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                        "Bad sort key (must be a DICOM tag \"gggg,eeee\" or the number of a metadata): " + *it);
+      }
+
+      sortKeys_.insert(ISqlLookupFormatter::EncodeMetadataSortKey(metadata));
+    }
+  }
+
+
+  void PostgreSQLIndex::SynchronizeSortKeys(DatabaseManager& manager)
+  {
+    std::set<int64_t> existing;
+
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "SELECT sortKey FROM SortKeysDefinitions");
+
+      statement.SetResultFieldType(0, ValueType_Integer64);
+      statement.Execute();
+
+      while (!statement.IsDone())
+      {
+        existing.insert(statement.ReadInteger64(0));
+        statement.Next();
+      }
+    }
+
+    for (std::set<int64_t>::const_iterator it = existing.begin(); it != existing.end(); ++it)
+    {
+      if (sortKeys_.find(*it) == sortKeys_.end())
+      {
+        Dictionary args;
+        args.SetIntegerValue("key", *it);
+
+        {
+          DatabaseManager::CachedStatement statement(
+            STATEMENT_FROM_HERE, manager,
+            "DELETE FROM SortKeysDefinitions WHERE sortKey=${key}");
+
+          statement.SetParameterType("key", ValueType_Integer64);
+          statement.ExecuteWithoutResult(args);
+        }
+
+        {
+          DatabaseManager::CachedStatement statement(
+            STATEMENT_FROM_HERE, manager,
+            "DELETE FROM SortKeys WHERE sortKey=${key}");
+
+          statement.SetParameterType("key", ValueType_Integer64);
+          statement.ExecuteWithoutResult(args);
+        }
+      }
+    }
+
+    for (std::set<int64_t>::const_iterator it = sortKeys_.begin(); it != sortKeys_.end(); ++it)
+    {
+      if (existing.find(*it) == existing.end())
+      {
+        LOG(WARNING) << "Copying the values of the sort key " << *it << " into the SortKeys table, "
+                     << "this may take several minutes on large databases";
+
+        Dictionary args;
+        args.SetIntegerValue("key", *it);
+
+        {
+          DatabaseManager::CachedStatement statement(
+            STATEMENT_FROM_HERE, manager,
+            "INSERT INTO SortKeysDefinitions VALUES(${key})");
+
+          statement.SetParameterType("key", ValueType_Integer64);
+          statement.ExecuteWithoutResult(args);
+        }
+
+        {
+          DatabaseManager::CachedStatement statement(
+            STATEMENT_FROM_HERE, manager,
+            "SELECT BackfillSortKey(${key})");
+
+          statement.SetParameterType("key", ValueType_Integer64);
+          statement.ExecuteWithoutResult(args);
+        }
+      }
+    }
+  }
+
+
+  void PostgreSQLIndex::MigrateTagsPartitions(DatabaseManager& manager)
+  {
+    if (hkHasSwappedTagsPartitions_)
+    {
+      return;
+    }
+
+    DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+
+    int64_t copied;
+
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "SELECT CopyTagsToPartitions(${batch})");
+
+      statement.SetParameterType("batch", ValueType_Integer64);
+
+      Dictionary args;
+      args.SetIntegerValue("batch", tagsPartitioningBatchSize_);
+
+      statement.Execute(args);
+      copied = statement.ReadInteger64(0);
+    }
+
+    if (copied > 0)
+    {
+      LOG(INFO) << "Copied the tags of " << copied << " resources to the partitioned tables";
+    }
+    else
+    {
+      // Also reached if the tables have been swapped by another Orthanc server
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "SELECT SwapTagsPartitions()");
+
+      statement.Execute();
+
+      if (statement.ReadInteger64(0) == 1)
+      {
+        LOG(WARNING) << "The MainDicomTags and DicomIdentifiers tables are now hash-partitioned";
+      }
+
+      hkHasSwappedTagsPartitions_ = true;
+    }
+
+    t.Commit();
+  }
+
+  void PostgreSQLIndex::PerformOnlineUpgrades(DatabaseManager& manager)
+  {
+    if (hkHasPerformedOnlineUpgrades_)
+    {
+      return;
+    }
+
+    // The statements with "CONCURRENTLY" don't block the writes, but
+    // they cannot be executed within a transaction
+    PostgreSQLDatabase& db = dynamic_cast<PostgreSQLDatabase&>(manager.GetDatabase());
+
+    if (!db.AcquireAdvisoryLock(POSTGRESQL_LOCK_ONLINE_UPGRADES))
+    {
+      LOG(INFO) << "The online upgrades are performed by another Orthanc server";
+      return;
+    }
+
+    try
+    {
+      // "ChildrenIndex2" replaces "ChildrenIndex" since the DB schema revision 3
+      if (db.DoesIndexExist("ChildrenIndex"))
+      {
+        if (!IsValidIndex(db, "ChildrenIndex2"))
+        {
+          LOG(WARNING) << "Building the ChildrenIndex2 index online, this may take several minutes on large databases";
+
+          db.ExecuteMultiLines("DROP INDEX CONCURRENTLY IF EXISTS ChildrenIndex2");
+
+          if (db.GetServerVersion() >= 110000)
+          {
+            db.ExecuteMultiLines("CREATE INDEX CONCURRENTLY ChildrenIndex2 ON Resources "
+                                 "USING btree (parentId ASC NULLS LAST) INCLUDE (publicId, internalId)");
+          }
+          else
+          {
+            db.ExecuteMultiLines("CREATE INDEX CONCURRENTLY ChildrenIndex2 ON Resources "
+                                 "USING btree (parentId ASC NULLS LAST, publicId, internalId)");
+          }
+        }
+
+        db.ExecuteMultiLines("DROP INDEX CONCURRENTLY IF EXISTS ChildrenIndex");
+        LOG(WARNING) << "The ChildrenIndex index has been replaced by ChildrenIndex2";
+      }
+
+      // The predicate of the partial index matches the literal tags
+      // that are generated by "ISqlLookupFormatter", i.e. (0008,0020)
+      if (!studyDateBrinIndex_)
+      {
+        if (db.DoesIndexExist("DicomIdentifiersStudyDateBrin"))
+        {
+          db.ExecuteMultiLines("DROP INDEX CONCURRENTLY IF EXISTS DicomIdentifiersStudyDateBrin");
+          LOG(WARNING) << "The BRIN index on StudyDate has been dropped";
+        }
+      }
+      else if (tagsPartitionsCount_ > 0)
+      {
+        // "CREATE INDEX CONCURRENTLY" is not available on partitioned tables
+        LOG(WARNING) << "The BRIN index on StudyDate is not available if the DicomIdentifiers table is partitioned";
+      }
+      else if (!IsValidIndex(db, "DicomIdentifiersStudyDateBrin"))
+      {
+        LOG(WARNING) << "Building the BRIN index on StudyDate online";
+
+        db.ExecuteMultiLines("DROP INDEX CONCURRENTLY IF EXISTS DicomIdentifiersStudyDateBrin");
+        db.ExecuteMultiLines("CREATE INDEX CONCURRENTLY DicomIdentifiersStudyDateBrin ON DicomIdentifiers "
+                             "USING brin (value) WHERE tagGroup = 8 AND tagElement = 32");
+      }
+
+      // The predicate matches the literal type of "LastUpdate" in the
+      // statements of "LookupUpdatedResources()" and "ISqlLookupFormatter"
+      if (!lastUpdateIndex_)
+      {
+        if (db.DoesIndexExist("MetadataLastUpdateIndex"))
+        {
+          db.ExecuteMultiLines("DROP INDEX CONCURRENTLY IF EXISTS MetadataLastUpdateIndex");
+          LOG(WARNING) << "The index on the last update of the resources has been dropped";
+        }
+      }
+      else if (!IsValidIndex(db, "MetadataLastUpdateIndex"))
+      {
+        LOG(WARNING) << "Building the index on the last update of the resources online";
+
+        db.ExecuteMultiLines("DROP INDEX CONCURRENTLY IF EXISTS MetadataLastUpdateIndex");
+        db.ExecuteMultiLines("CREATE INDEX CONCURRENTLY MetadataLastUpdateIndex ON Metadata "
+                             "(value, id) WHERE type = 7");
+      }
+    }
+    catch (Orthanc::OrthancException&)
+    {
+      db.ReleaseAdvisoryLock(POSTGRESQL_LOCK_ONLINE_UPGRADES);
+      throw;
+    }
+
+    db.ReleaseAdvisoryLock(POSTGRESQL_LOCK_ONLINE_UPGRADES);
+    hkHasPerformedOnlineUpgrades_ = true;
+  }
+
+  void PostgreSQLIndex::ClearDeletedFiles(DatabaseManager& manager)
+  {
+    // The deleted files and resources are recorded by the triggers in
+    // permanent tables keyed by the backend process, not in temporary tables
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "DELETE FROM DeletedFilesQueue WHERE backendPid = pg_backend_pid()");
+    statement.ExecuteWithoutResult();
+  }
+
+  void PostgreSQLIndex::ClearDeletedResources(DatabaseManager& manager)
+  {
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "DELETE FROM DeletedResourcesQueue WHERE backendPid = pg_backend_pid()");
+    statement.ExecuteWithoutResult();
+  }
+
+  void PostgreSQLIndex::SignalDeletedItems(IDatabaseBackendOutput& output,
+                                           std::map<std::string, OrthancPluginResourceType>* remainingAncestors,
+                                           std::vector<std::string>& deletedResources,
+                                           DatabaseManager::StatementBase& statement)
+  {
+    if (statement.GetResultFieldsCount() != 8)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);
+    }
+
+    statement.SetResultFieldType(0, ValueType_Integer64);
+    statement.SetResultFieldType(1, ValueType_Integer64);
+    statement.SetResultFieldType(2, ValueType_Utf8String);
+    statement.SetResultFieldType(3, ValueType_Integer64);
+    statement.SetResultFieldType(4, ValueType_Utf8String);
+    statement.SetResultFieldType(5, ValueType_Integer64);
+    statement.SetResultFieldType(6, ValueType_Integer64);
+    statement.SetResultFieldType(7, ValueType_Utf8String);
+
+    while (!statement.IsDone())
+    {
+      const std::string id = statement.ReadString(2);
+
+      switch (statement.ReadInteger32(0))
+      {
+        case 0:  // Remaining ancestor
+          if (remainingAncestors == NULL)
+          {
+            output.SignalRemainingAncestor(id, static_cast<OrthancPluginResourceType>(statement.ReadInteger32(1)));
+          }
+          else
+          {
+            (*remainingAncestors)[id] = static_cast<OrthancPluginResourceType>(statement.ReadInteger32(1));
+          }
+          break;
+
+        case 1:  // Deleted file
+          output.SignalDeletedAttachment(id,
+                                         statement.ReadInteger32(1),
+                                         statement.ReadInteger64(3),
+                                         statement.ReadString(4),
+                                         statement.ReadInteger32(5),
+                                         statement.ReadInteger64(6),
+                                         statement.ReadString(7));
+          break;
+
+        case 2:  // Deleted resource
+          output.SignalDeletedResource(id, static_cast<OrthancPluginResourceType>(statement.ReadInteger32(1)));
+          deletedResources.push_back(id);
+          break;
+
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);
+      }
+
+      statement.Next();
+    }
+  }
+
+  void PostgreSQLIndex::ClearRemainingAncestor(DatabaseManager& manager)
+  {
+  }
+
+  void PostgreSQLIndex::AddAttachment(DatabaseManager& manager,
+                                      int64_t id,
+                                      const OrthancPluginAttachment& attachment,
+                                      int64_t revision)
+  {
+    statisticsCache_.Invalidate();
+    IndexBackend::AddAttachment(manager, id, attachment, revision);
+  }
+
+  void PostgreSQLIndex::DeleteAttachment(IDatabaseBackendOutput& output,
+                                         DatabaseManager& manager,
+                                         int64_t id,
+                                         int32_t attachment)
+  {
+    statisticsCache_.Invalidate();
+
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "SELECT * FROM DeleteAttachment(${id}, ${type})");
+
+    statement.SetParameterType("id", ValueType_Integer64);
+    statement.SetParameterType("type", ValueType_Integer64);
+
+    Dictionary args;
+    args.SetIntegerValue("id", id);
+    args.SetIntegerValue("type", static_cast<int>(attachment));
+
+    statement.Execute(args);
+
+    std::vector<std::string> deletedResources;
+    SignalDeletedItems(output, NULL, deletedResources, statement);
+    NotifyDeletedResources(manager, deletedResources);
+  }
+
+  void PostgreSQLIndex::DeleteResource(IDatabaseBackendOutput& output,
+                                       DatabaseManager& manager,
+                                       int64_t id)
+  {
+    statisticsCache_.Invalidate();
+
+    // The function returns the remaining ancestor, then the deleted files and resources
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "SELECT * FROM DeleteResource(${id})");
+
+    // Deleting a patient can signal hundreds of thousands of files:
+    // The rows are received by chunks, not as a whole result set
+    statement.SetStreaming(true);
+    statement.SetParameterType("id", ValueType_Integer64);
+
+    Dictionary args;
+    args.SetIntegerValue("id", id);
+
+    statement.Execute(args);
+
+    std::vector<std::string> deletedResources;
+    SignalDeletedItems(output, NULL, deletedResources, statement);
+    NotifyDeletedResources(manager, deletedResources);
+  }
+
+
+  void PostgreSQLIndex::DeleteResources(IDatabaseBackendOutput& output,
+                                        std::map<std::string, OrthancPluginResourceType>& remainingAncestors,
+                                        DatabaseManager& manager,
+                                        const std::list<int64_t>& ids)
+  {
+    statisticsCache_.Invalidate();
+    remainingAncestors.clear();
+
+    if (ids.empty())
+    {
+      return;
+    }
+
+    std::string sql;
+    for (std::list<int64_t>::const_iterator it = ids.begin(); it != ids.end(); ++it)
+    {
+      sql += (sql.empty() ? "" : ",") + boost::lexical_cast<std::string>(*it);
+    }
+
+    std::vector<std::string> deletedResources;
+
+    {
+      // Not a cached statement, as the number of IDs varies
+      DatabaseManager::StandaloneStatement statement(
+        manager, "SELECT * FROM DeleteResources(ARRAY[" + sql + "]::BIGINT[])");
+
+      statement.SetStreaming(true);
+      statement.Execute();
+      SignalDeletedItems(output, &remainingAncestors, deletedResources, statement);
+    }
+
+    NotifyDeletedResources(manager, deletedResources);
+  }
+
+
+
+#if ORTHANC_PLUGINS_HAS_DATABASE_CONSTRAINT == 1
+  void PostgreSQLIndex::CreateInstance(OrthancPluginCreateInstanceResult& result,
+                                       DatabaseManager& manager,
+                                       const char* hashPatient,
+                                       const char* hashStudy,
+                                       const char* hashSeries,
+                                       const char* hashInstance)
+  {
+    statisticsCache_.Invalidate();
+
+    if (parameters_.IsMultiWriter())
+    {
+      // Serializes the concurrent ingestions of the same patient by
+      // several Orthanc servers, until the end of the transaction
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "SELECT pg_advisory_xact_lock(" + boost::lexical_cast<std::string>(POSTGRESQL_LOCK_CREATE_INSTANCE) +
+        ", hashtext(${patient}))");
+
+      statement.SetParameterType("patient", ValueType_Utf8String);
+
+      Dictionary args;
+      args.SetUtf8Value("patient", hashPatient);
+      statement.ExecuteWithoutResult(args);
+    }
+
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "SELECT * FROM CreateInstance(${patient}, ${study}, ${series}, ${instance})");
+
+    statement.SetParameterType("patient", ValueType_Utf8String);
+    statement.SetParameterType("study", ValueType_Utf8String);
+    statement.SetParameterType("series", ValueType_Utf8String);
+    statement.SetParameterType("instance", ValueType_Utf8String);
+
+    Dictionary args;
+    args.SetUtf8Value("patient", hashPatient);
+    args.SetUtf8Value("study", hashStudy);
+    args.SetUtf8Value("series", hashSeries);
+    args.SetUtf8Value("instance", hashInstance);
+
+    statement.Execute(args);
+
+    if (statement.IsDone() ||
+        statement.GetResultFieldsCount() != 8)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);
+    }
+
     for (size_t i = 0; i < 8; i++)
     {
       statement.SetResultFieldType(i, ValueType_Integer64);
@@ -525,150 +2050,154 @@ namespace OrthancDatabases
     result.isNewInstance = (statement.ReadInteger64(3) == 1);
     result.instanceId = statement.ReadInteger64(7);
 
-    if (result.isNewInstance)
+    if (result.isNewInstance)
+    {
+      result.isNewPatient = (statement.ReadInteger64(0) == 1);
+      result.isNewStudy = (statement.ReadInteger64(1) == 1);
+      result.isNewSeries = (statement.ReadInteger64(2) == 1);
+      result.patientId = statement.ReadInteger64(4);
+      result.studyId = statement.ReadInteger64(5);
+      result.seriesId = statement.ReadInteger64(6);
+
+      if (result.isNewStudy)
+      {
+        SignalCacheInvalidation(manager, CacheInvalidationType_NewStudy, result.studyId, "");
+      }
+    }
+  }
+#endif
+
+
+  /**
+   * Formats a PostgreSQL array literal, such as '{1,2,3}' or
+   * '{"a","b"}', which is sent as a single text parameter and cast to
+   * the array type on the server side.
+   **/
+  static void AppendArrayItem(std::string& target,
+                              const std::string& item,
+                              bool quote)
+  {
+    if (target.empty())
+    {
+      target = "{";
+    }
+    else
+    {
+      target += ",";
+    }
+
+    if (quote)
+    {
+      target.reserve(target.size() + item.size() + 2);
+      target += '"';
+
+      for (size_t i = 0; i < item.size(); i++)
+      {
+        if (item[i] == '"' ||
+            item[i] == '\\')
+        {
+          target += '\\';
+        }
+
+        target += item[i];
+      }
+
+      target += '"';
+    }
+    else
     {
-      result.isNewPatient = (statement.ReadInteger64(0) == 1);
-      result.isNewStudy = (statement.ReadInteger64(1) == 1);
-      result.isNewSeries = (statement.ReadInteger64(2) == 1);
-      result.patientId = statement.ReadInteger64(4);
-      result.studyId = statement.ReadInteger64(5);
-      result.seriesId = statement.ReadInteger64(6);
+      target += item;
     }
   }
-#endif
 
 
-#if ORTHANC_PLUGINS_HAS_DATABASE_CONSTRAINT == 1
-  static void ExecuteSetResourcesContentTags(
-    DatabaseManager& manager,
-    const std::string& table,
-    uint32_t count,
-    const OrthancPluginResourcesContentTags* tags)
+  static std::string CloseArray(const std::string& target)
   {
-    std::string sql;
+    return (target.empty() ? "{}" : target + "}");
+  }
 
-    std::vector<std::string> resourceIds;
-    std::vector<std::string> groups;
-    std::vector<std::string> elements;
-    std::vector<std::string> values;
 
-    Dictionary args;
-    
-    for (uint32_t i = 0; i < count; i++)
-    {
-      std::string resourceArgName = "r" + boost::lexical_cast<std::string>(i);
-      std::string groupArgName = "g" + boost::lexical_cast<std::string>(i);
-      std::string elementArgName = "e" + boost::lexical_cast<std::string>(i);
-      std::string valueArgName = "v" + boost::lexical_cast<std::string>(i);
+  void PostgreSQLIndex::WriteCacheInvalidation(DatabaseManager& manager,
+                                               const std::string& server,
+                                               CacheInvalidationType type,
+                                               int64_t internalId,
+                                               const std::string& value)
+  {
+    // The notification is only delivered if the transaction commits
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "SELECT pg_notify('orthanc_invalidations', ${payload})");
 
-      args.SetIntegerValue(resourceArgName, tags[i].resource);
-      args.SetInteger32Value(elementArgName, tags[i].element);
-      args.SetInteger32Value(groupArgName, tags[i].group);
-      args.SetUtf8Value(valueArgName, tags[i].value);
+    statement.SetParameterType("payload", ValueType_Utf8String);
 
-      std::string insert = ("(${" + resourceArgName + "}, ${" +
-                            groupArgName + "}, ${" +
-                            elementArgName + "}, " +
-                            "${" + valueArgName + "})");
+    Dictionary args;
+    args.SetUtf8Value("payload", CacheInvalidations::FormatPayload(server, type, internalId, value));
+    statement.ExecuteWithoutResult(args);
+  }
 
-      if (sql.empty())
-      {
-        sql = "INSERT INTO " + table + " VALUES " + insert;
-      }
-      else
-      {
-        sql += ", " + insert;
-      }
-    }
 
-    if (!sql.empty())
+  void PostgreSQLIndex::NotifyDeletedResources(DatabaseManager& manager,
+                                               const std::vector<std::string>& publicIds)
+  {
+    if (publicIds.empty())
     {
-      DatabaseManager::CachedStatement statement(STATEMENT_FROM_HERE_DYNAMIC(sql), manager, sql);
-      
-      for (uint32_t i = 0; i < count; i++)
-      {
-        statement.SetParameterType("r" + boost::lexical_cast<std::string>(i),
-                                    ValueType_Integer64);
-        statement.SetParameterType("g" + boost::lexical_cast<std::string>(i),
-                                    ValueType_Integer32);
-        statement.SetParameterType("e" + boost::lexical_cast<std::string>(i),
-                                    ValueType_Integer32);
-        statement.SetParameterType("v" + boost::lexical_cast<std::string>(i),
-                                   ValueType_Utf8String);
-      }
-
-      statement.Execute(args);
+      return;
     }
-  }
-#endif
-  
 
-#if ORTHANC_PLUGINS_HAS_DATABASE_CONSTRAINT == 1
-  static void ExecuteSetResourcesContentMetadata(
-    DatabaseManager& manager,
-    bool hasRevisionsSupport,
-    uint32_t count,
-    const OrthancPluginResourcesContentMetadata* metadata)
-  {
-    if (count < 1)
+    InvalidateCachedResources(manager, std::list<std::string>(publicIds.begin(), publicIds.end()));
+
+    if (!HasCacheInvalidations())
     {
       return;
     }
 
-    std::vector<std::string> resourceIds;
-    std::vector<std::string> metadataTypes;
-    std::vector<std::string> metadataValues;
-    std::vector<std::string> revisions;
+    // Bounded batches, so that deleting a whole patient doesn't build one huge array
+    static const size_t BATCH_SIZE = 1000;
 
-    Dictionary args;
-    
-    for (uint32_t i = 0; i < count; i++)
+    for (size_t start = 0; start < publicIds.size(); start += BATCH_SIZE)
     {
-      std::string resourceArgName = "r" + boost::lexical_cast<std::string>(i);
-      std::string typeArgName = "t" + boost::lexical_cast<std::string>(i);
-      std::string valueArgName = "v" + boost::lexical_cast<std::string>(i);
+      const size_t end = std::min(publicIds.size(), start + BATCH_SIZE);
 
-      args.SetIntegerValue(resourceArgName, metadata[i].resource);
-      args.SetInteger32Value(typeArgName, metadata[i].metadata);
-      args.SetUtf8Value(valueArgName, metadata[i].value);
+      std::string payloads;
+      for (size_t i = start; i < end; i++)
+      {
+        AppendArrayItem(payloads, CacheInvalidations::FormatPayload(
+                          GetCacheInvalidations().GetServer(), CacheInvalidationType_DeletedResource, -1, publicIds[i]), true);
+      }
 
-      resourceIds.push_back("${" + resourceArgName + "}");
-      metadataTypes.push_back("${" + typeArgName + "}");
-      metadataValues.push_back("${" + valueArgName + "}");
-      revisions.push_back("0");
-    }
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "SELECT pg_notify('orthanc_invalidations', p) FROM UNNEST(CAST(${payloads} AS TEXT[])) AS p");
 
-    std::string joinedResourceIds;
-    std::string joinedMetadataTypes;
-    std::string joinedMetadataValues;
-    std::string joinedRevisions;
+      statement.SetParameterType("payloads", ValueType_Utf8String);
 
-    Orthanc::Toolbox::JoinStrings(joinedResourceIds, resourceIds, ",");
-    Orthanc::Toolbox::JoinStrings(joinedMetadataTypes, metadataTypes, ",");
-    Orthanc::Toolbox::JoinStrings(joinedMetadataValues, metadataValues, ",");
-    Orthanc::Toolbox::JoinStrings(joinedRevisions, revisions, ",");
+      Dictionary args;
+      args.SetUtf8Value("payloads", CloseArray(payloads));
+      statement.ExecuteWithoutResult(args);
+    }
+  }
 
-    std::string sql = std::string("SELECT InsertOrUpdateMetadata(ARRAY[") + 
-                                  joinedResourceIds + "], ARRAY[" + 
-                                  joinedMetadataTypes + "], ARRAY[" + 
-                                  joinedMetadataValues + "], ARRAY[" + 
-                                  joinedRevisions + "])";
 
-    DatabaseManager::CachedStatement statement(STATEMENT_FROM_HERE_DYNAMIC(sql), manager, sql);
+  static void SetTagsArrays(Dictionary& args,
+                            const std::string& prefix,
+                            uint32_t count,
+                            const OrthancPluginResourcesContentTags* tags)
+  {
+    std::string resources, groups, elements, values;
 
     for (uint32_t i = 0; i < count; i++)
     {
-      statement.SetParameterType("v" + boost::lexical_cast<std::string>(i),
-                                  ValueType_Utf8String);
-      statement.SetParameterType("r" + boost::lexical_cast<std::string>(i),
-                                  ValueType_Integer64);
-      statement.SetParameterType("t" + boost::lexical_cast<std::string>(i),
-                                  ValueType_Integer32);
+      AppendArrayItem(resources, boost::lexical_cast<std::string>(tags[i].resource), false);
+      AppendArrayItem(groups, boost::lexical_cast<std::string>(tags[i].group), false);
+      AppendArrayItem(elements, boost::lexical_cast<std::string>(tags[i].element), false);
+      AppendArrayItem(values, tags[i].value, true);
     }
 
-    statement.Execute(args);
+    args.SetUtf8Value(prefix + "r", CloseArray(resources));
+    args.SetUtf8Value(prefix + "g", CloseArray(groups));
+    args.SetUtf8Value(prefix + "e", CloseArray(elements));
+    args.SetUtf8Value(prefix + "v", CloseArray(values));
   }
-#endif
 
 
   void PostgreSQLIndex::SetResourcesContent(DatabaseManager& manager,
@@ -679,12 +2208,208 @@ namespace OrthancDatabases
                                      uint32_t countMetadata,
                                      const OrthancPluginResourcesContentMetadata* metadata)
   {
-    ExecuteSetResourcesContentTags(manager, "DicomIdentifiers", countIdentifierTags, identifierTags);
+    if (countIdentifierTags == 0 &&
+        countMainDicomTags == 0 &&
+        countMetadata == 0)
+    {
+      return;
+    }
+
+    /**
+     * All the tags and metadata of the 4 levels are shipped as arrays
+     * to a server-side function, which results in a single cached
+     * statement and a single round-trip per instance.
+     **/
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "SELECT SetResourcesContent("
+      "CAST(${ir} AS BIGINT[]), CAST(${ig} AS INTEGER[]), CAST(${ie} AS INTEGER[]), CAST(${iv} AS TEXT[]), "
+      "CAST(${tr} AS BIGINT[]), CAST(${tg} AS INTEGER[]), CAST(${te} AS INTEGER[]), CAST(${tv} AS TEXT[]), "
+      "CAST(${mr} AS BIGINT[]), CAST(${mt} AS INTEGER[]), CAST(${mv} AS TEXT[]))");
+
+    const char* const PARAMETERS[] = { "ir", "ig", "ie", "iv", "tr", "tg", "te", "tv", "mr", "mt", "mv" };
+    for (size_t i = 0; i < sizeof(PARAMETERS) / sizeof(PARAMETERS[0]); i++)
+    {
+      statement.SetParameterType(PARAMETERS[i], ValueType_Utf8String);
+    }
+
+    Dictionary args;
+    SetTagsArrays(args, "i", countIdentifierTags, identifierTags);
+    SetTagsArrays(args, "t", countMainDicomTags, mainDicomTags);
+
+    std::string resources, types, values;
+
+    for (uint32_t i = 0; i < countMetadata; i++)
+    {
+      AppendArrayItem(resources, boost::lexical_cast<std::string>(metadata[i].resource), false);
+      AppendArrayItem(types, boost::lexical_cast<std::string>(metadata[i].metadata), false);
+      AppendArrayItem(values, metadata[i].value, true);
+    }
+
+    args.SetUtf8Value("mr", CloseArray(resources));
+    args.SetUtf8Value("mt", CloseArray(types));
+    args.SetUtf8Value("mv", CloseArray(values));
+
+    statement.Execute(args);
+
+    UpdateStudyColumnStore(countIdentifierTags, identifierTags);
+  }
+
+
+  static void SetDeferredTagsArrays(Dictionary& args,
+                                    const std::string& prefix,
+                                    const std::vector<DeferredWrites::Tag>& tags)
+  {
+    std::string resources, groups, elements, values;
+
+    for (size_t i = 0; i < tags.size(); i++)
+    {
+      AppendArrayItem(resources, boost::lexical_cast<std::string>(tags[i].resource_), false);
+      AppendArrayItem(groups, boost::lexical_cast<std::string>(tags[i].group_), false);
+      AppendArrayItem(elements, boost::lexical_cast<std::string>(tags[i].element_), false);
+      AppendArrayItem(values, tags[i].value_, true);
+    }
+
+    args.SetUtf8Value(prefix + "r", CloseArray(resources));
+    args.SetUtf8Value(prefix + "g", CloseArray(groups));
+    args.SetUtf8Value(prefix + "e", CloseArray(elements));
+    args.SetUtf8Value(prefix + "v", CloseArray(values));
+  }
+
+
+  static void SetDeferredMetadataArrays(Dictionary& args,
+                                        const std::string& prefix,
+                                        const std::vector<DeferredWrites::ResourceMetadata>& metadata,
+                                        bool withRevisions)
+  {
+    std::string resources, types, values, revisions;
+
+    for (size_t i = 0; i < metadata.size(); i++)
+    {
+      AppendArrayItem(resources, boost::lexical_cast<std::string>(metadata[i].resource_), false);
+      AppendArrayItem(types, boost::lexical_cast<std::string>(metadata[i].type_), false);
+      AppendArrayItem(values, metadata[i].value_, true);
+      AppendArrayItem(revisions, boost::lexical_cast<std::string>(metadata[i].revision_), false);
+    }
+
+    args.SetUtf8Value(prefix + "r", CloseArray(resources));
+    args.SetUtf8Value(prefix + "t", CloseArray(types));
+    args.SetUtf8Value(prefix + "v", CloseArray(values));
+
+    if (withRevisions)
+    {
+      args.SetUtf8Value(prefix + "n", CloseArray(revisions));
+    }
+  }
+
+
+  void PostgreSQLIndex::FlushDeferredWrites(DatabaseManager& manager,
+                                            const DeferredWrites& writes)
+  {
+    if (writes.IsEmpty())
+    {
+      return;
+    }
+
+    // The log of the exported resources is not part of the ingestion
+    LogExportedResources(manager, writes.GetExportedResources());
+
+    if (writes.GetIdentifierTags().empty() &&
+        writes.GetMainDicomTags().empty() &&
+        writes.GetResourcesMetadata().empty() &&
+        writes.GetAttachments().empty() &&
+        writes.GetMetadata().empty() &&
+        writes.GetChanges().empty())
+    {
+      return;
+    }
 
-    ExecuteSetResourcesContentTags(manager, "MainDicomTags", countMainDicomTags, mainDicomTags);
+    statisticsCache_.Invalidate();
+
+    /**
+     * All the writes that follow "CreateInstance()" during the
+     * ingestion of one instance are sent to the "IngestResources()"
+     * server-side function, in a single round-trip.
+     **/
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "SELECT IngestResources("
+      "CAST(${ir} AS BIGINT[]), CAST(${ig} AS INTEGER[]), CAST(${ie} AS INTEGER[]), CAST(${iv} AS TEXT[]), "
+      "CAST(${tr} AS BIGINT[]), CAST(${tg} AS INTEGER[]), CAST(${te} AS INTEGER[]), CAST(${tv} AS TEXT[]), "
+      "CAST(${mr} AS BIGINT[]), CAST(${mt} AS INTEGER[]), CAST(${mv} AS TEXT[]), "
+      "CAST(${ar} AS BIGINT[]), CAST(${at} AS INTEGER[]), CAST(${au} AS TEXT[]), CAST(${acs} AS BIGINT[]), "
+      "CAST(${aus} AS BIGINT[]), CAST(${act} AS INTEGER[]), CAST(${auh} AS TEXT[]), CAST(${ach} AS TEXT[]), "
+      "CAST(${an} AS INTEGER[]), "
+      "CAST(${sr} AS BIGINT[]), CAST(${st} AS INTEGER[]), CAST(${sv} AS TEXT[]), CAST(${sn} AS INTEGER[]), "
+      "CAST(${ct} AS INTEGER[]), CAST(${cr} AS BIGINT[]), CAST(${crt} AS INTEGER[]), CAST(${cd} AS TEXT[]))");
+
+    const char* const PARAMETERS[] = {
+      "ir", "ig", "ie", "iv", "tr", "tg", "te", "tv", "mr", "mt", "mv",
+      "ar", "at", "au", "acs", "aus", "act", "auh", "ach", "an",
+      "sr", "st", "sv", "sn", "ct", "cr", "crt", "cd"
+    };
     
-    ExecuteSetResourcesContentMetadata(manager, HasRevisionsSupport(), countMetadata, metadata);
+    for (size_t i = 0; i < sizeof(PARAMETERS) / sizeof(PARAMETERS[0]); i++)
+    {
+      statement.SetParameterType(PARAMETERS[i], ValueType_Utf8String);
+    }
+
+    Dictionary args;
+    SetDeferredTagsArrays(args, "i", writes.GetIdentifierTags());
+    SetDeferredTagsArrays(args, "t", writes.GetMainDicomTags());
+    SetDeferredMetadataArrays(args, "m", writes.GetResourcesMetadata(), false);
+    SetDeferredMetadataArrays(args, "s", writes.GetMetadata(), true);
+
+    {
+      std::string resources, types, uuids, compressedSizes, uncompressedSizes,
+        compressionTypes, uncompressedHashes, compressedHashes, revisions;
+
+      for (size_t i = 0; i < writes.GetAttachments().size(); i++)
+      {
+        const DeferredWrites::Attachment& item = writes.GetAttachments()[i];
+        AppendArrayItem(resources, boost::lexical_cast<std::string>(item.resource_), false);
+        AppendArrayItem(types, boost::lexical_cast<std::string>(item.contentType_), false);
+        AppendArrayItem(uuids, item.uuid_, true);
+        AppendArrayItem(compressedSizes, boost::lexical_cast<std::string>(item.compressedSize_), false);
+        AppendArrayItem(uncompressedSizes, boost::lexical_cast<std::string>(item.uncompressedSize_), false);
+        AppendArrayItem(compressionTypes, boost::lexical_cast<std::string>(item.compressionType_), false);
+        AppendArrayItem(uncompressedHashes, item.uncompressedHash_, true);
+        AppendArrayItem(compressedHashes, item.compressedHash_, true);
+        AppendArrayItem(revisions, boost::lexical_cast<std::string>(item.revision_), false);
+      }
+
+      args.SetUtf8Value("ar", CloseArray(resources));
+      args.SetUtf8Value("at", CloseArray(types));
+      args.SetUtf8Value("au", CloseArray(uuids));
+      args.SetUtf8Value("acs", CloseArray(compressedSizes));
+      args.SetUtf8Value("aus", CloseArray(uncompressedSizes));
+      args.SetUtf8Value("act", CloseArray(compressionTypes));
+      args.SetUtf8Value("auh", CloseArray(uncompressedHashes));
+      args.SetUtf8Value("ach", CloseArray(compressedHashes));
+      args.SetUtf8Value("an", CloseArray(revisions));
+    }
+
+    {
+      std::string types, resources, resourceTypes, dates;
+
+      for (size_t i = 0; i < writes.GetChanges().size(); i++)
+      {
+        const DeferredWrites::Change& item = writes.GetChanges()[i];
+        AppendArrayItem(types, boost::lexical_cast<std::string>(item.changeType_), false);
+        AppendArrayItem(resources, boost::lexical_cast<std::string>(item.resource_), false);
+        AppendArrayItem(resourceTypes, boost::lexical_cast<std::string>(static_cast<int>(item.resourceType_)), false);
+        AppendArrayItem(dates, item.date_, true);
+      }
+
+      args.SetUtf8Value("ct", CloseArray(types));
+      args.SetUtf8Value("cr", CloseArray(resources));
+      args.SetUtf8Value("crt", CloseArray(resourceTypes));
+      args.SetUtf8Value("cd", CloseArray(dates));
+    }
+
+    statement.Execute(args);
 
+    UpdateStudyColumnStore(writes.GetIdentifierTags());
   }
 
 
@@ -696,6 +2421,30 @@ namespace OrthancDatabases
            OrthancPluginResourceType_Series == 2 &&
            OrthancPluginResourceType_Instance == 3);
 
+    if (statisticsCache_.IsEnabled())
+    {
+      StatisticsCache::Statistics statistics;
+      GetCachedStatistics(statistics, manager);
+
+      switch (resourceType)
+      {
+        case OrthancPluginResourceType_Patient:
+          return static_cast<uint64_t>(statistics.patientsCount_);
+
+        case OrthancPluginResourceType_Study:
+          return static_cast<uint64_t>(statistics.studiesCount_);
+
+        case OrthancPluginResourceType_Series:
+          return static_cast<uint64_t>(statistics.seriesCount_);
+
+        case OrthancPluginResourceType_Instance:
+          return static_cast<uint64_t>(statistics.instancesCount_);
+
+        default:
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+      }
+    }
+
     uint64_t result;
     
     {
@@ -724,6 +2473,12 @@ namespace OrthancDatabases
 
   int64_t PostgreSQLIndex::GetLastChangeIndex(DatabaseManager& manager)
   {
+    int64_t cached;
+    if (LookupCachedLastChangeIndex(cached))
+    {
+      return cached;
+    }
+
     DatabaseManager::CachedStatement statement(
       STATEMENT_FROM_HERE, manager,
       "SELECT value FROM GlobalIntegers WHERE key = 6");
@@ -735,6 +2490,29 @@ namespace OrthancDatabases
   }
 
 
+  void PostgreSQLIndex::GetChangesExtended(IDatabaseBackendOutput& output,
+                                           bool& done /*out*/,
+                                           DatabaseManager& manager,
+                                           int64_t since,
+                                           int64_t to,
+                                           const std::set<uint32_t>& changeTypes,
+                                           uint32_t limit)
+  {
+    int64_t cached;
+    if (since > 0 &&
+        LookupCachedLastChangeIndex(cached) &&
+        since >= cached)
+    {
+      // The consumer is polling past the last change: Nothing to read
+      done = true;
+    }
+    else
+    {
+      IndexBackend::GetChangesExtended(output, done, manager, since, to, changeTypes, limit);
+    }
+  }
+
+
   void PostgreSQLIndex::TagMostRecentPatient(DatabaseManager& manager,
                                              int64_t patient)
   {
@@ -750,31 +2528,245 @@ namespace OrthancDatabases
 
   void PostgreSQLIndex::PerformDbHousekeeping(DatabaseManager& manager)
   {
-    // Compute the missing child count (table introduced in rev3)
-    if (!hkHasComputedAllMissingChildCount_)
+    PerformHousekeepingTask(manager, "ComputeMissingChildCount");
+    PerformHousekeepingTask(manager, "UpdateStatistics");
+    PerformHousekeepingTask(manager, "RollupChildCounts");
+    PerformHousekeepingTask(manager, "CompactLabelsCatalog");
+  }
+
+  void PostgreSQLIndex::RegisterHousekeepingTasks(HousekeepingScheduler& scheduler,
+                                                  unsigned int defaultIntervalSeconds,
+                                                  const boost::posix_time::ptime& now)
+  {
+    scheduler.AddTask("ComputeMissingChildCount", GetHousekeepingInterval("ComputeMissingChildCount", defaultIntervalSeconds), now);
+    scheduler.AddTask("UpdateStatistics", GetHousekeepingInterval("UpdateStatistics", defaultIntervalSeconds), now);
+    scheduler.AddTask("RollupChildCounts", GetHousekeepingInterval("RollupChildCounts", defaultIntervalSeconds), now);
+    scheduler.AddTask("Analyze", GetHousekeepingInterval("Analyze", 0), now);
+
+    if (!IsReadOnly())
     {
-      DatabaseManager::CachedStatement statement(STATEMENT_FROM_HERE, manager,
-        "SELECT ComputeMissingChildCount(50)");
+      scheduler.AddTask("CompactLabelsCatalog", GetHousekeepingInterval("CompactLabelsCatalog", defaultIntervalSeconds), now);
+      scheduler.AddTask("OnlineUpgrades", GetHousekeepingInterval("OnlineUpgrades", defaultIntervalSeconds), now);
+    }
 
-      statement.Execute();
+    if (changesPartitionSize_ > 0 &&
+        !IsReadOnly())
+    {
+      scheduler.AddTask("ChangesPartitions", GetHousekeepingInterval("ChangesPartitions", defaultIntervalSeconds), now);
+    }
+
+    if (tagsPartitionsCount_ > 0 &&
+        !IsReadOnly())
+    {
+      scheduler.AddTask("TagsPartitioning", GetHousekeepingInterval("TagsPartitioning", defaultIntervalSeconds), now);
+    }
+
+    if (GetExportedResourcesRetentionDays() > 0 &&
+        !IsReadOnly())
+    {
+      scheduler.AddTask("ExportedResourcesRetention",
+                        GetHousekeepingInterval("ExportedResourcesRetention", defaultIntervalSeconds), now);
+    }
+
+    if (HasStudyColumnStore())
+    {
+      scheduler.AddTask("StudyColumnStore", GetHousekeepingInterval("StudyColumnStore", defaultIntervalSeconds), now);
+    }
+
+    scheduler.AddTask("DatabaseMetrics", GetHousekeepingInterval("DatabaseMetrics", 0), now);
+  }
+
+  void PostgreSQLIndex::CollectDatabaseMetrics(std::map<std::string, float>& metrics,
+                                               DatabaseManager& manager)
+  {
+    IndexBackend::CollectDatabaseMetrics(metrics, manager);
+
+    // Backlog of the "UpdateStatistics" housekeeping task
+    DatabaseManager::Transaction t(manager, TransactionType_ReadOnly);
+
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "SELECT COUNT(*) FROM GlobalIntegersChanges");
+
+    statement.SetReadOnly(true);
+    statement.Execute();
+    statement.SetResultFieldType(0, ValueType_Integer64);
+
+    metrics["orthanc_index_pending_statistics_changes"] = static_cast<float>(statement.ReadInteger64(0));
+
+    // Backlog of the "RollupChildCounts" housekeeping task
+    DatabaseManager::CachedStatement childCounts(
+      STATEMENT_FROM_HERE, manager,
+      "SELECT COUNT(*) FROM ChildCountChanges");
+
+    childCounts.SetReadOnly(true);
+    childCounts.Execute();
+    childCounts.SetResultFieldType(0, ValueType_Integer64);
+
+    metrics["orthanc_index_pending_child_count_changes"] = static_cast<float>(childCounts.ReadInteger64(0));
+
+    t.Commit();
+  }
+
+  void PostgreSQLIndex::PerformHousekeepingTask(DatabaseManager& manager,
+                                                const std::string& task)
+  {
+    if (task == "ComputeMissingChildCount")
+    {
+      // Compute the missing child count (table introduced in rev3) by ranges of
+      // "internalId", the progress being saved with the updates, so that the
+      // backfill is resumed after a restart
+      if (!hkHasComputedAllMissingChildCount_)
+      {
+        DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+
+        Json::Value progress = Json::objectValue;
+
+        std::string s;
+        if (LookupGlobalProperty(s, manager, MISSING_SERVER_IDENTIFIER, Orthanc::GlobalProperty_OnlineUpgrades) &&
+            (!Orthanc::Toolbox::ReadJson(progress, s) ||
+             progress.type() != Json::objectValue))
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Corrupted progress of the online upgrades");
+        }
+
+        int64_t lastId = 0;
+        if (progress.isMember(ONLINE_UPGRADE_CHILD_COUNT))
+        {
+          lastId = progress[ONLINE_UPGRADE_CHILD_COUNT].asInt64();
+        }
+
+        if (lastId != -1)
+        {
+          DatabaseManager::CachedStatement statement(STATEMENT_FROM_HERE, manager,
+            "SELECT ComputeMissingChildCountFrom(${after}, ${batch})");
+
+          statement.SetParameterType("after", ValueType_Integer64);
+          statement.SetParameterType("batch", ValueType_Integer64);
+
+          Dictionary args;
+          args.SetIntegerValue("after", lastId);
+          args.SetIntegerValue("batch", CHILD_COUNT_BATCH_SIZE);
+
+          statement.Execute(args);
+          lastId = statement.ReadInteger64(0);
+
+          progress[ONLINE_UPGRADE_CHILD_COUNT] = static_cast<Json::Int64>(lastId);
+          Orthanc::Toolbox::WriteFastJson(s, progress);
+          SetGlobalProperty(manager, MISSING_SERVER_IDENTIFIER, Orthanc::GlobalProperty_OnlineUpgrades, s.c_str());
+        }
+
+        t.Commit();
 
-      int64_t updatedCount = statement.ReadInteger64(0);
-      hkHasComputedAllMissingChildCount_ = updatedCount == 0;
+        if (lastId == -1)
+        {
+          LOG(INFO) << "No missing ChildCount entries";
+          hkHasComputedAllMissingChildCount_ = true;
+        }
+        else
+        {
+          LOG(INFO) << "Computed the missing ChildCount entries up to resource " << lastId;
+        }
+      }
+    }
+    else if (task == "UpdateStatistics")
+    {
+      if (unloggedTables_)
+      {
+        RecoverUnloggedTables(manager);
+      }
 
-      if (updatedCount > 0)
+      // Consume the statistics delta to minimize computation when calling ComputeStatisticsReadOnly
+      if (statisticsRollupBatchSize_ == 0)
       {
-        LOG(INFO) << "Computed " << updatedCount << " missing ChildCount entries";
+        int64_t patientsCount, studiesCount, seriesCount, instancesCount, compressedSize, uncompressedSize;
+        UpdateAndGetStatistics(manager, patientsCount, studiesCount, seriesCount, instancesCount, compressedSize, uncompressedSize);
       }
       else
       {
-        LOG(INFO) << "No missing ChildCount entries";
+        // Each batch is a separate transaction, and the work of one pass is bounded: The
+        // remaining rows are folded by the next passes
+        int64_t total = 0;
+
+        for (unsigned int i = 0; i < STATISTICS_ROLLUP_BATCHES_PER_HOUSEKEEPING; i++)
+        {
+          const int64_t count = RollupStatistics(manager, statisticsRollupBatchSize_);
+          total += count;
+
+          if (count < static_cast<int64_t>(statisticsRollupBatchSize_))
+          {
+            break;
+          }
+        }
+
+        if (total > 0)
+        {
+          LOG(INFO) << "Folded " << total << " changes into the statistics";
+        }
+
+        if (statisticsCache_.IsEnabled())
+        {
+          // Publish a snapshot, which also answers the read-only transactions of the replicas
+          const uint64_t revision = statisticsCache_.GetRevision();
+          StatisticsCache::Statistics statistics;
+          ReadStatistics(statistics, manager);
+          statisticsCache_.Store(statistics, revision, boost::posix_time::microsec_clock::universal_time());
+        }
+      }
+    }
+    else if (task == "RollupChildCounts")
+    {
+      // The triggers only append to "ChildCountChanges", which doesn't serialize
+      // the ingest of the instances of the same series on the row of the series
+      const unsigned int batchSize = (statisticsRollupBatchSize_ == 0 ? 10000 : statisticsRollupBatchSize_);
+      int64_t total = 0;
+
+      for (unsigned int i = 0; i < STATISTICS_ROLLUP_BATCHES_PER_HOUSEKEEPING; i++)
+      {
+        const int64_t count = RollupChildCounts(manager, batchSize);
+        total += count;
+
+        if (count < static_cast<int64_t>(batchSize))
+        {
+          break;
+        }
+      }
+
+      if (total > 0)
+      {
+        LOG(INFO) << "Folded " << total << " changes into the child counts";
       }
     }
+    else if (task == "CompactLabelsCatalog")
+    {
+      const int64_t count = CompactLabelsCatalog(manager);
 
-    // Consume the statistics delta to minimize computation when calling ComputeStatisticsReadOnly
+      if (count > 0)
+      {
+        LOG(INFO) << "Folded " << count << " shards of the labels catalog";
+      }
+    }
+    else if (task == "Analyze")
+    {
+      // Refresh the planner statistics of the largest tables, in addition to autovacuum
+      DatabaseManager::StandaloneStatement statement(manager, "ANALYZE Resources, MainDicomTags, DicomIdentifiers, Metadata, AttachedFiles");
+      statement.ExecuteWithoutResult();
+    }
+    else if (task == "OnlineUpgrades")
+    {
+      PerformOnlineUpgrades(manager);
+    }
+    else if (task == "ChangesPartitions")
+    {
+      MaintainChangesPartitions(manager);
+    }
+    else if (task == "TagsPartitioning")
+    {
+      MigrateTagsPartitions(manager);
+    }
+    else
     {
-      int64_t patientsCount, studiesCount, seriesCount, instancesCount, compressedSize, uncompressedSize;
-      UpdateAndGetStatistics(manager, patientsCount, studiesCount, seriesCount, instancesCount, compressedSize, uncompressedSize);
+      IndexBackend::PerformHousekeepingTask(manager, task);
     }
   }
 }
@@ -24,6 +24,7 @@
 #pragma once
 
 #include "../../Framework/Plugins/IndexBackend.h"
+#include "../../Framework/Plugins/StatisticsCache.h"
 #include "../../Framework/PostgreSQL/PostgreSQLParameters.h"
 #include <boost/thread.hpp>
 
@@ -34,8 +35,73 @@ namespace OrthancDatabases
   {
   private:
     PostgreSQLParameters   parameters_;
+    std::unique_ptr<PostgreSQLParameters>  replicaParameters_;
+    size_t                 replicaConnectionsCount_;
     bool                   clearAll_;
     bool                   hkHasComputedAllMissingChildCount_;
+    bool                   hkHasPerformedOnlineUpgrades_;
+    bool                   batchIngestWrites_;
+    bool                   resourceSummary_;
+    std::set<int64_t>      sortKeys_;
+    unsigned int           statisticsRollupBatchSize_;
+    bool                   changesNotifications_;
+    unsigned int           changesPartitionSize_;
+    unsigned int           changesRetentionDays_;
+    unsigned int           tagsPartitionsCount_;
+    unsigned int           tagsPartitioningBatchSize_;
+    bool                   hkHasSwappedTagsPartitions_;
+    bool                   studyDateBrinIndex_;
+    bool                   lastUpdateIndex_;
+    bool                   unloggedTables_;
+    bool                   binaryCollation_;
+    bool                   hasBinaryCollation_;   // Whether "DicomIdentifiers.value" has the "C" collation
+    bool                   citus_;
+    boost::mutex           changesMutex_;
+    bool                   changesListenerStop_;  // Protected by "changesMutex_"
+    int64_t                lastChangeIndex_;      // Protected by "changesMutex_", -1 if unknown
+    boost::thread          changesListener_;
+    StatisticsCache        statisticsCache_;
+
+    static void ChangesListenerThread(PostgreSQLIndex* that);
+
+    void ListenChanges();
+
+    bool LookupCachedLastChangeIndex(int64_t& target);
+
+    void MaintainChangesPartitions(DatabaseManager& manager);
+
+    void MigrateTagsPartitions(DatabaseManager& manager);
+
+    // Recomputes the statistics and the child counts if the crash
+    // recovery of PostgreSQL has emptied the unlogged tables
+    void RecoverUnloggedTables(DatabaseManager& manager);
+
+    void PerformOnlineUpgrades(DatabaseManager& manager);
+
+    // Makes "SortKeysDefinitions" match "sortKeys_", and backfills
+    // the values of the new keys
+    void SynchronizeSortKeys(DatabaseManager& manager);
+
+    // Reads the statistics with one read-only statement, without folding the pending changes
+    void ReadStatistics(StatisticsCache::Statistics& target,
+                        DatabaseManager& manager);
+
+    void GetCachedStatistics(StatisticsCache::Statistics& target,
+                             DatabaseManager& manager);
+
+    // Reads the result set of the SQL functions that delete resources or
+    // attachments (cf. "ConsumeDeletedItems()"). The remaining ancestors
+    // are stored in "remainingAncestors" if not NULL, or signaled otherwise.
+    // The public IDs of the deleted resources are added to "deletedResources".
+    void SignalDeletedItems(IDatabaseBackendOutput& output,
+                            std::map<std::string, OrthancPluginResourceType>* remainingAncestors,
+                            std::vector<std::string>& deletedResources,
+                            DatabaseManager::StatementBase& statement);
+
+    // Invalidates the cached lookups of the deleted resources at commit,
+    // and publishes their invalidations by a single statement
+    void NotifyDeletedResources(DatabaseManager& manager,
+                                const std::vector<std::string>& publicIds);
 
   protected:
     virtual void ClearDeletedFiles(DatabaseManager& manager) ORTHANC_OVERRIDE;
@@ -44,25 +110,268 @@ namespace OrthancDatabases
 
     virtual void ClearRemainingAncestor(DatabaseManager& manager) ORTHANC_OVERRIDE;
 
+    // The invalidations are notified on the channel "orthanc_invalidations"
+    virtual void WriteCacheInvalidation(DatabaseManager& manager,
+                                        const std::string& server,
+                                        CacheInvalidationType type,
+                                        int64_t internalId,
+                                        const std::string& value) ORTHANC_OVERRIDE;
+
     virtual bool HasChildCountTable() const ORTHANC_OVERRIDE
     {
       return true;
     }
 
+    // "FOR UPDATE SKIP LOCKED" on PostgreSQL >= 9.5
+    virtual std::string GetRecyclingLockClause(DatabaseManager& manager) ORTHANC_OVERRIDE;
+
+    // "statement_timeout", local to the current transaction
+    virtual void SetStatementTimeout(DatabaseManager& manager,
+                                     unsigned int milliseconds) ORTHANC_OVERRIDE;
+
+    virtual bool LookupAdvisedIndex(std::string& name,
+                                    std::string& sql,
+                                    DatabaseManager& manager,
+                                    const Orthanc::DicomTag& tag) ORTHANC_OVERRIDE;
+
+    // "CREATE INDEX CONCURRENTLY" cannot be executed within a transaction
+    virtual void CreateAdvisedIndex(DatabaseManager& manager,
+                                    const std::string& sql) ORTHANC_OVERRIDE;
+
+    // Reads "pg_stat_statements", if the extension is installed
+    virtual void ReadStatementsStatistics(Json::Value& target,
+                                          DatabaseManager& manager) ORTHANC_OVERRIDE;
+
+    virtual bool HasResourceSummary() const ORTHANC_OVERRIDE
+    {
+      return resourceSummary_;
+    }
+
+    virtual bool HasLabelsCatalog() const ORTHANC_OVERRIDE
+    {
+      return true;
+    }
+
+    virtual const std::set<int64_t>* GetSortKeys() const ORTHANC_OVERRIDE
+    {
+      return (sortKeys_.empty() ? NULL : &sortKeys_);
+    }
+
     void ApplyPrepareIndex(DatabaseManager::Transaction& t, DatabaseManager& manager);
 
+    // Folds at most "maxRows" rows of "GlobalIntegersChanges" into
+    // "GlobalIntegers", returns the number of folded rows
+    int64_t RollupStatistics(DatabaseManager& manager,
+                             unsigned int maxRows);
+
+    // Folds at most "maxRows" rows of "ChildCountChanges" into
+    // "Resources.childCount", returns the number of folded rows
+    int64_t RollupChildCounts(DatabaseManager& manager,
+                              unsigned int maxRows);
+
+    // Folds the shards of "LabelsCatalog" into its shard "-1", and
+    // removes the labels that are not used anymore. Returns the
+    // number of folded rows.
+    int64_t CompactLabelsCatalog(DatabaseManager& manager);
+
   public:
     PostgreSQLIndex(OrthancPluginContext* context,
                     const PostgreSQLParameters& parameters,
                     bool readOnly = false);
 
+    virtual ~PostgreSQLIndex();
+
     void SetClearAll(bool clear)
     {
       clearAll_ = clear;
     }
 
+    void SetBatchIngestWrites(bool batch)
+    {
+      batchIngestWrites_ = batch;
+    }
+
+    // Requires PostgreSQL >= 10. The table is created (or dropped)
+    // by "ConfigureDatabase()" according to this option.
+    void SetResourceSummary(bool enabled)
+    {
+      resourceSummary_ = enabled;
+    }
+
+    /**
+     * The ordering keys of "ExecuteFind()" whose values are copied in
+     * the "SortKeys" table, whose index gives the order of the results.
+     * Each key is either a DICOM tag "gggg,eeee", or the number of a
+     * metadata (e.g. "7" for "LastUpdate"). Requires PostgreSQL >= 10.
+     * The table is created (or dropped if the set is empty) by
+     * "ConfigureDatabase()".
+     **/
+    void SetSortKeys(const std::set<std::string>& keys);
+
+    /**
+     * Maximum number of rows of "GlobalIntegersChanges" that are folded
+     * into "GlobalIntegers" by one transaction ("0" means no limit).
+     * "UpdateAndGetStatistics()" folds one batch, and each housekeeping
+     * pass folds a bounded number of batches.
+     **/
+    void SetStatisticsRollupBatchSize(unsigned int size)
+    {
+      statisticsRollupBatchSize_ = size;
+    }
+
+    /**
+     * A trigger on "Changes" notifies the new changes on the channel
+     * "orthanc_changes" (LISTEN/NOTIFY), and a thread keeps the last
+     * change index of the database in memory. "GetLastChangeIndex()"
+     * and the polling of the changes past the last one are then
+     * answered without any query. The notifications are received
+     * after the commit, so the cached index can be a few milliseconds
+     * late.
+     **/
+    void SetChangesNotifications(bool enabled)
+    {
+      changesNotifications_ = enabled;
+    }
+
+    /**
+     * Requires PostgreSQL >= 11. If "partitionSize" is not zero, the
+     * "Changes" table is converted once by "ConfigureDatabase()" into
+     * a table that is range-partitioned by "seq", with "partitionSize"
+     * changes per partition. The housekeeping creates the partitions
+     * in advance and, if "retentionDays" is not zero, drops the
+     * partitions whose changes are all older than "retentionDays".
+     **/
+    void SetChangesPartitions(unsigned int partitionSize,
+                              unsigned int retentionDays)
+    {
+      changesPartitionSize_ = partitionSize;
+      changesRetentionDays_ = retentionDays;
+    }
+
+    /**
+     * The statistics of the database are remembered during the given
+     * number of seconds ("0", the default, disables the cache). They
+     * are invalidated by the writes of this plugin, and the
+     * "UpdateStatistics" housekeeping task publishes a new snapshot
+     * at each run, which answers the read-only transactions of the
+     * replicas.
+     **/
+    void SetStatisticsCacheTimeToLive(unsigned int seconds)
+    {
+      statisticsCache_.SetTimeToLive(seconds);
+    }
+
+    /**
+     * Requires PostgreSQL >= 11. If "partitionsCount" is not zero,
+     * "ConfigureDatabase()" starts the online migration of the
+     * "MainDicomTags" and "DicomIdentifiers" tables to tables that are
+     * hash-partitioned by "id". The housekeeping copies the tags of
+     * "batchSize" resources per transaction, then swaps the tables.
+     **/
+    void SetTagsPartitions(unsigned int partitionsCount,
+                           unsigned int batchSize)
+    {
+      if (batchSize == 0)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+      }
+
+      tagsPartitionsCount_ = partitionsCount;
+      tagsPartitioningBatchSize_ = batchSize;
+    }
+
+    /**
+     * If enabled, the "OnlineUpgrades" housekeeping task builds a
+     * partial BRIN index on the values of StudyDate in
+     * "DicomIdentifiers". As the study dates mostly follow the order
+     * of the ingestion, the date ranges on the recent studies only
+     * read the most recent pages of the table. The index is dropped
+     * once disabled.
+     **/
+    void SetStudyDateBrinIndex(bool enabled)
+    {
+      studyDateBrinIndex_ = enabled;
+    }
+
+    /**
+     * If enabled, the "OnlineUpgrades" housekeeping task builds a
+     * partial index "(value, id)" on the "LastUpdate" metadata, that
+     * turns the incremental synchronizations into index range scans
+     * (cf. "IndexBackend::LookupUpdatedResources()"). The index is
+     * dropped once disabled.
+     **/
+    void SetLastUpdateIndex(bool enabled)
+    {
+      lastUpdateIndex_ = enabled;
+    }
+
+    /**
+     * If enabled, "ConfigureDatabase()" switches the tables of the
+     * pending changes of the statistics and of the child counts
+     * ("GlobalIntegersChanges" and "ChildCountChanges") to UNLOGGED,
+     * which removes their inserts by the triggers from the WAL and
+     * from the replication. As PostgreSQL empties these tables after
+     * a crash, the statistics are then recomputed from scratch, and
+     * the child counts by the "ComputeMissingChildCount" task. The
+     * tables are switched back to LOGGED once disabled. Requires
+     * PostgreSQL >= 9.5. This cannot be combined with a read-only
+     * replica, as a hot standby cannot read the unlogged tables.
+     **/
+    void SetUnloggedTables(bool enabled);
+
+    /**
+     * If enabled, "ConfigureDatabase()" rebuilds the "value" column of
+     * "DicomIdentifiers" and its indexes with the "C" collation, that
+     * compares the bytes of the strings instead of going through the
+     * collation of the database. The case-insensitive constraints
+     * still lowercase with the default collation, but the identifier
+     * tags become sorted bytewise. The column is left unchanged once
+     * disabled. Cannot be combined with "TagsPartitionsCount".
+     **/
+    void SetBinaryCollation(bool enabled)
+    {
+      binaryCollation_ = enabled;
+    }
+
+    virtual bool HasBinaryCollation() const ORTHANC_OVERRIDE
+    {
+      return hasBinaryCollation_;
+    }
+
+    /**
+     * Requires the "citus" extension. The "MainDicomTags" and
+     * "DicomIdentifiers" tables are distributed once by
+     * "ConfigureDatabase()" over the worker nodes of the Citus
+     * cluster, co-located by the internal ID of the resources. This
+     * cannot be combined with the partitioning of these tables, nor
+     * with the "ResourceSummary" table.
+     **/
+    void SetCitus(bool enabled)
+    {
+      citus_ = enabled;
+    }
+
     virtual IDatabaseFactory* CreateDatabaseFactory() ORTHANC_OVERRIDE;
 
+    // Cannot be combined with the unlogged tables (cf. "SetUnloggedTables()")
+    void SetReplica(const PostgreSQLParameters& parameters,
+                    size_t countConnections);
+
+    virtual size_t GetReplicaConnectionsCount() const ORTHANC_OVERRIDE
+    {
+      return replicaConnectionsCount_;
+    }
+
+    virtual IDatabaseFactory* CreateReplicaDatabaseFactory() ORTHANC_OVERRIDE;
+
+    // Applies the "Housekeeping" session settings
+    virtual IDatabaseFactory* CreateHousekeepingDatabaseFactory() ORTHANC_OVERRIDE;
+
+    // Positions in the WAL, i.e. the LSN as an integer
+    virtual uint64_t GetCommitPosition(DatabaseManager& manager) ORTHANC_OVERRIDE;
+
+    virtual uint64_t GetReplayPosition(DatabaseManager& replica) ORTHANC_OVERRIDE;
+
     virtual void ConfigureDatabase(DatabaseManager& manager,
                                    bool hasIdentifierTags,
                                    const std::list<IdentifierTag>& identifierTags) ORTHANC_OVERRIDE;
@@ -76,10 +385,25 @@ namespace OrthancDatabases
                                    const char* publicId,
                                    OrthancPluginResourceType type) ORTHANC_OVERRIDE;
 
+    virtual void AddAttachment(DatabaseManager& manager,
+                               int64_t id,
+                               const OrthancPluginAttachment& attachment,
+                               int64_t revision) ORTHANC_OVERRIDE;
+
+    virtual void DeleteAttachment(IDatabaseBackendOutput& output,
+                                  DatabaseManager& manager,
+                                  int64_t id,
+                                  int32_t attachment) ORTHANC_OVERRIDE;
+
     virtual void DeleteResource(IDatabaseBackendOutput& output,
                                 DatabaseManager& manager,
                                 int64_t id) ORTHANC_OVERRIDE;
 
+    virtual void DeleteResources(IDatabaseBackendOutput& output,
+                                 std::map<std::string, OrthancPluginResourceType>& remainingAncestors,
+                                 DatabaseManager& manager,
+                                 const std::list<int64_t>& ids) ORTHANC_OVERRIDE;
+
     virtual void SetResourcesContent(DatabaseManager& manager,
                                      uint32_t countIdentifierTags,
                                      const OrthancPluginResourcesContentTags* identifierTags,
@@ -88,6 +412,14 @@ namespace OrthancDatabases
                                      uint32_t countMetadata,
                                      const OrthancPluginResourcesContentMetadata* metadata) ORTHANC_OVERRIDE;
 
+    virtual bool HasDeferredWrites() const ORTHANC_OVERRIDE
+    {
+      return batchIngestWrites_;
+    }
+
+    virtual void FlushDeferredWrites(DatabaseManager& manager,
+                                     const DeferredWrites& writes) ORTHANC_OVERRIDE;
+
     virtual uint64_t GetTotalCompressedSize(DatabaseManager& manager) ORTHANC_OVERRIDE;
 
     virtual uint64_t GetTotalUncompressedSize(DatabaseManager& manager) ORTHANC_OVERRIDE;
@@ -112,6 +444,14 @@ namespace OrthancDatabases
 
     virtual int64_t GetLastChangeIndex(DatabaseManager& manager) ORTHANC_OVERRIDE;
 
+    virtual void GetChangesExtended(IDatabaseBackendOutput& output,
+                                    bool& done /*out*/,
+                                    DatabaseManager& manager,
+                                    int64_t since,
+                                    int64_t to,
+                                    const std::set<uint32_t>& changeTypes,
+                                    uint32_t limit) ORTHANC_OVERRIDE;
+
     virtual void TagMostRecentPatient(DatabaseManager& manager,
                                       int64_t patient) ORTHANC_OVERRIDE;
 
@@ -148,5 +488,19 @@ namespace OrthancDatabases
 
     virtual void PerformDbHousekeeping(DatabaseManager& manager) ORTHANC_OVERRIDE;
 
+    // Tasks: "ComputeMissingChildCount", "UpdateStatistics", "RollupChildCounts", "OnlineUpgrades", "Analyze"
+    // (disabled by default), "ChangesPartitions" and "TagsPartitioning" (if configured),
+    // "DatabaseMetrics" (disabled by default)
+    virtual void RegisterHousekeepingTasks(HousekeepingScheduler& scheduler,
+                                           unsigned int defaultIntervalSeconds,
+                                           const boost::posix_time::ptime& now) ORTHANC_OVERRIDE;
+
+    virtual void PerformHousekeepingTask(DatabaseManager& manager,
+                                         const std::string& task) ORTHANC_OVERRIDE;
+
+    // Adds the number of rows pending in "GlobalIntegersChanges"
+    virtual void CollectDatabaseMetrics(std::map<std::string, float>& metrics,
+                                        DatabaseManager& manager) ORTHANC_OVERRIDE;
+
   };
 }
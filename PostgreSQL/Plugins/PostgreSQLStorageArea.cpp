@@ -24,6 +24,8 @@
 #include "PostgreSQLStorageArea.h"
 #include "PostgreSQLDefinitions.h"
 
+#include "../../Framework/Common/BinaryStringValue.h"
+#include "../../Framework/Plugins/StorageCompression.h"
 #include "../../Framework/PostgreSQL/PostgreSQLTransaction.h"
 #include "../../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
 
@@ -33,6 +35,203 @@
 
 namespace OrthancDatabases
 {
+  // Files up to this size are written as a large object by a single "INSERT"
+  static const size_t MAX_SINGLE_STATEMENT_SIZE = 16 * 1024 * 1024;
+
+
+  class PostgreSQLStorageArea::Accessor : public AccessorBase
+  {
+  private:
+    PostgreSQLStorageArea&  that_;
+
+    // Returns "false" if the file is not stored inline (i.e. it is a
+    // large object, or it doesn't exist)
+    bool LookupInlineContent(std::string& content,
+                             const std::string& uuid,
+                             OrthancPluginContentType type)
+    {
+      if (!that_.hasInlineContent_)
+      {
+        return false;
+      }
+
+      bool found;
+
+      {
+        DatabaseManager::Transaction transaction(GetManager(), TransactionType_ReadOnly);
+
+        {
+          DatabaseManager::CachedStatement statement(
+            STATEMENT_FROM_HERE, GetManager(),
+            "SELECT inlineContent FROM StorageArea WHERE uuid=${uuid} AND type=${type} AND inlineContent IS NOT NULL");
+
+          statement.SetParameterType("uuid", ValueType_Utf8String);
+          statement.SetParameterType("type", ValueType_Integer64);
+
+          Dictionary args;
+          args.SetUtf8Value("uuid", uuid);
+          args.SetIntegerValue("type", type);
+
+          statement.Execute(args);
+
+          if (statement.IsDone())
+          {
+            found = false;
+          }
+          else
+          {
+            content = dynamic_cast<const BinaryStringValue&>(statement.GetResultField(0)).GetContent();
+            found = true;
+          }
+        }
+
+        transaction.Commit();
+      }
+
+      if (found &&
+          IsCompressedContent(uuid, type, content.c_str(), content.size()))
+      {
+        std::string uncompressed;
+        StorageCompression::Uncompress(uncompressed, content.c_str(), content.size());
+        content.swap(uncompressed);
+      }
+
+      return found;
+    }
+
+  protected:
+    virtual void InsertContent(const std::string& uuid,
+                               const void* content,
+                               size_t size,
+                               OrthancPluginContentType type) ORTHANC_OVERRIDE
+    {
+      if (size != 0 &&
+          size < that_.inlineThreshold_)
+      {
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, GetManager(),
+          "INSERT INTO StorageArea (uuid, content, type, inlineContent) VALUES (${uuid}, NULL, ${type}, ${content})");
+
+        statement.SetParameterType("uuid", ValueType_Utf8String);
+        statement.SetParameterType("type", ValueType_Integer64);
+        statement.SetParameterType("content", ValueType_BinaryString);
+
+        Dictionary args;
+        args.SetUtf8Value("uuid", uuid);
+        args.SetIntegerValue("type", type);
+        args.SetBinaryValue("content", std::string(reinterpret_cast<const char*>(content), size));
+
+        statement.Execute(args);
+      }
+      else if (that_.hasLoFromBytea_ &&
+               size != 0 &&
+               size <= MAX_SINGLE_STATEMENT_SIZE)
+      {
+        /**
+         * The large object is created and filled on the server side,
+         * instead of the 4 round-trips of "lo_creat()", "lo_open()",
+         * "lo_write()" and "lo_close()" before the "INSERT".
+         **/
+        DatabaseManager::CachedStatement statement(
+          STATEMENT_FROM_HERE, GetManager(),
+          "INSERT INTO StorageArea (uuid, content, type) VALUES (${uuid}, lo_from_bytea(0, ${content}), ${type})");
+
+        statement.SetParameterType("uuid", ValueType_Utf8String);
+        statement.SetParameterType("type", ValueType_Integer64);
+        statement.SetParameterType("content", ValueType_BinaryString);
+
+        Dictionary args;
+        args.SetUtf8Value("uuid", uuid);
+        args.SetIntegerValue("type", type);
+        args.SetBinaryValue("content", std::string(reinterpret_cast<const char*>(content), size));
+
+        statement.Execute(args);
+      }
+      else
+      {
+        AccessorBase::InsertContent(uuid, content, size, type);
+      }
+    }
+
+  public:
+    explicit Accessor(PostgreSQLStorageArea& that) :
+      AccessorBase(that),
+      that_(that)
+    {
+    }
+
+    virtual void ReadWhole(IFileContentVisitor& visitor,
+                           const std::string& uuid,
+                           OrthancPluginContentType type) ORTHANC_OVERRIDE
+    {
+      std::string content;
+      if (LookupInlineContent(content, uuid, type))
+      {
+        visitor.Assign(content);
+
+        if (!visitor.IsSuccess())
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Could not read attachment from the storage area");
+        }
+      }
+      else
+      {
+        AccessorBase::ReadWhole(visitor, uuid, type);
+      }
+    }
+
+    virtual void ReadRange(IFileContentVisitor& visitor,
+                           const std::string& uuid,
+                           OrthancPluginContentType type,
+                           uint64_t start,
+                           size_t length) ORTHANC_OVERRIDE
+    {
+      std::string content;
+      if (LookupInlineContent(content, uuid, type))
+      {
+        if (start + length > content.size())
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRange);
+        }
+
+        visitor.Assign(content.substr(start, length));
+
+        if (!visitor.IsSuccess())
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_Database, "Could not read attachment from the storage area");
+        }
+      }
+      else
+      {
+        AccessorBase::ReadRange(visitor, uuid, type, start, length);
+      }
+    }
+
+    virtual void ReadRange(IFileChunkVisitor& visitor,
+                           const std::string& uuid,
+                           OrthancPluginContentType type,
+                           uint64_t start,
+                           size_t length,
+                           size_t chunkSize) ORTHANC_OVERRIDE
+    {
+      std::string content;
+      if (LookupInlineContent(content, uuid, type))
+      {
+        if (start + length > content.size())
+        {
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_BadRange);
+        }
+
+        ResultFileValue::VisitChunks(visitor, (length == 0 ? NULL : content.c_str() + start), length, chunkSize);
+      }
+      else
+      {
+        AccessorBase::ReadRange(visitor, uuid, type, start, length, chunkSize);
+      }
+    }
+  };
+
+
   void PostgreSQLStorageArea::ConfigureDatabase(PostgreSQLDatabase& db,
                                                 const PostgreSQLParameters& parameters,
                                                 bool clearAll)
@@ -64,6 +263,10 @@ namespace OrthancDatabases
           db.ExecuteMultiLines("CREATE OR REPLACE RULE StorageAreaDelete AS ON DELETE "
                                "TO StorageArea DO SELECT lo_unlink(old.content);");
         }
+
+        hasInlineContent_ = db.DoesColumnExist("StorageArea", "inlineContent");
+        hasLoFromBytea_ = (db.GetServerVersion() >= 90400);
+        hasSkipLocked_ = (db.GetServerVersion() >= 90500);
         
         t.Commit();
       }
@@ -74,7 +277,11 @@ namespace OrthancDatabases
   PostgreSQLStorageArea::PostgreSQLStorageArea(const PostgreSQLParameters& parameters,
                                                bool clearAll) :
     StorageBackend(PostgreSQLDatabase::CreateDatabaseFactory(parameters),
-                   parameters.GetMaxConnectionRetries())
+                   parameters.GetMaxConnectionRetries()),
+    inlineThreshold_(0),
+    hasInlineContent_(false),
+    hasLoFromBytea_(false),
+    hasSkipLocked_(false)
   {
     {
       AccessorBase accessor(*this);
@@ -82,4 +289,99 @@ namespace OrthancDatabases
       ConfigureDatabase(database, parameters, clearAll);
     }
   }
+
+
+  void PostgreSQLStorageArea::SetInlineThreshold(size_t threshold)
+  {
+    if (threshold > 0 &&
+        !hasInlineContent_)
+    {
+      AccessorBase accessor(*this);
+      PostgreSQLDatabase& db = dynamic_cast<PostgreSQLDatabase&>(accessor.GetManager().GetDatabase());
+
+      PostgreSQLDatabase::TransientAdvisoryLock lock(db, POSTGRESQL_LOCK_DATABASE_SETUP);
+      PostgreSQLTransaction t(db, TransactionType_ReadWrite);
+
+      if (!db.DoesColumnExist("StorageArea", "inlineContent"))
+      {
+        // "lo_unlink(NULL)" is a no-op, so the "StorageAreaDelete" rule is unchanged
+        LOG(WARNING) << "Adding the column of the inline files to the storage area";
+        db.ExecuteMultiLines("ALTER TABLE StorageArea ADD COLUMN inlineContent BYTEA;"
+                             "ALTER TABLE StorageArea ALTER COLUMN content DROP NOT NULL;");
+      }
+
+      t.Commit();
+      hasInlineContent_ = true;
+    }
+
+    inlineThreshold_ = threshold;
+  }
+
+
+  size_t PostgreSQLStorageArea::RemovePendingInBulk(DatabaseManager& manager,
+                                                    size_t maxCount)
+  {
+    std::string uuids;
+    size_t count = 0;
+
+    {
+      // "SKIP LOCKED" lets several Orthanc servers drain the queue concurrently
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "DELETE FROM PendingDeletes WHERE uuid = ANY(ARRAY("
+        "SELECT uuid FROM PendingDeletes LIMIT ${count} FOR UPDATE SKIP LOCKED)) RETURNING uuid");
+
+      statement.SetParameterType("count", ValueType_Integer64);
+
+      Dictionary args;
+      args.SetIntegerValue("count", static_cast<int64_t>(maxCount));
+
+      statement.Execute(args);
+
+      while (!statement.IsDone())
+      {
+        const std::string uuid = statement.ReadString(0);
+
+        if (uuid.find(',') != std::string::npos)
+        {
+          // Never the case of the uuids that are generated by the Orthanc core
+          throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                          "Unexpected uuid in the storage area: " + uuid);
+        }
+
+        if (count > 0)
+        {
+          uuids += ",";
+        }
+
+        uuids += uuid;
+        count++;
+
+        statement.Next();
+      }
+    }
+
+    if (count > 0)
+    {
+      // "uuid" is the primary key of "StorageArea"
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "DELETE FROM StorageArea WHERE uuid = ANY(string_to_array(${uuids}, ','))");
+
+      statement.SetParameterType("uuids", ValueType_Utf8String);
+
+      Dictionary args;
+      args.SetUtf8Value("uuids", uuids);
+
+      statement.Execute(args);
+    }
+
+    return count;
+  }
+
+
+  StorageBackend::IAccessor* PostgreSQLStorageArea::CreateAccessor()
+  {
+    return new Accessor(*this);
+  }
 }
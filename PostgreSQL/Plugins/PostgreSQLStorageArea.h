@@ -31,6 +31,13 @@ namespace OrthancDatabases
   class PostgreSQLStorageArea : public StorageBackend
   {
   private:
+    class Accessor;
+
+    size_t  inlineThreshold_;
+    bool    hasInlineContent_;  // Whether the "inlineContent" column exists
+    bool    hasLoFromBytea_;    // Whether "lo_from_bytea()" is available (PostgreSQL >= 9.4)
+    bool    hasSkipLocked_;     // Whether "FOR UPDATE SKIP LOCKED" is available (PostgreSQL >= 9.5)
+
     void ConfigureDatabase(PostgreSQLDatabase& db,
                            const PostgreSQLParameters& parameters,
                            bool clearAll);
@@ -41,8 +48,36 @@ namespace OrthancDatabases
       return true;
     }
 
+    virtual bool HasBulkRemove() const ORTHANC_OVERRIDE
+    {
+      return hasSkipLocked_;
+    }
+
+    // The large objects are unlinked by the "StorageAreaDelete" rule,
+    // within one "DELETE" statement for the whole batch
+    virtual size_t RemovePendingInBulk(DatabaseManager& manager,
+                                       size_t maxCount) ORTHANC_OVERRIDE;
+
   public:
     PostgreSQLStorageArea(const PostgreSQLParameters& parameters,
                           bool clearAll);
+
+    /**
+     * The files whose size is below "threshold" bytes are stored in
+     * the "inlineContent" column of the "StorageArea" table, with a
+     * single "INSERT", instead of a large object. "0" disables this
+     * mode, which is the default. The files that have been stored
+     * inline can still be read once this mode is disabled, but not by
+     * the previous versions of the plugin. This must be called before
+     * "Register()".
+     **/
+    void SetInlineThreshold(size_t threshold);
+
+    size_t GetInlineThreshold() const
+    {
+      return inlineThreshold_;
+    }
+
+    virtual IAccessor* CreateAccessor() ORTHANC_OVERRIDE;
   };
 }
@@ -6,6 +6,9 @@
 
 -- these constraints were introduced in Rev2
 ALTER TABLE Resources DROP CONSTRAINT UniquePublicId;
+
+-- the index of "UniquePublicId" has replaced "PublicIndex", that must be reinstalled for the lookups by public ID
+CREATE INDEX IF NOT EXISTS PublicIndex ON Resources(publicId);
 ALTER TABLE PatientRecyclingOrder DROP CONSTRAINT UniquePatientId;
 
 -- the CreateInstance has been replaced in Rev2, reinstall the Rev1
@@ -7,9 +7,83 @@ DROP TRIGGER IF EXISTS DecrementChildCount ON Resources;
 DROP TRIGGER IF EXISTS IncrementChildCount ON Resources;
 DROP TABLE ChildCount;
 DROP FUNCTION UpdateChildCount;
+DROP FUNCTION IF EXISTS IngestResources;
+DROP FUNCTION IF EXISTS SetResourcesContent;
+DROP FUNCTION IF EXISTS DeleteResources;
+
+-- the sharded counters: fold them back into GlobalIntegers
+DO $body$
+BEGIN
+    IF EXISTS (SELECT 1 FROM pg_tables WHERE tablename = 'globalintegersshards') THEN
+        UPDATE GlobalIntegers SET value = GREATEST(value, (SELECT MAX(value) FROM GlobalIntegersShards WHERE key = 6)) WHERE key = 6;
+        DROP TABLE GlobalIntegersShards;
+    END IF;
+END $body$;
+UPDATE GlobalIntegers SET value = GREATEST(value, (SELECT last_value FROM patientrecyclingorder_seq_seq)) WHERE key = 7;
+
+DROP TRIGGER IF EXISTS LockChangeSeq ON Changes;
+DROP FUNCTION IF EXISTS LockChangeSeqFunc;
+
+CREATE OR REPLACE FUNCTION InsertedChangeFunc() 
+RETURNS TRIGGER AS $body$
+BEGIN
+    UPDATE GlobalIntegers SET value = new.seq WHERE key = 6;
+    RETURN NULL;
+END;
+$body$ LANGUAGE plpgsql;
+
+CREATE OR REPLACE FUNCTION PatientAddedOrUpdated(
+    IN patient_id BIGINT,
+    IN is_update BIGINT
+    )
+RETURNS VOID AS $body$
+BEGIN
+    DECLARE
+        newSeq BIGINT;
+    BEGIN
+        UPDATE GlobalIntegers SET value = value + 1 WHERE key = 7 RETURNING value INTO newSeq;
+        IF is_update > 0 THEN
+            UPDATE PatientRecyclingOrder SET seq = newSeq WHERE PatientRecyclingOrder.patientId = patient_id;
+        ELSE
+            INSERT INTO PatientRecyclingOrder VALUES (newSeq, patient_id);
+        END IF;
+    END;
+END;
+$body$ LANGUAGE plpgsql;
+
+-- the optional ResourceSummary table (cf. UninstallResourceSummary.sql)
+DROP TRIGGER IF EXISTS MainDicomTagsInsertedSummary ON MainDicomTags;
+DROP TRIGGER IF EXISTS MainDicomTagsUpdatedSummary ON MainDicomTags;
+DROP TRIGGER IF EXISTS MainDicomTagsDeletedSummary ON MainDicomTags;
+DROP TRIGGER IF EXISTS MetadataInsertedSummary ON Metadata;
+DROP TRIGGER IF EXISTS MetadataUpdatedSummary ON Metadata;
+DROP TRIGGER IF EXISTS MetadataDeletedSummary ON Metadata;
+DROP FUNCTION IF EXISTS ResourceSummaryNewRowsFunc;
+DROP FUNCTION IF EXISTS ResourceSummaryOldRowsFunc;
+DROP FUNCTION IF EXISTS RefreshResourceSummaries;
+DROP FUNCTION IF EXISTS ComputeResourceSummary;
+DROP TABLE IF EXISTS ResourceSummary;
+
+-- the optional SortKeys table (cf. UninstallSortKeys.sql)
+DROP TRIGGER IF EXISTS MainDicomTagsInsertedSortKeys ON MainDicomTags;
+DROP TRIGGER IF EXISTS MainDicomTagsUpdatedSortKeys ON MainDicomTags;
+DROP TRIGGER IF EXISTS MainDicomTagsDeletedSortKeys ON MainDicomTags;
+DROP TRIGGER IF EXISTS DicomIdentifiersInsertedSortKeys ON DicomIdentifiers;
+DROP TRIGGER IF EXISTS DicomIdentifiersUpdatedSortKeys ON DicomIdentifiers;
+DROP TRIGGER IF EXISTS DicomIdentifiersDeletedSortKeys ON DicomIdentifiers;
+DROP TRIGGER IF EXISTS MetadataInsertedSortKeys ON Metadata;
+DROP TRIGGER IF EXISTS MetadataUpdatedSortKeys ON Metadata;
+DROP TRIGGER IF EXISTS MetadataDeletedSortKeys ON Metadata;
+DROP FUNCTION IF EXISTS SortKeysTagsNewRowsFunc;
+DROP FUNCTION IF EXISTS SortKeysTagsOldRowsFunc;
+DROP FUNCTION IF EXISTS SortKeysMetadataNewRowsFunc;
+DROP FUNCTION IF EXISTS SortKeysMetadataOldRowsFunc;
+DROP FUNCTION IF EXISTS BackfillSortKey;
+DROP TABLE IF EXISTS SortKeys;
+DROP TABLE IF EXISTS SortKeysDefinitions;
 
 
 -- set the global properties that actually documents the DB version, revision and some of the capabilities
 -- modify only the ones that have changed
-DELETE FROM GlobalProperties WHERE property IN (4, 11);
+DELETE FROM GlobalProperties WHERE property IN (4, 11, 15, 16, 17);
 INSERT INTO GlobalProperties VALUES (4, 2); -- GlobalProperty_DatabasePatchLevel
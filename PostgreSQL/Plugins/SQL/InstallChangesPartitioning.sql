@@ -0,0 +1,167 @@
+-- This SQL file converts the "Changes" table into a table that is range-partitioned by "seq"
+-- (cf. the "ChangesPartitionSize" option). The existing rows are kept as a whole in the
+-- "ChangesLegacy" partition, and each partition has its own index on "seq". The old changes
+-- are removed by dropping whole partitions (cf. the "ChangesRetentionDays" option), which
+-- is much cheaper than a massive DELETE and doesn't bloat the table.
+-- The "ChangesDefault" partition catches the changes that are beyond the last partition, if
+-- the housekeeping is late. Such changes are moved to a regular partition by the next call
+-- to "CreateChangesPartitions()".
+-- Note to developers:
+--   - it is only executed if the "ChangesPartitions" table does not exist yet, when the DB is "locked"
+--   - it requires PostgreSQL >= 11 (default partitions, primary keys on partitioned tables)
+--   - attaching "ChangesLegacy" scans the existing changes once
+--   - the partitions are listed in "ChangesPartitions", in order to avoid parsing the bounds in "pg_class"
+
+CREATE TABLE ChangesPartitions(
+       name TEXT PRIMARY KEY,
+       lowerBound BIGINT NOT NULL,
+       upperBound BIGINT NOT NULL
+       );
+
+DROP TRIGGER IF EXISTS InsertedChange ON Changes;
+DROP TRIGGER IF EXISTS LockChangeSeq ON Changes;
+
+ALTER TABLE Changes RENAME TO ChangesLegacy;
+ALTER INDEX IF EXISTS changes_pkey RENAME TO changeslegacy_pkey;
+ALTER INDEX IF EXISTS ChangesIndex RENAME TO ChangesLegacyIndex;
+ALTER INDEX IF EXISTS ChangesIndex2 RENAME TO ChangesLegacyIndex2;
+
+-- the sequence must survive the drop of the "ChangesLegacy" partition
+ALTER SEQUENCE changes_seq_seq OWNED BY NONE;
+
+CREATE TABLE Changes(
+       seq BIGINT NOT NULL DEFAULT nextval('changes_seq_seq'),
+       changeType INTEGER,
+       internalId BIGINT REFERENCES Resources(internalId) ON DELETE CASCADE,
+       resourceType INTEGER,
+       date VARCHAR(64),
+       PRIMARY KEY(seq)
+       ) PARTITION BY RANGE (seq);
+
+ALTER SEQUENCE changes_seq_seq OWNED BY Changes.seq;
+
+CREATE INDEX ChangesIndex ON Changes(internalId);
+CREATE INDEX ChangesIndex2 ON Changes(changeType, seq);
+
+DO $body$
+DECLARE
+    upper_bound BIGINT;
+BEGIN
+    -- PostgreSQL 11 only accepts constants as partition bounds, hence the dynamic SQL
+    SELECT COALESCE(MAX(seq), 0) + 1 INTO upper_bound FROM ChangesLegacy;
+    EXECUTE format('ALTER TABLE Changes ATTACH PARTITION ChangesLegacy FOR VALUES FROM (MINVALUE) TO (%s)', upper_bound);
+    INSERT INTO ChangesPartitions VALUES ('changeslegacy', 0, upper_bound);
+
+    -- the notifications of the changes (cf. "EnableChangesNotifications") are moved to the
+    -- partitioned table, as they might be used by other Orthanc servers
+    IF EXISTS (SELECT 1 FROM pg_trigger WHERE tgname = 'changenotification' AND
+               tgrelid = 'changeslegacy'::regclass) THEN
+        DROP TRIGGER ChangeNotification ON ChangesLegacy;
+        CREATE TRIGGER ChangeNotification AFTER INSERT ON Changes
+          FOR EACH ROW EXECUTE PROCEDURE ChangeNotificationFunc();
+    END IF;
+END;
+$body$;
+
+CREATE TABLE ChangesDefault PARTITION OF Changes DEFAULT;
+
+CREATE TRIGGER LockChangeSeq
+BEFORE INSERT ON Changes
+FOR EACH STATEMENT
+EXECUTE PROCEDURE LockChangeSeqFunc();
+
+CREATE TRIGGER InsertedChange
+AFTER INSERT ON Changes
+FOR EACH ROW
+EXECUTE PROCEDURE InsertedChangeFunc();
+
+
+-- Makes sure that the partitions cover the next "count_ahead" blocks of "partition_size"
+-- changes, and moves the changes of the default partition to a regular partition.
+-- "pg_advisory_xact_lock(46)" must be taken by the caller. Returns the number of
+-- created partitions.
+CREATE OR REPLACE FUNCTION CreateChangesPartitions(
+  IN partition_size BIGINT,
+  IN count_ahead BIGINT)
+RETURNS BIGINT AS $body$
+DECLARE
+    last_seq BIGINT;
+    lower_bound BIGINT;
+    upper_bound BIGINT;
+    partition_name TEXT;
+    created BIGINT := 0;
+BEGIN
+    SELECT last_value INTO last_seq FROM changes_seq_seq;
+    SELECT MAX(upperBound) INTO lower_bound FROM ChangesPartitions;
+
+    LOCK TABLE ChangesDefault IN EXCLUSIVE MODE;
+
+    SELECT MAX(seq) + 1 INTO upper_bound FROM ChangesDefault;
+
+    IF upper_bound IS NOT NULL THEN
+        -- the partition is filled before being attached, as the rows
+        -- cannot be moved out of the default partition otherwise
+        upper_bound := lower_bound + partition_size *
+                       ((upper_bound - lower_bound + partition_size - 1) / partition_size);
+        partition_name := 'changes_' || lower_bound;
+
+        EXECUTE format('CREATE TABLE %I (LIKE Changes INCLUDING DEFAULTS)', partition_name);
+        EXECUTE format('WITH moved AS (DELETE FROM ChangesDefault RETURNING *) '
+                       'INSERT INTO %I SELECT * FROM moved', partition_name);
+        EXECUTE format('ALTER TABLE Changes ATTACH PARTITION %I FOR VALUES FROM (%s) TO (%s)',
+                       partition_name, lower_bound, upper_bound);
+        INSERT INTO ChangesPartitions VALUES (partition_name, lower_bound, upper_bound);
+
+        RAISE WARNING 'The changes up to % were beyond the last partition of the Changes table', upper_bound - 1;
+
+        lower_bound := upper_bound;
+        created := created + 1;
+    END IF;
+
+    WHILE lower_bound <= last_seq + partition_size * count_ahead LOOP
+        upper_bound := lower_bound + partition_size;
+        partition_name := 'changes_' || lower_bound;
+
+        EXECUTE format('CREATE TABLE %I PARTITION OF Changes FOR VALUES FROM (%s) TO (%s)',
+                       partition_name, lower_bound, upper_bound);
+        INSERT INTO ChangesPartitions VALUES (partition_name, lower_bound, upper_bound);
+
+        lower_bound := upper_bound;
+        created := created + 1;
+    END LOOP;
+
+    RETURN created;
+END;
+$body$ LANGUAGE plpgsql;
+
+
+-- Drops the oldest partitions whose last change is older than "oldest_date" (the dates
+-- of the changes are ISO strings, that can be compared as text). The partition that
+-- contains the last change is never dropped. "pg_advisory_xact_lock(46)" must be
+-- taken by the caller. Returns the number of dropped partitions.
+CREATE OR REPLACE FUNCTION DropExpiredChangesPartitions(
+  IN oldest_date TEXT)
+RETURNS BIGINT AS $body$
+DECLARE
+    last_seq BIGINT;
+    p RECORD;
+    last_date TEXT;
+    dropped BIGINT := 0;
+BEGIN
+    SELECT last_value INTO last_seq FROM changes_seq_seq;
+
+    FOR p IN SELECT name FROM ChangesPartitions WHERE upperBound <= last_seq ORDER BY lowerBound LOOP
+        EXECUTE format('SELECT date FROM %I ORDER BY seq DESC LIMIT 1', p.name) INTO last_date;
+
+        IF last_date >= oldest_date THEN
+            EXIT;  -- the next partitions hold more recent changes
+        END IF;
+
+        EXECUTE format('DROP TABLE %I', p.name);
+        DELETE FROM ChangesPartitions WHERE name = p.name;
+        dropped := dropped + 1;
+    END LOOP;
+
+    RETURN dropped;
+END;
+$body$ LANGUAGE plpgsql;
@@ -0,0 +1,44 @@
+-- This SQL file distributes the "MainDicomTags" and "DicomIdentifiers" tables, that hold most
+-- of the rows of the index, over the worker nodes of a Citus cluster (cf. the "EnableCitus"
+-- option). Both tables are hash-distributed by "id" and co-located, so that all the tags of one
+-- resource are stored in the same shard: The statements that read or write the tags of one
+-- resource (i.e. "WHERE id = ...") are routed to a single worker. The other tables stay on the
+-- coordinator, where Citus plans their joins with the distributed tables.
+-- Note to developers:
+--   - it is only executed if the tables are not distributed yet, when the DB is "locked"
+--   - it requires the "citus" extension, and the worker nodes must have been registered
+--   - the distributed tables cannot reference the local table "Resources": Their foreign keys are
+--     replaced by a trigger that deletes the tags of the deleted resources
+--   - "create_distributed_table()" copies the existing rows, and blocks the writes to the tables
+--     in the meantime
+--   - the tables must not have triggers (e.g. the ones of "ResourceSummary")
+
+DO $body$
+DECLARE
+    fk RECORD;
+BEGIN
+    FOR fk IN SELECT conrelid::regclass AS tbl, conname FROM pg_constraint
+              WHERE contype = 'f' AND conrelid IN ('maindicomtags'::regclass, 'dicomidentifiers'::regclass) LOOP
+        EXECUTE format('ALTER TABLE %s DROP CONSTRAINT %I', fk.tbl, fk.conname);
+    END LOOP;
+END $body$;
+
+
+CREATE OR REPLACE FUNCTION ResourceTagsDeletedFunc()
+RETURNS TRIGGER AS $body$
+BEGIN
+    DELETE FROM MainDicomTags WHERE id = old.internalId;
+    DELETE FROM DicomIdentifiers WHERE id = old.internalId;
+    RETURN NULL;
+END;
+$body$ LANGUAGE plpgsql;
+
+DROP TRIGGER IF EXISTS ResourceTagsDeleted ON Resources;
+CREATE TRIGGER ResourceTagsDeleted
+AFTER DELETE ON Resources
+FOR EACH ROW
+EXECUTE PROCEDURE ResourceTagsDeletedFunc();
+
+
+SELECT create_distributed_table('maindicomtags', 'id');
+SELECT create_distributed_table('dicomidentifiers', 'id', colocate_with => 'maindicomtags');
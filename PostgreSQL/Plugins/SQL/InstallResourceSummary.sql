@@ -0,0 +1,90 @@
+-- This SQL file creates the optional "ResourceSummary" table (cf. the "EnableResourceSummary" option).
+-- The table holds, for each resource, a JSON array "[ mainDicomTags, metadata ]" where:
+--   - "mainDicomTags" is an array of "[ tagGroup, tagElement, value ]"
+--   - "metadata" is an array of "[ type, revision, value ]"
+-- It is maintained by statement-level triggers on MainDicomTags and Metadata, and it is
+-- read by "ExecuteFind()" instead of joining these 2 tables.
+-- Note to developers:
+--   - it is only executed if the table does not exist yet, when the DB is "locked"
+--   - it requires PostgreSQL >= 10 (transition tables in triggers)
+
+CREATE TABLE ResourceSummary(
+       id BIGINT PRIMARY KEY REFERENCES Resources(internalId) ON DELETE CASCADE,
+       content TEXT NOT NULL
+       );
+
+CREATE OR REPLACE FUNCTION ComputeResourceSummary(resource BIGINT)
+RETURNS TEXT AS $body$
+BEGIN
+    RETURN json_build_array(
+        COALESCE((SELECT json_agg(json_build_array(tagGroup, tagElement, value))
+                  FROM MainDicomTags WHERE id = resource), '[]'::json),
+        COALESCE((SELECT json_agg(json_build_array(type, COALESCE(revision, 0), value))
+                  FROM Metadata WHERE id = resource), '[]'::json))::TEXT;
+END;
+$body$ LANGUAGE plpgsql;
+
+CREATE OR REPLACE FUNCTION RefreshResourceSummaries(resources BIGINT[])
+RETURNS VOID AS $body$
+BEGIN
+    -- the join on Resources skips the resources that are being deleted: their
+    -- summary is removed by the "ON DELETE CASCADE"
+    INSERT INTO ResourceSummary (id, content)
+      SELECT internalId, ComputeResourceSummary(internalId)
+      FROM Resources WHERE internalId = ANY(resources)
+      ON CONFLICT (id) DO UPDATE SET content = EXCLUDED.content;
+END;
+$body$ LANGUAGE plpgsql;
+
+CREATE OR REPLACE FUNCTION ResourceSummaryNewRowsFunc()
+RETURNS TRIGGER AS $body$
+BEGIN
+    PERFORM RefreshResourceSummaries(ARRAY(SELECT DISTINCT id FROM newRows));
+    RETURN NULL;
+END;
+$body$ LANGUAGE plpgsql;
+
+CREATE OR REPLACE FUNCTION ResourceSummaryOldRowsFunc()
+RETURNS TRIGGER AS $body$
+BEGIN
+    PERFORM RefreshResourceSummaries(ARRAY(SELECT DISTINCT id FROM oldRows));
+    RETURN NULL;
+END;
+$body$ LANGUAGE plpgsql;
+
+-- transition tables are not allowed in triggers with more than one event,
+-- hence the 3 triggers per table
+
+CREATE TRIGGER MainDicomTagsInsertedSummary
+AFTER INSERT ON MainDicomTags
+REFERENCING NEW TABLE AS newRows
+FOR EACH STATEMENT EXECUTE PROCEDURE ResourceSummaryNewRowsFunc();
+
+CREATE TRIGGER MainDicomTagsUpdatedSummary
+AFTER UPDATE ON MainDicomTags
+REFERENCING NEW TABLE AS newRows
+FOR EACH STATEMENT EXECUTE PROCEDURE ResourceSummaryNewRowsFunc();
+
+CREATE TRIGGER MainDicomTagsDeletedSummary
+AFTER DELETE ON MainDicomTags
+REFERENCING OLD TABLE AS oldRows
+FOR EACH STATEMENT EXECUTE PROCEDURE ResourceSummaryOldRowsFunc();
+
+CREATE TRIGGER MetadataInsertedSummary
+AFTER INSERT ON Metadata
+REFERENCING NEW TABLE AS newRows
+FOR EACH STATEMENT EXECUTE PROCEDURE ResourceSummaryNewRowsFunc();
+
+CREATE TRIGGER MetadataUpdatedSummary
+AFTER UPDATE ON Metadata
+REFERENCING NEW TABLE AS newRows
+FOR EACH STATEMENT EXECUTE PROCEDURE ResourceSummaryNewRowsFunc();
+
+CREATE TRIGGER MetadataDeletedSummary
+AFTER DELETE ON Metadata
+REFERENCING OLD TABLE AS oldRows
+FOR EACH STATEMENT EXECUTE PROCEDURE ResourceSummaryOldRowsFunc();
+
+-- backfill the summaries of the existing resources
+INSERT INTO ResourceSummary (id, content)
+  SELECT internalId, ComputeResourceSummary(internalId) FROM Resources;
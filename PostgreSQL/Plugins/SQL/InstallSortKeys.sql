@@ -0,0 +1,134 @@
+-- This SQL file creates the optional "SortKeys" table (cf. the "SortKeys" option).
+-- The table holds a copy of the values of the tags and of the metadata that are the most
+-- frequent ordering keys of "ExecuteFind()", with an index on "(sortKey, value)", so that
+-- the sorted lists of resources are read in the order of the index.
+-- The "sortKey" column is "(tagGroup << 16) + tagElement" for a tag, and "2^32 + type"
+-- for a metadata (cf. "ISqlLookupFormatter::EncodeTagSortKey()").
+-- It is maintained by statement-level triggers on MainDicomTags, DicomIdentifiers and
+-- Metadata, for the keys that are listed in "SortKeysDefinitions".
+-- Note to developers:
+--   - it is only executed if the table does not exist yet, when the DB is "locked"
+--   - it requires PostgreSQL >= 10 (transition tables in triggers)
+
+CREATE TABLE SortKeysDefinitions(
+       sortKey BIGINT PRIMARY KEY
+       );
+
+CREATE TABLE SortKeys(
+       id BIGINT NOT NULL REFERENCES Resources(internalId) ON DELETE CASCADE,
+       sortKey BIGINT NOT NULL,
+       value TEXT,
+       PRIMARY KEY(id, sortKey)
+       );
+
+CREATE INDEX SortKeysIndex ON SortKeys(sortKey, value, id);
+
+-- copies the values of a new key, once it has been added to "SortKeysDefinitions"
+CREATE OR REPLACE FUNCTION BackfillSortKey(key BIGINT)
+RETURNS VOID AS $body$
+BEGIN
+    IF key < 4294967296 THEN
+        INSERT INTO SortKeys (id, sortKey, value)
+          SELECT id, key, value FROM MainDicomTags
+          WHERE tagGroup = key / 65536 AND tagElement = key % 65536
+          ON CONFLICT DO NOTHING;
+        INSERT INTO SortKeys (id, sortKey, value)
+          SELECT id, key, value FROM DicomIdentifiers
+          WHERE tagGroup = key / 65536 AND tagElement = key % 65536
+          ON CONFLICT DO NOTHING;
+    ELSE
+        INSERT INTO SortKeys (id, sortKey, value)
+          SELECT id, key, value FROM Metadata
+          WHERE type = key - 4294967296
+          ON CONFLICT DO NOTHING;
+    END IF;
+END;
+$body$ LANGUAGE plpgsql;
+
+CREATE OR REPLACE FUNCTION SortKeysTagsNewRowsFunc()
+RETURNS TRIGGER AS $body$
+BEGIN
+    INSERT INTO SortKeys (id, sortKey, value)
+      SELECT newRows.id, d.sortKey, newRows.value FROM newRows
+      INNER JOIN SortKeysDefinitions d ON d.sortKey = newRows.tagGroup::BIGINT * 65536 + newRows.tagElement
+      ON CONFLICT (id, sortKey) DO UPDATE SET value = EXCLUDED.value;
+    RETURN NULL;
+END;
+$body$ LANGUAGE plpgsql;
+
+CREATE OR REPLACE FUNCTION SortKeysTagsOldRowsFunc()
+RETURNS TRIGGER AS $body$
+BEGIN
+    DELETE FROM SortKeys USING oldRows
+      WHERE SortKeys.id = oldRows.id AND SortKeys.sortKey = oldRows.tagGroup::BIGINT * 65536 + oldRows.tagElement;
+    RETURN NULL;
+END;
+$body$ LANGUAGE plpgsql;
+
+CREATE OR REPLACE FUNCTION SortKeysMetadataNewRowsFunc()
+RETURNS TRIGGER AS $body$
+BEGIN
+    INSERT INTO SortKeys (id, sortKey, value)
+      SELECT newRows.id, d.sortKey, newRows.value FROM newRows
+      INNER JOIN SortKeysDefinitions d ON d.sortKey = 4294967296 + newRows.type
+      ON CONFLICT (id, sortKey) DO UPDATE SET value = EXCLUDED.value;
+    RETURN NULL;
+END;
+$body$ LANGUAGE plpgsql;
+
+CREATE OR REPLACE FUNCTION SortKeysMetadataOldRowsFunc()
+RETURNS TRIGGER AS $body$
+BEGIN
+    DELETE FROM SortKeys USING oldRows
+      WHERE SortKeys.id = oldRows.id AND SortKeys.sortKey = 4294967296 + oldRows.type;
+    RETURN NULL;
+END;
+$body$ LANGUAGE plpgsql;
+
+-- transition tables are not allowed in triggers with more than one event,
+-- hence the 3 triggers per table
+
+CREATE TRIGGER MainDicomTagsInsertedSortKeys
+AFTER INSERT ON MainDicomTags
+REFERENCING NEW TABLE AS newRows
+FOR EACH STATEMENT EXECUTE PROCEDURE SortKeysTagsNewRowsFunc();
+
+CREATE TRIGGER MainDicomTagsUpdatedSortKeys
+AFTER UPDATE ON MainDicomTags
+REFERENCING NEW TABLE AS newRows
+FOR EACH STATEMENT EXECUTE PROCEDURE SortKeysTagsNewRowsFunc();
+
+CREATE TRIGGER MainDicomTagsDeletedSortKeys
+AFTER DELETE ON MainDicomTags
+REFERENCING OLD TABLE AS oldRows
+FOR EACH STATEMENT EXECUTE PROCEDURE SortKeysTagsOldRowsFunc();
+
+CREATE TRIGGER DicomIdentifiersInsertedSortKeys
+AFTER INSERT ON DicomIdentifiers
+REFERENCING NEW TABLE AS newRows
+FOR EACH STATEMENT EXECUTE PROCEDURE SortKeysTagsNewRowsFunc();
+
+CREATE TRIGGER DicomIdentifiersUpdatedSortKeys
+AFTER UPDATE ON DicomIdentifiers
+REFERENCING NEW TABLE AS newRows
+FOR EACH STATEMENT EXECUTE PROCEDURE SortKeysTagsNewRowsFunc();
+
+CREATE TRIGGER DicomIdentifiersDeletedSortKeys
+AFTER DELETE ON DicomIdentifiers
+REFERENCING OLD TABLE AS oldRows
+FOR EACH STATEMENT EXECUTE PROCEDURE SortKeysTagsOldRowsFunc();
+
+CREATE TRIGGER MetadataInsertedSortKeys
+AFTER INSERT ON Metadata
+REFERENCING NEW TABLE AS newRows
+FOR EACH STATEMENT EXECUTE PROCEDURE SortKeysMetadataNewRowsFunc();
+
+CREATE TRIGGER MetadataUpdatedSortKeys
+AFTER UPDATE ON Metadata
+REFERENCING NEW TABLE AS newRows
+FOR EACH STATEMENT EXECUTE PROCEDURE SortKeysMetadataNewRowsFunc();
+
+CREATE TRIGGER MetadataDeletedSortKeys
+AFTER DELETE ON Metadata
+REFERENCING OLD TABLE AS oldRows
+FOR EACH STATEMENT EXECUTE PROCEDURE SortKeysMetadataOldRowsFunc();
@@ -0,0 +1,195 @@
+-- This SQL file starts the online migration of the "MainDicomTags" and "DicomIdentifiers" tables
+-- to tables that are hash-partitioned by "id" (cf. the "TagsPartitionsCount" option).
+--   1. "CreateTagsPartitions()" creates the empty partitioned tables "MainDicomTagsPartitioned" and
+--      "DicomIdentifiersPartitioned", and row triggers mirror the writes to the original tables
+--   2. the housekeeping calls "CopyTagsToPartitions()", which copies the tags of a batch of
+--      resources, until all the resources that existed at step 1 have been copied
+--   3. "SwapTagsPartitions()" replaces the original tables by the partitioned tables, within
+--      a short transaction
+-- Note to developers:
+--   - it is only executed if the "TagsPartitioning" table does not exist yet, when the DB is "locked"
+--   - it requires PostgreSQL >= 11 (hash partitioning, "ON CONFLICT" on partitioned tables)
+--   - the indexes have the same definitions as in "PrepareIndex.sql", with the suffix "Partitioned"
+--     in their names until the swap
+--   - the copy locks the source rows ("FOR SHARE"), so that a concurrent deletion is either mirrored
+--     after the copy, or seen by the copy
+
+CREATE TABLE TagsPartitioning(
+       lastId BIGINT NOT NULL,    -- the tags of the resources up to "lastId" have been copied
+       targetId BIGINT NOT NULL   -- the tags of the resources beyond "targetId" are mirrored by the triggers
+       );
+
+INSERT INTO TagsPartitioning SELECT 0, COALESCE(MAX(internalId), 0) FROM Resources;
+
+
+CREATE OR REPLACE FUNCTION CreateTagsPartitions(
+  IN partitions_count INTEGER)
+RETURNS VOID AS $body$
+BEGIN
+    CREATE TABLE MainDicomTagsPartitioned(
+           id BIGINT REFERENCES Resources(internalId) ON DELETE CASCADE,
+           tagGroup INTEGER,
+           tagElement INTEGER,
+           value TEXT,
+           PRIMARY KEY(id, tagGroup, tagElement)
+           ) PARTITION BY HASH (id);
+
+    CREATE TABLE DicomIdentifiersPartitioned(
+           id BIGINT REFERENCES Resources(internalId) ON DELETE CASCADE,
+           tagGroup INTEGER,
+           tagElement INTEGER,
+           value TEXT,
+           PRIMARY KEY(id, tagGroup, tagElement)
+           ) PARTITION BY HASH (id);
+
+    FOR i IN 0 .. partitions_count - 1 LOOP
+        EXECUTE format('CREATE TABLE MainDicomTags_%s PARTITION OF MainDicomTagsPartitioned '
+                       'FOR VALUES WITH (MODULUS %s, REMAINDER %s)', i, partitions_count, i);
+        EXECUTE format('CREATE TABLE DicomIdentifiers_%s PARTITION OF DicomIdentifiersPartitioned '
+                       'FOR VALUES WITH (MODULUS %s, REMAINDER %s)', i, partitions_count, i);
+    END LOOP;
+
+    CREATE INDEX MainDicomTagsIndexPartitioned ON MainDicomTagsPartitioned(id);
+    CREATE INDEX DicomIdentifiersIndex1Partitioned ON DicomIdentifiersPartitioned(id);
+    CREATE INDEX DicomIdentifiersIndex3Partitioned ON DicomIdentifiersPartitioned(tagGroup, tagElement, value);
+    CREATE INDEX DicomIdentifiersIndexValuesPartitioned ON DicomIdentifiersPartitioned(value);
+    CREATE INDEX DicomIdentifiersIndex4Partitioned ON DicomIdentifiersPartitioned(tagGroup, tagElement, value text_pattern_ops);
+
+    IF EXISTS (SELECT 1 FROM pg_extension WHERE extname='pg_trgm') THEN
+        CREATE INDEX DicomIdentifiersIndexValues2Partitioned ON DicomIdentifiersPartitioned USING gin(value gin_trgm_ops);
+    END IF;
+
+    CREATE TRIGGER MainDicomTagsMirrored
+    AFTER INSERT OR UPDATE OR DELETE ON MainDicomTags
+    FOR EACH ROW
+    EXECUTE PROCEDURE MainDicomTagsMirroredFunc();
+
+    CREATE TRIGGER DicomIdentifiersMirrored
+    AFTER INSERT OR UPDATE OR DELETE ON DicomIdentifiers
+    FOR EACH ROW
+    EXECUTE PROCEDURE DicomIdentifiersMirroredFunc();
+END;
+$body$ LANGUAGE plpgsql;
+
+
+-- Two distinct functions avoid dynamic SQL in the triggers, that are executed for each row
+
+CREATE OR REPLACE FUNCTION MainDicomTagsMirroredFunc()
+RETURNS TRIGGER AS $body$
+BEGIN
+    IF TG_OP = 'DELETE' OR TG_OP = 'UPDATE' THEN
+        DELETE FROM MainDicomTagsPartitioned
+          WHERE id = old.id AND tagGroup = old.tagGroup AND tagElement = old.tagElement;
+    END IF;
+
+    IF TG_OP = 'INSERT' OR TG_OP = 'UPDATE' THEN
+        INSERT INTO MainDicomTagsPartitioned VALUES (new.id, new.tagGroup, new.tagElement, new.value)
+          ON CONFLICT (id, tagGroup, tagElement) DO UPDATE SET value = EXCLUDED.value;
+    END IF;
+
+    RETURN NULL;
+END;
+$body$ LANGUAGE plpgsql;
+
+CREATE OR REPLACE FUNCTION DicomIdentifiersMirroredFunc()
+RETURNS TRIGGER AS $body$
+BEGIN
+    IF TG_OP = 'DELETE' OR TG_OP = 'UPDATE' THEN
+        DELETE FROM DicomIdentifiersPartitioned
+          WHERE id = old.id AND tagGroup = old.tagGroup AND tagElement = old.tagElement;
+    END IF;
+
+    IF TG_OP = 'INSERT' OR TG_OP = 'UPDATE' THEN
+        INSERT INTO DicomIdentifiersPartitioned VALUES (new.id, new.tagGroup, new.tagElement, new.value)
+          ON CONFLICT (id, tagGroup, tagElement) DO UPDATE SET value = EXCLUDED.value;
+    END IF;
+
+    RETURN NULL;
+END;
+$body$ LANGUAGE plpgsql;
+
+
+-- Copies the tags of the next "batch_size" resources (by range of "id"). Returns the
+-- number of resources of the range, or 0 if all the resources have been copied.
+CREATE OR REPLACE FUNCTION CopyTagsToPartitions(
+  IN batch_size BIGINT)
+RETURNS BIGINT AS $body$
+DECLARE
+    first_id BIGINT;
+    last_id BIGINT;
+    target_id BIGINT;
+BEGIN
+    -- the lock serializes the Orthanc servers sharing the database
+    SELECT lastId, targetId INTO first_id, target_id FROM TagsPartitioning FOR UPDATE;
+
+    IF first_id >= target_id THEN
+        RETURN 0;
+    END IF;
+
+    last_id := LEAST(first_id + batch_size, target_id);
+
+    INSERT INTO MainDicomTagsPartitioned
+      SELECT * FROM MainDicomTags WHERE id > first_id AND id <= last_id FOR SHARE
+      ON CONFLICT DO NOTHING;
+
+    INSERT INTO DicomIdentifiersPartitioned
+      SELECT * FROM DicomIdentifiers WHERE id > first_id AND id <= last_id FOR SHARE
+      ON CONFLICT DO NOTHING;
+
+    UPDATE TagsPartitioning SET lastId = last_id;
+
+    RETURN last_id - first_id;
+END;
+$body$ LANGUAGE plpgsql;
+
+
+-- Replaces the original tables by the partitioned tables, once all the tags have been
+-- copied. The other triggers of the original tables (e.g. the ones of "ResourceSummary")
+-- are recreated on the partitioned tables. Returns 1 if the tables have been swapped,
+-- or 0 if the copy is not complete or if the tables have already been swapped.
+CREATE OR REPLACE FUNCTION SwapTagsPartitions()
+RETURNS BIGINT AS $body$
+DECLARE
+    tables TEXT[] := ARRAY['maindicomtags', 'dicomidentifiers'];
+    indexes TEXT[] := ARRAY['maindicomtagsindex', 'dicomidentifiersindex1', 'dicomidentifiersindex2',
+                            'dicomidentifiersindex3', 'dicomidentifiersindexvalues',
+                            'dicomidentifiersindex4', 'dicomidentifiersindexvalues2'];
+    t TEXT;
+    i TEXT;
+    trig RECORD;
+BEGIN
+    IF to_regclass('maindicomtagspartitioned') IS NULL OR
+       EXISTS (SELECT 1 FROM TagsPartitioning WHERE lastId < targetId FOR UPDATE) THEN
+        RETURN 0;
+    END IF;
+
+    LOCK TABLE MainDicomTags, DicomIdentifiers IN ACCESS EXCLUSIVE MODE;
+
+    DROP TRIGGER MainDicomTagsMirrored ON MainDicomTags;
+    DROP TRIGGER DicomIdentifiersMirrored ON DicomIdentifiers;
+
+    FOREACH t IN ARRAY tables LOOP
+        EXECUTE format('ALTER TABLE %I RENAME TO %I', t, t || 'legacy');
+        EXECUTE format('ALTER TABLE %I RENAME TO %I', t || 'partitioned', t);
+
+        FOR trig IN SELECT pg_get_triggerdef(oid) AS def FROM pg_trigger
+                    WHERE tgrelid = to_regclass(t || 'legacy') AND NOT tgisinternal LOOP
+            EXECUTE regexp_replace(trig.def, ' ON \S+ ', format(' ON %I ', t));
+        END LOOP;
+
+        EXECUTE format('DROP TABLE %I', t || 'legacy');
+        EXECUTE format('ALTER INDEX %I RENAME TO %I', t || 'partitioned_pkey', t || '_pkey');
+    END LOOP;
+
+    FOREACH i IN ARRAY indexes LOOP
+        IF to_regclass(i || 'partitioned') IS NOT NULL THEN
+            EXECUTE format('ALTER INDEX %I RENAME TO %I', i || 'partitioned', i);
+        END IF;
+    END LOOP;
+
+    DROP FUNCTION MainDicomTagsMirroredFunc;
+    DROP FUNCTION DicomIdentifiersMirroredFunc;
+
+    RETURN 1;
+END;
+$body$ LANGUAGE plpgsql;
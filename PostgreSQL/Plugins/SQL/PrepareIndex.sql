@@ -99,7 +99,7 @@ CREATE TABLE IF NOT EXISTS GlobalIntegers(
 -- 4: SeriesCount
 -- 5: InstancesCount
 -- 6: ChangeSeq
--- 7: PatientRecyclingOrderSeq
+-- 7: PatientRecyclingOrderSeq (only used by former revisions, the sequence of PatientRecyclingOrder is used instead)
 
 CREATE TABLE IF NOT EXISTS ServerProperties(
         server VARCHAR(64) NOT NULL,
@@ -113,7 +113,11 @@ DECLARE
 BEGIN
     SELECT version() INTO pg_version;
 
-    IF substring(pg_version from 'PostgreSQL (\d+)\.')::int >= 11 THEN
+    IF to_regclass('childrenindex') IS NOT NULL THEN
+        -- upgrade from Rev2: ChildrenIndex2 is built online by the housekeeping of the plugin
+        -- (cf. "OnlineUpgrades"), and ChildrenIndex is used until then
+        RAISE NOTICE 'ChildrenIndex2 will be built online';
+    ELSIF substring(pg_version from 'PostgreSQL (\d+)\.')::int >= 11 THEN
         -- PostgreSQL 11 or later
 
         -- new ChildrenIndex2 introduced in Rev3 (replacing previous ChildrenIndex)
@@ -124,17 +128,30 @@ BEGIN
 END $$;
 
 
-CREATE INDEX IF NOT EXISTS PublicIndex ON Resources(publicId);
+-- The lookups by public ID use the index of the "UniquePublicId" constraint:
+-- The former "PublicIndex" was a second copy of this index
+DROP INDEX IF EXISTS PublicIndex;
 CREATE INDEX IF NOT EXISTS ResourceTypeIndex ON Resources(resourceType);
 CREATE INDEX IF NOT EXISTS PatientRecyclingIndex ON PatientRecyclingOrder(patientId);
 
 CREATE INDEX IF NOT EXISTS MainDicomTagsIndex ON MainDicomTags(id);
 CREATE INDEX IF NOT EXISTS DicomIdentifiersIndex1 ON DicomIdentifiers(id);
-CREATE INDEX IF NOT EXISTS DicomIdentifiersIndex2 ON DicomIdentifiers(tagGroup, tagElement);
 CREATE INDEX IF NOT EXISTS DicomIdentifiersIndex3 ON DicomIdentifiers(tagGroup, tagElement, value);
 CREATE INDEX IF NOT EXISTS DicomIdentifiersIndexValues ON DicomIdentifiers(value);
 
+-- The predicates on "(tagGroup, tagElement)" use the prefix of "DicomIdentifiersIndex3":
+-- The former "DicomIdentifiersIndex2" was a narrower copy of this prefix
+DROP INDEX IF EXISTS DicomIdentifiersIndex2;
+
+-- Range scans for the wildcards with a literal prefix (e.g. "DOE*"), whatever the
+-- collation of the database, through the "~>=~" and "~<~" operators
+CREATE INDEX IF NOT EXISTS DicomIdentifiersIndex4 ON DicomIdentifiers(tagGroup, tagElement, value text_pattern_ops);
+
 CREATE INDEX IF NOT EXISTS ChangesIndex ON Changes(internalId);
+
+-- The change feeds that are filtered by change type skip the other changes
+CREATE INDEX IF NOT EXISTS ChangesIndex2 ON Changes(changeType, seq);
+
 CREATE INDEX IF NOT EXISTS LabelsIndex1 ON LABELS(id);
 CREATE INDEX IF NOT EXISTS LabelsIndex2 ON LABELS(label);
 
@@ -170,10 +187,20 @@ BEGIN
     DECLARE
         newSeq BIGINT;
     BEGIN
-        UPDATE GlobalIntegers SET value = value + 1 WHERE key = 7 RETURNING value INTO newSeq;
+        -- "nextval()" does not lock any row, contrary to an "UPDATE" of the GlobalIntegers key 7
+        newSeq := nextval('patientrecyclingorder_seq_seq');
         IF is_update > 0 THEN
             -- Note: Protected patients are not listed in this table !  So, they won't be updated
-            UPDATE PatientRecyclingOrder SET seq = newSeq WHERE PatientRecyclingOrder.patientId = patient_id;
+            IF current_setting('server_version_num')::integer >= 90500 THEN
+                -- The transactions that ingest the same patient don't wait for each other:
+                -- If the row is locked, the patient is being moved to the end of the
+                -- recycling order by another transaction (dynamic SQL, as "SKIP LOCKED" is not parsed by older versions)
+                EXECUTE 'UPDATE PatientRecyclingOrder SET seq = $1 WHERE ctid IN ('
+                        'SELECT ctid FROM PatientRecyclingOrder WHERE patientId = $2 FOR UPDATE SKIP LOCKED)'
+                    USING newSeq, patient_id;
+            ELSE
+                UPDATE PatientRecyclingOrder SET seq = newSeq WHERE PatientRecyclingOrder.patientId = patient_id;
+            END IF;
         ELSE
             INSERT INTO PatientRecyclingOrder VALUES (newSeq, patient_id);
         END IF;
@@ -203,6 +230,75 @@ INSERT INTO GlobalIntegers
     SELECT 7, CAST(COALESCE(MAX(seq), 0) AS BIGINT) FROM PatientRecyclingOrder
     ON CONFLICT DO NOTHING;
 
+-- the sequence continues after the values that former revisions have taken from the key 7
+SELECT setval('patientrecyclingorder_seq_seq', GREATEST(
+    (SELECT last_value FROM patientrecyclingorder_seq_seq),
+    (SELECT COALESCE(MAX(seq), 0) FROM PatientRecyclingOrder),
+    (SELECT COALESCE(MAX(value), 0) FROM GlobalIntegers WHERE key = 7)));
+
+
+------------------- Signalling of the deletions -------------------
+
+-- The triggers record the deleted resources and files in these tables, keyed by the backend
+-- process of the connection, instead of session-level temporary tables, whose creation bloats
+-- the system catalogs. The rows are consumed by "ConsumeDeletedItems()" in the transaction that
+-- has deleted them, so they are never visible to the other connections.
+CREATE UNLOGGED TABLE IF NOT EXISTS DeletedResourcesQueue(
+       backendPid INTEGER NOT NULL,
+       resourceType INTEGER NOT NULL,
+       publicId VARCHAR(64) NOT NULL
+       );
+
+CREATE INDEX IF NOT EXISTS DeletedResourcesQueueIndex ON DeletedResourcesQueue(backendPid);
+
+CREATE UNLOGGED TABLE IF NOT EXISTS DeletedFilesQueue(
+       backendPid INTEGER NOT NULL,
+       uuid VARCHAR(64) NOT NULL,
+       fileType INTEGER,
+       compressedSize BIGINT,
+       uncompressedSize BIGINT,
+       compressionType INTEGER,
+       uncompressedHash VARCHAR(40),
+       compressedHash VARCHAR(40)
+       );
+
+CREATE INDEX IF NOT EXISTS DeletedFilesQueueIndex ON DeletedFilesQueue(backendPid);
+
+-- The functions that delete resources or attachments return the signals in a single result set,
+-- the first column being the kind of the row:
+--   0 = remaining ancestor (item_type = resource type, item_id = public ID)
+--   1 = deleted file (item_type = file type, item_id = UUID, and the other columns)
+--   2 = deleted resource (item_type = resource type, item_id = public ID)
+CREATE OR REPLACE FUNCTION ConsumeDeletedItems()
+RETURNS TABLE(signal_kind INTEGER, item_type INTEGER, item_id TEXT,
+              uncompressed_size BIGINT, uncompressed_hash TEXT, compression_type INTEGER,
+              compressed_size BIGINT, compressed_hash TEXT) AS $body$
+BEGIN
+    RETURN QUERY
+        WITH deleted_rows AS (
+            DELETE FROM DeletedFilesQueue WHERE backendPid = pg_backend_pid() RETURNING *)
+        SELECT 1, d.fileType, d.uuid::TEXT, d.uncompressedSize, d.uncompressedHash::TEXT,
+               d.compressionType, d.compressedSize, d.compressedHash::TEXT
+        FROM deleted_rows AS d;
+
+    RETURN QUERY
+        WITH deleted_rows AS (
+            DELETE FROM DeletedResourcesQueue WHERE backendPid = pg_backend_pid() RETURNING *)
+        SELECT 2, d.resourceType, d.publicId::TEXT, NULL::BIGINT, NULL::TEXT,
+               NULL::INTEGER, NULL::BIGINT, NULL::TEXT
+        FROM deleted_rows AS d;
+END;
+$body$ LANGUAGE plpgsql;
+
+-- Discards the rows that would have been left by a previous transaction of the same connection
+CREATE OR REPLACE FUNCTION ClearDeletedItems(
+) RETURNS VOID AS $body$
+BEGIN
+    DELETE FROM DeletedFilesQueue WHERE backendPid = pg_backend_pid();
+    DELETE FROM DeletedResourcesQueue WHERE backendPid = pg_backend_pid();
+END;
+$body$ LANGUAGE plpgsql;
+
 
 ------------------- ResourceDeleted trigger -------------------
 DROP TRIGGER IF EXISTS ResourceDeleted ON Resources;
@@ -213,7 +309,7 @@ CREATE OR REPLACE FUNCTION ResourceDeletedFunc()
 RETURNS TRIGGER AS $body$
 BEGIN
   -- RAISE NOTICE 'ResourceDeletedFunc %', old.publicId;
-  INSERT INTO DeletedResources VALUES (old.resourceType, old.publicId);
+  INSERT INTO DeletedResourcesQueue VALUES (pg_backend_pid(), old.resourceType, old.publicId);
   
   -- If this resource is the latest child, delete the parent
   DELETE FROM Resources WHERE internalId = old.parentId
@@ -231,10 +327,14 @@ EXECUTE PROCEDURE ResourceDeletedFunc();
 
 ------------------- DeleteResource function -------------------
 
+-- The signature has changed, as the signals are now returned by the function
+DROP FUNCTION IF EXISTS DeleteResource(BIGINT);
+
 CREATE OR REPLACE FUNCTION DeleteResource(
-    IN id BIGINT,
-    OUT remaining_ancestor_resource_type INTEGER,
-    OUT remaining_anncestor_public_id TEXT) AS $body$
+    IN id BIGINT)
+RETURNS TABLE(signal_kind INTEGER, item_type INTEGER, item_id TEXT,
+              uncompressed_size BIGINT, uncompressed_hash TEXT, compression_type INTEGER,
+              compressed_size BIGINT, compressed_hash TEXT) AS $body$
 
 DECLARE
     deleted_row RECORD;
@@ -242,22 +342,7 @@ DECLARE
 
 BEGIN
 
-    SET client_min_messages = warning;   -- suppress NOTICE:  relation "deletedresources" already exists, skipping
-    
-    -- note: temporary tables are created at session (connection) level -> they are likely to exist
-    -- these tables are used by the triggers
-    CREATE TEMPORARY TABLE IF NOT EXISTS DeletedResources(
-        resourceType INTEGER NOT NULL,
-        publicId VARCHAR(64) NOT NULL
-        );
-
-    RESET client_min_messages;
-
-    -- clear the temporary table in case it has been created earlier in the session
-    DELETE FROM DeletedResources;
-    
-    -- create/clear the DeletedFiles temporary table
-    PERFORM CreateDeletedFilesTemporaryTable();
+    PERFORM ClearDeletedItems();
 
     -- Before deleting an object, we need to lock its parent until the end of the transaction to avoid that
     -- 2 threads deletes the last 2 instances of a series at the same time -> none of them would realize
@@ -271,47 +356,101 @@ BEGIN
 
     -- If this resource still has siblings, keep track of the remaining parent
     -- (a parent that must not be deleted but whose LastUpdate must be updated)
-    SELECT resourceType, publicId INTO remaining_ancestor_resource_type, remaining_anncestor_public_id
+    RETURN QUERY
+        SELECT 0, Resources.resourceType, Resources.publicId::TEXT, NULL::BIGINT, NULL::TEXT,
+               NULL::INTEGER, NULL::BIGINT, NULL::TEXT
         FROM Resources 
         WHERE internalId = deleted_row.parentId
             AND EXISTS (SELECT 1 FROM Resources WHERE parentId = deleted_row.parentId);
 
+    RETURN QUERY SELECT * FROM ConsumeDeletedItems();
+
 END;
 
 $body$ LANGUAGE plpgsql;
 
-CREATE OR REPLACE FUNCTION CreateDeletedFilesTemporaryTable(
-) RETURNS VOID AS $body$
+------------------- DeleteResources function -------------------
 
-BEGIN
+DROP FUNCTION IF EXISTS DeleteResources(BIGINT[]);
 
-    SET client_min_messages = warning;   -- suppress NOTICE:  relation "deletedresources" already exists, skipping
-    
-    -- note: temporary tables are created at session (connection) level -> they are likely to exist
-    CREATE TEMPORARY TABLE IF NOT EXISTS DeletedFiles(
-        uuid VARCHAR(64) NOT NULL,
-        fileType INTEGER,
-        compressedSize BIGINT,
-        uncompressedSize BIGINT,
-        compressionType INTEGER,
-        uncompressedHash VARCHAR(40),
-        compressedHash VARCHAR(40)
-        );
+-- Set-based version of DeleteResource() for bulk deletions: the resources are deleted by a single
+-- statement, and the nearest surviving ancestor of each deleted resource is returned
+CREATE OR REPLACE FUNCTION DeleteResources(
+    IN ids BIGINT[])
+RETURNS TABLE(signal_kind INTEGER, item_type INTEGER, item_id TEXT,
+              uncompressed_size BIGINT, uncompressed_hash TEXT, compression_type INTEGER,
+              compressed_size BIGINT, compressed_hash TEXT) AS $body$
 
-    RESET client_min_messages;
+DECLARE
+    resource_ids BIGINT[];
+    ancestor_ids BIGINT[];
+    depths INTEGER[];
+
+BEGIN
+
+    PERFORM ClearDeletedItems();
+
+    -- Same locking as in DeleteResource(), the parents being locked in a fixed order to avoid
+    -- deadlocks between concurrent bulk deletions
+    PERFORM 1 FROM Resources WHERE internalId IN (SELECT parentId FROM Resources WHERE internalId = ANY(ids))
+        ORDER BY internalId FOR UPDATE;
+
+    -- The ancestors must be recorded before the deletion, as the trigger deletes the parents
+    -- that have no remaining children
+    WITH RECURSIVE Ancestors(resourceId, ancestorId, depth) AS (
+        SELECT internalId, parentId, 1 FROM Resources WHERE internalId = ANY(ids) AND parentId IS NOT NULL
+      UNION ALL
+        SELECT Ancestors.resourceId, Resources.parentId, Ancestors.depth + 1 FROM Ancestors
+          INNER JOIN Resources ON Resources.internalId = Ancestors.ancestorId
+          WHERE Resources.parentId IS NOT NULL)
+    SELECT array_agg(resourceId), array_agg(ancestorId), array_agg(depth)
+        INTO resource_ids, ancestor_ids, depths FROM Ancestors;
+
+    DELETE FROM Resources WHERE internalId = ANY(ids);
+    -- note: the ResourceDeletedFunc trigger fills "DeletedResourcesQueue" and deletes the parents
+
+    RETURN QUERY
+        SELECT DISTINCT 0, Resources.resourceType, Resources.publicId::TEXT, NULL::BIGINT, NULL::TEXT,
+               NULL::INTEGER, NULL::BIGINT, NULL::TEXT
+            FROM Resources INNER JOIN
+                (SELECT DISTINCT ON (a.resourceId) a.ancestorId
+                    FROM unnest(resource_ids, ancestor_ids, depths) AS a(resourceId, ancestorId, depth)
+                    WHERE EXISTS (SELECT 1 FROM Resources AS r WHERE r.internalId = a.ancestorId)
+                    ORDER BY a.resourceId, a.depth) AS Nearest
+            ON Resources.internalId = Nearest.ancestorId;
+
+    RETURN QUERY SELECT * FROM ConsumeDeletedItems();
 
-    -- clear the temporary table in case it has been created earlier in the session
-    DELETE FROM DeletedFiles;
 END;
 
 $body$ LANGUAGE plpgsql;
 
+------------------- DeleteAttachment function -------------------
+
+CREATE OR REPLACE FUNCTION DeleteAttachment(
+    IN resource_id BIGINT,
+    IN file_type INTEGER)
+RETURNS TABLE(signal_kind INTEGER, item_type INTEGER, item_id TEXT,
+              uncompressed_size BIGINT, uncompressed_hash TEXT, compression_type INTEGER,
+              compressed_size BIGINT, compressed_hash TEXT) AS $body$
+BEGIN
+    PERFORM ClearDeletedItems();
+
+    DELETE FROM AttachedFiles WHERE id = resource_id AND fileType = file_type;
+
+    RETURN QUERY SELECT * FROM ConsumeDeletedItems();
+END;
+$body$ LANGUAGE plpgsql;
+
+-- Replaced by "DeletedFilesQueue"
+DROP FUNCTION IF EXISTS CreateDeletedFilesTemporaryTable();
+
 
 CREATE OR REPLACE FUNCTION AttachedFileDeletedFunc() 
 RETURNS TRIGGER AS $body$
 BEGIN
-  INSERT INTO DeletedFiles VALUES
-    (old.uuid, old.filetype, old.compressedSize,
+  INSERT INTO DeletedFilesQueue VALUES
+    (pg_backend_pid(), old.uuid, old.filetype, old.compressedSize,
      old.uncompressedSize, old.compressionType,
      old.uncompressedHash, old.compressedHash);
   RETURN NULL;
@@ -485,22 +624,145 @@ END;
 $body$ LANGUAGE plpgsql;
 
 
+------------------- SetResourcesContent function -------------------
+-- Stores the identifier tags, the main DICOM tags and the metadata of
+-- the resources of a new instance in a single round-trip
+CREATE OR REPLACE FUNCTION SetResourcesContent(
+    identifiers_resources BIGINT[],
+    identifiers_groups INTEGER[],
+    identifiers_elements INTEGER[],
+    identifiers_values TEXT[],
+    tags_resources BIGINT[],
+    tags_groups INTEGER[],
+    tags_elements INTEGER[],
+    tags_values TEXT[],
+    metadata_resources BIGINT[],
+    metadata_types INTEGER[],
+    metadata_values TEXT[])
+RETURNS VOID AS $body$
+BEGIN
+    INSERT INTO DicomIdentifiers
+        SELECT * FROM UNNEST(identifiers_resources, identifiers_groups, identifiers_elements, identifiers_values);
+
+    INSERT INTO MainDicomTags
+        SELECT * FROM UNNEST(tags_resources, tags_groups, tags_elements, tags_values);
+
+    -- A loop is used for the metadata, as the same metadata might be set twice
+    IF CARDINALITY(metadata_resources) > 0 THEN
+        PERFORM InsertOrUpdateMetadata(metadata_resources, metadata_types, metadata_values,
+                                       ARRAY_FILL(0, ARRAY[CARDINALITY(metadata_resources)]));
+    END IF;
+END;
+$body$ LANGUAGE plpgsql;
+
+
+------------------- IngestResources function -------------------
+-- Stores all the writes that follow "CreateInstance()" while ingesting
+-- a new instance (resources content, attachments, metadata and changes)
+-- in a single round-trip. The changes are logged in the order of the
+-- arrays, so that the sequence numbers match the order of the calls.
+CREATE OR REPLACE FUNCTION IngestResources(
+    identifiers_resources BIGINT[],
+    identifiers_groups INTEGER[],
+    identifiers_elements INTEGER[],
+    identifiers_values TEXT[],
+    tags_resources BIGINT[],
+    tags_groups INTEGER[],
+    tags_elements INTEGER[],
+    tags_values TEXT[],
+    content_metadata_resources BIGINT[],
+    content_metadata_types INTEGER[],
+    content_metadata_values TEXT[],
+    attachments_resources BIGINT[],
+    attachments_types INTEGER[],
+    attachments_uuids TEXT[],
+    attachments_compressed_sizes BIGINT[],
+    attachments_uncompressed_sizes BIGINT[],
+    attachments_compression_types INTEGER[],
+    attachments_uncompressed_hashes TEXT[],
+    attachments_compressed_hashes TEXT[],
+    attachments_revisions INTEGER[],
+    metadata_resources BIGINT[],
+    metadata_types INTEGER[],
+    metadata_values TEXT[],
+    metadata_revisions INTEGER[],
+    changes_types INTEGER[],
+    changes_resources BIGINT[],
+    changes_resource_types INTEGER[],
+    changes_dates TEXT[])
+RETURNS VOID AS $body$
+BEGIN
+    PERFORM SetResourcesContent(identifiers_resources, identifiers_groups, identifiers_elements, identifiers_values,
+                                tags_resources, tags_groups, tags_elements, tags_values,
+                                content_metadata_resources, content_metadata_types, content_metadata_values);
+
+    INSERT INTO AttachedFiles
+        SELECT * FROM UNNEST(attachments_resources, attachments_types, attachments_uuids,
+                             attachments_compressed_sizes, attachments_uncompressed_sizes,
+                             attachments_compression_types, attachments_uncompressed_hashes,
+                             attachments_compressed_hashes, attachments_revisions);
+
+    IF CARDINALITY(metadata_resources) > 0 THEN
+        PERFORM InsertOrUpdateMetadata(metadata_resources, metadata_types, metadata_values, metadata_revisions);
+    END IF;
+
+    IF CARDINALITY(changes_types) > 0 THEN
+        FOR i IN 1 .. CARDINALITY(changes_types) LOOP
+            INSERT INTO Changes (changeType, internalId, resourceType, date)
+                VALUES(changes_types[i], changes_resources[i], changes_resource_types[i], changes_dates[i]);
+        END LOOP;
+    END IF;
+END;
+$body$ LANGUAGE plpgsql;
+
+
 ------------------- GetLastChange function -------------------
 DROP TRIGGER IF EXISTS InsertedChange ON Changes;
 
+DROP TRIGGER IF EXISTS LockChangeSeq ON Changes;
+
 -- insert the value if not already there
 INSERT INTO GlobalIntegers
     SELECT 6, CAST(COALESCE(MAX(seq), 0) AS BIGINT) FROM Changes
     ON CONFLICT DO NOTHING;
 
+-- fold the ChangeSeq that was sharded by former revisions of this file, and drop their shards
+DO $body$
+BEGIN
+    IF to_regclass('globalintegersshards') IS NOT NULL THEN
+        UPDATE GlobalIntegers SET value = GREATEST(value, (SELECT MAX(value) FROM GlobalIntegersShards WHERE key = 6)) WHERE key = 6;
+        DROP TABLE GlobalIntegersShards;
+    END IF;
+END $body$;
+
+-- The row of the key 6 serializes the transactions that insert changes: Its lock is taken
+-- before the "seq" of the new changes are allocated (cf. "LockChangeSeq"), and it is only
+-- released at the commit. The changes are therefore committed in the order of "seq", and
+-- the readers of "Changes" cannot see a "seq" before a smaller one has been committed.
+-- The key 6 must not be sharded, otherwise the pollers of the changes might skip the changes
+-- of a longer-running transaction.
+CREATE OR REPLACE FUNCTION LockChangeSeqFunc()
+RETURNS TRIGGER AS $body$
+BEGIN
+    PERFORM value FROM GlobalIntegers WHERE key = 6 FOR UPDATE;
+    RETURN NULL;
+END;
+$body$ LANGUAGE plpgsql;
+
 CREATE OR REPLACE FUNCTION InsertedChangeFunc() 
 RETURNS TRIGGER AS $body$
 BEGIN
-    UPDATE GlobalIntegers SET value = new.seq WHERE key = 6;
+    UPDATE GlobalIntegers SET value = GREATEST(value, new.seq) WHERE key = 6;
     RETURN NULL;
 END;
 $body$ LANGUAGE plpgsql;
 
+-- "BEFORE ... FOR EACH STATEMENT" is fired before the default values of "seq" are computed
+CREATE TRIGGER LockChangeSeq
+BEFORE INSERT ON Changes
+FOR EACH STATEMENT
+EXECUTE PROCEDURE LockChangeSeqFunc();
+
 DROP TRIGGER IF EXISTS InsertedChange on Changes;
 CREATE TRIGGER InsertedChange
 AFTER INSERT ON Changes
@@ -529,12 +791,14 @@ BEGIN
 	is_new_series := 1;
 	is_new_instance := 1;
 
+	-- The existing parents are locked with "FOR KEY SHARE", which prevents from their deletion
+	-- (cf. "DeleteResource()"), but not the concurrent ingests of other children
 	BEGIN
         INSERT INTO "resources" VALUES (DEFAULT, 0, patient_public_id, NULL, 0) RETURNING internalid INTO patient_internal_id;
     EXCEPTION
         WHEN unique_violation THEN
             is_new_patient := 0;
-            SELECT internalid INTO patient_internal_id FROM "resources" WHERE publicId = patient_public_id FOR UPDATE;  -- also locks the resource and its parent to prevent from deletion while we complete this transaction
+            SELECT internalid INTO patient_internal_id FROM "resources" WHERE publicId = patient_public_id FOR KEY SHARE;  -- also locks the resource and its parent to prevent from deletion while we complete this transaction
     END;
 
 	BEGIN
@@ -542,7 +806,7 @@ BEGIN
     EXCEPTION
         WHEN unique_violation THEN
             is_new_study := 0;
-            SELECT internalid INTO study_internal_id FROM "resources" WHERE publicId = study_public_id FOR UPDATE;  -- also locks the resource and its parent to prevent from deletion while we complete this transaction    END;
+            SELECT internalid INTO study_internal_id FROM "resources" WHERE publicId = study_public_id FOR KEY SHARE;  -- also locks the resource and its parent to prevent from deletion while we complete this transaction    END;
     END;
 
 	BEGIN
@@ -550,7 +814,7 @@ BEGIN
     EXCEPTION
         WHEN unique_violation THEN
             is_new_series := 0;
-            SELECT internalid INTO series_internal_id FROM "resources" WHERE publicId = series_public_id FOR UPDATE;  -- also locks the resource and its parent to prevent from deletion while we complete this transaction    END;
+            SELECT internalid INTO series_internal_id FROM "resources" WHERE publicId = series_public_id FOR KEY SHARE;  -- also locks the resource and its parent to prevent from deletion while we complete this transaction    END;
     END;
 
   	BEGIN
@@ -601,68 +865,89 @@ CREATE OR REPLACE FUNCTION ComputeMissingChildCount(
     OUT updated_rows_count BIGINT
 ) RETURNS BIGINT AS $body$
 BEGIN
+    -- The pending changes of the child counts are already accounted for by the count,
+    -- that must use the same snapshot as their deletion (hence the single statement)
+    WITH batch AS (
+        SELECT internalId FROM Resources
+        WHERE resourceType < 3 AND childCount IS NULL
+        LIMIT batch_size),
+    deleted_changes AS (
+        DELETE FROM ChildCountChanges WHERE parentId IN (SELECT internalId FROM batch))
 	UPDATE Resources AS r
     SET childCount = (SELECT COUNT(childLevel.internalId)
                       FROM Resources AS childLevel
                       WHERE childLevel.parentId = r.internalId)
-    WHERE internalId IN (
-        SELECT internalId FROM Resources
-        WHERE resourceType < 3 AND childCount IS NULL
-        LIMIT batch_size);
+    WHERE internalId IN (SELECT internalId FROM batch);
     
     -- Get the number of rows affected
     GET DIAGNOSTICS updated_rows_count = ROW_COUNT;
 END;
 $body$ LANGUAGE plpgsql;
 
+-- Variant of "ComputeMissingChildCount()" for the online upgrades: the resources are
+-- scanned by ranges of "internalId", instead of searching the missing child counts from
+-- the beginning of the table at each batch (the former function is kept for the older
+-- plugins that share the database). Returns the last scanned "internalId", or -1 if
+-- there is no resource after "after_id".
+CREATE OR REPLACE FUNCTION ComputeMissingChildCountFrom(
+    IN after_id BIGINT,
+    IN batch_size BIGINT,
+    OUT last_id BIGINT
+) RETURNS BIGINT AS $body$
+BEGIN
+    SELECT MAX(internalId) INTO last_id FROM
+      (SELECT internalId FROM Resources WHERE internalId > after_id
+       ORDER BY internalId LIMIT batch_size) AS batch;
+
+    IF last_id IS NULL THEN
+        last_id := -1;
+    ELSE
+        -- Same handling of the pending changes as in "ComputeMissingChildCount()"
+        WITH deleted_changes AS (
+            DELETE FROM ChildCountChanges WHERE parentId IN (
+                SELECT internalId FROM Resources
+                WHERE internalId > after_id AND internalId <= last_id
+                  AND resourceType < 3 AND childCount IS NULL))
+        UPDATE Resources AS r
+        SET childCount = (SELECT COUNT(childLevel.internalId)
+                          FROM Resources AS childLevel
+                          WHERE childLevel.parentId = r.internalId)
+        WHERE internalId > after_id AND internalId <= last_id
+          AND resourceType < 3 AND childCount IS NULL;
+    END IF;
+END;
+$body$ LANGUAGE plpgsql;
+
 
 
 DROP TRIGGER IF EXISTS IncrementChildCount on Resources;
 DROP TRIGGER IF EXISTS DecrementChildCount on Resources;
 
+-- The child counts are maintained by appending changes to this table, instead of updating
+-- the row of the parent for each new child, which serializes the transactions that ingest the
+-- same series. The changes are folded into "Resources.childCount" by the housekeeping, the
+-- readers adding the pending changes to "childCount". The changes of the resources whose
+-- "childCount" is NULL are discarded, as it is computed from scratch.
+-- NB: No foreign key, as the changes would be added while their parent is being deleted
+CREATE TABLE IF NOT EXISTS ChildCountChanges(
+    parentId BIGINT NOT NULL,
+    delta INTEGER NOT NULL);
+
+CREATE INDEX IF NOT EXISTS ChildCountChangesIndex ON ChildCountChanges(parentId);
+
 CREATE OR REPLACE FUNCTION UpdateChildCount()
 RETURNS TRIGGER AS $body$
 BEGIN
     IF TG_OP = 'INSERT' THEN
-		IF new.parentId IS NOT NULL THEN
-            -- try to increment the childcount from the parent
-            -- note that we already have the lock on this row because the parent is locked in CreateInstance
-			UPDATE Resources
-		    SET childCount = childCount + 1
-		    WHERE internalId = new.parentId AND childCount IS NOT NULL;
-		
-            -- this should only happen for old studies whose childCount has not yet been computed
-            -- note: this child has already been added so it will be counted
-		    IF NOT FOUND THEN
-		        UPDATE Resources
-                SET childCount = (SELECT COUNT(*)
-		                              FROM Resources
-		                              WHERE internalId = new.parentId)
-		        WHERE internalId = new.parentId;
-		    END IF;
+        IF new.parentId IS NOT NULL THEN
+            INSERT INTO ChildCountChanges VALUES(new.parentId, 1);
         END IF;
-	
-    ELSIF TG_OP = 'DELETE' THEN
 
-		IF old.parentId IS NOT NULL THEN
-
-            -- Decrement the child count for the parent
-            -- note that we already have the lock on this row because the parent is locked in DeleteResource
-            UPDATE Resources
-            SET childCount = childCount - 1
-            WHERE internalId = old.parentId AND childCount IS NOT NULL;
-		
-            -- this should only happen for old studies whose childCount has not yet been computed
-            -- note: this child has already been removed so it will not be counted
-		    IF NOT FOUND THEN
-		        UPDATE Resources
-                SET childCount = (SELECT COUNT(*)
-		                              FROM Resources
-		                              WHERE internalId = new.parentId)
-		        WHERE internalId = new.parentId;
-		    END IF;
+    ELSIF TG_OP = 'DELETE' THEN
+        IF old.parentId IS NOT NULL THEN
+            INSERT INTO ChildCountChanges VALUES(old.parentId, -1);
         END IF;
-        
+
     END IF;
     RETURN NULL;
 END;
@@ -680,9 +965,57 @@ WHEN (OLD.parentId IS NOT NULL)
 EXECUTE PROCEDURE UpdateChildCount();
 
 
+------------------- LabelsCatalog -------------------
+
+-- Number of resources per label, so that listing the labels doesn't scan "Labels": Each
+-- connection updates the shard of its backend pid, and the shards are folded into the
+-- shard "-1" by the housekeeping (cf. "CompactLabelsCatalog").
+-- NB: The triggers are also fired by the "ON DELETE CASCADE" of the deleted resources
+DO $body$
+BEGIN
+    IF to_regclass('labelscatalog') IS NULL THEN
+        CREATE TABLE LabelsCatalog(
+            label TEXT NOT NULL,
+            shard INTEGER NOT NULL,
+            count BIGINT NOT NULL,
+            PRIMARY KEY(label, shard));
+
+        INSERT INTO LabelsCatalog SELECT label, -1, COUNT(*) FROM Labels GROUP BY label;
+    END IF;
+END $body$;
+
+CREATE OR REPLACE FUNCTION UpdateLabelsCatalog()
+RETURNS TRIGGER AS $body$
+BEGIN
+    IF TG_OP = 'INSERT' THEN
+        INSERT INTO LabelsCatalog VALUES (new.label, pg_backend_pid() % 64, 1)
+            ON CONFLICT (label, shard) DO UPDATE SET count = LabelsCatalog.count + 1;
+
+    ELSIF TG_OP = 'DELETE' THEN
+        INSERT INTO LabelsCatalog VALUES (old.label, pg_backend_pid() % 64, -1)
+            ON CONFLICT (label, shard) DO UPDATE SET count = LabelsCatalog.count - 1;
+
+    END IF;
+    RETURN NULL;
+END;
+$body$ LANGUAGE plpgsql;
+
+DROP TRIGGER IF EXISTS LabelAdded ON Labels;
+CREATE TRIGGER LabelAdded
+AFTER INSERT ON Labels
+FOR EACH ROW
+EXECUTE PROCEDURE UpdateLabelsCatalog();
+
+DROP TRIGGER IF EXISTS LabelDeleted ON Labels;
+CREATE TRIGGER LabelDeleted
+AFTER DELETE ON Labels
+FOR EACH ROW
+EXECUTE PROCEDURE UpdateLabelsCatalog();
+
+
 
 -- set the global properties that actually documents the DB version, revision and some of the capabilities
-DELETE FROM GlobalProperties WHERE property IN (1, 4, 6, 10, 11, 12, 13, 14);
+DELETE FROM GlobalProperties WHERE property IN (1, 4, 6, 10, 11, 12, 13, 14, 15, 16, 17);
 INSERT INTO GlobalProperties VALUES (1, 6); -- GlobalProperty_DatabaseSchemaVersion
 INSERT INTO GlobalProperties VALUES (4, 3); -- GlobalProperty_DatabasePatchLevel
 INSERT INTO GlobalProperties VALUES (6, 1); -- GlobalProperty_GetTotalSizeIsFast
@@ -691,3 +1024,9 @@ INSERT INTO GlobalProperties VALUES (11, 3); -- GlobalProperty_HasCreateInstance
 INSERT INTO GlobalProperties VALUES (12, 1); -- GlobalProperty_HasFastCountResources
 INSERT INTO GlobalProperties VALUES (13, 1); -- GlobalProperty_GetLastChangeIndex
 INSERT INTO GlobalProperties VALUES (14, 1); -- GlobalProperty_HasComputeStatisticsReadOnly
+INSERT INTO GlobalProperties VALUES (15, 2); -- GlobalProperty_HasSetResourcesContent  -- 2nd version also provides IngestResources()
+INSERT INTO GlobalProperties VALUES (16, 3); -- GlobalProperty_HasSerializedChangeSeq  -- 3rd version, the former "GlobalIntegersShards" table is dropped
+INSERT INTO GlobalProperties VALUES (17, 1); -- GlobalProperty_HasDeleteResources
+
+-- the progress of the online upgrades is kept if this file is executed again
+INSERT INTO GlobalProperties VALUES (18, '{}') ON CONFLICT DO NOTHING; -- GlobalProperty_OnlineUpgrades
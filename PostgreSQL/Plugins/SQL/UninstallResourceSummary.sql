@@ -0,0 +1,14 @@
+-- This SQL file removes the optional "ResourceSummary" table, its triggers and its functions
+-- (cf. "InstallResourceSummary.sql"). It must stay idempotent.
+
+DROP TRIGGER IF EXISTS MainDicomTagsInsertedSummary ON MainDicomTags;
+DROP TRIGGER IF EXISTS MainDicomTagsUpdatedSummary ON MainDicomTags;
+DROP TRIGGER IF EXISTS MainDicomTagsDeletedSummary ON MainDicomTags;
+DROP TRIGGER IF EXISTS MetadataInsertedSummary ON Metadata;
+DROP TRIGGER IF EXISTS MetadataUpdatedSummary ON Metadata;
+DROP TRIGGER IF EXISTS MetadataDeletedSummary ON Metadata;
+DROP FUNCTION IF EXISTS ResourceSummaryNewRowsFunc;
+DROP FUNCTION IF EXISTS ResourceSummaryOldRowsFunc;
+DROP FUNCTION IF EXISTS RefreshResourceSummaries;
+DROP FUNCTION IF EXISTS ComputeResourceSummary;
+DROP TABLE IF EXISTS ResourceSummary;
@@ -0,0 +1,19 @@
+-- This SQL file removes the optional "SortKeys" table, its triggers and its functions
+-- (cf. "InstallSortKeys.sql"). It must stay idempotent.
+
+DROP TRIGGER IF EXISTS MainDicomTagsInsertedSortKeys ON MainDicomTags;
+DROP TRIGGER IF EXISTS MainDicomTagsUpdatedSortKeys ON MainDicomTags;
+DROP TRIGGER IF EXISTS MainDicomTagsDeletedSortKeys ON MainDicomTags;
+DROP TRIGGER IF EXISTS DicomIdentifiersInsertedSortKeys ON DicomIdentifiers;
+DROP TRIGGER IF EXISTS DicomIdentifiersUpdatedSortKeys ON DicomIdentifiers;
+DROP TRIGGER IF EXISTS DicomIdentifiersDeletedSortKeys ON DicomIdentifiers;
+DROP TRIGGER IF EXISTS MetadataInsertedSortKeys ON Metadata;
+DROP TRIGGER IF EXISTS MetadataUpdatedSortKeys ON Metadata;
+DROP TRIGGER IF EXISTS MetadataDeletedSortKeys ON Metadata;
+DROP FUNCTION IF EXISTS SortKeysTagsNewRowsFunc;
+DROP FUNCTION IF EXISTS SortKeysTagsOldRowsFunc;
+DROP FUNCTION IF EXISTS SortKeysMetadataNewRowsFunc;
+DROP FUNCTION IF EXISTS SortKeysMetadataOldRowsFunc;
+DROP FUNCTION IF EXISTS BackfillSortKey;
+DROP TABLE IF EXISTS SortKeys;
+DROP TABLE IF EXISTS SortKeysDefinitions;
@@ -7,23 +7,9 @@
 -- before PrepareIndex.sql that is idempotent.
 
 
--- create a new ChildrenIndex2 that is replacing ChildrenIndex.
--- We create it in this partial update so it can be created while the system is up !
-DO $$
-DECLARE
-    pg_version text;
-BEGIN
-    SELECT version() INTO pg_version;
-
-    IF substring(pg_version from 'PostgreSQL (\d+)\.')::int >= 11 THEN
-        -- PostgreSQL 11 or later
-        EXECUTE 'CREATE INDEX IF NOT EXISTS ChildrenIndex2 ON Resources USING btree (parentId ASC NULLS LAST) INCLUDE (publicId, internalId)';
-    ELSE
-        EXECUTE 'CREATE INDEX IF NOT EXISTS ChildrenIndex2 ON Resources USING btree (parentId ASC NULLS LAST, publicId, internalId)';
-    END IF;
-END $$;
-
-DROP INDEX IF EXISTS ChildrenIndex;  -- replaced by ChildrenIndex2 but no need to uninstall ChildrenIndex2 when downgrading
+-- The new ChildrenIndex2 that is replacing ChildrenIndex is not created here: it is built with
+-- "CREATE INDEX CONCURRENTLY" by the housekeeping of the plugin (cf. "OnlineUpgrades"), that
+-- drops ChildrenIndex afterwards, so that the system stays up during the upgrade.
 
 -- add the childCount columns in Resources if not yet done
 
@@ -24,6 +24,7 @@
 #include "PostgreSQLStorageArea.h"
 #include "../../Framework/Plugins/PluginInitialization.h"
 
+#include <Compatibility.h>  // For std::unique_ptr<>
 #include <Logging.h>
 #include <Toolbox.h>
 
@@ -64,8 +65,61 @@ extern "C"
     try
     {
       OrthancDatabases::PostgreSQLParameters parameters(postgresql);
-      OrthancDatabases::StorageBackend::Register(
-        context, new OrthancDatabases::PostgreSQLStorageArea(parameters, false /* don't clear database */));
+
+      if (postgresql.GetBooleanValue("StorageAsynchronousCommit", false))
+      {
+        // Only the connections of the storage area are affected, not those of the index
+        LOG(WARNING) << "PostgreSQL storage area: The files are written with an asynchronous commit, "
+                     << "the last files can be lost if the PostgreSQL server crashes";
+        parameters.SetSynchronousCommit(false);
+      }
+
+      std::unique_ptr<OrthancDatabases::PostgreSQLStorageArea> storage(
+        new OrthancDatabases::PostgreSQLStorageArea(parameters, false /* don't clear database */));
+      storage->SetConnectionsCount(postgresql.GetUnsignedIntegerValue("StorageConnectionsCount", 1));
+
+      if (postgresql.GetBooleanValue("EnableStorageCompression", false))
+      {
+        storage->SetCompressed(OrthancPluginContentType_Dicom, true);
+        storage->SetCompressed(OrthancPluginContentType_DicomUntilPixelData, true);
+      }
+
+      storage->SetInlineThreshold(postgresql.GetUnsignedIntegerValue("StorageInlineThreshold", 0));
+
+      if (postgresql.GetBooleanValue("EnableDeferredRemove", false))
+      {
+        storage->SetDeferredRemove(postgresql.GetUnsignedIntegerValue("DeferredRemoveBatchSize", 100),
+                                   postgresql.GetUnsignedIntegerValue("DeferredRemoveInterval", 5));
+        storage->SetDeferredRemoveMaxRate(postgresql.GetUnsignedIntegerValue("DeferredRemoveMaxRate", 0));
+      }
+
+      storage->SetDeduplication(postgresql.GetBooleanValue("EnableStorageDeduplication", false));
+      storage->SetUsageAccounting(postgresql.GetBooleanValue("EnableStorageUsageAccounting", false));
+
+      if (!postgresql.GetStringValue("TieringDirectory", "").empty())
+      {
+        // "TieringAgeDays" set to "0" stops moving the files, that can still be read
+        storage->SetTiering(postgresql.GetStringValue("TieringDirectory", ""),
+                            postgresql.GetUnsignedIntegerValue("TieringAgeDays", 90),
+                            postgresql.GetUnsignedIntegerValue("TieringBatchSize", 100),
+                            postgresql.GetUnsignedIntegerValue("TieringInterval", 3600));
+      }
+
+      if (!postgresql.GetBooleanValue("StoreDicom", true))
+      {
+        // By default, share the directory of the default storage area of the Orthanc core
+        storage->SetDicomDirectory(postgresql.GetStringValue("DicomDirectory", configuration.GetStringValue("StorageDirectory", "OrthancStorage")));
+      }
+
+      // Expressed in MB, "0" disables the cache of the attachments
+      storage->SetAttachmentCacheSize(static_cast<uint64_t>(postgresql.GetUnsignedIntegerValue("StorageCacheSize", 0)) * 1024 * 1024);
+
+      if (storage->GetAttachmentCache().IsEnabled())
+      {
+        storage->SetPrefetchThreads(postgresql.GetUnsignedIntegerValue("StoragePrefetchThreads", 0));
+      }
+
+      OrthancDatabases::StorageBackend::Register(context, storage.release());
     }
     catch (Orthanc::OrthancException& e)
     {
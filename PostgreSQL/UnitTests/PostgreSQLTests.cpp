@@ -36,17 +36,24 @@
 #  undef S_IXOTH
 #endif
 
+#include "../../Framework/Common/Integer64Value.h"
+#include "../../Framework/Common/Utf8StringValue.h"
 #include "../../Framework/Plugins/GlobalProperties.h"
+#include "../../Framework/Plugins/StorageCompression.h"
+#include "../../Framework/PostgreSQL/PostgreSQLAsyncQueries.h"
 #include "../../Framework/PostgreSQL/PostgreSQLLargeObject.h"
 #include "../../Framework/PostgreSQL/PostgreSQLResult.h"
 #include "../../Framework/PostgreSQL/PostgreSQLTransaction.h"
+#include "../Plugins/PostgreSQLBulkLoader.h"
 #include "../Plugins/PostgreSQLIndex.h"
 #include "../Plugins/PostgreSQLStorageArea.h"
 
 #include <Compatibility.h>  // For std::unique_ptr<>
 #include <OrthancException.h>
+#include <Toolbox.h>
 
 #include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
 
 using namespace OrthancDatabases;
 
@@ -286,6 +293,201 @@ TEST(PostgreSQL, Transaction)
 }
 
 
+TEST(PostgreSQL, SessionSettings)
+{
+  PostgreSQLParameters parameters(globalParameters_);
+  ASSERT_FALSE(parameters.HasSessionSettings(SessionProfile_ReadOnly));
+  ASSERT_THROW(parameters.SetSessionSetting(SessionProfile_ReadOnly, "", "on"), Orthanc::OrthancException);
+  ASSERT_THROW(parameters.SetSessionSetting(SessionProfile_ReadOnly, "jit = off; DROP TABLE Resources", "on"),
+               Orthanc::OrthancException);
+
+  parameters.SetSessionSetting(SessionProfile_ReadOnly, "work_mem", "64MB");
+  parameters.SetSessionSetting(SessionProfile_ReadOnly, "jit", "off");
+  parameters.SetSessionSetting(SessionProfile_ReadWrite, "application_name", "it's");
+  parameters.SetSessionSetting(SessionProfile_Housekeeping, "maintenance_work_mem", "128MB");
+  ASSERT_TRUE(parameters.HasSessionSettings(SessionProfile_ReadOnly));
+
+  ASSERT_NE(std::string::npos, parameters.GetReadOnlyTransactionStatement().find(
+              "READ ONLY; SET LOCAL jit = 'off'; SET LOCAL work_mem = '64MB'"));
+  ASSERT_NE(std::string::npos, parameters.GetReadWriteTransactionStatement().find(
+              "SET LOCAL application_name = 'it''s'"));
+  ASSERT_TRUE(parameters.GetOpeningStatements().empty());
+
+  {
+    std::unique_ptr<PostgreSQLDatabase> pg(PostgreSQLDatabase::CreateDatabaseConnection(parameters));
+
+    {
+      PostgreSQLTransaction t(*pg, TransactionType_ReadOnly);
+      PostgreSQLStatement s(*pg, "SHOW work_mem");
+      PostgreSQLResult r(s);
+      ASSERT_EQ("64MB", r.GetString(0));
+    }
+
+    {
+      // "SET LOCAL" only lasts until the end of the transaction
+      PostgreSQLStatement s(*pg, "SHOW application_name");
+      PostgreSQLResult r(s);
+      ASSERT_NE("it's", r.GetString(0));
+    }
+  }
+
+  parameters.SetHousekeeping(true);
+  ASSERT_EQ("SET maintenance_work_mem = '128MB'", parameters.GetOpeningStatements());
+
+  {
+    std::unique_ptr<PostgreSQLDatabase> pg(PostgreSQLDatabase::CreateDatabaseConnection(parameters));
+    PostgreSQLStatement s(*pg, "SHOW maintenance_work_mem");
+    PostgreSQLResult r(s);
+    ASSERT_EQ("128MB", r.GetString(0));
+  }
+
+  // With transaction pooling, the housekeeping settings only last until the end of each transaction
+  parameters.SetTransactionPooling(true);
+  ASSERT_TRUE(parameters.GetOpeningStatements().empty());
+  ASSERT_NE(std::string::npos, parameters.GetReadWriteTransactionStatement().find(
+              "SET LOCAL maintenance_work_mem = '128MB'"));
+  ASSERT_NE(std::string::npos, parameters.GetReadOnlyTransactionStatement().find(
+              "SET LOCAL maintenance_work_mem = '128MB'"));
+
+  {
+    std::unique_ptr<PostgreSQLDatabase> pg(PostgreSQLDatabase::CreateDatabaseConnection(parameters));
+
+    {
+      PostgreSQLTransaction t(*pg, TransactionType_ReadWrite);
+      PostgreSQLStatement s(*pg, "SHOW maintenance_work_mem");
+      PostgreSQLResult r(s);
+      ASSERT_EQ("128MB", r.GetString(0));
+    }
+
+    {
+      PostgreSQLStatement s(*pg, "SHOW maintenance_work_mem");
+      PostgreSQLResult r(s);
+      ASSERT_NE("128MB", r.GetString(0));
+    }
+  }
+
+  parameters.SetHousekeeping(false);
+  ASSERT_EQ(std::string::npos, parameters.GetReadWriteTransactionStatement().find("maintenance_work_mem"));
+}
+
+
+TEST(PostgreSQL, DeferredBegin)
+{
+  std::unique_ptr<PostgreSQLDatabase> pg(CreateTestDatabase());
+
+  pg->ExecuteMultiLines("CREATE TABLE Test(value INTEGER)");
+
+  {
+    // Without statements, neither "BEGIN" nor "COMMIT" are sent
+    PostgreSQLTransaction t(*pg, TransactionType_ReadWrite);
+    t.Commit();
+    ASSERT_THROW(t.Commit(), Orthanc::OrthancException);
+  }
+
+  {
+    PostgreSQLTransaction t(*pg, TransactionType_ReadWrite);
+    t.Rollback();
+  }
+
+  {
+    PostgreSQLTransaction t(*pg, TransactionType_ReadOnly);
+    // Dismissed
+  }
+
+  {
+    // "BEGIN" is sent together with these commands
+    PostgreSQLTransaction t(*pg, TransactionType_ReadWrite);
+    pg->ExecuteMultiLines("INSERT INTO Test VALUES(1); INSERT INTO Test VALUES(2)");
+    // No commit
+  }
+
+  {
+    PostgreSQLStatement u(*pg, "SELECT COUNT(*) FROM Test");
+    PostgreSQLResult r(u);
+    ASSERT_EQ(0, r.GetInteger64(0));
+  }
+
+  {
+    PostgreSQLTransaction t(*pg, TransactionType_ReadWrite);
+    pg->ExecuteMultiLines("INSERT INTO Test VALUES(1)");
+    t.Commit();
+  }
+
+  {
+    // The next transaction is not affected by the previous ones
+    PostgreSQLTransaction t(*pg, TransactionType_ReadOnly);
+    PostgreSQLStatement u(*pg, "SELECT COUNT(*) FROM Test");
+    PostgreSQLResult r(u);
+    ASSERT_EQ(1, r.GetInteger64(0));
+  }
+}
+
+
+
+TEST(PostgreSQL, Streaming)
+{
+  std::unique_ptr<PostgreSQLDatabase> pg(CreateTestDatabase());
+
+  pg->ExecuteMultiLines("CREATE TABLE Test(name INTEGER, value INTEGER)");
+
+  {
+    PostgreSQLStatement s(*pg, "INSERT INTO Test SELECT i, 2 * i FROM generate_series(1, 2500) AS i");
+    s.SetStreaming(true);
+
+    PostgreSQLResult r(s);
+    ASSERT_TRUE(r.IsDone());
+    ASSERT_EQ(0u, r.GetColumnsCount());
+  }
+
+  {
+    PostgreSQLTransaction t(*pg, TransactionType_ReadOnly);
+
+    PostgreSQLStatement s(*pg, "SELECT name, value FROM Test WHERE name >= $1 ORDER BY name");
+    s.DeclareInputInteger(0);
+    s.SetStreaming(true);
+
+    {
+      s.BindInteger(0, 1);
+      PostgreSQLResult r(s);
+      ASSERT_EQ(2u, r.GetColumnsCount());
+
+      int count = 0;
+      while (!r.IsDone())
+      {
+        count++;
+        ASSERT_EQ(count, r.GetInteger(0));
+        ASSERT_EQ(2 * count, r.GetInteger(1));
+        r.Next();
+      }
+
+      ASSERT_EQ(2500, count);
+    }
+
+    {
+      // Stop reading before the end: the remaining rows are discarded
+      s.BindInteger(0, 2000);
+      PostgreSQLResult r(s);
+      ASSERT_FALSE(r.IsDone());
+      ASSERT_EQ(2000, r.GetInteger(0));
+    }
+
+    {
+      s.BindInteger(0, 3000);
+      PostgreSQLResult r(s);
+      ASSERT_TRUE(r.IsDone());
+    }
+
+    {
+      // The connection is usable again
+      PostgreSQLStatement u(*pg, "SELECT COUNT(*) FROM Test");
+      PostgreSQLResult r(u);
+      ASSERT_EQ(2500, r.GetInteger64(0));
+    }
+
+    t.Commit();
+  }
+}
+
 
 
 
@@ -367,6 +569,60 @@ TEST(PostgreSQL, LargeObject)
 }
 
 
+TEST(PostgreSQL, LargeObjectWriter)
+{
+  std::unique_ptr<PostgreSQLDatabase> pg(CreateTestDatabase());
+  ASSERT_EQ(0, CountLargeObjects(*pg));
+
+  pg->ExecuteMultiLines("CREATE TABLE Test(name VARCHAR, value OID)");
+
+  std::string oid;
+
+  {
+    PostgreSQLTransaction t(*pg, TransactionType_ReadWrite);
+
+    std::unique_ptr<PostgreSQLLargeObject> obj;
+
+    {
+      PostgreSQLLargeObject::Writer writer(*pg);
+      writer.Append("Hello", 5);
+      writer.Append(NULL, 0);
+      writer.Append(", ", 2);
+      writer.Append("world", 5);
+      ASSERT_EQ(12u, writer.GetSize());
+
+      obj.reset(new PostgreSQLLargeObject(writer));
+      ASSERT_EQ(writer.GetOid(), obj->GetOid());
+    }
+
+    PostgreSQLStatement s(*pg, "INSERT INTO Test VALUES ($1,$2)");
+    s.DeclareInputString(0);
+    s.DeclareInputLargeObject(1);
+    s.BindString(0, "a");
+    s.BindLargeObject(1, *obj);
+    s.Run();
+
+    oid = obj->GetOid();
+    t.Commit();
+  }
+
+  ASSERT_EQ(1, CountLargeObjects(*pg));
+
+  {
+    PostgreSQLTransaction t(*pg, TransactionType_ReadOnly);
+
+    std::string s;
+    PostgreSQLLargeObject::ReadWhole(s, *pg, oid);
+    ASSERT_EQ("Hello, world", s);
+
+    PostgreSQLLargeObject::ReadRange(s, *pg, oid, 7, 5);
+    ASSERT_EQ("world", s);
+
+    ASSERT_THROW(PostgreSQLLargeObject::ReadRange(s, *pg, oid, 8, 5), Orthanc::OrthancException);
+  }
+}
+
+
 TEST(PostgreSQL, StorageArea)
 {
   std::unique_ptr<PostgreSQLDatabase> database(PostgreSQLDatabase::CreateDatabaseConnection(globalParameters_));
@@ -421,123 +677,979 @@ TEST(PostgreSQL, StorageArea)
 }
 
 
-TEST(PostgreSQL, StorageReadRange)
+TEST(PostgreSQL, StorageAreaSingleStatement)
 {
-  std::unique_ptr<OrthancDatabases::PostgreSQLDatabase> database(
-    OrthancDatabases::PostgreSQLDatabase::CreateDatabaseConnection(globalParameters_));
-  
-  OrthancDatabases::PostgreSQLStorageArea storageArea(globalParameters_, true /* clear database */);
+  std::unique_ptr<PostgreSQLDatabase> database(PostgreSQLDatabase::CreateDatabaseConnection(globalParameters_));
+
+  PostgreSQLStorageArea storageArea(globalParameters_, true /* clear database */);
 
   {
     std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor(storageArea.CreateAccessor());
+
+    // Below and above the size of the files that are written by a single "INSERT"
+    std::string small(1024 * 1024, '\0');
+    std::string large(17 * 1024 * 1024, '\0');
+
+    for (size_t i = 0; i < small.size(); i++)
+    {
+      small[i] = static_cast<char>(i % 251);
+    }
+
+    for (size_t i = 0; i < large.size(); i++)
+    {
+      large[i] = static_cast<char>(i % 253);
+    }
+
+    accessor->Create("small", small.c_str(), small.size(), OrthancPluginContentType_Unknown);
+    accessor->Create("large", large.c_str(), large.size(), OrthancPluginContentType_Unknown);
+    ASSERT_EQ(2, CountLargeObjects(*database));
+
+    std::string buffer;
+    OrthancDatabases::StorageBackend::ReadWholeToString(buffer, *accessor, "small", OrthancPluginContentType_Unknown);
+    ASSERT_TRUE(buffer == small);
+    OrthancDatabases::StorageBackend::ReadWholeToString(buffer, *accessor, "large", OrthancPluginContentType_Unknown);
+    ASSERT_TRUE(buffer == large);
+
+    accessor->Remove("small", OrthancPluginContentType_Unknown);
+    accessor->Remove("large", OrthancPluginContentType_Unknown);
     ASSERT_EQ(0, CountLargeObjects(*database));
-    accessor->Create("uuid", "abcd\0\1\2\3\4\5", 10, OrthancPluginContentType_Unknown);
-    ASSERT_EQ(1u, CountLargeObjects(*database));
   }
+}
 
-  {
-    std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor(storageArea.CreateAccessor());
-    ASSERT_EQ(1u, CountLargeObjects(*database));
 
-    std::string s;
-    OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor, "uuid", OrthancPluginContentType_Unknown);
-    ASSERT_EQ(10u, s.size());
-    ASSERT_EQ('a', s[0]);
-    ASSERT_EQ('d', s[3]);
-    ASSERT_EQ('\0', s[4]);
-    ASSERT_EQ('\5', s[9]);
+TEST(PostgreSQL, StorageAreaInline)
+{
+  std::unique_ptr<PostgreSQLDatabase> database(PostgreSQLDatabase::CreateDatabaseConnection(globalParameters_));
 
-    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "uuid", OrthancPluginContentType_Unknown, 0, 0);
-    ASSERT_TRUE(s.empty());
+  PostgreSQLStorageArea storageArea(globalParameters_, true /* clear database */);
+  ASSERT_EQ(0u, storageArea.GetInlineThreshold());
+  storageArea.SetInlineThreshold(16);
+  ASSERT_EQ(16u, storageArea.GetInlineThreshold());
 
-    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "uuid", OrthancPluginContentType_Unknown, 0, 1);
-    ASSERT_EQ(1u, s.size());
-    ASSERT_EQ('a', s[0]);
+  const std::string small("he\0llo", 6);  // With a null byte
 
-    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "uuid", OrthancPluginContentType_Unknown, 4, 1);
-    ASSERT_EQ(1u, s.size());
-    ASSERT_EQ('\0', s[0]);
+  std::string large(100, 'a');
+  large[50] = '\0';  // NB: The large objects are not affected by the threshold
 
-    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "uuid", OrthancPluginContentType_Unknown, 9, 1);
-    ASSERT_EQ(1u, s.size());
-    ASSERT_EQ('\5', s[0]);
+  {
+    std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor(storageArea.CreateAccessor());
+    accessor->Create("small", small.c_str(), small.size(), OrthancPluginContentType_Unknown);
+    accessor->Create("large", large.c_str(), large.size(), OrthancPluginContentType_Unknown);
+    accessor->Create("empty", NULL, 0, OrthancPluginContentType_Unknown);
 
-    // Cannot read non-empty range after the end of the string. NB:
-    // The behavior on range (10, 0) is different than in MySQL!
-    ASSERT_THROW(OrthancDatabases::StorageBackend::ReadRangeToString(
-                   s, *accessor, "uuid", OrthancPluginContentType_Unknown, 10, 0), Orthanc::OrthancException);
+    // Only the large file and the empty file are stored as large objects
+    ASSERT_EQ(2, CountLargeObjects(*database));
 
+    std::string s;
+    OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor, "small", OrthancPluginContentType_Unknown);
+    ASSERT_EQ(small, s);
+    OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor, "large", OrthancPluginContentType_Unknown);
+    ASSERT_EQ(large, s);
+    OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor, "empty", OrthancPluginContentType_Unknown);
+    ASSERT_TRUE(s.empty());
+
+    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "small", OrthancPluginContentType_Unknown, 1, 3);
+    ASSERT_EQ(small.substr(1, 3), s);
+    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "small", OrthancPluginContentType_Unknown, 1, 5, 2);
+    ASSERT_EQ(small.substr(1, 5), s);
     ASSERT_THROW(OrthancDatabases::StorageBackend::ReadRangeToString(
-                   s, *accessor, "uuid", OrthancPluginContentType_Unknown, 10, 1), Orthanc::OrthancException);
+                   s, *accessor, "small", OrthancPluginContentType_Unknown, 4, 3), Orthanc::OrthancException);
+    ASSERT_THROW(OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor, "nope", OrthancPluginContentType_Unknown),
+                 Orthanc::OrthancException);
+  }
 
-    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "uuid", OrthancPluginContentType_Unknown, 0, 4);
-    ASSERT_EQ(4u, s.size());
-    ASSERT_EQ('a', s[0]);
-    ASSERT_EQ('b', s[1]);
-    ASSERT_EQ('c', s[2]);
-    ASSERT_EQ('d', s[3]);
+  {
+    // The inline files can still be read once the mode is disabled
+    storageArea.SetInlineThreshold(0);
 
-    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "uuid", OrthancPluginContentType_Unknown, 4, 6);
-    ASSERT_EQ(6u, s.size());
-    ASSERT_EQ('\0', s[0]);
-    ASSERT_EQ('\1', s[1]);
-    ASSERT_EQ('\2', s[2]);
-    ASSERT_EQ('\3', s[3]);
-    ASSERT_EQ('\4', s[4]);
-    ASSERT_EQ('\5', s[5]);
+    std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor(storageArea.CreateAccessor());
 
-    ASSERT_THROW(OrthancDatabases::StorageBackend::ReadRangeToString(
-                   s, *accessor, "uuid", OrthancPluginContentType_Unknown, 4, 7), Orthanc::OrthancException);
+    std::string s;
+    OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor, "small", OrthancPluginContentType_Unknown);
+    ASSERT_EQ(small, s);
+
+    accessor->Remove("small", OrthancPluginContentType_Unknown);
+    accessor->Remove("large", OrthancPluginContentType_Unknown);
+    accessor->Remove("empty", OrthancPluginContentType_Unknown);
+
+    ASSERT_THROW(OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor, "small", OrthancPluginContentType_Unknown),
+                 Orthanc::OrthancException);
+    ASSERT_EQ(0, CountLargeObjects(*database));
   }
 }
 
 
-TEST(PostgreSQL, ImplicitTransaction)
+TEST(PostgreSQL, StorageAreaUsage)
 {
-  std::unique_ptr<PostgreSQLDatabase> db(CreateTestDatabase());
-
-  ASSERT_FALSE(db->DoesTableExist("test"));
-  ASSERT_FALSE(db->DoesTableExist("test2"));
+  PostgreSQLStorageArea storageArea(globalParameters_, true /* clear database */);
+  storageArea.SetConnectionsCount(2);
 
-  {
-    std::unique_ptr<OrthancDatabases::ITransaction> t(db->CreateTransaction(TransactionType_ReadWrite));
-    ASSERT_FALSE(t->IsImplicit());
-  }
+  std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor(storageArea.CreateAccessor());
+  accessor->Create("before", "hello", 5, OrthancPluginContentType_Dicom);
 
-  {
-    Query query("CREATE TABLE test(id INT)", false);
-    std::unique_ptr<IPrecompiledStatement> s(db->Compile(query));
-    
-    std::unique_ptr<ITransaction> t(db->CreateTransaction(TransactionType_Implicit));
-    ASSERT_TRUE(t->IsImplicit());
-    ASSERT_THROW(t->Commit(), Orthanc::OrthancException);
-    ASSERT_THROW(t->Rollback(), Orthanc::OrthancException);
+  ASSERT_FALSE(storageArea.IsUsageAccounting());
+  storageArea.SetUsageAccounting(true);
+  ASSERT_TRUE(storageArea.IsUsageAccounting());
 
-    Dictionary args;
-    t->ExecuteWithoutResult(*s, args);
-    ASSERT_THROW(t->Rollback(), Orthanc::OrthancException);
-    t->Commit();
+  OrthancDatabases::StorageBackend::Usage usage;
+  storageArea.ReadUsage(usage);
+  ASSERT_TRUE(usage.empty());
 
-    ASSERT_THROW(t->Commit(), Orthanc::OrthancException);
-  }
+  accessor->Create("a", "hello", 5, OrthancPluginContentType_Dicom);
 
   {
-    // An implicit transaction does not need to be explicitely committed
-    Query query("CREATE TABLE test2(id INT)", false);
-    std::unique_ptr<IPrecompiledStatement> s(db->Compile(query));
-    
-    std::unique_ptr<ITransaction> t(db->CreateTransaction(TransactionType_Implicit));
-
-    Dictionary args;
-    t->ExecuteWithoutResult(*s, args);
+    // Another connection of the pool writes into another shard
+    std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor2(storageArea.CreateAccessor());
+    accessor2->Create("b", "world!", 6, OrthancPluginContentType_Dicom);
+    accessor2->Create("c", "{}", 2, OrthancPluginContentType_DicomAsJson);
   }
 
-  ASSERT_TRUE(db->DoesTableExist("test"));
-  ASSERT_TRUE(db->DoesTableExist("test2"));
+  storageArea.ReadUsage(usage);
+  ASSERT_EQ(2u, usage.size());
+  ASSERT_EQ(2u, usage[OrthancPluginContentType_Dicom].first);
+  ASSERT_EQ(11u, usage[OrthancPluginContentType_Dicom].second);
+  ASSERT_EQ(1u, usage[OrthancPluginContentType_DicomAsJson].first);
+  ASSERT_EQ(2u, usage[OrthancPluginContentType_DicomAsJson].second);
+
+  // The files that were written before the accounting are ignored
+  accessor->Remove("before", OrthancPluginContentType_Dicom);
+  accessor->Remove("b", OrthancPluginContentType_Dicom);
+  accessor->Remove("c", OrthancPluginContentType_DicomAsJson);
+
+  storageArea.ReadUsage(usage);
+  ASSERT_EQ(1u, usage[OrthancPluginContentType_Dicom].first);
+  ASSERT_EQ(5u, usage[OrthancPluginContentType_Dicom].second);
+  ASSERT_EQ(0u, usage[OrthancPluginContentType_DicomAsJson].first);
+  ASSERT_EQ(0u, usage[OrthancPluginContentType_DicomAsJson].second);
+
+  accessor->Remove("a", OrthancPluginContentType_Dicom);
 }
 
 
-#if ORTHANC_PLUGINS_HAS_DATABASE_CONSTRAINT == 1
+TEST(PostgreSQL, StorageAreaPrefetch)
+{
+  PostgreSQLStorageArea storageArea(globalParameters_, true /* clear database */);
+
+  // The prefetching requires the cache
+  ASSERT_THROW(storageArea.SetPrefetchThreads(1), Orthanc::OrthancException);
+  storageArea.SetAttachmentCacheSize(1024);
+  storageArea.SetPrefetchThreads(1);
+  ASSERT_TRUE(storageArea.HasPrefetch());
+
+  {
+    std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor(storageArea.CreateAccessor());
+    accessor->Create("a", "hello", 5, OrthancPluginContentType_Dicom);
+  }
+
+  storageArea.Prefetch("a", OrthancPluginContentType_Dicom);
+  storageArea.Prefetch("nope", OrthancPluginContentType_Dicom);  // Ignored
+
+  OrthancDatabases::AttachmentCache::Content content;
+  for (unsigned int i = 0; i < 100 && !storageArea.GetAttachmentCache().Lookup(content, "a", OrthancPluginContentType_Dicom); i++)
+  {
+    boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+  }
+
+  ASSERT_TRUE(storageArea.GetAttachmentCache().Lookup(content, "a", OrthancPluginContentType_Dicom));
+  ASSERT_EQ("hello", *content);
+  ASSERT_FALSE(storageArea.GetAttachmentCache().Lookup(content, "nope", OrthancPluginContentType_Dicom));
+}
+
+
+TEST(PostgreSQL, StorageAreaDeduplication)
+{
+  std::unique_ptr<PostgreSQLDatabase> database(PostgreSQLDatabase::CreateDatabaseConnection(globalParameters_));
+
+  PostgreSQLStorageArea storageArea(globalParameters_, true /* clear database */);
+  ASSERT_FALSE(storageArea.IsDeduplication());
+  storageArea.SetDeduplication(true);
+  ASSERT_TRUE(storageArea.IsDeduplication());
+
+  const std::string content(100, 'a');
+  const std::string other(100, 'b');
+
+  std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor(storageArea.CreateAccessor());
+  accessor->Create("first", content.c_str(), content.size(), OrthancPluginContentType_Dicom);
+  accessor->Create("second", content.c_str(), content.size(), OrthancPluginContentType_Dicom);
+  accessor->Create("third", content.c_str(), content.size(), OrthancPluginContentType_DicomAsJson);
+  accessor->Create("other", other.c_str(), other.size(), OrthancPluginContentType_Dicom);
+
+  // The duplicates are only stored once
+  ASSERT_EQ(2, CountLargeObjects(*database));
+
+  std::string s;
+  OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor, "second", OrthancPluginContentType_Dicom);
+  ASSERT_EQ(content, s);
+  OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "third", OrthancPluginContentType_DicomAsJson, 10, 5);
+  ASSERT_EQ(content.substr(10, 5), s);
+  ASSERT_THROW(OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor, "third", OrthancPluginContentType_Dicom),
+               Orthanc::OrthancException);
+
+  // The duplicates would be unreadable without the deduplication
+  ASSERT_THROW(storageArea.SetDeduplication(false), Orthanc::OrthancException);
+  ASSERT_TRUE(storageArea.IsDeduplication());
+
+  // The content survives the removal of the file that has stored it
+  accessor->Remove("first", OrthancPluginContentType_Dicom);
+  ASSERT_EQ(2, CountLargeObjects(*database));
+  ASSERT_THROW(OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor, "first", OrthancPluginContentType_Dicom),
+               Orthanc::OrthancException);
+  ASSERT_THROW(OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "first", OrthancPluginContentType_Dicom, 10, 5),
+               Orthanc::OrthancException);
+  OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor, "third", OrthancPluginContentType_DicomAsJson);
+  ASSERT_EQ(content, s);
+
+  // Removing the owner again doesn't release the content of the duplicates
+  accessor->Remove("first", OrthancPluginContentType_Dicom);
+  ASSERT_EQ(2, CountLargeObjects(*database));
+
+  accessor->Remove("second", OrthancPluginContentType_Dicom);
+  ASSERT_EQ(2, CountLargeObjects(*database));
+
+  accessor->Remove("third", OrthancPluginContentType_DicomAsJson);
+  ASSERT_EQ(1, CountLargeObjects(*database));
+
+  // New writes of a removed content are stored again
+  accessor->Create("fourth", content.c_str(), content.size(), OrthancPluginContentType_Dicom);
+  ASSERT_EQ(2, CountLargeObjects(*database));
+  OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor, "fourth", OrthancPluginContentType_Dicom);
+  ASSERT_EQ(content, s);
+
+  accessor->Remove("fourth", OrthancPluginContentType_Dicom);
+  accessor->Remove("other", OrthancPluginContentType_Dicom);
+  ASSERT_EQ(0, CountLargeObjects(*database));
+
+  // No file is shared anymore
+  accessor.reset();
+  storageArea.SetDeduplication(false);
+  ASSERT_FALSE(storageArea.IsDeduplication());
+}
+
+
+TEST(PostgreSQL, StorageAreaConnectionsPool)
+{
+  OrthancDatabases::PostgreSQLStorageArea storageArea(globalParameters_, true /* clear database */);
+  ASSERT_EQ(1u, storageArea.GetConnectionsCount());
+
+  ASSERT_THROW(storageArea.SetConnectionsCount(0), Orthanc::OrthancException);
+  storageArea.SetConnectionsCount(3);
+  ASSERT_EQ(3u, storageArea.GetConnectionsCount());
+  storageArea.SetConnectionsCount(2);  // The pool can shrink at runtime
+  ASSERT_EQ(2u, storageArea.GetConnectionsCount());
+
+  {
+    // Two accessors can be used at the same time, on distinct connections
+    std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor1(storageArea.CreateAccessor());
+    std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor2(storageArea.CreateAccessor());
+
+    accessor1->Create("a", "hello", 5, OrthancPluginContentType_Unknown);
+    accessor2->Create("b", "world", 5, OrthancPluginContentType_Unknown);
+
+    std::string s;
+    OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor2, "a", OrthancPluginContentType_Unknown);
+    ASSERT_EQ("hello", s);
+    OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor1, "b", OrthancPluginContentType_Unknown);
+    ASSERT_EQ("world", s);
+
+    accessor1->Remove("a", OrthancPluginContentType_Unknown);
+    accessor2->Remove("b", OrthancPluginContentType_Unknown);
+
+    // The connections that are in use are closed once given back
+    storageArea.SetConnectionsCount(1);
+    ASSERT_EQ(1u, storageArea.GetConnectionsCount());
+    accessor1->Create("c", "hello", 5, OrthancPluginContentType_Unknown);
+    accessor2->Remove("c", OrthancPluginContentType_Unknown);
+  }
+
+  {
+    std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor(storageArea.CreateAccessor());
+    accessor->Create("d", "world", 5, OrthancPluginContentType_Unknown);
+    accessor->Remove("d", OrthancPluginContentType_Unknown);
+  }
+
+  storageArea.SetConnectionsCount(2);
+  ASSERT_EQ(2u, storageArea.GetConnectionsCount());
+}
+
+
+TEST(PostgreSQL, StorageAreaCompression)
+{
+  OrthancDatabases::PostgreSQLStorageArea storageArea(globalParameters_, true /* clear database */);
+  storageArea.SetCompressed(OrthancPluginContentType_Dicom, true);
+  ASSERT_TRUE(storageArea.HasCompression());
+  ASSERT_TRUE(storageArea.IsCompressed(OrthancPluginContentType_Dicom));
+  ASSERT_FALSE(storageArea.IsCompressed(OrthancPluginContentType_DicomAsJson));
+
+  std::string raw(100000, 'a');
+  raw[10] = 'b';
+
+  std::string compressed;
+  ASSERT_TRUE(OrthancDatabases::StorageCompression::Compress(compressed, raw.c_str(), raw.size()));
+  ASSERT_TRUE(OrthancDatabases::StorageCompression::HasSignature(compressed.c_str(), compressed.size()));
+  ASSERT_FALSE(OrthancDatabases::StorageCompression::HasSignature(raw.c_str(), raw.size()));
+  ASSERT_LT(compressed.size(), raw.size());
+
+  std::string s;
+  OrthancDatabases::StorageCompression::Uncompress(s, compressed.c_str(), compressed.size());
+  ASSERT_EQ(raw, s);
+
+  ASSERT_FALSE(OrthancDatabases::StorageCompression::Compress(compressed, "abc", 3));
+
+  {
+    std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor(storageArea.CreateAccessor());
+    accessor->Create("dicom", raw.c_str(), raw.size(), OrthancPluginContentType_Dicom);
+    accessor->Create("json", raw.c_str(), raw.size(), OrthancPluginContentType_DicomAsJson);
+
+    // A file that was not compressed, but that starts with the signature
+    accessor->Create("signature", compressed.c_str(), compressed.size(), OrthancPluginContentType_DicomAsJson);
+
+    OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor, "dicom", OrthancPluginContentType_Dicom);
+    ASSERT_EQ(raw, s);
+    OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor, "json", OrthancPluginContentType_DicomAsJson);
+    ASSERT_EQ(raw, s);
+    OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor, "signature", OrthancPluginContentType_DicomAsJson);
+    ASSERT_EQ(compressed, s);
+    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "signature", OrthancPluginContentType_DicomAsJson, 1, 3);
+    ASSERT_EQ("OZL", s);
+
+    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "dicom", OrthancPluginContentType_Dicom, 9, 3);
+    ASSERT_EQ("aba", s);
+    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "dicom", OrthancPluginContentType_Dicom, 9, 3, 2);
+    ASSERT_EQ("aba", s);
+  }
+
+  {
+    // Files that were stored with compression can be read after compression is disabled
+    storageArea.SetCompressed(OrthancPluginContentType_Dicom, false);
+    ASSERT_FALSE(storageArea.HasCompression());
+
+    std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor(storageArea.CreateAccessor());
+    OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor, "dicom", OrthancPluginContentType_Dicom);
+    ASSERT_EQ(raw, s);
+    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "dicom", OrthancPluginContentType_Dicom, 9, 3);
+    ASSERT_EQ("aba", s);
+
+    accessor->Remove("dicom", OrthancPluginContentType_Dicom);
+    accessor->Remove("json", OrthancPluginContentType_DicomAsJson);
+    accessor->Remove("signature", OrthancPluginContentType_DicomAsJson);
+  }
+
+  {
+    // Files starting with the signature are returned as such by a
+    // storage area that has never compressed a file
+    OrthancDatabases::PostgreSQLStorageArea other(globalParameters_, true /* clear database */);
+
+    std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor(other.CreateAccessor());
+    accessor->Create("signature", compressed.c_str(), compressed.size(), OrthancPluginContentType_Dicom);
+    OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor, "signature", OrthancPluginContentType_Dicom);
+    ASSERT_EQ(compressed, s);
+    accessor->Remove("signature", OrthancPluginContentType_Dicom);
+  }
+}
+
+
+TEST(PostgreSQL, StorageAreaDeferredRemove)
+{
+  std::unique_ptr<OrthancDatabases::PostgreSQLDatabase> database(
+    OrthancDatabases::PostgreSQLDatabase::CreateDatabaseConnection(globalParameters_));
+
+  OrthancDatabases::PostgreSQLStorageArea storageArea(globalParameters_, true /* clear database */);
+  ASSERT_FALSE(storageArea.IsDeferredRemove());
+  ASSERT_THROW(storageArea.SetDeferredRemove(0, 3600), Orthanc::OrthancException);
+
+  // Large interval, so that the queue is only drained by this test
+  storageArea.SetDeferredRemove(2, 3600);
+  ASSERT_TRUE(storageArea.IsDeferredRemove());
+  ASSERT_THROW(storageArea.SetDeferredRemove(2, 3600), Orthanc::OrthancException);
+
+  {
+    std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor(storageArea.CreateAccessor());
+
+    for (int i = 0; i < 3; i++)
+    {
+      accessor->Create(boost::lexical_cast<std::string>(i), "hello", 5, OrthancPluginContentType_Unknown);
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+      accessor->Remove(boost::lexical_cast<std::string>(i), OrthancPluginContentType_Unknown);
+    }
+
+    // The files are only queued
+    ASSERT_EQ(3, CountLargeObjects(*database));
+  }
+
+  ASSERT_EQ(2u, storageArea.DrainPendingDeletes(2));
+  ASSERT_EQ(1, CountLargeObjects(*database));
+  ASSERT_EQ(1u, storageArea.DrainPendingDeletes(2));
+  ASSERT_EQ(0, CountLargeObjects(*database));
+  ASSERT_EQ(0u, storageArea.DrainPendingDeletes(2));
+
+  {
+    std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor(storageArea.CreateAccessor());
+
+    std::string s;
+    ASSERT_THROW(OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor, "1", OrthancPluginContentType_Unknown),
+                 Orthanc::OrthancException);
+  }
+}
+
+
+TEST(PostgreSQL, StorageAreaTiering)
+{
+  std::unique_ptr<OrthancDatabases::PostgreSQLDatabase> database(
+    OrthancDatabases::PostgreSQLDatabase::CreateDatabaseConnection(globalParameters_));
+
+  OrthancDatabases::PostgreSQLStorageArea storageArea(globalParameters_, true /* clear database */);
+  ASSERT_FALSE(storageArea.IsTiering());
+
+  const boost::filesystem::path root = boost::filesystem::temp_directory_path() / Orthanc::Toolbox::GenerateUuid();
+  const std::string old = Orthanc::Toolbox::GenerateUuid();
+  const std::string recent = Orthanc::Toolbox::GenerateUuid();
+
+  {
+    // Written before the tiering is enabled
+    std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor(storageArea.CreateAccessor());
+    accessor->Create(old, "hello", 5, OrthancPluginContentType_Unknown);
+  }
+
+  // Large interval, so that the files are only moved by this test
+  storageArea.SetTiering(root.string(), 10, 2, 3600);
+  ASSERT_TRUE(storageArea.IsTiering());
+  ASSERT_THROW(storageArea.SetTiering(root.string(), 10, 2, 3600), Orthanc::OrthancException);
+
+  {
+    std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor(storageArea.CreateAccessor());
+    accessor->Create(recent, "world", 5, OrthancPluginContentType_Unknown);
+    ASSERT_EQ(2, CountLargeObjects(*database));
+  }
+
+  const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+  ASSERT_EQ(0u, storageArea.MoveToTier(10, now));
+  ASSERT_EQ(2u, storageArea.MoveToTier(10, now + boost::posix_time::hours(24 * 11)));
+  ASSERT_EQ(0, CountLargeObjects(*database));
+  ASSERT_EQ(0u, storageArea.MoveToTier(10, now + boost::posix_time::hours(24 * 11)));
+
+  {
+    std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor(storageArea.CreateAccessor());
+    ASSERT_TRUE(accessor->LookupTier(old, OrthancPluginContentType_Unknown) != NULL);
+
+    std::string s;
+    OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor, old, OrthancPluginContentType_Unknown);
+    ASSERT_EQ("hello", s);
+    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, recent, OrthancPluginContentType_Unknown, 1, 3);
+    ASSERT_EQ("orl", s);
+
+    accessor->Remove(old, OrthancPluginContentType_Unknown);
+    ASSERT_TRUE(accessor->LookupTier(old, OrthancPluginContentType_Unknown) == NULL);
+    ASSERT_THROW(OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor, old, OrthancPluginContentType_Unknown),
+                 Orthanc::OrthancException);
+  }
+
+  boost::filesystem::remove_all(root);
+}
+
+
+TEST(PostgreSQL, StorageReadRange)
+{
+  std::unique_ptr<OrthancDatabases::PostgreSQLDatabase> database(
+    OrthancDatabases::PostgreSQLDatabase::CreateDatabaseConnection(globalParameters_));
+  
+  OrthancDatabases::PostgreSQLStorageArea storageArea(globalParameters_, true /* clear database */);
+
+  {
+    std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor(storageArea.CreateAccessor());
+    ASSERT_EQ(0, CountLargeObjects(*database));
+    accessor->Create("uuid", "abcd\0\1\2\3\4\5", 10, OrthancPluginContentType_Unknown);
+    ASSERT_EQ(1u, CountLargeObjects(*database));
+  }
+
+  {
+    std::unique_ptr<OrthancDatabases::StorageBackend::IAccessor> accessor(storageArea.CreateAccessor());
+    ASSERT_EQ(1u, CountLargeObjects(*database));
+
+    std::string s;
+    OrthancDatabases::StorageBackend::ReadWholeToString(s, *accessor, "uuid", OrthancPluginContentType_Unknown);
+    ASSERT_EQ(10u, s.size());
+    ASSERT_EQ('a', s[0]);
+    ASSERT_EQ('d', s[3]);
+    ASSERT_EQ('\0', s[4]);
+    ASSERT_EQ('\5', s[9]);
+
+    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "uuid", OrthancPluginContentType_Unknown, 0, 0);
+    ASSERT_TRUE(s.empty());
+
+    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "uuid", OrthancPluginContentType_Unknown, 0, 1);
+    ASSERT_EQ(1u, s.size());
+    ASSERT_EQ('a', s[0]);
+
+    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "uuid", OrthancPluginContentType_Unknown, 4, 1);
+    ASSERT_EQ(1u, s.size());
+    ASSERT_EQ('\0', s[0]);
+
+    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "uuid", OrthancPluginContentType_Unknown, 9, 1);
+    ASSERT_EQ(1u, s.size());
+    ASSERT_EQ('\5', s[0]);
+
+    // Streamed reads, by chunks of 3 bytes
+    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "uuid", OrthancPluginContentType_Unknown, 0, 10, 3);
+    ASSERT_EQ(10u, s.size());
+    ASSERT_EQ('a', s[0]);
+    ASSERT_EQ('\5', s[9]);
+
+    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "uuid", OrthancPluginContentType_Unknown, 2, 5, 3);
+    ASSERT_EQ(5u, s.size());
+    ASSERT_EQ('c', s[0]);
+    ASSERT_EQ('\2', s[4]);
+
+    ASSERT_THROW(OrthancDatabases::StorageBackend::ReadRangeToString(
+                   s, *accessor, "uuid", OrthancPluginContentType_Unknown, 8, 3, 3), Orthanc::OrthancException);
+    ASSERT_THROW(OrthancDatabases::StorageBackend::ReadRangeToString(
+                   s, *accessor, "uuid", OrthancPluginContentType_Unknown, 0, 3, 0), Orthanc::OrthancException);
+
+    // Cannot read non-empty range after the end of the string. NB:
+    // The behavior on range (10, 0) is different than in MySQL!
+    ASSERT_THROW(OrthancDatabases::StorageBackend::ReadRangeToString(
+                   s, *accessor, "uuid", OrthancPluginContentType_Unknown, 10, 0), Orthanc::OrthancException);
+
+    ASSERT_THROW(OrthancDatabases::StorageBackend::ReadRangeToString(
+                   s, *accessor, "uuid", OrthancPluginContentType_Unknown, 10, 1), Orthanc::OrthancException);
+
+    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "uuid", OrthancPluginContentType_Unknown, 0, 4);
+    ASSERT_EQ(4u, s.size());
+    ASSERT_EQ('a', s[0]);
+    ASSERT_EQ('b', s[1]);
+    ASSERT_EQ('c', s[2]);
+    ASSERT_EQ('d', s[3]);
+
+    OrthancDatabases::StorageBackend::ReadRangeToString(s, *accessor, "uuid", OrthancPluginContentType_Unknown, 4, 6);
+    ASSERT_EQ(6u, s.size());
+    ASSERT_EQ('\0', s[0]);
+    ASSERT_EQ('\1', s[1]);
+    ASSERT_EQ('\2', s[2]);
+    ASSERT_EQ('\3', s[3]);
+    ASSERT_EQ('\4', s[4]);
+    ASSERT_EQ('\5', s[5]);
+
+    ASSERT_THROW(OrthancDatabases::StorageBackend::ReadRangeToString(
+                   s, *accessor, "uuid", OrthancPluginContentType_Unknown, 4, 7), Orthanc::OrthancException);
+  }
+}
+
+
+TEST(PostgreSQL, ImplicitTransaction)
+{
+  std::unique_ptr<PostgreSQLDatabase> db(CreateTestDatabase());
+
+  ASSERT_FALSE(db->DoesTableExist("test"));
+  ASSERT_FALSE(db->DoesTableExist("test2"));
+
+  {
+    std::unique_ptr<OrthancDatabases::ITransaction> t(db->CreateTransaction(TransactionType_ReadWrite));
+    ASSERT_FALSE(t->IsImplicit());
+  }
+
+  {
+    Query query("CREATE TABLE test(id INT)", false);
+    std::unique_ptr<IPrecompiledStatement> s(db->Compile(query));
+    
+    std::unique_ptr<ITransaction> t(db->CreateTransaction(TransactionType_Implicit));
+    ASSERT_TRUE(t->IsImplicit());
+    ASSERT_THROW(t->Commit(), Orthanc::OrthancException);
+    ASSERT_THROW(t->Rollback(), Orthanc::OrthancException);
+
+    Dictionary args;
+    t->ExecuteWithoutResult(*s, args);
+    ASSERT_THROW(t->Rollback(), Orthanc::OrthancException);
+    t->Commit();
+
+    ASSERT_THROW(t->Commit(), Orthanc::OrthancException);
+  }
+
+  {
+    // An implicit transaction does not need to be explicitely committed
+    Query query("CREATE TABLE test2(id INT)", false);
+    std::unique_ptr<IPrecompiledStatement> s(db->Compile(query));
+    
+    std::unique_ptr<ITransaction> t(db->CreateTransaction(TransactionType_Implicit));
+
+    Dictionary args;
+    t->ExecuteWithoutResult(*s, args);
+  }
+
+  ASSERT_TRUE(db->DoesTableExist("test"));
+  ASSERT_TRUE(db->DoesTableExist("test2"));
+}
+
+
+TEST(PostgreSQL, RecycledValues)
+{
+  std::unique_ptr<PostgreSQLDatabase> db(CreateTestDatabase());
+
+  // Alternate NULL and non-NULL values, whose storage is reused between the rows
+  Query query("SELECT i, CASE WHEN i % 2 = 0 THEN NULL ELSE 'value' || i END "
+              "FROM generate_series(1, 5) AS i ORDER BY i", true);
+  std::unique_ptr<IPrecompiledStatement> s(db->Compile(query));
+
+  std::unique_ptr<ITransaction> t(db->CreateTransaction(TransactionType_ReadOnly));
+
+  Dictionary args;
+  std::unique_ptr<IResult> r(t->Execute(*s, args));
+  ASSERT_EQ(2u, r->GetFieldsCount());
+
+  for (int i = 1; i <= 5; i++)
+  {
+    ASSERT_FALSE(r->IsDone());
+    ASSERT_EQ(i, dynamic_cast<const Integer64Value&>(r->GetField(0)).GetValue());
+
+    if (i % 2 == 0)
+    {
+      ASSERT_EQ(ValueType_Null, r->GetField(1).GetType());
+    }
+    else
+    {
+      ASSERT_EQ("value" + boost::lexical_cast<std::string>(i),
+                dynamic_cast<const Utf8StringValue&>(r->GetField(1)).GetContent());
+    }
+
+    r->Next();
+  }
+
+  ASSERT_TRUE(r->IsDone());
+  r.reset();
+
+  t->Commit();
+}
+
+
+TEST(PostgreSQL, PlanCacheMode)
+{
+  std::unique_ptr<PostgreSQLDatabase> db(CreateTestDatabase());
+
+  Query query("SELECT ${ms} FROM (SELECT pg_sleep(${ms} / 1000.0)) AS s", true);
+  query.SetType("ms", ValueType_Integer64);
+
+  {
+    query.SetPlanCacheMode(PlanCacheMode_ForceCustom);
+    std::unique_ptr<IPrecompiledStatement> s(db->Compile(query));
+    ASSERT_TRUE(dynamic_cast<PostgreSQLStatement&>(*s).IsCustomPlans());
+
+    std::unique_ptr<ITransaction> t(db->CreateTransaction(TransactionType_ReadOnly));
+
+    for (int i = 0; i < 3; i++)
+    {
+      Dictionary args;
+      args.SetIntegerValue("ms", i);
+      std::unique_ptr<IResult> r(t->Execute(*s, args));
+      ASSERT_FALSE(r->IsDone());
+      ASSERT_EQ(i, dynamic_cast<const Integer64Value&>(r->GetField(0)).GetValue());
+    }
+
+    t->Commit();
+  }
+
+  {
+    query.SetPlanCacheMode(PlanCacheMode_Adaptive);
+    std::unique_ptr<IPrecompiledStatement> s(db->Compile(query));
+    PostgreSQLStatement& statement = dynamic_cast<PostgreSQLStatement&>(*s);
+
+    std::unique_ptr<ITransaction> t(db->CreateTransaction(TransactionType_ReadOnly));
+
+    Dictionary args;
+    args.SetIntegerValue("ms", 0);
+
+    for (int i = 0; i < 10; i++)
+    {
+      std::unique_ptr<IResult> r(t->Execute(*s, args));
+      ASSERT_FALSE(statement.IsCustomPlans());
+    }
+
+    // The latency diverges from the baseline
+    args.SetIntegerValue("ms", 100);
+
+    for (int i = 0; i < 10 && !statement.IsCustomPlans(); i++)
+    {
+      std::unique_ptr<IResult> r(t->Execute(*s, args));
+    }
+
+    ASSERT_TRUE(statement.IsCustomPlans());
+
+    {
+      std::unique_ptr<IResult> r(t->Execute(*s, args));
+      ASSERT_EQ(100, dynamic_cast<const Integer64Value&>(r->GetField(0)).GetValue());
+    }
+
+    t->Commit();
+  }
+}
+
+
+TEST(PostgreSQL, Notifications)
+{
+  std::unique_ptr<PostgreSQLDatabase> listener(CreateTestDatabase());
+  std::unique_ptr<PostgreSQLDatabase> notifier(CreateTestDatabase());
+
+  listener->ExecuteMultiLines("LISTEN orthanc_test");
+
+  std::string payload;
+  ASSERT_FALSE(listener->WaitForNotification(payload, 10));
+
+  notifier->ExecuteMultiLines("SELECT pg_notify('orthanc_test', '42'); NOTIFY orthanc_test, '43'");
+
+  ASSERT_TRUE(listener->WaitForNotification(payload, 5000));
+  ASSERT_EQ("42", payload);
+  ASSERT_TRUE(listener->WaitForNotification(payload, 5000));
+  ASSERT_EQ("43", payload);
+  ASSERT_FALSE(listener->WaitForNotification(payload, 10));
+
+  listener->ExecuteMultiLines("LISTEN orthanc_test2");
+  notifier->ExecuteMultiLines("NOTIFY orthanc_test2, '44'");
+
+  std::string channel;
+  ASSERT_TRUE(listener->WaitForNotification(channel, payload, 5000));
+  ASSERT_EQ("orthanc_test2", channel);
+  ASSERT_EQ("44", payload);
+}
+
+
+TEST(PostgreSQL, Pipeline)
+{
+  PostgreSQLParameters parameters(globalParameters_);
+  parameters.SetPipelineMode(true);
+
+  std::unique_ptr<PostgreSQLDatabase> db(new PostgreSQLDatabase(parameters));
+  db->Open();
+  db->ClearAll();
+
+  ASSERT_EQ(PostgreSQLDatabase::IsPipelineModeSupported(), db->IsPipelineEnabled());
+
+  db->ExecuteMultiLines("CREATE TABLE test(id INT PRIMARY KEY)");
+
+  Query insert("INSERT INTO test VALUES(${id})", false);
+  insert.SetType("id", ValueType_Integer64);
+  std::unique_ptr<IPrecompiledStatement> s(db->Compile(insert));
+
+  Query count("SELECT COUNT(*) FROM test", true);
+  std::unique_ptr<IPrecompiledStatement> c(db->Compile(count));
+
+  {
+    std::unique_ptr<ITransaction> t(db->CreateTransaction(TransactionType_ReadWrite));
+
+    for (int i = 0; i < 10; i++)
+    {
+      Dictionary args;
+      args.SetIntegerValue("id", i);
+      t->ExecuteWithoutResult(*s, args);
+    }
+
+    // The queued statements are synchronized before the SELECT
+    Dictionary args;
+    std::unique_ptr<IResult> r(t->Execute(*c, args));
+    ASSERT_EQ(10, dynamic_cast<const Integer64Value&>(r->GetField(0)).GetValue());
+    r.reset();
+
+    t->Commit();
+  }
+
+  {
+    std::unique_ptr<ITransaction> t(db->CreateTransaction(TransactionType_ReadWrite));
+
+    Dictionary args;
+    args.SetIntegerValue("id", 42);
+    t->ExecuteWithoutResult(*s, args);
+
+    args.SetIntegerValue("id", 0);  // Violates the primary key
+    try
+    {
+      t->ExecuteWithoutResult(*s, args);
+      t->Commit();  // The error is reported at the latest by the commit
+      FAIL();
+    }
+    catch (Orthanc::OrthancException&)
+    {
+    }
+
+    t->Rollback();
+  }
+
+  {
+    std::unique_ptr<ITransaction> t(db->CreateTransaction(TransactionType_ReadOnly));
+
+    Dictionary args;
+    std::unique_ptr<IResult> r(t->Execute(*c, args));
+    ASSERT_EQ(10, dynamic_cast<const Integer64Value&>(r->GetField(0)).GetValue());
+    r.reset();
+
+    t->Commit();
+  }
+}
+
+
+TEST(PostgreSQL, TransactionPooling)
+{
+  PostgreSQLParameters parameters(globalParameters_);
+  parameters.SetTransactionPooling(true);
+
+  std::unique_ptr<PostgreSQLDatabase> db(new PostgreSQLDatabase(parameters));
+  db->Open();
+  db->ClearAll();
+
+  db->ExecuteMultiLines("CREATE TABLE test(id INT PRIMARY KEY)");
+
+  Query insert("INSERT INTO test VALUES(${id})", false);
+  insert.SetType("id", ValueType_Integer64);
+  std::unique_ptr<IPrecompiledStatement> s(db->Compile(insert));
+  s->Warmup();
+
+  Query prepared("SELECT COUNT(*) FROM pg_prepared_statements", true);
+  std::unique_ptr<IPrecompiledStatement> p(db->Compile(prepared));
+
+  {
+    std::unique_ptr<ITransaction> t(db->CreateTransaction(TransactionType_ReadWrite));
+
+    for (int i = 0; i < 10; i++)
+    {
+      Dictionary args;
+      args.SetIntegerValue("id", i);
+      t->ExecuteWithoutResult(*s, args);
+    }
+
+    // No named statement was prepared in the session
+    Dictionary args;
+    std::unique_ptr<IResult> r(t->Execute(*p, args));
+    ASSERT_EQ(0, dynamic_cast<const Integer64Value&>(r->GetField(0)).GetValue());
+    r.reset();
+
+    t->Commit();
+  }
+}
+
+
+TEST(PostgreSQL, AsynchronousCommit)
+{
+  PostgreSQLParameters parameters(globalParameters_);
+  parameters.SetSynchronousCommit(false);
+
+  std::unique_ptr<PostgreSQLDatabase> db(new PostgreSQLDatabase(parameters));
+  db->Open();
+
+  Query show("SHOW synchronous_commit", true);
+  std::unique_ptr<IPrecompiledStatement> s(db->Compile(show));
+
+  {
+    // Only the read-write transactions are affected
+    std::unique_ptr<ITransaction> t(db->CreateTransaction(TransactionType_ReadWrite));
+
+    Dictionary args;
+    std::unique_ptr<IResult> r(t->Execute(*s, args));
+    ASSERT_EQ("off", dynamic_cast<const Utf8StringValue&>(r->GetField(0)).GetContent());
+    r.reset();
+
+    t->Commit();
+  }
+
+  {
+    // "SET LOCAL" doesn't leak out of the transaction
+    std::unique_ptr<ITransaction> t(db->CreateTransaction(TransactionType_ReadOnly));
+
+    Dictionary args;
+    std::unique_ptr<IResult> r(t->Execute(*s, args));
+    ASSERT_NE("off", dynamic_cast<const Utf8StringValue&>(r->GetField(0)).GetContent());
+    r.reset();
+
+    t->Commit();
+  }
+}
+
+
+namespace
+{
+  class AsyncHandler : public PostgreSQLAsyncQueries::IHandler
+  {
+  private:
+    std::vector<int>  values_;
+
+  public:
+    explicit AsyncHandler(size_t count) :
+      values_(count, -1)
+    {
+    }
+
+    virtual void Handle(size_t query,
+                        PostgreSQLResult& result) ORTHANC_OVERRIDE
+    {
+      ASSERT_FALSE(result.IsDone());
+      values_[query] = result.GetInteger(0);
+      result.Next();
+      ASSERT_TRUE(result.IsDone());
+    }
+
+    int GetValue(size_t query) const
+    {
+      return values_[query];
+    }
+  };
+}
+
+
+TEST(PostgreSQL, AsyncQueries)
+{
+  static const size_t COUNT = 3;
+
+  std::vector<PostgreSQLDatabase*> connections;
+  std::vector<PostgreSQLStatement*> statements;
+
+  for (size_t i = 0; i < COUNT; i++)
+  {
+    connections.push_back(CreateTestDatabase());
+    statements.push_back(new PostgreSQLStatement(*connections[i], "SELECT $1 + 1 FROM pg_sleep(0.5)"));
+    statements[i]->DeclareInputInteger(0);
+    statements[i]->BindInteger(0, static_cast<int>(10 * i));
+  }
+
+  {
+    PostgreSQLAsyncQueries queries;
+
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    for (size_t i = 0; i < COUNT; i++)
+    {
+      ASSERT_EQ(i, queries.Add(*statements[i]));
+    }
+
+    ASSERT_EQ(COUNT, queries.GetSize());
+
+    // Only one statement can be in flight on each connection
+    ASSERT_THROW(queries.Add(*statements[0]), Orthanc::OrthancException);
+
+    AsyncHandler handler(COUNT);
+    queries.WaitAll(handler);
+
+    // The queries have run concurrently, from this single thread
+    ASSERT_LT((boost::posix_time::microsec_clock::universal_time() - start).total_milliseconds(), 1400);
+
+    for (size_t i = 0; i < COUNT; i++)
+    {
+      ASSERT_EQ(static_cast<int>(10 * i + 1), handler.GetValue(i));
+    }
+  }
+
+  {
+    // The connections are usable again
+    PostgreSQLStatement s(*connections[0], "SELECT 42");
+    PostgreSQLResult r(s);
+    ASSERT_EQ(42, r.GetInteger(0));
+  }
+
+  for (size_t i = 0; i < COUNT; i++)
+  {
+    delete statements[i];
+    delete connections[i];
+  }
+}
+
+
+#if ORTHANC_PLUGINS_HAS_DATABASE_CONSTRAINT == 1
 TEST(PostgreSQLIndex, CreateInstance)
 {
   OrthancDatabases::PostgreSQLIndex db(NULL, globalParameters_);
@@ -547,72 +1659,1195 @@ TEST(PostgreSQLIndex, CreateInstance)
   std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
 
   std::string s;
-  ASSERT_TRUE(db.LookupGlobalProperty(s, *manager, MISSING_SERVER_IDENTIFIER, Orthanc::GlobalProperty_DatabaseInternal1));
-  ASSERT_EQ("2", s);
+  ASSERT_TRUE(db.LookupGlobalProperty(s, *manager, MISSING_SERVER_IDENTIFIER, Orthanc::GlobalProperty_DatabaseInternal1));
+  ASSERT_EQ("2", s);
+
+  OrthancPluginCreateInstanceResult r1, r2;
+  
+  memset(&r1, 0, sizeof(r1));
+  db.CreateInstance(r1, *manager, "a", "b", "c", "d");
+  ASSERT_TRUE(r1.isNewInstance);
+  ASSERT_TRUE(r1.isNewSeries);
+  ASSERT_TRUE(r1.isNewStudy);
+  ASSERT_TRUE(r1.isNewPatient);
+
+  memset(&r2, 0, sizeof(r2));
+  db.CreateInstance(r2, *manager, "a", "b", "c", "d");
+  ASSERT_FALSE(r2.isNewInstance);
+  ASSERT_EQ(r1.instanceId, r2.instanceId);
+
+  // Breaking the hierarchy
+  memset(&r2, 0, sizeof(r2));
+  ASSERT_THROW(db.CreateInstance(r2, *manager, "a", "e", "c", "f"), Orthanc::OrthancException);
+
+  memset(&r2, 0, sizeof(r2));
+  db.CreateInstance(r2, *manager, "a", "b", "c", "e");
+  ASSERT_TRUE(r2.isNewInstance);
+  ASSERT_FALSE(r2.isNewSeries);
+  ASSERT_FALSE(r2.isNewStudy);
+  ASSERT_FALSE(r2.isNewPatient);
+  ASSERT_EQ(r1.patientId, r2.patientId);
+  ASSERT_EQ(r1.studyId, r2.studyId);
+  ASSERT_EQ(r1.seriesId, r2.seriesId);
+  ASSERT_NE(r1.instanceId, r2.instanceId);
+
+  memset(&r2, 0, sizeof(r2));
+  db.CreateInstance(r2, *manager, "a", "b", "f", "g");
+  ASSERT_TRUE(r2.isNewInstance);
+  ASSERT_TRUE(r2.isNewSeries);
+  ASSERT_FALSE(r2.isNewStudy);
+  ASSERT_FALSE(r2.isNewPatient);
+  ASSERT_EQ(r1.patientId, r2.patientId);
+  ASSERT_EQ(r1.studyId, r2.studyId);
+  ASSERT_NE(r1.seriesId, r2.seriesId);
+  ASSERT_NE(r1.instanceId, r2.instanceId);
+
+  memset(&r2, 0, sizeof(r2));
+  db.CreateInstance(r2, *manager, "a", "h", "i", "j");
+  ASSERT_TRUE(r2.isNewInstance);
+  ASSERT_TRUE(r2.isNewSeries);
+  ASSERT_TRUE(r2.isNewStudy);
+  ASSERT_FALSE(r2.isNewPatient);
+  ASSERT_EQ(r1.patientId, r2.patientId);
+  ASSERT_NE(r1.studyId, r2.studyId);
+  ASSERT_NE(r1.seriesId, r2.seriesId);
+  ASSERT_NE(r1.instanceId, r2.instanceId);
+
+  memset(&r2, 0, sizeof(r2));
+  db.CreateInstance(r2, *manager, "k", "l", "m", "n");
+  ASSERT_TRUE(r2.isNewInstance);
+  ASSERT_TRUE(r2.isNewSeries);
+  ASSERT_TRUE(r2.isNewStudy);
+  ASSERT_TRUE(r2.isNewPatient);
+  ASSERT_NE(r1.patientId, r2.patientId);
+  ASSERT_NE(r1.studyId, r2.studyId);
+  ASSERT_NE(r1.seriesId, r2.seriesId);
+  ASSERT_NE(r1.instanceId, r2.instanceId);
+}
+
+
+TEST(PostgreSQLIndex, MultiWriter)
+{
+  PostgreSQLParameters parameters(globalParameters_);
+  parameters.SetLock(false);
+  parameters.SetMultiWriter(true);
+
+  OrthancDatabases::PostgreSQLIndex db(NULL, parameters);
+  db.SetClearAll(true);
+
+  // Both connections are created before the database is filled, as each of them clears the database
+  std::list<OrthancDatabases::IdentifierTag> tags;
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager1(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager2(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
+
+  OrthancPluginCreateInstanceResult r1, r2;
+  memset(&r1, 0, sizeof(r1));
+  memset(&r2, 0, sizeof(r2));
+
+  {
+    OrthancDatabases::DatabaseManager::Transaction t(*manager1, OrthancDatabases::TransactionType_ReadWrite);
+    db.CreateInstance(r1, *manager1, "a", "b", "c", "d");
+    db.CreateInstance(r2, *manager1, "e", "f", "g", "h");
+    t.Commit();
+  }
+
+  ASSERT_TRUE(r1.isNewPatient);
+  ASSERT_TRUE(r2.isNewPatient);
+
+  OrthancDatabases::DatabaseManager::Transaction t1(*manager1, OrthancDatabases::TransactionType_ReadWrite);
+
+  int64_t id;
+  ASSERT_TRUE(db.SelectPatientToRecycle(id, *manager1));
+  ASSERT_EQ(r1.patientId, id);
+
+  {
+    // The patient that is selected by the first connection is skipped
+    OrthancDatabases::DatabaseManager::Transaction t2(*manager2, OrthancDatabases::TransactionType_ReadWrite);
+    ASSERT_TRUE(db.SelectPatientToRecycle(id, *manager2));
+    ASSERT_EQ(r2.patientId, id);
+    ASSERT_FALSE(db.SelectPatientToRecycle(id, *manager2, r2.patientId));
+    t2.Rollback();
+  }
+
+  t1.Rollback();
+}
+#endif
+
+
+TEST(PostgreSQLIndex, BulkLoader)
+{
+  OrthancDatabases::PostgreSQLIndex db(NULL, globalParameters_);
+  db.SetClearAll(true);
+
+  std::list<OrthancDatabases::IdentifierTag> tags;
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
+
+  PostgreSQLDatabase& pg = dynamic_cast<PostgreSQLDatabase&>(manager->GetDatabase());
+
+  OrthancPluginAttachment attachment;
+  attachment.uuid = "uuid";
+  attachment.contentType = Orthanc::FileContentType_Dicom;
+  attachment.uncompressedSize = 4242;
+  attachment.uncompressedHash = "md5_1";
+  attachment.compressionType = Orthanc::CompressionType_ZlibWithSize;
+  attachment.compressedSize = 42;
+  attachment.compressedHash = "md5_2";
+
+  {
+    // Nothing is loaded if not committed
+    PostgreSQLBulkLoader loader(pg);
+    loader.AddResource(10, OrthancPluginResourceType_Patient, "patient");
+  }
+
+  ASSERT_EQ(0u, db.GetResourcesCount(*manager, OrthancPluginResourceType_Patient));
+
+  {
+    PostgreSQLBulkLoader loader(pg);
+    loader.AddResource(10, OrthancPluginResourceType_Patient, "patient");
+    loader.AddResource(11, OrthancPluginResourceType_Study, "study", 10);
+    loader.AddResource(12, OrthancPluginResourceType_Series, "series", 11);
+    loader.AddResource(13, OrthancPluginResourceType_Instance, "instance1", 12);
+    loader.AddResource(14, OrthancPluginResourceType_Instance, "instance2", 12);
+    loader.AddMainDicomTag(13, 0x0010, 0x0010, "PATIENT^NAME");
+    loader.AddIdentifierTag(13, 0x0008, 0x0018, "1.2.3");
+    loader.AddMetadata(13, Orthanc::MetadataType_RemoteAet, "AET", 2);
+    loader.AddAttachment(13, attachment, 3);
+    loader.AddMainDicomTag(14, 0x0010, 0x0020, "ID");  // Back to a previous table
+    loader.Commit();
+  }
+
+  ASSERT_EQ(1u, db.GetResourcesCount(*manager, OrthancPluginResourceType_Patient));
+  ASSERT_EQ(1u, db.GetResourcesCount(*manager, OrthancPluginResourceType_Study));
+  ASSERT_EQ(1u, db.GetResourcesCount(*manager, OrthancPluginResourceType_Series));
+  ASSERT_EQ(2u, db.GetResourcesCount(*manager, OrthancPluginResourceType_Instance));
+  ASSERT_EQ(42u, db.GetTotalCompressedSize(*manager));
+  ASSERT_EQ(4242u, db.GetTotalUncompressedSize(*manager));
+
+  std::string s;
+  int64_t revision;
+  ASSERT_TRUE(db.LookupMetadata(s, revision, *manager, 13, Orthanc::MetadataType_RemoteAet));
+  ASSERT_EQ("AET", s);
+  ASSERT_EQ(2, revision);
+
+  int64_t parent;
+  ASSERT_TRUE(db.LookupParent(parent, *manager, 13));
+  ASSERT_EQ(12, parent);
+
+  {
+    PostgreSQLStatement statement(pg, "SELECT childCount FROM Resources WHERE internalId=12");
+    PostgreSQLResult result(statement);
+    ASSERT_EQ(2, result.GetInteger(0));
+  }
+
+  {
+    PostgreSQLStatement statement(pg, "SELECT COUNT(*) FROM PatientRecyclingOrder WHERE patientId=10");
+    PostgreSQLResult result(statement);
+    ASSERT_EQ(1, result.GetInteger64(0));
+  }
+
+  // The triggers are enabled again, and the internal IDs continue after the loaded ones
+  ASSERT_LT(14, db.CreateResource(*manager, "other", OrthancPluginResourceType_Patient));
+  ASSERT_EQ(2u, db.GetResourcesCount(*manager, OrthancPluginResourceType_Patient));
+}
+
+
+TEST(PostgreSQLIndex, ChangeSeq)
+{
+  OrthancDatabases::PostgreSQLIndex db(NULL, globalParameters_);
+  db.SetClearAll(true);
+
+  std::list<OrthancDatabases::IdentifierTag> tags;
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
+  PostgreSQLDatabase& pg = dynamic_cast<PostgreSQLDatabase&>(manager->GetDatabase());
+
+  int64_t a = db.CreateResource(*manager, "a", OrthancPluginResourceType_Patient);
+  int64_t b = db.CreateResource(*manager, "b", OrthancPluginResourceType_Patient);
+
+  {
+    // The recycling order is taken from the sequence of "PatientRecyclingOrder"
+    PostgreSQLStatement statement(pg, "SELECT patientId FROM PatientRecyclingOrder ORDER BY seq");
+    PostgreSQLResult result(statement);
+    ASSERT_EQ(a, result.GetInteger64(0));
+    result.Next();
+    ASSERT_EQ(b, result.GetInteger64(0));
+    result.Next();
+    ASSERT_TRUE(result.IsDone());
+  }
+
+  ASSERT_EQ(0, db.GetLastChangeIndex(*manager));
+  db.LogChange(*manager, 1, a, OrthancPluginResourceType_Patient, "20241014T120000");
+  db.LogChange(*manager, 1, b, OrthancPluginResourceType_Patient, "20241014T120000");
+  ASSERT_EQ(2, db.GetLastChangeIndex(*manager));
+
+  // The last change index is not sharded, as it serializes the changes
+  ASSERT_FALSE(pg.DoesTableExist("GlobalIntegersShards"));
+}
+
+
+static void LogChangeInTransaction(OrthancDatabases::PostgreSQLIndex* db,
+                                   OrthancDatabases::DatabaseManager* manager,
+                                   int64_t resource)
+{
+  OrthancDatabases::DatabaseManager::Transaction t(*manager, OrthancDatabases::TransactionType_ReadWrite);
+  db->LogChange(*manager, 2, resource, OrthancPluginResourceType_Patient, "20241014T120000");
+  t.Commit();
+}
+
+
+TEST(PostgreSQLIndex, ChangesCommitOrder)
+{
+  PostgreSQLParameters parameters(globalParameters_);
+  parameters.SetLock(false);
+  parameters.SetIsolationMode(IsolationMode_ReadCommited);  // The second writer waits instead of failing
+
+  OrthancDatabases::PostgreSQLIndex db(NULL, parameters);
+  db.SetClearAll(true);
+
+  // The connections are created before the database is filled, as each of them clears the database
+  std::list<OrthancDatabases::IdentifierTag> tags;
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager1(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager2(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
+  std::unique_ptr<OrthancDatabases::DatabaseManager> poller(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
+  PostgreSQLDatabase& pg = dynamic_cast<PostgreSQLDatabase&>(poller->GetDatabase());
+
+  int64_t a = db.CreateResource(*manager1, "a", OrthancPluginResourceType_Patient);
+
+  {
+    OrthancDatabases::DatabaseManager::Transaction t1(*manager1, OrthancDatabases::TransactionType_ReadWrite);
+    db.LogChange(*manager1, 1, a, OrthancPluginResourceType_Patient, "20241014T120000");
+
+    // The second writer cannot allocate its "seq" as long as the first one is not committed
+    boost::thread writer(LogChangeInTransaction, &db, manager2.get(), a);
+    ASSERT_FALSE(writer.timed_join(boost::posix_time::milliseconds(500)));
+    ASSERT_EQ(0, db.GetLastChangeIndex(*poller));
+
+    t1.Commit();
+    writer.join();
+  }
+
+  ASSERT_EQ(2, db.GetLastChangeIndex(*poller));
+
+  {
+    // No change was skipped, and the changes were committed in the order of "seq"
+    PostgreSQLStatement statement(pg, "SELECT seq, changeType FROM Changes ORDER BY seq");
+    PostgreSQLResult result(statement);
+    ASSERT_FALSE(result.IsDone());
+    ASSERT_EQ(1, result.GetInteger64(0));
+    ASSERT_EQ(1, result.GetInteger(1));
+    result.Next();
+    ASSERT_FALSE(result.IsDone());
+    ASSERT_EQ(2, result.GetInteger64(0));
+    ASSERT_EQ(2, result.GetInteger(1));
+    result.Next();
+    ASSERT_TRUE(result.IsDone());
+  }
+}
+
+TEST(PostgreSQLIndex, StatisticsRollup)
+{
+  OrthancDatabases::PostgreSQLIndex db(NULL, globalParameters_);
+  db.SetClearAll(true);
+  db.SetStatisticsRollupBatchSize(2);
+
+  std::list<OrthancDatabases::IdentifierTag> tags;
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
+  PostgreSQLDatabase& pg = dynamic_cast<PostgreSQLDatabase&>(manager->GetDatabase());
+
+  for (int i = 0; i < 5; i++)
+  {
+    db.CreateResource(*manager, ("patient" + boost::lexical_cast<std::string>(i)).c_str(), OrthancPluginResourceType_Patient);
+  }
+
+  int64_t patientsCount, studiesCount, seriesCount, instancesCount, compressedSize, uncompressedSize;
+  db.UpdateAndGetStatistics(*manager, patientsCount, studiesCount, seriesCount, instancesCount, compressedSize, uncompressedSize);
+  ASSERT_EQ(5, patientsCount);
+  ASSERT_EQ(0, studiesCount);
+  ASSERT_EQ(0, compressedSize);
+
+  {
+    // Only one batch has been folded
+    PostgreSQLStatement statement(pg, "SELECT COUNT(*) FROM GlobalIntegersChanges");
+    PostgreSQLResult result(statement);
+    ASSERT_EQ(3, result.GetInteger64(0));
+  }
+
+  db.PerformHousekeepingTask(*manager, "UpdateStatistics");
+
+  {
+    PostgreSQLStatement statement(pg, "SELECT COUNT(*) FROM GlobalIntegersChanges");
+    PostgreSQLResult result(statement);
+    ASSERT_EQ(0, result.GetInteger64(0));
+  }
+
+  db.UpdateAndGetStatistics(*manager, patientsCount, studiesCount, seriesCount, instancesCount, compressedSize, uncompressedSize);
+  ASSERT_EQ(5, patientsCount);
+}
+
+TEST(PostgreSQLIndex, StatisticsCache)
+{
+  OrthancDatabases::PostgreSQLIndex db(NULL, globalParameters_);
+  db.SetClearAll(true);
+  db.SetStatisticsCacheTimeToLive(60);
+
+  std::list<OrthancDatabases::IdentifierTag> tags;
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
+
+  int64_t a = db.CreateResource(*manager, "a", OrthancPluginResourceType_Patient);
+  db.CreateResource(*manager, "b", OrthancPluginResourceType_Study);
+
+  OrthancPluginAttachment attachment;
+  attachment.uuid = "uuid";
+  attachment.contentType = Orthanc::FileContentType_Dicom;
+  attachment.uncompressedSize = 4242;
+  attachment.uncompressedHash = "md5";
+  attachment.compressionType = Orthanc::CompressionType_None;
+  attachment.compressedSize = 42;
+  attachment.compressedHash = "md5";
+  db.AddAttachment(*manager, a, attachment, 0);
+
+  // These calls go through "ReadStatistics()", as the cache is empty
+  ASSERT_EQ(1u, db.GetResourcesCount(*manager, OrthancPluginResourceType_Patient));
+  ASSERT_EQ(1u, db.GetResourcesCount(*manager, OrthancPluginResourceType_Study));
+  ASSERT_EQ(0u, db.GetResourcesCount(*manager, OrthancPluginResourceType_Series));
+  ASSERT_EQ(0u, db.GetResourcesCount(*manager, OrthancPluginResourceType_Instance));
+  ASSERT_EQ(42u, db.GetTotalCompressedSize(*manager));
+  ASSERT_EQ(4242u, db.GetTotalUncompressedSize(*manager));
+
+  // A write invalidates the cached snapshot
+  db.CreateResource(*manager, "c", OrthancPluginResourceType_Patient);
+  ASSERT_EQ(2u, db.GetResourcesCount(*manager, OrthancPluginResourceType_Patient));
+
+  // Same values once the pending changes have been folded
+  db.PerformHousekeepingTask(*manager, "UpdateStatistics");
+  ASSERT_EQ(2u, db.GetResourcesCount(*manager, OrthancPluginResourceType_Patient));
+  ASSERT_EQ(42u, db.GetTotalCompressedSize(*manager));
+}
+
+TEST(PostgreSQLIndex, HousekeepingScheduler)
+{
+  const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+
+  OrthancDatabases::HousekeepingScheduler scheduler;
+  ASSERT_TRUE(scheduler.IsEmpty());
+
+  scheduler.AddTask("a", 5, now);
+  scheduler.AddTask("disabled", 0, now);
+  scheduler.AddTask("b", 10, now);
+  ASSERT_EQ(2u, scheduler.GetTasksCount());
+  ASSERT_EQ("a", scheduler.GetTaskName(0));
+  ASSERT_EQ("b", scheduler.GetTaskName(1));
+  ASSERT_EQ(now + boost::posix_time::seconds(5), scheduler.GetNextDeadline());
+
+  ASSERT_FALSE(scheduler.IsDue(0, now));
+  ASSERT_TRUE(scheduler.IsDue(0, now + boost::posix_time::seconds(5)));
+  ASSERT_FALSE(scheduler.IsDue(1, now + boost::posix_time::seconds(5)));
+
+  // Backpressure: A task can be postponed during at most one interval
+  const boost::posix_time::ptime t1 = now + boost::posix_time::seconds(6);
+  ASSERT_TRUE(scheduler.CanPostpone(0, t1));
+  scheduler.Postpone(0, t1, boost::posix_time::seconds(1));
+  ASSERT_FALSE(scheduler.IsDue(0, t1));
+  ASSERT_TRUE(scheduler.IsDue(0, t1 + boost::posix_time::seconds(1)));
+  ASSERT_FALSE(scheduler.CanPostpone(0, now + boost::posix_time::seconds(10)));
+
+  scheduler.SignalExecuted(0, now + boost::posix_time::seconds(10));
+  ASSERT_FALSE(scheduler.IsDue(0, now + boost::posix_time::seconds(14)));
+  ASSERT_TRUE(scheduler.IsDue(0, now + boost::posix_time::seconds(15)));
+  ASSERT_EQ(now + boost::posix_time::seconds(10), scheduler.GetNextDeadline());
+
+  // Runtime changes of the intervals
+  ASSERT_EQ(5u, scheduler.GetInterval(0));
+  ASSERT_FALSE(scheduler.SetInterval("disabled", 3, now));
+  ASSERT_TRUE(scheduler.SetInterval("b", 0, now));
+  ASSERT_EQ(0u, scheduler.GetInterval(1));
+  ASSERT_FALSE(scheduler.IsDue(1, now + boost::posix_time::hours(24)));
+  ASSERT_EQ(now + boost::posix_time::seconds(15), scheduler.GetNextDeadline());
+  ASSERT_TRUE(scheduler.SetInterval("b", 2, now));
+  ASSERT_EQ(2u, scheduler.GetInterval(1));
+  ASSERT_TRUE(scheduler.IsDue(1, now + boost::posix_time::seconds(2)));
+  ASSERT_EQ(now + boost::posix_time::seconds(2), scheduler.GetNextDeadline());
+
+  ASSERT_THROW(scheduler.GetTaskName(2), Orthanc::OrthancException);
+}
+
+TEST(PostgreSQLIndex, WalPositions)
+{
+  std::list<OrthancDatabases::IdentifierTag> tags;
+
+  OrthancDatabases::PostgreSQLIndex db(NULL, globalParameters_);
+  db.SetClearAll(true);
+
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
+
+  ASSERT_FALSE(db.IsReplicaReadYourWrites());
+
+  if (dynamic_cast<PostgreSQLDatabase&>(manager->GetDatabase()).GetServerVersion() < 100000)
+  {
+    // The commits are not tracked
+    ASSERT_EQ(0u, db.GetCommitPosition(*manager));
+    ASSERT_EQ(0u, db.GetReplayPosition(*manager));
+  }
+  else
+  {
+    const uint64_t before = db.GetCommitPosition(*manager);
+    ASSERT_GT(before, 0u);
+
+    db.CreateResource(*manager, "a", OrthancPluginResourceType_Patient);
+    ASSERT_GT(db.GetCommitPosition(*manager), before);
+
+    // The test server is not a standby, so there is no replayed position
+    ASSERT_EQ(0u, db.GetReplayPosition(*manager));
+  }
+}
+
+
+TEST(PostgreSQLIndex, ResourceSummary)
+{
+  std::list<OrthancDatabases::IdentifierTag> tags;
+
+  {
+    OrthancDatabases::PostgreSQLIndex db(NULL, globalParameters_);
+    db.SetClearAll(true);
+    db.SetResourceSummary(true);
+
+    std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
+    PostgreSQLDatabase& pg = dynamic_cast<PostgreSQLDatabase&>(manager->GetDatabase());
+    ASSERT_TRUE(pg.DoesTableExist("ResourceSummary"));
+
+    int64_t a = db.CreateResource(*manager, "a", OrthancPluginResourceType_Patient);
+    db.SetMainDicomTag(*manager, a, 0x0010, 0x0010, "NAME");
+    db.SetMetadata(*manager, a, Orthanc::MetadataType_RemoteAet, "AET", 2);
+
+    {
+      PostgreSQLStatement statement(pg, "SELECT content FROM ResourceSummary WHERE id=" + boost::lexical_cast<std::string>(a));
+      PostgreSQLResult result(statement);
+
+      Json::Value summary;
+      ASSERT_TRUE(Orthanc::Toolbox::ReadJson(summary, result.GetString(0)));
+      ASSERT_EQ(2u, summary.size());
+      ASSERT_EQ(1u, summary[0].size());
+      ASSERT_EQ(0x0010, summary[0][0][0].asInt());
+      ASSERT_EQ(0x0010, summary[0][0][1].asInt());
+      ASSERT_EQ("NAME", summary[0][0][2].asString());
+      ASSERT_EQ(1u, summary[1].size());
+      ASSERT_EQ(Orthanc::MetadataType_RemoteAet, summary[1][0][0].asInt());
+      ASSERT_EQ(2, summary[1][0][1].asInt());
+      ASSERT_EQ("AET", summary[1][0][2].asString());
+    }
+
+    db.DeleteMetadata(*manager, a, Orthanc::MetadataType_RemoteAet);
+
+    {
+      PostgreSQLStatement statement(pg, "SELECT content FROM ResourceSummary WHERE id=" + boost::lexical_cast<std::string>(a));
+      PostgreSQLResult result(statement);
+
+      Json::Value summary;
+      ASSERT_TRUE(Orthanc::Toolbox::ReadJson(summary, result.GetString(0)));
+      ASSERT_EQ(1u, summary[0].size());
+      ASSERT_EQ(0u, summary[1].size());
+    }
+
+    {
+      // The summary follows the resource through the "ON DELETE CASCADE"
+      PostgreSQLStatement statement(pg, "DELETE FROM Resources");
+      statement.Run();
+    }
+
+    {
+      PostgreSQLStatement statement(pg, "SELECT COUNT(*) FROM ResourceSummary");
+      PostgreSQLResult result(statement);
+      ASSERT_EQ(0, result.GetInteger64(0));
+    }
+  }
+
+  {
+    // Disabling the option drops the table
+    OrthancDatabases::PostgreSQLIndex db(NULL, globalParameters_);
+    std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
+    ASSERT_FALSE(dynamic_cast<PostgreSQLDatabase&>(manager->GetDatabase()).DoesTableExist("ResourceSummary"));
+  }
+}
+
+TEST(PostgreSQLIndex, UnloggedTables)
+{
+  std::list<OrthancDatabases::IdentifierTag> tags;
+
+  {
+    // A hot standby cannot read the unlogged tables
+    OrthancDatabases::PostgreSQLIndex db(NULL, globalParameters_);
+    db.SetUnloggedTables(true);
+    ASSERT_THROW(db.SetReplica(globalParameters_, 1), Orthanc::OrthancException);
+
+    OrthancDatabases::PostgreSQLIndex db2(NULL, globalParameters_);
+    db2.SetReplica(globalParameters_, 1);
+    ASSERT_THROW(db2.SetUnloggedTables(true), Orthanc::OrthancException);
+    db2.SetUnloggedTables(false);
+  }
+
+  {
+    OrthancDatabases::PostgreSQLIndex db(NULL, globalParameters_);
+    db.SetClearAll(true);
+    db.SetUnloggedTables(true);
+
+    std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
+    PostgreSQLDatabase& pg = dynamic_cast<PostgreSQLDatabase&>(manager->GetDatabase());
+    ASSERT_TRUE(pg.DoesTableExist("UnloggedTablesSentinel"));
+
+    {
+      PostgreSQLStatement statement(pg, "SELECT relpersistence FROM pg_class WHERE relname = 'childcountchanges'");
+      PostgreSQLResult result(statement);
+      ASSERT_EQ("u", result.GetString(0));
+    }
+
+    OrthancPluginCreateInstanceResult r;
+    db.CreateInstance(r, *manager, "a", "b", "c", "d");
+
+    // Same content as after the crash recovery of PostgreSQL, that empties the unlogged tables
+    pg.ExecuteMultiLines("DELETE FROM GlobalIntegersChanges; "
+                         "DELETE FROM ChildCountChanges; "
+                         "DELETE FROM UnloggedTablesSentinel;");
+
+    db.PerformHousekeepingTask(*manager, "UpdateStatistics");
+
+    int64_t patientsCount, studiesCount, seriesCount, instancesCount, compressedSize, uncompressedSize;
+    db.UpdateAndGetStatistics(*manager, patientsCount, studiesCount, seriesCount, instancesCount, compressedSize, uncompressedSize);
+    ASSERT_EQ(1, patientsCount);
+    ASSERT_EQ(1, studiesCount);
+    ASSERT_EQ(1, seriesCount);
+    ASSERT_EQ(1, instancesCount);
+
+    const std::string childCount = "SELECT childCount FROM Resources WHERE internalId = " + boost::lexical_cast<std::string>(r.patientId);
+
+    {
+      PostgreSQLStatement statement(pg, childCount);
+      PostgreSQLResult result(statement);
+      ASSERT_TRUE(result.IsNull(0));
+    }
+
+    db.PerformHousekeepingTask(*manager, "ComputeMissingChildCount");
+
+    {
+      PostgreSQLStatement statement(pg, childCount);
+      PostgreSQLResult result(statement);
+      ASSERT_EQ(1, result.GetInteger64(0));
+    }
+  }
+
+  {
+    // Disabling the option switches back the tables to LOGGED
+    OrthancDatabases::PostgreSQLIndex db(NULL, globalParameters_);
+    std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
+    PostgreSQLDatabase& pg = dynamic_cast<PostgreSQLDatabase&>(manager->GetDatabase());
+    ASSERT_FALSE(pg.DoesTableExist("UnloggedTablesSentinel"));
+
+    PostgreSQLStatement statement(pg, "SELECT relpersistence FROM pg_class WHERE relname = 'childcountchanges'");
+    PostgreSQLResult result(statement);
+    ASSERT_EQ("p", result.GetString(0));
+  }
+}
+
+TEST(PostgreSQLIndex, SortKeys)
+{
+  std::list<OrthancDatabases::IdentifierTag> tags;
+
+  const int64_t studyDate = OrthancDatabases::ISqlLookupFormatter::EncodeTagSortKey(0x0008, 0x0020);
+  const int64_t lastUpdate = OrthancDatabases::ISqlLookupFormatter::EncodeMetadataSortKey(Orthanc::MetadataType_LastUpdate);
+
+  {
+    std::set<std::string> keys;
+    keys.insert("nope");
+
+    OrthancDatabases::PostgreSQLIndex db(NULL, globalParameters_);
+    ASSERT_THROW(db.SetSortKeys(keys), Orthanc::OrthancException);
+  }
+
+  {
+    std::set<std::string> keys;
+    keys.insert("0008,0020");
+    keys.insert(boost::lexical_cast<std::string>(static_cast<int>(Orthanc::MetadataType_LastUpdate)));
+
+    OrthancDatabases::PostgreSQLIndex db(NULL, globalParameters_);
+    db.SetClearAll(true);
+    db.SetSortKeys(keys);
+
+    std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
+    PostgreSQLDatabase& pg = dynamic_cast<PostgreSQLDatabase&>(manager->GetDatabase());
+    ASSERT_TRUE(pg.DoesTableExist("SortKeys"));
+
+    int64_t a = db.CreateResource(*manager, "a", OrthancPluginResourceType_Study);
+    db.SetMainDicomTag(*manager, a, 0x0008, 0x0020, "20240101");
+    db.SetMainDicomTag(*manager, a, 0x0008, 0x0030, "120000");  // Not a sort key
+    db.SetMetadata(*manager, a, Orthanc::MetadataType_LastUpdate, "20240102T000000", 0);
+
+    {
+      PostgreSQLStatement statement(pg, "SELECT sortKey, value FROM SortKeys ORDER BY sortKey");
+      PostgreSQLResult result(statement);
+
+      ASSERT_FALSE(result.IsDone());
+      ASSERT_EQ(studyDate, result.GetInteger64(0));
+      ASSERT_EQ("20240101", result.GetString(1));
+      result.Next();
+      ASSERT_FALSE(result.IsDone());
+      ASSERT_EQ(lastUpdate, result.GetInteger64(0));
+      ASSERT_EQ("20240102T000000", result.GetString(1));
+      result.Next();
+      ASSERT_TRUE(result.IsDone());
+    }
+
+    db.DeleteMetadata(*manager, a, Orthanc::MetadataType_LastUpdate);
+
+    {
+      PostgreSQLStatement statement(pg, "SELECT COUNT(*) FROM SortKeys");
+      PostgreSQLResult result(statement);
+      ASSERT_EQ(1, result.GetInteger64(0));
+    }
+
+    {
+      // The sort keys follow the resource through the "ON DELETE CASCADE"
+      PostgreSQLStatement statement(pg, "DELETE FROM Resources");
+      statement.Run();
+    }
+
+    {
+      PostgreSQLStatement statement(pg, "SELECT COUNT(*) FROM SortKeys");
+      PostgreSQLResult result(statement);
+      ASSERT_EQ(0, result.GetInteger64(0));
+    }
+  }
+
+  {
+    // An empty set of keys drops the table
+    OrthancDatabases::PostgreSQLIndex db(NULL, globalParameters_);
+    std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
+    ASSERT_FALSE(dynamic_cast<PostgreSQLDatabase&>(manager->GetDatabase()).DoesTableExist("SortKeys"));
+  }
+}
+
+TEST(PostgreSQLIndex, ChangesPartitions)
+{
+  OrthancDatabases::PostgreSQLIndex db(NULL, globalParameters_);
+  db.SetClearAll(true);
+  db.SetChangesPartitions(10, 1);
+
+  std::list<OrthancDatabases::IdentifierTag> tags;
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
+  PostgreSQLDatabase& pg = dynamic_cast<PostgreSQLDatabase&>(manager->GetDatabase());
+  ASSERT_TRUE(pg.DoesTableExist("ChangesPartitions"));
+
+  {
+    // Partitions [1,11), [11,21) and [21,31) after the empty legacy partition
+    PostgreSQLStatement statement(pg, "SELECT COUNT(*), MAX(upperBound) FROM ChangesPartitions");
+    PostgreSQLResult result(statement);
+    ASSERT_EQ(4, result.GetInteger64(0));
+    ASSERT_EQ(31, result.GetInteger64(1));
+  }
+
+  int64_t a = db.CreateResource(*manager, "a", OrthancPluginResourceType_Patient);
+
+  for (int i = 0; i < 25; i++)
+  {
+    db.LogChange(*manager, 1, a, OrthancPluginResourceType_Patient, "20000101T000000");
+  }
+
+  {
+    // Change beyond the last partition, that goes to the default partition
+    PostgreSQLStatement statement(pg, "INSERT INTO Changes VALUES(100, 1, " + boost::lexical_cast<std::string>(a) +
+                                  ", 0, '20000101T000000')");
+    statement.Run();
+  }
+
+  db.PerformHousekeepingTask(*manager, "ChangesPartitions");
+
+  {
+    // The partitions up to the last change (25) are dropped, as they only contain expired changes
+    PostgreSQLStatement statement(pg, "SELECT COUNT(*), MIN(lowerBound), MAX(upperBound) FROM ChangesPartitions");
+    PostgreSQLResult result(statement);
+    ASSERT_EQ(4, result.GetInteger64(0));
+    ASSERT_EQ(21, result.GetInteger64(1));
+    ASSERT_EQ(101, result.GetInteger64(2));
+  }
+
+  {
+    PostgreSQLStatement statement(pg, "SELECT COUNT(*) FROM ChangesDefault");
+    PostgreSQLResult result(statement);
+    ASSERT_EQ(0, result.GetInteger64(0));
+  }
+
+  {
+    PostgreSQLStatement statement(pg, "SELECT COUNT(*), MIN(seq) FROM Changes");
+    PostgreSQLResult result(statement);
+    ASSERT_EQ(6, result.GetInteger64(0));
+    ASSERT_EQ(21, result.GetInteger64(1));
+  }
+}
+
+TEST(PostgreSQLIndex, OnlineUpgrades)
+{
+  OrthancDatabases::PostgreSQLIndex db(NULL, globalParameters_);
+  db.SetClearAll(true);
+
+  std::list<OrthancDatabases::IdentifierTag> tags;
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
+  PostgreSQLDatabase& pg = dynamic_cast<PostgreSQLDatabase&>(manager->GetDatabase());
+
+  int64_t patient = db.CreateResource(*manager, "patient", OrthancPluginResourceType_Patient);
+  int64_t study = db.CreateResource(*manager, "study", OrthancPluginResourceType_Study);
+  db.AttachChild(*manager, patient, study);
+
+  // Simulate a database that has just been upgraded from revision 2
+  pg.ExecuteMultiLines("DROP INDEX ChildrenIndex2; "
+                       "CREATE INDEX ChildrenIndex ON Resources(parentId); "
+                       "UPDATE Resources SET childCount = NULL; "
+                       "UPDATE GlobalProperties SET value = '{}' WHERE property = 18");
+
+  db.PerformHousekeepingTask(*manager, "OnlineUpgrades");
+  ASSERT_FALSE(pg.DoesIndexExist("ChildrenIndex"));
+  ASSERT_TRUE(pg.DoesIndexExist("ChildrenIndex2"));
+
+  db.PerformHousekeepingTask(*manager, "ComputeMissingChildCount");
+
+  {
+    PostgreSQLStatement statement(pg, "SELECT childCount FROM Resources WHERE internalId=" +
+                                  boost::lexical_cast<std::string>(patient));
+    PostgreSQLResult result(statement);
+    ASSERT_EQ(1, result.GetInteger(0));
+  }
+
+  // No resource after the last batch
+  db.PerformHousekeepingTask(*manager, "ComputeMissingChildCount");
+
+  std::string s;
+  ASSERT_TRUE(db.LookupGlobalProperty(s, *manager, MISSING_SERVER_IDENTIFIER, Orthanc::GlobalProperty_DatabaseInternal8));
 
-  OrthancPluginCreateInstanceResult r1, r2;
-  
-  memset(&r1, 0, sizeof(r1));
-  db.CreateInstance(r1, *manager, "a", "b", "c", "d");
-  ASSERT_TRUE(r1.isNewInstance);
-  ASSERT_TRUE(r1.isNewSeries);
-  ASSERT_TRUE(r1.isNewStudy);
-  ASSERT_TRUE(r1.isNewPatient);
+  Json::Value progress;
+  ASSERT_TRUE(Orthanc::Toolbox::ReadJson(progress, s));
+  ASSERT_EQ(-1, progress["ChildCount"].asInt64());
+}
 
-  memset(&r2, 0, sizeof(r2));
-  db.CreateInstance(r2, *manager, "a", "b", "c", "d");
-  ASSERT_FALSE(r2.isNewInstance);
-  ASSERT_EQ(r1.instanceId, r2.instanceId);
+TEST(PostgreSQLIndex, RollupChildCounts)
+{
+  OrthancDatabases::PostgreSQLIndex db(NULL, globalParameters_);
+  db.SetClearAll(true);
 
-  // Breaking the hierarchy
-  memset(&r2, 0, sizeof(r2));
-  ASSERT_THROW(db.CreateInstance(r2, *manager, "a", "e", "c", "f"), Orthanc::OrthancException);
+  std::list<OrthancDatabases::IdentifierTag> tags;
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
+  PostgreSQLDatabase& pg = dynamic_cast<PostgreSQLDatabase&>(manager->GetDatabase());
 
-  memset(&r2, 0, sizeof(r2));
-  db.CreateInstance(r2, *manager, "a", "b", "c", "e");
-  ASSERT_TRUE(r2.isNewInstance);
-  ASSERT_FALSE(r2.isNewSeries);
-  ASSERT_FALSE(r2.isNewStudy);
-  ASSERT_FALSE(r2.isNewPatient);
-  ASSERT_EQ(r1.patientId, r2.patientId);
-  ASSERT_EQ(r1.studyId, r2.studyId);
-  ASSERT_EQ(r1.seriesId, r2.seriesId);
-  ASSERT_NE(r1.instanceId, r2.instanceId);
+  pg.ExecuteMultiLines("INSERT INTO Resources VALUES (1000, 0, 'patient', NULL, 0); "
+                       "INSERT INTO Resources VALUES (1001, 1, 'study1', 1000, 0); "
+                       "INSERT INTO Resources VALUES (1002, 1, 'study2', 1000, 0); "
+                       "INSERT INTO Resources VALUES (1003, 1, 'study3', 1000, 0); "
+                       "DELETE FROM Resources WHERE internalId = 1003");
 
-  memset(&r2, 0, sizeof(r2));
-  db.CreateInstance(r2, *manager, "a", "b", "f", "g");
-  ASSERT_TRUE(r2.isNewInstance);
-  ASSERT_TRUE(r2.isNewSeries);
-  ASSERT_FALSE(r2.isNewStudy);
-  ASSERT_FALSE(r2.isNewPatient);
-  ASSERT_EQ(r1.patientId, r2.patientId);
-  ASSERT_EQ(r1.studyId, r2.studyId);
-  ASSERT_NE(r1.seriesId, r2.seriesId);
-  ASSERT_NE(r1.instanceId, r2.instanceId);
+  {
+    // The triggers don't update the row of the parent
+    PostgreSQLStatement statement(pg, "SELECT childCount, (SELECT COUNT(*) FROM ChildCountChanges) FROM Resources WHERE internalId=1000");
+    PostgreSQLResult result(statement);
+    ASSERT_EQ(0, result.GetInteger(0));
+    ASSERT_EQ(4, result.GetInteger64(1));
+  }
 
-  memset(&r2, 0, sizeof(r2));
-  db.CreateInstance(r2, *manager, "a", "h", "i", "j");
-  ASSERT_TRUE(r2.isNewInstance);
-  ASSERT_TRUE(r2.isNewSeries);
-  ASSERT_TRUE(r2.isNewStudy);
-  ASSERT_FALSE(r2.isNewPatient);
-  ASSERT_EQ(r1.patientId, r2.patientId);
-  ASSERT_NE(r1.studyId, r2.studyId);
-  ASSERT_NE(r1.seriesId, r2.seriesId);
-  ASSERT_NE(r1.instanceId, r2.instanceId);
+  db.PerformHousekeepingTask(*manager, "RollupChildCounts");
 
-  memset(&r2, 0, sizeof(r2));
-  db.CreateInstance(r2, *manager, "k", "l", "m", "n");
-  ASSERT_TRUE(r2.isNewInstance);
-  ASSERT_TRUE(r2.isNewSeries);
-  ASSERT_TRUE(r2.isNewStudy);
-  ASSERT_TRUE(r2.isNewPatient);
-  ASSERT_NE(r1.patientId, r2.patientId);
-  ASSERT_NE(r1.studyId, r2.studyId);
-  ASSERT_NE(r1.seriesId, r2.seriesId);
-  ASSERT_NE(r1.instanceId, r2.instanceId);
+  {
+    PostgreSQLStatement statement(pg, "SELECT childCount, (SELECT COUNT(*) FROM ChildCountChanges) FROM Resources WHERE internalId=1000");
+    PostgreSQLResult result(statement);
+    ASSERT_EQ(2, result.GetInteger(0));
+    ASSERT_EQ(0, result.GetInteger64(1));
+  }
+}
+
+TEST(PostgreSQLIndex, LabelsCatalog)
+{
+  OrthancDatabases::PostgreSQLIndex db(NULL, globalParameters_);
+  db.SetClearAll(true);
+
+  std::list<OrthancDatabases::IdentifierTag> tags;
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
+  PostgreSQLDatabase& pg = dynamic_cast<PostgreSQLDatabase&>(manager->GetDatabase());
+
+  int64_t a = db.CreateResource(*manager, "a", OrthancPluginResourceType_Patient);
+  int64_t b = db.CreateResource(*manager, "b", OrthancPluginResourceType_Patient);
+  db.AddLabel(*manager, a, "hello");
+  db.AddLabel(*manager, b, "hello");
+  db.AddLabel(*manager, a, "world");
+
+  std::list<std::string> labels;
+  db.ListAllLabels(labels, *manager);
+  ASSERT_EQ(2u, labels.size());
+
+  db.RemoveLabel(*manager, a, "world");
+  db.ListAllLabels(labels, *manager);
+  ASSERT_EQ(1u, labels.size());
+  ASSERT_EQ("hello", labels.front());
+
+  {
+    // The deletion of the labels through "ON DELETE CASCADE" also fires the triggers
+    pg.ExecuteMultiLines("DELETE FROM Resources WHERE internalId = " + boost::lexical_cast<std::string>(b));
+  }
+
+  db.PerformHousekeepingTask(*manager, "CompactLabelsCatalog");
+
+  {
+    PostgreSQLStatement statement(pg, "SELECT label, count FROM LabelsCatalog WHERE shard <> -1 OR count <> 1");
+    PostgreSQLResult result(statement);
+    ASSERT_TRUE(result.IsDone());
+  }
+
+  {
+    PostgreSQLStatement statement(pg, "SELECT label, count FROM LabelsCatalog");
+    PostgreSQLResult result(statement);
+    ASSERT_FALSE(result.IsDone());
+    ASSERT_EQ("hello", result.GetString(0));
+    ASSERT_EQ(1, result.GetInteger64(1));
+    result.Next();
+    ASSERT_TRUE(result.IsDone());
+  }
+
+  db.ListAllLabels(labels, *manager);
+  ASSERT_EQ(1u, labels.size());
+}
+
+TEST(PostgreSQLIndex, TagsPartitions)
+{
+  std::list<OrthancDatabases::IdentifierTag> tags;
+
+  {
+    OrthancDatabases::PostgreSQLIndex db(NULL, globalParameters_);
+    db.SetClearAll(true);
+
+    std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
+
+    for (int i = 0; i < 5; i++)
+    {
+      int64_t id = db.CreateResource(*manager, ("patient" + boost::lexical_cast<std::string>(i)).c_str(), OrthancPluginResourceType_Patient);
+      db.SetMainDicomTag(*manager, id, 0x0010, 0x0010, "NAME");
+      db.SetIdentifierTag(*manager, id, 0x0010, 0x0020, "ID");
+    }
+  }
+
+  OrthancDatabases::PostgreSQLIndex db(NULL, globalParameters_);
+  db.SetTagsPartitions(4, 2);
+
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
+  PostgreSQLDatabase& pg = dynamic_cast<PostgreSQLDatabase&>(manager->GetDatabase());
+  ASSERT_TRUE(pg.DoesTableExist("TagsPartitioning"));
+  ASSERT_TRUE(pg.DoesTableExist("MainDicomTagsPartitioned"));
+
+  // The writes during the migration are mirrored
+  int64_t a = db.CreateResource(*manager, "a", OrthancPluginResourceType_Patient);
+  db.SetMainDicomTag(*manager, a, 0x0010, 0x0010, "A");
+  db.SetIdentifierTag(*manager, a, 0x0010, 0x0020, "A");
+
+  for (int i = 0; i < 3; i++)  // 2 batches of 2 resources and 1 batch of 1 resource
+  {
+    db.PerformHousekeepingTask(*manager, "TagsPartitioning");
+    ASSERT_TRUE(pg.DoesTableExist("MainDicomTagsPartitioned"));
+  }
+
+  db.PerformHousekeepingTask(*manager, "TagsPartitioning");
+  ASSERT_FALSE(pg.DoesTableExist("MainDicomTagsPartitioned"));
+  ASSERT_FALSE(pg.DoesTableExist("DicomIdentifiersPartitioned"));
+
+  {
+    PostgreSQLStatement statement(pg, "SELECT COUNT(*) FROM pg_class WHERE relkind='p' AND "
+                                  "relname IN ('maindicomtags', 'dicomidentifiers')");
+    PostgreSQLResult result(statement);
+    ASSERT_EQ(2, result.GetInteger64(0));
+  }
+
+  {
+    PostgreSQLStatement statement(pg, "SELECT COUNT(*) FROM MainDicomTags");
+    PostgreSQLResult result(statement);
+    ASSERT_EQ(6, result.GetInteger64(0));
+  }
+
+  {
+    PostgreSQLStatement statement(pg, "SELECT COUNT(*) FROM DicomIdentifiers");
+    PostgreSQLResult result(statement);
+    ASSERT_EQ(6, result.GetInteger64(0));
+  }
+
+  ASSERT_TRUE(pg.DoesIndexExist("DicomIdentifiersIndex4"));
+  ASSERT_FALSE(pg.DoesIndexExist("DicomIdentifiersIndex2"));
+
+  // The deletions go through the "ON DELETE CASCADE" of the partitioned tables
+  std::unique_ptr<OrthancDatabases::IDatabaseBackendOutput> output(db.CreateOutput());
+  db.DeleteResource(*output, *manager, a);
+
+  {
+    PostgreSQLStatement statement(pg, "SELECT COUNT(*) FROM MainDicomTags");
+    PostgreSQLResult result(statement);
+    ASSERT_EQ(5, result.GetInteger64(0));
+  }
 }
+
+
+// Records the signals of the deletions, and ignores the answers
+class DeletionSignalsOutput : public OrthancDatabases::IDatabaseBackendOutput
+{
+private:
+  std::map<std::string, int32_t>                    deletedFiles_;
+  std::map<std::string, OrthancPluginResourceType>  deletedResources_;
+  std::map<std::string, OrthancPluginResourceType>  remainingAncestors_;
+
+public:
+  void Clear()
+  {
+    deletedFiles_.clear();
+    deletedResources_.clear();
+    remainingAncestors_.clear();
+  }
+
+  const std::map<std::string, int32_t>& GetDeletedFiles() const
+  {
+    return deletedFiles_;
+  }
+
+  const std::map<std::string, OrthancPluginResourceType>& GetDeletedResources() const
+  {
+    return deletedResources_;
+  }
+
+  const std::map<std::string, OrthancPluginResourceType>& GetRemainingAncestors() const
+  {
+    return remainingAncestors_;
+  }
+
+  virtual void SignalDeletedAttachment(const std::string& uuid,
+                                       int32_t            contentType,
+                                       uint64_t           uncompressedSize,
+                                       const std::string& uncompressedHash,
+                                       int32_t            compressionType,
+                                       uint64_t           compressedSize,
+                                       const std::string& compressedHash) ORTHANC_OVERRIDE
+  {
+    ASSERT_EQ(uuid + "_md5", uncompressedHash);
+    ASSERT_EQ(uuid + "_md5", compressedHash);
+    ASSERT_EQ(10u, uncompressedSize);
+    ASSERT_EQ(10u, compressedSize);
+    ASSERT_EQ(static_cast<int32_t>(Orthanc::CompressionType_None), compressionType);
+    deletedFiles_[uuid] = contentType;
+  }
+
+  virtual void SignalDeletedResource(const std::string& publicId,
+                                     OrthancPluginResourceType resourceType) ORTHANC_OVERRIDE
+  {
+    deletedResources_[publicId] = resourceType;
+  }
+
+  virtual void SignalRemainingAncestor(const std::string& ancestorId,
+                                       OrthancPluginResourceType ancestorType) ORTHANC_OVERRIDE
+  {
+    remainingAncestors_[ancestorId] = ancestorType;
+  }
+
+  virtual void AnswerAttachment(const std::string& uuid,
+                                int32_t            contentType,
+                                uint64_t           uncompressedSize,
+                                const std::string& uncompressedHash,
+                                int32_t            compressionType,
+                                uint64_t           compressedSize,
+                                const std::string& compressedHash) ORTHANC_OVERRIDE
+  {
+  }
+
+  virtual void AnswerChange(int64_t                    seq,
+                            int32_t                    changeType,
+                            OrthancPluginResourceType  resourceType,
+                            const std::string&         publicId,
+                            const std::string&         date) ORTHANC_OVERRIDE
+  {
+  }
+
+  virtual void AnswerDicomTag(uint16_t group,
+                              uint16_t element,
+                              const std::string& value) ORTHANC_OVERRIDE
+  {
+  }
+
+  virtual void AnswerResourceDicomTag(int64_t resource,
+                                      uint16_t group,
+                                      uint16_t element,
+                                      const std::string& value) ORTHANC_OVERRIDE
+  {
+  }
+
+  virtual void AnswerExportedResource(int64_t                    seq,
+                                      OrthancPluginResourceType  resourceType,
+                                      const std::string&         publicId,
+                                      const std::string&         modality,
+                                      const std::string&         date,
+                                      const std::string&         patientId,
+                                      const std::string&         studyInstanceUid,
+                                      const std::string&         seriesInstanceUid,
+                                      const std::string&         sopInstanceUid) ORTHANC_OVERRIDE
+  {
+  }
+
+#if ORTHANC_PLUGINS_HAS_DATABASE_CONSTRAINT == 1
+  virtual void AnswerMatchingResource(const std::string& resourceId) ORTHANC_OVERRIDE
+  {
+  }
+#endif
+
+#if ORTHANC_PLUGINS_HAS_DATABASE_CONSTRAINT == 1
+  virtual void AnswerMatchingResource(const std::string& resourceId,
+                                      const std::string& someInstanceId) ORTHANC_OVERRIDE
+  {
+  }
 #endif
+};
+
+
+static void AddTestAttachment(OrthancDatabases::PostgreSQLIndex& db,
+                              OrthancDatabases::DatabaseManager& manager,
+                              int64_t id,
+                              const std::string& uuid,
+                              Orthanc::FileContentType type)
+{
+  const std::string hash = uuid + "_md5";
+
+  OrthancPluginAttachment attachment;
+  attachment.uuid = uuid.c_str();
+  attachment.contentType = type;
+  attachment.uncompressedSize = 10;
+  attachment.uncompressedHash = hash.c_str();
+  attachment.compressionType = Orthanc::CompressionType_None;
+  attachment.compressedSize = 10;
+  attachment.compressedHash = hash.c_str();
+  db.AddAttachment(manager, id, attachment, 0);
+}
+
+
+TEST(PostgreSQLIndex, DeletionSignals)
+{
+  OrthancDatabases::PostgreSQLIndex db(NULL, globalParameters_);
+  db.SetClearAll(true);
+
+  std::list<OrthancDatabases::IdentifierTag> tags;
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
+  PostgreSQLDatabase& pg = dynamic_cast<PostgreSQLDatabase&>(manager->GetDatabase());
+
+  // Patient "p" has 2 studies: "s1/r1/i1" and "s2/r2/{i2,i3}"
+  OrthancPluginCreateInstanceResult r1, r2, r3;
+  memset(&r1, 0, sizeof(r1));
+  memset(&r2, 0, sizeof(r2));
+  memset(&r3, 0, sizeof(r3));
+  db.CreateInstance(r1, *manager, "p", "s1", "r1", "i1");
+  db.CreateInstance(r2, *manager, "p", "s2", "r2", "i2");
+  db.CreateInstance(r3, *manager, "p", "s2", "r2", "i3");
+
+  AddTestAttachment(db, *manager, r1.instanceId, "uuid1", Orthanc::FileContentType_Dicom);
+  AddTestAttachment(db, *manager, r2.instanceId, "uuid2", Orthanc::FileContentType_Dicom);
+  AddTestAttachment(db, *manager, r2.instanceId, "uuid3", Orthanc::FileContentType_DicomAsJson);
+  AddTestAttachment(db, *manager, r3.instanceId, "uuid4", Orthanc::FileContentType_Dicom);
+
+  DeletionSignalsOutput output;
+
+  // Only the deleted file is signaled
+  db.DeleteAttachment(output, *manager, r2.instanceId, Orthanc::FileContentType_DicomAsJson);
+  ASSERT_EQ(1u, output.GetDeletedFiles().size());
+  ASSERT_EQ(Orthanc::FileContentType_DicomAsJson, output.GetDeletedFiles().find("uuid3")->second);
+  ASSERT_TRUE(output.GetDeletedResources().empty());
+  ASSERT_TRUE(output.GetRemainingAncestors().empty());
+
+  // The parent series survives, as it has another instance
+  output.Clear();
+  db.DeleteResource(output, *manager, r3.instanceId);
+  ASSERT_EQ(1u, output.GetDeletedFiles().size());
+  ASSERT_EQ(Orthanc::FileContentType_Dicom, output.GetDeletedFiles().find("uuid4")->second);
+  ASSERT_EQ(1u, output.GetDeletedResources().size());
+  ASSERT_EQ(OrthancPluginResourceType_Instance, output.GetDeletedResources().find("i3")->second);
+  ASSERT_EQ(1u, output.GetRemainingAncestors().size());
+  ASSERT_EQ(OrthancPluginResourceType_Series, output.GetRemainingAncestors().find("r2")->second);
+
+  // The bulk deletion cascades to the parents without other child,
+  // and reports the nearest surviving ancestor
+  output.Clear();
+
+  std::list<int64_t> ids;
+  ids.push_back(r1.instanceId);
+
+  std::map<std::string, OrthancPluginResourceType> remainingAncestors;
+  db.DeleteResources(output, remainingAncestors, *manager, ids);
+  ASSERT_EQ(1u, output.GetDeletedFiles().size());
+  ASSERT_TRUE(output.GetDeletedFiles().find("uuid1") != output.GetDeletedFiles().end());
+  ASSERT_EQ(3u, output.GetDeletedResources().size());
+  ASSERT_EQ(OrthancPluginResourceType_Instance, output.GetDeletedResources().find("i1")->second);
+  ASSERT_EQ(OrthancPluginResourceType_Series, output.GetDeletedResources().find("r1")->second);
+  ASSERT_EQ(OrthancPluginResourceType_Study, output.GetDeletedResources().find("s1")->second);
+  ASSERT_TRUE(output.GetRemainingAncestors().empty());
+  ASSERT_EQ(1u, remainingAncestors.size());
+  ASSERT_EQ(OrthancPluginResourceType_Patient, remainingAncestors["p"]);
+
+  // Deleting a whole patient leaves no remaining ancestor
+  output.Clear();
+  db.DeleteResource(output, *manager, r2.patientId);
+  ASSERT_EQ(1u, output.GetDeletedFiles().size());
+  ASSERT_TRUE(output.GetDeletedFiles().find("uuid2") != output.GetDeletedFiles().end());
+  ASSERT_EQ(4u, output.GetDeletedResources().size());
+  ASSERT_TRUE(output.GetRemainingAncestors().empty());
+
+  {
+    // The signals of the deletions are consumed, without any temporary table
+    PostgreSQLStatement statement(pg, "SELECT (SELECT COUNT(*) FROM DeletedResourcesQueue), "
+                                  "(SELECT COUNT(*) FROM DeletedFilesQueue), "
+                                  "(SELECT COUNT(*) FROM pg_class WHERE relpersistence = 't' AND pg_table_is_visible(oid))");
+    PostgreSQLResult result(statement);
+    ASSERT_EQ(0, result.GetInteger64(0));
+    ASSERT_EQ(0, result.GetInteger64(1));
+    ASSERT_EQ(0, result.GetInteger64(2));
+  }
+}
+
+
+TEST(PostgreSQLIndex, BinaryCollation)
+{
+  std::list<OrthancDatabases::IdentifierTag> tags;
+
+  {
+    OrthancDatabases::PostgreSQLIndex db(NULL, globalParameters_);
+    db.SetClearAll(true);
+
+    std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
+    ASSERT_FALSE(db.HasBinaryCollation());
+  }
+
+  {
+    OrthancDatabases::PostgreSQLIndex db(NULL, globalParameters_);
+    db.SetBinaryCollation(true);
+
+    std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
+    ASSERT_TRUE(db.HasBinaryCollation());
+
+    int64_t a = db.CreateResource(*manager, "a", OrthancPluginResourceType_Patient);
+    int64_t b = db.CreateResource(*manager, "b", OrthancPluginResourceType_Patient);
+    db.SetIdentifierTag(*manager, a, 0x0010, 0x0010, "a");
+    db.SetIdentifierTag(*manager, b, 0x0010, 0x0010, "B");
+
+    // The uppercase letters come first in the bytewise order
+    PostgreSQLDatabase& pg = dynamic_cast<PostgreSQLDatabase&>(manager->GetDatabase());
+    PostgreSQLStatement statement(pg, "SELECT value FROM DicomIdentifiers ORDER BY value");
+    PostgreSQLResult result(statement);
+    ASSERT_EQ("B", result.GetString(0));
+    ASSERT_TRUE(pg.DoesIndexExist("DicomIdentifiersIndex4"));
+  }
+
+  {
+    // The column is left unchanged once the option is disabled
+    OrthancDatabases::PostgreSQLIndex db(NULL, globalParameters_);
+
+    std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags));
+    ASSERT_TRUE(db.HasBinaryCollation());
+  }
+
+  {
+    OrthancDatabases::PostgreSQLIndex db(NULL, globalParameters_);
+    db.SetTagsPartitions(4, 100);
+    ASSERT_THROW(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, tags), Orthanc::OrthancException);
+  }
+}
 
 
 TEST(PostgreSQL, Lock2)
@@ -22,6 +22,7 @@
 
 
 #include "../Plugins/PostgreSQLIndex.h"
+#include "../Plugins/PostgreSQLStorageArea.h"
 
 #include <Logging.h>
 #include <Toolbox.h>
@@ -29,6 +30,7 @@
 
 OrthancDatabases::PostgreSQLParameters  globalParameters_;
 
+#include "../../Framework/Plugins/CachesUnitTests.h"
 #include "../../Framework/Plugins/IndexUnitTests.h"
 #include "../../Framework/PostgreSQL/PostgreSQLDatabase.h"
 
@@ -85,6 +87,75 @@ TEST(PostgreSQLParameters, Basic)
 }
 
 
+TEST(PostgreSQLParameters, Hosts)
+{
+  OrthancDatabases::PostgreSQLParameters p;
+  p.SetDatabase("hello");
+  p.SetUsername("user");
+  ASSERT_EQ(1u, p.GetHostsCount());
+
+  std::list<std::string> hosts;
+  hosts.push_back("a");
+  hosts.push_back("b:1234");
+  hosts.push_back("[::1]:5433");
+  hosts.push_back("[::2]");
+  p.SetHosts(hosts);
+  ASSERT_EQ(4u, p.GetHostsCount());
+
+  ASSERT_EQ("postgresql://user@a:5432,b:1234,[::1]:5433,[::2]:5432/hello", p.GetConnectionUri());
+
+  std::string s;
+  p.Format(s);
+  ASSERT_EQ("sslmode=disable user=user host=a,b,::1,::2 port=5432,1234,5433,5432 dbname=hello", s);
+
+  p.SetTargetSessionAttributes("read-write");
+  p.SetLoadBalanceHosts(true);
+  ASSERT_EQ("postgresql://user@a:5432,b:1234,[::1]:5433,[::2]:5432/hello?target_session_attrs=read-write&load_balance_hosts=random",
+            p.GetConnectionUri());
+
+  p.Format(s);
+  ASSERT_EQ("sslmode=disable user=user host=a,b,::1,::2 port=5432,1234,5433,5432 "
+            "target_session_attrs=read-write load_balance_hosts=random dbname=hello", s);
+
+  ASSERT_THROW(p.SetTargetSessionAttributes("nope"), Orthanc::OrthancException);
+  ASSERT_EQ("read-write", p.GetTargetSessionAttributes());
+
+  hosts.push_back("c:nope");
+  ASSERT_THROW(p.SetHosts(hosts), Orthanc::OrthancException);
+  ASSERT_EQ(4u, p.GetHostsCount());
+
+  hosts.clear();
+  hosts.push_back(":1234");
+  ASSERT_THROW(p.SetHosts(hosts), Orthanc::OrthancException);
+
+  p.SetHost("server");
+  ASSERT_EQ(1u, p.GetHostsCount());
+  p.SetLoadBalanceHosts(false);
+  ASSERT_EQ("postgresql://user@server:5432/hello?target_session_attrs=read-write", p.GetConnectionUri());
+}
+
+
+TEST(PostgreSQLParameters, ProtocolCompression)
+{
+  OrthancDatabases::PostgreSQLParameters p;
+  p.SetDatabase("hello");
+  p.SetUsername("user");
+  p.SetProtocolCompression("zstd");
+
+  ASSERT_EQ("postgresql://user@localhost:5432/hello?compression=zstd", p.GetConnectionUri());
+
+  std::string s;
+  p.Format(s);
+  ASSERT_EQ("sslmode=disable user=user host=localhost port=5432 compression=zstd dbname=hello", s);
+
+  p.SetTargetSessionAttributes("read-write");
+  ASSERT_EQ("postgresql://user@localhost:5432/hello?target_session_attrs=read-write&compression=zstd", p.GetConnectionUri());
+
+  p.SetProtocolCompression("");
+  ASSERT_EQ("postgresql://user@localhost:5432/hello?target_session_attrs=read-write", p.GetConnectionUri());
+}
+
+
 TEST(PostgreSQLIndex, Lock)
 {
   OrthancDatabases::PostgreSQLParameters noLock = globalParameters_;
@@ -112,6 +183,23 @@ TEST(PostgreSQLIndex, Lock)
 }
 
 
+#if ORTHANC_PLUGINS_HAS_DATABASE_CONSTRAINT == 1
+/**
+ * Throughput of the storage area (cf. "RunStorageBenchmark()"), in
+ * large objects, or inline below "ORTHANC_STORAGE_BENCHMARK_INLINE"
+ * bytes (0 by default). WARNING: The database is cleared. Run it with:
+ *
+ *   ./UnitTests <arguments> --gtest_also_run_disabled_tests --gtest_filter=PostgreSQL.DISABLED_StorageBenchmark
+ **/
+TEST(PostgreSQL, DISABLED_StorageBenchmark)
+{
+  OrthancDatabases::PostgreSQLStorageArea storageArea(globalParameters_, true /* clear database */);
+  storageArea.SetInlineThreshold(GetBenchmarkParameter("ORTHANC_STORAGE_BENCHMARK_INLINE", 0));
+  RunStorageBenchmark(storageArea, "PostgreSQL");
+}
+#endif
+
+
 int main(int argc, char **argv)
 {
   if (argc < 6)
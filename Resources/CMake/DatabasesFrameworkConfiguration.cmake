@@ -26,6 +26,7 @@
 
 if (ENABLE_SQLITE_BACKEND)
   set(ENABLE_SQLITE ON)
+  set(ENABLE_ZLIB ON)        # For the compression of the storage area
 endif()
 
 if (ENABLE_POSTGRESQL_BACKEND)
@@ -44,6 +45,7 @@ if (ENABLE_MYSQL_BACKEND)
 endif()
 
 if (ENABLE_ODBC_BACKEND)
+  set(ENABLE_ZLIB ON)        # For the compression of the storage area
 endif()
   
 
@@ -122,6 +124,7 @@ set(DATABASES_SOURCES
   ${ORTHANC_DATABASES_ROOT}/Framework/Common/RetryDatabaseFactory.cpp
   ${ORTHANC_DATABASES_ROOT}/Framework/Common/RetryDatabaseFactory.cpp
   ${ORTHANC_DATABASES_ROOT}/Framework/Common/StatementId.cpp
+  ${ORTHANC_DATABASES_ROOT}/Framework/Common/StatementsWarmup.cpp
   ${ORTHANC_DATABASES_ROOT}/Framework/Common/Utf8StringValue.cpp
   )
 
@@ -170,10 +173,13 @@ if (ENABLE_POSTGRESQL_BACKEND)
   include(${CMAKE_CURRENT_LIST_DIR}/PostgreSQLConfiguration.cmake)
   add_definitions(-DORTHANC_ENABLE_POSTGRESQL=1)
   list(APPEND DATABASES_SOURCES
+    ${ORTHANC_DATABASES_ROOT}/Framework/PostgreSQL/PostgreSQLAsyncQueries.cpp
+    ${ORTHANC_DATABASES_ROOT}/Framework/PostgreSQL/PostgreSQLCopy.cpp
     ${ORTHANC_DATABASES_ROOT}/Framework/PostgreSQL/PostgreSQLDatabase.cpp
     ${ORTHANC_DATABASES_ROOT}/Framework/PostgreSQL/PostgreSQLLargeObject.cpp
     ${ORTHANC_DATABASES_ROOT}/Framework/PostgreSQL/PostgreSQLParameters.cpp
     ${ORTHANC_DATABASES_ROOT}/Framework/PostgreSQL/PostgreSQLResult.cpp
+    ${ORTHANC_DATABASES_ROOT}/Framework/PostgreSQL/PostgreSQLSlowStatementsExplainer.cpp
     ${ORTHANC_DATABASES_ROOT}/Framework/PostgreSQL/PostgreSQLStatement.cpp
     ${ORTHANC_DATABASES_ROOT}/Framework/PostgreSQL/PostgreSQLTransaction.cpp
     ${LIBPQ_SOURCES}
@@ -109,14 +109,40 @@ endif()
 
 list(APPEND DATABASES_SOURCES
   ${ORTHANC_CORE_SOURCES}
+  ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/AdmissionController.cpp
+  ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/AnalyticsExport.cpp
+  ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/AttachmentCache.cpp
+  ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/CacheInvalidations.cpp
+  ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/CountResourcesCache.cpp
   ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/DatabaseBackendAdapterV2.cpp
   ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/DatabaseBackendAdapterV3.cpp
   ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/DatabaseBackendAdapterV4.cpp
   ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/DatabaseConstraint.cpp
+  ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/DeferredWrites.cpp
+  ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/FilesystemStorage.cpp
+  ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/FindProjectionsCache.cpp
+  ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/FindResultsCache.cpp
+  ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/GlobalPropertiesCache.cpp
+  ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/HiddenResources.cpp
+  ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/HousekeepingScheduler.cpp
   ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/ISqlLookupFormatter.cpp
+  ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/IndexAdvisor.cpp
   ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/IndexBackend.cpp
   ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/IndexConnectionsPool.cpp
+  ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/IndexShards.cpp
+  ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/IngestStatistics.cpp
+  ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/KeysetPaginationCache.cpp
+  ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/LabelsCache.cpp
   ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/MessagesToolbox.cpp
+  ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/OperationsStatistics.cpp
+  ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/PrefetchedResources.cpp
+  ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/RequestsRecorder.cpp
+  ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/ResourcesLookupCache.cpp
+  ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/RetryPolicy.cpp
+  ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/StatisticsCache.cpp
   ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/StorageBackend.cpp
+  ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/StorageCompression.cpp
+  ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/StudyColumnStore.cpp
+  ${ORTHANC_DATABASES_ROOT}/Framework/Plugins/TracesExporter.cpp
   ${ORTHANC_DATABASES_ROOT}/Resources/Orthanc/Plugins/OrthancPluginCppWrapper.cpp
   )
@@ -24,6 +24,7 @@
 #include "SQLiteIndex.h"
 #include "../../Framework/Plugins/PluginInitialization.h"
 
+#include <Compatibility.h>  // For std::unique_ptr<>
 #include <Logging.h>
 
 #include <google/protobuf/any.h>
@@ -66,11 +67,83 @@ extern "C"
 
     try
     {
+      std::unique_ptr<OrthancDatabases::SQLiteIndex> index(
+        new OrthancDatabases::SQLiteIndex(context, "index.db"));   // TODO parameter
+
+      OrthancPlugins::OrthancConfiguration configuration;
+      unsigned int housekeepingDelaySeconds = 5;
+
+      if (configuration.IsSection("SQLite"))
+      {
+        OrthancPlugins::OrthancConfiguration sqlite;
+        configuration.GetSection(sqlite, "SQLite");
+
+        // Number of read-only connections that run the lookups
+        // concurrently with the writer (0 for exclusive locking)
+        index->SetReadConnectionsCount(sqlite.GetUnsignedIntegerValue("ReadConnectionsCount", 0));
+
+        index->SetMmapSize(static_cast<uint64_t>(sqlite.GetUnsignedIntegerValue("MmapSize", 0)) * 1024 * 1024);  // In MB
+        index->SetCacheSize(sqlite.GetUnsignedIntegerValue("CacheSize", 0) * 1024);  // In MB
+        index->SetTempStoreMemory(sqlite.GetBooleanValue("TempStoreMemory", false));
+        index->SetWalAutoCheckpoint(sqlite.GetUnsignedIntegerValue("WalAutoCheckpoint", 1000));
+        index->SetCheckpointInterval(sqlite.GetUnsignedIntegerValue("CheckpointInterval", 0));
+        index->SetIncrementalVacuum(sqlite.GetUnsignedIntegerValue("IncrementalVacuumInterval", 0),
+                                    sqlite.GetUnsignedIntegerValue("IncrementalVacuumPages", 1000));
+        index->SetOptimizeInterval(sqlite.GetUnsignedIntegerValue("OptimizeInterval", 0));
+        index->SetTagsValuesIndex(sqlite.GetBooleanValue("EnableTagsValuesIndex", false));
+        index->SetLastUpdateIndex(sqlite.GetBooleanValue("EnableLastUpdateIndex", false));
+        index->SetIngestStatistics(sqlite.GetBooleanValue("EnableIngestStatistics", false));
+        index->SetChunkedDeletionBatchSize(sqlite.GetUnsignedIntegerValue("ChunkedDeletionBatchSize", 0));
+        index->SetIndexAdvisor(sqlite.GetBooleanValue("EnableIndexAdvisor", false));
+        index->SetMaxResponseSize(static_cast<uint64_t>(sqlite.GetUnsignedIntegerValue("MaxResponseSize", 0)) * 1024 * 1024);  // In MB
+        index->SetExportedResourcesRetention(sqlite.GetUnsignedIntegerValue("ExportedResourcesRetentionDays", 0),
+                                             sqlite.GetUnsignedIntegerValue("ExportedResourcesRetentionBatchSize", 10000));
+        index->SetAnalyticsExport(sqlite.GetStringValue("AnalyticsExportDirectory", ""),
+                                  sqlite.GetUnsignedIntegerValue("AnalyticsExportBatchSize", 10000));
+        index->SetHousekeepingInterval("AnalyticsExport", sqlite.GetUnsignedIntegerValue("AnalyticsExportInterval", 60));
+        index->SetHousekeepingInterval("DatabaseMetrics", sqlite.GetUnsignedIntegerValue("DatabaseMetricsInterval", 0));
+
+        // Initial import, that can also be started and stopped through "/index/bulk-load"
+        index->SetBulkLoadSettings(sqlite.GetUnsignedIntegerValue("BulkLoadBatchSize", 1000),
+                                   sqlite.GetUnsignedIntegerValue("BulkLoadMaxDelay", 10),
+                                   sqlite.GetBooleanValue("BulkLoad", false));
+
+        if (sqlite.IsSection("Replica"))
+        {
+          // Local copy of the index of another Orthanc server, that
+          // only serves the reads of this read-only Orthanc server
+          if (!configuration.GetBooleanValue("ReadOnly", false))
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                            "The local replica of the SQLite index requires \"ReadOnly\" to be \"true\"");
+          }
+
+          OrthancPlugins::OrthancConfiguration replica;
+          sqlite.GetSection(replica, "Replica");
+
+          std::string url;
+          if (!replica.LookupStringValue(url, "Url"))
+          {
+            throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                            "Missing \"Url\" in the \"Replica\" section of the SQLite index");
+          }
+
+          index->SetReplicaSource(url, replica.GetStringValue("Username", ""), replica.GetStringValue("Password", ""),
+                                  replica.GetUnsignedIntegerValue("BatchSize", 1000));
+          index->SetHousekeepingInterval("Replica", replica.GetUnsignedIntegerValue("SyncInterval", 5));
+
+          LOG(WARNING) << "The SQLite index is a local replica of the index of: " << url;
+        }
+
+        housekeepingDelaySeconds = sqlite.GetUnsignedIntegerValue("HousekeepingInterval", housekeepingDelaySeconds);
+      }
+
       /* Register the SQLite index into Orthanc */
       OrthancDatabases::IndexBackend::Register(
-        new OrthancDatabases::SQLiteIndex(context, "index.db"),   // TODO parameter
-        1 /* only 1 connection is possible with SQLite */,
-        0 /* no collision is possible, as SQLite has a global lock */);
+        index.release(),
+        1 /* only 1 writer connection is possible with SQLite */,
+        0 /* no collision is possible, as SQLite has a global write lock */,
+        housekeepingDelaySeconds);
     }
     catch (Orthanc::OrthancException& e)
     {
@@ -72,7 +72,9 @@ CREATE TABLE PatientRecyclingOrder(
        patientId INTEGER REFERENCES Resources(internalId) ON DELETE CASCADE
        );
 
-CREATE INDEX ChildrenIndex ON Resources(parentId);
+-- Covering index for the listings of the children: The entries of
+-- an index also contain the rowid, i.e. "internalId"
+CREATE INDEX ChildrenIndex2 ON Resources(parentId, publicId);
 CREATE INDEX PublicIndex ON Resources(publicId);
 CREATE INDEX ResourceTypeIndex ON Resources(resourceType);
 CREATE INDEX PatientRecyclingIndex ON PatientRecyclingOrder(patientId);
@@ -88,6 +90,7 @@ CREATE INDEX DicomIdentifiersIndex2 ON DicomIdentifiers(tagGroup, tagElement);
 CREATE INDEX DicomIdentifiersIndexValues ON DicomIdentifiers(value COLLATE BINARY);
 
 CREATE INDEX ChangesIndex ON Changes(internalId);
+CREATE INDEX ChangesIndex2 ON Changes(changeType, seq);
 
 
 
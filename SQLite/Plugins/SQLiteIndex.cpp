@@ -27,62 +27,589 @@
 #include "../../Framework/Plugins/GlobalProperties.h"
 #include "../../Framework/SQLite/SQLiteDatabase.h"
 #include "../../Framework/SQLite/SQLiteTransaction.h"
+#include "../../Resources/Orthanc/Plugins/OrthancPluginCppWrapper.h"
 
 #include <EmbeddedResources.h>  // Auto-generated file
 
 #include <Compatibility.h>  // For std::unique_ptr<>
 #include <Logging.h>
 #include <OrthancException.h>
+#include <SQLite/Statement.h>
+#include <Toolbox.h>
+
+#include <boost/lexical_cast.hpp>
 
 namespace OrthancDatabases
 {
-  IDatabaseFactory* SQLiteIndex::CreateDatabaseFactory()
+  // State of the synchronization of the local replica (cf. "SetReplicaSource()")
+  static const Orthanc::GlobalProperty GlobalProperty_ReplicaBootstrap = Orthanc::GlobalProperty_DatabaseInternal0;  // Next internal ID, or "done"
+  static const Orthanc::GlobalProperty GlobalProperty_ReplicaLastChange = Orthanc::GlobalProperty_DatabaseInternal1;
+  static const Orthanc::GlobalProperty GlobalProperty_ReplicaSweep = Orthanc::GlobalProperty_DatabaseInternal2;
+
+  // Definitions of the indexes that are dropped by the bulk-load mode, as a JSON object
+  static const Orthanc::GlobalProperty GlobalProperty_BulkLoadIndexes = Orthanc::GlobalProperty_DatabaseInternal3;
+
+  // Secondary indexes that are not used while ingesting instances,
+  // which are dropped by the bulk-load mode
+  static const char* const DEFERRED_INDEXES[] = {
+    "ResourceTypeIndex",
+    "DicomIdentifiersIndex2",
+    "DicomIdentifiersIndexValues",
+    "DicomIdentifiersIndexValues2",
+    "MainDicomTagsIndexValues2",
+    "ChangesIndex2",
+    "LabelsIndex2"
+  };
+
+
+  static void ApplyBulkLoadSettings(SQLiteDatabase& db,
+                                   unsigned int batchSize,
+                                   unsigned int maxDelay)
+  {
+    // The bulk-load mode requires the database to be exclusively
+    // locked, so there is no reader that requires WAL mode. "OFF" is
+    // not used, as the Orthanc core must still be able to roll back
+    // its transactions.
+    db.Execute("PRAGMA SYNCHRONOUS=OFF;");
+    db.Execute("PRAGMA JOURNAL_MODE=MEMORY;");
+    db.SetBatchSize(batchSize);
+    db.SetBatchMaxDuration(maxDelay);
+  }
+
+  // Bounds the duration of one run of the housekeeping, the next run goes on
+  static const unsigned int MAX_REPLICA_PAGES_PER_RUN = 100;
+
+  class SQLiteIndex::Factory : public IDatabaseFactory
   {
-    class Factory : public IDatabaseFactory
+  private:
+    const SQLiteIndex&  index_;
+    std::string   path_;
+    bool          fast_;
+    bool          exclusive_;
+    bool          readOnly_;
+    uint64_t      mmapSize_;
+    unsigned int  cacheSize_;
+    bool          tempStoreMemory_;
+    unsigned int  walAutoCheckpoint_;
+      
+  public:
+    Factory(const SQLiteIndex& index,
+            bool exclusive,
+            bool readOnly) :
+      index_(index),
+      path_(index.path_),
+      fast_(index.fast_),
+      exclusive_(exclusive),
+      readOnly_(readOnly),
+      mmapSize_(index.mmapSize_),
+      cacheSize_(index.cacheSize_),
+      tempStoreMemory_(index.tempStoreMemory_),
+      walAutoCheckpoint_(index.walAutoCheckpoint_)
     {
-    private:
-      std::string  path_;
-      bool         fast_;
+    }
       
-    public:
-      Factory(const std::string& path,
-              bool fast) :
-        path_(path),
-        fast_(fast)
+    virtual IDatabase* Open() ORTHANC_OVERRIDE
+    {
+      std::unique_ptr<SQLiteDatabase> db(new SQLiteDatabase);
+
+      if (path_.empty())
       {
+        db->OpenInMemory();
       }
-      
-      virtual IDatabase* Open() ORTHANC_OVERRIDE
+      else
+      {
+        db->Open(path_);
+      }
+
+      db->Execute("PRAGMA ENCODING=\"UTF-8\";");
+
+      if (fast_)
+      {
+        // Performance tuning of SQLite with PRAGMAs
+        // http://www.sqlite.org/pragma.html
+        db->Execute("PRAGMA SYNCHRONOUS=NORMAL;");
+        db->Execute("PRAGMA JOURNAL_MODE=WAL;");
+
+        if (exclusive_)
+        {
+          db->Execute("PRAGMA LOCKING_MODE=EXCLUSIVE;");
+        }
+
+        db->Execute("PRAGMA WAL_AUTOCHECKPOINT=" + boost::lexical_cast<std::string>(walAutoCheckpoint_) + ";");
+      }
+      else if (!exclusive_)
+      {
+        // The readers can only run concurrently with the writer in WAL mode
+        db->Execute("PRAGMA JOURNAL_MODE=WAL;");
+      }
+
+      if (!exclusive_)
+      {
+        // Wait for the locks that are briefly taken by the other
+        // connections (e.g. during the checkpoints)
+        db->Execute("PRAGMA BUSY_TIMEOUT=10000;");
+      }
+
+      if (mmapSize_ != 0)
+      {
+        // Memory-mapped I/O for the reads of the database file
+        db->Execute("PRAGMA MMAP_SIZE=" + boost::lexical_cast<std::string>(mmapSize_) + ";");
+      }
+
+      if (cacheSize_ != 0)
+      {
+        // A negative value is the size of the page cache in KiB
+        db->Execute("PRAGMA CACHE_SIZE=-" + boost::lexical_cast<std::string>(cacheSize_) + ";");
+      }
+
+      if (tempStoreMemory_)
+      {
+        db->Execute("PRAGMA TEMP_STORE=MEMORY;");
+      }
+
+      if (readOnly_)
+      {
+        db->Execute("PRAGMA QUERY_ONLY=1;");
+      }
+      else if (index_.IsBulkLoad())
+      {
+        // The connection is reopened while in bulk-load mode
+        ApplyBulkLoadSettings(*db, index_.bulkLoadBatchSize_, index_.bulkLoadMaxDelay_);
+      }
+
+      return db.release();
+    }
+  };
+
+
+  IDatabaseFactory* SQLiteIndex::CreateDatabaseFactory()
+  {
+    return new Factory(*this, readConnectionsCount_ == 0 /* exclusive */, false /* read-write */);
+  }
+
+
+  void SQLiteIndex::SetReadConnectionsCount(size_t count)
+  {
+    if (count != 0 &&
+        path_.empty())
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange,
+                                      "Read-only connections are not available for an in-memory SQLite database");
+    }
+
+    readConnectionsCount_ = count;
+  }
+
+
+  void SQLiteIndex::SetReplicaSource(const std::string& url,
+                                     const std::string& username,
+                                     const std::string& password,
+                                     unsigned int batchSize)
+  {
+    if (batchSize == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    replicaUrl_ = url;
+
+    while (!replicaUrl_.empty() &&
+           replicaUrl_[replicaUrl_.size() - 1] == '/')
+    {
+      replicaUrl_.resize(replicaUrl_.size() - 1);
+    }
+
+    replicaUsername_ = username;
+    replicaPassword_ = password;
+    replicaBatchSize_ = batchSize;
+  }
+
+
+  void SQLiteIndex::SetIncrementalVacuum(unsigned int intervalSeconds,
+                                         unsigned int pages)
+  {
+    if (pages == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    vacuumInterval_ = intervalSeconds;
+    vacuumPages_ = pages;
+  }
+
+
+  void SQLiteIndex::SetBulkLoadSettings(unsigned int batchSize,
+                                        unsigned int maxDelay,
+                                        bool atStartup)
+  {
+    if (batchSize == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_ParameterOutOfRange);
+    }
+
+    bulkLoadBatchSize_ = batchSize;
+    bulkLoadMaxDelay_ = maxDelay;
+    bulkLoadAtStartup_ = atStartup;
+  }
+
+
+  bool SQLiteIndex::IsBulkLoad() const
+  {
+    boost::mutex::scoped_lock lock(bulkLoadMutex_);
+    return bulkLoad_;
+  }
+
+
+  void SQLiteIndex::RestoreDeferredIndexes(DatabaseManager& manager)
+  {
+    DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+
+    std::string s;
+    Json::Value indexes;
+    if (LookupGlobalProperty(s, manager, MISSING_SERVER_IDENTIFIER, GlobalProperty_BulkLoadIndexes) &&
+        !s.empty())
+    {
+      if (!Orthanc::Toolbox::ReadJson(indexes, s) ||
+          indexes.type() != Json::objectValue)
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_CorruptedFile,
+                                        "Bad definitions of the indexes dropped by the bulk-load mode");
+      }
+
+      const Json::Value::Members names = indexes.getMemberNames();
+      for (size_t i = 0; i < names.size(); i++)
+      {
+        // The index might have been recreated by "ConfigureDatabase()",
+        // or disabled in the meantime (cf. "SetTagsValuesIndex()" and
+        // "SetLastUpdateIndex()")
+        if (!t.GetDatabaseTransaction().DoesIndexExist(names[i]) &&
+            (tagsValuesIndex_ ||
+             (names[i] != "MainDicomTagsIndexValues2" &&
+              names[i] != "DicomIdentifiersIndexValues2")) &&
+            (lastUpdateIndex_ ||
+             names[i] != "MetadataLastUpdateIndex"))
+        {
+          LOG(WARNING) << "Recreating the index that was dropped by the bulk-load mode: " << names[i];
+          t.GetDatabaseTransaction().ExecuteMultiLines(indexes[names[i]].asString());
+        }
+      }
+
+      SetGlobalProperty(manager, MISSING_SERVER_IDENTIFIER, GlobalProperty_BulkLoadIndexes, "");
+    }
+
+    t.Commit();
+  }
+
+
+  void SQLiteIndex::SetBulkLoad(DatabaseManager& manager,
+                                bool enabled)
+  {
+    if (IsBulkLoad() == enabled)
+    {
+      return;
+    }
+
+    if (enabled &&
+        readConnectionsCount_ != 0)
+    {
+      // The uncommitted batch would be hidden from the read-only
+      // connections, that would not see the writes of this server
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls,
+                                      "The bulk-load mode of the SQLite index requires \"ReadConnectionsCount\" to be zero");
+    }
+
+    SQLiteDatabase& db = dynamic_cast<SQLiteDatabase&>(manager.GetDatabase());
+    const bool exclusive = (readConnectionsCount_ == 0);
+
+    if (enabled)
+    {
+      LOG(WARNING) << "Entering the bulk-load mode of the SQLite index, the last "
+                   << bulkLoadBatchSize_ << " transactions are lost if Orthanc stops abruptly";
+
       {
-        std::unique_ptr<SQLiteDatabase> db(new SQLiteDatabase);
+        DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
 
-        if (path_.empty())
+        // The definitions are stored before dropping the indexes, so
+        // that they are recreated at the next start if Orthanc stops.
+        // They are merged with the indexes that are still dropped by
+        // the previous execution, if it stopped in bulk-load mode.
+        std::string previous;
+        Json::Value indexes;
+        if (!LookupGlobalProperty(previous, manager, MISSING_SERVER_IDENTIFIER, GlobalProperty_BulkLoadIndexes) ||
+            !Orthanc::Toolbox::ReadJson(indexes, previous) ||
+            indexes.type() != Json::objectValue)
         {
-          db->OpenInMemory();
+          indexes = Json::objectValue;
         }
-        else
+
+        for (size_t i = 0; i < sizeof(DEFERRED_INDEXES) / sizeof(DEFERRED_INDEXES[0]); i++)
         {
-          db->Open(path_);
+          DatabaseManager::CachedStatement statement(
+            STATEMENT_FROM_HERE, manager,
+            "SELECT sql FROM sqlite_master WHERE type='index' AND name=${name}");
+
+          statement.SetReadOnly(true);
+          statement.SetParameterType("name", ValueType_Utf8String);
+
+          Dictionary args;
+          args.SetUtf8Value("name", DEFERRED_INDEXES[i]);
+          statement.Execute(args);
+
+          if (!statement.IsDone() &&
+              !statement.IsNull(0))
+          {
+            indexes[DEFERRED_INDEXES[i]] = statement.ReadString(0);
+          }
         }
 
-        db->Execute("PRAGMA ENCODING=\"UTF-8\";");
+        std::string s;
+        Orthanc::Toolbox::WriteFastJson(s, indexes);
+        SetGlobalProperty(manager, MISSING_SERVER_IDENTIFIER, GlobalProperty_BulkLoadIndexes, s.c_str());
 
-        if (fast_)
+        const Json::Value::Members names = indexes.getMemberNames();
+        for (size_t i = 0; i < names.size(); i++)
         {
-          // Performance tuning of SQLite with PRAGMAs
-          // http://www.sqlite.org/pragma.html
-          db->Execute("PRAGMA SYNCHRONOUS=NORMAL;");
-          db->Execute("PRAGMA JOURNAL_MODE=WAL;");
-          db->Execute("PRAGMA LOCKING_MODE=EXCLUSIVE;");
-          db->Execute("PRAGMA WAL_AUTOCHECKPOINT=1000;");
-          //db->Execute("PRAGMA TEMP_STORE=memory");
+          t.GetDatabaseTransaction().ExecuteMultiLines("DROP INDEX IF EXISTS " + names[i]);
         }
 
-        return db.release();
+        t.Commit();
       }
-    };
 
-    return new Factory(path_, fast_);
+      ApplyBulkLoadSettings(db, bulkLoadBatchSize_, bulkLoadMaxDelay_);
+
+      boost::mutex::scoped_lock lock(bulkLoadMutex_);
+      bulkLoad_ = true;
+    }
+    else
+    {
+      LOG(WARNING) << "Leaving the bulk-load mode of the SQLite index";
+
+      // Commits the last batch
+      db.SetBatchSize(0);
+
+      {
+        boost::mutex::scoped_lock lock(bulkLoadMutex_);
+        bulkLoad_ = false;
+      }
+
+      // Same settings as "Factory::Open()"
+      if (fast_)
+      {
+        db.Execute("PRAGMA SYNCHRONOUS=NORMAL;");
+        db.Execute("PRAGMA JOURNAL_MODE=WAL;");
+      }
+      else
+      {
+        db.Execute("PRAGMA SYNCHRONOUS=FULL;");
+        db.Execute(exclusive ? "PRAGMA JOURNAL_MODE=DELETE;" : "PRAGMA JOURNAL_MODE=WAL;");
+      }
+
+      RestoreDeferredIndexes(manager);
+
+      // Statistics of the new content of the tables for the query planner
+      db.Execute("ANALYZE;");
+    }
+  }
+
+
+  void SQLiteIndex::StoreReplicaResource(DatabaseManager& manager,
+                                         const Json::Value& resource)
+  {
+    const int64_t id = resource["ID"].asInt64();
+    const std::string publicId = resource["PublicID"].asString();
+
+    Dictionary args;
+    args.SetIntegerValue("id", id);
+    args.SetIntegerValue("type", resource["Type"].asInt());
+    args.SetUtf8Value("public", publicId);
+
+    if (resource["Parent"].isNull())
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "INSERT OR IGNORE INTO Resources VALUES(${id}, ${type}, ${public}, NULL)");
+
+      statement.SetParameterType("id", ValueType_Integer64);
+      statement.SetParameterType("type", ValueType_Integer64);
+      statement.SetParameterType("public", ValueType_Utf8String);
+      statement.ExecuteWithoutResult(args);
+    }
+    else
+    {
+      // The resources whose parent is not known yet are skipped
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "INSERT OR IGNORE INTO Resources SELECT ${id}, ${type}, ${public}, ${parent} "
+        "WHERE EXISTS (SELECT 1 FROM Resources WHERE internalId = ${parent})");
+
+      args.SetIntegerValue("parent", resource["Parent"].asInt64());
+
+      statement.SetParameterType("id", ValueType_Integer64);
+      statement.SetParameterType("type", ValueType_Integer64);
+      statement.SetParameterType("public", ValueType_Utf8String);
+      statement.SetParameterType("parent", ValueType_Integer64);
+      statement.ExecuteWithoutResult(args);
+    }
+
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, manager,
+        "SELECT publicId FROM Resources WHERE internalId = ${id}");
+
+      statement.SetReadOnly(true);
+      statement.SetParameterType("id", ValueType_Integer64);
+
+      Dictionary args;
+      args.SetIntegerValue("id", id);
+      statement.Execute(args);
+
+      if (statement.IsDone() ||
+          statement.ReadString(0) != publicId)
+      {
+        return;
+      }
+    }
+
+    static const char* const TABLES[] = { "MainDicomTags", "DicomIdentifiers", "Metadata", "AttachedFiles", "Labels" };
+
+    for (size_t i = 0; i < sizeof(TABLES) / sizeof(TABLES[0]); i++)
+    {
+      const std::string sql = "DELETE FROM " + std::string(TABLES[i]) + " WHERE id = ${id}";
+      DatabaseManager::CachedStatement statement(STATEMENT_FROM_HERE_DYNAMIC(sql), manager, sql);
+      statement.SetParameterType("id", ValueType_Integer64);
+
+      Dictionary args;
+      args.SetIntegerValue("id", id);
+      statement.ExecuteWithoutResult(args);
+    }
+
+    const Json::Value& tags = resource["Tags"];
+    for (Json::ArrayIndex i = 0; i < tags.size(); i++)
+    {
+      SetMainDicomTag(manager, id, static_cast<uint16_t>(tags[i][0].asUInt()),
+                      static_cast<uint16_t>(tags[i][1].asUInt()), tags[i][2].asCString());
+    }
+
+    const Json::Value& identifiers = resource["Identifiers"];
+    for (Json::ArrayIndex i = 0; i < identifiers.size(); i++)
+    {
+      SetIdentifierTag(manager, id, static_cast<uint16_t>(identifiers[i][0].asUInt()),
+                       static_cast<uint16_t>(identifiers[i][1].asUInt()), identifiers[i][2].asCString());
+    }
+
+    const Json::Value& metadata = resource["Metadata"];
+    for (Json::ArrayIndex i = 0; i < metadata.size(); i++)
+    {
+      SetMetadata(manager, id, metadata[i][0].asInt(), metadata[i][1].asCString(), metadata[i][2].asInt64());
+    }
+
+    const Json::Value& attachments = resource["Attachments"];
+    for (Json::ArrayIndex i = 0; i < attachments.size(); i++)
+    {
+      const std::string uuid = attachments[i]["UUID"].asString();
+      const std::string uncompressedHash = attachments[i]["UncompressedHash"].asString();
+      const std::string compressedHash = attachments[i]["CompressedHash"].asString();
+
+      OrthancPluginAttachment attachment;
+      attachment.uuid = uuid.c_str();
+      attachment.contentType = attachments[i]["Type"].asInt();
+      attachment.uncompressedSize = attachments[i]["UncompressedSize"].asUInt64();
+      attachment.uncompressedHash = uncompressedHash.c_str();
+      attachment.compressionType = attachments[i]["CompressionType"].asInt();
+      attachment.compressedSize = attachments[i]["CompressedSize"].asUInt64();
+      attachment.compressedHash = compressedHash.c_str();
+
+      AddAttachment(manager, id, attachment, attachments[i]["Revision"].asInt64());
+    }
+
+    const Json::Value& labels = resource["Labels"];
+    for (Json::ArrayIndex i = 0; i < labels.size(); i++)
+    {
+      AddLabel(manager, id, labels[i].asString());
+    }
+  }
+
+
+  void SQLiteIndex::ApplyReplicaPage(DatabaseManager& manager,
+                                     const Json::Value& page,
+                                     bool removeMissing,
+                                     int64_t since)
+  {
+    if (page.type() != Json::objectValue ||
+        !page.isMember("Resources") ||
+        !page.isMember("Next") ||
+        !page.isMember("Done") ||
+        page["Resources"].type() != Json::arrayValue)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol, "Bad page of the remote index");
+    }
+
+    const Json::Value& resources = page["Resources"];
+
+    for (Json::ArrayIndex i = 0; i < resources.size(); i++)
+    {
+      StoreReplicaResource(manager, resources[i]);
+    }
+
+    if (removeMissing)
+    {
+      std::string sql = "DELETE FROM Resources WHERE internalId > ${since}";
+
+      if (!page["Done"].asBool())
+      {
+        sql += " AND internalId <= ${next}";
+      }
+
+      if (resources.size() > 0)
+      {
+        sql += " AND internalId NOT IN (";
+
+        for (Json::ArrayIndex i = 0; i < resources.size(); i++)
+        {
+          if (i > 0)
+          {
+            sql += ",";
+          }
+
+          sql += boost::lexical_cast<std::string>(resources[i]["ID"].asInt64());
+        }
+
+        sql += ")";
+      }
+
+      DatabaseManager::StandaloneStatement statement(manager, sql);
+      statement.SetParameterType("since", ValueType_Integer64);
+
+      Dictionary args;
+      args.SetIntegerValue("since", since);
+
+      if (!page["Done"].asBool())
+      {
+        statement.SetParameterType("next", ValueType_Integer64);
+        args.SetIntegerValue("next", page["Next"].asInt64());
+      }
+
+      statement.Execute(args);
+    }
+
+    // The storage area is shared with the remote server: The files
+    // that are dropped by the triggers must not be removed
+    ClearDeletedFiles(manager);
+    ClearDeletedResources(manager);
+    ClearRemainingAncestor(manager);
+  }
+
+
+  IDatabaseFactory* SQLiteIndex::CreateReplicaDatabaseFactory()
+  {
+    if (readConnectionsCount_ == 0)
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_BadSequenceOfCalls, "No read-only connection is configured");
+    }
+    else
+    {
+      return new Factory(*this, false /* shared */, true /* read-only */);
+    }
   }
 
 
@@ -106,6 +633,30 @@ namespace OrthancDatabases
       throw Orthanc::OrthancException(Orthanc::ErrorCode_Plugin);
     }
 
+    if (vacuumInterval_ != 0)
+    {
+      SQLiteDatabase& db = dynamic_cast<SQLiteDatabase&>(manager.GetDatabase());
+
+      Orthanc::SQLite::Statement statement(db.GetObject(), "PRAGMA AUTO_VACUUM");
+      if (!statement.Step())
+      {
+        throw Orthanc::OrthancException(Orthanc::ErrorCode_Database);
+      }
+
+      if (statement.ColumnInt(0) != 2 /* incremental */)
+      {
+        // The mode of a new database is set before its tables are
+        // created, the existing databases must be rebuilt once
+        db.Execute("PRAGMA AUTO_VACUUM=INCREMENTAL;");
+
+        if (db.GetObject().DoesTableExist("Resources"))
+        {
+          LOG(WARNING) << "Switching the SQLite index to incremental vacuum, this can take some time";
+          db.Execute("VACUUM;");
+        }
+      }
+    }
+
     {
       DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
 
@@ -186,6 +737,88 @@ namespace OrthancDatabases
 
       t.Commit();
     }    
+
+    {
+      DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+
+      // "ChildrenIndex2" replaces "ChildrenIndex", so that the
+      // children are listed and counted by an index-only scan
+      if (!t.GetDatabaseTransaction().DoesIndexExist("ChildrenIndex2"))
+      {
+        t.GetDatabaseTransaction().ExecuteMultiLines(
+          "CREATE INDEX ChildrenIndex2 ON Resources(parentId, publicId);"
+          "DROP INDEX IF EXISTS ChildrenIndex;");
+      }
+
+      // Composite index for the change feeds that are filtered by
+      // change type (cf. "IndexBackend::GetChangesCursor()")
+      if (!t.GetDatabaseTransaction().DoesIndexExist("ChangesIndex2"))
+      {
+        t.GetDatabaseTransaction().ExecuteMultiLines(
+          "CREATE INDEX ChangesIndex2 ON Changes(changeType, seq);");
+      }
+
+      t.Commit();
+    }
+
+    {
+      DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+
+      // Covering indexes for the constraints and the ordering on the
+      // main DICOM tags (opt-in, as they increase the size of the file)
+      if (tagsValuesIndex_)
+      {
+        if (!t.GetDatabaseTransaction().DoesIndexExist("MainDicomTagsIndexValues2"))
+        {
+          LOG(WARNING) << "Creating the covering indexes on the values of the main DICOM tags, this can take some time";
+          t.GetDatabaseTransaction().ExecuteMultiLines(
+            "CREATE INDEX MainDicomTagsIndexValues2 ON MainDicomTags(tagGroup, tagElement, value, id);"
+            "CREATE INDEX DicomIdentifiersIndexValues2 ON DicomIdentifiers(tagGroup, tagElement, value, id);");
+        }
+      }
+      else
+      {
+        t.GetDatabaseTransaction().ExecuteMultiLines(
+          "DROP INDEX IF EXISTS MainDicomTagsIndexValues2;"
+          "DROP INDEX IF EXISTS DicomIdentifiersIndexValues2;");
+      }
+
+      // Partial index for the incremental synchronizations, on the
+      // "LastUpdate" metadata (whose type is 7)
+      if (lastUpdateIndex_)
+      {
+        if (!t.GetDatabaseTransaction().DoesIndexExist("MetadataLastUpdateIndex"))
+        {
+          LOG(WARNING) << "Creating the index on the last update of the resources";
+          t.GetDatabaseTransaction().ExecuteMultiLines(
+            "CREATE INDEX MetadataLastUpdateIndex ON Metadata(value, id) WHERE type = 7;");
+        }
+      }
+      else
+      {
+        t.GetDatabaseTransaction().ExecuteMultiLines(
+          "DROP INDEX IF EXISTS MetadataLastUpdateIndex;");
+      }
+
+      t.Commit();
+    }
+
+    if (bulkLoadAtStartup_ &&
+        readConnectionsCount_ != 0)
+    {
+      LOG(WARNING) << "The bulk-load mode of the SQLite index requires \"ReadConnectionsCount\" to be zero, "
+                   << "ignoring the \"BulkLoad\" configuration option";
+      RestoreDeferredIndexes(manager);
+    }
+    else if (bulkLoadAtStartup_)
+    {
+      SetBulkLoad(manager, true);
+    }
+    else
+    {
+      // In the case Orthanc stopped in bulk-load mode
+      RestoreDeferredIndexes(manager);
+    }
   }
 
 
@@ -193,7 +826,23 @@ namespace OrthancDatabases
                            const std::string& path) :
     IndexBackend(context),
     path_(path),
-    fast_(true)
+    fast_(true),
+    readConnectionsCount_(0),
+    mmapSize_(0),
+    cacheSize_(0),
+    tempStoreMemory_(false),
+    walAutoCheckpoint_(1000),
+    checkpointInterval_(0),
+    vacuumInterval_(0),
+    vacuumPages_(1000),
+    optimizeInterval_(0),
+    tagsValuesIndex_(false),
+    lastUpdateIndex_(false),
+    replicaBatchSize_(1000),
+    bulkLoadBatchSize_(1000),
+    bulkLoadMaxDelay_(10),
+    bulkLoadAtStartup_(false),
+    bulkLoad_(false)
   {
     if (path.empty())
     {
@@ -204,11 +853,233 @@ namespace OrthancDatabases
 
   SQLiteIndex::SQLiteIndex(OrthancPluginContext* context) :
     IndexBackend(context),
-    fast_(true)
+    fast_(true),
+    readConnectionsCount_(0),
+    mmapSize_(0),
+    cacheSize_(0),
+    tempStoreMemory_(false),
+    walAutoCheckpoint_(1000),
+    checkpointInterval_(0),
+    vacuumInterval_(0),
+    vacuumPages_(1000),
+    optimizeInterval_(0),
+    tagsValuesIndex_(false),
+    lastUpdateIndex_(false),
+    replicaBatchSize_(1000),
+    bulkLoadBatchSize_(1000),
+    bulkLoadMaxDelay_(10),
+    bulkLoadAtStartup_(false),
+    bulkLoad_(false)
   {
   }
 
 
+#if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 5)
+  void SQLiteIndex::RegisterHousekeepingTasks(HousekeepingScheduler& scheduler,
+                                              unsigned int defaultIntervalSeconds,
+                                              const boost::posix_time::ptime& now)
+  {
+    if (readConnectionsCount_ == 0)
+    {
+      // The housekeeping thread has its own connection, that cannot
+      // be opened if the database is exclusively locked
+      if (checkpointInterval_ != 0 ||
+          vacuumInterval_ != 0 ||
+          optimizeInterval_ != 0 ||
+          GetExportedResourcesRetentionDays() != 0 ||
+          GetHousekeepingInterval("DatabaseMetrics", 0) != 0 ||
+          IsReplica())
+      {
+        LOG(WARNING) << "The background checkpoints, the incremental vacuum, \"PRAGMA optimize\", "
+                     << "the retention of the exported resources, the "
+                     << "database metrics and the local replica of the SQLite index require "
+                     << "\"ReadConnectionsCount\" to be greater than 0";
+      }
+    }
+    else
+    {
+      IndexBackend::RegisterHousekeepingTasks(scheduler, defaultIntervalSeconds, now);
+
+      if (checkpointInterval_ != 0)
+      {
+        scheduler.AddTask("Checkpoint", GetHousekeepingInterval("Checkpoint", checkpointInterval_), now);
+      }
+
+      if (vacuumInterval_ != 0)
+      {
+        scheduler.AddTask("IncrementalVacuum", GetHousekeepingInterval("IncrementalVacuum", vacuumInterval_), now);
+      }
+
+      if (optimizeInterval_ != 0)
+      {
+        scheduler.AddTask("Optimize", GetHousekeepingInterval("Optimize", optimizeInterval_), now);
+      }
+
+      if (IsReplica())
+      {
+        scheduler.AddTask("Replica", GetHousekeepingInterval("Replica", defaultIntervalSeconds), now);
+      }
+    }
+  }
+
+
+  void SQLiteIndex::PerformHousekeepingTask(DatabaseManager& manager,
+                                            const std::string& task)
+  {
+    if (task == "Checkpoint")
+    {
+      // A passive checkpoint does not wait for the readers and the
+      // writer, and the housekeeping only runs it if the writer
+      // connection is idle ("IndexConnectionsPool::IsSaturated()")
+      dynamic_cast<SQLiteDatabase&>(manager.GetDatabase()).Execute("PRAGMA WAL_CHECKPOINT(PASSIVE);");
+    }
+    else if (task == "IncrementalVacuum")
+    {
+      // Bounded pass, as the writer is blocked while the pages are moved
+      dynamic_cast<SQLiteDatabase&>(manager.GetDatabase()).Execute(
+        "PRAGMA INCREMENTAL_VACUUM(" + boost::lexical_cast<std::string>(vacuumPages_) + ");");
+    }
+    else if (task == "Optimize")
+    {
+      // Only analyzes the tables whose statistics are outdated
+      dynamic_cast<SQLiteDatabase&>(manager.GetDatabase()).Execute("PRAGMA OPTIMIZE;");
+    }
+    else if (task == "Replica")
+    {
+      SynchronizeReplica(manager);
+    }
+    else
+    {
+      IndexBackend::PerformHousekeepingTask(manager, task);
+    }
+  }
+
+
+  void SQLiteIndex::ReadRemoteReplicaPage(Json::Value& page /*out*/,
+                                          int64_t since,
+                                          bool changes) const
+  {
+    OrthancPlugins::HttpClient client;
+    client.SetUrl(replicaUrl_ + "/index/replica?since=" + boost::lexical_cast<std::string>(since) +
+                  "&limit=" + boost::lexical_cast<std::string>(replicaBatchSize_) +
+                  (changes ? "&changes=true" : ""));
+
+    if (!replicaUsername_.empty())
+    {
+      client.SetCredentials(replicaUsername_, replicaPassword_);
+    }
+
+    OrthancPlugins::HttpClient::HttpHeaders headers;
+    client.Execute(headers, page);
+
+    if (page.type() != Json::objectValue ||
+        !page.isMember("LastChange"))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_NetworkProtocol,
+                                      "The remote Orthanc server does not publish its index: " + replicaUrl_);
+    }
+  }
+
+
+  void SQLiteIndex::SynchronizeReplica(DatabaseManager& manager)
+  {
+    std::string bootstrap, lastChange, sweep;
+
+    {
+      DatabaseManager::Transaction t(manager, TransactionType_ReadOnly);
+
+      if (!LookupGlobalProperty(bootstrap, manager, MISSING_SERVER_IDENTIFIER, GlobalProperty_ReplicaBootstrap))
+      {
+        bootstrap = "-1";
+      }
+
+      if (!LookupGlobalProperty(lastChange, manager, MISSING_SERVER_IDENTIFIER, GlobalProperty_ReplicaLastChange))
+      {
+        lastChange.clear();
+      }
+
+      if (!LookupGlobalProperty(sweep, manager, MISSING_SERVER_IDENTIFIER, GlobalProperty_ReplicaSweep))
+      {
+        sweep = "-1";
+      }
+
+      t.Commit();
+    }
+
+    unsigned int countPages = 0;
+
+    // 1. Copy of all the remote resources
+    while (bootstrap != "done" &&
+           countPages < MAX_REPLICA_PAGES_PER_RUN)
+    {
+      Json::Value page;
+      ReadRemoteReplicaPage(page, boost::lexical_cast<int64_t>(bootstrap), false);
+
+      DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+
+      if (lastChange.empty())
+      {
+        // The changes that occur during the copy are read once the copy is over
+        lastChange = boost::lexical_cast<std::string>(page["LastChange"].asInt64());
+        SetGlobalProperty(manager, MISSING_SERVER_IDENTIFIER, GlobalProperty_ReplicaLastChange, lastChange.c_str());
+      }
+
+      ApplyReplicaPage(manager, page, false, -1);
+
+      bootstrap = (page["Done"].asBool() ? "done" : boost::lexical_cast<std::string>(page["Next"].asInt64()));
+      SetGlobalProperty(manager, MISSING_SERVER_IDENTIFIER, GlobalProperty_ReplicaBootstrap, bootstrap.c_str());
+
+      t.Commit();
+      countPages++;
+    }
+
+    if (bootstrap == "done")
+    {
+      // 2. Resources of the new changes
+      bool done = false;
+      while (!done &&
+             countPages < MAX_REPLICA_PAGES_PER_RUN)
+      {
+        Json::Value page;
+        ReadRemoteReplicaPage(page, boost::lexical_cast<int64_t>(lastChange), true);
+
+        DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+        ApplyReplicaPage(manager, page, false, -1);
+
+        lastChange = boost::lexical_cast<std::string>(page["Next"].asInt64());
+        SetGlobalProperty(manager, MISSING_SERVER_IDENTIFIER, GlobalProperty_ReplicaLastChange, lastChange.c_str());
+
+        t.Commit();
+        countPages++;
+        done = page["Done"].asBool();
+      }
+
+      // 3. One page of the local resources is checked against the remote index
+      {
+        const int64_t since = boost::lexical_cast<int64_t>(sweep);
+
+        Json::Value page;
+        ReadRemoteReplicaPage(page, since, false);
+
+        DatabaseManager::Transaction t(manager, TransactionType_ReadWrite);
+        ApplyReplicaPage(manager, page, true, since);
+
+        sweep = (page["Done"].asBool() ? "-1" : boost::lexical_cast<std::string>(page["Next"].asInt64()));
+        SetGlobalProperty(manager, MISSING_SERVER_IDENTIFIER, GlobalProperty_ReplicaSweep, sweep.c_str());
+
+        t.Commit();
+        countPages++;
+      }
+    }
+
+    // The in-process caches are not updated by the writes of the replica
+    ClearCaches();
+
+    LOG(INFO) << "Local replica of the index: " << countPages << " page(s) read from " << replicaUrl_;
+  }
+#endif
+
+
   int64_t SQLiteIndex::CreateResource(DatabaseManager& manager,
                                       const char* publicId,
                                       OrthancPluginResourceType type)
@@ -230,6 +1101,90 @@ namespace OrthancDatabases
   }
 
 
+  int64_t SQLiteIndex::CreateChildResource(DatabaseManager& manager,
+                                           const char* publicId,
+                                           OrthancPluginResourceType type,
+                                           int64_t parentId)
+  {
+    // The parent is set by the insertion itself, which saves the
+    // "UPDATE" of "AttachChild()"
+    DatabaseManager::CachedStatement statement(
+      STATEMENT_FROM_HERE, manager,
+      "INSERT INTO Resources VALUES(NULL, ${type}, ${id}, ${parent})");
+    
+    statement.SetParameterType("id", ValueType_Utf8String);
+    statement.SetParameterType("type", ValueType_Integer64);
+    statement.SetParameterType("parent", ValueType_Integer64);
+
+    Dictionary args;
+    args.SetUtf8Value("id", publicId);
+    args.SetIntegerValue("type", static_cast<int>(type));
+    args.SetIntegerValue("parent", parentId);
+    
+    statement.Execute(args);
+
+    return dynamic_cast<SQLiteDatabase&>(statement.GetDatabase()).GetLastInsertRowId();
+  }
+
+
+#if ORTHANC_PLUGINS_HAS_DATABASE_CONSTRAINT == 1
+  void SQLiteIndex::CreateInstance(OrthancPluginCreateInstanceResult& result,
+                                   DatabaseManager& manager,
+                                   const char* hashPatient,
+                                   const char* hashStudy,
+                                   const char* hashSeries,
+                                   const char* hashInstance)
+  {
+    result.isNewInstance = false;
+    result.isNewPatient = false;
+    result.isNewStudy = false;
+    result.isNewSeries = false;
+    // Resolve the four levels of the hierarchy at once
+    LookupHierarchy(result.patientId, result.studyId, result.seriesId, result.instanceId,
+                    manager, hashPatient, hashStudy, hashSeries, hashInstance);
+
+    if (result.instanceId != -1)
+    {
+      // The instance already exists
+      return;
+    }
+
+    // An existing level implies that all its ancestors exist
+    if ((result.seriesId != -1 && result.studyId == -1) ||
+        (result.studyId != -1 && result.patientId == -1))
+    {
+      throw Orthanc::OrthancException(Orthanc::ErrorCode_Database,
+                                      "Inconsistent patient/study/series hierarchy in the index");
+    }
+
+    // Create the missing levels from the top, so that each resource
+    // is inserted together with its parent
+    if (result.patientId == -1)
+    {
+      result.patientId = CreateResource(manager, hashPatient, OrthancPluginResourceType_Patient);
+      result.isNewPatient = true;
+    }
+
+    if (result.studyId == -1)
+    {
+      result.studyId = CreateChildResource(manager, hashStudy, OrthancPluginResourceType_Study, result.patientId);
+      result.isNewStudy = true;
+    }
+
+    if (result.seriesId == -1)
+    {
+      result.seriesId = CreateChildResource(manager, hashSeries, OrthancPluginResourceType_Series, result.studyId);
+      result.isNewSeries = true;
+    }
+
+    result.instanceId = CreateChildResource(manager, hashInstance, OrthancPluginResourceType_Instance, result.seriesId);
+    result.isNewInstance = true;
+
+    TagMostRecentPatient(manager, result.patientId);
+  }
+#endif
+
+
   int64_t SQLiteIndex::GetLastChangeIndex(DatabaseManager& manager)
   {
     DatabaseManager::CachedStatement statement(
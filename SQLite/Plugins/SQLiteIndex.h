@@ -25,13 +25,52 @@
 
 #include "../../Framework/Plugins/IndexBackend.h"
 
+#include <boost/thread/mutex.hpp>
+
 namespace OrthancDatabases
 {
   class SQLiteIndex : public IndexBackend 
   {
   private:
-    std::string  path_;
-    bool         fast_;
+    class Factory;
+
+    std::string   path_;
+    bool          fast_;
+    size_t        readConnectionsCount_;
+    uint64_t      mmapSize_;           // In bytes, 0 for the default of SQLite
+    unsigned int  cacheSize_;          // In KiB, 0 for the default of SQLite
+    bool          tempStoreMemory_;
+    unsigned int  walAutoCheckpoint_;  // In pages, 0 to disable the automatic checkpoints
+    unsigned int  checkpointInterval_; // In seconds, 0 to disable the background checkpoints
+    unsigned int  vacuumInterval_;     // In seconds, 0 to disable the incremental vacuum
+    unsigned int  vacuumPages_;        // Maximum number of pages that are freed by each pass
+    unsigned int  optimizeInterval_;   // In seconds, 0 to disable "PRAGMA optimize"
+    bool          tagsValuesIndex_;
+    bool          lastUpdateIndex_;
+    std::string   replicaUrl_;         // Empty if the index is not a replica
+    std::string   replicaUsername_;
+    std::string   replicaPassword_;
+    unsigned int  replicaBatchSize_;
+    unsigned int  bulkLoadBatchSize_;  // Number of read-write transactions per commit in bulk-load mode
+    unsigned int  bulkLoadMaxDelay_;   // In seconds, maximum age of the uncommitted batch (0 if unbounded)
+    bool          bulkLoadAtStartup_;
+    mutable boost::mutex  bulkLoadMutex_;
+    bool          bulkLoad_;           // Protected by "bulkLoadMutex_"
+
+    // Recreates the indexes that were dropped by the bulk-load mode, if any
+    void RestoreDeferredIndexes(DatabaseManager& manager);
+
+    void ReadRemoteReplicaPage(Json::Value& page /*out*/,
+                               int64_t since,
+                               bool changes) const;
+
+    void StoreReplicaResource(DatabaseManager& manager,
+                              const Json::Value& resource);
+
+    int64_t CreateChildResource(DatabaseManager& manager,
+                                const char* publicId,
+                                OrthancPluginResourceType type,
+                                int64_t parentId);
 
   public:
     explicit SQLiteIndex(OrthancPluginContext* context);  // Opens in memory
@@ -44,8 +83,158 @@ namespace OrthancDatabases
       fast_ = fast;
     }
 
+    void SetMmapSize(uint64_t bytes)
+    {
+      mmapSize_ = bytes;
+    }
+
+    void SetCacheSize(unsigned int kilobytes)
+    {
+      cacheSize_ = kilobytes;
+    }
+
+    void SetTempStoreMemory(bool memory)
+    {
+      tempStoreMemory_ = memory;
+    }
+
+    /**
+     * The automatic checkpoints are run by the thread that commits a
+     * transaction once the WAL reaches "pages" pages. They can be
+     * replaced by passive checkpoints that are run every
+     * "intervalSeconds" by the housekeeping thread, if the writer is
+     * idle. The background checkpoints require read-only connections
+     * (cf. "SetReadConnectionsCount()"), as the database is otherwise
+     * exclusively locked by the writer.
+     **/
+    void SetWalAutoCheckpoint(unsigned int pages)
+    {
+      walAutoCheckpoint_ = pages;
+    }
+
+    void SetCheckpointInterval(unsigned int intervalSeconds)
+    {
+      checkpointInterval_ = intervalSeconds;
+    }
+
+    /**
+     * Every "intervalSeconds", the housekeeping thread returns at most
+     * "pages" free pages of the database to the filesystem, if the
+     * writer is idle. This switches the database to
+     * "AUTO_VACUUM=INCREMENTAL" when it is opened, which runs a full
+     * "VACUUM" once if the database already exists. Like the
+     * background checkpoints, this requires read-only connections.
+     **/
+    void SetIncrementalVacuum(unsigned int intervalSeconds,
+                              unsigned int pages);
+
+    // Periodic "PRAGMA optimize", which refreshes the statistics of the query planner
+    void SetOptimizeInterval(unsigned int intervalSeconds)
+    {
+      optimizeInterval_ = intervalSeconds;
+    }
+
+    /**
+     * Creates the covering indexes "(tagGroup, tagElement, value,
+     * id)" on "MainDicomTags" and "DicomIdentifiers" when the database
+     * is opened, or drops them if disabled.
+     **/
+    void SetTagsValuesIndex(bool enabled)
+    {
+      tagsValuesIndex_ = enabled;
+    }
+
+    /**
+     * Creates the partial index "(value, id)" on the "LastUpdate"
+     * metadata when the database is opened, or drops it if disabled
+     * (cf. "IndexBackend::LookupUpdatedResources()").
+     **/
+    void SetLastUpdateIndex(bool enabled)
+    {
+      lastUpdateIndex_ = enabled;
+    }
+
+    /**
+     * If "count > 0", the exclusive locking of the database is
+     * disabled, and the read-only transactions are routed to "count"
+     * read-only connections in WAL mode, that run concurrently with
+     * the single connection that writes to the database.
+     **/
+    void SetReadConnectionsCount(size_t count);
+
+    /**
+     * Makes this index a local copy of the index of the Orthanc server
+     * at "url", whose database plugin publishes its content (cf.
+     * "IndexBackend::SetReplicaSource()"). The housekeeping thread
+     * reads all the remote resources once, then the resources of the
+     * new changes. At each run, it also reads one page of the remote
+     * resources again, in the order of their internal IDs, which
+     * removes the local resources that were deleted and refreshes
+     * their labels. Orthanc must be read-only, and the housekeeping
+     * requires "ReadConnectionsCount" to be greater than 0.
+     **/
+    void SetReplicaSource(const std::string& url,
+                          const std::string& username,
+                          const std::string& password,
+                          unsigned int batchSize);
+
+    bool IsReplica() const
+    {
+      return !replicaUrl_.empty();
+    }
+
+    /**
+     * The bulk-load mode speeds up the initial imports: The
+     * synchronous writes are disabled, the journal is kept in memory
+     * (if the database is exclusively locked), "batchSize" read-write
+     * transactions are committed at once, and the secondary indexes
+     * that are not used by the ingest are dropped. Leaving the mode
+     * recreates the indexes, runs "ANALYZE" and restores the
+     * durability. The last batch of transactions is lost if Orthanc
+     * stops abruptly in this mode, and the indexes are recreated at
+     * the next start. The batch is also committed by the first
+     * transaction that ends "maxDelay" seconds after its start ("0"
+     * to disable), which bounds the writes that are lost. If
+     * "atStartup" is "true", the mode is entered once the database is
+     * opened. The mode is refused if there are read-only connections,
+     * as they would not see the uncommitted batch.
+     **/
+    void SetBulkLoadSettings(unsigned int batchSize,
+                             unsigned int maxDelay,
+                             bool atStartup);
+
+    virtual bool HasBulkLoad() const ORTHANC_OVERRIDE
+    {
+      return true;
+    }
+
+    virtual bool IsBulkLoad() const ORTHANC_OVERRIDE;
+
+    virtual void SetBulkLoad(DatabaseManager& manager,
+                             bool enabled) ORTHANC_OVERRIDE;
+
+    /**
+     * Stores the resources of a page of "ReadReplicaPage()". If
+     * "removeMissing" is "true", the page was read by internal IDs
+     * from "since", and the local resources of its range that are not
+     * in the page are removed. The resources whose parent is missing
+     * are skipped, until a later page. Must be called inside a
+     * read-write transaction.
+     **/
+    void ApplyReplicaPage(DatabaseManager& manager,
+                          const Json::Value& page,
+                          bool removeMissing,
+                          int64_t since);
+
     virtual IDatabaseFactory* CreateDatabaseFactory() ORTHANC_OVERRIDE;
 
+    virtual size_t GetReplicaConnectionsCount() const ORTHANC_OVERRIDE
+    {
+      return readConnectionsCount_;
+    }
+
+    virtual IDatabaseFactory* CreateReplicaDatabaseFactory() ORTHANC_OVERRIDE;
+
     virtual void ConfigureDatabase(DatabaseManager& manager,
                                    bool hasIdentifierTags,
                                    const std::list<IdentifierTag>& identifierTags) ORTHANC_OVERRIDE;
@@ -54,11 +243,37 @@ namespace OrthancDatabases
     {
       return true;
     }
+
+#if ORTHANC_PLUGINS_VERSION_IS_ABOVE(1, 12, 5)
+    virtual void RegisterHousekeepingTasks(HousekeepingScheduler& scheduler,
+                                           unsigned int defaultIntervalSeconds,
+                                           const boost::posix_time::ptime& now) ORTHANC_OVERRIDE;
+
+    virtual void PerformHousekeepingTask(DatabaseManager& manager,
+                                         const std::string& task) ORTHANC_OVERRIDE;
+
+    // Each page is stored by its own transaction, so this must be called outside of a transaction
+    void SynchronizeReplica(DatabaseManager& manager);
+#endif
     
     virtual int64_t CreateResource(DatabaseManager& manager,
                                    const char* publicId,
                                    OrthancPluginResourceType type) ORTHANC_OVERRIDE;
 
+    virtual bool HasCreateInstance() const ORTHANC_OVERRIDE
+    {
+      return true;
+    }
+
+#if ORTHANC_PLUGINS_HAS_DATABASE_CONSTRAINT == 1
+    virtual void CreateInstance(OrthancPluginCreateInstanceResult& result,
+                                DatabaseManager& manager,
+                                const char* hashPatient,
+                                const char* hashStudy,
+                                const char* hashSeries,
+                                const char* hashInstance) ORTHANC_OVERRIDE;
+#endif
+
     // New primitive since Orthanc 1.5.2
     virtual int64_t GetLastChangeIndex(DatabaseManager& manager) ORTHANC_OVERRIDE;
 
@@ -21,16 +21,38 @@
  **/
 
 
+#include "../../Framework/Common/Dictionary.h"
+#include "../../Framework/Common/GenericFormatter.h"
+#include "../../Framework/Common/StatementId.h"
+#include "../../Framework/Common/Utf8StringValue.h"
+#include "../../Framework/Plugins/AdmissionController.h"
+#include "../../Framework/Plugins/AnalyticsExport.h"
+#include "../../Framework/Plugins/CacheInvalidations.h"
+#include "../../Framework/Plugins/FilesystemStorage.h"
+#include "../../Framework/Plugins/HiddenResources.h"
+#include "../../Framework/Plugins/ISqlLookupFormatter.h"
+#include "../../Framework/Plugins/IndexAdvisor.h"
+#include "../../Framework/Plugins/IndexShards.h"
+#include "../../Framework/Plugins/IngestStatistics.h"
+#include "../../Framework/Plugins/RequestsRecorder.h"
+#include "../../Framework/Plugins/ResourcesLookupCache.h"
+#include "../../Framework/Plugins/RetryPolicy.h"
+#include "../../Framework/Plugins/StudyColumnStore.h"
+#include "../../Framework/Plugins/TracesExporter.h"
 #include "../../Framework/SQLite/SQLiteDatabase.h"
 #include "../Plugins/SQLiteIndex.h"
 
 #include <Compatibility.h>  // For std::unique_ptr<>
 #include <Logging.h>
+#include <SQLite/Statement.h>
 #include <SystemToolbox.h>
 
+#include <boost/lexical_cast.hpp>
 #include <gtest/gtest.h>
+#include <limits>
 
 
+#include "../../Framework/Plugins/CachesUnitTests.h"
 #include "../../Framework/Plugins/IndexUnitTests.h"
 
 
@@ -64,45 +86,1190 @@ TEST(SQLiteIndex, Lock)
 }
 
 
-TEST(SQLite, ImplicitTransaction)
+TEST(SQLiteIndex, ReadConnections)
+{
+  std::list<OrthancDatabases::IdentifierTag> identifierTags;
+
+  {
+    OrthancDatabases::SQLiteIndex db(NULL);
+    ASSERT_THROW(db.SetReadConnectionsCount(2), Orthanc::OrthancException);
+    ASSERT_EQ(0u, db.GetReplicaConnectionsCount());
+  }
+
+  Orthanc::SystemToolbox::RemoveFile("index.db");
+
+  {
+    OrthancDatabases::SQLiteIndex db(NULL, "index.db");
+    db.SetReadConnectionsCount(2);
+    ASSERT_EQ(2u, db.GetReplicaConnectionsCount());
+
+    std::unique_ptr<OrthancDatabases::DatabaseManager> writer(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+    OrthancDatabases::DatabaseManager reader(db.CreateReplicaDatabaseFactory());
+
+    // The readers are not blocked by a pending write transaction
+    OrthancDatabases::DatabaseManager::Transaction t1(*writer, OrthancDatabases::TransactionType_ReadWrite);
+    db.CreateResource(*writer, "patient", OrthancPluginResourceType_Patient);
+
+    {
+      OrthancDatabases::DatabaseManager::Transaction t2(reader, OrthancDatabases::TransactionType_ReadOnly);
+      ASSERT_TRUE(t2.GetDatabaseTransaction().DoesTableExist("Resources"));
+      ASSERT_EQ(0u, db.GetAllResourcesCount(reader));
+      ASSERT_THROW(db.CreateResource(reader, "other", OrthancPluginResourceType_Patient), Orthanc::OrthancException);
+    }
+
+    t1.Commit();
+
+    {
+      OrthancDatabases::DatabaseManager::Transaction t2(reader, OrthancDatabases::TransactionType_ReadOnly);
+      ASSERT_EQ(1u, db.GetAllResourcesCount(reader));
+    }
+  }
+}
+
+
+TEST(SQLiteIndex, GlobalPropertiesCacheCommit)
+{
+  std::list<OrthancDatabases::IdentifierTag> identifierTags;
+
+  Orthanc::SystemToolbox::RemoveFile("index.db");
+
+  OrthancDatabases::SQLiteIndex db(NULL, "index.db");
+  db.SetReadConnectionsCount(1);
+  db.SetGlobalPropertiesCacheTimeToLive(60);
+
+  std::unique_ptr<OrthancDatabases::DatabaseManager> writer(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+  OrthancDatabases::DatabaseManager reader(db.CreateReplicaDatabaseFactory());
+
+  db.SetGlobalProperty(*writer, "", 4, "1");
+
+  std::string value;
+  ASSERT_TRUE(db.LookupGlobalProperty(value, reader, "", 4));
+  ASSERT_EQ("1", value);
+
+  {
+    OrthancDatabases::DatabaseManager::Transaction t(*writer, OrthancDatabases::TransactionType_ReadWrite);
+    db.SetGlobalProperty(*writer, "", 4, "2");
+
+    // The uncommitted value is not visible, and must not be cached
+    // by the reader once the write is committed
+    {
+      OrthancDatabases::DatabaseManager::Transaction t2(reader, OrthancDatabases::TransactionType_ReadOnly);
+      ASSERT_TRUE(db.LookupGlobalProperty(value, reader, "", 4));
+      ASSERT_EQ("1", value);
+      t2.Commit();
+    }
+
+    t.Commit();
+  }
+
+  ASSERT_TRUE(db.LookupGlobalProperty(value, reader, "", 4));
+  ASSERT_EQ("2", value);
+
+  {
+    // The cached value is kept by a rollback
+    OrthancDatabases::DatabaseManager::Transaction t(*writer, OrthancDatabases::TransactionType_ReadWrite);
+    db.SetGlobalProperty(*writer, "", 4, "3");
+    t.Rollback();
+  }
+
+  ASSERT_TRUE(db.LookupGlobalProperty(value, reader, "", 4));
+  ASSERT_EQ("2", value);
+}
+
+
+TEST(SQLiteIndex, LabelsCacheCommit)
+{
+  std::list<OrthancDatabases::IdentifierTag> identifierTags;
+
+  Orthanc::SystemToolbox::RemoveFile("index.db");
+
+  OrthancDatabases::SQLiteIndex db(NULL, "index.db");
+  db.SetReadConnectionsCount(1);
+  db.SetLabelsCacheTimeToLive(60);
+
+  std::unique_ptr<OrthancDatabases::DatabaseManager> writer(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+  OrthancDatabases::DatabaseManager reader(db.CreateReplicaDatabaseFactory());
+
+  const int64_t patient = db.CreateResource(*writer, "patient", OrthancPluginResourceType_Patient);
+
+  std::list<std::string> labels;
+  db.ListAllLabels(labels, reader);
+  ASSERT_TRUE(labels.empty());
+
+  {
+    OrthancDatabases::DatabaseManager::Transaction t(*writer, OrthancDatabases::TransactionType_ReadWrite);
+    db.AddLabel(*writer, patient, "hello");
+
+    {
+      OrthancDatabases::DatabaseManager::Transaction t2(reader, OrthancDatabases::TransactionType_ReadOnly);
+      db.ListAllLabels(labels, reader);
+      ASSERT_TRUE(labels.empty());
+      t2.Commit();
+    }
+
+    t.Commit();
+  }
+
+  db.ListAllLabels(labels, reader);
+  ASSERT_EQ(1u, labels.size());
+  ASSERT_EQ("hello", labels.front());
+
+  {
+    OrthancDatabases::DatabaseManager::Transaction t(*writer, OrthancDatabases::TransactionType_ReadWrite);
+    db.RemoveLabel(*writer, patient, "hello");
+
+    {
+      OrthancDatabases::DatabaseManager::Transaction t2(reader, OrthancDatabases::TransactionType_ReadOnly);
+      db.ListAllLabels(labels, reader);
+      ASSERT_EQ(1u, labels.size());
+      t2.Commit();
+    }
+
+    t.Commit();
+  }
+
+  db.ListAllLabels(labels, reader);
+  ASSERT_TRUE(labels.empty());
+}
+
+
+TEST(SQLiteIndex, Checkpoint)
+{
+  std::list<OrthancDatabases::IdentifierTag> identifierTags;
+
+  Orthanc::SystemToolbox::RemoveFile("index.db");
+
+  OrthancDatabases::SQLiteIndex db(NULL, "index.db");
+  db.SetReadConnectionsCount(1);
+  db.SetMmapSize(16 * 1024 * 1024);
+  db.SetCacheSize(4096);
+  db.SetTempStoreMemory(true);
+  db.SetWalAutoCheckpoint(0);
+  db.SetCheckpointInterval(10);
+
+  std::unique_ptr<OrthancDatabases::DatabaseManager> writer(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+
+  {
+    OrthancDatabases::DatabaseManager::Transaction t(*writer, OrthancDatabases::TransactionType_ReadWrite);
+    db.CreateResource(*writer, "patient", OrthancPluginResourceType_Patient);
+    t.Commit();
+  }
+
+  OrthancDatabases::HousekeepingScheduler scheduler;
+  db.RegisterHousekeepingTasks(scheduler, 5, boost::posix_time::microsec_clock::universal_time());
+  ASSERT_EQ(1u, scheduler.GetTasksCount());
+  ASSERT_EQ("Checkpoint", scheduler.GetTaskName(0));
+
+  // The checkpoint runs on its own connection, as in the housekeeping thread
+  OrthancDatabases::DatabaseManager housekeeping(db.CreateDatabaseFactory());
+  db.PerformHousekeepingTask(housekeeping, "Checkpoint");
+  ASSERT_THROW(db.PerformHousekeepingTask(housekeeping, "Nope"), Orthanc::OrthancException);
+}
+
+
+TEST(SQLiteIndex, IncrementalVacuum)
+{
+  std::list<OrthancDatabases::IdentifierTag> identifierTags;
+
+  Orthanc::SystemToolbox::RemoveFile("index.db");
+
+  for (unsigned int i = 0; i < 2; i++)
+  {
+    // The second iteration switches the existing database to incremental vacuum
+    OrthancDatabases::SQLiteIndex db(NULL, "index.db");
+    db.SetReadConnectionsCount(1);
+
+    if (i == 1)
+    {
+      db.SetIncrementalVacuum(10, 100);
+      db.SetOptimizeInterval(3600);
+    }
+
+    std::unique_ptr<OrthancDatabases::DatabaseManager> writer(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+
+    {
+      Orthanc::SQLite::Statement statement(dynamic_cast<OrthancDatabases::SQLiteDatabase&>(writer->GetDatabase()).GetObject(),
+                                           "PRAGMA AUTO_VACUUM");
+      ASSERT_TRUE(statement.Step());
+      ASSERT_EQ(i == 1 ? 2 : 0, statement.ColumnInt(0));
+    }
+
+    {
+      OrthancDatabases::DatabaseManager::Transaction t(*writer, OrthancDatabases::TransactionType_ReadWrite);
+      db.CreateResource(*writer, ("patient" + boost::lexical_cast<std::string>(i)).c_str(), OrthancPluginResourceType_Patient);
+      t.Commit();
+    }
+
+    OrthancDatabases::HousekeepingScheduler scheduler;
+    db.RegisterHousekeepingTasks(scheduler, 5, boost::posix_time::microsec_clock::universal_time());
+
+    if (i == 1)
+    {
+      ASSERT_EQ(2u, scheduler.GetTasksCount());
+      ASSERT_EQ("IncrementalVacuum", scheduler.GetTaskName(0));
+      ASSERT_EQ("Optimize", scheduler.GetTaskName(1));
+
+      OrthancDatabases::DatabaseManager housekeeping(db.CreateDatabaseFactory());
+      db.PerformHousekeepingTask(housekeeping, "IncrementalVacuum");
+      db.PerformHousekeepingTask(housekeeping, "Optimize");
+    }
+    else
+    {
+      ASSERT_EQ(0u, scheduler.GetTasksCount());
+    }
+  }
+}
+
+
+TEST(SQLiteIndex, MaxResponseSize)
+{
+  std::list<OrthancDatabases::IdentifierTag> identifierTags;
+
+  OrthancDatabases::SQLiteIndex db(NULL);  // Open in memory
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+
+  {
+    OrthancDatabases::DatabaseManager::Transaction t(*manager, OrthancDatabases::TransactionType_ReadWrite);
+
+    for (unsigned int i = 0; i < 100; i++)
+    {
+      db.CreateResource(*manager, ("patient" + boost::lexical_cast<std::string>(i)).c_str(), OrthancPluginResourceType_Patient);
+    }
+
+    t.Commit();
+  }
+
+  OrthancDatabases::DatabaseManager::Transaction t(*manager, OrthancDatabases::TransactionType_ReadOnly);
+
+  std::list<std::string> publicIds;
+  std::list<int64_t> internalIds;
+  db.GetAllPublicIds(publicIds, *manager, OrthancPluginResourceType_Patient);
+  ASSERT_EQ(100u, publicIds.size());
+
+  // Each public ID counts for about 25 bytes
+  db.SetMaxResponseSize(1000);
+  ASSERT_THROW(db.GetAllPublicIds(publicIds, *manager, OrthancPluginResourceType_Patient), Orthanc::OrthancException);
+  ASSERT_THROW(db.GetAllInternalIds(internalIds, *manager, OrthancPluginResourceType_Patient), Orthanc::OrthancException);
+
+  db.GetAllPublicIds(publicIds, *manager, OrthancPluginResourceType_Patient, 0, 10);
+  ASSERT_EQ(10u, publicIds.size());
+
+  db.SetMaxResponseSize(0);
+  db.GetAllInternalIds(internalIds, *manager, OrthancPluginResourceType_Patient);
+  ASSERT_EQ(100u, internalIds.size());
+}
+
+
+TEST(SQLiteIndex, PublicIdsKeyset)
+{
+  std::list<OrthancDatabases::IdentifierTag> identifierTags;
+
+  OrthancDatabases::SQLiteIndex db(NULL);  // Open in memory
+  db.SetKeysetPagination(true);
+
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+
+  {
+    OrthancDatabases::DatabaseManager::Transaction t(*manager, OrthancDatabases::TransactionType_ReadWrite);
+
+    for (unsigned int i = 0; i < 25; i++)
+    {
+      db.CreateResource(*manager, ("patient" + boost::lexical_cast<std::string>(100 + i)).c_str(), OrthancPluginResourceType_Patient);
+    }
+
+    db.CreateResource(*manager, "study", OrthancPluginResourceType_Study);
+    t.Commit();
+  }
+
+  std::list<std::string> all, page;
+
+  {
+    OrthancDatabases::DatabaseManager::Transaction t(*manager, OrthancDatabases::TransactionType_ReadOnly);
+
+    // The pages that are read after a full page use a seek, and give the same result as "OFFSET"
+    for (int64_t since = 0; since < 30; since += 10)
+    {
+      db.GetAllPublicIds(page, *manager, OrthancPluginResourceType_Patient, since, 10);
+      ASSERT_EQ(since == 20 ? 5u : 10u, page.size());
+      all.splice(all.end(), page);
+    }
+
+    ASSERT_EQ(25u, all.size());
+    ASSERT_EQ("patient100", all.front());
+    ASSERT_EQ("patient124", all.back());
+
+    db.GetAllPublicIds(page, *manager, OrthancPluginResourceType_Patient, 15, 3);  // Not a known bound
+    ASSERT_EQ(3u, page.size());
+    ASSERT_EQ("patient115", page.front());
+
+    db.GetAllPublicIds(page, *manager, OrthancPluginResourceType_Patient, 0, 10);
+    ASSERT_EQ("patient109", page.back());
+    t.Commit();
+  }
+
+  {
+    // A patient is added before the bound of the second page
+    OrthancDatabases::DatabaseManager::Transaction t(*manager, OrthancDatabases::TransactionType_ReadWrite);
+    int64_t id = db.CreateResource(*manager, "patient000", OrthancPluginResourceType_Patient);
+    db.LogChange(*manager, OrthancPluginChangeType_NewPatient, id, OrthancPluginResourceType_Patient, "20240101T000000");
+    t.Commit();
+  }
+
+  {
+    // The stale bound is dropped, and "OFFSET" is used instead
+    OrthancDatabases::DatabaseManager::Transaction t(*manager, OrthancDatabases::TransactionType_ReadOnly);
+    db.GetAllPublicIds(page, *manager, OrthancPluginResourceType_Patient, 10, 10);
+    ASSERT_EQ(10u, page.size());
+    ASSERT_EQ("patient109", page.front());
+    ASSERT_EQ("patient118", page.back());
+    t.Commit();
+  }
+}
+
+
+TEST(SQLiteIndex, TagsValuesIndex)
+{
+  std::list<OrthancDatabases::IdentifierTag> identifierTags;
+
+  Orthanc::SystemToolbox::RemoveFile("index.db");
+
+  for (unsigned int i = 0; i < 3; i++)
+  {
+    const bool enabled = (i != 2);
+
+    OrthancDatabases::SQLiteIndex db(NULL, "index.db");
+    db.SetTagsValuesIndex(enabled);
+
+    std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+
+    OrthancDatabases::DatabaseManager::Transaction t(*manager, OrthancDatabases::TransactionType_ReadOnly);
+    ASSERT_EQ(enabled, t.GetDatabaseTransaction().DoesIndexExist("MainDicomTagsIndexValues2"));
+    ASSERT_EQ(enabled, t.GetDatabaseTransaction().DoesIndexExist("DicomIdentifiersIndexValues2"));
+    ASSERT_TRUE(t.GetDatabaseTransaction().DoesIndexExist("MainDicomTagsIndex1"));
+    ASSERT_TRUE(t.GetDatabaseTransaction().DoesIndexExist("ChildrenIndex2"));
+    ASSERT_FALSE(t.GetDatabaseTransaction().DoesIndexExist("ChildrenIndex"));
+  }
+}
+
+
+TEST(SQLiteIndex, UpdatedResources)
+{
+  std::list<OrthancDatabases::IdentifierTag> identifierTags;
+
+  OrthancDatabases::SQLiteIndex db(NULL);  // Open in memory
+  db.SetLastUpdateIndex(true);
+
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+
+  OrthancDatabases::DatabaseManager::Transaction t(*manager, OrthancDatabases::TransactionType_ReadWrite);
+  ASSERT_TRUE(t.GetDatabaseTransaction().DoesIndexExist("MetadataLastUpdateIndex"));
+
+  int64_t a = db.CreateResource(*manager, "a", OrthancPluginResourceType_Study);
+  int64_t b = db.CreateResource(*manager, "b", OrthancPluginResourceType_Study);
+  int64_t c = db.CreateResource(*manager, "c", OrthancPluginResourceType_Study);
+  int64_t p = db.CreateResource(*manager, "p", OrthancPluginResourceType_Patient);
+  db.SetMetadata(*manager, a, Orthanc::MetadataType_LastUpdate, "20240102T000000", 0);
+  db.SetMetadata(*manager, b, Orthanc::MetadataType_LastUpdate, "20240101T000000", 0);
+  db.SetMetadata(*manager, c, Orthanc::MetadataType_LastUpdate, "20240102T000000", 0);
+  db.SetMetadata(*manager, p, Orthanc::MetadataType_LastUpdate, "20240101T000000", 0);
+
+  // The resources that share the same date are not skipped by the pages
+  Json::Value page;
+  db.LookupUpdatedResources(page, *manager, OrthancPluginResourceType_Study, "", -1, "", 2);
+  ASSERT_EQ(2u, page["Resources"].size());
+  ASSERT_EQ("b", page["Resources"][0]["ID"].asString());
+  ASSERT_EQ("a", page["Resources"][1]["ID"].asString());
+  ASSERT_FALSE(page["Done"].asBool());
+  ASSERT_EQ("20240102T000000", page["Since"].asString());
+  ASSERT_EQ(a, page["SinceID"].asInt64());
+
+  db.LookupUpdatedResources(page, *manager, OrthancPluginResourceType_Study, page["Since"].asString(), page["SinceID"].asInt64(), "", 2);
+  ASSERT_EQ(1u, page["Resources"].size());
+  ASSERT_EQ("c", page["Resources"][0]["ID"].asString());
+  ASSERT_TRUE(page["Done"].asBool());
+
+  db.LookupUpdatedResources(page, *manager, OrthancPluginResourceType_Study, "", -1, "20240102T000000", 10);
+  ASSERT_EQ(1u, page["Resources"].size());
+  ASSERT_EQ("b", page["Resources"][0]["ID"].asString());
+
+  db.LookupUpdatedResources(page, *manager, OrthancPluginResourceType_Patient, "", -1, "", 10);
+  ASSERT_EQ(1u, page["Resources"].size());
+  ASSERT_EQ("p", page["Resources"][0]["ID"].asString());
+
+  ASSERT_THROW(db.LookupUpdatedResources(page, *manager, OrthancPluginResourceType_Study, "", -1, "", 0), Orthanc::OrthancException);
+
+  // The cursor of the last page is rewound before the recent dates,
+  // which might still receive the resources of uncommitted transactions
+  const std::string now = OrthancDatabases::CacheInvalidations::FormatDate(boost::posix_time::microsec_clock::universal_time());
+  int64_t d = db.CreateResource(*manager, "d", OrthancPluginResourceType_Study);
+  db.SetMetadata(*manager, d, Orthanc::MetadataType_LastUpdate, now, 0);
+
+  db.LookupUpdatedResources(page, *manager, OrthancPluginResourceType_Study, "20240102T000000", c, "", 10);
+  ASSERT_EQ(1u, page["Resources"].size());
+  ASSERT_EQ("d", page["Resources"][0]["ID"].asString());
+  ASSERT_TRUE(page["Done"].asBool());
+  ASSERT_LT(page["Since"].asString(), now);
+  ASSERT_EQ(-1, page["SinceID"].asInt64());
+
+  db.LookupUpdatedResources(page, *manager, OrthancPluginResourceType_Study, page["Since"].asString(), page["SinceID"].asInt64(), "", 10);
+  ASSERT_EQ(1u, page["Resources"].size());
+  ASSERT_EQ("d", page["Resources"][0]["ID"].asString());
+
+  t.Commit();
+}
+
+
+TEST(SQLiteIndex, CreateInstance)
+{
+  std::list<OrthancDatabases::IdentifierTag> identifierTags;
+
+  OrthancDatabases::SQLiteIndex db(NULL);  // Open in memory
+  ASSERT_TRUE(db.HasCreateInstance());
+
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+
+  OrthancDatabases::DatabaseManager::Transaction t(*manager, OrthancDatabases::TransactionType_ReadWrite);
+
+  OrthancPluginCreateInstanceResult a;
+  db.CreateInstance(a, *manager, "patient", "study", "series", "instance1");
+  ASSERT_TRUE(a.isNewInstance);
+  ASSERT_TRUE(a.isNewPatient);
+  ASSERT_TRUE(a.isNewStudy);
+  ASSERT_TRUE(a.isNewSeries);
+  ASSERT_EQ(4u, db.GetAllResourcesCount(*manager));
+
+  std::string parent;
+  ASSERT_TRUE(db.GetParentPublicId(parent, *manager, a.instanceId));
+  ASSERT_EQ("series", parent);
+  ASSERT_TRUE(db.GetParentPublicId(parent, *manager, a.seriesId));
+  ASSERT_EQ("study", parent);
+  ASSERT_TRUE(db.GetParentPublicId(parent, *manager, a.studyId));
+  ASSERT_EQ("patient", parent);
+  ASSERT_FALSE(db.GetParentPublicId(parent, *manager, a.patientId));
+
+  OrthancPluginCreateInstanceResult b;
+  db.CreateInstance(b, *manager, "patient", "study", "series", "instance1");
+  ASSERT_FALSE(b.isNewInstance);
+  ASSERT_EQ(a.instanceId, b.instanceId);
+
+  db.CreateInstance(b, *manager, "patient", "study", "series", "instance2");
+  ASSERT_TRUE(b.isNewInstance);
+  ASSERT_FALSE(b.isNewPatient);
+  ASSERT_FALSE(b.isNewStudy);
+  ASSERT_FALSE(b.isNewSeries);
+  ASSERT_EQ(a.patientId, b.patientId);
+  ASSERT_EQ(a.studyId, b.studyId);
+  ASSERT_EQ(a.seriesId, b.seriesId);
+
+  db.CreateInstance(b, *manager, "patient", "study2", "series2", "instance3");
+  ASSERT_TRUE(b.isNewInstance);
+  ASSERT_FALSE(b.isNewPatient);
+  ASSERT_TRUE(b.isNewStudy);
+  ASSERT_TRUE(b.isNewSeries);
+  ASSERT_EQ(a.patientId, b.patientId);
+  ASSERT_TRUE(db.GetParentPublicId(parent, *manager, b.studyId));
+  ASSERT_EQ("patient", parent);
+  ASSERT_EQ(8u, db.GetAllResourcesCount(*manager));
+
+  // A series without its study is reported as a corrupted index
+  db.CreateResource(*manager, "orphan", OrthancPluginResourceType_Series);
+  ASSERT_THROW(db.CreateInstance(b, *manager, "patient3", "study3", "orphan", "instance4"), Orthanc::OrthancException);
+
+  t.Commit();
+}
+
+
+TEST(SQLiteIndex, BulkLoad)
+{
+  std::list<OrthancDatabases::IdentifierTag> identifierTags;
+
+  Orthanc::SystemToolbox::RemoveFile("index.db");
+
+  {
+    // The read-only connections would not see the uncommitted batch
+    OrthancDatabases::SQLiteIndex db(NULL, "index.db");
+    db.SetReadConnectionsCount(1);
+    db.SetBulkLoadSettings(2, 0, false);
+
+    std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+    ASSERT_THROW(db.SetBulkLoad(*manager, true), Orthanc::OrthancException);
+    ASSERT_FALSE(db.IsBulkLoad());
+  }
+
+  {
+    OrthancDatabases::SQLiteIndex db(NULL, "index.db");
+    db.SetBulkLoadSettings(2, 0, false);
+    ASSERT_TRUE(db.HasBulkLoad());
+
+    std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+
+    ASSERT_FALSE(db.IsBulkLoad());
+    db.SetBulkLoad(*manager, true);
+    ASSERT_TRUE(db.IsBulkLoad());
+
+    {
+      OrthancDatabases::DatabaseManager::Transaction t(*manager, OrthancDatabases::TransactionType_ReadOnly);
+      ASSERT_FALSE(t.GetDatabaseTransaction().DoesIndexExist("DicomIdentifiersIndex2"));
+      ASSERT_FALSE(t.GetDatabaseTransaction().DoesIndexExist("ChangesIndex2"));
+      ASSERT_TRUE(t.GetDatabaseTransaction().DoesIndexExist("PublicIndex"));
+      ASSERT_TRUE(t.GetDatabaseTransaction().DoesIndexExist("ChildrenIndex2"));
+      t.Commit();
+    }
+
+    for (unsigned int i = 0; i < 5; i++)
+    {
+      OrthancDatabases::DatabaseManager::Transaction t(*manager, OrthancDatabases::TransactionType_ReadWrite);
+
+      OrthancPluginCreateInstanceResult result;
+      db.CreateInstance(result, *manager, "patient", "study", "series", ("instance" + boost::lexical_cast<std::string>(i)).c_str());
+
+      if (i != 3)
+      {
+        t.Commit();
+      }
+      // Otherwise, only this transaction of the batch is rolled back
+    }
+
+    db.SetBulkLoad(*manager, false);
+    ASSERT_FALSE(db.IsBulkLoad());
+
+    {
+      OrthancDatabases::DatabaseManager::Transaction t(*manager, OrthancDatabases::TransactionType_ReadOnly);
+      ASSERT_TRUE(t.GetDatabaseTransaction().DoesIndexExist("DicomIdentifiersIndex2"));
+      ASSERT_TRUE(t.GetDatabaseTransaction().DoesIndexExist("ChangesIndex2"));
+      ASSERT_EQ(7u, db.GetAllResourcesCount(*manager));
+      t.Commit();
+    }
+
+    // Orthanc stops in bulk-load mode
+    db.SetBulkLoad(*manager, true);
+  }
+
+  {
+    OrthancDatabases::SQLiteIndex db(NULL, "index.db");
+    std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+    ASSERT_FALSE(db.IsBulkLoad());
+
+    OrthancDatabases::DatabaseManager::Transaction t(*manager, OrthancDatabases::TransactionType_ReadOnly);
+    ASSERT_TRUE(t.GetDatabaseTransaction().DoesIndexExist("DicomIdentifiersIndex2"));
+    ASSERT_TRUE(t.GetDatabaseTransaction().DoesIndexExist("ResourceTypeIndex"));
+    ASSERT_EQ(7u, db.GetAllResourcesCount(*manager));
+    t.Commit();
+  }
+}
+
+
+TEST(SQLite, BatchMaxDuration)
 {
+  Orthanc::SystemToolbox::RemoveFile("batch.db");
+
   OrthancDatabases::SQLiteDatabase db;
-  db.OpenInMemory();
+  db.Open("batch.db");
+  db.Execute("CREATE TABLE test(id INT)");
+  db.SetBatchSize(1000);
+  db.SetBatchMaxDuration(1);
 
-  ASSERT_FALSE(db.GetObject().DoesTableExist("test"));
-  ASSERT_FALSE(db.GetObject().DoesTableExist("test2"));
+  Orthanc::SQLite::Connection other;
+  other.Open("batch.db");
 
   {
     std::unique_ptr<OrthancDatabases::ITransaction> t(db.CreateTransaction(OrthancDatabases::TransactionType_ReadWrite));
-    ASSERT_FALSE(t->IsImplicit());
+    t->ExecuteMultiLines("INSERT INTO test VALUES(42)");
+    t->Commit();
   }
 
   {
-    OrthancDatabases::Query query("CREATE TABLE test(id INT)", false);
-    std::unique_ptr<OrthancDatabases::IPrecompiledStatement> s(db.Compile(query));
-    
-    std::unique_ptr<OrthancDatabases::ITransaction> t(db.CreateTransaction(OrthancDatabases::TransactionType_Implicit));
-    ASSERT_TRUE(t->IsImplicit());
-    ASSERT_THROW(t->Commit(), Orthanc::OrthancException);
-    ASSERT_THROW(t->Rollback(), Orthanc::OrthancException);
+    // The batch is not committed yet
+    Orthanc::SQLite::Statement s(other, "SELECT COUNT(*) FROM test");
+    ASSERT_TRUE(s.Step());
+    ASSERT_EQ(0, s.ColumnInt(0));
+  }
 
-    OrthancDatabases::Dictionary args;
-    t->ExecuteWithoutResult(*s, args);
-    ASSERT_THROW(t->Rollback(), Orthanc::OrthancException);
+  Orthanc::SystemToolbox::USleep(1100000);
+
+  {
+    // A read-only transaction ends the batch that is too old
+    std::unique_ptr<OrthancDatabases::ITransaction> t(db.CreateTransaction(OrthancDatabases::TransactionType_ReadOnly));
     t->Commit();
+  }
 
-    ASSERT_THROW(t->Commit(), Orthanc::OrthancException);
+  {
+    Orthanc::SQLite::Statement s(other, "SELECT COUNT(*) FROM test");
+    ASSERT_TRUE(s.Step());
+    ASSERT_EQ(1, s.ColumnInt(0));
   }
 
+  db.SetBatchSize(0);
+}
+
+
+static int64_t CountExportedResources(OrthancDatabases::DatabaseManager& manager)
+{
+  OrthancDatabases::DatabaseManager::Transaction t(manager, OrthancDatabases::TransactionType_ReadOnly);
+  OrthancDatabases::DatabaseManager::StandaloneStatement statement(manager, "SELECT COUNT(*) FROM ExportedResources");
+  statement.Execute();
+  const int64_t count = statement.ReadInteger64(0);
+  t.Commit();
+  return count;
+}
+
+
+TEST(SQLiteIndex, ExportedResources)
+{
+  std::list<OrthancDatabases::IdentifierTag> identifierTags;
+
+  Orthanc::SystemToolbox::RemoveFile("index.db");
+
+  // The housekeeping requires a read connection
+  OrthancDatabases::SQLiteIndex db(NULL, "index.db");
+  db.SetReadConnectionsCount(1);
+
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+
+  OrthancDatabases::DeferredWrites writes;
+  ASSERT_TRUE(writes.CanAdd(OrthancDatabases::DeferredWrites::WriteKind_ExportedResource));
+
+  for (unsigned int i = 0; i < 150; i++)
   {
-    // An implicit transaction does not need to be explicitely committed
-    OrthancDatabases::Query query("CREATE TABLE test2(id INT)", false);
-    std::unique_ptr<OrthancDatabases::IPrecompiledStatement> s(db.Compile(query));
-    
-    std::unique_ptr<OrthancDatabases::ITransaction> t(db.CreateTransaction(OrthancDatabases::TransactionType_Implicit));
+    // 100 expired exports, followed by 50 recent exports
+    writes.AddExportedResource(OrthancPluginResourceType_Instance, "id" + boost::lexical_cast<std::string>(i),
+                               "remote", (i < 100 ? "20000101T000000" : "29990101T000000"),
+                               "patient", "study", "series", "instance");
+  }
 
-    OrthancDatabases::Dictionary args;
-    t->ExecuteWithoutResult(*s, args);
+  ASSERT_FALSE(writes.CanAdd(OrthancDatabases::DeferredWrites::WriteKind_Change));
+  ASSERT_EQ(150u, writes.GetExportedResources().size());
+
+  {
+    // Three multi-row insertions (64 + 64 + 22 rows)
+    OrthancDatabases::DatabaseManager::Transaction t(*manager, OrthancDatabases::TransactionType_ReadWrite);
+    db.FlushDeferredWrites(*manager, writes);
+    t.Commit();
+  }
+
+  writes.Clear();
+  ASSERT_TRUE(writes.GetExportedResources().empty());
+  ASSERT_EQ(150, CountExportedResources(*manager));
+
+  ASSERT_THROW(db.DeleteExpiredExportedResources(*manager, "20100101T000000", 0), Orthanc::OrthancException);
+  db.DeleteExpiredExportedResources(*manager, "19990101T000000", 7);
+  ASSERT_EQ(150, CountExportedResources(*manager));
+  db.DeleteExpiredExportedResources(*manager, "20100101T000000", 7);
+  ASSERT_EQ(50, CountExportedResources(*manager));
+
+  ASSERT_THROW(db.SetExportedResourcesRetention(10, 0), Orthanc::OrthancException);
+  db.SetExportedResourcesRetention(10, 100);
+  ASSERT_EQ(10u, db.GetExportedResourcesRetentionDays());
+
+  OrthancDatabases::HousekeepingScheduler scheduler;
+  db.RegisterHousekeepingTasks(scheduler, 5, boost::posix_time::microsec_clock::universal_time());
+  ASSERT_EQ(1u, scheduler.GetTasksCount());
+  ASSERT_EQ("ExportedResourcesRetention", scheduler.GetTaskName(0));
+
+  db.PerformHousekeepingTask(*manager, "ExportedResourcesRetention");
+  ASSERT_EQ(50, CountExportedResources(*manager));
+}
+
+
+TEST(SQLiteIndex, AnalyticsExport)
+{
+  {
+    std::string s;
+    OrthancDatabases::AnalyticsExport::AppendCsvField(s, "abc");
+    s += ',';
+    OrthancDatabases::AnalyticsExport::AppendCsvField(s, "a,\"b\"");
+    ASSERT_EQ("abc,\"a,\"\"b\"\"\"", s);
+  }
+
+  const std::string root = (boost::filesystem::temp_directory_path() /
+                            boost::filesystem::unique_path("orthanc-%%%%-%%%%")).string();
+
+  std::list<OrthancDatabases::IdentifierTag> identifierTags;
+
+  OrthancDatabases::SQLiteIndex db(NULL);  // Open in memory
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+
+  ASSERT_THROW(db.ExportAnalytics(*manager), Orthanc::OrthancException);
+  ASSERT_THROW(db.SetAnalyticsExport(root, 0), Orthanc::OrthancException);
+  db.SetAnalyticsExport(root, 2);
+
+  OrthancPluginCreateInstanceResult a;
+
+  {
+    OrthancDatabases::DatabaseManager::Transaction t(*manager, OrthancDatabases::TransactionType_ReadWrite);
+    db.CreateInstance(a, *manager, "patient", "study", "series", "instance");
+    db.SetMainDicomTag(*manager, a.studyId, 0x0008, 0x1030, "Hello, \"world\"");
+
+    OrthancPluginAttachment attachment;
+    attachment.uuid = "uuid";
+    attachment.contentType = Orthanc::FileContentType_Dicom;
+    attachment.uncompressedSize = 42;
+    attachment.uncompressedHash = "md5";
+    attachment.compressionType = Orthanc::CompressionType_None;
+    attachment.compressedSize = 40;
+    attachment.compressedHash = "md5";
+    db.AddAttachment(*manager, a.instanceId, attachment, 0);
+
+    db.LogChange(*manager, 2, a.instanceId, OrthancPluginResourceType_Instance, "20240101T000000");
+    db.LogChange(*manager, 2, a.studyId, OrthancPluginResourceType_Study, "20240101T000000");
+    db.LogChange(*manager, 2, a.patientId, OrthancPluginResourceType_Patient, "20240101T000000");
+    t.Commit();
+  }
+
+  // Two deltas: "]0, 2]" and "]2, 3]"
+  ASSERT_EQ(2u, db.ExportAnalytics(*manager));
+  ASSERT_EQ(0u, db.ExportAnalytics(*manager));
+
+  std::string s;
+  Orthanc::SystemToolbox::ReadFile(s, root + "/last-seq");
+  ASSERT_EQ("3\n", s);
+
+  Orthanc::SystemToolbox::ReadFile(s, root + "/resources-00000000000000000002.csv");
+  ASSERT_EQ(0u, s.find("internalId,resourceType,publicId,parentId,seq\n"));
+  ASSERT_NE(std::string::npos, s.find("\n" + boost::lexical_cast<std::string>(a.instanceId) + ",3,instance," + boost::lexical_cast<std::string>(a.seriesId) + ",1\n"));
+  ASSERT_NE(std::string::npos, s.find("\n" + boost::lexical_cast<std::string>(a.studyId) + ",1,study," + boost::lexical_cast<std::string>(a.patientId) + ",2\n"));
+  ASSERT_EQ(std::string::npos, s.find(",patient,"));
+
+  // The second delta also covers the changes of the first one
+  Orthanc::SystemToolbox::ReadFile(s, root + "/resources-00000000000000000003.csv");
+  ASSERT_NE(std::string::npos, s.find("\n" + boost::lexical_cast<std::string>(a.patientId) + ",0,patient,,3\n"));
+  ASSERT_NE(std::string::npos, s.find(",study,"));
+
+  Orthanc::SystemToolbox::ReadFile(s, root + "/tags-00000000000000000003.csv");
+  ASSERT_NE(std::string::npos, s.find("\n" + boost::lexical_cast<std::string>(a.studyId) + ",8,4144,\"Hello, \"\"world\"\"\"\n"));
+
+  Orthanc::SystemToolbox::ReadFile(s, root + "/attachments-00000000000000000003.csv");
+  ASSERT_NE(std::string::npos, s.find("\n" + boost::lexical_cast<std::string>(a.instanceId) + ",1,40,42\n"));
+
+  boost::filesystem::remove_all(root);
+}
+
+
+TEST(SQLite, QueryParsing)
+{
+  {
+    OrthancDatabases::Query query("${a}SELECT ${b} FROM t WHERE x=${a} AND y='${'");
+    ASSERT_TRUE(query.HasParameter("a"));
+    ASSERT_TRUE(query.HasParameter("b"));
+    ASSERT_FALSE(query.HasParameter("c"));
+    query.SetType("b", OrthancDatabases::ValueType_Integer64);
+    ASSERT_EQ(OrthancDatabases::ValueType_Utf8String, query.GetType("a"));
+    ASSERT_EQ(OrthancDatabases::ValueType_Integer64, query.GetType("b"));
+    ASSERT_THROW(query.GetType("c"), Orthanc::OrthancException);
+
+    OrthancDatabases::GenericFormatter formatter(OrthancDatabases::Dialect_PostgreSQL);
+    std::string sql;
+    query.Format(sql, formatter);
+    ASSERT_EQ("$1SELECT $2 FROM t WHERE x=$3 AND y='${'", sql);
+    ASSERT_EQ(3u, formatter.GetParametersCount());
+    ASSERT_EQ("a", formatter.GetParameterName(0));
+    ASSERT_EQ("b", formatter.GetParameterName(1));
+    ASSERT_EQ("a", formatter.GetParameterName(2));
+    ASSERT_EQ(OrthancDatabases::ValueType_Integer64, formatter.GetParameterType(1));
+  }
+
+  {
+    OrthancDatabases::Query query("SELECT 1");
+    ASSERT_FALSE(query.HasParameter("a"));
+
+    OrthancDatabases::GenericFormatter formatter(OrthancDatabases::Dialect_SQLite);
+    std::string sql;
+    query.Format(sql, formatter);
+    ASSERT_EQ("SELECT 1", sql);
+    ASSERT_EQ(0u, formatter.GetParametersCount());
+  }
+}
+
+
+TEST(SQLite, Dictionary)
+{
+  OrthancDatabases::Dictionary d;
+
+  // More values than inline slots, to test the overflow
+  for (int i = 0; i < 20; i++)
+  {
+    const std::string key = "k" + boost::lexical_cast<std::string>(i);
+
+    if (i % 2 == 0)
+    {
+      d.SetIntegerValue(key, i);
+    }
+    else
+    {
+      d.SetUtf8Value(key, "v" + boost::lexical_cast<std::string>(i));
+    }
+  }
+
+  for (int i = 0; i < 20; i++)
+  {
+    const std::string key = "k" + boost::lexical_cast<std::string>(i);
+    ASSERT_TRUE(d.HasKey(key));
+
+    if (i % 2 == 0)
+    {
+      ASSERT_EQ(i, dynamic_cast<const OrthancDatabases::Integer64Value&>(d.GetValue(key)).GetValue());
+    }
+    else
+    {
+      ASSERT_EQ("v" + boost::lexical_cast<std::string>(i),
+                dynamic_cast<const OrthancDatabases::Utf8StringValue&>(d.GetValue(key)).GetContent());
+    }
+  }
+
+  d.SetUtf8Value("k0", "hello");   // Replace an inline integer by a string
+  d.SetIntegerValue("k1", 42);     // Replace an inline string by an integer
+  d.SetIntegerValue("k19", 43);    // Replace an overflowing value
+  d.Remove("k2");
+  d.Remove("k15");
+  d.Remove("nope");
+  d.SetIntegerValue("k2", 44);
+
+  ASSERT_FALSE(d.HasKey("k15"));
+  ASSERT_EQ("hello", dynamic_cast<const OrthancDatabases::Utf8StringValue&>(d.GetValue("k0")).GetContent());
+  ASSERT_EQ(42, dynamic_cast<const OrthancDatabases::Integer64Value&>(d.GetValue("k1")).GetValue());
+  ASSERT_EQ(43, dynamic_cast<const OrthancDatabases::Integer64Value&>(d.GetValue("k19")).GetValue());
+  ASSERT_EQ(44, dynamic_cast<const OrthancDatabases::Integer64Value&>(d.GetValue("k2")).GetValue());
+  ASSERT_THROW(d.GetValue("k15"), Orthanc::OrthancException);
+
+  std::list<std::string> keys;
+  d.ListKeys(keys);
+  ASSERT_EQ(19u, keys.size());
+  ASSERT_EQ("k0", keys.front());
+  ASSERT_EQ("k9", keys.back());
+
+  OrthancDatabases::Dictionary copy;
+  d.Copy(copy);
+  ASSERT_TRUE(copy.HasKey("k19"));
+  ASSERT_FALSE(copy.HasKey("k15"));
+  ASSERT_EQ(42, dynamic_cast<const OrthancDatabases::Integer64Value&>(copy.GetValue("k1")).GetValue());
+
+  std::string s;
+  d.Format(s);
+  ASSERT_EQ(0u, s.find("${k0}=\"hello\", ${k1}=42, ${k10}=10"));
+
+  d.Clear();
+  ASSERT_FALSE(d.HasKey("k0"));
+  ASSERT_FALSE(d.HasKey("k19"));
+}
+
+
+TEST(SQLite, StatementId)
+{
+  using namespace OrthancDatabases;
+
+  // The file names are compared by content, not by pointer
+  std::string file1 = "file.cpp";
+  std::string file2 = "file.cpp";
+  ASSERT_TRUE(StatementId(file1.c_str(), 10) == StatementId(file2.c_str(), 10));
+  ASSERT_EQ(StatementId(file1.c_str(), 10).GetHash(), StatementId(file2.c_str(), 10).GetHash());
+
+  ASSERT_FALSE(StatementId("file.cpp", 10) == StatementId("file.cpp", 11));
+  ASSERT_FALSE(StatementId("file.cpp", 10) == StatementId("other.cpp", 10));
+  ASSERT_FALSE(StatementId("file.cpp", 10) == StatementId("file.cpp", 10, "SELECT 1"));
+  ASSERT_FALSE(StatementId("file.cpp", 10, "SELECT 1") == StatementId("file.cpp", 10, "SELECT 2"));
+  ASSERT_TRUE(StatementId("file.cpp", 10, "SELECT 1") == StatementId("file.cpp", 10, "SELECT 1"));
+
+  const StatementId a("file.cpp", 10, "SELECT 1");
+  const StatementId b("file.cpp", 10, "SELECT 2");
+  ASSERT_TRUE((a < b) != (b < a));
+  ASSERT_FALSE(a < a);
+}
+
+
+#if ORTHANC_PLUGINS_HAS_DATABASE_CONSTRAINT == 1
+// Formatter of the SQLite dialect, without any cache of the plugin
+class BenchmarkLookupFormatter : public OrthancDatabases::ISqlLookupFormatter
+{
+private:
+  size_t  count_;
+
+public:
+  BenchmarkLookupFormatter() :
+    count_(0)
+  {
+  }
+
+  virtual std::string GenerateParameter(const std::string& value) ORTHANC_OVERRIDE
+  {
+    return "${p" + boost::lexical_cast<std::string>(count_++) + "}";
+  }
+
+  virtual std::string FormatResourceType(Orthanc::ResourceType level) ORTHANC_OVERRIDE
+  {
+    return boost::lexical_cast<std::string>(OrthancDatabases::MessagesToolbox::ConvertToPlainC(level));
+  }
+
+  virtual std::string FormatWildcardEscape() ORTHANC_OVERRIDE
+  {
+    return "ESCAPE '\\'";
+  }
+
+  virtual std::string FormatLimits(uint64_t since,
+                                   uint64_t count) ORTHANC_OVERRIDE
+  {
+    return (count > 0 ? " LIMIT " + boost::lexical_cast<std::string>(count) : std::string()) +
+      (since > 0 ? " OFFSET " + boost::lexical_cast<std::string>(since) : std::string());
+  }
+
+  virtual std::string FormatNull(const char* type) ORTHANC_OVERRIDE
+  {
+    return "NULL";
+  }
+
+  virtual bool IsEscapeBrackets() const ORTHANC_OVERRIDE
+  {
+    return false;
+  }
+
+  virtual bool SupportsNullsLast() const ORTHANC_OVERRIDE
+  {
+    return true;
+  }
+
+  virtual bool IsOrderByRequiredByLimits() const ORTHANC_OVERRIDE
+  {
+    return false;
+  }
+
+  virtual bool HasWildcardFullTextIndex() const ORTHANC_OVERRIDE
+  {
+    return false;
+  }
+
+  virtual bool HasBytewiseComparison() const ORTHANC_OVERRIDE
+  {
+    return true;
+  }
+
+  virtual std::string FormatBytewiseComparison(const std::string& column,
+                                               const std::string& op,
+                                               const std::string& parameter) const ORTHANC_OVERRIDE
+  {
+    return column + " " + op + " " + parameter;
+  }
+
+  virtual std::string FormatLowerValue(const std::string& column) const ORTHANC_OVERRIDE
+  {
+    return "lower(" + column + ")";
+  }
+
+  virtual const std::vector<int64_t>* GetLabelsResources() const ORTHANC_OVERRIDE
+  {
+    return NULL;
+  }
+
+  virtual const std::vector<int64_t>* GetCandidateResources() const ORTHANC_OVERRIDE
+  {
+    return NULL;
+  }
+
+  virtual const std::vector<int64_t>* GetHiddenResources(Orthanc::ResourceType level) const ORTHANC_OVERRIDE
+  {
+    return NULL;
+  }
+
+  virtual bool IsSortKey(int64_t sortKey) const ORTHANC_OVERRIDE
+  {
+    return false;
+  }
+};
+
+
+/**
+ * Per-statement overhead of the primitives of the framework, measured
+ * on an in-memory SQLite database so that the results don't depend on
+ * a server. This gives the baseline of the optimizations of the hot
+ * paths of the framework. The test is disabled by default, run it with:
+ *
+ *   ./UnitTests --gtest_also_run_disabled_tests --gtest_filter=SQLite.DISABLED_FrameworkBenchmark
+ *
+ * The number of iterations is set by the "ORTHANC_BENCHMARK_ITERATIONS"
+ * environment variable.
+ **/
+TEST(SQLite, DISABLED_FrameworkBenchmark)
+{
+  using namespace OrthancDatabases;
+
+  const unsigned int iterations = std::max(1u, GetBenchmarkParameter("ORTHANC_BENCHMARK_ITERATIONS", 100000));
+  const std::string sql = ("SELECT internalId, publicId FROM Resources WHERE resourceType=${type} "
+                           "AND parentId=${parent} AND publicId<>${id} LIMIT ${limit}");
+
+  {
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    for (unsigned int i = 0; i < iterations; i++)
+    {
+      Query query(sql);
+      query.SetType("type", ValueType_Integer64);
+      query.SetType("parent", ValueType_Integer64);
+      query.SetType("limit", ValueType_Integer64);
+    }
+
+    PrintBenchmark("Query (parsing)", start, iterations);
+  }
+
+  {
+    const Query query(sql);
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    for (unsigned int i = 0; i < iterations; i++)
+    {
+      GenericFormatter formatter(Dialect_PostgreSQL);
+      std::string s;
+      query.Format(s, formatter);
+    }
+
+    PrintBenchmark("Query::Format (GenericFormatter)", start, iterations);
+  }
+
+  {
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    for (unsigned int i = 0; i < iterations; i++)
+    {
+      Dictionary args;
+      args.SetIntegerValue("type", 1);
+      args.SetIntegerValue("parent", i);
+      args.SetUtf8Value("id", "8a8cf898-ca27c490-d0c7058c-929d0581-2bbf104d");
+      args.SetIntegerValue("limit", 100);
+    }
+
+    PrintBenchmark("Dictionary (4 values)", start, iterations);
+  }
+
+  {
+    DatabaseConstraints lookup;
+
+    std::vector<std::string> values;
+    values.push_back("PATIENT");
+    lookup.AddConstraint(new DatabaseConstraint(Orthanc::ResourceType_Patient, Orthanc::DicomTag(0x0010, 0x0020), true,
+                                                ConstraintType_Equal, values, true, true));
+
+    values[0] = "20240101";
+    lookup.AddConstraint(new DatabaseConstraint(Orthanc::ResourceType_Study, Orthanc::DicomTag(0x0008, 0x0020), false,
+                                                ConstraintType_GreaterOrEqual, values, true, true));
+
+    values[0] = "CT*";
+    lookup.AddConstraint(new DatabaseConstraint(Orthanc::ResourceType_Study, Orthanc::DicomTag(0x0008, 0x1030), false,
+                                                ConstraintType_Wildcard, values, false, true));
+
+    const std::set<std::string> labels;
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    for (unsigned int i = 0; i < iterations; i++)
+    {
+      BenchmarkLookupFormatter formatter;
+      std::string s;
+      ISqlLookupFormatter::Apply(s, formatter, lookup, Orthanc::ResourceType_Study, labels, LabelsConstraint_All, 100);
+    }
+
+    PrintBenchmark("ISqlLookupFormatter::Apply (3 constraints)", start, iterations);
+  }
+
+  std::list<IdentifierTag> identifierTags;
+  SQLiteIndex db(NULL);  // Open in memory
+  std::unique_ptr<DatabaseManager> manager(IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+
+  {
+    DatabaseManager::Transaction t(*manager, TransactionType_ReadOnly);
+
+    Dictionary args;
+    args.SetIntegerValue("x", 42);
+
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    for (unsigned int i = 0; i < iterations; i++)
+    {
+      DatabaseManager::CachedStatement statement(STATEMENT_FROM_HERE, *manager, "SELECT ${x}");
+      statement.SetParameterType("x", ValueType_Integer64);
+      statement.Execute(args);
+      ASSERT_EQ(42, statement.ReadInteger64(0));
+    }
+
+    PrintBenchmark("CachedStatement (lookup + execute)", start, iterations);
+    t.Commit();
+  }
+
+  {
+    const unsigned int ROWS = 1000;
+
+    DatabaseManager::Transaction t(*manager, TransactionType_ReadOnly);
+
+    Dictionary args;
+    args.SetIntegerValue("count", ROWS);
+
+    const unsigned int countQueries = std::max(1u, iterations / ROWS);
+    const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+    for (unsigned int i = 0; i < countQueries; i++)
+    {
+      DatabaseManager::CachedStatement statement(
+        STATEMENT_FROM_HERE, *manager,
+        "WITH RECURSIVE Numbers(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM Numbers WHERE x < ${count}) "
+        "SELECT x, 'value' || x, NULL FROM Numbers");
+      statement.SetParameterType("count", ValueType_Integer64);
+      statement.Execute(args);
+
+      unsigned int count = 0;
+      while (!statement.IsDone())
+      {
+        statement.ReadInteger64(0);
+        statement.ReadStringReference(1);
+        statement.IsNull(2);
+        statement.Next();
+        count++;
+      }
+
+      ASSERT_EQ(ROWS, count);
+    }
+
+    PrintBenchmark("ResultBase (decoding of 3 fields per row)", start, countQueries * ROWS);
+    t.Commit();
+  }
+
+  manager->Close();
+}
+#endif
+
+TEST(SQLite, ImplicitTransaction)
+{
+  OrthancDatabases::SQLiteDatabase db;
+  db.OpenInMemory();
+
+  ASSERT_FALSE(db.GetObject().DoesTableExist("test"));
+  ASSERT_FALSE(db.GetObject().DoesTableExist("test2"));
+
+  {
+    std::unique_ptr<OrthancDatabases::ITransaction> t(db.CreateTransaction(OrthancDatabases::TransactionType_ReadWrite));
+    ASSERT_FALSE(t->IsImplicit());
+  }
+
+  {
+    OrthancDatabases::Query query("CREATE TABLE test(id INT)", false);
+    std::unique_ptr<OrthancDatabases::IPrecompiledStatement> s(db.Compile(query));
+    
+    std::unique_ptr<OrthancDatabases::ITransaction> t(db.CreateTransaction(OrthancDatabases::TransactionType_Implicit));
+    ASSERT_TRUE(t->IsImplicit());
+    ASSERT_THROW(t->Commit(), Orthanc::OrthancException);
+    ASSERT_THROW(t->Rollback(), Orthanc::OrthancException);
+
+    OrthancDatabases::Dictionary args;
+    t->ExecuteWithoutResult(*s, args);
+    ASSERT_THROW(t->Rollback(), Orthanc::OrthancException);
+    t->Commit();
+
+    ASSERT_THROW(t->Commit(), Orthanc::OrthancException);
+  }
+
+  {
+    // An implicit transaction does not need to be explicitely committed
+    OrthancDatabases::Query query("CREATE TABLE test2(id INT)", false);
+    std::unique_ptr<OrthancDatabases::IPrecompiledStatement> s(db.Compile(query));
+    
+    std::unique_ptr<OrthancDatabases::ITransaction> t(db.CreateTransaction(OrthancDatabases::TransactionType_Implicit));
+
+    OrthancDatabases::Dictionary args;
+    t->ExecuteWithoutResult(*s, args);
   }
 
   ASSERT_TRUE(db.GetObject().DoesTableExist("test"));
@@ -110,6 +1277,1021 @@ TEST(SQLite, ImplicitTransaction)
 }
 
 
+TEST(SQLite, CachedStatementsEviction)
+{
+  std::list<OrthancDatabases::IdentifierTag> identifierTags;
+
+  OrthancDatabases::SQLiteIndex db(NULL);
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+
+  manager->SetMaxCachedStatements(2);
+  ASSERT_LE(manager->GetCachedStatementsCount(), 2u);
+
+  const OrthancDatabases::StatementId pinned(__FILE__, __LINE__, "SELECT 100");
+
+  {
+    OrthancDatabases::DatabaseManager::Transaction t(*manager, OrthancDatabases::TransactionType_ReadOnly);
+
+    OrthancDatabases::DatabaseManager::CachedStatement a(pinned, *manager, "SELECT 100");
+    a.Execute();
+    ASSERT_EQ(100, a.ReadInteger64(0));
+
+    for (int i = 0; i < 5; i++)
+    {
+      // The statement "a" is in use, so it must not be evicted
+      const std::string sql = "SELECT " + boost::lexical_cast<std::string>(i);
+      OrthancDatabases::DatabaseManager::CachedStatement b(STATEMENT_FROM_HERE_DYNAMIC(sql), *manager, sql);
+      b.Execute();
+      ASSERT_EQ(i, b.ReadInteger64(0));
+      ASSERT_EQ(100, a.ReadInteger64(0));
+    }
+
+    t.Commit();
+  }
+
+  ASSERT_EQ(2u, manager->GetCachedStatementsCount());
+
+  {
+    OrthancDatabases::DatabaseManager::CachedStatement a(pinned, *manager, "SELECT 100");
+    a.Execute();
+    ASSERT_EQ(100, a.ReadInteger64(0));
+  }
+
+  const OrthancDatabases::DatabaseManager::StatementsStatistics& statistics = manager->GetStatementsStatistics();
+  ASSERT_TRUE(statistics.find(pinned) != statistics.end());
+  ASSERT_EQ(1u, statistics.find(pinned)->second.GetMisses());
+  ASSERT_EQ(1u, statistics.find(pinned)->second.GetHits());
+  ASSERT_EQ(2u, statistics.find(pinned)->second.GetExecutions());
+
+  // The counters of the evicted dynamic statements are aggregated,
+  // which bounds their number by the size of the cache
+  size_t countDynamic = 0;
+  for (OrthancDatabases::DatabaseManager::StatementsStatistics::const_iterator
+         it = statistics.begin(); it != statistics.end(); ++it)
+  {
+    if (!it->first.GetDynamicStatement().empty())
+    {
+      countDynamic++;
+    }
+  }
+
+  ASSERT_LE(countDynamic, manager->GetCachedStatementsCount());
+  ASSERT_LE(4u, manager->GetEvictedStatementsStatistics().GetMisses());
+  ASSERT_LE(4u, manager->GetEvictedStatementsStatistics().GetExecutions());
+
+  manager->SetMaxCachedStatements(0);
+  ASSERT_EQ(2u, manager->GetCachedStatementsCount());
+}
+
+
+namespace
+{
+  class InvalidateAction : public OrthancDatabases::DatabaseManager::ICommitAction
+  {
+  private:
+    OrthancDatabases::ResourcesLookupCache&  cache_;
+    std::string                              publicId_;
+
+  public:
+    InvalidateAction(OrthancDatabases::ResourcesLookupCache& cache,
+                     const std::string& publicId) :
+      cache_(cache),
+      publicId_(publicId)
+    {
+    }
+
+    virtual void Execute() ORTHANC_OVERRIDE
+    {
+      cache_.Invalidate(publicId_);
+    }
+  };
+}
+
+
+TEST(SQLite, CommitActions)
+{
+  std::list<OrthancDatabases::IdentifierTag> identifierTags;
+
+  OrthancDatabases::SQLiteIndex db(NULL);
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+
+  OrthancDatabases::ResourcesLookupCache cache;
+  cache.SetMaxSize(10);
+
+  int64_t id;
+  OrthancPluginResourceType type;
+
+  {
+    OrthancDatabases::DatabaseManager::Transaction t(*manager, OrthancDatabases::TransactionType_ReadOnly);
+    cache.StoreResource(manager->GetTransactionSequence(), "a", 42, OrthancPluginResourceType_Patient);
+    t.Commit();
+  }
+
+  ASSERT_TRUE(cache.LookupResource(id, type, "a"));
+  ASSERT_EQ(42, id);
+
+  {
+    // The invalidation is dropped by a rollback
+    OrthancDatabases::DatabaseManager::Transaction t(*manager, OrthancDatabases::TransactionType_ReadWrite);
+    manager->AddCommitAction(new InvalidateAction(cache, "a"));
+    t.Rollback();
+  }
+
+  ASSERT_TRUE(cache.LookupResource(id, type, "a"));
+
+  {
+    OrthancDatabases::DatabaseManager::Transaction t(*manager, OrthancDatabases::TransactionType_ReadWrite);
+    manager->AddCommitAction(new InvalidateAction(cache, "a"));
+    ASSERT_TRUE(cache.LookupResource(id, type, "a"));  // Not committed yet
+    t.Commit();
+  }
+
+  ASSERT_FALSE(cache.LookupResource(id, type, "a"));
+
+  // Without an explicit transaction, the action is executed immediately
+  cache.StoreResource(OrthancDatabases::DatabaseManager::GetLastTransactionSequence() + 1, "a", 42, OrthancPluginResourceType_Patient);
+  ASSERT_TRUE(cache.LookupResource(id, type, "a"));
+  manager->AddCommitAction(new InvalidateAction(cache, "a"));
+  ASSERT_FALSE(cache.LookupResource(id, type, "a"));
+
+  {
+    // A lookup from a transaction that was started before the
+    // invalidation might predate the deletion, so it is not stored
+    OrthancDatabases::DatabaseManager::Transaction t(*manager, OrthancDatabases::TransactionType_ReadOnly);
+    const uint64_t sequence = manager->GetTransactionSequence();
+    cache.Invalidate("a");
+    cache.StoreResource(sequence, "a", 42, OrthancPluginResourceType_Patient);
+    ASSERT_FALSE(cache.LookupResource(id, type, "a"));
+    t.Commit();
+  }
+
+  {
+    OrthancDatabases::DatabaseManager::Transaction t(*manager, OrthancDatabases::TransactionType_ReadOnly);
+    cache.StoreResource(manager->GetTransactionSequence(), "a", 43, OrthancPluginResourceType_Patient);
+    ASSERT_TRUE(cache.LookupResource(id, type, "a"));
+    ASSERT_EQ(43, id);
+    t.Commit();
+  }
+
+  // "Clear()" also discards the lookups of the former transactions
+  const uint64_t sequence = OrthancDatabases::DatabaseManager::GetLastTransactionSequence();
+  cache.Clear();
+  cache.StoreResource(sequence, "b", 44, OrthancPluginResourceType_Study);
+  ASSERT_FALSE(cache.LookupResource(id, type, "b"));
+}
+
+
+TEST(SQLite, StatementsWarmup)
+{
+  std::list<OrthancDatabases::IdentifierTag> identifierTags;
+
+  OrthancDatabases::StatementsWarmup warmup(1);
+  ASSERT_THROW(OrthancDatabases::StatementsWarmup(0), Orthanc::OrthancException);
+
+  const OrthancDatabases::StatementId hot(__FILE__, __LINE__);
+  const OrthancDatabases::StatementId cold(__FILE__, __LINE__);
+
+  OrthancDatabases::SQLiteIndex db(NULL);
+
+  for (unsigned int i = 0; i < 3; i++)
+  {
+    // Simulates 3 connections that use the "hot" statement, and 1 connection that uses the "cold" one
+    std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+    manager->SetStatementsWarmup(&warmup);
+
+    OrthancDatabases::DatabaseManager::CachedStatement s(i == 0 ? cold : hot, *manager, "SELECT ${x}");
+    s.SetParameterType("x", OrthancDatabases::ValueType_Integer64);
+
+    OrthancDatabases::Dictionary args;
+    args.SetIntegerValue("x", 42);
+    s.Execute(args);
+    ASSERT_EQ(42, s.ReadInteger64(0));
+  }
+
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+  manager->SetStatementsWarmup(&warmup);
+
+  // Simulates the loss of the connection to the database, then its re-opening
+  manager->Close();
+  ASSERT_EQ(0u, manager->GetCachedStatementsCount());
+  manager->GetDatabase();
+  ASSERT_EQ(1u, manager->GetCachedStatementsCount());
+
+  {
+    OrthancDatabases::DatabaseManager::CachedStatement s(hot, *manager, "SELECT ${x}");
+    s.SetParameterType("x", OrthancDatabases::ValueType_Integer64);
+
+    OrthancDatabases::Dictionary args;
+    args.SetIntegerValue("x", 43);
+    s.Execute(args);
+    ASSERT_EQ(43, s.ReadInteger64(0));
+  }
+
+  const OrthancDatabases::DatabaseManager::StatementsStatistics& statistics = manager->GetStatementsStatistics();
+  ASSERT_TRUE(statistics.find(hot) != statistics.end());
+  ASSERT_EQ(1u, statistics.find(hot)->second.GetMisses());
+  ASSERT_EQ(1u, statistics.find(hot)->second.GetHits());
+  ASSERT_TRUE(statistics.find(cold) == statistics.end());
+}
+
+
+namespace
+{
+  class SlowStatementsListener : public OrthancDatabases::DatabaseManager::ISlowStatementListener
+  {
+  private:
+    unsigned int  count_;
+    std::string   sql_;
+    std::string   parameters_;
+
+  public:
+    SlowStatementsListener() :
+      count_(0)
+    {
+    }
+
+    virtual void SignalSlowStatement(const std::string& sql,
+                                     const OrthancDatabases::Dictionary& parameters,
+                                     uint64_t executeTime) ORTHANC_OVERRIDE
+    {
+      OrthancDatabases::Dictionary copy;
+      parameters.Copy(copy);
+
+      count_++;
+      sql_ = sql;
+      copy.Format(parameters_);
+    }
+
+    unsigned int GetCount() const
+    {
+      return count_;
+    }
+
+    const std::string& GetSql() const
+    {
+      return sql_;
+    }
+
+    const std::string& GetParameters() const
+    {
+      return parameters_;
+    }
+  };
+}
+
+
+TEST(SQLite, SlowStatements)
+{
+  std::list<OrthancDatabases::IdentifierTag> identifierTags;
+
+  OrthancDatabases::SQLiteIndex db(NULL);
+  std::unique_ptr<OrthancDatabases::DatabaseManager> manager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(db, false, identifierTags));
+
+  SlowStatementsListener listener;
+  manager->SetSlowStatementListener(&listener);
+
+  // Takes much more than 1 millisecond
+  const std::string sql = ("WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x + 1 FROM c WHERE x < ${max}) "
+                           "SELECT COUNT(*) FROM c");
+
+  OrthancDatabases::Dictionary args;
+  args.SetIntegerValue("max", 1000000);
+
+  for (unsigned int i = 0; i < 2; i++)
+  {
+    if (i == 1)
+    {
+      manager->SetSlowStatementThreshold(1);
+    }
+
+    OrthancDatabases::DatabaseManager::CachedStatement statement(STATEMENT_FROM_HERE, *manager, sql);
+    statement.SetParameterType("max", OrthancDatabases::ValueType_Integer64);
+    statement.Execute(args);
+    ASSERT_EQ(1000000, statement.ReadInteger64(0));
+    ASSERT_EQ(i, listener.GetCount());
+  }
+
+  ASSERT_EQ(sql, listener.GetSql());
+  ASSERT_EQ("${max}=1000000", listener.GetParameters());
+
+  {
+    OrthancDatabases::DatabaseManager::StandaloneStatement statement(*manager, sql);
+    statement.SetParameterType("max", OrthancDatabases::ValueType_Integer64);
+    statement.Execute(args);
+    ASSERT_EQ(1000000, statement.ReadInteger64(0));
+    ASSERT_EQ(2u, listener.GetCount());
+  }
+
+  {
+    // Fast statements are not reported
+    OrthancDatabases::DatabaseManager::CachedStatement statement(STATEMENT_FROM_HERE, *manager, "SELECT 42");
+    statement.Execute();
+    ASSERT_EQ(42, statement.ReadInteger64(0));
+    ASSERT_EQ(2u, listener.GetCount());
+  }
+
+  manager->SetSlowStatementListener(NULL);
+}
+
+
+TEST(SQLite, RetryPolicy)
+{
+  OrthancDatabases::RetryPolicy policy;
+
+  unsigned int delay = 0;
+  for (unsigned int i = 0; i < 20; i++)
+  {
+    const unsigned int next = policy.GetNextDelay(delay);
+    ASSERT_GE(next, 20u);
+    ASSERT_LE(next, std::max(20u, std::min(2000u, 3 * delay)));
+    delay = next;
+  }
+
+  // The first retry is always allowed, the next ones consume the budget
+  unsigned int count = 0;
+  while (policy.TryRetry(1))
+  {
+    count++;
+  }
+
+  ASSERT_EQ(20u, count);
+  ASSERT_TRUE(policy.TryRetry(0));
+
+  for (unsigned int i = 0; i < 5; i++)
+  {
+    policy.SignalSuccess();
+  }
+
+  ASSERT_TRUE(policy.TryRetry(1));
+  ASSERT_FALSE(policy.TryRetry(1));
+
+  // Adaptive limit of the writers
+  ASSERT_EQ(0u, policy.GetMaxWriters());
+  policy.SetMaxWriters(8);
+  ASSERT_EQ(8u, policy.GetWritersLimit());
+
+  policy.SignalConflict();
+  ASSERT_EQ(4u, policy.GetWritersLimit());
+  policy.SignalConflict();  // Same burst of conflicts
+  ASSERT_EQ(4u, policy.GetWritersLimit());
+
+  {
+    OrthancDatabases::RetryPolicy::WriterSlot a(policy);
+    OrthancDatabases::RetryPolicy::WriterSlot b(policy);
+  }
+
+  for (unsigned int i = 0; i < 100; i++)
+  {
+    policy.SignalSuccess();
+  }
+
+  ASSERT_EQ(8u, policy.GetWritersLimit());
+
+  uint64_t successes, conflicts, retries, exhaustedRetries;
+  double conflictRate;
+  policy.GetStatistics(successes, conflicts, retries, exhaustedRetries, conflictRate);
+  ASSERT_EQ(105u, successes);
+  ASSERT_EQ(2u, conflicts);
+  ASSERT_EQ(22u, retries);
+  ASSERT_EQ(2u, exhaustedRetries);
+  ASSERT_GE(conflictRate, 0.0);
+  ASSERT_LT(conflictRate, 0.1);
+}
+
+
+TEST(SQLite, AdmissionController)
+{
+  OrthancDatabases::AdmissionController controller;
+
+  // Disabled by default
+  ASSERT_EQ(0u, controller.GetMaxInFlight());
+  ASSERT_TRUE(controller.Enter(false));
+  controller.Leave(1000);
+
+  controller.SetMaxInFlight(32);
+  ASSERT_EQ(32u, controller.GetLimit());
+
+  // 20 writers are in flight, with a stable latency
+  for (unsigned int i = 0; i < 20; i++)
+  {
+    ASSERT_TRUE(controller.Enter(true));
+  }
+
+  for (unsigned int i = 0; i < 100; i++)
+  {
+    ASSERT_TRUE(controller.Enter(false));
+    controller.Leave(1000);
+  }
+
+  ASSERT_EQ(32u, controller.GetLimit());
+
+  // The database slows down: The limit shrinks, and the readers are rejected
+  for (unsigned int i = 0; i < 50; i++)
+  {
+    ASSERT_TRUE(controller.Enter(true));
+    controller.Leave(20000);
+  }
+
+  ASSERT_LT(controller.GetLimit(), 20u);
+  ASSERT_GE(controller.GetLimit(), 1u);
+  ASSERT_FALSE(controller.Enter(false));
+  ASSERT_TRUE(controller.Enter(true));  // The writers are always admitted
+  controller.Cancel();
+
+  // The database recovers
+  for (unsigned int i = 0; i < 300; i++)
+  {
+    ASSERT_TRUE(controller.Enter(true));
+    controller.Leave(1000);
+  }
+
+  ASSERT_EQ(32u, controller.GetLimit());
+  ASSERT_TRUE(controller.Enter(false));
+  controller.Leave(1000);
+
+  for (unsigned int i = 0; i < 20; i++)
+  {
+    controller.Cancel();
+  }
+
+  uint64_t admitted, rejected;
+  size_t inFlight;
+  controller.GetStatistics(admitted, rejected, inFlight);
+  ASSERT_EQ(473u, admitted);
+  ASSERT_EQ(1u, rejected);
+  ASSERT_EQ(0u, inFlight);
+}
+
+
+TEST(SQLite, FilesystemStorage)
+{
+  const std::string root = (boost::filesystem::temp_directory_path() /
+                            boost::filesystem::unique_path("orthanc-%%%%-%%%%")).string();
+
+  {
+    OrthancDatabases::FilesystemStorage storage(root);
+
+    const std::string uuid = "c5f3ac1f-9b16-4a2c-91ab-5d2e4a0f6c1d";
+    storage.Create(uuid, "hello world", 11);
+    ASSERT_TRUE(boost::filesystem::exists(boost::filesystem::path(root) / "c5" / "f3" / uuid));
+    ASSERT_THROW(storage.Create(uuid, "hello", 5), Orthanc::OrthancException);
+
+    std::string s;
+    ASSERT_EQ(11u, storage.GetSize(uuid));
+    storage.ReadWhole(s, uuid);
+    ASSERT_EQ("hello world", s);
+
+    char buffer[5];
+    storage.ReadRange(buffer, uuid, 6, 5);
+    ASSERT_EQ("world", std::string(buffer, 5));
+    ASSERT_THROW(storage.ReadRange(buffer, uuid, 7, 5), Orthanc::OrthancException);
+
+    // The uuid cannot escape the root directory
+    ASSERT_THROW(storage.Create("../../etc/passwd", "", 0), Orthanc::OrthancException);
+
+    const std::string empty = "0b8e3d07-26b6-4f8d-a7f1-3c0f41f2a9e2";
+    storage.Create(empty, NULL, 0);
+    storage.ReadWhole(s, empty);
+    ASSERT_TRUE(s.empty());
+
+    storage.Remove(uuid);
+    ASSERT_THROW(storage.GetSize(uuid), Orthanc::OrthancException);
+    ASSERT_FALSE(boost::filesystem::exists(boost::filesystem::path(root) / "c5"));
+    storage.Remove(uuid);  // No error if the file doesn't exist
+  }
+
+  boost::filesystem::remove_all(root);
+}
+
+
+static void AddStudyConstraint(OrthancDatabases::DatabaseConstraints& constraints,
+                               const Orthanc::DicomTag& tag,
+                               OrthancDatabases::ConstraintType type,
+                               const std::string& value,
+                               bool mandatory)
+{
+  std::vector<std::string> values;
+  values.push_back(value);
+  constraints.AddConstraint(new OrthancDatabases::DatabaseConstraint(
+                              Orthanc::ResourceType_Study, tag, true, type, values, true, mandatory));
+}
+
+
+TEST(SQLite, StudyColumnStore)
+{
+  const boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+  const Orthanc::DicomTag name(0x0010, 0x0010);
+  const Orthanc::DicomTag date(0x0008, 0x0020);
+
+  OrthancDatabases::StudyColumnStore store;
+  ASSERT_FALSE(store.IsEnabled());
+
+  std::vector<Orthanc::DicomTag> tags;
+  tags.push_back(name);
+  tags.push_back(date);
+  store.SetTags(tags);
+  ASSERT_TRUE(store.IsEnabled());
+  ASSERT_FALSE(store.IsLoaded());
+
+  // Written before the reload, but possibly not visible to the reload
+  store.SetValue(30, 0x0010, 0x0010, "SMITH^JOHN", now);
+  store.SetValue(30, 0x0020, 0x000d, "1.2.3", now);  // Not stored
+
+  std::unique_ptr<OrthancDatabases::StudyColumnStore::Table> table(store.CreateTable());
+  ASSERT_TRUE(table->SetValue(10, name, "DOE^JOHN"));
+  ASSERT_TRUE(table->SetValue(10, date, "20240115"));
+  ASSERT_TRUE(table->SetValue(20, name, "DOE^JANE"));
+  ASSERT_TRUE(table->SetValue(20, date, "20231231"));
+  ASSERT_FALSE(table->SetValue(20, Orthanc::DicomTag(0x0020, 0x000d), "1.2.4"));
+  store.CommitReload(table.release(), now);
+  ASSERT_TRUE(store.IsLoaded());
+  ASSERT_EQ(3u, store.GetRowsCount());
+
+  OrthancDatabases::StudyColumnStore::Resources candidates;
+
+  {
+    OrthancDatabases::DatabaseConstraints constraints;
+    AddStudyConstraint(constraints, name, OrthancDatabases::ConstraintType_Wildcard, "DOE^J*", true);
+    ASSERT_TRUE(store.Evaluate(candidates, constraints, Orthanc::ResourceType_Study, 100));
+    ASSERT_EQ(2u, candidates.size());
+    ASSERT_EQ(10, candidates[0]);
+    ASSERT_EQ(20, candidates[1]);
+
+    // Only the study-level lookups are narrowed
+    ASSERT_FALSE(store.Evaluate(candidates, constraints, Orthanc::ResourceType_Series, 100));
+
+    // Too many candidates
+    ASSERT_FALSE(store.Evaluate(candidates, constraints, Orthanc::ResourceType_Study, 1));
+  }
+
+  {
+    OrthancDatabases::DatabaseConstraints constraints;
+    AddStudyConstraint(constraints, name, OrthancDatabases::ConstraintType_Wildcard, "?MITH^JOH?", true);
+    ASSERT_TRUE(store.Evaluate(candidates, constraints, Orthanc::ResourceType_Study, 100));
+    ASSERT_EQ(1u, candidates.size());
+    ASSERT_EQ(30, candidates[0]);
+  }
+
+  {
+    // Range on the dates, the study without date is excluded by a mandatory constraint
+    OrthancDatabases::DatabaseConstraints constraints;
+    AddStudyConstraint(constraints, date, OrthancDatabases::ConstraintType_GreaterOrEqual, "20240101", true);
+    AddStudyConstraint(constraints, date, OrthancDatabases::ConstraintType_SmallerOrEqual, "20241231", true);
+    ASSERT_TRUE(store.Evaluate(candidates, constraints, Orthanc::ResourceType_Study, 100));
+    ASSERT_EQ(1u, candidates.size());
+    ASSERT_EQ(10, candidates[0]);
+  }
+
+  {
+    // The optional constraints accept the missing values
+    OrthancDatabases::DatabaseConstraints constraints;
+    AddStudyConstraint(constraints, name, OrthancDatabases::ConstraintType_Equal, "DOE^JANE", true);
+    AddStudyConstraint(constraints, date, OrthancDatabases::ConstraintType_Equal, "20231231", false);
+    ASSERT_TRUE(store.Evaluate(candidates, constraints, Orthanc::ResourceType_Study, 100));
+    ASSERT_EQ(1u, candidates.size());
+    ASSERT_EQ(20, candidates[0]);
+  }
+
+  {
+    // Without a mandatory constraint, the studies without any stored value would be missed
+    OrthancDatabases::DatabaseConstraints constraints;
+    AddStudyConstraint(constraints, name, OrthancDatabases::ConstraintType_Equal, "DOE^JANE", false);
+    ASSERT_FALSE(store.Evaluate(candidates, constraints, Orthanc::ResourceType_Study, 100));
+  }
+
+  {
+    // An overwritten value might be rolled back: The study remains a candidate
+    store.SetValue(10, 0x0010, 0x0010, "DOE^JOHNNY", now);
+
+    OrthancDatabases::DatabaseConstraints constraints;
+    AddStudyConstraint(constraints, name, OrthancDatabases::ConstraintType_Equal, "DOE^JANE", true);
+    ASSERT_TRUE(store.Evaluate(candidates, constraints, Orthanc::ResourceType_Study, 100));
+    ASSERT_EQ(2u, candidates.size());
+    ASSERT_EQ(10, candidates[0]);
+    ASSERT_EQ(20, candidates[1]);
+  }
+
+  {
+    // The studies created by other servers are candidates until their values are read
+    store.AddPendingStudy(40);
+    store.AddPendingStudy(20);
+
+    OrthancDatabases::DatabaseConstraints constraints;
+    AddStudyConstraint(constraints, name, OrthancDatabases::ConstraintType_Equal, "SMITH^JOHN", true);
+    ASSERT_TRUE(store.Evaluate(candidates, constraints, Orthanc::ResourceType_Study, 100));
+    ASSERT_EQ(4u, candidates.size());
+    ASSERT_EQ(10, candidates[0]);
+    ASSERT_EQ(20, candidates[1]);
+    ASSERT_EQ(30, candidates[2]);
+    ASSERT_EQ(40, candidates[3]);
+
+    std::vector<int64_t> pending;
+    store.GetPendingStudies(pending, 1);
+    ASSERT_EQ(1u, pending.size());
+    ASSERT_EQ(20, pending[0]);
+    store.GetPendingStudies(pending, 10);
+    ASSERT_EQ(2u, pending.size());
+
+    store.SetValue(40, 0x0010, 0x0010, "SMITH^JANE", now);
+    store.RemovePendingStudies(pending);
+
+    ASSERT_TRUE(store.Evaluate(candidates, constraints, Orthanc::ResourceType_Study, 100));
+    ASSERT_EQ(2u, candidates.size());
+    ASSERT_EQ(10, candidates[0]);
+    ASSERT_EQ(30, candidates[1]);
+
+    store.Unload();
+    ASSERT_FALSE(store.IsLoaded());
+    ASSERT_FALSE(store.Evaluate(candidates, constraints, Orthanc::ResourceType_Study, 100));
+  }
+
+  {
+    // The low-cardinality values are dictionary-encoded
+    table.reset(store.CreateTable());
+    ASSERT_TRUE(table->SetValue(1, name, ""));
+    ASSERT_TRUE(table->SetValue(2, name, "CT"));
+    ASSERT_TRUE(table->SetValue(3, name, "MR"));
+    ASSERT_TRUE(table->SetValue(4, name, "CT"));
+    ASSERT_TRUE(table->IsEncoded(name));
+    ASSERT_FALSE(table->IsEncoded(Orthanc::DicomTag(0x0020, 0x000d)));
+
+    OrthancDatabases::DatabaseConstraints constraints;
+    AddStudyConstraint(constraints, name, OrthancDatabases::ConstraintType_Equal, "CT", true);
+    ASSERT_TRUE(table->Evaluate(candidates, constraints, 100));
+    ASSERT_EQ(2u, candidates.size());
+    ASSERT_EQ(2, candidates[0]);
+    ASSERT_EQ(4, candidates[1]);
+
+    constraints.Clear();
+    AddStudyConstraint(constraints, name, OrthancDatabases::ConstraintType_Equal, "", true);
+    ASSERT_TRUE(table->Evaluate(candidates, constraints, 100));
+    ASSERT_EQ(1u, candidates.size());
+    ASSERT_EQ(1, candidates[0]);
+
+    constraints.Clear();
+    AddStudyConstraint(constraints, name, OrthancDatabases::ConstraintType_Equal, "XA", true);
+    ASSERT_TRUE(table->Evaluate(candidates, constraints, 100));
+    ASSERT_TRUE(candidates.empty());
+
+    // The high-cardinality values are stored one by one
+    for (int64_t i = 0; i < 20000; i++)
+    {
+      ASSERT_TRUE(table->SetValue(10 + i, name, "value" + boost::lexical_cast<std::string>(i)));
+    }
+
+    ASSERT_FALSE(table->IsEncoded(name));
+    ASSERT_TRUE(table->Evaluate(candidates, constraints, 100));
+    ASSERT_TRUE(candidates.empty());
+
+    constraints.Clear();
+    AddStudyConstraint(constraints, name, OrthancDatabases::ConstraintType_Equal, "CT", true);
+    ASSERT_TRUE(table->Evaluate(candidates, constraints, 100));
+    ASSERT_EQ(2u, candidates.size());
+
+    constraints.Clear();
+    AddStudyConstraint(constraints, name, OrthancDatabases::ConstraintType_Equal, "value19999", true);
+    ASSERT_TRUE(table->Evaluate(candidates, constraints, 100));
+    ASSERT_EQ(1u, candidates.size());
+    ASSERT_EQ(20009, candidates[0]);
+  }
+}
+
+
+TEST(SQLite, RequestsRecorder)
+{
+  Orthanc::SystemToolbox::RemoveFile("requests.bin");
+
+  const boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+  {
+    OrthancDatabases::RequestsRecorder recorder("requests.bin", 2);
+
+    for (int i = 0; i < 5; i++)
+    {
+      const std::string request = "request" + boost::lexical_cast<std::string>(i);
+      recorder.Add(i, 10 * i, start, start + boost::posix_time::microseconds(i),
+                   (i % 2 == 0), request.c_str(), request.size());
+    }
+  }  // The last record is written by the destructor
+
+  std::ifstream stream("requests.bin", std::ios::binary);
+
+  OrthancDatabases::RequestsRecorder::Record record;
+  for (int i = 0; i < 5; i++)
+  {
+    ASSERT_TRUE(record.Read(stream));
+    ASSERT_EQ(i, record.GetTransaction());
+    ASSERT_EQ(10 * i, record.GetConnection());
+    ASSERT_EQ(static_cast<uint64_t>(i), record.GetDuration());
+    ASSERT_EQ(i % 2 == 0, record.IsSuccess());
+    ASSERT_EQ("request" + boost::lexical_cast<std::string>(i), record.GetRequest());
+  }
+
+  ASSERT_FALSE(record.Read(stream));
+}
+
+
+TEST(SQLite, IngestStatistics)
+{
+  OrthancDatabases::IngestStatistics statistics(2);
+
+  OrthancDatabases::IngestStatistics::Timeline timeline;
+  ASSERT_FALSE(timeline.IsIngest());
+  timeline.Add(OrthancDatabases::IngestStatistics::Stage_Other, 1000);
+  statistics.Add(timeline);  // Ignored, no instance was created
+
+  for (int i = 1; i <= 3; i++)
+  {
+    timeline.Reset();
+    timeline.SetInstance("instance" + boost::lexical_cast<std::string>(i));
+    ASSERT_TRUE(timeline.IsIngest());
+    timeline.Add(OrthancDatabases::IngestStatistics::Stage_CreateInstance, 10 * i);
+    timeline.Add(OrthancDatabases::IngestStatistics::Stage_AddAttachment, i);
+    timeline.Add(OrthancDatabases::IngestStatistics::Stage_AddAttachment, i);
+    timeline.Add(OrthancDatabases::IngestStatistics::Stage_Commit, 100 * i);
+    ASSERT_EQ(static_cast<uint64_t>(2 * i), timeline.GetDuration(OrthancDatabases::IngestStatistics::Stage_AddAttachment));
+    ASSERT_EQ(static_cast<uint64_t>(112 * i), timeline.GetTotal());
+    statistics.Add(timeline);
+  }
+
+  ASSERT_THROW(timeline.Add(OrthancDatabases::IngestStatistics::Stage_Count, 1), Orthanc::OrthancException);
+
+  Json::Value json;
+  statistics.Format(json);
+  ASSERT_EQ(3u, json["Total"]["Count"].asUInt());
+  ASSERT_EQ(3u, json["Stages"]["Commit"]["Count"].asUInt());
+  ASSERT_EQ(336u, json["Total"]["MaxMicroseconds"].asUInt());
+
+  // Only the 2 slowest ingests are kept, the slowest first
+  ASSERT_EQ(2u, json["Slowest"].size());
+  ASSERT_EQ("instance3", json["Slowest"][0]["Instance"].asString());
+  ASSERT_EQ("instance2", json["Slowest"][1]["Instance"].asString());
+  ASSERT_EQ(224u, json["Slowest"][1]["TotalMicroseconds"].asUInt());
+  ASSERT_EQ(4u, json["Slowest"][1]["StagesMicroseconds"]["AddAttachment"].asUInt());
+}
+
+
+TEST(SQLite, IndexAdvisor)
+{
+  const Orthanc::DicomTag studyDate(0x0008, 0x0020);
+  const Orthanc::DicomTag modality(0x0008, 0x0060);
+
+  OrthancDatabases::IndexAdvisor advisor;
+  advisor.SetEnabled(true);
+
+  for (int i = 0; i < 3; i++)
+  {
+    OrthancDatabases::IndexAdvisor::Shape shape(advisor);
+    shape.AddConstraint(studyDate, true);
+    shape.AddOrdering(studyDate, true);
+    shape.AddConstraint(modality, false);
+  }
+
+  {
+    OrthancDatabases::IndexAdvisor::Shape shape(advisor);  // Not recorded, as it has no tag
+  }
+
+  OrthancDatabases::IndexAdvisor::Usages usages;
+  advisor.GetUsages(usages);
+  ASSERT_EQ(2u, usages.size());
+  ASSERT_EQ(3u, usages[std::make_pair(studyDate, true)].constraints_);
+  ASSERT_EQ(3u, usages[std::make_pair(studyDate, true)].orderings_);
+  ASSERT_EQ(3u, usages[std::make_pair(modality, false)].constraints_);
+  ASSERT_EQ(0u, usages[std::make_pair(modality, false)].orderings_);
+
+  usages[std::make_pair(studyDate, true)].microseconds_ = 1000;
+  usages[std::make_pair(modality, false)].microseconds_ = 5000;
+
+  std::vector<OrthancDatabases::IndexAdvisor::Key> keys;
+  OrthancDatabases::IndexAdvisor::GetSortedKeys(keys, usages);
+  ASSERT_EQ(2u, keys.size());
+  ASSERT_TRUE(keys[0].first == modality);
+  ASSERT_TRUE(keys[1].first == studyDate);
+
+  Json::Value json;
+  OrthancDatabases::IndexAdvisor::Format(json, keys[0], usages[keys[0]]);
+  ASSERT_EQ("MainDicomTags", json["Table"].asString());
+  ASSERT_EQ(3u, json["Constraints"].asUInt());
+  ASSERT_EQ(5u, json["TotalMilliseconds"].asUInt());
+
+  ASSERT_EQ("MainDicomTagsAdvised00080060", OrthancDatabases::IndexAdvisor::FormatIndexName(modality));
+
+  advisor.Clear();
+  advisor.GetUsages(usages);
+  ASSERT_TRUE(usages.empty());
+}
+
+
+TEST(SQLite, HiddenResources)
+{
+  OrthancDatabases::HiddenResources hidden;
+  ASSERT_TRUE(hidden.IsEmpty());
+
+  hidden.Hide(42, Orthanc::ResourceType_Patient);
+  hidden.Hide(7, Orthanc::ResourceType_Patient);
+  hidden.Hide(10, Orthanc::ResourceType_Study);
+  ASSERT_FALSE(hidden.IsEmpty());
+
+  OrthancDatabases::HiddenResources::Snapshot snapshot;
+  hidden.GetSnapshot(snapshot);
+  ASSERT_EQ(2u, snapshot.size());
+  ASSERT_EQ(2u, snapshot[Orthanc::ResourceType_Patient].size());
+  ASSERT_EQ(7, snapshot[Orthanc::ResourceType_Patient][0]);
+  ASSERT_EQ(42, snapshot[Orthanc::ResourceType_Patient][1]);
+  ASSERT_EQ(1u, snapshot[Orthanc::ResourceType_Study].size());
+  ASSERT_EQ(10, snapshot[Orthanc::ResourceType_Study][0]);
+
+  hidden.Unhide(42);
+  hidden.Unhide(10);
+  hidden.Unhide(1000);  // Ignored
+  hidden.GetSnapshot(snapshot);
+  ASSERT_EQ(1u, snapshot.size());
+  ASSERT_EQ(1u, snapshot[Orthanc::ResourceType_Patient].size());
+  ASSERT_EQ(7, snapshot[Orthanc::ResourceType_Patient][0]);
+
+  hidden.Unhide(7);
+  ASSERT_TRUE(hidden.IsEmpty());
+  hidden.GetSnapshot(snapshot);
+  ASSERT_TRUE(snapshot.empty());
+}
+
+
+TEST(SQLite, TracesExporter)
+{
+  const boost::posix_time::ptime epoch(boost::gregorian::date(1970, 1, 1));
+  ASSERT_EQ("0", OrthancDatabases::TracesExporter::FormatTime(epoch));
+  ASSERT_EQ("1500000000", OrthancDatabases::TracesExporter::FormatTime(epoch + boost::posix_time::milliseconds(1500)));
+
+  {
+    // No exporter is started
+    OrthancDatabases::TracesExporter::Span span("test");
+    ASSERT_FALSE(span.IsEnabled());
+    span.SetAttribute("bytes", 42);
+    span.SetSuccess();
+  }
+
+  std::deque<Json::Value> spans;
+  spans.push_back(Json::objectValue);
+  spans.back()["name"] = "a";
+  spans.push_back(Json::objectValue);
+  spans.back()["name"] = "b";
+
+  Json::Value batch;
+  OrthancDatabases::TracesExporter::FormatBatch(batch, "service", spans);
+  ASSERT_EQ(1u, batch["resourceSpans"].size());
+
+  const Json::Value& resource = batch["resourceSpans"][0];
+  ASSERT_EQ("service.name", resource["resource"]["attributes"][0]["key"].asString());
+  ASSERT_EQ("service", resource["resource"]["attributes"][0]["value"]["stringValue"].asString());
+  ASSERT_EQ(1u, resource["scopeSpans"].size());
+  ASSERT_EQ(2u, resource["scopeSpans"][0]["spans"].size());
+  ASSERT_EQ("a", resource["scopeSpans"][0]["spans"][0]["name"].asString());
+  ASSERT_EQ("b", resource["scopeSpans"][0]["spans"][1]["name"].asString());
+}
+
+
+TEST(SQLite, IndexShards)
+{
+  ASSERT_THROW(OrthancDatabases::IndexShards(0), Orthanc::OrthancException);
+
+  {
+    OrthancDatabases::IndexShards single(1);
+    ASSERT_EQ(0u, single.GetPatientShard("patient"));
+    ASSERT_EQ(42, single.EncodeIdentifier(0, 42));
+    ASSERT_EQ(42, single.GetLocalSince(0, 42));
+  }
+
+  OrthancDatabases::IndexShards shards(3);
+  ASSERT_EQ(3u, shards.GetShardsCount());
+
+  // The shard of a patient doesn't depend on the platform (32-bit FNV-1a)
+  ASSERT_EQ(2166136261u % 3, shards.GetPatientShard(""));
+  ASSERT_EQ(shards.GetPatientShard("patient"), shards.GetPatientShard("patient"));
+
+  ASSERT_EQ(14, shards.EncodeIdentifier(2, 4));
+  ASSERT_EQ(2u, shards.GetShard(14));
+  ASSERT_EQ(4, shards.GetLocalIdentifier(14));
+  ASSERT_THROW(shards.EncodeIdentifier(3, 4), Orthanc::OrthancException);
+  ASSERT_THROW(shards.EncodeIdentifier(0, -1), Orthanc::OrthancException);
+  ASSERT_THROW(shards.EncodeIdentifier(2, std::numeric_limits<int64_t>::max() / 3), Orthanc::OrthancException);
+  ASSERT_THROW(shards.GetShard(-1), Orthanc::OrthancException);
+
+  for (size_t shard = 0; shard < 3; shard++)
+  {
+    for (int64_t since = 0; since < 10; since++)
+    {
+      // The next local sequence is the first one after "since"
+      const int64_t local = shards.GetLocalSince(shard, since);
+      ASSERT_LE(local * 3 + static_cast<int64_t>(shard), since);
+      ASSERT_GT(shards.EncodeIdentifier(shard, local + 1), since);
+    }
+  }
+
+  ASSERT_EQ(-1, shards.GetLocalSince(1, 0));
+  ASSERT_EQ(0, shards.GetLocalSince(0, 0));
+
+  std::vector< std::vector<int64_t> > pages(3);
+  std::vector<bool> done(3, true);
+
+  // Shard 0: 3 6 9 12,  shard 1: 4,  shard 2: 5 8 11
+  pages[0].push_back(3);
+  pages[0].push_back(6);
+  pages[0].push_back(9);
+  done[0] = false;
+  pages[1].push_back(4);
+  pages[2].push_back(5);
+  pages[2].push_back(8);
+  pages[2].push_back(11);
+
+  std::vector<int64_t> merged;
+  ASSERT_FALSE(OrthancDatabases::IndexShards::MergePages(merged, pages, done, 3));
+  ASSERT_EQ(3u, merged.size());
+  ASSERT_EQ(3, merged[0]);
+  ASSERT_EQ(4, merged[1]);
+  ASSERT_EQ(5, merged[2]);
+
+  pages[0].clear();
+  pages[0].push_back(12);
+  done[0] = true;
+  pages[1].clear();
+  pages[2].clear();
+  ASSERT_TRUE(OrthancDatabases::IndexShards::MergePages(merged, pages, done, 3));
+  ASSERT_EQ(1u, merged.size());
+  ASSERT_EQ(12, merged[0]);
+
+  // The merged page is full, and one shard can have more items
+  pages[0].clear();
+  pages[0].push_back(3);
+  done[0] = false;
+  pages[2].push_back(5);
+  pages[2].push_back(8);
+  ASSERT_FALSE(OrthancDatabases::IndexShards::MergePages(merged, pages, done, 3));
+  ASSERT_EQ(3u, merged.size());
+
+  done.pop_back();
+  ASSERT_THROW(OrthancDatabases::IndexShards::MergePages(merged, pages, done, 3), Orthanc::OrthancException);
+}
+
+
+TEST(SQLiteIndex, Replica)
+{
+  std::list<OrthancDatabases::IdentifierTag> identifierTags;
+
+  OrthancDatabases::SQLiteIndex source(NULL);  // Open in memory
+  std::unique_ptr<OrthancDatabases::DatabaseManager> sourceManager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(source, false, identifierTags));
+
+  OrthancDatabases::SQLiteIndex replica(NULL);
+  std::unique_ptr<OrthancDatabases::DatabaseManager> replicaManager(OrthancDatabases::IndexBackend::CreateSingleDatabaseManager(replica, false, identifierTags));
+
+  ASSERT_FALSE(replica.IsReplica());
+  ASSERT_THROW(replica.SetReplicaSource("http://localhost:8042", "", "", 0), Orthanc::OrthancException);
+  replica.SetReplicaSource("http://localhost:8042/", "", "", 10);
+  ASSERT_TRUE(replica.IsReplica());
+
+  Json::Value page;
+
+  {
+    OrthancDatabases::DatabaseManager::Transaction t(*sourceManager, OrthancDatabases::TransactionType_ReadWrite);
+    int64_t patient = source.CreateResource(*sourceManager, "patient", OrthancPluginResourceType_Patient);
+    int64_t study = source.CreateResource(*sourceManager, "study", OrthancPluginResourceType_Study);
+    source.AttachChild(*sourceManager, patient, study);
+    source.SetMainDicomTag(*sourceManager, study, 0x0008, 0x0020, "20240101");
+    source.AddLabel(*sourceManager, study, "hello");
+    source.ReadReplicaPage(page, *sourceManager, -1, 10, false);
+    t.Commit();
+  }
+
+  ASSERT_EQ(2u, page["Resources"].size());
+  ASSERT_TRUE(page["Done"].asBool());
+
+  {
+    OrthancDatabases::DatabaseManager::Transaction t(*replicaManager, OrthancDatabases::TransactionType_ReadWrite);
+    replica.ApplyReplicaPage(*replicaManager, page, true, -1);
+
+    int64_t id;
+    OrthancPluginResourceType type;
+    ASSERT_TRUE(replica.LookupResource(id, type, *replicaManager, "study"));
+    ASSERT_EQ(OrthancPluginResourceType_Study, type);
+    ASSERT_EQ(page["Resources"][1]["ID"].asInt64(), id);
+
+    std::list<std::string> labels;
+    replica.ListLabels(labels, *replicaManager, id);
+    ASSERT_EQ(1u, labels.size());
+    ASSERT_EQ("hello", labels.front());
+
+    // The study has been deleted from the source
+    Json::Value resources = Json::arrayValue;
+    resources.append(page["Resources"][0]);
+    page["Resources"] = resources;
+
+    replica.ApplyReplicaPage(*replicaManager, page, true, -1);
+    ASSERT_FALSE(replica.LookupResource(id, type, *replicaManager, "study"));
+    ASSERT_TRUE(replica.LookupResource(id, type, *replicaManager, "patient"));
+    t.Commit();
+  }
+}
+
+
 int main(int argc, char **argv)
 {
   ::testing::InitGoogleTest(&argc, argv);